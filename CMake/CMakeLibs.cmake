@@ -216,7 +216,7 @@ endmacro(ADD_OSQUERY_LIBRARY_ADDITIONAL)
 macro(ADD_OSQUERY_LIBRARY IS_CORE TARGET)
   if(${IS_CORE} OR NOT OSQUERY_BUILD_SDK_ONLY)
     add_library(${TARGET} OBJECT ${ARGN})
-    add_dependencies(${TARGET} osquery_extensions)
+    add_dependencies(${TARGET} osquery_extensions osquery_table_columns)
     # TODO(#1985): For Windows, ignore the -static compiler flag
     if(WINDOWS)
       SET_OSQUERY_COMPILE(${TARGET} "${CXX_COMPILE_FLAGS} /EHsc")
@@ -247,7 +247,7 @@ endmacro(ADD_OSQUERY_OBJCXX_LIBRARY_ADDITIONAL)
 macro(ADD_OSQUERY_OBJCXX_LIBRARY IS_CORE TARGET)
   if(${IS_CORE} OR NOT OSQUERY_BUILD_SDK_ONLY)
     add_library(${TARGET} OBJECT ${ARGN})
-    add_dependencies(${TARGET} osquery_extensions)
+    add_dependencies(${TARGET} osquery_extensions osquery_table_columns)
     # TODO(#1985): For Windows, ignore the -static compiler flag
     if(WINDOWS)
       SET_OSQUERY_COMPILE(${TARGET} "${CXX_COMPILE_FLAGS} ${OBJCXX_COMPILE_FLAGS} /EHsc")
@@ -402,8 +402,36 @@ macro(GENERATE_TABLE TABLE_FILE FOREIGN NAME BASE_PATH OUTPUT)
   )
 
   list(APPEND ${OUTPUT} "${TABLE_FILE_GEN}")
+
+  # Generate the column indexes of tables implemented on this platform.
+  if(NOT "${NAME}" STREQUAL "foreign")
+    string(REGEX REPLACE
+      ".*/specs.*/(.*)\\.table"
+      "${CMAKE_BINARY_DIR}/generated/osquery/tables/columns/\\1.h"
+      TABLE_COLUMNS_GEN
+      ${TABLE_FILE}
+    )
+
+    add_custom_command(
+      OUTPUT "${TABLE_COLUMNS_GEN}"
+      COMMAND "${PYTHON_EXECUTABLE}"
+        "${BASE_PATH}/tools/codegen/gentable.py"
+        "--columns"
+        "${TABLE_FILE}"
+        "${TABLE_COLUMNS_GEN}"
+      DEPENDS ${TABLE_FILE} ${GENERATION_DEPENDENCIES}
+      WORKING_DIRECTORY "${CMAKE_SOURCE_DIR}"
+    )
+    set_property(GLOBAL APPEND PROPERTY TABLE_COLUMNS "${TABLE_COLUMNS_GEN}")
+  endif()
 endmacro(GENERATE_TABLE)
 
+# Generate the column headers before compiling any library.
+macro(GENERATE_TABLE_COLUMNS)
+  get_property(TABLE_COLUMNS GLOBAL PROPERTY TABLE_COLUMNS)
+  add_custom_target(osquery_table_columns DEPENDS ${TABLE_COLUMNS})
+endmacro(GENERATE_TABLE_COLUMNS)
+
 macro(AMALGAMATE BASE_PATH NAME OUTPUT)
   GET_GENERATION_DEPS(${BASE_PATH})
   if("${NAME}" STREQUAL "foreign")
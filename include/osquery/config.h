@@ -10,9 +10,11 @@
 
 #pragma once
 
+#include <deque>
 #include <list>
 #include <map>
 #include <memory>
+#include <set>
 #include <vector>
 
 #include <boost/iterator/filter_iterator.hpp>
@@ -33,6 +35,18 @@ class ConfigParserPlugin;
 /// The name of the executing query within the single-threaded schedule.
 extern const std::string kExecutingQuery;
 
+/// The number of recent executions kept for each query's percentiles.
+extern const size_t kQueryPerformanceSamples;
+
+/**
+ * @brief The nearest-rank percentile of a set of measurements.
+ *
+ * @param values the measurements, such as those of recent executions.
+ * @param percentile a percentile from 1 to 100.
+ * @return the smallest value at or above the percentile, 0 if none.
+ */
+uint64_t getPercentile(std::vector<uint64_t> values, size_t percentile);
+
 /**
  * @brief The programmatic representation of osquery's configuration
  *
@@ -73,17 +87,23 @@ class Config : private boost::noncopyable {
    * as the metrics are transient to the process running the schedule and apply
    * to the updates/changes reflected in the schedule, from the config.
    *
+   * The most recent executions are kept for percentiles of wall time, rows,
+   * and output size, and the cost of each scanned table is accumulated.
+   *
    * @param name The unique name of the scheduled item
-   * @param delay Number of seconds (wall time) taken by the query
    * @param size Number of characters generated by query
-   * @param r0 the process row before the query
-   * @param r1 the process row after the query
+   * @param r0 the resource usage sampled before the query
+   * @param r1 the resource usage sampled after the query
+   * @param rows Number of rows returned by the query
+   * @param tables The cost of each table the query scanned
    */
-  void recordQueryPerformance(const std::string& name,
-                              size_t delay,
-                              size_t size,
-                              const Row& r0,
-                              const Row& r1);
+  void recordQueryPerformance(
+      const std::string& name,
+      size_t size,
+      const ResourceUsage& r0,
+      const ResourceUsage& r1,
+      size_t rows = 0,
+      const std::map<std::string, TableCost>& tables = {});
 
   /**
    * @brief Record a query 'initialization', meaning the query will run.
@@ -98,6 +118,45 @@ class Config : private boost::noncopyable {
    */
   void recordQueryStart(const std::string& name);
 
+  /**
+   * @brief Record how late a scheduled query started executing.
+   *
+   * The scheduler steps once each second, a query is due when the step
+   * matches its splayed interval. Slow queries delay the steps, or delay
+   * queued queries when the schedule uses workers.
+   *
+   * @param name The unique name of the scheduled item
+   * @param drift Number of seconds between the due step and the start
+   */
+  void recordQueryDrift(const std::string& name, size_t drift);
+
+  /**
+   * @brief Record that a scheduled query's tables exceeded the result limits.
+   *
+   * @param name The unique name of the scheduled item
+   */
+  void recordQueryTruncated(const std::string& name);
+
+  /**
+   * @brief Skip a scheduled query for a number of seconds.
+   *
+   * The query is added to the schedule's saved blacklist, the same way
+   * queries are blacklisted when they did not complete before a restart.
+   *
+   * @param name The unique name of the scheduled item
+   * @param seconds Number of seconds before the query may execute again
+   */
+  void blacklistQuery(const std::string& name, size_t seconds);
+
+  /**
+   * @brief The name of the scheduled query executing on the calling thread.
+   *
+   * Several scheduled queries may execute concurrently. Tables that keep
+   * state for each scheduled query, such as event subscriber optimizations,
+   * use this name rather than the persisted executing query names.
+   */
+  static const std::string& getExecutingQuery();
+
   /**
    * @brief Calculate the hash of the osquery config
    *
@@ -213,6 +272,17 @@ class Config : private boost::noncopyable {
       const std::string& name,
       std::function<void(const QueryPerformance& query)> predicate);
 
+  /**
+   * @brief Record the cost of a schedule step.
+   *
+   * The config keeps the most recent steps, reported within the
+   * osquery_schedule_load table.
+   */
+  void recordScheduleLoad(const ScheduleLoad& load);
+
+  /// Iterate the recorded schedule steps, oldest first.
+  void scheduleLoad(std::function<void(const ScheduleLoad& load)> predicate);
+
   /**
    * @brief Helper to access config parsers via the registry
    *
@@ -231,8 +301,8 @@ class Config : private boost::noncopyable {
    * @brief Call the genConfig method of the config retriever plugin.
    *
    * This may perform a resource load such as TCP request or filesystem read.
-   * If a non-zero value is passed to --config_refresh, this starts a thread
-   * that periodically calls genConfig to reload config state
+   * If a non-zero value is passed to --config_refresh, this adds a dispatcher
+   * task that periodically calls genConfig to reload config state
    */
   Status refresh();
 
@@ -295,6 +365,18 @@ class Config : private boost::noncopyable {
    */
   void purge();
 
+  /**
+   * @brief Check if an update would not change the configuration.
+   *
+   * Each source's content hash is compared with its previous update. A source
+   * with packs generated by the config plugin is always considered changed,
+   * since the packs may change separately from the source content.
+   */
+  bool isUnchanged(const std::map<std::string, std::string>& config);
+
+  /// Copy the data of every config parser, to detect changes.
+  std::map<std::string, boost::property_tree::ptree> getParserData() const;
+
   /**
    * @brief Reset the configuration state, reserved for testing only.
    */
@@ -307,6 +389,12 @@ class Config : private boost::noncopyable {
   /// A set of performance stats for each query in the schedule.
   std::map<std::string, QueryPerformance> performance_;
 
+  /// The names of scheduled queries that have started but not completed.
+  std::set<std::string> executing_;
+
+  /// The cost of recent schedule steps.
+  std::deque<ScheduleLoad> schedule_load_;
+
   /// A set of named categories filled with filesystem globbing paths.
   using FileCategories = std::map<std::string, std::vector<std::string>>;
   std::map<std::string, FileCategories> files_;
@@ -321,8 +409,12 @@ class Config : private boost::noncopyable {
   /// or the initialization load step.
   bool loaded_{false};
 
+  /// The configuration is periodically refreshed by a dispatcher task.
   bool started_thread_{false};
 
+  /// The dispatcher task refreshing the configuration.
+  static size_t refreshTask();
+
   /// A UNIX timestamp recorded when the config started.
   size_t start_time_{0};
 
@@ -331,7 +423,6 @@ class Config : private boost::noncopyable {
 
  private:
   friend class ConfigTests;
-  friend class ConfigRefreshRunner;
   friend class FilePathsConfigParserPluginTests;
   friend class FileEventsTableTests;
   friend class DecoratorsConfigParserPluginTests;
@@ -527,13 +618,6 @@ class ConfigParserPlugin : public Plugin {
   friend class Config;
 };
 
-// A thread that periodically reloads configuration state
-class ConfigRefreshRunner : public InternalRunnable {
- public:
-  /// A simple wait/interruptible lock.
-  void start();
-};
-
 /**
  * @brief Boost's 1.59 property tree based JSON parser does not accept comments.
  *
@@ -11,10 +11,14 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
+#include <deque>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/registry.h>
@@ -22,6 +26,8 @@
 
 namespace osquery {
 
+class JSONWriter;
+
 /**
  * @brief A list of supported backing storage categories: called domains.
  *
@@ -59,6 +65,9 @@ extern const std::string kEvents;
  */
 extern const std::string kLogs;
 
+/// The "domain" where file hashes are cached, keyed by path.
+extern const std::string kHashes;
+
 /**
  * @brief A variant type for the SQLite type affinities.
  */
@@ -151,6 +160,19 @@ Status serializeQueryData(const QueryData& q,
                           const ColumnNames& cols,
                           boost::property_tree::ptree& tree);
 
+/**
+ * @brief Write a QueryData object as a JSON array in column order
+ *
+ * @param q the QueryData to serialize
+ * @param cols the TableColumn vector indicating column order
+ * @param writer the output JSON writer
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryData(const QueryData& q,
+                          const ColumnNames& cols,
+                          JSONWriter& writer);
+
 /**
  * @brief Serialize a QueryData object into a JSON string
  *
@@ -168,6 +190,49 @@ Status deserializeQueryData(const boost::property_tree::ptree& tree,
 /// Inverse of serializeQueryDataJSON, convert a JSON string to QueryData.
 Status deserializeQueryDataJSON(const std::string& json, QueryData& qd);
 
+/**
+ * @brief Serialize a QueryData object into a compact binary string
+ *
+ * The encoding starts with a format byte that never begins a JSON document,
+ * followed by a dictionary of column names, and length-prefixed values that
+ * refer to columns by their dictionary index. Lengths are LEB128 varints.
+ *
+ * @param q the QueryData to serialize
+ * @param data the output binary string
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryDataBinary(const QueryData& q, std::string& data);
+
+/// Inverse of serializeQueryDataBinary, convert a binary string to QueryData.
+Status deserializeQueryDataBinary(const std::string& data, QueryData& qd);
+
+/// Serialize a single Row using the serializeQueryDataBinary encoding.
+Status serializeRowBinary(const Row& r, std::string& data);
+
+/// Inverse of serializeRowBinary, convert a binary string to a Row.
+Status deserializeRowBinary(const std::string& data, Row& r);
+
+/// Check if content was created by serializeQueryDataBinary.
+bool isBinarySerialized(const std::string& data);
+
+/**
+ * @brief Serialize a QueryData object for storage in the backing store
+ *
+ * Stored results and events use the binary encoding unless the
+ * --database_format flag selects JSON.
+ */
+Status serializeQueryDataStored(const QueryData& q, std::string& data);
+
+/// Inverse of serializeQueryDataStored, accepts both binary and JSON.
+Status deserializeQueryDataStored(const std::string& data, QueryData& qd);
+
+/// Serialize a Row for storage in the backing store.
+Status serializeRowStored(const Row& r, std::string& data);
+
+/// Inverse of serializeRowStored, accepts both binary and JSON.
+Status deserializeRowStored(const std::string& data, Row& r);
+
 /**
  * @brief Data structure representing the difference between the results of
  * two queries
@@ -216,9 +281,27 @@ Status serializeDiffResults(const DiffResults& d,
  */
 Status serializeDiffResultsJSON(const DiffResults& d, std::string& json);
 
+/// A 64-bit hash of a Row's column names and values.
+using RowFingerprint = uint64_t;
+
+/**
+ * @brief Compute a stable fingerprint of a Row.
+ *
+ * Fingerprints are persisted in the backing store to differential scheduled
+ * query results, the value must not change across versions or platforms.
+ *
+ * @param r the Row to fingerprint
+ *
+ * @return the FNV-1a hash of each column name and value
+ */
+RowFingerprint getRowFingerprint(const Row& r);
+
 /**
  * @brief Diff two QueryData objects and create a DiffResults object
  *
+ * Rows are matched using a hash table of fingerprints, then compared exactly.
+ * Added rows are in the order of new_ and removed rows in the order of old_.
+ *
  * @param old_ the "old" set of results
  * @param new_ the "new" set of results
  *
@@ -258,6 +341,30 @@ bool addUniqueRowToQueryData(QueryData& q, const Row& r);
  */
 void escapeQueryData(const QueryData& oldData, QueryData& newData);
 
+/// The cost of generating a table's rows for the executions of a query.
+struct TableCost {
+  /// Number of times the table was filtered.
+  size_t filters{0};
+
+  /// Time spent in the table's generator in microseconds.
+  uint64_t generate_time{0};
+
+  /// Number of rows the table generated.
+  uint64_t rows{0};
+};
+
+/// The measurements of a single execution of a query.
+struct QueryExecution {
+  /// Wall time taken in microseconds.
+  uint64_t wall_time{0};
+
+  /// Number of rows returned.
+  uint64_t rows{0};
+
+  /// Characters, bytes, generated by the execution.
+  uint64_t output_size{0};
+};
+
 /**
  * @brief performance statistics about a query
  */
@@ -268,13 +375,13 @@ struct QueryPerformance {
   /// Last UNIX time in seconds the query was executed successfully.
   size_t last_executed;
 
-  /// Total wall time taken
+  /// Total wall time taken in microseconds
   unsigned long long int wall_time;
 
-  /// Total user time (cycles)
+  /// Total user time of the executing thread in microseconds
   unsigned long long int user_time;
 
-  /// Total system time (cycles)
+  /// Total system time of the executing thread in microseconds
   unsigned long long int system_time;
 
   /// Average memory differentials. This should be near 0.
@@ -283,6 +390,21 @@ struct QueryPerformance {
   /// Total characters, bytes, generated by query.
   unsigned long long int output_size;
 
+  /// Total seconds executions started after they were due.
+  unsigned long long int drift;
+
+  /// Total rows returned by the query.
+  unsigned long long int rows;
+
+  /// Number of executions whose results exceeded the result limits.
+  size_t truncated;
+
+  /// The most recent executions, oldest first.
+  std::deque<QueryExecution> recent;
+
+  /// The total cost of each table the query's executions scanned.
+  std::map<std::string, TableCost> tables;
+
   QueryPerformance()
       : executions(0),
         last_executed(0),
@@ -290,7 +412,48 @@ struct QueryPerformance {
         user_time(0),
         system_time(0),
         average_memory(0),
-        output_size(0) {}
+        output_size(0),
+        drift(0),
+        rows(0),
+        truncated(0) {}
+};
+
+/// The queries executed and deferred by a single step of the schedule.
+struct ScheduleLoad {
+  /// The schedule step, a UNIX time in seconds.
+  size_t step{0};
+
+  /// Number of queries that became due at this step.
+  size_t due{0};
+
+  /// Number of queries executed or dispatched to workers.
+  size_t executed{0};
+
+  /// Number of queries waiting for a later step.
+  size_t deferred{0};
+
+  /// Estimated CPU time of the executed queries in microseconds.
+  uint64_t cost{0};
+};
+
+/**
+ * @brief CPU and memory use sampled before and after a unit of work.
+ *
+ * The schedule monitor samples the executing thread around each query and
+ * records the differences in the query's QueryPerformance.
+ */
+struct ResourceUsage {
+  /// Monotonic wall time in microseconds.
+  uint64_t wall_time{0};
+
+  /// User CPU time of the calling thread in microseconds.
+  uint64_t user_time{0};
+
+  /// System CPU time of the calling thread in microseconds.
+  uint64_t system_time{0};
+
+  /// Resident memory of the process in bytes.
+  uint64_t resident_size{0};
 };
 
 /**
@@ -312,7 +475,13 @@ struct ScheduledQuery {
   /// Set of query options.
   std::map<std::string, bool> options;
 
-  ScheduledQuery() : interval(0), splayed_interval(0) {}
+  /// Seconds before the query is interrupted, 0 uses the default timeout.
+  size_t timeout;
+
+  /// The priority class of the query's result logs, empty if normal.
+  std::string priority;
+
+  ScheduledQuery() : interval(0), splayed_interval(0), timeout(0) {}
 
   /// equals operator
   bool operator==(const ScheduledQuery& comp) const {
@@ -339,6 +508,12 @@ struct QueryLogItem {
   /// Optional snapshot results, no differential applied.
   QueryData snapshot_results;
 
+  /// The snapshot matched the last logged snapshot, only a marker is logged.
+  bool snapshot_unchanged{false};
+
+  /// The fingerprint of an unchanged snapshot's results.
+  std::string snapshot_fingerprint;
+
   /// The name of the scheduled query.
   std::string name;
 
@@ -354,6 +529,14 @@ struct QueryLogItem {
   /// A set of additional fields to emit with the log line.
   std::map<std::string, std::string> decorations;
 
+  /**
+   * @brief Decorations serialized as JSON object members, or nullptr.
+   *
+   * Log items of the schedule share the serialized decorations rather than
+   * copying them, these are emitted after QueryLogItem::decorations.
+   */
+  std::shared_ptr<const std::string> decorations_json;
+
   /// equals operator
   bool operator==(const QueryLogItem& comp) const {
     return (comp.results == results) && (comp.name == name);
@@ -386,6 +569,52 @@ Status serializeQueryLogItem(const QueryLogItem& item,
  */
 Status serializeQueryLogItemJSON(const QueryLogItem& item, std::string& json);
 
+/**
+ * @brief Serialize a snapshot QueryLogItem into JSON as its rows are produced.
+ *
+ * The output matches serializeQueryLogItemJSON for the item with the rows
+ * as its snapshot_results, but the rows are not kept.
+ */
+class SnapshotLogItemWriter : private boost::noncopyable {
+ public:
+  /**
+   * @brief Start a line for the item, its snapshot_results are not used.
+   *
+   * @param item the QueryLogItem to serialize, kept until finish
+   * @param json the output JSON string
+   */
+  SnapshotLogItemWriter(const QueryLogItem& item, std::string& json);
+  ~SnapshotLogItemWriter();
+
+  /// Append a row to the snapshot's results.
+  void addRow(const Row& row);
+
+  /// The number of rows appended.
+  size_t rows() const {
+    return rows_;
+  }
+
+  /**
+   * @brief Close the line, the output then ends with a newline.
+   *
+   * @param fields additional fields written after the item's fields
+   */
+  void finish(const std::map<std::string, std::string>& fields = {});
+
+ private:
+  /// The item's metadata and decorations.
+  const QueryLogItem& item_;
+
+  /// The output line.
+  std::string& json_;
+
+  /// The writer of the output line.
+  std::unique_ptr<JSONWriter> writer_;
+
+  /// The number of rows appended.
+  size_t rows_{0};
+};
+
 /// Inverse of serializeQueryLogItem, convert property tree to QueryLogItem.
 Status deserializeQueryLogItem(const boost::property_tree::ptree& tree,
                                QueryLogItem& item);
@@ -417,6 +646,9 @@ Status serializeQueryLogItemAsEvents(const QueryLogItem& item,
 Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
                                          std::vector<std::string>& items);
 
+/// Ordered keys and values returned by a database range scan.
+using DatabaseKeyValues = std::vector<std::pair<std::string, std::string>>;
+
 /**
  * @brief An osquery backing storage (database) type that persists executions.
  *
@@ -464,9 +696,33 @@ class DatabasePlugin : public Plugin {
                      const std::string& key,
                      const std::string& value) = 0;
 
+  /**
+   * @brief Store several values in a domain using a single write.
+   *
+   * The default implementation puts each value, plugins with batched writes
+   * apply every value together. Later duplicate keys win.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param data The keys and values to store.
+   */
+  virtual Status putBatch(const std::string& domain,
+                          const DatabaseKeyValues& data);
+
   /// Data removal method.
   virtual Status remove(const std::string& domain, const std::string& k) = 0;
 
+  /**
+   * @brief Remove several keys from a domain using a single write.
+   *
+   * The default implementation removes each key, plugins with batched writes
+   * remove every key together.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param keys The keys to remove.
+   */
+  virtual Status removeBatch(const std::string& domain,
+                             const std::vector<std::string>& keys);
+
   virtual Status scan(const std::string& domain,
                       std::vector<std::string>& results,
                       const std::string& prefix,
@@ -474,6 +730,55 @@ class DatabasePlugin : public Plugin {
     return Status(0, "Not used");
   }
 
+  /**
+   * @brief Scan the keys and values within a range of ordered keys.
+   *
+   * Keys are compared bytewise. The default implementation filters a scan of
+   * every key in the domain, plugins with ordered storage seek to the range.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param begin The inclusive first key of the range.
+   * @param end The exclusive end of the range, empty for no upper bound.
+   * @param results The output keys and values, in key order.
+   * @param max An optional maximum number of results.
+   * @param reverse Return the keys in descending order, the maximum number
+   *   of results are taken from the end of the range.
+   */
+  virtual Status scanRange(const std::string& domain,
+                           const std::string& begin,
+                           const std::string& end,
+                           DatabaseKeyValues& results,
+                           size_t max = 0,
+                           bool reverse = false) const;
+
+  /// Remove every key within the range [begin, end).
+  virtual Status removeRange(const std::string& domain,
+                             const std::string& begin,
+                             const std::string& end);
+
+  /**
+   * @brief Report storage statistics for each domain.
+   *
+   * Each row includes the "domain" and any statistics the plugin measures,
+   * such as on-disk "size" and "memtable_bytes". The default reports none.
+   *
+   * @param response The output rows, one for each domain.
+   */
+  virtual Status stats(PluginResponse& response) const {
+    return Status(0, "Not used");
+  }
+
+  /**
+   * @brief Release memory held by in-memory buffers, keeping open handles.
+   *
+   * A plugin may write buffered data to storage, such as RocksDB memtables,
+   * so their memory is returned while read caches stay warm. The default
+   * releases nothing.
+   */
+  virtual Status releaseMemory() {
+    return Status(0, "Not used");
+  }
+
   /**
    * @brief Shutdown the database and release initialization resources.
    *
@@ -575,9 +880,26 @@ Status setDatabaseValue(const std::string& domain,
                         const std::string& key,
                         const std::string& value);
 
+/**
+ * @brief Put several values into the active DatabasePlugin with one write.
+ *
+ * Callers that write many keys at once, such as event subscribers, should
+ * prefer a batch to a setDatabaseValue for each key.
+ *
+ * @param domain A string value representing abstract storage indexing.
+ * @param data The keys and values to store.
+ * @return Storage operation status.
+ */
+Status setDatabaseBatch(const std::string& domain,
+                        const DatabaseKeyValues& data);
+
 /// Remove a domain/key identified value from backing-store.
 Status deleteDatabaseValue(const std::string& domain, const std::string& key);
 
+/// Remove the values for several keys from the backing-store with one write.
+Status deleteDatabaseBatch(const std::string& domain,
+                           const std::vector<std::string>& keys);
+
 /// Get a list of keys for a given domain.
 Status scanDatabaseKeys(const std::string& domain,
                         std::vector<std::string>& keys,
@@ -589,6 +911,55 @@ Status scanDatabaseKeys(const std::string& domain,
                         const std::string& prefix,
                         size_t max = 0);
 
+/**
+ * @brief Get the keys and values within a range of the domain's ordered keys.
+ *
+ * @param domain A string value representing abstract storage indexing.
+ * @param begin The inclusive first key of the range.
+ * @param end The exclusive end of the range, empty for no upper bound.
+ * @param results The output keys and values, in key order.
+ * @param max An optional maximum number of results.
+ * @param reverse Return the keys in descending order, from the end.
+ * @return Storage operation status.
+ */
+Status scanDatabaseRange(const std::string& domain,
+                         const std::string& begin,
+                         const std::string& end,
+                         DatabaseKeyValues& results,
+                         size_t max = 0,
+                         bool reverse = false);
+
+/**
+ * @brief Get the keys and values beginning with a prefix, in key order.
+ *
+ * This is a range scan bounded by the prefix, callers needing values avoid
+ * a get for each key returned by scanDatabaseKeys.
+ *
+ * @param domain A string value representing abstract storage indexing.
+ * @param prefix The prefix of every returned key.
+ * @param results The output keys and values, in key order.
+ * @param max An optional maximum number of results.
+ * @return Storage operation status.
+ */
+Status scanDatabasePrefix(const std::string& domain,
+                          const std::string& prefix,
+                          DatabaseKeyValues& results,
+                          size_t max = 0);
+
+/// The first key ordered after every key beginning with prefix, or empty.
+std::string getDatabasePrefixEnd(const std::string& prefix);
+
+/// Remove the values for every key within the range [begin, end).
+Status deleteDatabaseRange(const std::string& domain,
+                           const std::string& begin,
+                           const std::string& end);
+
+/// Get the active database plugin's statistics for each domain.
+Status getDatabaseStats(PluginResponse& stats);
+
+/// Release the active database plugin's buffers, see releaseMemory.
+Status releaseDatabaseMemory();
+
 /// Allow callers to reload or reset the database plugin.
 void resetDatabase();
 
@@ -13,6 +13,7 @@
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <memory>
 #include <thread>
 #include <vector>
@@ -159,6 +160,16 @@ class InternalRunnable : private boost::noncopyable,
 using InternalRunnableRef = std::shared_ptr<InternalRunnable>;
 using InternalThreadRef = std::shared_ptr<std::thread>;
 
+/**
+ * @brief A short-lived task executed by the Dispatcher's thread pool.
+ *
+ * The task returns the milliseconds until it should execute again, which
+ * makes it a timer, or 0 if it is complete.
+ */
+using DispatcherTask = std::function<size_t()>;
+
+class DispatcherExecutor;
+
 /**
  * @brief Singleton for queuing asynchronous tasks to be executed in parallel
  *
@@ -189,11 +200,27 @@ class Dispatcher : private boost::noncopyable {
   /// Destroy and stop all osquery service threads and service objects.
   static void stopServices();
 
+  /**
+   * @brief Execute a short-lived task in the Dispatcher's thread pool.
+   *
+   * Periodic work such as configuration refreshes shares `--worker_threads`
+   * threads, rather than each requiring a dedicated service thread. Idle
+   * threads steal queued tasks from busy threads. A task should not block,
+   * a long-running loop belongs in a service.
+   *
+   * @param task The task, it may return a delay to execute again.
+   * @param delay Milliseconds before the first execution.
+   */
+  static Status addTask(DispatcherTask task, size_t delay = 0);
+
   /// Return number of services.
   size_t serviceCount() {
     return services_.size();
   }
 
+  /// Return the number of queued and delayed tasks.
+  size_t taskCount() const;
+
  private:
   /**
    * @brief Default constructor.
@@ -221,6 +248,9 @@ class Dispatcher : private boost::noncopyable {
   /// The set of shared osquery services.
   std::vector<InternalRunnableRef> services_;
 
+  /// The thread pool executing tasks, started with the first task.
+  std::shared_ptr<DispatcherExecutor> executor_;
+
   // Protection around service access.
   mutable Mutex mutex_;
 
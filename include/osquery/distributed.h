@@ -10,6 +10,9 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -29,6 +32,9 @@ struct DistributedQueryRequest {
 
   std::string query;
   std::string id;
+
+  /// Seconds a cached result of the same query may be used instead.
+  size_t max_age{0};
 };
 
 /**
@@ -91,6 +97,12 @@ struct DistributedQueryResult {
   QueryData results;
   ColumnNames columns;
   Status status;
+
+  /// The number of rows sent in earlier result chunks.
+  size_t sent{0};
+
+  /// The sequence number of the next result chunk.
+  size_t sequence{0};
 };
 
 /**
@@ -191,6 +203,17 @@ class DistributedPlugin : public Plugin {
    */
   virtual Status writeResults(const std::string& json) = 0;
 
+  /**
+   * @brief Check if getQueries waits on the server for new queries.
+   *
+   * A long-polling plugin returns once queries are available or its wait
+   * expired, so the distributed service polls again without sleeping for
+   * `--distributed_interval` seconds.
+   */
+  virtual bool isLongPolling() const {
+    return false;
+  }
+
   /// Main entrypoint for distirbuted plugin requests
   Status call(const PluginRequest& request, PluginResponse& response) override;
 };
@@ -201,7 +224,7 @@ class DistributedPlugin : public Plugin {
  * Consider the following workflow example, without any error handling
  *
  * @code{.cpp}
- *   auto dist = Distributed();
+ *   Distributed dist;
  *   while (true) {
  *     dist.pullUpdates();
  *     if (dist.getPendingQueryCount() > 0) {
@@ -218,6 +241,11 @@ class Distributed {
   /// Retrieve queued queries from a remote server
   Status pullUpdates();
 
+  /// True if the last retrieval long-polled and returned without an error.
+  bool isLongPolling() const {
+    return long_poll_;
+  }
+
   /// Get the number of queries which are waiting to be executed
   size_t getPendingQueryCount();
 
@@ -227,9 +255,20 @@ class Distributed {
   /// Serialize result data into a JSON string and clear the results
   Status serializeResults(std::string& json);
 
-  /// Process and execute queued queries
+  /**
+   * @brief Process and execute queued queries
+   *
+   * Queries execute concurrently on up to `--distributed_workers` threads,
+   * each using its own database connection. Results are flushed as queries
+   * complete, so a slow query does not delay the results of the rest of the
+   * batch. A query running longer than `--distributed_timeout` is interrupted
+   * and reported with a failed status.
+   */
   Status runQueries();
 
+  /// Interrupt running queries and stop executing queued queries.
+  void stop();
+
  protected:
   /**
    * @brief Process several queries from a distributed plugin
@@ -252,20 +291,53 @@ class Distributed {
   /**
    * @brief Queue a result to be batch sent to the server
    *
+   * Workers wait here while the queued results use their memory share,
+   * until flushes send earlier results or the queries are stopped.
+   *
    * @param result is a DistributedQueryResult object to be sent to the server
    */
-  void addResult(const DistributedQueryResult& result);
+  void addResult(DistributedQueryResult&& result);
 
   /**
    * @brief Flush all of the collected results to the server
+   *
+   * With `--distributed_chunk_bytes` results are sent in requests of about
+   * that size. Each query's rows carry a chunk sequence number, and a failed
+   * request is retried from its chunk rather than from the first one.
    */
   Status flushCompleted();
 
+  /**
+   * @brief Execute a request, interrupting it at the query deadline
+   *
+   * @param request is the query and ID to execute
+   * @return a DistributedQueryResult with the rows or a failed status
+   */
+  DistributedQueryResult runRequest(const DistributedQueryRequest& request);
+
  protected:
   std::vector<DistributedQueryResult> results_;
 
+  /// Protect the results from concurrently completing queries.
+  std::mutex results_mutex_;
+
+  /// Signaled when flushed results free space for completing queries.
+  std::condition_variable results_flushed_;
+
+  /// The estimated size of the results waiting to be sent.
+  size_t results_bytes_{0};
+
+  /// Set when running queries should be interrupted.
+  std::atomic<bool> stopped_{false};
+
+  /// Set if the plugin long-polled for the last retrieved queries.
+  bool long_poll_{false};
+
  private:
   friend class DistributedTests;
   FRIEND_TEST(DistributedTests, test_workflow);
+  FRIEND_TEST(DistributedTests, test_concurrent_timeout);
+  FRIEND_TEST(DistributedTests, test_chunked_results);
+  FRIEND_TEST(DistributedTests, test_cached_results);
 };
 }
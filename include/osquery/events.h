@@ -11,6 +11,7 @@
 #pragma once
 
 #include <atomic>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
@@ -19,6 +20,7 @@
 #include <vector>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/dispatcher.h>
 #include <osquery/registry.h>
 #include <osquery/status.h>
@@ -32,13 +34,14 @@ class EventPublisher;
 template <class PUB>
 class EventSubscriber;
 class EventFactory;
+class EventSubscriberQueue;
+class EventExpirationService;
 
 using EventPublisherID = const std::string;
 using EventSubscriberID = const std::string;
 using EventID = const std::string;
 using EventContextID = uint64_t;
 using EventTime = uint64_t;
-using EventRecord = std::pair<EventID, EventTime>;
 
 /**
  * @brief An EventPublisher will define a SubscriptionContext for
@@ -111,6 +114,54 @@ using EventCallback = std::function<Status(const EventContextRef&,
 /// An EventPublisher must track every subscription added.
 using SubscriptionVector = std::vector<SubscriptionRef>;
 
+/// A Subscription and the EventSubscriber it resolved to, if registered.
+using SubscriptionTarget = std::pair<SubscriptionRef, EventSubscriberRef>;
+
+/**
+ * @brief A publisher's Subscription%s compiled to select those an event fires.
+ *
+ * Publishers with many Subscription%s may compile them, for example into a
+ * prefix tree of paths or sets of actions, so each fired event is matched
+ * against every Subscription in one pass. The selected Subscription%s are
+ * still checked with `shouldFire`.
+ */
+class SubscriptionMatcher {
+ public:
+  virtual ~SubscriptionMatcher() {}
+
+  /**
+   * @brief Select the Subscription%s an event may fire.
+   *
+   * @param ec The fired event.
+   * @param targets (output) Sorted indexes of the compiled Subscription%s.
+   */
+  virtual void match(const EventContextRef& ec,
+                     std::vector<size_t>& targets) const = 0;
+};
+
+using SubscriptionMatcherRef = std::shared_ptr<const SubscriptionMatcher>;
+
+/**
+ * @brief An immutable copy of a publisher's Subscription%s used to fire.
+ *
+ * Publishers replace the snapshot when Subscription%s change, or when the
+ * EventFactory registers subscribers, so events fan out without locks or
+ * subscriber lookups.
+ */
+struct SubscriptionSnapshot {
+  /// The EventFactory subscriber generation used to resolve targets.
+  size_t generation{0};
+
+  /// The publisher's subscriptions version that was copied.
+  size_t version{0};
+
+  /// Each Subscription with its EventSubscriber.
+  std::vector<SubscriptionTarget> targets;
+
+  /// The publisher's compiled targets, if it compiles Subscription%s.
+  SubscriptionMatcherRef matcher{nullptr};
+};
+
 /// The set of search-time binned lookup tables.
 extern const std::vector<size_t> kEventTimeLists;
 
@@ -249,6 +300,17 @@ class EventPublisherPlugin : public Plugin,
     return Status(1, "No run loop required");
   }
 
+  /**
+   * @brief Handle input recorded with `--events_capture` as if it was read.
+   *
+   * A publisher that captures its raw input passes each record to
+   * EventCapture::record, and parses the same data here without reading
+   * from the kernel. The run loop is not started while replaying.
+   */
+  virtual Status replay(const std::string& data) {
+    return Status(1, "Replay is not supported");
+  }
+
   /**
    * @brief Allow the EventFactory to interrupt the run loop.
    *
@@ -327,6 +389,16 @@ class EventPublisherPlugin : public Plugin,
     return restart_count_;
   }
 
+  /// Get the number of events merged into another event before firing.
+  size_t numCoalesced() const {
+    return coalesced_count_;
+  }
+
+  /// Get the number of events the publisher's source reported as dropped.
+  size_t numDropped() const {
+    return dropped_count_;
+  }
+
  public:
   explicit EventPublisherPlugin(EventPublisherPlugin const&) = delete;
   EventPublisherPlugin& operator=(EventPublisherPlugin const&) = delete;
@@ -347,13 +419,42 @@ class EventPublisherPlugin : public Plugin,
   virtual void fireCallback(const SubscriptionRef& sub,
                             const EventContextRef& ec) const = 0;
 
+  /**
+   * @brief Compile Subscription%s to match fired events in one pass.
+   *
+   * This is called when the subscriptions change, and again if the
+   * publisher increments subscriptions_version_ after configure changes
+   * their contexts. Without a matcher every Subscription is checked.
+   *
+   * @param subscriptions The Subscription%s in the order of their indexes.
+   */
+  virtual SubscriptionMatcherRef compileSubscriptions(
+      const SubscriptionVector& subscriptions) const {
+    return nullptr;
+  }
+
+  /// Get the current snapshot of subscriptions, creating one when stale.
+  std::shared_ptr<const SubscriptionSnapshot> getSnapshot();
+
+  /// Call a Subscription%'s callback, or queue it for the subscriber.
+  void fireTarget(const SubscriptionTarget& target, const EventContextRef& ec);
+
   /// The EventPublisher will keep track of Subscription%s that contain callins.
   SubscriptionVector subscriptions_;
 
+  /// Incremented when subscriptions_ changes, to replace the fire snapshot.
+  std::atomic<size_t> subscriptions_version_{0};
+
   /// An Event ID is assigned by the EventPublisher within the EventContext.
   /// This is not used to store event date in the backing store.
   std::atomic<EventContextID> next_ec_id_{0};
 
+  /// Publishers that coalesce event bursts count each merged event.
+  std::atomic<size_t> coalesced_count_{0};
+
+  /// Publishers reading a bounded source, such as a kernel queue, count drops.
+  std::atomic<size_t> dropped_count_{0};
+
  private:
   /// Set ending to True to cause event type run loops to finish.
   std::atomic<bool> ending_{false};
@@ -361,12 +462,12 @@ class EventPublisherPlugin : public Plugin,
   /// Set to indicate whether the event run loop ever started.
   std::atomic<bool> started_{false};
 
-  /// A lock for incrementing the next EventContextID.
-  Mutex ec_id_lock_;
-
   /// A lock for subscription manipulation.
   Mutex subscription_lock_;
 
+  /// Copy-on-write snapshot of subscriptions_, read atomically by fire.
+  std::shared_ptr<const SubscriptionSnapshot> snapshot_;
+
   /// A helper count of event publisher runloop iterations.
   std::atomic<size_t> restart_count_{0};
 
@@ -377,6 +478,9 @@ class EventPublisherPlugin : public Plugin,
  private:
   FRIEND_TEST(EventsTests, test_event_publisher);
   FRIEND_TEST(EventsTests, test_fire_event);
+  FRIEND_TEST(EventsTests, test_fire_snapshot);
+  FRIEND_TEST(EventsTests, test_dispatch_queue);
+  FRIEND_TEST(EventsTests, test_dispatch_queue_threads);
 };
 
 class EventSubscriberPlugin : public Plugin, public Eventer {
@@ -427,23 +531,45 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
   virtual QueryData get(EventTime start, EventTime stop) final;
 
  private:
-  /// Overload add for tests and allow them to override the event time.
-  virtual Status add(Row& r, EventTime event_time) final;
-
- private:
-  /*
-   * @brief When `get`ing event results, return EventID%s from time indexes.
+  /**
+   * @brief A consumer's position within this subscriber's events.
    *
-   * Used by EventSubscriber::get to retrieve EventID, EventTime indexes. This
-   * applies the lookup-efficiency checks for time list appropriate bins.
-   * If the time range in 24 hours and there is a 24-hour list bin it will
-   * be queried using a single backing store `Get` followed by two `Get`s of
-   * the most-specific boundary lists.
+   * Each scheduled query selecting from the subscriber keeps a cursor, so
+   * every query receives each event once regardless of other queries.
+   */
+  struct EventCursor {
+    /// The time of the consumer's previous select.
+    EventTime time{0};
+
+    /// The greatest EventID the consumer has received.
+    size_t eid{0};
+  };
+
+  /// Read a consumer's cursor from the backing store.
+  EventCursor getCursor(const std::string& consumer) const;
+
+  /// Write a consumer's cursor to the backing store.
+  void setCursor(const std::string& consumer, const EventCursor& cursor) const;
+
+  /**
+   * @brief Return the events within start, stop after a consumer's cursor.
    *
-   * @return List of EventID, EventTime%s
+   * @param cursor Optional cursor, events at or before its EventID are
+   * skipped and it is advanced to the last event returned.
+   * @param descending Return the newest events first.
+   * @param limit Optionally stop after this many events, if there is no
+   * cursor.
    */
-  std::vector<EventRecord> getRecords(const std::vector<std::string>& indexes);
+  QueryData getEvents(EventTime start,
+                      EventTime stop,
+                      EventCursor* cursor,
+                      bool descending = false,
+                      size_t limit = 0);
+
+  /// Overload add for tests and allow them to override the event time.
+  virtual Status add(Row& r, EventTime event_time) final;
 
+ private:
   /**
    * @brief Get a unique storage-related EventID.
    *
@@ -455,64 +581,89 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
    * indexing is required within-EventCallback consider an
    * EventSubscriber%-unique indexing, counting mechanic.
    *
+   * EventIDs are reserved from the backing store in blocks, so most calls
+   * do not access the backing store. IDs left in a block when the process
+   * exits are skipped.
+   *
    * @return A unique ID for backing storage.
    */
   EventID getEventID();
 
   /**
-   * @brief Plan the best set of indexes for event record access.
+   * @brief Write the staged events to the backing store as a single batch.
+   *
+   * Events are staged by add until `events_batch_size` events are waiting or
+   * the oldest staged event was added over a second before. Selecting,
+   * expiring, and tearing down events first flushes the staged events.
+   * A streaming subscriber logs its waiting events instead.
+   */
+  Status flushEvents();
+
+  /**
+   * @brief Deliver this subscriber's events from a dedicated thread.
    *
-   * @param start an inclusive time to begin searching.
-   * @param stop an inclusive time to end searching.
+   * Subscribers named in `events_dispatch_async` receive EventCallback%s
+   * from a bounded queue, so slow callbacks do not stall publisher threads.
+   * When the queue is full events are dropped, or if blocking is requested
+   * the publisher waits for space.
    *
-   * @return List of 'index.step' index strings.
+   * @param max_depth The maximum number of queued events, 0 for no limit.
+   * @param block Wait for space rather than dropping events.
+   * @param threads The number of threads delivering queued events.
    */
-  std::vector<std::string> getIndexes(EventTime start, EventTime stop);
+  void startDispatchQueue(size_t max_depth, bool block, size_t threads = 1);
+
+  /// Deliver the queued events then stop the dispatch thread.
+  void stopDispatchQueue();
+
+  /// Queue a callback, returns false if the callback should run inline.
+  bool dispatch(std::function<void()> callback);
 
   /**
-   * @brief Expire indexes and eventually records.
+   * @brief The key prefix of this subscriber's events.
    *
-   * @param list_type the string representation of list binning type.
-   * @param indexes complete set of 'index.step' indexes for the list_type.
-   * @param expirations of the indexes, the set to expire.
+   * Each event is stored at "event.<namespace>.<time>.<eid>" where the time
+   * and EventID are fixed-width hex, so keys sort by time then EventID. A
+   * time range of events is a single backing store range scan.
    */
-  void expireIndexes(const std::string& list_type,
-                     const std::vector<std::string>& indexes,
-                     const std::vector<std::string>& expirations);
+  std::string getEventPrefix() const;
 
-  /// Expire all datums within a bin.
-  void expireRecords(const std::string& list_type,
-                     const std::string& index,
-                     bool all);
+  /// The time-ordered backing store key for an event.
+  std::string getEventKey(EventTime time, size_t eid) const;
 
   /**
-   * @brief Inspect the number of events, expire those overflowing events_max.
+   * @brief Remove a bounded batch of the oldest expired events.
    *
-   * When the event manager starts, or after a checkpoint number of events,
-   * the EventFactory will call expireCheck for each subscriber.
+   * Events at or before expire_time_, and the oldest events beyond
+   * `events_max`, are a prefix of the subscriber's keys. At most batch keys
+   * are inspected and the expired are removed with one range removal.
    *
-   * The subscriber must count the number of buffered records and check if
-   * that count exceeds the configured `events_max` limit. If an overflow
-   * occurs the subscriber will expire N-events_max from the end of the queue.
+   * @param batch The most events to remove, 0 for no limit.
+   * @return The number of removed events.
+   */
+  size_t expireEvents(size_t batch);
+
+  /**
+   * @brief Move events stored in per-minute index bins to time-ordered keys.
    *
-   * @param cleanup Perform an intense scan of zombie event IDs.
+   * Earlier versions kept comma-joined "eid:time" records for each minute and
+   * a list of bins, this moves the data of every recorded event.
    */
-  void expireCheck(bool cleanup = false);
+  void migrateEvents();
 
   /**
-   * @brief Add an EventID, EventTime pair to all matching list types.
+   * @brief Expire the events overflowing events_max.
    *
-   * The list types are defined by time size. Based on the EventTime this pair
-   * is added to the list bin for each list type. If there are two list types:
-   * 60 seconds and 3600 seconds and `time` is 92, this pair will be added to
-   * list type 1 bin 4 and list type 2 bin 1.
+   * When the event manager starts the EventFactory will call expireCheck for
+   * each subscriber, which counts the stored events once. The count is then
+   * kept as events are written and removed.
    *
-   * @param eid A unique EventID.
-   * @param time The time when this EventID%'s event occurred.
+   * Without the background expiration service, a checkpoint number of events
+   * also calls expireCheck and the overflow is removed inline.
    *
-   * @return Were the indexes recorded.
+   * @param cleanup Migrate events stored by earlier versions and count them.
    */
-  Status recordEvent(EventID& eid, EventTime time);
+  void expireCheck(bool cleanup = false);
 
   /**
    * @brief Get the expiration timeout for this event type
@@ -545,9 +696,8 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
    * EventPublisher instances will have run `setUp` and initialized their run
    * loops.
    */
-  EventSubscriberPlugin()
-      : expire_events_(true), expire_time_(0), optimize_time_(0) {}
-  virtual ~EventSubscriberPlugin() {}
+  EventSubscriberPlugin() : expire_events_(true), expire_time_(0) {}
+  virtual ~EventSubscriberPlugin();
 
   /**
    * @brief Suggested entrypoint for table generation.
@@ -570,6 +720,30 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
     return event_count_;
   }
 
+  /// The number of events waiting in this EventSubscriber%'s dispatch queue.
+  size_t queueDepth() const;
+
+  /// The number of events dropped because the dispatch queue was full.
+  size_t queueDrops() const;
+
+  /// The number of events dropped by this subscriber's rate limit.
+  size_t rateLimited() const {
+    return rate_limited_;
+  }
+
+  /// The number of events not kept by this subscriber's sampling.
+  size_t sampledOut() const {
+    return sampled_out_;
+  }
+
+  /// The number of events removed by expiration since osquery started.
+  size_t expiredEvents() const {
+    return expired_events_;
+  }
+
+  /// The number of stored events beyond events_max waiting to be removed.
+  size_t pendingExpiration();
+
  private:
   explicit EventSubscriberPlugin(EventSubscriberPlugin const&) = delete;
   EventSubscriberPlugin& operator=(EventSubscriberPlugin const&) = delete;
@@ -593,6 +767,33 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
     expire_events_ = false;
   }
 
+  /**
+   * @brief The number of threads delivering events from a dispatch queue.
+   *
+   * With more than one thread the EventCallback%s run concurrently and must
+   * be thread safe. Events may be added out of order.
+   */
+  virtual size_t dispatchThreads() const {
+    return 1;
+  }
+
+  /**
+   * @brief The columns identifying an event for deterministic sampling.
+   *
+   * Events with the same sample key are either all kept or all sampled out.
+   * The default uses every column except the event and uptime times.
+   */
+  virtual Row getSampleKey(const Row& r) const;
+
+  /**
+   * @brief Fill in the derived columns of selected events.
+   *
+   * Most stored events expire before they are selected. Columns that are
+   * expensive to compute, and can be derived from the stored columns, may be
+   * computed here instead of before the event is added.
+   */
+  virtual void enrichEvents(QueryData& results) const {}
+
   /// Trampoline into the EventFactory and lookup the name of the publisher.
   virtual EventPublisherID& getType() const = 0;
 
@@ -604,7 +805,7 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
 
  protected:
   /// A helper value counting the number of fired events tracked by publishers.
-  EventContextID event_count_{0};
+  std::atomic<EventContextID> event_count_{0};
 
   /// A helper value counting the number of subscriptions created.
   size_t subscription_count_{0};
@@ -624,42 +825,106 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
   /// Cached value of last generated EventID.
   size_t last_eid_{0};
 
-  /**
-   * @brief Optimize subscriber selects by tracking the last select time.
-   *
-   * Event subscribers may optimize selects when used in a daemon schedule by
-   * requiring an event 'time' constraint and otherwise applying a minimum time
-   * as the last time the scheduled query ran.
-   */
-  EventTime optimize_time_{0};
-
-  /**
-   * @brief Last event ID returned while using events-optimization.
-   *
-   * A time with second precision is not sufficient, but it works for index
-   * retrieval. While sorting using the time optimization, discard events
-   * before or equal to the optimization ID.
-   */
-  size_t optimize_eid_{0};
+  /// The last EventID of the block reserved in the backing store.
+  size_t reserved_eid_{0};
 
   /// Lock used when incrementing the EventID database index.
   Mutex event_id_lock_;
 
-  /// Lock used when recording an EventID and time into search bins.
-  Mutex event_record_lock_;
+  /// Serialized events and their keys waiting for a batched write.
+  DatabaseKeyValues staged_events_;
+
+  /// The time the oldest staged event was added.
+  EventTime staged_time_{0};
+
+  /// Lock protecting the staged events.
+  Mutex staged_events_lock_;
+
+  /// Queue an event for the logger and the in-memory ring.
+  Status streamEvent(const Row& r, EventTime event_time);
+
+  /// Log the streamed events as a batch of added rows.
+  Status flushStream();
+
+  /// Log events to the active logger instead of storing them.
+  bool stream_{false};
+
+  /// The most streamed events kept in memory for selects, 0 for none.
+  size_t stream_ring_{0};
+
+  /// Streamed events waiting for a batched log.
+  QueryData streamed_events_;
+
+  /// The time the oldest waiting streamed event was added.
+  EventTime streamed_time_{0};
+
+  /// The most-recent streamed events and their times.
+  std::deque<std::pair<EventTime, Row>> stream_ring_events_;
+
+  /// Lock protecting the streamed events and ring.
+  Mutex stream_lock_;
+
+  /// Apply sampling and the rate limit, returns false to drop the event.
+  bool admitEvent(const Row& r);
+
+  /// Keep one of each sample_ratio_ events, 0 or 1 keeps every event.
+  size_t sample_ratio_{0};
+
+  /// The most events added each second, 0 for no limit.
+  size_t rate_limit_{0};
+
+  /// Events that may be added before the rate limit drops events.
+  double rate_tokens_{0};
+
+  /// The steady clock milliseconds of the last rate limit refill.
+  size_t rate_time_{0};
+
+  /// Lock protecting the rate limit tokens.
+  Mutex rate_lock_;
+
+  /// The number of events dropped by the rate limit.
+  std::atomic<size_t> rate_limited_{0};
+
+  /// The number of events not kept by sampling.
+  std::atomic<size_t> sampled_out_{0};
+
+  /// The number of events in the backing store, counted once at setup.
+  std::atomic<size_t> stored_events_{0};
+
+  /// The number of events removed by expiration.
+  std::atomic<size_t> expired_events_{0};
+
+  /// Lock serializing the background and inline expiration.
+  Mutex expire_lock_;
+
+  /// Optional queue and service thread delivering events to this subscriber.
+  std::shared_ptr<EventSubscriberQueue> queue_{nullptr};
 
  private:
   friend class EventFactory;
   friend class EventPublisherPlugin;
+  friend class EventExpirationService;
 
  private:
   FRIEND_TEST(EventsDatabaseTests, test_event_module_id);
-  FRIEND_TEST(EventsDatabaseTests, test_record_indexing);
+  FRIEND_TEST(EventsDatabaseTests, test_event_keys);
   FRIEND_TEST(EventsDatabaseTests, test_record_range);
   FRIEND_TEST(EventsDatabaseTests, test_record_expiration);
   FRIEND_TEST(EventsDatabaseTests, test_gentable);
+  FRIEND_TEST(EventsDatabaseTests, test_gentable_ordered);
   FRIEND_TEST(EventsDatabaseTests, test_expire_check);
+  FRIEND_TEST(EventsDatabaseTests, test_expire_batches);
   FRIEND_TEST(EventsDatabaseTests, test_optimize);
+  FRIEND_TEST(EventsDatabaseTests, test_optimize_consumers);
+  FRIEND_TEST(EventsDatabaseTests, test_migrate_events);
+  FRIEND_TEST(EventsDatabaseTests, test_event_id_blocks);
+  FRIEND_TEST(EventsDatabaseTests, test_staged_events);
+  FRIEND_TEST(EventsDatabaseTests, test_rate_limit);
+  FRIEND_TEST(EventsDatabaseTests, test_sampling);
+  FRIEND_TEST(EventsDatabaseTests, test_stream_events);
+  FRIEND_TEST(EventsDatabaseTests, test_enrich_events);
+  FRIEND_TEST(EventsTests, test_dispatch_queue);
+  FRIEND_TEST(EventsTests, test_dispatch_queue_threads);
   friend class DBFakeEventSubscriber;
   friend class BenchmarkEventSubscriber;
 };
@@ -791,6 +1056,17 @@ class EventFactory : private boost::noncopyable {
   /// Optionally forward events to loggers.
   static void forwardEvent(const std::string& event);
 
+  /**
+   * @brief Release the events subscribers hold in memory.
+   *
+   * Staged events are written to the backing store and the in-memory rings
+   * of streaming subscribers are trimmed, or emptied if
+   * `--events_stream_ring_shed` is set. Used under memory pressure.
+   *
+   * @return The number of events released.
+   */
+  static size_t releaseEvents();
+
  public:
   /// The dispatched event thread's entry-point (if needed).
   static Status run(EventPublisherID& type_id);
@@ -854,6 +1130,12 @@ class EventFactory : private boost::noncopyable {
 
   /// Factory publisher state manipulation.
   Mutex factory_lock_;
+
+  /// Incremented when subscribers change, publishers then resolve them again.
+  std::atomic<size_t> subscriber_generation_{0};
+
+ private:
+  friend class EventPublisherPlugin;
 };
 
 /**
@@ -958,6 +1240,7 @@ class EventPublisher : public EventPublisherPlugin {
   FRIEND_TEST(EventsTests, test_event_subscriber_subscribe);
   FRIEND_TEST(EventsTests, test_event_subscriber_context);
   FRIEND_TEST(EventsTests, test_fire_event);
+  FRIEND_TEST(EventsTests, test_fire_matcher);
 };
 
 /**
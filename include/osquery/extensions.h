@@ -38,6 +38,31 @@ struct ExtensionInfo {
 
 typedef std::map<RouteUUID, ExtensionInfo> ExtensionList;
 
+/// Calls made to an extension, and the time spent waiting to make them.
+struct ExtensionRouteMetrics {
+  /// Calls started, including running calls.
+  size_t calls{0};
+
+  /// Calls running now.
+  size_t active{0};
+
+  /// Calls waiting for a concurrency slot now.
+  size_t queued{0};
+
+  /// Total and maximum milliseconds a call waited for a concurrency slot.
+  size_t wait{0};
+  size_t max_wait{0};
+};
+
+/**
+ * @brief Return the call metrics for each extension route.
+ *
+ * Calls from this process to an extension are recorded for its RouteUUID.
+ * Calls served by this process's extension or extension manager Thrift
+ * server are recorded for 0.
+ */
+std::map<RouteUUID, ExtensionRouteMetrics> getExtensionRouteMetrics();
+
 inline std::string getExtensionSocket(
     RouteUUID uuid, const std::string& path = FLAGS_extensions_socket) {
   return (uuid == 0) ? path : path + "." + std::to_string(uuid);
@@ -160,6 +185,24 @@ Status callExtension(const std::string& extension_path,
                      const PluginRequest& request,
                      PluginResponse& response);
 
+/**
+ * @brief Generate an extension's table in pages, appending rows to a batch.
+ *
+ * The extension returns pages of at most `--extensions_page_rows` rows using
+ * a table cursor. When the batch is bounded, the next page is not requested
+ * until the buffered rows have been read, so neither process holds the whole
+ * table. Extensions that do not support cursors return the complete table.
+ *
+ * @param uuid Route UUID of the extension providing the table.
+ * @param table The table name.
+ * @param context The query context sent to the extension.
+ * @param batch A batch reset to the table's columns.
+ */
+Status callExtensionTable(const RouteUUID uuid,
+                          const std::string& table,
+                          QueryContext& context,
+                          RowBatch& batch);
+
 /// The main runloop entered by an Extension, start an ExtensionRunner thread.
 Status startExtension(const std::string& name, const std::string& version);
 
@@ -180,6 +223,23 @@ Status startExtensionWatcher(const std::string& manager_path,
                              size_t interval,
                              bool fatal);
 
+/**
+ * @brief Remember the table routes of a registered extension.
+ *
+ * With --extensions_cache_routes the routes are stored in the database so
+ * the next worker may attach the tables before the extension registers.
+ */
+void cacheExtensionRoutes(const std::string& name,
+                          const RegistryBroadcast& registry);
+
+/**
+ * @brief Attach the tables of extensions from their previous registrations.
+ *
+ * This requires the database, calls fail with an error until each extension
+ * registers the same tables again.
+ */
+void loadCachedExtensionRoutes();
+
 /// Start an ExtensionManagerRunner thread.
 Status startExtensionManager();
 
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
 #include <set>
 #include <string>
@@ -35,6 +36,15 @@ inline GlobLimits operator|(GlobLimits a, GlobLimits b) {
                                  static_cast<size_t>(b));
 }
 
+/**
+ * @brief A check for whether the descendants of a directory are wanted.
+ *
+ * The recursive wildcard does not descend into a directory, which always
+ * ends with a separator, if the filter returns false. The directory itself is
+ * still a result.
+ */
+using GlobPrefixFilter = std::function<bool(const std::string& directory)>;
+
 /// Globbing wildcard character.
 const std::string kSQLGlobWildcard{"%"};
 /// Globbing wildcard recursive character (double wildcard).
@@ -85,6 +95,29 @@ Status readFile(const boost::filesystem::path& path,
                 std::function<void(std::string& buffer, size_t size)> predicate,
                 bool blocking = false);
 
+/**
+ * @brief Read a file's content in large blocks without a copy per block.
+ *
+ * The predicate receives consecutive blocks of at most block_size bytes. With
+ * --read_mmap regular files are mapped into memory and the predicate reads
+ * the mapping directly, otherwise a single buffer is reused for every block.
+ * Special files use the buffered readFile path. The read limits apply.
+ *
+ * @param path the path of the file that you would like to read.
+ * @param block_size the maximum number of bytes passed to the predicate.
+ * @param preserve_time Attempt to preserve file mtime and atime.
+ * @param predicate called with each block and its size.
+ * @param blocking Request a blocking read.
+ *
+ * @return an instance of Status, indicating success or failure.
+ */
+Status readFileBlocks(
+    const boost::filesystem::path& path,
+    size_t block_size,
+    bool preserve_time,
+    std::function<void(const char* buffer, size_t size)> predicate,
+    bool blocking = false);
+
 /**
  * @brief Write text to disk.
  *
@@ -185,6 +218,25 @@ Status resolveFilePattern(const boost::filesystem::path& pattern,
                           std::vector<std::string>& results,
                           GlobLimits setting);
 
+/**
+ * @brief Given a filesystem globbing patten, resolve all matching paths.
+ *
+ * See resolveFilePattern, but skip the descendants of directories that the
+ * filter rejects when expanding a recursive wildcard. A table may use its
+ * other path constraints to avoid walking subtrees it would not return.
+ *
+ * @param pattern filesystem globbing pattern.
+ * @param results output vector of matching paths.
+ * @param setting a bit list of match types, e.g., files, folders.
+ * @param filter a check for directories to descend into.
+ *
+ * @return an instance of Status, indicating success or failure.
+ */
+Status resolveFilePattern(const boost::filesystem::path& pattern,
+                          std::vector<std::string>& results,
+                          GlobLimits setting,
+                          const GlobPrefixFilter& filter);
+
 /**
  * @brief Transform a path with SQL wildcards to globbing wildcard.
  *
@@ -213,6 +265,18 @@ Status remove(const boost::filesystem::path& path);
  */
 Status isDirectory(const boost::filesystem::path& path);
 
+/**
+ * @brief Identify the state of files and directories without reading them.
+ *
+ * The identity includes each existing path's inode, size, and modification
+ * time. Tables reading a database that is rewritten by each transaction,
+ * such as a package manager's, may use it as a generation token.
+ *
+ * @param paths the files or directories to identify.
+ * @return the identity, empty if none of the paths exist.
+ */
+std::string getPathsIdentity(const std::vector<std::string>& paths);
+
 /**
  * @brief Return a vector of all home directories on the system.
  *
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -129,6 +130,17 @@ class LoggerPlugin : public Plugin {
   /// The LoggerPlugin PluginRequest action router.
   Status call(const PluginRequest& request, PluginResponse& response) override;
 
+  /**
+   * @brief Typed actions for local calls, see Registry::callLocal.
+   *
+   * These route results, snapshots, status logs, and events as call does,
+   * without building or parsing a PluginRequest.
+   */
+  Status callString(const std::string& s);
+  Status callSnapshot(const std::string& s);
+  Status callStatus(const std::vector<StatusLogLine>& log);
+  Status callEvent(const std::string& s);
+
   /**
    * @brief A feature method to decide if Glog should stop handling statuses.
    *
@@ -289,6 +301,43 @@ Status logString(const std::string& message,
                  const std::string& category,
                  const std::string& receiver);
 
+/// The priority class of result logs, from a pack's "priority" option.
+enum class LogPriority {
+  /// Sent before other buffered logs, such as alerting packs.
+  HIGH = 0,
+
+  /// The default, and the class of status logs.
+  NORMAL = 1,
+
+  /// Sent after other buffered logs, such as large snapshots.
+  LOW = 2,
+};
+
+/// Parse a priority class name, "high", "normal", or "low".
+bool getLogPriority(const std::string& name, LogPriority& priority);
+
+/// The name of a priority class.
+std::string getLogPriorityName(LogPriority priority);
+
+/**
+ * @brief Set the priority class of results logged on this thread.
+ *
+ * The scheduler logs a query's results within a scope of its pack's priority.
+ * Logger plugins that buffer results, see BufferedLogForwarder, read the
+ * current priority when a result is logged.
+ */
+class LogPriorityScope : private boost::noncopyable {
+ public:
+  explicit LogPriorityScope(LogPriority priority);
+  ~LogPriorityScope();
+
+  /// The priority of results logged on this thread.
+  static LogPriority current();
+
+ private:
+  LogPriority previous_;
+};
+
 /**
  * @brief Log results of scheduled queries to the default receiver
  *
@@ -317,6 +366,69 @@ Status logQueryLogItem(const QueryLogItem& item, const std::string& receiver);
  */
 Status logSnapshotQuery(const QueryLogItem& item);
 
+/**
+ * @brief Log the results of a snapshot query as its rows are produced.
+ *
+ * Each row is serialized into the snapshot's log line rather than kept. When
+ * `--logger_snapshot_chunk_rows` is set a snapshot with more rows is logged
+ * as several lines of at most that many rows, each with a "snapshotPart"
+ * index, and the last with "snapshotParts", the number of lines. A snapshot
+ * logged as one line matches the line of logSnapshotQuery.
+ */
+class SnapshotLogStream : private boost::noncopyable {
+ public:
+  /// Stream the rows of a snapshot, the item is kept until finish.
+  explicit SnapshotLogStream(const QueryLogItem& item);
+
+  /// A snapshot that was not finished is aborted.
+  ~SnapshotLogStream();
+
+  /**
+   * @brief Append a row, a full line is logged before the row is appended.
+   *
+   * A logger failure is reported by finish and does not stop the query.
+   */
+  Status add(Row&& row);
+
+  /// Log the remaining rows, this is the final line of the snapshot.
+  Status finish();
+
+  /**
+   * @brief End the snapshot of a query that did not complete.
+   *
+   * Nothing is logged unless earlier lines of the snapshot were, then the
+   * final line has the remaining rows and a "snapshotIncomplete" field.
+   */
+  void abort();
+
+  /// The number of rows appended.
+  size_t rows() const {
+    return rows_;
+  }
+
+ private:
+  /// The item's metadata and decorations.
+  const QueryLogItem& item_;
+
+  /// The line being serialized.
+  std::string json_;
+
+  /// The writer of the current line.
+  std::unique_ptr<SnapshotLogItemWriter> writer_;
+
+  /// The index of the current line.
+  size_t part_{0};
+
+  /// The number of rows appended.
+  size_t rows_{0};
+
+  /// The first failure of the logger, returned by finish.
+  Status status_;
+
+  /// Set after finish or abort.
+  bool finished_{false};
+};
+
 /**
  * @brief Helper class to disable logger forwarding
  *
@@ -357,6 +469,16 @@ class LoggerForwardingDisabler : private boost::noncopyable {
  */
 void relayStatusLogs();
 
+/**
+ * @brief Wait for forwarded status logs to reach the logger plugins.
+ *
+ * Glog status logs forwarded to logger plugins are queued for a relay thread,
+ * unless `--logger_status_sync` is set, so logging threads do not wait for
+ * the plugins. This returns once every status log queued before the call was
+ * sent.
+ */
+void flushStatusLogs();
+
 /**
  * @brief Write a log line to the OS system log.
  *
@@ -29,6 +29,26 @@ struct PackStats {
   size_t misses{0};
 };
 
+/**
+ * @brief Discovery query results shared by every pack.
+ *
+ * Packs often repeat the same discovery queries, so results are cached by
+ * query text and each distinct query runs once for all packs. A result
+ * expires after pack_refresh_interval, or earlier when invalidated, such as
+ * when an event reports the host's installed software changed.
+ */
+class DiscoveryCache : private boost::noncopyable {
+ public:
+  /// Return true if the discovery query succeeds and returns rows.
+  static bool check(const std::string& query);
+
+  /// Expire every cached result and every pack's discovery state.
+  static void invalidate();
+
+  /// A counter incremented by each invalidation.
+  static size_t generation();
+};
+
 /**
  * @brief The programmatic representation of a query pack
  *
@@ -135,6 +155,9 @@ class Pack : private boost::noncopyable {
   /// Cached time and result from previous discovery step.
   std::pair<size_t, bool> discovery_cache_;
 
+  /// The DiscoveryCache generation of the cached discovery result.
+  size_t discovery_generation_{0};
+
   /// Aggregate appropriateness of pack for this host.
   std::atomic<bool> valid_{false};
 
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <map>
 #include <mutex>
 #include <set>
@@ -69,6 +71,7 @@ using ModuleInitalizer = void (*)(void);
 
 /// The registry includes a single optimization for table generation.
 struct QueryContext;
+class RowBatch;
 
 class Plugin : private boost::noncopyable {
  public:
@@ -194,6 +197,11 @@ class RegistryInterface : private boost::noncopyable {
     return external_;
   }
 
+  /// Check if an item only has routes remembered from a registration.
+  bool isCached(const std::string& item_name) const {
+    return cached_.count(item_name) > 0;
+  }
+
   /// Get the 'active' plugin, return success with the active plugin name.
   const std::string& getActive() const {
     return active_;
@@ -295,6 +303,17 @@ class RegistryInterface : private boost::noncopyable {
   virtual Status addExternalPlugin(const std::string& name,
                                    const PluginResponse& info) const = 0;
 
+  /**
+   * @brief Add routes remembered from an earlier registration.
+   *
+   * The route info is available before the extension registers, for example
+   * tables are attached, but calls fail until the extension registers the
+   * same items. Items that already exist are skipped.
+   *
+   * @param routes The plugin name and optional route info list.
+   */
+  void addCached(const RegistryRoutes& routes);
+
   /// Remove all the routes for a given uuid.
   void removeExternal(const RouteUUID& uuid);
 
@@ -352,6 +371,9 @@ class RegistryInterface : private boost::noncopyable {
   /// to external items differently.
   std::map<std::string, PluginResponse> routes_;
 
+  /// Items with remembered route info and no registered extension.
+  std::set<std::string> cached_;
+
   /// Keep a lookup of registry items that are blacklisted from broadcast.
   std::vector<std::string> internal_;
 
@@ -521,6 +543,46 @@ class RegistryFactory : private boost::noncopyable {
                           QueryContext& context,
                           PluginResponse& response);
 
+  /**
+   * @brief A helper call for columnar table data generation.
+   *
+   * Local tables that use TablePlugin::generateBatch fill the batch directly.
+   * Extension tables are read in pages, see callExtensionTable, appended to a
+   * batch the caller has reset to the table's columns. For every other table
+   * this fails without generating so the caller can use the PluginResponse
+   * variant of callTable.
+   */
+  static Status callTable(const std::string& table_name,
+                          QueryContext& context,
+                          RowBatch& batch);
+
+  /**
+   * @brief A helper call for plugins of a known type, without an envelope.
+   *
+   * A local plugin is given to the typed callable directly, skipping the
+   * PluginRequest marshalling. Items routed to an extension, or unknown to
+   * this registry, are called with the PluginRequest the envelope callable
+   * builds. Multiplexed item names call each item without regard for
+   * statuses, as call does.
+   *
+   * @param registry_name The registry of PluginType items.
+   * @param item_name The name of the plugin, or a comma-separated list.
+   * @param local Called with a local plugin.
+   * @param envelope Builds the request for an extension's plugin.
+   */
+  template <class PluginType>
+  static Status callLocal(const std::string& registry_name,
+                          const std::string& item_name,
+                          const std::function<Status(PluginType&)>& local,
+                          const std::function<PluginRequest()>& envelope) {
+    return callPlugin(registry_name,
+                      item_name,
+                      [&local](Plugin& plugin) {
+                        return local(static_cast<PluginType&>(plugin));
+                      },
+                      envelope);
+  }
+
   /// Run `setUp` on every registry that is not marked 'lazy'.
   static void setUp();
 
@@ -551,6 +613,9 @@ class RegistryFactory : private boost::noncopyable {
   /// Given an extension UUID remove all external registry items.
   Status removeBroadcast(const RouteUUID& uuid);
 
+  /// Add registry items remembered from an extension's earlier broadcast.
+  Status addCachedBroadcast(const RegistryBroadcast& broadcast);
+
   /// Adds an alias for an internal registry item. This registry will only
   /// broadcast the alias name.
   Status addAlias(const std::string& registry_name,
@@ -624,6 +689,16 @@ class RegistryFactory : private boost::noncopyable {
     return external_;
   }
 
+  /**
+   * @brief A counter changed when registry items or active plugins change.
+   *
+   * Callers keeping a reference to an active plugin compare the generation
+   * to know when the plugin must be resolved again.
+   */
+  size_t generation() const {
+    return generation_;
+  }
+
  private:
   /// Access the current initializing module UUID.
   RouteUUID getModule();
@@ -647,6 +722,12 @@ class RegistryFactory : private boost::noncopyable {
     locked_ = locked;
   }
 
+  /// The untyped implementation of callLocal.
+  static Status callPlugin(const std::string& registry_name,
+                           const std::string& item_name,
+                           const std::function<Status(Plugin&)>& local,
+                           const std::function<PluginRequest()>& envelope);
+
  protected:
   RegistryFactory()
       : allow_duplicates_(false),
@@ -694,6 +775,9 @@ class RegistryFactory : private boost::noncopyable {
   /// Protector for broadcast lookups and external registry mutations.
   mutable Mutex mutex_;
 
+  /// Incremented when an item is added or removed, or a plugin set active.
+  std::atomic<size_t> generation_{0};
+
  private:
   friend class RegistryInterface;
   friend class RegistryModuleLoader;
@@ -187,6 +187,16 @@ class SQLPlugin : public Plugin {
   /// Run a SQL query string against the SQL implementation.
   virtual Status query(const std::string& q, QueryData& results) const = 0;
 
+  /**
+   * @brief Run a SQL query string, the results may be reused.
+   *
+   * An implementation may return the results of a recent execution of the
+   * same query string, by default the query is executed.
+   */
+  virtual Status queryCached(const std::string& q, QueryData& results) const {
+    return query(q, results);
+  }
+
   /// Use the SQL implementation to parse a query string and return details
   /// (name, type) about the columns.
   virtual Status getQueryColumns(const std::string& q,
@@ -236,6 +246,18 @@ class SQLPlugin : public Plugin {
  */
 Status query(const std::string& query, QueryData& results);
 
+/**
+ * @brief Execute a query, allowing the results of a recent execution.
+ *
+ * When the SQL implementation caches results, see --query_results_cache_ttl,
+ * the results may be a copy of an identical query executed moments ago.
+ *
+ * @param query the query to execute
+ * @param results A QueryData structure to emit result rows on success.
+ * @return A status indicating query success.
+ */
+Status queryCached(const std::string& query, QueryData& results);
+
 /**
  * @brief Analyze a query, providing information about the result columns.
  *
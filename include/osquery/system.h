@@ -14,6 +14,7 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <boost/filesystem/path.hpp>
@@ -95,6 +96,14 @@ class Initializer : private boost::noncopyable {
   /// Assume initialization finished, start work.
   void start() const;
 
+  /**
+   * @brief Milliseconds spent in each startup phase, in the order they ended.
+   *
+   * Phases that run concurrently, such as opening the database while the
+   * extension manager starts, are each timed from their own beginning.
+   */
+  static std::vector<std::pair<std::string, size_t>> getStartupTimings();
+
   /**
    * @brief Forcefully request the application to stop.
    *
@@ -310,6 +319,17 @@ std::string getHostIdentifier();
  */
 size_t getUnixTime();
 
+/**
+ * @brief Get an identity of the current system boot.
+ *
+ * The identity is the same for every process within a boot and changes when
+ * the system reboots. Linux provides a boot UUID, other platforms use the
+ * boot time.
+ *
+ * @return the boot identity, empty if it cannot be determined.
+ */
+std::string getBootIdentity();
+
 /**
  * @brief Getter for the current time, in a human-readable format.
  *
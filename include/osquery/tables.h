@@ -10,15 +10,22 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <set>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/optional.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/core.h>
 #include <osquery/database.h>
@@ -249,6 +256,9 @@ enum class TableAttributes {
 
   /// This table's data requires an osquery kernel extension/module.
   KERNEL_REQUIRED = 16,
+
+  /// The results from this table do not change until the system reboots.
+  BOOT_CACHEABLE = 32,
 };
 
 /// Treat table attributes as a set of flags.
@@ -272,6 +282,291 @@ using TableColumns =
 /// Alias for map of column alias sets.
 using ColumnAliasSet = std::map<std::string, std::set<std::string>>;
 
+/// Alias for a map of column names to a relative constraint lookup cost.
+using ColumnCostMap = std::map<std::string, size_t>;
+
+/// Usage of a TablePlugin's result cache, see TablePlugin::cacheStats.
+struct TableCacheStats {
+  /// The number of cached query context keys.
+  size_t entries{0};
+
+  /// The number of entries held in the database instead of memory.
+  size_t spilled{0};
+
+  /// The approximate in-memory size of cached results.
+  size_t bytes{0};
+
+  /// Lookups returning fresh results, and lookups that missed.
+  size_t hits{0};
+  size_t misses{0};
+};
+
+/**
+ * @brief A monotonic buffer for the text cells of generated rows.
+ *
+ * Copies are appended to large chunks and never freed individually. All of
+ * the arena's memory is released at once when it is reset, such as when a
+ * query's cursor is closed, instead of leaving holes of freed cell strings
+ * fragmenting the heap after large queries.
+ */
+class RowArena : private boost::noncopyable {
+ public:
+  /// The size of each chunk, larger copies are given a chunk of their own.
+  static const size_t kChunkSize;
+
+  /// Copy bytes into the arena, the copy is valid until the arena is reset.
+  boost::string_ref copy(const char* data, size_t size);
+
+  /// Release every copy, the first chunk is kept for reuse.
+  void reset();
+
+  /// The number of bytes copied into the arena.
+  size_t bytes() const {
+    return bytes_;
+  }
+
+  /// The number of bytes the arena has allocated.
+  size_t capacity() const;
+
+ private:
+  struct Chunk {
+    std::unique_ptr<char[]> data;
+    size_t size{0};
+    size_t used{0};
+  };
+
+  /// Chunks in allocation order, copies are appended to the last chunk.
+  std::vector<Chunk> chunks_;
+
+  /// The number of bytes copied since the last reset.
+  size_t bytes_{0};
+};
+
+/**
+ * @brief A column-major, typed set of generated table rows.
+ *
+ * A Row maps each column name to a TEXT-represented value, so every generated
+ * cell costs a column-name copy, a map node, and a string allocation. Tables
+ * that emit many rows may instead fill a RowBatch. Each column is a vector
+ * indexed by the column's position within the table's TableColumns and the
+ * INTEGER, BIGINT, UNSIGNED_BIGINT, and DOUBLE affinities are stored natively.
+ *
+ * A generator appends a row using RowBatch::addRow, then sets cells for that
+ * row by column index. Cells that are never set are NULL. Text cells are
+ * copied into the batch's RowArena and released when the batch is cleared.
+ *
+ * A batch may be bounded: when the batch holds the requested capacity the next
+ * RowBatch::addRow calls a yield function. SQL cursors use this to suspend the
+ * generator until the rows have been read and the batch cleared, then resume.
+ * Generators must not catch all (...) exceptions around RowBatch::addRow as a
+ * suspended generator is unwound when its cursor is closed.
+ */
+class RowBatch : private boost::noncopyable {
+ public:
+  RowBatch() = default;
+
+  /// Construct a batch for a table schema.
+  explicit RowBatch(const TableColumns& columns) {
+    reset(columns);
+  }
+
+  /// Remove all rows and apply a, potentially new, table schema.
+  void reset(const TableColumns& columns);
+
+  /// Remove all rows but keep the schema.
+  void clear();
+
+  /// The number of columns in the batch's schema.
+  size_t columns() const {
+    return columns_.size();
+  }
+
+  /// The number of rows in the batch.
+  size_t size() const {
+    return rows_;
+  }
+
+  /// Get the index of a column name, or RowBatch::columns if it is unknown.
+  size_t index(const std::string& name) const;
+
+  /// Get the name of the column at an index.
+  const std::string& name(size_t column) const {
+    return columns_[column].name;
+  }
+
+  /// Get the affinity of the column at an index.
+  ColumnType type(size_t column) const {
+    return columns_[column].type;
+  }
+
+  /// Append a row of NULL cells, the set methods act on this row.
+  size_t addRow();
+
+  /// Call yield before adding a row to a batch holding capacity rows.
+  void setYield(std::function<void()> yield, size_t capacity) {
+    yield_ = std::move(yield);
+    capacity_ = capacity;
+  }
+
+  /// Set an INTEGER, BIGINT, or UNSIGNED_BIGINT cell in the last row.
+  void setInteger(size_t column, long long value);
+
+  /// Set a DOUBLE cell in the last row.
+  void setDouble(size_t column, double value);
+
+  /// Set a TEXT or BLOB cell in the last row.
+  void setText(size_t column, std::string value);
+
+  /// Set any cell in the last row using a TEXT expression of the affinity.
+  void set(size_t column, const std::string& value);
+
+  /// Check if a cell was not set.
+  bool isNull(size_t row, size_t column) const {
+    return columns_[column].nulls[row];
+  }
+
+  /// Access a cell with an INTEGER, BIGINT, or UNSIGNED_BIGINT affinity.
+  long long getInteger(size_t row, size_t column) const {
+    return columns_[column].integers[row];
+  }
+
+  /// Access a cell with a DOUBLE affinity.
+  double getDouble(size_t row, size_t column) const {
+    return columns_[column].doubles[row];
+  }
+
+  /// Access a cell with a TEXT or BLOB affinity, valid until the next clear.
+  boost::string_ref getText(size_t row, size_t column) const {
+    return columns_[column].text[row];
+  }
+
+  /// Get the TEXT representation of any cell, NULL cells are empty.
+  std::string getAsText(size_t row, size_t column) const;
+
+  /// Append every row, as a Row, to a QueryData.
+  void toQueryData(QueryData& results) const;
+
+  /// The approximate size of the batch's cells in bytes.
+  size_t bytes() const;
+
+ private:
+  /// Storage for a single column, only one of the value vectors is used.
+  struct Column {
+    std::string name;
+    ColumnType type{TEXT_TYPE};
+    std::vector<long long> integers;
+    std::vector<double> doubles;
+    std::vector<boost::string_ref> text;
+    std::vector<bool> nulls;
+  };
+
+  /// Set the last row's cell of a text column to a copy of the value.
+  void setTextCell(Column& storage, const std::string& value);
+
+  /// Column storage in table schema order.
+  std::vector<Column> columns_;
+
+  /// Storage for the content of text cells.
+  RowArena arena_;
+
+  /// The number of rows added.
+  size_t rows_{0};
+
+  /// Optional bound on the number of rows held before yielding.
+  size_t capacity_{0};
+
+  /// Optional yield, called when the batch is full.
+  std::function<void()> yield_{nullptr};
+};
+
+/**
+ * @brief A row of a table with generated column indexes.
+ *
+ * The Columns of each table are generated from its spec, see the
+ * tools/codegen/templates/columns.h.in template, and included from
+ * "osquery/tables/columns/<table>.h". Cells are set by a column index known
+ * at compile time, and a value of the column's affinity:
+ *
+ * @code{.cpp}
+ *   using Col = ProcessesColumns;
+ *   ProcessesRow r(batch);
+ *   r.set<Col::pid>(pid);
+ *   r.set<Col::name>(name);
+ * @endcode
+ *
+ * A row built on a RowBatch appends a row to the batch and fills its cells by
+ * index. A row built on a Row fills cells by the column names, for tables
+ * returning QueryData.
+ */
+template <class Columns>
+class TypedRow : private boost::noncopyable {
+ public:
+  /// Append a row to a batch reset to the table's columns.
+  explicit TypedRow(RowBatch& batch) : batch_(&batch) {
+    batch_->addRow();
+  }
+
+  /// Fill a Row, the cells are keyed by column name.
+  explicit TypedRow(Row& row) : row_(&row) {}
+
+  /// Set the cell of a column, the value must match the column's affinity.
+  template <size_t C, typename T>
+  void set(const T& value) {
+    static_assert(C < Columns::kCount, "Unknown column");
+    setCell(C, value, Kind<getKind(Columns::getType(C))>());
+  }
+
+ private:
+  enum CellKind { INTEGER_CELL, DOUBLE_CELL, TEXT_CELL };
+
+  template <CellKind K>
+  using Kind = std::integral_constant<CellKind, K>;
+
+  static constexpr CellKind getKind(ColumnType type) {
+    return (type == INTEGER_TYPE || type == BIGINT_TYPE ||
+            type == UNSIGNED_BIGINT_TYPE)
+               ? INTEGER_CELL
+               : (type == DOUBLE_TYPE) ? DOUBLE_CELL : TEXT_CELL;
+  }
+
+  template <typename T>
+  void setCell(size_t column, const T& value, Kind<INTEGER_CELL>) {
+    static_assert(std::is_integral<T>::value || std::is_enum<T>::value,
+                  "Integer columns require an integer value");
+    if (batch_ != nullptr) {
+      batch_->setInteger(column, static_cast<long long>(value));
+    } else {
+      (*row_)[Columns::getName(column)] = std::to_string(value);
+    }
+  }
+
+  template <typename T>
+  void setCell(size_t column, const T& value, Kind<DOUBLE_CELL>) {
+    static_assert(std::is_arithmetic<T>::value,
+                  "Double columns require a numeric value");
+    if (batch_ != nullptr) {
+      batch_->setDouble(column, static_cast<double>(value));
+    } else {
+      (*row_)[Columns::getName(column)] = DOUBLE(static_cast<double>(value));
+    }
+  }
+
+  template <typename T>
+  void setCell(size_t column, const T& value, Kind<TEXT_CELL>) {
+    static_assert(std::is_convertible<T, std::string>::value,
+                  "Text columns require a string value");
+    if (batch_ != nullptr) {
+      batch_->setText(column, value);
+    } else {
+      (*row_)[Columns::getName(column)] = value;
+    }
+  }
+
+ private:
+  RowBatch* batch_{nullptr};
+  Row* row_{nullptr};
+};
+
 /// Forward declaration of QueryContext for ConstraintList relationships.
 struct QueryContext;
 
@@ -354,6 +649,10 @@ struct ConstraintList : private boost::noncopyable {
    * map index. Tables that act on required constraints can make decisions
    * on missing constraints or a constraint match.
    *
+   * Every constraint must match, an IN list on an indexed column arrives as
+   * several EQUALS constraints. Generators selecting values should use
+   * ConstraintList::admits instead.
+   *
    * @param expr The expression to match.
    * @return true if constraint is missing or matches the type expression.
    */
@@ -362,12 +661,51 @@ struct ConstraintList : private boost::noncopyable {
     return (!exists() || matches(expr));
   }
 
+  /**
+   * @brief Check if an expression may satisfy the constraints.
+   *
+   * Generators may use this to skip the work for values SQLite would
+   * filter. Unlike ConstraintList::matches, several EQUALS constraints match
+   * any of their expressions, like an IN list, and LIKE constraints are
+   * evaluated. Constraints that cannot be evaluated, such as REGEXP or an
+   * expression not of the list's affinity, admit every expression. SQLite
+   * still evaluates the constraints on the generated rows.
+   *
+   * @param expr a SQL type expression of the column literal type to check.
+   * @return false only if the expression cannot satisfy the constraints.
+   */
+  bool admits(const std::string& expr) const;
+
+  /// See ConstraintList::admits, but as a selected literal type.
+  template <typename T>
+  bool admits(const T& expr) const {
+    return admits(SQL_TEXT(expr));
+  }
+
+  /**
+   * @brief Check if any expression beginning with a prefix may satisfy the
+   * constraints.
+   *
+   * A generator walking a tree, such as a recursive file pattern, may skip a
+   * subtree whose prefix is not admitted. Only TEXT EQUALS and LIKE
+   * constraints are evaluated.
+   *
+   * @param prefix The beginning of the expressions, such as a directory.
+   * @return false only if no expression with the prefix can satisfy the
+   *   constraints.
+   */
+  bool admitsPrefix(const std::string& prefix) const;
+
   /**
    * @brief Helper templated function for ConstraintList::matches.
    */
   template <typename T>
   bool literal_matches(const T& base_expr) const;
 
+  /// Helper templated function for ConstraintList::admits.
+  template <typename T>
+  bool literal_admits(const T& base_expr, const std::string& expr) const;
+
   /**
    * @brief Get all expressions for a given ConstraintOperator.
    *
@@ -437,6 +775,9 @@ using ConstraintMap = std::map<std::string, struct ConstraintList>;
 /// Populate a constraint list from a query's parsed predicate.
 using ConstraintSet = std::vector<std::pair<std::string, struct Constraint>>;
 
+/// The set of column names a query reads from a table.
+using UsedColumns = std::unordered_set<std::string>;
+
 /**
  * @brief osquery table content descriptor.
  *
@@ -462,6 +803,18 @@ struct VirtualTableContent {
   /// passed to the SQL and optional Query for inspection.
   TableAttributes attributes{TableAttributes::NONE};
 
+  /// The estimated number of rows from a full scan, 0 if unknown.
+  size_t cardinality{0};
+
+  /// The relative cost of generating rows using a constraint on a column.
+  ColumnCostMap costs;
+
+  /// The table's TablePlugin::generation when it was last scanned.
+  std::string generation;
+
+  /// The cost of the filters of the executing query, reset after the query.
+  TableCost cost;
+
   /**
    * @brief Table column aliases structure.
    *
@@ -471,9 +824,6 @@ struct VirtualTableContent {
    */
   std::map<std::string, size_t> aliases;
 
-  /// Transient set of virtual table access constraints.
-  std::unordered_map<size_t, ConstraintSet> constraints;
-
   /*
    * @brief A table implementation specific query result cache.
    *
@@ -492,6 +842,34 @@ struct VirtualTableContent {
   std::map<std::string, Row> cache;
 };
 
+/**
+ * @brief Objects shared by every table scanned by a single query.
+ *
+ * Tables reading the same expensive source, such as the process tables each
+ * walking /proc, may share one read using QueryContext::getShared. The state
+ * is released when the query completes.
+ */
+class QueryState : private boost::noncopyable {
+ public:
+  /// Get the object stored for a key, creating it if it does not exist.
+  template <typename T>
+  std::shared_ptr<T> get(const std::string& key) {
+    WriteLock lock(mutex_);
+    auto& item = items_[key];
+    if (item == nullptr) {
+      item = std::make_shared<T>();
+    }
+    return std::static_pointer_cast<T>(item);
+  }
+
+ private:
+  /// The shared objects, by a key chosen by the tables sharing them.
+  std::map<std::string, std::shared_ptr<void>> items_;
+
+  /// Tables using concurrency may request objects from several threads.
+  Mutex mutex_;
+};
+
 /**
  * @brief A QueryContext is provided to every table generator for optimization
  * on query components like predicate constraints and limits.
@@ -526,6 +904,18 @@ struct QueryContext : private boost::noncopyable {
   bool hasConstraint(const std::string& column,
                      ConstraintOperator op = EQUALS) const;
 
+  /**
+   * @brief Check if a value of a column may satisfy the column's constraints.
+   *
+   * See ConstraintList::admits, a column without constraints admits every
+   * value.
+   *
+   * @param column The name of a column within this table.
+   * @param expr The value generated for the column.
+   * @return false if the row with this value would be filtered by SQLite.
+   */
+  bool admits(const std::string& column, const std::string& expr) const;
+
   /**
    * @brief Apply a predicate function to each expression in a constraint list.
    *
@@ -622,10 +1012,106 @@ struct QueryContext : private boost::noncopyable {
     table_->cache[index][key] = std::move(_item);
   }
 
+  /**
+   * @brief Get an object shared by the tables scanned by the same query.
+   *
+   * A context created outside of an SQLite query, such as for a generate
+   * call through the Registry, does not share objects and a new object is
+   * returned.
+   *
+   * @param key A name for the object, always used with the same type.
+   * @return The shared object.
+   */
+  template <typename T>
+  std::shared_ptr<T> getShared(const std::string& key) const {
+    if (state == nullptr) {
+      return std::make_shared<T>();
+    }
+    return state->get<T>(key);
+  }
+
+  /**
+   * @brief Check if a column is read by the query.
+   *
+   * Tables may skip expensive per-row work for columns that are not selected,
+   * used in a predicate, or used for sorting. When the used columns are not
+   * known, such as for a generate call without SQLite, every column is used.
+   *
+   * @param colName The name of a column within this table.
+   * @return true if the column is used or the used columns are unknown.
+   */
+  bool isColumnUsed(const std::string& colName) const;
+
+  /// Check if any of the columns are read by the query.
+  bool isAnyColumnUsed(std::initializer_list<std::string> colNames) const;
+
+  /**
+   * @brief A key identifying the rows a table generates for this context.
+   *
+   * Contexts with the same constraints, in any order, and the same used
+   * columns have equal keys. Results generated for one may be reused by the
+   * other, see TablePlugin::getCache.
+   */
+  std::string cacheKey() const;
+
+  /**
+   * @brief Account a generated row before adding it to the results.
+   *
+   * A scheduled query may limit the rows and bytes its tables generate, see
+   * QueryBudget::setResultLimits. The virtual table layer drops rows beyond
+   * the limits, but generators that may produce many rows, such as those
+   * expanding globs, should admit each row and stop once one is refused.
+   *
+   * @param row The generated row.
+   * @return false if the row exceeds the limits, it should not be added.
+   */
+  bool admit(const Row& row);
+
+  /// Check if QueryContext::admit refused a row.
+  bool truncated() const {
+    return truncated_;
+  }
+
   /// The map of column name to constraint list.
   ConstraintMap constraints;
 
+  /// The optional set of columns used by the query.
+  boost::optional<UsedColumns> colsUsed;
+
+  /// The number of workers the table may use, see TablePlugin::concurrency.
+  size_t concurrency{1};
+
+  /// Objects shared with other tables scanned by the query, if any.
+  std::shared_ptr<QueryState> state;
+
+  /// Rows the query may still generate when the table is filtered, or 0.
+  size_t max_rows{0};
+
+  /// Bytes the query may still generate when the table is filtered, or 0.
+  size_t max_bytes{0};
+
+  /// Event-based tables return rows ordered by time, SQLite does not sort.
+  bool ordered{false};
+
+  /// The ordered rows are returned newest first.
+  bool descending{false};
+
+  /**
+   * @brief The number of ordered rows the query reads, or 0.
+   *
+   * This is only set when the table's time constraints select exactly the
+   * rows SQLite keeps, so the table may stop after this many rows.
+   */
+  size_t limit{0};
+
  private:
+  /// Rows and bytes accounted using QueryContext::admit.
+  std::atomic<size_t> admitted_rows_{0};
+  std::atomic<size_t> admitted_bytes_{0};
+
+  /// Latched once QueryContext::admit refused a row.
+  std::atomic<bool> truncated_{false};
+
   /// If false then the context is maintaining a ephemeral cache.
   bool enable_cache_{false};
 
@@ -639,6 +1125,162 @@ struct QueryContext : private boost::noncopyable {
 using QueryContext = struct QueryContext;
 using Constraint = struct Constraint;
 
+/**
+ * @brief Run independent pieces of table generation concurrently.
+ *
+ * Generators performing I/O-bound work for each constraint expression, such
+ * as hashing every path in `WHERE path IN (...)`, may call work for each index
+ * in [0, count) across up to concurrency threads. The calling thread is one
+ * of the workers and this returns once all work has completed.
+ *
+ * Workers are reserved from a budget shared by every table, set using
+ * --table_generator_threads. When the budget is exhausted the remaining work
+ * runs on the calling thread. Work must not touch the QueryContext cache or a
+ * RowBatch; write to per-index results and merge them after this returns.
+ *
+ * @param count The number of independent pieces of work.
+ * @param concurrency The maximum number of threads, usually the context's.
+ * @param work The work for a single index.
+ */
+void parallelFor(size_t count,
+                 size_t concurrency,
+                 const std::function<void(size_t index)>& work);
+
+/**
+ * @brief A time budget for the query executing on the current thread.
+ *
+ * A query runner starts a budget before executing a query, and the budget
+ * ends when it goes out of scope. Each osquery SQLite connection checks the
+ * budget of its thread using a progress handler and stops the query with an
+ * error once it is spent. This bounds a single query without relying on the
+ * watchdog, which restarts the whole worker.
+ *
+ * SQLite cannot stop a query while a table is generating rows. Generators that
+ * may run for a long time, such as those reading or hashing files, should
+ * check QueryBudget::interrupted between units of work and return early.
+ *
+ * A budget may also limit the rows and bytes generated by tables, so a query
+ * returns truncated results instead of growing the worker's memory.
+ */
+class QueryBudget : private boost::noncopyable {
+ public:
+  /**
+   * @brief Start a budget for the queries executed by this thread.
+   *
+   * @param milliseconds The time allowed, 0 means no limit.
+   * @param stopped An optional flag that spends the budget when set.
+   */
+  explicit QueryBudget(size_t milliseconds,
+                       const std::atomic<bool>* stopped = nullptr);
+
+  /// Restore the budget that was active when this budget started.
+  ~QueryBudget();
+
+  /// Check if the time allowed has elapsed or the stop flag is set.
+  bool spent();
+
+  /// Check if the budget was spent because the time allowed elapsed.
+  bool expired() const {
+    return expired_;
+  }
+
+  /// Check if any budget active on this thread is spent.
+  static bool interrupted();
+
+  /**
+   * @brief Limit the rows and bytes the tables of this budget's queries
+   * generate.
+   *
+   * Rows beyond the limits are dropped and the results are truncated, rather
+   * than the query failing. A limit of 0 means no limit.
+   */
+  void setResultLimits(size_t rows, size_t bytes);
+
+  /// Check if the budget limits generated rows or bytes.
+  bool limitsResults() const {
+    return max_rows_ > 0 || max_bytes_ > 0;
+  }
+
+  /**
+   * @brief Account rows generated by a table.
+   *
+   * @param rows The number of generated rows.
+   * @param bytes The size of the generated rows, assumed to be even.
+   * @return The number of leading rows within the limits.
+   */
+  size_t admitRows(size_t rows, size_t bytes);
+
+  /// The rows and bytes tables may still generate, 0 if unlimited.
+  size_t remainingRows() const;
+  size_t remainingBytes() const;
+
+  /**
+   * @brief Check if tables may generate more rows before filtering another.
+   *
+   * Once a limit is reached the results are considered truncated, even if
+   * the next table would not generate rows.
+   */
+  bool hasRoom();
+
+  /// Check if generated rows were dropped because they exceeded the limits.
+  bool truncated() const {
+    return truncated_;
+  }
+
+  /// Record that a generator stopped at the limits, dropping rows.
+  void setTruncated() {
+    truncated_ = true;
+  }
+
+  /// The innermost budget active on this thread, or nullptr.
+  static QueryBudget* current();
+
+  /// Make another thread's budget current, such as for a table's workers.
+  class Scope : private boost::noncopyable {
+   public:
+    explicit Scope(QueryBudget* budget) : previous_(kCurrent) {
+      kCurrent = budget;
+    }
+
+    ~Scope() {
+      kCurrent = previous_;
+    }
+
+   private:
+    QueryBudget* previous_{nullptr};
+  };
+
+ private:
+  /// The time the budget is spent, if the budget is timed.
+  std::chrono::steady_clock::time_point expires_;
+
+  /// True if the budget has a time limit.
+  bool timed_{false};
+
+  /// Latched once the time allowed elapsed.
+  std::atomic<bool> expired_{false};
+
+  /// An optional owner's stop request.
+  const std::atomic<bool>* stopped_{nullptr};
+
+  /// Limits of generated rows and bytes, 0 for no limit.
+  size_t max_rows_{0};
+  size_t max_bytes_{0};
+
+  /// Rows and bytes generated within the limits.
+  std::atomic<size_t> rows_{0};
+  std::atomic<size_t> bytes_{0};
+
+  /// Latched once a generated row exceeded the limits.
+  std::atomic<bool> truncated_{false};
+
+  /// The enclosing budget on this thread.
+  QueryBudget* previous_{nullptr};
+
+  /// The innermost budget for each thread.
+  static thread_local QueryBudget* kCurrent;
+};
+
 /**
  * @brief The TablePlugin defines the name, types, and column information.
  *
@@ -650,6 +1292,10 @@ using Constraint = struct Constraint;
  * in osquery/tables/templates/default.cpp.in
  */
 class TablePlugin : public Plugin {
+ public:
+  /// Release the memory accounted to this table's cached results.
+  ~TablePlugin() override;
+
  protected:
   /**
    * @brief Table name aliases create full-scan VIEWs for tables.
@@ -678,6 +1324,37 @@ class TablePlugin : public Plugin {
     return TableAttributes::NONE;
   }
 
+  /**
+   * @brief The estimated number of rows generated by a full table scan.
+   *
+   * SQLite uses this estimate to order the tables within a join. A table
+   * returning 0 (the default) uses the planner's flat scan cost.
+   */
+  virtual size_t cardinality() const {
+    return 0;
+  }
+
+  /**
+   * @brief The relative cost of generating rows using a column constraint.
+   *
+   * A lookup through an index or required column costs 1 by default. Tables
+   * that perform expensive work for each constrained value, such as reading
+   * and hashing file content, should declare a higher cost.
+   */
+  virtual ColumnCostMap columnCosts() const {
+    return ColumnCostMap();
+  }
+
+  /**
+   * @brief The maximum number of workers used to generate the table.
+   *
+   * This is copied into QueryContext::concurrency before generating. Tables
+   * may use it with parallelFor to fan out independent per-constraint work.
+   */
+  virtual size_t concurrency() const {
+    return 1;
+  }
+
   /**
    * @brief Generate a complete table representation.
    *
@@ -695,8 +1372,27 @@ class TablePlugin : public Plugin {
    * @param request A query context filled in by SQLite's virtual table API.
    * @return The result rows for this table, given the query context.
    */
-  virtual QueryData generate(QueryContext& request) {
-    return QueryData();
+  virtual QueryData generate(QueryContext& request);
+
+  /**
+   * @brief Generate a complete table representation into a columnar batch.
+   *
+   * Tables that return true from TablePlugin::usesBatch implement this method
+   * instead of TablePlugin::generate. The batch has been reset to the table's
+   * columns so cells are set using each column's index in TablePlugin::columns.
+   *
+   * Local SQL queries read the batch directly. Other callers, such as the
+   * extensions API, receive the batch converted to QueryData.
+   *
+   * @param batch The output columnar rows, using this table's schema.
+   * @param request A query context filled in by SQLite's virtual table API.
+   */
+  virtual void generateBatch(RowBatch& batch, QueryContext& request) {}
+
+ public:
+  /// Override and return true to use TablePlugin::generateBatch.
+  virtual bool usesBatch() const {
+    return false;
   }
 
  protected:
@@ -714,55 +1410,169 @@ class TablePlugin : public Plugin {
    * Caching and cache freshness only applies to queries acting on tables
    * within a schedule. If two queries "one" and "two" both inspect the
    * table "processes" at the interval 60. The first executed will cache results
-   * and the second will use the cached results.
-   *
-   * Table results are not cached if a QueryContext contains constraints or
-   * provides HOB (hand-off blocks) to additional tables within a query.
-   * Currently, the query scheduler cannot communicate to table implementations.
-   * An interval is set globally by the scheduler and passed to the table
-   * implementation as a future-proof API. There is no "shortcut" for caching
-   * when used in external tables. A cache lookup within an extension means
-   * a database call API and re-serialization to the virtual table APIs. In
-   * practice this does not perform well and is explicitly disabled.
-   *
-   * @param interval The interval this query expects the tables results.
+   * and the second will use the cached results. A table may declare a fixed
+   * lifetime for its results with TablePlugin::cacheTTL.
+   *
+   * Results are cached for each QueryContext::cacheKey, so queries with
+   * different constraints or used columns do not share results. There is no
+   * "shortcut" for caching when used in external tables. A cache lookup within
+   * an extension means re-serialization to the virtual table APIs. In practice
+   * this does not perform well and is explicitly disabled.
+   *
+   * @param step The current schedule step, 0 when not within the schedule.
+   * @param context The query context used to generate results.
    * @return True if the cache contains fresh results, otherwise false.
    */
-  bool isCached(size_t interval);
+  bool isCached(size_t step, const QueryContext& context) const;
 
   /**
-   * @brief Perform a database lookup of cached results and deserialize.
+   * @brief Retrieve fresh cached results for a query context.
    *
-   * If a query determined the table's cached results are fresh, it may ask the
-   * table to retrieve results from the database and deserialized them into
-   * table row data.
+   * Results are held in memory in their native form. When the cache is full
+   * and `--table_cache_spill` is set, results are kept in the database and
+   * deserialized here.
    *
-   * @return The deserialized row data of cached results.
+   * @param step The current schedule step.
+   * @param context The query context used to generate results.
+   * @param results Output of the cached row data.
+   * @return True if fresh results were found, this counts as a cache hit.
    */
-  QueryData getCache() const;
+  bool getCache(size_t step, const QueryContext& context, QueryData& results);
 
   /// Similar to TablePlugin::getCache, if TablePlugin::generate is called.
-  void setCache(size_t step, size_t interval, const QueryData& results);
+  void setCache(size_t step,
+                size_t interval,
+                const QueryContext& context,
+                const QueryData& results);
+
+  /**
+   * @brief Retrieve results generated by this table within the current boot.
+   *
+   * Tables marked boot_cacheable, such as `cpuid`, report the same
+   * data until the system reboots. Their results are stored in the database
+   * for each QueryContext::cacheKey along with the boot identity and osquery
+   * version that generated them, and are served inside and outside of the
+   * schedule, and across osquery restarts.
+   *
+   * @param context The query context used to generate results.
+   * @param results Output of the cached row data.
+   * @return True if results from this boot were found.
+   */
+  bool getBootCache(const QueryContext& context, QueryData& results);
+
+  /// Similar to TablePlugin::getBootCache, if TablePlugin::generate is called.
+  void setBootCache(const QueryContext& context, const QueryData& results);
+
+ public:
+  /**
+   * @brief Seconds that cached results remain fresh.
+   *
+   * Tables declaring a cache_ttl in their spec override this. The default, 0,
+   * keeps results for the interval of the query that generated them.
+   */
+  virtual size_t cacheTTL() const {
+    return 0;
+  }
+
+  /**
+   * @brief A token that changes whenever the table's content may change.
+   *
+   * Tables reading rarely changing state, such as a package database, may
+   * return a cheap identity of that state. The scheduler skips a differential
+   * query when every table it scanned reports the same generation as the
+   * query's previous execution. The default, empty, is always regenerated.
+   */
+  virtual std::string generation() const {
+    return "";
+  }
+
+  /// Statistics for this table's result cache.
+  TableCacheStats cacheStats() const;
+
+  /// Release the cached results held in memory, returns the bytes released.
+  size_t clearCache();
+
+  /**
+   * @brief Check if the table's complete results may be generated ahead.
+   *
+   * Tables with required columns, event-based, utility, and batch tables
+   * cannot be warmed.
+   */
+  bool canWarm() const;
+
+  /**
+   * @brief Generate the table's complete results for later queries.
+   *
+   * Tables in the `--table_warm_set` are generated in the background without
+   * constraints. Queries outside of the schedule, such as distributed
+   * queries, read these results instead of generating their own. SQLite
+   * applies each query's constraints to the rows.
+   *
+   * @param lifetime The number of seconds the results remain fresh.
+   */
+  Status warmCache(size_t lifetime);
+
+  /**
+   * @brief Retrieve fresh warm results usable for a query context.
+   *
+   * Warm results are not used within the schedule, or when the context
+   * constrains a column that changes the meaning of the table.
+   *
+   * @param context The query context used to generate results.
+   * @param results Output of the warm row data.
+   * @return True if fresh results were found.
+   */
+  bool getWarmCache(const QueryContext& context, QueryData& results);
 
  private:
-  /// The last time in seconds the table data results were saved to cache.
-  size_t last_cached_{0};
+  /// Cached results for a single context key.
+  struct CacheEntry {
+    /// The schedule step when the results were generated.
+    size_t step{0};
+
+    /// The number of steps the results remain fresh.
+    size_t lifetime{0};
+
+    /// The results, empty if they were spilled to the database.
+    QueryData results;
+
+    /// The approximate in-memory size of the results.
+    size_t bytes{0};
+
+    /// The results are stored in the database.
+    bool spilled{false};
+  };
+
+  /// Remove an entry and its spilled content, the cache lock must be held.
+  void eraseCache(std::map<std::string, CacheEntry>::iterator it);
+
+ private:
+  /// Cached results keyed by QueryContext::cacheKey.
+  std::map<std::string, CacheEntry> cache_;
+
+  /// Warm results, the step is the time in seconds they were generated.
+  CacheEntry warm_;
+
+  /// Lookups returning fresh results, and lookups that missed.
+  std::atomic<size_t> cache_hits_{0};
+  std::atomic<size_t> cache_misses_{0};
 
-  /// The last interval in seconds when the table data was cached.
-  size_t last_interval_{0};
+  /// Protect the cached results from concurrent scheduled queries.
+  mutable Mutex cache_mutex_;
 
  public:
   /**
    * @brief The scheduled interval for the executing query.
    *
-   * Scheduled queries execute within a pseudo-mutex, and each may communicate
-   * their scheduled interval to internal TablePlugin implementations. If the
-   * table is cachable then the interval can be used to calculate freshness.
+   * Scheduled queries may execute concurrently on schedule workers, and each
+   * communicates its scheduled interval to internal TablePlugin implementations
+   * on the executing thread. If the table is cachable then the interval can be
+   * used to calculate freshness.
    */
-  static size_t kCacheInterval;
+  static thread_local size_t kCacheInterval;
 
   /// The schedule step, this is the current position of the schedule.
-  static size_t kCacheStep;
+  static thread_local size_t kCacheStep;
 
  public:
   /**
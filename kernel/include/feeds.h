@@ -28,7 +28,7 @@
  *  A daemon may only connect to a kernel with the same communication version.
  *  Bump this number when changing or adding any event structs.
  */
-#define OSQUERY_KERNEL_COMMUNICATION_VERSION 4
+#define OSQUERY_KERNEL_COMMUNICATION_VERSION 7
 #ifdef KERNEL_TEST
 #define OSQUERY_KERNEL_COMM_VERSION \
   (OSQUERY_KERNEL_COMMUNICATION_VERSION | (1UL << 63))
@@ -36,6 +36,12 @@
 #define OSQUERY_KERNEL_COMM_VERSION (OSQUERY_KERNEL_COMMUNICATION_VERSION | 0UL)
 #endif
 
+/// The maximum number of per-CPU rings in the shared buffer.
+#define OSQUERY_MAX_CQUEUE_RINGS 64
+
+/// The maximum number of filters the kernel holds for each event type.
+#define OSQUERY_MAX_EVENT_FILTERS 32
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -122,10 +128,19 @@ typedef struct {
   char path[MAXPATHLEN];
 } osquery_file_event_t;
 
+/** @brief A subscription predicate evaluated in the kernel.
+ *
+ *  An event matches a filter if it matches every predicate of the filter.  An
+ *  event type with filters only publishes events matching at least one.
+ */
 typedef struct {
+  /// File actions to match, OSQUERY_FILE_ACTION_NONE matches any action.
   osquery_file_action_t actions;
+  /// Real user ID to match, negative matches any user.
+  int64_t uid;
+  /// Path prefix to match, empty matches any path.
   char path[MAXPATHLEN];
-} osquery_file_event_subscription_t;
+} osquery_event_filter_t;
 
 #ifdef KERNEL_TEST
 typedef struct {
@@ -148,6 +163,8 @@ typedef struct {
   uint32_t time;
   /// System uptime in seconds.
   uint32_t uptime;
+  /// Microseconds of the calendar time, used to merge the rings in order.
+  uint32_t time_usec;
 } osquery_event_time_t;
 
 typedef struct {
@@ -170,6 +187,13 @@ typedef struct {
   int subscribe;
 } osquery_subscription_args_t;
 
+typedef struct {
+  osquery_event_t event;
+  // Remove the event's filters instead of adding the filter.
+  int clear;
+  osquery_event_filter_t filter;
+} osquery_event_filter_args_t;
+
 // Flags for buffer sync options.
 enum osquery_options {
   OSQUERY_OPTIONS_DEFAULT = 0,
@@ -180,11 +204,17 @@ typedef struct {
   // Option such as OSQUERY_NO_BLOCK.
   int options;
 
-  // Offset of daemon read pointer.
-  size_t read_offset;
+  // Block until at least this many bytes are readable, 0 for any data.
+  size_t watermark;
+
+  // Maximum milliseconds to block for the watermark, 0 for no limit.
+  uint32_t timeout_ms;
+
+  // Offset of daemon read pointer within each ring.
+  size_t read_offset[OSQUERY_MAX_CQUEUE_RINGS];
 
-  // (Output) Offset of max_read pointer.
-  size_t max_read_offset;
+  // (Output) Offset of max_read pointer within each ring.
+  size_t max_read_offset[OSQUERY_MAX_CQUEUE_RINGS];
 
   // (Output) Number of drops or negative on overflow.
   int drops;
@@ -197,6 +227,10 @@ typedef struct {
   void *buffer;
   // osquery kernel communication version.
   uint64_t version;
+  // Requested number of per-CPU rings, (Output) the number allocated.
+  uint32_t rings;
+  // (Output) Size of each ring, ring N starts at N * ring_size.
+  size_t ring_size;
 } osquery_buf_allocate_args_t;
 
 // TODO: Choose a proper IOCTL num.
@@ -211,6 +245,8 @@ typedef struct {
 #ifdef KERNEL_TEST
 #define OSQUERY_IOCTL_TEST _IOW(OSQUERY_IOCTL_NUM, 0x4, int)
 #endif // KERNEL_TEST
+#define OSQUERY_IOCTL_FILTER \
+  _IOW(OSQUERY_IOCTL_NUM, 0x5, osquery_event_filter_args_t)
 
 #ifdef __cplusplus
 } // end extern "c"
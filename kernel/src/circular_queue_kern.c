@@ -13,9 +13,13 @@
 #include <sys/proc.h>
 
 #include <kern/assert.h>
+#include <kern/cpu_number.h>
 
 #include "circular_queue_kern.h"
 
+/// Rings are never smaller than this many bytes.
+#define MIN_RING_SIZE (8 * (1 << 10))
+
 static inline void setup_queue_locks(osquery_cqueue_t *queue) {
   /* Create locks.  Cannot be done on the stack. */
   queue->lck_grp_attr = lck_grp_attr_alloc_init();
@@ -26,9 +30,15 @@ static inline void setup_queue_locks(osquery_cqueue_t *queue) {
   queue->lck_attr = lck_attr_alloc_init();
 
   queue->lck = lck_spin_alloc_init(queue->lck_grp, queue->lck_attr);
+  for (int i = 0; i < OSQUERY_MAX_CQUEUE_RINGS; i++) {
+    queue->rings[i].lck = lck_spin_alloc_init(queue->lck_grp, queue->lck_attr);
+  }
 }
 
 static inline void teardown_queue_locks(osquery_cqueue_t *queue) {
+  for (int i = 0; i < OSQUERY_MAX_CQUEUE_RINGS; i++) {
+    lck_spin_free(queue->rings[i].lck, queue->lck_grp);
+  }
   lck_spin_free(queue->lck, queue->lck_grp);
 
   lck_attr_free(queue->lck_attr);
@@ -38,18 +48,18 @@ static inline void teardown_queue_locks(osquery_cqueue_t *queue) {
   lck_grp_attr_free(queue->lck_grp_attr);
 }
 
-static inline void *advance_pointer(osquery_cqueue_t *queue, void *ptr,
+static inline void *advance_pointer(osquery_cqueue_ring_t *ring, void *ptr,
                                     size_t bytes) {
-  return ((uint8_t *)ptr + bytes - queue->buffer) % queue->size + queue->buffer;
+  return ((uint8_t *)ptr + bytes - ring->buffer) % ring->size + ring->buffer;
 }
 
-static inline size_t get_distance(osquery_cqueue_t *queue, void *lower,
+static inline size_t get_distance(osquery_cqueue_ring_t *ring, void *lower,
                                   void *upper, int cannot_be_empty) {
   ssize_t size = (uint8_t *)upper - (uint8_t *)lower;
   if (size == 0) {
-    return cannot_be_empty ? queue->size : 0;
+    return cannot_be_empty ? ring->size : 0;
   } else if (size < 0) {
-    return queue->size + size;
+    return ring->size + size;
   } else {
     return size;
   }
@@ -62,12 +72,12 @@ typedef enum {
   OSQUERY_NOT_IN_BUFFER = 1 << 2
 } osquery_between_t;
 
-static inline osquery_between_t is_between(osquery_cqueue_t *queue, void *ptr,
-                                           void *lower, void *upper,
+static inline osquery_between_t is_between(osquery_cqueue_ring_t *ring,
+                                           void *ptr, void *lower, void *upper,
                                            size_t size) {
   osquery_between_t b = OSQUERY_BETWEEN_INIT;
-  if (ptr < (void *)queue->buffer
-      || ((uint8_t *)ptr) + size > (queue->buffer + queue->size)) {
+  if (ptr < (void *)ring->buffer
+      || ((uint8_t *)ptr) + size > (ring->buffer + ring->size)) {
     b |= OSQUERY_NOT_IN_BUFFER;
   }
 
@@ -75,7 +85,8 @@ static inline osquery_between_t is_between(osquery_cqueue_t *queue, void *ptr,
       && ((void *)(((uint8_t *)ptr) + size)) <= upper) {
     b |= OSQUERY_BETWEEN;
   } else if (upper < lower
-             && (((void *)(((uint8_t *)ptr) + size)) <= upper || lower <= ptr)) {
+             && (((void *)(((uint8_t *)ptr) + size)) <= upper
+                 || lower <= ptr)) {
     b |= OSQUERY_BETWEEN;
   } else {
     b |= OSQUERY_NOT_BETWEEN;
@@ -84,9 +95,56 @@ static inline osquery_between_t is_between(osquery_cqueue_t *queue, void *ptr,
   return b;
 }
 
+/** @brief Find the ring containing a reserved space.
+ *
+ *  @param queue The queue the space was reserved in.
+ *  @param space The space returned by osquery_cqueue_reserve.
+ *  @return The ring, NULL if the space is not within the queue's buffer.
+ */
+static inline osquery_cqueue_ring_t *find_ring(osquery_cqueue_t *queue,
+                                               void *space) {
+  if (queue->ring_count == 0 || (uint8_t *)space < queue->buffer) {
+    return NULL;
+  }
+
+  size_t index = ((uint8_t *)space - queue->buffer) / queue->rings[0].size;
+  if (index >= queue->ring_count) {
+    return NULL;
+  }
+  return &queue->rings[index];
+}
+
+/** @brief Wake a waiting reader if the readable space crossed its watermark.
+ *
+ *  Called by a ring, which never holds the queue lock while taking its own,
+ *  after adding readable space.
+ *
+ *  @param queue The queue the readable space was added to.
+ *  @return Void.
+ */
+static inline void wakeup_reader(osquery_cqueue_t *queue) {
+  SInt64 watermark = queue->wakeup_watermark;
+  if (watermark == 0 || queue->readable < watermark) {
+    return;
+  }
+
+  // The reader sets the watermark before checking the readable space.
+  lck_spin_lock(queue->lck);
+  if (queue->wakeup_watermark > 0 &&
+      queue->readable >= queue->wakeup_watermark) {
+    queue->wakeup_watermark = 0;
+    wakeup(&queue->readable);
+  }
+  lck_spin_unlock(queue->lck);
+}
+
 void osquery_cqueue_setup(osquery_cqueue_t *queue) {
   queue->last_destruction_time = 0;
   queue->initialized = 0;
+  queue->ring_count = 0;
+  for (int i = 0; i < OSQUERY_MAX_CQUEUE_RINGS; i++) {
+    queue->rings[i].initialized = 0;
+  }
   setup_queue_locks(queue);
 }
 
@@ -114,102 +172,198 @@ int osquery_cqueue_teardown(osquery_cqueue_t *queue) {
   }
 }
 
-void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size) {
+size_t osquery_cqueue_init(osquery_cqueue_t *queue,
+                           void *buffer,
+                           size_t size,
+                           uint32_t rings) {
+  // Each ring must hold several of the largest events.
+  if (rings > OSQUERY_MAX_CQUEUE_RINGS) {
+    rings = OSQUERY_MAX_CQUEUE_RINGS;
+  }
+  while (rings > 1 && size / rings < MIN_RING_SIZE) {
+    rings--;
+  }
+  if (rings == 0) {
+    rings = 1;
+  }
+  size_t ring_size = (size / rings) & ~((size_t)(sizeof(uint64_t) - 1));
+
   lck_spin_lock(queue->lck);
   queue->buffer = (uint8_t *)buffer;
   queue->size = size;
-
-  queue->write = queue->buffer;
-  queue->max_read = queue->buffer;
-  queue->read = queue->buffer;
-
-  queue->drops = 0;
+  queue->ring_count = rings;
+  queue->readable = 0;
+  queue->wakeup_watermark = 0;
   queue->initialized = 1;
-  queue->reservations = 0;
   lck_spin_unlock(queue->lck);
+
+  for (uint32_t i = 0; i < rings; i++) {
+    osquery_cqueue_ring_t *ring = &queue->rings[i];
+    lck_spin_lock(ring->lck);
+    ring->buffer = queue->buffer + i * ring_size;
+    ring->size = ring_size;
+
+    ring->write = ring->buffer;
+    ring->max_read = ring->buffer;
+    ring->read = ring->buffer;
+
+    ring->drops = 0;
+    ring->initialized = 1;
+    ring->reservations = 0;
+    lck_spin_unlock(ring->lck);
+  }
+
+  return ring_size;
 }
 
 void osquery_cqueue_destroy(osquery_cqueue_t *queue) {
   lck_spin_lock(queue->lck);
-  if (queue->initialized) {
-    queue->initialized = 0;
+  if (!queue->initialized) {
+    lck_spin_unlock(queue->lck);
+    return;
+  }
+  queue->initialized = 0;
+
+  // A waiting reader must notice the queue is no longer initialized.
+  wakeup(&queue->readable);
+  lck_spin_unlock(queue->lck);
 
-    while (queue->reservations > 0) {
-      lck_spin_sleep(queue->lck, LCK_SLEEP_DEFAULT, &queue->reservations,
+  for (uint32_t i = 0; i < queue->ring_count; i++) {
+    osquery_cqueue_ring_t *ring = &queue->rings[i];
+    lck_spin_lock(ring->lck);
+    ring->initialized = 0;
+    while (ring->reservations > 0) {
+      lck_spin_sleep(ring->lck, LCK_SLEEP_DEFAULT, &ring->reservations,
                      THREAD_UNINT);
     }
-
-    // Time is recorded so we can fail cqueue_teardown (destruction of cqueue
-    // locks) for a short period of time.  This should allow pending event
-    // callbacks to notice ths cqueue has been unitialized and error out before
-    // the locks become unusable.
-    clock_usec_t micro_sec;
-    clock_get_system_microtime(&queue->last_destruction_time, &micro_sec);
+    lck_spin_unlock(ring->lck);
   }
 
+  // Time is recorded so we can fail cqueue_teardown (destruction of cqueue
+  // locks) for a short period of time.  This should allow pending event
+  // callbacks to notice ths cqueue has been unitialized and error out before
+  // the locks become unusable.
+  lck_spin_lock(queue->lck);
+  clock_usec_t micro_sec;
+  clock_get_system_microtime(&queue->last_destruction_time, &micro_sec);
   lck_spin_unlock(queue->lck);
 }
 
-int osquery_cqueue_advance_read(osquery_cqueue_t *queue, size_t read_offset,
+int osquery_cqueue_advance_read(osquery_cqueue_t *queue,
+                                const size_t *read_offset,
                                 size_t *max_read_offset) {
   int err = 0;
-  lck_spin_lock(queue->lck);
+  for (uint32_t i = 0; i < queue->ring_count; i++) {
+    osquery_cqueue_ring_t *ring = &queue->rings[i];
+    lck_spin_lock(ring->lck);
+    if (!ring->initialized) {
+      lck_spin_unlock(ring->lck);
+      return -1;
+    }
 
-  if (!queue->initialized) {
-    err = -1;
-    goto error_exit;
-  }
+    uint8_t *new_read = ring->buffer + read_offset[i];
+    if (read_offset[i] > ring->size) {
+      new_read = ring->max_read;
+      err = -1;
+    } else if (OSQUERY_BETWEEN != is_between(ring, new_read, ring->read,
+                                             ring->max_read, 0)) {
+      new_read = ring->max_read;
+      err = -1;
+    }
 
-  uint8_t *new_read = queue->buffer + read_offset;
-  if (OSQUERY_BETWEEN == is_between(queue, new_read, queue->read,
-                                    queue->max_read, 0)) {
-    queue->read = new_read;
-  } else {
-    queue->read = queue->max_read;
-    err = -1;
+    // The space between the old and new read heads is no longer readable.
+    OSAddAtomic64(-(SInt64)get_distance(ring, ring->read, new_read, 0),
+                  &queue->readable);
+    ring->read = new_read;
+    max_read_offset[i] = ring->max_read - ring->buffer;
+    lck_spin_unlock(ring->lck);
   }
-  *max_read_offset = queue->max_read - queue->buffer;
-
-error_exit:
-  lck_spin_unlock(queue->lck);
 
   return err;
 }
 
-ssize_t osquery_cqueue_wait_for_data(osquery_cqueue_t *queue) {
-  ssize_t offset = 0;
+/// Read each ring's max_read offset.
+static inline int get_max_read(osquery_cqueue_t *queue,
+                               size_t *max_read_offset) {
+  for (uint32_t i = 0; i < queue->ring_count; i++) {
+    osquery_cqueue_ring_t *ring = &queue->rings[i];
+    lck_spin_lock(ring->lck);
+    if (!ring->initialized) {
+      lck_spin_unlock(ring->lck);
+      return -1;
+    }
+    max_read_offset[i] = ring->max_read - ring->buffer;
+    lck_spin_unlock(ring->lck);
+  }
+  return 0;
+}
+
+int osquery_cqueue_wait_for_data(osquery_cqueue_t *queue,
+                                 size_t watermark,
+                                 uint32_t timeout_ms,
+                                 size_t *max_read_offset) {
   lck_spin_lock(queue->lck);
 
   if (!queue->initialized) {
-    offset = -1;
-    goto error_exit;
+    lck_spin_unlock(queue->lck);
+    return -1;
+  }
+
+  // Never wait for more than half of a ring, writers would drop events.
+  if (watermark == 0) {
+    watermark = 1;
+  } else if (watermark > queue->rings[0].size / 2) {
+    watermark = queue->rings[0].size / 2;
+  }
+
+  uint64_t deadline = 0;
+  if (timeout_ms > 0) {
+    clock_interval_to_deadline(timeout_ms, kMillisecondScale, &deadline);
   }
 
   wait_result_t wait_result = THREAD_AWAKENED;
-  while (wait_result == THREAD_AWAKENED && queue->max_read == queue->read) {
-    wait_result = lck_spin_sleep(queue->lck, LCK_SLEEP_DEFAULT,
-                                 &queue->max_read, THREAD_ABORTSAFE);
+  while (wait_result == THREAD_AWAKENED && queue->initialized) {
+    // Set the watermark before checking, a ring adding space after the check
+    // then finds the watermark and wakes this reader.
+    queue->wakeup_watermark = watermark;
+    OSSynchronizeIO();
+    if (queue->readable >= (SInt64)watermark) {
+      break;
+    }
+
+    if (deadline > 0) {
+      wait_result = lck_spin_sleep_deadline(queue->lck, LCK_SLEEP_DEFAULT,
+                                            &queue->readable, THREAD_ABORTSAFE,
+                                            deadline);
+    } else {
+      wait_result = lck_spin_sleep(queue->lck, LCK_SLEEP_DEFAULT,
+                                   &queue->readable, THREAD_ABORTSAFE);
+    }
   }
-  offset = queue->max_read - queue->buffer;
+  queue->wakeup_watermark = 0;
 
-error_exit:
+  int initialized = queue->initialized;
   lck_spin_unlock(queue->lck);
-  return offset;
+  if (!initialized) {
+    return -1;
+  }
+  return get_max_read(queue, max_read_offset);
 }
 
 int osquery_cqueue_dropped_data(osquery_cqueue_t *queue) {
-  int drops;
-  lck_spin_lock(queue->lck);
-  if (!queue->initialized) {
-    drops = -1;
-    goto error_exit;
-  }
-
-  drops = queue->drops;
-  queue->drops = 0;
+  int drops = 0;
+  for (uint32_t i = 0; i < queue->ring_count; i++) {
+    osquery_cqueue_ring_t *ring = &queue->rings[i];
+    lck_spin_lock(ring->lck);
+    if (!ring->initialized) {
+      lck_spin_unlock(ring->lck);
+      return -1;
+    }
 
-error_exit:
-  lck_spin_unlock(queue->lck);
+    drops += ring->drops;
+    ring->drops = 0;
+    lck_spin_unlock(ring->lck);
+  }
 
   return drops;
 }
@@ -218,8 +372,15 @@ void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
                              osquery_event_t event,
                              size_t size) {
   void *ret = NULL;
-  lck_spin_lock(queue->lck);
-  if (!queue->initialized) {
+  uint32_t ring_count = queue->ring_count;
+  if (ring_count == 0) {
+    return NULL;
+  }
+
+  // The thread may migrate to another CPU, the ring is only a locality hint.
+  osquery_cqueue_ring_t *ring = &queue->rings[cpu_number() % ring_count];
+  lck_spin_lock(ring->lck);
+  if (!ring->initialized) {
     ret = NULL;
     goto error_exit;
   }
@@ -232,25 +393,25 @@ void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
   // We do not want the write pointer to ever equal the read pointer unless
   // everything is empty.  Otherwise we need to track the empty states for the
   // buffer.
-  if (get_distance(queue, queue->write, queue->read, 1) > size) {
-    if (get_distance(queue, queue->write,
-                     queue->buffer + queue->size, 0) >= size) {
+  if (get_distance(ring, ring->write, ring->read, 1) > size) {
+    if (get_distance(ring, ring->write,
+                     ring->buffer + ring->size, 0) >= size) {
       // We can fit the allocation by advancing the write pointer.
-      header = (osquery_data_header_t *)queue->write;
-      queue->write = (uint8_t *)advance_pointer(queue, queue->write, size);
-    } else if (get_distance(queue, queue->buffer, queue->read, 0) > size) {
+      header = (osquery_data_header_t *)ring->write;
+      ring->write = (uint8_t *)advance_pointer(ring, ring->write, size);
+    } else if (get_distance(ring, ring->buffer, ring->read, 0) > size) {
       // We can fit the allocation by wrapping the write pointer.
-      if (get_distance(queue, queue->write, queue->buffer + queue->size, 0)
+      if (get_distance(ring, ring->write, ring->buffer + ring->size, 0)
           >= sizeof(osquery_data_header_t)) {
         // Signal a Null event ie. jump to beginning of buf.  If there
         // is not enough room to do so, this is ok because it will know to
         // skip to the beginning of the buffer based on the amount of space
         // left.
-        header = (osquery_data_header_t *)queue->write;
+        header = (osquery_data_header_t *)ring->write;
         header->event = END_OF_BUFFER_EVENT;
       }
-      header = (osquery_data_header_t *)queue->buffer;
-      queue->write = (uint8_t *)advance_pointer(queue, queue->buffer, size);
+      header = (osquery_data_header_t *)ring->buffer;
+      ring->write = (uint8_t *)advance_pointer(ring, ring->buffer, size);
     }
   }
 
@@ -261,15 +422,15 @@ void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
 
     // Give them the pointer to the space not the header.
     ret = (void *)(header + 1);
-    queue->reservations++;
+    ring->reservations++;
   } else {
-    if (queue->drops >= 0) {
-      queue->drops += 1;
+    if (ring->drops >= 0) {
+      ring->drops += 1;
     }
     ret = NULL;
   }
 error_exit:
-  lck_spin_unlock(queue->lck);
+  lck_spin_unlock(ring->lck);
 
   return ret;
 }
@@ -277,47 +438,60 @@ error_exit:
 /** @brief Turn blocks that have been commited into readable space for user
  *  level process.
  *
- *  REQUIRES the lock.
+ *  REQUIRES the ring lock.
  *
- *  @param queue The queue to create readable space in.
- *  @return Void.
+ *  @param queue The queue the ring belongs to.
+ *  @param ring The ring to create readable space in.
+ *  @return The number of bytes made readable.
  */
-static inline void coalesce_readable(osquery_cqueue_t *queue) {
-  osquery_data_header_t *header = (osquery_data_header_t *)queue->max_read;
+static inline size_t coalesce_readable(osquery_cqueue_t *queue,
+                                       osquery_cqueue_ring_t *ring) {
+  osquery_data_header_t *header = (osquery_data_header_t *)ring->max_read;
   osquery_between_t b;
+  size_t readable = 0;
 
-  while (OSQUERY_BETWEEN & (b = is_between(queue, header, queue->max_read,
-                                       queue->write, sizeof(osquery_data_header_t)))) {
+  while (OSQUERY_BETWEEN &
+         (b = is_between(ring, header, ring->max_read, ring->write,
+                         sizeof(osquery_data_header_t)))) {
     if (b & OSQUERY_NOT_IN_BUFFER || header->event == END_OF_BUFFER_EVENT) {
-      queue->max_read = queue->buffer;
-      header = (osquery_data_header_t *)queue->max_read;
+      // The skipped space at the end of the ring is read past.
+      readable += get_distance(ring, ring->max_read,
+                               ring->buffer + ring->size, 0);
+      ring->max_read = ring->buffer;
+      header = (osquery_data_header_t *)ring->max_read;
       continue;
     } else if (!header->finished) {
       break;
     }
 
-    queue->max_read = (uint8_t *)advance_pointer(
-        queue, queue->max_read, header->size + sizeof(osquery_data_header_t));
-
-    header = (osquery_data_header_t *)queue->max_read;
-    wakeup(&queue->max_read);
+    size_t size = header->size + sizeof(osquery_data_header_t);
+    ring->max_read = (uint8_t *)advance_pointer(ring, ring->max_read, size);
+    readable += size;
 
-    lck_spin_unlock(queue->lck);
-    lck_spin_lock(queue->lck);
+    header = (osquery_data_header_t *)ring->max_read;
   }
+
+  OSAddAtomic64((SInt64)readable, &queue->readable);
+  return readable;
 }
 
 int osquery_cqueue_commit(osquery_cqueue_t *queue, void *space) {
   int err = 0;
+  size_t readable = 0;
 
-  lck_spin_lock(queue->lck);
+  osquery_cqueue_ring_t *ring = find_ring(queue, space);
+  if (ring == NULL) {
+    return -1; // Invalid space.
+  }
+
+  lck_spin_lock(ring->lck);
 
   // Retrieve the header for the initialized space.
   osquery_data_header_t *header = ((osquery_data_header_t *)space) - 1;
-  if (OSQUERY_BETWEEN != is_between(queue, header, queue->max_read,
-                                    queue->write,
+  if (OSQUERY_BETWEEN != is_between(ring, header, ring->max_read,
+                                    ring->write,
                                     sizeof(osquery_data_header_t)) ||
-      queue->reservations == 0 || header->event == END_OF_BUFFER_EVENT ||
+      ring->reservations == 0 || header->event == END_OF_BUFFER_EVENT ||
       header->finished) {
     err = -1;  // Invalid space.
     goto error_exit;
@@ -328,15 +502,19 @@ int osquery_cqueue_commit(osquery_cqueue_t *queue, void *space) {
   clock_usec_t microsecs;
   clock_get_calendar_microtime(&seconds, &microsecs);
   header->time.time = (uint64_t)seconds;
+  header->time.time_usec = (uint32_t)microsecs;
   clock_get_system_microtime(&seconds, &microsecs);
   header->time.uptime = (uint64_t)seconds;
 
-  coalesce_readable(queue);
+  readable = coalesce_readable(queue, ring);
 
-  queue->reservations--;
-  wakeup(&queue->reservations);
+  ring->reservations--;
+  wakeup(&ring->reservations);
 error_exit:
-  lck_spin_unlock(queue->lck);
+  lck_spin_unlock(ring->lck);
+
+  if (readable > 0) {
+    wakeup_reader(queue);
+  }
   return err;
 }
-
@@ -24,6 +24,7 @@
 #include <sys/lock.h>
 
 #include <kern/clock.h>
+#include <libkern/OSAtomic.h>
 
 #include <feeds.h>
 
@@ -31,7 +32,7 @@
 extern "C" {
 #endif
 
-// Circular queue data structure.
+// A ring of the circular queue, written by the CPUs mapped to it.
 typedef struct {
   uint8_t *buffer;
   size_t size;
@@ -41,11 +42,30 @@ typedef struct {
   int drops;
   int initialized;
   uint32_t reservations;
+
+  lck_spin_t *lck;
+} osquery_cqueue_ring_t;
+
+// Circular queue data structure, a set of per-CPU rings.
+typedef struct {
+  uint8_t *buffer;
+  size_t size;
+  osquery_cqueue_ring_t rings[OSQUERY_MAX_CQUEUE_RINGS];
+  uint32_t ring_count;
+  int initialized;
   clock_sec_t last_destruction_time;
 
+  // Readable bytes in every ring, updated atomically by the rings.
+  volatile SInt64 readable;
+
+  // Readable bytes that wake a waiting reader, 0 if no reader is waiting.
+  volatile SInt64 wakeup_watermark;
+
   lck_grp_attr_t *lck_grp_attr;
   lck_grp_t *lck_grp;
   lck_attr_t *lck_attr;
+
+  // Protects the queue state and the reader's wait, never held by a ring.
   lck_spin_t *lck;
 } osquery_cqueue_t;
 
@@ -73,13 +93,19 @@ int osquery_cqueue_teardown(osquery_cqueue_t *queue);
 /** @brief Initialize a circular queue.
  *
  *  Initializes a circular queue given a preallocated buffer of a given size.
+ *  The buffer is split into equally sized rings, and each CPU reserves space
+ *  in the ring of its CPU number, so CPUs do not contend on a single lock.
  *
  *  @param queue The circular queue structure to initialize.
  *  @param buffer The buffer to use in the queue.
  *  @param size The size of the passed in buffer.
- *  @return Void.
+ *  @param rings The number of rings, at most OSQUERY_MAX_CQUEUE_RINGS.
+ *  @return The size of each ring.
  */
-void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size);
+size_t osquery_cqueue_init(osquery_cqueue_t *queue,
+                           void *buffer,
+                           size_t size,
+                           uint32_t rings);
 
 
 /** @brief Cleanup a cqueue.
@@ -99,23 +125,34 @@ void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size);
 void osquery_cqueue_destroy(osquery_cqueue_t *queue);
 
 
-/** @brief Advance the read head in the buffer.
+/** @brief Advance the read head of each ring in the buffer.
  *
- *  @param queue The circular queue structure to advance the read head in.
- *  @param read_offset Offset of pointer to new location of read head.
- *  @param max_read_offset (Output) Output the offset of the max_read pointer.
+ *  @param queue The circular queue structure to advance the read heads in.
+ *  @param read_offset Offsets of the new read heads within each ring.
+ *  @param max_read_offset (Output) The offsets of each ring's max_read.
  *  @return Return negative on failure (invalid offset).
  */
-int osquery_cqueue_advance_read(osquery_cqueue_t *queue, size_t read_offset,
+int osquery_cqueue_advance_read(osquery_cqueue_t *queue,
+                                const size_t *read_offset,
                                 size_t *max_read_offset);
 
 
-/** @brief Find the position of the max_read pointer.  Block if buffer is empty.
+/** @brief Find the max_read pointers of the rings.  Block if all are empty.
+ *
+ *  The reader is only woken once the readable space crosses the watermark,
+ *  so a burst of small events does not wake the daemon for each event.  The
+ *  timeout bounds the latency of events below the watermark.
  *
- *  @param queue The queue to find the offset of the max_read pointer in.
- *  @return Return offset of max_read pointer.  Negative on failure.
+ *  @param queue The queue to find the offsets of the max_read pointers in.
+ *  @param watermark Readable bytes to wait for, 0 waits for any data.
+ *  @param timeout_ms Maximum milliseconds to wait, 0 for no limit.
+ *  @param max_read_offset (Output) The offsets of each ring's max_read.
+ *  @return Return negative on failure.
  */
-ssize_t osquery_cqueue_wait_for_data(osquery_cqueue_t *queue);
+int osquery_cqueue_wait_for_data(osquery_cqueue_t *queue,
+                                 size_t watermark,
+                                 uint32_t timeout_ms,
+                                 size_t *max_read_offset);
 
 /** @brief Returns if the cqueue has dropped data.
  *
@@ -128,6 +165,7 @@ int osquery_cqueue_dropped_data(osquery_cqueue_t *queue);
 
 /** @brief Reserve space to store an event in the queue.
  *
+ *  The space is reserved in the ring of the calling CPU.
  *  This gives you a brief moment to write data to the returned space.
  *  NOTE: You must call the commit function on your pointer shortly after
  *  reserving it.  Otherwise the buffer will become deadlocked.
@@ -0,0 +1,115 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <libkern/libkern.h>
+
+#include <kern/locks.h>
+
+#include "event_filters.h"
+
+typedef struct {
+  osquery_event_filter_t filters[OSQUERY_MAX_EVENT_FILTERS];
+  size_t path_lengths[OSQUERY_MAX_EVENT_FILTERS];
+  uint32_t count;
+} osquery_event_filter_table_t;
+
+static struct {
+  osquery_event_filter_table_t tables[OSQUERY_NUM_EVENTS];
+
+  lck_grp_attr_t *lck_grp_attr;
+  lck_grp_t *lck_grp;
+  lck_attr_t *lck_attr;
+
+  // Publishers match while holding a shared lock, the daemon edits exclusive.
+  lck_rw_t *lck;
+} filters;
+
+void osquery_event_filters_setup() {
+  filters.lck_grp_attr = lck_grp_attr_alloc_init();
+  filters.lck_grp =
+      lck_grp_alloc_init("osquery event filters", filters.lck_grp_attr);
+  filters.lck_attr = lck_attr_alloc_init();
+  filters.lck = lck_rw_alloc_init(filters.lck_grp, filters.lck_attr);
+
+  for (int i = 0; i < OSQUERY_NUM_EVENTS; i++) {
+    filters.tables[i].count = 0;
+  }
+}
+
+void osquery_event_filters_teardown() {
+  lck_rw_free(filters.lck, filters.lck_grp);
+  lck_attr_free(filters.lck_attr);
+  lck_grp_free(filters.lck_grp);
+  lck_grp_attr_free(filters.lck_grp_attr);
+}
+
+int osquery_event_filters_add(osquery_event_t event,
+                              const osquery_event_filter_t *filter) {
+  if (!(OSQUERY_NULL_EVENT < event && event < OSQUERY_NUM_EVENTS)) {
+    return -1;
+  }
+
+  int err = 0;
+  lck_rw_lock_exclusive(filters.lck);
+  osquery_event_filter_table_t *table = &filters.tables[event];
+  if (table->count >= OSQUERY_MAX_EVENT_FILTERS) {
+    err = -1;
+  } else {
+    table->filters[table->count] = *filter;
+    // The daemon's path may not be terminated.
+    table->filters[table->count].path[MAXPATHLEN - 1] = '\0';
+    table->path_lengths[table->count] =
+        strnlen(table->filters[table->count].path, MAXPATHLEN);
+    table->count++;
+  }
+  lck_rw_unlock_exclusive(filters.lck);
+  return err;
+}
+
+void osquery_event_filters_clear(osquery_event_t event) {
+  if (!(OSQUERY_NULL_EVENT < event && event < OSQUERY_NUM_EVENTS)) {
+    return;
+  }
+
+  lck_rw_lock_exclusive(filters.lck);
+  filters.tables[event].count = 0;
+  lck_rw_unlock_exclusive(filters.lck);
+}
+
+int osquery_event_filters_match(osquery_event_t event,
+                                const char *path,
+                                osquery_file_action_t action,
+                                uint64_t uid) {
+  if (!(OSQUERY_NULL_EVENT < event && event < OSQUERY_NUM_EVENTS)) {
+    return 0;
+  }
+
+  lck_rw_lock_shared(filters.lck);
+  osquery_event_filter_table_t *table = &filters.tables[event];
+  int matched = (table->count == 0);
+  for (uint32_t i = 0; i < table->count && !matched; i++) {
+    osquery_event_filter_t *filter = &table->filters[i];
+    if (filter->actions != OSQUERY_FILE_ACTION_NONE &&
+        !(filter->actions & action)) {
+      continue;
+    }
+    if (filter->uid >= 0 && (uint64_t)filter->uid != uid) {
+      continue;
+    }
+    if (table->path_lengths[i] > 0 &&
+        (path == NULL ||
+         strncmp(path, filter->path, table->path_lengths[i]) != 0)) {
+      continue;
+    }
+    matched = 1;
+  }
+  lck_rw_unlock_shared(filters.lck);
+  return matched;
+}
@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+/** @brief Event filters pushed down from daemon subscriptions.
+ *
+ *  Each event type has a small table of filters.  A publisher asks the table
+ *  whether an event matches before reserving queue space, so events no
+ *  subscriber wants never consume the shared buffer.  An event type without
+ *  filters matches every event.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/lock.h>
+
+#include <feeds.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Setup the event filter tables and their lock.
+ *
+ *  @return Void.
+ */
+void osquery_event_filters_setup();
+
+/** @brief Teardown the event filter tables and their lock.
+ *
+ *  @return Void.
+ */
+void osquery_event_filters_teardown();
+
+/** @brief Add a filter to an event type's table.
+ *
+ *  @param event The event type to filter.
+ *  @param filter The filter, any of its predicates may be a wildcard.
+ *  @return 0 on success.  Negative if the event type or table is invalid/full.
+ */
+int osquery_event_filters_add(osquery_event_t event,
+                              const osquery_event_filter_t *filter);
+
+/** @brief Remove all filters of an event type, every event then matches.
+ *
+ *  @param event The event type to clear the filters of.
+ *  @return Void.
+ */
+void osquery_event_filters_clear(osquery_event_t event);
+
+/** @brief Check if an event matches any filter of its event type.
+ *
+ *  @param event The event type.
+ *  @param path The event's path, may be NULL if the event has no path.
+ *  @param action The file action, OSQUERY_FILE_ACTION_NONE if not a file event.
+ *  @param uid The real user ID of the event.
+ *  @return 1 if the event should be published, 0 if it is discarded.
+ */
+int osquery_event_filters_match(osquery_event_t event,
+                                const char *path,
+                                osquery_file_action_t action,
+                                uint64_t uid);
+
+#ifdef __cplusplus
+}  // end extern "c"
+#endif
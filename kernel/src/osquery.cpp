@@ -24,6 +24,7 @@
 #include "publishers.h"
 
 #include "circular_queue_kern.h"
+#include "event_filters.h"
 
 #ifdef DEBUG
 #define dbg_printf(...) printf("osquery kext: " __VA_ARGS__)
@@ -108,6 +109,7 @@ static void unsubscribe_all_events() {
     if (osquery_publishers[i]) {
       osquery_publishers[i]->unsubscribe();
     }
+    osquery_event_filters_clear((osquery_event_t)i);
   }
 }
 
@@ -133,8 +135,27 @@ static int subscribe_to_event(osquery_event_t event, int subscribe) {
   return 0;
 }
 
+static int filter_event(osquery_event_t event,
+                        int clear,
+                        const osquery_event_filter_t *filter) {
+  if (!(OSQUERY_NULL_EVENT < event && event < OSQUERY_NUM_EVENTS)) {
+    return -EINVAL;
+  }
+
+  if (clear) {
+    osquery_event_filters_clear(event);
+  } else if (osquery_event_filters_add(event, filter)) {
+    // The filter table is full, the daemon should stop filtering this event.
+    return -ENOSPC;
+  }
+
+  return 0;
+}
+
 static int update_user_kernel_buffer(int options,
-                                     size_t read_offset,
+                                     const size_t *read_offset,
+                                     size_t watermark,
+                                     uint32_t timeout_ms,
                                      size_t *max_read_offset,
                                      int *drops) {
   if (osquery_cqueue_advance_read(
@@ -142,12 +163,10 @@ static int update_user_kernel_buffer(int options,
     return -EINVAL;
   }
   if (!(options & OSQUERY_OPTIONS_NO_BLOCK)) {
-    ssize_t offset = 0;
-    if ((offset = osquery_cqueue_wait_for_data(&osquery.cqueue)) < 0) {
+    if (osquery_cqueue_wait_for_data(
+            &osquery.cqueue, watermark, timeout_ms, max_read_offset) < 0) {
       return -EINVAL;
     }
-
-    *max_read_offset = offset;
   }
   *drops = osquery_cqueue_dropped_data(&osquery.cqueue);
   return 0;
@@ -172,7 +191,10 @@ static void cleanup_user_kernel_buffer() {
   }
 }
 
-static int allocate_user_kernel_buffer(size_t size, void **buf) {
+static int allocate_user_kernel_buffer(size_t size,
+                                       void **buf,
+                                       uint32_t *rings,
+                                       size_t *ring_size) {
   int err = 0;
 
   // The user space daemon is requesting a new circular queue.
@@ -217,7 +239,10 @@ static int allocate_user_kernel_buffer(size_t size, void **buf) {
   // The virtual address will be shared back to the user space queue manager.
   *buf = (void *)osquery.mm->getAddress();
   // Initialize the kernel space queue manager with the new buffer.
-  osquery_cqueue_init(&osquery.cqueue, osquery.buffer, osquery.buf_size);
+  // The rings are clamped to the buffer size, report the rings allocated.
+  *ring_size = osquery_cqueue_init(
+      &osquery.cqueue, osquery.buffer, osquery.buf_size, *rings);
+  *rings = osquery.cqueue.ring_count;
 
   return 0;
 error_exit:
@@ -301,6 +326,7 @@ static int osquery_ioctl(
 
   int err = 0;
   osquery_subscription_args_t *sub = NULL;
+  osquery_event_filter_args_t *filter = NULL;
   osquery_buf_sync_args_t *sync = NULL;
   osquery_buf_allocate_args_t *alloc = NULL;
 
@@ -316,6 +342,14 @@ static int osquery_ioctl(
     }
     break;
 
+  // Daemon is replacing the filters evaluated before events are queued.
+  case OSQUERY_IOCTL_FILTER:
+    filter = (osquery_event_filter_args_t *)data;
+    if ((err = filter_event(filter->event, filter->clear, &(filter->filter)))) {
+      goto error_exit;
+    }
+    break;
+
   // Daemon is requesting a synchronization of readable queue space.
   case OSQUERY_IOCTL_BUF_SYNC:
     // The queue buffer cannot be synchronized if it has not been allocated.
@@ -329,7 +363,9 @@ static int osquery_ioctl(
     sync = (osquery_buf_sync_args_t *)data;
     if ((err = update_user_kernel_buffer(sync->options,
                                          sync->read_offset,
-                                         &(sync->max_read_offset),
+                                         sync->watermark,
+                                         sync->timeout_ms,
+                                         sync->max_read_offset,
                                          &(sync->drops)))) {
       lck_mtx_lock(osquery.mtx);
       goto error_exit;
@@ -355,12 +391,17 @@ static int osquery_ioctl(
     }
 
     // Attempt to allocation and set up the circular queue.
-    if ((err = allocate_user_kernel_buffer(alloc->size, &(alloc->buffer)))) {
+    if ((err = allocate_user_kernel_buffer(alloc->size,
+                                           &(alloc->buffer),
+                                           &(alloc->rings),
+                                           &(alloc->ring_size)))) {
       goto error_exit;
     }
 
-    dbg_printf(
-        "IOCTL alloc: size %lu, location %p\n", alloc->size, alloc->buffer);
+    dbg_printf("IOCTL alloc: size %lu, location %p, rings %u\n",
+               alloc->size,
+               alloc->buffer,
+               alloc->rings);
     break;
   default:
     err = -ENOTTY;
@@ -399,6 +440,9 @@ kern_return_t OsqueryStart(kmod_info_t *ki, void *d) {
   // This does not allocate, share, or set the queue buffer or buffer values.
   osquery_cqueue_setup(&osquery.cqueue);
 
+  // Setup the subscription filters evaluated by the publishers.
+  osquery_event_filters_setup();
+
   // Initialize the IOCTL (and more) device node.
   osquery.major_number = cdevsw_add(osquery.major_number, &osquery_cdevsw);
   if (osquery.major_number < 0) {
@@ -439,6 +483,7 @@ error_exit:
 
   // Reset the queue and remove the queue locks.
   osquery_cqueue_teardown(&osquery.cqueue);
+  osquery_event_filters_teardown();
   return KERN_FAILURE;
 }
 
@@ -460,6 +505,9 @@ kern_return_t OsqueryStop(kmod_info_t *ki, void *d) {
     return KERN_FAILURE;
   }
 
+  // The publishers stopped with the queue, no filter is being matched.
+  osquery_event_filters_teardown();
+
   // Remove the device node.
   devfs_remove(osquery.devfs);
   osquery.devfs = NULL;
@@ -17,6 +17,7 @@
 #include <security/mac.h>
 #include <security/mac_policy.h>
 
+#include "event_filters.h"
 #include "publishers.h"
 
 static osquery_cqueue_t *cqueue = NULL;
@@ -54,6 +55,18 @@ static int process_cred_label_update_execvew(kauth_cred_t old_cred,
     goto error_exit;
   }
 
+  // Discard the event before reserving space if no subscription matches.
+  char path[MAXPATHLEN];
+  if (vn_getpath(vp, path, &path_len) != 0) {
+    path[0] = '\0';
+  }
+  if (!osquery_event_filters_match(OSQUERY_PROCESS_EVENT,
+                                   path,
+                                   OSQUERY_FILE_ACTION_NONE,
+                                   kauth_cred_getruid(new_cred))) {
+    goto error_exit;
+  }
+
   // Determine address of image_params based off of csflags pointer. (HACKY)
   struct image_params *img =
       (struct image_params *)((char *)csflags -
@@ -129,7 +142,7 @@ static int process_cred_label_update_execvew(kauth_cred_t old_cred,
   e->gid = kauth_cred_getrgid(new_cred);
   e->egid = kauth_cred_getgid(new_cred);
 
-  vn_getpath(vp, e->path, &path_len);
+  memcpy(e->path, path, MAXPATHLEN);
 
   osquery_cqueue_commit(cqueue, e);
 error_exit:
@@ -21,6 +21,10 @@ struct InternalExtensionInfo {
   2:string version,
   3:string sdk_version,
   4:string min_sdk_version,
+  /// The name of a shared memory segment offered for table pages.
+  5:optional string shared_memory,
+  /// The size in bytes of the shared memory segment.
+  6:optional i64 shared_size,
 }
 
 /// Unique ID for each extension.
@@ -46,9 +50,39 @@ struct ExtensionStatus {
   3:ExtensionRouteUUID uuid,
 }
 
+/// Rows encoded by column, each column name is sent once.
+struct ExtensionColumnarResponse {
+  /// The union of column names across every row.
+  1:list<string> columns,
+  /// The values of each column, in row order, parallel to columns.
+  2:list<list<string>> values,
+  /// For a column index, the indexes of rows that do not include the column.
+  3:map<i32, list<i32>> absent,
+  /// The number of rows, which may not include any columns.
+  4:i32 rows,
+}
+
 struct ExtensionResponse {
   1:ExtensionStatus status,
   2:ExtensionPluginResponse response,
+  /// Set instead of response when the request included a response_format of
+  /// "columnar" and the receiver supports it.
+  3:optional ExtensionColumnarResponse columnar,
+}
+
+/// Identifies an open table generation cursor within an extension.
+typedef i64 ExtensionCursorID
+
+/// A page of generated table rows.
+struct ExtensionCursorResponse {
+  1:ExtensionStatus status,
+  /// The cursor used to request the next page.
+  2:ExtensionCursorID cursor,
+  3:ExtensionColumnarResponse rows,
+  /// True if the table has no more rows, the cursor has been released.
+  4:bool done,
+  /// Set instead of rows when the page was written to a shared memory slot.
+  5:optional i32 shared_slot,
 }
 
 exception ExtensionException {
@@ -70,6 +104,20 @@ service Extension {
     3:ExtensionPluginRequest request),
   /// Request that an extension shutdown (does not apply to managers).
   void shutdown(),
+  /// Start generating a table, returning a first page of at most rows.
+  ExtensionCursorResponse generateOpen(
+    /// The table plugin name.
+    1:string table,
+    /// The thrift-equivilent of a table's generate PluginRequest.
+    2:ExtensionPluginRequest request,
+    3:i32 rows),
+  /// Return the next page of at most rows from a cursor.
+  ExtensionCursorResponse generateNext(
+    1:ExtensionCursorID cursor,
+    2:i32 rows),
+  /// Release a cursor before its table has no more rows.
+  ExtensionStatus generateClose(
+    1:ExtensionCursorID cursor),
 }
 
 /// The extension manager is run by the osquery core process.
@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sstream>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/config.h>
+
+#include "osquery/core/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/// Create a config with packs of queries, about 10KB for each pack.
+static std::string getPacksConfig(size_t packs) {
+  std::string json = "{\"options\": {\"host_identifier\": \"uuid\"}, ";
+  json += "\"packs\": {";
+  for (size_t p = 0; p < packs; p++) {
+    json += (p > 0) ? ", " : "";
+    json += "\"pack" + std::to_string(p) + "\": {\"platform\": \"posix\", ";
+    json += "\"queries\": {";
+    for (size_t q = 0; q < 100; q++) {
+      json += (q > 0) ? ", " : "";
+      json += "\"query" + std::to_string(q) + "\": {\"query\": \"SELECT * ";
+      json += "FROM processes WHERE name = 'p" + std::to_string(q) + "'\", ";
+      json += "\"interval\": 3600, \"removed\": false}";
+    }
+    json += "}}";
+  }
+  json += "}}";
+  return json;
+}
+
+static void CONFIG_parse_read_json(benchmark::State& state) {
+  auto json = getPacksConfig(state.range_x());
+  while (state.KeepRunning()) {
+    pt::ptree tree;
+    std::stringstream input(json);
+    pt::read_json(input, tree);
+  }
+}
+
+BENCHMARK(CONFIG_parse_read_json)->Arg(1)->Arg(50)->Arg(500);
+
+static void CONFIG_parse(benchmark::State& state) {
+  auto json = getPacksConfig(state.range_x());
+  while (state.KeepRunning()) {
+    pt::ptree tree;
+    parseJSONTree(json, tree);
+  }
+}
+
+BENCHMARK(CONFIG_parse)->Arg(1)->Arg(50)->Arg(500);
+
+static void CONFIG_update(benchmark::State& state) {
+  auto json = getPacksConfig(state.range_x());
+  while (state.KeepRunning()) {
+    Config::getInstance().update({{"benchmark", json}});
+  }
+  Config::getInstance().update({{"benchmark", "{}"}});
+}
+
+BENCHMARK(CONFIG_update)->Arg(1)->Arg(50);
+}
@@ -8,10 +8,12 @@
  *
  */
 
+#include <algorithm>
 #include <chrono>
 #include <mutex>
 #include <random>
 
+#include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/trim.hpp>
 
@@ -27,6 +29,7 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
+#include "osquery/database/query.h"
 
 namespace pt = boost::property_tree;
 
@@ -79,6 +82,14 @@ DECLARE_bool(disable_events);
 const std::string kExecutingQuery{"executing_query"};
 const std::string kFailedQueries{"failed_queries"};
 
+/// Number of schedule steps kept for the osquery_schedule_load table.
+const size_t kScheduleLoadSteps{300};
+
+const size_t kQueryPerformanceSamples{64};
+
+/// The scheduled query started on the calling thread.
+static thread_local std::string kCurrentQuery;
+
 // The config may be accessed and updated asynchronously; use mutexes.
 Mutex config_hash_mutex_;
 Mutex config_valid_mutex_;
@@ -124,8 +135,57 @@ class Schedule : private boost::noncopyable {
 
   /// Add a pack to the schedule
   void add(PackRef&& pack) {
+    add(std::move(pack), "");
+  }
+
+  /// Add a pack and the hash of its content.
+  void add(PackRef&& pack, const std::string& hash) {
+    auto key = getKey(pack->getName(), pack->getSource());
     remove(pack->getName(), pack->getSource());
     packs_.push_back(pack);
+    hashes_[key] = hash;
+    stale_.erase(key);
+  }
+
+  /**
+   * @brief Keep an existing pack if its content is unchanged.
+   *
+   * A kept pack retains its discovery cache and statistics.
+   *
+   * @return true if the pack exists with the same content hash.
+   */
+  bool keep(const std::string& pack,
+            const std::string& source,
+            const std::string& hash) {
+    auto key = getKey(pack, source);
+    if (hash.empty() || hashes_.count(key) == 0 || hashes_[key] != hash) {
+      return false;
+    }
+    stale_.erase(key);
+    return true;
+  }
+
+  /// Mark every pack from a source as stale before the source is updated.
+  void markStale(const std::string& source) {
+    for (const auto& pack : packs_) {
+      if (pack->getSource() == source) {
+        stale_.insert(getKey(pack->getName(), source));
+      }
+    }
+  }
+
+  /// Remove the packs that were not added or kept since they were marked.
+  void removeStale(const std::string& source) {
+    packs_.remove_if([this, &source](PackRef& p) {
+      auto key = getKey(p->getName(), p->getSource());
+      if (p->getSource() == source && stale_.count(key) > 0) {
+        Config::getInstance().removeFiles(key);
+        hashes_.erase(key);
+        return true;
+      }
+      return false;
+    });
+    stale_.clear();
   }
 
   /// Remove a pack, by name.
@@ -135,10 +195,11 @@ class Schedule : private boost::noncopyable {
 
   /// Remove a pack by name and source.
   void remove(const std::string& pack, const std::string& source) {
-    packs_.remove_if([pack, source](PackRef& p) {
+    packs_.remove_if([this, pack, source](PackRef& p) {
       if (p->getName() == pack && (p->getSource() == source || source == "")) {
         Config::getInstance().removeFiles(source + FLAGS_pack_delimiter +
                                           p->getName());
+        hashes_.erase(getKey(p->getName(), p->getSource()));
         return true;
       }
       return false;
@@ -147,10 +208,11 @@ class Schedule : private boost::noncopyable {
 
   /// Remove all packs by source.
   void removeAll(const std::string& source) {
-    packs_.remove_if(([source](PackRef& p) {
+    packs_.remove_if(([this, source](PackRef& p) {
       if (p->getSource() == source) {
         Config::getInstance().removeFiles(source + FLAGS_pack_delimiter +
                                           p->getName());
+        hashes_.erase(getKey(p->getName(), source));
         return true;
       }
       return false;
@@ -172,10 +234,26 @@ class Schedule : private boost::noncopyable {
     return packs_.back();
   }
 
+ private:
+  /// The key of a pack, also used for the pack's files.
+  static std::string getKey(const std::string& pack,
+                            const std::string& source) {
+    return source + FLAGS_pack_delimiter + pack;
+  }
+
  private:
   /// Underlying storage for the packs
   container packs_;
 
+  /// The content hash of each pack, by key.
+  std::map<std::string, std::string> hashes_;
+
+  /// Packs from a source being updated that were not yet added again.
+  std::set<std::string> stale_;
+
+  /// Sources that included packs generated by the config plugin.
+  std::set<std::string> generated_;
+
   /**
    * @brief The schedule will check and record previously executing queries.
    *
@@ -237,12 +315,15 @@ Schedule::Schedule() {
   restoreScheduleBlacklist(blacklist_);
 
   // Check if any queries were executing when the tool last stopped.
+  // Concurrent schedules record every executing query, comma-separated.
   getDatabaseValue(kPersistentSettings, kExecutingQuery, failed_query_);
   if (!failed_query_.empty()) {
     LOG(WARNING) << "Scheduled query may have failed: " << failed_query_;
     setDatabaseValue(kPersistentSettings, kExecutingQuery, "");
-    // Add this query name to the blacklist and save the blacklist.
-    blacklist_[failed_query_] = getUnixTime() + 86400;
+    // Add these query names to the blacklist and save the blacklist.
+    for (const auto& name : osquery::split(failed_query_, ",")) {
+      blacklist_[name] = getUnixTime() + 86400;
+    }
     saveScheduleBlacklist(blacklist_);
   }
 }
@@ -252,14 +333,33 @@ Config::Config()
       valid_(false),
       start_time_(std::time(nullptr)) {}
 
+/// Hash the content of a pack, or return empty if it cannot be serialized.
+static std::string getPackHash(const pt::ptree& tree) {
+  std::stringstream stream;
+  try {
+    pt::write_json(stream, tree, false);
+  } catch (const pt::json_parser::json_parser_error& /* e */) {
+    return "";
+  }
+  auto content = stream.str();
+  return getBufferSHA1(content.c_str(), content.size());
+}
+
 void Config::addPack(const std::string& name,
                      const std::string& source,
                      const pt::ptree& tree) {
   auto addSinglePack = ([this, &source](const std::string pack_name,
                                         const pt::ptree& pack_tree) {
+    // An unchanged pack keeps its state, such as the discovery cache.
+    auto hash = getPackHash(pack_tree);
     RecursiveLock wlock(config_schedule_mutex_);
+    if (schedule_->keep(pack_name, source, hash)) {
+      return;
+    }
+
     try {
-      schedule_->add(std::make_shared<Pack>(pack_name, source, pack_tree));
+      schedule_->add(std::make_shared<Pack>(pack_name, source, pack_tree),
+                     hash);
       if (schedule_->last()->shouldPackExecute()) {
         applyParsers(
             source + FLAGS_pack_delimiter + pack_name, pack_tree, true);
@@ -362,12 +462,11 @@ Status Config::refresh() {
     status = update(response[0]);
 
     /*
-     * If the initial configuration includes a non-0 refresh, start an
-     * additional service that sleeps and periodically regenerates the
-     * configuration.
+     * If the initial configuration includes a non-0 refresh, add a dispatcher
+     * task that periodically regenerates the configuration.
      */
     if (!started_thread_ && FLAGS_config_refresh >= 1) {
-      Dispatcher::addService(std::make_shared<ConfigRefreshRunner>());
+      Dispatcher::addTask(refreshTask, FLAGS_config_refresh * 1000);
       started_thread_ = true;
     }
   }
@@ -410,22 +509,23 @@ Status Config::updateSource(const std::string& source,
 
   {
     RecursiveLock lock(config_schedule_mutex_);
-    // Remove all packs from this source.
-    schedule_->removeAll(source);
+    // Packs from this source are removed unless they are added again.
+    schedule_->markStale(source);
+    schedule_->generated_.erase(source);
     // Remove all files from this source.
     removeFiles(source);
   }
 
   // load the config (source.second) into a pt::ptree
   pt::ptree tree;
-  try {
+  {
     auto clone = json;
     stripConfigComments(clone);
-    std::stringstream json_stream;
-    json_stream << clone;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& /* e */) {
-    return Status(1, "Error parsing the config JSON");
+    if (!parseJSONTree(clone, tree).ok()) {
+      RecursiveLock lock(config_schedule_mutex_);
+      schedule_->removeStale(source);
+      return Status(1, "Error parsing the config JSON");
+    }
   }
 
   // extract the "schedule" key and store it as the main pack
@@ -443,6 +543,8 @@ Status Config::updateSource(const std::string& source,
     for (const std::pair<std::string, pt::ptree>& query : scheduled_queries) {
       auto query_name = query.second.get<std::string>("name", "");
       if (query_name.empty()) {
+        RecursiveLock lock(config_schedule_mutex_);
+        schedule_->removeStale(source);
         return Status(1, "Error getting name from legacy scheduled query");
       }
       queries.add_child(query_name, query.second);
@@ -466,6 +568,11 @@ Status Config::updateSource(const std::string& source,
     }
   }
 
+  {
+    RecursiveLock lock(config_schedule_mutex_);
+    schedule_->removeStale(source);
+  }
+
   applyParsers(source, tree, false);
   return Status(0, "OK");
 }
@@ -475,6 +582,12 @@ Status Config::genPack(const std::string& name,
                        const std::string& target) {
   // If the pack value is a string (and not a JSON object) then it is a
   // resource to be handled by the config plugin.
+  {
+    // The source must be updated again, even if its content is unchanged.
+    RecursiveLock lock(config_schedule_mutex_);
+    schedule_->generated_.insert(source);
+  }
+
   PluginResponse response;
   PluginRequest request = {
       {"action", "genPack"}, {"name", name}, {"value", target}};
@@ -484,15 +597,12 @@ Status Config::genPack(const std::string& name,
     return Status(1, "Invalid plugin response");
   }
 
-  try {
-    auto clone = response[0][name];
-    stripConfigComments(clone);
-    pt::ptree pack_tree;
-    std::stringstream pack_stream;
-    pack_stream << clone;
-    pt::read_json(pack_stream, pack_tree);
+  auto clone = response[0][name];
+  stripConfigComments(clone);
+  pt::ptree pack_tree;
+  if (parseJSONTree(clone, pack_tree).ok()) {
     addPack(name, source, pack_tree);
-  } catch (const pt::json_parser::json_parser_error& /* e */) {
+  } else {
     LOG(WARNING) << "Error parsing the pack JSON: " << name;
   }
   return Status(0);
@@ -548,6 +658,22 @@ Status Config::update(const std::map<std::string, std::string>& config) {
     }
   }
 
+  // A periodic refresh usually returns the same content, skip the update if
+  // every source is unchanged and none generate packs.
+  if (loaded_ && isUnchanged(config)) {
+    VLOG(1) << "Configuration content is unchanged";
+    return Status(0, "OK");
+  }
+
+  // Event publishers are only reconfigured if a parser's data or the
+  // monitored files changed.
+  auto parsers = getParserData();
+  std::map<std::string, FileCategories> previous_files;
+  {
+    RecursiveLock lock(config_files_mutex_);
+    previous_files = files_;
+  }
+
   // Iterate though each source and overwrite config data.
   // This will add/overwrite pack data, append to the schedule, change watched
   // files, set options, etc.
@@ -561,6 +687,12 @@ Status Config::update(const std::map<std::string, std::string>& config) {
     }
   }
 
+  bool events_changed = (parsers != getParserData());
+  {
+    RecursiveLock lock(config_files_mutex_);
+    events_changed = events_changed || (previous_files != files_);
+  }
+
   if (loaded_) {
     // The config has since been loaded.
     // This update call is most likely a response to an async update request
@@ -574,7 +706,7 @@ Status Config::update(const std::map<std::string, std::string>& config) {
     }
 
     // If events are enabled configure the subscribers before publishers.
-    if (!FLAGS_disable_events) {
+    if (!FLAGS_disable_events && events_changed) {
       RegistryFactory::get().registry("event_subscriber")->configure();
       RegistryFactory::get().registry("event_publisher")->configure();
     }
@@ -583,10 +715,53 @@ Status Config::update(const std::map<std::string, std::string>& config) {
   return Status(0, "OK");
 }
 
+bool Config::isUnchanged(const std::map<std::string, std::string>& config) {
+  {
+    RecursiveLock lock(config_schedule_mutex_);
+    for (const auto& source : config) {
+      if (schedule_->generated_.count(source.first) > 0) {
+        return false;
+      }
+    }
+  }
+
+  WriteLock lock(config_hash_mutex_);
+  for (const auto& source : config) {
+    auto hash = hash_.find(source.first);
+    if (hash == hash_.end() ||
+        hash->second != getBufferSHA1(source.second.c_str(),
+                                      source.second.size())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::map<std::string, pt::ptree> Config::getParserData() const {
+  RecursiveLock lock(config_schedule_mutex_);
+  std::map<std::string, pt::ptree> data;
+  for (const auto& plugin : RegistryFactory::get().plugins("config_parser")) {
+    auto parser = std::dynamic_pointer_cast<ConfigParserPlugin>(plugin.second);
+    if (parser != nullptr) {
+      data[plugin.first] = parser->getData();
+    }
+  }
+  return data;
+}
+
 void Config::purge() {
   // The first use of purge is removing expired query results.
-  std::vector<std::string> saved_queries;
-  scanDatabaseKeys(kQueries, saved_queries);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kQueries, keys);
+
+  // Keys stored with a query's results expire with the query.
+  std::set<std::string> saved_queries;
+  for (const auto& key : keys) {
+    std::string name;
+    if (Query::getStoredQueryName(key, name)) {
+      saved_queries.insert(name);
+    }
+  }
 
   const auto& schedule = this->schedule_;
   auto queryExists = [&schedule](const std::string& query_name) {
@@ -629,7 +804,7 @@ void Config::purge() {
 
     if (last_executed < getUnixTime() - 592200) {
       // Query has not run in the last week, expire results and interval.
-      deleteDatabaseValue(kQueries, saved_query);
+      Query::deletePreviousResults(saved_query);
       deleteDatabaseValue(kPersistentSettings, "interval." + saved_query);
       deleteDatabaseValue(kPersistentSettings, "timestamp." + saved_query);
       VLOG(1) << "Expiring results for scheduled query: " << saved_query;
@@ -640,6 +815,8 @@ void Config::purge() {
 void Config::reset() {
   schedule_ = std::make_shared<Schedule>();
   std::map<std::string, QueryPerformance>().swap(performance_);
+  std::set<std::string>().swap(executing_);
+  std::deque<ScheduleLoad>().swap(schedule_load_);
   std::map<std::string, FileCategories>().swap(files_);
   std::map<std::string, std::string>().swap(hash_);
   valid_ = false;
@@ -668,11 +845,25 @@ void ConfigParserPlugin::reset() {
   }
 }
 
-void Config::recordQueryPerformance(const std::string& name,
-                                    size_t delay,
-                                    size_t size,
-                                    const Row& r0,
-                                    const Row& r1) {
+uint64_t getPercentile(std::vector<uint64_t> values, size_t percentile) {
+  if (values.empty()) {
+    return 0;
+  }
+
+  // The nearest rank is the ceiling of the percentile's share of the values.
+  auto rank = (std::min<size_t>(percentile, 100) * values.size() + 99) / 100;
+  auto nth = values.begin() + ((rank > 0) ? rank - 1 : 0);
+  std::nth_element(values.begin(), nth, values.end());
+  return *nth;
+}
+
+void Config::recordQueryPerformance(
+    const std::string& name,
+    size_t size,
+    const ResourceUsage& r0,
+    const ResourceUsage& r1,
+    size_t rows,
+    const std::map<std::string, TableCost>& tables) {
   RecursiveLock lock(config_performance_mutex_);
   if (performance_.count(name) == 0) {
     performance_[name] = QueryPerformance();
@@ -680,45 +871,62 @@ void Config::recordQueryPerformance(const std::string& name,
 
   // Grab access to the non-const schedule item.
   auto& query = performance_.at(name);
-  BIGINT_LITERAL diff = 0;
-  if (!r1.at("user_time").empty() && !r0.at("user_time").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("user_time")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("user_time"));
-    if (diff > 0) {
-      query.user_time += diff;
-    }
+  if (r1.user_time > r0.user_time) {
+    query.user_time += r1.user_time - r0.user_time;
   }
 
-  if (!r1.at("system_time").empty() && !r0.at("system_time").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("system_time")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("system_time"));
-    if (diff > 0) {
-      query.system_time += diff;
-    }
+  if (r1.system_time > r0.system_time) {
+    query.system_time += r1.system_time - r0.system_time;
   }
 
-  if (!r1.at("resident_size").empty() && !r0.at("resident_size").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("resident_size")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("resident_size"));
-    if (diff > 0) {
-      // Memory is stored as an average of RSS changes between query executions.
-      query.average_memory = (query.average_memory * query.executions) + diff;
-      query.average_memory = (query.average_memory / (query.executions + 1));
-    }
+  if (r1.resident_size > r0.resident_size) {
+    // Memory is stored as an average of RSS changes between query executions.
+    auto diff = r1.resident_size - r0.resident_size;
+    query.average_memory = (query.average_memory * query.executions) + diff;
+    query.average_memory = (query.average_memory / (query.executions + 1));
   }
 
-  query.wall_time += delay;
+  QueryExecution execution;
+  if (r1.wall_time > r0.wall_time) {
+    execution.wall_time = r1.wall_time - r0.wall_time;
+    query.wall_time += execution.wall_time;
+  }
   query.output_size += size;
+  query.rows += rows;
   query.executions += 1;
   query.last_executed = getUnixTime();
 
+  execution.rows = rows;
+  execution.output_size = size;
+  query.recent.push_back(execution);
+  if (query.recent.size() > kQueryPerformanceSamples) {
+    query.recent.pop_front();
+  }
+
+  for (const auto& table : tables) {
+    auto& cost = query.tables[table.first];
+    cost.filters += table.second.filters;
+    cost.generate_time += table.second.generate_time;
+    cost.rows += table.second.rows;
+  }
+
   // Clear the executing query (remove the dirty bit).
-  setDatabaseValue(kPersistentSettings, kExecutingQuery, "");
+  executing_.erase(name);
+  auto executing = boost::algorithm::join(executing_, ",");
+  setDatabaseValue(kPersistentSettings, kExecutingQuery, executing);
+  kCurrentQuery.clear();
 }
 
 void Config::recordQueryStart(const std::string& name) {
-  // There should only ever be a single executing query in the schedule.
-  setDatabaseValue(kPersistentSettings, kExecutingQuery, name);
+  // Schedule workers may execute several queries, each is marked as dirty.
+  {
+    RecursiveLock lock(config_performance_mutex_);
+    executing_.insert(name);
+    auto executing = boost::algorithm::join(executing_, ",");
+    setDatabaseValue(kPersistentSettings, kExecutingQuery, executing);
+  }
+  kCurrentQuery = name;
+
   // Store the time this query name last executed for later results eviction.
   // When configuration updates occur the previous schedule is searched for
   // 'stale' query names, aka those that have week-old or longer last execute
@@ -727,6 +935,26 @@ void Config::recordQueryStart(const std::string& name) {
       kPersistentSettings, "timestamp." + name, std::to_string(getUnixTime()));
 }
 
+void Config::recordQueryDrift(const std::string& name, size_t drift) {
+  RecursiveLock lock(config_performance_mutex_);
+  performance_[name].drift += drift;
+}
+
+void Config::recordQueryTruncated(const std::string& name) {
+  RecursiveLock lock(config_performance_mutex_);
+  performance_[name].truncated++;
+}
+
+void Config::blacklistQuery(const std::string& name, size_t seconds) {
+  RecursiveLock lock(config_schedule_mutex_);
+  schedule_->blacklist_[name] = getUnixTime() + seconds;
+  saveScheduleBlacklist(schedule_->blacklist_);
+}
+
+const std::string& Config::getExecutingQuery() {
+  return kCurrentQuery;
+}
+
 void Config::getPerformanceStats(
     const std::string& name,
     std::function<void(const QueryPerformance& query)> predicate) {
@@ -736,6 +964,22 @@ void Config::getPerformanceStats(
   }
 }
 
+void Config::recordScheduleLoad(const ScheduleLoad& load) {
+  RecursiveLock lock(config_performance_mutex_);
+  schedule_load_.push_back(load);
+  if (schedule_load_.size() > kScheduleLoadSteps) {
+    schedule_load_.pop_front();
+  }
+}
+
+void Config::scheduleLoad(
+    std::function<void(const ScheduleLoad& load)> predicate) {
+  RecursiveLock lock(config_performance_mutex_);
+  for (const auto& load : schedule_load_) {
+    predicate(load);
+  }
+}
+
 void Config::hashSource(const std::string& source, const std::string& content) {
   WriteLock wlock(config_hash_mutex_);
   hash_[source] = getBufferSHA1(content.c_str(), content.size());
@@ -826,19 +1070,9 @@ Status ConfigParserPlugin::setUp() {
   return Status(0, "OK");
 }
 
-void ConfigRefreshRunner::start() {
-  while (!interrupted()) {
-    // Cool off and time wait the configured period.
-    // Apply this interruption initially as at t=0 the config was read.
-    pauseMilli(FLAGS_config_refresh * 1000);
-    // Since the pause occurs before the logic, we need to check for an
-    // interruption request.
-    if (interrupted()) {
-      return;
-    }
-
-    VLOG(1) << "Refreshing configuration state";
-    Config::getInstance().refresh();
-  }
+size_t Config::refreshTask() {
+  VLOG(1) << "Refreshing configuration state";
+  Config::getInstance().refresh();
+  return FLAGS_config_refresh * 1000;
 }
 }
@@ -40,6 +40,61 @@ FLAG(uint64,
 
 size_t kMaxQueryInterval = 604800;
 
+/// A discovery query result, and the time and generation it was run at.
+struct DiscoveryResult {
+  size_t time{0};
+  size_t generation{0};
+  bool result{false};
+};
+
+/// Discovery query results keyed by query text.
+static std::map<std::string, DiscoveryResult> kDiscoveryResults;
+
+/// Protects the discovery results, queries run without holding it.
+static Mutex kDiscoveryMutex;
+
+static std::atomic<size_t> kDiscoveryGeneration{0};
+
+bool DiscoveryCache::check(const std::string& query) {
+  size_t current = osquery::getUnixTime();
+  size_t generation = kDiscoveryGeneration;
+  {
+    ReadLock lock(kDiscoveryMutex);
+    auto it = kDiscoveryResults.find(query);
+    if (it != kDiscoveryResults.end() &&
+        it->second.generation == generation &&
+        (current - it->second.time) < FLAGS_pack_refresh_interval) {
+      return it->second.result;
+    }
+  }
+
+  DiscoveryResult entry;
+  entry.time = current;
+  entry.generation = generation;
+  SQL results(query);
+  if (!results.ok()) {
+    LOG(WARNING) << "Discovery query failed (" << query
+                 << "): " << results.getMessageString();
+  } else {
+    entry.result = (results.rows().size() > 0);
+  }
+
+  // An invalidation while the query ran leaves this entry expired.
+  WriteLock lock(kDiscoveryMutex);
+  kDiscoveryResults[query] = entry;
+  return entry.result;
+}
+
+void DiscoveryCache::invalidate() {
+  WriteLock lock(kDiscoveryMutex);
+  kDiscoveryResults.clear();
+  kDiscoveryGeneration++;
+}
+
+size_t DiscoveryCache::generation() {
+  return kDiscoveryGeneration;
+}
+
 size_t splayValue(size_t original, size_t splayPercent) {
   if (splayPercent == 0 || splayPercent > 100) {
     return original;
@@ -137,6 +192,18 @@ void Pack::initialize(const std::string& name,
     return;
   }
 
+  // Results of the pack's queries are forwarded in its priority class.
+  std::string priority;
+  if (tree.count("priority") > 0) {
+    priority = tree.get<std::string>("priority", "");
+    LogPriority parsed;
+    if (!getLogPriority(priority, parsed)) {
+      LOG(WARNING) << "Pack has invalid priority: " << name << ": "
+                   << priority;
+      priority.clear();
+    }
+  }
+
   discovery_queries_.clear();
   if (tree.count("discovery") > 0) {
     for (const auto& item : tree.get_child("discovery")) {
@@ -194,6 +261,9 @@ void Pack::initialize(const std::string& name,
     query.splayed_interval = restoreSplayedValue(q.first, query.interval);
     query.options["snapshot"] = q.second.get<bool>("snapshot", false);
     query.options["removed"] = q.second.get<bool>("removed", true);
+    query.options["low_priority"] = q.second.get<bool>("low_priority", false);
+    query.timeout = q.second.get<size_t>("timeout", 0);
+    query.priority = priority;
     schedule_[q.first] = query;
   }
 }
@@ -272,7 +342,9 @@ bool Pack::checkVersion(const std::string& version) const {
 bool Pack::checkDiscovery() {
   stats_.total++;
   size_t current = osquery::getUnixTime();
-  if ((current - discovery_cache_.first) < FLAGS_pack_refresh_interval) {
+  auto generation = DiscoveryCache::generation();
+  if (discovery_generation_ == generation &&
+      (current - discovery_cache_.first) < FLAGS_pack_refresh_interval) {
     stats_.hits++;
     return discovery_cache_.second;
   }
@@ -280,15 +352,9 @@ bool Pack::checkDiscovery() {
   stats_.misses++;
   discovery_cache_.first = current;
   discovery_cache_.second = true;
+  discovery_generation_ = generation;
   for (const auto& q : discovery_queries_) {
-    SQL results(q);
-    if (!results.ok()) {
-      LOG(WARNING) << "Discovery query failed (" << q
-                   << "): " << results.getMessageString();
-      discovery_cache_.second = false;
-      break;
-    }
-    if (results.rows().size() == 0) {
+    if (!DiscoveryCache::check(q)) {
       discovery_cache_.second = false;
       break;
     }
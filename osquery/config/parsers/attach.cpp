@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/config.h>
+#include <osquery/logger.h>
+
+#include "osquery/sql/attach.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/**
+ * @brief A ConfigParserPlugin for an "attach" dictionary key.
+ *
+ * Each key is a view name, with the "path" pattern of the SQLite databases
+ * and the "query" run against each, see AttachedDatabases.
+ */
+class AttachConfigParserPlugin : public ConfigParserPlugin {
+ public:
+  std::vector<std::string> keys() const override {
+    return {"attach"};
+  }
+
+  Status setUp() override;
+
+  Status update(const std::string& source, const ParserConfig& config) override;
+
+ private:
+  /// The sources of each config source.
+  std::map<std::string, std::map<std::string, AttachedDatabaseSource>>
+      sources_;
+};
+
+Status AttachConfigParserPlugin::setUp() {
+  data_.put_child("attach", pt::ptree());
+  return Status(0, "OK");
+}
+
+Status AttachConfigParserPlugin::update(const std::string& source,
+                                        const ParserConfig& config) {
+  auto& sources = sources_[source];
+  sources.clear();
+  if (config.count("attach") > 0) {
+    for (const auto& view : config.at("attach")) {
+      AttachedDatabaseSource attached;
+      attached.pattern = view.second.get<std::string>("path", "");
+      attached.query = view.second.get<std::string>("query", "");
+      if (attached.pattern.empty() || attached.query.empty()) {
+        LOG(WARNING) << "Attached database " << view.first
+                     << " requires a path and query";
+        continue;
+      }
+      sources[view.first] = std::move(attached);
+    }
+  }
+
+  std::map<std::string, AttachedDatabaseSource> merged;
+  for (const auto& config_source : sources_) {
+    merged.insert(config_source.second.begin(), config_source.second.end());
+  }
+
+  auto status = AttachedDatabases::set(merged);
+  if (!status.ok()) {
+    LOG(WARNING) << status.getMessage();
+  }
+  return status;
+}
+
+REGISTER_INTERNAL(AttachConfigParserPlugin, "config_parser", "attach");
+}
@@ -14,6 +14,7 @@
 #include <osquery/sql.h>
 
 #include "osquery/config/parsers/decorators.h"
+#include "osquery/core/json.h"
 
 namespace pt = boost::property_tree;
 
@@ -26,6 +27,11 @@ FLAG(bool,
      false,
      "Add decorators as top level JSON objects");
 
+FLAG(uint64,
+     decorators_always_interval,
+     1,
+     "Seconds the schedule reuses 'always' decorations, 0 to run per query");
+
 /// Statically define the parser name to avoid mistakes.
 #define PARSER_NAME "decorators"
 
@@ -102,12 +108,21 @@ class DecoratorsConfigParserPlugin : public ConfigParserPlugin {
 
   /// Protect the configuration controlled content.
   static Mutex kDecorationsConfigMutex;
+
+  /// The decorations serialized as JSON members, nullptr after a change.
+  static std::shared_ptr<const std::string> kDecorationsJSON;
+
+  /// The schedule time 'always' decorators last ran, 0 after a change.
+  static std::atomic<size_t> kAlwaysTime;
 };
 }
 
 DecorationStore DecoratorsConfigParserPlugin::kDecorations;
 Mutex DecoratorsConfigParserPlugin::kDecorationsMutex;
 Mutex DecoratorsConfigParserPlugin::kDecorationsConfigMutex;
+std::shared_ptr<const std::string>
+    DecoratorsConfigParserPlugin::kDecorationsJSON;
+std::atomic<size_t> DecoratorsConfigParserPlugin::kAlwaysTime{0};
 
 Status DecoratorsConfigParserPlugin::setUp() {
   // Decorators are kept within customized data structures.
@@ -199,7 +214,11 @@ inline void addDecoration(const std::string& source,
                           const std::string& name,
                           const std::string& value) {
   WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
-  DecoratorsConfigParserPlugin::kDecorations[source][name] = value;
+  auto& decoration = DecoratorsConfigParserPlugin::kDecorations[source][name];
+  if (decoration != value) {
+    decoration = value;
+    DecoratorsConfigParserPlugin::kDecorationsJSON = nullptr;
+  }
 }
 
 inline void runDecorators(const std::string& source,
@@ -225,6 +244,9 @@ inline void runDecorators(const std::string& source,
 void clearDecorations(const std::string& source) {
   WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
   DecoratorsConfigParserPlugin::kDecorations[source].clear();
+  DecoratorsConfigParserPlugin::kDecorationsJSON = nullptr;
+  // The schedule runs the source's 'always' decorators at its next step.
+  DecoratorsConfigParserPlugin::kAlwaysTime = 0;
 }
 
 void runDecorators(DecorationPoint point,
@@ -268,6 +290,61 @@ void runDecorators(DecorationPoint point,
   }
 }
 
+bool refreshDecorators(size_t time) {
+  if (FLAGS_decorators_always_interval == 0) {
+    return false;
+  }
+
+  auto last = DecoratorsConfigParserPlugin::kAlwaysTime.load();
+  if (last != 0 && time < last + FLAGS_decorators_always_interval) {
+    return false;
+  }
+  runDecorators(DECORATE_ALWAYS);
+  DecoratorsConfigParserPlugin::kAlwaysTime = time;
+  return true;
+}
+
+void getDecorations(QueryLogItem& item) {
+  if (FLAGS_disable_decorators) {
+    return;
+  }
+
+  if (FLAGS_decorations_top_level) {
+    // Top-level decorations may replace the fields of the log item.
+    getDecorations(item.decorations);
+    return;
+  }
+
+  {
+    ReadLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+    if (DecoratorsConfigParserPlugin::kDecorationsJSON != nullptr) {
+      item.decorations_json = DecoratorsConfigParserPlugin::kDecorationsJSON;
+      return;
+    }
+  }
+
+  // Serialize the decorations once until they change.
+  std::map<std::string, std::string> decorations;
+  WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+  for (const auto& source : DecoratorsConfigParserPlugin::kDecorations) {
+    for (const auto& decoration : source.second) {
+      decorations[decoration.first] = decoration.second;
+    }
+  }
+
+  std::string json;
+  JSONWriter writer(json);
+  writer.startObject();
+  for (const auto& decoration : decorations) {
+    writer.value(decoration.first, decoration.second);
+  }
+  writer.endObject();
+  // Keep the members, the log item serialization writes the braces.
+  auto members = std::make_shared<const std::string>(json, 1, json.size() - 2);
+  DecoratorsConfigParserPlugin::kDecorationsJSON = members;
+  item.decorations_json = std::move(members);
+}
+
 void getDecorations(std::map<std::string, std::string>& results) {
   if (FLAGS_disable_decorators) {
     return;
@@ -55,6 +55,28 @@ void runDecorators(DecorationPoint point,
  */
 void getDecorations(std::map<std::string, std::string>& results);
 
+/**
+ * @brief Add the decorations to a log item.
+ *
+ * Log items share the decorations serialized as JSON, they are serialized
+ * again only after a decorator's results change.
+ *
+ * @param item the log item to decorate.
+ */
+void getDecorations(QueryLogItem& item);
+
+/**
+ * @brief Run the 'always' decorators for the schedule.
+ *
+ * Rather than running before every scheduled query, the decorators run at
+ * most once each decorators_always_interval seconds. Their decorations are
+ * reused by the queries executed in between.
+ *
+ * @param time the schedule's time in seconds.
+ * @return true if the decorators ran.
+ */
+bool refreshDecorators(size_t time);
+
 /// Clear decorations for a source when it updates.
 void clearDecorations(const std::string& source);
 }
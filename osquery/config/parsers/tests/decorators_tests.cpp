@@ -128,4 +128,39 @@ TEST_F(DecoratorsConfigParserPluginTests, test_decorators_run_load_top_level) {
   // disable top level decorations
   FLAGS_decorations_top_level = false;
 }
+TEST_F(DecoratorsConfigParserPluginTests, test_decorators_always_interval) {
+  // Prevent loads from executing.
+  Config::getInstance().update(config_data_);
+  FLAGS_disable_decorators = false;
+
+  // The schedule runs 'always' decorators once each interval.
+  EXPECT_TRUE(refreshDecorators(100));
+  EXPECT_FALSE(refreshDecorators(100));
+  EXPECT_TRUE(refreshDecorators(101));
+
+  // Log items share the serialized decorations.
+  QueryLogItem item;
+  getDecorations(item);
+  ASSERT_NE(nullptr, item.decorations_json);
+  EXPECT_EQ(0U, item.decorations.size());
+  EXPECT_NE(std::string::npos,
+            item.decorations_json->find("\"always_test\":\"test\""));
+
+  QueryLogItem second_item;
+  getDecorations(second_item);
+  EXPECT_EQ(item.decorations_json, second_item.decorations_json);
+
+  std::string log_line;
+  serializeQueryLogItemJSON(item, log_line);
+  EXPECT_NE(std::string::npos,
+            log_line.find("\"decorations\":{" + *item.decorations_json + "}"));
+
+  // A cleared source is decorated again at the next step.
+  clearDecorations("awesome");
+  QueryLogItem cleared_item;
+  getDecorations(cleared_item);
+  ASSERT_NE(nullptr, cleared_item.decorations_json);
+  EXPECT_TRUE(cleared_item.decorations_json->empty());
+  EXPECT_TRUE(refreshDecorators(101));
+}
 }
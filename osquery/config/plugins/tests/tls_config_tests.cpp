@@ -183,4 +183,51 @@ TEST_F(TLSConfigTests, test_setup) {
   db_value = response_tree.get<std::string>(".command");
   EXPECT_STREQ(db_value.c_str(), "enroll");
 }
+
+TEST_F(TLSConfigTests, test_config_delta) {
+  TLSConfigPlugin plugin;
+
+  // A response referring to a config the plugin does not have fails.
+  pt::ptree response;
+  response.put("etag", "1");
+  response.put("config_unchanged", true);
+  std::string json;
+  EXPECT_FALSE(plugin.readConfigResponse(response, json).ok());
+  EXPECT_TRUE(plugin.etag_.empty());
+
+  // A complete config sets the base of later responses.
+  response.clear();
+  response.put("etag", "2");
+  response.put("options.verbose", "true");
+  response.put("packs.first.queries.time.query", "select * from time");
+  response.put("packs.second.queries.time.query", "select * from time");
+  ASSERT_TRUE(plugin.readConfigResponse(response, json).ok());
+  EXPECT_EQ("2", plugin.etag_);
+  EXPECT_EQ(std::string::npos, json.find("etag"));
+  auto complete = json;
+
+  response.clear();
+  response.put("etag", "3");
+  response.put("config_unchanged", true);
+  ASSERT_TRUE(plugin.readConfigResponse(response, json).ok());
+  EXPECT_EQ("3", plugin.etag_);
+  EXPECT_EQ(complete, json);
+
+  // A delta replaces top-level keys and packs, and null removes them.
+  response.clear();
+  response.put("etag", "4");
+  response.put("config_delta.options.verbose", "false");
+  response.put("config_delta.packs.first", "null");
+  response.put("config_delta.packs.third.queries.time.query",
+               "select * from time");
+  ASSERT_TRUE(plugin.readConfigResponse(response, json).ok());
+
+  pt::ptree config;
+  std::stringstream input(json);
+  pt::read_json(input, config);
+  EXPECT_EQ("false", config.get("options.verbose", ""));
+  EXPECT_EQ(0U, config.get_child("packs").count("first"));
+  EXPECT_EQ(1U, config.get_child("packs").count("second"));
+  EXPECT_EQ(1U, config.get_child("packs").count("third"));
+}
 }
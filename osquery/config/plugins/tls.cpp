@@ -17,6 +17,7 @@
 #include <osquery/dispatcher.h>
 #include <osquery/enroll.h>
 #include <osquery/flags.h>
+#include <osquery/packs.h>
 #include <osquery/registry.h>
 
 #include "osquery/core/conversions.h"
@@ -54,6 +55,12 @@ CLI_FLAG(uint64,
          300,
          "Interval to wait if reading a configuration fails");
 
+/// Spread the refreshes of many nodes, such as after a fleet restart.
+CLI_FLAG(uint64,
+         config_tls_refresh_splay,
+         10,
+         "Percent to splay config refresh intervals (default 10)");
+
 DECLARE_bool(tls_secret_always);
 DECLARE_string(tls_enroll_override);
 DECLARE_bool(tls_node_api);
@@ -61,6 +68,46 @@ DECLARE_bool(enroll_always);
 
 REGISTER(TLSConfigPlugin, "config", "tls");
 
+/// Response keys of conditional and delta config responses.
+const std::string kConfigETag = "etag";
+const std::string kConfigUnchanged = "config_unchanged";
+const std::string kConfigDelta = "config_delta";
+
+/// Replace a child of a config tree, a JSON null value removes it.
+static void mergeConfigChild(pt::ptree& tree,
+                             const std::string& key,
+                             const pt::ptree& value) {
+  bool remove = (value.empty() && value.data() == "null");
+  auto it = tree.find(key);
+  if (it != tree.not_found()) {
+    if (remove) {
+      tree.erase(tree.to_iterator(it));
+    } else {
+      it->second = value;
+    }
+  } else if (!remove) {
+    tree.push_back(std::make_pair(key, value));
+  }
+}
+
+/// Apply a delta to the top-level keys, and to each pack, of a config.
+static void applyConfigDelta(const pt::ptree& delta, pt::ptree& config) {
+  for (const auto& item : delta) {
+    if (item.first != "packs" || item.second.empty()) {
+      mergeConfigChild(config, item.first, item.second);
+      continue;
+    }
+
+    if (config.find("packs") == config.not_found()) {
+      config.push_back(std::make_pair("packs", pt::ptree()));
+    }
+    auto& packs = config.find("packs")->second;
+    for (const auto& pack : item.second) {
+      mergeConfigChild(packs, pack.first, pack.second);
+    }
+  }
+}
+
 std::atomic<size_t> TLSConfigPlugin::kCurrentDelay{0};
 
 Status TLSConfigPlugin::setUp() {
@@ -95,69 +142,91 @@ void TLSConfigPlugin::updateDelayPeriod(bool success) {
   }
 }
 
-Status TLSConfigPlugin::genConfig(std::map<std::string, std::string>& config) {
-  std::string json;
+Status TLSConfigPlugin::readConfigResponse(pt::ptree& response,
+                                           std::string& json) {
+  WriteLock lock(config_mutex_);
+  auto etag = response.get<std::string>(kConfigETag, "");
+  response.erase(kConfigETag);
+
+  if (response.get<bool>(kConfigUnchanged, false) ||
+      response.count(kConfigDelta) > 0) {
+    if (!has_config_) {
+      // The next request asks for the complete configuration.
+      etag_.clear();
+      return Status(1, "Config response refers to an unknown config");
+    }
 
+    if (response.count(kConfigDelta) > 0) {
+      applyConfigDelta(response.get_child(kConfigDelta), config_);
+    }
+  } else {
+    config_ = std::move(response);
+    has_config_ = true;
+  }
+
+  etag_ = etag;
+  return JSONSerializer().serialize(config_, json);
+}
+
+Status TLSConfigPlugin::genConfig(std::map<std::string, std::string>& config) {
   pt::ptree params;
   if (FLAGS_tls_node_api) {
     // The TLS node API morphs some verbs and variables.
     params.put("_get", true);
+  } else {
+    ReadLock lock(config_mutex_);
+    if (!etag_.empty()) {
+      // Ask the server to reply with the changes since this configuration.
+      params.put(kConfigETag, etag_);
+    }
   }
 
+  pt::ptree response;
   auto s = TLSRequestHelper::go<JSONSerializer>(
-      uri_, params, json, FLAGS_config_tls_max_attempts);
+      uri_, params, response, FLAGS_config_tls_max_attempts);
 
   if (s.ok()) {
     if (FLAGS_tls_node_api) {
       // The node API embeds configuration data (JSON escaped).
-      pt::ptree tree;
-      try {
-        std::stringstream input;
-        input << json;
-        pt::read_json(input, tree);
-      } catch (const pt::json_parser::json_parser_error& /* e */) {
-        VLOG(1) << "Could not parse JSON from TLS node API";
-      }
-
       // Re-encode the config key into JSON.
-      config["tls_plugin"] = unescapeUnicode(tree.get("config", ""));
+      config["tls_plugin"] = unescapeUnicode(response.get("config", ""));
     } else {
-      config["tls_plugin"] = json;
+      std::string json;
+      s = readConfigResponse(response, json);
+      if (s.ok()) {
+        config["tls_plugin"] = std::move(json);
+      }
     }
   }
   updateDelayPeriod(s.ok());
 
-  // If the initial configuration includes a non-0 refresh, start an additional
-  // service that sleeps and periodically regenerates the configuration.
+  // If the initial configuration includes a non-0 refresh, add a dispatcher
+  // task that periodically regenerates the configuration.
   if (!started_thread_ && FLAGS_config_tls_refresh >= 1) {
-    Dispatcher::addService(std::make_shared<TLSConfigRefreshRunner>());
+    Dispatcher::addTask(refreshTask, getRefreshDelay());
     started_thread_ = true;
   }
   return s;
 }
 
-void TLSConfigRefreshRunner::start() {
-  while (!interrupted()) {
-    // Cool off and time wait the configured period.
-    // Apply this interruption initially as at t=0 the config was read.
-    pauseMilli(TLSConfigPlugin::kCurrentDelay * 1000);
-    // Since the pause occurs before the logic, we need to check for an
-    // interruption request.
-    if (interrupted()) {
-      return;
-    }
+size_t TLSConfigPlugin::getRefreshDelay() {
+  return splayValue(kCurrentDelay, FLAGS_config_tls_refresh_splay) * 1000;
+}
 
-    // Access the configuration.
-    auto plugin = RegistryFactory::get().plugin("config", "tls");
-    if (plugin != nullptr) {
-      auto config_plugin = std::dynamic_pointer_cast<ConfigPlugin>(plugin);
+size_t TLSConfigPlugin::refreshTask() {
+  // Access the configuration.
+  auto plugin = RegistryFactory::get().plugin("config", "tls");
+  if (plugin != nullptr) {
+    auto config_plugin = std::dynamic_pointer_cast<ConfigPlugin>(plugin);
 
-      // The config instance knows the TLS plugin is selected.
-      std::map<std::string, std::string> config;
-      if (config_plugin->genConfig(config)) {
-        Config::getInstance().update(config);
-      }
+    // The config instance knows the TLS plugin is selected.
+    std::map<std::string, std::string> config;
+    if (config_plugin->genConfig(config)) {
+      Config::getInstance().update(config);
     }
   }
+
+  // The delay is accelerated while requests fail.
+  return getRefreshDelay();
 }
 }
@@ -12,6 +12,8 @@
 
 #include <vector>
 
+#include <boost/property_tree/ptree.hpp>
+
 #include <osquery/config.h>
 #include <osquery/dispatcher.h>
 
@@ -27,6 +29,20 @@ class TLSConfigPlugin : public ConfigPlugin,
   static std::atomic<size_t> kCurrentDelay;
 
  protected:
+  /**
+   * @brief Read a config response, which may refer to the previous config.
+   *
+   * A response with an "etag" is remembered and the etag is sent with the
+   * next request. The server may then reply "config_unchanged", or send a
+   * "config_delta" with the top-level keys and packs that changed, where
+   * null removes a key or pack. Other responses replace the config.
+   *
+   * @param response The response, the reserved keys are removed.
+   * @param json (output) The complete configuration.
+   */
+  Status readConfigResponse(boost::property_tree::ptree& response,
+                            std::string& json);
+
   /// Calculate the URL once and cache the result.
   std::string uri_;
 
@@ -35,11 +51,24 @@ class TLSConfigPlugin : public ConfigPlugin,
 
   void updateDelayPeriod(bool success);
   bool started_thread_{false};
-};
 
-class TLSConfigRefreshRunner : public InternalRunnable {
- public:
-  /// A simple wait/interruptible lock.
-  void start();
+  /// The server's identifier for the most recent configuration.
+  std::string etag_;
+
+  /// The most recent configuration, the base of deltas.
+  boost::property_tree::ptree config_;
+  bool has_config_{false};
+
+  /// Access to the most recent configuration from the refresh task.
+  Mutex config_mutex_;
+
+  /// The dispatcher task refreshing the configuration.
+  static size_t refreshTask();
+
+  /// The jittered milliseconds before the next refresh.
+  static size_t getRefreshDelay();
+
+ private:
+  FRIEND_TEST(TLSConfigTests, test_config_delta);
 };
 }
@@ -11,6 +11,8 @@
 #include <memory>
 #include <vector>
 
+#include <boost/algorithm/string/replace.hpp>
+
 #include <gtest/gtest.h>
 
 #include <osquery/config.h>
@@ -240,6 +242,40 @@ TEST_F(ConfigTests, test_content_update) {
   EXPECT_EQ(count, 0U);
 }
 
+TEST_F(ConfigTests, test_content_unchanged) {
+  setLoaded();
+  std::string content =
+      "{\"packs\": {\"one\": {\"queries\": {\"q1\": {\"query\": "
+      "\"select 1\", \"interval\": 60}}}, \"two\": {\"queries\": {\"q2\": "
+      "{\"query\": \"select 2\", \"interval\": 60}}}}}";
+  EXPECT_TRUE(get().update({{"awesome", content}}));
+
+  std::map<std::string, Pack*> packs;
+  auto packCollector = [&packs](std::shared_ptr<Pack>& pack) {
+    packs[pack->getName()] = pack.get();
+  };
+  get().packs(packCollector);
+  ASSERT_EQ(2U, packs.size());
+  auto one = packs["one"];
+  auto two = packs["two"];
+
+  // The same content does not replace the packs.
+  EXPECT_TRUE(get().update({{"awesome", content}}));
+  packs.clear();
+  get().packs(packCollector);
+  EXPECT_EQ(one, packs["one"]);
+  EXPECT_EQ(two, packs["two"]);
+
+  // Changing one pack only replaces that pack.
+  boost::replace_all(content, "select 2", "select 3");
+  EXPECT_TRUE(get().update({{"awesome", content}}));
+  packs.clear();
+  get().packs(packCollector);
+  ASSERT_EQ(2U, packs.size());
+  EXPECT_EQ(one, packs["one"]);
+  EXPECT_EQ("select 3", packs["two"]->getSchedule().at("q2").query);
+}
+
 TEST_F(ConfigTests, test_get_scheduled_queries) {
   std::vector<ScheduledQuery> queries;
   get().addPack("unrestricted_pack", "", getUnrestrictedPack());
@@ -150,6 +150,25 @@ TEST_F(PacksTests, test_discovery_cache) {
   c.reset();
 }
 
+TEST_F(PacksTests, test_discovery_invalidate) {
+  Pack pack("valid_discovery_pack", getPackWithValidDiscovery());
+  EXPECT_TRUE(pack.shouldPackExecute());
+  EXPECT_TRUE(pack.shouldPackExecute());
+  EXPECT_EQ(pack.getStats().misses, 1U);
+
+  // Packs sharing a discovery query share its cached result.
+  EXPECT_TRUE(DiscoveryCache::check("select 1"));
+  EXPECT_FALSE(DiscoveryCache::check("select 1 where 0"));
+
+  // An invalidation expires the pack's discovery state.
+  auto generation = DiscoveryCache::generation();
+  DiscoveryCache::invalidate();
+  EXPECT_EQ(generation + 1, DiscoveryCache::generation());
+  EXPECT_TRUE(pack.shouldPackExecute());
+  EXPECT_EQ(pack.getStats().misses, 2U);
+  EXPECT_EQ(pack.getStats().hits, 1U);
+}
+
 TEST_F(PacksTests, test_multi_pack) {
   std::string multi_pack_content = "{\"first\": {}, \"second\": {}}";
   pt::ptree multi_pack;
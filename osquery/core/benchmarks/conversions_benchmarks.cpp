@@ -0,0 +1,101 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/sql.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/core/json.h"
+
+namespace osquery {
+
+extern void escapeNonPrintableBytesEx(std::string& data);
+
+/**
+ * @brief Content resembling a result column of the requested length.
+ *
+ * With a nonzero period, every period-th byte is a multi-byte UTF-8 or
+ * control character that must be escaped.
+ */
+static std::string getConversionsContent(size_t length, size_t period) {
+  std::string content;
+  while (content.size() < length) {
+    content += "/usr/lib/systemd/systemd --switched-root --system ";
+  }
+  content.resize(length);
+  for (size_t i = period; period > 0 && i + 1 < length; i += period) {
+    content[i] = '\xC3';
+    content[i + 1] = '\xA9';
+  }
+  return content;
+}
+
+static void CONVERSIONS_json_escape(benchmark::State& state) {
+  auto content = getConversionsContent(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    std::string output;
+    JSONWriter writer(output);
+    writer.value(content);
+    benchmark::DoNotOptimize(output);
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+BENCHMARK(CONVERSIONS_json_escape)
+    ->ArgPair(64, 0)
+    ->ArgPair(4096, 0)
+    ->ArgPair(4096, 64);
+
+static void CONVERSIONS_escape_results(benchmark::State& state) {
+  auto content = getConversionsContent(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    auto data = content;
+    escapeNonPrintableBytesEx(data);
+    benchmark::DoNotOptimize(data);
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+BENCHMARK(CONVERSIONS_escape_results)
+    ->ArgPair(64, 0)
+    ->ArgPair(4096, 0)
+    ->ArgPair(4096, 64);
+
+static void CONVERSIONS_is_printable(benchmark::State& state) {
+  auto content = getConversionsContent(state.range_x(), 0);
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(isPrintable(content));
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+BENCHMARK(CONVERSIONS_is_printable)->Arg(64)->Arg(4096);
+
+static void CONVERSIONS_base64_encode(benchmark::State& state) {
+  auto content = getConversionsContent(state.range_x(), 0);
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(base64Encode(content));
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+BENCHMARK(CONVERSIONS_base64_encode)->Arg(64)->Arg(4096);
+
+static void CONVERSIONS_base64_decode(benchmark::State& state) {
+  auto content = base64Encode(getConversionsContent(state.range_x(), 0));
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(base64Decode(content));
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+BENCHMARK(CONVERSIONS_base64_decode)->Arg(64)->Arg(4096);
+}
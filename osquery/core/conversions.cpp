@@ -8,75 +8,297 @@
  *
  */
 
+#include <cstring>
 #include <iomanip>
 #include <sstream>
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define OSQUERY_SCAN_SSE2
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(WIN32)
+#include <immintrin.h>
+#define OSQUERY_SCAN_AVX2
+#endif
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define OSQUERY_SCAN_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #include <boost/algorithm/string.hpp>
-#include <boost/archive/iterators/base64_from_binary.hpp>
-#include <boost/archive/iterators/binary_from_base64.hpp>
-#include <boost/archive/iterators/transform_width.hpp>
 #include <boost/uuid/sha1.hpp>
 
 #include "osquery/core/conversions.h"
 
-namespace bai = boost::archive::iterators;
-
 namespace osquery {
 
-typedef bai::binary_from_base64<const char*> base64_str;
-typedef bai::transform_width<base64_str, 8, 6> base64_dec;
-typedef bai::transform_width<std::string::const_iterator, 6, 8> base64_enc;
-typedef bai::base64_from_binary<base64_enc> it_base64;
+/// The bytes scanPlainBytes compares, unused stops are 0, already a stop.
+struct ByteScan {
+  unsigned char max{0xFF};
+  unsigned char stops[3]{0, 0, 0};
+};
+
+static size_t scanPlainBytesScalar(const char* data,
+                                   size_t size,
+                                   const ByteScan& scan) {
+  for (size_t i = 0; i < size; i++) {
+    auto c = static_cast<unsigned char>(data[i]);
+    if (c < 0x20 || c > scan.max || c == scan.stops[0] ||
+        c == scan.stops[1] || c == scan.stops[2]) {
+      return i;
+    }
+  }
+  return size;
+}
+
+#if defined(OSQUERY_SCAN_SSE2)
+/// The index of the lowest set bit of a nonzero mask.
+static inline size_t lowestBit(unsigned int mask) {
+#ifdef _MSC_VER
+  unsigned long index = 0;
+  _BitScanForward(&index, mask);
+  return index;
+#else
+  return static_cast<size_t>(__builtin_ctz(mask));
+#endif
+}
+
+static size_t scanPlainBytesSSE2(const char* data,
+                                 size_t size,
+                                 const ByteScan& scan) {
+  // Bias the bytes so that signed comparisons order them as unsigned.
+  const auto bias = _mm_set1_epi8(static_cast<char>(0x80));
+  const auto low = _mm_set1_epi8(static_cast<char>(0x20 ^ 0x80));
+  const auto high = _mm_set1_epi8(static_cast<char>(scan.max ^ 0x80));
+  const auto stop0 = _mm_set1_epi8(static_cast<char>(scan.stops[0]));
+  const auto stop1 = _mm_set1_epi8(static_cast<char>(scan.stops[1]));
+  const auto stop2 = _mm_set1_epi8(static_cast<char>(scan.stops[2]));
+
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    auto biased = _mm_xor_si128(bytes, bias);
+    auto stop = _mm_or_si128(_mm_cmplt_epi8(biased, low),
+                             _mm_cmpgt_epi8(biased, high));
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(bytes, stop0));
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(bytes, stop1));
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(bytes, stop2));
+    auto mask = static_cast<unsigned int>(_mm_movemask_epi8(stop));
+    if (mask != 0) {
+      return i + lowestBit(mask);
+    }
+  }
+  return i + scanPlainBytesScalar(data + i, size - i, scan);
+}
+#endif
+
+#if defined(OSQUERY_SCAN_AVX2)
+__attribute__((target("avx2"))) static size_t scanPlainBytesAVX2(
+    const char* data, size_t size, const ByteScan& scan) {
+  const auto bias = _mm256_set1_epi8(static_cast<char>(0x80));
+  const auto low = _mm256_set1_epi8(static_cast<char>(0x20 ^ 0x80));
+  const auto high = _mm256_set1_epi8(static_cast<char>(scan.max ^ 0x80));
+  const auto stop0 = _mm256_set1_epi8(static_cast<char>(scan.stops[0]));
+  const auto stop1 = _mm256_set1_epi8(static_cast<char>(scan.stops[1]));
+  const auto stop2 = _mm256_set1_epi8(static_cast<char>(scan.stops[2]));
+
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    auto bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    auto biased = _mm256_xor_si256(bytes, bias);
+    auto stop = _mm256_or_si256(_mm256_cmpgt_epi8(low, biased),
+                                _mm256_cmpgt_epi8(biased, high));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(bytes, stop0));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(bytes, stop1));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(bytes, stop2));
+    auto mask = static_cast<unsigned int>(_mm256_movemask_epi8(stop));
+    if (mask != 0) {
+      return i + lowestBit(mask);
+    }
+  }
+  return i + scanPlainBytesSSE2(data + i, size - i, scan);
+}
+#endif
+
+#if defined(OSQUERY_SCAN_NEON)
+static size_t scanPlainBytesNEON(const char* data,
+                                 size_t size,
+                                 const ByteScan& scan) {
+  const auto low = vdupq_n_u8(0x20);
+  const auto high = vdupq_n_u8(scan.max);
+  const auto stop0 = vdupq_n_u8(scan.stops[0]);
+  const auto stop1 = vdupq_n_u8(scan.stops[1]);
+  const auto stop2 = vdupq_n_u8(scan.stops[2]);
+
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(data + i));
+    auto stop = vorrq_u8(vcltq_u8(bytes, low), vcgtq_u8(bytes, high));
+    stop = vorrq_u8(stop, vceqq_u8(bytes, stop0));
+    stop = vorrq_u8(stop, vceqq_u8(bytes, stop1));
+    stop = vorrq_u8(stop, vceqq_u8(bytes, stop2));
+    if (vmaxvq_u8(stop) != 0) {
+      // Find the stop within these 16 bytes.
+      return i + scanPlainBytesScalar(data + i, 16, scan);
+    }
+  }
+  return i + scanPlainBytesScalar(data + i, size - i, scan);
+}
+#endif
+
+using ScanFunction = size_t (*)(const char*, size_t, const ByteScan&);
+
+/// Choose the widest implementation the CPU supports.
+static ScanFunction getScanFunction() {
+#if defined(OSQUERY_SCAN_AVX2)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return scanPlainBytesAVX2;
+  }
+#endif
+#if defined(OSQUERY_SCAN_SSE2)
+  return scanPlainBytesSSE2;
+#elif defined(OSQUERY_SCAN_NEON)
+  return scanPlainBytesNEON;
+#else
+  return scanPlainBytesScalar;
+#endif
+}
+
+size_t scanPlainBytes(const char* data,
+                      size_t size,
+                      unsigned char max,
+                      const char* stops) {
+  static const auto scanner = getScanFunction();
+
+  ByteScan scan;
+  scan.max = max;
+  for (size_t i = 0; i < 3 && stops != nullptr && stops[i] != '\0'; i++) {
+    scan.stops[i] = static_cast<unsigned char>(stops[i]);
+  }
+  return scanner(data, size, scan);
+}
+
+static const char kBase64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/// Value of each base64 character, 64 for padding, 0xFF if invalid.
+static const unsigned char* getBase64Values() {
+  static unsigned char values[256];
+  static bool initialized = ([]() {
+    std::memset(values, 0xFF, sizeof(values));
+    for (unsigned char i = 0; i < 64; i++) {
+      values[static_cast<unsigned char>(kBase64Alphabet[i])] = i;
+    }
+    values[static_cast<unsigned char>('=')] = 64;
+    return true;
+  })();
+  (void)initialized;
+  return values;
+}
 
 std::string base64Decode(const std::string& encoded) {
-  std::string is;
-  std::stringstream os;
-
-  is = encoded;
-  boost::replace_all(is, "\r\n", "");
-  boost::replace_all(is, "\n", "");
-  size_t size = is.size();
-
-  // Remove the padding characters
-  if (size && is[size - 1] == '=') {
-    --size;
-    if (size && is[size - 1] == '=') {
-      --size;
+  // Line breaks within the encoding are ignored.
+  std::string input;
+  const std::string* source = &encoded;
+  if (encoded.find_first_of("\r\n") != std::string::npos) {
+    input.reserve(encoded.size());
+    for (const auto& c : encoded) {
+      if (c != '\r' && c != '\n') {
+        input += c;
+      }
     }
+    source = &input;
   }
 
-  if (size == 0) {
-    return "";
+  const auto* values = getBase64Values();
+  const auto* data = reinterpret_cast<const unsigned char*>(source->data());
+  auto size = source->size();
+
+  std::string decoded;
+  decoded.reserve((size / 4) * 3 + 3);
+
+  // Decode each group of 4 characters into 3 bytes.
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto a = values[data[i]];
+    auto b = values[data[i + 1]];
+    auto c = values[data[i + 2]];
+    auto d = values[data[i + 3]];
+    if ((a | b | c | d) >= 64) {
+      // Padding, or an invalid character.
+      break;
+    }
+    uint32_t group = (a << 18) | (b << 12) | (c << 6) | d;
+    decoded += static_cast<char>(group >> 16);
+    decoded += static_cast<char>((group >> 8) & 0xFF);
+    decoded += static_cast<char>(group & 0xFF);
   }
 
-  std::copy(base64_dec(is.data()),
-            base64_dec(is.data() + size),
-            std::ostream_iterator<char>(os));
+  // A last, possibly padded, group is decoded into its complete bytes.
+  uint32_t bits = 0;
+  size_t count = 0;
+  for (; i < size; i++) {
+    auto value = values[data[i]];
+    if (value == 64) {
+      break;
+    } else if (value > 64) {
+      return "";
+    }
+    bits = (bits << 6) | value;
+    count += 6;
+    if (count >= 8) {
+      count -= 8;
+      decoded += static_cast<char>((bits >> count) & 0xFF);
+    }
+  }
 
-  return os.str();
+  // Only padding may follow the padding.
+  for (; i < size; i++) {
+    if (data[i] != '=') {
+      return "";
+    }
+  }
+  return decoded;
 }
 
 std::string base64Encode(const std::string& unencoded) {
-  std::stringstream os;
+  const auto* data = reinterpret_cast<const unsigned char*>(unencoded.data());
+  auto size = unencoded.size();
 
-  if (unencoded.size() == 0) {
-    return std::string();
+  std::string encoded(((size + 2) / 3) * 4, '=');
+  auto* output = &encoded[0];
+  size_t i = 0;
+  for (; i + 3 <= size; i += 3) {
+    uint32_t group = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+    *output++ = kBase64Alphabet[group >> 18];
+    *output++ = kBase64Alphabet[(group >> 12) & 0x3F];
+    *output++ = kBase64Alphabet[(group >> 6) & 0x3F];
+    *output++ = kBase64Alphabet[group & 0x3F];
   }
 
-  size_t writePaddChars = (3U - unencoded.length() % 3U) % 3U;
-  std::string base64(it_base64(unencoded.begin()), it_base64(unencoded.end()));
-  base64.append(writePaddChars, '=');
-  os << base64;
-  return os.str();
+  // The last 1 or 2 bytes are padded.
+  if (i < size) {
+    uint32_t group = data[i] << 16;
+    if (i + 1 < size) {
+      group |= data[i + 1] << 8;
+    }
+    *output++ = kBase64Alphabet[group >> 18];
+    *output++ = kBase64Alphabet[(group >> 12) & 0x3F];
+    if (i + 1 < size) {
+      *output++ = kBase64Alphabet[(group >> 6) & 0x3F];
+    }
+  }
+  return encoded;
 }
 
 bool isPrintable(const std::string& check) {
-  for (const unsigned char ch : check) {
-    if (ch >= 0x7F || ch <= 0x1F) {
-      return false;
-    }
-  }
-  return true;
+  return scanPlainBytes(check.data(), check.size(), 0x7E) == check.size();
 }
 
 std::vector<std::string> split(const std::string& s, const std::string& delim) {
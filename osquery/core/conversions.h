@@ -124,6 +124,25 @@ std::string base64Decode(const std::string& encoded);
  */
 std::string base64Encode(const std::string& unencoded);
 
+/**
+ * @brief The length of a prefix of bytes that need no escaping.
+ *
+ * Bytes below 0x20, bytes above max, and the stop bytes end the prefix. The
+ * JSON serializer, the result escaping, and isPrintable scan content this
+ * way. The bytes are compared 32 at a time with AVX2 when the CPU supports
+ * it, otherwise 16 at a time with SSE2 or NEON, or one at a time.
+ *
+ * @param data the bytes to scan.
+ * @param size the number of bytes.
+ * @param max the greatest byte that does not end the prefix.
+ * @param stops up to three more bytes that end the prefix.
+ * @return the length of the prefix, size if no byte ends it.
+ */
+size_t scanPlainBytes(const char* data,
+                      size_t size,
+                      unsigned char max,
+                      const char* stops = "");
+
 /**
  * @brief Check if a string is ASCII printable
  *
@@ -9,6 +9,7 @@
  */
 
 #include <chrono>
+#include <future>
 #include <iostream>
 #include <random>
 #include <thread>
@@ -39,41 +40,17 @@
 #include <osquery/registry.h>
 #include <osquery/system.h>
 
+#include "osquery/core/memory_pressure.h"
+#include "osquery/core/metrics.h"
 #include "osquery/core/process.h"
+#include "osquery/core/profiler.h"
 #include "osquery/core/watcher.h"
+#include "osquery/core/worker_stats.h"
 
 #if defined(__linux__) || defined(__FreeBSD__)
 #include <sys/resource.h>
 #endif
 
-#ifdef __linux__
-#include <sys/syscall.h>
-
-/*
- * These are the io priority groups as implemented by CFQ. RT is the realtime
- * class, it always gets premium service. BE is the best-effort scheduling
- * class, the default for any process. IDLE is the idle scheduling class, it
- * is only served when no one else is using the disk.
- */
-enum {
-  IOPRIO_CLASS_NONE,
-  IOPRIO_CLASS_RT,
-  IOPRIO_CLASS_BE,
-  IOPRIO_CLASS_IDLE,
-};
-
-/*
- * 8 best effort priority levels are supported
- */
-#define IOPRIO_BE_NR (8)
-
-enum {
-  IOPRIO_WHO_PROCESS = 1,
-  IOPRIO_WHO_PGRP,
-  IOPRIO_WHO_USER,
-};
-#endif
-
 #define DESCRIPTION                                                            \
   "osquery %s, your OS as a high-performance relational database\n"
 #define EPILOG "\nosquery project page <https://osquery.io>.\n"
@@ -201,6 +178,8 @@ DECLARE_string(distributed_plugin);
 DECLARE_bool(disable_distributed);
 DECLARE_bool(disable_database);
 DECLARE_bool(disable_events);
+DECLARE_bool(worker_profile);
+DECLARE_uint64(worker_profile_hz);
 
 #if !defined(__APPLE__) && !defined(WIN32)
 CLI_FLAG(bool, daemonize, false, "Run as daemon (osqueryd only)");
@@ -208,6 +187,11 @@ CLI_FLAG(bool, daemonize, false, "Run as daemon (osqueryd only)");
 
 FLAG(bool, ephemeral, false, "Skip pidfile and database state checks");
 
+CLI_FLAG(bool,
+         startup_parallel,
+         true,
+         "Open the database and set up event publishers concurrently");
+
 ToolType kToolType = ToolType::UNKNOWN;
 
 volatile std::sig_atomic_t kExitCode{0};
@@ -217,6 +201,46 @@ static std::thread::id kMainThreadId;
 
 const std::string kDefaultFlagfile = OSQUERY_HOME "/osquery.flags.default";
 
+/// Milliseconds spent in each startup phase, see getStartupTimings.
+static std::vector<std::pair<std::string, size_t>> kStartupTimings;
+
+/// Startup phases may end on other threads.
+static Mutex kStartupTimingsMutex;
+
+/// Record the time since a startup phase began.
+static void recordStartupPhase(
+    const std::string& phase,
+    const std::chrono::steady_clock::time_point& begin) {
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - begin);
+  WriteLock lock(kStartupTimingsMutex);
+  kStartupTimings.push_back(
+      std::make_pair(phase, static_cast<size_t>(duration.count())));
+}
+
+/// Milliseconds between a standby worker's checks for promotion.
+const size_t kStandbyPollInterval{20};
+
+/// A standby worker waits until the watcher promotes it to replace a worker.
+static void waitForPromotion() {
+  auto stats = WorkerStats::get();
+  if (stats == nullptr) {
+    return;
+  }
+
+  auto pid = PlatformProcess::getCurrentProcess()->pid();
+  VLOG(1) << "osquery standby worker (" << pid << ") waiting for promotion";
+  while (!stats->promoted(pid)) {
+    if (kHandledSignal != 0) {
+      // The watcher stopped the standby or the watcher exited.
+      Initializer::requestShutdown(kExitCode);
+    }
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(kStandbyPollInterval));
+  }
+  VLOG(1) << "osquery standby worker (" << pid << ") promoted";
+}
+
 static inline void printUsage(const std::string& binary, ToolType tool) {
   // Parse help options before gflags. Only display osquery-related options.
   fprintf(stdout, DESCRIPTION, kVersion.c_str());
@@ -427,13 +451,6 @@ void Initializer::initDaemon() const {
   if (!FLAGS_disable_watchdog && FLAGS_watchdog_level >= 0) {
     // Set CPU scheduling I/O limits.
     setToBackgroundPriority();
-
-#ifdef __linux__
-    // Using: ioprio_set(IOPRIO_WHO_PGRP, 0, IOPRIO_CLASS_IDLE);
-    syscall(SYS_ioprio_set, IOPRIO_WHO_PGRP, 0, IOPRIO_CLASS_IDLE);
-#elif defined(__APPLE__)
-    setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_PROCESS, IOPOL_THROTTLE);
-#endif
   }
 }
 
@@ -512,6 +529,32 @@ void Initializer::initWorker(const std::string& name) const {
   // In this case the parent process is called the 'watcher' process.
   Dispatcher::addService(std::make_shared<WatcherWatcherRunner>(
       PlatformProcess::getLauncherProcess()));
+
+  // Record the resource usage of scheduled queries for the watcher.
+  auto stats_name = getEnvVar(kWorkerStatsEnv);
+  if (stats_name.is_initialized()) {
+    std::shared_ptr<WorkerStats> stats;
+    auto status = WorkerStats::open(*stats_name, stats);
+    if (status.ok()) {
+      WorkerStats::set(stats);
+      Metrics::gauge("watcher_worker_restarts").set(stats->restarts());
+    } else {
+      VLOG(1) << status.getMessage();
+    }
+  }
+
+  // Shed caches and pause low priority work before exceeding a limit.
+  Dispatcher::addService(std::make_shared<MemoryPressureRunner>());
+
+  // Sample stacks so the worker can explain itself when nearing a limit.
+  if (FLAGS_worker_profile) {
+    auto status = WorkerProfiler::start(FLAGS_worker_profile_hz);
+    if (status.ok()) {
+      Dispatcher::addService(std::make_shared<WorkerProfilerRunner>());
+    } else {
+      LOG(WARNING) << status.getMessage();
+    }
+  }
 }
 
 void Initializer::initWorkerWatcher(const std::string& name) const {
@@ -552,8 +595,19 @@ void Initializer::initActivePlugin(const std::string& type,
 }
 
 void Initializer::start() const {
+  auto start = std::chrono::steady_clock::now();
+  auto phase = start;
+
   // Load registry/extension modules before extensions.
   osquery::loadModules();
+  recordStartupPhase("modules", phase);
+
+  // A standby worker opens the database after the worker it replaces exits.
+  // Startup timings measure the remaining phases from promotion.
+  if (isWorker() && getEnvVar(kWorkerStandbyEnv).is_initialized()) {
+    waitForPromotion();
+    start = std::chrono::steady_clock::now();
+  }
 
   // Pre-extension manager initialization options checking.
   // If the shell or daemon does not need extensions and it will exit quickly,
@@ -566,22 +620,43 @@ void Initializer::start() const {
   // A watcher should not need access to the backing store.
   // If there are spurious access then warning logs will be emitted since the
   // set-allow-open will never be called.
+  std::future<bool> database;
   if (!isWatcher()) {
     DatabasePlugin::setAllowOpen(true);
     // A daemon must always have R/W access to the database.
     DatabasePlugin::setRequireWrite(tool_ == ToolType::DAEMON);
-    if (!DatabasePlugin::initPlugin()) {
-      LOG(ERROR) << RLOG(1629) << binary_
-                 << " initialize failed: Could not initialize database";
-      auto retcode = (isWorker()) ? EXIT_CATASTROPHIC : EXIT_FAILURE;
-      requestShutdown(retcode);
+    // Opening the database does not depend on extensions, it may open while
+    // the extension manager waits for autoloaded extensions.
+    database = std::async(
+        (FLAGS_startup_parallel) ? std::launch::async : std::launch::deferred,
+        []() {
+          auto begin = std::chrono::steady_clock::now();
+          auto status = DatabasePlugin::initPlugin();
+          recordStartupPhase("database", begin);
+          return status;
+        });
+    if (!FLAGS_startup_parallel) {
+      database.wait();
     }
   }
 
   // Bind to an extensions socket and wait for registry additions.
   // After starting the extension manager, osquery MUST shutdown using the
   // internal 'shutdown' method.
+  phase = std::chrono::steady_clock::now();
   osquery::startExtensionManager();
+  recordStartupPhase("extensions", phase);
+
+  // Config plugins may read the database, for example enrollment secrets.
+  if (database.valid() && !database.get()) {
+    LOG(ERROR) << RLOG(1629) << binary_
+               << " initialize failed: Could not initialize database";
+    auto retcode = (isWorker()) ? EXIT_CATASTROPHIC : EXIT_FAILURE;
+    requestShutdown(retcode);
+  }
+
+  // Attach extension tables remembered by the database, before they connect.
+  osquery::loadCachedExtensionRoutes();
 
   // Then set the config plugin, which uses a single/active plugin.
   initActivePlugin("config", FLAGS_config_plugin);
@@ -606,6 +681,8 @@ void Initializer::start() const {
   }
 
   // Load the osquery config using the default/active config plugin.
+  // Config options may set flags read by the logger and event publishers.
+  phase = std::chrono::steady_clock::now();
   auto s = Config::getInstance().load();
   if (!s.ok()) {
     auto message = "Error reading config: " + s.toString();
@@ -615,8 +692,10 @@ void Initializer::start() const {
       LOG(INFO) << message;
     }
   }
+  recordStartupPhase("config", phase);
 
   // Initialize the status and result plugin logger.
+  phase = std::chrono::steady_clock::now();
   if (!FLAGS_disable_logging) {
     initActivePlugin("logger", FLAGS_logger_plugin);
   }
@@ -626,10 +705,29 @@ void Initializer::start() const {
   if (!FLAGS_disable_distributed) {
     initActivePlugin("distributed", FLAGS_distributed_plugin);
   }
+  recordStartupPhase("logger", phase);
 
   // Start event threads.
+  phase = std::chrono::steady_clock::now();
   osquery::attachEvents();
   EventFactory::delay();
+  recordStartupPhase("events", phase);
+  recordStartupPhase("total", start);
+
+  // The watcher lost the previous worker until this worker attached events.
+  auto stats = WorkerStats::get();
+  if (isWorker() && stats != nullptr) {
+    stats->setRecovered();
+    if (stats->recoveryGap() > 0) {
+      VLOG(1) << "osquery worker recovered after " << stats->recoveryGap()
+              << "ms";
+    }
+  }
+}
+
+std::vector<std::pair<std::string, size_t>> Initializer::getStartupTimings() {
+  WriteLock lock(kStartupTimingsMutex);
+  return kStartupTimings;
 }
 
 void Initializer::waitForShutdown() {
@@ -638,6 +736,9 @@ void Initializer::waitForShutdown() {
   // End any event type run loops.
   EventFactory::end(true);
 
+  // Send status logs still queued for the logger plugins.
+  flushStatusLogs();
+
   // Hopefully release memory used by global string constructors in gflags.
   GFLAGS_NAMESPACE::ShutDownCommandLineFlags();
   DatabasePlugin::shutdown();
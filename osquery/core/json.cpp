@@ -0,0 +1,530 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/core/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/// Written in place of each byte of an invalid UTF-8 sequence.
+const std::string kReplacementCharacter = "\xEF\xBF\xBD";
+
+/// Return the length of a valid UTF-8 sequence at offset, or 0.
+static size_t getSequenceLength(const std::string& data, size_t offset) {
+  auto c = static_cast<unsigned char>(data[offset]);
+  size_t length = 0;
+  unsigned char min = 0x80;
+  unsigned char max = 0xBF;
+  if (c >= 0xC2 && c <= 0xDF) {
+    length = 2;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    length = 3;
+    // Reject overlong encodings and UTF-16 surrogates.
+    min = (c == 0xE0) ? 0xA0 : 0x80;
+    max = (c == 0xED) ? 0x9F : 0xBF;
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    length = 4;
+    min = (c == 0xF0) ? 0x90 : 0x80;
+    max = (c == 0xF4) ? 0x8F : 0xBF;
+  } else {
+    return 0;
+  }
+
+  if (offset + length > data.size()) {
+    return 0;
+  }
+
+  auto second = static_cast<unsigned char>(data[offset + 1]);
+  if (second < min || second > max) {
+    return 0;
+  }
+  for (size_t i = 2; i < length; i++) {
+    auto next = static_cast<unsigned char>(data[offset + i]);
+    if (next < 0x80 || next > 0xBF) {
+      return 0;
+    }
+  }
+  return length;
+}
+
+namespace {
+
+/// A recursive descent parser building a property tree in place.
+class JSONTreeParser {
+ public:
+  explicit JSONTreeParser(const std::string& json)
+      : begin_(json.data()), p_(json.data()), end_(json.data() + json.size()) {}
+
+  Status parse(pt::ptree& tree) {
+    skipWhitespace();
+    if (!parseValue(tree, 0)) {
+      return error();
+    }
+    skipWhitespace();
+    if (p_ != end_) {
+      message_ = "Unexpected content";
+      return error();
+    }
+    return Status(0, "OK");
+  }
+
+ private:
+  /// Nested containers beyond this depth are rejected.
+  static const size_t kMaxDepth = 512;
+
+  Status error() const {
+    return Status(1,
+                  "JSON parse error at offset " +
+                      std::to_string(p_ - begin_) + ": " + message_);
+  }
+
+  bool fail(const char* message) {
+    message_ = message;
+    return false;
+  }
+
+  void skipWhitespace() {
+    while (p_ < end_ &&
+           (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) {
+      p_++;
+    }
+  }
+
+  bool parseValue(pt::ptree& tree, size_t depth) {
+    if (p_ == end_) {
+      return fail("Unexpected end of content");
+    }
+
+    switch (*p_) {
+    case '{':
+      return parseObject(tree, depth + 1);
+    case '[':
+      return parseArray(tree, depth + 1);
+    case '"':
+      return parseString(tree.data());
+    case 't':
+      return parseLiteral("true", tree);
+    case 'f':
+      return parseLiteral("false", tree);
+    case 'n':
+      return parseLiteral("null", tree);
+    default:
+      return parseNumber(tree);
+    }
+  }
+
+  bool parseObject(pt::ptree& tree, size_t depth) {
+    if (depth > kMaxDepth) {
+      return fail("Nesting is too deep");
+    }
+
+    p_++;
+    skipWhitespace();
+    if (p_ < end_ && *p_ == '}') {
+      p_++;
+      return true;
+    }
+
+    std::string key;
+    while (true) {
+      if (p_ == end_ || *p_ != '"') {
+        return fail("Expected a key");
+      }
+      key.clear();
+      if (!parseString(key)) {
+        return false;
+      }
+      skipWhitespace();
+      if (p_ == end_ || *p_ != ':') {
+        return fail("Expected ':'");
+      }
+      p_++;
+      skipWhitespace();
+
+      // Parse the value into its place in the tree, avoiding copies.
+      auto child = tree.push_back(std::make_pair(key, pt::ptree()));
+      if (!parseValue(child->second, depth)) {
+        return false;
+      }
+
+      skipWhitespace();
+      if (p_ < end_ && *p_ == ',') {
+        p_++;
+        skipWhitespace();
+      } else if (p_ < end_ && *p_ == '}') {
+        p_++;
+        return true;
+      } else {
+        return fail("Expected ',' or '}'");
+      }
+    }
+  }
+
+  bool parseArray(pt::ptree& tree, size_t depth) {
+    if (depth > kMaxDepth) {
+      return fail("Nesting is too deep");
+    }
+
+    p_++;
+    skipWhitespace();
+    if (p_ < end_ && *p_ == ']') {
+      p_++;
+      return true;
+    }
+
+    while (true) {
+      auto child = tree.push_back(std::make_pair("", pt::ptree()));
+      if (!parseValue(child->second, depth)) {
+        return false;
+      }
+
+      skipWhitespace();
+      if (p_ < end_ && *p_ == ',') {
+        p_++;
+        skipWhitespace();
+      } else if (p_ < end_ && *p_ == ']') {
+        p_++;
+        return true;
+      } else {
+        return fail("Expected ',' or ']'");
+      }
+    }
+  }
+
+  bool parseLiteral(const char* literal, pt::ptree& tree) {
+    auto length = strlen(literal);
+    if (static_cast<size_t>(end_ - p_) < length ||
+        strncmp(p_, literal, length) != 0) {
+      return fail("Invalid literal");
+    }
+    tree.data().assign(p_, length);
+    p_ += length;
+    return true;
+  }
+
+  bool parseNumber(pt::ptree& tree) {
+    auto start = p_;
+    if (p_ < end_ && *p_ == '-') {
+      p_++;
+    }
+    if (p_ < end_ && *p_ == '0') {
+      p_++;
+    } else if (!digits()) {
+      return fail("Invalid value");
+    }
+    if (p_ < end_ && *p_ == '.') {
+      p_++;
+      if (!digits()) {
+        return fail("Invalid number");
+      }
+    }
+    if (p_ < end_ && (*p_ == 'e' || *p_ == 'E')) {
+      p_++;
+      if (p_ < end_ && (*p_ == '+' || *p_ == '-')) {
+        p_++;
+      }
+      if (!digits()) {
+        return fail("Invalid number");
+      }
+    }
+    tree.data().assign(start, p_ - start);
+    return true;
+  }
+
+  /// Consume one or more digits.
+  bool digits() {
+    auto start = p_;
+    while (p_ < end_ && *p_ >= '0' && *p_ <= '9') {
+      p_++;
+    }
+    return p_ != start;
+  }
+
+  bool parseHex(unsigned int& code) {
+    if (end_ - p_ < 4) {
+      return fail("Invalid escape");
+    }
+    code = 0;
+    for (size_t i = 0; i < 4; i++) {
+      auto c = *p_++;
+      code <<= 4;
+      if (c >= '0' && c <= '9') {
+        code |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        code |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        code |= c - 'A' + 10;
+      } else {
+        return fail("Invalid escape");
+      }
+    }
+    return true;
+  }
+
+  static void appendUTF8(unsigned int code, std::string& output) {
+    if (code < 0x80) {
+      output += static_cast<char>(code);
+    } else if (code < 0x800) {
+      output += static_cast<char>(0xC0 | (code >> 6));
+      output += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+      output += static_cast<char>(0xE0 | (code >> 12));
+      output += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      output += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+      output += static_cast<char>(0xF0 | (code >> 18));
+      output += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+      output += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      output += static_cast<char>(0x80 | (code & 0x3F));
+    }
+  }
+
+  bool parseString(std::string& output) {
+    p_++;
+    while (true) {
+      // Copy runs of characters without escapes.
+      auto start = p_;
+      p_ += scanPlainBytes(p_, end_ - p_, 0xFF, "\"\\");
+      output.append(start, p_ - start);
+
+      if (p_ == end_) {
+        return fail("Unterminated string");
+      } else if (*p_ == '"') {
+        p_++;
+        return true;
+      } else if (*p_ != '\\') {
+        return fail("Invalid character in string");
+      }
+
+      p_++;
+      if (p_ == end_) {
+        return fail("Unterminated string");
+      }
+      switch (*p_++) {
+      case '"':
+        output += '"';
+        break;
+      case '\\':
+        output += '\\';
+        break;
+      case '/':
+        output += '/';
+        break;
+      case 'b':
+        output += '\b';
+        break;
+      case 'f':
+        output += '\f';
+        break;
+      case 'n':
+        output += '\n';
+        break;
+      case 'r':
+        output += '\r';
+        break;
+      case 't':
+        output += '\t';
+        break;
+      case 'u': {
+        unsigned int code = 0;
+        if (!parseHex(code)) {
+          return false;
+        }
+        if (code >= 0xD800 && code <= 0xDBFF) {
+          // A high surrogate must be followed by an escaped low surrogate.
+          unsigned int low = 0;
+          if (end_ - p_ < 2 || p_[0] != '\\' || p_[1] != 'u') {
+            return fail("Invalid surrogate pair");
+          }
+          p_ += 2;
+          if (!parseHex(low)) {
+            return false;
+          }
+          if (low < 0xDC00 || low > 0xDFFF) {
+            return fail("Invalid surrogate pair");
+          }
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        } else if (code >= 0xDC00 && code <= 0xDFFF) {
+          return fail("Invalid surrogate pair");
+        }
+        appendUTF8(code, output);
+        break;
+      }
+      default:
+        return fail("Invalid escape");
+      }
+    }
+  }
+
+ private:
+  const char* begin_;
+  const char* p_;
+  const char* end_;
+
+  const char* message_{""};
+};
+}
+
+Status parseJSONTree(const std::string& json, pt::ptree& tree) {
+  // Like boost, the output is unchanged if the content is invalid.
+  pt::ptree parsed;
+  auto status = JSONTreeParser(json).parse(parsed);
+  if (status.ok()) {
+    tree.swap(parsed);
+  }
+  return status;
+}
+
+void JSONWriter::escape(const std::string& data, std::string& output) {
+  static const char* kHexDigits = "0123456789ABCDEF";
+
+  size_t run = 0;
+  size_t i = 0;
+  while (i < data.size()) {
+    // Most content is printable ASCII, append it in runs.
+    i += scanPlainBytes(data.data() + i, data.size() - i, 0x7F, "\"\\/");
+    if (i == data.size()) {
+      break;
+    }
+
+    auto c = static_cast<unsigned char>(data[i]);
+    output.append(data, run, i - run);
+    if (c >= 0x80) {
+      auto length = getSequenceLength(data, i);
+      if (length == 0) {
+        output += kReplacementCharacter;
+        i++;
+      } else {
+        output.append(data, i, length);
+        i += length;
+      }
+      run = i;
+      continue;
+    }
+
+    output += '\\';
+    switch (c) {
+    case '\b':
+      output += 'b';
+      break;
+    case '\f':
+      output += 'f';
+      break;
+    case '\n':
+      output += 'n';
+      break;
+    case '\r':
+      output += 'r';
+      break;
+    case '\t':
+      output += 't';
+      break;
+    case '"':
+    case '\\':
+    case '/':
+      output += static_cast<char>(c);
+      break;
+    default:
+      output += "u00";
+      output += kHexDigits[c >> 4];
+      output += kHexDigits[c & 0xF];
+    }
+    run = ++i;
+  }
+  output.append(data, run, data.size() - run);
+}
+
+void JSONWriter::separate() {
+  if (keyed_) {
+    keyed_ = false;
+    return;
+  }
+
+  if (!written_.empty()) {
+    if (written_.back()) {
+      output_ += ',';
+    }
+    written_.back() = true;
+  }
+}
+
+void JSONWriter::startObject() {
+  separate();
+  output_ += '{';
+  written_.push_back(false);
+}
+
+void JSONWriter::endObject() {
+  written_.pop_back();
+  output_ += '}';
+}
+
+void JSONWriter::startArray() {
+  separate();
+  output_ += '[';
+  written_.push_back(false);
+}
+
+void JSONWriter::endArray() {
+  written_.pop_back();
+  output_ += ']';
+}
+
+void JSONWriter::key(const std::string& name) {
+  separate();
+  output_ += '"';
+  escape(name, output_);
+  output_ += "\":";
+  keyed_ = true;
+}
+
+void JSONWriter::value(const std::string& data) {
+  separate();
+  output_ += '"';
+  escape(data, output_);
+  output_ += '"';
+}
+
+void JSONWriter::members(const std::string& json) {
+  if (json.empty()) {
+    return;
+  }
+  separate();
+  output_ += json;
+}
+
+void JSONWriter::tree(const pt::ptree& tree) {
+  this->tree(tree, true);
+}
+
+void JSONWriter::tree(const pt::ptree& tree, bool root) {
+  // Like boost, the root is always an object and empty nodes are values.
+  if (!root && tree.empty()) {
+    value(tree.data());
+  } else if (!root && tree.count("") == tree.size()) {
+    startArray();
+    for (const auto& child : tree) {
+      this->tree(child.second, false);
+    }
+    endArray();
+  } else {
+    startObject();
+    for (const auto& child : tree) {
+      key(child.first);
+      this->tree(child.second, false);
+    }
+    endObject();
+  }
+}
+}
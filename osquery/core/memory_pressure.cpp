@@ -0,0 +1,197 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include <osquery/core.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/core/memory_pressure.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/process.h"
+#include "osquery/core/watcher.h"
+
+namespace osquery {
+
+CLI_FLAG(uint64,
+         worker_memory_shed,
+         75,
+         "Percent of the memory limit where the worker releases caches");
+
+CLI_FLAG(uint64,
+         worker_memory_pause,
+         90,
+         "Percent of the memory limit where low priority queries pause");
+
+/// Percent below a threshold the footprint must fall to lower the level.
+const size_t kMemoryPressureHysteresis = 5;
+
+/// Seconds between repeated degradation steps while under pressure.
+const size_t kMemoryPressureRepeat = 60;
+
+/// Milliseconds between footprint measurements.
+const size_t kMemoryPressureInterval = 1000;
+
+using MemoryPressureHandlers =
+    std::vector<std::pair<std::string, MemoryPressure::Handler>>;
+
+static MemoryPressureHandlers& getHandlers() {
+  static MemoryPressureHandlers handlers;
+  return handlers;
+}
+
+static Mutex& getHandlersMutex() {
+  static Mutex mutex;
+  return mutex;
+}
+
+static std::atomic<int> kMemoryPressureLevel{0};
+
+/// The time the degradation steps were last applied.
+static size_t kMemoryPressureApplied{0};
+
+std::string getMemoryPressureName(MemoryPressureLevel level) {
+  switch (level) {
+  case MemoryPressureLevel::SHED:
+    return "shed";
+  case MemoryPressureLevel::PAUSE:
+    return "pause";
+  default:
+    return "none";
+  }
+}
+
+/// The percent of the limit where a level begins, 0 if disabled.
+static size_t getThreshold(MemoryPressureLevel level) {
+  if (level == MemoryPressureLevel::PAUSE) {
+    return FLAGS_worker_memory_pause;
+  }
+  return (level == MemoryPressureLevel::SHED) ? FLAGS_worker_memory_shed : 0;
+}
+
+void MemoryPressure::addHandler(const std::string& name, Handler handler) {
+  WriteLock lock(getHandlersMutex());
+  getHandlers().push_back(std::make_pair(name, std::move(handler)));
+}
+
+MemoryPressureLevel MemoryPressure::level() {
+  return static_cast<MemoryPressureLevel>(kMemoryPressureLevel.load());
+}
+
+MemoryPressureLevel MemoryPressure::getLevel(size_t footprint, size_t limit) {
+  if (limit == 0) {
+    return MemoryPressureLevel::NONE;
+  }
+
+  auto percent = footprint / (limit / 100.0);
+  for (auto level : {MemoryPressureLevel::PAUSE, MemoryPressureLevel::SHED}) {
+    auto threshold = getThreshold(level);
+    if (threshold > 0 && percent >= threshold) {
+      return level;
+    }
+  }
+  return MemoryPressureLevel::NONE;
+}
+
+MemoryPressureLevel MemoryPressure::update(size_t footprint, size_t limit) {
+  auto previous = level();
+  auto current = getLevel(footprint, limit);
+  if (current < previous) {
+    // Stay at the previous level until the footprint is clearly below it.
+    auto threshold = getThreshold(previous);
+    auto relieved = (threshold > kMemoryPressureHysteresis)
+                        ? threshold - kMemoryPressureHysteresis
+                        : 0;
+    if (limit > 0 && footprint / (limit / 100.0) >= relieved) {
+      current = previous;
+    }
+  }
+
+  auto now = getUnixTime();
+  bool apply = (current != previous);
+  if (current > MemoryPressureLevel::NONE &&
+      now - kMemoryPressureApplied >= kMemoryPressureRepeat) {
+    apply = true;
+  }
+  kMemoryPressureLevel = static_cast<int>(current);
+  Metrics::gauge("worker_memory_pressure").set(static_cast<int>(current));
+  if (!apply) {
+    return current;
+  }
+  kMemoryPressureApplied = now;
+
+  MemoryPressureHandlers handlers;
+  {
+    ReadLock lock(getHandlersMutex());
+    handlers = getHandlers();
+  }
+
+  auto name = getMemoryPressureName(current);
+  auto usage = std::to_string(footprint / (1024 * 1024)) + " of " +
+               std::to_string(limit / (1024 * 1024)) + " MB";
+  if (current == MemoryPressureLevel::NONE) {
+    LOG(INFO) << "Worker memory pressure relieved (" << usage << ")";
+  }
+
+  // Handlers may take their own locks, they are called without the registry.
+  for (const auto& handler : handlers) {
+    auto step = handler.second(current);
+    if (step.empty()) {
+      continue;
+    }
+    Metrics::counter("worker_memory_degradations", "step=" + handler.first)
+        .add();
+    if (current == MemoryPressureLevel::NONE) {
+      LOG(INFO) << "Worker memory pressure relieved: " << handler.first << ": "
+                << step;
+    } else {
+      LOG(WARNING) << "Worker memory pressure " << name << " (" << usage
+                   << "): " << handler.first << ": " << step;
+    }
+  }
+  return current;
+}
+
+void MemoryPressure::reset() {
+  kMemoryPressureLevel = 0;
+  kMemoryPressureApplied = 0;
+}
+
+void MemoryPressureRunner::start() {
+  auto limit = getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024;
+  if (limit == 0 || FLAGS_worker_memory_shed == 0) {
+    return;
+  }
+
+  // The watchdog measures the footprint from the worker's first sample.
+  auto process = PlatformProcess::getCurrentProcess();
+  ProcessUsage usage;
+  if (process == nullptr || !process->getUsage(usage)) {
+    return;
+  }
+  auto initial = usage.resident_size;
+
+  while (!interrupted()) {
+    pauseMilli(kMemoryPressureInterval);
+    if (!process->getUsage(usage)) {
+      continue;
+    }
+
+    auto footprint = (usage.resident_size > initial)
+                         ? static_cast<size_t>(usage.resident_size - initial)
+                         : 0;
+    MemoryPressure::update(footprint, limit);
+  }
+}
+}
@@ -0,0 +1,87 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/dispatcher.h>
+
+namespace osquery {
+
+/// How close the worker's memory footprint is to the watchdog memory limit.
+enum class MemoryPressureLevel {
+  /// Below `--worker_memory_shed` percent of the limit.
+  NONE = 0,
+
+  /// Caches and buffers are released.
+  SHED = 1,
+
+  /// Above `--worker_memory_pause` percent, low priority queries are paused.
+  PAUSE = 2,
+};
+
+/// The name of a memory pressure level, such as "shed".
+std::string getMemoryPressureName(MemoryPressureLevel level);
+
+/**
+ * @brief Degrade the worker gracefully as it nears its memory limit.
+ *
+ * The watchdog restarts a worker whose footprint exceeds the memory limit,
+ * discarding every cache and in-flight query. The worker instead measures
+ * its own footprint and, as it approaches the limit, calls the degradation
+ * handlers registered by each subsystem. A handler releases what it can for
+ * the level and returns a short description of what it did.
+ *
+ * Handlers are called when the level rises, again each minute while the
+ * worker remains under pressure, and once when the pressure is relieved so
+ * paused work may resume.
+ */
+class MemoryPressure : private boost::noncopyable {
+ public:
+  /// A degradation step, returns what was released or an empty string.
+  using Handler = std::function<std::string(MemoryPressureLevel level)>;
+
+  /// Register a named degradation step.
+  static void addHandler(const std::string& name, Handler handler);
+
+  /// The current level.
+  static MemoryPressureLevel level();
+
+  /// Classify a footprint in bytes relative to a limit in bytes.
+  static MemoryPressureLevel getLevel(size_t footprint, size_t limit);
+
+  /**
+   * @brief Apply the degradation steps for a new footprint measurement.
+   *
+   * The level does not fall until the footprint is a few percent below the
+   * level's threshold, so a worker hovering at a threshold does not
+   * repeatedly pause and resume work.
+   *
+   * @param footprint Bytes allocated by the worker since it started.
+   * @param limit The watchdog memory limit in bytes.
+   * @return The level after the measurement.
+   */
+  static MemoryPressureLevel update(size_t footprint, size_t limit);
+
+  /// Testing only, return to the NONE level without calling handlers.
+  static void reset();
+};
+
+/// Measure the worker's footprint and apply MemoryPressure::update.
+class MemoryPressureRunner : public InternalRunnable {
+ public:
+  /// Runnable thread's entry point.
+  void start() override;
+};
+}
@@ -0,0 +1,251 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <map>
+#include <memory>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/core/metrics.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+FLAG(string,
+     metrics_textfile,
+     "",
+     "Path to write internal metrics in the Prometheus text format");
+
+FLAG(uint64,
+     metrics_textfile_interval,
+     60,
+     "Seconds between writes of --metrics_textfile");
+
+/// Metric names are prefixed in the Prometheus format.
+const std::string kMetricsPrefix{"osquery_"};
+
+using MetricKey = std::pair<std::string, std::string>;
+
+/// The registry's metrics, entries are never removed.
+static std::map<MetricKey, std::unique_ptr<Metric>>& getMetrics() {
+  static std::map<MetricKey, std::unique_ptr<Metric>> metrics;
+  return metrics;
+}
+
+/// The registered collectors.
+static std::vector<Metrics::Collector>& getCollectors() {
+  static std::vector<Metrics::Collector> collectors;
+  return collectors;
+}
+
+/// Protect the metrics and collectors, not the values of metrics.
+static Mutex& getMetricsMutex() {
+  static Mutex mutex;
+  return mutex;
+}
+
+const std::string& metricTypeName(MetricType type) {
+  static const std::string kCounter{"counter"};
+  static const std::string kGauge{"gauge"};
+  static const std::string kHistogram{"histogram"};
+  if (type == MetricType::GAUGE) {
+    return kGauge;
+  } else if (type == MetricType::HISTOGRAM) {
+    return kHistogram;
+  }
+  return kCounter;
+}
+
+/// The histogram bucket of a value, see MetricSample::buckets.
+static inline size_t getMetricBucket(unsigned long long value) {
+  size_t bucket = 0;
+  while (value > 0 && bucket < kMetricBuckets - 1) {
+    value >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+void Metric::observe(unsigned long long value) {
+  value_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  buckets_[getMetricBucket(value)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metric::sample(MetricSample& sample) const {
+  sample.name = name_;
+  sample.labels = labels_;
+  sample.type = type_;
+  sample.value = value_.load(std::memory_order_relaxed);
+  sample.buckets.clear();
+  if (type_ == MetricType::HISTOGRAM) {
+    sample.sum = sum_.load(std::memory_order_relaxed);
+    for (const auto& bucket : buckets_) {
+      sample.buckets.push_back(bucket.load(std::memory_order_relaxed));
+    }
+  }
+}
+
+Metric& Metrics::get(MetricType type,
+                     const std::string& name,
+                     const std::string& labels) {
+  auto key = std::make_pair(name, labels);
+  {
+    ReadLock lock(getMetricsMutex());
+    auto it = getMetrics().find(key);
+    if (it != getMetrics().end()) {
+      return *it->second;
+    }
+  }
+
+  WriteLock lock(getMetricsMutex());
+  auto& metric = getMetrics()[key];
+  if (metric == nullptr) {
+    metric = std::make_unique<Metric>(type, name, labels);
+  }
+  return *metric;
+}
+
+Metric& Metrics::counter(const std::string& name, const std::string& labels) {
+  return get(MetricType::COUNTER, name, labels);
+}
+
+Metric& Metrics::gauge(const std::string& name, const std::string& labels) {
+  return get(MetricType::GAUGE, name, labels);
+}
+
+Metric& Metrics::histogram(const std::string& name,
+                           const std::string& labels) {
+  return get(MetricType::HISTOGRAM, name, labels);
+}
+
+void Metrics::addCollector(Collector collector) {
+  WriteLock lock(getMetricsMutex());
+  getCollectors().push_back(std::move(collector));
+}
+
+void Metrics::samples(std::vector<MetricSample>& samples) {
+  std::vector<Collector> collectors;
+  {
+    ReadLock lock(getMetricsMutex());
+    for (const auto& metric : getMetrics()) {
+      samples.emplace_back();
+      metric.second->sample(samples.back());
+    }
+    collectors = getCollectors();
+  }
+
+  // Collectors may use their own locks, they are called without the registry.
+  for (const auto& collector : collectors) {
+    collector(samples);
+  }
+
+  std::stable_sort(samples.begin(),
+                   samples.end(),
+                   [](const MetricSample& a, const MetricSample& b) {
+                     return std::tie(a.name, a.labels) <
+                            std::tie(b.name, b.labels);
+                   });
+}
+
+/// Write key=value labels as Prometheus labels, with an optional extra label.
+static std::string getPrometheusLabels(const std::string& labels,
+                                       const std::string& extra = "") {
+  std::string output;
+  auto pairs = split(labels, ",");
+  if (!extra.empty()) {
+    pairs.push_back(extra);
+  }
+
+  for (const auto& pair : pairs) {
+    auto delimiter = pair.find('=');
+    if (delimiter == std::string::npos) {
+      continue;
+    }
+
+    output += (output.empty()) ? "{" : ",";
+    output += pair.substr(0, delimiter) + "=\"";
+    for (const auto& c : pair.substr(delimiter + 1)) {
+      if (c == '"' || c == '\\') {
+        output += '\\';
+      }
+      output += (c == '\n') ? ' ' : c;
+    }
+    output += "\"";
+  }
+  return (output.empty()) ? output : output + "}";
+}
+
+std::string Metrics::toPrometheus() {
+  std::vector<MetricSample> metrics;
+  samples(metrics);
+
+  std::string output;
+  const std::string* last = nullptr;
+  for (const auto& sample : metrics) {
+    auto name = kMetricsPrefix + sample.name;
+    if (last == nullptr || *last != sample.name) {
+      output += "# TYPE " + name + " " + metricTypeName(sample.type) + "\n";
+      last = &sample.name;
+    }
+
+    if (sample.type != MetricType::HISTOGRAM) {
+      output += name + getPrometheusLabels(sample.labels) + " " +
+                std::to_string(sample.value) + "\n";
+      continue;
+    }
+
+    // Prometheus buckets are cumulative and bounded by an inclusive le.
+    unsigned long long count = 0;
+    for (size_t i = 0; i < sample.buckets.size(); i++) {
+      count += sample.buckets[i];
+      auto le = (i + 1 == sample.buckets.size())
+                    ? std::string("+Inf")
+                    : std::to_string((1ULL << i) - 1);
+      output += name + "_bucket" +
+                getPrometheusLabels(sample.labels, "le=" + le) + " " +
+                std::to_string(count) + "\n";
+    }
+    output += name + "_sum" + getPrometheusLabels(sample.labels) + " " +
+              std::to_string(sample.sum) + "\n";
+    output += name + "_count" + getPrometheusLabels(sample.labels) + " " +
+              std::to_string(sample.value) + "\n";
+  }
+  return output;
+}
+
+void Metrics::writeTextfile() {
+  if (FLAGS_metrics_textfile.empty()) {
+    return;
+  }
+
+  // Collectors such as node_exporter read the file while it is replaced.
+  auto temporary = FLAGS_metrics_textfile + ".tmp";
+  auto status = writeTextFile(temporary, toPrometheus(), 0644);
+  if (!status.ok()) {
+    VLOG(1) << "Cannot write metrics: " << status.getMessage();
+    return;
+  }
+
+  boost::system::error_code ec;
+  fs::rename(temporary, FLAGS_metrics_textfile, ec);
+  if (ec) {
+    VLOG(1) << "Cannot replace metrics: " << ec.message();
+  }
+}
+}
@@ -0,0 +1,142 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/// The kinds of internal metrics.
+enum class MetricType {
+  /// A monotonic count of occurrences.
+  COUNTER,
+  /// A value that may go up or down.
+  GAUGE,
+  /// A distribution of observed values in power-of-two buckets.
+  HISTOGRAM,
+};
+
+/// The number of histogram buckets, the last holds values of 2^30 and above.
+constexpr size_t kMetricBuckets = 32;
+
+/// A point-in-time copy of a metric.
+struct MetricSample {
+  std::string name;
+
+  /// Comma-separated key=value labels, such as "subscriber=file_events".
+  std::string labels;
+
+  MetricType type{MetricType::COUNTER};
+
+  /// The counter or gauge value, or the number of histogram observations.
+  long long value{0};
+
+  /// The sum of histogram observations.
+  unsigned long long sum{0};
+
+  /// Histogram observations with values in [2^(i-1), 2^i), 0 is in bucket 0.
+  std::vector<unsigned long long> buckets;
+};
+
+/**
+ * @brief A counter, gauge, or histogram updated without locks.
+ *
+ * Metrics are owned by the Metrics registry and are never removed, code on
+ * hot paths should look a metric up once and keep the reference:
+ *
+ * @code{.cpp}
+ *   static auto& executed = Metrics::counter("schedule_queries_executed");
+ *   executed.add();
+ * @endcode
+ */
+class Metric : private boost::noncopyable {
+ public:
+  Metric(MetricType type, std::string name, std::string labels)
+      : type_(type), name_(std::move(name)), labels_(std::move(labels)) {}
+
+  /// Increment a counter or move a gauge.
+  void add(long long value = 1) {
+    value_.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  /// Set a gauge.
+  void set(long long value) {
+    value_.store(value, std::memory_order_relaxed);
+  }
+
+  /// Record a histogram observation.
+  void observe(unsigned long long value);
+
+  /// Copy the metric's current values.
+  void sample(MetricSample& sample) const;
+
+ private:
+  MetricType type_;
+  std::string name_;
+  std::string labels_;
+
+  std::atomic<long long> value_{0};
+  std::atomic<unsigned long long> sum_{0};
+  std::array<std::atomic<unsigned long long>, kMetricBuckets> buckets_{};
+};
+
+/**
+ * @brief The internal metrics of this process.
+ *
+ * Counters of dropped, sampled, buffered, and slow work are reported in the
+ * osquery_metrics table and, with --metrics_textfile, in the Prometheus text
+ * format. Components with existing counters register a collector instead of
+ * updating a metric, and are sampled when the metrics are read.
+ */
+class Metrics : private boost::noncopyable {
+ public:
+  /// A function appending samples of a component's counters.
+  using Collector = std::function<void(std::vector<MetricSample>&)>;
+
+  /// Get or create a counter.
+  static Metric& counter(const std::string& name,
+                         const std::string& labels = "");
+
+  /// Get or create a gauge.
+  static Metric& gauge(const std::string& name,
+                       const std::string& labels = "");
+
+  /// Get or create a histogram.
+  static Metric& histogram(const std::string& name,
+                           const std::string& labels = "");
+
+  /// Add a collector, sampled after the registry's metrics.
+  static void addCollector(Collector collector);
+
+  /// Copy every metric and collected sample, ordered by name and labels.
+  static void samples(std::vector<MetricSample>& samples);
+
+  /// Serialize every sample in the Prometheus text exposition format.
+  static std::string toPrometheus();
+
+  /// Write the Prometheus text format to --metrics_textfile, if set.
+  static void writeTextfile();
+
+ private:
+  static Metric& get(MetricType type,
+                     const std::string& name,
+                     const std::string& labels);
+};
+
+/// The name of a metric type.
+const std::string& metricTypeName(MetricType type);
+}
@@ -9,11 +9,19 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#ifdef __APPLE__
+#include <libproc.h>
+#endif
+
 #include <vector>
 
 #include <osquery/logger.h>
@@ -84,6 +92,92 @@ ProcessState PlatformProcess::checkStatus(int& status) const {
   return PROCESS_STATE_CHANGE;
 }
 
+#ifdef __linux__
+/// Read a small procfs file into a buffer without allocating.
+static bool readProcFile(const std::string& path, char* buffer, size_t size) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  auto length = ::read(fd, buffer, size - 1);
+  ::close(fd);
+  if (length <= 0) {
+    return false;
+  }
+  buffer[length] = 0;
+  return true;
+}
+#endif
+
+bool PlatformProcess::getUsage(ProcessUsage& usage) const {
+  if (!isValid()) {
+    return false;
+  }
+
+#ifdef __linux__
+  auto path = "/proc/" + std::to_string(nativeHandle());
+  char buffer[1024];
+  if (!readProcFile(path + "/stat", buffer, sizeof(buffer))) {
+    return false;
+  }
+
+  // The command name may include spaces, the fields follow its parenthesis.
+  auto fields = strrchr(buffer, ')');
+  if (fields == nullptr) {
+    return false;
+  }
+
+  int parent = 0;
+  unsigned long long user_ticks = 0;
+  unsigned long long system_ticks = 0;
+  if (sscanf(fields + 1,
+             " %*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+             &parent,
+             &user_ticks,
+             &system_ticks) != 3) {
+    return false;
+  }
+
+  auto hz = ::sysconf(_SC_CLK_TCK);
+  if (hz <= 0) {
+    return false;
+  }
+  usage.parent = static_cast<pid_t>(parent);
+  usage.user_time = user_ticks * 1000000 / hz;
+  usage.system_time = system_ticks * 1000000 / hz;
+
+  // The second field of statm is the resident set size in pages.
+  unsigned long long pages = 0;
+  if (readProcFile(path + "/statm", buffer, sizeof(buffer))) {
+    sscanf(buffer, "%*u %llu", &pages);
+  }
+  usage.resident_size = pages * ::sysconf(_SC_PAGESIZE);
+  return true;
+#elif defined(__APPLE__)
+  struct proc_bsdinfo bsd;
+  if (proc_pidinfo(nativeHandle(), PROC_PIDTBSDINFO, 0, &bsd, sizeof(bsd)) !=
+      sizeof(bsd)) {
+    return false;
+  }
+
+  struct proc_taskinfo task;
+  if (proc_pidinfo(nativeHandle(), PROC_PIDTASKINFO, 0, &task, sizeof(task)) !=
+      sizeof(task)) {
+    return false;
+  }
+
+  // Task times are nanoseconds.
+  usage.parent = static_cast<pid_t>(bsd.pbi_ppid);
+  usage.user_time = task.pti_total_user / 1000;
+  usage.system_time = task.pti_total_system / 1000;
+  usage.resident_size = task.pti_resident_size;
+  return true;
+#else
+  return false;
+#endif
+}
+
 std::shared_ptr<PlatformProcess> PlatformProcess::getCurrentProcess() {
   pid_t pid = ::getpid();
   return std::make_shared<PlatformProcess>(pid);
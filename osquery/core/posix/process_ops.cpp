@@ -11,13 +11,27 @@
 #include <string>
 
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sys/resource.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include <boost/optional.hpp>
 
@@ -29,6 +43,47 @@ namespace osquery {
 
 DECLARE_uint64(alarm_timeout);
 
+#ifdef __linux__
+FLAG(bool,
+     background_sched_idle,
+     false,
+     "Run background threads with the SCHED_IDLE scheduling policy");
+
+/*
+ * These are the io priority groups as implemented by CFQ. RT is the realtime
+ * class, it always gets premium service. BE is the best-effort scheduling
+ * class, the default for any process. IDLE is the idle scheduling class, it
+ * is only served when no one else is using the disk.
+ */
+enum {
+  IOPRIO_CLASS_NONE,
+  IOPRIO_CLASS_RT,
+  IOPRIO_CLASS_BE,
+  IOPRIO_CLASS_IDLE,
+};
+
+/*
+ * 8 best effort priority levels are supported
+ */
+#define IOPRIO_BE_NR (8)
+
+enum {
+  IOPRIO_WHO_PROCESS = 1,
+  IOPRIO_WHO_PGRP,
+  IOPRIO_WHO_USER,
+};
+
+/// An I/O priority is the class above 13 bits of class data.
+static inline int getIOPriority(int io_class, int data) {
+  return (io_class << 13) | data;
+}
+
+/// Linux threads have their own nice value and I/O priority.
+static inline id_t getThreadId() {
+  return static_cast<id_t>(syscall(SYS_gettid));
+}
+#endif
+
 int platformGetUid() {
   return ::getuid();
 }
@@ -77,6 +132,77 @@ bool platformModuleClose(ModuleHandle module) {
 
 void setToBackgroundPriority() {
   setpriority(PRIO_PGRP, 0, 10);
+#ifdef __linux__
+  // The lowest best-effort level, the process still shares the disk.
+  syscall(SYS_ioprio_set,
+          IOPRIO_WHO_PGRP,
+          0,
+          getIOPriority(IOPRIO_CLASS_BE, IOPRIO_BE_NR - 1));
+#elif defined(__APPLE__)
+  setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_PROCESS, IOPOL_THROTTLE);
+#endif
+}
+
+void setThreadToBackgroundPriority() {
+#ifdef __linux__
+  auto tid = getThreadId();
+  setpriority(PRIO_PROCESS, tid, 19);
+  syscall(SYS_ioprio_set,
+          IOPRIO_WHO_PROCESS,
+          tid,
+          getIOPriority(IOPRIO_CLASS_IDLE, 0));
+  if (FLAGS_background_sched_idle) {
+    struct sched_param param;
+    param.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+  }
+#elif defined(__APPLE__)
+  // Background threads are also throttled for I/O.
+  setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG);
+#endif
+}
+
+BackgroundPriorityScope::BackgroundPriorityScope() {
+#ifdef __linux__
+  // Lowering the nice value again requires privileges.
+  if (!isUserAdmin()) {
+    return;
+  }
+
+  auto tid = getThreadId();
+  errno = 0;
+  nice_ = getpriority(PRIO_PROCESS, tid);
+  if (errno != 0) {
+    return;
+  }
+  ioprio_ = static_cast<int>(syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, tid));
+  if (ioprio_ < 0) {
+    return;
+  }
+
+  setpriority(PRIO_PROCESS, tid, 19);
+  syscall(SYS_ioprio_set,
+          IOPRIO_WHO_PROCESS,
+          tid,
+          getIOPriority(IOPRIO_CLASS_IDLE, 0));
+  lowered_ = true;
+#elif defined(__APPLE__)
+  lowered_ = (setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG) == 0);
+#endif
+}
+
+BackgroundPriorityScope::~BackgroundPriorityScope() {
+  if (!lowered_) {
+    return;
+  }
+
+#ifdef __linux__
+  auto tid = getThreadId();
+  setpriority(PRIO_PROCESS, tid, nice_);
+  syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, ioprio_);
+#elif defined(__APPLE__)
+  setpriority(PRIO_DARWIN_THREAD, 0, 0);
+#endif
 }
 
 // Helper function to determine if thread is running with admin privilege.
@@ -94,4 +220,93 @@ int platformGetTid() {
 #endif
   return 0;
 }
+
+static inline uint64_t toMicroseconds(const struct timeval& tv) {
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+/// Read the process resident memory without allocating.
+static uint64_t getResidentSize() {
+#ifdef __linux__
+  // The second field of statm is the resident set size in pages.
+  int fd = ::open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+
+  char buffer[128] = {0};
+  auto size = ::read(fd, buffer, sizeof(buffer) - 1);
+  ::close(fd);
+  if (size <= 0) {
+    return 0;
+  }
+
+  unsigned long long pages = 0;
+  char* resident = strchr(buffer, ' ');
+  if (resident != nullptr) {
+    pages = strtoull(resident + 1, nullptr, 10);
+  }
+  return static_cast<uint64_t>(pages) * sysconf(_SC_PAGESIZE);
+#elif defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(),
+                MACH_TASK_BASIC_INFO,
+                reinterpret_cast<task_info_t>(&info),
+                &count) != KERN_SUCCESS) {
+    return 0;
+  }
+  return static_cast<uint64_t>(info.resident_size);
+#else
+  // Fall back to the maximum resident size, reported in kilobytes.
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+bool getResourceUsage(ResourceUsage& usage) {
+  struct timespec now;
+  if (clock_gettime(CLOCK_MONOTONIC, &now) == 0) {
+    usage.wall_time =
+        static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+  }
+  usage.resident_size = getResidentSize();
+
+#if defined(RUSAGE_THREAD)
+  struct rusage thread_usage;
+  if (getrusage(RUSAGE_THREAD, &thread_usage) != 0) {
+    return false;
+  }
+  usage.user_time = toMicroseconds(thread_usage.ru_utime);
+  usage.system_time = toMicroseconds(thread_usage.ru_stime);
+#elif defined(__APPLE__)
+  thread_basic_info_data_t info;
+  mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+  auto thread = mach_thread_self();
+  auto result = thread_info(thread,
+                            THREAD_BASIC_INFO,
+                            reinterpret_cast<thread_info_t>(&info),
+                            &count);
+  mach_port_deallocate(mach_task_self(), thread);
+  if (result != KERN_SUCCESS) {
+    return false;
+  }
+  usage.user_time = static_cast<uint64_t>(info.user_time.seconds) * 1000000 +
+                    info.user_time.microseconds;
+  usage.system_time =
+      static_cast<uint64_t>(info.system_time.seconds) * 1000000 +
+      info.system_time.microseconds;
+#else
+  struct rusage process_usage;
+  if (getrusage(RUSAGE_SELF, &process_usage) != 0) {
+    return false;
+  }
+  usage.user_time = toMicroseconds(process_usage.ru_utime);
+  usage.system_time = toMicroseconds(process_usage.ru_stime);
+#endif
+  return true;
+}
 }
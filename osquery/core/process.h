@@ -34,6 +34,7 @@
 #endif
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/system.h>
 
 namespace osquery {
@@ -55,6 +56,26 @@ enum ProcessState {
   PROCESS_STATE_CHANGE
 };
 
+/**
+ * @brief A cheap sample of a process's resource usage.
+ *
+ * The watcher samples its worker and extensions every interval. A sample
+ * reads only the platform's process accounting, not a processes table row.
+ */
+struct ProcessUsage {
+  /// The parent process ID.
+  pid_t parent{-1};
+
+  /// User CPU time of every thread in microseconds.
+  uint64_t user_time{0};
+
+  /// System CPU time of every thread in microseconds.
+  uint64_t system_time{0};
+
+  /// Resident memory in bytes.
+  uint64_t resident_size{0};
+};
+
 /**
  * @brief Platform-agnostic process object.
  *
@@ -134,6 +155,17 @@ class PlatformProcess : private boost::noncopyable {
 
   virtual ProcessState checkStatus(int& status) const;
 
+  /**
+   * @brief Sample the CPU times, memory, and parent of the process.
+   *
+   * On Linux this reads `/proc/<pid>/stat` and `statm`, on macOS it uses the
+   * process task info, and on Windows the process times and memory counters.
+   *
+   * @param usage Output sample.
+   * @return false if the process could not be sampled on this platform.
+   */
+  bool getUsage(ProcessUsage& usage) const;
+
   /// Returns the current process
   static std::shared_ptr<PlatformProcess> getCurrentProcess();
 
@@ -268,9 +300,42 @@ bool platformModuleClose(ModuleHandle module);
  */
 bool isLauncherProcessDead(PlatformProcess& launcher);
 
-/// Sets the current process to run with background scheduling priority.
+/// Sets the current process to run with background CPU and I/O priority.
 void setToBackgroundPriority();
 
+/**
+ * @brief Sets the calling thread to run with the lowest scheduling priority.
+ *
+ * The thread's I/O is also served after other processes' I/O. With
+ * `--background_sched_idle` Linux threads use the SCHED_IDLE policy, and only
+ * run when a CPU is otherwise idle.
+ */
+void setThreadToBackgroundPriority();
+
+/**
+ * @brief Lower the calling thread's CPU and I/O priority while in scope.
+ *
+ * Threads that also execute normal priority work, such as schedule workers,
+ * use this for expensive work like low priority scheduled queries. The
+ * previous priorities are restored when the scope ends. Linux threads are
+ * only lowered when running as root, which may raise them again.
+ */
+class BackgroundPriorityScope : private boost::noncopyable {
+ public:
+  BackgroundPriorityScope();
+  ~BackgroundPriorityScope();
+
+ private:
+  /// Set if the thread's priority was lowered.
+  bool lowered_{false};
+
+  /// The thread's previous nice value.
+  int nice_{0};
+
+  /// The thread's previous I/O priority.
+  int ioprio_{0};
+};
+
 /**
 * @brief Returns the current processes pid
 *
@@ -286,4 +351,17 @@ int platformGetPid();
 * and on posix platforms returns gettid()
 */
 int platformGetTid();
+
+/**
+* @brief Sample the resource usage of the calling thread.
+*
+* This is cheap enough to call around every scheduled query: it does not
+* allocate or use the processes table. CPU times are for the calling thread
+* where the platform supports it, so concurrent work on other threads is not
+* included. Memory is always measured for the whole process.
+*
+* @param usage Output sample.
+* @return false if the CPU times could not be read.
+*/
+bool getResourceUsage(ResourceUsage& usage);
 }
@@ -0,0 +1,373 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+
+#ifndef WIN32
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+#include <boost/filesystem/path.hpp>
+
+#include <osquery/core.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/core/profiler.h"
+#include "osquery/core/worker_stats.h"
+
+namespace osquery {
+
+CLI_FLAG(bool,
+         worker_profile,
+         false,
+         "Sample worker stacks, log a profile when nearing watchdog limits");
+
+CLI_FLAG(uint64,
+         worker_profile_hz,
+         10,
+         "Stack samples each second of worker CPU time for --worker_profile");
+
+/// The number of samples kept, the oldest are overwritten.
+const size_t kProfileSamples = 1024;
+
+/// The deepest stack recorded for a sample.
+const size_t kProfileFrames = 24;
+
+/// Query and table names are truncated to fit a sample.
+const size_t kProfileNameSize = 64;
+
+/// The highest sample rate accepted.
+const size_t kProfileMaxHz = 1000;
+
+/// Seconds between profile dumps requested by the watcher.
+const size_t kProfileDumpInterval = 60;
+
+/// The scheduled query and table executing on this thread.
+static thread_local const char* kProfileQuery{nullptr};
+static thread_local const char* kProfileTable{nullptr};
+
+WorkerProfileScope::WorkerProfileScope(Kind kind, const std::string& name)
+    : kind_(kind) {
+  auto& current = (kind_ == QUERY) ? kProfileQuery : kProfileTable;
+  previous_ = current;
+  current = name.c_str();
+}
+
+WorkerProfileScope::~WorkerProfileScope() {
+  auto& current = (kind_ == QUERY) ? kProfileQuery : kProfileTable;
+  current = previous_;
+}
+
+std::string WorkerProfiler::summarize(
+    const std::vector<WorkerProfileSample>& samples, size_t top) {
+  std::map<std::string, size_t> queries;
+  std::map<std::string, size_t> tables;
+  std::map<std::string, size_t> functions;
+  for (const auto& sample : samples) {
+    if (!sample.query.empty()) {
+      queries[sample.query]++;
+    }
+    if (!sample.table.empty()) {
+      tables[sample.table]++;
+    }
+    if (!sample.function.empty()) {
+      functions[sample.function]++;
+    }
+  }
+
+  std::stringstream summary;
+  summary << samples.size() << " samples";
+  auto section = [&summary, &samples, top](
+      const std::string& label, const std::map<std::string, size_t>& counts) {
+    if (counts.empty()) {
+      return;
+    }
+
+    // Order by samples then by name, the map iterates names in order.
+    std::vector<std::pair<std::string, size_t>> sorted(counts.begin(),
+                                                       counts.end());
+    std::stable_sort(sorted.begin(),
+                     sorted.end(),
+                     [](const std::pair<std::string, size_t>& a,
+                        const std::pair<std::string, size_t>& b) {
+                       return a.second > b.second;
+                     });
+    summary << "; " << label << ":";
+    for (size_t i = 0; i < sorted.size() && i < top; i++) {
+      summary << ((i == 0) ? " " : ", ") << sorted[i].first << " "
+              << (sorted[i].second * 100 / samples.size()) << "%";
+    }
+  };
+  section("queries", queries);
+  section("tables", tables);
+  section("functions", functions);
+  return summary.str();
+}
+
+void WorkerProfiler::dump(const std::string& reason) {
+  std::vector<WorkerProfileSample> samples;
+  auto dropped = collect(samples);
+  LOG(WARNING) << "Worker profile (" << reason
+               << "): " << summarize(samples, 5)
+               << ((dropped > 0) ? "; dropped " + std::to_string(dropped)
+                                 : "");
+}
+
+#ifndef WIN32
+
+/// A sample slot written by the signal handler.
+struct WorkerProfileSlot {
+  /// Odd while the handler writes the slot.
+  std::atomic<uint32_t> sequence;
+
+  /// The sample index written to this slot.
+  std::atomic<uint64_t> index;
+
+  int depth;
+  void* frames[kProfileFrames];
+  char query[kProfileNameSize];
+  char table[kProfileNameSize];
+};
+
+/// The ring of samples, static storage so the handler never allocates.
+static WorkerProfileSlot kProfileRing[kProfileSamples];
+
+/// The index of the next sample written.
+static std::atomic<uint64_t> kProfileNext{0};
+
+/// The index of the next sample collected.
+static uint64_t kProfileCollected{0};
+
+/// Protect collection and the symbol cache.
+static Mutex kProfileMutex;
+
+/// Symbolized names by frame address, and if the name is a function.
+static std::unordered_map<void*, std::pair<std::string, bool>>
+    kProfileSymbols;
+
+static std::atomic<bool> kProfileRunning{false};
+
+/// The signal handler and its trampoline are the first two frames.
+static const int kProfileSkipFrames = 2;
+
+static void copyProfileName(char* dest, const char* name) {
+  size_t i = 0;
+  if (name != nullptr) {
+    for (; i + 1 < kProfileNameSize && name[i] != '\0'; i++) {
+      dest[i] = name[i];
+    }
+  }
+  dest[i] = '\0';
+}
+
+static void onProfileSignal(int /* signal */) {
+  // Only async-signal-safe work here, backtrace was primed when starting.
+  auto saved_errno = errno;
+  auto index = kProfileNext.fetch_add(1);
+  auto& slot = kProfileRing[index % kProfileSamples];
+  slot.sequence.fetch_add(1);
+  slot.depth = backtrace(slot.frames, kProfileFrames);
+  copyProfileName(slot.query, kProfileQuery);
+  copyProfileName(slot.table, kProfileTable);
+  slot.index.store(index);
+  slot.sequence.fetch_add(1);
+  errno = saved_errno;
+}
+
+/// Name a frame by its demangled function without arguments, or module.
+static std::string getProfileSymbol(void* frame, bool& named) {
+  auto it = kProfileSymbols.find(frame);
+  if (it != kProfileSymbols.end()) {
+    named = it->second.second;
+    return it->second.first;
+  }
+
+  std::string symbol;
+  Dl_info info;
+  auto found = (dladdr(frame, &info) != 0);
+  named = (found && info.dli_sname != nullptr);
+  if (named) {
+    int status = 0;
+    char* demangled =
+        abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    symbol = (status == 0 && demangled != nullptr) ? demangled
+                                                   : info.dli_sname;
+    free(demangled);
+    auto arguments = symbol.find('(');
+    if (arguments != std::string::npos && arguments > 0) {
+      symbol = symbol.substr(0, arguments);
+    }
+  } else if (found && info.dli_fname != nullptr) {
+    auto offset = reinterpret_cast<uintptr_t>(frame) -
+                  reinterpret_cast<uintptr_t>(info.dli_fbase);
+    std::stringstream module;
+    module << boost::filesystem::path(info.dli_fname).filename().string()
+           << "+0x" << std::hex << offset;
+    symbol = module.str();
+  }
+  kProfileSymbols[frame] = std::make_pair(symbol, named);
+  return symbol;
+}
+
+Status WorkerProfiler::start(size_t hz) {
+  if (hz == 0 || hz > kProfileMaxHz) {
+    return Status(1, "Invalid worker profile rate: " + std::to_string(hz));
+  }
+
+  // The first backtrace may load the unwinder, which is not signal-safe.
+  void* prime[1];
+  backtrace(prime, 1);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onProfileSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, nullptr) != 0) {
+    return Status(1, "Cannot install the worker profile signal handler");
+  }
+
+  struct itimerval timer;
+  // A rate of 1 is a full second, which tv_usec cannot hold.
+  timer.it_interval.tv_sec = static_cast<time_t>(1 / hz);
+  timer.it_interval.tv_usec =
+      static_cast<suseconds_t>((1000000 / hz) % 1000000);
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    return Status(1, "Cannot arm the worker profile timer");
+  }
+  kProfileRunning = true;
+  return Status(0, "OK");
+}
+
+void WorkerProfiler::stop() {
+  if (!kProfileRunning.exchange(false)) {
+    return;
+  }
+
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+bool WorkerProfiler::running() {
+  return kProfileRunning;
+}
+
+size_t WorkerProfiler::collect(std::vector<WorkerProfileSample>& samples) {
+  WriteLock lock(kProfileMutex);
+  auto next = kProfileNext.load();
+  auto first = kProfileCollected;
+  if (next - first > kProfileSamples) {
+    first = next - kProfileSamples;
+  }
+  auto dropped = static_cast<size_t>(first - kProfileCollected);
+  kProfileCollected = next;
+
+  for (auto index = first; index < next; index++) {
+    auto& slot = kProfileRing[index % kProfileSamples];
+    auto sequence = slot.sequence.load();
+    if (sequence % 2 != 0 || slot.index.load() != index) {
+      // The handler is writing or has overwritten the slot.
+      dropped++;
+      continue;
+    }
+
+    // Copy the slot before symbolizing, the handler may reuse it.
+    void* frames[kProfileFrames];
+    auto depth = std::min(static_cast<size_t>(std::max(slot.depth, 0)),
+                          kProfileFrames);
+    std::copy(slot.frames, slot.frames + depth, frames);
+    WorkerProfileSample sample;
+    sample.query = slot.query;
+    sample.table = slot.table;
+    if (slot.sequence.load() != sequence || slot.index.load() != index) {
+      dropped++;
+      continue;
+    }
+
+    // Prefer the innermost osquery frame, the leaf is often libc.
+    for (size_t i = kProfileSkipFrames; i < depth; i++) {
+      bool named = false;
+      auto symbol = getProfileSymbol(frames[i], named);
+      if (i == kProfileSkipFrames) {
+        sample.function = symbol;
+      }
+      if (named && symbol.find("osquery::") != std::string::npos) {
+        sample.function = symbol;
+        break;
+      }
+    }
+    samples.push_back(std::move(sample));
+  }
+  return dropped;
+}
+
+#else
+
+Status WorkerProfiler::start(size_t hz) {
+  return Status(1, "The worker profiler is not supported on this platform");
+}
+
+void WorkerProfiler::stop() {}
+
+bool WorkerProfiler::running() {
+  return false;
+}
+
+size_t WorkerProfiler::collect(std::vector<WorkerProfileSample>& samples) {
+  return 0;
+}
+
+#endif
+
+void WorkerProfilerRunner::start() {
+  auto stats = WorkerStats::get();
+  if (stats == nullptr) {
+    // Without a stats block the watcher cannot request a profile.
+    return;
+  }
+
+  auto requests = stats->profileRequests();
+  size_t dumped = 0;
+  while (!interrupted()) {
+    pauseMilli(1000);
+    auto current = stats->profileRequests();
+    if (current == requests) {
+      continue;
+    }
+
+    auto now = getUnixTime();
+    if (now - dumped >= kProfileDumpInterval) {
+      WorkerProfiler::dump("approaching watchdog limits");
+      dumped = now;
+    }
+    requests = current;
+  }
+}
+
+void WorkerProfilerRunner::stop() {
+  WorkerProfiler::stop();
+}
+}
@@ -0,0 +1,119 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/dispatcher.h>
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// A stack sample captured by the worker profiler.
+struct WorkerProfileSample {
+  /// The scheduled query executing on the sampled thread, if any.
+  std::string query;
+
+  /// The table generating on the sampled thread, if any.
+  std::string table;
+
+  /// The sampled function, the innermost osquery frame or else the leaf.
+  std::string function;
+};
+
+/**
+ * @brief A low-frequency sampling profiler for the worker.
+ *
+ * When `--worker_profile` is set the worker arms a CPU-time interval timer.
+ * Each SIGPROF records the interrupted thread's stack and the scheduled
+ * query and table it is executing into a fixed ring of samples. The signal
+ * handler does not allocate or lock, samples are symbolized only when the
+ * profile is dumped.
+ *
+ * The watcher asks the worker for a profile when it approaches a watchdog
+ * limit, the dump is a single status log line naming the queries, tables,
+ * and functions that used the CPU before the worker may be restarted.
+ */
+class WorkerProfiler : private boost::noncopyable {
+ public:
+  /// Install the signal handler and arm the timer at a rate in Hz.
+  static Status start(size_t hz);
+
+  /// Disarm the timer, the samples are kept.
+  static void stop();
+
+  /// Check if the profiler timer is armed.
+  static bool running();
+
+  /**
+   * @brief Copy and symbolize the samples recorded since the last collect.
+   *
+   * @param samples The output samples, oldest first.
+   * @return The number of samples dropped because the ring wrapped.
+   */
+  static size_t collect(std::vector<WorkerProfileSample>& samples);
+
+  /**
+   * @brief Summarize samples as a compact, single-line profile.
+   *
+   * @param samples Samples from WorkerProfiler::collect.
+   * @param top The number of queries, tables, and functions to include.
+   */
+  static std::string summarize(const std::vector<WorkerProfileSample>& samples,
+                               size_t top);
+
+  /// Collect the recent samples and write the summary to the status log.
+  static void dump(const std::string& reason);
+};
+
+/**
+ * @brief Attribute profiler samples on the calling thread to a name.
+ *
+ * The name must outlive the scope, scopes nest and restore the previous
+ * name when they end.
+ */
+class WorkerProfileScope : private boost::noncopyable {
+ public:
+  enum Kind {
+    QUERY = 0,
+    TABLE = 1,
+  };
+
+  WorkerProfileScope(Kind kind, const std::string& name);
+
+  ~WorkerProfileScope();
+
+ private:
+  Kind kind_;
+
+  /// The name active on this thread when this scope started.
+  const char* previous_{nullptr};
+};
+
+/**
+ * @brief Dump the worker profile when the watcher requests one.
+ *
+ * The watcher increments a request counter in the worker's stats block when
+ * the worker approaches a watchdog limit. At most one profile is written
+ * each minute.
+ */
+class WorkerProfilerRunner : public InternalRunnable {
+ public:
+  /// Runnable thread's entry point.
+  void start() override;
+
+  /// Disarm the profiler timer when the service stops.
+  void stop() override;
+};
+}
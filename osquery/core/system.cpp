@@ -27,6 +27,11 @@
 #include <WinSock2.h>
 #endif
 
+#if defined(__APPLE__) || defined(__FreeBSD__)
+#include <sys/sysctl.h>
+#include <sys/time.h>
+#endif
+
 #include <ctime>
 #include <sstream>
 
@@ -224,6 +229,31 @@ size_t getUnixTime() {
   return std::time(nullptr);
 }
 
+std::string getBootIdentity() {
+  // The identity cannot change while this process is running.
+  static const std::string kBootIdentity = ([]() {
+    std::string identity;
+#if defined(__APPLE__) || defined(__FreeBSD__)
+    struct timeval boot_time;
+    size_t len = sizeof(boot_time);
+    int mib[2] = {CTL_KERN, KERN_BOOTTIME};
+    if (sysctl(mib, 2, &boot_time, &len, nullptr, 0) == 0) {
+      identity = std::to_string(boot_time.tv_sec);
+    }
+#elif defined(WIN32)
+    // The boot time is derived from the uptime, allow it to drift.
+    auto boot_time = getUnixTime() - GetTickCount64() / 1000;
+    identity = std::to_string(boot_time - boot_time % 60);
+#else
+    if (readFile("/proc/sys/kernel/random/boot_id", identity).ok()) {
+      boost::algorithm::trim(identity);
+    }
+#endif
+    return identity;
+  })();
+  return kBootIdentity;
+}
+
 Status checkStalePid(const std::string& content) {
   int pid;
   try {
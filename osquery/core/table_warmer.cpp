@@ -0,0 +1,88 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <boost/algorithm/string.hpp>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/registry.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/memory_pressure.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/process.h"
+#include "osquery/core/table_warmer.h"
+
+namespace osquery {
+
+FLAG(string,
+     table_warm_set,
+     "",
+     "Comma-separated tables to generate ahead of distributed queries");
+
+FLAG(uint64,
+     table_warm_interval,
+     60,
+     "Seconds between background generations of the warm set");
+
+/// Warm results outlive one missed interval.
+const size_t kTableWarmLifetime = 2;
+
+std::vector<std::string> getWarmTables() {
+  std::vector<std::string> tables;
+  std::vector<std::string> names;
+  boost::split(names, FLAGS_table_warm_set, boost::is_any_of(","));
+  for (auto& name : names) {
+    boost::trim(name);
+    if (!name.empty() &&
+        std::find(tables.begin(), tables.end(), name) == tables.end()) {
+      tables.push_back(name);
+    }
+  }
+  return tables;
+}
+
+void TableWarmerRunner::start() {
+  auto tables = getWarmTables();
+  if (tables.empty() || FLAGS_table_warm_interval == 0) {
+    return;
+  }
+
+  // Warming competes with the schedule, it only uses idle CPU.
+  setThreadToBackgroundPriority();
+
+  auto lifetime = FLAGS_table_warm_interval * kTableWarmLifetime;
+  while (!interrupted()) {
+    for (const auto& name : tables) {
+      if (interrupted() ||
+          MemoryPressure::level() != MemoryPressureLevel::NONE) {
+        break;
+      }
+
+      auto plugin = RegistryFactory::get().plugin("table", name);
+      auto table = std::dynamic_pointer_cast<TablePlugin>(plugin);
+      if (table == nullptr) {
+        VLOG(1) << "Cannot warm unknown table: " << name;
+        continue;
+      }
+
+      auto status = table->warmCache(lifetime);
+      if (status.ok()) {
+        Metrics::counter("table_warm_generations", "table=" + name).add();
+      } else {
+        VLOG(1) << status.getMessage();
+      }
+    }
+    pauseMilli(FLAGS_table_warm_interval * 1000);
+  }
+}
+}
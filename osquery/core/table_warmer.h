@@ -0,0 +1,38 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <osquery/dispatcher.h>
+
+namespace osquery {
+
+/// The tables named in `--table_warm_set`, in order and without duplicates.
+std::vector<std::string> getWarmTables();
+
+/**
+ * @brief Regenerate the warm set of tables in the background.
+ *
+ * Incident responders run a fixed set of expensive distributed queries. Each
+ * table named in `--table_warm_set` is generated every
+ * `--table_warm_interval` seconds on a background priority thread and kept
+ * in the table's cache, see TablePlugin::warmCache. Warming stops while the
+ * worker is under memory pressure. The runner starts with the distributed
+ * query service.
+ */
+class TableWarmerRunner : public InternalRunnable {
+ public:
+  /// Runnable thread's entry point.
+  void start() override;
+};
+}
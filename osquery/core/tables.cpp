@@ -8,12 +8,20 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
 #include <osquery/database.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
+#include "osquery/core/memory_pressure.h"
 
 namespace pt = boost::property_tree;
 
@@ -21,10 +29,57 @@ namespace osquery {
 
 FLAG(bool, disable_caching, false, "Disable scheduled query caching");
 
+FLAG(uint64,
+     table_generator_threads,
+     4,
+     "Maximum worker threads shared by concurrent table generators");
+
+FLAG(uint64,
+     table_cache_bytes,
+     64 * 1024 * 1024,
+     "Maximum bytes of cached table results held in memory");
+
+FLAG(bool,
+     table_cache_spill,
+     false,
+     "Store cached table results in the database when memory is full");
+
+/// The number of table generator worker threads currently running.
+static std::atomic<size_t> kTableWorkers{0};
+
+/// The in-memory size of cached results across all tables.
+static std::atomic<size_t> kTableCacheBytes{0};
+
+/// The approximate in-memory size of row data.
+static size_t getResultsSize(const QueryData& results) {
+  size_t size = 0;
+  for (const auto& row : results) {
+    for (const auto& column : row) {
+      size += column.first.size() + column.second.size();
+    }
+  }
+  return size;
+}
+
+/// The database key for spilled results of a table and context key.
+static std::string getSpillKey(const std::string& table,
+                               const std::string& key) {
+  return "cache." + table + "." + std::to_string(std::hash<std::string>()(key));
+}
+
+/// The database key for results of a table kept for the current boot.
+static std::string getBootCacheKey(const std::string& table,
+                                   const std::string& key) {
+  return "boot_cache." + table + "." +
+         std::to_string(std::hash<std::string>()(key));
+}
+
 CREATE_LAZY_REGISTRY(TablePlugin, "table");
 
-size_t TablePlugin::kCacheInterval = 0;
-size_t TablePlugin::kCacheStep = 0;
+thread_local size_t TablePlugin::kCacheInterval = 0;
+thread_local size_t TablePlugin::kCacheStep = 0;
+
+thread_local QueryBudget* QueryBudget::kCurrent = nullptr;
 
 const std::map<ColumnType, std::string> kColumnTypeNames = {
     {UNKNOWN_TYPE, "UNKNOWN"},
@@ -71,6 +126,17 @@ void TablePlugin::setRequestFromContext(const QueryContext& context,
   }
   tree.add_child("constraints", constraints);
 
+  // Tables in extensions may also skip work for columns that are not used.
+  if (context.colsUsed) {
+    pt::ptree colsUsed;
+    for (const auto& column : *context.colsUsed) {
+      pt::ptree child;
+      child.put("", column);
+      colsUsed.push_back(std::make_pair("", child));
+    }
+    tree.add_child("colsUsed", colsUsed);
+  }
+
   // Write the property tree as a JSON string into the PluginRequest.
   std::ostringstream output;
   try {
@@ -102,6 +168,15 @@ void TablePlugin::setContextFromRequest(const PluginRequest& request,
     auto column_name = constraint.second.get<std::string>("name");
     context.constraints[column_name].unserialize(constraint.second);
   }
+
+  // The used columns are optional, all columns are used if missing.
+  if (tree.count("colsUsed") > 0) {
+    UsedColumns colsUsed;
+    for (const auto& column : tree.get_child("colsUsed")) {
+      colsUsed.insert(column.second.data());
+    }
+    context.colsUsed = std::move(colsUsed);
+  }
 }
 
 Status TablePlugin::call(const PluginRequest& request,
@@ -122,6 +197,7 @@ Status TablePlugin::call(const PluginRequest& request,
     if (request.count("context") > 0) {
       setContextFromRequest(request, context);
     }
+    context.concurrency = concurrency();
     response = generate(context);
   } else if (request.at("action") == "columns") {
     // The "columns" action returns a PluginRequest filled with column
@@ -134,6 +210,17 @@ Status TablePlugin::call(const PluginRequest& request,
   return Status(0, "OK");
 }
 
+QueryData TablePlugin::generate(QueryContext& context) {
+  QueryData results;
+  if (usesBatch()) {
+    // Columnar tables are materialized as rows for non-SQL callers.
+    RowBatch batch(columns());
+    generateBatch(batch, context);
+    batch.toQueryData(results);
+  }
+  return results;
+}
+
 std::string TablePlugin::columnDefinition() const {
   return osquery::columnDefinition(columns());
 }
@@ -141,12 +228,18 @@ std::string TablePlugin::columnDefinition() const {
 PluginResponse TablePlugin::routeInfo() const {
   // Route info consists of the serialized column information.
   PluginResponse response;
+  auto costs = columnCosts();
   for (const auto& column : columns()) {
     response.push_back(
         {{"id", "column"},
          {"name", std::get<0>(column)},
          {"type", columnTypeName(std::get<1>(column))},
          {"op", INTEGER(static_cast<size_t>(std::get<2>(column)))}});
+    // The optional lookup cost is only included when the table declares one.
+    auto cost = costs.find(std::get<0>(column));
+    if (cost != costs.end()) {
+      response.back()["cost"] = INTEGER(cost->second);
+    }
   }
   // Each table name alias is provided such that the core may add the views.
   // These views need to be removed when the backing table is detached.
@@ -166,33 +259,295 @@ PluginResponse TablePlugin::routeInfo() const {
   response.push_back(
       {{"id", "attributes"},
        {"attributes", INTEGER(static_cast<size_t>(attributes()))}});
+  // The optional row estimate is only included when the table declares one.
+  if (cardinality() > 0) {
+    response.back()["cardinality"] = INTEGER(cardinality());
+  }
   return response;
 }
 
-bool TablePlugin::isCached(size_t step) {
-  return (!FLAGS_disable_caching && step < last_cached_ + last_interval_);
+TablePlugin::~TablePlugin() {
+  for (const auto& entry : cache_) {
+    if (!entry.second.spilled) {
+      kTableCacheBytes -= entry.second.bytes;
+    }
+  }
+  kTableCacheBytes -= warm_.bytes;
 }
 
-QueryData TablePlugin::getCache() const {
-  VLOG(1) << "Retrieving results from cache for table: " << getName();
-  // Lookup results from database and deserialize.
-  std::string content;
-  getDatabaseValue(kQueries, "cache." + getName(), content);
-  QueryData results;
-  deserializeQueryDataJSON(content, results);
-  return results;
+bool TablePlugin::isCached(size_t step, const QueryContext& context) const {
+  // Results are only cached within the schedule.
+  if (FLAGS_disable_caching || step == 0) {
+    return false;
+  }
+
+  ReadLock lock(cache_mutex_);
+  auto it = cache_.find(context.cacheKey());
+  return (it != cache_.end() && step < it->second.step + it->second.lifetime);
+}
+
+bool TablePlugin::getCache(size_t step,
+                           const QueryContext& context,
+                           QueryData& results) {
+  if (FLAGS_disable_caching || step == 0) {
+    return false;
+  }
+
+  auto key = context.cacheKey();
+  ReadLock lock(cache_mutex_);
+  auto it = cache_.find(key);
+  if (it == cache_.end() || step >= it->second.step + it->second.lifetime) {
+    cache_misses_++;
+    return false;
+  }
+
+  if (!it->second.spilled) {
+    results = it->second.results;
+  } else {
+    VLOG(1) << "Retrieving results from cache for table: " << getName();
+    std::string content;
+    results.clear();
+    if (!getDatabaseValue(kQueries, getSpillKey(getName(), key), content)
+             .ok() ||
+        !deserializeQueryDataStored(content, results).ok()) {
+      cache_misses_++;
+      return false;
+    }
+  }
+  cache_hits_++;
+  return true;
 }
 
 void TablePlugin::setCache(size_t step,
                            size_t interval,
+                           const QueryContext& context,
                            const QueryData& results) {
-  // Serialize QueryData and save to database.
+  CacheEntry entry;
+  entry.step = step;
+  entry.lifetime = (cacheTTL() > 0) ? cacheTTL() : interval;
+  if (FLAGS_disable_caching || step == 0 || entry.lifetime == 0) {
+    return;
+  }
+
+  auto key = context.cacheKey();
+  entry.bytes = key.size() + getResultsSize(results);
+
+  WriteLock lock(cache_mutex_);
+  // Release the replaced entry and every entry that is no longer fresh.
+  for (auto it = cache_.begin(); it != cache_.end();) {
+    if (it->first == key || step >= it->second.step + it->second.lifetime) {
+      eraseCache(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  // Memory pressure releases cached results, do not hold new results.
+  auto pressure = (MemoryPressure::level() != MemoryPressureLevel::NONE);
+  if (!pressure &&
+      kTableCacheBytes + entry.bytes <= FLAGS_table_cache_bytes) {
+    entry.results = results;
+    kTableCacheBytes += entry.bytes;
+  } else if (FLAGS_table_cache_spill) {
+    // Memory is full, keep the serialized results in the database.
+    std::string content;
+    if (!serializeQueryDataStored(results, content).ok() ||
+        !setDatabaseValue(kQueries, getSpillKey(getName(), key), content)
+             .ok()) {
+      return;
+    }
+    entry.spilled = true;
+    entry.bytes = 0;
+  } else {
+    return;
+  }
+  cache_[key] = std::move(entry);
+}
+
+bool TablePlugin::getBootCache(const QueryContext& context,
+                               QueryData& results) {
+  auto identity = getBootIdentity();
+  if (FLAGS_disable_caching || identity.empty()) {
+    return false;
+  }
+
+  // The stored results are prefixed by the boot and version generating them.
   std::string content;
-  if (!FLAGS_disable_caching && serializeQueryDataJSON(results, content)) {
-    last_cached_ = step;
-    last_interval_ = interval;
-    setDatabaseValue(kQueries, "cache." + getName(), content);
+  auto prefix = identity + "\n" + kVersion + "\n";
+  auto key = getBootCacheKey(getName(), context.cacheKey());
+  if (!getDatabaseValue(kQueries, key, content).ok() ||
+      content.compare(0, prefix.size(), prefix) != 0) {
+    cache_misses_++;
+    return false;
+  }
+
+  results.clear();
+  if (!deserializeQueryDataStored(content.substr(prefix.size()), results)
+           .ok()) {
+    cache_misses_++;
+    return false;
+  }
+  cache_hits_++;
+  return true;
+}
+
+void TablePlugin::setBootCache(const QueryContext& context,
+                               const QueryData& results) {
+  auto identity = getBootIdentity();
+  if (FLAGS_disable_caching || identity.empty() || context.truncated()) {
+    return;
+  }
+
+  std::string content;
+  if (!serializeQueryDataStored(results, content).ok()) {
+    return;
+  }
+  auto key = getBootCacheKey(getName(), context.cacheKey());
+  setDatabaseValue(
+      kQueries, key, identity + "\n" + kVersion + "\n" + content);
+}
+
+void TablePlugin::eraseCache(std::map<std::string, CacheEntry>::iterator it) {
+  if (it->second.spilled) {
+    deleteDatabaseValue(kQueries, getSpillKey(getName(), it->first));
+  } else {
+    kTableCacheBytes -= it->second.bytes;
+  }
+  cache_.erase(it);
+}
+
+size_t TablePlugin::clearCache() {
+  size_t bytes = 0;
+  WriteLock lock(cache_mutex_);
+  for (auto it = cache_.begin(); it != cache_.end();) {
+    if (!it->second.spilled) {
+      bytes += it->second.bytes;
+      eraseCache(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  bytes += warm_.bytes;
+  kTableCacheBytes -= warm_.bytes;
+  warm_ = CacheEntry();
+  return bytes;
+}
+
+bool TablePlugin::canWarm() const {
+  auto attr = attributes();
+  if (usesBatch() || (attr & TableAttributes::EVENT_BASED) ||
+      (attr & TableAttributes::UTILITY)) {
+    return false;
+  }
+
+  // Without its required constraints a table generates no results.
+  for (const auto& column : columns()) {
+    if (std::get<2>(column) & ColumnOptions::REQUIRED) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Status TablePlugin::warmCache(size_t lifetime) {
+  if (FLAGS_disable_caching || lifetime == 0) {
+    return Status(1, "Caching is disabled");
+  }
+
+  if (!canWarm()) {
+    return Status(1, "Table cannot be warmed: " + getName());
+  }
+
+  // Generate every column, the results answer any set of used columns.
+  QueryContext context;
+  CacheEntry entry;
+  entry.results = generate(context);
+  if (context.truncated()) {
+    return Status(1, "Warm results are incomplete: " + getName());
+  }
+  entry.step = getUnixTime();
+  entry.lifetime = lifetime;
+  entry.bytes = getResultsSize(entry.results);
+
+  WriteLock lock(cache_mutex_);
+  kTableCacheBytes -= warm_.bytes;
+  warm_ = CacheEntry();
+  if (MemoryPressure::level() != MemoryPressureLevel::NONE ||
+      kTableCacheBytes + entry.bytes > FLAGS_table_cache_bytes) {
+    return Status(1, "Warm results exceed the table cache: " + getName());
+  }
+  kTableCacheBytes += entry.bytes;
+  warm_ = std::move(entry);
+  return Status(0);
+}
+
+bool TablePlugin::getWarmCache(const QueryContext& context,
+                               QueryData& results) {
+  // Scheduled queries keep their schedule cache semantics.
+  if (FLAGS_disable_caching || kCacheStep != 0) {
+    return false;
+  }
+
+  // Additional columns generate different rows when constrained.
+  for (const auto& column : columns()) {
+    const auto& name = std::get<0>(column);
+    if ((std::get<2>(column) & ColumnOptions::ADDITIONAL) &&
+        context.constraints.count(name) > 0 &&
+        context.constraints.at(name).exists()) {
+      return false;
+    }
+  }
+
+  ReadLock lock(cache_mutex_);
+  if (warm_.lifetime == 0 || getUnixTime() >= warm_.step + warm_.lifetime) {
+    return false;
+  }
+  results = warm_.results;
+  cache_hits_++;
+  return true;
+}
+
+/// Under memory pressure release every table's cached results.
+static std::string shedTableCaches(MemoryPressureLevel level) {
+  if (level == MemoryPressureLevel::NONE) {
+    return "";
+  }
+
+  size_t bytes = 0;
+  for (const auto& plugin : RegistryFactory::get().plugins("table")) {
+    auto table = std::dynamic_pointer_cast<TablePlugin>(plugin.second);
+    if (table != nullptr) {
+      bytes += table->clearCache();
+    }
   }
+  return (bytes > 0) ? "released " + std::to_string(bytes) +
+                           " bytes of cached table results"
+                     : "";
+}
+
+static bool kTableCacheShedding =
+    (MemoryPressure::addHandler("table_cache", shedTableCaches), true);
+
+TableCacheStats TablePlugin::cacheStats() const {
+  TableCacheStats stats;
+  stats.hits = cache_hits_;
+  stats.misses = cache_misses_;
+
+  ReadLock lock(cache_mutex_);
+  stats.entries = cache_.size();
+  for (const auto& entry : cache_) {
+    if (entry.second.spilled) {
+      stats.spilled++;
+    } else {
+      stats.bytes += entry.second.bytes;
+    }
+  }
+  if (warm_.lifetime > 0) {
+    stats.entries++;
+    stats.bytes += warm_.bytes;
+  }
+  return stats;
 }
 
 std::string columnDefinition(const TableColumns& columns) {
@@ -265,6 +620,225 @@ ColumnType columnTypeName(const std::string& type) {
   return UNKNOWN_TYPE;
 }
 
+/// Integer affinities share the RowBatch integer storage.
+static inline bool isIntegerType(ColumnType type) {
+  return (type == INTEGER_TYPE || type == BIGINT_TYPE ||
+          type == UNSIGNED_BIGINT_TYPE);
+}
+
+const size_t RowArena::kChunkSize{64 * 1024};
+
+boost::string_ref RowArena::copy(const char* data, size_t size) {
+  if (size == 0) {
+    // SQLite reads a null text pointer as a NULL value.
+    return boost::string_ref("", 0);
+  }
+
+  if (chunks_.empty() || chunks_.back().size - chunks_.back().used < size) {
+    Chunk chunk;
+    chunk.size = std::max(size, kChunkSize);
+    chunk.data.reset(new char[chunk.size]);
+    if (size > kChunkSize && !chunks_.empty()) {
+      // Keep appending small copies to the current chunk.
+      chunk.used = size;
+      memcpy(chunk.data.get(), data, size);
+      bytes_ += size;
+      auto copied = boost::string_ref(chunk.data.get(), size);
+      chunks_.insert(chunks_.end() - 1, std::move(chunk));
+      return copied;
+    }
+    chunks_.push_back(std::move(chunk));
+  }
+
+  auto& chunk = chunks_.back();
+  auto dest = chunk.data.get() + chunk.used;
+  memcpy(dest, data, size);
+  chunk.used += size;
+  bytes_ += size;
+  return boost::string_ref(dest, size);
+}
+
+void RowArena::reset() {
+  Chunk reuse;
+  for (auto& chunk : chunks_) {
+    if (chunk.size == kChunkSize) {
+      reuse = std::move(chunk);
+      break;
+    }
+  }
+
+  chunks_.clear();
+  if (reuse.data != nullptr) {
+    reuse.used = 0;
+    chunks_.push_back(std::move(reuse));
+  }
+  bytes_ = 0;
+}
+
+size_t RowArena::capacity() const {
+  size_t size = 0;
+  for (const auto& chunk : chunks_) {
+    size += chunk.size;
+  }
+  return size;
+}
+
+void RowBatch::reset(const TableColumns& columns) {
+  columns_.clear();
+  columns_.resize(columns.size());
+  for (size_t i = 0; i < columns.size(); ++i) {
+    columns_[i].name = std::get<0>(columns[i]);
+    columns_[i].type = std::get<1>(columns[i]);
+  }
+  arena_.reset();
+  rows_ = 0;
+}
+
+void RowBatch::clear() {
+  for (auto& column : columns_) {
+    column.integers.clear();
+    column.doubles.clear();
+    column.text.clear();
+    column.nulls.clear();
+  }
+  arena_.reset();
+  rows_ = 0;
+}
+
+size_t RowBatch::index(const std::string& name) const {
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    if (columns_[i].name == name) {
+      return i;
+    }
+  }
+  return columns_.size();
+}
+
+size_t RowBatch::addRow() {
+  if (yield_ != nullptr && capacity_ > 0 && rows_ >= capacity_) {
+    // The consumer clears the batch before the generator resumes.
+    yield_();
+  }
+
+  for (auto& column : columns_) {
+    // Only the storage for the column's affinity grows.
+    if (isIntegerType(column.type)) {
+      column.integers.push_back(0);
+    } else if (column.type == DOUBLE_TYPE) {
+      column.doubles.push_back(0);
+    } else {
+      column.text.emplace_back();
+    }
+    column.nulls.push_back(true);
+  }
+  return rows_++;
+}
+
+void RowBatch::setInteger(size_t column, long long value) {
+  auto& storage = columns_[column];
+  if (storage.type == DOUBLE_TYPE) {
+    storage.doubles.back() = static_cast<double>(value);
+  } else if (isIntegerType(storage.type)) {
+    storage.integers.back() = value;
+  } else {
+    setTextCell(storage, std::to_string(value));
+  }
+  storage.nulls.back() = false;
+}
+
+void RowBatch::setDouble(size_t column, double value) {
+  auto& storage = columns_[column];
+  if (storage.type == DOUBLE_TYPE) {
+    storage.doubles.back() = value;
+  } else if (isIntegerType(storage.type)) {
+    storage.integers.back() = static_cast<long long>(value);
+  } else {
+    setTextCell(storage, DOUBLE(value));
+  }
+  storage.nulls.back() = false;
+}
+
+void RowBatch::setText(size_t column, std::string value) {
+  auto& storage = columns_[column];
+  if (storage.type == DOUBLE_TYPE || isIntegerType(storage.type)) {
+    set(column, value);
+  } else {
+    setTextCell(storage, value);
+    storage.nulls.back() = false;
+  }
+}
+
+void RowBatch::set(size_t column, const std::string& value) {
+  auto& storage = columns_[column];
+  if (storage.type == INTEGER_TYPE || storage.type == BIGINT_TYPE) {
+    long long afinite;
+    if (safeStrtoll(value, 10, afinite)) {
+      setInteger(column, afinite);
+    }
+  } else if (storage.type == UNSIGNED_BIGINT_TYPE) {
+    unsigned long long afinite;
+    char* end = nullptr;
+    afinite = strtoull(value.c_str(), &end, 10);
+    if (end != nullptr && end != value.c_str() && *end == '\0') {
+      setInteger(column, static_cast<long long>(afinite));
+    }
+  } else if (storage.type == DOUBLE_TYPE) {
+    char* end = nullptr;
+    double afinite = strtod(value.c_str(), &end);
+    if (end != nullptr && end != value.c_str() && *end == '\0') {
+      setDouble(column, afinite);
+    }
+  } else {
+    setTextCell(storage, value);
+    storage.nulls.back() = false;
+  }
+}
+
+void RowBatch::setTextCell(Column& storage, const std::string& value) {
+  storage.text.back() = arena_.copy(value.data(), value.size());
+}
+
+std::string RowBatch::getAsText(size_t row, size_t column) const {
+  const auto& storage = columns_[column];
+  if (storage.nulls[row]) {
+    return SQL_NULL_RESULT;
+  }
+
+  switch (storage.type) {
+  case INTEGER_TYPE:
+  case BIGINT_TYPE:
+    return std::to_string(storage.integers[row]);
+  case UNSIGNED_BIGINT_TYPE:
+    return std::to_string(
+        static_cast<unsigned long long>(storage.integers[row]));
+  case DOUBLE_TYPE:
+    return DOUBLE(storage.doubles[row]);
+  default:
+    return storage.text[row].to_string();
+  }
+}
+
+void RowBatch::toQueryData(QueryData& results) const {
+  results.reserve(results.size() + rows_);
+  for (size_t row = 0; row < rows_; ++row) {
+    Row r;
+    for (size_t column = 0; column < columns_.size(); ++column) {
+      if (!columns_[column].nulls[row]) {
+        r[columns_[column].name] = getAsText(row, column);
+      }
+    }
+    results.push_back(std::move(r));
+  }
+}
+
+size_t RowBatch::bytes() const {
+  size_t size = 0;
+  for (const auto& column : columns_) {
+    size += (column.integers.size() + column.doubles.size()) * sizeof(double);
+  }
+  return size + arena_.bytes();
+}
+
 bool ConstraintList::exists(const ConstraintOperatorFlag ops) const {
   if (ops == ANY_OP) {
     return (constraints_.size() > 0);
@@ -324,6 +898,156 @@ bool ConstraintList::literal_matches(const T& base_expr) const {
   return true;
 }
 
+/**
+ * @brief Match an expression using SQL LIKE semantics.
+ *
+ * A '%' matches any sequence and '_' matches a single (UTF-8) character, and
+ * ASCII characters compare without case.
+ */
+static bool likeMatches(const std::string& pattern, const std::string& expr) {
+  auto lower = [](char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+  };
+
+  size_t p = 0;
+  size_t e = 0;
+  size_t star = std::string::npos;
+  size_t mark = 0;
+  while (e < expr.size()) {
+    if (p < pattern.size() && pattern[p] == '%') {
+      // Remember the wildcard and try to match nothing first.
+      star = p++;
+      mark = e;
+    } else if (p < pattern.size() &&
+               (pattern[p] == '_' || lower(pattern[p]) == lower(expr[e]))) {
+      if (pattern[p++] == '_') {
+        // Skip the continuation bytes of a multibyte character.
+        while (++e < expr.size() && (expr[e] & 0xC0) == 0x80) {
+        }
+      } else {
+        e++;
+      }
+    } else if (star != std::string::npos) {
+      // Let the last wildcard match one more byte.
+      p = star + 1;
+      e = ++mark;
+    } else {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() && pattern[p] == '%') {
+    p++;
+  }
+  return p == pattern.size();
+}
+
+/// Check if a string beginning with a prefix may match a LIKE pattern.
+static bool likePrefixMatches(const std::string& pattern,
+                              const std::string& prefix) {
+  auto lower = [](char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+  };
+
+  size_t p = 0;
+  size_t e = 0;
+  while (e < prefix.size()) {
+    if (p == pattern.size()) {
+      // The prefix is longer than every match.
+      return false;
+    } else if (pattern[p] == '%') {
+      // Any remainder of the prefix may be matched by the wildcard.
+      return true;
+    } else if (pattern[p] == '_') {
+      while (++e < prefix.size() && (prefix[e] & 0xC0) == 0x80) {
+      }
+    } else if (lower(pattern[p]) != lower(prefix[e])) {
+      return false;
+    } else {
+      e++;
+    }
+    p++;
+  }
+  return true;
+}
+
+bool ConstraintList::admitsPrefix(const std::string& prefix) const {
+  if (affinity != TEXT_TYPE) {
+    return true;
+  }
+
+  bool equals = false;
+  bool equality = false;
+  for (const auto& constraint : constraints_) {
+    if (constraint.op == LIKE) {
+      if (!likePrefixMatches(constraint.expr, prefix)) {
+        return false;
+      }
+    } else if (constraint.op == EQUALS) {
+      equality = true;
+      equals = equals || constraint.expr.compare(0, prefix.size(), prefix) == 0;
+    }
+  }
+  return !equality || equals;
+}
+
+bool ConstraintList::admits(const std::string& expr) const {
+  try {
+    if (affinity == TEXT_TYPE) {
+      return literal_admits<TEXT_LITERAL>(expr, expr);
+    } else if (affinity == INTEGER_TYPE) {
+      return literal_admits<INTEGER_LITERAL>(
+          AS_LITERAL(INTEGER_LITERAL, expr), expr);
+    } else if (affinity == BIGINT_TYPE) {
+      return literal_admits<BIGINT_LITERAL>(AS_LITERAL(BIGINT_LITERAL, expr),
+                                            expr);
+    } else if (affinity == UNSIGNED_BIGINT_TYPE) {
+      return literal_admits<UNSIGNED_BIGINT_LITERAL>(
+          AS_LITERAL(UNSIGNED_BIGINT_LITERAL, expr), expr);
+    }
+  } catch (const boost::bad_lexical_cast& /* e */) {
+    // The expression is not of the column's affinity.
+  }
+  return true;
+}
+
+template <typename T>
+bool ConstraintList::literal_admits(const T& base_expr,
+                                    const std::string& expr) const {
+  bool equals = false;
+  bool equality = false;
+  for (const auto& constraint : constraints_) {
+    if (constraint.op == LIKE) {
+      if (!likeMatches(constraint.expr, expr)) {
+        return false;
+      }
+      continue;
+    }
+
+    T constraint_expr;
+    try {
+      constraint_expr = AS_LITERAL(T, constraint.expr);
+    } catch (const boost::bad_lexical_cast& /* e */) {
+      // SQLite compares mixed types differently, admit the expression.
+      continue;
+    }
+
+    if (constraint.op == EQUALS) {
+      equality = true;
+      equals = equals || (base_expr == constraint_expr);
+    } else if ((constraint.op == GREATER_THAN &&
+                !(base_expr > constraint_expr)) ||
+               (constraint.op == LESS_THAN && !(base_expr < constraint_expr)) ||
+               (constraint.op == GREATER_THAN_OR_EQUALS &&
+                !(base_expr >= constraint_expr)) ||
+               (constraint.op == LESS_THAN_OR_EQUALS &&
+                !(base_expr <= constraint_expr))) {
+      return false;
+    }
+  }
+  return !equality || equals;
+}
+
 std::set<std::string> ConstraintList::getAll(ConstraintOperator op) const {
   std::set<std::string> set;
   for (size_t i = 0; i < constraints_.size(); ++i) {
@@ -366,6 +1090,226 @@ bool QueryContext::hasConstraint(const std::string& column,
   return constraints.at(column).exists(op);
 }
 
+bool QueryContext::admits(const std::string& column,
+                          const std::string& expr) const {
+  auto list = constraints.find(column);
+  if (list == constraints.end()) {
+    return true;
+  }
+  return list->second.admits(expr);
+}
+
+bool QueryContext::isColumnUsed(const std::string& colName) const {
+  return !colsUsed || colsUsed->count(colName) > 0;
+}
+
+bool QueryContext::isAnyColumnUsed(
+    std::initializer_list<std::string> colNames) const {
+  for (const auto& colName : colNames) {
+    if (isColumnUsed(colName)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string QueryContext::cacheKey() const {
+  // Constraints are ordered by column, then by operator and expression.
+  std::string key;
+  for (const auto& column : constraints) {
+    std::vector<std::pair<unsigned char, std::string>> column_constraints;
+    for (const auto& constraint : column.second.getAll()) {
+      column_constraints.push_back(
+          std::make_pair(constraint.op, constraint.expr));
+    }
+    if (column_constraints.empty()) {
+      continue;
+    }
+
+    std::sort(column_constraints.begin(), column_constraints.end());
+    key += '\0' + column.first;
+    for (const auto& constraint : column_constraints) {
+      key += '\1' + std::to_string(constraint.first) + '\2' + constraint.second;
+    }
+  }
+
+  // Tables may skip generating columns the query does not use.
+  key += '\3';
+  if (colsUsed) {
+    std::vector<std::string> columns(colsUsed->begin(), colsUsed->end());
+    std::sort(columns.begin(), columns.end());
+    for (const auto& column : columns) {
+      key += column + '\1';
+    }
+  } else {
+    key += '*';
+  }
+
+  // Ordered and limited rows are a different selection of the table.
+  if (ordered || limit > 0) {
+    key += '\4' + std::string((descending) ? "d" : "a") +
+           std::to_string(limit);
+  }
+  return key;
+}
+
+void parallelFor(size_t count,
+                 size_t concurrency,
+                 const std::function<void(size_t index)>& work) {
+  std::atomic<size_t> next{0};
+  std::exception_ptr error{nullptr};
+  Mutex error_mutex;
+  // Workers do not start new work once the calling query's budget is spent.
+  auto budget = QueryBudget::current();
+  auto worker = ([&]() {
+    // Work on other threads is limited and truncated by the same budget.
+    QueryBudget::Scope scope(budget);
+    for (size_t i = next++; i < count; i = next++) {
+      if (budget != nullptr && budget->spent()) {
+        next = count;
+        break;
+      }
+      try {
+        work(i);
+      } catch (...) {
+        // Stop all workers and rethrow the first failure to the caller.
+        WriteLock lock(error_mutex);
+        if (error == nullptr) {
+          error = std::current_exception();
+        }
+        next = count;
+      }
+    }
+  });
+
+  // Reserve additional threads from the shared budget.
+  std::vector<std::thread> threads;
+  auto wanted = std::min(concurrency, count);
+  for (size_t i = 1; i < wanted; i++) {
+    if (kTableWorkers++ >= FLAGS_table_generator_threads) {
+      kTableWorkers--;
+      break;
+    }
+    threads.emplace_back(worker);
+  }
+
+  // The calling thread always takes part.
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+    kTableWorkers--;
+  }
+
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+}
+
+QueryBudget::QueryBudget(size_t milliseconds,
+                         const std::atomic<bool>* stopped)
+    : timed_(milliseconds > 0), stopped_(stopped), previous_(kCurrent) {
+  expires_ = std::chrono::steady_clock::now() +
+             std::chrono::milliseconds(milliseconds);
+  kCurrent = this;
+}
+
+QueryBudget::~QueryBudget() {
+  kCurrent = previous_;
+}
+
+bool QueryBudget::spent() {
+  if (stopped_ != nullptr && stopped_->load()) {
+    return true;
+  }
+
+  if (timed_ && !expired_ && std::chrono::steady_clock::now() >= expires_) {
+    expired_ = true;
+  }
+  return expired_;
+}
+
+bool QueryBudget::interrupted() {
+  for (auto budget = kCurrent; budget != nullptr; budget = budget->previous_) {
+    if (budget->spent()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+QueryBudget* QueryBudget::current() {
+  return kCurrent;
+}
+
+void QueryBudget::setResultLimits(size_t rows, size_t bytes) {
+  max_rows_ = rows;
+  max_bytes_ = bytes;
+}
+
+size_t QueryBudget::admitRows(size_t rows, size_t bytes) {
+  if (!limitsResults() || rows == 0) {
+    return rows;
+  }
+
+  auto admitted = rows;
+  if (max_rows_ > 0) {
+    admitted = std::min(admitted, remainingRows());
+  }
+  if (max_bytes_ > 0) {
+    auto row_size = std::max<size_t>(bytes / rows, 1);
+    admitted = std::min(admitted, remainingBytes() / row_size);
+  }
+
+  rows_ += admitted;
+  bytes_ += (admitted == rows) ? bytes : admitted * (bytes / rows);
+  if (admitted < rows) {
+    truncated_ = true;
+  }
+  return admitted;
+}
+
+bool QueryBudget::hasRoom() {
+  if ((max_rows_ > 0 && rows_ >= max_rows_) ||
+      (max_bytes_ > 0 && bytes_ >= max_bytes_)) {
+    setTruncated();
+    return false;
+  }
+  return true;
+}
+
+size_t QueryBudget::remainingRows() const {
+  if (max_rows_ == 0) {
+    return 0;
+  }
+  return (max_rows_ > rows_) ? max_rows_ - rows_ : 0;
+}
+
+size_t QueryBudget::remainingBytes() const {
+  if (max_bytes_ == 0) {
+    return 0;
+  }
+  return (max_bytes_ > bytes_) ? max_bytes_ - bytes_ : 0;
+}
+
+bool QueryContext::admit(const Row& row) {
+  if (max_rows == 0 && max_bytes == 0) {
+    return true;
+  }
+
+  size_t size = 0;
+  for (const auto& column : row) {
+    size += column.first.size() + column.second.size();
+  }
+  if ((max_rows > 0 && admitted_rows_ >= max_rows) ||
+      (max_bytes > 0 && admitted_bytes_ + size > max_bytes)) {
+    truncated_ = true;
+    return false;
+  }
+  admitted_rows_++;
+  admitted_bytes_ += size;
+  return true;
+}
+
 Status QueryContext::expandConstraints(
     const std::string& column,
     ConstraintOperator op,
@@ -48,6 +48,43 @@ TEST_F(ConversionsTests, test_base64) {
   EXPECT_EQ(unencoded, unencoded2);
 }
 
+TEST_F(ConversionsTests, test_base64_padding) {
+  EXPECT_EQ("", base64Encode(""));
+  EXPECT_EQ("YQ==", base64Encode("a"));
+  EXPECT_EQ("YWI=", base64Encode("ab"));
+  EXPECT_EQ("YWJj", base64Encode("abc"));
+  EXPECT_EQ("a", base64Decode("YQ=="));
+  EXPECT_EQ("ab", base64Decode("YWI"));
+
+  // Line breaks are ignored, invalid characters decode nothing.
+  EXPECT_EQ("abcabc", base64Decode("YWJj\r\nYWJj\n"));
+  EXPECT_EQ("", base64Decode("YW$j"));
+
+  std::string binary;
+  for (size_t i = 0; i < 256; i++) {
+    binary += static_cast<char>(i);
+  }
+  EXPECT_EQ(binary, base64Decode(base64Encode(binary)));
+}
+
+TEST_F(ConversionsTests, test_scan_plain_bytes) {
+  // Place each kind of stop at every offset of strings longer than a vector.
+  std::string plain(70, 'a');
+  for (const auto stop : std::string("\x01\x7F\xC3\"/")) {
+    for (size_t offset = 0; offset < plain.size(); offset++) {
+      auto data = plain;
+      data[offset] = stop;
+      auto json = scanPlainBytes(data.data(), data.size(), 0x7F, "\"\\/");
+      auto printable = scanPlainBytes(data.data(), data.size(), 0x7E);
+      EXPECT_EQ((stop == 0x7F) ? data.size() : offset, json);
+      EXPECT_EQ((stop == '"' || stop == '/') ? data.size() : offset,
+                printable);
+    }
+  }
+  EXPECT_EQ(plain.size(), scanPlainBytes(plain.data(), plain.size(), 0x7E));
+  EXPECT_EQ(0U, scanPlainBytes(plain.data(), 0, 0x7E));
+}
+
 TEST_F(ConversionsTests, test_ascii_true) {
   std::string unencoded = "HELLO";
   auto result = isPrintable(unencoded);
@@ -0,0 +1,143 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+class JSONTests : public testing::Test {};
+
+TEST_F(JSONTests, test_writer) {
+  std::string json;
+  JSONWriter writer(json);
+  writer.startObject();
+  writer.value("a", "1");
+  writer.key("b");
+  writer.startArray();
+  writer.value("2");
+  writer.startObject();
+  writer.endObject();
+  writer.value("3");
+  writer.endArray();
+  writer.value("c", "");
+  writer.endObject();
+  EXPECT_EQ("{\"a\":\"1\",\"b\":[\"2\",{},\"3\"],\"c\":\"\"}", json);
+}
+
+TEST_F(JSONTests, test_escape) {
+  std::string output;
+  JSONWriter::escape("a/b\"c\\d\b\f\n\r\t\x01\x1f\x7f", output);
+  EXPECT_EQ("a\\/b\\\"c\\\\d\\b\\f\\n\\r\\t\\u0001\\u001F\x7f", output);
+
+  // Valid UTF-8 is written as-is.
+  output.clear();
+  JSONWriter::escape("\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80", output);
+  EXPECT_EQ("\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80", output);
+
+  // Invalid, overlong, surrogate and truncated sequences are replaced.
+  output.clear();
+  JSONWriter::escape("a\xff" "b\xc0\xaf" "c\xed\xa0\x80" "d\xe2\x82", output);
+  EXPECT_EQ(
+      "a\xef\xbf\xbd"
+      "b\xef\xbf\xbd\xef\xbf\xbd"
+      "c\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd"
+      "d\xef\xbf\xbd\xef\xbf\xbd",
+      output);
+}
+
+TEST_F(JSONTests, test_tree) {
+  pt::ptree row;
+  row.put("name", "value/with \"quotes\"");
+  row.put("empty", "");
+  pt::ptree rows;
+  rows.push_back(std::make_pair("", row));
+  rows.push_back(std::make_pair("", row));
+  pt::ptree tree;
+  tree.add_child("rows", rows);
+  tree.add_child("none", pt::ptree());
+  tree.put("time", 1);
+
+  // Property trees are written the way boost writes them.
+  std::ostringstream expected;
+  pt::write_json(expected, tree, false);
+  std::string json;
+  JSONWriter(json).tree(tree);
+  json += '\n';
+  EXPECT_EQ(expected.str(), json);
+
+  // Including an array at the document root.
+  expected.str("");
+  pt::write_json(expected, rows, false);
+  json.clear();
+  JSONWriter(json).tree(rows);
+  json += '\n';
+  EXPECT_EQ(expected.str(), json);
+}
+
+/// Parse content with boost, which parseJSONTree must match.
+static pt::ptree readJSON(const std::string& json) {
+  pt::ptree tree;
+  std::stringstream input(json);
+  pt::read_json(input, tree);
+  return tree;
+}
+
+TEST_F(JSONTests, test_parse_tree) {
+  std::vector<std::string> documents = {
+      "{}",
+      "[]",
+      "{\"a\": \"1\", \"b\": 2, \"c\": -1.5e+3, \"d\": true, \"e\": null}",
+      " {\"a\": [1, \"two\", {\"b\": false}, [], {}], \"a\": \"dup\"}\n",
+      "[{\"k\": \"v\"}, {\"k\": \"v\"}]",
+      "{\"s\": \"q\\\"\\\\\\/\\b\\f\\n\\r\\t\\u0041\\u00e9\\u20ac\"}",
+      "{\"emoji\": \"\\ud83d\\ude00\", \"raw\": \"\xc3\xa9\"}",
+      "{\"packs\": {\"p\": {\"queries\": {\"q\": {\"query\": \"SELECT 1\", "
+      "\"interval\": 10}}}}}",
+  };
+
+  for (const auto& json : documents) {
+    pt::ptree tree;
+    auto status = parseJSONTree(json, tree);
+    ASSERT_TRUE(status.ok()) << json << ": " << status.getMessage();
+    EXPECT_TRUE(readJSON(json) == tree) << json;
+  }
+}
+
+TEST_F(JSONTests, test_parse_tree_errors) {
+  std::vector<std::string> documents = {
+      "",
+      "{",
+      "{\"a\"}",
+      "{\"a\": }",
+      "{\"a\": 1,}",
+      "[1 2]",
+      "{\"a\": tru}",
+      "{\"a\": 01}",
+      "{\"a\": \"\\x\"}",
+      "{\"a\": \"\\ud83d\"}",
+      "{\"a\": \"line\nbreak\"}",
+      "{} {}",
+  };
+
+  for (const auto& json : documents) {
+    pt::ptree tree;
+    tree.put("kept", "1");
+    EXPECT_FALSE(parseJSONTree(json, tree).ok()) << json;
+    // The tree is unchanged when the content is invalid.
+    EXPECT_EQ("1", tree.get("kept", ""));
+  }
+}
+}
@@ -0,0 +1,99 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/core/memory_pressure.h"
+
+namespace osquery {
+
+DECLARE_uint64(worker_memory_shed);
+DECLARE_uint64(worker_memory_pause);
+
+/// The handlers are never removed, tests record levels while this is set.
+static std::vector<MemoryPressureLevel>* kRecordedLevels{nullptr};
+
+static std::string recordLevel(MemoryPressureLevel level) {
+  if (kRecordedLevels != nullptr) {
+    kRecordedLevels->push_back(level);
+  }
+  return "";
+}
+
+class MemoryPressureTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    shed_ = FLAGS_worker_memory_shed;
+    pause_ = FLAGS_worker_memory_pause;
+    FLAGS_worker_memory_shed = 75;
+    FLAGS_worker_memory_pause = 90;
+    MemoryPressure::reset();
+  }
+
+  void TearDown() override {
+    kRecordedLevels = nullptr;
+    MemoryPressure::reset();
+    FLAGS_worker_memory_shed = shed_;
+    FLAGS_worker_memory_pause = pause_;
+  }
+
+ private:
+  size_t shed_{0};
+  size_t pause_{0};
+};
+
+TEST_F(MemoryPressureTests, test_get_level) {
+  EXPECT_EQ(MemoryPressureLevel::NONE, MemoryPressure::getLevel(10, 0));
+  EXPECT_EQ(MemoryPressureLevel::NONE, MemoryPressure::getLevel(74, 100));
+  EXPECT_EQ(MemoryPressureLevel::SHED, MemoryPressure::getLevel(75, 100));
+  EXPECT_EQ(MemoryPressureLevel::PAUSE, MemoryPressure::getLevel(95, 100));
+
+  // Pausing may be disabled independently of shedding.
+  FLAGS_worker_memory_pause = 0;
+  EXPECT_EQ(MemoryPressureLevel::SHED, MemoryPressure::getLevel(95, 100));
+  FLAGS_worker_memory_shed = 0;
+  EXPECT_EQ(MemoryPressureLevel::NONE, MemoryPressure::getLevel(95, 100));
+}
+
+TEST_F(MemoryPressureTests, test_update) {
+  static bool added =
+      (MemoryPressure::addHandler("test", recordLevel), true);
+  (void)added;
+  std::vector<MemoryPressureLevel> levels;
+  kRecordedLevels = &levels;
+
+  EXPECT_EQ(MemoryPressureLevel::NONE, MemoryPressure::update(50, 100));
+  EXPECT_TRUE(levels.empty());
+
+  EXPECT_EQ(MemoryPressureLevel::SHED, MemoryPressure::update(80, 100));
+  EXPECT_EQ(MemoryPressureLevel::SHED, MemoryPressure::level());
+  ASSERT_EQ(1U, levels.size());
+  EXPECT_EQ(MemoryPressureLevel::SHED, levels[0]);
+
+  // The steps are not repeated within a minute.
+  MemoryPressure::update(80, 100);
+  EXPECT_EQ(1U, levels.size());
+
+  EXPECT_EQ(MemoryPressureLevel::PAUSE, MemoryPressure::update(92, 100));
+  ASSERT_EQ(2U, levels.size());
+  EXPECT_EQ(MemoryPressureLevel::PAUSE, levels[1]);
+
+  // The level only falls once the footprint is clearly below a threshold.
+  EXPECT_EQ(MemoryPressureLevel::PAUSE, MemoryPressure::update(87, 100));
+  EXPECT_EQ(MemoryPressureLevel::SHED, MemoryPressure::update(80, 100));
+  EXPECT_EQ(MemoryPressureLevel::NONE, MemoryPressure::update(10, 100));
+  ASSERT_EQ(4U, levels.size());
+  EXPECT_EQ(MemoryPressureLevel::NONE, levels[3]);
+}
+}
@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/metrics.h"
+
+namespace osquery {
+
+class MetricsTests : public testing::Test {};
+
+/// Find the sample of a metric.
+static bool getSample(const std::string& name,
+                      const std::string& labels,
+                      MetricSample& sample) {
+  std::vector<MetricSample> samples;
+  Metrics::samples(samples);
+  for (const auto& item : samples) {
+    if (item.name == name && item.labels == labels) {
+      sample = item;
+      return true;
+    }
+  }
+  return false;
+}
+
+TEST_F(MetricsTests, test_counter_and_gauge) {
+  auto& counter = Metrics::counter("metrics_tests_counter", "a=b");
+  EXPECT_EQ(&counter, &Metrics::counter("metrics_tests_counter", "a=b"));
+  counter.add();
+  counter.add(2);
+
+  MetricSample sample;
+  ASSERT_TRUE(getSample("metrics_tests_counter", "a=b", sample));
+  EXPECT_EQ(MetricType::COUNTER, sample.type);
+  EXPECT_EQ(3, sample.value);
+
+  // Labels identify separate metrics of the same name.
+  Metrics::counter("metrics_tests_counter", "a=c").add();
+  ASSERT_TRUE(getSample("metrics_tests_counter", "a=c", sample));
+  EXPECT_EQ(1, sample.value);
+
+  auto& gauge = Metrics::gauge("metrics_tests_gauge");
+  gauge.set(10);
+  gauge.add(-3);
+  ASSERT_TRUE(getSample("metrics_tests_gauge", "", sample));
+  EXPECT_EQ(MetricType::GAUGE, sample.type);
+  EXPECT_EQ(7, sample.value);
+}
+
+TEST_F(MetricsTests, test_histogram) {
+  auto& histogram = Metrics::histogram("metrics_tests_histogram");
+  histogram.observe(0);
+  histogram.observe(1);
+  histogram.observe(3);
+  histogram.observe(1ULL << 40);
+
+  MetricSample sample;
+  ASSERT_TRUE(getSample("metrics_tests_histogram", "", sample));
+  EXPECT_EQ(MetricType::HISTOGRAM, sample.type);
+  EXPECT_EQ(4, sample.value);
+  EXPECT_EQ(4 + (1ULL << 40), sample.sum);
+  ASSERT_EQ(kMetricBuckets, sample.buckets.size());
+  EXPECT_EQ(1U, sample.buckets[0]);
+  EXPECT_EQ(1U, sample.buckets[1]);
+  EXPECT_EQ(1U, sample.buckets[2]);
+  EXPECT_EQ(1U, sample.buckets[kMetricBuckets - 1]);
+}
+
+TEST_F(MetricsTests, test_collectors_and_prometheus) {
+  Metrics::addCollector([](std::vector<MetricSample>& samples) {
+    samples.emplace_back();
+    samples.back().name = "metrics_tests_collected";
+    samples.back().labels = "name=with \"quotes\"";
+    samples.back().type = MetricType::GAUGE;
+    samples.back().value = 5;
+  });
+  Metrics::counter("metrics_tests_prometheus").add(2);
+  Metrics::histogram("metrics_tests_prometheus_ms").observe(2);
+
+  auto text = Metrics::toPrometheus();
+  EXPECT_NE(std::string::npos,
+            text.find("# TYPE osquery_metrics_tests_prometheus counter\n"
+                      "osquery_metrics_tests_prometheus 2\n"));
+  EXPECT_NE(std::string::npos,
+            text.find("osquery_metrics_tests_collected"
+                      "{name=\"with \\\"quotes\\\"\"} 5\n"));
+
+  // Histogram buckets are cumulative with inclusive upper bounds.
+  const std::string bucket = "osquery_metrics_tests_prometheus_ms_bucket";
+  EXPECT_NE(std::string::npos, text.find(bucket + "{le=\"1\"} 0\n"));
+  EXPECT_NE(std::string::npos, text.find(bucket + "{le=\"3\"} 1\n"));
+  EXPECT_NE(std::string::npos, text.find(bucket + "{le=\"+Inf\"} 1\n"));
+  EXPECT_NE(std::string::npos,
+            text.find("osquery_metrics_tests_prometheus_ms_count 1\n"));
+}
+}
@@ -8,6 +8,14 @@
  *
  */
 
+#include <thread>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
@@ -121,6 +129,63 @@ TEST_F(ProcessTests, test_envVar) {
   EXPECT_FALSE(val.is_initialized());
 }
 
+TEST_F(ProcessTests, test_getResourceUsage) {
+  ResourceUsage r0;
+  ASSERT_TRUE(getResourceUsage(r0));
+  EXPECT_GT(r0.wall_time, 0U);
+  EXPECT_GT(r0.resident_size, 0U);
+
+  // Spin until the calling thread has used some CPU time.
+  ResourceUsage r1;
+  volatile size_t work = 0;
+  do {
+    for (size_t i = 0; i < 100000; i++) {
+      work = work + i;
+    }
+    ASSERT_TRUE(getResourceUsage(r1));
+  } while (r1.user_time + r1.system_time == r0.user_time + r0.system_time);
+
+  EXPECT_GE(r1.wall_time, r0.wall_time);
+  EXPECT_GE(r1.user_time, r0.user_time);
+  EXPECT_GE(r1.system_time, r0.system_time);
+}
+
+#ifdef __linux__
+TEST_F(ProcessTests, test_background_priority_scope) {
+  if (!isUserAdmin()) {
+    // Only root may raise the thread's priority again.
+    return;
+  }
+
+  // A separate thread, so the test's thread keeps its priority.
+  std::thread([]() {
+    auto tid = static_cast<id_t>(syscall(SYS_gettid));
+    auto nice = getpriority(PRIO_PROCESS, tid);
+    {
+      BackgroundPriorityScope background;
+      EXPECT_EQ(19, getpriority(PRIO_PROCESS, tid));
+    }
+    EXPECT_EQ(nice, getpriority(PRIO_PROCESS, tid));
+  }).join();
+}
+#endif
+
+#if defined(__linux__) || defined(__APPLE__) || defined(WIN32)
+TEST_F(ProcessTests, test_getUsage) {
+  auto process = PlatformProcess::getCurrentProcess();
+  ProcessUsage usage;
+  ASSERT_TRUE(process->getUsage(usage));
+  EXPECT_GT(usage.resident_size, 0U);
+#ifndef WIN32
+  EXPECT_EQ(::getppid(), usage.parent);
+#endif
+
+  // An invalid process cannot be sampled.
+  PlatformProcess invalid;
+  EXPECT_FALSE(invalid.getUsage(usage));
+}
+#endif
+
 TEST_F(ProcessTests, test_launchExtension) {
   {
     std::shared_ptr<osquery::PlatformProcess> process =
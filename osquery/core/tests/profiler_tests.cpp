@@ -0,0 +1,85 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/profiler.h"
+
+namespace osquery {
+
+class WorkerProfilerTests : public testing::Test {};
+
+TEST_F(WorkerProfilerTests, test_summarize) {
+  std::vector<WorkerProfileSample> samples;
+  EXPECT_EQ("0 samples", WorkerProfiler::summarize(samples, 5));
+
+  samples.push_back({"pack_a", "processes", "osquery::genProcesses"});
+  samples.push_back({"pack_a", "processes", "osquery::genProcesses"});
+  samples.push_back({"pack_a", "users", "osquery::genUsers"});
+  samples.push_back({"", "", "memcpy"});
+  EXPECT_EQ(
+      "4 samples; queries: pack_a 75%; tables: processes 50%, users 25%; "
+      "functions: osquery::genProcesses 50%, memcpy 25%, osquery::genUsers 25%",
+      WorkerProfiler::summarize(samples, 5));
+
+  // Only the top entries of each section are included.
+  EXPECT_EQ(
+      "4 samples; queries: pack_a 75%; tables: processes 50%; "
+      "functions: osquery::genProcesses 50%",
+      WorkerProfiler::summarize(samples, 1));
+}
+
+#ifndef WIN32
+TEST_F(WorkerProfilerTests, test_sampling) {
+  EXPECT_FALSE(WorkerProfiler::start(0).ok());
+
+  // Drop samples from other tests.
+  std::vector<WorkerProfileSample> samples;
+  WorkerProfiler::collect(samples);
+  samples.clear();
+
+  ASSERT_TRUE(WorkerProfiler::start(1000).ok());
+  EXPECT_TRUE(WorkerProfiler::running());
+  {
+    std::string query = "profiled_query";
+    std::string table = "profiled_table";
+    WorkerProfileScope profiled_query(WorkerProfileScope::QUERY, query);
+    WorkerProfileScope profiled_table(WorkerProfileScope::TABLE, table);
+
+    // Use CPU time until the timer fires.
+    volatile size_t spin = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start <
+           std::chrono::seconds(1)) {
+      spin++;
+    }
+  }
+  WorkerProfiler::stop();
+  EXPECT_FALSE(WorkerProfiler::running());
+
+  WorkerProfiler::collect(samples);
+  auto attributed = std::find_if(
+      samples.begin(), samples.end(), [](const WorkerProfileSample& sample) {
+        return sample.query == "profiled_query";
+      });
+  ASSERT_NE(samples.end(), attributed);
+  EXPECT_EQ("profiled_table", attributed->table);
+  EXPECT_FALSE(attributed->function.empty());
+
+  // Collected samples are not returned again.
+  samples.clear();
+  WorkerProfiler::collect(samples);
+  EXPECT_TRUE(samples.empty());
+}
+#endif
+}
@@ -8,8 +8,12 @@
  *
  */
 
+#include <thread>
+
 #include <gtest/gtest.h>
 
+#include <osquery/database.h>
+#include <osquery/system.h>
 #include <osquery/tables.h>
 
 namespace osquery {
@@ -106,6 +110,54 @@ TEST_F(TablesTests, test_constraint_matching) {
   EXPECT_TRUE(cl3.matches(1));
 }
 
+TEST_F(TablesTests, test_constraint_admits) {
+  struct ConstraintList cl;
+  cl.affinity = INTEGER_TYPE;
+  EXPECT_TRUE(cl.admits(1));
+
+  // Ranges are evaluated with the list's affinity.
+  cl.add(Constraint(GREATER_THAN, "1000"));
+  cl.add(Constraint(LESS_THAN_OR_EQUALS, "2000"));
+  EXPECT_FALSE(cl.admits(999));
+  EXPECT_FALSE(cl.admits("1000"));
+  EXPECT_TRUE(cl.admits("1001"));
+  EXPECT_TRUE(cl.admits(2000));
+  EXPECT_FALSE(cl.admits(2001));
+  // An expression of another type cannot be compared and is admitted.
+  EXPECT_TRUE(cl.admits("not_a_number"));
+
+  // Several equality constraints are an IN list.
+  cl.add(Constraint(EQUALS, "1500"));
+  cl.add(Constraint(EQUALS, "3000"));
+  EXPECT_TRUE(cl.admits(1500));
+  EXPECT_FALSE(cl.admits(1600));
+  EXPECT_FALSE(cl.admits(3000));
+  EXPECT_FALSE(cl.matches(1500));
+
+  struct ConstraintList paths;
+  paths.add(Constraint(LIKE, "/etc/%"));
+  paths.add(Constraint(LIKE, "%.CONF"));
+  EXPECT_TRUE(paths.admits("/etc/ssh/sshd.conf"));
+  EXPECT_FALSE(paths.admits("/etc/hosts"));
+  EXPECT_FALSE(paths.admits("/var/etc/a.conf"));
+
+  struct ConstraintList names;
+  names.add(Constraint(LIKE, "a_c"));
+  EXPECT_TRUE(names.admits("abc"));
+  EXPECT_TRUE(names.admits("a\xc3\xa9c"));
+  EXPECT_FALSE(names.admits("ac"));
+  // Operators that are not evaluated admit every expression.
+  names.add(Constraint(REGEXP, "^b"));
+  EXPECT_TRUE(names.admits("abc"));
+
+  QueryContext context;
+  context.constraints["pid"].affinity = INTEGER_TYPE;
+  context.constraints["pid"].add(Constraint(GREATER_THAN, "1"));
+  EXPECT_FALSE(context.admits("pid", "1"));
+  EXPECT_TRUE(context.admits("pid", "2"));
+  EXPECT_TRUE(context.admits("parent", "1"));
+}
+
 TEST_F(TablesTests, test_constraint_map) {
   ConstraintMap cm;
 
@@ -133,10 +185,14 @@ class TestTablePlugin : public TablePlugin {
  public:
   void testSetCache(size_t step, size_t interval) {
     QueryData r;
-    setCache(step, interval, r);
+    QueryContext ctx;
+    setCache(step, interval, ctx, r);
   }
 
-  bool testIsCached(size_t interval) { return isCached(interval); }
+  bool testIsCached(size_t step) {
+    QueryContext ctx;
+    return isCached(step, ctx);
+  }
 };
 
 TEST_F(TablesTests, test_caching) {
@@ -163,5 +219,490 @@ TEST_F(TablesTests, test_caching) {
   // Now 6 is within the freshness of 2 + 5.
   EXPECT_TRUE(test.testIsCached(6));
   EXPECT_FALSE(test.testIsCached(7));
+
+  TablePlugin::kCacheInterval = 0;
+  TablePlugin::kCacheStep = 0;
+}
+
+class TTLTablePlugin : public TablePlugin {
+ public:
+  size_t cacheTTL() const override {
+    return 100;
+  }
+
+  bool cached(size_t step, const std::string& path, QueryData& results) {
+    QueryContext ctx;
+    if (!path.empty()) {
+      ctx.constraints["path"].add(Constraint(EQUALS, path));
+    }
+    return getCache(step, ctx, results);
+  }
+
+  void cache(size_t step, const std::string& path, const QueryData& results) {
+    QueryContext ctx;
+    if (!path.empty()) {
+      ctx.constraints["path"].add(Constraint(EQUALS, path));
+    }
+    setCache(step, 5, ctx, results);
+  }
+};
+
+TEST_F(TablesTests, test_caching_constraints) {
+  TTLTablePlugin test;
+  QueryData results;
+  EXPECT_FALSE(test.cached(10, "", results));
+
+  // Results are cached in memory for each set of constraints.
+  test.cache(10, "", {{{"path", "/"}}, {{"path", "/tmp"}}});
+  test.cache(10, "/tmp", {{{"path", "/tmp"}}});
+  ASSERT_TRUE(test.cached(11, "", results));
+  EXPECT_EQ(2U, results.size());
+  ASSERT_TRUE(test.cached(11, "/tmp", results));
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("/tmp", results[0]["path"]);
+  EXPECT_FALSE(test.cached(11, "/etc", results));
+
+  // The table's TTL replaces the query interval.
+  EXPECT_TRUE(test.cached(109, "", results));
+  EXPECT_FALSE(test.cached(110, "", results));
+
+  // Steps outside of the schedule are not cached.
+  EXPECT_FALSE(test.cached(0, "", results));
+
+  auto stats = test.cacheStats();
+  EXPECT_EQ(2U, stats.entries);
+  EXPECT_EQ(0U, stats.spilled);
+  EXPECT_GT(stats.bytes, 0U);
+  EXPECT_EQ(3U, stats.hits);
+  EXPECT_EQ(3U, stats.misses);
+
+  // Expired entries are released when new results are cached.
+  test.cache(200, "", {});
+  EXPECT_EQ(1U, test.cacheStats().entries);
+}
+
+class WarmTablePlugin : public TablePlugin {
+ public:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("pid", INTEGER_TYPE, ColumnOptions::INDEX),
+        std::make_tuple("uid", INTEGER_TYPE, ColumnOptions::ADDITIONAL),
+    };
+  }
+
+  QueryData generate(QueryContext& context) override {
+    generated++;
+    return {{{"pid", "1"}, {"uid", "0"}}, {{"pid", "2"}, {"uid", "0"}}};
+  }
+
+  size_t generated{0};
+};
+
+class RequiredTablePlugin : public TablePlugin {
+ public:
+  TableColumns columns() const override {
+    return {std::make_tuple("path", TEXT_TYPE, ColumnOptions::REQUIRED)};
+  }
+};
+
+TEST_F(TablesTests, test_warm_cache) {
+  WarmTablePlugin test;
+  QueryContext context;
+  QueryData results;
+  EXPECT_FALSE(test.getWarmCache(context, results));
+
+  ASSERT_TRUE(test.warmCache(60).ok());
+  EXPECT_EQ(1U, test.generated);
+  ASSERT_TRUE(test.getWarmCache(context, results));
+  EXPECT_EQ(2U, results.size());
+
+  // The warm results answer any query that SQLite may filter.
+  QueryContext indexed;
+  indexed.constraints["pid"].add(Constraint(EQUALS, "1"));
+  EXPECT_TRUE(test.getWarmCache(indexed, results));
+
+  // Additional columns change the table's rows.
+  QueryContext additional;
+  additional.constraints["uid"].add(Constraint(EQUALS, "501"));
+  EXPECT_FALSE(test.getWarmCache(additional, results));
+
+  // Scheduled queries do not use the warm results.
+  TablePlugin::kCacheStep = 1;
+  EXPECT_FALSE(test.getWarmCache(context, results));
+  TablePlugin::kCacheStep = 0;
+
+  EXPECT_EQ(1U, test.cacheStats().entries);
+  EXPECT_GT(test.clearCache(), 0U);
+  EXPECT_FALSE(test.getWarmCache(context, results));
+
+  RequiredTablePlugin required;
+  EXPECT_FALSE(required.canWarm());
+  EXPECT_FALSE(required.warmCache(60).ok());
+}
+
+class BootTablePlugin : public TablePlugin {
+ public:
+  BootTablePlugin() {
+    setName("boot_test");
+  }
+
+  bool cached(const std::string& path, QueryData& results) {
+    QueryContext ctx;
+    if (!path.empty()) {
+      ctx.constraints["path"].add(Constraint(EQUALS, path));
+    }
+    return getBootCache(ctx, results);
+  }
+
+  void cache(const std::string& path, const QueryData& results) {
+    QueryContext ctx;
+    if (!path.empty()) {
+      ctx.constraints["path"].add(Constraint(EQUALS, path));
+    }
+    setBootCache(ctx, results);
+  }
+};
+
+TEST_F(TablesTests, test_boot_cache) {
+  if (getBootIdentity().empty()) {
+    return;
+  }
+
+  BootTablePlugin test;
+  QueryData results;
+  EXPECT_FALSE(test.cached("/tmp", results));
+
+  // Results are kept for each set of constraints, inside and outside of the
+  // schedule.
+  test.cache("/tmp", {{{"path", "/tmp"}}});
+  ASSERT_TRUE(test.cached("/tmp", results));
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("/tmp", results[0]["path"]);
+  EXPECT_FALSE(test.cached("/etc", results));
+
+  TablePlugin::kCacheStep = 1;
+  EXPECT_TRUE(test.cached("/tmp", results));
+  TablePlugin::kCacheStep = 0;
+
+  // Results from a previous boot are not served.
+  auto key = "boot_cache.boot_test." +
+             std::to_string(std::hash<std::string>()(
+                 QueryContext().cacheKey()));
+  setDatabaseValue(kQueries, key, "0\n" + kVersion + "\n[]");
+  EXPECT_FALSE(test.cached("", results));
+
+  auto stats = test.cacheStats();
+  EXPECT_EQ(2U, stats.hits);
+  EXPECT_EQ(3U, stats.misses);
+}
+
+TEST_F(TablesTests, test_context_cache_key) {
+  QueryContext ctx1;
+  ctx1.constraints["path"].add(Constraint(EQUALS, "/tmp"));
+  ctx1.constraints["path"].add(Constraint(EQUALS, "/etc"));
+  QueryContext ctx2;
+  ctx2.constraints["path"].add(Constraint(EQUALS, "/etc"));
+  ctx2.constraints["path"].add(Constraint(EQUALS, "/tmp"));
+  // The order of constraints does not change the key.
+  EXPECT_EQ(ctx1.cacheKey(), ctx2.cacheKey());
+
+  ctx2.colsUsed = UsedColumns({"path"});
+  EXPECT_NE(ctx1.cacheKey(), ctx2.cacheKey());
+
+  QueryContext ctx3;
+  ctx3.constraints["path"].add(Constraint(LIKE, "/tmp"));
+  EXPECT_NE(ctx1.cacheKey(), ctx3.cacheKey());
+}
+
+TEST_F(TablesTests, test_row_batch) {
+  TableColumns columns = {
+      std::make_tuple("name", TEXT_TYPE, ColumnOptions::DEFAULT),
+      std::make_tuple("size", BIGINT_TYPE, ColumnOptions::DEFAULT),
+      std::make_tuple("ratio", DOUBLE_TYPE, ColumnOptions::DEFAULT),
+  };
+  RowBatch batch(columns);
+  EXPECT_EQ(3U, batch.columns());
+  EXPECT_EQ(0U, batch.size());
+  EXPECT_EQ(1U, batch.index("size"));
+  EXPECT_EQ(batch.columns(), batch.index("missing"));
+
+  batch.addRow();
+  batch.setText(0, "first");
+  batch.setInteger(1, 10);
+  batch.setDouble(2, 0.5);
+
+  // Cells that are not set are NULL.
+  batch.addRow();
+  batch.set(1, "20");
+  EXPECT_EQ(2U, batch.size());
+
+  EXPECT_EQ("first", batch.getText(0, 0));
+  EXPECT_EQ(10, batch.getInteger(0, 1));
+  EXPECT_EQ(0.5, batch.getDouble(0, 2));
+  EXPECT_TRUE(batch.isNull(1, 0));
+  EXPECT_EQ(20, batch.getInteger(1, 1));
+  EXPECT_EQ("20", batch.getAsText(1, 1));
+
+  // A TEXT expression that does not match the affinity remains NULL.
+  batch.set(2, "not a double");
+  EXPECT_TRUE(batch.isNull(1, 2));
+
+  QueryData results;
+  batch.toQueryData(results);
+  ASSERT_EQ(2U, results.size());
+  EXPECT_EQ("first", results[0]["name"]);
+  EXPECT_EQ("10", results[0]["size"]);
+  EXPECT_EQ(1U, results[1].size());
+  EXPECT_EQ("20", results[1]["size"]);
+
+  batch.clear();
+  EXPECT_EQ(0U, batch.size());
+  EXPECT_EQ(3U, batch.columns());
+}
+
+TEST_F(TablesTests, test_row_arena) {
+  RowArena arena;
+  auto first = arena.copy("first", 5);
+  EXPECT_EQ("first", first);
+  EXPECT_EQ(RowArena::kChunkSize, arena.capacity());
+
+  // Copies larger than a chunk do not move earlier copies.
+  std::string large(RowArena::kChunkSize * 2, 'a');
+  auto copied = arena.copy(large.data(), large.size());
+  EXPECT_EQ(large, copied.to_string());
+  auto second = arena.copy("second", 6);
+  EXPECT_EQ("first", first);
+  EXPECT_EQ("second", second);
+  EXPECT_EQ(large.size() + 11, arena.bytes());
+
+  // Empty copies are empty strings rather than null pointers.
+  EXPECT_NE(nullptr, arena.copy("", 0).data());
+
+  // Resetting keeps a single chunk to reuse.
+  arena.reset();
+  EXPECT_EQ(0U, arena.bytes());
+  EXPECT_EQ(RowArena::kChunkSize, arena.capacity());
+}
+
+/// Columns shaped like those generated with gentable.py --columns.
+struct TestColumns {
+  enum Col : size_t { name = 0, size, ratio };
+  static constexpr size_t kCount = 3;
+
+  static const std::string& getName(size_t column) {
+    static const std::string kNames[] = {"name", "size", "ratio"};
+    return kNames[column];
+  }
+
+  static constexpr ColumnType getType(size_t column) {
+    if (column == name) {
+      return TEXT_TYPE;
+    }
+    if (column == size) {
+      return BIGINT_TYPE;
+    }
+    if (column == ratio) {
+      return DOUBLE_TYPE;
+    }
+    return UNKNOWN_TYPE;
+  }
+};
+
+TEST_F(TablesTests, test_typed_row) {
+  using Col = TestColumns;
+  TableColumns columns = {
+      std::make_tuple("name", TEXT_TYPE, ColumnOptions::DEFAULT),
+      std::make_tuple("size", BIGINT_TYPE, ColumnOptions::DEFAULT),
+      std::make_tuple("ratio", DOUBLE_TYPE, ColumnOptions::DEFAULT),
+  };
+
+  // Typed rows write cells by index into a batch.
+  RowBatch batch(columns);
+  {
+    TypedRow<TestColumns> r(batch);
+    r.set<Col::name>(std::string("first"));
+    r.set<Col::size>(10);
+    r.set<Col::ratio>(0.5);
+  }
+  {
+    TypedRow<TestColumns> r(batch);
+    r.set<Col::size>(20U);
+  }
+  ASSERT_EQ(2U, batch.size());
+  EXPECT_EQ("first", batch.getText(0, Col::name));
+  EXPECT_EQ(10, batch.getInteger(0, Col::size));
+  EXPECT_EQ(0.5, batch.getDouble(0, Col::ratio));
+  EXPECT_TRUE(batch.isNull(1, Col::name));
+  EXPECT_EQ(20, batch.getInteger(1, Col::size));
+
+  // And by column name into a row for tables returning QueryData.
+  Row row;
+  {
+    TypedRow<TestColumns> r(row);
+    r.set<Col::name>(std::string("second"));
+    r.set<Col::size>(30);
+  }
+  ASSERT_EQ(2U, row.size());
+  EXPECT_EQ("second", row["name"]);
+  EXPECT_EQ("30", row["size"]);
+}
+
+TEST_F(TablesTests, test_context_columns_used) {
+  // Without SQLite, or without the information, every column is used.
+  QueryContext context;
+  EXPECT_TRUE(context.isColumnUsed("path"));
+  EXPECT_TRUE(context.isAnyColumnUsed({"path", "md5"}));
+
+  context.colsUsed = UsedColumns({"path"});
+  EXPECT_TRUE(context.isColumnUsed("path"));
+  EXPECT_FALSE(context.isColumnUsed("md5"));
+  EXPECT_TRUE(context.isAnyColumnUsed({"md5", "path"}));
+  EXPECT_FALSE(context.isAnyColumnUsed({"md5", "sha1"}));
+
+  // The used columns are serialized for extension tables.
+  PluginRequest request;
+  TablePlugin::setRequestFromContext(context, request);
+  QueryContext context2;
+  TablePlugin::setContextFromRequest(request, context2);
+  ASSERT_TRUE(context2.colsUsed);
+  EXPECT_EQ(*context.colsUsed, *context2.colsUsed);
+
+  // A context without used columns is serialized as using every column.
+  QueryContext context3;
+  TablePlugin::setRequestFromContext(context3, request);
+  QueryContext context4;
+  TablePlugin::setContextFromRequest(request, context4);
+  EXPECT_FALSE(context4.colsUsed);
+}
+
+TEST_F(TablesTests, test_parallel_for) {
+  std::vector<size_t> results(100, 0);
+  parallelFor(results.size(), 4, ([&results](size_t i) { results[i] = i; }));
+  for (size_t i = 0; i < results.size(); i++) {
+    EXPECT_EQ(i, results[i]);
+  }
+
+  // Without concurrency all work runs on the calling thread.
+  auto caller = std::this_thread::get_id();
+  bool same_thread = true;
+  parallelFor(10, 1, ([&caller, &same_thread](size_t i) {
+                same_thread &= (std::this_thread::get_id() == caller);
+              }));
+  EXPECT_TRUE(same_thread);
+
+  // Failures within a worker are raised to the caller.
+  EXPECT_THROW(parallelFor(10,
+                           4,
+                           ([](size_t i) {
+                             if (i == 5) {
+                               throw std::runtime_error("failed");
+                             }
+                           })),
+               std::runtime_error);
+
+  // Every task sees the calling query's budget.
+  {
+    QueryBudget budget(0);
+    std::atomic<size_t> budgeted{0};
+    parallelFor(10, 4, ([&budget, &budgeted](size_t i) {
+                  if (QueryBudget::current() == &budget) {
+                    budgeted++;
+                  }
+                }));
+    EXPECT_EQ(10U, budgeted);
+  }
+  EXPECT_EQ(nullptr, QueryBudget::current());
+
+  // Empty work is allowed.
+  parallelFor(0, 4, ([](size_t i) { FAIL(); }));
+}
+
+TEST_F(TablesTests, test_query_budget) {
+  EXPECT_FALSE(QueryBudget::interrupted());
+  EXPECT_EQ(nullptr, QueryBudget::current());
+
+  {
+    // A budget without a time limit is only spent when stopped.
+    std::atomic<bool> stopped{false};
+    QueryBudget unlimited(0, &stopped);
+    EXPECT_EQ(&unlimited, QueryBudget::current());
+    EXPECT_FALSE(QueryBudget::interrupted());
+    stopped = true;
+    EXPECT_TRUE(QueryBudget::interrupted());
+    EXPECT_FALSE(unlimited.expired());
+  }
+
+  {
+    QueryBudget outer(1);
+    {
+      // An enclosing budget that is spent interrupts nested queries.
+      QueryBudget inner(0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      EXPECT_FALSE(inner.spent());
+      EXPECT_TRUE(QueryBudget::interrupted());
+    }
+    EXPECT_EQ(&outer, QueryBudget::current());
+    EXPECT_TRUE(outer.expired());
+
+    // Work is not started once the calling query's budget is spent.
+    size_t started = 0;
+    parallelFor(10, 1, ([&started](size_t i) { started++; }));
+    EXPECT_EQ(0U, started);
+  }
+
+  EXPECT_EQ(nullptr, QueryBudget::current());
+  EXPECT_FALSE(QueryBudget::interrupted());
+}
+
+TEST_F(TablesTests, test_query_budget_result_limits) {
+  QueryBudget unlimited(0);
+  EXPECT_FALSE(unlimited.limitsResults());
+  EXPECT_EQ(100U, unlimited.admitRows(100, 1000));
+  EXPECT_TRUE(unlimited.hasRoom());
+  EXPECT_FALSE(unlimited.truncated());
+
+  {
+    // Rows beyond either limit are dropped.
+    QueryBudget budget(0);
+    budget.setResultLimits(10, 100);
+    EXPECT_EQ(4U, budget.admitRows(4, 40));
+    EXPECT_EQ(6U, budget.remainingRows());
+    EXPECT_EQ(60U, budget.remainingBytes());
+    EXPECT_FALSE(budget.truncated());
+
+    // 20 byte rows exceed the byte limit first.
+    EXPECT_EQ(3U, budget.admitRows(5, 100));
+    EXPECT_TRUE(budget.truncated());
+    EXPECT_FALSE(budget.hasRoom());
+    EXPECT_EQ(0U, budget.admitRows(1, 20));
+  }
+
+  {
+    QueryBudget budget(0);
+    budget.setResultLimits(2, 0);
+    EXPECT_EQ(2U, budget.admitRows(2, 10));
+    EXPECT_FALSE(budget.truncated());
+    // Reaching a limit truncates the results once more rows are asked for.
+    EXPECT_FALSE(budget.hasRoom());
+    EXPECT_TRUE(budget.truncated());
+  }
+}
+
+TEST_F(TablesTests, test_query_context_admit) {
+  QueryContext unlimited;
+  EXPECT_TRUE(unlimited.admit({{"path", "/"}}));
+  EXPECT_FALSE(unlimited.truncated());
+
+  QueryContext context;
+  context.max_rows = 2;
+  context.max_bytes = 16;
+  // Each row is 9 bytes of column names and values.
+  EXPECT_TRUE(context.admit({{"path", "/tmp"}, {"i", ""}}));
+  EXPECT_FALSE(context.admit({{"path", "/tmp"}, {"i", ""}}));
+  EXPECT_TRUE(context.truncated());
+
+  context.max_bytes = 0;
+  EXPECT_TRUE(context.admit({{"path", "/tmp"}}));
+  EXPECT_FALSE(context.admit({{"path", "/tmp"}}));
 }
 }
@@ -8,19 +8,25 @@
  *
  */
 
+#include <boost/filesystem.hpp>
+
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
+#include <osquery/filesystem.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/testing.h"
 #include "osquery/core/watcher.h"
+#include "osquery/tests/test_util.h"
 
 using namespace testing;
 
 namespace osquery {
 
+DECLARE_string(watchdog_cgroup);
+
 class WatcherTests : public testing::Test {};
 
 /**
@@ -261,4 +267,142 @@ TEST_F(WatcherTests, test_watcherrunner_watcherhealth) {
   runner.isWatcherHealthy(*test_process, state);
   EXPECT_EQ(2U, state.sustained_latency);
 }
+
+TEST_F(WatcherTests, test_query_offender) {
+  auto memory = getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024;
+  auto latency = getWorkerLimit(WatchdogLimitType::LATENCY_LIMIT) * 1000000;
+
+  WorkerQueryStats idle;
+  idle.slot = 0;
+  idle.name = "idle";
+  idle.elapsed = latency;
+
+  // A query may sustain the utilization limit for a share of the latency.
+  WorkerQueryStats busy;
+  busy.slot = 1;
+  busy.name = "busy";
+  busy.elapsed = latency;
+  busy.cpu_time = latency;
+
+  WorkerQueryStats offender;
+  std::vector<WorkerQueryStats> queries = {idle};
+  EXPECT_EQ(WorkerQueryAction::NONE, getQueryOffender(queries, offender));
+
+  queries.push_back(busy);
+  EXPECT_EQ(WorkerQueryAction::THROTTLE, getQueryOffender(queries, offender));
+  EXPECT_EQ("busy", offender.name);
+
+  // Memory growth takes precedence and blacklists the query.
+  idle.memory = memory;
+  queries.push_back(idle);
+  EXPECT_EQ(WorkerQueryAction::BLACKLIST, getQueryOffender(queries, offender));
+  EXPECT_EQ("idle", offender.name);
+
+  // Under memory pressure the query with the most growth is throttled.
+  WorkerQueryStats growing;
+  growing.slot = 2;
+  growing.name = "growing";
+  growing.memory = 1024;
+  queries = {idle, growing};
+  queries[0].memory = 0;
+  EXPECT_EQ(WorkerQueryAction::NONE, getQueryOffender(queries, offender));
+  EXPECT_EQ(WorkerQueryAction::THROTTLE,
+            getQueryOffender(queries, offender, true));
+  EXPECT_EQ("growing", offender.name);
+}
+
+#ifdef __linux__
+TEST_F(WatcherTests, test_watchdog_cgroup) {
+  // A directory stands in for the cgroup v2 hierarchy.
+  auto root = kTestWorkingDirectory + "watchdog-cgroup";
+  FLAGS_watchdog_cgroup = root;
+
+  auto process = PlatformProcess::getCurrentProcess();
+  ASSERT_TRUE(setWatchdogCgroup("worker", *process).ok());
+
+  std::string content;
+  ASSERT_TRUE(readFile(root + "/worker/cgroup.procs", content).ok());
+  EXPECT_EQ(std::to_string(process->pid()), content);
+
+  auto memory = getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024;
+  ASSERT_TRUE(readFile(root + "/worker/memory.high", content).ok());
+  EXPECT_EQ(std::to_string(memory), content);
+
+  ASSERT_TRUE(readFile(root + "/worker/cpu.max", content).ok());
+  auto quota = getWorkerLimit(WatchdogLimitType::UTILIZATION_LIMIT) * 1000;
+  EXPECT_EQ(std::to_string(quota) + " 100000", content);
+
+  double pressure = 0;
+  EXPECT_FALSE(getWatchdogCgroupPressure("worker", pressure).ok());
+  writeTextFile(root + "/worker/memory.pressure",
+                "some avg10=12.50 avg60=1.00 avg300=0.00 total=100\n"
+                "full avg10=2.00 avg60=0.00 avg300=0.00 total=10\n");
+  ASSERT_TRUE(getWatchdogCgroupPressure("worker", pressure).ok());
+  EXPECT_DOUBLE_EQ(12.5, pressure);
+
+  FLAGS_watchdog_cgroup = "";
+  boost::filesystem::remove_all(root);
+}
+#endif
+
+#ifndef WIN32
+TEST_F(WatcherTests, test_worker_stats) {
+  std::shared_ptr<WorkerStats> watcher;
+  ASSERT_TRUE(WorkerStats::create(watcher).ok());
+
+  // A worker maps the block named in its environment.
+  std::shared_ptr<WorkerStats> worker;
+  EXPECT_FALSE(WorkerStats::open("/not_osquery", worker).ok());
+  ASSERT_TRUE(WorkerStats::open(watcher->name(), worker).ok());
+
+  auto slot = worker->begin("test_query");
+  ASSERT_GE(slot, 0);
+  worker->sample(slot);
+
+  std::vector<WorkerQueryStats> queries;
+  watcher->queries(queries);
+  ASSERT_EQ(1U, queries.size());
+  EXPECT_EQ("test_query", queries[0].name);
+  EXPECT_FALSE(worker->stopped(slot)->load());
+
+  // The watcher stops the query, the worker sees the reason.
+  watcher->stop(queries[0], WorkerQueryAction::THROTTLE);
+  EXPECT_TRUE(worker->stopped(slot)->load());
+  EXPECT_EQ(WorkerQueryAction::THROTTLE, worker->action(slot));
+
+  worker->end(slot);
+  queries.clear();
+  watcher->queries(queries);
+  EXPECT_TRUE(queries.empty());
+
+  // The sample window keeps the latest samples, oldest first.
+  for (size_t i = 0; i < kWorkerStatsSamples + 2; i++) {
+    WorkerUtilization sample;
+    sample.utilization = i;
+    sample.footprint = i * 1024;
+    watcher->addSample(sample);
+  }
+
+  std::vector<WorkerUtilization> samples;
+  worker->samples(samples);
+  ASSERT_EQ(kWorkerStatsSamples, samples.size());
+  EXPECT_EQ(2U, samples.front().utilization);
+  EXPECT_EQ((kWorkerStatsSamples + 1) * 1024, samples.back().footprint);
+
+  // A standby worker continues once the watcher promotes its process ID.
+  EXPECT_FALSE(worker->promoted(1234));
+  watcher->promote(1234);
+  EXPECT_TRUE(worker->promoted(1234));
+  EXPECT_FALSE(worker->promoted(1235));
+
+  // The recovery gap is only recorded after the watcher lost a worker.
+  worker->setRecovered();
+  EXPECT_EQ(0U, worker->recoveryGap());
+  watcher->setWorkerLost();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  worker->setRecovered();
+  EXPECT_GE(worker->recoveryGap(), 20U);
+  EXPECT_EQ(worker->recoveryGap(), watcher->recoveryGap());
+}
+#endif
 }
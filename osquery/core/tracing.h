@@ -0,0 +1,41 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+/**
+ * @brief Statically-defined tracing probes of the "osquery" provider.
+ *
+ * Probes mark the boundaries of the query pipeline: scheduled queries, SQL
+ * statements, virtual table filters, table generation, logging, database
+ * access, and events. When osquery is built with <sys/sdt.h> each probe is a
+ * single no-op instruction until a tracer such as bpftrace or perf attaches:
+ *
+ * @code{.sh}
+ *   bpftrace -e 'usdt:/usr/bin/osqueryd:osquery:filter__done
+ *     { @rows[str(arg0)] = sum(arg1); }'
+ * @endcode
+ *
+ * Arguments are evaluated even when no tracer is attached, probes must not be
+ * passed expressions that allocate. Without tracing support the probes compile
+ * out. The probes and their arguments are listed in the performance-safety
+ * deployment documentation.
+ */
+#if defined(OSQUERY_TRACING)
+#include <sys/sdt.h>
+
+#define TRACE_PROBE1(name, a) DTRACE_PROBE1(osquery, name, a)
+#define TRACE_PROBE2(name, a, b) DTRACE_PROBE2(osquery, name, a, b)
+#define TRACE_PROBE3(name, a, b, c) DTRACE_PROBE3(osquery, name, a, b, c)
+#else
+#define TRACE_PROBE1(name, a)
+#define TRACE_PROBE2(name, a, b)
+#define TRACE_PROBE3(name, a, b, c)
+#endif
@@ -17,6 +17,11 @@
 #include <sys/wait.h>
 #endif
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
@@ -26,6 +31,7 @@
 
 #include "osquery/core/process.h"
 #include "osquery/core/watcher.h"
+#include "osquery/core/worker_stats.h"
 
 extern char** environ;
 
@@ -42,6 +48,7 @@ struct LimitDefinition {
 struct PerformanceChange {
   size_t sustained_latency;
   size_t footprint;
+  size_t utilization;
   size_t iv;
   pid_t parent;
 };
@@ -80,6 +87,31 @@ CLI_FLAG(uint64,
 
 CLI_FLAG(bool, disable_watchdog, false, "Disable userland watchdog process");
 
+CLI_FLAG(uint64,
+         watchdog_query_threshold,
+         75,
+         "Percent of the worker limits a single query may use (0 to disable)");
+
+CLI_FLAG(string,
+         watchdog_cgroup,
+         "",
+         "Linux cgroup v2 directory to place the worker and extensions in");
+
+CLI_FLAG(bool,
+         watchdog_standby,
+         false,
+         "Keep an initialized standby worker to replace a stopped worker");
+
+CLI_FLAG(uint64,
+         watchdog_memory_pressure,
+         10,
+         "Worker cgroup memory pressure percent that stops a query (0 to off)");
+
+DECLARE_bool(worker_profile);
+
+/// The cgroup CPU bandwidth period in microseconds.
+const size_t kCgroupCpuPeriod{100000};
+
 void Watcher::resetWorkerCounters(size_t respawn_time) {
   // Reset the monitoring counters for the watcher.
   auto& state = instance().state_;
@@ -195,6 +227,12 @@ void WatcherRunner::start() {
       createWorker();
     }
 
+    if (use_worker_ && FLAGS_watchdog_standby &&
+        Watcher::getWorker().isValid()) {
+      // Keep a standby ready to replace the worker.
+      createStandby();
+    }
+
     // Loop over every managed extension and check sanity.
     for (const auto& extension : Watcher::extensions()) {
       if (!isChildSane(*extension.second)) {
@@ -230,6 +268,12 @@ void WatcherRunner::start() {
     }
     pauseMilli(getWorkerLimit(WatchdogLimitType::INTERVAL) * 1000);
   } while (!interrupted() && ok());
+
+  // A standby worker is never promoted after the watcher stops.
+  if (Watcher::getStandby().isValid()) {
+    stopChild(Watcher::getStandby());
+    Watcher::setStandby(std::make_shared<PlatformProcess>());
+  }
 }
 
 bool WatcherRunner::watch(const PlatformProcess& child) const {
@@ -279,6 +323,7 @@ void WatcherRunner::stopChild(const PlatformProcess& child) const {
 
 PerformanceChange getChange(const Row& r, PerformanceState& state) {
   PerformanceChange change;
+  change.utilization = 0;
 
   // IV is the check interval in seconds, and utilization is set per-second.
   change.iv = std::max(getWorkerLimit(WatchdogLimitType::INTERVAL), (size_t)1);
@@ -294,6 +339,7 @@ PerformanceChange getChange(const Row& r, PerformanceState& state) {
   }
 
   // Check the difference of CPU time used since last check.
+  // Process times include every thread, such as table generator workers.
   if (user_time - state.user_time >
           getWorkerLimit(WatchdogLimitType::UTILIZATION_LIMIT) ||
       system_time - state.system_time >
@@ -302,6 +348,13 @@ PerformanceChange getChange(const Row& r, PerformanceState& state) {
   } else {
     state.sustained_latency = 0;
   }
+  // CPU times are hundredths of a second for each second of the interval.
+  if ((state.user_time > 0 || state.system_time > 0) &&
+      user_time >= state.user_time && system_time >= state.system_time) {
+    change.utilization =
+        user_time - state.user_time + system_time - state.system_time;
+  }
+
   // Update the current CPU time.
   state.user_time = user_time;
   state.system_time = system_time;
@@ -344,6 +397,18 @@ static bool exceededCyclesLimit(const PerformanceChange& change) {
   return (latency >= getWorkerLimit(WatchdogLimitType::LATENCY_LIMIT));
 }
 
+/// A worker nearing half the latency or three quarters of the memory limit.
+static bool approachedLimits(const PerformanceChange& change) {
+  auto latency = change.sustained_latency * change.iv;
+  if (latency > 0 &&
+      latency * 2 >= getWorkerLimit(WatchdogLimitType::LATENCY_LIMIT)) {
+    return true;
+  }
+
+  auto memory = getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024;
+  return (change.footprint > memory / 4 * 3);
+}
+
 Status WatcherRunner::isWatcherHealthy(const PlatformProcess& watcher,
                                        PerformanceState& watcher_state) const {
   auto rows = getProcessRow(watcher.pid());
@@ -361,6 +426,18 @@ Status WatcherRunner::isWatcherHealthy(const PlatformProcess& watcher,
 }
 
 QueryData WatcherRunner::getProcessRow(pid_t pid) const {
+  // Sample the process directly, a processes table row reads much more.
+  PlatformProcess process(pid);
+  ProcessUsage usage;
+  if (process.getUsage(usage)) {
+    Row r;
+    r["parent"] = BIGINT(usage.parent);
+    // CPU times are hundredths of a second, the same as Linux clock ticks.
+    r["user_time"] = BIGINT(usage.user_time / 10000);
+    r["system_time"] = BIGINT(usage.system_time / 10000);
+    r["resident_size"] = BIGINT(usage.resident_size);
+    return {r};
+  }
   return SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(pid));
 }
 
@@ -387,6 +464,21 @@ Status WatcherRunner::isChildSane(const PlatformProcess& child) const {
     return Status(0);
   }
 
+  if (use_worker_ && child.pid() == Watcher::getWorker().pid()) {
+    // Memory pressure in the worker's cgroup precedes the kernel's OOM kill.
+    double pressure = 0;
+    auto shed = FLAGS_watchdog_memory_pressure > 0 &&
+                getWatchdogCgroupPressure("worker", pressure).ok() &&
+                pressure >= FLAGS_watchdog_memory_pressure;
+    stopQueryOffender(change.utilization, change.footprint, shed);
+
+    // Ask the worker to log what it is executing before it is restarted.
+    auto stats = WorkerStats::get();
+    if (FLAGS_worker_profile && stats != nullptr && approachedLimits(change)) {
+      stats->requestProfile();
+    }
+  }
+
   if (exceededCyclesLimit(change)) {
     return Status(1, "System performance limits exceeded");
   }
@@ -405,7 +497,84 @@ Status WatcherRunner::isChildSane(const PlatformProcess& child) const {
   return Status(0);
 }
 
+void WatcherRunner::stopQueryOffender(size_t utilization,
+                                      size_t footprint,
+                                      bool shed) const {
+  auto stats = WorkerStats::get();
+  if (stats == nullptr) {
+    return;
+  }
+
+  WorkerUtilization sample;
+  sample.utilization = utilization;
+  sample.footprint = footprint;
+  stats->addSample(sample);
+
+  std::vector<WorkerQueryStats> queries;
+  stats->queries(queries);
+  WorkerQueryStats offender;
+  auto action = getQueryOffender(queries, offender, shed);
+  if (action == WorkerQueryAction::NONE) {
+    return;
+  }
+
+  LOG(WARNING) << "osqueryd worker (" << Watcher::getWorker().pid()
+               << ") stopping scheduled query " << offender.name << ": "
+               << ((action == WorkerQueryAction::BLACKLIST)
+                       ? "memory limits approached"
+                       : (shed) ? "memory pressure"
+                                : "utilization limits approached");
+  stats->stop(offender, action);
+}
+
+/// Get the complete path of the osquery process binary, to execute workers.
+static bool getWorkerExecPath(std::string& path) {
+  auto qd =
+      SQL::selectAllFrom("processes",
+                         "pid",
+                         EQUALS,
+                         INTEGER(PlatformProcess::getCurrentProcess()->pid()));
+  if (qd.size() != 1 || qd[0].count("path") == 0 || qd[0]["path"].size() == 0) {
+    LOG(ERROR) << "osquery watcher cannot determine process path for worker";
+    return false;
+  }
+
+  boost::system::error_code ec;
+  auto exec_path = fs::system_complete(fs::path(qd[0]["path"]), ec);
+  if (!safePermissions(
+          exec_path.parent_path().string(), exec_path.string(), true)) {
+    // osqueryd binary has become unsafe.
+    LOG(ERROR) << RLOG(1382)
+               << "osqueryd has unsafe permissions: " << exec_path.string();
+    return false;
+  }
+  path = exec_path.string();
+  return true;
+}
+
+/// The block shared with workers, created before launching the first worker.
+static std::shared_ptr<WorkerStats> getWorkerStats() {
+  auto stats = WorkerStats::get();
+  if (stats == nullptr &&
+      (FLAGS_watchdog_query_threshold > 0 || FLAGS_worker_profile ||
+       FLAGS_watchdog_standby)) {
+    auto status = WorkerStats::create(stats);
+    if (status.ok()) {
+      WorkerStats::set(stats);
+    } else {
+      VLOG(1) << status.getMessage();
+    }
+  }
+  return stats;
+}
+
 void WatcherRunner::createWorker() {
+  // The monitoring gap begins when a previous worker is lost.
+  auto stats = getWorkerStats();
+  if (stats != nullptr && Watcher::getWorker().isValid()) {
+    stats->setWorkerLost();
+  }
+
   {
     WatcherLocker locker;
     if (Watcher::getState(Watcher::getWorker()).last_respawn_time >
@@ -422,15 +591,8 @@ void WatcherRunner::createWorker() {
     }
   }
 
-  // Get the path of the current process.
-  auto qd =
-      SQL::selectAllFrom("processes",
-                         "pid",
-                         EQUALS,
-                         INTEGER(PlatformProcess::getCurrentProcess()->pid()));
-  if (qd.size() != 1 || qd[0].count("path") == 0 || qd[0]["path"].size() == 0) {
-    LOG(ERROR) << "osquery watcher cannot determine process path for worker";
-    Initializer::requestShutdown(EXIT_FAILURE);
+  // A standby worker has already started, it only opens the database.
+  if (promoteStandby()) {
     return;
   }
 
@@ -440,19 +602,20 @@ void WatcherRunner::createWorker() {
     setEnvVar("OSQUERY_EXTENSIONS", "true");
   }
 
-  // Get the complete path of the osquery process binary.
-  boost::system::error_code ec;
-  auto exec_path = fs::system_complete(fs::path(qd[0]["path"]), ec);
-  if (!safePermissions(
-          exec_path.parent_path().string(), exec_path.string(), true)) {
-    // osqueryd binary has become unsafe.
-    LOG(ERROR) << RLOG(1382)
-               << "osqueryd has unsafe permissions: " << exec_path.string();
+  std::string exec_path;
+  if (!getWorkerExecPath(exec_path)) {
     Initializer::requestShutdown(EXIT_FAILURE);
     return;
   }
 
-  auto worker = PlatformProcess::launchWorker(exec_path.string(), argc_, argv_);
+  // The worker records executing queries in a block named by its environment.
+  if (stats != nullptr) {
+    stats->reset();
+    stats->setRestarts(Watcher::workerRestartCount());
+    setEnvVar(kWorkerStatsEnv, stats->name());
+  }
+
+  auto worker = PlatformProcess::launchWorker(exec_path, argc_, argv_);
   if (worker == nullptr) {
     // Unrecoverable error, cannot create a worker process.
     LOG(ERROR) << "osqueryd could not create a worker process";
@@ -460,12 +623,88 @@ void WatcherRunner::createWorker() {
     return;
   }
 
+  if (!FLAGS_watchdog_cgroup.empty()) {
+    auto status = setWatchdogCgroup("worker", *worker);
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot set worker cgroup: " << status.getMessage();
+    }
+  }
+
   Watcher::setWorker(worker);
   Watcher::resetWorkerCounters(getUnixTime());
   VLOG(1) << "osqueryd watcher (" << PlatformProcess::getCurrentProcess()->pid()
           << ") executing worker (" << worker->pid() << ")";
 }
 
+void WatcherRunner::createStandby() {
+  int process_status = 0;
+  const auto& current = Watcher::getStandby();
+  if (current.isValid()) {
+    if (current.checkStatus(process_status) == PROCESS_STILL_ALIVE) {
+      return;
+    }
+    // The standby worker exited before it was promoted, replace it.
+    LOG(WARNING) << "osqueryd standby worker (" << current.pid()
+                 << ") exited: " << process_status;
+    Watcher::setStandby(std::make_shared<PlatformProcess>());
+  }
+
+  // A standby only waits for promotion written to the shared block.
+  auto stats = getWorkerStats();
+  std::string exec_path;
+  if (stats == nullptr || !getWorkerExecPath(exec_path)) {
+    return;
+  }
+
+  if (Watcher::hasManagedExtensions()) {
+    setEnvVar("OSQUERY_EXTENSIONS", "true");
+  }
+  setEnvVar(kWorkerStatsEnv, stats->name());
+  setEnvVar(kWorkerStandbyEnv, "true");
+  auto standby = PlatformProcess::launchWorker(exec_path, argc_, argv_);
+  unsetEnvVar(kWorkerStandbyEnv);
+  if (standby == nullptr) {
+    LOG(WARNING) << "osqueryd could not create a standby worker process";
+    return;
+  }
+
+  if (!FLAGS_watchdog_cgroup.empty()) {
+    auto status = setWatchdogCgroup("worker", *standby);
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot set standby cgroup: " << status.getMessage();
+    }
+  }
+
+  Watcher::setStandby(standby);
+  VLOG(1) << "osqueryd watcher (" << PlatformProcess::getCurrentProcess()->pid()
+          << ") executing standby worker (" << standby->pid() << ")";
+}
+
+bool WatcherRunner::promoteStandby() {
+  auto stats = WorkerStats::get();
+  auto standby = Watcher::instance().standby_;
+  if (stats == nullptr || !standby->isValid()) {
+    return false;
+  }
+
+  Watcher::setStandby(std::make_shared<PlatformProcess>());
+  int process_status = 0;
+  if (standby->checkStatus(process_status) != PROCESS_STILL_ALIVE) {
+    return false;
+  }
+
+  // The lost worker's queries are released before the standby continues.
+  stats->reset();
+  stats->setRestarts(Watcher::workerRestartCount());
+  stats->promote(standby->pid());
+
+  Watcher::setWorker(standby);
+  Watcher::resetWorkerCounters(getUnixTime());
+  VLOG(1) << "osqueryd watcher (" << PlatformProcess::getCurrentProcess()->pid()
+          << ") promoted standby worker (" << standby->pid() << ")";
+  return true;
+}
+
 void WatcherRunner::createExtension(const std::string& extension) {
   {
     WatcherLocker locker;
@@ -487,6 +726,11 @@ void WatcherRunner::createExtension(const std::string& extension) {
     return;
   }
 
+  // The extension's sockets must use the same protocol as the manager.
+  if (Flag::getValue("extensions_compact") == "true") {
+    setEnvVar("OSQUERY_EXTENSIONS_COMPACT", "true");
+  }
+
   auto ext_process =
       PlatformProcess::launchExtension(exec_path.string(),
                                        extension,
@@ -500,6 +744,14 @@ void WatcherRunner::createExtension(const std::string& extension) {
     Initializer::shutdown(EXIT_FAILURE);
   }
 
+  if (!FLAGS_watchdog_cgroup.empty()) {
+    auto name = "extension." + fs::path(extension).filename().string();
+    auto status = setWatchdogCgroup(name, *ext_process);
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot set extension cgroup: " << status.getMessage();
+    }
+  }
+
   Watcher::setExtension(extension, ext_process);
   Watcher::resetExtensionCounters(extension, getUnixTime());
   VLOG(1) << "Created and monitoring extension child (" << ext_process->pid()
@@ -522,6 +774,163 @@ void WatcherWatcherRunner::start() {
   }
 }
 
+WorkerQueryAction getQueryOffender(const std::vector<WorkerQueryStats>& queries,
+                                   WorkerQueryStats& offender,
+                                   bool shed) {
+  auto threshold = FLAGS_watchdog_query_threshold;
+  if (threshold == 0) {
+    return WorkerQueryAction::NONE;
+  }
+
+  // A query is stopped once it reaches a share of a whole-worker limit.
+  uint64_t memory =
+      getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024;
+  memory = memory / 100 * threshold;
+  uint64_t latency =
+      getWorkerLimit(WatchdogLimitType::LATENCY_LIMIT) * 1000 * 1000;
+  latency = latency / 100 * threshold;
+  auto utilization = getWorkerLimit(WatchdogLimitType::UTILIZATION_LIMIT);
+
+  // Memory growth is blacklisted, it would otherwise restart the worker.
+  auto action = WorkerQueryAction::NONE;
+  for (const auto& query : queries) {
+    if (query.memory > memory &&
+        (action != WorkerQueryAction::BLACKLIST ||
+         query.memory > offender.memory)) {
+      offender = query;
+      action = WorkerQueryAction::BLACKLIST;
+    }
+  }
+  if (action != WorkerQueryAction::NONE) {
+    return action;
+  }
+
+  // Under memory pressure throttle the query with the most memory growth.
+  if (shed) {
+    for (const auto& query : queries) {
+      if (query.memory > 0 && (action == WorkerQueryAction::NONE ||
+                               query.memory > offender.memory)) {
+        offender = query;
+        action = WorkerQueryAction::THROTTLE;
+      }
+    }
+    if (action != WorkerQueryAction::NONE) {
+      return action;
+    }
+  }
+
+  // Otherwise throttle the query with the most sustained CPU utilization.
+  // The utilization limit is a percent of one thread.
+  for (const auto& query : queries) {
+    if (query.elapsed == 0 || query.elapsed < latency) {
+      continue;
+    }
+    if (query.cpu_time * 100 / query.elapsed > utilization &&
+        (action == WorkerQueryAction::NONE ||
+         query.cpu_time > offender.cpu_time)) {
+      offender = query;
+      action = WorkerQueryAction::THROTTLE;
+    }
+  }
+  return action;
+}
+
+#ifdef __linux__
+/// Write a cgroup control file, these do not accept partial writes.
+static Status writeCgroupFile(const fs::path& path, const std::string& value) {
+  // Cgroup control files exist once their group is created.
+  int fd = ::open(path.string().c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(1, "Cannot open " + path.string());
+  }
+
+  auto bytes = ::write(fd, value.c_str(), value.size());
+  ::close(fd);
+  if (bytes < 0 || static_cast<size_t>(bytes) != value.size()) {
+    return Status(1, "Cannot write " + value + " to " + path.string());
+  }
+  return Status(0, "OK");
+}
+#endif
+
+Status setWatchdogCgroup(const std::string& name,
+                         const PlatformProcess& child) {
+#ifndef __linux__
+  return Status(1, "Cgroups are not supported");
+#else
+  if (FLAGS_watchdog_cgroup.empty()) {
+    return Status(1, "No watchdog cgroup is configured");
+  }
+
+  // Child cgroups are only limited if the parent delegates the controllers.
+  fs::path root(FLAGS_watchdog_cgroup);
+  writeCgroupFile(root / "cgroup.subtree_control", "+memory +cpu");
+
+  auto path = root / name;
+  boost::system::error_code ec;
+  fs::create_directories(path, ec);
+  if (ec) {
+    return Status(1, "Cannot create " + path.string());
+  }
+
+  if (FLAGS_watchdog_level >= 0) {
+    // The kernel reclaims above the limit, which raises memory pressure, and
+    // only kills if the watchdog did not stop a query or the process.
+    uint64_t memory =
+        getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024;
+    auto status = writeCgroupFile(path / "memory.high", std::to_string(memory));
+    if (status.ok()) {
+      status = writeCgroupFile(path / "memory.max", std::to_string(memory * 2));
+    }
+
+    // The utilization limit is a percent of one thread.
+    auto quota = getWorkerLimit(WatchdogLimitType::UTILIZATION_LIMIT) *
+                 kCgroupCpuPeriod / 100;
+    if (status.ok()) {
+      status = writeCgroupFile(path / "cpu.max",
+                               std::to_string(quota) + " " +
+                                   std::to_string(kCgroupCpuPeriod));
+    }
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  return writeCgroupFile(path / "cgroup.procs", std::to_string(child.pid()));
+#endif
+}
+
+Status getWatchdogCgroupPressure(const std::string& name, double& pressure) {
+#ifndef __linux__
+  return Status(1, "Cgroups are not supported");
+#else
+  if (FLAGS_watchdog_cgroup.empty()) {
+    return Status(1, "No watchdog cgroup is configured");
+  }
+
+  auto path = fs::path(FLAGS_watchdog_cgroup) / name / "memory.pressure";
+  int fd = ::open(path.string().c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(1, "Cannot open " + path.string());
+  }
+
+  char buffer[256] = {0};
+  auto bytes = ::read(fd, buffer, sizeof(buffer) - 1);
+  ::close(fd);
+  if (bytes <= 0) {
+    return Status(1, "Cannot read " + path.string());
+  }
+
+  // The 'some' line is the share of time any task stalled on memory.
+  auto average = strstr(buffer, "some avg10=");
+  if (average == nullptr) {
+    return Status(1, "Cannot parse " + path.string());
+  }
+  pressure = strtod(average + strlen("some avg10="), nullptr);
+  return Status(0, "OK");
+#endif
+}
+
 size_t getWorkerLimit(WatchdogLimitType name) {
   if (kWatchdogLimits.count(name) == 0) {
     return 0;
@@ -24,6 +24,7 @@
 #include <osquery/flags.h>
 
 #include "osquery/core/process.h"
+#include "osquery/core/worker_stats.h"
 
 namespace osquery {
 
@@ -31,6 +32,7 @@ using ExtensionMap = std::map<std::string, std::shared_ptr<PlatformProcess>>;
 
 DECLARE_bool(disable_watchdog);
 DECLARE_int32(watchdog_level);
+DECLARE_bool(watchdog_standby);
 
 class WatcherRunner;
 
@@ -146,6 +148,16 @@ class Watcher : private boost::noncopyable {
     instance().worker_ = child;
   }
 
+  /// Accessor for the standby worker process.
+  static PlatformProcess& getStandby() {
+    return *instance().standby_;
+  }
+
+  /// Setter for the standby worker process.
+  static void setStandby(const std::shared_ptr<PlatformProcess>& child) {
+    instance().standby_ = child;
+  }
+
   /// Setter for an extension process.
   static void setExtension(const std::string& extension,
                            const std::shared_ptr<PlatformProcess>& child);
@@ -186,6 +198,7 @@ class Watcher : private boost::noncopyable {
   /// Do not request the lock until extensions are used.
   Watcher()
       : worker_(std::make_shared<PlatformProcess>()),
+        standby_(std::make_shared<PlatformProcess>()),
         worker_restarts_(0),
         lock_(mutex_, std::defer_lock) {}
   Watcher(Watcher const&);
@@ -210,6 +223,9 @@ class Watcher : private boost::noncopyable {
   /// Keep the single worker process/thread ID for inspection.
   std::shared_ptr<PlatformProcess> worker_;
 
+  /// An optional initialized worker waiting to replace the worker.
+  std::shared_ptr<PlatformProcess> standby_;
+
   /// Number of worker restarts NOT induced by a watchdog process.
   size_t worker_restarts_{0};
 
@@ -297,10 +313,27 @@ class WatcherRunner : public InternalRunnable {
   /// Get row data from the processes table for a given pid.
   virtual QueryData getProcessRow(pid_t pid) const;
 
+  /**
+   * @brief Record a worker sample and stop a query approaching the limits.
+   *
+   * @param utilization The worker's CPU utilization as a percent.
+   * @param footprint The worker's memory allocated since it started.
+   * @param shed The worker's cgroup reported memory pressure.
+   */
+  void stopQueryOffender(size_t utilization,
+                         size_t footprint,
+                         bool shed) const;
+
  private:
-  /// Fork and execute a worker process.
+  /// Fork and execute a worker process, or promote the standby worker.
   virtual void createWorker();
 
+  /// Fork and execute a standby worker, if there is none.
+  virtual void createStandby();
+
+  /// Replace a lost worker with the standby worker, if it is alive.
+  bool promoteStandby();
+
   /// Fork an extension process.
   virtual void createExtension(const std::string& extension);
 
@@ -354,4 +387,37 @@ class WatcherWatcherRunner : public InternalRunnable {
 
 /// Get a performance limit by name and optional level.
 size_t getWorkerLimit(WatchdogLimitType limit);
+
+/**
+ * @brief Find an executing query using a share of the worker limits.
+ *
+ * The share is set by `--watchdog_query_threshold`. A query whose memory
+ * growth exceeds its share of the memory limit is blacklisted. A query that
+ * sustained the utilization limit for its share of the latency limit is
+ * throttled.
+ *
+ * @param queries The queries executing in the worker.
+ * @param offender The output query to stop.
+ * @param shed Throttle the query with the most memory growth, if no query
+ * exceeded its share, because the worker is under memory pressure.
+ * @return The action to take, NONE if no query should be stopped.
+ */
+WorkerQueryAction getQueryOffender(const std::vector<WorkerQueryStats>& queries,
+                                   WorkerQueryStats& offender,
+                                   bool shed = false);
+
+/**
+ * @brief Place a watched process in a cgroup v2 with the watchdog limits.
+ *
+ * The cgroup is created as a child of `--watchdog_cgroup`. Its `memory.high`
+ * is the memory limit, `memory.max` is twice the limit, and `cpu.max` is the
+ * utilization limit. No limits are written if the watchdog level is off.
+ *
+ * @param name The child cgroup name, such as "worker".
+ * @param child The process to move into the cgroup.
+ */
+Status setWatchdogCgroup(const std::string& name, const PlatformProcess& child);
+
+/// Read the 10 second average memory pressure percent of a watchdog cgroup.
+Status getWatchdogCgroupPressure(const std::string& name, double& pressure);
 }
@@ -13,6 +13,11 @@
 
 #include <signal.h>
 
+// clang-format off
+#include <psapi.h>
+#include <tlhelp32.h>
+// clang-format on
+
 #include <boost/algorithm/string.hpp>
 
 #include "osquery/core/process.h"
@@ -104,6 +109,52 @@ ProcessState PlatformProcess::checkStatus(int& status) const {
   return PROCESS_EXITED;
 }
 
+static inline uint64_t toMicroseconds(const FILETIME& time) {
+  ULARGE_INTEGER value;
+  value.LowPart = time.dwLowDateTime;
+  value.HighPart = time.dwHighDateTime;
+  // FILETIME durations are 100-nanosecond intervals.
+  return static_cast<uint64_t>(value.QuadPart / 10);
+}
+
+bool PlatformProcess::getUsage(ProcessUsage& usage) const {
+  if (!isValid()) {
+    return false;
+  }
+
+  FILETIME creation, exit, kernel, user;
+  if (!::GetProcessTimes(id_, &creation, &exit, &kernel, &user)) {
+    return false;
+  }
+  usage.user_time = toMicroseconds(user);
+  usage.system_time = toMicroseconds(kernel);
+
+  PROCESS_MEMORY_COUNTERS counters;
+  if (::GetProcessMemoryInfo(id_, &counters, sizeof(counters))) {
+    usage.resident_size = static_cast<uint64_t>(counters.WorkingSetSize);
+  }
+
+  // The parent is only available from a process snapshot.
+  auto snapshot = ::CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+  if (snapshot == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  auto pid = ::GetProcessId(id_);
+  PROCESSENTRY32 entry;
+  entry.dwSize = sizeof(entry);
+  auto found = ::Process32First(snapshot, &entry);
+  while (found) {
+    if (entry.th32ProcessID == pid) {
+      usage.parent = static_cast<pid_t>(entry.th32ParentProcessID);
+      break;
+    }
+    found = ::Process32Next(snapshot, &entry);
+  }
+  ::CloseHandle(snapshot);
+  return (found == TRUE);
+}
+
 std::shared_ptr<PlatformProcess> PlatformProcess::getCurrentProcess() {
   auto handle =
       ::OpenProcess(PROCESS_ALL_ACCESS, FALSE, ::GetCurrentProcessId());
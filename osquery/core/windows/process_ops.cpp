@@ -13,6 +13,7 @@
 #include <Windows.h>
 // clang-format off
 #include <LM.h>
+#include <psapi.h>
 // clang-format on
 
 #include <vector>
@@ -200,7 +201,26 @@ bool platformModuleClose(ModuleHandle module) {
   return (::FreeLibrary(static_cast<HMODULE>(module)) != 0);
 }
 
-void setToBackgroundPriority() {}
+void setToBackgroundPriority() {
+  SetPriorityClass(GetCurrentProcess(), BELOW_NORMAL_PRIORITY_CLASS);
+}
+
+void setThreadToBackgroundPriority() {
+  // Background mode also lowers the thread's I/O and memory priority.
+  SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+}
+
+BackgroundPriorityScope::BackgroundPriorityScope() {
+  // A thread already in background mode is not changed.
+  lowered_ = (SetThreadPriority(GetCurrentThread(),
+                                THREAD_MODE_BACKGROUND_BEGIN) != 0);
+}
+
+BackgroundPriorityScope::~BackgroundPriorityScope() {
+  if (lowered_) {
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+  }
+}
 
 // Helper function to determine if thread is running with admin privilege.
 bool isUserAdmin() {
@@ -229,4 +249,36 @@ int platformGetPid() {
 int platformGetTid() {
   return static_cast<int>(GetCurrentThreadId());
 }
+
+/// Convert a FILETIME duration, in 100 nanosecond units, to microseconds.
+static inline uint64_t toMicroseconds(const FILETIME& ft) {
+  ULARGE_INTEGER value;
+  value.LowPart = ft.dwLowDateTime;
+  value.HighPart = ft.dwHighDateTime;
+  return value.QuadPart / 10;
+}
+
+bool getResourceUsage(ResourceUsage& usage) {
+  LARGE_INTEGER counter;
+  LARGE_INTEGER frequency;
+  if (QueryPerformanceCounter(&counter) &&
+      QueryPerformanceFrequency(&frequency) && frequency.QuadPart > 0) {
+    usage.wall_time = static_cast<uint64_t>(
+        counter.QuadPart / frequency.QuadPart * 1000000 +
+        counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+  }
+
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    usage.resident_size = static_cast<uint64_t>(counters.WorkingSetSize);
+  }
+
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+    return false;
+  }
+  usage.user_time = toMicroseconds(user);
+  usage.system_time = toMicroseconds(kernel);
+  return true;
+}
 }
\ No newline at end of file
@@ -9,12 +9,42 @@
  */
 
 #include <locale>
+#include <map>
+#include <set>
 #include <string>
 
+#include <osquery/core.h>
+#include <osquery/system.h>
+
+#include "osquery/core/conversions.h"
 #include "osquery/core/windows/wmi.h"
 
 namespace osquery {
 
+/// Number of results read from a WMI enumerator with each Next.
+const ULONG kWmiBatchSize = 64;
+
+/// Results of a WMI query, shared by requests within its TTL.
+struct WmiCacheEntry {
+  size_t time{0};
+  size_t ttl{0};
+  std::vector<WmiResultItem> results;
+};
+
+/// Protects the WMI results cache.
+static Mutex kWmiCacheMutex;
+
+/**
+* @brief The WMI results cache, keyed by namespace and query.
+*
+* The cache is never destroyed, cached objects must not be released after
+* COM has been uninitialized at exit.
+*/
+static std::map<std::wstring, WmiCacheEntry>& getWmiCache() {
+  static auto cache = new std::map<std::wstring, WmiCacheEntry>();
+  return *cache;
+}
+
 std::wstring stringToWstring(const std::string& src) {
   std::wstring utf16le_str = converter.from_bytes(src);
   return utf16le_str;
@@ -38,6 +68,13 @@ WmiResultItem::WmiResultItem(WmiResultItem&& src) {
   std::swap(result_, src.result_);
 }
 
+WmiResultItem::WmiResultItem(const WmiResultItem& src) {
+  result_ = src.result_;
+  if (result_ != nullptr) {
+    result_->AddRef();
+  }
+}
+
 WmiResultItem::~WmiResultItem() {
   if (result_ != nullptr) {
     result_->Release();
@@ -246,8 +283,23 @@ Status WmiResultItem::GetVectorOfStrings(const std::string& name,
   return Status(0);
 }
 
-WmiRequest::WmiRequest(const std::string& query, BSTR nspace) {
+WmiRequest::WmiRequest(const std::string& query,
+                       BSTR nspace,
+                       size_t cache_ttl) {
   std::wstring wql = stringToWstring(query);
+  std::wstring key = std::wstring(nspace) + L":" + wql;
+
+  if (cache_ttl > 0) {
+    WriteLock lock(kWmiCacheMutex);
+    auto& cache = getWmiCache();
+    auto entry = cache.find(key);
+    if (entry != cache.end() &&
+        getUnixTime() < entry->second.time + cache_ttl) {
+      results_ = entry->second.results;
+      status_ = Status(0);
+      return;
+    }
+  }
 
   HRESULT hr = E_FAIL;
 
@@ -267,6 +319,7 @@ WmiRequest::WmiRequest(const std::string& query, BSTR nspace) {
                           (LPVOID*)&locator_);
   if (hr != S_OK) {
     locator_ = nullptr;
+    status_ = Status(1, "Cannot create the WMI locator");
     return;
   }
 
@@ -274,28 +327,81 @@ WmiRequest::WmiRequest(const std::string& query, BSTR nspace) {
       nspace, nullptr, nullptr, nullptr, 0, nullptr, nullptr, &services_);
   if (hr != S_OK) {
     services_ = nullptr;
+    status_ = Status(1, "Cannot connect to the WMI namespace");
     return;
   }
 
-  hr = services_->ExecQuery(
-      (BSTR)L"WQL", (BSTR)wql.c_str(), WBEM_FLAG_FORWARD_ONLY, nullptr, &enum_);
+  // Return the enumerator immediately, results are read while WMI produces
+  // them instead of waiting for the complete result set.
+  hr = services_->ExecQuery((BSTR)L"WQL",
+                            (BSTR)wql.c_str(),
+                            WBEM_FLAG_FORWARD_ONLY |
+                                WBEM_FLAG_RETURN_IMMEDIATELY,
+                            nullptr,
+                            &enum_);
   if (hr != S_OK) {
     enum_ = nullptr;
+    status_ = Status(1, "Cannot execute the WMI query");
     return;
   }
 
+  // The last, partial, batch is returned with WBEM_S_FALSE.
+  IWbemClassObject* batch[kWmiBatchSize];
   hr = WBEM_S_NO_ERROR;
   while (hr == WBEM_S_NO_ERROR) {
-    IWbemClassObject* result = nullptr;
     ULONG result_count = 0;
-
-    hr = enum_->Next(WBEM_INFINITE, 1, &result, &result_count);
-    if (SUCCEEDED(hr) && result_count > 0) {
-      results_.push_back(WmiResultItem(result));
+    hr = enum_->Next(WBEM_INFINITE, kWmiBatchSize, batch, &result_count);
+    if (SUCCEEDED(hr)) {
+      for (ULONG i = 0; i < result_count; i++) {
+        results_.push_back(WmiResultItem(batch[i]));
+      }
     }
   }
 
   status_ = Status(0);
+  if (cache_ttl > 0) {
+    WriteLock lock(kWmiCacheMutex);
+    auto& cache = getWmiCache();
+    auto now = getUnixTime();
+    for (auto it = cache.begin(); it != cache.end();) {
+      if (now >= it->second.time + it->second.ttl) {
+        it = cache.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    auto& entry = cache[key];
+    entry.time = now;
+    entry.ttl = cache_ttl;
+    entry.results = results_;
+  }
+}
+
+std::string WmiRequest::selectUsed(
+    const QueryContext& context,
+    const std::string& wmi_class,
+    const std::vector<std::pair<std::string, std::string>>& properties) {
+  if (!context.colsUsed || properties.empty()) {
+    return "SELECT * FROM " + wmi_class;
+  }
+
+  std::set<std::string> selected;
+  for (const auto& property : properties) {
+    if (context.isColumnUsed(property.first)) {
+      selected.insert(property.second);
+    }
+  }
+
+  // Each row needs at least one property, for example to count rows.
+  if (selected.empty()) {
+    selected.insert(properties.front().second);
+  }
+
+  return "SELECT " +
+         join(std::vector<std::string>(selected.begin(), selected.end()),
+              ", ") +
+         " FROM " + wmi_class;
 }
 
 WmiRequest::WmiRequest(WmiRequest&& src) {
@@ -13,6 +13,7 @@
 #include <codecvt>
 #include <iostream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #ifndef NOMINMAX
@@ -70,6 +71,9 @@ class WmiResultItem {
   explicit WmiResultItem(IWbemClassObject* result) : result_(result){};
   WmiResultItem(WmiResultItem&& src);
 
+  /// Copies share the WMI object, used to copy cached results.
+  WmiResultItem(const WmiResultItem& src);
+
   /**
   * @brief Destructor for our WMI Wrapper
   *
@@ -177,14 +181,46 @@ class WmiResultItem {
 *
 * This class abstracts away the WMI querying logic and
 * will return WMI results given a query string.
+*
+* Queries are executed semi-synchronously: WMI returns an enumerator
+* immediately and the results are read in batches while WMI produces them.
+* Queries of slow and rarely changing classes may name a cache TTL, their
+* results are then shared by requests for the same query within the TTL.
 */
 class WmiRequest {
  public:
+  /**
+  * @brief Execute a WQL query.
+  *
+  * @param query The WQL query.
+  * @param nspace The WMI namespace.
+  * @param cache_ttl Seconds to reuse the results of the same query, 0 to
+  * execute the query every time.
+  */
   explicit WmiRequest(const std::string& query,
-                      BSTR nspace = (BSTR)L"ROOT\\CIMV2");
+                      BSTR nspace = (BSTR)L"ROOT\\CIMV2",
+                      size_t cache_ttl = 0);
   WmiRequest(WmiRequest&& src);
   ~WmiRequest();
 
+  /**
+  * @brief Build a WQL query selecting only the properties a query uses.
+  *
+  * WMI providers skip computing properties that are not selected, which for
+  * some classes is most of the cost of the query.
+  *
+  * @param context The table's query context.
+  * @param wmi_class The WMI class to select from.
+  * @param properties Pairs of a table column and the WMI property read for
+  * that column, a property may be listed for several columns.
+  * @return A "SELECT ... FROM wmi_class" query, selecting * if the used
+  * columns are unknown.
+  */
+  static std::string selectUsed(
+      const QueryContext& context,
+      const std::string& wmi_class,
+      const std::vector<std::pair<std::string, std::string>>& properties);
+
   std::vector<WmiResultItem>& results() {
     return results_;
   }
@@ -0,0 +1,484 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <osquery/logger.h>
+
+#include "osquery/core/process.h"
+#include "osquery/core/worker_stats.h"
+
+namespace osquery {
+
+const std::string kWorkerStatsEnv{"OSQUERY_WORKER_STATS"};
+
+const std::string kWorkerStandbyEnv{"OSQUERY_WORKER_STANDBY"};
+
+const size_t kWorkerStatsSamples = 20;
+
+/// Block names are limited to this prefix, a worker maps no others.
+const std::string kWorkerStatsPrefix{"/osquery.worker."};
+
+/// Identifies a worker stats block.
+const uint32_t kWorkerStatsMagic = 0x5751534f;
+
+/// The number of queries the worker may record at once.
+const size_t kWorkerStatsSlots = 16;
+
+/// Query names longer than this are truncated.
+const size_t kWorkerStatsNameSize = 128;
+
+/// Microseconds between samples of an executing query.
+const uint64_t kWorkerStatsSampleInterval = 250 * 1000;
+
+/// Slot states, a slot is claimed by a worker thread as a query starts.
+enum WorkerSlotState : uint32_t {
+  WORKER_SLOT_FREE = 0,
+  WORKER_SLOT_ACTIVE = 1,
+};
+
+/// The resource usage of one executing query, written by the worker.
+struct WorkerStatsSlot {
+  /// Odd while the worker writes the slot.
+  std::atomic<uint32_t> sequence;
+  std::atomic<uint32_t> state;
+
+  /// Written by the watcher to stop the query.
+  std::atomic<uint32_t> action;
+  std::atomic<bool> stopped;
+
+  /// Monotonic microseconds the query started and was last sampled.
+  std::atomic<uint64_t> started;
+  std::atomic<uint64_t> sampled;
+
+  /// Thread CPU microseconds when the query started and was last sampled.
+  std::atomic<uint64_t> cpu_start;
+  std::atomic<uint64_t> cpu_time;
+
+  /// Worker resident bytes when the query started and was last sampled.
+  std::atomic<uint64_t> resident_start;
+  std::atomic<uint64_t> resident_size;
+
+  char name[kWorkerStatsNameSize];
+};
+
+/// The shared block, zero-filled when created.
+struct WorkerStatsBlock {
+  uint32_t magic;
+  uint32_t slots;
+
+  /// Odd while the watcher writes a sample.
+  std::atomic<uint32_t> sequence;
+
+  /// The number of samples written, the window is the latest samples.
+  std::atomic<uint32_t> count;
+  std::atomic<uint64_t> utilization[kWorkerStatsSamples];
+  std::atomic<uint64_t> footprint[kWorkerStatsSamples];
+
+  /// The number of times the watcher restarted a worker.
+  std::atomic<uint32_t> restarts;
+
+  /// Incremented by the watcher when the worker approaches a limit.
+  std::atomic<uint32_t> profiles;
+
+  /// Monotonic milliseconds when the watcher lost a worker, 0 if recovered.
+  std::atomic<uint64_t> lost;
+
+  /// Milliseconds from losing a worker until its replacement was monitoring.
+  std::atomic<uint64_t> recovery_gap;
+
+  /// The process ID of the standby worker promoted by the watcher.
+  std::atomic<int32_t> promoted;
+
+  WorkerStatsSlot slot[kWorkerStatsSlots];
+};
+
+/// The block created by this watcher or opened by this worker.
+static std::shared_ptr<WorkerStats> kWorkerStats{nullptr};
+
+/// Protect the block reference.
+static Mutex kWorkerStatsMutex;
+
+/// The query scope active on this thread.
+static thread_local WorkerQueryScope* kWorkerQueryScope{nullptr};
+
+/// Monotonic milliseconds, comparable between the watcher and worker.
+static uint64_t getMonotonicMilli() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+WorkerStats::~WorkerStats() {
+#ifndef WIN32
+  if (block_ != nullptr) {
+    ::munmap(block_, sizeof(WorkerStatsBlock));
+  }
+  if (owner_) {
+    ::shm_unlink(name_.c_str());
+  }
+#endif
+}
+
+Status WorkerStats::create(std::shared_ptr<WorkerStats>& stats) {
+#ifdef WIN32
+  return Status(1, "Worker stats are not supported");
+#else
+  std::shared_ptr<WorkerStats> block(new WorkerStats());
+  block->name_ = kWorkerStatsPrefix + std::to_string(::getpid());
+
+  auto fd = ::shm_open(block->name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    return Status(1, "Cannot create worker stats: " + block->name_);
+  }
+  block->owner_ = true;
+
+  if (::ftruncate(fd, static_cast<off_t>(sizeof(WorkerStatsBlock))) != 0) {
+    ::close(fd);
+    return Status(1, "Cannot size worker stats: " + block->name_);
+  }
+
+  auto status = block->map(fd, true);
+  ::close(fd);
+  if (!status.ok()) {
+    return status;
+  }
+  stats = std::move(block);
+  return Status(0, "OK");
+#endif
+}
+
+Status WorkerStats::open(const std::string& name,
+                         std::shared_ptr<WorkerStats>& stats) {
+#ifdef WIN32
+  return Status(1, "Worker stats are not supported");
+#else
+  if (name.compare(0, kWorkerStatsPrefix.size(), kWorkerStatsPrefix) != 0 ||
+      name.find('/', 1) != std::string::npos) {
+    return Status(1, "Invalid worker stats name: " + name);
+  }
+
+  auto fd = ::shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    return Status(1, "Cannot open worker stats: " + name);
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(WorkerStatsBlock)) {
+    ::close(fd);
+    return Status(1, "Worker stats are too small: " + name);
+  }
+
+  std::shared_ptr<WorkerStats> block(new WorkerStats());
+  block->name_ = name;
+  auto status = block->map(fd, false);
+  ::close(fd);
+  if (!status.ok()) {
+    return status;
+  }
+  stats = std::move(block);
+  return Status(0, "OK");
+#endif
+}
+
+Status WorkerStats::map(int fd, bool create) {
+#ifdef WIN32
+  return Status(1, "Worker stats are not supported");
+#else
+  auto base = ::mmap(nullptr,
+                     sizeof(WorkerStatsBlock),
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED,
+                     fd,
+                     0);
+  if (base == MAP_FAILED) {
+    return Status(1, "Cannot map worker stats: " + name_);
+  }
+  block_ = static_cast<WorkerStatsBlock*>(base);
+
+  // The truncated segment is zero-filled, every slot starts free.
+  if (create) {
+    block_->magic = kWorkerStatsMagic;
+    block_->slots = kWorkerStatsSlots;
+  }
+
+  if (block_->magic != kWorkerStatsMagic ||
+      block_->slots != kWorkerStatsSlots) {
+    return Status(1, "Invalid worker stats header: " + name_);
+  }
+  return Status(0, "OK");
+#endif
+}
+
+std::shared_ptr<WorkerStats> WorkerStats::get() {
+  ReadLock lock(kWorkerStatsMutex);
+  return kWorkerStats;
+}
+
+void WorkerStats::set(std::shared_ptr<WorkerStats> stats) {
+  WriteLock lock(kWorkerStatsMutex);
+  kWorkerStats = std::move(stats);
+}
+
+int WorkerStats::begin(const std::string& query) {
+  ResourceUsage usage;
+  getResourceUsage(usage);
+
+  for (size_t i = 0; i < kWorkerStatsSlots; i++) {
+    auto& slot = block_->slot[i];
+    uint32_t expected = WORKER_SLOT_FREE;
+    if (!slot.state.compare_exchange_strong(expected, WORKER_SLOT_ACTIVE)) {
+      continue;
+    }
+
+    slot.sequence.fetch_add(1, std::memory_order_acq_rel);
+    slot.action = static_cast<uint32_t>(WorkerQueryAction::NONE);
+    slot.stopped = false;
+    slot.started = usage.wall_time;
+    slot.sampled = usage.wall_time;
+    slot.cpu_start = usage.user_time + usage.system_time;
+    slot.cpu_time = usage.user_time + usage.system_time;
+    slot.resident_start = usage.resident_size;
+    slot.resident_size = usage.resident_size;
+    auto size = std::min(query.size(), kWorkerStatsNameSize - 1);
+    memcpy(slot.name, query.data(), size);
+    slot.name[size] = 0;
+    slot.sequence.fetch_add(1, std::memory_order_release);
+    return static_cast<int>(i);
+  }
+  return -1;
+}
+
+void WorkerStats::sample(int slot) {
+  if (slot < 0 || static_cast<size_t>(slot) >= kWorkerStatsSlots) {
+    return;
+  }
+
+  ResourceUsage usage;
+  if (!getResourceUsage(usage)) {
+    return;
+  }
+
+  auto& entry = block_->slot[slot];
+  entry.sequence.fetch_add(1, std::memory_order_acq_rel);
+  entry.sampled = usage.wall_time;
+  entry.cpu_time = usage.user_time + usage.system_time;
+  entry.resident_size = usage.resident_size;
+  entry.sequence.fetch_add(1, std::memory_order_release);
+}
+
+void WorkerStats::end(int slot) {
+  if (slot < 0 || static_cast<size_t>(slot) >= kWorkerStatsSlots) {
+    return;
+  }
+  block_->slot[slot].state.store(WORKER_SLOT_FREE, std::memory_order_release);
+}
+
+const std::atomic<bool>* WorkerStats::stopped(int slot) const {
+  if (slot < 0 || static_cast<size_t>(slot) >= kWorkerStatsSlots) {
+    return nullptr;
+  }
+  return &block_->slot[slot].stopped;
+}
+
+WorkerQueryAction WorkerStats::action(int slot) const {
+  if (slot < 0 || static_cast<size_t>(slot) >= kWorkerStatsSlots) {
+    return WorkerQueryAction::NONE;
+  }
+  return static_cast<WorkerQueryAction>(block_->slot[slot].action.load());
+}
+
+void WorkerStats::queries(std::vector<WorkerQueryStats>& queries) const {
+  for (size_t i = 0; i < kWorkerStatsSlots; i++) {
+    const auto& slot = block_->slot[i];
+    // Retry a few times if the worker is sampling the slot.
+    for (size_t attempt = 0; attempt < 3; attempt++) {
+      if (slot.state.load(std::memory_order_acquire) != WORKER_SLOT_ACTIVE) {
+        break;
+      }
+
+      auto sequence = slot.sequence.load(std::memory_order_acquire);
+      if (sequence % 2 != 0) {
+        continue;
+      }
+
+      char name[kWorkerStatsNameSize];
+      memcpy(name, slot.name, sizeof(name));
+      name[kWorkerStatsNameSize - 1] = 0;
+
+      WorkerQueryStats query;
+      query.slot = i;
+      query.started = slot.started;
+      auto sampled = slot.sampled.load();
+      auto cpu_start = slot.cpu_start.load();
+      auto cpu_time = slot.cpu_time.load();
+      auto resident_start = slot.resident_start.load();
+      auto resident_size = slot.resident_size.load();
+      if (slot.sequence.load(std::memory_order_acquire) != sequence) {
+        continue;
+      }
+
+      query.name = name;
+      query.elapsed = (sampled > query.started) ? sampled - query.started : 0;
+      query.cpu_time = (cpu_time > cpu_start) ? cpu_time - cpu_start : 0;
+      query.memory = (resident_size > resident_start)
+                         ? resident_size - resident_start
+                         : 0;
+      queries.push_back(std::move(query));
+      break;
+    }
+  }
+}
+
+void WorkerStats::stop(const WorkerQueryStats& query,
+                       WorkerQueryAction action) {
+  if (query.slot >= kWorkerStatsSlots) {
+    return;
+  }
+
+  // The slot may have been released and claimed by a later query.
+  auto& slot = block_->slot[query.slot];
+  if (slot.state.load() != WORKER_SLOT_ACTIVE ||
+      slot.started.load() != query.started) {
+    return;
+  }
+  slot.action = static_cast<uint32_t>(action);
+  slot.stopped.store(true, std::memory_order_release);
+}
+
+void WorkerStats::reset() {
+  for (size_t i = 0; i < kWorkerStatsSlots; i++) {
+    block_->slot[i].state.store(WORKER_SLOT_FREE);
+  }
+}
+
+void WorkerStats::setRestarts(size_t restarts) {
+  block_->restarts.store(static_cast<uint32_t>(restarts));
+}
+
+size_t WorkerStats::restarts() const {
+  return block_->restarts.load();
+}
+
+void WorkerStats::requestProfile() {
+  block_->profiles.fetch_add(1);
+}
+
+size_t WorkerStats::profileRequests() const {
+  return block_->profiles.load();
+}
+
+void WorkerStats::setWorkerLost() {
+  block_->lost.store(getMonotonicMilli());
+}
+
+void WorkerStats::promote(int pid) {
+  block_->promoted.store(static_cast<int32_t>(pid));
+}
+
+bool WorkerStats::promoted(int pid) const {
+  return block_->promoted.load() == static_cast<int32_t>(pid);
+}
+
+void WorkerStats::setRecovered() {
+  auto lost = block_->lost.exchange(0);
+  if (lost > 0) {
+    block_->recovery_gap.store(getMonotonicMilli() - lost);
+  }
+}
+
+uint64_t WorkerStats::recoveryGap() const {
+  return block_->recovery_gap.load();
+}
+
+void WorkerStats::addSample(const WorkerUtilization& sample) {
+  block_->sequence.fetch_add(1, std::memory_order_acq_rel);
+  auto index = block_->count.load() % kWorkerStatsSamples;
+  block_->utilization[index] = sample.utilization;
+  block_->footprint[index] = sample.footprint;
+  block_->count++;
+  block_->sequence.fetch_add(1, std::memory_order_release);
+}
+
+void WorkerStats::samples(std::vector<WorkerUtilization>& samples) const {
+  for (size_t attempt = 0; attempt < 3; attempt++) {
+    auto sequence = block_->sequence.load(std::memory_order_acquire);
+    if (sequence % 2 != 0) {
+      continue;
+    }
+
+    std::vector<WorkerUtilization> window;
+    size_t count = block_->count.load();
+    auto size = std::min(count, kWorkerStatsSamples);
+    for (size_t i = count - size; i < count; i++) {
+      WorkerUtilization sample;
+      sample.utilization = block_->utilization[i % kWorkerStatsSamples];
+      sample.footprint = block_->footprint[i % kWorkerStatsSamples];
+      window.push_back(sample);
+    }
+
+    if (block_->sequence.load(std::memory_order_acquire) == sequence) {
+      samples = std::move(window);
+      return;
+    }
+  }
+}
+
+WorkerQueryScope::WorkerQueryScope(const std::string& name)
+    : stats_(WorkerStats::get()), previous_(kWorkerQueryScope) {
+  if (stats_ != nullptr) {
+    slot_ = stats_->begin(name);
+  }
+  kWorkerQueryScope = this;
+}
+
+WorkerQueryScope::~WorkerQueryScope() {
+  if (slot_ >= 0) {
+    stats_->end(slot_);
+  }
+  kWorkerQueryScope = previous_;
+}
+
+const std::atomic<bool>* WorkerQueryScope::stopped() const {
+  return (slot_ >= 0) ? stats_->stopped(slot_) : nullptr;
+}
+
+WorkerQueryAction WorkerQueryScope::action() const {
+  return (slot_ >= 0) ? stats_->action(slot_) : WorkerQueryAction::NONE;
+}
+
+void WorkerQueryScope::sample() {
+  auto scope = kWorkerQueryScope;
+  if (scope == nullptr || scope->slot_ < 0) {
+    return;
+  }
+
+  auto now = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+  if (now - scope->sampled_ < kWorkerStatsSampleInterval) {
+    return;
+  }
+  scope->sampled_ = now;
+  scope->stats_->sample(scope->slot_);
+}
+}
@@ -0,0 +1,232 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+
+namespace osquery {
+
+/// The worker environment variable naming the watcher's stats block.
+extern const std::string kWorkerStatsEnv;
+
+/// The worker environment variable set for a standby worker.
+extern const std::string kWorkerStandbyEnv;
+
+/// The number of utilization samples kept by the watcher.
+extern const size_t kWorkerStatsSamples;
+
+/// What the watcher asked the worker to do with an executing query.
+enum class WorkerQueryAction : uint32_t {
+  NONE = 0,
+  /// Interrupt the query and skip it for a short time.
+  THROTTLE = 1,
+  /// Interrupt the query and blacklist it.
+  BLACKLIST = 2,
+};
+
+/// The resource usage of a scheduled query executing in the worker.
+struct WorkerQueryStats {
+  /// The block slot used by the query.
+  size_t slot{0};
+
+  /// The scheduled query name.
+  std::string name;
+
+  /// Worker monotonic microseconds when the query started.
+  uint64_t started{0};
+
+  /// Microseconds the query has executed for.
+  uint64_t elapsed{0};
+
+  /// Microseconds of user and system CPU used by the query's thread.
+  uint64_t cpu_time{0};
+
+  /// Bytes the worker's resident memory grew by while the query executed.
+  uint64_t memory{0};
+};
+
+/// A utilization sample of the worker recorded by the watcher.
+struct WorkerUtilization {
+  /// Percent of one CPU used during the watcher's interval.
+  size_t utilization{0};
+
+  /// Bytes of worker memory allocated since it started.
+  size_t footprint{0};
+};
+
+struct WorkerStatsBlock;
+
+/**
+ * @brief Statistics shared between a watcher and its worker process.
+ *
+ * The watcher creates a shared memory block before launching a worker and
+ * names it in the worker's environment. The worker records the resource
+ * usage of each executing scheduled query in a slot of the block. The
+ * watcher reads the slots each interval so it can stop a single offending
+ * query before the whole worker exceeds a limit and is restarted.
+ *
+ * The watcher also writes a window of worker utilization samples to the
+ * block, which the worker reports in the `osquery_info` table. When a worker
+ * is lost the block records how long until its replacement is monitoring,
+ * and promotes an optional standby worker.
+ *
+ * Each slot and the sample window use a sequence counter, a reader retries
+ * if the counter changed or was odd while copying.
+ */
+class WorkerStats : private boost::noncopyable {
+ public:
+  ~WorkerStats();
+
+  /// Create a block in the watcher process.
+  static Status create(std::shared_ptr<WorkerStats>& stats);
+
+  /// Map the block named by a watcher in the worker process.
+  static Status open(const std::string& name,
+                     std::shared_ptr<WorkerStats>& stats);
+
+  /// The block used by this watcher or worker, if any.
+  static std::shared_ptr<WorkerStats> get();
+
+  /// Set the block used by this watcher or worker.
+  static void set(std::shared_ptr<WorkerStats> stats);
+
+  const std::string& name() const {
+    return name_;
+  }
+
+ public:
+  /**
+   * @brief Claim a slot for a query starting on the calling thread.
+   *
+   * @param query The scheduled query name.
+   * @return The slot, or -1 if every slot is in use.
+   */
+  int begin(const std::string& query);
+
+  /// Record the current resource usage of the query using a slot.
+  void sample(int slot);
+
+  /// Release a slot after its query finished.
+  void end(int slot);
+
+  /// A flag set when the watcher asks the worker to stop the query.
+  const std::atomic<bool>* stopped(int slot) const;
+
+  /// The reason the watcher stopped the query using a slot.
+  WorkerQueryAction action(int slot) const;
+
+ public:
+  /// Copy the resource usage of every executing query.
+  void queries(std::vector<WorkerQueryStats>& queries) const;
+
+  /// Ask the worker to stop a query, if it is still executing.
+  void stop(const WorkerQueryStats& query, WorkerQueryAction action);
+
+  /// Release every slot, the watcher calls this before launching a worker.
+  void reset();
+
+  /// Record the number of worker restarts, before launching a worker.
+  void setRestarts(size_t restarts);
+
+  /// The number of times the watcher restarted a worker.
+  size_t restarts() const;
+
+  /// Ask the worker to dump its profile, the worker approached a limit.
+  void requestProfile();
+
+  /// The number of profiles the watcher requested.
+  size_t profileRequests() const;
+
+  /// Record when the watcher lost its worker, a recovery gap begins.
+  void setWorkerLost();
+
+  /**
+   * @brief Ask a standby worker to continue initializing.
+   *
+   * A standby worker waits before opening the database, it continues once
+   * the promoted process ID is its own.
+   */
+  void promote(int pid);
+
+  /// Check if the watcher promoted a standby worker.
+  bool promoted(int pid) const;
+
+  /// Record the end of a recovery gap, the replacement worker is monitoring.
+  void setRecovered();
+
+  /// Milliseconds of the last recovery gap, 0 if no worker was lost.
+  uint64_t recoveryGap() const;
+
+  /// Append a utilization sample to the window.
+  void addSample(const WorkerUtilization& sample);
+
+  /// Copy the window of utilization samples, oldest first.
+  void samples(std::vector<WorkerUtilization>& samples) const;
+
+ private:
+  WorkerStats() {}
+
+  /// Map an opened segment, initializing it for the creator.
+  Status map(int fd, bool create);
+
+ private:
+  std::string name_;
+
+  /// The mapped block.
+  WorkerStatsBlock* block_{nullptr};
+
+  /// The creator removes the segment name when it is released.
+  bool owner_{false};
+};
+
+/**
+ * @brief Record a scheduled query executing on the calling thread.
+ *
+ * The scope claims a slot in the worker's stats block, if one exists, and
+ * releases it when the query finishes. The SQLite progress handler calls
+ * WorkerQueryScope::sample while the query executes.
+ */
+class WorkerQueryScope : private boost::noncopyable {
+ public:
+  explicit WorkerQueryScope(const std::string& name);
+
+  ~WorkerQueryScope();
+
+  /// A flag for a QueryBudget, set when the watcher stops the query.
+  const std::atomic<bool>* stopped() const;
+
+  /// The reason the watcher stopped the query.
+  WorkerQueryAction action() const;
+
+  /// Sample the query executing on this thread, at most a few times a second.
+  static void sample();
+
+ private:
+  /// The worker's stats block.
+  std::shared_ptr<WorkerStats> stats_;
+
+  /// The claimed slot, or -1.
+  int slot_{-1};
+
+  /// The scope active on this thread when this scope started.
+  WorkerQueryScope* previous_{nullptr};
+
+  /// Microseconds of the last sample.
+  uint64_t sampled_{0};
+};
+}
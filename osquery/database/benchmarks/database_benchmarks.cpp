@@ -10,14 +10,61 @@
 
 #include <benchmark/benchmark.h>
 
+#include <boost/filesystem/operations.hpp>
+
 #include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 
 #include "osquery/tests/test_util.h"
 #include "osquery/database/query.h"
 
 namespace osquery {
 
+DECLARE_string(database_path);
+
+/// The database plugins compared by benchmarks, by their first argument.
+const std::vector<std::string> kBenchmarkDatabases = {"rocksdb", "sqlite"};
+
+/// The plugin active before a benchmark selected one.
+static std::string kDefaultBenchmarkDatabase;
+
+static void useDatabasePlugin(const std::string& name) {
+  auto& rf = RegistryFactory::get();
+  auto active = rf.getActive("database");
+  if (kDefaultBenchmarkDatabase.empty()) {
+    kDefaultBenchmarkDatabase = active;
+  }
+  if (active == name) {
+    return;
+  }
+
+  // Each plugin keeps its own format at the database path.
+  rf.plugin("database", active)->tearDown();
+  boost::filesystem::remove_all(FLAGS_database_path);
+  rf.setActive("database", name);
+  resetDatabase();
+}
+
+void setBenchmarkDatabase(benchmark::State& state) {
+  const auto& name = kBenchmarkDatabases[state.range_x()];
+  state.SetLabel(name);
+  useDatabasePlugin(name);
+}
+
+void resetBenchmarkDatabase() {
+  if (!kDefaultBenchmarkDatabase.empty()) {
+    useDatabasePlugin(kDefaultBenchmarkDatabase);
+  }
+}
+
+static void applyBenchmarkDatabases(benchmark::internal::Benchmark* b) {
+#if !defined(SKIP_ROCKSDB)
+  b->Arg(0);
+#endif
+  b->Arg(1);
+}
+
 QueryData getExampleQueryData(size_t x, size_t y) {
   QueryData qd;
   Row r;
@@ -78,6 +125,64 @@ BENCHMARK(DATABASE_serialize_json)
     ->ArgPair(10, 10)
     ->ArgPair(10, 100);
 
+static void DATABASE_serialize_log_item_json(benchmark::State& state) {
+  QueryLogItem item;
+  item.name = "benchmark";
+  item.results.added = getExampleQueryData(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    std::string content;
+    serializeQueryLogItemJSON(item, content);
+  }
+}
+
+BENCHMARK(DATABASE_serialize_log_item_json)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_serialize_binary(benchmark::State& state) {
+  auto qd = getExampleQueryData(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    std::string content;
+    serializeQueryDataBinary(qd, content);
+  }
+}
+
+BENCHMARK(DATABASE_serialize_binary)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_deserialize_json(benchmark::State& state) {
+  auto qd = getExampleQueryData(state.range_x(), state.range_y());
+  std::string content;
+  serializeQueryDataJSON(qd, content);
+  while (state.KeepRunning()) {
+    QueryData output;
+    deserializeQueryDataJSON(content, output);
+  }
+}
+
+BENCHMARK(DATABASE_deserialize_json)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_deserialize_binary(benchmark::State& state) {
+  auto qd = getExampleQueryData(state.range_x(), state.range_y());
+  std::string content;
+  serializeQueryDataBinary(qd, content);
+  while (state.KeepRunning()) {
+    QueryData output;
+    deserializeQueryDataBinary(content, output);
+  }
+}
+
+BENCHMARK(DATABASE_deserialize_binary)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
 static void DATABASE_diff(benchmark::State& state) {
   auto qd = getExampleQueryData(state.range_x(), state.range_y());
   while (state.KeepRunning()) {
@@ -124,6 +229,75 @@ static void DATABASE_store(benchmark::State& state) {
 
 BENCHMARK(DATABASE_store);
 
+/// The active database plugin, used to compare helpers with direct calls.
+static std::shared_ptr<DatabasePlugin> getActiveDatabasePlugin() {
+  auto& rf = RegistryFactory::get();
+  return std::dynamic_pointer_cast<DatabasePlugin>(
+      rf.plugin("database", rf.getActive("database")));
+}
+
+static void DATABASE_get_plugin(benchmark::State& state) {
+  setBenchmarkDatabase(state);
+  auto plugin = getActiveDatabasePlugin();
+  plugin->put(kPersistentSettings, "benchmark", "1");
+  while (state.KeepRunning()) {
+    std::string value;
+    plugin->get(kPersistentSettings, "benchmark", value);
+  }
+  plugin->remove(kPersistentSettings, "benchmark");
+  resetBenchmarkDatabase();
+}
+
+BENCHMARK(DATABASE_get_plugin)->Apply(applyBenchmarkDatabases);
+
+static void DATABASE_store_plugin(benchmark::State& state) {
+  setBenchmarkDatabase(state);
+  auto plugin = getActiveDatabasePlugin();
+  while (state.KeepRunning()) {
+    plugin->put(kPersistentSettings, "benchmark", "1");
+  }
+  plugin->remove(kPersistentSettings, "benchmark");
+  resetBenchmarkDatabase();
+}
+
+BENCHMARK(DATABASE_store_plugin)->Apply(applyBenchmarkDatabases);
+
+static void DATABASE_store_batch_plugin(benchmark::State& state) {
+  setBenchmarkDatabase(state);
+  auto plugin = getActiveDatabasePlugin();
+  DatabaseKeyValues data;
+  for (size_t i = 0; i < 100; i++) {
+    data.push_back(std::make_pair("benchmark" + std::to_string(i), "1"));
+  }
+
+  while (state.KeepRunning()) {
+    plugin->putBatch(kPersistentSettings, data);
+  }
+  plugin->removeRange(kPersistentSettings, "benchmark", "benchmarl");
+  resetBenchmarkDatabase();
+}
+
+BENCHMARK(DATABASE_store_batch_plugin)->Apply(applyBenchmarkDatabases);
+
+static void DATABASE_scan_plugin(benchmark::State& state) {
+  setBenchmarkDatabase(state);
+  auto plugin = getActiveDatabasePlugin();
+  DatabaseKeyValues data;
+  for (size_t i = 0; i < 100; i++) {
+    data.push_back(std::make_pair("benchmark" + std::to_string(i), "1"));
+  }
+  plugin->putBatch(kPersistentSettings, data);
+
+  while (state.KeepRunning()) {
+    std::vector<std::string> keys;
+    plugin->scan(kPersistentSettings, keys, "benchmark", 10);
+  }
+  plugin->removeRange(kPersistentSettings, "benchmark", "benchmarl");
+  resetBenchmarkDatabase();
+}
+
+BENCHMARK(DATABASE_scan_plugin)->Apply(applyBenchmarkDatabases);
+
 static void DATABASE_store_large(benchmark::State& state) {
   // Serialize the example result set into a string.
   std::string content;
@@ -0,0 +1,169 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/database.h>
+#include <osquery/flags.h>
+
+#include "osquery/database/query.h"
+
+namespace osquery {
+
+DECLARE_bool(rocksdb_domain_profiles);
+
+/// Select the database plugin from the first benchmark argument.
+extern void setBenchmarkDatabase(benchmark::State& state);
+
+/// Restore the database plugin active before the benchmarks.
+extern void resetBenchmarkDatabase();
+
+/// Select the plugin, then the RocksDB domain profiles, and reopen.
+static void setWorkload(benchmark::State& state) {
+  setBenchmarkDatabase(state);
+  bool profiles = (state.range_y() == 1);
+  if (FLAGS_rocksdb_domain_profiles != profiles) {
+    FLAGS_rocksdb_domain_profiles = profiles;
+    resetDatabase();
+  }
+}
+
+/// RocksDB runs with and without domain profiles, SQLite does not use them.
+static void applyWorkloads(benchmark::internal::Benchmark* b) {
+#if !defined(SKIP_ROCKSDB)
+  b->ArgPair(0, 0)->ArgPair(0, 1);
+#endif
+  b->ArgPair(1, 0);
+}
+
+/// A JSON event or result row, similar in size to a process event.
+static std::string getWorkloadValue(size_t i) {
+  return "{\"pid\":\"" + std::to_string(i) +
+         "\",\"path\":\"/usr/bin/example\",\"cmdline\":\"example --flag\","
+         "\"uid\":\"0\",\"gid\":\"0\",\"time\":\"1500000000\"}";
+}
+
+/// Zero-pad an increasing ID so keys sort in insertion order.
+static std::string getWorkloadKey(const std::string& prefix, size_t i) {
+  auto id = std::to_string(i);
+  return prefix + std::string(10 - std::min<size_t>(10, id.size()), '0') + id;
+}
+
+/**
+ * @brief Model the events domain, an append-then-expire time series.
+ *
+ * Each iteration appends a batch of records, looks up the batch index, and
+ * expires the oldest batch once a window of batches is stored.
+ */
+static void DATABASE_workload_events(benchmark::State& state) {
+  setWorkload(state);
+
+  const size_t kBatch = 100;
+  const size_t kWindow = 20;
+  size_t batch = 0;
+  while (state.KeepRunning()) {
+    DatabaseKeyValues records;
+    for (size_t i = 0; i < kBatch; i++) {
+      auto eid = batch * kBatch + i;
+      records.push_back(std::make_pair(
+          getWorkloadKey("data.benchmark.", eid), getWorkloadValue(eid)));
+    }
+    setDatabaseBatch(kEvents, records);
+    setDatabaseValue(kEvents,
+                     getWorkloadKey("index.benchmark.", batch),
+                     std::to_string(batch * kBatch));
+
+    std::string index;
+    getDatabaseValue(kEvents, getWorkloadKey("index.benchmark.", batch), index);
+
+    if (batch >= kWindow) {
+      auto expired = batch - kWindow;
+      deleteDatabaseRange(kEvents,
+                          getWorkloadKey("data.benchmark.", expired * kBatch),
+                          getWorkloadKey("data.benchmark.",
+                                         (expired + 1) * kBatch));
+      deleteDatabaseValue(kEvents, getWorkloadKey("index.benchmark.", expired));
+    }
+    batch++;
+  }
+
+  deleteDatabaseRange(kEvents, "data.benchmark.", "data.benchmark/");
+  deleteDatabaseRange(kEvents, "index.benchmark.", "index.benchmark/");
+  resetBenchmarkDatabase();
+}
+
+BENCHMARK(DATABASE_workload_events)->Apply(applyWorkloads);
+
+/**
+ * @brief Model the logs domain, a FIFO queue.
+ *
+ * Each iteration buffers lines, then reads and removes the oldest set the
+ * way a buffered log forwarder sends them.
+ */
+static void DATABASE_workload_logs(benchmark::State& state) {
+  setWorkload(state);
+
+  const size_t kLines = 256;
+  size_t line = 0;
+  while (state.KeepRunning()) {
+    for (size_t i = 0; i < kLines; i++) {
+      setDatabaseValue(kLogs,
+                       getWorkloadKey("benchmark_r_", line),
+                       getWorkloadValue(line));
+      line++;
+    }
+
+    DatabaseKeyValues sent;
+    scanDatabaseRange(kLogs, "benchmark_", "benchmark`", sent, kLines);
+    std::vector<std::string> keys;
+    for (const auto& item : sent) {
+      keys.push_back(item.first);
+    }
+    deleteDatabaseBatch(kLogs, keys);
+  }
+
+  deleteDatabaseRange(kLogs, "benchmark_", "benchmark`");
+  resetBenchmarkDatabase();
+}
+
+BENCHMARK(DATABASE_workload_logs)->Apply(applyWorkloads);
+
+/**
+ * @brief Model the queries domain, overwriting scheduled query results.
+ *
+ * Each iteration reads and overwrites the previous results of a schedule.
+ */
+static void DATABASE_workload_queries(benchmark::State& state) {
+  setWorkload(state);
+
+  const size_t kQueriesScheduled = 50;
+  std::string results = "[";
+  for (size_t i = 0; i < 20; i++) {
+    results += ((i > 0) ? "," : "") + getWorkloadValue(i);
+  }
+  results += "]";
+
+  size_t query = 0;
+  while (state.KeepRunning()) {
+    auto name = "benchmark" + std::to_string(query % kQueriesScheduled);
+    std::string previous;
+    getDatabaseValue(kQueries, name, previous);
+    setDatabaseValue(kQueries, name, results);
+    query++;
+  }
+
+  for (size_t i = 0; i < kQueriesScheduled; i++) {
+    deleteDatabaseValue(kQueries, "benchmark" + std::to_string(i));
+  }
+  resetBenchmarkDatabase();
+}
+
+BENCHMARK(DATABASE_workload_queries)->Apply(applyWorkloads);
+}
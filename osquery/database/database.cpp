@@ -8,7 +8,11 @@
  *
  */
 
+#include <algorithm>
+#include <map>
+#include <memory>
 #include <set>
+#include <unordered_map>
 
 #include <boost/lexical_cast.hpp>
 
@@ -16,6 +20,8 @@
 #include <osquery/logger.h>
 
 #include "osquery/core/json.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/tracing.h"
 
 namespace pt = boost::property_tree;
 
@@ -34,6 +40,11 @@ FLAG_ALIAS(std::string, db_path, database_path);
 
 FLAG(bool, disable_database, false, "Disable the persistent RocksDB storage");
 
+FLAG(string,
+     database_format,
+     "binary",
+     "Encoding of stored results and events: binary, json");
+
 DECLARE_bool(decorations_top_level);
 
 #if defined(SKIP_ROCKSDB)
@@ -47,9 +58,10 @@ const std::string kPersistentSettings = "configurations";
 const std::string kQueries = "queries";
 const std::string kEvents = "events";
 const std::string kLogs = "logs";
+const std::string kHashes = "hashes";
 
 const std::vector<std::string> kDomains = {
-    kPersistentSettings, kQueries, kEvents, kLogs};
+    kPersistentSettings, kQueries, kEvents, kLogs, kHashes};
 
 bool DatabasePlugin::kDBHandleOptionAllowOpen(false);
 bool DatabasePlugin::kDBHandleOptionRequireWrite(false);
@@ -85,21 +97,43 @@ Status serializeRow(const Row& r, const ColumnNames& cols, pt::ptree& tree) {
   return Status(0, "OK");
 }
 
-Status serializeRowJSON(const Row& r, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeRow(r, tree);
-  if (!status.ok()) {
-    return status;
+/// Write a Row as an object, an empty Row is an empty value like in a ptree.
+static void writeRow(const Row& r, JSONWriter& writer) {
+  if (r.empty()) {
+    writer.value("");
+    return;
   }
 
-  std::ostringstream output;
-  try {
-    pt::write_json(output, tree, false);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    // The content could not be represented as JSON.
-    return Status(1, e.what());
+  writer.startObject();
+  for (const auto& i : r) {
+    writer.value(i.first, i.second);
+  }
+  writer.endObject();
+}
+
+/// Write QueryData as an array, empty QueryData is an empty value.
+static void writeQueryData(const QueryData& q, JSONWriter& writer) {
+  if (q.empty()) {
+    writer.value("");
+    return;
   }
-  json = output.str();
+
+  writer.startArray();
+  for (const auto& r : q) {
+    writeRow(r, writer);
+  }
+  writer.endArray();
+}
+
+Status serializeRowJSON(const Row& r, std::string& json) {
+  json.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  for (const auto& i : r) {
+    writer.value(i.first, i.second);
+  }
+  writer.endObject();
+  json += '\n';
   return Status(0, "OK");
 }
 
@@ -114,12 +148,9 @@ Status deserializeRow(const pt::ptree& tree, Row& r) {
 
 Status deserializeRowJSON(const std::string& json, Row& r) {
   pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  auto status = parseJSONTree(json, tree);
+  if (!status.ok()) {
+    return status;
   }
   return deserializeRow(tree, r);
 }
@@ -150,21 +181,46 @@ Status serializeQueryData(const QueryData& q,
   return Status(0, "OK");
 }
 
-Status serializeQueryDataJSON(const QueryData& q, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeQueryData(q, tree);
-  if (!status.ok()) {
-    return status;
+Status serializeQueryData(const QueryData& q,
+                          const ColumnNames& cols,
+                          JSONWriter& writer) {
+  if (q.empty()) {
+    writer.value("");
+    return Status(0, "OK");
   }
 
-  std::ostringstream output;
-  try {
-    pt::write_json(output, tree, false);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    // The content could not be represented as JSON.
-    return Status(1, e.what());
+  writer.startArray();
+  for (const auto& r : q) {
+    if (cols.empty()) {
+      writer.value("");
+      continue;
+    }
+
+    writer.startObject();
+    for (const auto& c : cols) {
+      auto it = r.find(c);
+      if (it == r.end()) {
+        return Status(1, "Missing column: " + c);
+      }
+      writer.value(c, it->second);
+    }
+    writer.endObject();
+  }
+  writer.endArray();
+  return Status(0, "OK");
+}
+
+Status serializeQueryDataJSON(const QueryData& q, std::string& json) {
+  // The document root is an object with unnamed rows, as boost wrote it.
+  json.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  for (const auto& r : q) {
+    writer.key("");
+    writeRow(r, writer);
   }
-  json = output.str();
+  writer.endObject();
+  json += '\n';
   return Status(0, "OK");
 }
 
@@ -182,12 +238,9 @@ Status deserializeQueryData(const pt::ptree& tree, QueryData& qd) {
 
 Status deserializeQueryDataJSON(const std::string& json, QueryData& qd) {
   pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  auto status = parseJSONTree(json, tree);
+  if (!status.ok()) {
+    return status;
   }
   return deserializeQueryData(tree, qd);
 }
@@ -230,44 +283,246 @@ Status deserializeDiffResults(const pt::ptree& tree, DiffResults& dr) {
   return Status(0, "OK");
 }
 
+/// Write the "removed" then "added" rows, see serializeDiffResults.
+static void writeDiffResults(const DiffResults& d, JSONWriter& writer) {
+  writer.startObject();
+  writer.key("removed");
+  writeQueryData(d.removed, writer);
+  writer.key("added");
+  writeQueryData(d.added, writer);
+  writer.endObject();
+}
+
 Status serializeDiffResultsJSON(const DiffResults& d, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeDiffResults(d, tree);
+  json.clear();
+  JSONWriter writer(json);
+  writeDiffResults(d, writer);
+  json += '\n';
+  return Status(0, "OK");
+}
+
+/// The first byte of binary-serialized content, JSON begins with '[' or '{'.
+static const char kBinaryFormatVersion = '\x01';
+
+static inline void writeVarint(std::string& data, size_t value) {
+  while (value >= 0x80) {
+    data.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  data.push_back(static_cast<char>(value));
+}
+
+static inline bool readVarint(const std::string& data,
+                              size_t& offset,
+                              size_t& value) {
+  value = 0;
+  for (size_t shift = 0; offset < data.size() && shift < 64; shift += 7) {
+    auto byte = static_cast<unsigned char>(data[offset++]);
+    value |= static_cast<size_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline void writeString(std::string& data, const std::string& value) {
+  writeVarint(data, value.size());
+  data.append(value);
+}
+
+static inline bool readString(const std::string& data,
+                              size_t& offset,
+                              std::string& value) {
+  size_t size = 0;
+  if (!readVarint(data, offset, size) || size > data.size() - offset) {
+    return false;
+  }
+  value.assign(data, offset, size);
+  offset += size;
+  return true;
+}
+
+Status serializeQueryDataBinary(const QueryData& q, std::string& data) {
+  // Assign each distinct column name an index in the dictionary.
+  std::map<std::string, size_t> columns;
+  std::vector<const std::string*> dictionary;
+  size_t size = 0;
+  for (const auto& r : q) {
+    for (const auto& column : r) {
+      if (columns.emplace(column.first, dictionary.size()).second) {
+        dictionary.push_back(&column.first);
+        size += column.first.size() + 1;
+      }
+      size += column.second.size() + 2;
+    }
+  }
+
+  data.clear();
+  data.reserve(size + q.size() + 8);
+  data.push_back(kBinaryFormatVersion);
+  writeVarint(data, dictionary.size());
+  for (const auto& name : dictionary) {
+    writeString(data, *name);
+  }
+
+  writeVarint(data, q.size());
+  for (const auto& r : q) {
+    writeVarint(data, r.size());
+    for (const auto& column : r) {
+      writeVarint(data, columns.at(column.first));
+      writeString(data, column.second);
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status deserializeQueryDataBinary(const std::string& data, QueryData& qd) {
+  if (!isBinarySerialized(data)) {
+    return Status(1, "Unknown binary serialization format");
+  }
+
+  size_t offset = 1;
+  size_t count = 0;
+  if (!readVarint(data, offset, count) || count > data.size()) {
+    return Status(1, "Invalid binary column dictionary");
+  }
+
+  std::vector<std::string> dictionary(count);
+  for (auto& name : dictionary) {
+    if (!readString(data, offset, name)) {
+      return Status(1, "Invalid binary column dictionary");
+    }
+  }
+
+  if (!readVarint(data, offset, count) || count > data.size()) {
+    return Status(1, "Invalid binary row count");
+  }
+  qd.reserve(qd.size() + count);
+  for (size_t i = 0; i < count; i++) {
+    size_t cells = 0;
+    if (!readVarint(data, offset, cells)) {
+      return Status(1, "Invalid binary row");
+    }
+
+    Row r;
+    for (size_t j = 0; j < cells; j++) {
+      size_t index = 0;
+      if (!readVarint(data, offset, index) || index >= dictionary.size() ||
+          !readString(data, offset, r[dictionary[index]])) {
+        return Status(1, "Invalid binary row");
+      }
+    }
+    qd.push_back(std::move(r));
+  }
+  return Status(0, "OK");
+}
+
+Status serializeRowBinary(const Row& r, std::string& data) {
+  return serializeQueryDataBinary({r}, data);
+}
+
+Status deserializeRowBinary(const std::string& data, Row& r) {
+  QueryData qd;
+  auto status = deserializeQueryDataBinary(data, qd);
   if (!status.ok()) {
     return status;
   }
-
-  std::ostringstream output;
-  try {
-    pt::write_json(output, tree, false);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    // The content could not be represented as JSON.
-    return Status(1, e.what());
+  if (qd.size() != 1) {
+    return Status(1, "Binary content is not a single row");
   }
-  json = output.str();
+  r = std::move(qd[0]);
   return Status(0, "OK");
 }
 
+bool isBinarySerialized(const std::string& data) {
+  return !data.empty() && data[0] == kBinaryFormatVersion;
+}
+
+Status serializeQueryDataStored(const QueryData& q, std::string& data) {
+  if (FLAGS_database_format == "json") {
+    return serializeQueryDataJSON(q, data);
+  }
+  return serializeQueryDataBinary(q, data);
+}
+
+Status deserializeQueryDataStored(const std::string& data, QueryData& qd) {
+  // Content written before the binary format, or with JSON selected.
+  if (!isBinarySerialized(data)) {
+    return deserializeQueryDataJSON(data, qd);
+  }
+  return deserializeQueryDataBinary(data, qd);
+}
+
+Status serializeRowStored(const Row& r, std::string& data) {
+  if (FLAGS_database_format == "json") {
+    auto status = serializeRowJSON(r, data);
+    // Then remove the newline.
+    if (status.ok() && data.size() > 0 && data.back() == '\n') {
+      data.pop_back();
+    }
+    return status;
+  }
+  return serializeRowBinary(r, data);
+}
+
+Status deserializeRowStored(const std::string& data, Row& r) {
+  if (!isBinarySerialized(data)) {
+    return deserializeRowJSON(data, r);
+  }
+  return deserializeRowBinary(data, r);
+}
+
+RowFingerprint getRowFingerprint(const Row& r) {
+  // 64-bit FNV-1a, columns and values are terminated to avoid ambiguity.
+  RowFingerprint hash = 14695981039346656037ULL;
+  auto update = [&hash](const std::string& data) {
+    for (const auto& c : data) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 1099511628211ULL;
+    }
+    hash *= 1099511628211ULL;
+  };
+
+  for (const auto& column : r) {
+    update(column.first);
+    update(column.second);
+  }
+  return hash;
+}
+
 DiffResults diff(const QueryData& old, const QueryData& current) {
   DiffResults r;
-  QueryData overlap;
 
-  for (const auto& i : current) {
-    auto item = std::find(old.begin(), old.end(), i);
-    if (item != old.end()) {
-      overlap.push_back(i);
-    } else {
-      r.added.push_back(i);
+  // Index the old rows by fingerprint, each index is matched at most once.
+  std::unordered_multimap<RowFingerprint, size_t> old_rows;
+  old_rows.reserve(old.size());
+  for (size_t i = 0; i < old.size(); i++) {
+    old_rows.emplace(getRowFingerprint(old[i]), i);
+  }
+
+  std::vector<bool> matched(old.size(), false);
+  for (const auto& row : current) {
+    bool found = false;
+    auto range = old_rows.equal_range(getRowFingerprint(row));
+    for (auto it = range.first; it != range.second; ++it) {
+      if (old[it->second] == row) {
+        matched[it->second] = true;
+        old_rows.erase(it);
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      r.added.push_back(row);
     }
   }
 
-  std::multiset<Row> overlap_set(overlap.begin(), overlap.end());
-  std::multiset<Row> old_set(old.begin(), old.end());
-  std::set_difference(old_set.begin(),
-                      old_set.end(),
-                      overlap_set.begin(),
-                      overlap_set.end(),
-                      std::back_inserter(r.removed));
+  for (size_t i = 0; i < old.size(); i++) {
+    if (!matched[i]) {
+      r.removed.push_back(old[i]);
+    }
+  }
   return r;
 }
 
@@ -280,13 +535,23 @@ inline void addLegacyFieldsAndDecorations(const QueryLogItem& item,
   tree.put<size_t>("unixTime", item.time);
 
   // Append the decorations.
-  if (item.decorations.size() > 0) {
+  auto decorations = item.decorations;
+  if (item.decorations_json != nullptr && !item.decorations_json->empty()) {
+    pt::ptree serialized;
+    if (parseJSONTree("{" + *item.decorations_json + "}", serialized).ok()) {
+      for (const auto& name : serialized) {
+        decorations[name.first] = name.second.data();
+      }
+    }
+  }
+
+  if (decorations.size() > 0) {
     auto decorator_parent = std::ref(tree);
     if (!FLAGS_decorations_top_level) {
       tree.add_child("decorations", pt::ptree());
       decorator_parent = tree.get_child("decorations");
     }
-    for (const auto& name : item.decorations) {
+    for (const auto& name : decorations) {
       decorator_parent.get().put<std::string>(name.first, name.second);
     }
   }
@@ -315,6 +580,9 @@ Status serializeQueryLogItem(const QueryLogItem& item, pt::ptree& tree) {
       return status;
     }
     tree.add_child("diffResults", results_tree);
+  } else if (item.snapshot_unchanged) {
+    tree.put<std::string>("fingerprint", item.snapshot_fingerprint);
+    tree.put<std::string>("action", "snapshot_unchanged");
   } else {
     auto status = serializeQueryData(item.snapshot_results, results_tree);
     if (!status.ok()) {
@@ -328,24 +596,118 @@ Status serializeQueryLogItem(const QueryLogItem& item, pt::ptree& tree) {
   return Status(0, "OK");
 }
 
-Status serializeQueryLogItemJSON(const QueryLogItem& i, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeQueryLogItem(i, tree);
-  if (!status.ok()) {
-    return status;
+/// Top-level fields of log items, which top-level decorations replace.
+static const std::set<std::string> kLogItemFields = {
+    "action", "name", "hostIdentifier", "calendarTime", "unixTime"};
+
+/**
+ * @brief Write a log item field, a top-level decoration replaces its value.
+ *
+ * This keeps the output of addLegacyFieldsAndDecorations, which put the
+ * decorations over the existing fields.
+ */
+static void writeLogItemField(const QueryLogItem& item,
+                              const std::string& name,
+                              const std::string& value,
+                              JSONWriter& writer) {
+  if (FLAGS_decorations_top_level) {
+    auto it = item.decorations.find(name);
+    if (it != item.decorations.end()) {
+      writer.value(name, it->second);
+      return;
+    }
+  }
+  writer.value(name, value);
+}
+
+/// The streaming equivalent of addLegacyFieldsAndDecorations.
+static void writeLegacyFieldsAndDecorations(const QueryLogItem& item,
+                                            JSONWriter& writer) {
+  writeLogItemField(item, "name", item.name, writer);
+  writeLogItemField(item, "hostIdentifier", item.identifier, writer);
+  writeLogItemField(item, "calendarTime", item.calendar_time, writer);
+  writeLogItemField(item, "unixTime", std::to_string(item.time), writer);
+
+  bool serialized =
+      (item.decorations_json != nullptr && !item.decorations_json->empty());
+  if (item.decorations.empty() && !serialized) {
+    return;
   }
 
-  std::ostringstream output;
-  try {
-    pt::write_json(output, tree, false);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    // The content could not be represented as JSON.
-    return Status(1, e.what());
+  if (!FLAGS_decorations_top_level) {
+    writer.key("decorations");
+    writer.startObject();
   }
-  json = output.str();
+  for (const auto& name : item.decorations) {
+    if (!FLAGS_decorations_top_level || kLogItemFields.count(name.first) == 0) {
+      writer.value(name.first, name.second);
+    }
+  }
+  if (serialized) {
+    writer.members(*item.decorations_json);
+  }
+  if (!FLAGS_decorations_top_level) {
+    writer.endObject();
+  }
+}
+
+Status serializeQueryLogItemJSON(const QueryLogItem& i, std::string& json) {
+  json.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  if (i.results.added.size() > 0 || i.results.removed.size() > 0) {
+    writer.key("diffResults");
+    writeDiffResults(i.results, writer);
+  } else if (i.snapshot_unchanged) {
+    // The marker replaces results matching the last logged snapshot.
+    writer.value("fingerprint", i.snapshot_fingerprint);
+    writeLogItemField(i, "action", "snapshot_unchanged", writer);
+  } else {
+    writer.key("snapshot");
+    writeQueryData(i.snapshot_results, writer);
+    writeLogItemField(i, "action", "snapshot", writer);
+  }
+  writeLegacyFieldsAndDecorations(i, writer);
+  writer.endObject();
+  json += '\n';
   return Status(0, "OK");
 }
 
+SnapshotLogItemWriter::SnapshotLogItemWriter(const QueryLogItem& item,
+                                             std::string& json)
+    : item_(item), json_(json) {
+  json_.clear();
+  writer_ = std::make_unique<JSONWriter>(json_);
+  writer_->startObject();
+}
+
+SnapshotLogItemWriter::~SnapshotLogItemWriter() {}
+
+void SnapshotLogItemWriter::addRow(const Row& row) {
+  if (rows_++ == 0) {
+    writer_->key("snapshot");
+    writer_->startArray();
+  }
+  writeRow(row, *writer_);
+}
+
+void SnapshotLogItemWriter::finish(
+    const std::map<std::string, std::string>& fields) {
+  if (rows_ == 0) {
+    // Empty results are an empty value, see writeQueryData.
+    writer_->value("snapshot", "");
+  } else {
+    writer_->endArray();
+  }
+  writeLogItemField(item_, "action", "snapshot", *writer_);
+  writeLegacyFieldsAndDecorations(item_, *writer_);
+  for (const auto& field : fields) {
+    writer_->value(field.first, field.second);
+  }
+  writer_->endObject();
+  json_ += '\n';
+}
+
 Status deserializeQueryLogItem(const pt::ptree& tree, QueryLogItem& item) {
   if (tree.count("diffResults") > 0) {
     auto status =
@@ -359,6 +721,9 @@ Status deserializeQueryLogItem(const pt::ptree& tree, QueryLogItem& item) {
     if (!status.ok()) {
       return status;
     }
+  } else if (tree.get<std::string>("action", "") == "snapshot_unchanged") {
+    item.snapshot_unchanged = true;
+    item.snapshot_fingerprint = tree.get<std::string>("fingerprint", "");
   }
 
   getLegacyFieldsAndDecorations(tree, item);
@@ -368,12 +733,9 @@ Status deserializeQueryLogItem(const pt::ptree& tree, QueryLogItem& item) {
 Status deserializeQueryLogItemJSON(const std::string& json,
                                    QueryLogItem& item) {
   pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  auto status = parseJSONTree(json, tree);
+  if (!status.ok()) {
+    return status;
   }
   return deserializeQueryLogItem(tree, item);
 }
@@ -414,23 +776,31 @@ Status serializeQueryLogItemAsEvents(const QueryLogItem& i, pt::ptree& tree) {
   return Status(0, "OK");
 }
 
-Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
-                                         std::vector<std::string>& items) {
-  pt::ptree tree;
-  auto status = serializeQueryLogItemAsEvents(i, tree);
-  if (!status.ok()) {
-    return status;
+/// Write each row as an event, see serializeQueryLogItemAsEvents.
+static void writeEvents(const QueryLogItem& item,
+                        const QueryData& rows,
+                        const std::string& action,
+                        std::vector<std::string>& items) {
+  for (const auto& row : rows) {
+    std::string json;
+    JSONWriter writer(json);
+    writer.startObject();
+    writeLegacyFieldsAndDecorations(item, writer);
+    // Yield results as a "columns." map to avoid namespace collisions.
+    writer.key("columns");
+    writeRow(row, writer);
+    writer.value("action", action);
+    writer.endObject();
+    json += '\n';
+    items.push_back(std::move(json));
   }
+}
 
-  for (auto& event : tree) {
-    std::ostringstream output;
-    try {
-      pt::write_json(output, event.second, false);
-    } catch (const pt::json_parser::json_parser_error& e) {
-      return Status(1, e.what());
-    }
-    items.push_back(output.str());
-  }
+Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
+                                         std::vector<std::string>& items) {
+  // Removed rows are logged first, like serializeDiffResults.
+  writeEvents(i, i.results.removed, "removed", items);
+  writeEvents(i, i.results.added, "added", items);
   return Status(0, "OK");
 }
 
@@ -515,6 +885,26 @@ Status DatabasePlugin::call(const PluginRequest& request,
       response.push_back({{"k", k}});
     }
     return status;
+  } else if (request.at("action") == "scan_range") {
+    size_t max = 0;
+    if (request.count("max") > 0) {
+      max = std::stoul(request.at("max"));
+    }
+    bool reverse =
+        (request.count("reverse") > 0 && request.at("reverse") == "1");
+    DatabaseKeyValues results;
+    auto status = this->scanRange(
+        domain, request.at("begin"), request.at("end"), results, max, reverse);
+    for (auto& result : results) {
+      response.push_back({{"k", result.first}, {"v", result.second}});
+    }
+    return status;
+  } else if (request.at("action") == "remove_range") {
+    return this->removeRange(domain, request.at("begin"), request.at("end"));
+  } else if (request.at("action") == "stats") {
+    return this->stats(response);
+  } else if (request.at("action") == "release_memory") {
+    return this->releaseMemory();
   } else if (request.at("action") == "reset") {
     return this->reset();
   }
@@ -522,14 +912,108 @@ Status DatabasePlugin::call(const PluginRequest& request,
   return Status(1, "Unknown database plugin action");
 }
 
+Status DatabasePlugin::scanRange(const std::string& domain,
+                                 const std::string& begin,
+                                 const std::string& end,
+                                 DatabaseKeyValues& results,
+                                 size_t max,
+                                 bool reverse) const {
+  std::vector<std::string> keys;
+  auto status = scan(domain, keys, "", 0);
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::sort(keys.begin(), keys.end());
+  if (reverse) {
+    std::reverse(keys.begin(), keys.end());
+  }
+  for (const auto& key : keys) {
+    if (key < begin || (!end.empty() && key >= end)) {
+      continue;
+    }
+    std::string value;
+    if (get(domain, key, value).ok()) {
+      results.push_back(std::make_pair(key, std::move(value)));
+      if (max > 0 && results.size() >= max) {
+        break;
+      }
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::putBatch(const std::string& domain,
+                                const DatabaseKeyValues& data) {
+  for (const auto& item : data) {
+    auto status = put(domain, item.first, item.second);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::removeBatch(const std::string& domain,
+                                   const std::vector<std::string>& keys) {
+  for (const auto& key : keys) {
+    auto status = remove(domain, key);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::removeRange(const std::string& domain,
+                                   const std::string& begin,
+                                   const std::string& end) {
+  std::vector<std::string> keys;
+  auto status = scan(domain, keys, "", 0);
+  if (!status.ok()) {
+    return status;
+  }
+
+  for (const auto& key : keys) {
+    if (key >= begin && (end.empty() || key < end)) {
+      remove(domain, key);
+    }
+  }
+  return Status(0, "OK");
+}
+
+/// The active database plugin and the registry generation it was found in.
+struct DatabasePluginHandle {
+  size_t generation{0};
+  std::shared_ptr<DatabasePlugin> plugin{nullptr};
+};
+
+/**
+ * @brief A cached handle to the active database plugin.
+ *
+ * Every database helper needs the active plugin, resolving it from the
+ * registry copies the active name and searches two maps. The handle is kept
+ * until the registry generation changes or the database is reset.
+ */
+static std::shared_ptr<DatabasePluginHandle> kDatabasePluginHandle{nullptr};
+
 static inline std::shared_ptr<DatabasePlugin> getDatabasePlugin() {
   auto& rf = RegistryFactory::get();
-  if (!rf.exists("database", rf.getActive("database"), true)) {
-    return nullptr;
+  auto generation = rf.generation();
+  auto handle = std::atomic_load(&kDatabasePluginHandle);
+  if (handle != nullptr && handle->generation == generation) {
+    return handle->plugin;
   }
 
-  auto plugin = rf.plugin("database", rf.getActive("database"));
-  return std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+  handle = std::make_shared<DatabasePluginHandle>();
+  handle->generation = generation;
+  auto active = rf.getActive("database");
+  if (rf.exists("database", active, true)) {
+    auto plugin = rf.plugin("database", active);
+    handle->plugin = std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+  }
+  std::atomic_store(&kDatabasePluginHandle, handle);
+  return handle->plugin;
 }
 
 Status getDatabaseValue(const std::string& domain,
@@ -553,6 +1037,7 @@ Status getDatabaseValue(const std::string& domain,
     return status;
   } else {
     auto plugin = getDatabasePlugin();
+    TRACE_PROBE2(database__get, domain.c_str(), key.c_str());
     return plugin->get(domain, key, value);
   }
 }
@@ -570,7 +1055,53 @@ Status setDatabaseValue(const std::string& domain,
     return Registry::call("database", request);
   } else {
     auto plugin = getDatabasePlugin();
-    return plugin->put(domain, key, value);
+    TRACE_PROBE3(database__put, domain.c_str(), key.c_str(), value.size());
+    auto status = plugin->put(domain, key, value);
+    if (!status.ok()) {
+      static auto& errors = Metrics::counter("database_errors", "action=put");
+      errors.add();
+    } else {
+      static auto& bytes = Metrics::counter("database_bytes_written");
+      bytes.add(key.size() + value.size());
+    }
+    return status;
+  }
+}
+
+Status setDatabaseBatch(const std::string& domain,
+                        const DatabaseKeyValues& data) {
+  ReadLock lock(kDatabaseReset);
+
+  if (RegistryFactory::get().external()) {
+    // External registries (extensions) do not have databases active.
+    // A request cannot carry several values, so each is put separately.
+    for (const auto& item : data) {
+      PluginRequest request = {{"action", "put"},
+                               {"domain", domain},
+                               {"key", item.first},
+                               {"value", item.second}};
+      auto status = Registry::call("database", request);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    return Status(0, "OK");
+  } else {
+    auto plugin = getDatabasePlugin();
+    TRACE_PROBE2(database__put__batch, domain.c_str(), data.size());
+    auto status = plugin->putBatch(domain, data);
+    if (!status.ok()) {
+      static auto& errors = Metrics::counter("database_errors", "action=batch");
+      errors.add();
+    } else {
+      size_t size = 0;
+      for (const auto& item : data) {
+        size += item.first.size() + item.second.size();
+      }
+      static auto& bytes = Metrics::counter("database_bytes_written");
+      bytes.add(size);
+    }
+    return status;
   }
 }
 
@@ -624,8 +1155,130 @@ Status scanDatabaseKeys(const std::string& domain,
   }
 }
 
+Status scanDatabaseRange(const std::string& domain,
+                         const std::string& begin,
+                         const std::string& end,
+                         DatabaseKeyValues& results,
+                         size_t max,
+                         bool reverse) {
+  ReadLock lock(kDatabaseReset);
+
+  if (RegistryFactory::get().external()) {
+    // External registries (extensions) do not have databases active.
+    // It is not possible to use an extension-based database.
+    PluginRequest request = {{"action", "scan_range"},
+                             {"domain", domain},
+                             {"begin", begin},
+                             {"end", end},
+                             {"max", std::to_string(max)},
+                             {"reverse", (reverse) ? "1" : "0"}};
+    PluginResponse response;
+    auto status = Registry::call("database", request, response);
+
+    for (auto& item : response) {
+      if (item.count("k") > 0 && item.count("v") > 0) {
+        results.push_back(std::make_pair(item.at("k"), std::move(item["v"])));
+      }
+    }
+    return status;
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->scanRange(domain, begin, end, results, max, reverse);
+  }
+}
+
+Status scanDatabasePrefix(const std::string& domain,
+                          const std::string& prefix,
+                          DatabaseKeyValues& results,
+                          size_t max) {
+  return scanDatabaseRange(
+      domain, prefix, getDatabasePrefixEnd(prefix), results, max);
+}
+
+std::string getDatabasePrefixEnd(const std::string& prefix) {
+  // Increment the last byte that is not 0xff, dropping the bytes after it.
+  auto end = prefix;
+  while (!end.empty()) {
+    auto& last = end.back();
+    if (static_cast<unsigned char>(last) != 0xff) {
+      last++;
+      return end;
+    }
+    end.pop_back();
+  }
+  // Every byte is 0xff, there is no bounding key.
+  return end;
+}
+
+Status deleteDatabaseBatch(const std::string& domain,
+                           const std::vector<std::string>& keys) {
+  ReadLock lock(kDatabaseReset);
+
+  if (RegistryFactory::get().external()) {
+    // External registries (extensions) do not have databases active.
+    // A request cannot carry several keys, so each is removed separately.
+    for (const auto& key : keys) {
+      PluginRequest request = {
+          {"action", "remove"}, {"domain", domain}, {"key", key}};
+      auto status = Registry::call("database", request);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    return Status(0, "OK");
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->removeBatch(domain, keys);
+  }
+}
+
+Status deleteDatabaseRange(const std::string& domain,
+                           const std::string& begin,
+                           const std::string& end) {
+  ReadLock lock(kDatabaseReset);
+
+  if (RegistryFactory::get().external()) {
+    // External registries (extensions) do not have databases active.
+    // It is not possible to use an extension-based database.
+    PluginRequest request = {{"action", "remove_range"},
+                             {"domain", domain},
+                             {"begin", begin},
+                             {"end", end}};
+    return Registry::call("database", request);
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->removeRange(domain, begin, end);
+  }
+}
+
+Status getDatabaseStats(PluginResponse& stats) {
+  ReadLock lock(kDatabaseReset);
+
+  if (RegistryFactory::get().external()) {
+    PluginRequest request = {{"action", "stats"}};
+    return Registry::call("database", request, stats);
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->stats(stats);
+  }
+}
+
+Status releaseDatabaseMemory() {
+  ReadLock lock(kDatabaseReset);
+
+  if (RegistryFactory::get().external()) {
+    PluginRequest request = {{"action", "release_memory"}};
+    return Registry::call("database", request);
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->releaseMemory();
+  }
+}
+
 void resetDatabase() {
   WriteLock lock(kDatabaseReset);
+  std::atomic_store(&kDatabasePluginHandle,
+                    std::shared_ptr<DatabasePluginHandle>(nullptr));
 
   // Prevent RocksDB reentrancy by logger plugins during plugin setup.
   LoggerForwardingDisabler disable_logging;
@@ -8,15 +8,54 @@
  *
  */
 
+#include <boost/filesystem/operations.hpp>
+
+#include <osquery/core.h>
 #include <osquery/database.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/core/conversions.h"
+
+namespace fs = boost::filesystem;
 
 namespace osquery {
 
 DECLARE_string(database_path);
 
+FLAG(uint64,
+     ephemeral_memory_limit,
+     0,
+     "Megabytes of keys and values held by the ephemeral database (0 none)");
+
+FLAG(string,
+     ephemeral_snapshot_path,
+     "",
+     "Optional path to save and restore ephemeral database snapshots");
+
+FLAG(uint64,
+     ephemeral_snapshot_interval,
+     60,
+     "Seconds between ephemeral database snapshots");
+
+/// A value and its position in the domain's write order.
+struct EphemeralValue {
+  std::string value;
+  size_t order{0};
+};
+
+/// The keys of a domain, the write order of its keys, and their size.
+struct EphemeralDomain {
+  std::map<std::string, EphemeralValue> keys;
+  std::map<size_t, std::string> order;
+  size_t bytes{0};
+  size_t evicted{0};
+};
+
 class EphemeralDatabasePlugin : public DatabasePlugin {
-  using DBType = std::map<std::string, std::map<std::string, std::string> >;
+  using DBType = std::map<std::string, EphemeralDomain>;
 
  public:
   /// Data retrieval method.
@@ -38,25 +77,130 @@ class EphemeralDatabasePlugin : public DatabasePlugin {
               const std::string& prefix,
               size_t max = 0) const override;
 
+  /// Ordered key range lookup method.
+  Status scanRange(const std::string& domain,
+                   const std::string& begin,
+                   const std::string& end,
+                   DatabaseKeyValues& results,
+                   size_t max = 0,
+                   bool reverse = false) const override;
+
+  /// Ordered key range removal method.
+  Status removeRange(const std::string& domain,
+                     const std::string& begin,
+                     const std::string& end) override;
+
+  /// Report the keys, bytes, and evictions of each domain.
+  Status stats(PluginResponse& response) const override;
+
  public:
-  /// Database workflow: open and setup.
-  Status setUp() override {
-    DBType().swap(db_);
-    return Status(0);
-  }
+  /// Database workflow: open and restore a snapshot.
+  Status setUp() override;
+
+  /// Database workflow: save a snapshot and close.
+  void tearDown() override;
+
+ private:
+  /// The quota in bytes for a domain, 0 if the database is not limited.
+  static size_t getQuota(const std::string& domain);
+
+  /// Events and buffered logs evict their oldest keys to fit a quota.
+  static bool isEvictable(const std::string& domain);
+
+  /// Bytes used by every domain sharing a quota with domain.
+  size_t getUsage(const std::string& domain) const;
+
+  /// Store a value within the domain quota, the caller holds the mutex.
+  Status insert(const std::string& domain,
+                const std::string& key,
+                const std::string& value);
+
+  /// Remove a key from a domain, the caller holds the mutex.
+  void erase(EphemeralDomain& domain,
+             std::map<std::string, EphemeralValue>::iterator it);
+
+  /// Write every domain to the snapshot path.
+  void snapshot();
+
+  /// Write a snapshot if the interval has elapsed.
+  void checkSnapshot();
+
+  /// Read the snapshot path into the domains.
+  void restore();
 
  private:
   DBType db_;
+
+  /// The next write order of a put.
+  size_t order_{0};
+
+  /// The time of the last snapshot.
+  size_t snapshot_time_{0};
+
+  /// Calls may come from the event, logger, and scheduler threads.
+  mutable Mutex mutex_;
 };
 
 /// Backing-storage provider for osquery internal/core.
 REGISTER_INTERNAL(EphemeralDatabasePlugin, "database", "ephemeral");
 
+size_t EphemeralDatabasePlugin::getQuota(const std::string& domain) {
+  // Events receive half of the limit, buffered logs receive a quarter, and
+  // the remaining domains share the last quarter.
+  auto limit = static_cast<size_t>(FLAGS_ephemeral_memory_limit) << 20;
+  return (domain == kEvents) ? limit / 2 : limit / 4;
+}
+
+bool EphemeralDatabasePlugin::isEvictable(const std::string& domain) {
+  return (domain == kEvents || domain == kLogs);
+}
+
+size_t EphemeralDatabasePlugin::getUsage(const std::string& domain) const {
+  if (isEvictable(domain)) {
+    return (db_.count(domain) > 0) ? db_.at(domain).bytes : 0;
+  }
+
+  size_t usage = 0;
+  for (const auto& shared : db_) {
+    if (!isEvictable(shared.first)) {
+      usage += shared.second.bytes;
+    }
+  }
+  return usage;
+}
+
+void EphemeralDatabasePlugin::erase(
+    EphemeralDomain& domain,
+    std::map<std::string, EphemeralValue>::iterator it) {
+  domain.bytes -= it->first.size() + it->second.value.size();
+  domain.order.erase(it->second.order);
+  domain.keys.erase(it);
+}
+
+Status EphemeralDatabasePlugin::setUp() {
+  WriteLock lock(mutex_);
+  DBType().swap(db_);
+  order_ = 0;
+  snapshot_time_ = getUnixTime();
+  if (!FLAGS_ephemeral_snapshot_path.empty()) {
+    restore();
+  }
+  return Status(0);
+}
+
+void EphemeralDatabasePlugin::tearDown() {
+  WriteLock lock(mutex_);
+  if (!FLAGS_ephemeral_snapshot_path.empty()) {
+    snapshot();
+  }
+}
+
 Status EphemeralDatabasePlugin::get(const std::string& domain,
                                     const std::string& key,
                                     std::string& value) const {
-  if (db_.count(domain) > 0 && db_.at(domain).count(key) > 0) {
-    value = db_.at(domain).at(key);
+  ReadLock lock(mutex_);
+  if (db_.count(domain) > 0 && db_.at(domain).keys.count(key) > 0) {
+    value = db_.at(domain).keys.at(key).value;
     return Status(0);
   } else {
     return Status(1);
@@ -66,13 +210,63 @@ Status EphemeralDatabasePlugin::get(const std::string& domain,
 Status EphemeralDatabasePlugin::put(const std::string& domain,
                                     const std::string& key,
                                     const std::string& value) {
-  db_[domain][key] = value;
+  WriteLock lock(mutex_);
+  auto status = insert(domain, key, value);
+  if (status.ok()) {
+    checkSnapshot();
+  }
+  return status;
+}
+
+Status EphemeralDatabasePlugin::insert(const std::string& domain,
+                                       const std::string& key,
+                                       const std::string& value) {
+  auto& keys = db_[domain];
+  auto size = key.size() + value.size();
+  auto quota = getQuota(domain);
+  if (quota > 0 && size > quota) {
+    return Status(1, "Value exceeds the ephemeral quota for " + domain);
+  }
+
+  auto it = keys.keys.find(key);
+  auto previous =
+      (it != keys.keys.end()) ? key.size() + it->second.value.size() : 0;
+  if (quota > 0 && getUsage(domain) - previous + size > quota &&
+      !isEvictable(domain)) {
+    return Status(1, "Ephemeral quota exceeded for " + domain);
+  }
+
+  if (it != keys.keys.end()) {
+    erase(keys, it);
+  }
+
+  if (quota > 0 && keys.bytes + size > quota) {
+    // Drop the oldest events or logs until the new value fits.
+    size_t evicted = 0;
+    while (!keys.order.empty() && keys.bytes + size > quota) {
+      erase(keys, keys.keys.find(keys.order.begin()->second));
+      evicted++;
+    }
+    keys.evicted += evicted;
+    VLOG(1) << "Evicted " << evicted << " ephemeral values from " << domain;
+  }
+
+  auto order = order_++;
+  keys.keys[key] = {value, order};
+  keys.order[order] = key;
+  keys.bytes += size;
   return Status(0);
 }
 
 Status EphemeralDatabasePlugin::remove(const std::string& domain,
                                        const std::string& k) {
-  db_[domain].erase(k);
+  WriteLock lock(mutex_);
+  auto& keys = db_[domain];
+  auto it = keys.keys.find(k);
+  if (it != keys.keys.end()) {
+    erase(keys, it);
+  }
+  checkSnapshot();
   return Status(0);
 }
 
@@ -80,21 +274,183 @@ Status EphemeralDatabasePlugin::scan(const std::string& domain,
                                      std::vector<std::string>& results,
                                      const std::string& prefix,
                                      size_t max) const {
+  ReadLock lock(mutex_);
   if (db_.count(domain) == 0) {
     return Status(0);
   }
 
-  for (const auto& key : db_.at(domain)) {
-    if (!prefix.empty() &&
-        !(std::mismatch(prefix.begin(), prefix.end(), key.first.begin())
-              .first == prefix.end())) {
-      continue;
+  const auto& keys = db_.at(domain).keys;
+  for (auto it = keys.lower_bound(prefix); it != keys.end(); ++it) {
+    if (it->first.compare(0, prefix.size(), prefix) != 0) {
+      break;
     }
-    results.push_back(key.first);
+    results.push_back(it->first);
     if (max > 0 && results.size() >= max) {
       break;
     }
   }
   return Status(0);
 }
+
+Status EphemeralDatabasePlugin::scanRange(const std::string& domain,
+                                          const std::string& begin,
+                                          const std::string& end,
+                                          DatabaseKeyValues& results,
+                                          size_t max,
+                                          bool reverse) const {
+  ReadLock lock(mutex_);
+  if (db_.count(domain) == 0) {
+    return Status(0);
+  }
+
+  const auto& keys = db_.at(domain).keys;
+  if (reverse) {
+    auto first = keys.lower_bound(begin);
+    auto it = (end.empty()) ? keys.end() : keys.lower_bound(end);
+    while (it != first) {
+      --it;
+      results.push_back(std::make_pair(it->first, it->second.value));
+      if (max > 0 && results.size() >= max) {
+        break;
+      }
+    }
+    return Status(0);
+  }
+
+  for (auto it = keys.lower_bound(begin); it != keys.end(); ++it) {
+    if (!end.empty() && it->first >= end) {
+      break;
+    }
+    results.push_back(std::make_pair(it->first, it->second.value));
+    if (max > 0 && results.size() >= max) {
+      break;
+    }
+  }
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::removeRange(const std::string& domain,
+                                            const std::string& begin,
+                                            const std::string& end) {
+  WriteLock lock(mutex_);
+  auto& keys = db_[domain];
+  auto last = (end.empty()) ? keys.keys.end() : keys.keys.lower_bound(end);
+  for (auto it = keys.keys.lower_bound(begin); it != last;) {
+    erase(keys, it++);
+  }
+  checkSnapshot();
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::stats(PluginResponse& response) const {
+  ReadLock lock(mutex_);
+  for (const auto& domain : kDomains) {
+    PluginResponse::value_type row = {{"domain", domain}};
+    auto it = db_.find(domain);
+    auto keys = (it != db_.end()) ? it->second.keys.size() : 0;
+    auto bytes = (it != db_.end()) ? it->second.bytes : 0;
+    auto evicted = (it != db_.end()) ? it->second.evicted : 0;
+    row["keys"] = std::to_string(keys);
+    row["memtable_bytes"] = std::to_string(bytes);
+    row["evicted"] = std::to_string(evicted);
+    response.push_back(std::move(row));
+  }
+  return Status(0, "OK");
+}
+
+/// Append a length-prefixed field to a snapshot.
+static inline void appendField(std::string& snapshot,
+                               const std::string& field) {
+  snapshot += std::to_string(field.size()) + ":" + field;
+}
+
+/// Read a length-prefixed field from a snapshot at an offset.
+static bool readField(const std::string& snapshot,
+                      size_t& offset,
+                      std::string& field) {
+  auto delimiter = snapshot.find(':', offset);
+  if (delimiter == std::string::npos) {
+    return false;
+  }
+
+  unsigned long int size = 0;
+  auto length = snapshot.substr(offset, delimiter - offset);
+  if (!safeStrtoul(length, 10, size) ||
+      size > snapshot.size() - delimiter - 1) {
+    return false;
+  }
+  field = snapshot.substr(delimiter + 1, size);
+  offset = delimiter + 1 + size;
+  return true;
+}
+
+void EphemeralDatabasePlugin::snapshot() {
+  snapshot_time_ = getUnixTime();
+
+  // Each domain's keys are written in write order, restoring them with puts
+  // keeps the oldest-first eviction order.
+  std::string content;
+  for (const auto& domain : db_) {
+    for (const auto& order : domain.second.order) {
+      appendField(content, domain.first);
+      appendField(content, order.second);
+      appendField(content, domain.second.keys.at(order.second).value);
+    }
+  }
+
+  // Replace the snapshot only after the complete content is written.
+  auto path = fs::path(FLAGS_ephemeral_snapshot_path);
+  auto temporary = fs::path(FLAGS_ephemeral_snapshot_path + ".tmp");
+  auto status = writeTextFile(temporary, content, 0600, true);
+  if (!status.ok()) {
+    LOG(WARNING) << "Cannot write ephemeral database snapshot: "
+                 << status.getMessage();
+    return;
+  }
+
+  boost::system::error_code ec;
+  fs::rename(temporary, path, ec);
+  if (ec) {
+    LOG(WARNING) << "Cannot replace ephemeral database snapshot: "
+                 << ec.message();
+  }
+}
+
+void EphemeralDatabasePlugin::checkSnapshot() {
+  if (FLAGS_ephemeral_snapshot_path.empty() ||
+      FLAGS_ephemeral_snapshot_interval == 0) {
+    return;
+  }
+
+  if (getUnixTime() - snapshot_time_ >= FLAGS_ephemeral_snapshot_interval) {
+    snapshot();
+  }
+}
+
+void EphemeralDatabasePlugin::restore() {
+  std::string content;
+  if (!pathExists(FLAGS_ephemeral_snapshot_path).ok() ||
+      !readFile(FLAGS_ephemeral_snapshot_path, content).ok()) {
+    return;
+  }
+
+  size_t offset = 0;
+  size_t count = 0;
+  std::string domain, key, value;
+  while (offset < content.size()) {
+    if (!readField(content, offset, domain) ||
+        !readField(content, offset, key) ||
+        !readField(content, offset, value)) {
+      LOG(WARNING) << "Ephemeral database snapshot is truncated";
+      break;
+    }
+
+    // Apply quotas, a snapshot may be restored with a lower limit.
+    if (!insert(domain, key, value).ok()) {
+      continue;
+    }
+    count++;
+  }
+  VLOG(1) << "Restored " << count << " ephemeral database values";
+}
 }
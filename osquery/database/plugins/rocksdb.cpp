@@ -14,12 +14,19 @@
 
 #include <snappy.h>
 
+#include <rocksdb/cache.h>
 #include <rocksdb/db.h>
 #include <rocksdb/env.h>
+#include <rocksdb/filter_policy.h>
 #include <rocksdb/options.h>
+#include <rocksdb/statistics.h>
+#include <rocksdb/table.h>
+#include <rocksdb/version.h>
+#include <rocksdb/write_batch.h>
 
 #include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/filesystem/fileops.h"
@@ -28,6 +35,24 @@ namespace osquery {
 
 DECLARE_string(database_path);
 
+FLAG(bool,
+     rocksdb_domain_profiles,
+     true,
+     "Tune RocksDB options for the workload of each database domain");
+
+FLAG(uint64,
+     rocksdb_block_cache,
+     8,
+     "Megabytes of RocksDB block cache shared by every database domain");
+
+FLAG(bool,
+     rocksdb_statistics,
+     false,
+     "Collect RocksDB latency and compaction statistics");
+
+/// Bits per key for the bloom filters of domains using point lookups.
+const int kRocksDBBloomBits = 10;
+
 class GlogRocksDBLogger : public rocksdb::Logger {
  public:
   // We intend to override a virtual method that is overloaded.
@@ -47,15 +72,42 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
              const std::string& key,
              const std::string& value) override;
 
+  /// Batched data storage method.
+  Status putBatch(const std::string& domain,
+                  const DatabaseKeyValues& data) override;
+
   /// Data removal method.
   Status remove(const std::string& domain, const std::string& k) override;
 
+  /// Batched data removal method.
+  Status removeBatch(const std::string& domain,
+                     const std::vector<std::string>& keys) override;
+
   /// Key/index lookup method.
   Status scan(const std::string& domain,
               std::vector<std::string>& results,
               const std::string& prefix,
               size_t max = 0) const override;
 
+  /// Ordered key range lookup method.
+  Status scanRange(const std::string& domain,
+                   const std::string& begin,
+                   const std::string& end,
+                   DatabaseKeyValues& results,
+                   size_t max = 0,
+                   bool reverse = false) const override;
+
+  /// Ordered key range removal method.
+  Status removeRange(const std::string& domain,
+                     const std::string& begin,
+                     const std::string& end) override;
+
+  /// Column family properties and optional database statistics.
+  Status stats(PluginResponse& response) const override;
+
+  /// Flush the memtables, keeping the block cache and handles.
+  Status releaseMemory() override;
+
  public:
   /// Database workflow: open and setup.
   Status setUp() override;
@@ -96,6 +148,9 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
    */
   void repairDB();
 
+  /// Create the column family descriptors, with each domain's profile.
+  void setColumnFamilies(bool profiles);
+
  private:
   bool initialized_{false};
 
@@ -114,6 +169,9 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
   /// The RocksDB connection options that are used to connect to RocksDB
   rocksdb::Options options_;
 
+  /// The block cache shared by every column family's table reader.
+  std::shared_ptr<rocksdb::Cache> block_cache_{nullptr};
+
   /// Deconstruction mutex.
   Mutex close_mutex_;
 };
@@ -181,15 +239,15 @@ Status RocksDBDatabasePlugin::setUp() {
     }
     options_.info_log = logger_;
 
-    column_families_.push_back(rocksdb::ColumnFamilyDescriptor(
-        rocksdb::kDefaultColumnFamilyName, options_));
-
-    for (const auto& cf_name : kDomains) {
-      column_families_.push_back(
-          rocksdb::ColumnFamilyDescriptor(cf_name, options_));
+    // Statistics add a small cost to every operation.
+    if (FLAGS_rocksdb_statistics) {
+      options_.statistics = rocksdb::CreateDBStatistics();
     }
   }
 
+  // Profiles may be changed before a reset.
+  setColumnFamilies(FLAGS_rocksdb_domain_profiles);
+
   // Consume the current settings.
   // A configuration update may change them, but that does not affect state.
   path_ = fs::path(FLAGS_database_path).make_preferred().string();
@@ -209,6 +267,13 @@ Status RocksDBDatabasePlugin::setUp() {
   auto s =
       rocksdb::DB::Open(options_, path_, column_families_, &handles_, &db_);
 
+  if (s.IsInvalidArgument() && FLAGS_rocksdb_domain_profiles) {
+    // A RocksDB build without LZ4 rejects the profiles' compression.
+    LOG(WARNING) << "RocksDB rejected domain profiles: " << s.ToString();
+    setColumnFamilies(false);
+    s = rocksdb::DB::Open(options_, path_, column_families_, &handles_, &db_);
+  }
+
   if (s.IsCorruption()) {
     // The database is corrupt - try to repair it
     repairDB();
@@ -248,7 +313,12 @@ Status RocksDBDatabasePlugin::setUp() {
 
 void RocksDBDatabasePlugin::close() {
   WriteLock lock(close_mutex_);
+  auto events = getHandleForColumnFamily(kEvents);
   for (auto handle : handles_) {
+    if (db_ != nullptr && !read_only_ && handle == events) {
+      // Event batches skip the write-ahead log, persist them before closing.
+      db_->Flush(rocksdb::FlushOptions(), handle);
+    }
     delete handle;
   }
   handles_.clear();
@@ -274,6 +344,118 @@ void RocksDBDatabasePlugin::repairDB() {
   }
 }
 
+void RocksDBDatabasePlugin::setColumnFamilies(bool profiles) {
+  column_families_.clear();
+  column_families_.push_back(rocksdb::ColumnFamilyDescriptor(
+      rocksdb::kDefaultColumnFamilyName, options_));
+
+  for (const auto& cf_name : kDomains) {
+    column_families_.push_back(
+        rocksdb::ColumnFamilyDescriptor(cf_name, options_));
+  }
+
+  if (!profiles) {
+    return;
+  }
+
+  // Every table reader shares one block cache budget, rather than the 8MB
+  // cache RocksDB would create for each column family.
+  if (block_cache_ == nullptr) {
+    block_cache_ = rocksdb::NewLRUCache(
+        static_cast<size_t>(FLAGS_rocksdb_block_cache) * 1024 * 1024);
+  }
+
+  // getHandleForColumnFamily uses the handle at the domain's index in
+  // kDomains, so a domain's profile applies to the descriptor at that index.
+  for (size_t i = 0; i < kDomains.size(); i++) {
+    const auto& domain = kDomains[i];
+    auto& options = column_families_[i].options;
+
+    rocksdb::BlockBasedTableOptions table_options;
+    table_options.block_cache = block_cache_;
+
+    if (domain == kEvents || domain == kQueries) {
+      // Events and query results are read with point lookups of indexes and
+      // previous results. Use whole-key filters since prefix filters would
+      // hide keys from the range scans crossing prefixes.
+      table_options.filter_policy.reset(
+          rocksdb::NewBloomFilterPolicy(kRocksDBBloomBits, false));
+
+      // Compress flushed data on levels beyond the first.
+      options.compression_per_level.assign(options.num_levels,
+                                           rocksdb::kLZ4Compression);
+      options.compression_per_level[0] = rocksdb::kNoCompression;
+    }
+
+    if (domain == kQueries) {
+      // Results are overwritten each interval, absorb them in memory.
+      options.write_buffer_size *= 2;
+    } else if (domain == kLogs) {
+      // Buffered logs are a queue: most lines are removed before a flush,
+      // and tombstones are compacted early to keep scans from the head fast.
+      options.write_buffer_size *= 4;
+      options.level0_file_num_compaction_trigger = 2;
+    }
+
+    options.table_factory.reset(
+        rocksdb::NewBlockBasedTableFactory(table_options));
+  }
+}
+
+Status RocksDBDatabasePlugin::stats(PluginResponse& response) const {
+  auto db = getDB();
+  if (db == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  // Statistics are collected for the whole database, not each domain.
+  std::map<std::string, std::string> totals;
+  if (options_.statistics != nullptr) {
+    const auto& statistics = options_.statistics;
+    totals["bytes_written"] =
+        std::to_string(statistics->getTickerCount(rocksdb::BYTES_WRITTEN));
+    totals["compaction_bytes_written"] = std::to_string(
+        statistics->getTickerCount(rocksdb::COMPACT_WRITE_BYTES));
+    totals["stall_micros"] =
+        std::to_string(statistics->getTickerCount(rocksdb::STALL_MICROS));
+
+    rocksdb::HistogramData latency;
+    statistics->histogramData(rocksdb::DB_GET, &latency);
+    totals["get_p50"] = std::to_string(static_cast<size_t>(latency.median));
+    totals["get_p99"] =
+        std::to_string(static_cast<size_t>(latency.percentile99));
+    statistics->histogramData(rocksdb::DB_WRITE, &latency);
+    totals["write_p50"] = std::to_string(static_cast<size_t>(latency.median));
+    totals["write_p99"] =
+        std::to_string(static_cast<size_t>(latency.percentile99));
+  }
+
+  const std::map<std::string, std::string> properties = {
+      {"size", "rocksdb.total-sst-files-size"},
+      {"memtable_bytes", "rocksdb.cur-size-all-mem-tables"},
+      {"pending_compaction_bytes", "rocksdb.estimate-pending-compaction-bytes"},
+      {"keys", "rocksdb.estimate-num-keys"},
+  };
+
+  for (const auto& domain : kDomains) {
+    auto cfh = getHandleForColumnFamily(domain);
+    if (cfh == nullptr) {
+      continue;
+    }
+
+    auto row = totals;
+    row["domain"] = domain;
+    for (const auto& property : properties) {
+      uint64_t value = 0;
+      if (db->GetIntProperty(cfh, property.second, &value)) {
+        row[property.first] = std::to_string(value);
+      }
+    }
+    response.push_back(std::move(row));
+  }
+  return Status(0);
+}
+
 rocksdb::DB* RocksDBDatabasePlugin::getDB() const {
   return db_;
 }
@@ -292,6 +474,26 @@ rocksdb::ColumnFamilyHandle* RocksDBDatabasePlugin::getHandleForColumnFamily(
   return nullptr;
 }
 
+Status RocksDBDatabasePlugin::releaseMemory() {
+  auto db = getDB();
+  if (db == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  if (read_only_) {
+    return Status(0, "Read only");
+  }
+
+  // Flushed memtables release their arenas, reads then use the block cache.
+  for (auto handle : handles_) {
+    auto s = db->Flush(rocksdb::FlushOptions(), handle);
+    if (!s.ok()) {
+      return Status(s.code(), s.ToString());
+    }
+  }
+  return Status(0, "OK");
+}
+
 Status RocksDBDatabasePlugin::get(const std::string& domain,
                                   const std::string& key,
                                   std::string& value) const {
@@ -372,22 +574,201 @@ Status RocksDBDatabasePlugin::scan(const std::string& domain,
   auto options = rocksdb::ReadOptions();
   options.verify_checksums = false;
   options.fill_cache = false;
+
+  // Bound the iterator so it does not step into the keys after the prefix.
+  auto end = getDatabasePrefixEnd(prefix);
+  rocksdb::Slice upper_bound(end);
+  if (!end.empty()) {
+    options.iterate_upper_bound = &upper_bound;
+  }
   auto it = getDB()->NewIterator(options, cfh);
   if (it == nullptr) {
     return Status(1, "Could not get iterator for " + domain);
   }
 
+  // Keys are ordered, seek to the prefix and stop after the last match.
   size_t count = 0;
-  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+  for (it->Seek(prefix); it->Valid(); it->Next()) {
     auto key = it->key().ToString();
-    if (key.find(prefix) == 0) {
-      results.push_back(std::move(key));
+    if (key.compare(0, prefix.size(), prefix) != 0) {
+      break;
+    }
+    results.push_back(std::move(key));
+    if (max > 0 && ++count >= max) {
+      break;
+    }
+  }
+  delete it;
+  return Status(0, "OK");
+}
+
+Status RocksDBDatabasePlugin::scanRange(const std::string& domain,
+                                        const std::string& begin,
+                                        const std::string& end,
+                                        DatabaseKeyValues& results,
+                                        size_t max,
+                                        bool reverse) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+  // Range scans read buffered logs and events once, keep them from evicting
+  // the blocks of point lookups from the shared cache.
+  auto options = rocksdb::ReadOptions();
+  options.verify_checksums = false;
+  options.fill_cache = false;
+
+  // The upper bound lets the iterator skip tombstones past the range.
+  rocksdb::Slice upper_bound(end);
+  if (!end.empty() && !reverse) {
+    options.iterate_upper_bound = &upper_bound;
+  }
+  auto it = getDB()->NewIterator(options, cfh);
+  if (it == nullptr) {
+    return Status(1, "Could not get iterator for " + domain);
+  }
+
+  size_t count = 0;
+  if (reverse) {
+    // The end is exclusive, the last key of the range precedes it.
+    if (end.empty()) {
+      it->SeekToLast();
+    } else {
+      it->Seek(end);
+      if (it->Valid()) {
+        it->Prev();
+      } else {
+        it->SeekToLast();
+      }
+    }
+    for (; it->Valid(); it->Prev()) {
+      auto key = it->key();
+      if (!end.empty() && key.compare(end) >= 0) {
+        continue;
+      }
+      if (key.compare(begin) < 0) {
+        break;
+      }
+      results.push_back(
+          std::make_pair(key.ToString(), it->value().ToString()));
       if (max > 0 && ++count >= max) {
         break;
       }
     }
+    delete it;
+    return Status(0, "OK");
+  }
+
+  for (it->Seek(begin); it->Valid(); it->Next()) {
+    auto key = it->key();
+    if (!end.empty() && key.compare(end) >= 0) {
+      break;
+    }
+    results.push_back(std::make_pair(key.ToString(), it->value().ToString()));
+    if (max > 0 && ++count >= max) {
+      break;
+    }
   }
   delete it;
   return Status(0, "OK");
 }
+
+Status RocksDBDatabasePlugin::removeRange(const std::string& domain,
+                                          const std::string& begin,
+                                          const std::string& end) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+  auto options = rocksdb::WriteOptions();
+  if (kEvents != domain) {
+    options.sync = true;
+  }
+
+#if ROCKSDB_MAJOR >= 5
+  if (!end.empty()) {
+    auto s = getDB()->DeleteRange(options, cfh, begin, end);
+    return Status(s.code(), s.ToString());
+  }
+#endif
+
+  // Without DeleteRange, delete the range's keys using a single write.
+  auto it = getDB()->NewIterator(rocksdb::ReadOptions(), cfh);
+  if (it == nullptr) {
+    return Status(1, "Could not get iterator for " + domain);
+  }
+
+  rocksdb::WriteBatch batch;
+  for (it->Seek(begin); it->Valid(); it->Next()) {
+    if (!end.empty() && it->key().compare(end) >= 0) {
+      break;
+    }
+    batch.Delete(cfh, it->key());
+  }
+  delete it;
+
+  auto s = getDB()->Write(options, &batch);
+  return Status(s.code(), s.ToString());
+}
+
+Status RocksDBDatabasePlugin::removeBatch(
+    const std::string& domain, const std::vector<std::string>& keys) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+  auto options = rocksdb::WriteOptions();
+  if (kEvents != domain) {
+    options.sync = true;
+  }
+
+  rocksdb::WriteBatch batch;
+  for (const auto& key : keys) {
+    batch.Delete(cfh, key);
+  }
+
+  auto s = getDB()->Write(options, &batch);
+  return Status(s.code(), s.ToString());
+}
+
+Status RocksDBDatabasePlugin::putBatch(const std::string& domain,
+                                       const DatabaseKeyValues& data) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  auto options = rocksdb::WriteOptions();
+  if (kEvents != domain) {
+    options.sync = true;
+  } else {
+    // Event batches are frequent and may be lost on a crash, like buffered
+    // events, so they do not write to the write-ahead log.
+    options.disableWAL = true;
+  }
+
+  rocksdb::WriteBatch batch;
+  for (const auto& item : data) {
+    batch.Put(cfh, item.first, item.second);
+  }
+
+  auto s = getDB()->Write(options, &batch);
+  return Status(s.code(), s.ToString());
+}
 }
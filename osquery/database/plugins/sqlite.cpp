@@ -8,6 +8,8 @@
  *
  */
 
+#include <array>
+#include <map>
 #include <mutex>
 
 #include <sqlite3.h>
@@ -17,6 +19,7 @@
 #include <osquery/database.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
 
 #include "osquery/filesystem/fileops.h"
 
@@ -24,6 +27,11 @@ namespace osquery {
 
 DECLARE_string(database_path);
 
+FLAG(bool,
+     sqlite_database_wal,
+     false,
+     "Use write-ahead logging in the SQLite database plugin");
+
 const std::map<std::string, std::string> kDBSettings = {
     {"synchronous", "OFF"},
     {"count_changes", "OFF"},
@@ -34,6 +42,93 @@ const std::map<std::string, std::string> kDBSettings = {
     {"page_count", "1000"},
 };
 
+/// Seconds between checks of the database fragmentation.
+const size_t kSQLiteVacuumInterval = 600;
+
+/// The statements prepared for each domain, the FROM forms have no end key.
+enum SQLiteStatement {
+  SQLITE_STMT_GET = 0,
+  SQLITE_STMT_PUT,
+  SQLITE_STMT_REMOVE,
+  SQLITE_STMT_SCAN,
+  SQLITE_STMT_SCAN_FROM,
+  SQLITE_STMT_SCAN_RANGE,
+  SQLITE_STMT_SCAN_RANGE_FROM,
+  SQLITE_STMT_SCAN_RANGE_REVERSE,
+  SQLITE_STMT_SCAN_RANGE_FROM_REVERSE,
+  SQLITE_STMT_REMOVE_RANGE,
+  SQLITE_STMT_REMOVE_RANGE_FROM,
+  SQLITE_STMT_COUNT,
+};
+
+/// The cached statements of a domain, prepared on first use.
+using SQLiteStatements = std::array<sqlite3_stmt*, SQLITE_STMT_COUNT>;
+
+/// The SQL of each statement, keys bind to ?1 and ?2 and limits to ?3.
+static std::string getStatementSQL(SQLiteStatement kind,
+                                   const std::string& domain) {
+  // TEXT keys use the BINARY collation, a bytewise comparison.
+  switch (kind) {
+  case SQLITE_STMT_GET:
+    return "select value from " + domain + " where key = ?1;";
+  case SQLITE_STMT_PUT:
+    return "insert or replace into " + domain + " values (?1, ?2);";
+  case SQLITE_STMT_REMOVE:
+    return "delete from " + domain + " where key = ?1;";
+  case SQLITE_STMT_SCAN:
+    return "select key from " + domain +
+           " where key >= ?1 and key < ?2 order by key limit ?3;";
+  case SQLITE_STMT_SCAN_FROM:
+    return "select key from " + domain +
+           " where key >= ?1 order by key limit ?3;";
+  case SQLITE_STMT_SCAN_RANGE:
+    return "select key, value from " + domain +
+           " where key >= ?1 and key < ?2 order by key limit ?3;";
+  case SQLITE_STMT_SCAN_RANGE_FROM:
+    return "select key, value from " + domain +
+           " where key >= ?1 order by key limit ?3;";
+  case SQLITE_STMT_SCAN_RANGE_REVERSE:
+    return "select key, value from " + domain +
+           " where key >= ?1 and key < ?2 order by key desc limit ?3;";
+  case SQLITE_STMT_SCAN_RANGE_FROM_REVERSE:
+    return "select key, value from " + domain +
+           " where key >= ?1 order by key desc limit ?3;";
+  case SQLITE_STMT_REMOVE_RANGE:
+    return "delete from " + domain + " where key >= ?1 and key < ?2;";
+  case SQLITE_STMT_REMOVE_RANGE_FROM:
+    return "delete from " + domain + " where key >= ?1;";
+  default:
+    return "";
+  }
+}
+
+/// The first key following every key with a prefix, empty if unbounded.
+static std::string getPrefixEnd(std::string prefix) {
+  while (!prefix.empty()) {
+    auto last = static_cast<unsigned char>(prefix.back());
+    if (last != 0xff) {
+      prefix.back() = static_cast<char>(last + 1);
+      return prefix;
+    }
+    prefix.pop_back();
+  }
+  return prefix;
+}
+
+/// Reset a cached statement and release its bindings once it is used.
+class SQLiteStatementReset : private boost::noncopyable {
+ public:
+  explicit SQLiteStatementReset(sqlite3_stmt* stmt) : stmt_(stmt) {}
+
+  ~SQLiteStatementReset() {
+    sqlite3_reset(stmt_);
+    sqlite3_clear_bindings(stmt_);
+  }
+
+ private:
+  sqlite3_stmt* stmt_{nullptr};
+};
+
 class SQLiteDatabasePlugin : public DatabasePlugin {
  public:
   /// Data retrieval method.
@@ -46,15 +141,39 @@ class SQLiteDatabasePlugin : public DatabasePlugin {
              const std::string& key,
              const std::string& value) override;
 
+  /// Batched data storage method.
+  Status putBatch(const std::string& domain,
+                  const DatabaseKeyValues& data) override;
+
   /// Data removal method.
   Status remove(const std::string& domain, const std::string& k) override;
 
+  /// Batched data removal method.
+  Status removeBatch(const std::string& domain,
+                     const std::vector<std::string>& keys) override;
+
   /// Key/index lookup method.
   Status scan(const std::string& domain,
               std::vector<std::string>& results,
               const std::string& prefix,
               size_t max = 0) const override;
 
+  /// Ordered key range lookup method.
+  Status scanRange(const std::string& domain,
+                   const std::string& begin,
+                   const std::string& end,
+                   DatabaseKeyValues& results,
+                   size_t max = 0,
+                   bool reverse = false) const override;
+
+  /// Ordered key range removal method.
+  Status removeRange(const std::string& domain,
+                     const std::string& begin,
+                     const std::string& end) override;
+
+  /// Release the page cache, keeping the prepared statements.
+  Status releaseMemory() override;
+
  public:
   /// Database workflow: open and setup.
   Status setUp() override;
@@ -72,12 +191,43 @@ class SQLiteDatabasePlugin : public DatabasePlugin {
  private:
   void close();
 
+  /**
+   * @brief Get the cached statement of a domain, preparing it if needed.
+   *
+   * The statement lock must be held while the statement is used.
+   *
+   * @return nullptr if the domain does not exist.
+   */
+  sqlite3_stmt* getStatement(const std::string& domain,
+                             SQLiteStatement kind) const;
+
+  /// Step a key or key and value statement, then reset it.
+  Status writeStatement(sqlite3_stmt* stmt,
+                        const std::string& key,
+                        const std::string* value = nullptr);
+
+  /// Run the keys and values of a batch in one transaction.
+  template <typename T, typename F>
+  Status writeBatch(sqlite3_stmt* stmt, const T& items, F write);
+
+  /// Vacuum the database if it is fragmented, checked at an interval.
+  void tryVacuum();
+
  private:
   /// The long-lived sqlite3 database.
   sqlite3* db_{nullptr};
 
   /// Deconstruction mutex.
   Mutex close_mutex_;
+
+  /// Prepared statements for each domain.
+  mutable std::map<std::string, SQLiteStatements> statements_;
+
+  /// Cached statements are stepped and reset by one caller at a time.
+  mutable Mutex statement_mutex_;
+
+  /// The time of the last fragmentation check.
+  size_t last_vacuum_{0};
 };
 
 /// Backing-storage provider for osquery internal/core.
@@ -135,9 +285,14 @@ Status SQLiteDatabasePlugin::setUp() {
       }
     }
 
+    // Write-ahead logging lets readers continue while values are written.
     std::string settings;
     for (const auto& setting : kDBSettings) {
-      settings += "PRAGMA " + setting.first + "=" + setting.second + "; ";
+      auto value = setting.second;
+      if (setting.first == "journal_mode" && FLAGS_sqlite_database_wal) {
+        value = "WAL";
+      }
+      settings += "PRAGMA " + setting.first + "=" + value + "; ";
     }
     sqlite3_exec(db_, settings.c_str(), nullptr, nullptr, nullptr);
   }
@@ -147,17 +302,48 @@ Status SQLiteDatabasePlugin::setUp() {
     close();
     return Status(1, "Cannot set permissions on database path: " + path_);
   }
+  last_vacuum_ = getUnixTime();
   return Status(0);
 }
 
 void SQLiteDatabasePlugin::close() {
   WriteLock lock(close_mutex_);
+  {
+    WriteLock statement_lock(statement_mutex_);
+    for (auto& statements : statements_) {
+      for (auto& stmt : statements.second) {
+        if (stmt != nullptr) {
+          sqlite3_finalize(stmt);
+        }
+      }
+    }
+    statements_.clear();
+  }
+
   if (db_ != nullptr) {
     sqlite3_close(db_);
     db_ = nullptr;
   }
 }
 
+sqlite3_stmt* SQLiteDatabasePlugin::getStatement(const std::string& domain,
+                                                 SQLiteStatement kind) const {
+  if (db_ == nullptr) {
+    return nullptr;
+  }
+
+  // A domain's array is value-initialized to empty statements.
+  auto& stmt = statements_[domain][kind];
+  if (stmt == nullptr) {
+    auto q = getStatementSQL(kind, domain);
+    if (sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+      sqlite3_finalize(stmt);
+      stmt = nullptr;
+    }
+  }
+  return stmt;
+}
+
 static int getData(void* argument, int argc, char* argv[], char* column[]) {
   if (argument == nullptr) {
     return SQLITE_MISUSE;
@@ -174,26 +360,50 @@ static int getData(void* argument, int argc, char* argv[], char* column[]) {
   return 0;
 }
 
+/// Read a value column, which may contain binary-serialized content.
+static std::string getColumnValue(sqlite3_stmt* stmt, int column) {
+  auto data = static_cast<const char*>(sqlite3_column_blob(stmt, column));
+  auto size = static_cast<size_t>(sqlite3_column_bytes(stmt, column));
+  return (data != nullptr) ? std::string(data, size) : "";
+}
+
 Status SQLiteDatabasePlugin::get(const std::string& domain,
                                  const std::string& key,
                                  std::string& value) const {
-  QueryData results;
-  char* err = nullptr;
-  std::string q = "select value from " + domain + " where key = '" + key + "';";
-  sqlite3_exec(db_, q.c_str(), getData, &results, &err);
-  if (err != nullptr) {
-    sqlite3_free(err);
+  WriteLock lock(statement_mutex_);
+  auto stmt = getStatement(domain, SQLITE_STMT_GET);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot read domain: " + domain);
   }
 
+  SQLiteStatementReset reset(stmt);
+  sqlite3_bind_text(
+      stmt, 1, key.data(), static_cast<int>(key.size()), SQLITE_STATIC);
+
   // Only assign value if the query found a result.
-  if (results.size() > 0) {
-    value = std::move(results[0]["value"]);
-    return Status(0);
+  if (sqlite3_step(stmt) != SQLITE_ROW) {
+    return Status(1);
+  }
+  value = getColumnValue(stmt, 0);
+  return Status(0);
+}
+
+Status SQLiteDatabasePlugin::releaseMemory() {
+  WriteLock lock(statement_mutex_);
+  if (db_ == nullptr) {
+    return Status(1, "Database not opened");
   }
-  return Status(1);
+  sqlite3_db_release_memory(db_);
+  return Status(0, "OK");
 }
 
-static void tryVacuum(sqlite3* db) {
+void SQLiteDatabasePlugin::tryVacuum() {
+  auto now = getUnixTime();
+  if (now < last_vacuum_ + kSQLiteVacuumInterval) {
+    return;
+  }
+  last_vacuum_ = now;
+
   std::string q =
       "SELECT (sum(s1.pageno + 1 == s2.pageno) * 1.0 / count(*)) < 0.01 as v "
       " FROM "
@@ -202,12 +412,57 @@ static void tryVacuum(sqlite3* db) {
       "s1.rowid + 1 = s2.rowid; ";
 
   QueryData results;
-  sqlite3_exec(db, q.c_str(), getData, &results, nullptr);
+  sqlite3_exec(db_, q.c_str(), getData, &results, nullptr);
   if (results.size() > 0 && results[0]["v"].back() == '1') {
-    sqlite3_exec(db, "vacuum;", nullptr, nullptr, nullptr);
+    sqlite3_exec(db_, "vacuum;", nullptr, nullptr, nullptr);
   }
 }
 
+Status SQLiteDatabasePlugin::writeStatement(sqlite3_stmt* stmt,
+                                            const std::string& key,
+                                            const std::string* value) {
+  SQLiteStatementReset reset(stmt);
+  sqlite3_bind_text(
+      stmt, 1, key.data(), static_cast<int>(key.size()), SQLITE_STATIC);
+  if (value != nullptr) {
+    sqlite3_bind_text(stmt,
+                      2,
+                      value->data(),
+                      static_cast<int>(value->size()),
+                      SQLITE_STATIC);
+  }
+  return Status((sqlite3_step(stmt) == SQLITE_DONE) ? 0 : 1);
+}
+
+template <typename T, typename F>
+Status SQLiteDatabasePlugin::writeBatch(sqlite3_stmt* stmt,
+                                        const T& items,
+                                        F write) {
+  // If a transaction is already in progress the writes join it.
+  bool transaction = false;
+  if (sqlite3_get_autocommit(db_) != 0) {
+    transaction =
+        (sqlite3_exec(db_, "begin;", nullptr, nullptr, nullptr) == SQLITE_OK);
+  }
+
+  Status status(0);
+  for (const auto& item : items) {
+    status = write(stmt, item);
+    if (!status.ok()) {
+      break;
+    }
+  }
+
+  if (transaction) {
+    sqlite3_exec(db_,
+                 (status.ok()) ? "commit;" : "rollback;",
+                 nullptr,
+                 nullptr,
+                 nullptr);
+  }
+  return status;
+}
+
 Status SQLiteDatabasePlugin::put(const std::string& domain,
                                  const std::string& key,
                                  const std::string& value) {
@@ -215,22 +470,37 @@ Status SQLiteDatabasePlugin::put(const std::string& domain,
     return Status(0, "Database in readonly mode");
   }
 
-  sqlite3_stmt* stmt = nullptr;
-  std::string q = "insert or replace into " + domain + " values (?1, ?2);";
-  sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr);
+  WriteLock lock(statement_mutex_);
+  auto stmt = getStatement(domain, SQLITE_STMT_PUT);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot write domain: " + domain);
+  }
 
-  sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
-  sqlite3_bind_text(stmt, 2, value.c_str(), -1, SQLITE_STATIC);
-  auto rc = sqlite3_step(stmt);
-  if (rc != SQLITE_DONE) {
-    return Status(1);
+  auto status = writeStatement(stmt, key, &value);
+  tryVacuum();
+  return status;
+}
+
+Status SQLiteDatabasePlugin::putBatch(const std::string& domain,
+                                      const DatabaseKeyValues& data) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
   }
 
-  sqlite3_finalize(stmt);
-  if (rand() % 10 == 0) {
-    tryVacuum(db_);
+  // Reuse a single statement and commit every value in one transaction.
+  WriteLock lock(statement_mutex_);
+  auto stmt = getStatement(domain, SQLITE_STMT_PUT);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot write domain: " + domain);
   }
-  return Status(0);
+
+  return writeBatch(
+      stmt,
+      data,
+      [this](sqlite3_stmt* put,
+             const std::pair<std::string, std::string>& item) {
+        return writeStatement(put, item.first, &item.second);
+      });
 }
 
 Status SQLiteDatabasePlugin::remove(const std::string& domain,
@@ -239,45 +509,124 @@ Status SQLiteDatabasePlugin::remove(const std::string& domain,
     return Status(0, "Database in readonly mode");
   }
 
-  sqlite3_stmt* stmt = nullptr;
-  std::string q = "delete from " + domain + " where key IN (?1);";
-  sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr);
+  WriteLock lock(statement_mutex_);
+  auto stmt = getStatement(domain, SQLITE_STMT_REMOVE);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot write domain: " + domain);
+  }
 
-  sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
-  auto rc = sqlite3_step(stmt);
-  if (rc != SQLITE_DONE) {
-    return Status(1);
+  auto status = writeStatement(stmt, key);
+  tryVacuum();
+  return status;
+}
+
+Status SQLiteDatabasePlugin::removeBatch(
+    const std::string& domain, const std::vector<std::string>& keys) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
   }
 
-  sqlite3_finalize(stmt);
-  if (rand() % 10 == 0) {
-    tryVacuum(db_);
+  // Reuse a single statement and remove every key in one transaction.
+  WriteLock lock(statement_mutex_);
+  auto stmt = getStatement(domain, SQLITE_STMT_REMOVE);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot write domain: " + domain);
   }
-  return Status(0);
+
+  return writeBatch(
+      stmt, keys, [this](sqlite3_stmt* remove, const std::string& key) {
+        return writeStatement(remove, key);
+      });
 }
 
 Status SQLiteDatabasePlugin::scan(const std::string& domain,
                                   std::vector<std::string>& results,
                                   const std::string& prefix,
                                   size_t max) const {
-  QueryData _results;
-  char* err = nullptr;
+  // A prefix is the range of keys up to the prefix's successor.
+  auto end = getPrefixEnd(prefix);
+  WriteLock lock(statement_mutex_);
+  auto stmt = getStatement(
+      domain, (end.empty()) ? SQLITE_STMT_SCAN_FROM : SQLITE_STMT_SCAN);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot read domain: " + domain);
+  }
 
-  std::string q =
-      "select key from " + domain + " where key LIKE '" + prefix + "%'";
-  if (max > 0) {
-    q += " limit " + std::to_string(max);
+  SQLiteStatementReset reset(stmt);
+  sqlite3_bind_text(
+      stmt, 1, prefix.data(), static_cast<int>(prefix.size()), SQLITE_STATIC);
+  if (!end.empty()) {
+    sqlite3_bind_text(
+        stmt, 2, end.data(), static_cast<int>(end.size()), SQLITE_STATIC);
   }
-  sqlite3_exec(db_, q.c_str(), getData, &_results, &err);
-  if (err != nullptr) {
-    sqlite3_free(err);
+  // A negative limit returns every row.
+  sqlite3_bind_int64(stmt, 3, (max > 0) ? static_cast<sqlite3_int64>(max) : -1);
+
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto key = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    results.push_back((key != nullptr) ? key : "");
   }
+  return Status(0, "OK");
+}
 
-  // Only assign value if the query found a result.
-  for (auto& r : _results) {
-    results.push_back(std::move(r["key"]));
+Status SQLiteDatabasePlugin::scanRange(const std::string& domain,
+                                       const std::string& begin,
+                                       const std::string& end,
+                                       DatabaseKeyValues& results,
+                                       size_t max,
+                                       bool reverse) const {
+  WriteLock lock(statement_mutex_);
+  SQLiteStatement kind;
+  if (reverse) {
+    kind = (end.empty()) ? SQLITE_STMT_SCAN_RANGE_FROM_REVERSE
+                         : SQLITE_STMT_SCAN_RANGE_REVERSE;
+  } else {
+    kind = (end.empty()) ? SQLITE_STMT_SCAN_RANGE_FROM : SQLITE_STMT_SCAN_RANGE;
+  }
+  auto stmt = getStatement(domain, kind);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot read domain: " + domain);
   }
 
+  SQLiteStatementReset reset(stmt);
+  sqlite3_bind_text(
+      stmt, 1, begin.data(), static_cast<int>(begin.size()), SQLITE_STATIC);
+  if (!end.empty()) {
+    sqlite3_bind_text(
+        stmt, 2, end.data(), static_cast<int>(end.size()), SQLITE_STATIC);
+  }
+  sqlite3_bind_int64(stmt, 3, (max > 0) ? static_cast<sqlite3_int64>(max) : -1);
+
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto key = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    results.push_back(
+        std::make_pair((key != nullptr) ? key : "", getColumnValue(stmt, 1)));
+  }
   return Status(0, "OK");
 }
+
+Status SQLiteDatabasePlugin::removeRange(const std::string& domain,
+                                         const std::string& begin,
+                                         const std::string& end) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  WriteLock lock(statement_mutex_);
+  auto stmt = getStatement(domain,
+                           (end.empty()) ? SQLITE_STMT_REMOVE_RANGE_FROM
+                                         : SQLITE_STMT_REMOVE_RANGE);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot write domain: " + domain);
+  }
+
+  SQLiteStatementReset reset(stmt);
+  sqlite3_bind_text(
+      stmt, 1, begin.data(), static_cast<int>(begin.size()), SQLITE_STATIC);
+  if (!end.empty()) {
+    sqlite3_bind_text(
+        stmt, 2, end.data(), static_cast<int>(end.size()), SQLITE_STATIC);
+  }
+  return Status((sqlite3_step(stmt) == SQLITE_DONE) ? 0 : 1);
+}
 }
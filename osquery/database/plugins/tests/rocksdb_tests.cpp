@@ -14,6 +14,8 @@
 
 namespace osquery {
 
+DECLARE_bool(rocksdb_domain_profiles);
+
 class RocksDBDatabasePluginTests : public DatabasePluginTests {
  protected:
   std::string name() override {
@@ -33,4 +35,47 @@ TEST_F(RocksDBDatabasePluginTests, test_rocksdb_loglevel) {
   auto details = SQL::selectAllFrom("file", "path", EQUALS, path_ + "/LOG");
   ASSERT_EQ(details.size(), 0U);
 }
+
+TEST_F(RocksDBDatabasePluginTests, test_rocksdb_domain_profiles) {
+  auto plugin = std::dynamic_pointer_cast<DatabasePlugin>(
+      RegistryFactory::get().plugin("database", name()));
+
+  // Values written with the domain profiles remain readable without them.
+  for (const auto& domain : kDomains) {
+    EXPECT_TRUE(plugin->put(domain, "profile", domain));
+  }
+
+  FLAGS_rocksdb_domain_profiles = false;
+  plugin->reset();
+  for (const auto& domain : kDomains) {
+    std::string value;
+    EXPECT_TRUE(plugin->get(domain, "profile", value));
+    EXPECT_EQ(domain, value);
+    EXPECT_TRUE(plugin->put(domain, "uniform", domain));
+  }
+
+  FLAGS_rocksdb_domain_profiles = true;
+  plugin->reset();
+  for (const auto& domain : kDomains) {
+    std::string value;
+    EXPECT_TRUE(plugin->get(domain, "uniform", value));
+    EXPECT_EQ(domain, value);
+  }
+}
+
+TEST_F(RocksDBDatabasePluginTests, test_rocksdb_stats) {
+  auto plugin = std::dynamic_pointer_cast<DatabasePlugin>(
+      RegistryFactory::get().plugin("database", name()));
+  EXPECT_TRUE(plugin->put(kQueries, "stats", "value"));
+
+  // Each domain reports its column family properties.
+  PluginResponse stats;
+  ASSERT_TRUE(plugin->stats(stats));
+  ASSERT_EQ(kDomains.size(), stats.size());
+  for (auto& domain : stats) {
+    EXPECT_EQ(1U, domain.count("domain"));
+    EXPECT_EQ(1U, domain.count("memtable_bytes"));
+    EXPECT_EQ(1U, domain.count("keys"));
+  }
+}
 }
@@ -21,4 +21,51 @@ class SQLiteDatabasePluginTests : public DatabasePluginTests {
 
 // Define the default set of database plugin operation tests.
 CREATE_DATABASE_TESTS(SQLiteDatabasePluginTests);
+
+DECLARE_bool(sqlite_database_wal);
+
+static std::shared_ptr<DatabasePlugin> getSQLitePlugin() {
+  auto plugin = RegistryFactory::get().plugin("database", "sqlite");
+  return std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+}
+
+TEST_F(SQLiteDatabasePluginTests, test_scan_prefix_literal) {
+  auto plugin = getSQLitePlugin();
+  plugin->put(kQueries, "test_literal_1", "1");
+  plugin->put(kQueries, "testXliteral_2", "2");
+  plugin->put(kQueries, "test%literal_3", "3");
+
+  // Prefixes are not patterns, an underscore only matches itself.
+  std::vector<std::string> keys;
+  EXPECT_TRUE(plugin->scan(kQueries, keys, "test_"));
+  EXPECT_EQ(std::vector<std::string>({"test_literal_1"}), keys);
+
+  keys.clear();
+  EXPECT_TRUE(plugin->scan(kQueries, keys, "test%"));
+  EXPECT_EQ(std::vector<std::string>({"test%literal_3"}), keys);
+
+  // Scans are ordered by key and limited.
+  keys.clear();
+  EXPECT_TRUE(plugin->scan(kQueries, keys, "test", 2));
+  EXPECT_EQ(std::vector<std::string>({"test%literal_3", "testXliteral_2"}),
+            keys);
+}
+
+TEST_F(SQLiteDatabasePluginTests, test_write_ahead_log) {
+  FLAGS_sqlite_database_wal = true;
+  auto plugin = getSQLitePlugin();
+  plugin->reset();
+
+  EXPECT_TRUE(plugin->putBatch(kQueries, {{"wal_1", "1"}, {"wal_2", "2"}}));
+  EXPECT_TRUE(boost::filesystem::exists(path_ + "-wal"));
+
+  std::string value;
+  EXPECT_TRUE(plugin->get(kQueries, "wal_2", value));
+  EXPECT_EQ("2", value);
+
+  FLAGS_sqlite_database_wal = false;
+  plugin->reset();
+  EXPECT_TRUE(plugin->get(kQueries, "wal_1", value));
+  EXPECT_EQ("1", value);
+}
 }
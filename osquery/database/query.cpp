@@ -9,13 +9,234 @@
  */
 
 #include <algorithm>
+#include <cstdio>
+#include <set>
+#include <sstream>
+#include <unordered_map>
 
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/database/query.h"
+#include "osquery/database/query_diff.h"
 
 namespace osquery {
 
+FLAG(bool,
+     schedule_diff_sqlite,
+     false,
+     "Compute differentials in SQLite over in-memory previous results");
+
+FLAG(uint64,
+     schedule_results_chunk_rows,
+     256,
+     "Average rows of each stored chunk of previous results, 0 for one value");
+
+/// The number of occurrences of each row fingerprint within a result set.
+using FingerprintCounts = std::unordered_map<RowFingerprint, size_t>;
+
+/// Fingerprints are stored as fixed-width hex, 16 characters each.
+static const size_t kFingerprintWidth = 16;
+
+static inline std::string getFingerprintsKey(const std::string& name) {
+  return "fingerprints." + name;
+}
+
+static inline std::string getGenerationsKey(const std::string& name) {
+  return "generations." + name;
+}
+
+static inline std::string getSnapshotKey(const std::string& name) {
+  return "snapshot." + name;
+}
+
+/// Chunks of previous results are stored with this prefix, then their ID.
+static inline std::string getChunkPrefix(const std::string& name) {
+  return "chunk." + name + ".";
+}
+
+/// Keys stored with a query's results, followed by the query name.
+static const std::vector<std::string> kQueryCompanionPrefixes = {
+    "fingerprints.", "generations.", "snapshot.",
+};
+
+/// Keys in the queries domain that belong to no scheduled query.
+static const std::vector<std::string> kQueryForeignPrefixes = {
+    "chunk.", "cache.", "boot_cache.",
+};
+
+/// Previous results stored as chunks are a list of chunk IDs after this.
+static const std::string kResultChunksMagic{"chunks:"};
+
+/// The bytes of new chunks written in one batch.
+static const size_t kResultChunksBatchBytes{1024 * 1024};
+
+static std::string encodeFingerprint(RowFingerprint fingerprint) {
+  char buffer[kFingerprintWidth + 1];
+  snprintf(buffer,
+           sizeof(buffer),
+           "%016llx",
+           static_cast<unsigned long long>(fingerprint));
+  return std::string(buffer, kFingerprintWidth);
+}
+
+static std::string serializeFingerprints(
+    const std::vector<RowFingerprint>& fingerprints) {
+  std::string encoded;
+  encoded.reserve(fingerprints.size() * kFingerprintWidth);
+  for (const auto& fingerprint : fingerprints) {
+    encoded += encodeFingerprint(fingerprint);
+  }
+  return encoded;
+}
+
+static Status deserializeFingerprints(const std::string& encoded,
+                                      FingerprintCounts& counts) {
+  if (encoded.size() % kFingerprintWidth != 0) {
+    return Status(1, "Invalid result fingerprints");
+  }
+
+  counts.reserve(encoded.size() / kFingerprintWidth);
+  for (size_t i = 0; i < encoded.size(); i += kFingerprintWidth) {
+    try {
+      counts[std::stoull(encoded.substr(i, kFingerprintWidth), nullptr, 16)]++;
+    } catch (const std::exception& /* e */) {
+      return Status(1, "Invalid result fingerprints");
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status Query::getPreviousFingerprints(FingerprintCounts& counts) {
+  std::string encoded;
+  auto status = getDatabaseValue(kQueries, getFingerprintsKey(name_), encoded);
+  if (status.ok()) {
+    return deserializeFingerprints(encoded, counts);
+  }
+
+  // Results stored before fingerprints were introduced contain only rows.
+  QueryData previous_qd;
+  status = getPreviousQueryResults(previous_qd);
+  if (!status.ok()) {
+    return status;
+  }
+  for (const auto& row : previous_qd) {
+    counts[getRowFingerprint(row)]++;
+  }
+  return Status(0, "OK");
+}
+
+bool Query::isRemovedLogged() const {
+  return !(query_.options.count("removed") && !query_.options.at("removed"));
+}
+
+/// The IDs of the chunks listed by stored previous results.
+static std::vector<std::string> getChunkIDs(const std::string& manifest) {
+  std::vector<std::string> ids;
+  for (auto i = kResultChunksMagic.size();
+       i + kFingerprintWidth <= manifest.size();
+       i += kFingerprintWidth) {
+    ids.push_back(manifest.substr(i, kFingerprintWidth));
+  }
+  return ids;
+}
+
+/// The keys of a query name's stored chunks.
+static std::vector<std::string> getStoredChunks(const std::string& name) {
+  auto prefix = getChunkPrefix(name);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kQueries, keys, prefix);
+
+  // The prefix also matches chunks of names continuing with a separator.
+  keys.erase(std::remove_if(keys.begin(),
+                            keys.end(),
+                            [&prefix](const std::string& key) {
+                              return key.size() !=
+                                     prefix.size() + kFingerprintWidth;
+                            }),
+             keys.end());
+  return keys;
+}
+
+/**
+ * @brief Store previous results as chunks, writing only the changed chunks.
+ *
+ * A chunk ends after a row whose fingerprint is a multiple of the average
+ * chunk size, so a changed row changes only its own chunk, and inserted or
+ * removed rows do not shift the rows of later chunks. Chunks are keyed by a
+ * hash of their row fingerprints, a chunk that is already stored is kept.
+ */
+static Status storeResultChunks(
+    const std::string& name,
+    const QueryData& qd,
+    const std::vector<RowFingerprint>& fingerprints) {
+  auto stored = getStoredChunks(name);
+  std::set<std::string> existing(stored.begin(), stored.end());
+  std::set<std::string> used;
+
+  auto prefix = getChunkPrefix(name);
+  auto average = FLAGS_schedule_results_chunk_rows;
+  auto manifest = kResultChunksMagic;
+  DatabaseKeyValues added;
+  size_t added_bytes = 0;
+  size_t begin = 0;
+  RowFingerprint hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < qd.size(); i++) {
+    // The chunk ID hashes the fingerprints of its rows, in order.
+    hash = (hash ^ fingerprints[i]) * 1099511628211ULL;
+    if (i + 1 < qd.size() && fingerprints[i] % average != 0 &&
+        i + 1 - begin < average * 4) {
+      continue;
+    }
+
+    auto id = encodeFingerprint(hash);
+    auto key = prefix + id;
+    manifest += id;
+    if (existing.count(key) == 0 && used.count(key) == 0) {
+      std::string content;
+      auto status = serializeQueryDataStored(
+          QueryData(qd.begin() + begin, qd.begin() + i + 1), content);
+      if (!status.ok()) {
+        return status;
+      }
+      added_bytes += content.size();
+      added.push_back(std::make_pair(key, std::move(content)));
+    }
+    used.insert(key);
+
+    if (added_bytes >= kResultChunksBatchBytes || i + 1 == qd.size()) {
+      // New chunks are written before the list that uses them.
+      if (!added.empty()) {
+        auto status = setDatabaseBatch(kQueries, added);
+        if (!status.ok()) {
+          return status;
+        }
+      }
+      added.clear();
+      added_bytes = 0;
+    }
+    begin = i + 1;
+    hash = 14695981039346656037ULL;
+  }
+
+  auto status = setDatabaseValue(kQueries, name, manifest);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Remove the chunks that are no longer used.
+  std::vector<std::string> unused;
+  for (const auto& key : stored) {
+    if (used.count(key) == 0) {
+      unused.push_back(key);
+    }
+  }
+  if (!unused.empty()) {
+    deleteDatabaseBatch(kQueries, unused);
+  }
+  return Status(0, "OK");
+}
+
 Status Query::getPreviousQueryResults(QueryData& results) {
   std::string raw;
   auto status = getDatabaseValue(kQueries, name_, raw);
@@ -23,13 +244,63 @@ Status Query::getPreviousQueryResults(QueryData& results) {
     return status;
   }
 
-  status = deserializeQueryDataJSON(raw, results);
-  if (!status.ok()) {
-    return status;
+  if (raw.compare(0, kResultChunksMagic.size(), kResultChunksMagic) != 0) {
+    // Results stored as a single value.
+    return deserializeQueryDataStored(raw, results);
+  }
+
+  auto prefix = getChunkPrefix(name_);
+  for (const auto& id : getChunkIDs(raw)) {
+    std::string content;
+    QueryData chunk;
+    status = getDatabaseValue(kQueries, prefix + id, content);
+    if (status.ok()) {
+      status = deserializeQueryDataStored(content, chunk);
+    }
+    if (!status.ok()) {
+      results.clear();
+      return Status(1, "Cannot read stored results chunk: " + id);
+    }
+    results.insert(results.end(),
+                   std::make_move_iterator(chunk.begin()),
+                   std::make_move_iterator(chunk.end()));
   }
   return Status(0, "OK");
 }
 
+/// Remove the stored rows of a query, as one value or several chunks.
+static void deleteStoredRows(const std::string& name) {
+  deleteDatabaseValue(kQueries, name);
+  auto chunks = getStoredChunks(name);
+  if (!chunks.empty()) {
+    deleteDatabaseBatch(kQueries, chunks);
+  }
+}
+
+void Query::deletePreviousResults(const std::string& name) {
+  deleteStoredRows(name);
+  for (const auto& prefix : kQueryCompanionPrefixes) {
+    deleteDatabaseValue(kQueries, prefix + name);
+  }
+}
+
+bool Query::getStoredQueryName(const std::string& key, std::string& name) {
+  for (const auto& prefix : kQueryForeignPrefixes) {
+    if (key.compare(0, prefix.size(), prefix) == 0) {
+      return false;
+    }
+  }
+
+  for (const auto& prefix : kQueryCompanionPrefixes) {
+    if (key.compare(0, prefix.size(), prefix) == 0) {
+      name = key.substr(prefix.size());
+      return !name.empty();
+    }
+  }
+  name = key;
+  return true;
+}
+
 std::vector<std::string> Query::getStoredQueryNames() {
   std::vector<std::string> results;
   scanDatabaseKeys(kQueries, results);
@@ -37,7 +308,14 @@ std::vector<std::string> Query::getStoredQueryNames() {
 }
 
 bool Query::isQueryNameInDatabase() {
-  auto names = Query::getStoredQueryNames();
+  std::string encoded;
+  if (getDatabaseValue(kQueries, getFingerprintsKey(name_), encoded).ok()) {
+    return true;
+  }
+
+  // Results are stored at the query name, only scan the keys it prefixes.
+  std::vector<std::string> names;
+  scanDatabaseKeys(kQueries, names, name_);
   return std::find(names.begin(), names.end(), name_) != names.end();
 }
 
@@ -77,35 +355,190 @@ Status Query::addNewResults(const QueryData& current_qd,
   // If a differential is requested and needed the target remains the original
   // query data, otherwise the content is moved to the differential's added set.
   const auto* target_gd = &current_qd;
-  if (!fresh_results && calculate_diff) {
-    // Get the rows from the last run of this query name.
-    QueryData previous_qd;
-    auto status = getPreviousQueryResults(previous_qd);
+  bool stored_diff = false;
+  size_t stored_removed = 0;
+  if (!fresh_results && calculate_diff && FLAGS_schedule_diff_sqlite &&
+      QueryDiffStore::exists(name_, isRemovedLogged())) {
+    // The previous results are kept in SQLite, the store is updated in place.
+    dr.added.clear();
+    dr.removed.clear();
+    stored_diff = QueryDiffStore::diff(
+                      name_, current_qd, isRemovedLogged(), dr, stored_removed)
+                      .ok();
+  }
+
+  if (stored_diff) {
+    // The differential was computed without reading the backing store.
+    fresh_results = (!dr.added.empty() || stored_removed > 0);
+  } else if (!fresh_results && calculate_diff) {
+    // Get the row fingerprints from the last run of this query name.
+    FingerprintCounts previous;
+    auto status = getPreviousFingerprints(previous);
     if (!status.ok()) {
       return status;
     }
 
-    // Calculate the differential between previous and current query results.
-    dr = diff(previous_qd, current_qd);
-    fresh_results = (!dr.added.empty() || !dr.removed.empty());
+    // Rows with a fingerprint remaining from the previous results are kept.
+    dr.added.clear();
+    dr.removed.clear();
+    for (const auto& row : current_qd) {
+      auto fingerprint = previous.find(getRowFingerprint(row));
+      if (fingerprint != previous.end() && fingerprint->second > 0) {
+        fingerprint->second--;
+      } else {
+        dr.added.push_back(row);
+      }
+    }
+
+    size_t removed = 0;
+    for (const auto& fingerprint : previous) {
+      removed += fingerprint.second;
+    }
+
+    if (removed > 0 && isRemovedLogged()) {
+      // Only the removed rows are needed from the previous results.
+      QueryData previous_qd;
+      if (getPreviousQueryResults(previous_qd).ok()) {
+        for (auto& row : previous_qd) {
+          auto fingerprint = previous.find(getRowFingerprint(row));
+          if (fingerprint != previous.end() && fingerprint->second > 0) {
+            fingerprint->second--;
+            dr.removed.push_back(std::move(row));
+          }
+        }
+      } else {
+        VLOG(1) << "Cannot find removed rows for scheduled query: " << name_;
+      }
+    }
+    fresh_results = (!dr.added.empty() || removed > 0);
   } else {
     dr.added = std::move(current_qd);
     target_gd = &dr.added;
   }
 
+  if (FLAGS_schedule_diff_sqlite && calculate_diff && !stored_diff) {
+    // Seed the store, the next differential is computed in SQLite.
+    auto status = QueryDiffStore::replace(name_, *target_gd, isRemovedLogged());
+    if (!status.ok()) {
+      VLOG(1) << "Cannot store results for scheduled query: " << name_ << ": "
+              << status.getMessage();
+    }
+  }
+
   if (fresh_results) {
+    // Replace the "previous" fingerprints with the current.
+    std::vector<RowFingerprint> fingerprints;
+    fingerprints.reserve(target_gd->size());
+    for (const auto& row : *target_gd) {
+      fingerprints.push_back(getRowFingerprint(row));
+    }
+    auto status = setDatabaseValue(kQueries,
+                                   getFingerprintsKey(name_),
+                                   serializeFingerprints(fingerprints));
+    if (!status.ok()) {
+      return status;
+    }
+
+    if (!isRemovedLogged()) {
+      // Without removed logging the previous rows are never read.
+      deleteStoredRows(name_);
+      return Status(0, "OK");
+    }
+
     // Replace the "previous" query data with the current.
-    std::string json;
-    auto status = serializeQueryDataJSON(*target_gd, json);
+    if (FLAGS_schedule_results_chunk_rows > 0) {
+      return storeResultChunks(name_, *target_gd, fingerprints);
+    }
+
+    std::string content;
+    status = serializeQueryDataStored(*target_gd, content);
     if (!status.ok()) {
       return status;
     }
 
-    status = setDatabaseValue(kQueries, name_, json);
+    status = setDatabaseValue(kQueries, name_, content);
     if (!status.ok()) {
       return status;
     }
+
+    auto chunks = getStoredChunks(name_);
+    if (!chunks.empty()) {
+      deleteDatabaseBatch(kQueries, chunks);
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status Query::getGenerations(std::map<std::string, std::string>& generations) {
+  std::string encoded;
+  auto status = getDatabaseValue(kQueries, getGenerationsKey(name_), encoded);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Each line is a table name and its generation.
+  generations.clear();
+  std::istringstream lines(encoded);
+  std::string line;
+  while (std::getline(lines, line)) {
+    auto separator = line.find('=');
+    if (separator == std::string::npos) {
+      return Status(1, "Invalid table generations");
+    }
+    generations[line.substr(0, separator)] = line.substr(separator + 1);
   }
   return Status(0, "OK");
 }
+
+Status Query::saveGenerations(
+    const std::map<std::string, std::string>& generations) {
+  if (generations.empty()) {
+    return deleteDatabaseValue(kQueries, getGenerationsKey(name_));
+  }
+
+  std::string encoded;
+  for (const auto& generation : generations) {
+    encoded += generation.first + "=" + generation.second + "\n";
+  }
+  return setDatabaseValue(kQueries, getGenerationsKey(name_), encoded);
+}
+
+Status Query::getSnapshotFingerprint(const QueryData& qd,
+                                     std::string& fingerprint,
+                                     bool& unchanged) {
+  // Rows are sorted by fingerprint, tables may generate them in any order.
+  std::vector<RowFingerprint> rows;
+  rows.reserve(qd.size());
+  for (const auto& row : qd) {
+    rows.push_back(getRowFingerprint(row));
+  }
+  std::sort(rows.begin(), rows.end());
+  rows.push_back(getRowFingerprint({{"query", query_.query}}));
+
+  // 64-bit FNV-1a over each fingerprint.
+  RowFingerprint hash = 14695981039346656037ULL;
+  for (const auto& row : rows) {
+    for (size_t i = 0; i < sizeof(row); i++) {
+      hash ^= (row >> (i * 8)) & 0xff;
+      hash *= 1099511628211ULL;
+    }
+  }
+
+  char buffer[kFingerprintWidth + 1];
+  snprintf(
+      buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(hash));
+  fingerprint = buffer;
+
+  std::string previous;
+  unchanged = false;
+  auto status = getDatabaseValue(kQueries, getSnapshotKey(name_), previous);
+  if (status.ok()) {
+    unchanged = (previous == fingerprint);
+  }
+  return status;
+}
+
+Status Query::saveSnapshotFingerprint(const std::string& fingerprint) {
+  return setDatabaseValue(kQueries, getSnapshotKey(name_), fingerprint);
+}
 }
@@ -10,8 +10,10 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <osquery/database.h>
@@ -61,6 +63,30 @@ class Query {
    */
   static std::vector<std::string> getStoredQueryNames();
 
+  /**
+   * @brief Remove the previous results of a query name.
+   *
+   * Previous results may be stored as several chunks of rows, see
+   * `--schedule_results_chunk_rows`, these are removed too, as are the keys
+   * stored with the results such as their row fingerprints.
+   *
+   * @param name the scheduled query name.
+   */
+  static void deletePreviousResults(const std::string& name);
+
+  /**
+   * @brief Get the scheduled query name that a stored key belongs to.
+   *
+   * Keys stored with a query's results, such as its row fingerprints, map
+   * to the query's name. Keys of result chunks and of table caches in the
+   * same domain belong to no scheduled query.
+   *
+   * @param key a key of the queries domain.
+   * @param name output scheduled query name.
+   * @return false if the key belongs to no scheduled query.
+   */
+  static bool getStoredQueryName(const std::string& key, std::string& name);
+
   /**
    * @brief Check if a given scheduled query exists in the database.
    *
@@ -96,6 +122,10 @@ class Query {
    * to the database using addNewResults and get back a data structure
    * indicating what rows in the query's results have changed.
    *
+   * Only row fingerprints are compared. The previous rows are read from the
+   * database when rows were removed and the query logs removed rows, they are
+   * not stored at all when the query disables the "removed" option.
+   *
    * @param qd the QueryData object containing query results to store.
    * @param dr an output to a DiffResults object populated based on last run.
    *
@@ -114,6 +144,55 @@ class Query {
    */
   Status getCurrentResults(QueryData& qd);
 
+  /**
+   * @brief The table generations of the query's previous execution.
+   *
+   * @param generations output of each scanned table's generation.
+   *
+   * @return failure if no generations were stored for the query.
+   */
+  Status getGenerations(std::map<std::string, std::string>& generations);
+
+  /**
+   * @brief Store the table generations of the query's latest execution.
+   *
+   * @param generations each scanned table's generation, empty to remove.
+   *
+   * @return the success or failure of the operation.
+   */
+  Status saveGenerations(const std::map<std::string, std::string>& generations);
+
+  /**
+   * @brief Fingerprint a snapshot and compare it with the last logged one.
+   *
+   * The fingerprint does not depend on the order of rows, it changes if the
+   * query changes.
+   *
+   * @param qd the snapshot results.
+   * @param fingerprint output fingerprint of the snapshot.
+   * @param unchanged output, true if the last logged snapshot matched.
+   *
+   * @return the success or failure of reading the last fingerprint.
+   */
+  Status getSnapshotFingerprint(const QueryData& qd,
+                                std::string& fingerprint,
+                                bool& unchanged);
+
+  /// Store the fingerprint of a logged snapshot.
+  Status saveSnapshotFingerprint(const std::string& fingerprint);
+
+ private:
+  /**
+   * @brief Count the row fingerprints from the last run of this query name.
+   *
+   * Results stored without fingerprints are fingerprinted from their rows.
+   */
+  Status getPreviousFingerprints(
+      std::unordered_map<RowFingerprint, size_t>& counts);
+
+  /// True unless the scheduled query disables logging removed rows.
+  bool isRemovedLogged() const;
+
  private:
   /// The scheduled query and internal
   ScheduledQuery query_;
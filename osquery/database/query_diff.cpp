@@ -0,0 +1,391 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include <osquery/core.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/memory_pressure.h"
+#include "osquery/database/query_diff.h"
+
+namespace osquery {
+
+/// A query's previous results table.
+struct QueryDiffTable {
+  /// The table is named diff_<id>.
+  size_t id{0};
+
+  /// The table holds the row content.
+  bool rows{false};
+
+  /// The number of rows in the table.
+  size_t count{0};
+};
+
+/// A current result row's fingerprint and occurrence of that fingerprint.
+struct QueryDiffKey {
+  sqlite3_int64 fingerprint{0};
+  sqlite3_int64 occurrence{0};
+};
+
+/// The store's connection and tables, protected by the store mutex.
+struct QueryDiffState {
+  sqlite3* db{nullptr};
+  std::map<std::string, QueryDiffTable> tables;
+  size_t next_id{0};
+};
+
+static QueryDiffState kQueryDiff;
+
+static Mutex kQueryDiffMutex;
+
+static const std::string kQueryDiffCurrentTable = "diff_current";
+
+static inline std::string getDiffTableName(const QueryDiffTable& table) {
+  return "diff_" + std::to_string(table.id);
+}
+
+static Status execDiffStatement(const std::string& sql) {
+  char* error = nullptr;
+  auto rc = sqlite3_exec(kQueryDiff.db, sql.c_str(), nullptr, nullptr, &error);
+  if (rc != SQLITE_OK) {
+    std::string message = (error != nullptr) ? error : "unknown error";
+    sqlite3_free(error);
+    return Status(1, "Cannot compute the differential: " + message);
+  }
+  return Status(0, "OK");
+}
+
+/// A prepared statement finalized when it leaves scope.
+class QueryDiffStatement : private boost::noncopyable {
+ public:
+  explicit QueryDiffStatement(const std::string& sql) {
+    sqlite3_prepare_v2(kQueryDiff.db,
+                       sql.c_str(),
+                       static_cast<int>(sql.size()),
+                       &stmt_,
+                       nullptr);
+  }
+
+  ~QueryDiffStatement() {
+    sqlite3_finalize(stmt_);
+  }
+
+  sqlite3_stmt* get() const {
+    return stmt_;
+  }
+
+ private:
+  sqlite3_stmt* stmt_{nullptr};
+};
+
+static Status openDiffStore() {
+  if (kQueryDiff.db != nullptr) {
+    return Status(0, "OK");
+  }
+
+  if (sqlite3_open(":memory:", &kQueryDiff.db) != SQLITE_OK) {
+    sqlite3_close(kQueryDiff.db);
+    kQueryDiff.db = nullptr;
+    return Status(1, "Cannot open the differential store");
+  }
+
+  auto status = execDiffStatement(
+      "PRAGMA journal_mode=OFF; PRAGMA synchronous=OFF; "
+      "CREATE TABLE " +
+      kQueryDiffCurrentTable +
+      " (fingerprint INTEGER NOT NULL, occurrence INTEGER NOT NULL, "
+      "ordinal INTEGER NOT NULL, PRIMARY KEY (fingerprint, occurrence)) "
+      "WITHOUT ROWID");
+  if (!status.ok()) {
+    sqlite3_close(kQueryDiff.db);
+    kQueryDiff.db = nullptr;
+  }
+  return status;
+}
+
+/// Fingerprint rows, numbering the occurrences of repeated fingerprints.
+static void getDiffKeys(const QueryData& results,
+                        std::vector<QueryDiffKey>& keys) {
+  std::unordered_map<RowFingerprint, sqlite3_int64> occurrences;
+  occurrences.reserve(results.size());
+  keys.resize(results.size());
+  for (size_t i = 0; i < results.size(); i++) {
+    auto fingerprint = getRowFingerprint(results[i]);
+    keys[i].fingerprint = static_cast<sqlite3_int64>(fingerprint);
+    keys[i].occurrence = occurrences[fingerprint]++;
+  }
+}
+
+/// Row indexes in key order, inserting in index order appends to the B-tree.
+static std::vector<size_t> getDiffOrder(const std::vector<QueryDiffKey>& keys) {
+  std::vector<size_t> order(keys.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) {
+    return std::tie(keys[a].fingerprint, keys[a].occurrence) <
+           std::tie(keys[b].fingerprint, keys[b].occurrence);
+  });
+  return order;
+}
+
+/// Insert rows at indexes into a query's previous results table.
+static Status insertDiffRows(const QueryDiffTable& table,
+                             const QueryData& results,
+                             const std::vector<QueryDiffKey>& keys,
+                             const std::vector<size_t>& indexes) {
+  QueryDiffStatement insert("INSERT INTO " + getDiffTableName(table) +
+                            " (fingerprint, occurrence, row) "
+                            "VALUES (?, ?, ?)");
+  if (insert.get() == nullptr) {
+    return Status(1, sqlite3_errmsg(kQueryDiff.db));
+  }
+
+  std::string content;
+  for (auto index : indexes) {
+    sqlite3_bind_int64(insert.get(), 1, keys[index].fingerprint);
+    sqlite3_bind_int64(insert.get(), 2, keys[index].occurrence);
+    if (table.rows) {
+      serializeRowBinary(results[index], content);
+      sqlite3_bind_blob(insert.get(),
+                        3,
+                        content.data(),
+                        static_cast<int>(content.size()),
+                        SQLITE_TRANSIENT);
+    } else {
+      sqlite3_bind_null(insert.get(), 3);
+    }
+    if (sqlite3_step(insert.get()) != SQLITE_DONE) {
+      return Status(1, sqlite3_errmsg(kQueryDiff.db));
+    }
+    sqlite3_reset(insert.get());
+  }
+  return Status(0, "OK");
+}
+
+/// Remove a query's table, the store mutex must be held.
+static void dropDiffTable(const std::string& name) {
+  auto it = kQueryDiff.tables.find(name);
+  if (it == kQueryDiff.tables.end()) {
+    return;
+  }
+
+  execDiffStatement("DROP TABLE IF EXISTS " + getDiffTableName(it->second));
+  kQueryDiff.tables.erase(it);
+}
+
+bool QueryDiffStore::exists(const std::string& name, bool rows) {
+  ReadLock lock(kQueryDiffMutex);
+  auto it = kQueryDiff.tables.find(name);
+  return (it != kQueryDiff.tables.end() && (it->second.rows || !rows));
+}
+
+Status QueryDiffStore::diff(const std::string& name,
+                            const QueryData& current,
+                            bool log_removed,
+                            DiffResults& dr,
+                            size_t& removed) {
+  WriteLock lock(kQueryDiffMutex);
+  auto it = kQueryDiff.tables.find(name);
+  if (it == kQueryDiff.tables.end() || (log_removed && !it->second.rows)) {
+    return Status(1, "Query results are not stored: " + name);
+  }
+  auto& table = it->second;
+  auto previous = getDiffTableName(table);
+
+  std::vector<QueryDiffKey> keys;
+  getDiffKeys(current, keys);
+  auto order = getDiffOrder(keys);
+
+  auto status = execDiffStatement("BEGIN; DELETE FROM " +
+                                  kQueryDiffCurrentTable + ";");
+  {
+    QueryDiffStatement insert("INSERT INTO " + kQueryDiffCurrentTable +
+                              " (fingerprint, occurrence, ordinal) "
+                              "VALUES (?, ?, ?)");
+    for (size_t i = 0; status.ok() && i < order.size(); i++) {
+      const auto& key = keys[order[i]];
+      sqlite3_bind_int64(insert.get(), 1, key.fingerprint);
+      sqlite3_bind_int64(insert.get(), 2, key.occurrence);
+      sqlite3_bind_int64(
+          insert.get(), 3, static_cast<sqlite3_int64>(order[i]));
+      if (sqlite3_step(insert.get()) != SQLITE_DONE) {
+        status = Status(1, sqlite3_errmsg(kQueryDiff.db));
+      }
+      sqlite3_reset(insert.get());
+    }
+  }
+
+  // Current rows without a matching previous row were added.
+  std::vector<size_t> added;
+  if (status.ok()) {
+    QueryDiffStatement select(
+        "SELECT c.ordinal FROM " + kQueryDiffCurrentTable +
+        " c WHERE NOT EXISTS (SELECT 1 FROM " + previous +
+        " p WHERE p.fingerprint = c.fingerprint AND "
+        "p.occurrence = c.occurrence) ORDER BY c.ordinal");
+    int rc = SQLITE_ERROR;
+    while ((rc = sqlite3_step(select.get())) == SQLITE_ROW) {
+      auto ordinal = static_cast<size_t>(sqlite3_column_int64(select.get(), 0));
+      added.push_back(ordinal);
+      dr.added.push_back(current[ordinal]);
+    }
+    if (rc != SQLITE_DONE) {
+      status = Status(1, sqlite3_errmsg(kQueryDiff.db));
+    }
+  }
+
+  // Previous rows without a matching current row were removed.
+  removed = 0;
+  std::vector<QueryDiffKey> unmatched;
+  if (status.ok()) {
+    QueryDiffStatement select(
+        "SELECT p.fingerprint, p.occurrence, p.row FROM " + previous +
+        " p WHERE NOT EXISTS (SELECT 1 FROM " + kQueryDiffCurrentTable +
+        " c WHERE c.fingerprint = p.fingerprint AND "
+        "c.occurrence = p.occurrence)");
+    int rc = SQLITE_ERROR;
+    while ((rc = sqlite3_step(select.get())) == SQLITE_ROW) {
+      removed++;
+      QueryDiffKey key;
+      key.fingerprint = sqlite3_column_int64(select.get(), 0);
+      key.occurrence = sqlite3_column_int64(select.get(), 1);
+      unmatched.push_back(key);
+      if (!log_removed) {
+        continue;
+      }
+
+      Row row;
+      auto blob =
+          static_cast<const char*>(sqlite3_column_blob(select.get(), 2));
+      if (blob == nullptr) {
+        break;
+      }
+      std::string content(blob, sqlite3_column_bytes(select.get(), 2));
+      if (!deserializeRowBinary(content, row).ok()) {
+        break;
+      }
+      dr.removed.push_back(std::move(row));
+    }
+    if (rc != SQLITE_DONE) {
+      status = Status(1, "Cannot read the stored results: " + name);
+    }
+  }
+
+  // Keep the current results by applying the differential in place.
+  if (status.ok() && !unmatched.empty()) {
+    QueryDiffStatement remove("DELETE FROM " + previous +
+                              " WHERE fingerprint = ? AND occurrence = ?");
+    for (size_t i = 0; status.ok() && i < unmatched.size(); i++) {
+      sqlite3_bind_int64(remove.get(), 1, unmatched[i].fingerprint);
+      sqlite3_bind_int64(remove.get(), 2, unmatched[i].occurrence);
+      if (sqlite3_step(remove.get()) != SQLITE_DONE) {
+        status = Status(1, sqlite3_errmsg(kQueryDiff.db));
+      }
+      sqlite3_reset(remove.get());
+    }
+  }
+  if (status.ok() && !added.empty()) {
+    status = insertDiffRows(table, current, keys, added);
+  }
+  if (status.ok()) {
+    status = execDiffStatement("COMMIT");
+  }
+
+  if (!status.ok()) {
+    execDiffStatement("ROLLBACK");
+    dropDiffTable(name);
+    dr.added.clear();
+    dr.removed.clear();
+    return status;
+  }
+  table.count = current.size();
+  return Status(0, "OK");
+}
+
+Status QueryDiffStore::replace(const std::string& name,
+                               const QueryData& results,
+                               bool rows) {
+  WriteLock lock(kQueryDiffMutex);
+  auto status = openDiffStore();
+  if (!status.ok()) {
+    return status;
+  }
+  dropDiffTable(name);
+
+  QueryDiffTable table;
+  table.id = kQueryDiff.next_id++;
+  table.rows = rows;
+  table.count = results.size();
+  status = execDiffStatement(
+      "BEGIN; CREATE TABLE " + getDiffTableName(table) +
+      " (fingerprint INTEGER NOT NULL, occurrence INTEGER NOT NULL, "
+      "row BLOB, PRIMARY KEY (fingerprint, occurrence)) WITHOUT ROWID;");
+
+  std::vector<QueryDiffKey> keys;
+  getDiffKeys(results, keys);
+  if (status.ok()) {
+    status = insertDiffRows(table, results, keys, getDiffOrder(keys));
+  }
+  if (status.ok()) {
+    status = execDiffStatement("COMMIT");
+  }
+
+  if (!status.ok()) {
+    execDiffStatement("ROLLBACK");
+    return status;
+  }
+  kQueryDiff.tables[name] = table;
+  return Status(0, "OK");
+}
+
+void QueryDiffStore::clear(const std::string& name) {
+  WriteLock lock(kQueryDiffMutex);
+  if (!name.empty()) {
+    dropDiffTable(name);
+    return;
+  }
+
+  while (!kQueryDiff.tables.empty()) {
+    dropDiffTable(kQueryDiff.tables.begin()->first);
+  }
+}
+
+size_t QueryDiffStore::size() {
+  ReadLock lock(kQueryDiffMutex);
+  size_t rows = 0;
+  for (const auto& table : kQueryDiff.tables) {
+    rows += table.second.count;
+  }
+  return rows;
+}
+
+/// Under memory pressure differentials are computed from the backing store.
+static std::string shedQueryDiffs(MemoryPressureLevel level) {
+  auto rows = QueryDiffStore::size();
+  if (level == MemoryPressureLevel::NONE || rows == 0) {
+    return "";
+  }
+
+  QueryDiffStore::clear();
+  return "released " + std::to_string(rows) + " stored differential rows";
+}
+
+static bool kQueryDiffShedding =
+    (MemoryPressure::addHandler("query_diff", shedQueryDiffs), true);
+}
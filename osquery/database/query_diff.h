@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/database.h>
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief The previous results of differential queries, held in SQLite.
+ *
+ * When `--schedule_diff_sqlite` is set the worker keeps each differential
+ * query's previous results in an in-memory SQLite table indexed by row
+ * fingerprint and occurrence, the nth row with the same fingerprint. The
+ * current results are written to a second table and the added and removed
+ * rows are anti-joins between the two. The previous table is then updated
+ * in place, only changed rows are written.
+ *
+ * The backing store still holds the fingerprints and rows so a restarted
+ * worker can compute its first differential, the store is seeded from it.
+ */
+class QueryDiffStore : private boost::noncopyable {
+ public:
+  /**
+   * @brief Check if the previous results of a query are stored.
+   *
+   * @param name The scheduled query name.
+   * @param rows True if the removed row content is required.
+   */
+  static bool exists(const std::string& name, bool rows);
+
+  /**
+   * @brief Compute the differential of a query's results then keep them.
+   *
+   * @param name The scheduled query name.
+   * @param current The results of the query's latest execution.
+   * @param log_removed Output the content of removed rows.
+   * @param dr The output added, and optionally removed, rows.
+   * @param removed The output number of removed rows.
+   * @return Failure if the query is not stored, the store is then cleared.
+   */
+  static Status diff(const std::string& name,
+                     const QueryData& current,
+                     bool log_removed,
+                     DiffResults& dr,
+                     size_t& removed);
+
+  /**
+   * @brief Replace the stored results of a query.
+   *
+   * @param name The scheduled query name.
+   * @param results The results of the query's latest execution.
+   * @param rows Keep the row content, required to report removed rows.
+   */
+  static Status replace(const std::string& name,
+                        const QueryData& results,
+                        bool rows);
+
+  /// Remove the stored results of a query, or of every query if empty.
+  static void clear(const std::string& name = "");
+
+  /// The number of rows stored across every query.
+  static size_t size();
+};
+}
@@ -56,6 +56,31 @@ TEST_F(DatabaseTests, test_scan_values) {
   EXPECT_EQ(keys.size(), 2U);
 }
 
+TEST_F(DatabaseTests, test_scan_prefix) {
+  setDatabaseValue(kLogs, "prefix.1", "a");
+  setDatabaseValue(kLogs, "prefix.2", "b");
+  setDatabaseValue(kLogs, "prefix/", "c");
+  setDatabaseValue(kLogs, "prefi", "d");
+
+  DatabaseKeyValues results;
+  auto s = scanDatabasePrefix(kLogs, "prefix.", results);
+  EXPECT_TRUE(s.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0].first, "prefix.1");
+  EXPECT_EQ(results[0].second, "a");
+  EXPECT_EQ(results[1].first, "prefix.2");
+
+  results.clear();
+  s = scanDatabasePrefix(kLogs, "prefix.", results, 1);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(results.size(), 1U);
+
+  EXPECT_EQ(getDatabasePrefixEnd("prefix."), "prefix/");
+  EXPECT_EQ(getDatabasePrefixEnd("a\xff"), "b");
+  EXPECT_EQ(getDatabasePrefixEnd("\xff"), "");
+  EXPECT_EQ(getDatabasePrefixEnd(""), "");
+}
+
 TEST_F(DatabaseTests, test_delete_values) {
   setDatabaseValue(kLogs, "k", "0");
 
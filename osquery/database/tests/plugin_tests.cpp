@@ -22,6 +22,74 @@ class EphemeralDatabasePluginTests : public DatabasePluginTests {
 // Define the default set of database plugin operation tests.
 CREATE_DATABASE_TESTS(EphemeralDatabasePluginTests);
 
+DECLARE_uint64(ephemeral_memory_limit);
+DECLARE_string(ephemeral_snapshot_path);
+
+/// The ephemeral plugin, reset with the current flags.
+static std::shared_ptr<DatabasePlugin> getEphemeralPlugin() {
+  auto plugin = RegistryFactory::get().plugin("database", "ephemeral");
+  auto db_plugin = std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+  db_plugin->reset();
+  return db_plugin;
+}
+
+TEST_F(EphemeralDatabasePluginTests, test_ephemeral_memory_limit) {
+  // Events and logs are limited to half and a quarter of a megabyte.
+  FLAGS_ephemeral_memory_limit = 1;
+  auto plugin = getEphemeralPlugin();
+
+  std::string value(100 * 1024, 'a');
+  for (size_t i = 0; i < 10; i++) {
+    EXPECT_TRUE(plugin->put(kEvents, "event." + std::to_string(i), value));
+  }
+
+  // The oldest events are evicted to fit the newest.
+  std::string content;
+  EXPECT_FALSE(plugin->get(kEvents, "event.0", content));
+  EXPECT_TRUE(plugin->get(kEvents, "event.9", content));
+  std::vector<std::string> keys;
+  plugin->scan(kEvents, keys, "event.");
+  EXPECT_EQ(keys.size(), 5U);
+
+  // Other domains are not evicted, writes over the quota fail.
+  EXPECT_TRUE(plugin->put(kQueries, "first", value));
+  EXPECT_TRUE(plugin->put(kQueries, "second", value));
+  EXPECT_FALSE(plugin->put(kQueries, "third", value));
+  EXPECT_TRUE(plugin->get(kQueries, "first", content));
+
+  PluginResponse stats;
+  EXPECT_TRUE(plugin->stats(stats));
+  for (const auto& domain : stats) {
+    if (domain.at("domain") == kEvents) {
+      EXPECT_EQ(domain.at("evicted"), "5");
+      EXPECT_EQ(domain.at("keys"), "5");
+    }
+  }
+
+  FLAGS_ephemeral_memory_limit = 0;
+  plugin->reset();
+}
+
+TEST_F(EphemeralDatabasePluginTests, test_ephemeral_snapshot) {
+  FLAGS_ephemeral_snapshot_path = kTestWorkingDirectory + "ephemeral.snapshot";
+  auto plugin = getEphemeralPlugin();
+  EXPECT_TRUE(plugin->put(kLogs, "first", "1"));
+  EXPECT_TRUE(plugin->put(kLogs, "second", std::string("2\0:2", 3)));
+
+  // A snapshot is written when the plugin is torn down and read on setUp.
+  plugin->reset();
+  std::string value;
+  EXPECT_TRUE(plugin->get(kLogs, "first", value));
+  EXPECT_EQ(value, "1");
+  EXPECT_TRUE(plugin->get(kLogs, "second", value));
+  EXPECT_EQ(value, std::string("2\0:2", 3));
+
+  boost::filesystem::remove(FLAGS_ephemeral_snapshot_path);
+  FLAGS_ephemeral_snapshot_path = "";
+  plugin->reset();
+  EXPECT_FALSE(plugin->get(kLogs, "first", value));
+}
+
 void DatabasePluginTests::testPluginCheck() {
   auto& rf = RegistryFactory::get();
 
@@ -102,4 +170,90 @@ void DatabasePluginTests::testScanLimit() {
   EXPECT_EQ(s.getMessage(), "OK");
   EXPECT_EQ(keys.size(), 2U);
 }
+
+void DatabasePluginTests::testScanRange() {
+  getPlugin()->put(kQueries, "test_range_3", "c");
+  getPlugin()->put(kQueries, "test_range_1", "a");
+  getPlugin()->put(kQueries, "test_range_2", "b");
+  getPlugin()->put(kQueries, "test_range_4", "d");
+
+  // The range includes the first key and excludes the end.
+  DatabaseKeyValues results;
+  auto s = getPlugin()->scanRange(
+      kQueries, "test_range_2", "test_range_4", results);
+  EXPECT_TRUE(s.ok());
+  DatabaseKeyValues expected = {{"test_range_2", "b"}, {"test_range_3", "c"}};
+  EXPECT_EQ(expected, results);
+
+  // An empty end is unbounded.
+  results.clear();
+  s = getPlugin()->scanRange(kQueries, "test_range_1", "", results, 3);
+  EXPECT_TRUE(s.ok());
+  ASSERT_EQ(3U, results.size());
+  EXPECT_EQ("test_range_1", results[0].first);
+  EXPECT_EQ("test_range_3", results[2].first);
+
+  // A reverse scan takes the maximum from the end of the range.
+  results.clear();
+  s = getPlugin()->scanRange(
+      kQueries, "test_range_1", "test_range_4", results, 2, true);
+  EXPECT_TRUE(s.ok());
+  expected = {{"test_range_3", "c"}, {"test_range_2", "b"}};
+  EXPECT_EQ(expected, results);
+
+  results.clear();
+  s = getPlugin()->scanRange(
+      kQueries, "test_range_2", "test_range_5", results, 0, true);
+  EXPECT_TRUE(s.ok());
+  ASSERT_EQ(3U, results.size());
+  EXPECT_EQ("test_range_4", results[0].first);
+  EXPECT_EQ("test_range_2", results[2].first);
+}
+
+void DatabasePluginTests::testRemoveRange() {
+  getPlugin()->put(kQueries, "test_range_1", "a");
+  getPlugin()->put(kQueries, "test_range_2", "b");
+  getPlugin()->put(kQueries, "test_range_3", "c");
+
+  auto s =
+      getPlugin()->removeRange(kQueries, "test_range_1", "test_range_3");
+  EXPECT_TRUE(s.ok());
+
+  std::vector<std::string> keys;
+  getPlugin()->scan(kQueries, keys, "test_range_");
+  EXPECT_EQ(std::vector<std::string>{"test_range_3"}, keys);
+}
+
+void DatabasePluginTests::testPutBatch() {
+  DatabaseKeyValues data = {
+      {"test_batch_1", "a"}, {"test_batch_2", "b"}, {"test_batch_1", "c"}};
+  auto s = getPlugin()->putBatch(kQueries, data);
+  EXPECT_TRUE(s.ok());
+
+  // Later values for the same key replace earlier values.
+  std::string value;
+  getPlugin()->get(kQueries, "test_batch_1", value);
+  EXPECT_EQ("c", value);
+  getPlugin()->get(kQueries, "test_batch_2", value);
+  EXPECT_EQ("b", value);
+
+  // An empty batch is not an error.
+  EXPECT_TRUE(getPlugin()->putBatch(kQueries, {}).ok());
+}
+
+void DatabasePluginTests::testRemoveBatch() {
+  getPlugin()->put(kQueries, "test_remove_1", "a");
+  getPlugin()->put(kQueries, "test_remove_2", "b");
+  getPlugin()->put(kQueries, "test_remove_3", "c");
+
+  // Missing keys are not an error.
+  auto s = getPlugin()->removeBatch(
+      kQueries, {"test_remove_1", "test_remove_3", "test_remove_4"});
+  EXPECT_TRUE(s.ok());
+
+  std::vector<std::string> keys;
+  getPlugin()->scan(kQueries, keys, "test_remove_");
+  EXPECT_EQ(std::vector<std::string>{"test_remove_2"}, keys);
+  EXPECT_TRUE(getPlugin()->removeBatch(kQueries, {}).ok());
+}
 }
@@ -41,6 +41,18 @@
   }                                                                            \
   TEST_F(n, test_scan_limit) {                                                 \
     testScanLimit();                                                           \
+  }                                                                            \
+  TEST_F(n, test_scan_range) {                                                 \
+    testScanRange();                                                           \
+  }                                                                            \
+  TEST_F(n, test_remove_range) {                                               \
+    testRemoveRange();                                                         \
+  }                                                                            \
+  TEST_F(n, test_put_batch) {                                                  \
+    testPutBatch();                                                            \
+  }                                                                            \
+  TEST_F(n, test_remove_batch) {                                               \
+    testRemoveBatch();                                                         \
   }
 
 namespace osquery {
@@ -106,5 +118,9 @@ class DatabasePluginTests : public testing::Test {
   void testDelete();
   void testScan();
   void testScanLimit();
+  void testScanRange();
+  void testRemoveRange();
+  void testPutBatch();
+  void testRemoveBatch();
 };
 }
@@ -16,11 +16,17 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/flags.h>
+
 #include "osquery/database/query.h"
+#include "osquery/database/query_diff.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
 
+DECLARE_bool(schedule_diff_sqlite);
+DECLARE_uint64(schedule_results_chunk_rows);
+
 class QueryTests : public testing::Test {};
 
 TEST_F(QueryTests, test_private_members) {
@@ -61,6 +67,91 @@ TEST_F(QueryTests, test_add_and_get_current_results) {
   }
 }
 
+TEST_F(QueryTests, test_add_results_without_removed) {
+  auto query = getOsqueryScheduledQuery();
+  query.options["removed"] = false;
+  auto cf = Query("without_removed", query);
+
+  Row r1 = {{"foo", "bar"}};
+  Row r2 = {{"foo", "baz"}};
+  DiffResults dr;
+  auto status = cf.addNewResults({r1, r1, r2}, dr);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(cf.isQueryNameInDatabase());
+
+  // Only fingerprints are stored when removed rows are not logged.
+  QueryData previous_qd;
+  EXPECT_FALSE(cf.getPreviousQueryResults(previous_qd).ok());
+
+  // A duplicate row is removed and a new row is added.
+  Row r3 = {{"foo", "qux"}};
+  status = cf.addNewResults({r2, r1, r3}, dr);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(dr.added, QueryData({r3}));
+  EXPECT_TRUE(dr.removed.empty());
+
+  // The same results are not a differential.
+  status = cf.addNewResults({r3, r2, r1}, dr);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(dr.added.empty());
+  EXPECT_TRUE(dr.removed.empty());
+}
+
+TEST_F(QueryTests, test_add_results_with_diff_store) {
+  FLAGS_schedule_diff_sqlite = true;
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("diff_store", query);
+  auto status = cf.addNewResults(getTestDBExpectedResults());
+  EXPECT_TRUE(status.ok());
+
+  Row r1 = {{"foo", "bar"}};
+  Row r2 = {{"foo", "baz"}};
+  DiffResults dr;
+  status = cf.addNewResults({r1, r1, r2}, dr);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(QueryDiffStore::exists("diff_store", true));
+  EXPECT_EQ(3U, QueryDiffStore::size());
+
+  // The differential is computed from the store, duplicates are counted.
+  Row r3 = {{"foo", "qux"}};
+  status = cf.addNewResults({r2, r1, r3, r3}, dr);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(dr.added, QueryData({r3, r3}));
+  EXPECT_EQ(dr.removed, QueryData({r1}));
+
+  status = cf.addNewResults({r3, r2, r3, r1}, dr);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(dr.added.empty());
+  EXPECT_TRUE(dr.removed.empty());
+
+  // The backing store is kept current for a restarted worker.
+  QueryDiffStore::clear();
+  status = cf.addNewResults({r3}, dr);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(dr.added.empty());
+  EXPECT_EQ(dr.removed.size(), 3U);
+  FLAGS_schedule_diff_sqlite = false;
+}
+
+TEST_F(QueryTests, test_add_results_from_stored_rows) {
+  // Results stored as rows only are fingerprinted for a differential.
+  auto encoded_qd = getSerializedQueryDataJSON();
+  auto query = getOsqueryScheduledQuery();
+  auto status = setDatabaseValue(kQueries, "stored_rows", encoded_qd.first);
+  EXPECT_TRUE(status.ok());
+
+  auto cf = Query("stored_rows", query);
+  DiffResults dr;
+  status = cf.addNewResults(encoded_qd.second, dr);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(dr.added.empty());
+  EXPECT_TRUE(dr.removed.empty());
+
+  status = cf.addNewResults({}, dr);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(dr.removed, encoded_qd.second);
+}
+
 TEST_F(QueryTests, test_get_query_results) {
   // Grab an expected set of query data and add it as the previous result.
   auto encoded_qd = getSerializedQueryDataJSON();
@@ -129,4 +220,144 @@ TEST_F(QueryTests, test_get_stored_query_names) {
   auto in_vector = std::find(names.begin(), names.end(), "foobar");
   EXPECT_NE(in_vector, names.end());
 }
+
+TEST_F(QueryTests, test_get_stored_query_name) {
+  std::string name;
+  EXPECT_TRUE(Query::getStoredQueryName("foobar", name));
+  EXPECT_EQ(name, "foobar");
+
+  // Keys stored with the results belong to the query.
+  EXPECT_TRUE(Query::getStoredQueryName("fingerprints.foobar", name));
+  EXPECT_EQ(name, "foobar");
+  EXPECT_TRUE(Query::getStoredQueryName("generations.foobar", name));
+  EXPECT_EQ(name, "foobar");
+  EXPECT_TRUE(Query::getStoredQueryName("snapshot.foobar", name));
+  EXPECT_EQ(name, "foobar");
+
+  // Chunks and table caches belong to no scheduled query.
+  EXPECT_FALSE(Query::getStoredQueryName("chunk.foobar.1", name));
+  EXPECT_FALSE(Query::getStoredQueryName("cache.users.1", name));
+  EXPECT_FALSE(Query::getStoredQueryName("boot_cache.users.1", name));
+}
+
+TEST_F(QueryTests, test_delete_previous_results) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("deleted_results", query);
+  QueryData qd = {{{"a", "1"}}, {{"a", "2"}}};
+  DiffResults dr;
+  EXPECT_TRUE(cf.addNewResults(qd, dr, true).ok());
+
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kQueries, keys, "fingerprints.deleted_results");
+  EXPECT_FALSE(keys.empty());
+
+  // The fingerprints are removed with the results.
+  Query::deletePreviousResults("deleted_results");
+  keys.clear();
+  scanDatabaseKeys(kQueries, keys, "fingerprints.deleted_results");
+  EXPECT_TRUE(keys.empty());
+  EXPECT_FALSE(cf.isQueryNameInDatabase());
+}
+
+TEST_F(QueryTests, test_result_chunks) {
+  auto chunk_rows = FLAGS_schedule_results_chunk_rows;
+  FLAGS_schedule_results_chunk_rows = 4;
+
+  QueryData qd;
+  for (size_t i = 0; i < 200; i++) {
+    qd.push_back({{"i", std::to_string(i)}});
+  }
+
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("chunked_results", query);
+  DiffResults dr;
+  EXPECT_TRUE(cf.addNewResults(qd, dr, true).ok());
+  QueryData previous_qd;
+  EXPECT_TRUE(cf.getPreviousQueryResults(previous_qd).ok());
+  EXPECT_EQ(qd, previous_qd);
+
+  std::vector<std::string> chunks;
+  scanDatabaseKeys(kQueries, chunks, "chunk.chunked_results.");
+  EXPECT_GT(chunks.size(), 10U);
+
+  // Changing a row replaces at most the chunks around it.
+  qd[100]["i"] = "changed";
+  EXPECT_TRUE(cf.addNewResults(qd, dr, true).ok());
+  EXPECT_EQ(1U, dr.added.size());
+  EXPECT_EQ(1U, dr.removed.size());
+  previous_qd.clear();
+  EXPECT_TRUE(cf.getPreviousQueryResults(previous_qd).ok());
+  EXPECT_EQ(qd, previous_qd);
+
+  std::vector<std::string> updated;
+  scanDatabaseKeys(kQueries, updated, "chunk.chunked_results.");
+  size_t kept = 0;
+  for (const auto& key : updated) {
+    kept += std::count(chunks.begin(), chunks.end(), key);
+  }
+  EXPECT_GE(kept + 2, chunks.size());
+
+  // Results stored as a single value remove the chunks.
+  FLAGS_schedule_results_chunk_rows = 0;
+  qd.pop_back();
+  EXPECT_TRUE(cf.addNewResults(qd, dr, true).ok());
+  updated.clear();
+  scanDatabaseKeys(kQueries, updated, "chunk.chunked_results.");
+  EXPECT_TRUE(updated.empty());
+  previous_qd.clear();
+  EXPECT_TRUE(cf.getPreviousQueryResults(previous_qd).ok());
+  EXPECT_EQ(qd, previous_qd);
+
+  Query::deletePreviousResults("chunked_results");
+  EXPECT_FALSE(cf.getPreviousQueryResults(previous_qd).ok());
+  FLAGS_schedule_results_chunk_rows = chunk_rows;
+}
+
+TEST_F(QueryTests, test_generations) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("generations", query);
+  std::map<std::string, std::string> generations;
+  EXPECT_FALSE(cf.getGenerations(generations).ok());
+
+  std::map<std::string, std::string> expected = {
+      {"deb_packages", "/var/lib/dpkg/status:1:2:3;"}, {"time", "4"},
+  };
+  EXPECT_TRUE(cf.saveGenerations(expected).ok());
+  EXPECT_TRUE(cf.getGenerations(generations).ok());
+  EXPECT_EQ(generations, expected);
+
+  // An execution scanning a table without a generation removes them.
+  EXPECT_TRUE(cf.saveGenerations({}).ok());
+  EXPECT_FALSE(cf.getGenerations(generations).ok());
+}
+
+TEST_F(QueryTests, test_snapshot_fingerprint) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("snapshot_fingerprint", query);
+  QueryData qd = {{{"a", "1"}}, {{"a", "2"}}};
+
+  std::string fingerprint;
+  bool unchanged = true;
+  EXPECT_FALSE(cf.getSnapshotFingerprint(qd, fingerprint, unchanged).ok());
+  EXPECT_FALSE(unchanged);
+  EXPECT_EQ(16U, fingerprint.size());
+  EXPECT_TRUE(cf.saveSnapshotFingerprint(fingerprint).ok());
+
+  // The order of rows does not change the fingerprint.
+  QueryData reordered = {{{"a", "2"}}, {{"a", "1"}}};
+  std::string second;
+  EXPECT_TRUE(cf.getSnapshotFingerprint(reordered, second, unchanged).ok());
+  EXPECT_TRUE(unchanged);
+  EXPECT_EQ(fingerprint, second);
+
+  // Changed rows or an altered query do not match.
+  reordered[0]["a"] = "3";
+  cf.getSnapshotFingerprint(reordered, second, unchanged);
+  EXPECT_FALSE(unchanged);
+
+  query.query += " LIMIT 1";
+  auto altered = Query("snapshot_fingerprint", query);
+  altered.getSnapshotFingerprint(qd, second, unchanged);
+  EXPECT_FALSE(unchanged);
+}
 }
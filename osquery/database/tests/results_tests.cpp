@@ -38,6 +38,76 @@ TEST_F(ResultsTests, test_simple_diff) {
   EXPECT_EQ(results.removed, o);
 }
 
+TEST_F(ResultsTests, test_diff_duplicates) {
+  Row r1 = {{"foo", "bar"}};
+  Row r2 = {{"foo", "baz"}};
+  Row r3 = {{"fo", "obaz"}};
+
+  auto results = diff({r1, r2, r1}, {r3, r1, r2});
+  EXPECT_EQ(results.added, QueryData({r3}));
+  EXPECT_EQ(results.removed, QueryData({r1}));
+
+  // Column boundaries are part of a row's fingerprint.
+  EXPECT_NE(getRowFingerprint(r2), getRowFingerprint(r3));
+  EXPECT_EQ(getRowFingerprint(r1), getRowFingerprint(Row({{"foo", "bar"}})));
+}
+
+TEST_F(ResultsTests, test_serialize_query_data_binary) {
+  auto results = getSerializedQueryDataJSON();
+  auto qd = results.second;
+  qd.push_back({{"binary", std::string("a\0b", 3)}, {"other", ""}});
+  qd.push_back({});
+
+  std::string data;
+  auto s = serializeQueryDataBinary(qd, data);
+  EXPECT_TRUE(s.ok());
+  EXPECT_TRUE(isBinarySerialized(data));
+  EXPECT_FALSE(isBinarySerialized(results.first));
+
+  QueryData output;
+  s = deserializeQueryDataBinary(data, output);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(qd, output);
+
+  // Truncated content is an error.
+  output.clear();
+  s = deserializeQueryDataBinary(data.substr(0, data.size() / 2), output);
+  EXPECT_FALSE(s.ok());
+
+  s = deserializeQueryDataBinary(results.first, output);
+  EXPECT_FALSE(s.ok());
+}
+
+TEST_F(ResultsTests, test_deserialize_stored) {
+  // Stored content is read from either encoding.
+  auto results = getSerializedQueryDataJSON();
+  QueryData output;
+  auto s = deserializeQueryDataStored(results.first, output);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(results.second, output);
+
+  std::string data;
+  serializeQueryDataStored(results.second, data);
+  output.clear();
+  s = deserializeQueryDataStored(data, output);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(results.second, output);
+
+  auto row = getSerializedRow();
+  std::string json;
+  serializeRowJSON(row.second, json);
+  Row r;
+  s = deserializeRowStored(json, r);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(row.second, r);
+
+  serializeRowStored(row.second, data);
+  r.clear();
+  s = deserializeRowStored(data, r);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(row.second, r);
+}
+
 TEST_F(ResultsTests, test_serialize_row) {
   auto results = getSerializedRow();
   pt::ptree tree;
@@ -146,6 +216,24 @@ TEST_F(ResultsTests, test_deserialize_query_log_item_json) {
   EXPECT_EQ(output, results.second);
 }
 
+TEST_F(ResultsTests, test_serialize_unchanged_snapshot_json) {
+  QueryLogItem item;
+  item.name = "snapshot";
+  item.snapshot_unchanged = true;
+  item.snapshot_fingerprint = "00000000000000ff";
+
+  // The marker does not include the snapshot results.
+  std::string json;
+  EXPECT_TRUE(serializeQueryLogItemJSON(item, json).ok());
+  EXPECT_EQ(std::string::npos, json.find("\"snapshot\":"));
+  EXPECT_NE(std::string::npos, json.find("\"action\":\"snapshot_unchanged\""));
+
+  QueryLogItem output;
+  EXPECT_TRUE(deserializeQueryLogItemJSON(json, output).ok());
+  EXPECT_TRUE(output.snapshot_unchanged);
+  EXPECT_EQ(item.snapshot_fingerprint, output.snapshot_fingerprint);
+}
+
 TEST_F(ResultsTests, test_adding_duplicate_rows_to_query_data) {
   Row r1, r2, r3;
   r1["foo"] = "bar";
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
 
 #include <osquery/database.h>
@@ -122,4 +123,65 @@ std::string generateHeader(const std::map<std::string, size_t>& lengths,
 std::string generateRow(const Row& r,
                         const std::map<std::string, size_t>& lengths,
                         const std::vector<std::string>& columns);
+
+/// The number of rows used to size the columns of pretty printed results.
+extern const size_t kPrettyPrintSample;
+
+/**
+ * @brief Print query results as rows are stepped, without keeping them
+ *
+ * JSON output prints each row as it is added. Pretty output holds a sample
+ * of the first rows to size the columns, then prints the sample and each
+ * following row as it is added. A later value wider than its column is
+ * printed in full and shifts the rest of its row.
+ */
+class ResultPrinter {
+ public:
+  /// The output is written to the sink, stdout by default.
+  using Sink = std::function<void(const std::string&)>;
+
+  explicit ResultPrinter(bool json,
+                         size_t sample = kPrettyPrintSample,
+                         Sink sink = nullptr);
+
+  /// Set the order of the columns, before the rows of each statement.
+  void setColumns(const std::vector<std::string>& columns);
+
+  /// Check if the columns of the current statement are set.
+  bool hasColumns() const {
+    return !columns_.empty();
+  }
+
+  /// Print, or sample, a row.
+  void addRow(Row&& row);
+
+  /// Print the remaining output of a statement and reset for the next.
+  void finish();
+
+ private:
+  /// Print the header and the sampled rows.
+  void printSample();
+
+  void write(const std::string& output);
+
+ private:
+  bool json_{false};
+  size_t sample_{0};
+  Sink sink_;
+
+  std::vector<std::string> columns_;
+  std::map<std::string, size_t> lengths_;
+
+  /// Rows held until the sample is complete.
+  QueryData rows_;
+
+  /// The number of rows printed for the current statement.
+  size_t printed_{0};
+
+  /// Set after the header was printed.
+  bool streaming_{false};
+
+  /// The separator line of the pretty printed table.
+  std::string separator_;
+};
 }
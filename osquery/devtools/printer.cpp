@@ -8,6 +8,7 @@
  *
  */
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
@@ -22,6 +23,8 @@ namespace osquery {
 
 DECLARE_string(nullvalue);
 
+const size_t kPrettyPrintSample = 1000;
+
 static std::vector<char> kOffset = {0, 0};
 static std::string kToken = "|";
 
@@ -93,10 +96,9 @@ std::string generateRow(const Row& r,
     } else {
       int buffer_size =
           static_cast<int>(lengths.at(column) - utf8StringSize(r.at(column)));
-      if (buffer_size >= 0) {
-        size = static_cast<size_t>(buffer_size);
-        out += r.at(column);
-      }
+      // A value wider than a sampled column length is printed in full.
+      size = (buffer_size > 0) ? static_cast<size_t>(buffer_size) : 0;
+      out += r.at(column);
     }
     out += std::string(size + 1, ' ');
   }
@@ -157,4 +159,71 @@ void computeRowLengths(const Row& r,
     lengths[col.first] = (size > current) ? size : current;
   }
 }
+
+ResultPrinter::ResultPrinter(bool json, size_t sample, Sink sink)
+    : json_(json), sample_(std::max<size_t>(sample, 1)), sink_(sink) {}
+
+void ResultPrinter::write(const std::string& output) {
+  if (sink_ != nullptr) {
+    sink_(output);
+  } else {
+    printf("%s", output.c_str());
+  }
+}
+
+void ResultPrinter::setColumns(const std::vector<std::string>& columns) {
+  columns_ = columns;
+}
+
+void ResultPrinter::addRow(Row&& row) {
+  if (json_) {
+    std::string row_string;
+    if (serializeRowJSON(row, row_string).ok()) {
+      row_string.pop_back();
+      write(((printed_++ == 0) ? "[\n  " : ",\n  ") + row_string);
+    }
+    return;
+  }
+
+  if (streaming_) {
+    write(generateRow(row, lengths_, columns_));
+    return;
+  }
+
+  computeRowLengths(row, lengths_);
+  rows_.push_back(std::move(row));
+  if (rows_.size() >= sample_) {
+    printSample();
+  }
+}
+
+void ResultPrinter::printSample() {
+  // Use the column names as minimum lengths, like prettyPrint.
+  computeRowLengths(rows_.front(), lengths_, true);
+  separator_ = generateToken(lengths_, columns_);
+  write(separator_ + generateHeader(lengths_, columns_) + separator_);
+  for (const auto& row : rows_) {
+    write(generateRow(row, lengths_, columns_));
+  }
+  rows_.clear();
+  streaming_ = true;
+}
+
+void ResultPrinter::finish() {
+  if (json_) {
+    write((printed_ == 0) ? "[\n\n]\n" : "\n]\n");
+  } else if (!streaming_ && !rows_.empty()) {
+    printSample();
+    write(separator_);
+  } else if (streaming_) {
+    write(separator_);
+  }
+
+  columns_.clear();
+  lengths_.clear();
+  rows_.clear();
+  printed_ = 0;
+  streaming_ = false;
+  separator_.clear();
+}
 }
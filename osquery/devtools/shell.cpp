@@ -97,6 +97,7 @@ static char zHelp[] =
     "                   pretty   Pretty printed SQL results (default)\n"
     ".nullvalue STR   Use STRING in place of NULL values\n"
     ".print STR...    Print literal STRING\n"
+    ".profile ON|OFF  Report filters, generate time, and rows per table\n"
     ".quit            Exit this program\n"
     ".schema [TABLE]  Show the CREATE statements\n"
     ".separator STR   Change separator used by output mode\n"
@@ -222,6 +223,34 @@ static void endTimer(void) {
 #define END_TIMER endTimer()
 #define HAS_TIMER 1
 
+// Begin collecting per-table counters for the statements that follow.
+static void setProfile(bool enabled) {
+  osquery::TableProfiler::instance().setEnabled(enabled);
+  // Drop counters of statements executed while the previous mode was set.
+  osquery::TableProfiler::instance().take();
+}
+
+// Print the counters of each table used since the last report.
+static void endProfile(void) {
+  if (!osquery::TableProfiler::instance().enabled()) {
+    return;
+  }
+
+  // The report is written to stderr so it does not mix with --json results.
+  for (const auto& table : osquery::TableProfiler::instance().take()) {
+    const auto& profile = table.second;
+    fprintf(stderr,
+            "Profile: %s filters %zu generate %.3f ms rows %zu consumed %zu "
+            "bytes %zu\n",
+            table.first.c_str(),
+            profile.filters,
+            profile.generate_us * 0.001,
+            profile.generated,
+            profile.consumed,
+            profile.bytes);
+  }
+}
+
 // If the following flag is set, then command execution stops
 // at an error if we are not interactive.
 static int bail_on_error = 0;
@@ -343,9 +372,8 @@ static char* one_input_line(FILE* in, char* zPrior, int isContinuation) {
 ** Pretty print structure
  */
 struct prettyprint_data {
-  osquery::QueryData results;
-  std::vector<std::string> columns;
-  std::map<std::string, size_t> lengths;
+  /// Rows are printed as they are stepped, not collected per statement.
+  osquery::ResultPrinter printer{osquery::FLAGS_json};
 };
 
 /*
@@ -514,10 +542,13 @@ static int shell_callback(
 
   switch (p->mode) {
   case MODE_Pretty: {
-    if (p->prettyPrint->columns.size() == 0) {
+    auto& printer = p->prettyPrint->printer;
+    if (!printer.hasColumns()) {
+      std::vector<std::string> columns;
       for (i = 0; i < nArg; i++) {
-        p->prettyPrint->columns.push_back(std::string(azCol[i]));
+        columns.push_back(std::string(azCol[i]));
       }
+      printer.setColumns(columns);
     }
 
     osquery::Row r;
@@ -528,8 +559,7 @@ static int shell_callback(
                                        : std::string(azArg[i]);
       }
     }
-    osquery::computeRowLengths(r, p->prettyPrint->lengths);
-    p->prettyPrint->results.push_back(r);
+    printer.addRow(std::move(r));
     break;
   }
   case MODE_Line: {
@@ -898,17 +928,9 @@ static int shell_exec(
   dbc->clearAffectedTables();
 
   if (pArg && pArg->mode == MODE_Pretty) {
-    if (osquery::FLAGS_json) {
-      osquery::jsonPrint(pArg->prettyPrint->results);
-    } else {
-      osquery::prettyPrint(pArg->prettyPrint->results,
-                           pArg->prettyPrint->columns,
-                           pArg->prettyPrint->lengths);
-    }
-    pArg->prettyPrint->results.clear();
-    pArg->prettyPrint->columns.clear();
-    pArg->prettyPrint->lengths.clear();
+    pArg->prettyPrint->printer.finish();
   }
+  endProfile();
 
   return rc;
 }
@@ -1330,6 +1352,9 @@ static int do_meta_command(char* zLine, struct callback_data* p) {
       fprintf(p->out, "%s", azArg[j]);
     }
     fprintf(p->out, "\n");
+  } else if (c == 'p' && n >= 3 && strncmp(azArg[0], "profile", n) == 0 &&
+             nArg == 2) {
+    setProfile(booleanValue(azArg[1]) != 0);
   } else if (c == 'q' && strncmp(azArg[0], "quit", n) == 0 && nArg == 1) {
     rc = 2;
   } else if (c == 's' && strncmp(azArg[0], "schema", n) == 0 && nArg < 3) {
@@ -103,4 +103,55 @@ TEST_F(PrinterTests, test_unicode) {
   std::map<std::string, size_t> expected = {{"name", 10}};
   EXPECT_EQ(lengths, expected);
 }
+
+TEST_F(PrinterTests, test_result_printer_json) {
+  std::string output;
+  auto sink = [&output](const std::string& s) { output += s; };
+  ResultPrinter printer(true, kPrettyPrintSample, sink);
+  printer.setColumns(order);
+  printer.addRow(Row(q[0]));
+  printer.addRow(Row(q[1]));
+  printer.finish();
+
+  std::string first;
+  std::string second;
+  serializeRowJSON(q[0], first);
+  serializeRowJSON(q[1], second);
+  first.pop_back();
+  second.pop_back();
+  EXPECT_EQ("[\n  " + first + ",\n  " + second + "\n]\n", output);
+
+  // A statement without rows is an empty list.
+  output.clear();
+  printer.finish();
+  EXPECT_EQ("[\n\n]\n", output);
+}
+
+TEST_F(PrinterTests, test_result_printer_sample) {
+  std::string output;
+  auto sink = [&output](const std::string& s) { output += s; };
+  ResultPrinter printer(false, 2, sink);
+  printer.setColumns(order);
+
+  // The column lengths are computed from the first two rows.
+  printer.addRow(Row(q[0]));
+  EXPECT_TRUE(output.empty());
+  printer.addRow(Row(q[1]));
+  std::map<std::string, size_t> lengths;
+  computeRowLengths(q[0], lengths);
+  computeRowLengths(q[1], lengths);
+  computeRowLengths(q[0], lengths, true);
+  auto separator = generateToken(lengths, order);
+  auto expected = separator + generateHeader(lengths, order) + separator +
+                  generateRow(q[0], lengths, order) +
+                  generateRow(q[1], lengths, order);
+  EXPECT_EQ(expected, output);
+
+  // Later rows are printed as they are added, wider values in full.
+  printer.addRow(Row(q[2]));
+  expected += "| Doctor Who | 2000 | fish sticks and custard | 11     |\n";
+  EXPECT_EQ(expected, output);
+  printer.finish();
+  EXPECT_EQ(expected + separator, output);
+}
 }
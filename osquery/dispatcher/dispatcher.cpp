@@ -9,6 +9,8 @@
  */
 
 #include <chrono>
+#include <deque>
+#include <queue>
 
 #include <osquery/dispatcher.h>
 #include <osquery/flags.h>
@@ -22,6 +24,234 @@ namespace osquery {
 /// The worker_threads define the default thread pool size.
 FLAG(int32, worker_threads, 4, "Number of work dispatch threads");
 
+/// A delayed task, ordered by the time it is due.
+struct DispatcherTimer {
+  std::chrono::steady_clock::time_point due;
+  DispatcherTask task;
+};
+
+struct DispatcherTimerOrder {
+  bool operator()(const DispatcherTimer& l, const DispatcherTimer& r) const {
+    return l.due > r.due;
+  }
+};
+
+/**
+ * @brief A fixed-size, work-stealing thread pool with timers.
+ *
+ * Each thread owns a queue and executes from its front. An idle thread
+ * steals from the back of another thread's queue, then moves due timers
+ * into its own queue, then waits for the next timer or a new task.
+ */
+class DispatcherExecutor : private boost::noncopyable {
+ public:
+  explicit DispatcherExecutor(size_t threads);
+
+  ~DispatcherExecutor();
+
+  /// Queue a task, or delay it for a number of milliseconds.
+  void add(DispatcherTask task, size_t delay);
+
+  /// Drop queued tasks and timers and wake every thread to exit.
+  void interrupt();
+
+  /// Wait for the threads to exit, after an interrupt.
+  void join();
+
+  /// The number of queued and delayed tasks.
+  size_t count();
+
+  /// Check if the executor was interrupted.
+  bool stopped() const {
+    return stopping_;
+  }
+
+ private:
+  /// A thread's entry point.
+  void run(size_t index);
+
+  /// Take a task from a thread's queue, or steal one from another thread.
+  bool take(size_t index, DispatcherTask& task);
+
+ private:
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<DispatcherTask> tasks;
+  };
+
+  /// One queue for each thread.
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+
+  std::vector<std::thread> threads_;
+
+  /// New tasks are distributed across the queues.
+  std::atomic<size_t> next_{0};
+
+  /// The total number of queued tasks.
+  std::atomic<size_t> queued_{0};
+
+  /// Protects the timers and the wakeup of idle threads.
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::priority_queue<DispatcherTimer,
+                      std::vector<DispatcherTimer>,
+                      DispatcherTimerOrder>
+      timers_;
+  std::atomic<bool> stopping_{false};
+};
+
+DispatcherExecutor::DispatcherExecutor(size_t threads) {
+  for (size_t i = 0; i < threads; i++) {
+    queues_.push_back(std::unique_ptr<TaskQueue>(new TaskQueue()));
+  }
+  for (size_t i = 0; i < threads; i++) {
+    threads_.emplace_back(&DispatcherExecutor::run, this, i);
+  }
+}
+
+DispatcherExecutor::~DispatcherExecutor() {
+  interrupt();
+  join();
+}
+
+void DispatcherExecutor::add(DispatcherTask task, size_t delay) {
+  if (stopping_) {
+    return;
+  }
+
+  if (delay > 0) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    DispatcherTimer timer;
+    timer.due = std::chrono::steady_clock::now() +
+                std::chrono::milliseconds(delay);
+    timer.task = std::move(task);
+    timers_.push(std::move(timer));
+    // The new timer may be due before the one an idle thread waits for.
+    condition_.notify_all();
+    return;
+  }
+
+  auto& queue = *queues_[next_++ % queues_.size()];
+  {
+    // A thread taking the task must not decrement the count before it is
+    // incremented.
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    queued_++;
+    queue.tasks.push_back(std::move(task));
+  }
+
+  // Synchronize with an idle thread that is about to wait.
+  std::unique_lock<std::mutex> lock(mutex_);
+  condition_.notify_one();
+}
+
+bool DispatcherExecutor::take(size_t index, DispatcherTask& task) {
+  for (size_t i = 0; i < queues_.size(); i++) {
+    auto& queue = *queues_[(index + i) % queues_.size()];
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      continue;
+    }
+
+    // A thread executes its own oldest task, and steals the newest.
+    if (i == 0) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    } else {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    }
+    queued_--;
+    return true;
+  }
+  return false;
+}
+
+void DispatcherExecutor::run(size_t index) {
+  while (!stopping_) {
+    DispatcherTask task;
+    if (take(index, task)) {
+      size_t delay = 0;
+      try {
+        delay = task();
+      } catch (const std::exception& e) {
+        LOG(ERROR) << "Dispatcher task failed: " << e.what();
+      }
+
+      if (delay > 0) {
+        add(std::move(task), delay);
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+
+    // Move due timers into this thread's queue.
+    auto now = std::chrono::steady_clock::now();
+    std::vector<DispatcherTask> due;
+    while (!timers_.empty() && timers_.top().due <= now) {
+      due.push_back(timers_.top().task);
+      timers_.pop();
+    }
+
+    if (!due.empty()) {
+      lock.unlock();
+      auto& queue = *queues_[index];
+      std::unique_lock<std::mutex> queue_lock(queue.mutex);
+      for (auto& timer : due) {
+        queue.tasks.push_back(std::move(timer));
+        queued_++;
+      }
+      continue;
+    }
+
+    if (queued_ > 0) {
+      continue;
+    } else if (timers_.empty()) {
+      condition_.wait(lock);
+    } else {
+      condition_.wait_until(lock, timers_.top().due);
+    }
+  }
+}
+
+void DispatcherExecutor::interrupt() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  stopping_ = true;
+  while (!timers_.empty()) {
+    timers_.pop();
+  }
+
+  for (auto& queue : queues_) {
+    std::unique_lock<std::mutex> queue_lock(queue->mutex);
+    queued_ -= queue->tasks.size();
+    queue->tasks.clear();
+  }
+  condition_.notify_all();
+}
+
+void DispatcherExecutor::join() {
+  for (auto& thread : threads_) {
+    if (thread.get_id() == std::this_thread::get_id()) {
+      // A task cannot wait for its own thread.
+      thread.detach();
+    } else if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
+size_t DispatcherExecutor::count() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return queued_ + timers_.size();
+}
+
 /// Cancel the pause request.
 void RunnerInterruptPoint::cancel() {
   std::unique_lock<std::mutex> lock(mutex_);
@@ -97,6 +327,31 @@ Status Dispatcher::addService(InternalRunnableRef service) {
   return Status(0, "OK");
 }
 
+Status Dispatcher::addTask(DispatcherTask task, size_t delay) {
+  auto& self = instance();
+  if (self.stopping_) {
+    return Status(1, "Cannot add task, dispatcher is stopping");
+  }
+
+  std::shared_ptr<DispatcherExecutor> executor;
+  {
+    WriteLock lock(self.mutex_);
+    if (self.executor_ == nullptr || self.executor_->stopped()) {
+      auto threads = std::max(FLAGS_worker_threads, 1);
+      self.executor_ = std::make_shared<DispatcherExecutor>(threads);
+    }
+    executor = self.executor_;
+  }
+
+  executor->add(std::move(task), delay);
+  return Status(0, "OK");
+}
+
+size_t Dispatcher::taskCount() const {
+  ReadLock lock(mutex_);
+  return (executor_ != nullptr) ? executor_->count() : 0;
+}
+
 void Dispatcher::removeService(const InternalRunnable* service) {
   auto& self = Dispatcher::instance();
   WriteLock lock(self.mutex_);
@@ -135,6 +390,16 @@ void Dispatcher::joinServices() {
     DLOG(INFO) << "Service thread: " << thread.get() << " has joined";
   }
 
+  // The task threads only exit once the dispatcher is stopping.
+  std::shared_ptr<DispatcherExecutor> executor;
+  if (self.stopping_) {
+    WriteLock lock(self.mutex_);
+    executor = std::move(self.executor_);
+  }
+  if (executor != nullptr) {
+    executor->join();
+  }
+
   WriteLock lock(self.mutex_);
   self.services_.clear();
   self.service_threads_.clear();
@@ -154,5 +419,9 @@ void Dispatcher::stopServices() {
     service->interrupt();
     DLOG(INFO) << "Service: " << service.get() << " has been interrupted";
   }
+
+  if (self.executor_ != nullptr) {
+    self.executor_->interrupt();
+  }
 }
 }
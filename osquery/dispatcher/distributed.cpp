@@ -14,6 +14,7 @@
 #include <osquery/system.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/table_warmer.h"
 #include "osquery/dispatcher/distributed.h"
 
 namespace osquery {
@@ -29,11 +30,15 @@ DECLARE_string(distributed_plugin);
 const size_t kDistributedAccelerationInterval = 5;
 
 void DistributedRunner::start() {
-  auto dist = Distributed();
   while (!interrupted()) {
-    dist.pullUpdates();
-    if (dist.getPendingQueryCount() > 0) {
-      dist.runQueries();
+    dist_.pullUpdates();
+    if (dist_.getPendingQueryCount() > 0) {
+      dist_.runQueries();
+    }
+
+    if (dist_.isLongPolling()) {
+      // The plugin waited on the server, poll again right away.
+      continue;
     }
 
     std::string str_acu = "0";
@@ -53,6 +58,10 @@ void DistributedRunner::start() {
 Status startDistributed() {
   if (!FLAGS_disable_distributed) {
     Dispatcher::addService(std::make_shared<DistributedRunner>());
+    // Keep the results of expensive tables ready for distributed queries.
+    if (!getWarmTables().empty()) {
+      Dispatcher::addService(std::make_shared<TableWarmerRunner>());
+    }
     return Status(0, "OK");
   } else {
     return Status(1, "Distributed query service not enabled.");
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <osquery/dispatcher.h>
+#include <osquery/distributed.h>
 
 namespace osquery {
 
@@ -23,6 +24,15 @@ class DistributedRunner : public InternalRunnable {
  public:
   /// The Dispatcher thread entry point.
   void start();
+
+  /// Interrupt running distributed queries.
+  void stop() override {
+    dist_.stop();
+  }
+
+ private:
+  /// The distributed query state, results, and workers.
+  Distributed dist_;
 };
 
 Status startDistributed();
@@ -8,17 +8,26 @@
  *
  */
 
+#include <algorithm>
 #include <ctime>
+#include <memory>
 
 #include <osquery/config.h>
 #include <osquery/core.h>
 #include <osquery/database.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/registry.h>
 #include <osquery/system.h>
+#include <osquery/tables.h>
 
 #include "osquery/config/parsers/decorators.h"
+#include "osquery/core/memory_pressure.h"
+#include "osquery/core/metrics.h"
 #include "osquery/core/process.h"
+#include "osquery/core/profiler.h"
+#include "osquery/core/tracing.h"
+#include "osquery/core/worker_stats.h"
 #include "osquery/database/query.h"
 #include "osquery/dispatcher/scheduler.h"
 #include "osquery/sql/sqlite_util.h"
@@ -34,71 +43,451 @@ FLAG(uint64,
      7200,
      "Interval in seconds to reload database arenas");
 
+FLAG(bool,
+     schedule_reload_reset,
+     false,
+     "Reset the SQLite and database connections at each schedule_reload");
+
+FLAG(uint64,
+     schedule_workers,
+     1,
+     "Number of threads executing due scheduled queries");
+
+FLAG(uint64,
+     schedule_budget_ms,
+     0,
+     "Estimated CPU milliseconds of queries started each second, 0 for none");
+
+FLAG(uint64,
+     schedule_query_timeout,
+     0,
+     "Seconds before a scheduled query is interrupted, 0 for no limit");
+
+FLAG(uint64,
+     schedule_performance_interval,
+     0,
+     "Seconds between status log reports of query performance, 0 for none");
+
+FLAG(uint64,
+     schedule_max_rows,
+     0,
+     "Rows a scheduled query's tables may generate, 0 for no limit");
+
+FLAG(uint64,
+     schedule_max_bytes,
+     0,
+     "Bytes a scheduled query's tables may generate, 0 for no limit");
+
+FLAG(bool,
+     schedule_generations,
+     true,
+     "Skip differential queries whose tables report unchanged generations");
+
+FLAG(bool,
+     schedule_low_priority_background,
+     true,
+     "Run low priority scheduled queries with background CPU and I/O priority");
+
+FLAG(string,
+     schedule_snapshot_unchanged,
+     "log",
+     "Snapshots matching the last logged snapshot: log, marker, or skip");
+
+/// Maximum seconds a due query is deferred to stay within the budget.
+const size_t kScheduleMaxDefer{60};
+
+/// Seconds a query stopped by the watchdog for CPU utilization is skipped.
+const size_t kScheduleThrottleTime{600};
+
+/// Seconds a query stopped by the watchdog for memory growth is skipped.
+const size_t kScheduleBlacklistTime{86400};
+
 /// Used to bypass (optimize-out) the set-differential of query results.
 DECLARE_bool(events_optimize);
 
-SQLInternal monitor(const std::string& name, const ScheduledQuery& query) {
+/// Seconds between runs of 'always' decorators, 0 to run them per query.
+DECLARE_uint64(decorators_always_interval);
+
+/// Seconds between writes of the internal metrics for Prometheus.
+DECLARE_uint64(metrics_textfile_interval);
+
+/// Execute a scheduled query, passing each row to the callback if one is set.
+static SQLInternal executeQuery(const ScheduledQuery& query,
+                                const SQLiteDBInstanceRef& dbc,
+                                const QueryRowCallback* callback) {
+  auto db = (dbc != nullptr) ? dbc : SQLiteDBManager::get();
+  if (callback != nullptr) {
+    return SQLInternal(query.query, db, *callback);
+  }
+  return SQLInternal(query.query, db, true);
+}
+
+/// The expected byte output of a row.
+static size_t getRowSize(const Row& row) {
+  size_t size = 0;
+  for (const auto& column : row) {
+    size += column.first.size();
+    size += column.second.size();
+  }
+  return size;
+}
+
+SQLInternal monitor(const std::string& name,
+                    const ScheduledQuery& query,
+                    const SQLiteDBInstanceRef& dbc,
+                    const QueryRowCallback* callback) {
+  // Calculate a size as the expected byte output of results.
+  // This does not dedup result differentials and is not aware of snapshots.
+  size_t size = 0;
+  size_t rows = 0;
+  QueryRowCallback counted;
+  if (callback != nullptr) {
+    // Streamed rows are counted as they are produced.
+    counted = [&size, &rows, callback](Row&& row) {
+      size += getRowSize(row);
+      rows++;
+      return (*callback)(std::move(row));
+    };
+  }
+
   // Snapshot the performance and times for the worker before running.
-  auto pid = std::to_string(PlatformProcess::getCurrentProcess()->pid());
-  auto r0 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
-  auto t0 = getUnixTime();
+  ResourceUsage r0;
+  getResourceUsage(r0);
   Config::getInstance().recordQueryStart(name);
-  SQLInternal sql(query.query);
+  auto sql =
+      executeQuery(query, dbc, (callback != nullptr) ? &counted : nullptr);
   // Snapshot the performance after, and compare.
-  auto t1 = getUnixTime();
-  auto r1 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
-  if (r0.size() > 0 && r1.size() > 0) {
-    // Calculate a size as the expected byte output of results.
-    // This does not dedup result differentials and is not aware of snapshots.
-    size_t size = 0;
-    for (const auto& row : sql.rows()) {
-      for (const auto& column : row) {
-        size += column.first.size();
-        size += column.second.size();
-      }
-    }
-    // Always called while processes table is working.
-    Config::getInstance().recordQueryPerformance(
-        name, t1 - t0, size, r0[0], r1[0]);
+  ResourceUsage r1;
+  getResourceUsage(r1);
+
+  for (const auto& row : sql.rows()) {
+    size += getRowSize(row);
   }
+  rows += sql.rows().size();
+  Config::getInstance().recordQueryPerformance(
+      name, size, r0, r1, rows, sql.tableCosts());
   return sql;
 }
 
-inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
+/// Fill in the metadata and decorations of a scheduled query's log item.
+static void initLogItem(const std::string& name, QueryLogItem& item) {
+  item.name = name;
+  // Fill in a host identifier fields based on configuration or availability.
+  item.identifier = getHostIdentifier();
+  item.time = osquery::getUnixTime();
+  item.calendar_time = osquery::getAsciiTime();
+  getDecorations(item);
+}
+
+/**
+ * @brief Check if the tables scanned by a query's last execution are unchanged.
+ *
+ * The generations are only stored when every table the query scanned
+ * declares one, so the query would return the same results.
+ */
+static bool isQueryUnchanged(Query& query) {
+  std::map<std::string, std::string> generations;
+  if (query.isNewQuery() || !query.getGenerations(generations).ok()) {
+    return false;
+  }
+
+  for (const auto& generation : generations) {
+    auto plugin = std::dynamic_pointer_cast<TablePlugin>(
+        Registry::get().plugin("table", generation.first));
+    if (plugin == nullptr || plugin->generation() != generation.second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// The p50/p95/p99 of a measurement, in a unit of the measurement.
+static std::string describePercentiles(std::vector<uint64_t> values,
+                                       uint64_t unit) {
+  std::string description;
+  for (const auto percentile : {50, 95, 99}) {
+    if (!description.empty()) {
+      description += "/";
+    }
+    description += std::to_string(getPercentile(values, percentile) / unit);
+  }
+  return description;
+}
+
+std::string describePerformance(const QueryPerformance& perf) {
+  std::vector<uint64_t> wall_time;
+  std::vector<uint64_t> rows;
+  std::vector<uint64_t> output_size;
+  for (const auto& execution : perf.recent) {
+    wall_time.push_back(execution.wall_time);
+    rows.push_back(execution.rows);
+    output_size.push_back(execution.output_size);
+  }
+
+  std::string description = "executions=" + std::to_string(perf.executions);
+  description += " wall_ms=" + describePercentiles(wall_time, 1000);
+  description += " rows=" + describePercentiles(rows, 1);
+  description += " bytes=" + describePercentiles(output_size, 1);
+
+  std::vector<std::pair<std::string, TableCost>> tables(perf.tables.begin(),
+                                                        perf.tables.end());
+  std::stable_sort(tables.begin(),
+                   tables.end(),
+                   [](const std::pair<std::string, TableCost>& a,
+                      const std::pair<std::string, TableCost>& b) {
+                     return a.second.generate_time > b.second.generate_time;
+                   });
+  std::string costs;
+  for (const auto& table : tables) {
+    costs += (costs.empty()) ? " tables=" : ",";
+    costs += table.first + ":" +
+             std::to_string(table.second.generate_time / 1000) + "ms";
+  }
+  return description + costs;
+}
+
+/// Queries set "low_priority" to pause under worker memory pressure.
+static bool isLowPriority(const ScheduledQuery& query) {
+  return (query.options.count("low_priority") &&
+          query.options.at("low_priority"));
+}
+
+/// Set while low priority scheduled queries are paused.
+static std::atomic<bool> kLowPriorityPaused{false};
+
+/// Pause low priority queries near the memory limit, and resume them after.
+static std::string pauseLowPriorityQueries(MemoryPressureLevel level) {
+  auto pause = (level == MemoryPressureLevel::PAUSE);
+  if (kLowPriorityPaused.exchange(pause) == pause) {
+    return "";
+  }
+
+  size_t queries = 0;
+  Config::getInstance().scheduledQueries(
+      [&queries](const std::string& name, const ScheduledQuery& query) {
+        if (isLowPriority(query)) {
+          queries++;
+        }
+      });
+  return std::string((pause) ? "paused " : "resumed ") +
+         std::to_string(queries) + " low priority scheduled queries";
+}
+
+static bool kLowPriorityPausing =
+    (MemoryPressure::addHandler("schedule", pauseLowPriorityQueries), true);
+
+DECLARE_uint64(query_cost_budget);
+
+/// Planned queries by name, with the query text and if it exceeded the budget.
+static std::map<std::string, std::pair<std::string, bool>> kQueryCosts;
+static Mutex kQueryCostsMutex;
+
+/// Queries with an estimated cost above the budget run as low priority.
+static bool isOverBudget(const std::string& name,
+                         const ScheduledQuery& query,
+                         const SQLiteDBInstanceRef& dbc) {
+  if (FLAGS_query_cost_budget == 0) {
+    return false;
+  }
+
+  {
+    WriteLock lock(kQueryCostsMutex);
+    auto planned = kQueryCosts.find(name);
+    if (planned != kQueryCosts.end() &&
+        planned->second.first == query.query) {
+      return planned->second.second;
+    }
+  }
+
+  // A query is planned again only when its text changes.
+  auto db = (dbc != nullptr) ? dbc : SQLiteDBManager::get();
+  auto status = checkQueryCost(query.query, db->db());
+  if (!status.ok()) {
+    LOG(WARNING) << "Scheduled query " << name
+                 << " runs as low priority: " << status.getMessage();
+  }
+
+  WriteLock lock(kQueryCostsMutex);
+  kQueryCosts[name] = std::make_pair(query.query, !status.ok());
+  return !status.ok();
+}
+
+inline void launchQuery(const std::string& name,
+                        const ScheduledQuery& query,
+                        size_t step,
+                        const SQLiteDBInstanceRef& dbc = nullptr) {
+  // Record how long after the due step the query started.
+  auto now = osquery::getUnixTime();
+  if (now > step) {
+    Config::getInstance().recordQueryDrift(name, now - step);
+  }
+
+  // Low priority queries wait while the worker is near its memory limit.
+  if (MemoryPressure::level() == MemoryPressureLevel::PAUSE &&
+      (isLowPriority(query) || isOverBudget(name, query, dbc))) {
+    VLOG(1) << "Pausing low priority scheduled query under memory pressure: "
+            << name;
+    static auto& paused = Metrics::counter("schedule_queries_paused");
+    paused.add();
+    return;
+  }
+
+  // Differential queries over unchanged tables would not log results.
+  bool snapshot =
+      (query.options.count("snapshot") && query.options.at("snapshot"));
+  auto dbQuery = Query(name, query);
+  if (FLAGS_schedule_generations && !snapshot && isQueryUnchanged(dbQuery)) {
+    VLOG(1) << "Skipping scheduled query with unchanged tables: " << name;
+    static auto& skipped = Metrics::counter("schedule_queries_skipped");
+    skipped.add();
+    return;
+  }
+
   // Execute the scheduled query and create a named query object.
   LOG(INFO) << "Executing scheduled query " << name << ": " << query.query;
-  runDecorators(DECORATE_ALWAYS);
+  TRACE_PROBE1(query__start, name.c_str());
+  if (FLAGS_decorators_always_interval == 0) {
+    runDecorators(DECORATE_ALWAYS);
+  }
 
-  auto sql =
-      (FLAGS_enable_monitor) ? monitor(name, query) : SQLInternal(query.query);
+  // Low priority queries yield the CPU and disk to other processes.
+  std::unique_ptr<BackgroundPriorityScope> background;
+  if (FLAGS_schedule_low_priority_background && isLowPriority(query)) {
+    background = std::make_unique<BackgroundPriorityScope>();
+  }
+
+  // A pack's query timeout replaces the default for the schedule.
+  auto timeout =
+      (query.timeout > 0) ? query.timeout : FLAGS_schedule_query_timeout;
+  // The watcher may stop this query before the worker exceeds a limit.
+  WorkerQueryScope watched(name);
+  WorkerProfileScope profiled(WorkerProfileScope::QUERY, name);
+  QueryBudget budget(timeout * 1000, watched.stopped());
+  budget.setResultLimits(FLAGS_schedule_max_rows, FLAGS_schedule_max_bytes);
 
-  if (!sql.ok()) {
+  // Buffered loggers forward the results within the pack's priority class.
+  auto priority = LogPriority::NORMAL;
+  getLogPriority(query.priority, priority);
+  LogPriorityScope log_priority(priority);
+
+  // Snapshots are logged as their rows are produced, unless the rows are
+  // compared with the last logged snapshot or shared with other callers.
+  auto dedup = (FLAGS_schedule_snapshot_unchanged == "marker" ||
+                FLAGS_schedule_snapshot_unchanged == "skip");
+  auto stream = snapshot && !dedup && !QueryResultsCache::enabled();
+
+  // A query log item contains an optional set of differential results or
+  // a copy of the most-recent execution alongside some query metadata.
+  QueryLogItem item;
+  std::unique_ptr<SnapshotLogStream> snapshot_rows;
+  QueryRowCallback callback;
+  if (stream) {
+    initLogItem(name, item);
+    snapshot_rows = std::make_unique<SnapshotLogStream>(item);
+    callback = [&snapshot_rows](Row&& row) {
+      return snapshot_rows->add(std::move(row));
+    };
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto rows = (stream) ? &callback : nullptr;
+  auto sql = (FLAGS_enable_monitor) ? monitor(name, query, dbc, rows)
+                                    : executeQuery(query, dbc, rows);
+  static auto& executed = Metrics::counter("schedule_queries_executed");
+  static auto& duration = Metrics::histogram("schedule_query_duration_ms");
+  executed.add();
+  duration.observe(std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count());
+
+  TRACE_PROBE2(query__executed,
+               name.c_str(),
+               (stream) ? snapshot_rows->rows() : sql.rows().size());
+
+  // A snapshot streamed by a query that did not complete is marked so.
+  auto action = watched.action();
+  if (stream && (action != WorkerQueryAction::NONE || budget.expired() ||
+                 !sql.ok())) {
+    snapshot_rows->abort();
+  }
+
+  if (action != WorkerQueryAction::NONE) {
+    auto blacklist = (action == WorkerQueryAction::BLACKLIST);
+    LOG(WARNING) << "Scheduled query " << name << " was stopped by the "
+                 << "watchdog for " << ((blacklist) ? "memory" : "CPU")
+                 << " use";
+    Config::getInstance().blacklistQuery(
+        name, (blacklist) ? kScheduleBlacklistTime : kScheduleThrottleTime);
+    Metrics::counter("schedule_queries_stopped",
+                     (blacklist) ? "reason=memory" : "reason=cpu")
+        .add();
+    return;
+  } else if (budget.expired()) {
+    LOG(WARNING) << "Scheduled query " << name << " exceeded its timeout of "
+                 << timeout << " seconds";
+    static auto& timeouts = Metrics::counter("schedule_queries_timed_out");
+    timeouts.add();
+    return;
+  } else if (!sql.ok()) {
     LOG(ERROR) << "Error executing scheduled query " << name << ": "
                << sql.getMessageString();
+    static auto& errors = Metrics::counter("schedule_query_errors");
+    errors.add();
     return;
   }
 
-  // Fill in a host identifier fields based on configuration or availability.
-  std::string ident = getHostIdentifier();
+  if (budget.truncated()) {
+    Config::getInstance().recordQueryTruncated(name);
+    static auto& truncated = Metrics::counter("schedule_queries_truncated");
+    truncated.add();
+    if (!snapshot) {
+      // A partial differential would log the missing rows as removed.
+      LOG(WARNING) << "Scheduled query " << name << " exceeded its result "
+                   << "limits, its results are not logged";
+      return;
+    }
+    LOG(WARNING) << "Scheduled query " << name << " exceeded its result "
+                 << "limits, logging truncated results";
+  }
 
-  // A query log item contains an optional set of differential results or
-  // a copy of the most-recent execution alongside some query metadata.
-  QueryLogItem item;
-  item.name = name;
-  item.identifier = ident;
-  item.time = osquery::getUnixTime();
-  item.calendar_time = osquery::getAsciiTime();
-  getDecorations(item.decorations);
+  if (stream) {
+    // Earlier lines of a chunked snapshot were logged as the query ran.
+    snapshot_rows->finish();
+    return;
+  }
+
+  initLogItem(name, item);
+  if (snapshot) {
+    // Snapshots matching the last logged snapshot may log only a marker.
+    bool unchanged = false;
+    std::string fingerprint;
+    if (dedup) {
+      dbQuery.getSnapshotFingerprint(sql.rows(), fingerprint, unchanged);
+    }
+
+    if (unchanged) {
+      static auto& unchanged_count =
+          Metrics::counter("schedule_snapshots_unchanged");
+      unchanged_count.add();
+      if (FLAGS_schedule_snapshot_unchanged == "skip") {
+        VLOG(1) << "Skipping unchanged snapshot for query: " << name;
+        return;
+      }
+      item.snapshot_unchanged = true;
+      item.snapshot_fingerprint = fingerprint;
+      logSnapshotQuery(item);
+      return;
+    }
 
-  if (query.options.count("snapshot") && query.options.at("snapshot")) {
     // This is a snapshot query, emit results with a differential or state.
     item.snapshot_results = std::move(sql.rows());
-    logSnapshotQuery(item);
+    auto status = logSnapshotQuery(item);
+    if (dedup && status.ok()) {
+      dbQuery.saveSnapshotFingerprint(fingerprint);
+    }
     return;
   }
 
-  // Create a database-backed set of query results.
-  auto dbQuery = Query(name, query);
   // Comparisons and stores must include escaped data.
   sql.escapeResults();
 
@@ -108,6 +497,7 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
   // We can then ask for a differential from the last time this named query
   // was executed by exact matching each row.
   if (!FLAGS_events_optimize || !sql.eventBased()) {
+    TRACE_PROBE1(query__diff, name.c_str());
     status = dbQuery.addNewResults(sql.rows(), diff_results);
     if (!status.ok()) {
       std::string line =
@@ -117,6 +507,13 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
       // If the database is not available then the daemon cannot continue.
       Initializer::requestShutdown(EXIT_CATASTROPHIC, line);
     }
+
+    // The next execution may be skipped if the tables do not change.
+    if (FLAGS_schedule_generations) {
+      dbQuery.saveGenerations(sql.generations());
+    } else {
+      dbQuery.saveGenerations({});
+    }
   } else {
     diff_results.added = std::move(sql.rows());
   }
@@ -132,6 +529,10 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
     item.results.removed.clear();
   }
 
+  TRACE_PROBE3(query__log,
+               name.c_str(),
+               item.results.added.size(),
+               item.results.removed.size());
   status = logQueryLogItem(item);
   if (!status.ok()) {
     // If log directory is not available, then the daemon shouldn't continue.
@@ -140,27 +541,239 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
     LOG(ERROR) << error;
     Initializer::requestShutdown(EXIT_CATASTROPHIC, error);
   }
+  TRACE_PROBE2(query__done, name.c_str(), status.getCode());
+}
+
+SchedulerPool::SchedulerPool(size_t workers) {
+  for (size_t i = 0; i < workers; ++i) {
+    workers_.push_back(std::thread(&SchedulerPool::work, this));
+  }
+}
+
+SchedulerPool::~SchedulerPool() {
+  stop();
+}
+
+bool SchedulerPool::dispatch(const std::string& name,
+                             const ScheduledQuery& query,
+                             size_t step) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopped_ || active_.count(name) > 0) {
+      return false;
+    }
+
+    SchedulerJob job;
+    job.name = name;
+    job.query = query;
+    job.step = step;
+    jobs_.push_back(std::move(job));
+    active_.insert(name);
+  }
+  queued_.notify_one();
+  return true;
+}
+
+void SchedulerPool::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this]() { return active_.empty(); });
+}
+
+void SchedulerPool::stop() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopped_ = true;
+    for (const auto& job : jobs_) {
+      active_.erase(job.name);
+    }
+    jobs_.clear();
+  }
+  queued_.notify_all();
+
+  for (auto& worker : workers_) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+}
+
+size_t SchedulerPool::pending() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return active_.size();
+}
+
+void SchedulerPool::work() {
+  while (true) {
+    SchedulerJob job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      queued_.wait(lock, [this]() { return stopped_ || !jobs_.empty(); });
+      if (jobs_.empty()) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+
+    // The cache interval and step are local to the executing thread.
+    TablePlugin::kCacheInterval = job.query.splayed_interval;
+    TablePlugin::kCacheStep = job.step;
+    launchQuery(job.name, job.query, job.step, SQLiteDBManager::get());
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      active_.erase(job.name);
+    }
+    done_.notify_all();
+  }
+}
+
+/// Estimate the CPU time of a query in microseconds from previous executions.
+static uint64_t estimateCost(const std::string& name) {
+  uint64_t cost = 0;
+  Config::getInstance().getPerformanceStats(
+      name, ([&cost](const QueryPerformance& perf) {
+        if (perf.executions > 0) {
+          cost = (perf.user_time + perf.system_time) / perf.executions;
+        }
+      }));
+  return cost;
+}
+
+bool SchedulerRunner::queue(const std::string& name,
+                            const ScheduledQuery& query,
+                            size_t step) {
+  if (!queued_.insert(name).second) {
+    return false;
+  }
+
+  SchedulerJob job;
+  job.name = name;
+  job.query = query;
+  job.step = step;
+  due_.push(std::move(job));
+  return true;
+}
+
+void SchedulerRunner::runDue(size_t step, size_t due, SchedulerPool* pool) {
+  ScheduleLoad load;
+  load.step = step;
+  load.due = due;
+
+  // The queries of this step share the 'always' decorations.
+  if (!due_.empty()) {
+    refreshDecorators(step);
+  }
+
+  uint64_t budget = FLAGS_schedule_budget_ms * 1000;
+  while (!due_.empty()) {
+    const auto& next = due_.top();
+    auto cost = estimateCost(next.name);
+    auto max_defer = std::min(next.query.splayed_interval, kScheduleMaxDefer);
+    bool overdue = (step >= next.step + max_defer);
+    if (budget > 0 && load.executed > 0 && load.cost + cost > budget &&
+        !overdue) {
+      // Defer this, and every later query, to the next step.
+      break;
+    }
+
+    auto job = next;
+    due_.pop();
+    queued_.erase(job.name);
+    load.executed++;
+    load.cost += cost;
+
+    if (pool == nullptr) {
+      TablePlugin::kCacheInterval = job.query.splayed_interval;
+      TablePlugin::kCacheStep = step;
+      launchQuery(job.name, job.query, job.step);
+    } else if (!pool->dispatch(job.name, job.query, job.step)) {
+      VLOG(1) << "Scheduled query " << job.name << " is still executing";
+    }
+  }
+
+  load.deferred = due_.size();
+  Config::getInstance().recordScheduleLoad(load);
+}
+
+void SchedulerRunner::logPerformance() {
+  Config::getInstance().scheduledQueries(
+      ([this](const std::string& name, const ScheduledQuery& query) {
+        Config::getInstance().getPerformanceStats(
+            name, ([this, &name](const QueryPerformance& perf) {
+              if (perf.executions != reported_[name]) {
+                reported_[name] = perf.executions;
+                LOG(INFO) << "Query performance " << name << ": "
+                          << describePerformance(perf);
+              }
+            }));
+      }));
+}
+
+/**
+ * @brief Release SQLite and database memory, keeping warm caches.
+ *
+ * The connections keep their attached tables and prepared statements, and
+ * the database keeps its handles and read cache, so the next queries do not
+ * start cold.
+ */
+static void reclaimMemory() {
+  auto bytes = SQLiteDBManager::reclaimMemory();
+  static auto& reclaimed = Metrics::counter("schedule_reload_bytes_released");
+  reclaimed.add(static_cast<long long>(bytes));
+
+  auto status = releaseDatabaseMemory();
+  if (!status.ok()) {
+    VLOG(1) << "Cannot release database memory: " << status.getMessage();
+  }
+  VLOG(1) << "Schedule reload released " << bytes << " bytes of SQLite memory";
 }
 
 void SchedulerRunner::start() {
+  // Due queries are executed by workers when more than one is requested.
+  std::unique_ptr<SchedulerPool> pool;
+  if (FLAGS_schedule_workers > 1) {
+    pool.reset(new SchedulerPool(static_cast<size_t>(FLAGS_schedule_workers)));
+  }
+
   // Start the counter at the second.
   auto i = osquery::getUnixTime();
   for (; (timeout_ == 0) || (i <= timeout_); ++i) {
+    size_t due = 0;
     Config::getInstance().scheduledQueries(
-        ([&i](const std::string& name, const ScheduledQuery& query) {
+        ([this, &i, &due](const std::string& name,
+                          const ScheduledQuery& query) {
           if (query.splayed_interval > 0 && i % query.splayed_interval == 0) {
-            TablePlugin::kCacheInterval = query.splayed_interval;
-            TablePlugin::kCacheStep = i;
-            launchQuery(name, query);
+            due += (queue(name, query, i)) ? 1 : 0;
           }
         }));
+    runDue(i, due, pool.get());
+
     // Configuration decorators run on 60 second intervals only.
     if ((i % 60) == 0) {
       runDecorators(DECORATE_INTERVAL, i);
     }
     if (FLAGS_schedule_reload > 0 && (i % FLAGS_schedule_reload) == 0) {
-      SQLiteDBManager::resetPrimary();
-      resetDatabase();
+      if (FLAGS_schedule_reload_reset) {
+        // Executing queries must complete before the database is reset.
+        if (pool != nullptr) {
+          pool->wait();
+        }
+        SQLiteDBManager::resetPrimary();
+        resetDatabase();
+      } else {
+        reclaimMemory();
+      }
+    }
+
+    if (FLAGS_schedule_performance_interval > 0 &&
+        (i % FLAGS_schedule_performance_interval) == 0) {
+      logPerformance();
+    }
+
+    if (FLAGS_metrics_textfile_interval > 0 &&
+        (i % FLAGS_metrics_textfile_interval) == 0) {
+      Metrics::writeTextfile();
     }
 
     // Put the thread into an interruptible sleep without a config instance.
@@ -169,6 +782,10 @@ void SchedulerRunner::start() {
       break;
     }
   }
+
+  if (pool != nullptr) {
+    pool->stop();
+  }
 }
 
 void startScheduler() {
@@ -10,14 +10,106 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <thread>
+#include <vector>
 
+#include <osquery/database.h>
 #include <osquery/dispatcher.h>
 
 #include "osquery/sql/sqlite_util.h"
 
 namespace osquery {
 
+/// A due scheduled query waiting to execute.
+struct SchedulerJob {
+  /// The unique name of the scheduled query.
+  std::string name;
+
+  /// The scheduled query.
+  ScheduledQuery query;
+
+  /// The schedule step when the query was due.
+  size_t step{0};
+
+  /// Queries due earlier execute first, then those with shorter intervals.
+  bool operator<(const SchedulerJob& other) const {
+    if (step != other.step) {
+      return step > other.step;
+    }
+    return query.splayed_interval > other.query.splayed_interval;
+  }
+};
+
+/**
+ * @brief A bounded set of threads executing due scheduled queries.
+ *
+ * A slow query executing serially delays every other query due in the same
+ * schedule step. The SchedulerRunner instead dispatches due queries to a pool
+ * of workers, each query executes using its own SQLite connection.
+ *
+ * A query is never queued while a previous execution is queued or running.
+ * Its differential results are computed serially and the queue is bounded by
+ * the number of scheduled queries.
+ */
+class SchedulerPool {
+ public:
+  explicit SchedulerPool(size_t workers);
+  ~SchedulerPool();
+
+  /**
+   * @brief Queue a due query for a worker.
+   *
+   * @param name The unique name of the scheduled query.
+   * @param query The scheduled query.
+   * @param step The schedule step when the query was due.
+   * @return false if the query is already queued or running.
+   */
+  bool dispatch(const std::string& name,
+                const ScheduledQuery& query,
+                size_t step);
+
+  /// Wait until no queries are queued or running.
+  void wait();
+
+  /// Discard queued queries and join the workers after running queries end.
+  void stop();
+
+  /// The number of queries queued or running.
+  size_t pending();
+
+ private:
+  /// The worker thread entry point.
+  void work();
+
+ private:
+  /// Due queries in the order they were dispatched.
+  std::deque<SchedulerJob> jobs_;
+
+  /// Names of queued and running queries.
+  std::set<std::string> active_;
+
+  /// The worker threads.
+  std::vector<std::thread> workers_;
+
+  /// Protection around the queue and active names.
+  std::mutex mutex_;
+
+  /// Signaled when a query is queued or the pool is stopped.
+  std::condition_variable queued_;
+
+  /// Signaled when a query completes.
+  std::condition_variable done_;
+
+  /// The pool is no longer accepting queries.
+  bool stopped_{false};
+};
+
 /// A Dispatcher service thread that watches an ExtensionManagerHandler.
 class SchedulerRunner : public InternalRunnable {
  public:
@@ -32,6 +124,37 @@ class SchedulerRunner : public InternalRunnable {
   void stop() override {}
 
  protected:
+  /**
+   * @brief Queue a query that is due at a schedule step.
+   *
+   * @return false if the query is already waiting to execute.
+   */
+  bool queue(const std::string& name, const ScheduledQuery& query, size_t step);
+
+  /**
+   * @brief Execute or dispatch queued queries within the step's CPU budget.
+   *
+   * The cost of each query is estimated from its previous executions. When a
+   * budget is set, queries that would exceed it are deferred to later steps.
+   * At least one query executes each step, and a query deferred for its
+   * interval (or kScheduleMaxDefer seconds) executes regardless of the budget.
+   *
+   * @param step The current schedule step.
+   * @param due The number of queries queued for this step.
+   * @param pool Optional workers, otherwise queries execute on this thread.
+   */
+  void runDue(size_t step, size_t due, SchedulerPool* pool);
+
+  /// Log the performance of queries executed since the previous report.
+  void logPerformance();
+
+ protected:
+  /// Queued queries ordered by their due step.
+  std::priority_queue<SchedulerJob> due_;
+
+  /// Names of queued queries.
+  std::set<std::string> queued_;
+
   /// The UNIX domain socket path for the ExtensionManager.
   std::map<std::string, size_t> splay_;
 
@@ -40,9 +163,36 @@ class SchedulerRunner : public InternalRunnable {
 
   /// Maximum number of steps.
   unsigned long int timeout_;
+
+  /// The executions of each query at its last performance report.
+  std::map<std::string, size_t> reported_;
+
+ private:
+  FRIEND_TEST(SchedulerTests, test_scheduler_budget);
 };
 
-SQLInternal monitor(const std::string& name, const ScheduledQuery& query);
+/**
+ * @brief Execute a query and record its performance.
+ *
+ * @param name The unique name of the scheduled query.
+ * @param query The scheduled query.
+ * @param dbc An optional SQLite connection, the primary is used by default.
+ * @param callback An optional receiver of each row, rather than the results.
+ */
+SQLInternal monitor(const std::string& name,
+                    const ScheduledQuery& query,
+                    const SQLiteDBInstanceRef& dbc = nullptr,
+                    const QueryRowCallback* callback = nullptr);
+
+/**
+ * @brief A compact description of a query's recent performance.
+ *
+ * Percentiles of the recent executions are written as p50/p95/p99, followed
+ * by the generate time of each scanned table, the most costly first.
+ * For example: "executions=4 wall_ms=2/9/9 rows=10/12/12 bytes=380/420/420
+ * tables=processes:31ms,users:2ms".
+ */
+std::string describePerformance(const QueryPerformance& perf);
 
 /// Start querying according to the config's schedule
 void startScheduler();
@@ -124,4 +124,48 @@ TEST_F(DispatcherTests, test_stop_dispatcher) {
   auto s = Dispatcher::addService(r1);
   EXPECT_FALSE(s);
 }
+
+TEST_F(DispatcherTests, test_tasks) {
+  // Tasks complete on the pool's threads.
+  std::atomic<size_t> executed{0};
+  for (size_t i = 0; i < 100; i++) {
+    EXPECT_TRUE(Dispatcher::addTask([&executed]() -> size_t {
+      executed++;
+      return 0;
+    }));
+  }
+
+  // A timer repeats until it returns 0.
+  std::atomic<size_t> repeated{0};
+  Dispatcher::addTask(
+      [&repeated]() -> size_t { return (++repeated < 3) ? 10 : 0; }, 10);
+
+  for (size_t i = 0; i < 200; i++) {
+    if (executed == 100 && repeated == 3) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(100U, executed);
+  EXPECT_EQ(3U, repeated);
+  EXPECT_EQ(0U, Dispatcher::instance().taskCount());
+}
+
+TEST_F(DispatcherTests, test_stop_tasks) {
+  // Delayed tasks are dropped when the dispatcher stops.
+  std::atomic<size_t> executed{0};
+  Dispatcher::addTask(
+      [&executed]() -> size_t {
+        executed++;
+        return 0;
+      },
+      100 * 1000);
+  EXPECT_EQ(1U, Dispatcher::instance().taskCount());
+
+  Dispatcher::stopServices();
+  EXPECT_FALSE(Dispatcher::addTask([]() -> size_t { return 0; }));
+  Dispatcher::joinServices();
+  EXPECT_EQ(0U, executed);
+  EXPECT_EQ(0U, Dispatcher::instance().taskCount());
+}
 }
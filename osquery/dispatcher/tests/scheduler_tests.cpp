@@ -21,6 +21,7 @@ namespace osquery {
 
 DECLARE_bool(disable_logging);
 DECLARE_uint64(schedule_reload);
+DECLARE_uint64(schedule_budget_ms);
 
 class SchedulerTests : public testing::Test {
   void SetUp() override {
@@ -63,6 +64,10 @@ TEST_F(SchedulerTests, test_monitor) {
   // performance stats are tracked independently.
   EXPECT_EQ(perf.executions, 1U);
   EXPECT_GT(perf.output_size, 0U);
+  EXPECT_EQ(perf.rows, 1U);
+  ASSERT_EQ(perf.tables.count("time"), 1U);
+  EXPECT_EQ(perf.tables["time"].filters, 1U);
+  EXPECT_EQ(perf.tables["time"].rows, 1U);
 
   // A bit more testing, potentially redundant, check the database results.
   // Since we are only monitoring, no 'actual' results are stored.
@@ -173,6 +178,126 @@ TEST_F(SchedulerTests, test_scheduler) {
   TablePlugin::kCacheInterval = backup_interval;
 }
 
+TEST_F(SchedulerTests, test_scheduler_pool) {
+  ScheduledQuery query;
+  query.interval = 10;
+  query.splayed_interval = 10;
+  query.query = "select * from time";
+
+  // The query was due 5 seconds ago.
+  auto step = osquery::getUnixTime() - 5;
+  {
+    SchedulerPool pool(2);
+    EXPECT_TRUE(pool.dispatch("pool_test_query", query, step));
+    pool.wait();
+    EXPECT_EQ(0U, pool.pending());
+
+    // Once complete the same query may be dispatched again.
+    EXPECT_TRUE(pool.dispatch("pool_test_query", query, step));
+    pool.stop();
+    EXPECT_FALSE(pool.dispatch("pool_test_query", query, step));
+  }
+
+  // The first execution started at least 5 seconds after it was due.
+  QueryPerformance perf;
+  Config::getInstance().getPerformanceStats(
+      "pool_test_query", ([&perf](const QueryPerformance& r) { perf = r; }));
+  EXPECT_GE(perf.executions, 1U);
+  EXPECT_GE(perf.drift, 5U);
+
+  // Completed queries are not marked as executing.
+  std::string executing;
+  getDatabaseValue(kPersistentSettings, kExecutingQuery, executing);
+  EXPECT_TRUE(executing.empty());
+}
+
+TEST_F(SchedulerTests, test_scheduler_budget) {
+  ScheduledQuery query;
+  query.interval = 10;
+  query.splayed_interval = 10;
+  query.query = "select * from time";
+
+  // Each query previously used 2ms of CPU time.
+  ResourceUsage r0;
+  ResourceUsage r1;
+  r1.user_time = 2000;
+  Config::getInstance().recordQueryPerformance("budget_1", 0, r0, r1);
+  Config::getInstance().recordQueryPerformance("budget_2", 0, r0, r1);
+  Config::getInstance().recordQueryPerformance("budget_3", 0, r0, r1);
+
+  auto backup_budget = FLAGS_schedule_budget_ms;
+  FLAGS_schedule_budget_ms = 3;
+
+  SchedulerRunner runner(0, 1);
+  size_t step = 1000;
+  EXPECT_TRUE(runner.queue("budget_1", query, step));
+  EXPECT_TRUE(runner.queue("budget_2", query, step));
+  EXPECT_FALSE(runner.queue("budget_2", query, step));
+  EXPECT_TRUE(runner.queue("budget_3", query, step));
+
+  // Only the first query fits within the budget.
+  runner.runDue(step, 3, nullptr);
+  EXPECT_EQ(2U, runner.due_.size());
+  runner.runDue(step + 1, 0, nullptr);
+  EXPECT_EQ(1U, runner.due_.size());
+
+  // A query deferred for its interval is executed regardless of the budget.
+  EXPECT_TRUE(runner.queue("budget_1", query, step + 2));
+  runner.runDue(step + 12, 0, nullptr);
+  EXPECT_EQ(0U, runner.due_.size());
+
+  std::vector<ScheduleLoad> loads;
+  Config::getInstance().scheduleLoad(
+      [&loads](const ScheduleLoad& load) { loads.push_back(load); });
+  ASSERT_EQ(3U, loads.size());
+  EXPECT_EQ(3U, loads[0].due);
+  EXPECT_EQ(1U, loads[0].executed);
+  EXPECT_EQ(2U, loads[0].deferred);
+  EXPECT_EQ(2000U, loads[0].cost);
+  EXPECT_EQ(2U, loads[2].executed);
+
+  FLAGS_schedule_budget_ms = backup_budget;
+}
+
+TEST_F(SchedulerTests, test_query_performance) {
+  EXPECT_EQ(0U, getPercentile({}, 50));
+  EXPECT_EQ(2U, getPercentile({4, 1, 3, 2}, 50));
+  EXPECT_EQ(4U, getPercentile({4, 1, 3, 2}, 99));
+  EXPECT_EQ(1U, getPercentile({4, 1, 3, 2}, 1));
+
+  // Record executions taking 1ms to 100ms, each returning 10 rows.
+  std::map<std::string, TableCost> tables;
+  tables["processes"].filters = 1;
+  tables["processes"].generate_time = 5000;
+  tables["processes"].rows = 10;
+  tables["users"].generate_time = 30000;
+  for (size_t i = 1; i <= 100; i++) {
+    ResourceUsage r0;
+    ResourceUsage r1;
+    r1.wall_time = i * 1000;
+    Config::getInstance().recordQueryPerformance(
+        "performance", 200, r0, r1, 10, tables);
+  }
+
+  QueryPerformance perf;
+  Config::getInstance().getPerformanceStats(
+      "performance", ([&perf](const QueryPerformance& r) { perf = r; }));
+  EXPECT_EQ(100U, perf.executions);
+  EXPECT_EQ(1000U, perf.rows);
+  // Only the most recent executions are kept, from 37ms to 100ms.
+  ASSERT_EQ(kQueryPerformanceSamples, perf.recent.size());
+  EXPECT_EQ(37000U, perf.recent.front().wall_time);
+  EXPECT_EQ(100U, perf.tables["processes"].filters);
+  EXPECT_EQ(500000U, perf.tables["processes"].generate_time);
+  EXPECT_EQ(1000U, perf.tables["processes"].rows);
+
+  // The most costly table is described first.
+  EXPECT_EQ(
+      "executions=100 wall_ms=68/97/100 rows=10/10/10 bytes=200/200/200 "
+      "tables=users:3000ms,processes:500ms",
+      describePerformance(perf));
+}
+
 TEST_F(SchedulerTests, test_scheduler_reload) {
   std::string config =
       "{\"schedule\":{\"1\":{"
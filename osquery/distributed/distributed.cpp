@@ -8,7 +8,12 @@
  *
  */
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <limits>
 #include <sstream>
+#include <thread>
 #include <utility>
 
 #include <osquery/core.h>
@@ -16,9 +21,12 @@
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 #include <osquery/system.h>
+#include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
+#include "osquery/core/watcher.h"
+#include "osquery/sql/sqlite_util.h"
 
 namespace pt = boost::property_tree;
 
@@ -33,8 +41,175 @@ FLAG(bool,
      true,
      "Disable distributed queries (default true)");
 
+FLAG(uint64,
+     distributed_workers,
+     4,
+     "Number of distributed queries executed concurrently (default 4)");
+
+FLAG(uint64,
+     distributed_timeout,
+     0,
+     "Seconds before a distributed query is interrupted (default 0, none)");
+
+FLAG(uint64,
+     distributed_chunk_bytes,
+     0,
+     "Send distributed results in requests of about this size (default 0)");
+
+FLAG(uint64,
+     distributed_max_result_bytes,
+     0,
+     "Fail distributed queries with larger results (default 0, no limit)");
+
+FLAG(uint64,
+     distributed_cache_bytes,
+     1024 * 1024,
+     "Largest distributed result cached for repeated queries (default 1MB)");
+
 const std::string kDistributedQueryPrefix{"distributed."};
 
+/// The max-age hints of pending queries, keyed by query ID.
+const std::string kDistributedMaxAgePrefix{"distributed_max_age."};
+
+/// Cached results of distributed queries, keyed by query text.
+const std::string kDistributedCachePrefix{"distributed_cache."};
+
+/// Cached results older than this are removed, whatever the hints.
+const size_t kDistributedCacheExpire{24 * 60 * 60};
+
+/// Milliseconds between flushes of partial results while queries run.
+const size_t kDistributedFlushPeriod{1000};
+
+/// Estimate the size of rows written as JSON.
+static size_t getResultSize(const QueryData& rows) {
+  size_t size = 0;
+  for (const auto& row : rows) {
+    size += 2;
+    for (const auto& column : row) {
+      size += column.first.size() + column.second.size() + 6;
+    }
+  }
+  return size;
+}
+
+/// The estimated size of queued results before workers wait for flushes.
+static size_t getPendingLimit() {
+  // A quarter of the worker's memory may be held by unsent results.
+  auto limit = getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024;
+  return (limit == 0) ? std::numeric_limits<size_t>::max() : limit / 4;
+}
+
+/**
+ * @brief Serialize the next chunk of results, starting at the first result.
+ *
+ * Rows are added until the chunk reaches max_bytes, so a chunk holds the
+ * remaining rows of several small results or part of a large one. For each
+ * result in the chunk, ends holds the number of its rows sent after it.
+ */
+static Status serializeDistributedChunk(
+    const std::vector<DistributedQueryResult>& completed,
+    size_t first,
+    size_t max_bytes,
+    std::string& json,
+    std::vector<size_t>& ends) {
+  json.clear();
+  ends.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  writer.key("queries");
+  writer.startObject();
+  for (size_t i = first; i < completed.size(); i++) {
+    if (!ends.empty() && json.size() >= max_bytes) {
+      break;
+    }
+
+    const auto& result = completed[i];
+    writer.key(result.request.id);
+    writer.startArray();
+    auto row = result.sent;
+    // Every chunk makes progress, even with a row larger than a chunk.
+    for (; row < result.results.size(); row++) {
+      if (row > result.sent && json.size() >= max_bytes) {
+        break;
+      }
+      writer.startObject();
+      for (const auto& column : result.columns) {
+        auto it = result.results[row].find(column);
+        if (it == result.results[row].end()) {
+          return Status(1, "Missing column: " + column);
+        }
+        writer.value(column, it->second);
+      }
+      writer.endObject();
+    }
+    writer.endArray();
+    ends.push_back(row);
+  }
+  writer.endObject();
+
+  writer.key("statuses");
+  writer.startObject();
+  for (size_t i = 0; i < ends.size(); i++) {
+    const auto& result = completed[first + i];
+    writer.value(result.request.id, std::to_string(result.status.getCode()));
+  }
+  writer.endObject();
+
+  // A server appends the rows of each sequence until a query is complete.
+  writer.key("chunks");
+  writer.startObject();
+  for (size_t i = 0; i < ends.size(); i++) {
+    const auto& result = completed[first + i];
+    writer.key(result.request.id);
+    writer.startObject();
+    writer.value("sequence", std::to_string(result.sequence));
+    writer.value("complete",
+                 (ends[i] == result.results.size()) ? "true" : "false");
+    writer.endObject();
+  }
+  writer.endObject();
+  writer.endObject();
+  json += '\n';
+  return Status(0, "OK");
+}
+
+static Status serializeDistributedResults(
+    const std::vector<DistributedQueryResult>& completed, std::string& json) {
+  // Rows are written directly to the request body, without a property tree.
+  json.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  writer.key("queries");
+  if (completed.empty()) {
+    writer.value("");
+  } else {
+    writer.startObject();
+    for (const auto& result : completed) {
+      writer.key(result.request.id);
+      auto s = serializeQueryData(result.results, result.columns, writer);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    writer.endObject();
+  }
+
+  writer.key("statuses");
+  if (completed.empty()) {
+    writer.value("");
+  } else {
+    writer.startObject();
+    for (const auto& result : completed) {
+      writer.value(result.request.id,
+                   std::to_string(result.status.getCode()));
+    }
+    writer.endObject();
+  }
+  writer.endObject();
+  json += '\n';
+  return Status(0, "OK");
+}
+
 Status DistributedPlugin::call(const PluginRequest& request,
                                PluginResponse& response) {
   if (request.count("action") == 0) {
@@ -43,8 +218,11 @@ Status DistributedPlugin::call(const PluginRequest& request,
 
   if (request.at("action") == "getQueries") {
     std::string queries;
-    getQueries(queries);
+    auto status = getQueries(queries);
     response.push_back({{"results", queries}});
+    if (status.ok() && isLongPolling()) {
+      response.back()["long_poll"] = "1";
+    }
     return Status(0, "OK");
   } else if (request.at("action") == "writeResults") {
     if (request.count("results") == 0) {
@@ -63,6 +241,7 @@ Status Distributed::pullUpdates() {
     return Status(1, "Missing distributed plugin: " + distributed_plugin);
   }
 
+  long_poll_ = false;
   PluginResponse response;
   auto status =
       Registry::call("distributed", {{"action", "getQueries"}}, response);
@@ -70,6 +249,10 @@ Status Distributed::pullUpdates() {
     return status;
   }
 
+  if (response.size() > 0 && response[0].count("long_poll") > 0) {
+    long_poll_ = true;
+  }
+
   if (response.size() > 0 && response[0].count("results") > 0) {
     return acceptWork(response[0]["results"]);
   }
@@ -84,94 +267,329 @@ size_t Distributed::getPendingQueryCount() {
 }
 
 size_t Distributed::getCompletedCount() {
+  std::lock_guard<std::mutex> lock(results_mutex_);
   return results_.size();
 }
 
 Status Distributed::serializeResults(std::string& json) {
-  pt::ptree queries;
-  pt::ptree statuses;
-  for (const auto& result : results_) {
-    pt::ptree qd;
-    auto s = serializeQueryData(result.results, result.columns, qd);
-    if (!s.ok()) {
-      return s;
+  std::lock_guard<std::mutex> lock(results_mutex_);
+  return serializeDistributedResults(results_, json);
+}
+
+void Distributed::addResult(DistributedQueryResult&& result) {
+  auto size = getResultSize(result.results);
+  auto limit = getPendingLimit();
+  std::unique_lock<std::mutex> lock(results_mutex_);
+  results_flushed_.wait(lock, [this, size, limit]() {
+    return results_bytes_ == 0 || results_bytes_ + size <= limit || stopped_;
+  });
+  results_bytes_ += size;
+  results_.push_back(std::move(result));
+}
+
+/// Read a cached result of the query no older than max_age seconds.
+static bool getCachedResult(const DistributedQueryRequest& request,
+                            DistributedQueryResult& result) {
+  std::string content;
+  if (!getDatabaseValue(kQueries,
+                        kDistributedCachePrefix + request.query,
+                        content)
+           .ok()) {
+    return false;
+  }
+
+  try {
+    pt::ptree tree;
+    if (!parseJSONTree(content, tree).ok()) {
+      return false;
     }
-    queries.add_child(result.request.id, qd);
-    statuses.put(result.request.id, result.status.getCode());
+    if (tree.get<size_t>("time", 0) + request.max_age < getUnixTime()) {
+      return false;
+    }
+
+    ColumnNames columns;
+    for (const auto& column : tree.get_child("columns")) {
+      columns.push_back(column.second.data());
+    }
+    QueryData rows;
+    if (!deserializeQueryData(tree.get_child("results"), rows).ok()) {
+      return false;
+    }
+    result = DistributedQueryResult(request, {}, columns, Status(0, "OK"));
+    result.results = std::move(rows);
+  } catch (const pt::ptree_error& /* e */) {
+    return false;
   }
+  return true;
+}
 
-  pt::ptree results;
-  results.add_child("queries", queries);
-  results.add_child("statuses", statuses);
+/// Store a result for later requests of the same query.
+static void setCachedResult(const DistributedQueryResult& result) {
+  std::string content;
+  JSONWriter writer(content);
+  writer.startObject();
+  writer.value("time", std::to_string(getUnixTime()));
+  writer.key("columns");
+  writer.startArray();
+  for (const auto& column : result.columns) {
+    writer.value(column);
+  }
+  writer.endArray();
+  writer.key("results");
+  if (!serializeQueryData(result.results, result.columns, writer).ok()) {
+    return;
+  }
+  writer.endObject();
 
-  std::stringstream ss;
-  try {
-    pt::write_json(ss, results, false);
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error writing JSON: " + std::string(e.what()));
+  if (content.size() <= FLAGS_distributed_cache_bytes) {
+    setDatabaseValue(
+        kQueries, kDistributedCachePrefix + result.request.query, content);
   }
-  json = ss.str();
+}
 
-  return Status(0, "OK");
+/// Remove cached results that no max-age hint should select.
+static void expireCachedResults() {
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kQueries, keys, kDistributedCachePrefix);
+  auto now = getUnixTime();
+  for (const auto& key : keys) {
+    std::string content;
+    getDatabaseValue(kQueries, key, content);
+    size_t time = 0;
+    pt::ptree tree;
+    if (parseJSONTree(content, tree).ok()) {
+      time = tree.get<size_t>("time", 0);
+    }
+
+    if (time + kDistributedCacheExpire < now) {
+      deleteDatabaseValue(kQueries, key);
+    }
+  }
 }
 
-void Distributed::addResult(const DistributedQueryResult& result) {
-  results_.push_back(result);
+DistributedQueryResult Distributed::runRequest(
+    const DistributedQueryRequest& request) {
+  if (request.max_age > 0 && FLAGS_distributed_cache_bytes > 0) {
+    DistributedQueryResult cached;
+    if (getCachedResult(request, cached)) {
+      LOG(INFO) << "Using a cached result for distributed query: "
+                << request.id << ": " << request.query;
+      return cached;
+    }
+  }
+
+  LOG(INFO) << "Executing distributed query: " << request.id << ": "
+            << request.query;
+
+  // Each worker uses the primary or a pooled connection, never a shared one.
+  auto dbc = SQLiteDBManager::get();
+
+  // SQLite connections stop the query once its budget is spent.
+  QueryBudget budget(FLAGS_distributed_timeout * 1000, &stopped_);
+
+  // Queries expected to exceed the cost budget are rejected before running.
+  ColumnNames columns;
+  QueryData rows;
+  TableColumns table_columns;
+  auto status = checkQueryCost(request.query, dbc->db());
+  if (status.ok()) {
+    status = getQueryColumnsInternal(request.query, table_columns, dbc->db());
+  }
+  if (status.ok()) {
+    for (const auto& column : table_columns) {
+      columns.push_back(std::get<0>(column));
+    }
+    status = queryInternal(request.query, rows, dbc);
+  }
+  dbc->clearAffectedTables();
+
+  if (budget.expired()) {
+    status = Status(1, "Distributed query timed out");
+  } else if (!status.ok() && stopped_) {
+    status = Status(1, "Distributed query interrupted");
+  }
+
+  if (status.ok() && FLAGS_distributed_max_result_bytes > 0 &&
+      getResultSize(rows) > FLAGS_distributed_max_result_bytes) {
+    status = Status(1, "Distributed query results exceed the size limit");
+  }
+
+  if (!status.ok()) {
+    LOG(ERROR) << "Error executing distributed query: " << request.id << ": "
+               << status.toString();
+    rows.clear();
+  }
+
+  DistributedQueryResult result(request, {}, columns, status);
+  result.results = std::move(rows);
+  if (status.ok() && request.max_age > 0 && FLAGS_distributed_cache_bytes > 0) {
+    setCachedResult(result);
+  }
+  return result;
 }
 
 Status Distributed::runQueries() {
+  std::deque<DistributedQueryRequest> requests;
   while (getPendingQueryCount() > 0) {
-    auto request = popRequest();
-    LOG(INFO) << "Executing distributed query: " << request.id << ": "
-              << request.query;
-
-    SQL sql(request.query);
-    if (!sql.getStatus().ok()) {
-      LOG(ERROR) << "Error executing distributed query: " << request.id << ": "
-                 << sql.getMessageString();
+    requests.push_back(popRequest());
+  }
+
+  std::mutex queue_mutex;
+  std::condition_variable completed;
+  size_t remaining = requests.size();
+
+  auto work = [this, &requests, &queue_mutex, &completed, &remaining]() {
+    while (true) {
+      DistributedQueryRequest request;
+      {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (requests.empty() || stopped_) {
+          return;
+        }
+        request = std::move(requests.front());
+        requests.pop_front();
+      }
+
+      addResult(runRequest(request));
+      {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        remaining--;
+      }
+      completed.notify_one();
     }
+  };
 
-    DistributedQueryResult result(
-        request, sql.rows(), sql.columns(), sql.getStatus());
-    addResult(result);
+  auto count = std::min(requests.size(),
+                        std::max<size_t>(1, FLAGS_distributed_workers));
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < count; ++i) {
+    workers.push_back(std::thread(work));
   }
+
+  // Flush the results of completed queries while slow queries continue.
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex);
+      if (completed.wait_for(lock,
+                             std::chrono::milliseconds(kDistributedFlushPeriod),
+                             [this, &remaining]() {
+                               return remaining == 0 || stopped_;
+                             })) {
+        break;
+      }
+    }
+    flushCompleted();
+  }
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  // Requests that were not started are retried after a restart.
+  for (const auto& request : requests) {
+    setDatabaseValue(
+        kQueries, kDistributedQueryPrefix + request.id, request.query);
+    if (request.max_age > 0) {
+      setDatabaseValue(kQueries,
+                       kDistributedMaxAgePrefix + request.id,
+                       std::to_string(request.max_age));
+    }
+  }
+
+  expireCachedResults();
   return flushCompleted();
 }
 
+void Distributed::stop() {
+  stopped_ = true;
+  results_flushed_.notify_all();
+}
+
 Status Distributed::flushCompleted() {
-  if (getCompletedCount() == 0) {
+  std::vector<DistributedQueryResult> completed;
+  {
+    std::lock_guard<std::mutex> lock(results_mutex_);
+    completed.swap(results_);
+  }
+
+  if (completed.empty()) {
     return Status(0, "OK");
   }
 
   auto distributed_plugin = RegistryFactory::get().getActive("distributed");
+  auto s = Status(0, "OK");
   if (!RegistryFactory::get().exists("distributed", distributed_plugin)) {
-    return Status(1, "Missing distributed plugin " + distributed_plugin);
+    s = Status(1, "Missing distributed plugin " + distributed_plugin);
   }
 
+  // The number of results that were completely sent.
+  size_t flushed = 0;
+  size_t flushed_bytes = 0;
   std::string results;
-  auto s = serializeResults(results);
-  if (!s.ok()) {
-    return s;
+  std::vector<size_t> ends;
+  while (s.ok() && flushed < completed.size()) {
+    if (FLAGS_distributed_chunk_bytes == 0) {
+      s = serializeDistributedResults(completed, results);
+      ends.assign(completed.size(), 0);
+      for (size_t i = 0; i < completed.size(); i++) {
+        ends[i] = completed[i].results.size();
+      }
+    } else {
+      s = serializeDistributedChunk(
+          completed, flushed, FLAGS_distributed_chunk_bytes, results, ends);
+    }
+
+    if (s.ok()) {
+      PluginResponse response;
+      s = Registry::call("distributed",
+                         {{"action", "writeResults"}, {"results", results}},
+                         response);
+    }
+
+    if (!s.ok()) {
+      break;
+    }
+
+    // Only the last result of a chunk may have rows left for the next one.
+    for (const auto& end : ends) {
+      auto& result = completed[flushed];
+      result.sent = end;
+      result.sequence++;
+      if (end < result.results.size()) {
+        break;
+      }
+      flushed_bytes += getResultSize(result.results);
+      flushed++;
+    }
   }
 
-  PluginResponse response;
-  s = Registry::call("distributed",
-                     {{"action", "writeResults"}, {"results", results}},
-                     response);
-  if (s.ok()) {
-    results_.clear();
+  {
+    std::lock_guard<std::mutex> lock(results_mutex_);
+    results_bytes_ -= std::min(results_bytes_, flushed_bytes);
+    if (flushed < completed.size()) {
+      // Keep the results for the next flush, ahead of newly completed
+      // queries, resuming from their next chunk.
+      results_.insert(results_.begin(),
+                      std::make_move_iterator(completed.begin() + flushed),
+                      std::make_move_iterator(completed.end()));
+    }
   }
+  results_flushed_.notify_all();
   return s;
 }
 
 Status Distributed::acceptWork(const std::string& work) {
   try {
     pt::ptree tree;
-    {
-      std::stringstream ss(work);
-      pt::read_json(ss, tree);
+    auto status = parseJSONTree(work, tree);
+    if (!status.ok()) {
+      return Status(1, "Error parsing JSON: " + status.getMessage());
     }
 
+    // The server may allow recent results of a query to be reused, with a
+    // max-age for every query or an object of max-ages by query ID.
+    auto max_age = tree.get_child_optional("max_age");
+
     auto& queries = tree.get_child("queries");
     for (const auto& node : queries) {
       auto query = queries.get<std::string>(node.first, "");
@@ -179,6 +597,23 @@ Status Distributed::acceptWork(const std::string& work) {
         return Status(1, "Distributed query does not have complete attributes");
       }
       setDatabaseValue(kQueries, kDistributedQueryPrefix + node.first, query);
+
+      std::string age;
+      if (max_age && max_age->empty()) {
+        age = max_age->data();
+      } else if (max_age) {
+        auto child = max_age->find(node.first);
+        if (child != max_age->not_found()) {
+          age = child->second.data();
+        }
+      }
+
+      unsigned long seconds = 0;
+      if (!age.empty() && safeStrtoul(age, 10, seconds).ok() && seconds > 0) {
+        setDatabaseValue(kQueries,
+                         kDistributedMaxAgePrefix + node.first,
+                         std::to_string(seconds));
+      }
     }
 
     if (tree.count("accelerate") > 0) {
@@ -214,6 +649,16 @@ DistributedQueryRequest Distributed::popRequest() {
   request.id = next.substr(kDistributedQueryPrefix.size());
   getDatabaseValue(kQueries, next, request.query);
   deleteDatabaseValue(kQueries, next);
+
+  std::string max_age;
+  auto key = kDistributedMaxAgePrefix + request.id;
+  if (getDatabaseValue(kQueries, key, max_age).ok()) {
+    unsigned long seconds = 0;
+    if (safeStrtoul(max_age, 10, seconds).ok()) {
+      request.max_age = seconds;
+    }
+    deleteDatabaseValue(kQueries, key);
+  }
   return request;
 }
 
@@ -252,12 +697,10 @@ Status deserializeDistributedQueryRequest(const pt::ptree& tree,
 
 Status deserializeDistributedQueryRequestJSON(const std::string& json,
                                               DistributedQueryRequest& r) {
-  std::stringstream ss(json);
   pt::ptree tree;
-  try {
-    pt::read_json(ss, tree);
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error serializing JSON: " + std::string(e.what()));
+  auto s = parseJSONTree(json, tree);
+  if (!s.ok()) {
+    return Status(1, "Error serializing JSON: " + s.getMessage());
   }
   return deserializeDistributedQueryRequest(tree, r);
 }
@@ -284,20 +727,21 @@ Status serializeDistributedQueryResult(const DistributedQueryResult& r,
 
 Status serializeDistributedQueryResultJSON(const DistributedQueryResult& r,
                                            std::string& json) {
-  pt::ptree tree;
-  auto s = serializeDistributedQueryResult(r, tree);
+  json.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  writer.key("request");
+  writer.startObject();
+  writer.value("query", r.request.query);
+  writer.value("id", r.request.id);
+  writer.endObject();
+  writer.key("results");
+  auto s = serializeQueryData(r.results, r.columns, writer);
   if (!s.ok()) {
     return s;
   }
-
-  std::stringstream ss;
-  try {
-    pt::write_json(ss, tree, false);
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error serializing JSON: " + std::string(e.what()));
-  }
-  json = ss.str();
-
+  writer.endObject();
+  json += '\n';
   return Status(0, "OK");
 }
 
@@ -325,11 +769,9 @@ Status deserializeDistributedQueryResult(const pt::ptree& tree,
 Status deserializeDistributedQueryResultJSON(const std::string& json,
                                              DistributedQueryResult& r) {
   pt::ptree tree;
-  try {
-    std::stringstream ss(json);
-    pt::read_json(ss, tree);
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error serializing JSON: " + std::string(e.what()));
+  auto s = parseJSONTree(json, tree);
+  if (!s.ok()) {
+    return Status(1, "Error serializing JSON: " + s.getMessage());
   }
   return deserializeDistributedQueryResult(tree, r);
 }
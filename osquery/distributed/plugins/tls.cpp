@@ -13,6 +13,7 @@
 #include "osquery/remote/transports/tls.h"
 // clang-format on
 
+#include <chrono>
 #include <vector>
 #include <sstream>
 
@@ -48,6 +49,19 @@ FLAG(uint64,
      3,
      "Number of times to attempt a request")
 
+FLAG(bool,
+     distributed_tls_compress,
+     false,
+     "Compress TLS/HTTPS distributed query results");
+
+FLAG(uint64,
+     distributed_tls_long_poll,
+     0,
+     "Seconds the server may hold query retrieval waiting for queries");
+
+/// A long poll answered sooner without queries was not held by the server.
+const std::chrono::seconds kLongPollMinimum(1);
+
 class TLSDistributedPlugin : public DistributedPlugin {
  public:
   Status setUp() override;
@@ -56,9 +70,16 @@ class TLSDistributedPlugin : public DistributedPlugin {
 
   Status writeResults(const std::string& json) override;
 
+  bool isLongPolling() const override {
+    return long_polled_;
+  }
+
  protected:
   std::string read_uri_;
   std::string write_uri_;
+
+  /// Set if the server held the last retrieval.
+  bool long_polled_{false};
 };
 
 REGISTER(TLSDistributedPlugin, "distributed", "tls");
@@ -72,8 +93,28 @@ Status TLSDistributedPlugin::setUp() {
 Status TLSDistributedPlugin::getQueries(std::string& json) {
   pt::ptree params;
   params.put("_verb", "POST");
-  return TLSRequestHelper::go<JSONSerializer>(
-      read_uri_, params, json, FLAGS_distributed_tls_max_attempts);
+  long_polled_ = false;
+  if (FLAGS_distributed_tls_long_poll == 0) {
+    return TLSRequestHelper::go<JSONSerializer>(
+        read_uri_, params, json, FLAGS_distributed_tls_max_attempts);
+  }
+
+  // The server answers when queries are queued or the wait expires.
+  params.put("long_poll", FLAGS_distributed_tls_long_poll);
+  params.put("_timeout", FLAGS_distributed_tls_long_poll + 16);
+  auto start = std::chrono::steady_clock::now();
+  pt::ptree recv;
+  auto status = TLSRequestHelper::go<JSONSerializer>(read_uri_, params, recv);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // A server without long-poll support answers at once, so fall back to
+  // polling at the distributed interval rather than retrying in a loop.
+  auto queries = recv.get_child_optional("queries");
+  long_polled_ = (queries && !queries->empty()) ||
+                 std::chrono::steady_clock::now() - start >= kLongPollMinimum;
+  return JSONSerializer().serialize(recv, json);
 }
 
 Status TLSDistributedPlugin::writeResults(const std::string& json) {
@@ -85,6 +126,10 @@ Status TLSDistributedPlugin::writeResults(const std::string& json) {
     return Status(1, "Error parsing JSON: " + std::string(e.what()));
   }
 
+  if (FLAGS_distributed_tls_compress) {
+    params.put("_compress", true);
+  }
+
   // The response is ignored.
   std::string response;
   return TLSRequestHelper::go<JSONSerializer>(
@@ -171,7 +171,7 @@ TEST_F(DistributedTests, test_deserialize_distributed_query_result_json) {
 }
 
 TEST_F(DistributedTests, test_workflow) {
-  auto dist = Distributed();
+  Distributed dist;
   auto s = dist.pullUpdates();
   EXPECT_TRUE(s.ok());
   EXPECT_EQ(s.toString(), "OK");
@@ -185,4 +185,170 @@ TEST_F(DistributedTests, test_workflow) {
   EXPECT_EQ(dist.getPendingQueryCount(), 0U);
   EXPECT_EQ(dist.results_.size(), 0U);
 }
+
+TEST_F(DistributedTests, test_long_poll) {
+  Distributed dist;
+  auto s = dist.pullUpdates();
+  EXPECT_TRUE(s.ok());
+  EXPECT_FALSE(dist.isLongPolling());
+  dist.runQueries();
+
+  // The test server answers with queries, so the next poll may start at once.
+  auto long_poll = Flag::getValue("distributed_tls_long_poll");
+  Flag::updateValue("distributed_tls_long_poll", "5");
+  s = dist.pullUpdates();
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2U, dist.getPendingQueryCount());
+  EXPECT_TRUE(dist.isLongPolling());
+  dist.runQueries();
+
+  Flag::updateValue("distributed_tls_long_poll", long_poll);
+}
+
+class ChunkDistributedPlugin : public DistributedPlugin {
+ public:
+  Status getQueries(std::string& json) override {
+    return Status(0, "OK");
+  }
+
+  Status writeResults(const std::string& json) override {
+    if (fail) {
+      return Status(1, "Request failed");
+    }
+    writes.push_back(json);
+    return Status(0, "OK");
+  }
+
+  bool fail{false};
+  std::vector<std::string> writes;
+};
+
+TEST_F(DistributedTests, test_chunked_results) {
+  auto plugin = std::make_shared<ChunkDistributedPlugin>();
+  RegistryFactory::get().registry("distributed")->add("chunks", plugin);
+  Registry::get().setActive("distributed", "chunks");
+  auto chunk_bytes = Flag::getValue("distributed_chunk_bytes");
+  Flag::updateValue("distributed_chunk_bytes", "1");
+
+  Distributed dist;
+  DistributedQueryRequest request;
+  request.id = "rows";
+  request.query = "SELECT 1 AS n UNION ALL SELECT 2 UNION ALL SELECT 3";
+  dist.addResult(dist.runRequest(request));
+
+  // A failed request keeps the results, resuming from the unsent chunk.
+  plugin->fail = true;
+  EXPECT_FALSE(dist.flushCompleted().ok());
+  EXPECT_EQ(1U, dist.getCompletedCount());
+  plugin->fail = false;
+  EXPECT_TRUE(dist.flushCompleted().ok());
+  EXPECT_EQ(0U, dist.getCompletedCount());
+
+  // Each chunk holds a single row with a larger sequence number.
+  ASSERT_EQ(3U, plugin->writes.size());
+  for (size_t i = 0; i < plugin->writes.size(); i++) {
+    pt::ptree tree;
+    std::stringstream ss(plugin->writes[i]);
+    pt::read_json(ss, tree);
+    auto& rows = tree.get_child("queries.rows");
+    ASSERT_EQ(1U, rows.size());
+    EXPECT_EQ(std::to_string(i + 1), rows.front().second.get("n", ""));
+    EXPECT_EQ("0", tree.get("statuses.rows", ""));
+    EXPECT_EQ(std::to_string(i), tree.get("chunks.rows.sequence", ""));
+    EXPECT_EQ((i == 2) ? "true" : "false",
+              tree.get("chunks.rows.complete", ""));
+  }
+
+  // Results over the size limit fail the query.
+  auto max_bytes = Flag::getValue("distributed_max_result_bytes");
+  Flag::updateValue("distributed_max_result_bytes", "10");
+  auto result = dist.runRequest(request);
+  EXPECT_FALSE(result.status.ok());
+  EXPECT_TRUE(result.results.empty());
+
+  Flag::updateValue("distributed_max_result_bytes", max_bytes);
+  Flag::updateValue("distributed_chunk_bytes", chunk_bytes);
+  RegistryFactory::get().registry("distributed")->remove("chunks");
+}
+
+TEST_F(DistributedTests, test_cached_results) {
+  Distributed dist;
+  auto s = dist.acceptWork(
+      "{\"queries\": {\"cached\": \"SELECT 1 AS n\"}, "
+      "\"max_age\": {\"cached\": \"60\"}}");
+  ASSERT_TRUE(s.ok());
+  auto request = dist.popRequest();
+  EXPECT_EQ("cached", request.id);
+  EXPECT_EQ(60U, request.max_age);
+
+  auto result = dist.runRequest(request);
+  ASSERT_EQ(1U, result.results.size());
+  EXPECT_EQ("1", result.results[0]["n"]);
+
+  // A recent result of the same query is used while within the max-age.
+  auto key = "distributed_cache." + request.query;
+  auto cached = "{\"time\": \"" + std::to_string(getUnixTime()) +
+                "\", \"columns\": [\"n\"], \"results\": [{\"n\": "
+                "\"2\"}]}";
+  setDatabaseValue(kQueries, key, cached);
+  result = dist.runRequest(request);
+  ASSERT_EQ(1U, result.results.size());
+  EXPECT_EQ("2", result.results[0]["n"]);
+  ASSERT_EQ(1U, result.columns.size());
+  EXPECT_EQ("n", result.columns[0]);
+
+  // Requests without a max-age always execute.
+  request.max_age = 0;
+  result = dist.runRequest(request);
+  ASSERT_EQ(1U, result.results.size());
+  EXPECT_EQ("1", result.results[0]["n"]);
+
+  // An older result is replaced.
+  request.max_age = 60;
+  cached = "{\"time\": \"" + std::to_string(getUnixTime() - 120) +
+           "\", \"columns\": [\"n\"], \"results\": [{\"n\": \"2\"}]}";
+  setDatabaseValue(kQueries, key, cached);
+  result = dist.runRequest(request);
+  ASSERT_EQ(1U, result.results.size());
+  EXPECT_EQ("1", result.results[0]["n"]);
+  deleteDatabaseValue(kQueries, key);
+}
+
+TEST_F(DistributedTests, test_concurrent_timeout) {
+  auto timeout = Flag::getValue("distributed_timeout");
+  Flag::updateValue("distributed_timeout", "1");
+
+  // A query that never completes is interrupted at the deadline.
+  Distributed dist;
+  DistributedQueryRequest slow;
+  slow.id = "slow";
+  slow.query =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) "
+      "SELECT count(*) FROM c";
+  auto result = dist.runRequest(slow);
+  EXPECT_FALSE(result.status.ok());
+  EXPECT_EQ("Distributed query timed out", result.status.getMessage());
+  EXPECT_TRUE(result.results.empty());
+
+  DistributedQueryRequest fast;
+  fast.id = "fast";
+  fast.query = "SELECT 1 AS one";
+  result = dist.runRequest(fast);
+  EXPECT_TRUE(result.status.ok());
+  ASSERT_EQ(1U, result.results.size());
+  EXPECT_EQ("1", result.results[0]["one"]);
+  ASSERT_EQ(1U, result.columns.size());
+  EXPECT_EQ("one", result.columns[0]);
+
+  // The slow query does not prevent the rest of the batch from completing.
+  setDatabaseValue(kQueries, "distributed." + slow.id, slow.query);
+  setDatabaseValue(kQueries, "distributed." + fast.id, fast.query);
+  EXPECT_EQ(2U, dist.getPendingQueryCount());
+  auto s = dist.runQueries();
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0U, dist.getPendingQueryCount());
+  EXPECT_EQ(0U, dist.getCompletedCount());
+
+  Flag::updateValue("distributed_timeout", timeout);
+}
 }
@@ -8,12 +8,16 @@
  *
  */
 
+#include <fnmatch.h>
+
 #include <benchmark/benchmark.h>
 
 #include <osquery/config.h>
 #include <osquery/events.h>
 #include <osquery/tables.h>
 
+#include "osquery/events/pathtree.h"
+
 namespace osquery {
 
 class BenchmarkEventPublisher
@@ -62,7 +66,8 @@ class BenchmarkEventSubscriber
     auto et = expire_time_;
     expire_events_ = true;
     expire_time_ = -1;
-    getIndexes(0, 0);
+    flushEvents();
+    expireEvents(0);
     expire_events_ = ee;
     expire_time_ = et;
   }
@@ -95,6 +100,123 @@ static void EVENTS_subscribe_fire(benchmark::State& state) {
 
 BENCHMARK(EVENTS_subscribe_fire);
 
+static std::shared_ptr<BenchmarkEventPublisher> kFirePublisher{nullptr};
+
+static void EVENTS_subscribe_fire_threads(benchmark::State& state) {
+  // Publishers may fire from several threads, such as audit and kernel.
+  if (state.thread_index == 0) {
+    kFirePublisher = std::make_shared<BenchmarkEventPublisher>();
+    EventFactory::registerEventPublisher(kFirePublisher);
+
+    auto sub = std::make_shared<BenchmarkEventSubscriber>();
+    EventFactory::registerEventSubscriber(sub);
+    sub->benchmarkInit();
+  }
+
+  while (state.KeepRunning()) {
+    kFirePublisher->benchmarkFire();
+  }
+}
+
+BENCHMARK(EVENTS_subscribe_fire_threads)->UseRealTime()->ThreadRange(1, 8);
+
+struct BenchmarkPathSubscriptionContext : public SubscriptionContext {
+  std::string path;
+};
+
+struct BenchmarkPathEventContext : public EventContext {
+  std::string path;
+};
+
+/// Select subscriptions by the literal prefixes of their paths.
+class BenchmarkPathMatcher : public SubscriptionMatcher {
+ public:
+  explicit BenchmarkPathMatcher(const SubscriptionVector& subscriptions) {
+    for (size_t i = 0; i < subscriptions.size(); i++) {
+      auto sc = std::static_pointer_cast<BenchmarkPathSubscriptionContext>(
+          subscriptions[i]->context);
+      paths_.insert(sc->path, i);
+    }
+  }
+
+  void match(const EventContextRef& ec,
+             std::vector<size_t>& targets) const override {
+    auto pec = std::static_pointer_cast<BenchmarkPathEventContext>(ec);
+    paths_.match(pec->path, false, targets);
+  }
+
+ private:
+  PathPrefixTree<size_t> paths_;
+};
+
+class BenchmarkPathEventPublisher
+    : public EventPublisher<BenchmarkPathSubscriptionContext,
+                            BenchmarkPathEventContext> {
+  DECLARE_PUBLISHER("benchmark_paths");
+
+ public:
+  void benchmarkFire(const std::string& path) {
+    auto ec = createEventContext();
+    ec->path = path;
+    fire(ec, 0);
+  }
+
+  SubscriptionMatcherRef compileSubscriptions(
+      const SubscriptionVector& subscriptions) const override {
+    if (!compile_) {
+      return nullptr;
+    }
+    return std::make_shared<BenchmarkPathMatcher>(subscriptions);
+  }
+
+  bool shouldFire(const SCRef& sc, const ECRef& ec) const override {
+    return fnmatch((sc->path + "*").c_str(),
+                   ec->path.c_str(),
+                   FNM_PATHNAME | FNM_CASEFOLD) == 0;
+  }
+
+  bool compile_{false};
+};
+
+class BenchmarkPathEventSubscriber
+    : public EventSubscriber<BenchmarkPathEventPublisher> {
+ public:
+  BenchmarkPathEventSubscriber() {
+    setName("benchmark_paths");
+  }
+
+  Status Callback(const ECRef& ec, const SCRef& sc) {
+    return Status(0, "OK");
+  }
+
+  void benchmarkInit(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      auto sc = createSubscriptionContext();
+      sc->path = "/home/user" + std::to_string(i) + "/*/.ssh/";
+      subscribe(&BenchmarkPathEventSubscriber::Callback, sc);
+    }
+  }
+};
+
+static void EVENTS_fire_path_subscriptions(benchmark::State& state) {
+  // Model a file events configuration with 500 subscribed paths.
+  auto pub = std::make_shared<BenchmarkPathEventPublisher>();
+  pub->compile_ = (state.range_x() == 1);
+  EventFactory::registerEventPublisher(pub);
+
+  auto sub = std::make_shared<BenchmarkPathEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+  sub->benchmarkInit(500);
+
+  while (state.KeepRunning()) {
+    pub->benchmarkFire("/home/user250/osquery/.ssh/authorized_keys");
+  }
+
+  EventFactory::deregisterEventPublisher("benchmark_paths");
+}
+
+BENCHMARK(EVENTS_fire_path_subscriptions)->Arg(0)->Arg(1);
+
 static void EVENTS_add_events(benchmark::State& state) {
   auto pub = std::make_shared<BenchmarkEventPublisher>();
   EventFactory::registerEventPublisher(pub);
@@ -0,0 +1,99 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/darwin/fsevents.h"
+
+namespace osquery {
+
+/// Create subscriptions to sibling directories, as a file_paths config would.
+static std::vector<FSEventsSubscriptionContextRef> getSubscriptions(
+    size_t count) {
+  std::vector<FSEventsSubscriptionContextRef> subscriptions;
+  for (size_t i = 0; i < count; i++) {
+    auto sc = std::make_shared<FSEventsSubscriptionContext>();
+    sc->path = "/usr/local/osquery/" + std::to_string(i) + "/";
+    sc->recursive = true;
+    subscriptions.push_back(sc);
+  }
+  return subscriptions;
+}
+
+/// Create event paths below a single subscription, as a build would.
+static std::vector<FSEventsEventContextRef> getEvents(size_t count) {
+  std::vector<FSEventsEventContextRef> events;
+  for (size_t i = 0; i < count; i++) {
+    auto ec = std::make_shared<FSEventsEventContext>();
+    ec->path = "/usr/local/osquery/1/build/" + std::to_string(i) + ".o";
+    ec->fsevent_flags = kFSEventStreamEventFlagItemIsFile |
+                        kFSEventStreamEventFlagItemModified;
+    ec->action = "UPDATED";
+    events.push_back(ec);
+  }
+  return events;
+}
+
+static void FSEVENTS_shouldFire(benchmark::State& state) {
+  FSEventsEventPublisher pub;
+  auto subscriptions = getSubscriptions(state.range_x());
+  auto events = getEvents(100);
+
+  // The path tree is optional, without it every subscription is compared.
+  FSEventsPathTree tree;
+  if (state.range_y() == 1) {
+    for (const auto& sc : subscriptions) {
+      tree.insert(sc->path, sc.get());
+    }
+  }
+
+  size_t fired = 0;
+  while (state.KeepRunning()) {
+    for (const auto& ec : events) {
+      if (state.range_y() == 1) {
+        tree.match(ec->path, false, ec->candidates);
+        ec->matched = true;
+      }
+      for (const auto& sc : subscriptions) {
+        fired += (pub.shouldFire(sc, ec)) ? 1 : 0;
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * events.size());
+  benchmark::DoNotOptimize(fired);
+}
+
+BENCHMARK(FSEVENTS_shouldFire)
+    ->ArgPair(10, 0)
+    ->ArgPair(10, 1)
+    ->ArgPair(100, 0)
+    ->ArgPair(100, 1)
+    ->ArgPair(1000, 0)
+    ->ArgPair(1000, 1);
+
+static void FSEVENTS_pathTreeMatch(benchmark::State& state) {
+  auto subscriptions = getSubscriptions(state.range_x());
+  FSEventsPathTree tree;
+  for (const auto& sc : subscriptions) {
+    tree.insert(sc->path, sc.get());
+  }
+
+  std::vector<const FSEventsSubscriptionContext*> candidates;
+  std::string path = "/usr/local/osquery/1/build/intermediates/object.o";
+  while (state.KeepRunning()) {
+    tree.match(path, false, candidates);
+  }
+  benchmark::DoNotOptimize(candidates.size());
+}
+
+BENCHMARK(FSEVENTS_pathTreeMatch)->Arg(10)->Arg(100)->Arg(1000);
+}
@@ -9,14 +9,21 @@
  */
 
 #include <fnmatch.h>
+#include <strings.h>
+
+#include <algorithm>
+#include <set>
 
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/events/darwin/fsevents.h"
+#include "osquery/events/replay.h"
 
 /**
  * @brief FSEvents needs a real/absolute path for watches.
@@ -31,6 +38,23 @@ namespace fs = boost::filesystem;
 
 namespace osquery {
 
+DECLARE_uint64(file_events_coalesce_ms);
+
+FLAG(uint64,
+     fsevents_latency_ms,
+     0,
+     "Milliseconds FSEvents batches changes (0 uses file_events_coalesce_ms)");
+
+FLAG(bool,
+     fsevents_file_events,
+     true,
+     "Report FSEvents for each file, disable to coalesce by directory");
+
+/// Events for an item, without these the event reports a directory.
+static const FSEventStreamEventFlags kFSEventsItemFlags =
+    kFSEventStreamEventFlagItemIsFile | kFSEventStreamEventFlagItemIsDir |
+    kFSEventStreamEventFlagItemIsSymlink;
+
 std::map<FSEventStreamEventFlags, std::string> kMaskActions = {
     {kFSEventStreamEventFlagItemChangeOwner, "ATTRIBUTES_MODIFIED"},
     {kFSEventStreamEventFlagItemXattrMod, "ATTRIBUTES_MODIFIED"},
@@ -82,9 +106,11 @@ void FSEventsEventPublisher::restart() {
                                   cf_paths.size(),
                                   &kCFTypeArrayCallBacks);
 
-  // Set stream flags.
-  auto flags =
-      kFSEventStreamCreateFlagFileEvents | kFSEventStreamCreateFlagWatchRoot;
+  // Set stream flags, without file events FSEvents coalesces by directory.
+  FSEventStreamCreateFlags flags = kFSEventStreamCreateFlagWatchRoot;
+  if (FLAGS_fsevents_file_events) {
+    flags |= kFSEventStreamCreateFlagFileEvents;
+  }
   if (no_defer_) {
     flags |= kFSEventStreamCreateFlagNoDefer;
   }
@@ -92,13 +118,21 @@ void FSEventsEventPublisher::restart() {
     flags |= kFSEventStreamCreateFlagIgnoreSelf;
   }
 
-  // Create the FSEvent stream.
+  // The stream latency is the window FSEvents uses to batch changes.
+  CFTimeInterval latency =
+      std::max(1.0, FLAGS_file_events_coalesce_ms / 1000.0);
+  if (FLAGS_fsevents_latency_ms > 0) {
+    latency = FLAGS_fsevents_latency_ms / 1000.0;
+  }
+
+  // Create the FSEvent stream, the callback counts coalesced events.
+  FSEventStreamContext context = {0, this, nullptr, nullptr, nullptr};
   stream_ = FSEventStreamCreate(nullptr,
                                 &FSEventsEventPublisher::Callback,
-                                nullptr,
+                                &context,
                                 watch_list,
                                 kFSEventStreamEventIdSinceNow,
-                                1,
+                                latency,
                                 flags);
   if (stream_ != nullptr) {
     // Schedule the stream on the run loop.
@@ -192,13 +226,29 @@ void FSEventsEventPublisher::configure() {
   {
     WriteLock lock(mutex_);
     paths_.clear();
+    tree_.clear();
+    std::set<std::string> paths;
     for (auto& sub : subscriptions_) {
       auto sc = getSubscriptionContext(sub->context);
-      if (sc->discovered_.size() > 0) {
-        continue;
+      if (sc->discovered_.size() == 0) {
+        auto sc_paths = transformSubscription(sc);
+        paths.insert(sc_paths.begin(), sc_paths.end());
+      }
+      tree_.insert(sc->path, sc.get());
+    }
+
+    // FSEvents watches are recursive, a single stream only needs the topmost
+    // of nested paths.
+    for (const auto& path : paths) {
+      bool nested = std::any_of(
+          paths_.begin(), paths_.end(), [&path](const std::string& parent) {
+            return !parent.empty() &&
+                   path.compare(0, parent.size(), parent) == 0 &&
+                   (parent.back() == '/' || path[parent.size()] == '/');
+          });
+      if (!nested) {
+        paths_.insert(path);
       }
-      auto paths = transformSubscription(sc);
-      paths_.insert(paths.begin(), paths.end());
     }
   }
 
@@ -226,6 +276,46 @@ Status FSEventsEventPublisher::run() {
   return Status(0, "OK");
 }
 
+Status FSEventsEventPublisher::replay(const std::string& data) {
+  std::vector<std::string> paths;
+  std::vector<FSEventStreamEventFlags> flags;
+  std::vector<FSEventStreamEventId> ids;
+  size_t start = 0;
+  while (start < data.size()) {
+    auto end = data.find('\0', start);
+    auto flags_end = data.find(' ', start);
+    auto id_end = (flags_end == std::string::npos)
+                      ? std::string::npos
+                      : data.find(' ', flags_end + 1);
+    unsigned long int flag = 0;
+    unsigned long int id = 0;
+    if (end == std::string::npos || id_end == std::string::npos ||
+        id_end > end ||
+        !safeStrtoul(data.substr(start, flags_end - start), 10, flag) ||
+        !safeStrtoul(
+            data.substr(flags_end + 1, id_end - flags_end - 1), 10, id)) {
+      return Status(1, "Invalid fsevents record");
+    }
+
+    flags.push_back(static_cast<FSEventStreamEventFlags>(flag));
+    ids.push_back(static_cast<FSEventStreamEventId>(id));
+    paths.push_back(data.substr(id_end + 1, end - id_end - 1));
+    start = end + 1;
+  }
+
+  std::vector<char*> event_paths;
+  for (auto& path : paths) {
+    event_paths.push_back(&path[0]);
+  }
+  Callback(nullptr,
+           this,
+           paths.size(),
+           event_paths.data(),
+           flags.data(),
+           ids.data());
+  return Status(0, "OK");
+}
+
 void FSEventsEventPublisher::Callback(
     ConstFSEventStreamRef stream,
     void* callback_info,
@@ -233,6 +323,23 @@ void FSEventsEventPublisher::Callback(
     void* event_paths,
     const FSEventStreamEventFlags fsevent_flags[],
     const FSEventStreamEventId fsevent_ids[]) {
+  // Repeated path and action pairs within a batch are fired once.
+  auto publisher = static_cast<FSEventsEventPublisher*>(callback_info);
+  bool coalesce = (FLAGS_file_events_coalesce_ms > 0);
+  std::set<std::string> fired;
+
+  if (EventCapture::enabled()) {
+    // Each event is recorded as its flags, ID, and a NUL-terminated path.
+    std::string data;
+    for (size_t i = 0; i < num_events; ++i) {
+      data += std::to_string(fsevent_flags[i]) + ' ' +
+              std::to_string(fsevent_ids[i]) + ' ' +
+              ((char**)event_paths)[i];
+      data.push_back('\0');
+    }
+    EventCapture::record("fsevents", data.data(), data.size());
+  }
+
   for (size_t i = 0; i < num_events; ++i) {
     auto ec = createEventContext();
     ec->fsevent_stream = stream;
@@ -240,6 +347,15 @@ void FSEventsEventPublisher::Callback(
     ec->transaction_id = fsevent_ids[i];
     ec->path = std::string(((char**)event_paths)[i]);
 
+    // Walk the subscription prefixes once for every action fired.
+    if (publisher != nullptr) {
+      ReadLock lock(publisher->mutex_);
+      publisher->tree_.match(ec->path,
+                             !(ec->fsevent_flags & kFSEventsItemFlags),
+                             ec->candidates);
+      ec->matched = true;
+    }
+
     if (ec->fsevent_flags & kFSEventStreamEventFlagMustScanSubDirs) {
       // The FSEvents thread coalesced events within and will report a root.
       TLOG << "FSEvents collision, root: " << ec->path;
@@ -257,10 +373,17 @@ void FSEventsEventPublisher::Callback(
     bool has_action = false;
     for (const auto& action : kMaskActions) {
       if (ec->fsevent_flags & action.first) {
+        has_action = true;
+        if (coalesce && !fired.insert(action.second + ':' + ec->path).second) {
+          if (publisher != nullptr) {
+            publisher->coalesced_count_++;
+          }
+          continue;
+        }
+
         // Actions may be multiplexed. Fire and event for each.
         ec->action = action.second;
         EventFactory::fire<FSEventsEventPublisher>(ec);
-        has_action = true;
       }
     }
 
@@ -275,7 +398,17 @@ void FSEventsEventPublisher::Callback(
 bool FSEventsEventPublisher::shouldFire(
     const FSEventsSubscriptionContextRef& sc,
     const FSEventsEventContextRef& ec) const {
-  if (sc->recursive && !sc->recursive_match) {
+  if (ec->matched && !std::binary_search(ec->candidates.begin(),
+                                         ec->candidates.end(),
+                                         sc.get())) {
+    // The event path does not start with the subscription's path prefix.
+    return false;
+  }
+
+  if (!(ec->fsevent_flags & kFSEventsItemFlags) &&
+      strncasecmp(sc->path.c_str(), ec->path.c_str(), ec->path.size()) == 0) {
+    // A directory-level event reports a parent of the subscribed path.
+  } else if (sc->recursive && !sc->recursive_match) {
     ssize_t found = ec->path.find(sc->path);
     if (found != 0) {
       return false;
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -21,6 +22,8 @@
 #include <osquery/events.h>
 #include <osquery/status.h>
 
+#include "osquery/events/pathtree.h"
+
 namespace osquery {
 
 struct FSEventsSubscriptionContext : public SubscriptionContext {
@@ -71,8 +74,17 @@ struct FSEventsEventContext : public EventContext {
 
   std::string path;
   std::string action;
+
+  /// Sorted subscriptions whose path prefix matches, valid if matched is set.
+  std::vector<const FSEventsSubscriptionContext*> candidates;
+
+  /// The publisher matched the path against its subscription prefix tree.
+  bool matched{false};
 };
 
+/// Subscriptions are matched by the literal prefixes of their paths.
+using FSEventsPathTree = PathPrefixTree<const FSEventsSubscriptionContext*>;
+
 using FSEventsEventContextRef = std::shared_ptr<FSEventsEventContext>;
 using FSEventsSubscriptionContextRef =
     std::shared_ptr<FSEventsSubscriptionContext>;
@@ -98,6 +110,9 @@ class FSEventsEventPublisher
   /// Entrypoint to the run loop
   Status run() override;
 
+  /// Fire a captured batch of events through the callback.
+  Status replay(const std::string& data) override;
+
  public:
   /// FSEvents registers a client callback instead of using a select/poll loop.
   static void Callback(ConstFSEventStreamRef fsevent_stream,
@@ -152,6 +167,9 @@ class FSEventsEventPublisher
   /// Set of paths to monitor, determined by a configure step.
   std::set<std::string> paths_;
 
+  /// Subscription path prefixes, matched in the callback.
+  FSEventsPathTree tree_;
+
   /// Reference to the run loop for this thread.
   CFRunLoopRef run_loop_{nullptr};
 
@@ -174,5 +192,6 @@ class FSEventsEventPublisher
   FRIEND_TEST(FSEventsTests, test_fsevents_fire_event);
   FRIEND_TEST(FSEventsTests, test_fsevents_event_action);
   FRIEND_TEST(FSEventsTests, test_fsevents_embedded_wildcards);
+  FRIEND_TEST(FSEventsTests, test_fsevents_nested_paths);
 };
 }
@@ -232,6 +232,7 @@ class TestFSEventsEventSubscriber
   FRIEND_TEST(FSEventsTests, test_fsevents_fire_event);
   FRIEND_TEST(FSEventsTests, test_fsevents_event_action);
   FRIEND_TEST(FSEventsTests, test_fsevents_embedded_wildcards);
+  FRIEND_TEST(FSEventsTests, test_fsevents_nested_paths);
 };
 
 TEST_F(FSEventsTests, test_fsevents_run) {
@@ -376,4 +377,60 @@ TEST_F(FSEventsTests, test_fsevents_embedded_wildcards) {
   std::set<std::string> expected = {real_test_dir + "/2/1/"};
   EXPECT_EQ(event_pub_->paths_, expected);
 }
+
+TEST_F(FSEventsTests, test_fsevents_nested_paths) {
+  event_pub_ = std::make_shared<FSEventsEventPublisher>();
+  EventFactory::registerEventPublisher(event_pub_);
+
+  auto sub = std::make_shared<TestFSEventsEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+
+  auto sc = sub->createSubscriptionContext();
+  sc->path = real_test_dir + "/";
+  sub->subscribe(&TestFSEventsEventSubscriber::SimpleCallback, sc);
+  auto nested_sc = sub->createSubscriptionContext();
+  nested_sc->path = real_test_dir + "/2/1";
+  sub->subscribe(&TestFSEventsEventSubscriber::SimpleCallback, nested_sc);
+  event_pub_->configure();
+
+  // The stream is recursive, the nested path is covered by its parent.
+  std::set<std::string> expected = {real_test_dir + "/"};
+  EXPECT_EQ(event_pub_->paths_, expected);
+}
+
+TEST_F(FSEventsTests, test_fsevents_path_tree) {
+  auto root = std::make_shared<FSEventsSubscriptionContext>();
+  auto etc = std::make_shared<FSEventsSubscriptionContext>();
+  auto hosts = std::make_shared<FSEventsSubscriptionContext>();
+  auto users = std::make_shared<FSEventsSubscriptionContext>();
+
+  FSEventsPathTree tree;
+  tree.insert("/", root.get());
+  tree.insert("/etc/", etc.get());
+  tree.insert("/etc/hosts", hosts.get());
+  tree.insert("/Users/*/Library", users.get());
+
+  std::vector<const FSEventsSubscriptionContext*> candidates;
+  tree.match("/etc/hosts", false, candidates);
+  EXPECT_EQ(candidates.size(), 3U);
+
+  tree.match("/etc/passwd", false, candidates);
+  EXPECT_EQ(candidates.size(), 2U);
+  EXPECT_FALSE(std::binary_search(
+      candidates.begin(), candidates.end(), hosts.get()));
+
+  // Prefixes are matched up to the first wildcard and case insensitive.
+  tree.match("/users/osquery/Library/Preferences", false, candidates);
+  EXPECT_EQ(candidates.size(), 2U);
+  EXPECT_TRUE(std::binary_search(
+      candidates.begin(), candidates.end(), users.get()));
+
+  // A directory-level event may match subscriptions below it.
+  tree.match("/etc", true, candidates);
+  EXPECT_EQ(candidates.size(), 3U);
+
+  tree.clear();
+  tree.match("/etc/hosts", false, candidates);
+  EXPECT_TRUE(candidates.empty());
+}
 }
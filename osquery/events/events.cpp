@@ -8,22 +8,33 @@
  *
  */
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <exception>
+#include <future>
+#include <limits>
 #include <thread>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/classification.hpp>
-#include <boost/lexical_cast.hpp>
 
 #include <osquery/config.h>
 #include <osquery/core.h>
+#include <osquery/dispatcher.h>
 #include <osquery/events.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
+#include "osquery/config/parsers/decorators.h"
 #include "osquery/core/conversions.h"
+#include "osquery/core/memory_pressure.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/process.h"
+#include "osquery/core/tracing.h"
+#include "osquery/events/replay.h"
 
 namespace osquery {
 
@@ -33,6 +44,25 @@ CREATE_REGISTRY(EventSubscriberPlugin, "event_subscriber");
 /// Checkpoint interval to inspect max event buffering.
 #define EVENTS_CHECKPOINT 256
 
+/// Number of EventIDs reserved with each backing store write.
+#define EVENTS_ID_BLOCK 1024
+
+/// Maximum seconds an event may be staged before it is written.
+#define EVENTS_STAGE_SECONDS 1
+
+/// Seconds before a consumer's last select that its next select scans.
+#define EVENTS_CURSOR_LOOKBACK 60
+
+/// Milliseconds the expiration service rests when no batch was filled.
+#define EVENTS_EXPIRE_REST 1000
+
+/// Milliseconds the expiration service yields between filled batches.
+#define EVENTS_EXPIRE_YIELD 20
+
+DECLARE_bool(startup_parallel);
+DECLARE_string(events_replay);
+DECLARE_double(events_replay_speed);
+
 FLAG(bool, disable_events, false, "Disable osquery publish/subscribe system");
 
 FLAG(bool,
@@ -51,6 +81,254 @@ FLAG(uint64,
 // overriding in subclasses
 FLAG(uint64, events_max, 1000, "Maximum number of events per type to buffer");
 
+FLAG(string,
+     events_dispatch_async,
+     "yara_events",
+     "Comma-separated event subscribers receiving events on their own thread");
+
+FLAG(uint64,
+     events_queue_depth,
+     4096,
+     "Maximum events queued for each asynchronous event subscriber");
+
+FLAG(bool,
+     events_queue_block,
+     false,
+     "Block publishers when a subscriber queue is full instead of dropping");
+
+FLAG(uint64,
+     events_batch_size,
+     128,
+     "Number of events staged before a batched backing store write");
+
+FLAG(uint64,
+     events_expiry_batch,
+     1024,
+     "Maximum events removed from a subscriber's backing store at once");
+
+FLAG(string,
+     events_rate_limit,
+     "",
+     "Comma-separated subscriber=N limits of events added each second");
+
+FLAG(string,
+     events_sample,
+     "",
+     "Comma-separated subscriber=N, keep one of N events by column hash");
+
+FLAG(string,
+     events_stream,
+     "",
+     "Comma-separated event subscribers logging events instead of storing");
+
+FLAG(uint64,
+     events_stream_ring,
+     0,
+     "Number of recent events kept in memory for each streaming subscriber");
+
+FLAG(bool,
+     events_stream_ring_shed,
+     false,
+     "Drop streamed event rings under worker memory pressure");
+
+FLAG(uint64,
+     file_events_coalesce_ms,
+     0,
+     "Window in milliseconds to merge repeated file events (0 disables)");
+
+/**
+ * @brief A bounded queue of EventCallback%s delivered from service threads.
+ *
+ * Publishers push callbacks from their run loop threads and the services
+ * call them in order. With several services, callbacks may run concurrently
+ * and complete out of order. Stopping delivers queued callbacks first.
+ */
+class EventSubscriberQueue : private boost::noncopyable {
+ public:
+  EventSubscriberQueue(size_t max_depth, bool block)
+      : max_depth_(max_depth), block_(block) {}
+
+  /// Queue a callback, returns false if the queue is stopped.
+  bool push(std::function<void()> callback);
+
+  /// The number of queued callbacks.
+  size_t depth() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return callbacks_.size();
+  }
+
+  /// The number of callbacks dropped because the queue was full.
+  size_t drops() const {
+    return drops_;
+  }
+
+  /**
+   * @brief Stop accepting callbacks and wait for the services to exit.
+   *
+   * @param deliver Call the queued callbacks, otherwise discard them.
+   */
+  void drain(bool deliver = true);
+
+  /// A service entrypoint, call queued callbacks until stopped.
+  void deliver();
+
+  /// Stop accepting callbacks, the services exit when the queue is empty.
+  void stop();
+
+  /// A service will call deliver.
+  void addService() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    services_++;
+  }
+
+  /// A service could not be started.
+  void removeService() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    services_--;
+    removed_.notify_all();
+  }
+
+ private:
+  /// Queued callbacks, in the order events were fired.
+  std::deque<std::function<void()>> callbacks_;
+
+  /// Protection around the queue and its state.
+  std::mutex mutex_;
+
+  /// Signaled when a callback is queued or the queue is stopped.
+  std::condition_variable queued_;
+
+  /// Signaled when a callback is removed or the service finished.
+  std::condition_variable removed_;
+
+  /// The maximum number of queued callbacks, 0 for no limit.
+  size_t max_depth_{0};
+
+  /// Wait for space rather than dropping callbacks.
+  bool block_{false};
+
+  /// The queue is no longer accepting callbacks.
+  bool stopped_{false};
+
+  /// The number of services that have not exited.
+  size_t services_{0};
+
+  /// Number of dropped callbacks.
+  std::atomic<size_t> drops_{0};
+};
+
+bool EventSubscriberQueue::push(std::function<void()> callback) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (max_depth_ > 0 && callbacks_.size() >= max_depth_) {
+    if (!block_) {
+      drops_++;
+      return true;
+    }
+    removed_.wait(lock, [this]() {
+      return stopped_ || callbacks_.size() < max_depth_;
+    });
+  }
+
+  if (stopped_) {
+    return false;
+  }
+  callbacks_.push_back(std::move(callback));
+  queued_.notify_one();
+  return true;
+}
+
+/// A service thread delivering callbacks from a shared queue.
+class EventSubscriberService : public InternalRunnable {
+ public:
+  explicit EventSubscriberService(std::shared_ptr<EventSubscriberQueue> queue)
+      : queue_(std::move(queue)) {}
+
+ protected:
+  void start() override {
+    queue_->deliver();
+  }
+
+  void stop() override {
+    queue_->stop();
+  }
+
+ private:
+  std::shared_ptr<EventSubscriberQueue> queue_;
+};
+
+void EventSubscriberQueue::deliver() {
+  while (true) {
+    std::function<void()> callback;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      queued_.wait(lock, [this]() { return stopped_ || !callbacks_.empty(); });
+      if (callbacks_.empty()) {
+        // Stopped and every queued callback was delivered.
+        break;
+      }
+      callback = std::move(callbacks_.front());
+      callbacks_.pop_front();
+    }
+    removed_.notify_all();
+    callback();
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  services_--;
+  removed_.notify_all();
+}
+
+void EventSubscriberQueue::stop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  stopped_ = true;
+  queued_.notify_all();
+  removed_.notify_all();
+}
+
+void EventSubscriberQueue::drain(bool deliver) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  stopped_ = true;
+  if (!deliver) {
+    callbacks_.clear();
+  }
+  queued_.notify_all();
+  removed_.notify_all();
+  removed_.wait(lock, [this]() { return services_ == 0; });
+}
+
+/// Set while the background expiration service is running.
+static std::atomic<bool> kEventsExpiring{false};
+
+/**
+ * @brief A low priority service removing expired events in bounded batches.
+ *
+ * Selects and event writes do not remove expired events while the service
+ * is running. Each round removes up to a batch of events from each
+ * subscriber, filled batches are followed by a short yield.
+ */
+class EventExpirationService : public InternalRunnable {
+ protected:
+  void start() override {
+    kEventsExpiring = true;
+    setThreadToBackgroundPriority();
+    while (!interrupted()) {
+      bool filled = false;
+      for (const auto& name : EventFactory::subscriberNames()) {
+        auto sub = EventFactory::getEventSubscriber(name);
+        if (sub == nullptr || sub->state() != EventState::EVENT_RUNNING) {
+          continue;
+        }
+        auto batch = FLAGS_events_expiry_batch;
+        if (sub->expireEvents(batch) == batch) {
+          filled = true;
+        }
+      }
+      pauseMilli(filled ? EVENTS_EXPIRE_YIELD : EVENTS_EXPIRE_REST);
+    }
+    kEventsExpiring = false;
+  }
+};
+
 static inline EventTime timeFromRecord(const std::string& record) {
   // Convert a stored index "as string bytes" to a time value.
   long long afinite;
@@ -60,56 +338,84 @@ static inline EventTime timeFromRecord(const std::string& record) {
   return afinite;
 }
 
-static inline void getOptimizeData(EventTime& o_time,
-                                   size_t& o_eid,
-                                   const std::string& publisher) {
-  // Read the optimization time for the current executing query.
-  std::string query_name;
-  getDatabaseValue(kPersistentSettings, kExecutingQuery, query_name);
+/// Find a subscriber's value in a comma-separated list of name=value.
+static size_t getSubscriberSetting(const std::string& settings,
+                                   const std::string& name) {
+  for (const auto& setting : osquery::split(settings, ",")) {
+    auto delimiter = setting.find('=');
+    if (delimiter == std::string::npos ||
+        setting.substr(0, delimiter) != name) {
+      continue;
+    }
+
+    unsigned long int value = 0;
+    if (safeStrtoul(setting.substr(delimiter + 1), 10, value)) {
+      return static_cast<size_t>(value);
+    }
+    LOG(WARNING) << "Invalid event subscriber setting: " << setting;
+  }
+  return 0;
+}
+
+/// The scheduled query executing on this thread, or the persisted name.
+static inline std::string getOptimizeQuery() {
+  auto query_name = Config::getExecutingQuery();
   if (query_name.empty()) {
-    // Fallback when daemons disable query monitoring.
-    query_name = publisher;
+    getDatabaseValue(kPersistentSettings, kExecutingQuery, query_name);
   }
+  return query_name;
+}
 
-  {
-    std::string content;
-    getDatabaseValue(kEvents, "optimize." + query_name, content);
-    long long optimize_time = 0;
-    safeStrtoll(content, 10, optimize_time);
-    o_time = static_cast<EventTime>(optimize_time);
+EventSubscriberPlugin::EventCursor EventSubscriberPlugin::getCursor(
+    const std::string& consumer) const {
+  EventCursor cursor;
+  std::string content;
+  auto status = getDatabaseValue(
+      kEvents, "cursor." + dbNamespace() + "." + consumer, content);
+  if (!status.ok() || content.empty()) {
+    // Earlier versions kept a time and EventID for each query.
+    getDatabaseValue(kEvents, "optimize." + consumer, content);
+    content += ":";
+    std::string eid;
+    getDatabaseValue(kEvents, "optimize_eid." + consumer, eid);
+    content += eid;
   }
 
-  {
-    std::string content;
-    getDatabaseValue(kEvents, "optimize_eid." + query_name, content);
-    long long optimize_eid = 0;
-    safeStrtoll(content, 10, optimize_eid);
-    o_eid = static_cast<size_t>(optimize_eid);
+  auto separator = content.find(':');
+  if (separator == std::string::npos) {
+    return cursor;
   }
-}
 
-static inline void setOptimizeData(EventTime time,
-                                   size_t eid,
-                                   const std::string& publisher) {
-  // Store the optimization time and eid.
-  std::string query_name;
-  getDatabaseValue(kPersistentSettings, kExecutingQuery, query_name);
-  if (query_name.empty()) {
-    // Fallback when daemons disable query monitoring.
-    query_name = publisher;
+  long long value = 0;
+  if (safeStrtoll(content.substr(0, separator), 10, value) && value > 0) {
+    cursor.time = static_cast<EventTime>(value);
+  }
+  if (safeStrtoll(content.substr(separator + 1), 10, value) && value > 0) {
+    cursor.eid = static_cast<size_t>(value);
   }
+  return cursor;
+}
 
-  setDatabaseValue(kEvents, "optimize." + query_name, std::to_string(time));
-  setDatabaseValue(kEvents, "optimize_eid." + query_name, std::to_string(eid));
+void EventSubscriberPlugin::setCursor(const std::string& consumer,
+                                      const EventCursor& cursor) const {
+  setDatabaseValue(kEvents,
+                   "cursor." + dbNamespace() + "." + consumer,
+                   std::to_string(cursor.time) + ":" +
+                       std::to_string(cursor.eid));
 }
 
 QueryData EventSubscriberPlugin::genTable(QueryContext& context) {
   // Stop is an unsigned (-1), our end of time equivalent.
   EventTime start = 0, stop = 0;
+  // The limit applies if the range selects exactly the constrained rows.
+  auto limit = context.limit;
   if (context.constraints["time"].getAll().size() > 0) {
     // Use the 'time' constraint to optimize backing-store lookups.
     for (const auto& constraint : context.constraints["time"].getAll()) {
       EventTime expr = timeFromRecord(constraint.expr);
+      if (expr == 0) {
+        limit = 0;
+      }
       if (constraint.op == EQUALS) {
         stop = start = expr;
         break;
@@ -117,20 +423,35 @@ QueryData EventSubscriberPlugin::genTable(QueryContext& context) {
         start = std::max(start, expr + 1);
       } else if (constraint.op == GREATER_THAN_OR_EQUALS) {
         start = std::max(start, expr);
-      } else if (constraint.op == LESS_THAN) {
-        stop = std::min(stop, expr - 1);
+      } else if (constraint.op == LESS_THAN && expr > 0) {
+        stop = (stop == 0) ? expr - 1 : std::min(stop, expr - 1);
       } else if (constraint.op == LESS_THAN_OR_EQUALS) {
-        stop = std::min(stop, expr);
+        stop = (stop == 0) ? expr : std::min(stop, expr);
       }
     }
   } else if (kToolType == ToolType::DAEMON && FLAGS_events_optimize) {
     // If the daemon is querying a subscriber without a 'time' constraint and
-    // allows optimization, only emit events since the last query.
-    getOptimizeData(optimize_time_, optimize_eid_, dbNamespace());
-    start = optimize_time_;
-    optimize_time_ = getUnixTime() - 1;
-  }
-  return get(start, stop);
+    // allows optimization, only emit events since the query's last select.
+    auto consumer = getOptimizeQuery();
+    if (consumer.empty()) {
+      // Fallback when daemons disable query monitoring.
+      consumer = dbNamespace();
+    }
+
+    // Events are keyed by their time, an event may be added shortly after
+    // the time it occurred. Scan from before the last select and skip the
+    // events the consumer already received.
+    auto cursor = getCursor(consumer);
+    start = (cursor.time > EVENTS_CURSOR_LOOKBACK)
+                ? cursor.time - EVENTS_CURSOR_LOOKBACK
+                : 0;
+    auto now = getUnixTime();
+    auto results = getEvents(start, stop, &cursor, context.descending);
+    cursor.time = now;
+    setCursor(consumer, cursor);
+    return results;
+  }
+  return getEvents(start, stop, nullptr, context.descending, limit);
 }
 
 void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
@@ -139,11 +460,7 @@ void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
     return;
   }
 
-  EventContextID ec_id = 0;
-  {
-    WriteLock lock(ec_id_lock_);
-    ec_id = next_ec_id_++;
-  }
+  EventContextID ec_id = next_ec_id_.fetch_add(1);
 
   // Fill in EventContext ID and time if needed.
   if (ec != nullptr) {
@@ -156,254 +473,232 @@ void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
     }
   }
 
-  WriteLock lock(subscription_lock_);
-  for (const auto& subscription : subscriptions_) {
-    auto es = EventFactory::getEventSubscriber(subscription->subscriber_name);
-    if (es != nullptr && es->state() == EventState::EVENT_RUNNING) {
-      fireCallback(subscription, ec);
+  // Callbacks are called without holding a lock over the subscriptions.
+  TRACE_PROBE2(event__fire, getName().c_str(), ec_id);
+  auto snapshot = getSnapshot();
+  if (snapshot->matcher == nullptr) {
+    for (const auto& target : snapshot->targets) {
+      fireTarget(target, ec);
     }
+    return;
   }
-}
 
-std::vector<std::string> EventSubscriberPlugin::getIndexes(EventTime start,
-                                                           EventTime stop) {
-  auto index_key = "indexes." + dbNamespace();
-  std::vector<std::string> indexes;
+  // Only the subscriptions the compiled matcher selects are checked.
+  std::vector<size_t> matches;
+  snapshot->matcher->match(ec, matches);
+  for (const auto& index : matches) {
+    if (index < snapshot->targets.size()) {
+      fireTarget(snapshot->targets[index], ec);
+    }
+  }
+}
 
-  EventTime l_start = (start > 0) ? start / 60 : 0;
-  EventTime r_stop = (stop > 0) ? stop / 60 + 1 : 0;
+void EventPublisherPlugin::fireTarget(const SubscriptionTarget& target,
+                                      const EventContextRef& ec) {
+  if (target.second == nullptr ||
+      target.second->state() != EventState::EVENT_RUNNING) {
+    return;
+  }
 
-  std::string content;
-  getDatabaseValue(kEvents, index_key + ".60", content);
-  if (content.empty()) {
-    return indexes;
+  // Subscribers may receive events from their own dispatch thread.
+  const auto& subscription = target.first;
+  if (!target.second->dispatch(
+          [this, subscription, ec]() { fireCallback(subscription, ec); })) {
+    fireCallback(subscription, ec);
   }
+}
 
-  std::vector<std::string> bins, expirations;
-  boost::split(bins, content, boost::is_any_of(","));
-  for (const auto& bin : bins) {
-    auto step = timeFromRecord(bin);
-    auto step_start = step * 60;
-    auto step_stop = (step + 1) * 60;
-    if (step_stop < expire_time_) {
-      expirations.push_back(bin);
-    } else if (step_start < expire_time_) {
-      expireRecords("60", bin, false);
-    }
+std::shared_ptr<const SubscriptionSnapshot>
+EventPublisherPlugin::getSnapshot() {
+  auto& ef = EventFactory::getInstance();
+  auto generation = ef.subscriber_generation_.load();
+  auto snapshot = std::atomic_load(&snapshot_);
+  if (snapshot != nullptr && snapshot->generation == generation &&
+      snapshot->version == subscriptions_version_) {
+    return snapshot;
+  }
 
-    if (step >= l_start && (r_stop == 0 || step < r_stop)) {
-      indexes.push_back("60." + bin);
-    }
+  // Subscriptions or subscribers changed, resolve each subscription again.
+  auto fresh = std::make_shared<SubscriptionSnapshot>();
+  fresh->generation = generation;
+  SubscriptionVector subscriptions;
+  {
+    WriteLock lock(subscription_lock_);
+    subscriptions = subscriptions_;
+    fresh->version = subscriptions_version_;
   }
 
-  // Rewrite the index lists and delete each expired item.
-  if (!expirations.empty()) {
-    expireIndexes("60", bins, expirations);
+  for (const auto& subscription : subscriptions) {
+    EventSubscriberRef subscriber = nullptr;
+    if (EventFactory::exists(subscription->subscriber_name)) {
+      subscriber =
+          EventFactory::getEventSubscriber(subscription->subscriber_name);
+    }
+    fresh->targets.push_back(std::make_pair(subscription, subscriber));
   }
+  fresh->matcher = compileSubscriptions(subscriptions);
 
-  // Return indexes in binning order.
-  std::sort(indexes.begin(),
-            indexes.end(),
-            [](const std::string& left, const std::string& right) {
-              auto n1 = timeFromRecord(left.substr(left.find(".") + 1));
-              auto n2 = timeFromRecord(right.substr(right.find(".") + 1));
-              return n1 < n2;
-            });
+  snapshot = fresh;
+  std::atomic_store(&snapshot_, snapshot);
+  return snapshot;
+}
 
-  // Update the new time that events expire to now - expiry.
-  return indexes;
+/// Fixed-width hex keys sort bytewise in numeric order.
+static inline std::string getOrderedKey(uint64_t value) {
+  char buffer[17];
+  snprintf(buffer,
+           sizeof(buffer),
+           "%016llx",
+           static_cast<unsigned long long>(value));
+  return buffer;
 }
 
-void EventSubscriberPlugin::expireRecords(const std::string& list_type,
-                                          const std::string& index,
-                                          bool all) {
-  auto record_key = "records." + dbNamespace();
-  auto data_key = "data." + dbNamespace();
+/// Parse a fixed-width key component created by getOrderedKey.
+static inline uint64_t valueFromOrderedKey(const std::string& key,
+                                           size_t offset) {
+  if (key.size() < offset + 16) {
+    return 0;
+  }
 
-  // If the expirations is not removing all records, rewrite the persisting.
-  std::vector<std::string> persisting_records;
-  // Request all records within this list-size + bin offset.
-  auto expired_records = getRecords({list_type + "." + index});
-  for (const auto& record : expired_records) {
-    if (all || record.second <= expire_time_) {
-      deleteDatabaseValue(kEvents, data_key + "." + record.first);
+  unsigned long long value = 0;
+  for (size_t i = offset; i < offset + 16; i++) {
+    auto c = key[i];
+    value <<= 4;
+    if (c >= '0' && c <= '9') {
+      value |= static_cast<unsigned long long>(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value |= static_cast<unsigned long long>(c - 'a' + 10);
     } else {
-      persisting_records.push_back(record.first + ":" +
-                                   std::to_string(record.second));
+      return 0;
     }
   }
-
-  // Either drop or overwrite the record list.
-  if (all) {
-    deleteDatabaseValue(kEvents, record_key + "." + list_type + "." + index);
-  } else if (persisting_records.size() < expired_records.size()) {
-    auto new_records = boost::algorithm::join(persisting_records, ",");
-    setDatabaseValue(
-        kEvents, record_key + "." + list_type + "." + index, new_records);
-  }
+  return value;
 }
 
-void EventSubscriberPlugin::expireIndexes(
-    const std::string& list_type,
-    const std::vector<std::string>& indexes,
-    const std::vector<std::string>& expirations) {
-  auto index_key = "indexes." + dbNamespace();
-
-  // Construct a mutable list of persisting indexes to rewrite as records.
-  std::vector<std::string> persisting_indexes = indexes;
-  // Remove the records using the list of expired indexes.
-  for (const auto& bin : expirations) {
-    expireRecords(list_type, bin, true);
-    persisting_indexes.erase(
-        std::remove(persisting_indexes.begin(), persisting_indexes.end(), bin),
-        persisting_indexes.end());
-  }
+std::string EventSubscriberPlugin::getEventPrefix() const {
+  return "event." + dbNamespace() + ".";
+}
 
-  // Update the list of indexes with the non-expired indexes.
-  auto new_indexes = boost::algorithm::join(persisting_indexes, ",");
-  setDatabaseValue(kEvents, index_key + "." + list_type, new_indexes);
+std::string EventSubscriberPlugin::getEventKey(EventTime time,
+                                               size_t eid) const {
+  return getEventPrefix() + getOrderedKey(time) + "." + getOrderedKey(eid);
 }
 
-void EventSubscriberPlugin::expireCheck(bool cleanup) {
-  auto data_key = "data." + dbNamespace();
-  auto eid_key = "eid." + dbNamespace();
-  // Min key will be the last surviving key.
-  size_t min_key = 0;
+size_t EventSubscriberPlugin::expireEvents(size_t batch) {
+  WriteLock lock(expire_lock_);
+  size_t stored = stored_events_;
+  auto limit = getEventsMax();
+  auto overflow = (stored > limit) ? stored - limit : 0;
+  if (expire_time_ == 0 && overflow == 0) {
+    return 0;
+  }
 
-  {
-    auto limit = getEventsMax();
-    std::vector<std::string> keys;
-    scanDatabaseKeys(kEvents, keys, data_key);
-    if (keys.size() <= limit) {
-      return;
-    }
-
-    // There is an overflow of events buffered for this subscriber.
-    LOG(WARNING) << "Expiring events for subscriber: " << getName()
-                 << " (limit " << limit << ")";
-    VLOG(1) << "Subscriber events " << getName() << " exceeded limit " << limit
-            << " by: " << keys.size() - limit;
-    // Inspect the N-FLAGS_events_max -th event's value and expire before the
-    // time within the content.
-    std::string last_key;
-    getDatabaseValue(kEvents, eid_key, last_key);
-    // The EID is the next-index.
-    // EID - events_max is the most last-recent event to keep.
-    min_key = boost::lexical_cast<size_t>(last_key) - getEventsMax();
-
-    if (cleanup) {
-      // Scan each of the keys in keys, if their ID portion is < min_key.
-      // Nix them, this requires lots of conversions, use with care.
-      for (const auto& key : keys) {
-        if (std::stoul(key.substr(key.rfind('.') + 1)) < min_key) {
-          deleteDatabaseValue(kEvents, key);
-        }
-      }
+  // Keys are ordered by time, the oldest batch holds the expired events.
+  auto prefix = getEventPrefix();
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, prefix, batch);
+  size_t count = 0;
+  for (const auto& key : keys) {
+    if (count >= overflow &&
+        static_cast<EventTime>(valueFromOrderedKey(key, prefix.size())) >
+            expire_time_) {
+      break;
     }
+    count++;
   }
 
-  // Convert the key index into a time using the content.
-  // The last-recent event is fetched and the corresponding time is used as
-  // the expiration time for the subscriber.
-  std::string content;
-  getDatabaseValue(kEvents, data_key + "." + std::to_string(min_key), content);
-
-  // Decode the value into a row structure to extract the time.
-  Row r;
-  if (!deserializeRowJSON(content, r) || r.count("time") == 0) {
-    return;
+  if (count > 0) {
+    // Remove up to and including the last expired key.
+    auto end = (count < keys.size()) ? keys[count] : keys[count - 1] + '\0';
+    deleteDatabaseRange(kEvents, prefix, end);
+    expired_events_ += count;
+    if (overflow > 0) {
+      VLOG(1) << "Expired " << count << " events overflowing the limit "
+              << limit << " for subscriber: " << getName();
+    }
   }
 
-  // The last time will become the implicit expiration time.
-  size_t last_time = boost::lexical_cast<size_t>(r.at("time"));
-  if (last_time > 0) {
-    expire_time_ = last_time;
+  if (batch == 0 || keys.size() < batch) {
+    // Every stored event was inspected, the count is now exact.
+    stored_events_ = keys.size() - count;
+  } else {
+    stored_events_ = (stored > count) ? stored - count : 0;
   }
-
-  // Finally, attempt an index query to trigger expirations.
-  // In this case the result set is not used.
-  getIndexes(expire_time_, 0);
+  return count;
 }
 
-std::vector<EventRecord> EventSubscriberPlugin::getRecords(
-    const std::vector<std::string>& indexes) {
-  auto record_key = "records." + dbNamespace();
+void EventSubscriberPlugin::migrateEvents() {
+  // Earlier versions stored EIDs in per-minute bins of "eid:time" records.
+  auto index_key = "indexes." + dbNamespace() + ".60";
+  std::string content;
+  getDatabaseValue(kEvents, index_key, content);
+  if (content.empty()) {
+    return;
+  }
 
-  std::vector<EventRecord> records;
-  for (const auto& index : indexes) {
-    std::vector<std::string> bin_records;
-    {
-      std::string record_value;
-      getDatabaseValue(kEvents, record_key + "." + index, record_value);
-      if (record_value.empty()) {
-        // There are actually no events in this bin, interesting error case.
+  auto record_key = "records." + dbNamespace() + ".60.";
+  auto data_key = "data." + dbNamespace() + ".";
+  size_t count = 0;
+  for (const auto& bin : osquery::split(content, ",")) {
+    std::string records;
+    getDatabaseValue(kEvents, record_key + bin, records);
+    for (const auto& record : osquery::split(records, ",")) {
+      auto delimiter = record.find(':');
+      if (delimiter == std::string::npos) {
         continue;
       }
 
-      // Each list is tokenized into a record=event_id:time.
-      boost::split(bin_records, record_value, boost::is_any_of(",:"));
-    }
-
-    auto bin_it = bin_records.begin();
-    // Iterate over every 2 items: EID:TIME.
-    for (; bin_it != bin_records.end(); bin_it++) {
-      const auto& eid = *bin_it;
-      EventTime et = timeFromRecord(*(++bin_it));
-      if (FLAGS_events_optimize && et <= optimize_time_ + 1) {
-        // There is an optimization collision, check for colliding IDs.
-        auto eidr = timeFromRecord(eid);
-        if (eidr <= optimize_eid_) {
-          continue;
-        }
+      auto eid = record.substr(0, delimiter);
+      unsigned long int eidr = 0;
+      std::string data;
+      if (safeStrtoul(eid, 10, eidr) &&
+          getDatabaseValue(kEvents, data_key + eid, data).ok() &&
+          !data.empty()) {
+        auto time = timeFromRecord(record.substr(delimiter + 1));
+        setDatabaseValue(kEvents, getEventKey(time, eidr), data);
+        count++;
       }
-      records.push_back(std::make_pair(eid, et));
+      deleteDatabaseValue(kEvents, data_key + eid);
     }
+    deleteDatabaseValue(kEvents, record_key + bin);
   }
+  deleteDatabaseValue(kEvents, index_key);
 
-  return records;
+  // Remove event data that was never recorded into a bin.
+  deleteDatabaseRange(kEvents, data_key, getDatabasePrefixEnd(data_key));
+  VLOG(1) << "Migrated " << count << " events for subscriber: " << getName();
 }
 
-Status EventSubscriberPlugin::recordEvent(EventID& eid, EventTime et) {
-  std::string time_value = boost::lexical_cast<std::string>(et);
-
-  // The record is identified by the event type then module name.
-  std::string index_key = "indexes." + dbNamespace();
-  std::string record_key = "records." + dbNamespace();
-  // The list key includes the list type (bin size) and the list ID (bin).
-  std::string list_id;
-
-  // The list_id is the MOST-Specific key ID, the bin for this list.
-  // If the event time was 13 and the time_list is 5 seconds, lid = 2.
-  list_id = boost::lexical_cast<std::string>(et / 60);
+void EventSubscriberPlugin::expireCheck(bool cleanup) {
+  flushEvents();
+  if (cleanup) {
+    migrateEvents();
 
-  WriteLock lock(event_record_lock_);
-  // Append the record (eid, unix_time) to the list bin.
-  std::string record_value;
-  getDatabaseValue(kEvents, record_key + ".60." + list_id, record_value);
+    // Count the stored events once, writes and removals keep the count.
+    std::vector<std::string> keys;
+    scanDatabaseKeys(kEvents, keys, getEventPrefix());
+    stored_events_ = keys.size();
+  }
 
-  if (record_value.length() == 0) {
-    // This is a new list_id for list_key, append the ID to the indirect
-    // lookup for this list_key.
-    std::string index_value;
-    getDatabaseValue(kEvents, index_key + ".60", index_value);
-    if (index_value.length() == 0) {
-      // A new index.
-      index_value = list_id;
-    } else {
-      index_value += "," + list_id;
-    }
-    setDatabaseValue(kEvents, index_key + ".60", index_value);
-    record_value = eid + ":" + time_value;
-  } else {
-    // Tokenize a record using ',' and the EID/time using ':'.
-    record_value += "," + eid + ":" + time_value;
+  auto limit = getEventsMax();
+  if (kEventsExpiring || stored_events_ <= limit) {
+    return;
   }
-  auto status =
-      setDatabaseValue(kEvents, record_key + ".60." + list_id, record_value);
-  if (!status.ok()) {
-    LOG(ERROR) << "Could not put Event Record key: " << record_key;
+
+  // There is an overflow of events buffered for this subscriber.
+  LOG(WARNING) << "Expiring events for subscriber: " << getName()
+               << " (limit " << limit << ")";
+  VLOG(1) << "Subscriber events " << getName() << " exceeded limit " << limit
+          << " by: " << stored_events_ - limit;
+  auto batch = FLAGS_events_expiry_batch;
+  while (expireEvents(batch) == batch && batch > 0 && stored_events_ > limit) {
   }
-  return Status(0, "OK");
+}
+
+size_t EventSubscriberPlugin::pendingExpiration() {
+  size_t stored = stored_events_;
+  auto limit = getEventsMax();
+  return (stored > limit) ? stored - limit : 0;
 }
 
 size_t EventSubscriberPlugin::getEventsExpiry() {
@@ -415,106 +710,231 @@ size_t EventSubscriberPlugin::getEventsMax() {
 }
 
 EventID EventSubscriberPlugin::getEventID() {
-  Status status;
-  // First get an event ID from the meta key.
-  std::string eid_key = "eid." + dbNamespace();
-  std::string last_eid_value;
-  std::string eid_value;
+  WriteLock lock(event_id_lock_);
+  if (last_eid_ >= reserved_eid_) {
+    // The meta key holds the end of the last reserved block of EventIDs.
+    std::string eid_key = "eid." + dbNamespace();
+    if (reserved_eid_ == 0) {
+      std::string last_eid_value;
+      getDatabaseValue(kEvents, eid_key, last_eid_value);
+      unsigned long int last_eid = 0;
+      if (!last_eid_value.empty() &&
+          safeStrtoul(last_eid_value, 10, last_eid)) {
+        last_eid_ = std::max(last_eid_, static_cast<size_t>(last_eid));
+      }
+    }
 
-  {
-    WriteLock lock(event_id_lock_);
-    status = getDatabaseValue(kEvents, eid_key, last_eid_value);
-    if (!status.ok() || last_eid_value.empty()) {
-      last_eid_value = "0";
+    // Reserve the next block, IDs within it need no backing store access.
+    auto status = setDatabaseValue(
+        kEvents, eid_key, std::to_string(last_eid_ + EVENTS_ID_BLOCK));
+    if (!status.ok()) {
+      return "0";
     }
+    reserved_eid_ = last_eid_ + EVENTS_ID_BLOCK;
+  }
+
+  return std::to_string(++last_eid_);
+}
 
-    last_eid_ = boost::lexical_cast<size_t>(last_eid_value) + 1;
-    eid_value = boost::lexical_cast<std::string>(last_eid_);
-    status = setDatabaseValue(kEvents, eid_key, eid_value);
+Status EventSubscriberPlugin::flushEvents() {
+  if (stream_) {
+    return flushStream();
   }
 
-  if (!status.ok()) {
-    return "0";
+  DatabaseKeyValues events;
+  {
+    WriteLock lock(staged_events_lock_);
+    events.swap(staged_events_);
+    staged_time_ = 0;
   }
 
-  return eid_value;
+  if (events.empty()) {
+    return Status(0, "OK");
+  }
+
+  auto status = setDatabaseBatch(kEvents, events);
+  if (status.ok()) {
+    stored_events_ += events.size();
+  }
+  return status;
 }
 
 QueryData EventSubscriberPlugin::get(EventTime start, EventTime stop) {
-  QueryData results;
+  return getEvents(start, stop, nullptr);
+}
 
-  // Get the records for this time range.
-  auto indexes = getIndexes(start, stop);
-  auto records = getRecords(indexes);
+QueryData EventSubscriberPlugin::getEvents(EventTime start,
+                                           EventTime stop,
+                                           EventCursor* cursor,
+                                           bool descending,
+                                           size_t limit) {
+  QueryData results;
+  flushEvents();
+  if (stream_) {
+    // Streamed events are only selected from the in-memory ring, which is
+    // in the order events were added.
+    std::vector<std::pair<EventTime, const Row*>> selected;
+    ReadLock lock(stream_lock_);
+    for (const auto& event : stream_ring_events_) {
+      if (event.first >= start && (stop == 0 || event.first <= stop)) {
+        selected.push_back(std::make_pair(event.first, &event.second));
+      }
+    }
 
-  std::string events_key = "data." + dbNamespace();
-  std::vector<std::string> mapped_records;
-  for (const auto& record : records) {
-    if (record.second >= start && (record.second <= stop || stop == 0)) {
-      mapped_records.push_back(events_key + "." + record.first);
+    std::stable_sort(selected.begin(),
+                     selected.end(),
+                     [descending](const std::pair<EventTime, const Row*>& l,
+                                  const std::pair<EventTime, const Row*>& r) {
+                       return (descending) ? l.first > r.first
+                                           : l.first < r.first;
+                     });
+    if (limit > 0 && selected.size() > limit) {
+      selected.resize(limit);
+    }
+    for (const auto& event : selected) {
+      results.push_back(*event.second);
     }
+    enrichEvents(results);
+    return results;
   }
 
-  if (FLAGS_events_optimize && !records.empty()) {
-    // If records were returned save the ordered-last as the optimization EID.
-    unsigned long int eidr = 0;
-    if (safeStrtoul(records.back().first, 10, eidr)) {
-      optimize_eid_ = static_cast<size_t>(eidr);
+  if (!kEventsExpiring) {
+    // Without the background service the expired events are removed here.
+    auto batch = FLAGS_events_expiry_batch;
+    while (expireEvents(batch) == batch && batch > 0) {
     }
   }
 
-  // Select mapped_records using event_ids as keys.
-  std::string data_value;
-  for (const auto& record : mapped_records) {
-    Row r;
-    auto status = getDatabaseValue(kEvents, record, data_value);
-    if (data_value.length() == 0) {
-      // There is no record here, interesting error case.
+  // Expired events waiting for removal are not selected.
+  if (expire_time_ != 0 && start <= expire_time_) {
+    if (expire_time_ == std::numeric_limits<EventTime>::max()) {
+      return results;
+    }
+    start = expire_time_ + 1;
+  }
+
+  // Event keys are ordered by time, select the range [start, stop].
+  auto prefix = getEventPrefix();
+  auto end = (stop == 0 || stop == std::numeric_limits<EventTime>::max())
+                 ? getDatabasePrefixEnd(prefix)
+                 : prefix + getOrderedKey(stop + 1);
+  // A consumer's cursor reads every event forward, the results are reversed.
+  DatabaseKeyValues events;
+  if (cursor != nullptr) {
+    limit = 0;
+  }
+  scanDatabaseRange(kEvents,
+                    prefix + getOrderedKey(start),
+                    end,
+                    events,
+                    limit,
+                    descending && cursor == nullptr);
+
+  size_t last_eid = 0;
+  for (const auto& event : events) {
+    auto eid = static_cast<size_t>(
+        valueFromOrderedKey(event.first, prefix.size() + 17));
+    if (cursor != nullptr && eid <= cursor->eid) {
+      // The consumer received this event from an earlier select.
       continue;
     }
-    status = deserializeRowJSON(data_value, r);
-    data_value.clear();
-    if (status.ok()) {
+
+    Row r;
+    if (deserializeRowStored(event.second, r).ok()) {
       results.push_back(std::move(r));
     }
+    last_eid = std::max(last_eid, eid);
+  }
+
+  if (cursor != nullptr && last_eid > cursor->eid) {
+    cursor->eid = last_eid;
+  }
+
+  if (cursor != nullptr && descending) {
+    std::reverse(results.begin(), results.end());
   }
 
   if (getEventsExpiry() > 0) {
     // Set the expire time to NOW - "configured lifetime".
-    // Index retrieval will apply the constraints checking and auto-expire.
+    // The next retrieval will apply the expiration.
     expire_time_ = getUnixTime() - getEventsExpiry();
   }
 
-  if (FLAGS_events_optimize) {
-    setOptimizeData(optimize_time_, optimize_eid_, dbNamespace());
+  enrichEvents(results);
+  return results;
+}
+
+Row EventSubscriberPlugin::getSampleKey(const Row& r) const {
+  auto key = r;
+  key.erase("time");
+  key.erase("uptime");
+  return key;
+}
+
+bool EventSubscriberPlugin::admitEvent(const Row& r) {
+  // The row fingerprint is stable, hosts sample the same events.
+  if (sample_ratio_ > 1 &&
+      getRowFingerprint(getSampleKey(r)) % sample_ratio_ != 0) {
+    sampled_out_++;
+    return false;
+  }
+
+  if (rate_limit_ == 0) {
+    return true;
   }
 
-  return results;
+  auto now = static_cast<size_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+  WriteLock lock(rate_lock_);
+  // A token bucket refilled continuously, holding at most a second of events.
+  if (rate_time_ == 0) {
+    rate_tokens_ = static_cast<double>(rate_limit_);
+  } else {
+    rate_tokens_ = std::min(static_cast<double>(rate_limit_),
+                            rate_tokens_ + (now - rate_time_) *
+                                               rate_limit_ / 1000.0);
+  }
+  rate_time_ = now;
+
+  if (rate_tokens_ < 1) {
+    rate_limited_++;
+    return false;
+  }
+  rate_tokens_ -= 1;
+  return true;
 }
 
 Status EventSubscriberPlugin::add(Row& r, EventTime event_time) {
-  // Get and increment the EID for this module.
-  EventID eid = getEventID();
+  // Sampled and rate limited events are dropped before using an EventID.
+  if (!admitEvent(r)) {
+    return Status(0, "OK");
+  }
+
   // Without encouraging a missing event time, do not support a 0-time.
   if (event_time == 0) {
     event_time = getUnixTime();
   }
 
   r["time"] = std::to_string(event_time);
+  TRACE_PROBE2(event__add, getName().c_str(), event_time);
+  if (stream_) {
+    return streamEvent(r, event_time);
+  }
+
+  // Get and increment the EID for this module.
+  EventID eid = getEventID();
   // Serialize and store the row data, for query-time retrieval.
   std::string data;
-  auto status = serializeRowJSON(r, data);
+  auto status = serializeRowStored(r, data);
   if (!status.ok()) {
     return status;
   }
-  // Then remove the newline.
-  if (data.size() > 0 && data.back() == '\n') {
-    data.pop_back();
-  }
 
   // Use the last EventID and a checkpoint bucket size to periodically apply
-  // buffer eviction. Eviction occurs if the total count exceeds events_max.
-  if (last_eid_ % EVENTS_CHECKPOINT == 0) {
+  // buffer eviction, unless the background expiration service is running.
+  if (!kEventsExpiring && last_eid_ % EVENTS_CHECKPOINT == 0) {
     expireCheck();
   }
 
@@ -522,13 +942,133 @@ Status EventSubscriberPlugin::add(Row& r, EventTime event_time) {
   // If no active logger is marked 'usesLogEvent' then this is a no-op.
   EventFactory::forwardEvent(data);
 
-  // Store the event data.
-  std::string event_key = "data." + dbNamespace() + "." + eid;
-  status = setDatabaseValue(kEvents, event_key, data);
-  // Record the event in the indexing bins, using the index time.
-  recordEvent(eid, event_time);
+  // Stage the event data using a time-ordered key, no index is needed.
+  // Staged events are written together as a single backing store batch.
+  unsigned long int eidr = 0;
+  safeStrtoul(eid, 10, eidr);
+  bool flush = false;
+  {
+    WriteLock lock(staged_events_lock_);
+    auto now = getUnixTime();
+    if (staged_events_.empty()) {
+      staged_time_ = now;
+    }
+    staged_events_.push_back(
+        std::make_pair(getEventKey(event_time, eidr), std::move(data)));
+    flush = (staged_events_.size() >= FLAGS_events_batch_size ||
+             now >= staged_time_ + EVENTS_STAGE_SECONDS);
+  }
+
   event_count_++;
-  return status;
+  if (flush) {
+    return flushEvents();
+  }
+  return Status(0, "OK");
+}
+
+Status EventSubscriberPlugin::streamEvent(const Row& r,
+                                          EventTime event_time) {
+  bool flush = false;
+  {
+    WriteLock lock(stream_lock_);
+    auto now = getUnixTime();
+    if (streamed_events_.empty()) {
+      streamed_time_ = now;
+    }
+    streamed_events_.push_back(r);
+    flush = (streamed_events_.size() >= FLAGS_events_batch_size ||
+             now >= streamed_time_ + EVENTS_STAGE_SECONDS);
+
+    if (stream_ring_ > 0) {
+      stream_ring_events_.push_back(std::make_pair(event_time, r));
+      if (stream_ring_events_.size() > stream_ring_) {
+        stream_ring_events_.pop_front();
+      }
+    }
+  }
+
+  event_count_++;
+  if (flush) {
+    return flushStream();
+  }
+  return Status(0, "OK");
+}
+
+Status EventSubscriberPlugin::flushStream() {
+  QueryLogItem item;
+  {
+    WriteLock lock(stream_lock_);
+    item.results.added.swap(streamed_events_);
+    streamed_time_ = 0;
+  }
+
+  if (item.results.added.empty()) {
+    return Status(0, "OK");
+  }
+
+  // Streamed events are logged as rows added to a query named for the
+  // subscriber, like the results of a scheduled query selecting them.
+  item.name = getName();
+  item.identifier = getHostIdentifier();
+  item.time = getUnixTime();
+  item.calendar_time = getAsciiTime();
+  getDecorations(item);
+  return logQueryLogItem(item);
+}
+
+void EventSubscriberPlugin::startDispatchQueue(size_t max_depth,
+                                               bool block,
+                                               size_t threads) {
+  if (queue_ != nullptr) {
+    return;
+  }
+
+  auto queue = std::make_shared<EventSubscriberQueue>(max_depth, block);
+  size_t started = 0;
+  for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+    queue->addService();
+    auto status =
+        Dispatcher::addService(std::make_shared<EventSubscriberService>(queue));
+    if (!status.ok()) {
+      queue->removeService();
+      LOG(WARNING) << "Cannot start event dispatch for subscriber "
+                   << getName() << ": " << status.getMessage();
+      break;
+    }
+    started++;
+  }
+
+  if (started > 0) {
+    queue_ = queue;
+  }
+}
+
+EventSubscriberPlugin::~EventSubscriberPlugin() {
+  if (queue_ != nullptr) {
+    // Queued callbacks cannot be delivered to a destroyed subscriber.
+    queue_->drain(false);
+  }
+}
+
+void EventSubscriberPlugin::stopDispatchQueue() {
+  if (queue_ != nullptr) {
+    queue_->drain();
+  }
+}
+
+bool EventSubscriberPlugin::dispatch(std::function<void()> callback) {
+  if (queue_ == nullptr) {
+    return false;
+  }
+  return queue_->push(std::move(callback));
+}
+
+size_t EventSubscriberPlugin::queueDepth() const {
+  return (queue_ != nullptr) ? queue_->depth() : 0;
+}
+
+size_t EventSubscriberPlugin::queueDrops() const {
+  return (queue_ != nullptr) ? queue_->drops() : 0;
 }
 
 EventPublisherRef EventSubscriberPlugin::getPublisher() const {
@@ -552,15 +1092,31 @@ void EventFactory::delay() {
     return;
   }
 
-  // Create a thread for each event publisher.
   auto& ef = EventFactory::getInstance();
-  for (const auto& publisher : EventFactory::getInstance().event_pubs_) {
-    // Publishers that did not set up correctly are put into an ending state.
-    if (!publisher.second->isEnding()) {
-      auto thread_ = std::make_shared<std::thread>(
-          boost::bind(&EventFactory::run, publisher.first));
-      ef.threads_.push_back(thread_);
+  if (!FLAGS_events_replay.empty()) {
+    // Publishers are given captured input instead of running their loops.
+    Dispatcher::addService(std::make_shared<EventReplayRunner>(
+        FLAGS_events_replay, FLAGS_events_replay_speed));
+  } else {
+    auto status = EventCapture::start();
+    if (!status.ok()) {
+      LOG(WARNING) << status.getMessage();
     }
+
+    // Create a thread for each event publisher.
+    for (const auto& publisher : ef.event_pubs_) {
+      // Publishers that did not set up correctly are put into an ending state.
+      if (!publisher.second->isEnding()) {
+        auto thread_ = std::make_shared<std::thread>(
+            boost::bind(&EventFactory::run, publisher.first));
+        ef.threads_.push_back(thread_);
+      }
+    }
+  }
+
+  // Remove expired events in the background rather than within selects.
+  if (kToolType == ToolType::DAEMON) {
+    Dispatcher::addService(std::make_shared<EventExpirationService>());
   }
 }
 
@@ -570,6 +1126,7 @@ Status EventPublisherPlugin::addSubscription(
   // subscriptions will be walked.
   WriteLock lock(subscription_lock_);
   subscriptions_.push_back(subscription);
+  subscriptions_version_++;
   return Status(0);
 }
 
@@ -583,6 +1140,7 @@ void EventPublisherPlugin::removeSubscriptions(const std::string& subscriber) {
                        return (subscription->subscriber_name == subscriber);
                      });
   subscriptions_.erase(end, subscriptions_.end());
+  subscriptions_version_++;
 }
 
 void EventFactory::addForwarder(const std::string& logger) {
@@ -591,7 +1149,11 @@ void EventFactory::addForwarder(const std::string& logger) {
 
 void EventFactory::forwardEvent(const std::string& event) {
   for (const auto& logger : getInstance().loggers_) {
-    Registry::call("logger", logger, {{"event", event}});
+    Registry::callLocal<LoggerPlugin>(
+        "logger",
+        logger,
+        [&event](LoggerPlugin& plugin) { return plugin.callEvent(event); },
+        [&event]() { return PluginRequest{{"event", event}}; });
   }
 }
 
@@ -649,12 +1211,130 @@ Status EventFactory::run(EventPublisherID& type_id) {
   return Status(0, "OK");
 }
 
+/// Append the drop and backlog counters of publishers and subscribers.
+static void collectEventMetrics(std::vector<MetricSample>& samples) {
+  auto add = [&samples](const std::string& name,
+                        const std::string& labels,
+                        MetricType type,
+                        size_t value) {
+    samples.emplace_back();
+    samples.back().name = name;
+    samples.back().labels = labels;
+    samples.back().type = type;
+    samples.back().value = static_cast<long long>(value);
+  };
+
+  for (const auto& type : EventFactory::publisherTypes()) {
+    auto publisher = EventFactory::getEventPublisher(type);
+    if (publisher == nullptr) {
+      continue;
+    }
+
+    auto labels = "publisher=" + type;
+    add("events_fired", labels, MetricType::COUNTER, publisher->numEvents());
+    add("events_source_dropped",
+        labels,
+        MetricType::COUNTER,
+        publisher->numDropped());
+    add("events_publisher_restarts",
+        labels,
+        MetricType::COUNTER,
+        publisher->restartCount());
+  }
+
+  for (const auto& name : EventFactory::subscriberNames()) {
+    auto subscriber = EventFactory::getEventSubscriber(name);
+    if (subscriber == nullptr) {
+      continue;
+    }
+
+    auto labels = "subscriber=" + name;
+    add("events_received",
+        labels,
+        MetricType::COUNTER,
+        subscriber->numEvents());
+    add("events_queue_depth",
+        labels,
+        MetricType::GAUGE,
+        subscriber->queueDepth());
+    add("events_queue_dropped",
+        labels,
+        MetricType::COUNTER,
+        subscriber->queueDrops());
+    add("events_rate_limited",
+        labels,
+        MetricType::COUNTER,
+        subscriber->rateLimited());
+    add("events_sampled_out",
+        labels,
+        MetricType::COUNTER,
+        subscriber->sampledOut());
+    add("events_expired",
+        labels,
+        MetricType::COUNTER,
+        subscriber->expiredEvents());
+    add("events_expire_pending",
+        labels,
+        MetricType::GAUGE,
+        subscriber->pendingExpiration());
+  }
+}
+
+/// Under memory pressure write staged events and trim streamed rings.
+static std::string shedEvents(MemoryPressureLevel level) {
+  if (level == MemoryPressureLevel::NONE) {
+    return "";
+  }
+
+  auto events = EventFactory::releaseEvents();
+  return (events > 0)
+             ? "released " + std::to_string(events) + " buffered events"
+             : "";
+}
+
 // There's no reason for the event factory to keep multiple instances.
 EventFactory& EventFactory::getInstance() {
   static EventFactory ef;
+  // The factory's counters are reported with the internal metrics.
+  static bool collected = (Metrics::addCollector(collectEventMetrics),
+                           MemoryPressure::addHandler("events", shedEvents),
+                           true);
+  (void)collected;
   return ef;
 }
 
+size_t EventFactory::releaseEvents() {
+  size_t events = 0;
+  for (const auto& name : subscriberNames()) {
+    auto subscriber = getEventSubscriber(name);
+    if (subscriber == nullptr) {
+      continue;
+    }
+
+    {
+      ReadLock lock(subscriber->staged_events_lock_);
+      events += subscriber->staged_events_.size();
+    }
+    {
+      ReadLock lock(subscriber->stream_lock_);
+      events += subscriber->streamed_events_.size();
+    }
+    subscriber->flushEvents();
+
+    // Rings still hold events a select has not read, they are only dropped
+    // if requested and otherwise release their unused capacity.
+    WriteLock lock(subscriber->stream_lock_);
+    if (FLAGS_events_stream_ring_shed) {
+      events += subscriber->stream_ring_events_.size();
+      std::deque<std::pair<EventTime, Row>>().swap(
+          subscriber->stream_ring_events_);
+    } else {
+      subscriber->stream_ring_events_.shrink_to_fit();
+    }
+  }
+  return events;
+}
+
 Status EventFactory::registerEventPublisher(const PluginRef& pub) {
   // Try to downcast the plugin to an event publisher.
   EventPublisherRef specialized_pub;
@@ -755,6 +1435,23 @@ Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
   // Let the subscriber initialize any Subscriptions.
   if (!FLAGS_disable_events && !specialized_sub->disabled) {
     specialized_sub->expireCheck(true);
+    specialized_sub->rate_limit_ =
+        getSubscriberSetting(FLAGS_events_rate_limit, name);
+    specialized_sub->sample_ratio_ =
+        getSubscriberSetting(FLAGS_events_sample, name);
+    for (const auto& stream : osquery::split(FLAGS_events_stream, ",")) {
+      if (stream == name) {
+        specialized_sub->stream_ = true;
+        specialized_sub->stream_ring_ = FLAGS_events_stream_ring;
+      }
+    }
+    for (const auto& async : osquery::split(FLAGS_events_dispatch_async, ",")) {
+      if (async == name) {
+        specialized_sub->startDispatchQueue(FLAGS_events_queue_depth,
+                                            FLAGS_events_queue_block,
+                                            specialized_sub->dispatchThreads());
+      }
+    }
     status = specialized_sub->init();
     specialized_sub->state(EventState::EVENT_RUNNING);
   } else {
@@ -762,9 +1459,19 @@ Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
   }
 
   auto& ef = EventFactory::getInstance();
+  if (exists(name)) {
+    // Deliver events queued for a replaced subscriber.
+    getEventSubscriber(name)->stopDispatchQueue();
+  }
+
   {
     WriteLock lock(getInstance().factory_lock_);
+    if (ef.event_subs_.count(name) > 0) {
+      // Events staged by a replaced subscriber are not lost.
+      ef.event_subs_.at(name)->flushEvents();
+    }
     ef.event_subs_[name] = specialized_sub;
+    ef.subscriber_generation_++;
   }
 
   // Set state of subscriber.
@@ -891,6 +1598,14 @@ void EventFactory::end(bool join) {
     }
   }
 
+  // Publishers are no longer reading input.
+  EventCapture::stop();
+
+  // Deliver events queued for subscribers, the callbacks use publishers.
+  for (const auto& subscriber : ef.event_subs_) {
+    subscriber.second->stopDispatchQueue();
+  }
+
   {
     WriteLock lock(getInstance().factory_lock_);
     // A small cool off helps OS API event publisher flushing.
@@ -900,14 +1615,31 @@ void EventFactory::end(bool join) {
 
     // Threads may still be executing, when they finish, release publishers.
     ef.event_pubs_.clear();
+
+    // Write the events each subscriber has staged before releasing them.
+    for (const auto& subscriber : ef.event_subs_) {
+      subscriber.second->flushEvents();
+    }
     ef.event_subs_.clear();
+    ef.subscriber_generation_++;
   }
 }
 
 void attachEvents() {
+  // Publishers set up independent resources, slow setups may overlap.
   const auto& publishers = RegistryFactory::get().plugins("event_publisher");
+  std::vector<std::future<Status>> setups;
   for (const auto& publisher : publishers) {
-    EventFactory::registerEventPublisher(publisher.second);
+    auto plugin = publisher.second;
+    setups.push_back(std::async(
+        (FLAGS_startup_parallel) ? std::launch::async : std::launch::deferred,
+        [plugin]() { return EventFactory::registerEventPublisher(plugin); }));
+    if (!FLAGS_startup_parallel) {
+      setups.back().wait();
+    }
+  }
+  for (auto& setup : setups) {
+    setup.wait();
   }
 
   const auto& subscribers = RegistryFactory::get().plugins("event_subscriber");
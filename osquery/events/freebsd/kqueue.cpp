@@ -0,0 +1,466 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/event.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/metrics.h"
+#include "osquery/events/freebsd/kqueue.h"
+#include "osquery/filesystem/file_cache.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+const uint32_t kKQueueDefaultFlags = NOTE_DELETE | NOTE_WRITE | NOTE_EXTEND |
+                                     NOTE_ATTRIB | NOTE_RENAME | NOTE_REVOKE;
+
+/// The maximum number of vnode events read from the kqueue per run.
+static const size_t kKQueueEventBatch = 64;
+
+/// The kqueue wait, a stop is noticed between waits.
+static const long kKQueueMLatency = 200;
+
+REGISTER(KQueueEventPublisher, "event_publisher", "kqueue");
+
+/// List the entry names of a directory.
+static std::vector<std::string> listEntries(const std::string& path) {
+  std::vector<std::string> entries;
+  boost::system::error_code ec;
+  for (fs::directory_iterator it(path, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    entries.push_back(it->path().filename().string());
+  }
+  return entries;
+}
+
+Status KQueueEventPublisher::setUp() {
+  WriteLock lock(mutex_);
+  kqueue_handle_ = ::kqueue();
+  if (kqueue_handle_ == -1) {
+    return Status(1, "Could not create kqueue");
+  }
+
+  // Leave descriptors for the rest of the process.
+  struct rlimit limit;
+  max_watches_ = 1024;
+  if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur != RLIM_INFINITY) {
+    max_watches_ = static_cast<size_t>(limit.rlim_cur / 2);
+  }
+  return Status(0, "OK");
+}
+
+void KQueueEventPublisher::tearDown() {
+  WriteLock lock(mutex_);
+  for (const auto& watch : watches_) {
+    ::close(watch.second.descriptor);
+  }
+  watches_.clear();
+  descriptor_paths_.clear();
+
+  if (kqueue_handle_ != -1) {
+    ::close(kqueue_handle_);
+  }
+  kqueue_handle_ = -1;
+}
+
+void KQueueEventPublisher::discoverSubscription(
+    KQueueSubscriptionContextRef& sc) {
+  if (!sc->discovered_.empty()) {
+    // The subscription path was already resolved.
+    return;
+  }
+
+  sc->discovered_ = sc->path;
+  if (sc->path.find("**") != std::string::npos) {
+    sc->recursive = true;
+    sc->discovered_ = sc->path.substr(0, sc->path.find("**"));
+    sc->path = sc->discovered_;
+  }
+
+  if (sc->path.find('*') != std::string::npos) {
+    // A wildcard within the leaf is applied with fnmatch on fired events.
+    auto fullpath = fs::path(sc->path);
+    if (fullpath.filename().string().find('*') != std::string::npos) {
+      sc->discovered_ = fullpath.parent_path().string() + '/';
+    }
+
+    if (sc->discovered_.find('*') != std::string::npos) {
+      // A wildcard within the stem is resolved at configure time.
+      sc->recursive_match = sc->recursive;
+      return;
+    }
+  }
+
+  if (isDirectory(sc->discovered_) && sc->discovered_.back() != '/') {
+    sc->path += '/';
+    sc->discovered_ += '/';
+  }
+}
+
+void KQueueEventPublisher::collectSubscription(
+    const KQueueSubscriptionContextRef& sc, KQueuePathMap& paths) const {
+  if (sc->discovered_.find('*') != std::string::npos) {
+    std::vector<std::string> resolved;
+    resolveFilePattern(sc->discovered_, resolved);
+    for (const auto& path : resolved) {
+      collectPath(path, sc->recursive, paths);
+    }
+    return;
+  }
+  collectPath(sc->discovered_, sc->recursive, paths);
+}
+
+void KQueueEventPublisher::collectPath(const std::string& path,
+                                       bool recursive,
+                                       KQueuePathMap& paths) const {
+  if (!isDirectory(path).ok()) {
+    paths[path] = paths[path] || recursive;
+    return;
+  }
+
+  auto directory = (path.back() == '/') ? path : path + '/';
+  std::vector<std::string> directories = {directory};
+  if (recursive) {
+    // Only the directories that changed since the last expansion are listed.
+    std::vector<std::string> children;
+    DirectoryTreeCache::instance().listDirectories(directory, children);
+
+    boost::system::error_code ec;
+    for (const auto& child : children) {
+      directories.push_back(fs::canonical(child, ec).string() + '/');
+    }
+  }
+
+  // A directory vnode does not report writes to the files within it.
+  for (const auto& watched : directories) {
+    paths[watched] = paths[watched] || recursive;
+
+    std::vector<std::string> files;
+    listFilesInDirectory(watched, files, false);
+    for (const auto& file : files) {
+      if (!isDirectory(file).ok()) {
+        paths.insert(std::make_pair(file, false));
+      }
+    }
+  }
+}
+
+bool KQueueEventPublisher::addWatch(const std::string& path, bool recursive) {
+  WriteLock lock(mutex_);
+  auto existing = watches_.find(path);
+  if (existing != watches_.end()) {
+    existing->second.recursive = recursive;
+    return true;
+  }
+
+  if (kqueue_handle_ == -1) {
+    return false;
+  }
+
+  if (watches_.size() >= max_watches_) {
+    if (!capped_) {
+      LOG(WARNING) << "Reached the limit of " << max_watches_
+                   << " kqueue watches, not watching: " << path;
+      capped_ = true;
+    }
+    static auto& capped = Metrics::counter("kqueue_watches_capped");
+    capped.add();
+    return false;
+  }
+
+  int descriptor = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (descriptor == -1) {
+    VLOG(1) << "Could not open path for kqueue watch: " << path;
+    return false;
+  }
+
+  struct kevent change;
+  EV_SET(&change,
+         descriptor,
+         EVFILT_VNODE,
+         EV_ADD | EV_ENABLE | EV_CLEAR,
+         kKQueueDefaultFlags,
+         0,
+         nullptr);
+  if (::kevent(kqueue_handle_, &change, 1, nullptr, 0, nullptr) == -1) {
+    LOG(WARNING) << "Could not add kqueue watch on: " << path;
+    ::close(descriptor);
+    return false;
+  }
+
+  auto& watch = watches_[path];
+  watch.descriptor = descriptor;
+  watch.recursive = recursive;
+  watch.directory = (path.back() == '/');
+  if (watch.directory) {
+    for (const auto& entry : listEntries(path)) {
+      auto entry_path = path + entry;
+      watch.entries[entry] = watches_.count(entry_path) > 0 ||
+                             watches_.count(entry_path + '/') > 0;
+    }
+  }
+  descriptor_paths_[descriptor] = path;
+
+  // The entry of a watched parent directory now has its own watch.
+  auto entry = fs::path(path.substr(0, path.find_last_not_of('/') + 1));
+  auto parent = watches_.find(entry.parent_path().string() + '/');
+  if (parent != watches_.end()) {
+    parent->second.entries[entry.filename().string()] = true;
+  }
+  return true;
+}
+
+void KQueueEventPublisher::removeWatch(const std::string& path,
+                                       bool removed) {
+  WriteLock lock(mutex_);
+  auto watch = watches_.find(path);
+  if (watch == watches_.end()) {
+    return;
+  }
+
+  // Closing the descriptor removes its kqueue events.
+  ::close(watch->second.descriptor);
+  descriptor_paths_.erase(watch->second.descriptor);
+  watches_.erase(watch);
+
+  // The parent directory reports the removal of an unwatched entry.
+  auto entry = fs::path(path.substr(0, path.find_last_not_of('/') + 1));
+  auto parent = watches_.find(entry.parent_path().string() + '/');
+  if (parent != watches_.end()) {
+    auto name = parent->second.entries.find(entry.filename().string());
+    if (name == parent->second.entries.end()) {
+      return;
+    } else if (removed) {
+      parent->second.entries.erase(name);
+    } else {
+      name->second = false;
+    }
+  }
+}
+
+void KQueueEventPublisher::configure() {
+  // Compare the paths every subscription needs with the watched paths.
+  KQueuePathMap paths;
+  std::map<std::string, size_t> expansions;
+  for (auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    auto start = std::chrono::steady_clock::now();
+    discoverSubscription(sc);
+    collectSubscription(sc, paths);
+    expansions[sc->category] +=
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+  }
+
+  // The cost of expanding each category's paths, from the last configure.
+  for (const auto& expansion : expansions) {
+    Metrics::gauge("file_paths_expansion_us", "category=" + expansion.first)
+        .set(expansion.second);
+  }
+
+  std::vector<std::string> removed;
+  {
+    WriteLock lock(mutex_);
+    capped_ = false;
+    for (const auto& watch : watches_) {
+      if (paths.count(watch.first) == 0) {
+        removed.push_back(watch.first);
+      }
+    }
+  }
+
+  for (const auto& path : removed) {
+    removeWatch(path);
+  }
+
+  for (const auto& path : paths) {
+    addWatch(path.first, path.second);
+  }
+
+  // Monitoring may change the subscription paths, compile them again.
+  subscriptions_version_++;
+}
+
+Status KQueueEventPublisher::run() {
+  int handle = -1;
+  {
+    WriteLock lock(mutex_);
+    handle = kqueue_handle_;
+  }
+
+  if (handle == -1) {
+    return Status(1, "kqueue is not set up");
+  }
+
+  struct kevent events[kKQueueEventBatch];
+  struct timespec timeout = {0, kKQueueMLatency * 1000 * 1000};
+  auto count =
+      ::kevent(handle, nullptr, 0, events, kKQueueEventBatch, &timeout);
+  if (count == -1) {
+    if (errno == EINTR || isEnding()) {
+      return Status(0, "OK");
+    }
+    return Status(1, "kqueue read failed");
+  }
+
+  for (int i = 0; i < count && !interrupted(); i++) {
+    if (events[i].filter == EVFILT_VNODE) {
+      handleEvent(static_cast<int>(events[i].ident), events[i].fflags);
+    }
+  }
+  return Status(0, "OK");
+}
+
+void KQueueEventPublisher::handleEvent(int descriptor, uint32_t fflags) {
+  std::string path;
+  bool directory = false;
+  {
+    WriteLock lock(mutex_);
+    auto it = descriptor_paths_.find(descriptor);
+    if (it == descriptor_paths_.end()) {
+      return;
+    }
+    path = it->second;
+    directory = watches_.at(path).directory;
+  }
+
+  if (directory && (fflags & NOTE_WRITE)) {
+    // An entry was created or removed, only creation needs the listing.
+    scanDirectory(path);
+  } else if (!directory && (fflags & (NOTE_WRITE | NOTE_EXTEND))) {
+    fireEvent(path, fflags & (NOTE_WRITE | NOTE_EXTEND), "UPDATED");
+  }
+
+  if (fflags & NOTE_ATTRIB) {
+    fireEvent(path, NOTE_ATTRIB, "ATTRIBUTES_MODIFIED");
+  }
+
+  if (fflags & NOTE_RENAME) {
+    fireEvent(path, NOTE_RENAME, "MOVED_FROM");
+    removeWatch(path, true);
+  } else if (fflags & (NOTE_DELETE | NOTE_REVOKE)) {
+    fireEvent(path, fflags & (NOTE_DELETE | NOTE_REVOKE), "DELETED");
+    removeWatch(path, true);
+  }
+}
+
+void KQueueEventPublisher::scanDirectory(const std::string& path) {
+  auto current = listEntries(path);
+
+  bool recursive = false;
+  std::vector<std::string> created;
+  std::vector<std::string> deleted;
+  {
+    WriteLock lock(mutex_);
+    auto watch = watches_.find(path);
+    if (watch == watches_.end()) {
+      return;
+    }
+
+    recursive = watch->second.recursive;
+    auto previous = std::move(watch->second.entries);
+    watch->second.entries.clear();
+    for (const auto& entry : current) {
+      auto existing = previous.find(entry);
+      if (existing == previous.end()) {
+        created.push_back(entry);
+        watch->second.entries[entry] = false;
+      } else {
+        watch->second.entries[entry] = existing->second;
+        previous.erase(existing);
+      }
+    }
+
+    // Removed entries with their own watch are reported by that watch.
+    for (const auto& entry : previous) {
+      if (!entry.second) {
+        deleted.push_back(entry.first);
+      }
+    }
+  }
+
+  for (const auto& entry : created) {
+    auto entry_path = path + entry;
+    if (isDirectory(entry_path).ok()) {
+      if (recursive) {
+        // Directories may be created within it before it is watched.
+        KQueuePathMap paths;
+        collectPath(entry_path + '/', true, paths);
+        for (const auto& created_path : paths) {
+          addWatch(created_path.first, created_path.second);
+        }
+      }
+    } else {
+      addWatch(entry_path, false);
+    }
+    fireEvent(entry_path, NOTE_WRITE, "CREATED");
+  }
+
+  for (const auto& entry : deleted) {
+    fireEvent(path + entry, NOTE_WRITE, "DELETED");
+  }
+}
+
+void KQueueEventPublisher::fireEvent(const std::string& path,
+                                     uint32_t fflags,
+                                     const std::string& action) {
+  auto ec = createEventContext();
+  ec->path = path;
+  ec->fflags = fflags;
+  ec->action = action;
+  {
+    WriteLock lock(mutex_);
+    ec->transaction_id = ++transaction_id_;
+  }
+  fire(ec);
+}
+
+bool KQueueEventPublisher::shouldFire(const KQueueSubscriptionContextRef& sc,
+                                      const KQueueEventContextRef& ec) const {
+  // The subscription may supply required vnode notes.
+  if (sc->fflags != 0 && !(ec->fflags & sc->fflags)) {
+    return false;
+  }
+
+  if (sc->recursive && !sc->recursive_match) {
+    return ec->path.find(sc->path) == 0;
+  } else if (ec->path == sc->path) {
+    return true;
+  }
+
+  // Only apply a leading-dir match if this is a recursive watch with a
+  // match requirement (an inline wildcard with ending recursive wildcard).
+  return fnmatch((sc->path + "*").c_str(),
+                 ec->path.c_str(),
+                 FNM_PATHNAME | FNM_CASEFOLD |
+                     ((sc->recursive_match) ? FNM_LEADING_DIR : 0)) == 0;
+}
+
+size_t KQueueEventPublisher::numWatches() const {
+  WriteLock lock(mutex_);
+  return watches_.size();
+}
+}
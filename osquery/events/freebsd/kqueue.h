@@ -0,0 +1,183 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/// The vnode notes watched for each file and directory.
+extern const uint32_t kKQueueDefaultFlags;
+
+struct KQueueSubscriptionContext : public SubscriptionContext {
+  /// Subscription the following filesystem path.
+  std::string path;
+
+  /// Limit the vnode notes to the subscribed flags (if not 0).
+  uint32_t fflags{0};
+
+  /// Treat this path as a directory and subscribe recursively.
+  bool recursive{false};
+
+  /// Save the category this path originated form within the config.
+  std::string category;
+
+ private:
+  /// The configure-time discovered path, see the INotify context.
+  std::string discovered_;
+
+  /// A configure-time pattern was expanded to match absolute paths.
+  bool recursive_match{false};
+
+ private:
+  friend class KQueueEventPublisher;
+};
+
+struct KQueueEventContext : public EventContext {
+  /// The vnode notes reported, NOTE_WRITE for changed directory entries.
+  uint32_t fflags{0};
+
+  /// The path of the changed file or directory entry.
+  std::string path;
+
+  /// The string action representing the vnode notes.
+  std::string action;
+
+  /// A counter of the publisher's events, there is no kernel cookie.
+  size_t transaction_id{0};
+};
+
+using KQueueEventContextRef = std::shared_ptr<KQueueEventContext>;
+using KQueueSubscriptionContextRef = std::shared_ptr<KQueueSubscriptionContext>;
+
+/**
+ * @brief A vnode watched with EVFILT_VNODE.
+ *
+ * kqueue reports that a directory changed but not which entry changed. Each
+ * directory remembers its entries, and whether each has its own watch, so
+ * created entries are found by comparing a new listing.
+ */
+struct KQueueWatch {
+  /// The open descriptor identifying the vnode to kqueue.
+  int descriptor{-1};
+
+  /// The vnode is a directory, its entries are compared when written.
+  bool directory{false};
+
+  /// Directories created within this directory are also watched.
+  bool recursive{false};
+
+  /// Directory entry names, true if the entry has its own watch.
+  std::map<std::string, bool> entries;
+};
+
+/// The watched paths, directories end with a '/', and their recursion.
+using KQueuePathMap = std::map<std::string, bool>;
+
+/**
+ * @brief A file event publisher for FreeBSD using kqueue vnode filters.
+ *
+ * There is no inotify-like API on FreeBSD, each watched file and directory
+ * is opened and added to a kqueue. Subscribing to a directory watches the
+ * files within it, and every directory within it if recursive, such that
+ * the subscriber contract of the INotify publisher is kept.
+ */
+class KQueueEventPublisher
+    : public EventPublisher<KQueueSubscriptionContext, KQueueEventContext> {
+  DECLARE_PUBLISHER("kqueue");
+
+ public:
+  /// Create the kqueue.
+  Status setUp() override;
+
+  /// Watch the paths of each subscription, only changes are applied.
+  void configure() override;
+
+  /// Close every watched descriptor and the kqueue.
+  void tearDown() override;
+
+  /// Read and fire a batch of vnode events.
+  Status run() override;
+
+  /// The number of watched files and directories.
+  size_t numWatches() const;
+
+ public:
+  bool shouldFire(const KQueueSubscriptionContextRef& sc,
+                  const KQueueEventContextRef& ec) const override;
+
+ private:
+  /// Resolve the base path and recursion of a subscription once.
+  void discoverSubscription(KQueueSubscriptionContextRef& sc);
+
+  /// Collect the paths a subscription needs watched.
+  void collectSubscription(const KQueueSubscriptionContextRef& sc,
+                           KQueuePathMap& paths) const;
+
+  /// Collect a path, the files within it, and directories if recursive.
+  void collectPath(const std::string& path,
+                   bool recursive,
+                   KQueuePathMap& paths) const;
+
+  /// Open and add a path to the kqueue, if it is not watched.
+  bool addWatch(const std::string& path, bool recursive);
+
+  /**
+   * @brief Close a path's descriptor, this removes it from the kqueue.
+   *
+   * @param path The watched path.
+   * @param removed The vnode reported its removal, the parent must not.
+   */
+  void removeWatch(const std::string& path, bool removed = false);
+
+  /// Translate the vnode notes of a watched descriptor into events.
+  void handleEvent(int descriptor, uint32_t fflags);
+
+  /// Compare a written directory's entries, watch and fire new entries.
+  void scanDirectory(const std::string& path);
+
+  /// Create and fire an event context.
+  void fireEvent(const std::string& path,
+                 uint32_t fflags,
+                 const std::string& action);
+
+ private:
+  /// The kqueue descriptor.
+  int kqueue_handle_{-1};
+
+  /// Map of watched path to the watch.
+  std::map<std::string, KQueueWatch> watches_;
+
+  /// Map of watch descriptor to path.
+  std::map<int, std::string> descriptor_paths_;
+
+  /// Each watch holds a descriptor, at most half of the process's limit.
+  size_t max_watches_{0};
+
+  /// Set once paths were not watched because of the limit, until configure.
+  bool capped_{false};
+
+  /// The number of events fired, used as a transaction ID.
+  size_t transaction_id_{0};
+
+  /// Access to the kqueue and watches.
+  mutable Mutex mutex_;
+
+ private:
+  FRIEND_TEST(KQueueTests, test_kqueue_configure);
+  FRIEND_TEST(KQueueTests, test_kqueue_created_entry);
+};
+}
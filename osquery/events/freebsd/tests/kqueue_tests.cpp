@@ -0,0 +1,99 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <stdio.h>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+#include <osquery/filesystem.h>
+
+#include "osquery/events/freebsd/kqueue.h"
+#include "osquery/tests/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+class KQueueTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    real_test_dir = kTestWorkingDirectory + "kqueue-triggers" +
+                    std::to_string(rand() % 10000 + 10000);
+    fs::create_directories(real_test_dir + "/2");
+    TriggerEvent(real_test_dir + "/1");
+    TriggerEvent(real_test_dir + "/2/1");
+
+    pub_ = std::make_shared<KQueueEventPublisher>();
+    pub_->setUp();
+  }
+
+  void TearDown() override {
+    pub_->tearDown();
+    fs::remove_all(real_test_dir);
+  }
+
+  void TriggerEvent(const std::string& path) {
+    FILE* fd = fopen(path.c_str(), "w");
+    fputs("kqueue", fd);
+    fclose(fd);
+  }
+
+  void Subscribe(const std::string& path, bool recursive) {
+    auto sc = std::make_shared<KQueueSubscriptionContext>();
+    sc->path = path;
+    sc->recursive = recursive;
+    pub_->addSubscription(Subscription::create("TestSubscriber", sc));
+    pub_->configure();
+  }
+
+ protected:
+  std::shared_ptr<KQueueEventPublisher> pub_{nullptr};
+
+  /// Transient paths ./kqueue-triggers/.
+  std::string real_test_dir;
+};
+
+TEST_F(KQueueTests, test_kqueue_configure) {
+  // A directory watch includes the files within it.
+  Subscribe(real_test_dir, false);
+  EXPECT_EQ(pub_->numWatches(), 3U);
+  EXPECT_EQ(pub_->watches_.count(real_test_dir + "/"), 1U);
+  EXPECT_EQ(pub_->watches_.count(real_test_dir + "/1"), 1U);
+  auto descriptor = pub_->watches_.at(real_test_dir + "/").descriptor;
+
+  // A recursive watch adds the subdirectory and its files.
+  pub_->removeSubscriptions("TestSubscriber");
+  Subscribe(real_test_dir, true);
+  EXPECT_EQ(pub_->numWatches(), 5U);
+  EXPECT_EQ(pub_->watches_.at(real_test_dir + "/").descriptor, descriptor);
+
+  pub_->removeSubscriptions("TestSubscriber");
+  pub_->configure();
+  EXPECT_EQ(pub_->numWatches(), 0U);
+}
+
+TEST_F(KQueueTests, test_kqueue_created_entry) {
+  Subscribe(real_test_dir, true);
+  ASSERT_EQ(pub_->numWatches(), 5U);
+
+  // The directory write is compared against its entries.
+  fs::create_directory(real_test_dir + "/3");
+  TriggerEvent(real_test_dir + "/3/1");
+  pub_->run();
+
+  // Entries created before the new directory was watched are included.
+  EXPECT_EQ(pub_->watches_.count(real_test_dir + "/3/"), 1U);
+  EXPECT_EQ(pub_->watches_.count(real_test_dir + "/3/1"), 1U);
+  EXPECT_GT(pub_->numEvents(), 0U);
+}
+}
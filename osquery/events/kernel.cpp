@@ -8,6 +8,11 @@
  *
  */
 
+#include <algorithm>
+#include <map>
+
+#include <string.h>
+
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
@@ -28,6 +33,13 @@ static const int kKernelEventsSyncMax = 1000;
 /// Handle a maximum of 10 events before request another lock.
 static const int kKernelEventsIterate = 10;
 
+/// Wake the publisher once an eighth of the shared buffer is readable.
+static const size_t kKernelQueueWatermark = kKernelQueueSize / 8;
+
+/// The shortest and longest milliseconds to wait for the watermark.
+static const size_t kKernelSyncMinTimeout = 10;
+static const size_t kKernelSyncMaxTimeout = 1000;
+
 REGISTER(KernelEventPublisher, "event_publisher", "kernel");
 
 Status KernelEventPublisher::setUp() {
@@ -61,16 +73,101 @@ Status KernelEventPublisher::setUp() {
   return Status(0, "OK");
 }
 
+/// Check if every event matching the filter inner also matches outer.
+static bool filterCovers(const osquery_event_filter_t &outer,
+                         const osquery_event_filter_t &inner) {
+  if (outer.actions != OSQUERY_FILE_ACTION_NONE &&
+      (inner.actions == OSQUERY_FILE_ACTION_NONE ||
+       (outer.actions & inner.actions) != inner.actions)) {
+    return false;
+  }
+  if (outer.uid >= 0 && outer.uid != inner.uid) {
+    return false;
+  }
+  return strncmp(inner.path, outer.path, strlen(outer.path)) == 0;
+}
+
 void KernelEventPublisher::configure() {
   WriteLock lock(mutex_);
+  if (queue_ == nullptr) {
+    return;
+  }
+
+  std::map<osquery_event_t, std::vector<KernelSubscriptionContextRef>> events;
   for (const auto &sub : subscriptions_) {
-    if (queue_ != nullptr) {
-      auto sc = getSubscriptionContext(sub->context);
-      queue_->subscribe(sc->event_type);
+    auto sc = getSubscriptionContext(sub->context);
+    events[sc->event_type].push_back(sc);
+  }
+
+  // Filters are set before subscribing so unwanted events are never queued.
+  for (const auto &event : events) {
+    try {
+      setFilters(event.first, event.second);
+      queue_->subscribe(event.first);
+    } catch (const CQueueException &e) {
+      LOG(WARNING) << "Cannot subscribe to kernel event " << event.first
+                   << ": " << e.what();
     }
   }
 }
 
+void KernelEventPublisher::setFilters(
+    osquery_event_t event_type,
+    const std::vector<KernelSubscriptionContextRef> &subs) {
+  queue_->clearFilters(event_type);
+
+  std::vector<osquery_event_filter_t> filters;
+  for (const auto &sc : subs) {
+    if (sc->path.empty() && sc->actions == OSQUERY_FILE_ACTION_NONE &&
+        sc->uid < 0) {
+      // This subscription wants every event.
+      return;
+    }
+
+    // A truncated path is a shorter prefix and matches more events.
+    osquery_event_filter_t filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.actions = sc->actions;
+    filter.uid = sc->uid;
+    strncpy(filter.path, sc->path.c_str(), MAXPATHLEN - 1);
+    filters.push_back(filter);
+  }
+
+  // Shorter prefixes first, then drop filters covered by an earlier filter.
+  using Filter = osquery_event_filter_t;
+  std::sort(filters.begin(),
+            filters.end(),
+            [](const Filter &l, const Filter &r) {
+              return strlen(l.path) < strlen(r.path);
+            });
+  std::vector<Filter> unique;
+  for (const auto &filter : filters) {
+    bool covered =
+        std::any_of(unique.begin(), unique.end(), [&filter](const Filter &f) {
+          return filterCovers(f, filter);
+        });
+    if (!covered) {
+      unique.push_back(filter);
+    }
+  }
+
+  if (unique.size() > OSQUERY_MAX_EVENT_FILTERS) {
+    VLOG(1) << "Too many kernel filters for event " << event_type << ": "
+            << unique.size();
+    return;
+  }
+
+  try {
+    for (const auto &filter : unique) {
+      queue_->addFilter(event_type, filter);
+    }
+  } catch (const CQueueException &e) {
+    // A partial filter table would discard wanted events.
+    queue_->clearFilters(event_type);
+    throw;
+  }
+}
+
 void KernelEventPublisher::stop() {
   WriteLock lock(mutex_);
   if (queue_ != nullptr) {
@@ -80,23 +177,29 @@ void KernelEventPublisher::stop() {
 }
 
 Status KernelEventPublisher::run() {
-  {
+  // Perform queue read min/max synchronization.
+  try {
+    int drops = 0;
     WriteLock lock(mutex_);
     if (queue_ == nullptr) {
       return Status(1, "No kernel communication");
     }
-  }
 
-  // Perform queue read min/max synchronization.
-  try {
-    int drops = 0;
-    WriteLock lock(mutex_);
-    if ((drops = queue_->kernelSync(OSQUERY_OPTIONS_NO_BLOCK)) > 0 &&
-        kToolType == ToolType::DAEMON) {
-      LOG(WARNING) << "Dropping " << drops << " kernel events";
+    // Block in the kernel until the watermark is crossed or the timeout
+    // expires, the timeout also bounds how long a stop waits for the lock.
+    auto options =
+        (drain_) ? OSQUERY_OPTIONS_NO_BLOCK : OSQUERY_OPTIONS_DEFAULT;
+    drops = queue_->kernelSync(options, kKernelQueueWatermark, sync_timeout_);
+    if (drops > 0) {
+      dropped_count_ += drops;
+      if (kToolType == ToolType::DAEMON) {
+        LOG(WARNING) << "Dropping " << drops << " kernel events";
+      }
     }
   } catch (const CQueueException &e) {
     LOG(WARNING) << "Queue synchronization error: " << e.what();
+    pauseMilli(kKernelSyncMaxTimeout);
+    return Status(0, "Continue");
   }
 
   auto dequeueEvents = [this]() {
@@ -146,8 +249,14 @@ Status KernelEventPublisher::run() {
     max_before_sync -= kKernelEventsIterate;
   }
 
-  // Pause for a cool-off since we implement comms in a no-blocking mode.
-  pauseMilli(1000);
+  // A sync that reached the maximum resyncs without waiting. Otherwise the
+  // wait shortens while events arrive and lengthens while the queue is idle.
+  drain_ = (max_before_sync <= 0);
+  if (max_before_sync < kKernelEventsSyncMax) {
+    sync_timeout_ = std::max(kKernelSyncMinTimeout, sync_timeout_ / 2);
+  } else {
+    sync_timeout_ = std::min(kKernelSyncMaxTimeout, sync_timeout_ * 2);
+  }
   return Status(0, "Continue");
 }
 
@@ -168,8 +277,41 @@ KernelEventContextRef KernelEventPublisher::createEventContextFrom(
   return std::static_pointer_cast<KernelEventContext>(ec);
 }
 
+/// Apply the subscription predicates the kernel filters may not have applied.
+template <typename EventType>
+static bool matchesSubscription(const KernelSubscriptionContextRef &sc,
+                                const KernelEventContextRef &ec,
+                                osquery_file_action_t action) {
+  const auto &event =
+      std::static_pointer_cast<TypedKernelEventContext<EventType>>(ec)->event;
+  if (sc->actions != OSQUERY_FILE_ACTION_NONE && !(sc->actions & action)) {
+    return false;
+  }
+  if (sc->uid >= 0 && event.uid != static_cast<uint64_t>(sc->uid)) {
+    return false;
+  }
+  return sc->path.empty() ||
+         strncmp(event.path, sc->path.c_str(), sc->path.size()) == 0;
+}
+
 bool KernelEventPublisher::shouldFire(const KernelSubscriptionContextRef &sc,
                                       const KernelEventContextRef &ec) const {
-  return ec->event_type == sc->event_type;
+  if (ec->event_type != sc->event_type) {
+    return false;
+  }
+
+  switch (ec->event_type) {
+  case OSQUERY_PROCESS_EVENT:
+    return matchesSubscription<osquery_process_event_t>(
+        sc, ec, OSQUERY_FILE_ACTION_NONE);
+  case OSQUERY_FILE_EVENT: {
+    auto action = std::static_pointer_cast<
+                      TypedKernelEventContext<osquery_file_event_t>>(ec)
+                      ->event.action;
+    return matchesSubscription<osquery_file_event_t>(sc, ec, action);
+  }
+  default:
+    return true;
+  }
 }
 } // namespace osquery
@@ -41,6 +41,15 @@ struct KernelSubscriptionContext : public SubscriptionContext {
 
   /// Optional category passed to the callback.
   std::string category;
+
+  /// Optional path prefix, empty matches any path.
+  std::string path;
+
+  /// Optional file actions, OSQUERY_FILE_ACTION_NONE matches any action.
+  osquery_file_action_t actions{OSQUERY_FILE_ACTION_NONE};
+
+  /// Optional real user ID, negative matches any user.
+  int64_t uid{-1};
 };
 
 /**
@@ -120,6 +129,23 @@ class KernelEventPublisher
 
   CQueue *queue_{nullptr};
 
+  /// Milliseconds the next sync waits for the queue's watermark.
+  size_t sync_timeout_{1000};
+
+  /// The previous run stopped dequeuing at the sync maximum.
+  bool drain_{false};
+
+  /**
+   * @brief Replace the kernel filters of an event type.
+   *
+   * The predicates of each subscription are pushed to the kernel so events
+   * no subscription matches are discarded before they consume queue space.
+   * If any subscription has no predicates, or there are more filters than the
+   * kernel holds, every event of the type is queued and shouldFire filters.
+   */
+  void setFilters(osquery_event_t event_type,
+                  const std::vector<KernelSubscriptionContextRef> &subs);
+
   /// Check whether the subscription matches the event.
   bool shouldFire(const KernelSubscriptionContextRef &sc,
                   const KernelEventContextRef &ec) const override;
@@ -86,7 +86,7 @@ static void CommunicationBenchmark(benchmark::State &state) {
   }
 }
 
-BENCHMARK(CommunicationBenchmark)->UseRealTime()->ThreadRange(2, 32);
+BENCHMARK(CommunicationBenchmark)->UseRealTime()->ThreadRange(2, 128);
 
 #endif // KERNEL_TEST
 }
@@ -10,6 +10,7 @@
 
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "osquery/events/kernel/circular_queue_user.h"
@@ -21,6 +22,11 @@ CQueue::CQueue(const std::string &device, size_t size) {
   alloc.size = size;
   alloc.buffer = nullptr;
   alloc.version = OSQUERY_KERNEL_COMM_VERSION;
+  alloc.ring_size = 0;
+
+  // Request a ring per online CPU, the kernel clamps this to the buffer size.
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  alloc.rings = (cpus > 0) ? static_cast<uint32_t>(cpus) : 1;
 
   fd_ = open(device.c_str(), O_RDWR);
   if (fd_ < 0) {
@@ -31,10 +37,21 @@ CQueue::CQueue(const std::string &device, size_t size) {
     throw CQueueException("Could not allocate shared buffer");
   }
 
+  if (alloc.rings == 0 || alloc.rings > OSQUERY_MAX_CQUEUE_RINGS ||
+      alloc.ring_size == 0 || alloc.rings * alloc.ring_size > size) {
+    throw CQueueException("Invalid shared buffer rings");
+  }
+
   buffer_ = (uint8_t *)alloc.buffer;
   size_ = size;
-  read_ = (uint8_t *)alloc.buffer;
-  max_read_ = (uint8_t *)alloc.buffer;
+  rings_.resize(alloc.rings);
+  for (size_t i = 0; i < rings_.size(); i++) {
+    auto &ring = rings_[i];
+    ring.buffer = buffer_ + i * alloc.ring_size;
+    ring.size = alloc.ring_size;
+    ring.read = ring.buffer;
+    ring.max_read = ring.buffer;
+  }
 }
 
 CQueue::~CQueue() {
@@ -54,41 +71,101 @@ void CQueue::subscribe(osquery_event_t event) {
   }
 }
 
+void CQueue::addFilter(osquery_event_t event,
+                       const osquery_event_filter_t &filter) {
+  osquery_event_filter_args_t args;
+  args.event = event;
+  args.clear = 0;
+  args.filter = filter;
+
+  if (ioctl(fd_, OSQUERY_IOCTL_FILTER, &args)) {
+    throw CQueueException("Could not add event filter");
+  }
+}
+
+void CQueue::clearFilters(osquery_event_t event) {
+  osquery_event_filter_args_t args;
+  memset(&args, 0, sizeof(args));
+  args.event = event;
+  args.clear = 1;
+
+  if (ioctl(fd_, OSQUERY_IOCTL_FILTER, &args)) {
+    throw CQueueException("Could not clear event filters");
+  }
+}
+
+osquery_data_header_t *CQueue::peek(Ring &ring) {
+  if (ring.read == ring.max_read) {
+    return nullptr;
+  }
+  osquery_data_header_t *header = (osquery_data_header_t *)ring.read;
+  if (ring.read + sizeof(osquery_data_header_t) > ring.buffer + ring.size ||
+      header->event == END_OF_BUFFER_EVENT) {
+    ring.read = ring.buffer;
+    if (ring.read == ring.max_read) {
+      return nullptr;
+    }
+  }
+  header = (osquery_data_header_t *)ring.read;
+  if (header->event == END_OF_BUFFER_EVENT) {
+    return nullptr;
+  }
+  return header;
+}
+
 osquery_event_t CQueue::dequeue(CQueue::event **event) {
-  if (read_ == max_read_ || event == nullptr) {
+  if (event == nullptr) {
     return (osquery_event_t)0;
   }
-  osquery_data_header_t *header = (osquery_data_header_t *)read_;
-  if (read_ + sizeof(osquery_data_header_t) > buffer_ + size_ ||
-      header->event == END_OF_BUFFER_EVENT) {
-    read_ = buffer_;
-    if (read_ == max_read_) {
-      return (osquery_event_t)0;
+
+  // Merge the rings by selecting the oldest pending event.
+  Ring *oldest = nullptr;
+  osquery_data_header_t *header = nullptr;
+  for (auto &ring : rings_) {
+    auto next = peek(ring);
+    if (next == nullptr) {
+      continue;
+    }
+    if (header == nullptr || next->time.time < header->time.time ||
+        (next->time.time == header->time.time &&
+         next->time.time_usec < header->time.time_usec)) {
+      oldest = &ring;
+      header = next;
     }
   }
-  header = (osquery_data_header_t *)read_;
-  if (header->event != END_OF_BUFFER_EVENT) {
-    size_t size = header->size + sizeof(osquery_data_header_t);
-    read_ = (read_ + size - buffer_) % size_ + buffer_;
+
+  if (header == nullptr) {
+    return (osquery_event_t)0;
   }
 
+  size_t size = header->size + sizeof(osquery_data_header_t);
+  oldest->read =
+      (oldest->read + size - oldest->buffer) % oldest->size + oldest->buffer;
+
   *event = (CQueue::event *)&(header->size);
   return header->event;
 }
 
-int CQueue::kernelSync(int options) {
+int CQueue::kernelSync(int options, size_t watermark, size_t timeout_ms) {
   // A positive return indicates drops, 0 is all good in the hood.
   // Options are listed in kernel feeds; primarily OSQUERY_OPTIONS_NO_BLOCK.
   osquery_buf_sync_args_t sync;
-  sync.read_offset = read_ - buffer_;
+  for (size_t i = 0; i < rings_.size(); i++) {
+    sync.read_offset[i] = rings_[i].read - rings_[i].buffer;
+  }
   sync.options = options;
+  sync.watermark = watermark;
+  sync.timeout_ms = static_cast<uint32_t>(timeout_ms);
 
   int err = 0;
   err = ioctl(fd_, OSQUERY_IOCTL_BUF_SYNC, &sync);
-  uint8_t *new_max_read = sync.max_read_offset + buffer_;
-  max_read_ = new_max_read;
+  for (size_t i = 0; i < rings_.size(); i++) {
+    rings_[i].max_read = sync.max_read_offset[i] + rings_[i].buffer;
+    if (err) {
+      rings_[i].read = rings_[i].max_read;
+    }
+  }
   if (err) {
-    read_ = max_read_;
     throw CQueueException("Could not sync buffer with kernel properly");
   }
 
@@ -12,6 +12,7 @@
 
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 
@@ -42,7 +43,8 @@ class CQueue : private boost::noncopyable {
    *
    * This connects to the osquery kernel extension dev file and sets up a
    * shared buffer of the specified size.  The size must be accepted by the
-   * kernel extension.
+   * kernel extension.  The kernel splits the buffer into a ring per online
+   * CPU, up to OSQUERY_MAX_CQUEUE_RINGS.
    *
    * @param device The device node path for ioctl communication.
    * @param size The size of the shared buffer used for communication.
@@ -66,9 +68,29 @@ class CQueue : private boost::noncopyable {
    */
   void subscribe(osquery_event_t event);
 
+  /**
+   * @brief Add a filter the kernel evaluates before queuing an event.
+   *
+   * Once an event type has a filter the kernel only queues its events that
+   * match at least one filter.
+   *
+   * @param event The event type to filter.
+   * @param filter The subscription predicates.
+   */
+  void addFilter(osquery_event_t event, const osquery_event_filter_t &filter);
+
+  /**
+   * @brief Remove all kernel filters of an event type.
+   *
+   * @param event The event type, all of its events are then queued.
+   */
+  void clearFilters(osquery_event_t event);
+
   /**
    * @brief Dequeue's an event from the shared buffer.
    *
+   * Events are merged from the per-CPU rings in order of their calendar time.
+   *
    * @param event (output) A pointer to the event dequeue if any.
    * @return Returns 0 if queue is empty, otherwise the number of the event put
    * into event.
@@ -83,15 +105,28 @@ class CQueue : private boost::noncopyable {
    * @param options Options to be passed to the kernel. Primarily used for
    *   OSQUERY_OPTIONS_NO_BLOCK, which allows the sync to not block if there is
    *   no data.
+   * @param watermark When blocking, wait until this many bytes are readable.
+   * @param timeout_ms When blocking, the maximum milliseconds to wait.
    * @return Returns the number of dropped events, or negative if too many.
    */
-  int kernelSync(int options);
+  int kernelSync(int options, size_t watermark = 0, size_t timeout_ms = 0);
+
+ private:
+  /// The daemon's view of a per-CPU ring within the shared buffer.
+  struct Ring {
+    uint8_t *buffer{nullptr};
+    size_t size{0};
+    uint8_t *max_read{nullptr};
+    uint8_t *read{nullptr};
+  };
+
+  /// Return the next readable header in a ring, nullptr if it is empty.
+  osquery_data_header_t *peek(Ring &ring);
 
  private:
   uint8_t *buffer_{nullptr};
   size_t size_{0};
-  uint8_t *max_read_{nullptr};
-  uint8_t *read_{nullptr};
+  std::vector<Ring> rings_;
   int fd_{-1};
 };
 
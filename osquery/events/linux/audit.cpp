@@ -8,6 +8,11 @@
  *
  */
 
+#include <algorithm>
+#include <tuple>
+
+#include <sys/socket.h>
+
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem.hpp>
@@ -19,6 +24,7 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/events/linux/audit.h"
+#include "osquery/events/replay.h"
 
 namespace osquery {
 
@@ -37,100 +43,213 @@ FLAG(bool,
      false,
      "Allow the audit publisher to change auditing configuration");
 
+/// Receive audit records alongside another audit daemon.
+FLAG(bool,
+     audit_multicast,
+     false,
+     "Receive audit records from the read-only netlink multicast group");
+
+/// The kernel may drop records when the netlink socket buffer is full.
+FLAG(uint64,
+     audit_socket_buffer,
+     0,
+     "Audit netlink receive buffer size in bytes (default 0, kernel default)");
+
+/// Read several netlink messages with each system call.
+FLAG(uint64,
+     audit_batch_size,
+     1,
+     "Audit netlink messages read with each receive (default 1)");
+
 REGISTER(AuditEventPublisher, "event_publisher", "audit");
 
+#ifndef AUDIT_NLGRP_READLOG
+/// The read-only audit multicast group, available since Linux 3.16.
+#define AUDIT_NLGRP_READLOG 1
+#endif
+
 enum AuditStatus {
   AUDIT_DISABLED = 0,
   AUDIT_ENABLED = 1,
   AUDIT_IMMUTABLE = 2,
 };
 
-static const int kAuditMTimeout = 4000;
+/// Milliseconds the run loop waits for a reply before requesting a status.
+static const int kAuditMTimeout = 1000;
+
+/// The maximum number of netlink messages read with each receive.
+static const size_t kAuditMaxBatchSize = 256;
+
+/// Open a netlink socket bound to the read-only audit multicast group.
+static int openAuditMulticast() {
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_AUDIT);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct sockaddr_nl addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = AUDIT_NLGRP_READLOG;
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/// Increase the receive buffer, privileged processes may exceed rmem_max.
+static void setAuditReceiveBuffer(int fd, int size) {
+  if (size <= 0) {
+    return;
+  }
+
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0 &&
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) {
+    VLOG(1) << "Cannot set audit netlink receive buffer: " << size;
+  }
+}
 
 void AuditAssembler::start(size_t capacity,
                            std::vector<size_t> types,
                            AuditUpdate update) {
   capacity_ = capacity;
   update_ = update;
+  types_ = std::move(types);
 
-  queue_.clear();
-  queue_.reserve(capacity_);
-  mt_.clear();
-  m_.clear();
+  // Preallocate every slot so assembling a message does not allocate.
+  slots_.clear();
+  slots_.resize(capacity_);
+  for (auto& slot : slots_) {
+    slot.types.reserve(types_.size());
+  }
+  size_ = 0;
+  order_ = 0;
+}
 
-  types_ = std::move(types);
+AuditAssembler::AuditSlot* AuditAssembler::find(Auid id) {
+  for (auto& slot : slots_) {
+    if (slot.used && slot.id == id) {
+      return &slot;
+    }
+  }
+  return nullptr;
+}
+
+AuditAssembler::AuditSlot& AuditAssembler::claim(Auid id) {
+  AuditSlot* free_slot = nullptr;
+  AuditSlot* oldest = nullptr;
+  for (auto& slot : slots_) {
+    if (!slot.used) {
+      free_slot = &slot;
+      break;
+    }
+    if (oldest == nullptr || slot.order < oldest->order) {
+      oldest = &slot;
+    }
+  }
+
+  if (free_slot == nullptr) {
+    release(*oldest);
+    free_slot = oldest;
+  }
+
+  free_slot->id = id;
+  free_slot->used = true;
+  free_slot->order = ++order_;
+  size_++;
+  return *free_slot;
+}
+
+void AuditAssembler::release(AuditSlot& slot) {
+  slot.used = false;
+  slot.types.clear();
+  slot.fields.clear();
+  size_--;
 }
 
 boost::optional<AuditFields> AuditAssembler::add(Auid id,
                                                  size_t type,
                                                  const AuditFields& fields) {
-  auto it = m_.find(id);
-  if (it == m_.end()) {
+  auto slot = find(id);
+  if (slot == nullptr) {
     // A new audit ID.
-    if (queue_.size() == capacity_) {
-      evict(queue_.front());
-    }
-
     if (types_.size() == 1 && type == types_[0]) {
       // This is an easy match.
       AuditFields r;
-      if (update_ == nullptr) {
-        m_[id] = {};
-        return boost::none;
-      } else if (!update_(type, fields, r)) {
+      if (update_ == nullptr || !update_(type, fields, r)) {
         return boost::none;
       }
       return r;
     }
 
-    // Add the type, push the ID onto the queue, and update.
-    mt_[id] = {type};
-    queue_.push_back(id);
-    if (update_ == nullptr) {
-      m_[id] = {};
-    } else {
-      update_(type, fields, m_[id]);
+    if (slots_.empty()) {
+      return boost::none;
+    }
+
+    // Claim a slot, add the type, and update.
+    slot = &claim(id);
+    slot->types.push_back(type);
+    if (update_ != nullptr && !update_(type, fields, slot->fields)) {
+      release(*slot);
     }
     return boost::none;
   }
 
   // Add the type and update.
-  auto& mt = mt_[id];
+  auto& mt = slot->types;
   if (std::find(mt.begin(), mt.end(), type) == mt.end()) {
     mt.push_back(type);
   }
 
-  if (update_ != nullptr && !update_(type, fields, m_[id])) {
-    evict(id);
+  if (update_ != nullptr && !update_(type, fields, slot->fields)) {
+    release(*slot);
     return boost::none;
   }
 
   // Check if the message is complete (all types seen).
   if (complete(id)) {
-    auto new_fields = std::move(it->second);
-    evict(id);
+    auto new_fields = std::move(slot->fields);
+    release(*slot);
     return new_fields;
   }
 
   // Move the audit ID to the front of the queue.
-  shuffle(id);
+  slot->order = ++order_;
   return boost::none;
 }
 
+void AuditAssembler::set(Auid id,
+                         const std::string& key,
+                         const std::string& value) {
+  auto slot = find(id);
+  if (slot != nullptr) {
+    slot->fields[key] = value;
+  }
+}
+
 void AuditAssembler::evict(Auid id) {
-  queue_.erase(std::remove(queue_.begin(), queue_.end(), id), queue_.end());
-  mt_.erase(id);
-  m_.erase(id);
+  auto slot = find(id);
+  if (slot != nullptr) {
+    release(*slot);
+  }
 }
 
 void AuditAssembler::shuffle(Auid id) {
-  queue_.erase(std::remove(queue_.begin(), queue_.end(), id), queue_.end());
-  queue_.push_back(id);
+  auto slot = find(id);
+  if (slot != nullptr) {
+    slot->order = ++order_;
+  }
 }
 
 bool AuditAssembler::complete(Auid id) {
+  auto slot = find(id);
+  if (slot == nullptr) {
+    return false;
+  }
+
   // Is this type enough.
-  const auto& types = mt_.at(id);
+  const auto& types = slot->types;
   for (const auto& t : types_) {
     if (std::find(types.begin(), types.end(), t) == types.end()) {
       return false;
@@ -150,6 +269,42 @@ Status AuditEventPublisher::setUp() {
     return Status(1, "Could not open audit subsystem");
   }
 
+  reactor_.reset();
+  reactor_.addHandle(handle_);
+  setAuditReceiveBuffer(handle_, static_cast<int>(FLAGS_audit_socket_buffer));
+
+  if (FLAGS_audit_multicast) {
+    // Records are read from the multicast group, control of audit is not
+    // requested so another audit daemon may continue to run.
+    multicast_handle_ = openAuditMulticast();
+    if (multicast_handle_ < 0) {
+      audit_close(handle_);
+      handle_ = 0;
+      return Status(1, "Could not join the audit multicast group");
+    }
+    reactor_.addHandle(multicast_handle_);
+    setAuditReceiveBuffer(multicast_handle_,
+                          static_cast<int>(FLAGS_audit_socket_buffer));
+  }
+
+  // Preallocate the replies and message headers for each receive.
+  auto batch_size = std::min(
+      std::max(FLAGS_audit_batch_size, static_cast<uint64_t>(1)),
+      static_cast<uint64_t>(kAuditMaxBatchSize));
+  replies_.resize(batch_size);
+  headers_.resize(batch_size);
+  vectors_.resize(batch_size);
+  addresses_.resize(batch_size);
+  for (size_t i = 0; i < batch_size; i++) {
+    memset(&replies_[i], 0, sizeof(struct audit_reply));
+    memset(&headers_[i], 0, sizeof(struct mmsghdr));
+    vectors_[i].iov_base = &replies_[i].msg;
+    vectors_[i].iov_len = sizeof(replies_[i].msg);
+    headers_[i].msg_hdr.msg_iov = &vectors_[i];
+    headers_[i].msg_hdr.msg_iovlen = 1;
+    headers_[i].msg_hdr.msg_name = &addresses_[i];
+  }
+
   // The setup can try to enable auditing.
   if (FLAGS_audit_allow_config) {
     audit_set_enabled(handle_, AUDIT_ENABLED);
@@ -167,7 +322,7 @@ Status AuditEventPublisher::setUp() {
   }
 
   // The auditd daemon sets its PID.
-  if (!immutable_) {
+  if (!immutable_ && multicast_handle_ < 0) {
     if (audit_set_pid(handle_, getpid(), WAIT_YES) < 0) {
       // Could not set our process as the userspace auditing daemon.
       return Status(1, "Could not set audit PID");
@@ -192,8 +347,10 @@ void AuditEventPublisher::configure() {
   // Able to issue libaudit API calls.
   struct AuditRuleInternal rule;
 
-  // Before reply data is ever filled in, assure an empty message.
-  memset(&reply_, 0, sizeof(struct audit_reply));
+  // Before reply data is ever filled in, assure empty messages.
+  for (auto& reply : replies_) {
+    memset(&reply, 0, sizeof(struct audit_reply));
+  }
 
   if (handle_ <= 0 || FLAGS_disable_audit || immutable_) {
     // No configuration or rule manipulation needed.
@@ -270,6 +427,13 @@ void AuditEventPublisher::tearDown() {
     audit_set_enabled(handle_, AUDIT_DISABLED);
   }
 
+  if (multicast_handle_ >= 0) {
+    reactor_.removeHandle(multicast_handle_);
+    close(multicast_handle_);
+    multicast_handle_ = -1;
+  }
+
+  reactor_.removeHandle(handle_);
   audit_close(handle_);
   handle_ = 0;
 }
@@ -278,6 +442,54 @@ inline void handleAuditConfigChange(const struct audit_reply& reply) {
   // Another daemon may have taken control.
 }
 
+bool AuditFieldTokenizer::next(boost::string_ref& key,
+                               boost::string_ref& value) {
+  auto size = fields_.size();
+  while (pos_ < size) {
+    // Multiple space tokens are supported.
+    while (pos_ < size && fields_[pos_] == ' ') {
+      pos_++;
+    }
+    if (pos_ == size) {
+      break;
+    }
+
+    // The key is everything up to the assignment or a space tokenizer.
+    auto key_start = pos_;
+    while (pos_ < size && fields_[pos_] != '=' && fields_[pos_] != ' ') {
+      pos_++;
+    }
+    key = fields_.substr(key_start, pos_ - key_start);
+    value.clear();
+    if (pos_ == size || fields_[pos_] == ' ') {
+      // A token without an assignment.
+      return true;
+    }
+
+    // Skip the assignment, enclosure sequences may appear within the value.
+    auto value_start = ++pos_;
+    bool found_enclose{false};
+    while (pos_ < size) {
+      auto c = fields_[pos_];
+      if (found_enclose && c == '"') {
+        // The end of an enclosure is included in the value.
+        pos_++;
+        break;
+      } else if (!found_enclose && c == ' ') {
+        break;
+      } else if (c == '"') {
+        found_enclose = true;
+      }
+      pos_++;
+    }
+    value = fields_.substr(value_start, pos_ - value_start);
+    if (!key.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
 bool handleAuditReply(const struct audit_reply& reply,
                       AuditEventContextRef& ec) {
   // Build an event context around this reply.
@@ -292,55 +504,25 @@ bool handleAuditReply(const struct audit_reply& reply,
   safeStrtoul(std::string(message_view.substr(6, 10)), 10, ec->time);
   safeStrtoul(
       std::string(message_view.substr(21, preamble_end - 21)), 10, ec->auid);
-  boost::string_ref field_view(message_view.substr(preamble_end + 3));
-
-  // The linear search will construct series of key value pairs.
-  std::string key, value;
-  key.reserve(20);
-  value.reserve(256);
-
-  // There are several ways of representing value data (enclosed strings, etc).
-  bool found_assignment{false}, found_enclose{false};
-  for (const auto& c : field_view) {
-    // Iterate over each character in the audit message.
-    if ((found_enclose && c == '"') || (!found_enclose && c == ' ')) {
-      if (c == '"') {
-        value += c;
-      }
-      // This is a terminating sequence, the end of an enclosure or space tok.
-      if (!key.empty()) {
-        // Multiple space tokens are supported.
-        ec->fields.emplace(std::make_pair(std::move(key), std::move(value)));
-      }
-      found_enclose = false;
-      found_assignment = false;
-      key.clear();
-      value.clear();
-    } else if (!found_assignment && c == ' ') {
-      // A field tokenizer.
-    } else if (found_assignment) {
-      // Enclosure sequences appear immediately following assignment.
-      if (c == '"') {
-        found_enclose = true;
-      }
-      value += c;
-    } else if (c == '=') {
-      found_assignment = true;
-    } else {
-      key += c;
+  AuditFieldTokenizer tokenizer(message_view.substr(preamble_end + 3));
+
+  // Only the fields retained by the event context are copied.
+  boost::string_ref key, value, syscall_value;
+  bool found_syscall{false};
+  while (tokenizer.next(key, value)) {
+    if (!found_syscall && key == "syscall") {
+      // There is a special field for syscalls.
+      syscall_value = value;
+      found_syscall = true;
     }
+    ec->fields.emplace(std::piecewise_construct,
+                       std::forward_as_tuple(key.data(), key.size()),
+                       std::forward_as_tuple(value.data(), value.size()));
   }
 
-  // Last step, if there was no trailing tokenizer.
-  if (!key.empty()) {
-    ec->fields.emplace(std::make_pair(std::move(key), std::move(value)));
-  }
-
-  // There is a special field for syscalls.
-  if (ec->fields.count("syscall") == 1) {
-    const auto& syscall_string = ec->fields.at("syscall").c_str();
+  if (found_syscall) {
     long long syscall{0};
-    if (!safeStrtoll(syscall_string, 10, syscall)) {
+    if (!safeStrtoll(std::string(syscall_value), 10, syscall)) {
       syscall = 0;
     }
     ec->syscall = syscall;
@@ -394,50 +576,126 @@ static inline bool adjust_reply(struct audit_reply* rep, int len) {
   return true;
 }
 
-static inline bool safe_audit_get_reply(int fd, struct audit_reply* rep) {
+int AuditEventPublisher::receiveReplies(int fd) {
   if (fd < 0) {
     return -EBADF;
   }
 
-  struct timeval timeout = {0, kAuditMTimeout};
-
-  fd_set readSet;
-  FD_ZERO(&readSet);
-  FD_SET(fd, &readSet);
+  int count = 0;
+  if (replies_.size() == 1) {
+    auto& addr = addresses_[0];
+    socklen_t addrlen = sizeof(addr);
+    int len = recvfrom(fd,
+                       &replies_[0].msg,
+                       sizeof(replies_[0].msg),
+                       MSG_DONTWAIT,
+                       (struct sockaddr*)&addr,
+                       &addrlen);
+    if (len < 0) {
+      return -errno;
+    }
+    headers_[0].msg_hdr.msg_namelen = addrlen;
+    headers_[0].msg_len = len;
+    count = 1;
+  } else {
+    // The kernel replaces each name length, these must be reset per receive.
+    for (auto& header : headers_) {
+      header.msg_hdr.msg_namelen = sizeof(struct sockaddr_nl);
+    }
+    count = recvmmsg(fd,
+                     headers_.data(),
+                     static_cast<unsigned int>(headers_.size()),
+                     MSG_DONTWAIT,
+                     nullptr);
+    if (count < 0) {
+      return -errno;
+    }
+  }
 
-  if (select(fd + 1, &readSet, nullptr, nullptr, &timeout) < 0) {
-    return -1;
+  for (int i = 0; i < count; i++) {
+    // Only messages from the kernel are accepted.
+    if (headers_[i].msg_hdr.msg_namelen != sizeof(struct sockaddr_nl) ||
+        addresses_[i].nl_pid != 0 ||
+        !adjust_reply(&replies_[i], static_cast<int>(headers_[i].msg_len))) {
+      replies_[i].type = NLMSG_NOOP;
+    }
   }
 
-  if (!FD_ISSET(fd, &readSet)) {
-    return -1;
+  received_ += count;
+  receive_calls_++;
+  return count;
+}
+
+struct audit_status AuditEventPublisher::getStatus() const {
+  ReadLock lock(status_lock_);
+  return status_;
+}
+
+void AuditEventPublisher::updateAssemblers() {
+  auto snapshot = getSnapshot();
+  if (snapshot == assembler_snapshot_) {
+    return;
   }
 
-  struct sockaddr_nl nladdr;
-  socklen_t nladdrlen = sizeof(nladdr);
+  // Subscriptions changed, in-progress events are dropped.
+  assembler_snapshot_ = snapshot;
+  assemblers_.clear();
+  assembler_syscalls_.clear();
+  for (const auto& target : snapshot->targets) {
+    auto sc = getSubscriptionContext(target.first->context);
+    const auto& assembly = sc->assembly;
+    if (assembly.types.empty()) {
+      continue;
+    }
 
-  int len = recvfrom(fd,
-                     &rep->msg,
-                     sizeof(rep->msg),
-                     0,
-                     (struct sockaddr*)&nladdr,
-                     &nladdrlen);
-  if (len < 0) {
-    return -errno;
+    auto index = assemblers_.size();
+    assemblers_.push_back(std::make_unique<AuditAssembler>());
+    assemblers_.back()->start(
+        assembly.capacity, assembly.types, assembly.update);
+    for (const auto& rule : sc->rules) {
+      if (rule.syscall > 0 && assembler_syscalls_.count(rule.syscall) == 0) {
+        assembler_syscalls_[rule.syscall] = index;
+      }
+    }
   }
+}
 
-  if (nladdrlen != sizeof(nladdr)) {
-    return -EPROTO;
+void AuditEventPublisher::assembleRecord(const AuditEventContextRef& ec) {
+  updateAssemblers();
+  if (assemblers_.empty()) {
+    return;
   }
 
-  if (nladdr.nl_pid) {
-    return -EINVAL;
+  // A SYSCALL record starts an event, the following records continue it.
+  auto index = assemblers_.size();
+  if (ec->type == AUDIT_SYSCALL) {
+    auto it = assembler_syscalls_.find(ec->syscall);
+    if (it != assembler_syscalls_.end()) {
+      index = it->second;
+    }
+  } else {
+    for (size_t i = 0; i < assemblers_.size(); i++) {
+      if (assemblers_[i]->contains(ec->auid)) {
+        index = i;
+        break;
+      }
+    }
   }
 
-  if (!adjust_reply(rep, len)) {
-    return -errno;
+  if (index == assemblers_.size() || !assemblers_[index]->expects(ec->type)) {
+    return;
+  }
+
+  auto fields = assemblers_[index]->add(ec->auid, ec->type, ec->fields);
+  if (fields.is_initialized()) {
+    auto aec = createEventContext();
+    aec->type = AUDIT_SYSCALL;
+    aec->auid = ec->auid;
+    aec->time = ec->time;
+    aec->assembly = index;
+    aec->assembled = std::make_shared<const AuditFields>(std::move(*fields));
+    fire(aec);
   }
-  return len;
 }
 
 Status AuditEventPublisher::run() {
@@ -447,10 +705,10 @@ Status AuditEventPublisher::run() {
     audit_request_status(handle_);
   }
 
-  auto inspectReply = ([this]() {
+  auto inspectReply = ([this](struct audit_reply& reply) {
     bool handle_reply = false;
 
-    switch (reply_.type) {
+    switch (reply.type) {
     case NLMSG_NOOP:
     case NLMSG_DONE:
     case NLMSG_ERROR:
@@ -464,8 +722,14 @@ Status AuditEventPublisher::run() {
       break;
     case AUDIT_GET:
       // Make a copy of the status reply and store as the most-recent.
-      if (reply_.status != nullptr) {
-        memcpy(&status_, reply_.status, sizeof(struct audit_status));
+      if (reply.status != nullptr) {
+        WriteLock lock(status_lock_);
+        if (reply.status->lost > status_.lost) {
+          VLOG(1) << "Audit kernel lost "
+                  << (reply.status->lost - status_.lost)
+                  << " records, backlog: " << reply.status->backlog;
+        }
+        memcpy(&status_, reply.status, sizeof(struct audit_status));
       }
       break;
     case AUDIT_FIRST_USER_MSG... AUDIT_LAST_USER_MSG:
@@ -477,7 +741,7 @@ Status AuditEventPublisher::run() {
       break;
     case AUDIT_DAEMON_START... AUDIT_DAEMON_CONFIG: // 1200 - 1203
     case AUDIT_CONFIG_CHANGE:
-      handleAuditConfigChange(reply_);
+      handleAuditConfigChange(reply);
       break;
     case AUDIT_SYSCALL: // 1300
       // A monitored syscall was issued, most likely part of a multi-record.
@@ -496,26 +760,35 @@ Status AuditEventPublisher::run() {
 
     // Replies are 'handled' as potential events for several audit types.
     if (handle_reply) {
-      auto ec = createEventContext();
-      // Build the event context from the reply type and parse the message.
-      if (handleAuditReply(reply_, ec)) {
-        fire(ec);
-      }
+      handleReply(reply);
     }
   });
 
   // Reset the reply data.
   bool result = false;
+  int timeout = kAuditMTimeout;
+  std::vector<int> ready;
   do {
-    // Request a reply in a non-blocking mode.
+    // Wait a bounded time for the first reply.
     // This allows the publisher's run loop to periodically request an audit
     // status update. These updates can check for other processes attempting to
     // gain control over the audit sink.
-    // This non-blocking also allows faster receipt of multi-message events.
-    result = safe_audit_get_reply(handle_, &reply_);
-
-    if (result) {
-      inspectReply();
+    // Following replies are read without waiting, for faster receipt of
+    // multi-message events.
+    result = false;
+    if (!reactor_.wait(ready, timeout).ok()) {
+      break;
+    }
+    timeout = 0;
+
+    // Status replies arrive on the audit handle, records may arrive on the
+    // multicast handle.
+    for (const auto& fd : ready) {
+      auto count = receiveReplies(fd);
+      for (int i = 0; i < count; i++) {
+        inspectReply(replies_[i]);
+      }
+      result = result || (count > 0);
     }
   } while (result && !isEnding());
 
@@ -527,7 +800,8 @@ Status AuditEventPublisher::run() {
       control_ = false;
     }
 
-    if (FLAGS_audit_persist && !FLAGS_disable_audit && !immutable_) {
+    if (FLAGS_audit_persist && !FLAGS_disable_audit && !immutable_ &&
+        multicast_handle_ < 0) {
       VLOG(1) << "Persisting audit control";
       audit_set_pid(handle_, getpid(), WAIT_NO);
       control_ = true;
@@ -538,8 +812,119 @@ Status AuditEventPublisher::run() {
   return Status(0, "OK");
 }
 
+void AuditEventPublisher::handleReply(const struct audit_reply& reply) {
+  if (EventCapture::enabled()) {
+    auto data = std::to_string(reply.type) + ' ';
+    data.append(reply.message, reply.len);
+    EventCapture::record(type(), data.data(), data.size());
+  }
+
+  auto ec = createEventContext();
+  // Build the event context from the reply type and parse the message.
+  if (handleAuditReply(reply, ec)) {
+    assembleRecord(ec);
+    fire(ec);
+  }
+}
+
+Status AuditEventPublisher::replay(const std::string& data) {
+  auto separator = data.find(' ');
+  long type = 0;
+  if (separator == std::string::npos ||
+      !safeStrtol(data.substr(0, separator), 10, type)) {
+    return Status(1, "Invalid audit record");
+  }
+
+  // Only the type and message of a reply are parsed.
+  struct audit_reply reply;
+  memset(&reply, 0, sizeof(struct audit_reply));
+  reply.type = static_cast<int>(type);
+  reply.message = data.data() + separator + 1;
+  reply.len = static_cast<int>(data.size() - separator - 1);
+  handleReply(reply);
+  return Status(0, "OK");
+}
+
+AuditSubscriptionMatcher::AuditSubscriptionMatcher(
+    const SubscriptionVector& subscriptions) {
+  for (size_t i = 0; i < subscriptions.size(); i++) {
+    auto sc =
+        AuditEventPublisher::getSubscriptionContext(subscriptions[i]->context);
+    if (!sc->assembly.types.empty()) {
+      // Assembling subscriptions only receive their assembled events.
+      assemblies_.push_back(i);
+      continue;
+    }
+
+    if (sc->user_types) {
+      user_types_.push_back(i);
+    }
+
+    for (const auto& type : sc->types) {
+      if (type != 0) {
+        types_[type].push_back(i);
+      }
+    }
+
+    for (const auto& rule : sc->rules) {
+      if (rule.syscall <= 0) {
+        continue;
+      }
+      auto syscall = static_cast<size_t>(rule.syscall);
+      if (syscall >= syscalls_.size()) {
+        syscalls_.resize(syscall + 1);
+      }
+      auto& indexes = syscalls_[syscall];
+      if (indexes.empty() || indexes.back() != i) {
+        indexes.push_back(i);
+      }
+    }
+  }
+}
+
+void AuditSubscriptionMatcher::match(const EventContextRef& ec,
+                                     std::vector<size_t>& targets) const {
+  auto aec = AuditEventPublisher::getEventContext(ec);
+  targets.clear();
+  if (aec->assembled != nullptr) {
+    if (aec->assembly < assemblies_.size()) {
+      targets.push_back(assemblies_[aec->assembly]);
+    }
+    return;
+  }
+
+  if (aec->type >= AUDIT_FIRST_USER_MSG && aec->type <= AUDIT_LAST_USER_MSG) {
+    targets.insert(targets.end(), user_types_.begin(), user_types_.end());
+  }
+
+  auto type = types_.find(aec->type);
+  if (type != types_.end()) {
+    targets.insert(targets.end(), type->second.begin(), type->second.end());
+  }
+
+  if (aec->syscall > 0 &&
+      static_cast<size_t>(aec->syscall) < syscalls_.size()) {
+    const auto& indexes = syscalls_[aec->syscall];
+    targets.insert(targets.end(), indexes.begin(), indexes.end());
+  }
+
+  // A subscription may match by more than one of its selectors.
+  std::sort(targets.begin(), targets.end());
+  targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+}
+
+SubscriptionMatcherRef AuditEventPublisher::compileSubscriptions(
+    const SubscriptionVector& subscriptions) const {
+  return std::make_shared<AuditSubscriptionMatcher>(subscriptions);
+}
+
 bool AuditEventPublisher::shouldFire(const AuditSubscriptionContextRef& sc,
                                      const AuditEventContextRef& ec) const {
+  // The matcher selected the assembling subscription for an assembled event.
+  if (!sc->assembly.types.empty() || ec->assembled != nullptr) {
+    return !sc->assembly.types.empty() && ec->assembled != nullptr;
+  }
+
   // User messages allow a catch all configuration.
   if (sc->user_types &&
       (ec->type >= AUDIT_FIRST_USER_MSG && ec->type <= AUDIT_LAST_USER_MSG)) {
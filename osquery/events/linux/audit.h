@@ -11,15 +11,22 @@
 #pragma once
 
 #include <libaudit.h>
+#include <sys/socket.h>
 
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 
 #include <boost/algorithm/hex.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/events.h>
 
+#include "osquery/events/linux/reactor.h"
+
 namespace osquery {
 
 #define AUDIT_TYPE_SYSCALL 1300
@@ -68,13 +75,35 @@ using Auid = size_t;
 /// Alias the field container so we can replace and improve with refactors.
 using AuditFields = std::map<std::string, std::string>;
 
+/**
+ * @brief Tokenize the key=value fields of an audit message in place.
+ *
+ * Each key and value is a view into the message buffer, nothing is copied.
+ * Values enclosed in quotes keep their quotes and may contain spaces. Tokens
+ * without an assignment are returned with an empty value.
+ */
+class AuditFieldTokenizer {
+ public:
+  explicit AuditFieldTokenizer(boost::string_ref fields) : fields_(fields) {}
+
+  /// Move to the next field, returns false when the message is exhausted.
+  bool next(boost::string_ref& key, boost::string_ref& value);
+
+ private:
+  /// The message content following the audit preamble.
+  boost::string_ref fields_;
+
+  /// The current offset into the message.
+  size_t pos_{0};
+};
+
 /**
  * @brief The message callback method used within AuditAssembler.
  *
- * When a subscriber requires multiple audit messages it will call %start on
- * an AuditAssembler. That subscriber must provide a callable AuditUpdate to
- * move message content from the single message line into the assembler's
- * row data.
+ * When a subscriber requires multiple audit messages it describes an
+ * AuditAssembly and the publisher starts an AuditAssembler. That subscriber
+ * must provide a callable AuditUpdate to move message content from the single
+ * message line into the assembler's row data.
  *
  * @param type The audit message type.
  * @param fields The current message's fields.
@@ -109,10 +138,8 @@ class AuditAssembler : private boost::noncopyable {
                                    size_t type,
                                    const AuditFields& fields);
 
-  /// Allow the publisher to explicit-set fields.
-  void set(Auid id, const std::string& key, const std::string& value) {
-    m_[id][key] = value;
-  }
+  /// Allow the publisher to explicit-set fields for an in-progress audit ID.
+  void set(Auid id, const std::string& key, const std::string& value);
 
   /// Remove an audit ID from the queue and clear associated messages/types.
   void evict(Auid id);
@@ -123,12 +150,58 @@ class AuditAssembler : private boost::noncopyable {
   /// Check if the audit ID has completed each required message types.
   bool complete(Auid id);
 
+  /// Check if the audit ID is being assembled.
+  bool contains(Auid id) {
+    return find(id) != nullptr;
+  }
+
+  /// Check if the message type is one of the required types.
+  bool expects(size_t type) const {
+    return std::find(types_.begin(), types_.end(), type) != types_.end();
+  }
+
+  /// The number of audit IDs currently being assembled.
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  /// A preallocated assembly slot for a single audit ID.
+  struct AuditSlot {
+    /// The audit ID assembled in this slot.
+    Auid id{0};
+
+    /// The slot is in use.
+    bool used{false};
+
+    /// The queue order, the slot with the lowest value is evicted first.
+    size_t order{0};
+
+    /// The set of message types seen.
+    std::vector<size_t> types;
+
+    /// The aggregate message fields.
+    AuditFields fields;
+  };
+
+  /// Find the in-use slot for an audit ID.
+  AuditSlot* find(Auid id);
+
+  /// Claim a free slot for a new audit ID, evicting the oldest if needed.
+  AuditSlot& claim(Auid id);
+
+  /// Release a slot while retaining its type storage.
+  void release(AuditSlot& slot);
+
  private:
-  /// A map of audit ID to aggregate message fields.
-  std::unordered_map<Auid, AuditFields> m_;
+  /// The ring of assembly slots, sized to the queue capacity.
+  std::vector<AuditSlot> slots_;
 
-  /// A map of audit ID to current set of types seen.
-  std::unordered_map<Auid, std::vector<size_t>> mt_;
+  /// The number of in-use slots.
+  size_t size_{0};
+
+  /// A monotonic counter used to order slots.
+  size_t order_{0};
 
   /// A functional callable to sanitize individual messages.
   AuditUpdate update_{nullptr};
@@ -136,9 +209,6 @@ class AuditAssembler : private boost::noncopyable {
   /// The queue size.
   size_t capacity_{0};
 
-  /// The in-order (by time) queue of audit IDs.
-  std::vector<Auid> queue_;
-
   /// The set of required types.
   std::vector<size_t> types_;
 
@@ -158,6 +228,24 @@ inline std::string decodeAuditValue(const std::string& s) {
   }
 }
 
+/**
+ * @brief A multi-record event the publisher assembles for a subscription.
+ *
+ * Each SYSCALL record for one of the subscription's rule syscalls starts an
+ * event, the following records with the same audit ID are added until one of
+ * each type has been seen.
+ */
+struct AuditAssembly {
+  /// The number of concurrent audit IDs assembled.
+  size_t capacity{0};
+
+  /// The set of required types, an empty set disables assembly.
+  std::vector<size_t> types;
+
+  /// Move the needed fields of each record into the event.
+  AuditUpdate update{nullptr};
+};
+
 struct AuditSubscriptionContext : public SubscriptionContext {
   /**
    * @brief A subscription may supply a set of rules.
@@ -181,6 +269,16 @@ struct AuditSubscriptionContext : public SubscriptionContext {
   /// Macro for all types related to user messages.
   bool user_types{false};
 
+  /**
+   * @brief Receive assembled events instead of individual records.
+   *
+   * The publisher keeps one AuditAssembler for each assembling subscription
+   * and routes records to it by the SYSCALL record's syscall, so each record
+   * is stitched once no matter how many subscribers use audit. A rule syscall
+   * is assembled for the first subscription requesting it.
+   */
+  AuditAssembly assembly;
+
  private:
   friend class AuditEventPublisher;
 };
@@ -206,11 +304,49 @@ struct AuditEventContext : public EventContext {
 
   /// Each message will contain the event time.
   size_t time{0};
+
+  /**
+   * @brief The fields of an assembled multi-record event.
+   *
+   * This is only set for events fired to an assembling subscription, the
+   * fields are shared by pointer and must not be changed by subscribers.
+   */
+  std::shared_ptr<const AuditFields> assembled{nullptr};
+
+  /// The index of the assembling subscription an assembled event is for.
+  size_t assembly{0};
 };
 
 using AuditEventContextRef = std::shared_ptr<AuditEventContext>;
 using AuditSubscriptionContextRef = std::shared_ptr<AuditSubscriptionContext>;
 
+/**
+ * @brief Audit Subscription%s compiled into tables of types and syscalls.
+ *
+ * Each reply type and syscall number lists the subscriptions requesting it,
+ * so an event finds its subscriptions with two lookups.
+ */
+class AuditSubscriptionMatcher : public SubscriptionMatcher {
+ public:
+  explicit AuditSubscriptionMatcher(const SubscriptionVector& subscriptions);
+
+  void match(const EventContextRef& ec,
+             std::vector<size_t>& targets) const override;
+
+ private:
+  /// Subscriptions requesting every user message type.
+  std::vector<size_t> user_types_;
+
+  /// Subscriptions by the reply types they requested.
+  std::map<int, std::vector<size_t>> types_;
+
+  /// Subscriptions by the syscall numbers of their rules.
+  std::vector<std::vector<size_t>> syscalls_;
+
+  /// Assembling subscriptions, in the order of the publisher's assemblers.
+  std::vector<size_t> assemblies_;
+};
+
 class AuditEventPublisher
     : public EventPublisher<AuditSubscriptionContext, AuditEventContext> {
   DECLARE_PUBLISHER("audit");
@@ -242,9 +378,17 @@ class AuditEventPublisher
   /// Remove audit rules and close the handle.
   void tearDown() override;
 
-  /// Poll for replies to the netlink handle in a non-blocking mode.
+  /// Wait for replies to the netlink handle, then read them without waiting.
   Status run() override;
 
+  /// Handle a captured reply type and message.
+  Status replay(const std::string& data) override;
+
+  /// Wake the run loop so the EventFactory can end it.
+  void stop() override {
+    reactor_.interrupt();
+  }
+
  public:
   AuditEventPublisher() : EventPublisher() {}
 
@@ -252,10 +396,51 @@ class AuditEventPublisher
     tearDown();
   }
 
+  /// Copy the most recent kernel audit status, including lost and backlog.
+  struct audit_status getStatus() const;
+
+  /// The number of netlink messages received.
+  size_t numReceived() const {
+    return received_;
+  }
+
+  /// The number of receive system calls that returned messages.
+  size_t numReceiveCalls() const {
+    return receive_calls_;
+  }
+
+  /// True if records are read from the audit multicast group.
+  bool isMulticast() const {
+    return multicast_handle_ >= 0;
+  }
+
  private:
+  /**
+   * @brief Read up to a batch of netlink messages from a ready descriptor.
+   *
+   * Each message is read into the preallocated replies. Messages that are
+   * malformed or were not sent by the kernel are marked as NLMSG_NOOP.
+   *
+   * @return The number of replies read or a negative errno.
+   */
+  int receiveReplies(int fd);
+
   /// Maintain a list of audit rule data for displaying or deleting.
   void handleListRules();
 
+  /// Parse, assemble, and fire a reply that may be an event.
+  void handleReply(const struct audit_reply& reply);
+
+  /// Start an assembler for each assembling subscription when they change.
+  void updateAssemblers();
+
+  /// Add a record to its assembler, then fire the event once it is complete.
+  void assembleRecord(const AuditEventContextRef& ec);
+
+  /// Compile the subscription types and syscalls.
+  SubscriptionMatcherRef compileSubscriptions(
+      const SubscriptionVector& subscriptions) const override;
+
   /// Apply normal subscription to event matching logic.
   bool shouldFire(const AuditSubscriptionContextRef& mc,
                   const AuditEventContextRef& ec) const override;
@@ -264,6 +449,12 @@ class AuditEventPublisher
   /// Audit subsystem (netlink) socket descriptor.
   int handle_{0};
 
+  /// Read-only audit multicast socket descriptor, if requested.
+  int multicast_handle_{-1};
+
+  /// Wait for the netlink sockets without polling.
+  EventReactor reactor_;
+
   /// Audit subsystem is in an immutable state.
   bool immutable_{false};
 
@@ -273,25 +464,46 @@ class AuditEventPublisher
    * This contains the: pid, enabled, rate_limit, backlog_limit, lost, and
    * failure booleans and counts.
    */
-  struct audit_status status_;
+  struct audit_status status_{};
+
+  /// Protect the status, which is read by tables.
+  mutable Mutex status_lock_;
 
   /**
-   * @brief A counter of non-blocking netlink reads that contained no data.
+   * @brief A counter of run loop iterations.
    *
-   * After several iterations of no data, the audit run loop will request a
-   * status. It is possible another user land daemon requested control of the
-   * audit subsystem. The kernel thread will only emit to a single handle.
+   * After several iterations, the audit run loop will request a status. It
+   * is possible another user land daemon requested control of the audit
+   * subsystem. The kernel thread will only emit to a single handle.
    */
   size_t count_{0};
 
   /// Is this process in control of the audit subsystem.
   bool control_{false};
 
-  /// The last (most recent) audit reply.
-  struct audit_reply reply_;
+  /// The replies filled in by the last (most recent) receive.
+  std::vector<struct audit_reply> replies_;
+
+  /// Message headers, vectors, and sender addresses for each reply.
+  std::vector<struct mmsghdr> headers_;
+  std::vector<struct iovec> vectors_;
+  std::vector<struct sockaddr_nl> addresses_;
+
+  /// Counters for received messages and receive calls.
+  std::atomic<size_t> received_{0};
+  std::atomic<size_t> receive_calls_{0};
 
   /// Track all rule data added by the publisher.
   std::vector<struct AuditRuleInternal> transient_rules_;
+
+  /// An assembler for each assembling subscription, used by the run loop.
+  std::vector<std::unique_ptr<AuditAssembler>> assemblers_;
+
+  /// The assembler index for each rule syscall that is assembled.
+  std::map<int, size_t> assembler_syscalls_;
+
+  /// The subscription snapshot the assemblers were started for.
+  std::shared_ptr<const SubscriptionSnapshot> assembler_snapshot_{nullptr};
 };
 
 /**
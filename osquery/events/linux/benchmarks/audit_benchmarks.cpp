@@ -9,6 +9,7 @@
  */
 
 #include <map>
+#include <new>
 
 #include <benchmark/benchmark.h>
 
@@ -16,10 +17,30 @@
 
 #include "osquery/events/linux/audit.h"
 
+/// Heap allocations of this thread while an AllocationScope is active.
+static thread_local size_t kAllocations{0};
+static thread_local bool kCountAllocations{false};
+
+void* operator new(size_t size) {
+  if (kCountAllocations) {
+    kAllocations++;
+  }
+  if (auto p = malloc(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
 namespace osquery {
 
 /// This is a poor interface.
 extern bool ProcessUpdate(size_t, const AuditFields&, AuditFields&);
+extern bool SocketUpdate(size_t, const AuditFields&, AuditFields&);
+extern void parseSockAddr(const std::string&, AuditFields&);
 
 const std::vector<std::string> kBenchmarkMessages = {
     "audit(1480751147.912:48372): arch=c000003e syscall=59 success=yes exit=0 "
@@ -41,6 +62,30 @@ const std::vector<std::string> kBenchmarkMessages = {
     "73",
 };
 
+/// Captured connect syscalls, each followed by its SOCKADDR record.
+const std::vector<std::string> kBenchmarkSocketMessages = {
+    "audit(1480751148.102:48380): arch=c000003e syscall=42 success=yes exit=0 "
+    "a0=3 a1=7ffc3c4b21d0 a2=10 a3=0 items=0 ppid=8422 pid=8424 "
+    "auid=4294967295 uid=1000 gid=1000 euid=1000 suid=1000 fsuid=1000 "
+    "egid=1000 sgid=1000 fsgid=1000 tty=pts20 ses=4294967295 comm=\"curl\" "
+    "exe=\"/usr/bin/curl\" key=(null)",
+    "audit(1480751148.102:48380): saddr=020001BB5DB8D8220000000000000000",
+    "audit(1480751148.187:48381): arch=c000003e syscall=42 success=no "
+    "exit=-101 a0=4 a1=7ffc3c4b2210 a2=1c a3=0 items=0 ppid=8422 pid=8424 "
+    "auid=4294967295 uid=1000 gid=1000 euid=1000 suid=1000 fsuid=1000 "
+    "egid=1000 sgid=1000 fsgid=1000 tty=pts20 ses=4294967295 comm=\"curl\" "
+    "exe=\"/usr/bin/curl\" key=(null)",
+    "audit(1480751148.187:48381): "
+    "saddr=0A0001BB000000002606470000000000000000000000000100000000",
+    "audit(1480751148.203:48382): arch=c000003e syscall=42 success=yes exit=0 "
+    "a0=5 a1=7ffc3c4b2250 a2=6e a3=0 items=1 ppid=1 pid=912 auid=4294967295 "
+    "uid=0 gid=0 euid=0 suid=0 fsuid=0 egid=0 sgid=0 fsgid=0 tty=(none) "
+    "ses=4294967295 comm=\"systemd\" exe=\"/usr/lib/systemd/systemd\" "
+    "key=(null)",
+    "audit(1480751148.203:48382): "
+    "saddr=01002F72756E2F73797374656D642F6E6F7469667900",
+};
+
 struct audit_reply getMockReply(const std::string& message) {
   struct audit_reply reply;
 
@@ -53,15 +98,61 @@ struct audit_reply getMockReply(const std::string& message) {
   return reply;
 }
 
+/// Count allocations only within a benchmark's measured loop.
+class AllocationScope {
+ public:
+  AllocationScope() : start_(kAllocations) {
+    kCountAllocations = true;
+  }
+
+  ~AllocationScope() {
+    kCountAllocations = false;
+  }
+
+  /// The allocations since the scope started.
+  size_t count() const {
+    return kAllocations - start_;
+  }
+
+ private:
+  size_t start_{0};
+};
+
+/// Label a benchmark with the average allocations per record.
+static void setAllocationLabel(benchmark::State& state, size_t allocations) {
+  auto records = (state.iterations() > 0) ? state.iterations() : 1;
+  state.SetLabel("allocations/record=" +
+                 std::to_string(allocations / static_cast<double>(records)));
+}
+
+static void AUDIT_parseFields(benchmark::State& state) {
+  boost::string_ref message(kBenchmarkMessages[0]);
+  message = message.substr(message.find("): ") + 3);
+
+  AllocationScope allocations;
+  while (state.KeepRunning()) {
+    AuditFieldTokenizer tokenizer(message);
+    boost::string_ref key, value;
+    while (tokenizer.next(key, value)) {
+      benchmark::DoNotOptimize(key.data());
+    }
+  }
+  setAllocationLabel(state, allocations.count());
+}
+
+BENCHMARK(AUDIT_parseFields);
+
 static void AUDIT_handleReply(benchmark::State& state) {
   auto reply = getMockReply(kBenchmarkMessages[0]);
 
+  AllocationScope allocations;
   while (state.KeepRunning()) {
     auto ec = std::make_shared<AuditEventContext>();
 
     // Perform the parsing.
     handleAuditReply(reply, ec);
   }
+  setAllocationLabel(state, allocations.count());
 
   free((void*)reply.message);
 }
@@ -70,8 +161,10 @@ BENCHMARK(AUDIT_handleReply);
 
 static void AUDIT_assembler(benchmark::State& state) {
   AuditAssembler asmb;
-  asmb.start(
-      20, {AUDIT_SYSCALL, AUDIT_EXECVE, AUDIT_PATH, AUDIT_CWD}, &ProcessUpdate);
+  // Without an update callable the cost is only the assembly slot tracking.
+  asmb.start(20,
+             {AUDIT_SYSCALL, AUDIT_EXECVE, AUDIT_PATH, AUDIT_CWD},
+             (state.range_x() == 1) ? &ProcessUpdate : nullptr);
 
   std::vector<struct audit_reply> replies = {
       getMockReply(kBenchmarkMessages[0]),
@@ -90,15 +183,62 @@ static void AUDIT_assembler(benchmark::State& state) {
   }
 
   size_t i = 0;
+  AllocationScope allocations;
   while (state.KeepRunning()) {
     const auto& ec = contexts[i++ % 6];
     asmb.add(ec->auid, ec->type, ec->fields);
   }
+  setAllocationLabel(state, allocations.count());
+
+  for (auto& r : replies) {
+    free((void*)r.message);
+  }
+}
+
+BENCHMARK(AUDIT_assembler)->Arg(0)->Arg(1);
+
+static void SOCKET_parseSockAddr(benchmark::State& state) {
+  // Each record type of kBenchmarkSocketMessages: IPv4, IPv6, and Unix.
+  auto message = kBenchmarkSocketMessages[state.range_x() * 2 + 1];
+  auto saddr = message.substr(message.find("saddr=") + 6);
+
+  AllocationScope allocations;
+  while (state.KeepRunning()) {
+    AuditFields r;
+    parseSockAddr(saddr, r);
+    benchmark::DoNotOptimize(r);
+  }
+  setAllocationLabel(state, allocations.count());
+}
+
+BENCHMARK(SOCKET_parseSockAddr)->Arg(0)->Arg(1)->Arg(2);
+
+static void SOCKET_replay(benchmark::State& state) {
+  AuditAssembler asmb;
+  asmb.start(10, {AUDIT_TYPE_SYSCALL, AUDIT_TYPE_SOCKADDR}, &SocketUpdate);
+
+  // Replay the captured records through the publisher's parsing.
+  std::vector<struct audit_reply> replies;
+  for (size_t i = 0; i < kBenchmarkSocketMessages.size(); i++) {
+    replies.push_back(getMockReply(kBenchmarkSocketMessages[i]));
+    replies.back().type =
+        (i % 2 == 0) ? AUDIT_TYPE_SYSCALL : AUDIT_TYPE_SOCKADDR;
+  }
+
+  size_t i = 0;
+  AllocationScope allocations;
+  while (state.KeepRunning()) {
+    auto ec = std::make_shared<AuditEventContext>();
+    const auto& reply = replies[i++ % replies.size()];
+    handleAuditReply(reply, ec);
+    benchmark::DoNotOptimize(asmb.add(ec->auid, ec->type, ec->fields));
+  }
+  setAllocationLabel(state, allocations.count());
 
   for (auto& r : replies) {
     free((void*)r.message);
   }
 }
 
-BENCHMARK(AUDIT_assembler);
+BENCHMARK(SOCKET_replay);
 }
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/events.h>
+#include <osquery/filesystem.h>
+
+#include "osquery/events/linux/inotify.h"
+#include "osquery/tests/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+/// Create a tree of directories, 1000 per parent, to watch recursively.
+static std::string createINotifyBenchmarkTree(size_t directories) {
+  auto root = kTestWorkingDirectory + "inotify-benchmark-" +
+              std::to_string(directories);
+  if (isDirectory(root)) {
+    return root;
+  }
+
+  for (size_t i = 0; i < directories; i++) {
+    fs::create_directories(root + "/" + std::to_string(i / 1000) + "/" +
+                           std::to_string(i));
+  }
+  return root;
+}
+
+static SubscriptionRef getINotifyBenchmarkSubscription(
+    const std::string& path) {
+  auto sc = std::make_shared<INotifySubscriptionContext>();
+  sc->path = path;
+  sc->recursive = true;
+  return Subscription::create("benchmark", sc);
+}
+
+static void INOTIFY_configure(benchmark::State& state) {
+  auto root = createINotifyBenchmarkTree(state.range_x());
+  INotifyEventPublisher pub;
+  pub.setUp();
+
+  while (state.KeepRunning()) {
+    // Add then remove every watch of the tree.
+    pub.addSubscription(getINotifyBenchmarkSubscription(root));
+    pub.configure();
+    pub.removeSubscriptions("benchmark");
+    pub.configure();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+  pub.tearDown();
+}
+
+BENCHMARK(INOTIFY_configure)->Arg(1000)->Arg(100000);
+
+static void INOTIFY_reconfigure(benchmark::State& state) {
+  auto root = createINotifyBenchmarkTree(state.range_x());
+  INotifyEventPublisher pub;
+  pub.setUp();
+  pub.addSubscription(getINotifyBenchmarkSubscription(root));
+  pub.configure();
+
+  while (state.KeepRunning()) {
+    // A configuration update re-subscribes to the same tree.
+    pub.removeSubscriptions("benchmark");
+    pub.addSubscription(getINotifyBenchmarkSubscription(root));
+    pub.configure();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+  pub.tearDown();
+}
+
+BENCHMARK(INOTIFY_reconfigure)->Arg(1000)->Arg(100000);
+}
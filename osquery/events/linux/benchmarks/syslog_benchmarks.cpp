@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/flags.h>
+
+#include "osquery/events/linux/syslog.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+DECLARE_bool(enable_syslog);
+DECLARE_string(syslog_pipe_path);
+DECLARE_uint64(syslog_rate_limit);
+
+const std::string kBenchmarkSyslogLine =
+    R"|("2016-03-22T21:17:01.701882+00:00","vagrant-ubuntu-trusty-64","6",)|"
+    R"|("cron","CRON[16538]:"," (root) CMD (   cd / && run-parts )|"
+    R"|(--report /etc/cron.hourly)")|"
+    "\n";
+
+static void SYSLOG_populate_event_context(benchmark::State& state) {
+  auto line = kBenchmarkSyslogLine.data();
+  auto end = line + kBenchmarkSyslogLine.size() - 1;
+  while (state.KeepRunning()) {
+    auto ec = std::make_shared<SyslogEventContext>();
+    SyslogEventPublisher::populateEventContext(line, end, ec);
+  }
+}
+
+BENCHMARK(SYSLOG_populate_event_context);
+
+static void SYSLOG_run(benchmark::State& state) {
+  auto enable_syslog = FLAGS_enable_syslog;
+  auto pipe_path = FLAGS_syslog_pipe_path;
+  auto rate_limit = FLAGS_syslog_rate_limit;
+  FLAGS_enable_syslog = true;
+  FLAGS_syslog_pipe_path =
+      (fs::temp_directory_path() / fs::unique_path("osquery-syslog-%%%%%%"))
+          .string();
+  FLAGS_syslog_rate_limit = state.range_x();
+
+  // Each run reads a batch of lines at the rate limit.
+  std::string lines;
+  for (int i = 0; i < state.range_x(); i++) {
+    lines += kBenchmarkSyslogLine;
+  }
+
+  SyslogEventPublisher pub;
+  auto status = pub.setUp();
+  int fd = open(FLAGS_syslog_pipe_path.c_str(), O_WRONLY | O_NONBLOCK);
+  while (state.KeepRunning()) {
+    if (!status.ok() || fd == -1) {
+      state.SetLabel("Cannot open the syslog pipe");
+      continue;
+    }
+    state.PauseTiming();
+    write(fd, lines.data(), lines.size());
+    state.ResumeTiming();
+    pub.run();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+
+  if (fd != -1) {
+    close(fd);
+  }
+
+  pub.tearDown();
+  fs::remove(FLAGS_syslog_pipe_path);
+  FLAGS_enable_syslog = enable_syslog;
+  FLAGS_syslog_pipe_path = pipe_path;
+  FLAGS_syslog_rate_limit = rate_limit;
+}
+
+BENCHMARK(SYSLOG_run)->Arg(100)->Arg(300);
+}
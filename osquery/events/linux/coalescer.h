@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace osquery {
+
+/**
+ * @brief Merge bursts of events with the same key within a time window.
+ *
+ * Editors and package managers write a file many times in a short burst.
+ * A publisher adds each event context with a key (such as the path and
+ * action) and the coalescer holds the first event for a key until the window
+ * elapses. Later events with a pending key replace the held context, so the
+ * most recent event is fired once at the end of the window.
+ *
+ * The window starts with the first event for a key and is not extended by
+ * merged events, so a file that is written constantly is still reported.
+ */
+template <typename EC>
+class EventCoalescer {
+ public:
+  using ContextRef = std::shared_ptr<EC>;
+
+  /// Create a coalescer with a window in milliseconds.
+  explicit EventCoalescer(size_t window = 0) : window_(window) {}
+
+  /// Change the window, a zero window disables coalescing.
+  void setWindow(size_t window) {
+    window_ = window;
+  }
+
+  /// The window in milliseconds.
+  size_t window() const {
+    return window_;
+  }
+
+  /**
+   * @brief Hold an event context until its window elapses.
+   *
+   * @param key Events with equal keys are merged.
+   * @param ec The event context, this replaces a pending context.
+   * @param now The current time in milliseconds.
+   * @return true if the event was merged into a pending event.
+   */
+  bool add(const std::string& key, const ContextRef& ec, size_t now) {
+    auto it = pending_.find(key);
+    if (it != pending_.end()) {
+      it->second = ec;
+      return true;
+    }
+
+    pending_[key] = ec;
+    order_.push_back(std::make_pair(now + window_, key));
+    return false;
+  }
+
+  /**
+   * @brief Remove the events with an elapsed window.
+   *
+   * @param now The current time in milliseconds.
+   * @param ready Output of expired contexts in the order they were first seen.
+   * @param all Remove every pending event regardless of the window.
+   */
+  void expire(size_t now, std::vector<ContextRef>& ready, bool all = false) {
+    while (!order_.empty() && (all || order_.front().first <= now)) {
+      auto it = pending_.find(order_.front().second);
+      if (it != pending_.end()) {
+        ready.push_back(it->second);
+        pending_.erase(it);
+      }
+      order_.pop_front();
+    }
+  }
+
+  /// Milliseconds until the next window elapses, -1 if nothing is pending.
+  int timeout(size_t now) const {
+    if (order_.empty()) {
+      return -1;
+    }
+    auto expires = order_.front().first;
+    return static_cast<int>((expires > now) ? expires - now : 0);
+  }
+
+  /// The number of pending events.
+  size_t size() const {
+    return pending_.size();
+  }
+
+  /// A monotonic time in milliseconds for windows.
+  static size_t now() {
+    return static_cast<size_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+  }
+
+ private:
+  /// The coalescing window in milliseconds.
+  size_t window_{0};
+
+  /// The most recent context for each pending key.
+  std::map<std::string, ContextRef> pending_;
+
+  /// Pending keys and the time their window elapses, in first-seen order.
+  std::deque<std::pair<size_t, std::string>> order_;
+};
+}
@@ -0,0 +1,281 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <mntent.h>
+#include <sys/fanotify.h>
+#include <unistd.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/events/linux/fanotify.h"
+
+namespace osquery {
+
+/// fanotify marks whole mounts, and requires CAP_SYS_ADMIN.
+FLAG(bool,
+     disable_fanotify,
+     true,
+     "Disable fanotify mount marks for file events, inotify is used instead");
+
+DECLARE_uint64(file_events_coalesce_ms);
+
+REGISTER(FANotifyEventPublisher, "event_publisher", "fanotify");
+
+/// The fanotify events equivalent to inotify masks, the bits are shared.
+static const uint32_t kFANotifyMasks =
+    FAN_ACCESS | FAN_MODIFY | FAN_CLOSE_WRITE | FAN_OPEN;
+
+/// Size of the buffer for each read of event metadata.
+static const size_t kFANotifyBufferSize = 4096;
+
+std::string findMountPoint(const std::vector<std::string>& mounts,
+                           const std::string& path) {
+  // Only the directory stem of a pattern is considered.
+  auto wildcard = path.find('*');
+  auto stem = path.substr(0, wildcard);
+  if (wildcard != std::string::npos) {
+    stem = stem.substr(0, stem.rfind('/') + 1);
+  }
+
+  std::string mount_point;
+  for (const auto& mount : mounts) {
+    if (mount.size() <= mount_point.size() || stem.find(mount) != 0) {
+      continue;
+    }
+
+    // The mount must be a parent directory, not a prefix of a directory name.
+    if (mount.back() == '/' || stem.size() == mount.size() ||
+        stem[mount.size()] == '/') {
+      mount_point = mount;
+    }
+  }
+  return mount_point;
+}
+
+Status FANotifyEventPublisher::setUp() {
+  if (FLAGS_disable_fanotify) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  handle_ = ::fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK,
+                            O_RDONLY | O_LARGEFILE);
+  if (handle_ == -1) {
+    return Status(1, "Could not start fanotify: fanotify_init failed");
+  }
+
+  coalescer_.setWindow(FLAGS_file_events_coalesce_ms);
+  reactor_.reset();
+  return reactor_.addHandle(handle_);
+}
+
+void FANotifyEventPublisher::configure() {
+  if (handle_ == -1) {
+    // This publisher has not been setup correctly.
+    return;
+  }
+
+  std::vector<std::string> mounts;
+  FILE* mount_file = setmntent("/proc/mounts", "r");
+  if (mount_file != nullptr) {
+    struct mntent* entry = nullptr;
+    while ((entry = getmntent(mount_file)) != nullptr) {
+      mounts.push_back(entry->mnt_dir);
+    }
+    endmntent(mount_file);
+  }
+
+  // Each mount is marked once with the union of the subscription masks.
+  std::map<std::string, uint32_t> marks;
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    auto mount = findMountPoint(mounts, sc->path);
+    if (mount.empty()) {
+      LOG(WARNING) << "Cannot find the mount for fanotify path: " << sc->path;
+      continue;
+    }
+
+    auto mask = (sc->mask == 0) ? kFileDefaultMasks : sc->mask;
+    marks[mount] |= (mask & kFANotifyMasks);
+  }
+
+  WriteLock lock(marks_mutex_);
+  for (const auto& mark : marks) {
+    if (marks_.count(mark.first) > 0 && marks_.at(mark.first) == mark.second) {
+      continue;
+    }
+
+    // Marks are added to, masks removed from subscriptions stay until flush.
+    auto status = ::fanotify_mark(handle_,
+                                  FAN_MARK_ADD | FAN_MARK_MOUNT,
+                                  mark.second,
+                                  AT_FDCWD,
+                                  mark.first.c_str());
+    if (status == -1) {
+      LOG(WARNING) << "Could not add fanotify mark on: " << mark.first;
+      continue;
+    }
+    marks_[mark.first] = mark.second;
+  }
+}
+
+void FANotifyEventPublisher::removeSubscriptions(
+    const std::string& subscriber) {
+  {
+    WriteLock lock(marks_mutex_);
+    if (handle_ != -1) {
+      ::fanotify_mark(
+          handle_, FAN_MARK_FLUSH | FAN_MARK_MOUNT, 0, AT_FDCWD, nullptr);
+    }
+    marks_.clear();
+  }
+  EventPublisherPlugin::removeSubscriptions(subscriber);
+}
+
+void FANotifyEventPublisher::tearDown() {
+  WriteLock lock(marks_mutex_);
+  if (handle_ > -1) {
+    reactor_.removeHandle(handle_);
+    ::close(handle_);
+  }
+  handle_ = -1;
+  marks_.clear();
+}
+
+Status FANotifyEventPublisher::run() {
+  // Block until the handle is readable or a coalesced event is due.
+  std::vector<int> ready;
+  auto timeout = coalescer_.timeout(coalescer_.now());
+  auto status = reactor_.wait(ready, timeout);
+  if (!status.ok()) {
+    if (isEnding()) {
+      return Status(0, "Ending");
+    }
+    LOG(WARNING) << "Could not read fanotify handle";
+    return Status(1, "fanotify handle failed");
+  }
+
+  if (ready.empty()) {
+    firePending();
+    return Status(0, "Continue");
+  }
+
+  struct fanotify_event_metadata buffer[kFANotifyBufferSize /
+                                        sizeof(struct fanotify_event_metadata)];
+  auto length = ::read(handle_, buffer, sizeof(buffer));
+  if (length <= 0) {
+    return Status(0, "Continue");
+  }
+
+  auto self = getpid();
+  auto metadata = buffer;
+  for (; FAN_EVENT_OK(metadata, length);
+       metadata = FAN_EVENT_NEXT(metadata, length)) {
+    if (metadata->vers != FANOTIFY_METADATA_VERSION) {
+      return Status(1, "Unexpected fanotify metadata version");
+    }
+
+    if (metadata->mask & FAN_Q_OVERFLOW) {
+      LOG(WARNING) << "fanotify event queue overflowed";
+    }
+
+    if (metadata->fd < 0) {
+      continue;
+    }
+
+    // Hashing or reading files within osquery must not generate events.
+    if (metadata->pid != self) {
+      char path[PATH_MAX] = {0};
+      auto link = "/proc/self/fd/" + std::to_string(metadata->fd);
+      auto size = ::readlink(link.c_str(), path, sizeof(path) - 1);
+      if (size > 0) {
+        auto event = std::make_shared<struct inotify_event>();
+        event->wd = -1;
+        event->mask = static_cast<uint32_t>(metadata->mask & kFANotifyMasks);
+        event->cookie = 0;
+        event->len = 0;
+
+        auto ec = createEventContext();
+        ec->event = event;
+        ec->path = std::string(path, size);
+        for (const auto& action : kMaskActions) {
+          if (event->mask & action.first) {
+            ec->action = action.second;
+            break;
+          }
+        }
+
+        if (!ec->action.empty()) {
+          publish(ec);
+        }
+      }
+    }
+    ::close(metadata->fd);
+  }
+
+  firePending();
+  return Status(0, "OK");
+}
+
+void FANotifyEventPublisher::publish(const INotifyEventContextRef& ec) {
+  if (coalescer_.window() == 0) {
+    fire(ec);
+    return;
+  }
+
+  // Merge repeated accesses and writes to a path into a single event.
+  auto key = ec->action + ':' + ec->path;
+  if (coalescer_.add(key, ec, coalescer_.now())) {
+    coalesced_count_++;
+  }
+}
+
+void FANotifyEventPublisher::firePending() {
+  std::vector<INotifyEventContextRef> ready;
+  coalescer_.expire(coalescer_.now(), ready);
+  for (const auto& ec : ready) {
+    fire(ec);
+  }
+}
+
+bool FANotifyEventPublisher::shouldFire(
+    const INotifySubscriptionContextRef& sc,
+    const INotifyEventContextRef& ec) const {
+  // The subscription may supply a required event mask.
+  auto mask = (sc->mask == 0) ? kFileDefaultMasks : sc->mask;
+  if (!(ec->event->mask & mask)) {
+    return false;
+  }
+
+  const auto& path = sc->path;
+  auto recursive = path.find("**");
+  if (recursive != std::string::npos) {
+    // Recursive patterns match every path below the stem.
+    return ec->path.find(path.substr(0, recursive)) == 0;
+  }
+
+  if (path.find('*') != std::string::npos) {
+    return fnmatch(path.c_str(), ec->path.c_str(), FNM_PATHNAME) == 0;
+  }
+
+  if (ec->path == path) {
+    return true;
+  }
+
+  // A directory path matches the files directly within the directory.
+  auto directory = (path.back() == '/') ? path : path + '/';
+  return ec->path.find(directory) == 0 &&
+         ec->path.find('/', directory.size()) == std::string::npos;
+}
+}
@@ -0,0 +1,106 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/coalescer.h"
+#include "osquery/events/linux/inotify.h"
+#include "osquery/events/linux/reactor.h"
+
+namespace osquery {
+
+/**
+ * @brief Find the mount point containing a path.
+ *
+ * @param mounts The set of mount point directories.
+ * @param path An absolute path, which may include wildcards after its stem.
+ * @return The longest mount point that is a parent of path.
+ */
+std::string findMountPoint(const std::vector<std::string>& mounts,
+                           const std::string& path);
+
+/**
+ * @brief A Linux `fanotify` EventPublisher for file events.
+ *
+ * inotify requires a watch for every monitored directory, recursive file paths
+ * over large trees may exhaust `max_user_watches`. This publisher instead
+ * marks the mount containing each subscription's path, so a single descriptor
+ * covers a whole filesystem, and matches event paths when firing.
+ *
+ * The contexts are shared with the INotifyEventPublisher so the file events
+ * subscriber may use either publisher. fanotify mount marks only report
+ * accesses, opens, and modifications; creations, deletions, and moves are
+ * not reported.
+ */
+class FANotifyEventPublisher
+    : public EventPublisher<INotifySubscriptionContext, INotifyEventContext> {
+  DECLARE_PUBLISHER("fanotify");
+
+ public:
+  virtual ~FANotifyEventPublisher() {
+    tearDown();
+  }
+
+  /// Create an `fanotify` handle, this requires CAP_SYS_ADMIN.
+  Status setUp() override;
+
+  /// Mark the mounts containing each subscription path.
+  void configure() override;
+
+  /// Release the `fanotify` handle.
+  void tearDown() override;
+
+  /// Wait for and fire file events.
+  Status run() override;
+
+  /// Wake the run loop so the EventFactory can end it.
+  void stop() override {
+    reactor_.interrupt();
+  }
+
+  /// Remove all marks and subscriptions.
+  void removeSubscriptions(const std::string& subscriber) override;
+
+ private:
+  /// Match the event path and action against the subscription.
+  bool shouldFire(const INotifySubscriptionContextRef& sc,
+                  const INotifyEventContextRef& ec) const override;
+
+  /// Fire an event context, or hold it when coalescing is enabled.
+  void publish(const INotifyEventContextRef& ec);
+
+  /// Fire held event contexts with an elapsed window.
+  void firePending();
+
+ private:
+  /// The fanotify descriptor handle.
+  int handle_{-1};
+
+  /// The mount points and their marked event masks.
+  std::map<std::string, uint32_t> marks_;
+
+  /// Wait for the fanotify handle, or until a coalesced event is due.
+  EventReactor reactor_;
+
+  /// Bursts of events for the same path and action, held before firing.
+  EventCoalescer<INotifyEventContext> coalescer_;
+
+  /// Access to the marked mounts.
+  Mutex marks_mutex_;
+
+ private:
+  FRIEND_TEST(FANotifyTests, test_fanotify_match_subscription);
+};
+}
@@ -8,6 +8,10 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
 #include <sstream>
 
 #include <fnmatch.h>
@@ -16,15 +20,21 @@
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
+#include "osquery/core/metrics.h"
 #include "osquery/events/linux/inotify.h"
+#include "osquery/events/replay.h"
+#include "osquery/filesystem/file_cache.h"
 
 namespace fs = boost::filesystem;
 
 namespace osquery {
 
+DECLARE_uint64(file_events_coalesce_ms);
+
 static const int kINotifyMLatency = 200;
 static const uint32_t kINotifyBufferSize =
     (10 * ((sizeof(struct inotify_event)) + NAME_MAX + 1));
@@ -54,11 +64,19 @@ Status INotifyEventPublisher::setUp() {
   if (inotify_handle_ == -1) {
     return Status(1, "Could not start inotify: inotify_init failed");
   }
-  return Status(0, "OK");
+
+  coalescer_.setWindow(FLAGS_file_events_coalesce_ms);
+  reactor_.reset();
+  return reactor_.addHandle(inotify_handle_);
 }
 
-bool INotifyEventPublisher::monitorSubscription(
-    INotifySubscriptionContextRef& sc, bool add_watch) {
+void INotifyEventPublisher::discoverSubscription(
+    INotifySubscriptionContextRef& sc) {
+  if (!sc->discovered_.empty()) {
+    // The subscription path was already resolved.
+    return;
+  }
+
   sc->discovered_ = sc->path;
   if (sc->path.find("**") != std::string::npos) {
     sc->recursive = true;
@@ -77,13 +95,8 @@ bool INotifyEventPublisher::monitorSubscription(
     if (sc->discovered_.find('*') != std::string::npos) {
       // If a wildcard exists within the tree (stem), resolve at configure
       // time and monitor each path.
-      std::vector<std::string> paths;
-      resolveFilePattern(sc->discovered_, paths);
-      for (const auto& _path : paths) {
-        addMonitor(_path, sc->mask, sc->recursive, add_watch);
-      }
       sc->recursive_match = sc->recursive;
-      return true;
+      return;
     }
   }
 
@@ -91,7 +104,81 @@ bool INotifyEventPublisher::monitorSubscription(
     sc->path += '/';
     sc->discovered_ += '/';
   }
-  return addMonitor(sc->discovered_, sc->mask, sc->recursive, add_watch);
+}
+
+void INotifyEventPublisher::collectSubscription(
+    const INotifySubscriptionContextRef& sc, PathDescriptorMap& watches) const {
+  if (sc->discovered_.find('*') != std::string::npos) {
+    std::vector<std::string> paths;
+    resolveFilePattern(sc->discovered_, paths);
+    for (const auto& path : paths) {
+      collectPath(path, sc->mask, sc->recursive, watches);
+    }
+    return;
+  }
+  collectPath(sc->discovered_, sc->mask, sc->recursive, watches);
+}
+
+void INotifyEventPublisher::collectPath(const std::string& path,
+                                        uint32_t mask,
+                                        bool recursive,
+                                        PathDescriptorMap& watches) const {
+  auto watched = (mask == 0) ? kFileDefaultMasks : mask;
+  if (recursive) {
+    // New subdirectories are found by their creation events.
+    watched |= IN_CREATE | IN_MOVED_TO;
+  }
+
+  auto& watch = watches[path];
+  watch.mask |= watched;
+  watch.recursive = watch.recursive || recursive;
+  if (!recursive || !isDirectory(path).ok()) {
+    return;
+  }
+
+  // Get a list of children of this directory (requested recursive watches).
+  // Only the directories that changed since the last expansion are listed.
+  std::vector<std::string> children;
+  DirectoryTreeCache::instance().listDirectories(path, children);
+
+  boost::system::error_code ec;
+  for (const auto& child : children) {
+    auto& child_watch = watches[fs::canonical(child, ec).string() + '/'];
+    child_watch.mask |= watched;
+    child_watch.recursive = true;
+  }
+}
+
+/// A file within a watched directory is reported by the directory's watch.
+static void pruneWatches(PathDescriptorMap& watches) {
+  for (auto it = watches.begin(); it != watches.end();) {
+    const auto& path = it->first;
+    if (!path.empty() && path.back() != '/' && !isDirectory(path).ok() &&
+        watches.count(fs::path(path).parent_path().string() + '/') > 0) {
+      it = watches.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool INotifyEventPublisher::monitorSubscription(
+    INotifySubscriptionContextRef& sc, bool add_watch) {
+  discoverSubscription(sc);
+
+  PathDescriptorMap watches;
+  collectSubscription(sc, watches);
+  pruneWatches(watches);
+
+  bool result = true;
+  for (const auto& watch : watches) {
+    result = addWatch(watch.first,
+                      watch.second.mask,
+                      watch.second.recursive,
+                      add_watch) &&
+             result;
+  }
+  return result;
 }
 
 void INotifyEventPublisher::configure() {
@@ -100,23 +187,61 @@ void INotifyEventPublisher::configure() {
     return;
   }
 
+  // Configure is called as a response to removing/adding subscriptions.
+  // The watches every subscription requires are compared to the existing
+  // watches, then only the difference is removed and added.
+  WriteLock configure_lock(configure_mutex_);
+  PathDescriptorMap watches;
+  std::map<std::string, size_t> expansions;
   for (auto& sub : subscriptions_) {
-    // Anytime a configure is called, try to monitor all subscriptions.
-    // Configure is called as a response to removing/adding subscriptions.
-    // This means recalculating all monitored paths.
     auto sc = getSubscriptionContext(sub->context);
-    if (sc->discovered_.size() > 0) {
-      continue;
+    auto start = std::chrono::steady_clock::now();
+    discoverSubscription(sc);
+    collectSubscription(sc, watches);
+    expansions[sc->category] +=
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+  }
+  pruneWatches(watches);
+
+  // The cost of expanding each category's paths, from the last configure.
+  for (const auto& expansion : expansions) {
+    Metrics::gauge("file_paths_expansion_us", "category=" + expansion.first)
+        .set(expansion.second);
+    VLOG(1) << "Expanded file_paths category " << expansion.first << " in "
+            << expansion.second / 1000 << "ms";
+  }
+
+  std::vector<std::string> removed;
+  {
+    WriteLock lock(path_mutex_);
+    for (const auto& watch : path_descriptors_) {
+      if (watches.count(watch.first) == 0) {
+        removed.push_back(watch.first);
+      }
     }
-    monitorSubscription(sc);
   }
+
+  for (const auto& path : removed) {
+    removeMonitor(path, true);
+  }
+
+  for (const auto& watch : watches) {
+    addWatch(watch.first, watch.second.mask, watch.second.recursive);
+  }
+
+  // Monitoring may change the subscription paths, compile them again.
+  subscriptions_version_++;
 }
 
 void INotifyEventPublisher::tearDown() {
   if (inotify_handle_ > -1) {
+    reactor_.removeHandle(inotify_handle_);
     ::close(inotify_handle_);
   }
   inotify_handle_ = -1;
+  FileMetadataCache::instance().clear();
 }
 
 Status INotifyEventPublisher::restartMonitoring() {
@@ -125,22 +250,13 @@ Status INotifyEventPublisher::restartMonitoring() {
   }
 
   last_restart_ = getUnixTime();
-  VLOG(1) << "inotify was overflown, attempting to restart handle";
+  VLOG(1) << "inotify was overflown, reconciling watches";
 
-  // Create a copy of the descriptors, then remove each.
-  auto descriptors = descriptors_;
-  for (const auto& desc : descriptors) {
-    removeMonitor(desc, true);
-  }
+  // Events were dropped, no cached stat result can be trusted.
+  FileMetadataCache::instance().clear();
 
-  {
-    // Then remove all path/descriptor mappings.
-    WriteLock lock(path_mutex_);
-    path_descriptors_.clear();
-    descriptor_paths_.clear();
-  }
-
-  // Reconfigure ourself, the subscribers will not reconfigure.
+  // The watches remain, directories created while events were dropped are
+  // watched by reconfiguring.
   configure();
   return Status(0, "OK");
 }
@@ -148,20 +264,21 @@ Status INotifyEventPublisher::restartMonitoring() {
 Status INotifyEventPublisher::run() {
   // Get a while wrapper for free.
   char buffer[kINotifyBufferSize];
-  fd_set set;
-
-  FD_ZERO(&set);
-  FD_SET(getHandle(), &set);
 
-  struct timeval timeout = {1, 0};
-  int selector = ::select(getHandle() + 1, &set, nullptr, nullptr, &timeout);
-  if (selector == -1) {
+  // Block until the handle is readable or a coalesced event is due.
+  std::vector<int> ready;
+  auto timeout = coalescer_.timeout(coalescer_.now());
+  auto status = reactor_.wait(ready, timeout);
+  if (!status.ok()) {
+    if (isEnding()) {
+      return Status(0, "Ending");
+    }
     LOG(WARNING) << "Could not read inotify handle";
     return Status(1, "INotify handle failed");
   }
 
-  if (selector == 0) {
-    // Read timeout.
+  if (ready.empty()) {
+    firePending();
     return Status(0, "Continue");
   }
   ssize_t record_num = ::read(getHandle(), buffer, kINotifyBufferSize);
@@ -172,37 +289,129 @@ Status INotifyEventPublisher::run() {
   for (char* p = buffer; p < buffer + record_num;) {
     // Cast the inotify struct, make shared pointer, and append to contexts.
     auto event = reinterpret_cast<struct inotify_event*>(p);
-    if (event->mask & IN_Q_OVERFLOW) {
-      // The inotify queue was overflown (remove all paths).
-      Status stat = restartMonitoring();
-      if (!stat.ok()) {
-        return stat;
-      }
+    if (EventCapture::enabled()) {
+      captureEvent(event);
     }
 
-    if (event->mask & IN_IGNORED) {
-      // This inotify watch was removed.
-      removeMonitor(event->wd, false);
-    } else if (event->mask & IN_MOVE_SELF) {
-      // This inotify path was moved, but is still watched.
-      removeMonitor(event->wd, true);
-    } else if (event->mask & IN_DELETE_SELF) {
-      // A file was moved to replace the watched path.
-      removeMonitor(event->wd, false);
-    } else {
-      auto ec = createEventContextFrom(event);
-      if (!ec->action.empty()) {
-        fire(ec);
-      }
+    status = handleEvent(event);
+    if (!status.ok()) {
+      return status;
     }
     // Continue to iterate
     p += (sizeof(struct inotify_event)) + event->len;
   }
 
+  firePending();
   pauseMilli(kINotifyMLatency);
   return Status(0, "OK");
 }
 
+Status INotifyEventPublisher::handleEvent(struct inotify_event* event) {
+  if (event->mask & IN_Q_OVERFLOW) {
+    // The inotify queue was overflown (remove all paths).
+    Status stat = restartMonitoring();
+    if (!stat.ok()) {
+      return stat;
+    }
+  }
+
+  if (event->mask & IN_IGNORED) {
+    // This inotify watch was removed.
+    removeMonitor(event->wd, false);
+  } else if (event->mask & IN_MOVE_SELF) {
+    // This inotify path was moved, but is still watched.
+    removeMonitor(event->wd, true);
+  } else if (event->mask & IN_DELETE_SELF) {
+    // A file was moved to replace the watched path.
+    removeMonitor(event->wd, false);
+  } else {
+    auto ec = createEventContextFrom(event);
+    if (!ec->path.empty()) {
+      // Invalidate before the event is coalesced or fired.
+      FileMetadataCache::instance().invalidate(ec->path);
+    }
+
+    // inotify will not monitor recursively, new directories need watches.
+    auto created = event->mask & (IN_CREATE | IN_MOVED_TO);
+    if ((event->mask & IN_ISDIR) && created && !ec->path.empty()) {
+      watchCreatedDirectory(event->wd, ec->path);
+    }
+    if (!ec->action.empty()) {
+      publish(ec);
+    }
+  }
+  return Status(0, "OK");
+}
+
+void INotifyEventPublisher::captureEvent(struct inotify_event* event) const {
+  // Watch descriptors differ between runs, record the watched path.
+  std::string data;
+  {
+    WriteLock lock(path_mutex_);
+    auto it = descriptor_paths_.find(event->wd);
+    if (it != descriptor_paths_.end()) {
+      data = it->second;
+    }
+  }
+  data.push_back('\0');
+  data.append(reinterpret_cast<const char*>(event),
+              sizeof(struct inotify_event) + event->len);
+  EventCapture::record(type(), data.data(), data.size());
+}
+
+Status INotifyEventPublisher::replay(const std::string& data) {
+  auto separator = data.find('\0');
+  if (separator == std::string::npos ||
+      data.size() - separator - 1 < sizeof(struct inotify_event)) {
+    return Status(1, "Invalid inotify record");
+  }
+
+  // Copy the event into aligned storage, the name follows the struct.
+  auto size = data.size() - separator - 1;
+  std::vector<uint64_t> buffer(size / sizeof(uint64_t) + 2, 0);
+  auto event = reinterpret_cast<struct inotify_event*>(buffer.data());
+  memcpy(event, data.data() + separator + 1, size);
+  if (sizeof(struct inotify_event) + event->len > size) {
+    return Status(1, "Invalid inotify record");
+  }
+
+  // Events for watched paths are given this run's descriptor.
+  auto path = data.substr(0, separator);
+  if (!path.empty()) {
+    WriteLock lock(path_mutex_);
+    auto it = path_descriptors_.find(path);
+    if (it == path_descriptors_.end()) {
+      return Status(1, "Path is not watched: " + path);
+    }
+    event->wd = it->second.descriptor;
+  }
+
+  auto status = handleEvent(event);
+  firePending();
+  return status;
+}
+
+void INotifyEventPublisher::publish(const INotifyEventContextRef& ec) {
+  if (coalescer_.window() == 0) {
+    fire(ec);
+    return;
+  }
+
+  // Merge repeated writes to a path into a single event.
+  auto key = ec->action + ':' + ec->path;
+  if (coalescer_.add(key, ec, coalescer_.now())) {
+    coalesced_count_++;
+  }
+}
+
+void INotifyEventPublisher::firePending() {
+  std::vector<INotifyEventContextRef> ready;
+  coalescer_.expire(coalescer_.now(), ready);
+  for (const auto& ec : ready) {
+    fire(ec);
+  }
+}
+
 INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
     struct inotify_event* event) const {
   auto shared_event = std::make_shared<struct inotify_event>(*event);
@@ -233,6 +442,40 @@ INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
   return ec;
 }
 
+INotifySubscriptionMatcher::INotifySubscriptionMatcher(
+    const SubscriptionVector& subscriptions) {
+  for (size_t i = 0; i < subscriptions.size(); i++) {
+    auto sc = INotifyEventPublisher::getSubscriptionContext(
+        subscriptions[i]->context);
+    paths_.insert(sc->path, i);
+    masks_.push_back(sc->mask);
+  }
+}
+
+void INotifySubscriptionMatcher::match(const EventContextRef& ec,
+                                       std::vector<size_t>& targets) const {
+  auto iec = INotifyEventPublisher::getEventContext(ec);
+  paths_.match(iec->path, false, targets);
+  if (iec->event == nullptr) {
+    return;
+  }
+
+  // Remove the candidates requiring other actions.
+  auto mask = iec->event->mask;
+  targets.erase(std::remove_if(targets.begin(),
+                               targets.end(),
+                               [this, mask](size_t index) {
+                                 return masks_[index] != 0 &&
+                                        !(mask & masks_[index]);
+                               }),
+                targets.end());
+}
+
+SubscriptionMatcherRef INotifyEventPublisher::compileSubscriptions(
+    const SubscriptionVector& subscriptions) const {
+  return std::make_shared<INotifySubscriptionMatcher>(subscriptions);
+}
+
 bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
                                        const INotifyEventContextRef& ec) const {
   // The subscription may supply a required event mask.
@@ -255,13 +498,54 @@ bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
     // match requirement (an inline wildcard with ending recursive wildcard).
     return false;
   }
+  return true;
+}
 
-  // inotify will not monitor recursively, new directories need watches.
-  if (sc->recursive && ec->action == "CREATED" && isDirectory(ec->path)) {
-    const_cast<INotifyEventPublisher*>(this)
-        ->addMonitor(ec->path + '/', sc->mask, true);
+bool INotifyEventPublisher::addWatch(const std::string& path,
+                                     uint32_t mask,
+                                     bool recursive,
+                                     bool add_watch) {
+  bool exists = false;
+  {
+    WriteLock lock(path_mutex_);
+    auto it = path_descriptors_.find(path);
+    if (it != path_descriptors_.end()) {
+      if (it->second.mask == mask) {
+        it->second.recursive = recursive;
+        return true;
+      }
+      exists = true;
+    }
+  }
+
+  if (!exists && isPathMonitored(path)) {
+    // A file within a watched directory.
+    return true;
+  }
+
+  // Adding a watch to a watched path replaces its events, keeping the watch.
+  int watch = ::inotify_add_watch(getHandle(), path.c_str(), mask);
+  if (add_watch && watch == -1) {
+    LOG(WARNING) << "Could not add inotify watch on: " << path;
+    return false;
   }
 
+  {
+    WriteLock lock(path_mutex_);
+    auto& existing = path_descriptors_[path];
+    if (exists && existing.descriptor != watch) {
+      descriptor_paths_.erase(existing.descriptor);
+    }
+    existing.descriptor = watch;
+    existing.mask = mask;
+    existing.recursive = recursive;
+    descriptor_paths_[watch] = path;
+  }
+
+  // Stat results may be reused while content and attribute changes fire.
+  if (add_watch && (mask & kFileDefaultMasks) == kFileDefaultMasks) {
+    FileMetadataCache::instance().watch(path);
+  }
   return true;
 }
 
@@ -269,60 +553,58 @@ bool INotifyEventPublisher::addMonitor(const std::string& path,
                                        uint32_t mask,
                                        bool recursive,
                                        bool add_watch) {
-  if (!isPathMonitored(path)) {
-    int watch = ::inotify_add_watch(
-        getHandle(), path.c_str(), ((mask == 0) ? kFileDefaultMasks : mask));
-    if (add_watch && watch == -1) {
-      LOG(WARNING) << "Could not add inotify watch on: " << path;
-      return false;
-    }
+  PathDescriptorMap watches;
+  collectPath(path, mask, recursive, watches);
 
-    {
-      WriteLock lock(path_mutex_);
-      // Keep a list of the watch descriptors
-      descriptors_.push_back(watch);
-      // Keep a map of the path -> watch descriptor
-      path_descriptors_[path] = watch;
-      // Keep a map of the opposite (descriptor -> path)
-      descriptor_paths_[watch] = path;
+  auto result = addWatch(path, watches[path].mask, recursive, add_watch);
+  for (const auto& watch : watches) {
+    if (watch.first != path) {
+      addWatch(watch.first, watch.second.mask, true);
     }
   }
+  return result;
+}
 
-  if (recursive && isDirectory(path).ok()) {
-    std::vector<std::string> children;
-    // Get a list of children of this directory (requested recursive watches).
-    listDirectoriesInDirectory(path, children, true);
+void INotifyEventPublisher::watchCreatedDirectory(int parent,
+                                                  const std::string& path) {
+  uint32_t mask = 0;
+  {
+    WriteLock lock(path_mutex_);
+    auto descriptor = descriptor_paths_.find(parent);
+    if (descriptor == descriptor_paths_.end()) {
+      return;
+    }
 
-    boost::system::error_code ec;
-    for (const auto& child : children) {
-      auto canonicalized = fs::canonical(child, ec).string() + '/';
-      addMonitor(canonicalized, mask, false);
+    auto watch = path_descriptors_.find(descriptor->second);
+    if (watch == path_descriptors_.end() || !watch->second.recursive) {
+      return;
     }
+    mask = watch->second.mask;
   }
 
-  return true;
+  // Directories may be created within the new directory before it is watched.
+  addMonitor(path + '/', mask, true);
 }
 
 bool INotifyEventPublisher::removeMonitor(const std::string& path, bool force) {
+  int watch = 0;
   {
-    WriteLock lock(path_mutex_);
     // If force then remove from INotify, otherwise cleanup file descriptors.
-    if (path_descriptors_.find(path) == path_descriptors_.end()) {
+    WriteLock lock(path_mutex_);
+    auto it = path_descriptors_.find(path);
+    if (it == path_descriptors_.end()) {
       return false;
     }
-  }
 
-  int watch = 0;
-  {
-    WriteLock lock(path_mutex_);
-    watch = path_descriptors_[path];
-    path_descriptors_.erase(path);
-    descriptor_paths_.erase(watch);
-
-    auto position = std::find(descriptors_.begin(), descriptors_.end(), watch);
-    descriptors_.erase(position);
+    watch = it->second.descriptor;
+    path_descriptors_.erase(it);
+    auto descriptor = descriptor_paths_.find(watch);
+    if (descriptor != descriptor_paths_.end() && descriptor->second == path) {
+      descriptor_paths_.erase(descriptor);
+    }
   }
 
+  FileMetadataCache::instance().unwatch(path);
   if (force) {
     ::inotify_rm_watch(getHandle(), watch);
   }
@@ -333,22 +615,15 @@ bool INotifyEventPublisher::removeMonitor(int watch, bool force) {
   std::string path;
   {
     WriteLock lock(path_mutex_);
-    if (descriptor_paths_.find(watch) == descriptor_paths_.end()) {
+    auto descriptor = descriptor_paths_.find(watch);
+    if (descriptor == descriptor_paths_.end()) {
       return false;
     }
-    path = descriptor_paths_[watch];
+    path = descriptor->second;
   }
   return removeMonitor(path, force);
 }
 
-void INotifyEventPublisher::removeSubscriptions(const std::string& subscriber) {
-  auto paths = descriptor_paths_;
-  for (const auto& path : paths) {
-    removeMonitor(path.first, true);
-  }
-  EventPublisherPlugin::removeSubscriptions(subscriber);
-}
-
 bool INotifyEventPublisher::isPathMonitored(const std::string& path) const {
   WriteLock lock(path_mutex_);
   std::string parent_path;
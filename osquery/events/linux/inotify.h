@@ -11,6 +11,7 @@
 #pragma once
 
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 #include <sys/inotify.h>
@@ -18,6 +19,10 @@
 
 #include <osquery/events.h>
 
+#include "osquery/events/linux/coalescer.h"
+#include "osquery/events/linux/reactor.h"
+#include "osquery/events/pathtree.h"
+
 namespace osquery {
 
 extern std::map<int, std::string> kMaskActions;
@@ -96,10 +101,42 @@ using INotifyEventContextRef = std::shared_ptr<INotifyEventContext>;
 using INotifySubscriptionContextRef =
     std::shared_ptr<INotifySubscriptionContext>;
 
+/**
+ * @brief INotify Subscription%s compiled into a path tree and action masks.
+ *
+ * An event walks the prefix tree of subscription paths once, then the
+ * candidates requiring other actions are removed by their masks.
+ */
+class INotifySubscriptionMatcher : public SubscriptionMatcher {
+ public:
+  explicit INotifySubscriptionMatcher(const SubscriptionVector& subscriptions);
+
+  void match(const EventContextRef& ec,
+             std::vector<size_t>& targets) const override;
+
+ private:
+  /// The index of each subscription at the literal prefix of its path.
+  PathPrefixTree<size_t> paths_;
+
+  /// The required event mask of each subscription.
+  std::vector<uint32_t> masks_;
+};
+
+/// An inotify watch on a directory or file path.
+struct INotifyWatch {
+  /// The watch descriptor.
+  int descriptor{-1};
+
+  /// The watched events.
+  uint32_t mask{0};
+
+  /// Subdirectories created within a watched directory are also watched.
+  bool recursive{false};
+};
+
 // Publisher containers
-using DescriptorVector = std::vector<int>;
-using PathDescriptorMap = std::map<std::string, int>;
-using DescriptorPathMap = std::map<int, std::string>;
+using PathDescriptorMap = std::unordered_map<std::string, INotifyWatch>;
+using DescriptorPathMap = std::unordered_map<int, std::string>;
 
 /**
  * @brief A Linux `inotify` EventPublisher.
@@ -134,8 +171,13 @@ class INotifyEventPublisher
   /// The calling for beginning the thread's run loop.
   Status run() override;
 
-  /// Remove all monitors and subscriptions.
-  void removeSubscriptions(const std::string& subscriber) override;
+  /// Handle a captured event, recorded with its watched path.
+  Status replay(const std::string& data) override;
+
+  /// Wake the run loop so the EventFactory can end it.
+  void stop() override {
+    reactor_.interrupt();
+  }
 
  private:
   /// Helper/specialized event context creation.
@@ -174,10 +216,47 @@ class INotifyEventPublisher
   bool monitorSubscription(INotifySubscriptionContextRef& sc,
                            bool add_watch = true);
 
+  /// Resolve the directory or pattern a subscription watches, only once.
+  void discoverSubscription(INotifySubscriptionContextRef& sc);
+
+  /**
+   * @brief Collect the watches a discovered subscription requires.
+   *
+   * Paths requested by several subscriptions are watched for the union of
+   * their events. A file within a watched directory does not need a watch.
+   */
+  void collectSubscription(const INotifySubscriptionContextRef& sc,
+                           PathDescriptorMap& watches) const;
+
+  /// Collect a path and, if recursive, every directory within it.
+  void collectPath(const std::string& path,
+                   uint32_t mask,
+                   bool recursive,
+                   PathDescriptorMap& watches) const;
+
+  /**
+   * @brief Add or update a single inotify watch.
+   *
+   * A watch on an existing path is only changed if its events differ.
+   *
+   * @return success if the inotify watch exists.
+   */
+  bool addWatch(const std::string& path,
+                uint32_t mask,
+                bool recursive,
+                bool add_watch = true);
+
+  /// Watch a directory created within a recursively watched directory.
+  void watchCreatedDirectory(int parent, const std::string& path);
+
   /// Remove an INotify watch (monitor) from our tracking.
   bool removeMonitor(const std::string& path, bool force = false);
   bool removeMonitor(int watch, bool force = false);
 
+  /// Compile the subscription paths and masks.
+  SubscriptionMatcherRef compileSubscriptions(
+      const SubscriptionVector& subscriptions) const override;
+
   /// Given a SubscriptionContext and INotifyEventContext match path and action.
   bool shouldFire(const INotifySubscriptionContextRef& mc,
                   const INotifyEventContextRef& ec) const override;
@@ -189,16 +268,26 @@ class INotifyEventPublisher
 
   /// Get the number of actual INotify active descriptors.
   size_t numDescriptors() const {
-    return descriptors_.size();
+    WriteLock lock(path_mutex_);
+    return descriptor_paths_.size();
   }
 
-  /// If we overflow, try and restart the monitor
+  /// If we overflow, watch directories created while events were dropped.
   Status restartMonitoring();
 
-  // Consider an event queue if separating buffering from firing/servicing.
-  DescriptorVector descriptors_;
+  /// Fire an event context, or hold it when coalescing is enabled.
+  void publish(const INotifyEventContextRef& ec);
+
+  /// Fire held event contexts with an elapsed window.
+  void firePending();
+
+  /// Apply watch changes for an event and publish it.
+  Status handleEvent(struct inotify_event* event);
 
-  /// Map of watched path string to inotify watch file descriptor.
+  /// Record an event and the path of its watch descriptor.
+  void captureEvent(struct inotify_event* event) const;
+
+  /// Map of watched path string to inotify watch.
   PathDescriptorMap path_descriptors_;
 
   /// Map of inotify watch file descriptor to watched path string.
@@ -207,12 +296,21 @@ class INotifyEventPublisher
   /// The inotify file descriptor handle.
   std::atomic<int> inotify_handle_{-1};
 
+  /// Wait for the inotify handle, or until a coalesced event is due.
+  EventReactor reactor_;
+
+  /// Bursts of events for the same path and action, held before firing.
+  EventCoalescer<INotifyEventContext> coalescer_;
+
   /// Time in seconds of the last inotify restart.
   std::atomic<int> last_restart_{-1};
 
   /// Access to path and descriptor mappings.
   mutable Mutex path_mutex_;
 
+  /// Configure is called by the config refresh and by overflow restarts.
+  Mutex configure_mutex_;
+
  public:
   friend class INotifyTests;
   FRIEND_TEST(INotifyTests, test_inotify_init);
@@ -220,5 +318,8 @@ class INotifyEventPublisher
   FRIEND_TEST(INotifyTests, test_inotify_recursion);
   FRIEND_TEST(INotifyTests, test_inotify_match_subscription);
   FRIEND_TEST(INotifyTests, test_inotify_embedded_wildcards);
+  FRIEND_TEST(INotifyTests, test_inotify_coalesce);
+  FRIEND_TEST(INotifyTests, test_inotify_incremental_configure);
+  FRIEND_TEST(INotifyTests, test_inotify_created_directory);
 };
 }
@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "osquery/events/linux/reactor.h"
+
+namespace osquery {
+
+/// Maximum number of readable descriptors returned by a single wait.
+static const int kReactorMaxEvents = 16;
+
+EventReactor::EventReactor() {
+  epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+  wakeup_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (epoll_ == -1 || wakeup_ == -1) {
+    return;
+  }
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = wakeup_;
+  ::epoll_ctl(epoll_, EPOLL_CTL_ADD, wakeup_, &event);
+}
+
+EventReactor::~EventReactor() {
+  if (wakeup_ != -1) {
+    ::close(wakeup_);
+  }
+  if (epoll_ != -1) {
+    ::close(epoll_);
+  }
+}
+
+Status EventReactor::addHandle(int fd) {
+  if (!isValid()) {
+    return Status(1, "Event reactor is not available");
+  }
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) == -1 && errno != EEXIST) {
+    return Status(1, "Cannot watch descriptor: " + std::to_string(errno));
+  }
+  return Status(0, "OK");
+}
+
+void EventReactor::removeHandle(int fd) {
+  if (isValid()) {
+    ::epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+  }
+}
+
+Status EventReactor::wait(std::vector<int>& ready, int timeout) {
+  if (!isValid()) {
+    return Status(1, "Event reactor is not available");
+  }
+
+  ready.clear();
+  struct epoll_event events[kReactorMaxEvents];
+  int count = 0;
+  do {
+    count = ::epoll_wait(epoll_, events, kReactorMaxEvents, timeout);
+  } while (count == -1 && errno == EINTR);
+
+  if (count == -1) {
+    return Status(1, "Event reactor wait failed");
+  }
+
+  bool interrupted = false;
+  for (int i = 0; i < count; i++) {
+    if (events[i].data.fd == wakeup_) {
+      interrupted = true;
+    } else {
+      ready.push_back(events[i].data.fd);
+    }
+  }
+
+  if (interrupted) {
+    return Status(1, "Interrupted");
+  }
+  return Status(0, "OK");
+}
+
+void EventReactor::interrupt() {
+  if (wakeup_ != -1) {
+    uint64_t value = 1;
+    auto bytes = ::write(wakeup_, &value, sizeof(value));
+    (void)bytes;
+  }
+}
+
+void EventReactor::reset() {
+  if (wakeup_ != -1) {
+    uint64_t value = 0;
+    auto bytes = ::read(wakeup_, &value, sizeof(value));
+    (void)bytes;
+  }
+}
+}
@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief An epoll reactor used by Linux EventPublisher run loops.
+ *
+ * Publishers register the descriptors they read events from and block in
+ * EventReactor::wait until a descriptor is readable. Unlike a select with a
+ * timeout, an idle publisher thread does not wake until the EventFactory
+ * stops it using EventReactor::interrupt from the publisher's stop.
+ */
+class EventReactor : private boost::noncopyable {
+ public:
+  EventReactor();
+  ~EventReactor();
+
+  /// Check if the epoll and interruption descriptors were created.
+  bool isValid() const {
+    return epoll_ != -1 && wakeup_ != -1;
+  }
+
+  /// Watch a descriptor for readable data.
+  Status addHandle(int fd);
+
+  /// Stop watching a descriptor, this is required before closing it.
+  void removeHandle(int fd);
+
+  /**
+   * @brief Wait for watched descriptors to become readable.
+   *
+   * @param ready The output readable descriptors, replaced by each wait.
+   * @param timeout Milliseconds to wait, -1 waits until data or interruption.
+   * @return Failure if the reactor was interrupted or the wait failed.
+   */
+  Status wait(std::vector<int>& ready, int timeout = -1);
+
+  /// Wake a waiting thread, later waits return immediately until reset.
+  void interrupt();
+
+  /// Allow waits to block again after an interruption.
+  void reset();
+
+ private:
+  /// The epoll instance descriptor.
+  int epoll_{-1};
+
+  /// An eventfd, readable after an interruption.
+  int wakeup_{-1};
+};
+}
@@ -10,25 +10,25 @@
 
 #include <fcntl.h>
 #include <grp.h>
+#include <string.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
-#include <istream>
 #include <string>
 
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/json_parser.hpp>
-#include <boost/tokenizer.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
 #include "osquery/events/linux/syslog.h"
+#include "osquery/events/replay.h"
 
 namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
@@ -47,6 +47,11 @@ FLAG(uint64,
      100,
      "Maximum number of logs to ingest per run (~200ms between runs)");
 
+FLAG(bool,
+     syslog_drop_excess,
+     false,
+     "Drop logs over the rate limit instead of leaving them in the pipe");
+
 REGISTER(SyslogEventPublisher, "event_publisher", "syslog");
 
 // rsyslog needs read/write access, osquery process needs read access
@@ -57,6 +62,9 @@ const std::vector<std::string> kCsvFields = {
     "time", "host", "severity", "facility", "tag", "message"};
 const size_t kErrorThreshold = 10;
 
+/// The size of the read buffer, lines longer than this are dropped.
+const size_t kSyslogBufferSize = 256 * 1024;
+
 Status SyslogEventPublisher::setUp() {
   if (!FLAGS_enable_syslog) {
     return Status(1, "Publisher disabled via configuration");
@@ -84,16 +92,16 @@ Status SyslogEventPublisher::setUp() {
     return s;
   }
 
-  // Opening with both flags appears to be the only way to open the pipe
-  // without blocking for a writer. We won't ever write to the pipe, but we
-  // don't want to block here and will instead block waiting for a read in the
-  // run() method
-  readStream_.open(FLAGS_syslog_pipe_path,
-                   std::ifstream::in | std::ifstream::out);
-  if (!readStream_.good()) {
+  // Opening for reading and writing keeps the pipe from reporting an end of
+  // file when rsyslog restarts. We won't ever write to the pipe, reads do
+  // not block and the run loop waits between reads.
+  readFd_ = open(FLAGS_syslog_pipe_path.c_str(), O_RDWR | O_NONBLOCK);
+  if (readFd_ == -1) {
     return Status(1,
                   "Error opening pipe for reading: " + FLAGS_syslog_pipe_path);
   }
+  buffer_.resize(kSyslogBufferSize);
+  buffered_ = 0;
   VLOG(1) << "Successfully opened pipe for syslog ingestion: "
           << FLAGS_syslog_pipe_path;
 
@@ -148,59 +156,219 @@ void SyslogEventPublisher::unlockPipe() {
   }
 }
 
-Status SyslogEventPublisher::run() {
-  // This run function will be called by the event factory with ~100ms pause
-  // (see InterruptableRunnable::pause()) between runs. In case something goes
-  // weird and there is a huge amount of input, we limit how many logs we
-  // take in per run to avoid pegging the CPU.
-  for (size_t i = 0; i < FLAGS_syslog_rate_limit; ++i) {
-    if (readStream_.rdbuf()->in_avail() == 0) {
-      // If there is no pending data, we have flushed everything and can wait
-      // until the next time EventFactory calls run(). This also allows the
-      // thread to join when it is stopped by EventFactory.
+Status SyslogEventPublisher::readPipe(size_t& bytes) {
+  bytes = 0;
+  if (buffered_ == buffer_.size()) {
+    // The buffer holds part of a single line, drop it.
+    buffered_ = 0;
+    if (!skipping_) {
+      skipping_ = true;
+      dropped_count_++;
+    }
+  }
+
+  auto result =
+      ::read(readFd_, buffer_.data() + buffered_, buffer_.size() - buffered_);
+  if (result < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
       return Status(0, "OK");
     }
-    std::string line;
-    std::getline(readStream_, line);
+    return Status(1, "Error reading pipe: " + std::string(strerror(errno)));
+  }
+
+  bytes = static_cast<size_t>(result);
+  buffered_ += bytes;
+  return Status(0, "OK");
+}
+
+Status SyslogEventPublisher::fireLines(size_t& lines) {
+  auto begin = buffer_.data();
+  auto end = begin + buffered_;
+  auto next = begin;
+  Status status;
+  while (next != end && lines < FLAGS_syslog_rate_limit) {
+    auto newline = static_cast<const char*>(memchr(next, '\n', end - next));
+    if (newline == nullptr) {
+      break;
+    }
+
+    const char* line = next;
+    next = const_cast<char*>(newline) + 1;
+    if (skipping_) {
+      // The end of a line that did not fit in the buffer.
+      skipping_ = false;
+      continue;
+    }
+
+    lines++;
+    if (EventCapture::enabled()) {
+      EventCapture::record(type(), line, newline - line);
+    }
+
     auto ec = createEventContext();
-    Status status = populateEventContext(line, ec);
+    status = populateEventContext(line, newline, ec);
     if (status.ok()) {
       fire(ec);
       if (errorCount_ > 0) {
         --errorCount_;
       }
     } else {
-      LOG(ERROR) << status.getMessage() << " in line: " << line;
+      LOG(ERROR) << status.getMessage()
+                 << " in line: " << std::string(line, newline);
       ++errorCount_;
       if (errorCount_ >= kErrorThreshold) {
-        return Status(1, "Too many errors in syslog parsing.");
+        status = Status(1, "Too many errors in syslog parsing.");
+        break;
       }
+      status = Status(0, "OK");
     }
   }
-  return Status(0, "OK");
+
+  // Keep the lines that were not fired, and the start of an incomplete line.
+  buffered_ = end - next;
+  if (buffered_ > 0 && next != begin) {
+    memmove(begin, next, buffered_);
+  }
+  return status;
+}
+
+void SyslogEventPublisher::dropPipe() {
+  // Complete lines already buffered are fired by the next run, the end of an
+  // incomplete line is in the pipe and is dropped with it.
+  auto begin = buffer_.data();
+  auto kept = static_cast<const char*>(begin);
+  while (auto newline = static_cast<const char*>(
+             memchr(kept, '\n', begin + buffered_ - kept))) {
+    kept = newline + 1;
+  }
+
+  // A dropped line is counted once, when it is first skipped.
+  bool counted = skipping_;
+  if (kept != begin + buffered_) {
+    buffered_ = kept - begin;
+    if (!counted) {
+      dropped_count_++;
+      counted = true;
+    }
+  }
+
+  char scratch[4096];
+  ssize_t result = 0;
+  while ((result = ::read(readFd_, scratch, sizeof(scratch))) > 0) {
+    for (ssize_t i = 0; i < result; i++) {
+      if (scratch[i] == '\n') {
+        if (!counted) {
+          dropped_count_++;
+        }
+        counted = false;
+      }
+    }
+    if (scratch[result - 1] != '\n' && !counted) {
+      dropped_count_++;
+      counted = true;
+    }
+  }
+  skipping_ = counted;
+}
+
+Status SyslogEventPublisher::run() {
+  // This run function will be called by the event factory with ~100ms pause
+  // (see InterruptableRunnable::pause()) between runs. In case something goes
+  // weird and there is a huge amount of input, we limit how many logs we
+  // take in per run to avoid pegging the CPU.
+  size_t lines = 0;
+  auto status = fireLines(lines);
+  while (status.ok() && lines < FLAGS_syslog_rate_limit) {
+    // If there is no pending data, we have flushed everything and can wait
+    // until the next time EventFactory calls run(). This also allows the
+    // thread to join when it is stopped by EventFactory.
+    size_t bytes = 0;
+    status = readPipe(bytes);
+    if (!status.ok() || bytes == 0) {
+      break;
+    }
+    status = fireLines(lines);
+  }
+
+  if (status.ok() && lines >= FLAGS_syslog_rate_limit &&
+      FLAGS_syslog_drop_excess) {
+    // Over the rate limit, keep rsyslog from blocking on a full pipe.
+    dropPipe();
+  }
+  return status;
 }
 
 void SyslogEventPublisher::tearDown() {
   unlockPipe();
+  if (readFd_ != -1) {
+    close(readFd_);
+    readFd_ = -1;
+  }
+}
+
+bool parseRsyslogCsvField(const char*& next,
+                          const char* end,
+                          std::string& value) {
+  value.clear();
+  bool in_quote = false;
+  // The start of the span appended to the value at once.
+  auto span = next;
+  for (; next != end; ++next) {
+    if (*next == ',' && !in_quote) {
+      value.append(span, next);
+      ++next;
+      return true;
+    } else if (*next == '"') {
+      value.append(span, next);
+      if (in_quote && next + 1 != end && *(next + 1) == '"') {
+        // rsyslog escapes " with "", so reverse this by inserting "
+        value += '"';
+        ++next;
+      } else {
+        in_quote = !in_quote;
+      }
+      span = next + 1;
+    }
+  }
+  value.append(span, next);
+  return false;
+}
+
+Status SyslogEventPublisher::replay(const std::string& data) {
+  auto ec = createEventContext();
+  auto status = populateEventContext(data, ec);
+  if (status.ok()) {
+    fire(ec);
+  }
+  return status;
 }
 
-Status SyslogEventPublisher::populateEventContext(const std::string& line,
+Status SyslogEventPublisher::populateEventContext(const char* begin,
+                                                  const char* end,
                                                   SyslogEventContextRef& ec) {
-  boost::tokenizer<RsyslogCsvSeparator> tokenizer(line);
+  if (begin == end) {
+    return Status(1, "Received fewer fields than expected");
+  }
+
   auto key = kCsvFields.begin();
-  for (std::string value : tokenizer) {
+  auto next = begin;
+  bool more = true;
+  std::string value;
+  while (more) {
     if (key == kCsvFields.end()) {
       return Status(1, "Received more fields than expected");
     }
 
+    more = parseRsyslogCsvField(next, end, value);
     boost::trim(value);
     if (*key == "time") {
-      ec->fields["datetime"] = value;
+      ec->fields["datetime"] = std::move(value);
     } else if (*key == "tag" && !value.empty() && value.back() == ':') {
       // rsyslog sends "tag" with a trailing colon that we don't need
-      ec->fields.emplace(*key, value.substr(0, value.size() - 1));
+      value.pop_back();
+      ec->fields.emplace(*key, std::move(value));
     } else {
-      ec->fields.emplace(*key, value);
+      ec->fields.emplace(*key, std::move(value));
     }
     ++key;
   }
@@ -12,8 +12,9 @@
 
 #include <stdio.h>
 
-#include <fstream>
 #include <map>
+#include <string>
+#include <vector>
 
 #include <boost/property_tree/ptree.hpp>
 
@@ -48,13 +49,32 @@ struct SyslogEventContext : public EventContext {
 using SyslogEventContextRef = std::shared_ptr<SyslogEventContext>;
 using SyslogSubscriptionContextRef = std::shared_ptr<SyslogSubscriptionContext>;
 
+/**
+ * @brief Parse one rsyslog CSV field in place.
+ *
+ * rsyslog escapes " with "" and does not escape backslashes, which the
+ * default boost::escaped_list_separator does not support. Unquoted spans
+ * are appended to the value at once, quotes are removed and "" unescaped.
+ *
+ * @param next The start of the field, moved past its separating comma.
+ * @param end The end of the line.
+ * @param value (output) The unescaped field.
+ * @return true if a comma followed the field, so another field follows.
+ */
+bool parseRsyslogCsvField(const char*& next,
+                          const char* end,
+                          std::string& value);
+
 /**
  * @brief Event publisher for syslog lines forwarded through rsyslog
  *
- * This event publisher ingests JSON representations of syslog entries, and
+ * This event publisher ingests CSV representations of syslog entries, and
  * publishes them to it's subscribers. In order for it to function properly,
- * rsyslog must be configured to forward JSON to a named pipe that this
+ * rsyslog must be configured to forward CSV to a named pipe that this
  * publisher will read from.
+ *
+ * The pipe is read in large blocks into a preallocated buffer, and complete
+ * lines are parsed where they were read.
  */
 class SyslogEventPublisher
     : public EventPublisher<SyslogSubscriptionContext, SyslogEventContext> {
@@ -69,9 +89,27 @@ class SyslogEventPublisher
 
   Status run() override;
 
+  /// Parse and fire a captured line.
+  Status replay(const std::string& data) override;
+
  public:
   SyslogEventPublisher() : EventPublisher(), errorCount_(0), lockFd_(-1) {}
 
+  /**
+   * @brief Populate the SyslogEventContext with a syslog CSV line.
+   *
+   * Performs basic cleanup on the data as it is populated into the context.
+   */
+  static Status populateEventContext(const char* begin,
+                                     const char* end,
+                                     SyslogEventContextRef& ec);
+
+  /// See populateEventContext, for a line copied into a string.
+  static Status populateEventContext(const std::string& line,
+                                     SyslogEventContextRef& ec) {
+    return populateEventContext(line.data(), line.data() + line.size(), ec);
+  }
+
  private:
   /// Apply normal subscription to event matching logic.
   bool shouldFire(const SyslogSubscriptionContextRef& mc,
@@ -106,18 +144,35 @@ class SyslogEventPublisher
   void unlockPipe();
 
   /**
-   * @brief Populate the SyslogEventContext with the syslog JSON.
+   * @brief Read the pipe into the free space of the buffer.
    *
-   * Performs basic cleanup on the JSON data as it is populated into the
-   * context.
+   * @return The number of bytes read, 0 if no data is waiting.
    */
-  static Status populateEventContext(const std::string& line,
-                                     SyslogEventContextRef& ec);
+  Status readPipe(size_t& bytes);
 
   /**
-   * @brief Input stream for reading from the pipe.
+   * @brief Parse and fire the complete lines in the buffer.
+   *
+   * Lines are fired until the rate limit, the rest stay buffered.
+   *
+   * @param lines The lines fired during this run, incremented.
    */
-  std::fstream readStream_;
+  Status fireLines(size_t& lines);
+
+  /// Remove the data waiting in the pipe, counting the dropped lines.
+  void dropPipe();
+
+  /// Descriptor the pipe is read from, opened without blocking.
+  int readFd_{-1};
+
+  /// The preallocated read buffer, lines are parsed in place.
+  std::vector<char> buffer_;
+
+  /// The number of bytes read into the buffer and not yet parsed.
+  size_t buffered_{0};
+
+  /// The buffer began within a dropped line, skip until its end.
+  bool skipping_{false};
 
   /**
    * @brief Counter used to shut down thread when too many errors occur.
@@ -133,76 +188,12 @@ class SyslogEventPublisher
    * @brief File descriptor used to lock the pipe for reading.
    *
    * This fd should not be used for reading from the pipe, instead use
-   * readStream_.
+   * readFd_.
    */
   int lockFd_;
 
  private:
   FRIEND_TEST(SyslogTests, test_populate_event_context);
-};
-
-/**
- * Boost TokenizerFunction functor for tokenizing rsyslog CSV data
- *
- * This functor is intended to be used with boost::tokenizer in order to
- * properly parse CSV data generated by rsyslog. The default
- * boost::escaped_list_separator provided with boost::tokenizer chokes on
- * rsyslog CSV output, because rsyslog escapes " with "", and also does not
- * escape backslashes. Our implementation closely follows the one provided with
- * Boost, but allows for the idiosyncrasies of rsyslog output and simplifies
- * the implementation for our limited use case.
- */
-class RsyslogCsvSeparator {
- public:
-  RsyslogCsvSeparator() : last_(false) {}
-
-  void reset() {
-    last_ = false;
-  }
-
-  template <typename InputIterator, typename Token>
-  bool operator()(InputIterator& next, InputIterator end, Token& tok) {
-    bool in_quote = false;
-    tok = Token();
-
-    if (next == end) {
-      if (last_) {
-        // The last character was a comma, so we got an empty field at the end
-        last_ = false;
-        return true;
-      } else {
-        return false;
-      }
-    }
-    last_ = false;
-    for (; next != end; ++next) {
-      if (*next == ',') {
-        if (!in_quote) {
-          ++next;
-          last_ = true;
-          return true;
-        } else {
-          tok += *next;
-        }
-      } else if (*next == '"') {
-        auto after = next + 1;
-        if (!in_quote) {
-          in_quote = true;
-        } else if (after != end && *after == '"') {
-          // rsyslog escapes " with "", so reverse this by inserting "
-          tok += "\"";
-          ++next;
-        } else {
-          in_quote = false;
-        }
-      } else {
-        tok += *next;
-      }
-    }
-    return true;
-  }
-
- private:
-  bool last_;
+  FRIEND_TEST(SyslogTests, test_read_lines);
 };
 }
@@ -102,31 +102,35 @@ TEST_F(AuditTests, test_audit_assembler) {
   asmb.add(100U, 1, expected_fields);
 
   EXPECT_EQ(3U, asmb.capacity_);
-  EXPECT_EQ(1U, asmb.queue_.size());
+  EXPECT_EQ(3U, asmb.slots_.size());
+  EXPECT_EQ(1U, asmb.size());
 
   EXPECT_EQ(expected_types, asmb.types_);
   // This will be empty since there is no update method.
-  EXPECT_TRUE(asmb.m_[100].empty());
+  ASSERT_NE(nullptr, asmb.find(100));
+  EXPECT_TRUE(asmb.find(100)->fields.empty());
 
   expected_fields = {{"2", "2"}};
   asmb.add(100U, 1, expected_fields);
 
   // Again empty.
-  EXPECT_TRUE(asmb.m_[100].empty());
-  EXPECT_EQ(1U, asmb.mt_[100].size());
+  EXPECT_TRUE(asmb.find(100)->fields.empty());
+  EXPECT_EQ(1U, asmb.find(100)->types.size());
 
   asmb.add(100U, 2, expected_fields);
   asmb.add(100U, 3, expected_fields);
-  EXPECT_TRUE(asmb.m_.empty());
-  EXPECT_EQ(0U, asmb.queue_.size());
+  EXPECT_EQ(nullptr, asmb.find(100));
+  EXPECT_EQ(0U, asmb.size());
 
   // Flood with incomplete messages.
   for (size_t i = 0; i < 101; i++) {
     asmb.add(i, 1, {});
   }
-  EXPECT_EQ(3U, asmb.queue_.size());
-  EXPECT_EQ(3U, asmb.mt_.size());
-  EXPECT_EQ(3U, asmb.m_.size());
+  EXPECT_EQ(3U, asmb.size());
+  // The oldest audit IDs were evicted.
+  EXPECT_EQ(nullptr, asmb.find(97));
+  EXPECT_NE(nullptr, asmb.find(98));
+  EXPECT_NE(nullptr, asmb.find(100));
 
   // Flood with complete messages.
   for (size_t i = 0; i < 101; i++) {
@@ -136,9 +140,8 @@ TEST_F(AuditTests, test_audit_assembler) {
   }
 
   // All of the queue items should have been removed.
-  EXPECT_EQ(0U, asmb.queue_.size());
-  EXPECT_EQ(0U, asmb.mt_.size());
-  EXPECT_EQ(0U, asmb.m_.size());
+  EXPECT_EQ(0U, asmb.size());
+  EXPECT_EQ(3U, asmb.slots_.size());
 
   asmb.start(3U, {1, 2, 3}, &SimpleUpdate);
   EXPECT_FALSE(asmb.add(1, 1, expected_fields).is_initialized());
@@ -152,6 +155,107 @@ TEST_F(AuditTests, test_audit_assembler) {
   auto fields = asmb.add(1, 3, expected_fields);
   EXPECT_TRUE(fields.is_initialized());
   EXPECT_EQ(*fields, expected_fields);
+
+  // A shuffled audit ID is evicted after newer IDs.
+  asmb.add(1, 1, expected_fields);
+  asmb.add(2, 1, expected_fields);
+  asmb.add(3, 1, expected_fields);
+  asmb.add(1, 2, expected_fields);
+  asmb.add(4, 1, expected_fields);
+  EXPECT_NE(nullptr, asmb.find(1));
+  EXPECT_EQ(nullptr, asmb.find(2));
+
+  // Explicit fields are only set on in-progress audit IDs.
+  asmb.set(1, "action", "bind");
+  asmb.set(2, "action", "bind");
+  EXPECT_EQ("bind", asmb.find(1)->fields["action"]);
+  EXPECT_EQ(nullptr, asmb.find(2));
+}
+
+bool RejectUpdate(size_t t, const AuditFields& f, AuditFields& m) {
+  return t != 1;
+}
+
+TEST_F(AuditTests, test_audit_assembler_reject) {
+  AuditAssembler asmb;
+  asmb.start(3U, {1, 2}, &RejectUpdate);
+
+  // A rejected first message does not claim a slot.
+  EXPECT_FALSE(asmb.add(1, 1, {}).is_initialized());
+  EXPECT_FALSE(asmb.contains(1));
+  EXPECT_EQ(0U, asmb.size());
+
+  EXPECT_FALSE(asmb.add(2, 2, {}).is_initialized());
+  EXPECT_TRUE(asmb.contains(2));
+  EXPECT_TRUE(asmb.expects(2));
+  EXPECT_FALSE(asmb.expects(3));
+}
+
+TEST_F(AuditTests, test_audit_assembled_matcher) {
+  auto raw = AuditEventPublisher::createSubscriptionContext();
+  raw->rules.push_back({59, ""});
+  raw->types.insert(AUDIT_PATH);
+
+  auto assembling = AuditEventPublisher::createSubscriptionContext();
+  assembling->rules.push_back({59, ""});
+  assembling->assembly.capacity = 10;
+  assembling->assembly.types = {AUDIT_SYSCALL, AUDIT_PATH};
+
+  EventSubscriberID raw_name = "raw";
+  EventSubscriberID assembling_name = "assembling";
+  SubscriptionVector subscriptions = {
+      Subscription::create(raw_name, raw),
+      Subscription::create(assembling_name, assembling),
+  };
+  AuditSubscriptionMatcher matcher(subscriptions);
+
+  // Individual records are only matched to subscriptions without assembly.
+  auto ec = AuditEventPublisher::createEventContext();
+  ec->type = AUDIT_SYSCALL;
+  ec->syscall = 59;
+  std::vector<size_t> targets;
+  matcher.match(ec, targets);
+  EXPECT_EQ(std::vector<size_t>({0}), targets);
+
+  ec->type = AUDIT_PATH;
+  ec->syscall = 0;
+  matcher.match(ec, targets);
+  EXPECT_EQ(std::vector<size_t>({0}), targets);
+
+  // Assembled events are matched to their assembling subscription.
+  auto aec = AuditEventPublisher::createEventContext();
+  aec->type = AUDIT_SYSCALL;
+  aec->assembled = std::make_shared<const AuditFields>();
+  aec->assembly = 0;
+  matcher.match(aec, targets);
+  EXPECT_EQ(std::vector<size_t>({1}), targets);
+
+  aec->assembly = 1;
+  matcher.match(aec, targets);
+  EXPECT_TRUE(targets.empty());
+}
+
+TEST_F(AuditTests, test_audit_field_tokenizer) {
+  std::string message = "argc=3 a0=\"H=1 \"  a1=\"/bin/sh\"a2=c flag =x";
+  AuditFieldTokenizer tokenizer(message);
+
+  std::vector<std::pair<std::string, std::string>> tokens;
+  boost::string_ref key, value;
+  while (tokenizer.next(key, value)) {
+    // Each token is a view into the message buffer.
+    EXPECT_GE(key.data(), message.data());
+    EXPECT_LE(key.data() + key.size(), message.data() + message.size());
+    tokens.emplace_back(std::string(key), std::string(value));
+  }
+
+  std::vector<std::pair<std::string, std::string>> expected = {
+      {"argc", "3"},
+      {"a0", "\"H=1 \""},
+      {"a1", "\"/bin/sh\""},
+      {"a2", "c"},
+      {"flag", ""},
+  };
+  EXPECT_EQ(expected, tokens);
 }
 
 TEST_F(AuditTests, test_parse_sock_addr) {
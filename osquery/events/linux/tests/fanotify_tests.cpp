@@ -0,0 +1,65 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/events/linux/fanotify.h"
+
+namespace osquery {
+
+class FANotifyTests : public testing::Test {};
+
+TEST_F(FANotifyTests, test_find_mount_point) {
+  std::vector<std::string> mounts = {"/", "/home", "/usr", "/usr/local"};
+  EXPECT_EQ("/", findMountPoint(mounts, "/etc/passwd"));
+  EXPECT_EQ("/home", findMountPoint(mounts, "/home/"));
+  EXPECT_EQ("/home", findMountPoint(mounts, "/home/user/**"));
+  EXPECT_EQ("/usr/local", findMountPoint(mounts, "/usr/local/bin/%"));
+
+  // A mount is not a parent of a path that only shares a prefix.
+  EXPECT_EQ("/", findMountPoint(mounts, "/homes/user"));
+
+  // Wildcards are not considered part of the mount.
+  EXPECT_EQ("/", findMountPoint(mounts, "/usr*/local"));
+  EXPECT_EQ("", findMountPoint({"/home"}, "/etc/passwd"));
+}
+
+TEST_F(FANotifyTests, test_fanotify_match_subscription) {
+  auto pub = std::make_shared<FANotifyEventPublisher>();
+  auto sc = pub->createSubscriptionContext();
+  auto ec = pub->createEventContext();
+  ec->event = std::make_shared<struct inotify_event>();
+  ec->event->mask = IN_MODIFY;
+
+  // A recursive pattern matches any depth.
+  sc->path = "/etc/**";
+  ec->path = "/etc/ssh/sshd_config";
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+
+  // A directory matches only files directly within the directory.
+  sc->path = "/etc";
+  EXPECT_FALSE(pub->shouldFire(sc, ec));
+  ec->path = "/etc/passwd";
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+
+  // Leaf wildcards use a path match.
+  sc->path = "/etc/pass*";
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+  sc->path = "/etc/shadow";
+  EXPECT_FALSE(pub->shouldFire(sc, ec));
+
+  // Access events require the access masks.
+  sc->path = "/etc/passwd";
+  ec->event->mask = IN_ACCESS;
+  EXPECT_FALSE(pub->shouldFire(sc, ec));
+  sc->mask = kFileAccessMasks;
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+}
+}
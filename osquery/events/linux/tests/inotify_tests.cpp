@@ -103,6 +103,7 @@ class INotifyTests : public testing::Test {
 
   void RemoveAll(std::shared_ptr<INotifyEventPublisher>& pub) {
     pub->subscriptions_.clear();
+    pub->subscriptions_version_++;
     // Reset monitors.
     std::vector<std::string> monitors;
     for (const auto& path : pub->path_descriptors_) {
@@ -301,6 +302,7 @@ class TestINotifyEventSubscriber
   FRIEND_TEST(INotifyTests, test_inotify_event_action);
   FRIEND_TEST(INotifyTests, test_inotify_optimization);
   FRIEND_TEST(INotifyTests, test_inotify_directory_watch);
+  FRIEND_TEST(INotifyTests, test_inotify_created_directory);
   FRIEND_TEST(INotifyTests, test_inotify_recursion);
   FRIEND_TEST(INotifyTests, test_inotify_embedded_wildcards);
 };
@@ -423,6 +425,65 @@ TEST_F(INotifyTests, test_inotify_directory_watch) {
   StopEventLoop();
 }
 
+TEST_F(INotifyTests, test_inotify_incremental_configure) {
+  StartEventLoop();
+  fs::create_directories(real_test_sub_dir);
+
+  SubscriptionAction(real_test_dir);
+  ASSERT_EQ(event_pub_->numDescriptors(), 1U);
+  auto watch = event_pub_->path_descriptors_.at(real_test_dir + "/");
+
+  // Configuring again keeps the existing watch.
+  event_pub_->configure();
+  ASSERT_EQ(event_pub_->numDescriptors(), 1U);
+  EXPECT_EQ(event_pub_->path_descriptors_.at(real_test_dir + "/").descriptor,
+            watch.descriptor);
+
+  // An added subscription only adds its own watch.
+  SubscriptionAction(real_test_sub_dir);
+  ASSERT_EQ(event_pub_->numDescriptors(), 2U);
+  EXPECT_EQ(event_pub_->path_descriptors_.at(real_test_dir + "/").descriptor,
+            watch.descriptor);
+
+  // Watches are removed when their subscriptions are removed.
+  event_pub_->removeSubscriptions("TestSubscriber");
+  event_pub_->configure();
+  EXPECT_EQ(event_pub_->numDescriptors(), 0U);
+  StopEventLoop();
+}
+
+TEST_F(INotifyTests, test_inotify_created_directory) {
+  StartEventLoop();
+  fs::create_directory(real_test_dir);
+
+  auto sub = std::make_shared<TestINotifyEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+
+  auto mc = sub->createSubscriptionContext();
+  mc->path = real_test_dir;
+  mc->recursive = true;
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, mc);
+  event_pub_->configure();
+  ASSERT_EQ(event_pub_->numDescriptors(), 1U);
+
+  // The publisher watches a directory created within the recursive watch.
+  fs::create_directory(real_test_sub_dir);
+  size_t delay = 0;
+  while (event_pub_->numDescriptors() < 2 && delay < kMaxEventLatency) {
+    delay += 50;
+    ::usleep(50 * 1000);
+  }
+  ASSERT_EQ(event_pub_->numDescriptors(), 2U);
+  EXPECT_EQ(event_pub_->path_descriptors_.count(real_test_sub_dir + "/"), 1U);
+
+  // Files within the new directory fire events.
+  auto count = sub->count();
+  TriggerEvent(real_test_sub_dir_path);
+  sub->WaitForEvents(kMaxEventLatency, count + 1);
+  EXPECT_GT(sub->count(), count);
+  StopEventLoop();
+}
+
 TEST_F(INotifyTests, test_inotify_recursion) {
   // Create a non-registered publisher and subscriber.
   auto pub = std::make_shared<INotifyEventPublisher>();
@@ -501,4 +562,97 @@ TEST_F(INotifyTests, test_inotify_embedded_wildcards) {
   ASSERT_EQ(event_pub_->numDescriptors(), 1U);
   EXPECT_EQ(event_pub_->path_descriptors_.count(real_test_dir + "/2/1/"), 1U);
 }
+
+TEST_F(INotifyTests, test_inotify_subscription_matcher) {
+  SubscriptionVector subscriptions;
+  auto add = [&subscriptions](const std::string& path, uint32_t mask) {
+    auto sc = std::make_shared<INotifySubscriptionContext>();
+    sc->path = path;
+    sc->mask = mask;
+    subscriptions.push_back(Subscription::create("subscriber", sc));
+  };
+  add("/etc/", 0);
+  add("/etc/hosts", IN_MODIFY);
+  add("/home/*/.ssh/", 0);
+  add("/var/", IN_CREATE);
+  INotifySubscriptionMatcher matcher(subscriptions);
+
+  auto ec = std::make_shared<INotifyEventContext>();
+  ec->event = std::make_shared<struct inotify_event>();
+  ec->event->mask = IN_MODIFY;
+  ec->path = "/etc/hosts";
+  std::vector<size_t> targets;
+  matcher.match(ec, targets);
+  EXPECT_EQ(std::vector<size_t>({0, 1}), targets);
+
+  // Subscriptions requiring other actions are not selected.
+  ec->event->mask = IN_ATTRIB;
+  matcher.match(ec, targets);
+  EXPECT_EQ(std::vector<size_t>({0}), targets);
+
+  // Paths are selected by the literal prefix before a wildcard.
+  ec->path = "/home/osquery/.ssh/authorized_keys";
+  matcher.match(ec, targets);
+  EXPECT_EQ(std::vector<size_t>({2}), targets);
+
+  ec->path = "/var/log/syslog";
+  matcher.match(ec, targets);
+  EXPECT_TRUE(targets.empty());
+}
+
+TEST_F(INotifyTests, test_event_coalescer) {
+  EventCoalescer<INotifyEventContext> coalescer(100);
+  auto first = std::make_shared<INotifyEventContext>();
+  auto second = std::make_shared<INotifyEventContext>();
+  auto other = std::make_shared<INotifyEventContext>();
+  EXPECT_EQ(-1, coalescer.timeout(0));
+
+  // The second event for a key replaces the first.
+  EXPECT_FALSE(coalescer.add("UPDATED:/tmp/a", first, 1000));
+  EXPECT_FALSE(coalescer.add("UPDATED:/tmp/b", other, 1050));
+  EXPECT_TRUE(coalescer.add("UPDATED:/tmp/a", second, 1090));
+  EXPECT_EQ(2U, coalescer.size());
+
+  // The window is not extended by merged events.
+  EXPECT_EQ(10, coalescer.timeout(1090));
+  std::vector<INotifyEventContextRef> ready;
+  coalescer.expire(1099, ready);
+  EXPECT_TRUE(ready.empty());
+  coalescer.expire(1100, ready);
+  ASSERT_EQ(1U, ready.size());
+  EXPECT_EQ(second, ready[0]);
+  EXPECT_EQ(50, coalescer.timeout(1100));
+
+  // Expiring all events ignores the window.
+  ready.clear();
+  coalescer.expire(0, ready, true);
+  ASSERT_EQ(1U, ready.size());
+  EXPECT_EQ(other, ready[0]);
+  EXPECT_EQ(0U, coalescer.size());
+}
+
+TEST_F(INotifyTests, test_inotify_coalesce) {
+  event_pub_ = std::make_shared<INotifyEventPublisher>();
+  event_pub_->coalescer_.setWindow(100);
+
+  auto ec = std::make_shared<INotifyEventContext>();
+  ec->path = real_test_path;
+  ec->action = "UPDATED";
+  for (size_t i = 0; i < 3; i++) {
+    event_pub_->publish(ec);
+  }
+
+  // The burst is held as a single event, and the merges are counted.
+  EXPECT_EQ(1U, event_pub_->coalescer_.size());
+  EXPECT_EQ(2U, event_pub_->numCoalesced());
+  EXPECT_EQ(0U, event_pub_->numEvents());
+
+  // The held event fires after the window.
+  event_pub_->firePending();
+  EXPECT_EQ(1U, event_pub_->coalescer_.size());
+  ::usleep(150 * 1000);
+  event_pub_->firePending();
+  EXPECT_EQ(0U, event_pub_->coalescer_.size());
+  EXPECT_EQ(1U, event_pub_->numEvents());
+}
 }
@@ -0,0 +1,83 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "osquery/events/linux/reactor.h"
+
+namespace osquery {
+
+class EventReactorTests : public testing::Test {
+ public:
+  void SetUp() override {
+    ASSERT_EQ(0, ::pipe(fds_));
+  }
+
+  void TearDown() override {
+    ::close(fds_[0]);
+    ::close(fds_[1]);
+  }
+
+ protected:
+  int fds_[2];
+};
+
+TEST_F(EventReactorTests, test_wait) {
+  EventReactor reactor;
+  ASSERT_TRUE(reactor.isValid());
+  EXPECT_TRUE(reactor.addHandle(fds_[0]).ok());
+
+  // Nothing is readable, a bounded wait times out.
+  std::vector<int> ready;
+  EXPECT_TRUE(reactor.wait(ready, 0).ok());
+  EXPECT_TRUE(ready.empty());
+
+  EXPECT_EQ(1, ::write(fds_[1], "r", 1));
+  EXPECT_TRUE(reactor.wait(ready, 0).ok());
+  ASSERT_EQ(1U, ready.size());
+  EXPECT_EQ(fds_[0], ready[0]);
+
+  // Each wait replaces the descriptors of a previous wait.
+  char byte = 0;
+  EXPECT_EQ(1, ::read(fds_[0], &byte, 1));
+  EXPECT_TRUE(reactor.wait(ready, 0).ok());
+  EXPECT_TRUE(ready.empty());
+
+  // Removed descriptors are not returned.
+  EXPECT_EQ(1, ::write(fds_[1], "r", 1));
+  reactor.removeHandle(fds_[0]);
+  EXPECT_TRUE(reactor.wait(ready, 0).ok());
+  EXPECT_TRUE(ready.empty());
+}
+
+TEST_F(EventReactorTests, test_interrupt) {
+  EventReactor reactor;
+  reactor.addHandle(fds_[0]);
+
+  // An unbounded wait returns when another thread interrupts.
+  std::thread waiter([&reactor]() {
+    std::vector<int> ready;
+    EXPECT_FALSE(reactor.wait(ready).ok());
+  });
+  reactor.interrupt();
+  waiter.join();
+
+  // The interruption remains until the reactor is reset.
+  std::vector<int> ready;
+  EXPECT_FALSE(reactor.wait(ready, 0).ok());
+  reactor.reset();
+  EXPECT_TRUE(reactor.wait(ready, 0).ok());
+}
+}
@@ -8,11 +8,14 @@
  *
  */
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <vector>
 
 #include <gtest/gtest.h>
 
-#include <boost/tokenizer.hpp>
+#include <osquery/flags.h>
 
 #include "osquery/events/linux/syslog.h"
 #include "osquery/tests/test_util.h"
@@ -22,12 +25,24 @@ namespace osquery {
 class SyslogTests : public testing::Test {
  public:
   std::vector<std::string> splitCsv(std::string line) {
-    boost::tokenizer<RsyslogCsvSeparator> tokenizer(line);
-    std::vector<std::string> result(tokenizer.begin(), tokenizer.end());
+    std::vector<std::string> result;
+    if (line.empty()) {
+      return result;
+    }
+
+    const char* next = line.data();
+    std::string value;
+    while (parseRsyslogCsvField(next, line.data() + line.size(), value)) {
+      result.push_back(value);
+    }
+    result.push_back(value);
     return result;
   }
 };
 
+DECLARE_uint64(syslog_rate_limit);
+DECLARE_bool(syslog_drop_excess);
+
 TEST_F(SyslogTests, test_populate_event_context) {
   std::string line =
       R"|("2016-03-22T21:17:01.701882+00:00","vagrant-ubuntu-trusty-64","6","cron","CRON[16538]:"," (root) CMD (   cd / && run-parts --report /etc/cron.hourly)")|";
@@ -80,4 +95,76 @@ TEST_F(SyslogTests, test_csv_separator) {
   ASSERT_EQ(std::vector<std::string>({"\",f\\ø\"o,", "\",bá\\'r", "baz\\,\""}),
             splitCsv("\"\"\",f\\ø\"\"o,\",\"\"\",bá\\'r\",\"baz\\,\"\"\""));
 }
+
+TEST_F(SyslogTests, test_read_lines) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+  SyslogEventPublisher pub;
+  pub.readFd_ = fds[0];
+  pub.buffer_.resize(128);
+
+  auto rate_limit = FLAGS_syslog_rate_limit;
+  auto drop_excess = FLAGS_syslog_drop_excess;
+  FLAGS_syslog_rate_limit = 2;
+  FLAGS_syslog_drop_excess = false;
+
+  // Three complete lines and the start of a fourth.
+  std::string lines =
+      "\"t\",\"h\",\"6\",\"cron\",\"tag:\",\"one\"\n"
+      "\"t\",\"h\",\"6\",\"cron\",\"tag:\",\"two\"\n"
+      "\"t\",\"h\",\"6\",\"cron\",\"tag:\",\"three\"\n"
+      "\"t\",\"h\"";
+  ASSERT_EQ(static_cast<ssize_t>(lines.size()),
+            write(fds[1], lines.data(), lines.size()));
+
+  // The rate limit leaves the third line and the partial line buffered.
+  EXPECT_TRUE(pub.run().ok());
+  EXPECT_EQ(0U, pub.numDropped());
+  std::string buffered(pub.buffer_.data(), pub.buffered_);
+  EXPECT_EQ("\"t\",\"h\",\"6\",\"cron\",\"tag:\",\"three\"\n\"t\",\"h\"",
+            buffered);
+
+  // Finishing the partial line fires both.
+  std::string rest = ",\"6\",\"cron\",\"tag:\",\"four\"\n";
+  write(fds[1], rest.data(), rest.size());
+  EXPECT_TRUE(pub.run().ok());
+  EXPECT_EQ(0U, pub.buffered_);
+
+  // A line longer than the buffer is dropped, the next line is kept.
+  std::string overflow(200, 'x');
+  overflow += "\n\"t\",\"h\",\"6\",\"cron\",\"tag:\",\"five\"\n";
+  write(fds[1], overflow.data(), overflow.size());
+  EXPECT_TRUE(pub.run().ok());
+  EXPECT_EQ(1U, pub.numDropped());
+  EXPECT_FALSE(pub.skipping_);
+  EXPECT_EQ(0U, pub.buffered_);
+
+  // Lines over the rate limit may be dropped from the pipe.
+  FLAGS_syslog_drop_excess = true;
+  std::string excess;
+  for (size_t i = 0; i < 5; i++) {
+    excess += "\"t\",\"h\",\"6\",\"cron\",\"tag:\",\"excess\"\n";
+  }
+  write(fds[1], excess.data(), excess.size());
+  EXPECT_TRUE(pub.run().ok());
+  // The fourth line was partly buffered and is dropped with the fifth.
+  EXPECT_EQ(3U, pub.numDropped());
+  buffered = std::string(pub.buffer_.data(), pub.buffered_);
+  EXPECT_EQ("\"t\",\"h\",\"6\",\"cron\",\"tag:\",\"excess\"\n",
+            buffered);
+  std::string remaining;
+  char byte;
+  while (read(fds[0], &byte, 1) == 1) {
+    remaining += byte;
+  }
+  EXPECT_TRUE(remaining.empty());
+
+  FLAGS_syslog_rate_limit = rate_limit;
+  FLAGS_syslog_drop_excess = drop_excess;
+  pub.readFd_ = -1;
+  close(fds[0]);
+  close(fds[1]);
+}
 }
@@ -0,0 +1,89 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "osquery/events/linux/tracing.h"
+
+namespace osquery {
+
+class TracingTests : public testing::Test {};
+
+const std::string kExecFormat =
+    "name: sched_process_exec\n"
+    "ID: 316\n"
+    "format:\n"
+    "\tfield:unsigned short common_type;\toffset:0;\tsize:2;\tsigned:0;\n"
+    "\tfield:unsigned char common_flags;\toffset:2;\tsize:1;\tsigned:0;\n"
+    "\tfield:int common_pid;\toffset:4;\tsize:4;\tsigned:1;\n"
+    "\n"
+    "\tfield:__data_loc char[] filename;\toffset:8;\tsize:4;\tsigned:1;\n"
+    "\tfield:pid_t pid;\toffset:12;\tsize:4;\tsigned:1;\n"
+    "\tfield:char comm[8];\toffset:16;\tsize:8;\tsigned:1;\n"
+    "\tfield:__u8 saddr[4];\toffset:24;\tsize:4;\tsigned:0;\n"
+    "\n"
+    "print fmt: \"filename=%s pid=%d\", __get_str(filename), REC->pid\n";
+
+TEST_F(TracingTests, test_parse_format) {
+  TracepointFormat format;
+  ASSERT_TRUE(parseTracepointFormat(kExecFormat, format).ok());
+  EXPECT_EQ(316U, format.id);
+
+  // The common fields are not included.
+  ASSERT_EQ(4U, format.fields.size());
+  EXPECT_EQ("filename", format.fields[0].name);
+  EXPECT_TRUE(format.fields[0].is_dynamic);
+  EXPECT_EQ("pid", format.fields[1].name);
+  EXPECT_EQ(12U, format.fields[1].offset);
+  EXPECT_EQ(4U, format.fields[1].size);
+  EXPECT_TRUE(format.fields[1].is_signed);
+  EXPECT_EQ("comm", format.fields[2].name);
+  EXPECT_TRUE(format.fields[2].is_string);
+  EXPECT_EQ("saddr", format.fields[3].name);
+  EXPECT_TRUE(format.fields[3].is_array);
+
+  // A format without an ID cannot be opened.
+  TracepointFormat invalid;
+  EXPECT_FALSE(parseTracepointFormat("format:\n", invalid).ok());
+}
+
+TEST_F(TracingTests, test_decode_fields) {
+  TracepointFormat format;
+  ASSERT_TRUE(parseTracepointFormat(kExecFormat, format).ok());
+
+  // Build a raw record with the dynamic string following the fixed fields.
+  char record[40] = {0};
+  std::string filename = "/bin/ls";
+  uint32_t location = ((filename.size() + 1) << 16) | 28;
+  memcpy(record + 8, &location, sizeof(location));
+  int32_t pid = -2;
+  memcpy(record + 12, &pid, sizeof(pid));
+  memcpy(record + 16, "ls", 2);
+  record[24] = 127;
+  record[27] = 1;
+  memcpy(record + 28, filename.c_str(), filename.size() + 1);
+
+  TracingFields fields;
+  decodeTracepointFields(format, record, sizeof(record), fields);
+  EXPECT_EQ("/bin/ls", fields["filename"]);
+  EXPECT_EQ("-2", fields["pid"]);
+  EXPECT_EQ("ls", fields["comm"]);
+  EXPECT_EQ(std::string("\x7f\x00\x00\x01", 4), fields["saddr"]);
+
+  // Fields beyond a truncated record are not decoded.
+  fields.clear();
+  decodeTracepointFields(format, record, 16, fields);
+  EXPECT_EQ(1U, fields.count("pid"));
+  EXPECT_EQ(0U, fields.count("comm"));
+  EXPECT_EQ(0U, fields.count("filename"));
+}
+}
@@ -0,0 +1,410 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string.h>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/linux/tracing.h"
+
+namespace osquery {
+
+/// Tracepoints are an alternative to audit for process and socket events.
+FLAG(bool,
+     disable_tracing,
+     true,
+     "Disable receiving events from kernel tracepoints");
+
+FLAG(uint64,
+     tracing_buffer_pages,
+     64,
+     "Data pages in each per-CPU tracepoint ring buffer (default 64)");
+
+REGISTER(TracingEventPublisher, "event_publisher", "tracing");
+
+/// Locations of the tracing filesystem's events directory.
+const std::vector<std::string> kTracingEventsPaths = {
+    "/sys/kernel/debug/tracing/events", "/sys/kernel/tracing/events",
+};
+
+/// Copy bytes from a ring buffer, which may wrap at the end of the data.
+static void copyRing(const char* data,
+                     size_t data_size,
+                     size_t offset,
+                     void* dest,
+                     size_t size) {
+  auto first = std::min(size, data_size - offset);
+  memcpy(dest, data + offset, first);
+  if (first < size) {
+    memcpy(static_cast<char*>(dest) + first, data, size - first);
+  }
+}
+
+Status parseTracepointFormat(const std::string& content,
+                             TracepointFormat& format) {
+  format.fields.clear();
+  for (const auto& line : osquery::split(content, "\n")) {
+    if (line.find("ID:") == 0) {
+      unsigned long int id = 0;
+      if (!safeStrtoul(boost::algorithm::trim_copy(line.substr(3)), 10, id)) {
+        return Status(1, "Invalid tracepoint ID");
+      }
+      format.id = id;
+      continue;
+    }
+
+    auto start = line.find("field:");
+    if (start == std::string::npos) {
+      continue;
+    }
+
+    // Each field is described as: field:<declaration>; offset:N; size:N; ...
+    TracepointField field;
+    std::string declaration;
+    for (const auto& part : osquery::split(line.substr(start), ";")) {
+      auto trimmed = boost::algorithm::trim_copy(part);
+      unsigned long int value = 0;
+      if (trimmed.find("field:") == 0) {
+        declaration = trimmed.substr(6);
+      } else if (trimmed.find("offset:") == 0 &&
+                 safeStrtoul(trimmed.substr(7), 10, value)) {
+        field.offset = value;
+      } else if (trimmed.find("size:") == 0 &&
+                 safeStrtoul(trimmed.substr(5), 10, value)) {
+        field.size = value;
+      } else if (trimmed.find("signed:") == 0) {
+        field.is_signed = (trimmed.substr(7) == "1");
+      }
+    }
+
+    // The field name is the last token of the declaration.
+    auto name_start = declaration.find_last_of(' ');
+    if (name_start == std::string::npos || field.size == 0) {
+      continue;
+    }
+    field.name = declaration.substr(name_start + 1);
+    auto dimension = field.name.find('[');
+    if (dimension != std::string::npos) {
+      field.name = field.name.substr(0, dimension);
+      field.is_array = true;
+    }
+
+    if (declaration.find("__data_loc") == 0) {
+      field.is_dynamic = true;
+      field.is_array = false;
+    } else if (field.is_array &&
+               declaration.find("char") != std::string::npos) {
+      field.is_string = true;
+      field.is_array = false;
+    }
+
+    if (field.name.find("common_") != 0) {
+      format.fields.push_back(std::move(field));
+    }
+  }
+
+  if (format.id == 0) {
+    return Status(1, "Tracepoint format has no ID");
+  }
+  return Status(0, "OK");
+}
+
+void decodeTracepointFields(const TracepointFormat& format,
+                            const char* data,
+                            size_t size,
+                            TracingFields& fields) {
+  for (const auto& field : format.fields) {
+    if (field.offset + field.size > size) {
+      continue;
+    }
+
+    auto value = data + field.offset;
+    if (field.is_dynamic) {
+      // The lower 16 bits are the string's offset, the upper are its length.
+      uint32_t location = 0;
+      memcpy(&location, value, sizeof(location));
+      size_t string_offset = location & 0xffff;
+      size_t string_size = location >> 16;
+      if (string_offset + string_size <= size) {
+        auto string = data + string_offset;
+        fields[field.name] = std::string(string, strnlen(string, string_size));
+      }
+    } else if (field.is_string) {
+      fields[field.name] = std::string(value, strnlen(value, field.size));
+    } else if (field.is_array ||
+               (field.size != 1 && field.size != 2 && field.size != 4 &&
+                field.size != 8)) {
+      fields[field.name] = std::string(value, field.size);
+    } else if (field.is_signed) {
+      int64_t number = 0;
+      if (field.size == 1) {
+        number = *reinterpret_cast<const int8_t*>(value);
+      } else if (field.size == 2) {
+        int16_t n;
+        memcpy(&n, value, sizeof(n));
+        number = n;
+      } else if (field.size == 4) {
+        int32_t n;
+        memcpy(&n, value, sizeof(n));
+        number = n;
+      } else {
+        memcpy(&number, value, sizeof(number));
+      }
+      fields[field.name] = std::to_string(number);
+    } else {
+      uint64_t number = 0;
+      // Tracepoint records use the host byte order.
+      memcpy(&number, value, field.size);
+      fields[field.name] = std::to_string(number);
+    }
+  }
+}
+
+Status addTracingSubscription(EventSubscriberID& subscriber,
+                              std::set<std::string> tracepoints,
+                              TracingCallback callback) {
+  auto sc = TracingEventPublisher::createSubscriptionContext();
+  sc->tracepoints = std::move(tracepoints);
+  return EventFactory::addSubscription(
+      "tracing",
+      subscriber,
+      sc,
+      [callback](const EventContextRef& ec, const SubscriptionContextRef&) {
+        return callback(std::static_pointer_cast<TracingEventContext>(ec));
+      });
+}
+
+Status TracingEventPublisher::setUp() {
+  if (FLAGS_disable_tracing) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  for (const auto& path : kTracingEventsPaths) {
+    if (isReadable(path).ok()) {
+      events_path_ = path;
+      break;
+    }
+  }
+
+  if (events_path_.empty()) {
+    return Status(1, "Cannot read the kernel tracing filesystem");
+  }
+
+  reactor_.reset();
+  return Status(0, "OK");
+}
+
+void TracingEventPublisher::configure() {
+  if (events_path_.empty()) {
+    return;
+  }
+
+  std::set<std::string> tracepoints;
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    tracepoints.insert(sc->tracepoints.begin(), sc->tracepoints.end());
+  }
+
+  WriteLock lock(rings_lock_);
+  if (tracepoints == tracepoints_) {
+    // The requested tracepoints are already open.
+    return;
+  }
+
+  closeRings();
+  tracepoints_ = tracepoints;
+
+  auto cpus = sysconf(_SC_NPROCESSORS_CONF);
+  for (const auto& tracepoint : tracepoints_) {
+    std::string content;
+    auto format = std::make_shared<TracepointFormat>();
+    auto path = events_path_ + "/" + tracepoint + "/format";
+    auto status = readFile(path, content);
+    if (status.ok()) {
+      status = parseTracepointFormat(content, *format);
+    }
+
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot read tracepoint " << tracepoint << ": "
+                   << status.getMessage();
+      continue;
+    }
+
+    // Offline CPUs cannot be opened, each tracepoint needs at least one ring.
+    size_t opened = 0;
+    for (int cpu = 0; cpu < cpus; cpu++) {
+      if (openRing(tracepoint, format, cpu).ok()) {
+        opened++;
+      }
+    }
+
+    if (opened == 0) {
+      LOG(WARNING) << "Cannot open tracepoint " << tracepoint;
+    }
+  }
+}
+
+Status TracingEventPublisher::openRing(
+    const std::string& tracepoint,
+    const std::shared_ptr<TracepointFormat>& format,
+    int cpu) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_TRACEPOINT;
+  attr.size = sizeof(attr);
+  attr.config = format->id;
+  attr.sample_period = 1;
+  attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_RAW;
+  attr.wakeup_events = 1;
+  attr.disabled = 1;
+
+  int fd = static_cast<int>(
+      syscall(__NR_perf_event_open, &attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC));
+  if (fd < 0) {
+    return Status(1, "Cannot open perf event");
+  }
+
+  // The data pages must be a power of two.
+  size_t pages = 1;
+  while (pages < FLAGS_tracing_buffer_pages) {
+    pages <<= 1;
+  }
+
+  TracingRing ring;
+  ring.fd = fd;
+  ring.length = (pages + 1) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  ring.base =
+      mmap(nullptr, ring.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ring.base == MAP_FAILED) {
+    close(fd);
+    return Status(1, "Cannot map perf event ring");
+  }
+
+  ring.tracepoint = tracepoint;
+  ring.format = format;
+  reactor_.addHandle(fd);
+  ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  rings_[fd] = std::move(ring);
+  return Status(0, "OK");
+}
+
+void TracingEventPublisher::closeRings() {
+  for (auto& ring : rings_) {
+    ioctl(ring.second.fd, PERF_EVENT_IOC_DISABLE, 0);
+    reactor_.removeHandle(ring.second.fd);
+    munmap(ring.second.base, ring.second.length);
+    close(ring.second.fd);
+  }
+  rings_.clear();
+}
+
+void TracingEventPublisher::tearDown() {
+  WriteLock lock(rings_lock_);
+  closeRings();
+  tracepoints_.clear();
+}
+
+void TracingEventPublisher::readRing(TracingRing& ring) {
+  auto page = static_cast<struct perf_event_mmap_page*>(ring.base);
+  auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  auto data = static_cast<const char*>(ring.base) + page_size;
+  auto data_size = ring.length - page_size;
+
+  // The kernel writes the head, records before the head are complete.
+  uint64_t head = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+
+  uint64_t tail = page->data_tail;
+  while (tail < head) {
+    struct perf_event_header header;
+    auto offset = static_cast<size_t>(tail % data_size);
+    copyRing(data, data_size, offset, &header, sizeof(header));
+    if (header.size < sizeof(header)) {
+      // The ring is corrupt, drop the remaining records.
+      tail = head;
+      break;
+    }
+
+    if (record_.size() < header.size) {
+      record_.resize(header.size);
+    }
+    copyRing(data, data_size, offset, record_.data(), header.size);
+
+    if (header.type == PERF_RECORD_SAMPLE) {
+      // The sample contains: u32 pid, u32 tid, u32 size, char data[size].
+      struct {
+        uint32_t pid;
+        uint32_t tid;
+        uint32_t size;
+      } sample;
+      if (header.size >= sizeof(header) + sizeof(sample)) {
+        memcpy(&sample, record_.data() + sizeof(header), sizeof(sample));
+        auto raw = record_.data() + sizeof(header) + sizeof(sample);
+        auto raw_size = std::min(static_cast<size_t>(sample.size),
+                                 header.size - sizeof(header) - sizeof(sample));
+
+        auto ec = createEventContext();
+        ec->tracepoint = ring.tracepoint;
+        ec->pid = sample.pid;
+        ec->tid = sample.tid;
+        decodeTracepointFields(*ring.format, raw, raw_size, ec->fields);
+        fire(ec);
+      }
+    } else if (header.type == PERF_RECORD_LOST) {
+      // The lost record contains: u64 id, u64 lost.
+      uint64_t lost[2] = {0, 0};
+      if (header.size >= sizeof(header) + sizeof(lost)) {
+        memcpy(lost, record_.data() + sizeof(header), sizeof(lost));
+        lost_ += lost[1];
+      }
+    }
+    tail += header.size;
+  }
+
+  // Release the space only after every record has been read.
+  __atomic_store_n(&page->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+Status TracingEventPublisher::run() {
+  // Block until a ring is readable, the publisher's stop interrupts.
+  std::vector<int> ready;
+  auto status = reactor_.wait(ready);
+  if (!status.ok()) {
+    if (isEnding()) {
+      return Status(0, "Ending");
+    }
+    return Status(1, "Tracing wait failed");
+  }
+
+  ReadLock lock(rings_lock_);
+  for (const auto& fd : ready) {
+    auto ring = rings_.find(fd);
+    if (ring != rings_.end()) {
+      readRing(ring->second);
+    }
+  }
+  return Status(0, "OK");
+}
+
+bool TracingEventPublisher::shouldFire(const TracingSubscriptionContextRef& sc,
+                                       const TracingEventContextRef& ec) const {
+  return sc->tracepoints.count(ec->tracepoint) > 0;
+}
+}
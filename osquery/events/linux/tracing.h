@@ -0,0 +1,221 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/reactor.h"
+
+namespace osquery {
+
+/// Tracepoint field names mapped to their decoded values.
+using TracingFields = std::map<std::string, std::string>;
+
+/// A single field described by a tracepoint's format file.
+struct TracepointField {
+  /// The field name, without array dimensions.
+  std::string name;
+
+  /// Offset of the field within the raw record.
+  size_t offset{0};
+
+  /// Size of the field in bytes.
+  size_t size{0};
+
+  /// The field is a signed integer.
+  bool is_signed{false};
+
+  /// The field is a fixed char array, decoded as a string.
+  bool is_string{false};
+
+  /// The field is a fixed array of other types, decoded as raw bytes.
+  bool is_array{false};
+
+  /// The field is a __data_loc offset and length of a dynamic string.
+  bool is_dynamic{false};
+};
+
+/// The fields of a tracepoint, excluding the common header fields.
+struct TracepointFormat {
+  /// The kernel-assigned tracepoint ID.
+  size_t id{0};
+
+  std::vector<TracepointField> fields;
+};
+
+/**
+ * @brief Parse a tracepoint format file.
+ *
+ * Each field line includes a C declaration, offset, size, and signedness.
+ * The "common_" fields shared by every tracepoint are skipped.
+ */
+Status parseTracepointFormat(const std::string& content,
+                             TracepointFormat& format);
+
+/**
+ * @brief Decode a raw tracepoint record using the tracepoint format.
+ *
+ * Integers are decoded as decimal strings, char arrays and dynamic strings as
+ * strings, and other arrays (such as addresses) as raw bytes. Fields beyond
+ * the end of the record are not decoded.
+ */
+void decodeTracepointFields(const TracepointFormat& format,
+                            const char* data,
+                            size_t size,
+                            TracingFields& fields);
+
+struct TracingSubscriptionContext : public SubscriptionContext {
+  /**
+   * @brief The tracepoints this subscription requests.
+   *
+   * Each tracepoint is named by its category and event, for example
+   * "sched/sched_process_exec".
+   */
+  std::set<std::string> tracepoints;
+
+ private:
+  friend class TracingEventPublisher;
+};
+
+struct TracingEventContext : public EventContext {
+  /// The tracepoint that emitted this record.
+  std::string tracepoint;
+
+  /// The process and thread ID current when the tracepoint fired.
+  pid_t pid{0};
+  pid_t tid{0};
+
+  /// The decoded tracepoint fields.
+  TracingFields fields;
+};
+
+using TracingEventContextRef = std::shared_ptr<TracingEventContext>;
+using TracingSubscriptionContextRef =
+    std::shared_ptr<TracingSubscriptionContext>;
+
+/// A tracepoint callback used by subscribers of other publishers.
+using TracingCallback = std::function<Status(const TracingEventContextRef&)>;
+
+/**
+ * @brief Subscribe to tracepoints from an EventSubscriber of another type.
+ *
+ * The process and socket event subscribers receive audit events by default.
+ * When tracing is enabled they fill the same tables from tracepoints, so
+ * queries do not change with the event source.
+ */
+Status addTracingSubscription(EventSubscriberID& subscriber,
+                              std::set<std::string> tracepoints,
+                              TracingCallback callback);
+
+/**
+ * @brief Read kernel tracepoint records from per-CPU perf ring buffers.
+ *
+ * Subscriptions name the tracepoints they need. For each tracepoint the
+ * publisher opens a perf event on every CPU, maps its ring buffer, and waits
+ * for the descriptors with an EventReactor. Records are decoded with the
+ * tracepoint's format description so subscribers do not depend on kernel
+ * structure layouts.
+ *
+ * Tracepoints are cheaper than audit syscall rules and do not take control of
+ * the audit netlink socket, so auditd may continue to run.
+ */
+class TracingEventPublisher
+    : public EventPublisher<TracingSubscriptionContext, TracingEventContext> {
+  DECLARE_PUBLISHER("tracing");
+
+ public:
+  /// Check that the tracing filesystem is available.
+  Status setUp() override;
+
+  /// Open the tracepoints requested by subscriptions.
+  void configure() override;
+
+  /// Close every tracepoint.
+  void tearDown() override;
+
+  /// Wait for ring buffers to become readable and fire their records.
+  Status run() override;
+
+  /// Wake the run loop so the EventFactory can end it.
+  void stop() override {
+    reactor_.interrupt();
+  }
+
+ public:
+  virtual ~TracingEventPublisher() {
+    tearDown();
+  }
+
+  /// The number of records the kernel dropped because a ring buffer was full.
+  size_t numLost() const {
+    return lost_;
+  }
+
+ private:
+  /// A perf event ring buffer for one tracepoint on one CPU.
+  struct TracingRing {
+    /// The perf event descriptor.
+    int fd{-1};
+
+    /// The mapped control page followed by the data pages.
+    void* base{nullptr};
+
+    /// The size of the mapping in bytes.
+    size_t length{0};
+
+    /// The tracepoint name and its format.
+    std::string tracepoint;
+    std::shared_ptr<TracepointFormat> format;
+  };
+
+  /// Open a ring for a tracepoint on a CPU.
+  Status openRing(const std::string& tracepoint,
+                  const std::shared_ptr<TracepointFormat>& format,
+                  int cpu);
+
+  /// Unmap and close every ring, the rings lock must be held.
+  void closeRings();
+
+  /// Fire each record in a ring and release the space to the kernel.
+  void readRing(TracingRing& ring);
+
+  /// Apply normal subscription to event matching logic.
+  bool shouldFire(const TracingSubscriptionContextRef& sc,
+                  const TracingEventContextRef& ec) const override;
+
+ private:
+  /// The tracing events directory in use.
+  std::string events_path_;
+
+  /// Open rings, keyed by perf event descriptor.
+  std::map<int, TracingRing> rings_;
+
+  /// The set of tracepoints the rings were opened for.
+  std::set<std::string> tracepoints_;
+
+  /// Protect the rings from a configure during a run loop read.
+  Mutex rings_lock_;
+
+  /// Wait for the ring buffers without polling.
+  EventReactor reactor_;
+
+  /// A copy buffer for records that wrap the end of a ring.
+  std::vector<char> record_;
+
+  /// Records dropped by the kernel.
+  std::atomic<size_t> lost_{0};
+};
+}
@@ -18,6 +18,9 @@ namespace osquery {
 
 static const int kUdevMLatency = 200;
 
+/// The most devices received per wakeup before pausing.
+static const size_t kUdevBatchSize = 128;
+
 REGISTER(UdevEventPublisher, "event_publisher", "udev");
 
 Status UdevEventPublisher::setUp() {
@@ -40,12 +43,24 @@ Status UdevEventPublisher::setUp() {
   }
 
   udev_monitor_enable_receiving(monitor_);
-  return Status(0, "OK");
+  reactor_.reset();
+  return reactor_.addHandle(udev_monitor_get_fd(monitor_));
+}
+
+bool UdevEventPublisher::isRunning() {
+  std::string type = "udev";
+  auto publisher = EventFactory::getEventPublisher(type);
+
+  // A failed setUp ends the publisher, and the state is reset after the run
+  // loop ends.
+  return publisher != nullptr && !publisher->isEnding() &&
+         publisher->state() == EventState::EVENT_SETUP;
 }
 
 void UdevEventPublisher::tearDown() {
   WriteLock lock(mutex_);
   if (monitor_ != nullptr) {
+    reactor_.removeHandle(udev_monitor_get_fd(monitor_));
     udev_monitor_unref(monitor_);
     monitor_ = nullptr;
   }
@@ -57,42 +72,52 @@ void UdevEventPublisher::tearDown() {
 }
 
 Status UdevEventPublisher::run() {
-  int fd = 0;
-  fd_set set;
-
   {
     WriteLock lock(mutex_);
     if (monitor_ == nullptr) {
       return Status(1);
     }
-    fd = udev_monitor_get_fd(monitor_);
   }
 
-  FD_ZERO(&set);
-  FD_SET(fd, &set);
-
-  struct timeval timeout = {1, 0};
-  int selector = ::select(fd + 1, &set, nullptr, nullptr, &timeout);
-  if (selector == -1) {
+  // Block until the monitor is readable, the publisher's stop interrupts.
+  std::vector<int> ready;
+  auto status = reactor_.wait(ready);
+  if (!status.ok()) {
+    if (isEnding()) {
+      return Status(0, "Ending");
+    }
     LOG(ERROR) << "Could not read udev monitor";
     return Status(1, "udev monitor failed.");
   }
 
-  if (selector == 0 || !FD_ISSET(fd, &set)) {
+  if (ready.empty()) {
     // Read timeout.
     return Status(0, "Finished");
   }
 
-  struct udev_device* device = udev_monitor_receive_device(monitor_);
-  if (device == nullptr) {
-    LOG(ERROR) << "udev monitor returned invalid device";
-    return Status(1, "udev monitor failed.");
-  }
+  // Drain the devices queued on the monitor, a hub or boot may queue many.
+  for (size_t i = 0; i < kUdevBatchSize && !interrupted(); i++) {
+    if (i > 0) {
+      // Check for another device without blocking.
+      status = reactor_.wait(ready, 0);
+      if (!status.ok() || ready.empty()) {
+        break;
+      }
+    }
 
-  auto ec = createEventContextFrom(device);
-  fire(ec);
+    struct udev_device* device = udev_monitor_receive_device(monitor_);
+    if (device == nullptr) {
+      if (i == 0) {
+        LOG(ERROR) << "udev monitor returned invalid device";
+        return Status(1, "udev monitor failed.");
+      }
+      break;
+    }
 
-  udev_device_unref(device);
+    auto ec = createEventContextFrom(device);
+    fire(ec);
+    udev_device_unref(device);
+  }
 
   pauseMilli(kUdevMLatency);
   return Status(0, "OK");
@@ -116,10 +141,30 @@ std::string UdevEventPublisher::getAttr(struct udev_device* device,
   return "";
 }
 
+const std::string& UdevEventContext::getValue(const std::string& property) {
+  WriteLock lock(values_mutex_);
+  auto it = values_.find(property);
+  if (it == values_.end()) {
+    it = values_
+             .emplace(property, UdevEventPublisher::getValue(device, property))
+             .first;
+  }
+  return it->second;
+}
+
+const std::string& UdevEventContext::getAttr(const std::string& attr) {
+  WriteLock lock(values_mutex_);
+  auto it = attrs_.find(attr);
+  if (it == attrs_.end()) {
+    it = attrs_.emplace(attr, UdevEventPublisher::getAttr(device, attr)).first;
+  }
+  return it->second;
+}
+
 UdevEventContextRef UdevEventPublisher::createEventContextFrom(
     struct udev_device* device) {
   auto ec = createEventContext();
-  ec->device = device;
+  ec->device = udev_device_ref(device);
   // Map the action string to the eventing enum.
   ec->action = UDEV_EVENT_ACTION_UNKNOWN;
   ec->action_string = std::string(udev_device_get_action(device));
@@ -12,9 +12,14 @@
 
 #include <libudev.h>
 
+#include <map>
+#include <string>
+
 #include <osquery/events.h>
 #include <osquery/status.h>
 
+#include "osquery/events/linux/reactor.h"
+
 namespace osquery {
 
 enum udev_event_action {
@@ -52,7 +57,13 @@ struct UdevSubscriptionContext : public SubscriptionContext {
  * @brief Event details for UdevEventPublisher events.
  */
 struct UdevEventContext : public EventContext {
-  /// A pointer to the device object, most subscribers will only use device.
+  /**
+   * @brief A pointer to the device object, most subscribers will only use
+   * device.
+   *
+   * The context holds a reference to the device, so subscribers receiving
+   * events from a dispatch thread may read it after the publisher moves on.
+   */
   struct udev_device* device{nullptr};
 
   /// The udev_event_action identifier.
@@ -65,6 +76,41 @@ struct UdevEventContext : public EventContext {
   std::string devnode;
   std::string devtype;
   std::string driver;
+
+  ~UdevEventContext() {
+    if (device != nullptr) {
+      udev_device_unref(device);
+    }
+  }
+
+  /**
+   * @brief Return a udev property of the device, fetched on first use.
+   *
+   * Subscribers sharing the event share the fetched values.
+   *
+   * @param property the udev property identifier string.
+   * @return string representation of the property or empty if null.
+   */
+  const std::string& getValue(const std::string& property);
+
+  /**
+   * @brief Return a udev system attribute of the device, fetched on first use.
+   *
+   * Reading a system attribute reads sysfs, so only the attributes a
+   * subscriber asks for are read.
+   *
+   * @param attr the udev system attribute identifier string.
+   * @return string representation of the attribute or empty if null.
+   */
+  const std::string& getAttr(const std::string& attr);
+
+ private:
+  /// Properties and system attributes read from the device.
+  std::map<std::string, std::string> values_;
+  std::map<std::string, std::string> attrs_;
+
+  /// Subscribers may read values from their own dispatch threads.
+  Mutex values_mutex_;
 };
 
 using UdevEventContextRef = std::shared_ptr<UdevEventContext>;
@@ -89,6 +135,14 @@ class UdevEventPublisher
 
   Status run() override;
 
+  /// Check that the publisher is set up and its run loop has not ended.
+  static bool isRunning();
+
+  /// Wake the run loop so the EventFactory can end it.
+  void stop() override {
+    reactor_.interrupt();
+  }
+
   /**
    * @brief Return a string representation of a udev property.
    *
@@ -119,6 +173,9 @@ class UdevEventPublisher
   /// Protection around udev resources.
   Mutex mutex_;
 
+  /// Wait for the udev monitor without a timeout.
+  EventReactor reactor_;
+
  private:
   /// Check subscription details.
   bool shouldFire(const UdevSubscriptionContextRef& mc,
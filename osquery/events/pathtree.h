@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace osquery {
+
+/**
+ * @brief A prefix tree of subscription paths, walked once per event path.
+ *
+ * Each value is inserted at the literal prefix of its path, before any
+ * wildcard, folded to lowercase as file event matching is case insensitive.
+ * Walking an event path collects the values of every subscription it may
+ * match, so publishers reject every other subscription without a string
+ * comparison or fnmatch.
+ */
+template <typename T>
+class PathPrefixTree {
+ public:
+  /// Add a value at the literal prefix of a path.
+  void insert(const std::string& path, const T& value) {
+    auto node = &root_;
+    for (const auto& c : getLiteralPrefix(path)) {
+      auto& child = node->children[c];
+      if (child == nullptr) {
+        child.reset(new Node());
+      }
+      node = child.get();
+    }
+    node->values.push_back(value);
+  }
+
+  /// Remove all values.
+  void clear() {
+    root_.children.clear();
+    root_.values.clear();
+  }
+
+  /**
+   * @brief Collect the values an event path may match.
+   *
+   * @param path The event path.
+   * @param descendants Also collect values below the path, used for
+   * directory-level events that report a parent of the subscribed paths.
+   * @param candidates (output) The sorted values.
+   */
+  void match(const std::string& path,
+             bool descendants,
+             std::vector<T>& candidates) const {
+    candidates.clear();
+    auto node = &root_;
+    for (const auto& c : path) {
+      candidates.insert(
+          candidates.end(), node->values.begin(), node->values.end());
+      auto child = node->children.find(static_cast<char>(::tolower(c)));
+      if (child == node->children.end()) {
+        node = nullptr;
+        break;
+      }
+      node = child->second.get();
+    }
+
+    if (node != nullptr) {
+      if (descendants) {
+        collect(*node, candidates);
+      } else {
+        candidates.insert(
+            candidates.end(), node->values.begin(), node->values.end());
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+  }
+
+  /// The literal prefix of a subscription path, folded for matching.
+  static std::string getLiteralPrefix(const std::string& path) {
+    auto prefix = path.substr(0, path.find_first_of("*?["));
+    std::transform(prefix.begin(), prefix.end(), prefix.begin(), ::tolower);
+    return prefix;
+  }
+
+ private:
+  struct Node {
+    std::map<char, std::unique_ptr<Node>> children;
+    std::vector<T> values;
+  };
+
+  /// Append the values of a node and every node below it.
+  static void collect(const Node& node, std::vector<T>& candidates) {
+    candidates.insert(candidates.end(), node.values.begin(), node.values.end());
+    for (const auto& child : node.children) {
+      collect(*child.second, candidates);
+    }
+  }
+
+ private:
+  Node root_;
+};
+}
@@ -0,0 +1,268 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+#include <osquery/core.h>
+#include <osquery/events.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/process.h"
+#include "osquery/events/replay.h"
+
+namespace osquery {
+
+CLI_FLAG(string,
+         events_capture,
+         "",
+         "Record the raw input of event publishers to this file");
+
+CLI_FLAG(string,
+         events_replay,
+         "",
+         "Replay an events_capture file into the event publishers and exit");
+
+CLI_FLAG(double,
+         events_replay_speed,
+         1.0,
+         "Multiple of the captured pace to replay at, 0 to replay at once");
+
+/// The largest record read from a capture.
+const size_t kEventRecordMaxSize{16 * 1024 * 1024};
+
+/// Milliseconds to wait for the subscriber queues after a replay.
+const size_t kEventReplayDrainTime{10000};
+
+std::atomic<bool> EventCapture::enabled_{false};
+
+/// The open capture file.
+static std::ofstream kEventCaptureFile;
+
+/// When the capture started, records are offset from this time.
+static std::chrono::steady_clock::time_point kEventCaptureStart;
+
+/// Protect the capture file, publisher threads record concurrently.
+static Mutex kEventCaptureMutex;
+
+void writeEventRecord(std::ostream& output, const EventRecord& record) {
+  // A text header allows captures to be inspected and filtered.
+  output << record.publisher << ' ' << record.offset << ' '
+         << record.data.size() << '\n';
+  output.write(record.data.data(), record.data.size());
+  output << '\n';
+}
+
+bool readEventRecord(std::istream& input, EventRecord& record) {
+  std::string header;
+  if (!std::getline(input, header)) {
+    return false;
+  }
+
+  auto fields = osquery::split(header, " ");
+  unsigned long int offset = 0;
+  unsigned long int size = 0;
+  if (fields.size() != 3 || !safeStrtoul(fields[1], 10, offset) ||
+      !safeStrtoul(fields[2], 10, size) || size > kEventRecordMaxSize) {
+    return false;
+  }
+
+  record.publisher = fields[0];
+  record.offset = offset;
+  record.data.resize(size);
+  if (size > 0) {
+    input.read(&record.data[0], size);
+  }
+  return (static_cast<size_t>(input.gcount()) == size || size == 0) &&
+         input.get() == '\n';
+}
+
+Status EventCapture::start() {
+  if (FLAGS_events_capture.empty()) {
+    return Status(0, "Capture disabled");
+  }
+
+  WriteLock lock(kEventCaptureMutex);
+  kEventCaptureFile.open(FLAGS_events_capture,
+                         std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!kEventCaptureFile.is_open()) {
+    return Status(1, "Cannot open event capture: " + FLAGS_events_capture);
+  }
+  kEventCaptureStart = std::chrono::steady_clock::now();
+  enabled_ = true;
+  return Status(0, "OK");
+}
+
+void EventCapture::stop() {
+  WriteLock lock(kEventCaptureMutex);
+  enabled_ = false;
+  if (kEventCaptureFile.is_open()) {
+    kEventCaptureFile.close();
+  }
+}
+
+void EventCapture::record(const std::string& publisher,
+                          const char* data,
+                          size_t size) {
+  WriteLock lock(kEventCaptureMutex);
+  if (!enabled_) {
+    return;
+  }
+
+  EventRecord record;
+  record.publisher = publisher;
+  record.offset = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - kEventCaptureStart)
+                      .count();
+  record.data.assign(data, size);
+  writeEventRecord(kEventCaptureFile, record);
+}
+
+/// Counters of every publisher and subscriber, compared before and after.
+struct EventTotals {
+  size_t events{0};
+  size_t added{0};
+  size_t dropped{0};
+  size_t queued{0};
+};
+
+static EventTotals getEventTotals() {
+  EventTotals totals;
+  for (auto& type : EventFactory::publisherTypes()) {
+    auto publisher = EventFactory::getEventPublisher(type);
+    if (publisher != nullptr) {
+      totals.events += publisher->numEvents();
+      totals.dropped += publisher->numDropped();
+    }
+  }
+
+  for (auto& name : EventFactory::subscriberNames()) {
+    auto subscriber = EventFactory::getEventSubscriber(name);
+    if (subscriber != nullptr) {
+      totals.added += subscriber->numEvents();
+      totals.dropped += subscriber->queueDrops() + subscriber->rateLimited();
+      totals.queued += subscriber->queueDepth();
+    }
+  }
+  return totals;
+}
+
+/// The bytes written to the database since the process started.
+static size_t getDatabaseBytesWritten() {
+  MetricSample sample;
+  Metrics::counter("database_bytes_written").sample(sample);
+  return static_cast<size_t>(sample.value);
+}
+
+/// Microseconds of CPU used by every thread of the process.
+static uint64_t getProcessCPUTime() {
+  ProcessUsage usage;
+  if (!PlatformProcess::getCurrentProcess()->getUsage(usage)) {
+    return 0;
+  }
+  return usage.user_time + usage.system_time;
+}
+
+Status EventReplayRunner::replay(EventReplayStats& stats) {
+  std::ifstream input(path_, std::ios::in | std::ios::binary);
+  if (!input.is_open()) {
+    return Status(1, "Cannot open event capture: " + path_);
+  }
+
+  auto before = getEventTotals();
+  auto database_bytes = getDatabaseBytesWritten();
+  auto cpu_time = getProcessCPUTime();
+  auto start = std::chrono::steady_clock::now();
+
+  EventRecord record;
+  while (!interrupted() && readEventRecord(input, record)) {
+    if (speed_ > 0) {
+      // Wait until the record is due at the requested pace.
+      auto due = start + std::chrono::microseconds(
+                             static_cast<uint64_t>(record.offset / speed_));
+      auto now = std::chrono::steady_clock::now();
+      if (due > now) {
+        pauseMilli(
+            std::chrono::duration_cast<std::chrono::milliseconds>(due - now));
+      }
+    }
+
+    stats.records++;
+    stats.bytes += record.data.size();
+    stats.publishers[record.publisher]++;
+    auto publisher = EventFactory::getEventPublisher(record.publisher);
+    if (publisher == nullptr || !publisher->replay(record.data).ok()) {
+      stats.failed++;
+    }
+  }
+
+  // Include the time subscribers spend adding queued events.
+  for (size_t waited = 0; waited < kEventReplayDrainTime && !interrupted();
+       waited += 10) {
+    if (getEventTotals().queued == 0) {
+      break;
+    }
+    pauseMilli(10);
+  }
+
+  stats.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  stats.cpu_time = getProcessCPUTime() - cpu_time;
+  stats.database_bytes = getDatabaseBytesWritten() - database_bytes;
+
+  auto after = getEventTotals();
+  stats.events = after.events - before.events;
+  stats.added = after.added - before.added;
+  stats.dropped = after.dropped - before.dropped;
+  return Status(0, "OK");
+}
+
+std::string EventReplayRunner::report(const EventReplayStats& stats) {
+  auto seconds = static_cast<double>(stats.elapsed) / (1000 * 1000);
+  auto events = static_cast<double>((stats.events > 0) ? stats.events : 1);
+  auto bytes = static_cast<double>((stats.bytes > 0) ? stats.bytes : 1);
+
+  std::stringstream output;
+  output << "Replayed " << stats.records << " records (" << stats.bytes
+         << " bytes, " << stats.failed << " failed) in " << seconds << "s\n";
+  for (const auto& publisher : stats.publishers) {
+    output << "  " << publisher.first << ": " << publisher.second
+           << " records\n";
+  }
+  output << "Events fired: " << stats.events << " ("
+         << ((seconds > 0) ? stats.events / seconds : 0) << "/s)\n";
+  output << "Events added: " << stats.added << "\n";
+  output << "Events dropped: " << stats.dropped << "\n";
+  output << "CPU per event: " << stats.cpu_time / events << "us\n";
+  output << "Database bytes written: " << stats.database_bytes << " ("
+         << stats.database_bytes / bytes << " per input byte)\n";
+  return output.str();
+}
+
+void EventReplayRunner::start() {
+  EventReplayStats stats;
+  auto status = replay(stats);
+  if (!status.ok()) {
+    LOG(ERROR) << status.getMessage();
+    Initializer::requestShutdown(EXIT_FAILURE);
+    return;
+  }
+
+  auto message = report(stats);
+  fprintf(stdout, "%s", message.c_str());
+  fflush(stdout);
+  Initializer::requestShutdown();
+}
+}
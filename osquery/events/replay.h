@@ -0,0 +1,138 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/dispatcher.h>
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// A raw input record read by an event publisher.
+struct EventRecord {
+  /// The publisher type that read the input.
+  std::string publisher;
+
+  /// Microseconds since the capture started.
+  uint64_t offset{0};
+
+  /// The input in the publisher's capture format, see replay.
+  std::string data;
+};
+
+/// Append a record to a capture stream.
+void writeEventRecord(std::ostream& output, const EventRecord& record);
+
+/// Read the next record of a capture stream, false at the end or if invalid.
+bool readEventRecord(std::istream& input, EventRecord& record);
+
+/**
+ * @brief Record the raw input of event publishers to a file.
+ *
+ * When `--events_capture` is set, publishers append each input they read
+ * from the kernel or another process, such as an inotify event, an audit
+ * reply, or a syslog line, before parsing it. The capture may be replayed
+ * with `--events_replay` into the same publishers.
+ */
+class EventCapture : private boost::noncopyable {
+ public:
+  /// Open the `--events_capture` file, if set.
+  static Status start();
+
+  /// Close the capture file.
+  static void stop();
+
+  /// Check if input is captured, publishers check before building a record.
+  static bool enabled() {
+    return enabled_;
+  }
+
+  /// Append the raw input of a publisher.
+  static void record(const std::string& publisher,
+                     const char* data,
+                     size_t size);
+
+ private:
+  /// Set while the capture file is open.
+  static std::atomic<bool> enabled_;
+};
+
+/// The totals measured while replaying a capture.
+struct EventReplayStats {
+  /// The number of records replayed.
+  size_t records{0};
+
+  /// The bytes of captured input replayed.
+  size_t bytes{0};
+
+  /// Records of publishers that are missing, or failed to replay them.
+  size_t failed{0};
+
+  /// Events fired by the publishers.
+  size_t events{0};
+
+  /// Events added by the subscribers.
+  size_t added{0};
+
+  /// Events dropped by publishers and by subscriber queues or rate limits.
+  size_t dropped{0};
+
+  /// Bytes written to the database, keys and values.
+  size_t database_bytes{0};
+
+  /// Wall microseconds, until the subscriber queues were empty.
+  uint64_t elapsed{0};
+
+  /// Microseconds of user and system CPU used by the process.
+  uint64_t cpu_time{0};
+
+  /// Records replayed for each publisher.
+  std::map<std::string, size_t> publishers;
+};
+
+/**
+ * @brief Replay a capture into the event publishers, then shut down.
+ *
+ * The EventFactory starts this instead of the publisher run loops when
+ * `--events_replay` is set. Each record is given to the publisher that
+ * captured it using EventPublisherPlugin::replay, at the captured pace
+ * multiplied by `--events_replay_speed`. The subscribers store and expire
+ * events as they would with live input, and a report of the throughput,
+ * CPU used per event, drops, and database write amplification is printed.
+ */
+class EventReplayRunner : public InternalRunnable {
+ public:
+  EventReplayRunner(const std::string& path, double speed)
+      : path_(path), speed_(speed) {}
+
+  /// Replay, print the report, and request a shutdown.
+  void start() override;
+
+  /// Replay every record of the capture.
+  Status replay(EventReplayStats& stats);
+
+  /// Format a replay report.
+  static std::string report(const EventReplayStats& stats);
+
+ private:
+  /// The capture file path.
+  std::string path_;
+
+  /// A multiple of the captured pace, 0 replays without waiting.
+  double speed_{1};
+};
+}
@@ -27,6 +27,7 @@ namespace osquery {
 
 DECLARE_uint64(events_expiry);
 DECLARE_uint64(events_max);
+DECLARE_uint64(events_batch_size);
 DECLARE_bool(events_optimize);
 
 class EventsDatabaseTests : public ::testing::Test {
@@ -81,42 +82,53 @@ TEST_F(EventsDatabaseTests, test_event_module_id) {
   EXPECT_EQ(event_id2, "2");
 }
 
+TEST_F(EventsDatabaseTests, test_event_id_blocks) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  EXPECT_EQ("1", sub->getEventID());
+
+  // A block of EventIDs is reserved with the first ID.
+  std::string reserved;
+  getDatabaseValue(kEvents, "eid." + sub->dbNamespace(), reserved);
+  EXPECT_EQ("1024", reserved);
+  for (size_t i = 2; i <= 1024; i++) {
+    sub->getEventID();
+  }
+  EXPECT_EQ(1024U, sub->reserved_eid_);
+
+  // The next ID reserves another block.
+  EXPECT_EQ("1025", sub->getEventID());
+  getDatabaseValue(kEvents, "eid." + sub->dbNamespace(), reserved);
+  EXPECT_EQ("2048", reserved);
+
+  // A restarted subscriber continues after the reserved block.
+  auto restarted = std::make_shared<DBFakeEventSubscriber>();
+  EXPECT_EQ("2049", restarted->getEventID());
+}
+
 TEST_F(EventsDatabaseTests, test_event_add) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   auto status = sub->testAdd(1);
   EXPECT_TRUE(status.ok());
 }
 
-TEST_F(EventsDatabaseTests, test_record_indexing) {
+TEST_F(EventsDatabaseTests, test_event_keys) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
-  auto status = sub->testAdd(2);
-  status = sub->testAdd(11);
-  status = sub->testAdd(61);
-  status = sub->testAdd((1 * 3600) + 1);
+  auto status = sub->testAdd(61);
+  status = sub->testAdd(2);
   status = sub->testAdd((2 * 3600) + 1);
+  sub->flushEvents();
 
-  // An "all" range, will pick up everything in the largest index.
-  auto indexes = sub->getIndexes(0, 3 * 3600);
-  auto output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ("60.0, 60.1, 60.60, 60.120", output);
-
-  // Restrict range to "most specific", which is an index by 10.
-  indexes = sub->getIndexes(0, 5);
-  output = boost::algorithm::join(indexes, ", ");
-  // The order 10, 0th index include results with t = [0, 10).
-  EXPECT_EQ("60.0", output);
-
-  // Add specific indexes to the upper bound.
-  status = sub->testAdd((2 * 3600) + 11);
-  status = sub->testAdd((2 * 3600) + 61);
-  indexes = sub->getIndexes(2 * 3600, (2 * 3600) + 62);
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ("60.120, 60.121", output);
-
-  // Request specific lower and upper bounding.
-  indexes = sub->getIndexes(2, (2 * 3600) + 62);
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ("60.0, 60.1, 60.60, 60.120, 60.121", output);
+  // Keys are ordered by the event time, then by the EventID.
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, sub->getEventPrefix());
+  ASSERT_EQ(3U, keys.size());
+  EXPECT_EQ(sub->getEventKey(2, 2), keys[0]);
+  EXPECT_EQ(sub->getEventKey(61, 1), keys[1]);
+  EXPECT_EQ(sub->getEventKey((2 * 3600) + 1, 3), keys[2]);
+
+  // Times compare in numeric order.
+  EXPECT_LT(sub->getEventKey(0xf, 1), sub->getEventKey(0x10, 1));
+  EXPECT_LT(sub->getEventKey(100, 9), sub->getEventKey(100, 10));
 }
 
 TEST_F(EventsDatabaseTests, test_record_range) {
@@ -128,39 +140,35 @@ TEST_F(EventsDatabaseTests, test_record_range) {
   status = sub->testAdd((1 * 3600) + 1);
   status = sub->testAdd((2 * 3600) + 1);
 
-  // Search within a specific record range.
-  auto indexes = sub->getIndexes(0, 10);
-  EXPECT_EQ(1U, indexes.size());
-  auto records = sub->getRecords(indexes);
-  // This will return 3 results, ::get filters records by an absolute range.
-  EXPECT_EQ(3U, records.size()); // 1, 2, 11
+  // Each get sets an expiration time relative to now, ignore it.
+  sub->expire_time_ = 0;
+  auto results = sub->get(0, 10);
+  EXPECT_EQ(2U, results.size()); // 1, 2
 
   // Search within a large bound.
-  indexes = sub->getIndexes(3, 3601);
-  // This will include the 0-10 bucket meaning 1, 2 will show up.
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(5U, records.size()); // 1, 2, 11, 61, 3601
+  sub->expire_time_ = 0;
+  results = sub->get(3, 3601);
+  EXPECT_EQ(3U, results.size()); // 11, 61, 3601
 
   // Get all of the records.
-  indexes = sub->getIndexes(0, 3 * 3600);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(6U, records.size()); // 1, 2, 11, 61, 3601, 7201
+  sub->expire_time_ = 0;
+  results = sub->get(0, 3 * 3600);
+  EXPECT_EQ(6U, results.size()); // 1, 2, 11, 61, 3601, 7201
 
   // stop = 0 is an alias for everything.
-  indexes = sub->getIndexes(0, 0);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(6U, records.size());
+  sub->expire_time_ = 0;
+  results = sub->get(0, 0);
+  EXPECT_EQ(6U, results.size());
+  EXPECT_EQ("1", results[0]["time"]);
+  EXPECT_EQ("7201", results[5]["time"]);
 
   for (size_t j = 0; j < 30; j++) {
-    // 110 is 10 below an index (60.2).
     sub->testAdd(110 + static_cast<int>(j));
   }
 
-  indexes = sub->getIndexes(110, 0);
-  auto output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ("60.1, 60.2, 60.60, 60.120", output);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(33U, records.size()); // (61) 110 - 139 + 3601, 7201
+  sub->expire_time_ = 0;
+  results = sub->get(110, 0);
+  EXPECT_EQ(32U, results.size()); // 110 - 139, 3601, 7201
 }
 
 TEST_F(EventsDatabaseTests, test_record_expiration) {
@@ -173,34 +181,23 @@ TEST_F(EventsDatabaseTests, test_record_expiration) {
   status = sub->testAdd((2 * 3600) + 1);
 
   // No expiration
-  auto indexes = sub->getIndexes(0, 5000);
-  auto records = sub->getRecords(indexes);
-  EXPECT_EQ(5U, records.size()); // 1, 2, 11, 61, 3601
+  sub->expire_time_ = 0;
+  auto results = sub->get(0, 5000);
+  EXPECT_EQ(5U, results.size()); // 1, 2, 11, 61, 3601
 
   sub->expire_events_ = true;
   sub->expire_time_ = 10;
-  indexes = sub->getIndexes(0, 5000);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(3U, records.size()); // 11, 61, 3601
-
-  indexes = sub->getIndexes(0, 5000);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(3U, records.size()); // 11, 61, 3601
+  results = sub->get(0, 5000);
+  EXPECT_EQ(3U, results.size()); // 11, 61, 3601
 
-  indexes = sub->getIndexes(0, 5000);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(3U, records.size()); // 11, 61, 3601
-
-  indexes = sub->getIndexes(0, 5000);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(3U, records.size()); // 11, 61, 3601
-
-  // Check that get/deletes did not act on cache.
-  // This implies that RocksDB is flushing the requested delete records.
+  // Check that the expired events were removed from the backing store.
   sub->expire_time_ = 0;
-  indexes = sub->getIndexes(0, 5000);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(3U, records.size()); // 11, 61, 3601
+  results = sub->get(0, 5000);
+  EXPECT_EQ(3U, results.size()); // 11, 61, 3601
+
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, sub->getEventPrefix());
+  EXPECT_EQ(4U, keys.size()); // 11, 61, 3601, 7201
 }
 
 TEST_F(EventsDatabaseTests, test_gentable) {
@@ -212,7 +209,6 @@ TEST_F(EventsDatabaseTests, test_gentable) {
   status = sub->testAdd((1 * 3600) + 1);
   status = sub->testAdd((2 * 3600) + 1);
 
-  ASSERT_EQ(0U, sub->optimize_time_);
   ASSERT_EQ(0U, sub->expire_time_);
 
   auto t = static_cast<int>(getUnixTime());
@@ -223,11 +219,11 @@ TEST_F(EventsDatabaseTests, test_gentable) {
   // Test the expire workflow by creating a short expiration time.
   FLAGS_events_expiry = 10;
 
+  sub->flushEvents();
   std::vector<std::string> keys;
   scanDatabaseKeys("events", keys);
-  // 9 data records, 1 eid counter, 3 indexes, 15 index records.
-  // Depending on the moment, an additional 3 indexs may be introduced.
-  EXPECT_LE(16U, keys.size());
+  // 9 events and 1 eid counter.
+  EXPECT_LE(10U, keys.size());
 
   // Perform a "select" equivalent.
   QueryContext context;
@@ -238,8 +234,10 @@ TEST_F(EventsDatabaseTests, test_gentable) {
   // The expiration time is now - events_expiry.
   EXPECT_LT(t - (FLAGS_events_expiry * 2), sub->expire_time_);
   EXPECT_GT(t, sub->expire_time_);
-  // The optimize time will not be changed.
-  ASSERT_EQ(0U, sub->optimize_time_);
+  // Without optimization no consumer cursor is kept.
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, "cursor." + sub->dbNamespace());
+  EXPECT_TRUE(keys.empty());
 
   results = sub->genTable(context);
   EXPECT_EQ(3U, results.size());
@@ -249,7 +247,44 @@ TEST_F(EventsDatabaseTests, test_gentable) {
 
   keys.clear();
   scanDatabaseKeys("events", keys);
-  EXPECT_LE(6U, keys.size());
+  EXPECT_LE(4U, keys.size());
+}
+
+TEST_F(EventsDatabaseTests, test_gentable_ordered) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  auto t = static_cast<int>(getUnixTime());
+  for (int i = 1; i <= 10; ++i) {
+    sub->testAdd(t + i);
+  }
+
+  // The newest events are read first, up to the limit.
+  QueryContext context;
+  context.ordered = true;
+  context.descending = true;
+  context.limit = 3;
+  auto results = sub->genTable(context);
+  ASSERT_EQ(3U, results.size());
+  EXPECT_EQ(INTEGER(t + 10), results[0]["time"]);
+  EXPECT_EQ(INTEGER(t + 8), results[2]["time"]);
+
+  // The limit applies within the time range.
+  context.constraints["time"].add(Constraint(LESS_THAN, INTEGER(t + 6)));
+  results = sub->genTable(context);
+  ASSERT_EQ(3U, results.size());
+  EXPECT_EQ(INTEGER(t + 5), results[0]["time"]);
+  EXPECT_EQ(INTEGER(t + 3), results[2]["time"]);
+
+  // Ascending order reads the oldest events first.
+  context.descending = false;
+  context.limit = 2;
+  results = sub->genTable(context);
+  ASSERT_EQ(2U, results.size());
+  EXPECT_EQ(INTEGER(t + 1), results[0]["time"]);
+  EXPECT_EQ(INTEGER(t + 2), results[1]["time"]);
+
+  // Without a limit every event in the range is returned.
+  context.limit = 0;
+  EXPECT_EQ(5U, sub->genTable(context).size());
 }
 
 TEST_F(EventsDatabaseTests, test_optimize) {
@@ -267,32 +302,67 @@ TEST_F(EventsDatabaseTests, test_optimize) {
   setDatabaseValue(kPersistentSettings, kExecutingQuery, "events_db_test");
 
   QueryContext context;
-  auto t = static_cast<int>(getUnixTime());
+  auto t = getUnixTime();
   auto results = sub->genTable(context);
   EXPECT_EQ(10U, results.size());
-  // Optimization will set the time NOW as the minimum event time.
-  // Thus it is not possible to set event in past.
-  EXPECT_GE(sub->optimize_time_ + 100, t);
-  EXPECT_LE(sub->optimize_time_ - 100, t);
-  // The last EID returned will also be stored for duplication checks.
-  EXPECT_EQ(10U, sub->optimize_eid_);
+  // The cursor keeps the select time and the last EID returned.
+  auto cursor = sub->getCursor("events_db_test");
+  EXPECT_GE(cursor.time + 100, t);
+  EXPECT_LE(cursor.time, t + 100);
+  EXPECT_EQ(10U, cursor.eid);
 
   for (size_t i = t + 800; i < t + 800 + 10; ++i) {
     sub->testAdd(static_cast<int>(i));
   }
   results = sub->genTable(context);
   EXPECT_EQ(10U, results.size());
+  EXPECT_EQ(20U, sub->getCursor("events_db_test").eid);
 
-  // The optimize time should have been written to the database.
-  // It should be the same as the current (relative) optimize time.
-  std::string content;
-  getDatabaseValue("events", "optimize.events_db_test", content);
-  EXPECT_EQ(std::to_string(sub->optimize_time_), content);
+  // Events added shortly before the last select are not missed.
+  sub->testAdd(static_cast<int>(t - 1));
+  results = sub->genTable(context);
+  ASSERT_EQ(1U, results.size());
+
+  // Nothing is returned twice.
+  results = sub->genTable(context);
+  EXPECT_EQ(0U, results.size());
 
   // Restore the tool type.
   kToolType = default_type;
 }
 
+TEST_F(EventsDatabaseTests, test_optimize_consumers) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  auto default_type = kToolType;
+  kToolType = ToolType::DAEMON;
+  FLAGS_events_optimize = true;
+
+  auto t = static_cast<int>(getUnixTime());
+  for (int i = 0; i < 5; ++i) {
+    sub->testAdd(t + i);
+  }
+
+  // Each consumer resumes from its own cursor.
+  QueryContext context;
+  setDatabaseValue(kPersistentSettings, kExecutingQuery, "consumer_a");
+  EXPECT_EQ(5U, sub->genTable(context).size());
+
+  sub->testAdd(t + 5);
+  EXPECT_EQ(1U, sub->genTable(context).size());
+
+  setDatabaseValue(kPersistentSettings, kExecutingQuery, "consumer_b");
+  EXPECT_EQ(6U, sub->genTable(context).size());
+  EXPECT_EQ(0U, sub->genTable(context).size());
+
+  // A cursor written by earlier versions is used once.
+  setDatabaseValue(kEvents, "optimize.consumer_c", std::to_string(t));
+  setDatabaseValue(kEvents, "optimize_eid.consumer_c", "3");
+  setDatabaseValue(kPersistentSettings, kExecutingQuery, "consumer_c");
+  EXPECT_EQ(3U, sub->genTable(context).size());
+
+  kToolType = default_type;
+}
+
 TEST_F(EventsDatabaseTests, test_expire_check) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   // Set the max number of buffered events to something reasonably small.
@@ -327,18 +397,218 @@ TEST_F(EventsDatabaseTests, test_expire_check) {
         sub->testAdd(t++);
       }
 
-      // Records hold the event_id + time indexes.
-      // Data hosts the event_id + JSON content.
-      auto record_key = "records." + sub->dbNamespace();
-      auto data_key = "data." + sub->dbNamespace();
+      // Each event is a single time-ordered key.
+      std::vector<std::string> events;
+      scanDatabaseKeys(kEvents, events, sub->getEventPrefix());
+      EXPECT_LT(events.size(), 60U);
+    }
+  }
+}
+
+TEST_F(EventsDatabaseTests, test_expire_batches) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  auto events_max = FLAGS_events_max;
+  FLAGS_events_max = 10;
+  for (int t = 1; t <= 20; t++) {
+    sub->testAdd(t);
+  }
+  sub->flushEvents();
+  EXPECT_EQ(20U, sub->stored_events_);
+  EXPECT_EQ(10U, sub->pendingExpiration());
+
+  // The overflow is removed in batches, oldest first.
+  EXPECT_EQ(4U, sub->expireEvents(4));
+  EXPECT_EQ(6U, sub->pendingExpiration());
+  EXPECT_EQ(4U, sub->expireEvents(4));
+  EXPECT_EQ(2U, sub->expireEvents(4));
+  EXPECT_EQ(0U, sub->expireEvents(4));
+  EXPECT_EQ(0U, sub->pendingExpiration());
+  EXPECT_EQ(10U, sub->expiredEvents());
 
-      std::vector<std::string> records, datas;
-      scanDatabaseKeys(kEvents, records, record_key);
-      scanDatabaseKeys(kEvents, datas, data_key);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, sub->getEventPrefix());
+  ASSERT_EQ(10U, keys.size());
+  EXPECT_EQ(sub->getEventKey(11, 11), keys[0]);
+
+  // Events at or before the expiration time are removed the same way.
+  sub->expire_time_ = 15;
+  EXPECT_EQ(4U, sub->expireEvents(4));
+  EXPECT_EQ(1U, sub->expireEvents(4));
+  EXPECT_EQ(0U, sub->expireEvents(4));
+  EXPECT_EQ(5U, sub->stored_events_);
+  EXPECT_EQ(15U, sub->expiredEvents());
+
+  auto results = sub->get(0, 0);
+  ASSERT_EQ(5U, results.size());
+  EXPECT_EQ("16", results[0]["time"]);
+
+  FLAGS_events_max = events_max;
+}
+
+TEST_F(EventsDatabaseTests, test_staged_events) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  auto batch_size = FLAGS_events_batch_size;
+  FLAGS_events_batch_size = 4;
 
-      EXPECT_LT(records.size(), 20U);
-      EXPECT_LT(datas.size(), 60U);
+  // Events are staged until the batch size is reached.
+  sub->testAdd(1);
+  // Prevent the staged age from requesting a write.
+  sub->staged_time_ = getUnixTime() + 100;
+  sub->testAdd(2);
+  sub->testAdd(3);
+
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, sub->getEventPrefix());
+  EXPECT_EQ(0U, keys.size());
+
+  sub->testAdd(4);
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, sub->getEventPrefix());
+  EXPECT_EQ(4U, keys.size());
+
+  // Events staged for over a second are written with the next event.
+  sub->testAdd(5);
+  sub->staged_time_ = getUnixTime() - 2;
+  sub->testAdd(6);
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, sub->getEventPrefix());
+  EXPECT_EQ(6U, keys.size());
+
+  // Selecting events includes those staged.
+  sub->testAdd(7);
+  sub->expire_time_ = 0;
+  auto results = sub->get(0, 0);
+  EXPECT_EQ(7U, results.size());
+
+  FLAGS_events_batch_size = batch_size;
+}
+
+TEST_F(EventsDatabaseTests, test_rate_limit) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->rate_limit_ = 5;
+  for (int t = 1; t <= 10; t++) {
+    sub->testAdd(t);
+  }
+
+  // The bucket holds a second of events, the remaining events are dropped.
+  EXPECT_EQ(5U, sub->rateLimited());
+  sub->expire_time_ = 0;
+  EXPECT_EQ(5U, sub->get(0, 0).size());
+
+  // Tokens are refilled as time passes.
+  sub->rate_time_ -= 1000;
+  sub->testAdd(11);
+  EXPECT_EQ(5U, sub->rateLimited());
+  EXPECT_EQ(6U, sub->get(0, 0).size());
+}
+
+TEST_F(EventsDatabaseTests, test_sampling) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->sample_ratio_ = 4;
+  auto addEvents = [&sub]() {
+    for (int i = 0; i < 100; i++) {
+      Row r = {{"path", "/bin/" + std::to_string(i)}};
+      sub->add(r, 100 + i);
+    }
+  };
+
+  addEvents();
+  sub->expire_time_ = 0;
+  auto kept = sub->get(0, 0).size();
+  EXPECT_EQ(100U, kept + sub->sampledOut());
+  EXPECT_LT(0U, kept);
+  EXPECT_GT(100U, kept);
+
+  // Sampling by the columns keeps the same events each time.
+  addEvents();
+  EXPECT_EQ(kept * 2, sub->get(0, 0).size());
+  EXPECT_EQ(2 * (100 - kept), sub->sampledOut());
+
+  // The event times are not part of the sample key.
+  Row r = {{"path", "/bin/0"}, {"time", "1"}, {"uptime", "2"}};
+  EXPECT_EQ(sub->getSampleKey(r), Row({{"path", "/bin/0"}}));
+}
+
+TEST_F(EventsDatabaseTests, test_stream_events) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->stream_ = true;
+  sub->stream_ring_ = 2;
+  sub->testAdd(1);
+  sub->testAdd(2);
+  sub->testAdd(3);
+  EXPECT_EQ(3U, sub->numEvents());
+
+  // Streamed events are not stored and do not reserve EventIDs.
+  sub->flushEvents();
+  EXPECT_TRUE(sub->streamed_events_.empty());
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, sub->getEventPrefix());
+  EXPECT_TRUE(keys.empty());
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, "eid." + sub->dbNamespace());
+  EXPECT_TRUE(keys.empty());
+
+  // Selects use the ring of most-recent events.
+  auto results = sub->get(0, 0);
+  ASSERT_EQ(2U, results.size());
+  EXPECT_EQ("2", results[0]["time"]);
+  EXPECT_EQ("3", results[1]["time"]);
+  EXPECT_EQ(1U, sub->get(3, 10).size());
+}
+
+class EnrichedEventSubscriber : public DBFakeEventSubscriber {
+ protected:
+  void enrichEvents(QueryData& results) const override {
+    for (auto& r : results) {
+      r["enriched"] = r["testing"] + "!";
     }
   }
+};
+
+TEST_F(EventsDatabaseTests, test_enrich_events) {
+  auto sub = std::make_shared<EnrichedEventSubscriber>();
+  sub->testAdd(1);
+  sub->testAdd(2);
+
+  // Derived columns are only computed for the selected events.
+  auto results = sub->get(2, 2);
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("hello from space!", results[0]["enriched"]);
+  EXPECT_EQ(2U, sub->get(0, 0).size());
+}
+
+TEST_F(EventsDatabaseTests, test_migrate_events) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  auto ns = sub->dbNamespace();
+
+  // Store events using the per-minute record bins of earlier versions.
+  std::string first, second;
+  serializeRowJSON({{"testing", "legacy"}, {"time", "61"}}, first);
+  serializeRowJSON({{"testing", "legacy"}, {"time", "62"}}, second);
+  setDatabaseValue(kEvents, "data." + ns + ".1", first);
+  setDatabaseValue(kEvents, "data." + ns + ".2", second);
+  setDatabaseValue(kEvents, "data." + ns + ".3", second);
+  setDatabaseValue(kEvents, "records." + ns + ".60.1", "1:61,2:62");
+  setDatabaseValue(kEvents, "indexes." + ns + ".60", "1");
+
+  sub->expireCheck(true);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, sub->getEventPrefix());
+  ASSERT_EQ(2U, keys.size());
+  EXPECT_EQ(sub->getEventKey(61, 1), keys[0]);
+  EXPECT_EQ(sub->getEventKey(62, 2), keys[1]);
+
+  // The legacy records, indexes, and unrecorded data are removed.
+  for (const auto& prefix : {"data.", "records.", "indexes."}) {
+    keys.clear();
+    scanDatabaseKeys(kEvents, keys, prefix + ns);
+    EXPECT_TRUE(keys.empty());
+  }
+
+  sub->expire_time_ = 0;
+  auto results = sub->get(0, 0);
+  ASSERT_EQ(2U, results.size());
+  EXPECT_EQ("legacy", results[0]["testing"]);
+  EXPECT_EQ("62", results[1]["time"]);
 }
 }
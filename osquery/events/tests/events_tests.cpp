@@ -8,6 +8,12 @@
  *
  */
 
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
 #include <boost/filesystem/operations.hpp>
 
 #include <gtest/gtest.h>
@@ -16,6 +22,8 @@
 #include <osquery/events.h>
 #include <osquery/tables.h>
 
+#include "osquery/events/replay.h"
+
 namespace osquery {
 
 class EventsTests : public ::testing::Test {
@@ -410,6 +418,202 @@ TEST_F(EventsTests, test_fire_event) {
   EXPECT_EQ(kBellHathTolled, 4);
 }
 
+TEST_F(EventsTests, test_fire_snapshot) {
+  auto pub = std::make_shared<BasicEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+
+  auto sub = std::make_shared<FakeEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+
+  auto subscription = Subscription::create("FakeSubscriber");
+  subscription->callback = TestTheeCallback;
+  EventFactory::addSubscription("publisher", subscription);
+
+  // Subscriptions without a registered subscriber are not fired.
+  auto unknown = Subscription::create("UnknownSubscriber");
+  unknown->callback = TestTheeCallback;
+  EventFactory::addSubscription("publisher", unknown);
+
+  auto tolled = kBellHathTolled;
+  auto ec = pub->createEventContext();
+  pub->fire(ec, 0);
+  EXPECT_EQ(tolled + 1, kBellHathTolled);
+
+  // The snapshot is reused until subscriptions or subscribers change.
+  auto snapshot = pub->getSnapshot();
+  EXPECT_EQ(2U, snapshot->targets.size());
+  EXPECT_EQ(snapshot, pub->getSnapshot());
+
+  // A replaced subscriber is resolved again.
+  auto replacement = std::make_shared<FakeEventSubscriber>();
+  EventFactory::registerEventSubscriber(replacement);
+  EXPECT_NE(snapshot, pub->getSnapshot());
+  EXPECT_EQ(EventFactory::getEventSubscriber("FakeSubscriber"),
+            pub->getSnapshot()->targets[0].second);
+
+  pub->removeSubscriptions("FakeSubscriber");
+  pub->fire(ec, 0);
+  EXPECT_EQ(tolled + 1, kBellHathTolled);
+  EXPECT_EQ(1U, pub->getSnapshot()->targets.size());
+}
+
+/// Select the subscriptions requiring the event's value.
+class FakeSubscriptionMatcher : public SubscriptionMatcher {
+ public:
+  explicit FakeSubscriptionMatcher(const SubscriptionVector& subscriptions) {
+    for (const auto& subscription : subscriptions) {
+      auto sc = std::static_pointer_cast<FakeSubscriptionContext>(
+          subscription->context);
+      values_.push_back(sc->require_this_value);
+    }
+  }
+
+  void match(const EventContextRef& ec,
+             std::vector<size_t>& targets) const override {
+    auto fec = std::static_pointer_cast<FakeEventContext>(ec);
+    for (size_t i = 0; i < values_.size(); i++) {
+      if (values_[i] == fec->required_value) {
+        targets.push_back(i);
+      }
+    }
+  }
+
+ private:
+  std::vector<int> values_;
+};
+
+class MatchedEventPublisher
+    : public EventPublisher<FakeSubscriptionContext, FakeEventContext> {
+  DECLARE_PUBLISHER("FakePublisher");
+
+ public:
+  SubscriptionMatcherRef compileSubscriptions(
+      const SubscriptionVector& subscriptions) const override {
+    compiled++;
+    return std::make_shared<FakeSubscriptionMatcher>(subscriptions);
+  }
+
+  bool shouldFire(const SCRef& sc, const ECRef& ec) const override {
+    checked++;
+    return true;
+  }
+
+  mutable size_t compiled{0};
+  mutable size_t checked{0};
+};
+
+TEST_F(EventsTests, test_fire_matcher) {
+  auto pub = std::make_shared<MatchedEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+
+  auto sub = std::make_shared<FakeEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+  for (int value : {1, 2, 2}) {
+    auto sc = pub->createSubscriptionContext();
+    sc->require_this_value = value;
+    EventFactory::addSubscription(
+        "FakePublisher",
+        Subscription::create("FakeSubscriber", sc, TestTheeCallback));
+  }
+
+  // Only the subscriptions selected by the matcher are checked.
+  auto tolled = kBellHathTolled;
+  auto ec = pub->createEventContext();
+  ec->required_value = 2;
+  pub->fire(ec, 0);
+  EXPECT_EQ(2U, pub->checked);
+  EXPECT_EQ(tolled + 2, kBellHathTolled);
+
+  ec->required_value = 3;
+  pub->fire(ec, 0);
+  EXPECT_EQ(2U, pub->checked);
+  EXPECT_EQ(tolled + 2, kBellHathTolled);
+
+  // The subscriptions are compiled once for each snapshot.
+  EXPECT_EQ(1U, pub->compiled);
+}
+
+class QueuedEventSubscriber : public EventSubscriber<FakeEventPublisher> {
+ public:
+  QueuedEventSubscriber() {
+    setName("QueuedSubscriber");
+  }
+
+  Status Callback(const ECRef& ec, const SCRef& sc) {
+    callback_thread = std::this_thread::get_id();
+    ++callbacks;
+    // Let the test control when the first delivered callback returns.
+    while (!released) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return Status(0, "OK");
+  }
+
+  void lateInit() {
+    subscribe(&QueuedEventSubscriber::Callback, createSubscriptionContext());
+  }
+
+  std::atomic<size_t> callbacks{0};
+  std::atomic<bool> released{false};
+  std::thread::id callback_thread;
+};
+
+TEST_F(EventsTests, test_dispatch_queue) {
+  auto pub = std::make_shared<FakeEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+
+  auto sub = std::make_shared<QueuedEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+  sub->startDispatchQueue(1, false);
+  sub->lateInit();
+
+  // The first event is delivered from the subscriber's thread.
+  pub->fire(pub->createEventContext(), 0);
+  while (sub->callbacks == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_NE(std::this_thread::get_id(), sub->callback_thread);
+
+  // The publisher does not wait, the next event is queued and another dropped.
+  pub->fire(pub->createEventContext(), 0);
+  pub->fire(pub->createEventContext(), 0);
+  EXPECT_EQ(1U, sub->queueDepth());
+  EXPECT_EQ(1U, sub->queueDrops());
+
+  // Stopping the queue delivers the queued event.
+  sub->released = true;
+  sub->stopDispatchQueue();
+  EXPECT_EQ(2U, sub->callbacks);
+  EXPECT_EQ(0U, sub->queueDepth());
+
+  // Afterward events are delivered from the publisher's thread.
+  pub->fire(pub->createEventContext(), 0);
+  EXPECT_EQ(3U, sub->callbacks);
+  EXPECT_EQ(std::this_thread::get_id(), sub->callback_thread);
+}
+
+TEST_F(EventsTests, test_dispatch_queue_threads) {
+  auto pub = std::make_shared<FakeEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+
+  auto sub = std::make_shared<QueuedEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+  sub->startDispatchQueue(0, false, 2);
+  sub->lateInit();
+
+  // Both events are delivered while the first callback has not returned.
+  pub->fire(pub->createEventContext(), 0);
+  pub->fire(pub->createEventContext(), 0);
+  while (sub->callbacks < 2) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_EQ(0U, sub->queueDepth());
+
+  sub->released = true;
+  sub->stopDispatchQueue();
+  EXPECT_EQ(2U, sub->callbacks);
+}
+
 class SubFakeEventSubscriber : public FakeEventSubscriber {
  public:
   SubFakeEventSubscriber() {
@@ -452,4 +656,83 @@ TEST_F(EventsTests, test_event_toggle_subscribers) {
   EventFactory::registerEventSubscriber(sub);
   EXPECT_EQ(sub->state(), EventState::EVENT_PAUSED);
 }
+
+TEST_F(EventsTests, test_event_record) {
+  EventRecord record;
+  record.publisher = "FakePublisher";
+  record.offset = 1500;
+  // Captured input is binary and may contain newlines.
+  record.data = std::string("line\n\0line", 10);
+
+  std::stringstream stream;
+  writeEventRecord(stream, record);
+  record.offset = 3000;
+  record.data.clear();
+  writeEventRecord(stream, record);
+
+  EventRecord read;
+  ASSERT_TRUE(readEventRecord(stream, read));
+  EXPECT_EQ(read.publisher, "FakePublisher");
+  EXPECT_EQ(read.offset, 1500U);
+  EXPECT_EQ(read.data, std::string("line\n\0line", 10));
+
+  ASSERT_TRUE(readEventRecord(stream, read));
+  EXPECT_EQ(read.offset, 3000U);
+  EXPECT_TRUE(read.data.empty());
+  EXPECT_FALSE(readEventRecord(stream, read));
+
+  // A truncated record is invalid.
+  std::stringstream truncated("FakePublisher 0 10\nline");
+  EXPECT_FALSE(readEventRecord(truncated, read));
+}
+
+class ReplayEventPublisher
+    : public EventPublisher<FakeSubscriptionContext, FakeEventContext> {
+  DECLARE_PUBLISHER("ReplayPublisher");
+
+ public:
+  Status replay(const std::string& data) override {
+    if (data.empty()) {
+      return Status(1, "Empty record");
+    }
+    replayed.push_back(data);
+    fire(createEventContext());
+    return Status(0, "OK");
+  }
+
+  std::vector<std::string> replayed;
+};
+
+TEST_F(EventsTests, test_event_replay) {
+  auto pub = std::make_shared<ReplayEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+
+  auto path = (boost::filesystem::temp_directory_path() /
+               boost::filesystem::unique_path("osquery-replay-%%%%%%"))
+                  .string();
+  {
+    std::ofstream capture(path, std::ios::out | std::ios::binary);
+    writeEventRecord(capture, {"ReplayPublisher", 0, "first"});
+    writeEventRecord(capture, {"ReplayPublisher", 10, ""});
+    writeEventRecord(capture, {"MissingPublisher", 20, "missing"});
+    writeEventRecord(capture, {"ReplayPublisher", 30, "second"});
+  }
+
+  EventReplayRunner runner(path, 0);
+  EventReplayStats stats;
+  EXPECT_TRUE(runner.replay(stats).ok());
+  boost::filesystem::remove(path);
+
+  ASSERT_EQ(pub->replayed.size(), 2U);
+  EXPECT_EQ(pub->replayed[1], "second");
+  EXPECT_EQ(stats.records, 4U);
+  EXPECT_EQ(stats.failed, 2U);
+  EXPECT_EQ(stats.events, 2U);
+  EXPECT_EQ(stats.publishers["ReplayPublisher"], 3U);
+  EXPECT_FALSE(EventReplayRunner::report(stats).empty());
+
+  // A missing capture cannot be replayed.
+  EventReplayRunner missing(path, 0);
+  EXPECT_FALSE(missing.replay(stats).ok());
+}
 }
@@ -0,0 +1,410 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <ws2tcpip.h>
+
+// clang-format off
+#include "osquery/events/windows/etw.h"
+#include <tdh.h>
+// clang-format on
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/filesystem/fileops.h"
+
+namespace osquery {
+
+REGISTER(EtwEventPublisher, "event_publisher", "etw");
+
+/// The kernel providers may have a performance impact on the system.
+FLAG(bool,
+     disable_etw,
+     true,
+     "Disable receiving events from Event Tracing for Windows");
+
+FLAG(uint64,
+     etw_buffer_size,
+     64,
+     "Size in KB of each ETW session buffer (default 64)");
+
+FLAG(uint64,
+     etw_flush_interval,
+     1,
+     "Seconds before ETW delivers a partially filled buffer (default 1)");
+
+/// The trace session owned by the publisher.
+const wchar_t kEtwSessionName[] = L"osquery-etw";
+
+/// Microsoft-Windows-Kernel-Process
+const GUID kEtwProcessProvider = {
+    0x22fb2cd6,
+    0x0e7b,
+    0x422b,
+    {0xa0, 0xc7, 0x2f, 0xad, 0x1f, 0xd0, 0xe7, 0x16}};
+
+/// Microsoft-Windows-Kernel-Network
+const GUID kEtwNetworkProvider = {
+    0x7dd42a49,
+    0x5329,
+    0x4832,
+    {0x8d, 0xfd, 0x43, 0xd9, 0x79, 0x15, 0x3a, 0x88}};
+
+/// WINEVENT_KEYWORD_PROCESS, process start and stop without thread events.
+const ULONGLONG kEtwProcessKeywords = 0x10;
+
+/// KERNEL_NETWORK_KEYWORD_IPV4 and KERNEL_NETWORK_KEYWORD_IPV6.
+const ULONGLONG kEtwNetworkKeywords = 0x10 | 0x20;
+
+/// The minimum number of session buffers, enough to absorb a burst.
+const ULONG kEtwMinimumBuffers = 16;
+
+/// Read a fixed size property of an event record by name.
+template <typename T>
+static bool getProperty(PEVENT_RECORD record, LPCWSTR name, T& value) {
+  PROPERTY_DATA_DESCRIPTOR desc;
+  desc.PropertyName = reinterpret_cast<ULONGLONG>(name);
+  desc.ArrayIndex = ULONG_MAX;
+  desc.Reserved = 0;
+
+  ULONG size = 0;
+  if (TdhGetPropertySize(record, 0, nullptr, 1, &desc, &size) !=
+          ERROR_SUCCESS ||
+      size != sizeof(T)) {
+    return false;
+  }
+  return TdhGetProperty(record,
+                        0,
+                        nullptr,
+                        1,
+                        &desc,
+                        size,
+                        reinterpret_cast<PBYTE>(&value)) == ERROR_SUCCESS;
+}
+
+/// Read a string property of an event record by name.
+static bool getProperty(PEVENT_RECORD record,
+                        LPCWSTR name,
+                        std::string& value) {
+  PROPERTY_DATA_DESCRIPTOR desc;
+  desc.PropertyName = reinterpret_cast<ULONGLONG>(name);
+  desc.ArrayIndex = ULONG_MAX;
+  desc.Reserved = 0;
+
+  ULONG size = 0;
+  if (TdhGetPropertySize(record, 0, nullptr, 1, &desc, &size) !=
+          ERROR_SUCCESS ||
+      size < sizeof(wchar_t)) {
+    return false;
+  }
+
+  std::vector<wchar_t> buffer(size / sizeof(wchar_t) + 1, 0);
+  if (TdhGetProperty(record,
+                     0,
+                     nullptr,
+                     1,
+                     &desc,
+                     size,
+                     reinterpret_cast<PBYTE>(buffer.data())) !=
+      ERROR_SUCCESS) {
+    return false;
+  }
+  value = wstringToString(buffer.data());
+  return true;
+}
+
+/// Read the address and port properties of a network event.
+static void getEndpoint(PEVENT_RECORD record,
+                        bool ipv6,
+                        LPCWSTR addr_name,
+                        LPCWSTR port_name,
+                        std::string& address,
+                        uint16_t& port) {
+  char buffer[INET6_ADDRSTRLEN] = {0};
+  if (ipv6) {
+    IN6_ADDR addr;
+    if (getProperty(record, addr_name, addr)) {
+      inet_ntop(AF_INET6, &addr, buffer, sizeof(buffer));
+    }
+  } else {
+    IN_ADDR addr;
+    if (getProperty(record, addr_name, addr)) {
+      inet_ntop(AF_INET, &addr, buffer, sizeof(buffer));
+    }
+  }
+  address = buffer;
+
+  // The ports are in network byte order.
+  uint16_t value = 0;
+  if (getProperty(record, port_name, value)) {
+    port = ntohs(value);
+  }
+}
+
+Status EtwEventPublisher::setUp() {
+  if (FLAGS_disable_etw) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  WriteLock lock(mutex_);
+  return startSession();
+}
+
+Status EtwEventPublisher::startSession() {
+  auto init = [this]() {
+    properties_.assign(sizeof(EVENT_TRACE_PROPERTIES) + sizeof(kEtwSessionName),
+                       0);
+    auto props = reinterpret_cast<PEVENT_TRACE_PROPERTIES>(properties_.data());
+    props->Wnode.BufferSize = static_cast<ULONG>(properties_.size());
+    props->Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+    // Use the system time for event timestamps.
+    props->Wnode.ClientContext = 2;
+    props->LogFileMode = EVENT_TRACE_REAL_TIME_MODE;
+    props->BufferSize = static_cast<ULONG>(FLAGS_etw_buffer_size);
+    props->MinimumBuffers = kEtwMinimumBuffers;
+    props->MaximumBuffers = kEtwMinimumBuffers * 4;
+    props->FlushTimer = static_cast<ULONG>(FLAGS_etw_flush_interval);
+    props->LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
+    return props;
+  };
+
+  auto status = StartTraceW(&session_, kEtwSessionName, init());
+  if (status == ERROR_ALREADY_EXISTS) {
+    // A previous process did not stop the session, replace it.
+    ControlTraceW(0, kEtwSessionName, init(), EVENT_TRACE_CONTROL_STOP);
+    status = StartTraceW(&session_, kEtwSessionName, init());
+  }
+
+  if (status != ERROR_SUCCESS) {
+    session_ = 0;
+    return Status(status, "Cannot start the ETW session");
+  }
+  providers_ = 0;
+  events_lost_ = 0;
+  return Status(0, "OK");
+}
+
+void EtwEventPublisher::configure() {
+  size_t providers = 0;
+  for (const auto& sub : subscriptions_) {
+    providers |= getSubscriptionContext(sub->context)->providers;
+  }
+
+  WriteLock lock(mutex_);
+  if (session_ == 0) {
+    return;
+  }
+  enableProviders(providers);
+}
+
+void EtwEventPublisher::enableProviders(size_t providers) {
+  auto enable = [this, providers](EtwProvider provider,
+                                  const GUID& guid,
+                                  ULONGLONG keywords) {
+    if ((providers & provider) == (providers_ & provider)) {
+      return;
+    }
+
+    auto control = (providers & provider) ? EVENT_CONTROL_CODE_ENABLE_PROVIDER
+                                          : EVENT_CONTROL_CODE_DISABLE_PROVIDER;
+    auto status = EnableTraceEx2(session_,
+                                 &guid,
+                                 control,
+                                 TRACE_LEVEL_INFORMATION,
+                                 keywords,
+                                 0,
+                                 0,
+                                 nullptr);
+    if (status != ERROR_SUCCESS) {
+      LOG(WARNING) << "Cannot change ETW provider " << provider << ": "
+                   << status;
+      return;
+    }
+    providers_ ^= provider;
+  };
+
+  enable(ETW_PROVIDER_PROCESS, kEtwProcessProvider, kEtwProcessKeywords);
+  enable(ETW_PROVIDER_NETWORK, kEtwNetworkProvider, kEtwNetworkKeywords);
+}
+
+Status EtwEventPublisher::run() {
+  {
+    WriteLock lock(mutex_);
+    if (session_ == 0 || providers_ == 0) {
+      lock.unlock();
+      pause();
+      return Status(0, "OK");
+    }
+
+    EVENT_TRACE_LOGFILEW logfile;
+    ZeroMemory(&logfile, sizeof(logfile));
+    logfile.LoggerName = const_cast<LPWSTR>(kEtwSessionName);
+    logfile.ProcessTraceMode =
+        PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+    logfile.EventRecordCallback = recordCallback;
+    logfile.BufferCallback = bufferCallback;
+    logfile.Context = this;
+
+    consumer_ = OpenTraceW(&logfile);
+    if (consumer_ == INVALID_PROCESSTRACE_HANDLE) {
+      return Status(GetLastError(), "Cannot open the ETW session");
+    }
+  }
+
+  // Blocks and delivers buffers until the session is stopped.
+  auto status = ProcessTrace(&consumer_, 1, nullptr, nullptr);
+
+  WriteLock lock(mutex_);
+  if (consumer_ != INVALID_PROCESSTRACE_HANDLE) {
+    CloseTrace(consumer_);
+    consumer_ = INVALID_PROCESSTRACE_HANDLE;
+  }
+
+  if (status != ERROR_SUCCESS && status != ERROR_CANCELLED) {
+    return Status(status, "ETW session consumer failed");
+  }
+  return Status(0, "OK");
+}
+
+VOID WINAPI EtwEventPublisher::recordCallback(PEVENT_RECORD record) {
+  auto publisher = reinterpret_cast<EtwEventPublisher*>(record->UserContext);
+  if (publisher == nullptr || publisher->isEnding()) {
+    return;
+  }
+
+  auto ec = publisher->createEventContext();
+  if (parseRecord(record, *ec).ok()) {
+    publisher->fire(ec, ec->time);
+  }
+}
+
+ULONG WINAPI EtwEventPublisher::bufferCallback(PEVENT_TRACE_LOGFILEW logfile) {
+  auto publisher = reinterpret_cast<EtwEventPublisher*>(logfile->Context);
+  if (publisher == nullptr || publisher->isEnding()) {
+    return FALSE;
+  }
+
+  publisher->updateDropped();
+  return TRUE;
+}
+
+void EtwEventPublisher::updateDropped() {
+  WriteLock lock(mutex_);
+  if (session_ == 0) {
+    return;
+  }
+
+  std::vector<BYTE> buffer(properties_.size(), 0);
+  auto props = reinterpret_cast<PEVENT_TRACE_PROPERTIES>(buffer.data());
+  props->Wnode.BufferSize = static_cast<ULONG>(buffer.size());
+  props->LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
+  if (ControlTraceW(session_, nullptr, props, EVENT_TRACE_CONTROL_QUERY) !=
+      ERROR_SUCCESS) {
+    return;
+  }
+
+  if (props->EventsLost > events_lost_) {
+    dropped_count_ += props->EventsLost - events_lost_;
+  }
+  events_lost_ = props->EventsLost;
+}
+
+Status EtwEventPublisher::parseRecord(PEVENT_RECORD record,
+                                      EtwEventContext& ec) {
+  const auto& header = record->EventHeader;
+  FILETIME ft;
+  ft.dwLowDateTime = header.TimeStamp.LowPart;
+  ft.dwHighDateTime = header.TimeStamp.HighPart;
+  ec.time = filetimeToUnixtime(ft);
+
+  auto id = header.EventDescriptor.Id;
+  if (IsEqualGUID(header.ProviderId, kEtwProcessProvider)) {
+    ec.provider = ETW_PROVIDER_PROCESS;
+    if (id == 1) {
+      ec.action = ETW_ACTION_PROCESS_START;
+    } else if (id == 2) {
+      ec.action = ETW_ACTION_PROCESS_STOP;
+    } else {
+      return Status(1, "Unexpected process event");
+    }
+
+    uint32_t value = 0;
+    if (!getProperty(record, L"ProcessID", value)) {
+      return Status(1, "Missing process ID");
+    }
+    ec.pid = value;
+    if (getProperty(record, L"ParentProcessID", value)) {
+      ec.ppid = value;
+    }
+    if (getProperty(record, L"SessionID", value)) {
+      ec.session_id = value;
+    }
+    getProperty(record, L"ImageName", ec.path);
+    return Status(0, "OK");
+  }
+
+  if (IsEqualGUID(header.ProviderId, kEtwNetworkProvider)) {
+    ec.provider = ETW_PROVIDER_NETWORK;
+    // TCP events of the IPv4 task, the IPv6 events are numbered 16 after.
+    auto action = (id >= 28) ? id - 16 : id;
+    if (action == 12) {
+      ec.action = ETW_ACTION_SOCKET_CONNECT;
+    } else if (action == 15) {
+      ec.action = ETW_ACTION_SOCKET_ACCEPT;
+    } else if (action == 13) {
+      ec.action = ETW_ACTION_SOCKET_DISCONNECT;
+    } else {
+      return Status(1, "Unexpected network event");
+    }
+
+    // Network events are logged in the context of the system, not the
+    // process owning the socket.
+    uint32_t pid = 0;
+    if (!getProperty(record, L"PID", pid)) {
+      return Status(1, "Missing process ID");
+    }
+    ec.pid = pid;
+
+    bool ipv6 = (id >= 28);
+    ec.family = (ipv6) ? AF_INET6 : AF_INET;
+    ec.protocol = IPPROTO_TCP;
+    getEndpoint(
+        record, ipv6, L"saddr", L"sport", ec.local_address, ec.local_port);
+    getEndpoint(
+        record, ipv6, L"daddr", L"dport", ec.remote_address, ec.remote_port);
+    return Status(0, "OK");
+  }
+  return Status(1, "Unexpected provider");
+}
+
+bool EtwEventPublisher::shouldFire(const EtwSubscriptionContextRef& sc,
+                                   const EtwEventContextRef& ec) const {
+  return (sc->providers & ec->provider) != 0;
+}
+
+void EtwEventPublisher::stop() {
+  WriteLock lock(mutex_);
+  if (session_ != 0) {
+    // Stopping the session ends ProcessTrace after the remaining buffers.
+    std::vector<BYTE> buffer(properties_.size(), 0);
+    auto props = reinterpret_cast<PEVENT_TRACE_PROPERTIES>(buffer.data());
+    props->Wnode.BufferSize = static_cast<ULONG>(buffer.size());
+    props->LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
+    ControlTraceW(session_, nullptr, props, EVENT_TRACE_CONTROL_STOP);
+    session_ = 0;
+    providers_ = 0;
+  }
+}
+
+void EtwEventPublisher::tearDown() {
+  stop();
+}
+}
@@ -0,0 +1,157 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#define _WIN32_DCOM
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <evntcons.h>
+#include <evntrace.h>
+
+#include <vector>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/// The ETW providers the publisher enables for its subscriptions.
+enum EtwProvider {
+  ETW_PROVIDER_PROCESS = 1,
+  ETW_PROVIDER_NETWORK = 1 << 1,
+};
+
+/// The actions of the events the publisher parses.
+enum EtwAction {
+  ETW_ACTION_UNKNOWN = 0,
+  ETW_ACTION_PROCESS_START,
+  ETW_ACTION_PROCESS_STOP,
+  ETW_ACTION_SOCKET_CONNECT,
+  ETW_ACTION_SOCKET_ACCEPT,
+  ETW_ACTION_SOCKET_DISCONNECT,
+};
+
+/**
+ * @brief Subscription details for ETW events.
+ *
+ * Subscribers name the providers they consume, the trace session only
+ * enables providers with at least one subscription.
+ */
+struct EtwSubscriptionContext : public SubscriptionContext {
+  /// A bitmask of EtwProvider values.
+  size_t providers{0};
+
+ private:
+  friend class EtwEventPublisher;
+};
+
+/**
+ * @brief Event details for EtwEventPublisher events.
+ *
+ * Process and network events share a context, the network fields are only
+ * set for network events.
+ */
+struct EtwEventContext : public EventContext {
+  EtwProvider provider{ETW_PROVIDER_PROCESS};
+  EtwAction action{ETW_ACTION_UNKNOWN};
+
+  /// The time of the event in UNIX time.
+  EventTime time{0};
+
+  uint64_t pid{0};
+  uint64_t ppid{0};
+  uint64_t session_id{0};
+
+  /// The image path of a started process.
+  std::string path;
+
+  /// AF_INET or AF_INET6 for network events.
+  int family{0};
+  /// IPPROTO_TCP or IPPROTO_UDP for network events.
+  int protocol{0};
+  std::string local_address;
+  std::string remote_address;
+  uint16_t local_port{0};
+  uint16_t remote_port{0};
+};
+
+using EtwEventContextRef = std::shared_ptr<EtwEventContext>;
+using EtwSubscriptionContextRef = std::shared_ptr<EtwSubscriptionContext>;
+
+/**
+ * @brief An Event Tracing for Windows real-time consumer.
+ *
+ * The publisher owns a real-time trace session with the kernel process and
+ * network providers enabled. ETW collects events into the session's buffers
+ * and delivers them to this publisher's thread when a buffer fills or the
+ * flush timer expires, so events are parsed and fired in batches rather than
+ * as they occur. Events lost because the consumer fell behind are reported
+ * by the session and counted as dropped.
+ */
+class EtwEventPublisher
+    : public EventPublisher<EtwSubscriptionContext, EtwEventContext> {
+  DECLARE_PUBLISHER("etw");
+
+ public:
+  Status setUp() override;
+
+  void configure() override;
+
+  void tearDown() override;
+
+  /// Consume the trace session until it is stopped.
+  Status run() override;
+
+  bool shouldFire(const EtwSubscriptionContextRef& sc,
+                  const EtwEventContextRef& ec) const override;
+
+  /// Parse an event record of an enabled provider.
+  static Status parseRecord(PEVENT_RECORD record, EtwEventContext& ec);
+
+ private:
+  /// Start the trace session, replacing a session left by a previous run.
+  Status startSession();
+
+  /// Enable the providers used by subscriptions and disable the others.
+  void enableProviders(size_t providers);
+
+  /// Stop the trace session, which ends a consumer's ProcessTrace.
+  void stop() override;
+
+  /// ETW calls this for each event record, on the thread in ProcessTrace.
+  static VOID WINAPI recordCallback(PEVENT_RECORD record);
+
+  /// ETW calls this after each delivered buffer, returning false ends it.
+  static ULONG WINAPI bufferCallback(PEVENT_TRACE_LOGFILEW logfile);
+
+  /// Count the events the session lost since the last buffer.
+  void updateDropped();
+
+ private:
+  /// The session's properties, followed by its name.
+  std::vector<BYTE> properties_;
+
+  TRACEHANDLE session_{0};
+  TRACEHANDLE consumer_{INVALID_PROCESSTRACE_HANDLE};
+
+  /// The bitmask of enabled providers.
+  size_t providers_{0};
+
+  /// Events lost by the session at the last buffer.
+  ULONG events_lost_{0};
+
+  /// Protects the session handles from a reconfigure or stop.
+  Mutex mutex_;
+
+ public:
+  friend class EtwTests;
+  FRIEND_TEST(EtwTests, test_should_fire);
+};
+}
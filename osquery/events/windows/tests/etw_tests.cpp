@@ -0,0 +1,47 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/windows/etw.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+
+class EtwTests : public testing::Test {};
+
+TEST_F(EtwTests, test_register_event_pub) {
+  auto pub = std::make_shared<EtwEventPublisher>();
+  auto status = EventFactory::registerEventPublisher(pub);
+  EXPECT_TRUE(status.ok());
+
+  status = EventFactory::deregisterEventPublisher("etw");
+  EXPECT_TRUE(status.ok());
+}
+
+TEST_F(EtwTests, test_should_fire) {
+  auto pub = std::make_shared<EtwEventPublisher>();
+
+  auto sc = pub->createSubscriptionContext();
+  sc->providers = ETW_PROVIDER_NETWORK;
+
+  auto ec = pub->createEventContext();
+  ec->provider = ETW_PROVIDER_PROCESS;
+  EXPECT_FALSE(pub->shouldFire(sc, ec));
+
+  ec->provider = ETW_PROVIDER_NETWORK;
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+
+  sc->providers = ETW_PROVIDER_PROCESS | ETW_PROVIDER_NETWORK;
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+}
+}
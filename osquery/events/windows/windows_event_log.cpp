@@ -12,10 +12,15 @@
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
+#include <algorithm>
+#include <set>
+#include <vector>
+
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/tokenizer.hpp>
 
+#include <osquery/database.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
@@ -28,35 +33,136 @@ namespace osquery {
 
 REGISTER(WindowsEventLogEventPublisher, "event_publisher", "windows_event_log");
 
+FLAG(bool,
+     windows_event_bookmarks,
+     true,
+     "Resume Windows event log channels after the last event read");
+
 const std::chrono::milliseconds kWinEventLogPause(200);
 
+/// Number of events requested from a channel with each EvtNext.
+const DWORD kWinEventLogBatch = 64;
+
+/// Prefix of the persisted channel bookmarks.
+const std::string kWinEventLogBookmarkPrefix = "windows_event_log.bookmark.";
+
+/**
+ * @brief Render an event, bookmark or values into a reusable buffer.
+ *
+ * @param buffer (output) The rendered content, grown as needed.
+ * @param count (output) The number of rendered values.
+ */
+static Status renderHandle(EVT_HANDLE context,
+                           EVT_HANDLE handle,
+                           DWORD flags,
+                           std::vector<BYTE>& buffer,
+                           DWORD& count) {
+  DWORD used = 0;
+  if (!EvtRender(context,
+                 handle,
+                 flags,
+                 static_cast<DWORD>(buffer.size()),
+                 buffer.data(),
+                 &used,
+                 &count)) {
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+      return Status(GetLastError(), "Event rendering failed");
+    }
+    buffer.resize(used);
+    if (!EvtRender(context,
+                   handle,
+                   flags,
+                   static_cast<DWORD>(buffer.size()),
+                   buffer.data(),
+                   &used,
+                   &count)) {
+      return Status(GetLastError(), "Event rendering failed");
+    }
+  }
+  return Status(0, "OK");
+}
+
 void WindowsEventLogEventPublisher::configure() {
   stop();
+
+  WriteLock lock(mutex_);
+  if (render_context_ == nullptr) {
+    render_context_ =
+        EvtCreateRenderContext(0, nullptr, EvtRenderContextSystem);
+  }
+
+  // Subscribers asking for the same channel share its subscription.
+  std::set<std::wstring> channels;
   for (auto& sub : subscriptions_) {
     auto sc = getSubscriptionContext(sub->context);
-    for (const auto& chan : sc->sources) {
-      /*
-       * We don't apply any filtering to the Windows event logs. It's assumed
-       * that if filtering is required, this will be handled via SQL queries
-       * or in the subscriber logic.
-       */
-      auto hSubscription =
-          EvtSubscribe(nullptr,
-                       nullptr,
-                       chan.c_str(),
-                       L"*",
-                       nullptr,
-                       nullptr,
-                       EVT_SUBSCRIBE_CALLBACK(winEventCallback),
-                       EvtSubscribeToFutureEvents);
-      if (hSubscription == nullptr) {
-        LOG(WARNING) << "Failed to subscribe to "
-                     << wstringToString(chan.c_str()) << ": " << GetLastError();
-      } else {
-        win_event_handles_.push_back(hSubscription);
-      }
+    channels.insert(sc->sources.begin(), sc->sources.end());
+  }
+
+  for (const auto& chan : channels) {
+    auto s = subscribeChannel(chan);
+    if (!s.ok()) {
+      LOG(WARNING) << "Failed to subscribe to " << wstringToString(chan.c_str())
+                   << ": " << s.getCode();
+    }
+  }
+}
+
+Status WindowsEventLogEventPublisher::subscribeChannel(
+    const std::wstring& channel) {
+  ChannelSubscription sub;
+  sub.channel = channel;
+
+  if (FLAGS_windows_event_bookmarks) {
+    std::string content;
+    auto key = kWinEventLogBookmarkPrefix + wstringToString(channel.c_str());
+    if (getDatabaseValue(kPersistentSettings, key, content) &&
+        !content.empty()) {
+      sub.bookmark = EvtCreateBookmark(stringToWstring(content).c_str());
+    }
+  }
+
+  /*
+   * We don't apply any filtering to the Windows event logs. It's assumed
+   * that if filtering is required, this will be handled via SQL queries
+   * or in the subscriber logic.
+   */
+  DWORD flags = EvtSubscribeToFutureEvents;
+  if (sub.bookmark != nullptr) {
+    flags = EvtSubscribeStartAfterBookmark;
+  } else if (FLAGS_windows_event_bookmarks) {
+    sub.bookmark = EvtCreateBookmark(nullptr);
+  }
+
+  // The signal is set while the subscription has events to pull.
+  sub.signal = CreateEvent(nullptr, FALSE, TRUE, nullptr);
+  if (sub.signal == nullptr) {
+    if (sub.bookmark != nullptr) {
+      EvtClose(sub.bookmark);
+    }
+    return Status(GetLastError(), "Cannot create subscription signal");
+  }
+
+  sub.subscription = EvtSubscribe(nullptr,
+                                  sub.signal,
+                                  channel.c_str(),
+                                  L"*",
+                                  (flags == EvtSubscribeStartAfterBookmark)
+                                      ? sub.bookmark
+                                      : nullptr,
+                                  nullptr,
+                                  nullptr,
+                                  flags);
+  if (sub.subscription == nullptr) {
+    auto error = GetLastError();
+    CloseHandle(sub.signal);
+    if (sub.bookmark != nullptr) {
+      EvtClose(sub.bookmark);
     }
+    return Status(error, "EvtSubscribe failed");
   }
+
+  channels_.push_back(sub);
+  return Status(0, "OK");
 }
 
 void WindowsEventLogEventPublisher::restart() {
@@ -64,90 +170,201 @@ void WindowsEventLogEventPublisher::restart() {
 }
 
 Status WindowsEventLogEventPublisher::run() {
-  pause();
+  std::vector<HANDLE> signals;
+  {
+    WriteLock lock(mutex_);
+    for (const auto& channel : channels_) {
+      signals.push_back(channel.signal);
+    }
+  }
+
+  if (signals.empty()) {
+    pause();
+    return Status(0, "OK");
+  }
+
+  // Channels beyond the wait limit are drained when the wait times out.
+  auto count = std::min<size_t>(signals.size(), MAXIMUM_WAIT_OBJECTS);
+  WaitForMultipleObjects(static_cast<DWORD>(count),
+                         signals.data(),
+                         FALSE,
+                         static_cast<DWORD>(kWinEventLogPause.count()));
+
+  WriteLock lock(mutex_);
+  for (auto& channel : channels_) {
+    drain(channel);
+  }
   return Status(0, "OK");
 }
 
+void WindowsEventLogEventPublisher::drain(ChannelSubscription& channel) {
+  EVT_HANDLE events[kWinEventLogBatch];
+  DWORD returned = 0;
+  bool updated = false;
+  while (EvtNext(
+      channel.subscription, kWinEventLogBatch, events, 0, 0, &returned)) {
+    for (DWORD i = 0; i < returned; i++) {
+      auto ec = createEventContext();
+      auto s = renderSystem(render_context_, events[i], *ec);
+      if (s.ok()) {
+        s = parseEvent(events[i], ec->eventRecord);
+      }
+      if (s.ok()) {
+        EventFactory::fire<WindowsEventLogEventPublisher>(ec);
+      } else {
+        VLOG(1) << "Error rendering Windows event log: " << s.getCode();
+      }
+
+      if (channel.bookmark != nullptr &&
+          EvtUpdateBookmark(channel.bookmark, events[i])) {
+        updated = true;
+      }
+      EvtClose(events[i]);
+    }
+  }
+
+  if (GetLastError() != ERROR_NO_MORE_ITEMS) {
+    VLOG(1) << "Windows event log read failed: " << GetLastError();
+  }
+
+  if (updated) {
+    saveBookmark(channel);
+  }
+}
+
+void WindowsEventLogEventPublisher::saveBookmark(
+    const ChannelSubscription& channel) {
+  std::vector<BYTE> buffer;
+  DWORD count = 0;
+  auto s = renderHandle(
+      nullptr, channel.bookmark, EvtRenderBookmark, buffer, count);
+  if (!s.ok()) {
+    VLOG(1) << "Cannot render Windows event log bookmark: " << s.getCode();
+    return;
+  }
+
+  auto key =
+      kWinEventLogBookmarkPrefix + wstringToString(channel.channel.c_str());
+  setDatabaseValue(kPersistentSettings,
+                   key,
+                   wstringToString(reinterpret_cast<LPWSTR>(buffer.data())));
+}
+
 void WindowsEventLogEventPublisher::stop() {
-  for (auto& e : win_event_handles_) {
-    if (e != nullptr) {
-      EvtClose(e);
+  WriteLock lock(mutex_);
+  for (auto& channel : channels_) {
+    if (channel.subscription != nullptr) {
+      EvtClose(channel.subscription);
+    }
+    if (channel.bookmark != nullptr) {
+      EvtClose(channel.bookmark);
+    }
+    if (channel.signal != nullptr) {
+      CloseHandle(channel.signal);
     }
   }
-  win_event_handles_.clear();
+  channels_.clear();
 }
 
 void WindowsEventLogEventPublisher::tearDown() {
   stop();
+
+  WriteLock lock(mutex_);
+  if (render_context_ != nullptr) {
+    EvtClose(render_context_);
+    render_context_ = nullptr;
+  }
 }
 
-unsigned long __stdcall WindowsEventLogEventPublisher::winEventCallback(
-    EVT_SUBSCRIBE_NOTIFY_ACTION action, PVOID pContext, EVT_HANDLE hEvent) {
-  UNREFERENCED_PARAMETER(pContext);
-
-  switch (action) {
-  case EvtSubscribeActionError:
-    VLOG(1) << "Windows event callback failed: " << hEvent;
-    break;
-  case EvtSubscribeActionDeliver: {
-    pt::ptree propTree;
-    auto s = parseEvent(hEvent, propTree);
-    if (s.ok()) {
-      auto ec = createEventContext();
-      /// We leave the parsing of the properties up to the subscriber
-      ec->eventRecord = propTree;
-      ec->channel = stringToWstring(propTree.get("Event.System.Channel", ""));
-      EventFactory::fire<WindowsEventLogEventPublisher>(ec);
-    } else {
-      VLOG(1) << "Error rendering Windows event log: " << s.getCode();
-    }
-  } break;
+/// Format a FILETIME as the SystemTime attribute of the event XML.
+static std::string formatSystemTime(const FILETIME& ft) {
+  SYSTEMTIME st;
+  if (!FileTimeToSystemTime(&ft, &st)) {
+    return "";
+  }
 
-  default:
-    VLOG(1) << "Received unknown action from Windows event log: "
-            << GetLastError();
+  ULARGE_INTEGER ticks;
+  ticks.LowPart = ft.dwLowDateTime;
+  ticks.HighPart = ft.dwHighDateTime;
+  char buffer[64] = {0};
+  snprintf(buffer,
+           sizeof(buffer),
+           "%04d-%02d-%02dT%02d:%02d:%02d.%09lluZ",
+           st.wYear,
+           st.wMonth,
+           st.wDay,
+           st.wHour,
+           st.wMinute,
+           st.wSecond,
+           (ticks.QuadPart % 10000000ULL) * 100);
+  return buffer;
+}
+
+Status WindowsEventLogEventPublisher::renderSystem(
+    EVT_HANDLE context, EVT_HANDLE evt, WindowsEventLogEventContext& ec) {
+  std::vector<BYTE> buffer;
+  DWORD count = 0;
+  auto s = renderHandle(context, evt, EvtRenderEventValues, buffer, count);
+  if (!s.ok()) {
+    return s;
+  }
+  if (count < EvtSystemPropertyIdEND) {
+    return Status(1, "Missing event System properties");
+  }
+
+  auto values = reinterpret_cast<PEVT_VARIANT>(buffer.data());
+  auto value = [values](EVT_SYSTEM_PROPERTY_ID id) -> const EVT_VARIANT* {
+    return (values[id].Type == EvtVarTypeNull) ? nullptr : &values[id];
+  };
+
+  if (auto v = value(EvtSystemChannel)) {
+    ec.channel = v->StringVal;
+  }
+  if (auto v = value(EvtSystemProviderName)) {
+    ec.provider_name = wstringToString(v->StringVal);
+  }
+  if (auto v = value(EvtSystemProviderGuid)) {
+    WCHAR guid[40] = {0};
+    if (StringFromGUID2(*v->GuidVal, guid, 40) > 0) {
+      ec.provider_guid = wstringToString(guid);
+    }
+  }
+  if (auto v = value(EvtSystemTimeCreated)) {
+    FILETIME ft;
+    ft.dwLowDateTime = static_cast<DWORD>(v->FileTimeVal);
+    ft.dwHighDateTime = static_cast<DWORD>(v->FileTimeVal >> 32);
+    ec.datetime = formatSystemTime(ft);
+  }
+  if (auto v = value(EvtSystemEventID)) {
+    ec.eventid = v->UInt16Val;
+  }
+  if (auto v = value(EvtSystemTask)) {
+    ec.task = v->UInt16Val;
   }
-  return ERROR_SUCCESS;
+  if (auto v = value(EvtSystemLevel)) {
+    ec.level = v->ByteVal;
+  }
+  if (auto v = value(EvtSystemKeywords)) {
+    ec.keywords = static_cast<int64_t>(v->UInt64Val);
+  }
+  if (auto v = value(EvtSystemEventRecordId)) {
+    ec.record_id = v->UInt64Val;
+  }
+  return Status(0, "OK");
 }
 
 Status WindowsEventLogEventPublisher::parseEvent(EVT_HANDLE evt,
                                                  pt::ptree& propTree) {
-  unsigned long buffSize = 0;
-  unsigned long buffUsed = 0;
-  unsigned long propCount = 0;
-  LPWSTR xml = nullptr;
-  auto ret = EvtRender(
-      nullptr, evt, EvtRenderEventXml, buffSize, xml, &buffUsed, &propCount);
-  if (ret == 0) {
-    if (GetLastError() == ERROR_INSUFFICIENT_BUFFER) {
-      buffSize = buffUsed;
-      xml = static_cast<LPWSTR>(malloc(buffSize));
-      EvtRender(nullptr,
-                evt,
-                EvtRenderEventXml,
-                buffSize,
-                xml,
-                &buffUsed,
-                &propCount);
-    } else {
-      return Status(GetLastError(), "Event rendering failed");
-    }
-  }
-  if (GetLastError() != ERROR_SUCCESS) {
-    if (xml != nullptr) {
-      free(xml);
-      xml = nullptr;
-    }
-    return Status(GetLastError(), "Event rendering failed");
+  std::vector<BYTE> buffer;
+  DWORD count = 0;
+  auto s = renderHandle(nullptr, evt, EvtRenderEventXml, buffer, count);
+  if (!s.ok()) {
+    return s;
   }
+
   std::stringstream ss;
-  ss << wstringToString(xml);
+  ss << wstringToString(reinterpret_cast<LPWSTR>(buffer.data()));
   read_xml(ss, propTree);
-
-  if (xml != nullptr) {
-    free(xml);
-    xml = nullptr;
-  }
   return Status(0, "OK");
 }
 
@@ -158,6 +375,6 @@ bool WindowsEventLogEventPublisher::shouldFire(
 }
 
 bool WindowsEventLogEventPublisher::isSubscriptionActive() const {
-  return win_event_handles_.size() > 0;
+  return channels_.size() > 0;
 }
 }
@@ -37,15 +37,26 @@ struct WindowsEventLogSubscriptionContext : public SubscriptionContext {
 /**
  * @brief Event details for WindowsEventLogEventPublisher events.
  *
- * It is the responsibility of the subscriber to understand the best
- * way in which to parse the event data. The publisher will convert the
- * Event Log record into a boost::property_tree, and return the tree to
- * the subscriber for further parsing and row population.
+ * The System properties of each event are rendered as values, without XML.
+ * It is the responsibility of the subscriber to understand the best way in
+ * which to parse the event data. The publisher will convert the Event Log
+ * record into a boost::property_tree, and return the tree to the subscriber
+ * for further parsing and row population.
  */
 struct WindowsEventLogEventContext : public EventContext {
   /// A Windows event log record converted from XML
   boost::property_tree::ptree eventRecord;
 
+  /// The System properties, rendered from EvtRenderContextSystem values.
+  std::string provider_name;
+  std::string provider_guid;
+  std::string datetime;
+  int eventid{-1};
+  int task{-1};
+  int level{-1};
+  int64_t keywords{-1};
+  uint64_t record_id{0};
+
   /*
    * In Windows event logs, the source to which an event belongs is referred
    * to as the 'channel'. We keep track of the channel for each event, as the
@@ -85,13 +96,14 @@ class WindowsEventLogEventPublisher
   /// The calling for beginning the thread's run loop.
   Status run() override;
 
-  /// Windows Event Callback required for API calls
-  static unsigned long __stdcall winEventCallback(
-      EVT_SUBSCRIBE_NOTIFY_ACTION action, PVOID pContext, EVT_HANDLE hEvent);
-
   /// Helper function to convert an XML event blob into a property tree
-  static Status WindowsEventLogEventPublisher::parseEvent(
-      EVT_HANDLE evt, boost::property_tree::ptree& propTree);
+  static Status parseEvent(EVT_HANDLE evt,
+                           boost::property_tree::ptree& propTree);
+
+  /// Render the System properties of an event as values.
+  static Status renderSystem(EVT_HANDLE context,
+                             EVT_HANDLE evt,
+                             WindowsEventLogEventContext& ec);
 
  private:
   /// Restarts the osquery Windows Event Log Events publisher
@@ -104,8 +116,35 @@ class WindowsEventLogEventPublisher
   bool isSubscriptionActive() const;
 
  private:
-  /// Vector of all handles to windows event log publisher callbacks
-  std::vector<EVT_HANDLE> win_event_handles_;
+  /// A pull subscription to a channel, signaled when events are available.
+  struct ChannelSubscription {
+    std::wstring channel;
+    EVT_HANDLE subscription{nullptr};
+
+    /// The last event read, persisted so a restart resumes after it.
+    EVT_HANDLE bookmark{nullptr};
+
+    HANDLE signal{nullptr};
+  };
+
+  /// Subscribe to a channel, after its persisted bookmark if one exists.
+  Status subscribeChannel(const std::wstring& channel);
+
+  /// Read the available events of a channel in batches and fire them.
+  void drain(ChannelSubscription& channel);
+
+  /// Persist the bookmark of a channel.
+  void saveBookmark(const ChannelSubscription& channel);
+
+ private:
+  /// The pull subscriptions, one for each distinct channel.
+  std::vector<ChannelSubscription> channels_;
+
+  /// Render context selecting the System properties of events.
+  EVT_HANDLE render_context_{nullptr};
+
+  /// Protects the channel subscriptions from a reconfigure while draining.
+  Mutex mutex_;
 
  public:
   friend class WindowsEventLogTests;
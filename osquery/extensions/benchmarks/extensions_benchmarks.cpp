@@ -0,0 +1,168 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/extensions.h>
+#include <osquery/filesystem.h>
+#include <osquery/registry.h>
+#include <osquery/tables.h>
+
+#include "osquery/extensions/interface.h"
+#include "osquery/filesystem/fileops.h"
+#include "osquery/tests/test_util.h"
+
+using namespace osquery::extensions;
+
+namespace osquery {
+
+/// The example extension's table, called through an extension socket.
+class BenchmarkExampleTable : public TablePlugin {
+ private:
+  TableColumns columns() const {
+    return {
+        std::make_tuple("example_text", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple(
+            "example_integer", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  QueryData generate(QueryContext& request) {
+    QueryData results;
+
+    Row r;
+    r["example_text"] = "example";
+    r["example_integer"] = INTEGER(1);
+
+    results.push_back(r);
+    return results;
+  }
+};
+
+/**
+ * @brief Start an extension manager and an extension within this process.
+ *
+ * The extension broadcasts the example table, which is answered by the local
+ * registry. Returns the extension socket path, or empty on failure.
+ */
+static std::string startBenchmarkExtension() {
+  static std::string extension_path;
+  if (!extension_path.empty()) {
+    return extension_path;
+  }
+
+  auto manager_path = kTestWorkingDirectory + "benchmarkextmgr";
+  remove(manager_path);
+  if (!startExtensionManager(manager_path).ok()) {
+    return "";
+  }
+
+  auto& rf = RegistryFactory::get();
+  rf.registry("table")->add("example_benchmark",
+                            std::make_shared<BenchmarkExampleTable>());
+  rf.allowDuplicates(true);
+  auto status = startExtension(manager_path, "bench", "0.1", "0.0.0", "0.0.0");
+  if (!status.ok()) {
+    return "";
+  }
+
+  extension_path = manager_path + "." + status.getMessage();
+  for (size_t delay = 0; delay < 3000; delay += 20) {
+    if (socketExists(extension_path).ok()) {
+      break;
+    }
+    sleepFor(20);
+  }
+  return extension_path;
+}
+
+/// Table calls per second, using the protocol set by --extensions_compact.
+static void EXT_call_table_pooled(benchmark::State& state) {
+  auto path = startBenchmarkExtension();
+  while (state.KeepRunning()) {
+    PluginResponse response;
+    callExtension(
+        path, "table", "example_benchmark", {{"action", "generate"}}, response);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(EXT_call_table_pooled);
+
+static void EXT_call_table_connect(benchmark::State& state) {
+  // Each call opens a new connection and pings before the call.
+  auto path = startBenchmarkExtension();
+  while (state.KeepRunning()) {
+    ExtensionResponse response;
+    try {
+      ExtensionStatus status;
+      EXClient(path).get()->ping(status);
+      EXClient client(path);
+      client.get()->call(
+          response, "table", "example_benchmark", {{"action", "generate"}});
+    } catch (const std::exception& /* e */) {
+      break;
+    }
+  }
+}
+
+BENCHMARK(EXT_call_table_connect);
+
+/**
+ * @brief Write and read a table response with a transport and protocol.
+ *
+ * The range is the number of rows, each with several columns. The items
+ * processed are the rows, which compares the encoding cost of the binary
+ * and compact protocols without the socket.
+ */
+static void encodeTableResponse(benchmark::State& state, bool compact) {
+  ExtensionResponse response;
+  for (int i = 0; i < state.range_x(); i++) {
+    response.response.push_back({{"pid", std::to_string(i)},
+                                 {"name", "osqueryd"},
+                                 {"path", "/usr/bin/osqueryd"},
+                                 {"uid", "0"},
+                                 {"resident_size", "41943040"}});
+  }
+
+  auto memory = SHARED_PTR_IMPL<TMemoryBuffer>(new TMemoryBuffer());
+  TTransportRef transport;
+  TProtocolRef protocol;
+  if (compact) {
+    transport.reset(new TFramedTransport(memory));
+    protocol.reset(new TCompactProtocol(transport));
+  } else {
+    transport.reset(new TBufferedTransport(memory));
+    protocol.reset(new TBinaryProtocol(transport));
+  }
+
+  while (state.KeepRunning()) {
+    memory->resetBuffer();
+    response.write(protocol.get());
+    transport->flush();
+
+    ExtensionResponse decoded;
+    decoded.read(protocol.get());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range_x());
+}
+
+static void EXT_encode_binary(benchmark::State& state) {
+  encodeTableResponse(state, false);
+}
+
+BENCHMARK(EXT_encode_binary)->Arg(1)->Arg(1000);
+
+static void EXT_encode_compact(benchmark::State& state) {
+  encodeTableResponse(state, true);
+}
+
+BENCHMARK(EXT_encode_compact)->Arg(1)->Arg(1000);
+}
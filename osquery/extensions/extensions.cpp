@@ -8,12 +8,18 @@
  *
  */
 
+#include <chrono>
+#include <condition_variable>
 #include <csignal>
+#include <limits>
+#include <mutex>
+#include <set>
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/trim.hpp>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/registry.h>
@@ -21,9 +27,11 @@
 #include <osquery/system.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/metrics.h"
 #include "osquery/core/process.h"
 #include "osquery/core/watcher.h"
 #include "osquery/extensions/interface.h"
+#include "osquery/extensions/shared_memory.h"
 #include "osquery/filesystem/fileops.h"
 
 using namespace osquery::extensions;
@@ -85,6 +93,174 @@ CLI_FLAG(string,
          "",
          "Comma-separated list of required extensions");
 
+FLAG(uint64,
+     extensions_page_rows,
+     5000,
+     "Rows in each page of an extension table, 0 disables paging");
+
+FLAG(uint64,
+     extensions_shared_memory,
+     0,
+     "KB of shared memory an extension offers for table pages, 0 disables");
+
+FLAG(uint64,
+     extensions_route_concurrency,
+     16,
+     "Concurrent calls to each extension registry, 0 is unlimited");
+
+CLI_FLAG(bool,
+         extensions_compact,
+         false,
+         "Use a framed transport and compact protocol for extension sockets");
+
+FLAG(bool,
+     extensions_cache_routes,
+     false,
+     "Attach extension tables from their previous registration at startup");
+
+/// Database key prefix of the table routes registered by each extension.
+const std::string kExtensionRoutesPrefix = "extension_routes.";
+
+/// Registrations received before the database is available.
+static std::map<std::string, RegistryBroadcast> kPendingExtensionRoutes;
+static bool kExtensionRoutesLoaded{false};
+static Mutex kExtensionRoutesMutex;
+
+/// Extensions that do not implement paged table generation.
+static std::set<RouteUUID> kUnpagedExtensions;
+
+/// Protect the set of extensions without paging.
+static Mutex kUnpagedExtensionsMutex;
+
+/// Running calls for each extension route and registry.
+static std::map<std::pair<RouteUUID, std::string>, size_t> kRouteActive;
+
+/// Call metrics for each extension route.
+static std::map<RouteUUID, ExtensionRouteMetrics> kRouteMetrics;
+
+/// Protect the route calls, and wake calls waiting for a slot.
+static std::mutex kRouteMutex;
+static std::condition_variable kRouteCondition;
+
+/// The steady time in milliseconds of the last completed call to each path.
+static std::map<std::string, size_t> kEXClientHealth;
+
+/// Protect the socket path health.
+static Mutex kEXClientHealthMutex;
+
+static size_t getSteadyTime() {
+  return static_cast<size_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+void EXClientHealth::success(const std::string& path) {
+  auto now = getSteadyTime();
+  WriteLock lock(kEXClientHealthMutex);
+  kEXClientHealth[path] = now;
+}
+
+void EXClientHealth::failure(const std::string& path) {
+  WriteLock lock(kEXClientHealthMutex);
+  kEXClientHealth.erase(path);
+}
+
+bool EXClientHealth::recent(const std::string& path, size_t milliseconds) {
+  auto now = getSteadyTime();
+  ReadLock lock(kEXClientHealthMutex);
+  auto it = kEXClientHealth.find(path);
+  return (it != kEXClientHealth.end() && now - it->second < milliseconds);
+}
+
+ExtensionRouteSlot::ExtensionRouteSlot(RouteUUID uuid,
+                                       const std::string& registry)
+    : uuid_(uuid), registry_(registry) {
+  auto start = getSteadyTime();
+  std::unique_lock<std::mutex> lock(kRouteMutex);
+  auto& metrics = kRouteMetrics[uuid_];
+  auto& active = kRouteActive[std::make_pair(uuid_, registry_)];
+  metrics.queued++;
+  kRouteCondition.wait(lock, [&active]() {
+    return FLAGS_extensions_route_concurrency == 0 ||
+           active < FLAGS_extensions_route_concurrency;
+  });
+  metrics.queued--;
+
+  active++;
+  metrics.active++;
+  metrics.calls++;
+  auto wait = getSteadyTime() - start;
+  metrics.wait += wait;
+  metrics.max_wait = std::max(metrics.max_wait, wait);
+}
+
+ExtensionRouteSlot::~ExtensionRouteSlot() {
+  {
+    std::lock_guard<std::mutex> lock(kRouteMutex);
+    kRouteActive[std::make_pair(uuid_, registry_)]--;
+    kRouteMetrics[uuid_].active--;
+  }
+  kRouteCondition.notify_all();
+}
+
+std::map<RouteUUID, ExtensionRouteMetrics> getExtensionRouteMetrics() {
+  std::lock_guard<std::mutex> lock(kRouteMutex);
+  return kRouteMetrics;
+}
+
+/// Forget the metrics of an extension that has gone away.
+static void removeRouteMetrics(RouteUUID uuid) {
+  std::lock_guard<std::mutex> lock(kRouteMutex);
+  auto it = kRouteMetrics.find(uuid);
+  if (it == kRouteMetrics.end() || it->second.active > 0 ||
+      it->second.queued > 0) {
+    return;
+  }
+
+  kRouteMetrics.erase(it);
+  for (auto route = kRouteActive.begin(); route != kRouteActive.end();) {
+    if (route->first.first == uuid) {
+      route = kRouteActive.erase(route);
+    } else {
+      ++route;
+    }
+  }
+}
+
+/**
+ * @brief Make a call using a pooled client for a socket path.
+ *
+ * An idle connection may have been closed by its peer, for example when an
+ * extension restarts. A call that fails with a transport error on a reused
+ * connection is retried once using a new connection.
+ */
+template <typename T, typename F>
+static void callPooled(const std::string& path, F call) {
+  for (size_t attempt = 0;; attempt++) {
+    bool reused = false;
+    try {
+      EXPooledClient<T> client(path);
+      reused = client.reused();
+      call(client);
+      client.release();
+      return;
+    } catch (const TTransportException& /* e */) {
+      EXClientHealth::failure(path);
+      if (!reused || attempt > 0) {
+        throw;
+      }
+    }
+  }
+}
+
+/// Release the pooled connections to a socket path that has gone away.
+static void resetPooledClients(const std::string& path) {
+  EXClientHealth::failure(path);
+  EXClientPool<EXClient>::instance().reset(path);
+  EXClientPool<EXManagerClient>::instance().reset(path);
+}
+
 /**
  * @brief Alias the extensions_socket (used by core) to a simple 'socket'.
  *
@@ -123,12 +299,21 @@ Status applyExtensionDelay(std::function<Status(bool& stop)> predicate) {
 }
 
 Status extensionPathActive(const std::string& path, bool use_timeout = false) {
+  // A path that answered a call within the connectivity check interval is
+  // active, this avoids a ping before every call.
+  size_t interval = atoi(FLAGS_extensions_interval.c_str()) * 1000;
+  if (!use_timeout && EXClientHealth::recent(path, interval)) {
+    return Status(0, "OK");
+  }
+
   return applyExtensionDelay(([path, &use_timeout](bool& stop) {
     if (socketExists(path)) {
       try {
         ExtensionStatus status;
-        auto client = EXManagerClient(path);
-        client.get()->ping(status);
+        callPooled<EXManagerClient>(
+            path, [&status](EXPooledClient<EXManagerClient>& client) {
+              client.get()->ping(status);
+            });
         return Status(0, "OK");
       } catch (const std::exception& /* e */) {
         // Path might exist without a connected extension or extension manager.
@@ -164,8 +349,9 @@ void ExtensionManagerWatcher::start() {
   for (const auto& uuid : uuids) {
     try {
       auto path = getExtensionSocket(uuid);
-      auto client = EXClient(path);
+      EXPooledClient<EXClient> client(path);
       client.get()->shutdown();
+      resetPooledClients(path);
     } catch (const std::exception& /* e */) {
       VLOG(1) << "Extension UUID " << uuid << " shutdown request failed";
       continue;
@@ -187,9 +373,11 @@ void ExtensionWatcher::watch() {
   bool core_sane = true;
   if (socketExists(path_)) {
     try {
-      auto client = EXManagerClient(path_);
       // Ping the extension manager until it goes down.
-      client.get()->ping(status);
+      callPooled<EXManagerClient>(
+          path_, [&status](EXPooledClient<EXManagerClient>& client) {
+            client.get()->ping(status);
+          });
     } catch (const std::exception& /* e */) {
       core_sane = false;
     }
@@ -231,9 +419,10 @@ void ExtensionManagerWatcher::watch() {
     failures_[uuid] = 1;
     if (exists.ok()) {
       try {
-        auto client = EXClient(path);
         // Ping the extension until it goes down.
-        client.get()->ping(status);
+        callPooled<EXClient>(path, [&status](EXPooledClient<EXClient>& client) {
+          client.get()->ping(status);
+        });
       } catch (const std::exception& /* e */) {
         failures_[uuid] += 1;
         continue;
@@ -246,6 +435,8 @@ void ExtensionManagerWatcher::watch() {
 
     if (status.code != ExtensionCode::EXT_SUCCESS) {
       LOG(INFO) << "Extension UUID " << uuid << " ping failed";
+      static auto& failed = Metrics::counter("extensions_ping_failures");
+      failed.add();
       failures_[uuid] += 1;
     } else {
       failures_[uuid] = 1;
@@ -255,7 +446,12 @@ void ExtensionManagerWatcher::watch() {
   for (const auto& uuid : failures_) {
     if (uuid.second > 1) {
       LOG(INFO) << "Extension UUID " << uuid.first << " has gone away";
+      static auto& removed = Metrics::counter("extensions_removed");
+      removed.add();
       RegistryFactory::get().removeBroadcast(uuid.first);
+      resetPooledClients(getExtensionSocket(uuid.first));
+      ExtensionSharedMemory::detach(uuid.first);
+      removeRouteMetrics(uuid.first);
       failures_[uuid.first] = 1;
     }
   }
@@ -433,6 +629,11 @@ Status startExtension(const std::string& name,
   // When a broadcast is requested this registry should not send core plugins.
   RegistryFactory::get().setExternal();
 
+  // Autoloaded extensions use the protocol of the process that started them.
+  if (getEnvVar("OSQUERY_EXTENSIONS_COMPACT").is_initialized()) {
+    FLAGS_extensions_compact = true;
+  }
+
   // Latency converted to milliseconds, used as a thread interruptible.
   auto latency = atoi(FLAGS_extensions_interval.c_str()) * 1000;
   auto status = startExtensionWatcher(FLAGS_extensions_socket, latency, true);
@@ -470,6 +671,20 @@ Status startExtension(const std::string& manager_path,
   info.sdk_version = sdk_version;
   info.min_sdk_version = min_sdk_version;
 
+  // Offer the manager shared memory for table pages.
+  std::shared_ptr<ExtensionSharedMemory> shared;
+  if (FLAGS_extensions_shared_memory > 0) {
+    auto shared_status = ExtensionSharedMemory::create(
+        FLAGS_extensions_shared_memory * 1024, shared);
+    if (shared_status.ok()) {
+      info.__set_shared_memory(shared->name());
+      info.__set_shared_size(static_cast<int64_t>(shared->size()));
+    } else {
+      VLOG(1) << "Extension shared memory not available: "
+              << shared_status.getMessage();
+    }
+  }
+
   // If registration is successful, we will also request the manager's options.
   InternalOptionList options;
   // Register the extension's registry broadcast with the manager.
@@ -477,6 +692,10 @@ Status startExtension(const std::string& manager_path,
   try {
     auto client = EXManagerClient(manager_path);
     client.get()->registerExtension(ext_status, info, broadcast);
+    if (shared != nullptr) {
+      // The manager has mapped the segment, if it supports shared memory.
+      shared->unlink();
+    }
     // The main reason for a failed registry is a duplicate extension name
     // (the extension process is already running), or the extension broadcasts
     // a duplicate registry item.
@@ -490,6 +709,8 @@ Status startExtension(const std::string& manager_path,
     return Status(1, "Extension register failed: " + std::string(e.what()));
   }
 
+  ExtensionSharedMemory::setLocal(shared);
+
   // Now that the UUID is known, try to clean up stale socket paths.
   auto extension_path = getExtensionSocket(ext_status.uuid, manager_path);
 
@@ -526,8 +747,11 @@ Status queryExternal(const std::string& manager_path,
 
   ExtensionResponse response;
   try {
-    auto client = EXManagerClient(manager_path);
-    client.get()->query(response, query);
+    callPooled<EXManagerClient>(
+        manager_path,
+        [&response, &query](EXPooledClient<EXManagerClient>& client) {
+          client.get()->query(response, query);
+        });
   } catch (const std::exception& e) {
     return Status(1, "Extension call failed: " + std::string(e.what()));
   }
@@ -554,8 +778,11 @@ Status getQueryColumnsExternal(const std::string& manager_path,
 
   ExtensionResponse response;
   try {
-    auto client = EXManagerClient(manager_path);
-    client.get()->getQueryColumns(response, query);
+    callPooled<EXManagerClient>(
+        manager_path,
+        [&response, &query](EXPooledClient<EXManagerClient>& client) {
+          client.get()->getQueryColumns(response, query);
+        });
   } catch (const std::exception& e) {
     return Status(1, "Extension call failed: " + std::string(e.what()));
   }
@@ -589,8 +816,9 @@ Status pingExtension(const std::string& path) {
 
   ExtensionStatus ext_status;
   try {
-    auto client = EXClient(path);
-    client.get()->ping(ext_status);
+    callPooled<EXClient>(path, [&ext_status](EXPooledClient<EXClient>& client) {
+      client.get()->ping(ext_status);
+    });
   } catch (const std::exception& e) {
     return Status(1, "Extension call failed: " + std::string(e.what()));
   }
@@ -615,8 +843,10 @@ Status getExtensions(const std::string& manager_path,
 
   InternalExtensionList ext_list;
   try {
-    auto client = EXManagerClient(manager_path);
-    client.get()->extensions(ext_list);
+    callPooled<EXManagerClient>(
+        manager_path, [&ext_list](EXPooledClient<EXManagerClient>& client) {
+          client.get()->extensions(ext_list);
+        });
   } catch (const std::exception& e) {
     return Status(1, "Extension call failed: " + std::string(e.what()));
   }
@@ -643,6 +873,8 @@ Status callExtension(const RouteUUID uuid,
   if (FLAGS_disable_extensions) {
     return Status(1, "Extensions disabled");
   }
+
+  ExtensionRouteSlot slot(uuid, registry);
   return callExtension(
       getExtensionSocket(uuid), registry, item, request, response);
 }
@@ -658,23 +890,184 @@ Status callExtension(const std::string& extension_path,
     return status;
   }
 
+  // Table rows are requested by column, the extension may ignore this.
+  const PluginRequest* ext_request = &request;
+  PluginRequest columnar_request;
+  if (registry == "table" && request.count("action") > 0 &&
+      request.at("action") == "generate") {
+    columnar_request = request;
+    columnar_request[kResponseFormatKey] = kColumnarFormat;
+    ext_request = &columnar_request;
+  }
+
   ExtensionResponse ext_response;
   try {
-    auto client = EXClient(extension_path);
-    client.get()->call(ext_response, registry, item, request);
+    callPooled<EXClient>(extension_path,
+                         [&](EXPooledClient<EXClient>& client) {
+                           client.get()->call(
+                               ext_response, registry, item, *ext_request);
+                         });
   } catch (const std::exception& e) {
     return Status(1, "Extension call failed: " + std::string(e.what()));
   }
 
   // Convert from Thrift-internal list type to PluginResponse type.
   if (ext_response.status.code == ExtensionCode::EXT_SUCCESS) {
-    for (const auto& response_item : ext_response.response) {
-      response.push_back(response_item);
+    if (ext_response.__isset.columnar) {
+      decodeColumnarResponse(std::move(ext_response.columnar), response);
+    }
+    if (response.empty()) {
+      response = std::move(ext_response.response);
+    } else {
+      response.insert(response.end(),
+                      std::make_move_iterator(ext_response.response.begin()),
+                      std::make_move_iterator(ext_response.response.end()));
     }
   }
   return Status(ext_response.status.code, ext_response.status.message);
 }
 
+/// Release an extension's table cursor if the generator stops reading pages.
+class ExtensionCursorGuard : private boost::noncopyable {
+ public:
+  explicit ExtensionCursorGuard(EXPooledClient<EXClient>& client)
+      : client_(client) {}
+
+  ~ExtensionCursorGuard() {
+    if (open_) {
+      try {
+        ExtensionStatus status;
+        client_.get()->generateClose(status, cursor_);
+
+        // A stop such as a LIMIT leaves the connection usable.
+        client_.release();
+      } catch (const std::exception& /* e */) {
+        // The extension releases abandoned cursors.
+      }
+    }
+  }
+
+  /// Track the cursor state after each page.
+  void update(ExtensionCursorID cursor, bool done) {
+    cursor_ = cursor;
+    open_ = !done;
+  }
+
+ private:
+  EXPooledClient<EXClient>& client_;
+  ExtensionCursorID cursor_{0};
+  bool open_{false};
+};
+
+/// Append the rows of a complete table response when paging is unsupported.
+static Status appendExtensionTable(const RouteUUID uuid,
+                                   const std::string& table,
+                                   const PluginRequest& request,
+                                   RowBatch& batch) {
+  PluginResponse response;
+  auto status = callExtension(uuid, "table", table, request, response);
+  if (!status.ok()) {
+    return status;
+  }
+
+  ExtensionColumnarResponse columnar;
+  encodeColumnarResponse(std::move(response), columnar);
+  appendColumnarRows(columnar, batch);
+  return Status(0, "OK");
+}
+
+Status callExtensionTable(const RouteUUID uuid,
+                          const std::string& table,
+                          QueryContext& context,
+                          RowBatch& batch) {
+  if (FLAGS_disable_extensions) {
+    return Status(1, "Extensions disabled");
+  }
+
+  PluginRequest request = {{"action", "generate"}};
+  TablePlugin::setRequestFromContext(context, request);
+
+  bool paged = (FLAGS_extensions_page_rows > 0);
+  if (paged) {
+    ReadLock lock(kUnpagedExtensionsMutex);
+    paged = (kUnpagedExtensions.count(uuid) == 0);
+  }
+  if (!paged) {
+    return appendExtensionTable(uuid, table, request, batch);
+  }
+
+  auto path = getExtensionSocket(uuid);
+  auto status = extensionPathActive(path);
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto rows = static_cast<int32_t>(
+      std::min<uint64_t>(FLAGS_extensions_page_rows,
+                         std::numeric_limits<int32_t>::max()));
+
+  // Request pages in shared memory if the extension offered a segment.
+  auto shared = ExtensionSharedMemory::get(uuid);
+  auto open_request = request;
+  if (shared != nullptr) {
+    open_request[kSharedPagesKey] = "1";
+  }
+
+  ExtensionCursorResponse page;
+  try {
+    EXPooledClient<EXClient> client(path);
+    try {
+      ExtensionRouteSlot slot(uuid, "table");
+      client.get()->generateOpen(page, table, open_request, rows);
+    } catch (const TApplicationException& e) {
+      if (e.getType() != TApplicationException::UNKNOWN_METHOD) {
+        throw;
+      }
+
+      // The connection is usable after an unknown method.
+      client.release();
+
+      // The extension was built with an SDK that does not page tables.
+      {
+        WriteLock lock(kUnpagedExtensionsMutex);
+        kUnpagedExtensions.insert(uuid);
+      }
+      return appendExtensionTable(uuid, table, request, batch);
+    }
+
+    ExtensionCursorGuard guard(client);
+    while (true) {
+      guard.update(page.cursor, page.done);
+      if (page.status.code != ExtensionCode::EXT_SUCCESS) {
+        client.release();
+        return Status(page.status.code, page.status.message);
+      }
+
+      // Appending may suspend until the rows are read by the cursor.
+      if (page.__isset.shared_slot && shared != nullptr) {
+        status = shared->read(page.shared_slot, batch);
+        if (!status.ok()) {
+          return status;
+        }
+      } else {
+        appendColumnarRows(page.rows, batch);
+      }
+      if (page.done) {
+        client.release();
+        break;
+      }
+
+      auto cursor = page.cursor;
+      page = ExtensionCursorResponse();
+      ExtensionRouteSlot slot(uuid, "table");
+      client.get()->generateNext(page, cursor, rows);
+    }
+  } catch (const std::exception& e) {
+    return Status(1, "Extension call failed: " + std::string(e.what()));
+  }
+  return Status(0, "OK");
+}
+
 Status startExtensionWatcher(const std::string& manager_path,
                              size_t interval,
                              bool fatal) {
@@ -690,6 +1083,73 @@ Status startExtensionWatcher(const std::string& manager_path,
   return Status(0, "OK");
 }
 
+/// Replace the stored table routes of an extension.
+static void storeExtensionRoutes(const std::string& name,
+                                 const RegistryBroadcast& registry) {
+  auto prefix = kExtensionRoutesPrefix + name + ".";
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kPersistentSettings, keys, prefix);
+  deleteDatabaseBatch(kPersistentSettings, keys);
+
+  if (registry.count("table") == 0) {
+    return;
+  }
+
+  for (const auto& route : registry.at("table")) {
+    std::string json;
+    if (serializeQueryDataJSON(route.second, json).ok()) {
+      setDatabaseValue(kPersistentSettings, prefix + route.first, json);
+    }
+  }
+}
+
+void cacheExtensionRoutes(const std::string& name,
+                          const RegistryBroadcast& registry) {
+  if (!FLAGS_extensions_cache_routes) {
+    return;
+  }
+
+  WriteLock lock(kExtensionRoutesMutex);
+  if (!kExtensionRoutesLoaded) {
+    kPendingExtensionRoutes[name] = registry;
+    return;
+  }
+  storeExtensionRoutes(name, registry);
+}
+
+void loadCachedExtensionRoutes() {
+  if (FLAGS_disable_extensions || !FLAGS_extensions_cache_routes) {
+    return;
+  }
+
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kPersistentSettings, keys, kExtensionRoutesPrefix);
+
+  RegistryRoutes routes;
+  for (const auto& key : keys) {
+    std::string json;
+    QueryData columns;
+    if (!getDatabaseValue(kPersistentSettings, key, json).ok() ||
+        !deserializeQueryDataJSON(json, columns).ok()) {
+      continue;
+    }
+    // Keys are the prefix, the extension name, and the table name.
+    routes[key.substr(key.rfind('.') + 1)] = std::move(columns);
+  }
+
+  if (!routes.empty()) {
+    VLOG(1) << "Attaching " << routes.size() << " cached extension tables";
+    RegistryFactory::get().addCachedBroadcast({{"table", routes}});
+  }
+
+  WriteLock lock(kExtensionRoutesMutex);
+  kExtensionRoutesLoaded = true;
+  for (const auto& pending : kPendingExtensionRoutes) {
+    storeExtensionRoutes(pending.first, pending.second);
+  }
+  kPendingExtensionRoutes.clear();
+}
+
 Status startExtensionManager() {
   if (FLAGS_disable_extensions) {
     return Status(1, "Extensions disabled");
@@ -8,26 +8,288 @@
  *
  */
 
+#include <algorithm>
+#include <map>
 #include <string>
 
 #include <thrift/TOutput.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
 #include "osquery/extensions/interface.h"
+#include "osquery/extensions/shared_memory.h"
 
 using namespace osquery::extensions;
 
 namespace osquery {
+
+DECLARE_bool(extensions_compact);
+
+/// Initial bytes of each transport buffer, a page of typical table rows.
+const uint32_t kExtensionBufferSize{64 * 1024};
+
+/// Create each connection's buffered transport with a pre-sized buffer.
+class TSizedBufferedTransportFactory : public TTransportFactory {
+ public:
+  TTransportRef getTransport(TTransportRef transport) override {
+    return TTransportRef(new TBufferedTransport(
+        transport, kExtensionBufferSize, kExtensionBufferSize));
+  }
+};
+
+/// Create each connection's framed transport with a pre-sized buffer.
+class TSizedFramedTransportFactory : public TTransportFactory {
+ public:
+  TTransportRef getTransport(TTransportRef transport) override {
+    return TTransportRef(new TFramedTransport(transport, kExtensionBufferSize));
+  }
+};
+
+EXInternal::EXInternal(const std::string& path)
+    : socket_(new TPlatformSocket(path)) {
+  if (FLAGS_extensions_compact) {
+    transport_.reset(new TFramedTransport(socket_, kExtensionBufferSize));
+    protocol_.reset(new TCompactProtocol(transport_));
+  } else {
+    transport_.reset(new TBufferedTransport(
+        socket_, kExtensionBufferSize, kExtensionBufferSize));
+    protocol_.reset(new TBinaryProtocol(transport_));
+  }
+}
+
 namespace extensions {
 
 const std::vector<std::string> kSDKVersionChanges = {
     {"1.7.7"},
 };
 
+const std::string kResponseFormatKey{"response_format"};
+
+const std::string kColumnarFormat{"columnar"};
+
+/// Copy a value from a response that is still used.
+static std::string takeValue(const std::string& value) {
+  return value;
+}
+
+/// Move a value from a response that is released after it is converted.
+static std::string takeValue(std::string& value) {
+  return std::move(value);
+}
+
+template <typename Response>
+static void encodeColumnar(Response& response,
+                           ExtensionColumnarResponse& columnar) {
+  columnar.columns.clear();
+  columnar.values.clear();
+  columnar.absent.clear();
+  columnar.rows = static_cast<int32_t>(response.size());
+
+  // Collect the union of column names in the order they are first seen.
+  std::map<std::string, size_t> indexes;
+  for (const auto& row : response) {
+    for (const auto& column : row) {
+      if (indexes.count(column.first) == 0) {
+        indexes[column.first] = columnar.columns.size();
+        columnar.columns.push_back(column.first);
+      }
+    }
+  }
+
+  columnar.values.resize(columnar.columns.size());
+  for (auto& values : columnar.values) {
+    values.reserve(response.size());
+  }
+
+  for (size_t i = 0; i < columnar.columns.size(); i++) {
+    const auto& name = columnar.columns[i];
+    auto& values = columnar.values[i];
+    for (size_t r = 0; r < response.size(); r++) {
+      auto value = response[r].find(name);
+      if (value == response[r].end()) {
+        values.push_back("");
+        columnar.absent[static_cast<int32_t>(i)].push_back(
+            static_cast<int32_t>(r));
+      } else {
+        values.push_back(takeValue(value->second));
+      }
+    }
+  }
+}
+
+void encodeColumnarResponse(const PluginResponse& response,
+                            ExtensionColumnarResponse& columnar) {
+  encodeColumnar(response, columnar);
+}
+
+void encodeColumnarResponse(PluginResponse&& response,
+                            ExtensionColumnarResponse& columnar) {
+  encodeColumnar(response, columnar);
+  response.clear();
+}
+
+template <typename Columnar>
+static void decodeColumnar(Columnar& columnar, PluginResponse& response) {
+  auto offset = response.size();
+  auto rows = static_cast<size_t>(std::max(columnar.rows, 0));
+  response.resize(offset + rows);
+  for (size_t i = 0; i < columnar.columns.size() && i < columnar.values.size();
+       i++) {
+    const auto& name = columnar.columns[i];
+    auto& values = columnar.values[i];
+
+    // Absent row indexes are encoded in ascending order.
+    const std::vector<int32_t>* absent = nullptr;
+    auto it = columnar.absent.find(static_cast<int32_t>(i));
+    if (it != columnar.absent.end()) {
+      absent = &it->second;
+    }
+
+    size_t next_absent = 0;
+    for (size_t r = 0; r < values.size() && r < rows; r++) {
+      if (absent != nullptr && next_absent < absent->size() &&
+          static_cast<size_t>((*absent)[next_absent]) == r) {
+        next_absent++;
+        continue;
+      }
+      response[offset + r][name] = takeValue(values[r]);
+    }
+  }
+}
+
+void decodeColumnarResponse(const ExtensionColumnarResponse& columnar,
+                            PluginResponse& response) {
+  decodeColumnar(columnar, response);
+}
+
+void decodeColumnarResponse(ExtensionColumnarResponse&& columnar,
+                            PluginResponse& response) {
+  decodeColumnar(columnar, response);
+  columnar = ExtensionColumnarResponse();
+}
+
+/// Stack size for each suspendable columnar table generator.
+const size_t kCursorStackSize = 512 * 1024;
+
+/// Seconds before an unused table cursor is released.
+const size_t kCursorIdleTimeout = 300;
+
+void appendColumnarRows(const ExtensionColumnarResponse& columnar,
+                        RowBatch& batch) {
+  auto rows = static_cast<size_t>(std::max(columnar.rows, 0));
+  std::vector<size_t> indexes;
+  std::vector<const std::vector<int32_t>*> absent;
+  for (size_t i = 0; i < columnar.columns.size() && i < columnar.values.size();
+       i++) {
+    indexes.push_back(batch.index(columnar.columns[i]));
+    auto it = columnar.absent.find(static_cast<int32_t>(i));
+    absent.push_back((it == columnar.absent.end()) ? nullptr : &it->second);
+  }
+
+  std::vector<size_t> next_absent(indexes.size(), 0);
+  for (size_t r = 0; r < rows; r++) {
+    // Adding a row may suspend a bounded batch until it is read.
+    batch.addRow();
+    for (size_t i = 0; i < indexes.size(); i++) {
+      if (absent[i] != nullptr && next_absent[i] < absent[i]->size() &&
+          static_cast<size_t>((*absent[i])[next_absent[i]]) == r) {
+        next_absent[i]++;
+        continue;
+      }
+
+      const auto& values = columnar.values[i];
+      if (indexes[i] < batch.columns() && r < values.size()) {
+        batch.set(indexes[i], values[r]);
+      }
+    }
+  }
+}
+
+/// Encode the rows of a RowBatch page by column, NULL cells are absent.
+static void encodeColumnarBatch(const RowBatch& batch,
+                                ExtensionColumnarResponse& columnar) {
+  columnar.columns.clear();
+  columnar.values.clear();
+  columnar.absent.clear();
+  columnar.rows = static_cast<int32_t>(batch.size());
+
+  columnar.values.resize(batch.columns());
+  for (size_t i = 0; i < batch.columns(); i++) {
+    columnar.columns.push_back(batch.name(i));
+    auto& values = columnar.values[i];
+    values.reserve(batch.size());
+    for (size_t r = 0; r < batch.size(); r++) {
+      if (batch.isNull(r, i)) {
+        values.push_back("");
+        columnar.absent[static_cast<int32_t>(i)].push_back(
+            static_cast<int32_t>(r));
+      } else {
+        values.push_back(batch.getAsText(r, i));
+      }
+    }
+  }
+}
+
+ExtensionTableCursor::ExtensionTableCursor(const std::string& table,
+                                           const PluginRequest& request,
+                                           size_t rows)
+    : page_rows_(std::max<size_t>(rows, 1)) {
+  accessed = getUnixTime();
+  auto plugin = std::dynamic_pointer_cast<TablePlugin>(
+      RegistryFactory::get().plugin("table", table));
+  if (plugin == nullptr || !plugin->usesBatch()) {
+    status_ = RegistryFactory::call("table", table, request, rows_);
+    return;
+  }
+
+  TablePlugin::setContextFromRequest(request, context_);
+  try {
+    generator_ = std::make_unique<Generator::pull_type>(
+        boost::coroutines2::fixedsize_stack(kCursorStackSize),
+        [this, table](Generator::push_type& yield) {
+          batch_.setYield([&yield]() { yield(); }, page_rows_);
+          status_ = RegistryFactory::callTable(table, context_, batch_);
+        });
+  } catch (const std::exception& e) {
+    status_ = Status(1, "Table generator caused exception: " +
+                            std::string(e.what()));
+    generator_.reset();
+  }
+}
+
+bool ExtensionTableCursor::next(ExtensionColumnarResponse& page) {
+  accessed = getUnixTime();
+  if (generator_ == nullptr) {
+    // Send the next page of completely generated rows.
+    auto end = std::min(rows_.size(), offset_ + page_rows_);
+    PluginResponse rows(std::make_move_iterator(rows_.begin() + offset_),
+                        std::make_move_iterator(rows_.begin() + end));
+    offset_ = end;
+    encodeColumnarResponse(std::move(rows), page);
+    return offset_ >= rows_.size();
+  }
+
+  if (batch_.size() == 0 && *generator_) {
+    try {
+      (*generator_)();
+    } catch (const std::exception& e) {
+      status_ = Status(1, "Table generator caused exception: " +
+                              std::string(e.what()));
+      generator_.reset();
+      encodeColumnarBatch(batch_, page);
+      return true;
+    }
+  }
+
+  encodeColumnarBatch(batch_, page);
+  batch_.clear();
+  return !(*generator_);
+}
+
 void ExtensionHandler::ping(ExtensionStatus& _return) {
   _return.code = ExtensionCode::EXT_SUCCESS;
   _return.message = "pong";
@@ -49,21 +311,33 @@ void ExtensionHandler::call(ExtensionResponse& _return,
 
   PluginResponse response;
   PluginRequest plugin_request;
+  bool columnar = false;
   for (const auto& request_item : request) {
+    if (request_item.first == kResponseFormatKey) {
+      // The response format is negotiated by the caller, not the plugin.
+      columnar = (request_item.second == kColumnarFormat);
+      continue;
+    }
     // Create a PluginRequest from an ExtensionPluginRequest.
     plugin_request[request_item.first] = request_item.second;
   }
 
-  auto status =
-      RegistryFactory::call(registry, local_item, plugin_request, response);
+  Status status;
+  {
+    ExtensionRouteSlot slot(0, registry);
+    status =
+        RegistryFactory::call(registry, local_item, plugin_request, response);
+  }
   _return.status.code = status.getCode();
   _return.status.message = status.getMessage();
   _return.status.uuid = uuid_;
-  if (status.ok()) {
-    for (const auto& response_item : response) {
-      // Translate a PluginResponse to an ExtensionPluginResponse.
-      _return.response.push_back(response_item);
-    }
+  if (status.ok() && columnar) {
+    ExtensionColumnarResponse columnar_response;
+    encodeColumnarResponse(std::move(response), columnar_response);
+    _return.__set_columnar(std::move(columnar_response));
+  } else if (status.ok()) {
+    // A PluginResponse is the same type as an ExtensionPluginResponse.
+    _return.response = std::move(response);
   }
 }
 
@@ -73,6 +347,134 @@ void ExtensionHandler::shutdown() {
   Initializer::requestShutdown(EXIT_SUCCESS);
 }
 
+void ExtensionHandler::generateOpen(ExtensionCursorResponse& _return,
+                                    const std::string& table,
+                                    const ExtensionPluginRequest& request,
+                                    const int32_t rows) {
+  expireCursors();
+
+  PluginRequest plugin_request;
+  bool shared = false;
+  for (const auto& request_item : request) {
+    if (request_item.first == kSharedPagesKey) {
+      // The manager mapped this extension's shared memory.
+      shared = true;
+      continue;
+    }
+    plugin_request[request_item.first] = request_item.second;
+  }
+  plugin_request["action"] = "generate";
+
+  ExtensionRouteSlot slot(0, "table");
+  auto local_item = RegistryFactory::get().getAlias("table", table);
+  auto cursor = std::make_shared<ExtensionTableCursor>(
+      local_item, plugin_request, static_cast<size_t>(std::max(rows, 1)));
+  cursor->shared = shared;
+
+  ExtensionCursorID id = 0;
+  {
+    WriteLock lock(cursors_mutex_);
+    id = next_cursor_++;
+  }
+  readCursor(_return, id, cursor);
+}
+
+void ExtensionHandler::generateNext(ExtensionCursorResponse& _return,
+                                    const ExtensionCursorID cursor,
+                                    const int32_t /* rows */) {
+  std::shared_ptr<ExtensionTableCursor> table_cursor;
+  {
+    // The cursor is removed while it is read, pages are read one at a time.
+    WriteLock lock(cursors_mutex_);
+    auto it = cursors_.find(cursor);
+    if (it != cursors_.end()) {
+      table_cursor = it->second;
+      cursors_.erase(it);
+    }
+  }
+
+  _return.status.uuid = uuid_;
+  _return.cursor = cursor;
+  if (table_cursor == nullptr) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = "Unknown table cursor";
+    _return.done = true;
+    return;
+  }
+
+  ExtensionRouteSlot slot(0, "table");
+  readCursor(_return, cursor, table_cursor);
+}
+
+void ExtensionHandler::generateClose(ExtensionStatus& _return,
+                                     const ExtensionCursorID cursor) {
+  std::shared_ptr<ExtensionTableCursor> table_cursor;
+  {
+    WriteLock lock(cursors_mutex_);
+    auto it = cursors_.find(cursor);
+    if (it != cursors_.end()) {
+      table_cursor = it->second;
+      cursors_.erase(it);
+    }
+  }
+
+  // A suspended generator is unwound as the cursor is released.
+  table_cursor.reset();
+  _return.code = ExtensionCode::EXT_SUCCESS;
+  _return.message = "OK";
+  _return.uuid = uuid_;
+}
+
+void ExtensionHandler::readCursor(
+    ExtensionCursorResponse& _return,
+    ExtensionCursorID id,
+    const std::shared_ptr<ExtensionTableCursor>& cursor) {
+  _return.cursor = id;
+  _return.done = cursor->next(_return.rows);
+
+  const auto& status = cursor->getStatus();
+  _return.status.code = status.getCode();
+  _return.status.message = status.getMessage();
+  _return.status.uuid = uuid_;
+  if (!status.ok()) {
+    _return.done = true;
+  } else if (cursor->shared) {
+    // The manager frees a slot after reading the page.
+    auto shared = ExtensionSharedMemory::local();
+    int32_t slot = 0;
+    if (shared != nullptr && shared->write(_return.rows, slot)) {
+      _return.rows = ExtensionColumnarResponse();
+      _return.__set_shared_slot(slot);
+    }
+  }
+
+  if (!_return.done) {
+    WriteLock lock(cursors_mutex_);
+    cursors_[id] = cursor;
+  }
+}
+
+void ExtensionHandler::expireCursors() {
+  std::vector<std::shared_ptr<ExtensionTableCursor>> expired;
+  auto now = getUnixTime();
+  {
+    WriteLock lock(cursors_mutex_);
+    for (auto it = cursors_.begin(); it != cursors_.end();) {
+      if (it->second->accessed + kCursorIdleTimeout < now) {
+        expired.push_back(it->second);
+        it = cursors_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Generators are unwound without holding the cursors lock.
+  if (!expired.empty()) {
+    VLOG(1) << "Releasing " << expired.size() << " abandoned table cursors";
+  }
+}
+
 /**
  * @brief Updates the Thrift server output to be VLOG
  *
@@ -142,6 +544,23 @@ void ExtensionManagerHandler::registerExtension(
     return;
   }
 
+  // Map the shared memory offered for table pages, the extension removes its
+  // name after registering so it cannot be mapped later.
+  if (info.__isset.shared_memory && info.shared_size > 0) {
+    std::shared_ptr<ExtensionSharedMemory> shared;
+    auto status = ExtensionSharedMemory::open(
+        info.shared_memory, static_cast<size_t>(info.shared_size), shared);
+    if (status.ok()) {
+      ExtensionSharedMemory::attach(uuid, shared);
+    } else {
+      VLOG(1) << "Extension " << info.name << " shared memory not used: "
+              << status.getMessage();
+    }
+  }
+
+  // The next worker may attach the tables before the extension restarts.
+  cacheExtensionRoutes(info.name, registry);
+
   WriteLock lock(extensions_mutex_);
   extensions_[uuid] = info;
   _return.code = ExtensionCode::EXT_SUCCESS;
@@ -163,6 +582,7 @@ void ExtensionManagerHandler::deregisterExtension(
 
   // On success return the uuid of the now de-registered extension.
   RegistryFactory::get().removeBroadcast(uuid);
+  ExtensionSharedMemory::detach(uuid);
 
   WriteLock lock(extensions_mutex_);
   extensions_.erase(uuid);
@@ -172,8 +592,9 @@ void ExtensionManagerHandler::deregisterExtension(
 
 void ExtensionManagerHandler::query(ExtensionResponse& _return,
                                     const std::string& sql) {
+  // Extensions may share recent results with the schedule.
   QueryData results;
-  auto status = osquery::query(sql, results);
+  auto status = osquery::queryCached(sql, results);
   _return.status.code = status.getCode();
   _return.status.message = status.getMessage();
   _return.status.uuid = uuid_;
@@ -216,6 +637,7 @@ void ExtensionManagerHandler::refresh() {
   // Remove each from the manager's list of extension metadata.
   for (const auto& uuid : removed_routes) {
     extensions_.erase(uuid);
+    ExtensionSharedMemory::detach(uuid);
   }
 }
 
@@ -278,8 +700,15 @@ void ExtensionRunnerCore::startServer(TProcessorRef processor) {
     }
 
     // Construct the service's transport, protocol, thread pool.
-    auto transport_fac = TTransportFactoryRef(new TBufferedTransportFactory());
-    auto protocol_fac = TProtocolFactoryRef(new TBinaryProtocolFactory());
+    TTransportFactoryRef transport_fac;
+    TProtocolFactoryRef protocol_fac;
+    if (FLAGS_extensions_compact) {
+      transport_fac.reset(new TSizedFramedTransportFactory());
+      protocol_fac.reset(new TCompactProtocolFactory());
+    } else {
+      transport_fac.reset(new TSizedBufferedTransportFactory());
+      protocol_fac.reset(new TBinaryProtocolFactory());
+    }
 
     // Start the Thrift server's run loop.
     server_ = TThreadedServerRef(new TThreadedServer(
@@ -10,10 +10,18 @@
 
 #pragma once
 
+#include <map>
+#include <memory>
 #include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/coroutine2/coroutine.hpp>
+#include <boost/noncopyable.hpp>
 
 #include <osquery/dispatcher.h>
 #include <osquery/extensions.h>
+#include <osquery/tables.h>
 
 #ifdef WIN32
 #pragma warning(push, 3)
@@ -34,6 +42,7 @@
 // clang-format off
 #include CONCAT(OSQUERY_THRIFT_SERVER_LIB,/TThreadedServer.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/protocol/TBinaryProtocol.h)
+#include CONCAT(OSQUERY_THRIFT_LIB,/protocol/TCompactProtocol.h)
 
 #ifdef WIN32
 #include CONCAT(OSQUERY_THRIFT_LIB,/transport/TPipeServer.h)
@@ -89,6 +98,107 @@ using TThreadedServerRef = std::shared_ptr<TThreadedServer>;
 
 namespace extensions {
 
+/// The PluginRequest key naming a response encoding accepted by the caller.
+extern const std::string kResponseFormatKey;
+
+/// The response_format requesting an ExtensionColumnarResponse.
+extern const std::string kColumnarFormat;
+
+/**
+ * @brief Encode a PluginResponse by column.
+ *
+ * A table's generated rows repeat every column name in each row's map. The
+ * columnar encoding sends each name once followed by the column's values,
+ * which reduces both the Thrift encoding work and the size of large table
+ * responses. Rows that do not include a column are recorded as absent so the
+ * decoded rows are identical to the original response.
+ *
+ * @param response The plugin response, often table rows.
+ * @param columnar The output columnar response.
+ */
+void encodeColumnarResponse(const PluginResponse& response,
+                            ExtensionColumnarResponse& columnar);
+
+/// Encode a PluginResponse by column, moving each value from the response.
+void encodeColumnarResponse(PluginResponse&& response,
+                            ExtensionColumnarResponse& columnar);
+
+/// Decode an ExtensionColumnarResponse into a PluginResponse.
+void decodeColumnarResponse(const ExtensionColumnarResponse& columnar,
+                            PluginResponse& response);
+
+/// Decode an ExtensionColumnarResponse, moving each value into the response.
+void decodeColumnarResponse(ExtensionColumnarResponse&& columnar,
+                            PluginResponse& response);
+
+/// Append the rows of a columnar page to a RowBatch using the batch's schema.
+void appendColumnarRows(const ExtensionColumnarResponse& columnar,
+                        RowBatch& batch);
+
+/**
+ * @brief A table generation in progress for a paged generate request.
+ *
+ * Tables using TablePlugin::generateBatch are generated within a coroutine
+ * that yields each time a page of rows is buffered, so the extension holds at
+ * most one page. Other tables are generated completely when the cursor opens
+ * and are sent one page at a time.
+ */
+class ExtensionTableCursor : private boost::noncopyable {
+ public:
+  using Generator = boost::coroutines2::coroutine<void>;
+
+  /**
+   * @brief Start generating a table.
+   *
+   * @param table The local table plugin name.
+   * @param request The table's generate request.
+   * @param rows The maximum number of rows in each page.
+   */
+  ExtensionTableCursor(const std::string& table,
+                       const PluginRequest& request,
+                       size_t rows);
+
+  /**
+   * @brief Fill the next page of rows.
+   *
+   * @param page The output page.
+   * @return true if the table has no more rows.
+   */
+  bool next(ExtensionColumnarResponse& page);
+
+  /// The status of the table's generation.
+  const Status& getStatus() const {
+    return status_;
+  }
+
+  /// The time, in seconds, of the last page request.
+  size_t accessed{0};
+
+  /// The caller reads pages from shared memory when possible.
+  bool shared{false};
+
+ private:
+  /// The table's context, this must exist as long as the generator.
+  QueryContext context_;
+
+  /// The buffered page of a columnar table.
+  RowBatch batch_;
+
+  /// A suspended columnar table generator.
+  std::unique_ptr<Generator::pull_type> generator_;
+
+  /// The complete rows of a table not using batches.
+  PluginResponse rows_;
+
+  /// The next unsent row within rows_.
+  size_t offset_{0};
+
+  /// The maximum number of rows in each page.
+  size_t page_rows_{0};
+
+  Status status_;
+};
+
 /**
  * @brief The Thrift API server used by an osquery Extension process.
  *
@@ -108,6 +218,10 @@ class ExtensionHandler : virtual public ExtensionIf {
   /**
    * @brief The Thrift API used by Registry::call for an extension route.
    *
+   * When the request includes a "columnar" response_format, the response is
+   * encoded using ExtensionResponse::columnar. Callers that do not request a
+   * format, such as older SDKs, receive row maps.
+   *
    * @param _return The return response (combo Status and PluginResponse).
    * @param registry The name of the Extension registry.
    * @param item The Extension plugin name.
@@ -121,9 +235,53 @@ class ExtensionHandler : virtual public ExtensionIf {
   /// Request an extension to shutdown.
   void shutdown();
 
+  /**
+   * @brief Start a paged table generation.
+   *
+   * Large tables would otherwise build a complete ExtensionResponse in both
+   * processes. A cursor returns pages of at most rows, encoded by column,
+   * until the table has no more rows.
+   *
+   * @param _return The first page and the cursor used for following pages.
+   * @param table The table plugin name.
+   * @param request The table's generate request.
+   * @param rows The maximum number of rows in each page.
+   */
+  void generateOpen(ExtensionCursorResponse& _return,
+                    const std::string& table,
+                    const ExtensionPluginRequest& request,
+                    const int32_t rows);
+
+  /// Return the next page of a cursor, rows is set by generateOpen.
+  void generateNext(ExtensionCursorResponse& _return,
+                    const ExtensionCursorID cursor,
+                    const int32_t rows);
+
+  /// Release a cursor that has not completed.
+  void generateClose(ExtensionStatus& _return, const ExtensionCursorID cursor);
+
+ private:
+  /// Fill a page from a cursor and release the cursor if it is done.
+  void readCursor(ExtensionCursorResponse& _return,
+                  ExtensionCursorID id,
+                  const std::shared_ptr<ExtensionTableCursor>& cursor);
+
+  /// Release cursors the caller abandoned.
+  void expireCursors();
+
  protected:
   /// Transient UUID assigned to the extension after registering.
   std::atomic<RouteUUID> uuid_;
+
+ private:
+  /// Open cursors, each is used by one caller at a time.
+  std::map<ExtensionCursorID, std::shared_ptr<ExtensionTableCursor>> cursors_;
+
+  /// The next cursor ID.
+  ExtensionCursorID next_cursor_{1};
+
+  /// Protect the open cursors.
+  Mutex cursors_mutex_;
 };
 
 /**
@@ -361,13 +519,17 @@ class ExtensionManagerRunner : public ExtensionRunnerCore {
   void start();
 };
 
-/// Internal accessor for extension clients.
+/**
+ * @brief Internal accessor for extension clients.
+ *
+ * Clients use a buffered transport and the binary protocol, or with
+ * `--extensions_compact` a framed transport and the compact protocol. The
+ * transport's buffers are sized for a page of table rows and reused by each
+ * call of a pooled client.
+ */
 class EXInternal {
  public:
-  explicit EXInternal(const std::string& path)
-      : socket_(new TPlatformSocket(path)),
-        transport_(new TBufferedTransport(socket_)),
-        protocol_(new TBinaryProtocol(transport_)) {}
+  explicit EXInternal(const std::string& path);
 
   virtual ~EXInternal() {
     transport_->close();
@@ -413,6 +575,160 @@ class EXManagerClient : public EXInternal {
  private:
   std::shared_ptr<extensions::ExtensionManagerClient> client_;
 };
+
+/**
+ * @brief Hold one of the concurrent call slots for an extension registry.
+ *
+ * Each RouteUUID and registry pair allows `--extensions_route_concurrency`
+ * concurrent calls, and further calls wait for a slot. A slow logger plugin
+ * cannot occupy every call to the same extension's tables.
+ */
+class ExtensionRouteSlot : private boost::noncopyable {
+ public:
+  ExtensionRouteSlot(RouteUUID uuid, const std::string& registry);
+  ~ExtensionRouteSlot();
+
+ private:
+  RouteUUID uuid_{0};
+  std::string registry_;
+};
+
+/// The number of idle connections kept for each socket path.
+const size_t kEXPoolIdleClients = 4;
+
+/**
+ * @brief Idle extension and extension manager clients kept for reuse.
+ *
+ * Creating a client connects to the socket path. Clients are returned to the
+ * pool after a completed call and the next call to the same path reuses the
+ * connection. A Thrift client is not safe for concurrent calls, so each
+ * client is leased by one caller at a time.
+ */
+template <typename T>
+class EXClientPool : private boost::noncopyable {
+ public:
+  static EXClientPool<T>& instance() {
+    static EXClientPool<T> pool;
+    return pool;
+  }
+
+  /**
+   * @brief Take an idle client for a path, or connect a new client.
+   *
+   * @param path The extension or extension manager socket path.
+   * @param reused Set to true if the client was idle in the pool.
+   */
+  std::unique_ptr<T> take(const std::string& path, bool& reused) {
+    {
+      WriteLock lock(mutex_);
+      auto it = idle_.find(path);
+      if (it != idle_.end() && !it->second.empty()) {
+        auto client = std::move(it->second.back());
+        it->second.pop_back();
+        reused = true;
+        return client;
+      }
+    }
+
+    reused = false;
+    return std::unique_ptr<T>(new T(path));
+  }
+
+  /// Return a client after a completed call.
+  void release(const std::string& path, std::unique_ptr<T> client) {
+    WriteLock lock(mutex_);
+    auto& idle = idle_[path];
+    if (idle.size() < kEXPoolIdleClients) {
+      idle.push_back(std::move(client));
+    }
+  }
+
+  /// Close the idle clients for a path.
+  void reset(const std::string& path) {
+    WriteLock lock(mutex_);
+    idle_.erase(path);
+  }
+
+  /// The number of idle clients for a path.
+  size_t idle(const std::string& path) {
+    ReadLock lock(mutex_);
+    auto it = idle_.find(path);
+    return (it == idle_.end()) ? 0 : it->second.size();
+  }
+
+ private:
+  EXClientPool() {}
+
+ private:
+  /// Idle clients for each socket path.
+  std::map<std::string, std::vector<std::unique_ptr<T>>> idle_;
+
+  /// Protect the idle clients.
+  Mutex mutex_;
+};
+
+/**
+ * @brief The health of extension and extension manager socket paths.
+ *
+ * Each completed call records the time it was answered, and a failed call
+ * forgets the path. Callers may skip an activity check (itself a connect and
+ * ping) for a path that answered recently.
+ */
+class EXClientHealth {
+ public:
+  /// Record a completed call to a socket path.
+  static void success(const std::string& path);
+
+  /// Forget a socket path after a failed call or when it is removed.
+  static void failure(const std::string& path);
+
+  /// Check if a call to the path completed within an interval.
+  static bool recent(const std::string& path, size_t milliseconds);
+};
+
+/**
+ * @brief A client leased from an EXClientPool.
+ *
+ * If the lease is released after a completed call, the client is returned to
+ * the pool. Otherwise the call failed; the connection is closed along with
+ * the idle clients for the same path, which are likely to fail too.
+ */
+template <typename T>
+class EXPooledClient : private boost::noncopyable {
+ public:
+  explicit EXPooledClient(const std::string& path)
+      : path_(path), client_(EXClientPool<T>::instance().take(path, reused_)) {}
+
+  ~EXPooledClient() {
+    if (released_) {
+      EXClientHealth::success(path_);
+      EXClientPool<T>::instance().release(path_, std::move(client_));
+    } else {
+      EXClientHealth::failure(path_);
+      EXClientPool<T>::instance().reset(path_);
+    }
+  }
+
+  auto get() -> decltype(std::declval<T&>().get()) {
+    return client_->get();
+  }
+
+  /// The client's connection was used by a previous call.
+  bool reused() const {
+    return reused_;
+  }
+
+  /// The call completed and the connection may be reused.
+  void release() {
+    released_ = true;
+  }
+
+ private:
+  std::string path_;
+  bool reused_{false};
+  bool released_{false};
+  std::unique_ptr<T> client_;
+};
 }
 
 #ifdef WIN32
@@ -0,0 +1,477 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+#include <map>
+#include <new>
+#include <vector>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <osquery/core.h>
+#include <osquery/logger.h>
+
+#include "osquery/extensions/shared_memory.h"
+
+namespace osquery {
+namespace extensions {
+
+const std::string kSharedPagesKey{"shared_pages"};
+
+/// Segment names are limited to this prefix, the manager maps no others.
+const std::string kSharedMemoryPrefix{"/osquery.ext."};
+
+/// Identifies an osquery table page segment.
+const uint32_t kSharedMemoryMagic = 0x5051534f;
+
+/// The number of page slots in each segment.
+const size_t kSharedMemorySlots = 4;
+
+/// The segment header size, slots begin at this offset.
+const size_t kSharedMemoryHeader = 64;
+
+/// Each slot starts with a state word and the page length.
+const size_t kSlotHeader = 16;
+
+/// The smallest useful slot.
+const size_t kSlotMinimum = 4096;
+
+/// Slot states, a slot is claimed by the writer while it encodes a page.
+enum SlotState : uint32_t {
+  SLOT_FREE = 0,
+  SLOT_WRITTEN = 1,
+  SLOT_WRITING = 2,
+};
+
+/// The segment header written by the creator.
+struct SharedMemoryHeader {
+  uint32_t magic;
+  uint32_t reserved;
+  uint64_t slots;
+  uint64_t slot_size;
+};
+
+/// Segments mapped for each registered extension.
+static std::map<RouteUUID, std::shared_ptr<ExtensionSharedMemory>> kShared;
+
+/// The segment created by this extension process.
+static std::shared_ptr<ExtensionSharedMemory> kLocalShared;
+
+/// Protect the mapped segments.
+static Mutex kSharedMutex;
+
+static void writeU32(char*& out, uint32_t value) {
+  memcpy(out, &value, sizeof(value));
+  out += sizeof(value);
+}
+
+static void writeBytes(char*& out, const std::string& value) {
+  writeU32(out, static_cast<uint32_t>(value.size()));
+  memcpy(out, value.data(), value.size());
+  out += value.size();
+}
+
+/// Read from a bounded page, failing if the page is truncated.
+class SharedPageReader {
+ public:
+  SharedPageReader(const char* data, size_t size)
+      : data_(data), size_(size) {}
+
+  bool readU32(uint32_t& value) {
+    if (size_ - offset_ < sizeof(value)) {
+      return false;
+    }
+    memcpy(&value, data_ + offset_, sizeof(value));
+    offset_ += sizeof(value);
+    return true;
+  }
+
+  /// Find the next length-prefixed value without copying it.
+  bool readBytes(const char*& value, size_t& length) {
+    uint32_t size = 0;
+    if (!readU32(size) || size_ - offset_ < size) {
+      return false;
+    }
+    value = data_ + offset_;
+    length = size;
+    offset_ += size;
+    return true;
+  }
+
+  size_t offset() const {
+    return offset_;
+  }
+
+  void seek(size_t offset) {
+    offset_ = offset;
+  }
+
+ private:
+  const char* data_{nullptr};
+  size_t size_{0};
+  size_t offset_{0};
+};
+
+/// Free a slot after it is decoded, or when a suspended decode is unwound.
+class SharedSlotGuard : private boost::noncopyable {
+ public:
+  explicit SharedSlotGuard(std::atomic<uint32_t>* state) : state_(state) {}
+
+  ~SharedSlotGuard() {
+    state_->store(SLOT_FREE, std::memory_order_release);
+  }
+
+ private:
+  std::atomic<uint32_t>* state_{nullptr};
+};
+
+ExtensionSharedMemory::~ExtensionSharedMemory() {
+#ifndef WIN32
+  if (base_ != nullptr) {
+    ::munmap(base_, size_);
+  }
+  unlink();
+#endif
+}
+
+Status ExtensionSharedMemory::create(
+    size_t size, std::shared_ptr<ExtensionSharedMemory>& shared) {
+#ifdef WIN32
+  return Status(1, "Shared memory pages are not supported");
+#else
+  if (size < kSharedMemoryHeader + kSharedMemorySlots * kSlotMinimum) {
+    return Status(1, "Shared memory size is too small");
+  }
+
+  std::shared_ptr<ExtensionSharedMemory> segment(new ExtensionSharedMemory());
+  segment->name_ = kSharedMemoryPrefix + std::to_string(::getpid()) + "." +
+                   std::to_string(static_cast<uint16_t>(rand()));
+  segment->size_ = size;
+
+  auto fd =
+      ::shm_open(segment->name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    return Status(1, "Cannot create shared memory: " + segment->name_);
+  }
+  segment->owner_ = true;
+  segment->linked_ = true;
+
+  if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    ::close(fd);
+    return Status(1, "Cannot size shared memory: " + segment->name_);
+  }
+
+  auto status = segment->map(fd, true);
+  ::close(fd);
+  if (!status.ok()) {
+    return status;
+  }
+  shared = std::move(segment);
+  return Status(0, "OK");
+#endif
+}
+
+Status ExtensionSharedMemory::open(
+    const std::string& name,
+    size_t size,
+    std::shared_ptr<ExtensionSharedMemory>& shared) {
+#ifdef WIN32
+  return Status(1, "Shared memory pages are not supported");
+#else
+  if (!boost::starts_with(name, kSharedMemoryPrefix) ||
+      name.find('/', 1) != std::string::npos) {
+    return Status(1, "Invalid shared memory name: " + name);
+  }
+
+  if (size < kSharedMemoryHeader + kSharedMemorySlots * kSlotMinimum) {
+    return Status(1, "Shared memory size is too small");
+  }
+
+  auto fd = ::shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    return Status(1, "Cannot open shared memory: " + name);
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < size) {
+    ::close(fd);
+    return Status(1, "Shared memory is smaller than offered: " + name);
+  }
+
+  std::shared_ptr<ExtensionSharedMemory> segment(new ExtensionSharedMemory());
+  segment->name_ = name;
+  segment->size_ = size;
+  auto status = segment->map(fd, false);
+  ::close(fd);
+  if (!status.ok()) {
+    return status;
+  }
+  shared = std::move(segment);
+  return Status(0, "OK");
+#endif
+}
+
+Status ExtensionSharedMemory::map(int fd, bool create) {
+#ifdef WIN32
+  return Status(1, "Shared memory pages are not supported");
+#else
+  auto base =
+      ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    return Status(1, "Cannot map shared memory: " + name_);
+  }
+  base_ = static_cast<char*>(base);
+
+  auto header = reinterpret_cast<SharedMemoryHeader*>(base_);
+  if (create) {
+    header->magic = kSharedMemoryMagic;
+    header->reserved = 0;
+    header->slots = kSharedMemorySlots;
+    // Slots are aligned so each state word is naturally aligned.
+    header->slot_size =
+        ((size_ - kSharedMemoryHeader) / kSharedMemorySlots) & ~size_t(63);
+    for (size_t i = 0; i < kSharedMemorySlots; i++) {
+      new (base_ + kSharedMemoryHeader + i * header->slot_size)
+          std::atomic<uint32_t>(SLOT_FREE);
+    }
+  }
+
+  // The header describes the slots, check they are within the mapping.
+  if (header->magic != kSharedMemoryMagic || header->slots == 0 ||
+      header->slots > kSharedMemorySlots || header->slot_size < kSlotMinimum ||
+      header->slot_size % 64 != 0 ||
+      header->slot_size > (size_ - kSharedMemoryHeader) / header->slots) {
+    return Status(1, "Invalid shared memory header: " + name_);
+  }
+
+  slots_ = static_cast<size_t>(header->slots);
+  slot_size_ = static_cast<size_t>(header->slot_size);
+  return Status(0, "OK");
+#endif
+}
+
+void ExtensionSharedMemory::unlink() {
+#ifndef WIN32
+  if (owner_ && linked_) {
+    ::shm_unlink(name_.c_str());
+    linked_ = false;
+  }
+#endif
+}
+
+std::atomic<uint32_t>* ExtensionSharedMemory::state(size_t slot) const {
+  return reinterpret_cast<std::atomic<uint32_t>*>(
+      base_ + kSharedMemoryHeader + slot * slot_size_);
+}
+
+char* ExtensionSharedMemory::data(size_t slot) const {
+  return base_ + kSharedMemoryHeader + slot * slot_size_ + kSlotHeader;
+}
+
+bool ExtensionSharedMemory::write(const ExtensionColumnarResponse& page,
+                                  int32_t& slot) {
+  if (base_ == nullptr || page.rows < 0) {
+    return false;
+  }
+
+  // Find the encoded size before claiming a slot.
+  size_t length = sizeof(uint32_t) * 2;
+  for (size_t i = 0; i < page.columns.size(); i++) {
+    length += sizeof(uint32_t) + page.columns[i].size();
+    length += sizeof(uint32_t) * 2;
+    auto absent = page.absent.find(static_cast<int32_t>(i));
+    if (absent != page.absent.end()) {
+      length += sizeof(uint32_t) * absent->second.size();
+    }
+    if (i < page.values.size()) {
+      for (const auto& value : page.values[i]) {
+        length += sizeof(uint32_t) + value.size();
+      }
+    }
+  }
+  if (length > slot_size_ - kSlotHeader) {
+    return false;
+  }
+
+  for (size_t i = 0; i < slots_; i++) {
+    uint32_t expected = SLOT_FREE;
+    if (!state(i)->compare_exchange_strong(expected, SLOT_WRITING)) {
+      continue;
+    }
+
+    // The page is written as the row count, the column count, then for each
+    // column its name, absent row indexes, and values.
+    char* out = data(i);
+    writeU32(out, static_cast<uint32_t>(page.rows));
+    writeU32(out, static_cast<uint32_t>(page.columns.size()));
+    for (size_t c = 0; c < page.columns.size(); c++) {
+      writeBytes(out, page.columns[c]);
+      auto absent = page.absent.find(static_cast<int32_t>(c));
+      if (absent == page.absent.end()) {
+        writeU32(out, 0);
+      } else {
+        writeU32(out, static_cast<uint32_t>(absent->second.size()));
+        for (const auto& row : absent->second) {
+          writeU32(out, static_cast<uint32_t>(row));
+        }
+      }
+
+      if (c < page.values.size()) {
+        writeU32(out, static_cast<uint32_t>(page.values[c].size()));
+        for (const auto& value : page.values[c]) {
+          writeBytes(out, value);
+        }
+      } else {
+        writeU32(out, 0);
+      }
+    }
+
+    uint64_t written = static_cast<uint64_t>(out - data(i));
+    memcpy(data(i) - sizeof(written), &written, sizeof(written));
+    state(i)->store(SLOT_WRITTEN, std::memory_order_release);
+    slot = static_cast<int32_t>(i);
+    return true;
+  }
+
+  // Every slot is in use by the manager.
+  return false;
+}
+
+Status ExtensionSharedMemory::read(int32_t slot, RowBatch& batch) {
+  if (base_ == nullptr || slot < 0 || static_cast<size_t>(slot) >= slots_) {
+    return Status(1, "Invalid shared memory slot");
+  }
+
+  auto slot_state = state(static_cast<size_t>(slot));
+  if (slot_state->load(std::memory_order_acquire) != SLOT_WRITTEN) {
+    return Status(1, "Shared memory slot was not written");
+  }
+  SharedSlotGuard guard(slot_state);
+
+  uint64_t length = 0;
+  memcpy(&length, data(slot) - sizeof(length), sizeof(length));
+  if (length > slot_size_ - kSlotHeader) {
+    return Status(1, "Invalid shared memory page length");
+  }
+
+  SharedPageReader reader(data(slot), static_cast<size_t>(length));
+  uint32_t rows = 0;
+  uint32_t columns = 0;
+  if (!reader.readU32(rows) || !reader.readU32(columns) ||
+      columns > length / (sizeof(uint32_t) * 3)) {
+    return Status(1, "Truncated shared memory page");
+  }
+
+  // Find the batch column, absent rows, and first value of each column.
+  struct PageColumn {
+    size_t index{0};
+    std::vector<uint32_t> absent;
+    size_t next_absent{0};
+    uint32_t values{0};
+    size_t offset{0};
+  };
+
+  std::vector<PageColumn> page_columns(columns);
+  for (auto& column : page_columns) {
+    const char* name = nullptr;
+    size_t name_length = 0;
+    uint32_t absent = 0;
+    if (!reader.readBytes(name, name_length) || !reader.readU32(absent) ||
+        absent > length / sizeof(uint32_t)) {
+      return Status(1, "Truncated shared memory page");
+    }
+    column.index = batch.index(std::string(name, name_length));
+    column.absent.resize(absent);
+    for (auto& row : column.absent) {
+      if (!reader.readU32(row)) {
+        return Status(1, "Truncated shared memory page");
+      }
+    }
+
+    if (!reader.readU32(column.values)) {
+      return Status(1, "Truncated shared memory page");
+    }
+    column.offset = reader.offset();
+    for (uint32_t v = 0; v < column.values; v++) {
+      const char* value = nullptr;
+      size_t value_length = 0;
+      if (!reader.readBytes(value, value_length)) {
+        return Status(1, "Truncated shared memory page");
+      }
+    }
+  }
+
+  for (uint32_t r = 0; r < rows; r++) {
+    // Adding a row may suspend a bounded batch until it is read.
+    batch.addRow();
+    for (auto& column : page_columns) {
+      if (r >= column.values) {
+        continue;
+      }
+
+      const char* value = nullptr;
+      size_t value_length = 0;
+      reader.seek(column.offset);
+      if (!reader.readBytes(value, value_length)) {
+        // The extension changed the page while it was read.
+        return Status(1, "Truncated shared memory page");
+      }
+      column.offset = reader.offset();
+
+      if (column.next_absent < column.absent.size() &&
+          column.absent[column.next_absent] == r) {
+        column.next_absent++;
+        continue;
+      }
+      if (column.index < batch.columns()) {
+        batch.set(column.index, std::string(value, value_length));
+      }
+    }
+  }
+  return Status(0, "OK");
+}
+
+std::shared_ptr<ExtensionSharedMemory> ExtensionSharedMemory::local() {
+  ReadLock lock(kSharedMutex);
+  return kLocalShared;
+}
+
+void ExtensionSharedMemory::setLocal(
+    std::shared_ptr<ExtensionSharedMemory> shared) {
+  WriteLock lock(kSharedMutex);
+  kLocalShared = std::move(shared);
+}
+
+std::shared_ptr<ExtensionSharedMemory> ExtensionSharedMemory::get(
+    RouteUUID uuid) {
+  ReadLock lock(kSharedMutex);
+  auto it = kShared.find(uuid);
+  return (it == kShared.end()) ? nullptr : it->second;
+}
+
+void ExtensionSharedMemory::attach(
+    RouteUUID uuid, std::shared_ptr<ExtensionSharedMemory> shared) {
+  WriteLock lock(kSharedMutex);
+  kShared[uuid] = std::move(shared);
+}
+
+void ExtensionSharedMemory::detach(RouteUUID uuid) {
+  WriteLock lock(kSharedMutex);
+  kShared.erase(uuid);
+}
+}
+}
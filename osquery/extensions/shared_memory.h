@@ -0,0 +1,137 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include "osquery/extensions/interface.h"
+
+namespace osquery {
+namespace extensions {
+
+/// The generateOpen request key asking for pages in shared memory.
+extern const std::string kSharedPagesKey;
+
+/**
+ * @brief Shared memory for table pages between an extension and its manager.
+ *
+ * An extension creating a segment offers it to the manager when registering.
+ * The manager maps the segment, and requests extension table pages stored in
+ * the segment rather than sent through the extension socket. Control
+ * messages, such as the page cursors, are still sent with Thrift.
+ *
+ * The segment is divided into a fixed number of slots. The extension writes
+ * a page to a free slot and returns the slot index in the cursor response;
+ * the manager decodes the slot directly into a RowBatch and frees it. A page
+ * larger than a slot, or a page written while every slot is in use, is sent
+ * through the socket.
+ */
+class ExtensionSharedMemory : private boost::noncopyable {
+ public:
+  ~ExtensionSharedMemory();
+
+  /**
+   * @brief Create a segment owned by this process.
+   *
+   * @param size The total size of the segment in bytes.
+   * @param shared The output segment.
+   */
+  static Status create(size_t size,
+                       std::shared_ptr<ExtensionSharedMemory>& shared);
+
+  /**
+   * @brief Map a segment created by another process.
+   *
+   * @param name The segment name offered by the creator.
+   * @param size The size of the segment offered by the creator.
+   * @param shared The output segment.
+   */
+  static Status open(const std::string& name,
+                     size_t size,
+                     std::shared_ptr<ExtensionSharedMemory>& shared);
+
+  /// Remove the segment name, mappings remain valid until released.
+  void unlink();
+
+  /**
+   * @brief Copy a page into a free slot.
+   *
+   * @param page The encoded page.
+   * @param slot The output slot index.
+   * @return false if the page must be sent through the socket.
+   */
+  bool write(const ExtensionColumnarResponse& page, int32_t& slot);
+
+  /**
+   * @brief Decode the page in a slot into a batch, and free the slot.
+   *
+   * Adding rows may suspend a bounded batch, the slot is freed if the
+   * generator is unwound.
+   */
+  Status read(int32_t slot, RowBatch& batch);
+
+  const std::string& name() const {
+    return name_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  /// The segment used by this extension process, if any.
+  static std::shared_ptr<ExtensionSharedMemory> local();
+
+  /// Set the segment used by this extension process.
+  static void setLocal(std::shared_ptr<ExtensionSharedMemory> shared);
+
+  /// The segment mapped for a registered extension, if any.
+  static std::shared_ptr<ExtensionSharedMemory> get(RouteUUID uuid);
+
+  /// Keep the segment mapped for a registered extension.
+  static void attach(RouteUUID uuid,
+                     std::shared_ptr<ExtensionSharedMemory> shared);
+
+  /// Release the segment of an extension that has gone away.
+  static void detach(RouteUUID uuid);
+
+ private:
+  ExtensionSharedMemory() {}
+
+  /// Check the segment header and find the slots.
+  Status map(int fd, bool create);
+
+  /// The state word of a slot.
+  std::atomic<uint32_t>* state(size_t slot) const;
+
+  /// The start of a slot's page, after its state and length.
+  char* data(size_t slot) const;
+
+ private:
+  std::string name_;
+
+  /// The mapped segment.
+  char* base_{nullptr};
+  size_t size_{0};
+
+  /// The number of slots and the bytes in each.
+  size_t slots_{0};
+  size_t slot_size_{0};
+
+  /// The creator removes the segment name when it is released.
+  bool owner_{false};
+  bool linked_{false};
+};
+}
+}
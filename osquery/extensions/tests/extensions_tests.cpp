@@ -14,6 +14,7 @@
 #endif
 
 #include <stdexcept>
+#include <thread>
 
 #include <gtest/gtest.h>
 
@@ -22,6 +23,7 @@
 
 #include "osquery/core/process.h"
 #include "osquery/extensions/interface.h"
+#include "osquery/extensions/shared_memory.h"
 #include "osquery/filesystem/fileops.h"
 #include "osquery/tests/test_util.h"
 
@@ -29,6 +31,8 @@ using namespace osquery::extensions;
 
 namespace osquery {
 
+DECLARE_uint64(extensions_route_concurrency);
+
 const int kDelay = 20;
 const int kTimeout = 3000;
 
@@ -182,6 +186,221 @@ class ExtensionPlugin : public Plugin {
   }
 };
 
+TEST_F(ExtensionsTest, test_columnar_response) {
+  PluginResponse rows = {
+      {{"name", "a"}, {"value", "1"}},
+      {{"name", "b"}},
+      {},
+      {{"value", ""}, {"other", "x"}},
+  };
+
+  ExtensionColumnarResponse columnar;
+  encodeColumnarResponse(rows, columnar);
+  EXPECT_EQ(4, columnar.rows);
+  ASSERT_EQ(3U, columnar.columns.size());
+  EXPECT_EQ("name", columnar.columns[0]);
+  EXPECT_EQ("value", columnar.columns[1]);
+  EXPECT_EQ("other", columnar.columns[2]);
+  ASSERT_EQ(3U, columnar.values.size());
+  EXPECT_EQ(4U, columnar.values[0].size());
+
+  // Missing columns are recorded separately from empty values.
+  ASSERT_EQ(1U, columnar.absent.count(1));
+  EXPECT_EQ(std::vector<int32_t>({1, 2}), columnar.absent.at(1));
+
+  PluginResponse decoded;
+  decodeColumnarResponse(columnar, decoded);
+  EXPECT_EQ(rows, decoded);
+
+  // A response without rows encodes no columns.
+  encodeColumnarResponse({}, columnar);
+  EXPECT_EQ(0, columnar.rows);
+  EXPECT_TRUE(columnar.columns.empty());
+  decoded.clear();
+  decodeColumnarResponse(columnar, decoded);
+  EXPECT_TRUE(decoded.empty());
+}
+
+class pagedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", INTEGER_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("text", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  bool usesBatch() const override {
+    return true;
+  }
+
+ public:
+  void generateBatch(RowBatch& batch, QueryContext& context) override {
+    for (size_t i = 0; i < 10; i++) {
+      batch.addRow();
+      batch.setInteger(0, i);
+      if (i % 2 == 0) {
+        batch.setText(1, "row_" + std::to_string(i));
+      }
+      generated++;
+    }
+  }
+
+  size_t generated{0};
+};
+
+TEST_F(ExtensionsTest, test_table_cursor) {
+  auto paged = std::make_shared<pagedTablePlugin>();
+  RegistryFactory::get().registry("table")->add("paged_test", paged);
+
+  // Columnar tables generate one page at a time.
+  ExtensionTableCursor cursor("paged_test", {{"action", "generate"}}, 4);
+  EXPECT_TRUE(cursor.getStatus().ok());
+  EXPECT_EQ(4U, paged->generated);
+
+  RowBatch batch({
+      std::make_tuple("i", INTEGER_TYPE, ColumnOptions::DEFAULT),
+      std::make_tuple("text", TEXT_TYPE, ColumnOptions::DEFAULT),
+  });
+
+  ExtensionColumnarResponse page;
+  EXPECT_FALSE(cursor.next(page));
+  EXPECT_EQ(4, page.rows);
+  appendColumnarRows(page, batch);
+  EXPECT_FALSE(cursor.next(page));
+  EXPECT_EQ(8U, paged->generated);
+  appendColumnarRows(page, batch);
+
+  // The last page completes the cursor.
+  EXPECT_TRUE(cursor.next(page));
+  EXPECT_EQ(2, page.rows);
+  appendColumnarRows(page, batch);
+  EXPECT_EQ(10U, paged->generated);
+
+  ASSERT_EQ(10U, batch.size());
+  EXPECT_EQ(9, batch.getInteger(9, 0));
+  EXPECT_EQ("row_8", batch.getText(8, 1));
+
+  // Cells that were not set remain NULL.
+  EXPECT_TRUE(batch.isNull(9, 1));
+
+  RegistryFactory::get().registry("table")->remove("paged_test");
+}
+
+TEST_F(ExtensionsTest, test_shared_memory_pages) {
+  if (isPlatform(PlatformType::TYPE_WINDOWS)) {
+    return;
+  }
+
+  std::shared_ptr<ExtensionSharedMemory> local;
+  ASSERT_TRUE(ExtensionSharedMemory::create(64 * 1024, local).ok());
+
+  // The manager maps the segment using the offered name and size.
+  std::shared_ptr<ExtensionSharedMemory> shared;
+  ASSERT_TRUE(
+      ExtensionSharedMemory::open(local->name(), local->size(), shared).ok());
+  local->unlink();
+  EXPECT_FALSE(ExtensionSharedMemory::open("/other", 64 * 1024, shared).ok());
+
+  ExtensionColumnarResponse page;
+  encodeColumnarResponse({{{"i", "1"}, {"text", "one"}}, {{"i", "2"}}}, page);
+  int32_t slot = -1;
+  ASSERT_TRUE(local->write(page, slot));
+
+  RowBatch batch({
+      std::make_tuple("i", INTEGER_TYPE, ColumnOptions::DEFAULT),
+      std::make_tuple("text", TEXT_TYPE, ColumnOptions::DEFAULT),
+  });
+  ASSERT_TRUE(shared->read(slot, batch).ok());
+  ASSERT_EQ(2U, batch.size());
+  EXPECT_EQ(2, batch.getInteger(1, 0));
+  EXPECT_EQ("one", batch.getText(0, 1));
+  EXPECT_TRUE(batch.isNull(1, 1));
+
+  // A slot is freed once read, and cannot be read twice.
+  EXPECT_FALSE(shared->read(slot, batch).ok());
+
+  // Pages are sent through the socket when every slot is in use.
+  size_t written = 0;
+  while (local->write(page, slot) && written < 16) {
+    written++;
+  }
+  EXPECT_EQ(4U, written);
+  ASSERT_TRUE(shared->read(slot, batch).ok());
+  EXPECT_TRUE(local->write(page, slot));
+}
+
+TEST_F(ExtensionsTest, test_route_concurrency) {
+  auto concurrency = FLAGS_extensions_route_concurrency;
+  FLAGS_extensions_route_concurrency = 1;
+
+  RouteUUID uuid = 65537;
+  std::thread waiting;
+  {
+    ExtensionRouteSlot logger(uuid, "logger");
+
+    // A second logger call waits for the slot.
+    waiting =
+        std::thread([uuid]() { ExtensionRouteSlot slot(uuid, "logger"); });
+    for (size_t delay = 0; delay < kTimeout; delay += kDelay) {
+      if (getExtensionRouteMetrics()[uuid].queued == 1) {
+        break;
+      }
+      sleepFor(kDelay);
+    }
+    EXPECT_EQ(1U, getExtensionRouteMetrics()[uuid].queued);
+
+    // Calls to other registries of the same extension are not blocked.
+    { ExtensionRouteSlot table(uuid, "table"); }
+    EXPECT_EQ(1U, getExtensionRouteMetrics()[uuid].active);
+    sleepFor(kDelay * 2);
+  }
+  waiting.join();
+
+  auto metrics = getExtensionRouteMetrics()[uuid];
+  EXPECT_EQ(3U, metrics.calls);
+  EXPECT_EQ(0U, metrics.active);
+  EXPECT_EQ(0U, metrics.queued);
+  EXPECT_GE(metrics.max_wait, static_cast<size_t>(kDelay));
+  EXPECT_GE(metrics.wait, metrics.max_wait);
+  FLAGS_extensions_route_concurrency = concurrency;
+}
+
+TEST_F(ExtensionsTest, test_client_pool) {
+  auto status = startExtensionManager(socket_path);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(socketExistsLocal(socket_path));
+
+  // Completed calls return their client to the pool for reuse.
+  auto& pool = EXClientPool<EXManagerClient>::instance();
+  EXPECT_EQ(1U, registeredExtensions().size());
+  EXPECT_EQ(1U, pool.idle(socket_path));
+  EXPECT_TRUE(EXClientHealth::recent(socket_path, kTimeout));
+  EXPECT_EQ(1U, registeredExtensions().size());
+  EXPECT_EQ(1U, pool.idle(socket_path));
+
+  // Restart the manager, the idle connection was closed by its peer.
+  Dispatcher::stopServices();
+  Dispatcher::joinServices();
+  status = startExtensionManager(socket_path);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(socketExistsLocal(socket_path));
+
+  // The call is retried with a new connection.
+  ExtensionList extensions;
+  EXPECT_TRUE(getExtensions(socket_path, extensions).ok());
+  EXPECT_EQ(1U, extensions.size());
+  EXPECT_EQ(1U, pool.idle(socket_path));
+
+  // A failed call forgets the path's health and idle clients.
+  {
+    EXPooledClient<EXManagerClient> client(socket_path);
+    EXPECT_TRUE(client.reused());
+  }
+  EXPECT_EQ(0U, pool.idle(socket_path));
+  EXPECT_FALSE(EXClientHealth::recent(socket_path, kTimeout));
+}
+
 class TestExtensionPlugin : public ExtensionPlugin {};
 
 CREATE_REGISTRY(ExtensionPlugin, "extension_test");
@@ -0,0 +1,101 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+#include "osquery/tests/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+DECLARE_uint64(glob_concurrency);
+
+/**
+ * @brief Create a tree of directories, each with files and subdirectories.
+ *
+ * The tree resembles home directories, 8 top-level directories each with
+ * nested directories to the requested depth.
+ */
+static std::string createGlobBenchmarkTree(size_t depth) {
+  auto root = kTestWorkingDirectory + "glob-benchmark-" + std::to_string(depth);
+  if (isDirectory(root)) {
+    return root;
+  }
+
+  std::vector<std::string> level = {root};
+  for (size_t d = 0; d <= depth; d++) {
+    std::vector<std::string> next;
+    for (const auto& directory : level) {
+      fs::create_directories(directory);
+      for (size_t i = 0; i < 4; i++) {
+        writeTextFile(directory + "/file" + std::to_string(i) + ".conf", "");
+      }
+      writeTextFile(directory + "/.hidden", "");
+      size_t children = (d == 0) ? 8 : 3;
+      for (size_t i = 0; i < children && d < depth; i++) {
+        next.push_back(directory + "/dir" + std::to_string(i));
+      }
+    }
+    level = std::move(next);
+  }
+  return root;
+}
+
+static void benchmarkGlob(benchmark::State& state,
+                          const GlobPrefixFilter& filter) {
+  auto root = createGlobBenchmarkTree(static_cast<size_t>(state.range_x()));
+  auto concurrency = FLAGS_glob_concurrency;
+  FLAGS_glob_concurrency = static_cast<size_t>(state.range_y());
+
+  size_t paths = 0;
+  while (state.KeepRunning()) {
+    std::vector<std::string> results;
+    resolveFilePattern(root + "/%%", results, GLOB_ALL, filter);
+    paths += results.size();
+  }
+  state.SetItemsProcessed(paths);
+
+  FLAGS_glob_concurrency = concurrency;
+}
+
+/// Resolve every path below the tree, like `path LIKE '/home/%%'`.
+static void GLOB_recursive(benchmark::State& state) {
+  benchmarkGlob(state, nullptr);
+}
+
+BENCHMARK(GLOB_recursive)->ArgPair(3, 1)->ArgPair(3, 4)->ArgPair(5, 4);
+
+/// Resolve the paths below a single top-level directory of the tree.
+static void GLOB_recursive_pruned(benchmark::State& state) {
+  benchmarkGlob(state, [](const std::string& directory) {
+    return directory.find("/dir0/") != std::string::npos;
+  });
+}
+
+BENCHMARK(GLOB_recursive_pruned)->ArgPair(3, 1)->ArgPair(5, 1);
+
+/// Resolve a non-recursive pattern of files in each top-level directory.
+static void GLOB_wildcard(benchmark::State& state) {
+  auto root = createGlobBenchmarkTree(static_cast<size_t>(state.range_x()));
+  while (state.KeepRunning()) {
+    std::vector<std::string> results;
+    resolveFilePattern(root + "/%/%.conf", results, GLOB_FILES);
+    benchmark::DoNotOptimize(results);
+  }
+}
+
+BENCHMARK(GLOB_wildcard)->Arg(3);
+}
@@ -35,6 +35,18 @@ static void PLIST_parse_content(benchmark::State& state) {
 
 BENCHMARK(PLIST_parse_content);
 
+static void PLIST_parse_binary_content(benchmark::State& state) {
+  std::string content;
+  readFile(kTestDataPath + "test_binary.plist", content);
+
+  while (state.KeepRunning()) {
+    pt::ptree tree;
+    auto status = parsePlistContent(content, tree);
+  }
+}
+
+BENCHMARK(PLIST_parse_binary_content);
+
 static void PLIST_parse_file(benchmark::State& state) {
   while (state.KeepRunning()) {
     pt::ptree tree;
@@ -0,0 +1,448 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "osquery/core/conversions.h"
+#include "osquery/filesystem/darwin/binary_plist.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+const std::string kBinaryPlistMagic = "bplist00";
+
+/// The trailer holds the sizes and offsets needed to find each object.
+const size_t kBinaryPlistTrailerSize = 32;
+
+/// Seconds between the UNIX epoch and the CoreFoundation epoch, 2001-01-01.
+const double kCFAbsoluteTimeIntervalSince1970 = 978307200.0;
+
+/// Nested containers deeper than this are considered malformed (or cyclic).
+const size_t kBinaryPlistMaxDepth = 512;
+
+enum BinaryPlistMarker {
+  BPLIST_SIMPLE = 0x0,
+  BPLIST_INT = 0x1,
+  BPLIST_REAL = 0x2,
+  BPLIST_DATE = 0x3,
+  BPLIST_DATA = 0x4,
+  BPLIST_ASCII = 0x5,
+  BPLIST_UTF16 = 0x6,
+  BPLIST_UID = 0x8,
+  BPLIST_ARRAY = 0xA,
+  BPLIST_SET = 0xC,
+  BPLIST_DICT = 0xD,
+};
+
+/**
+ * @brief A reader for the objects of a binary property list.
+ *
+ * Every read is bounds-checked against the content, objects are found using
+ * the offset table and only the objects reachable from the top are read.
+ */
+class BinaryPlistReader {
+ public:
+  explicit BinaryPlistReader(const std::string& content)
+      : data_(reinterpret_cast<const unsigned char*>(content.data())),
+        size_(content.size()) {}
+
+  /// Read the trailer and offset table.
+  Status init();
+
+  /// Read the top object into a tree with the Foundation parser's layout.
+  Status parse(pt::ptree& tree);
+
+ private:
+  /// Read a big-endian unsigned integer of 1 to 8 bytes.
+  bool readUInt(size_t offset, size_t bytes, uint64_t& value) const;
+
+  /// Read the marker and the object or element count at an object's offset.
+  bool readHeader(uint64_t object,
+                  unsigned char& type,
+                  unsigned char& info,
+                  size_t& offset,
+                  uint64_t& count) const;
+
+  /// Read a list of object references following a container header.
+  bool readRef(size_t offset, uint64_t index, uint64_t& object) const;
+
+  /// Read a scalar object as the Foundation parser's string value.
+  Status readValue(uint64_t object, std::string& value) const;
+
+  /// Read a dictionary key, which must be a string.
+  Status readKey(uint64_t object, std::string& key) const;
+
+  /// Read any object into a tree node.
+  Status readObject(uint64_t object, size_t depth, pt::ptree& node) const;
+
+  /// Read a dictionary's entries as children of a node.
+  Status readDictionary(size_t offset,
+                        uint64_t count,
+                        size_t depth,
+                        pt::ptree& node) const;
+
+  /// Read an array's elements as anonymous children of a node.
+  Status readArray(size_t offset,
+                   uint64_t count,
+                   size_t depth,
+                   pt::ptree& node) const;
+
+ private:
+  const unsigned char* data_{nullptr};
+  size_t size_{0};
+
+  size_t offset_size_{0};
+  size_t ref_size_{0};
+  uint64_t objects_{0};
+  uint64_t top_{0};
+  uint64_t table_{0};
+
+  /// Objects read so far, limited by the number of references.
+  mutable size_t visited_{0};
+};
+
+/// Format a real as the shortest decimal that reads back to the same value.
+static std::string formatReal(double value, bool single) {
+  if (std::isnan(value)) {
+    return "nan";
+  } else if (std::isinf(value)) {
+    return (value < 0) ? "-inf" : "inf";
+  }
+
+  char buffer[32];
+  for (int precision = 1; precision <= 17; precision++) {
+    snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+    auto parsed = strtod(buffer, nullptr);
+    if ((single && static_cast<float>(parsed) == static_cast<float>(value)) ||
+        parsed == value) {
+      break;
+    }
+  }
+  return buffer;
+}
+
+/// Append a code point as UTF-8.
+static void appendUTF8(uint32_t code, std::string& output) {
+  if (code < 0x80) {
+    output += static_cast<char>(code);
+  } else if (code < 0x800) {
+    output += static_cast<char>(0xC0 | (code >> 6));
+    output += static_cast<char>(0x80 | (code & 0x3F));
+  } else if (code < 0x10000) {
+    output += static_cast<char>(0xE0 | (code >> 12));
+    output += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    output += static_cast<char>(0x80 | (code & 0x3F));
+  } else {
+    output += static_cast<char>(0xF0 | (code >> 18));
+    output += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+    output += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    output += static_cast<char>(0x80 | (code & 0x3F));
+  }
+}
+
+bool BinaryPlistReader::readUInt(size_t offset,
+                                 size_t bytes,
+                                 uint64_t& value) const {
+  if (bytes == 0 || bytes > 8 || offset > size_ || size_ - offset < bytes) {
+    return false;
+  }
+
+  value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value = (value << 8) | data_[offset + i];
+  }
+  return true;
+}
+
+Status BinaryPlistReader::init() {
+  if (size_ < kBinaryPlistMagic.size() + kBinaryPlistTrailerSize ||
+      memcmp(data_, kBinaryPlistMagic.data(), kBinaryPlistMagic.size()) != 0) {
+    return Status(1, "Not a binary plist");
+  }
+
+  auto trailer = size_ - kBinaryPlistTrailerSize;
+  offset_size_ = data_[trailer + 6];
+  ref_size_ = data_[trailer + 7];
+  readUInt(trailer + 8, 8, objects_);
+  readUInt(trailer + 16, 8, top_);
+  readUInt(trailer + 24, 8, table_);
+
+  if (offset_size_ == 0 || offset_size_ > 8 || ref_size_ == 0 ||
+      ref_size_ > 8 || top_ >= objects_ || table_ >= trailer ||
+      objects_ > (trailer - table_) / offset_size_) {
+    return Status(1, "Malformed binary plist trailer");
+  }
+  return Status(0, "OK");
+}
+
+bool BinaryPlistReader::readHeader(uint64_t object,
+                                   unsigned char& type,
+                                   unsigned char& info,
+                                   size_t& offset,
+                                   uint64_t& count) const {
+  uint64_t start = 0;
+  if (object >= objects_ ||
+      !readUInt(table_ + object * offset_size_, offset_size_, start) ||
+      start < kBinaryPlistMagic.size() || start >= table_) {
+    return false;
+  }
+
+  offset = static_cast<size_t>(start);
+  type = data_[offset] >> 4;
+  info = data_[offset] & 0x0F;
+  offset++;
+  count = info;
+  if (info != 0x0F || type == BPLIST_SIMPLE || type == BPLIST_INT ||
+      type == BPLIST_REAL || type == BPLIST_DATE || type == BPLIST_UID) {
+    return true;
+  }
+
+  // Large counts follow the marker as an integer object.
+  if (offset >= size_ || (data_[offset] >> 4) != BPLIST_INT) {
+    return false;
+  }
+  size_t bytes = static_cast<size_t>(1) << (data_[offset] & 0x0F);
+  if (!readUInt(offset + 1, bytes, count)) {
+    return false;
+  }
+  offset += 1 + bytes;
+  return true;
+}
+
+bool BinaryPlistReader::readRef(size_t offset,
+                                uint64_t index,
+                                uint64_t& object) const {
+  return readUInt(offset + index * ref_size_, ref_size_, object);
+}
+
+Status BinaryPlistReader::readValue(uint64_t object, std::string& value) const {
+  unsigned char type = 0;
+  unsigned char info = 0;
+  size_t offset = 0;
+  uint64_t count = 0;
+  if (!readHeader(object, type, info, offset, count)) {
+    return Status(1, "Malformed binary plist object");
+  }
+
+  value.clear();
+  switch (type) {
+  case BPLIST_SIMPLE:
+    // Booleans are NSNumbers, null and fill objects have no value.
+    if (info == 0x08 || info == 0x09) {
+      value = (info == 0x09) ? "1" : "0";
+    }
+    break;
+  case BPLIST_INT: {
+    size_t bytes = static_cast<size_t>(1) << info;
+    uint64_t number = 0;
+    // Integers of 16 bytes store values above INT64_MAX in the low bytes.
+    size_t skip = (bytes > 8) ? bytes - 8 : 0;
+    if (!readUInt(offset + skip, bytes - skip, number)) {
+      return Status(1, "Malformed binary plist integer");
+    }
+    // Only integers of 8 bytes are signed.
+    value = (bytes == 8) ? std::to_string(static_cast<int64_t>(number))
+                         : std::to_string(number);
+    break;
+  }
+  case BPLIST_REAL:
+  case BPLIST_DATE: {
+    size_t bytes = static_cast<size_t>(1) << info;
+    uint64_t bits = 0;
+    if ((bytes != 4 && bytes != 8) || !readUInt(offset, bytes, bits)) {
+      return Status(1, "Malformed binary plist real");
+    }
+    double number = 0;
+    if (bytes == 4) {
+      float single = 0;
+      auto bits32 = static_cast<uint32_t>(bits);
+      memcpy(&single, &bits32, sizeof(single));
+      number = single;
+    } else {
+      memcpy(&number, &bits, sizeof(number));
+    }
+    if (type == BPLIST_DATE) {
+      number += kCFAbsoluteTimeIntervalSince1970;
+    }
+    value = formatReal(number, bytes == 4);
+    break;
+  }
+  case BPLIST_DATA:
+    if (offset > table_ || table_ - offset < count) {
+      return Status(1, "Malformed binary plist data");
+    }
+    value = base64Encode(std::string(
+        reinterpret_cast<const char*>(data_ + offset), count));
+    break;
+  case BPLIST_ASCII:
+    if (offset > table_ || table_ - offset < count) {
+      return Status(1, "Malformed binary plist string");
+    }
+    value.assign(reinterpret_cast<const char*>(data_ + offset), count);
+    break;
+  case BPLIST_UTF16: {
+    if (offset > table_ || (table_ - offset) / 2 < count) {
+      return Status(1, "Malformed binary plist string");
+    }
+    value.reserve(count);
+    for (uint64_t i = 0; i < count; i++) {
+      uint32_t code = (data_[offset + i * 2] << 8) | data_[offset + i * 2 + 1];
+      if (code >= 0xD800 && code < 0xDC00 && i + 1 < count) {
+        uint32_t low =
+            (data_[offset + i * 2 + 2] << 8) | data_[offset + i * 2 + 3];
+        if (low >= 0xDC00 && low < 0xE000) {
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+          i++;
+        }
+      }
+      appendUTF8(code, value);
+    }
+    break;
+  }
+  default:
+    // Keyed archiver UIDs are not converted by Foundation either.
+    break;
+  }
+  return Status(0, "OK");
+}
+
+Status BinaryPlistReader::readKey(uint64_t object, std::string& key) const {
+  unsigned char type = 0;
+  unsigned char info = 0;
+  size_t offset = 0;
+  uint64_t count = 0;
+  if (!readHeader(object, type, info, offset, count) ||
+      (type != BPLIST_ASCII && type != BPLIST_UTF16)) {
+    return Status(1, "Binary plist dictionary key is not a string");
+  }
+  return readValue(object, key);
+}
+
+Status BinaryPlistReader::readObject(uint64_t object,
+                                     size_t depth,
+                                     pt::ptree& node) const {
+  if (depth > kBinaryPlistMaxDepth) {
+    return Status(1, "Binary plist is nested too deeply");
+  }
+
+  // A tree reads each reference once, and each reference is at least a byte.
+  // Containers referenced many times would expand without bound.
+  if (++visited_ > size_) {
+    return Status(1, "Binary plist references too many objects");
+  }
+
+  unsigned char type = 0;
+  unsigned char info = 0;
+  size_t offset = 0;
+  uint64_t count = 0;
+  if (!readHeader(object, type, info, offset, count)) {
+    return Status(1, "Malformed binary plist object");
+  }
+
+  if (type == BPLIST_DICT) {
+    return readDictionary(offset, count, depth, node);
+  } else if (type == BPLIST_ARRAY || type == BPLIST_SET) {
+    return readArray(offset, count, depth, node);
+  }
+
+  std::string value;
+  auto status = readValue(object, value);
+  node.put_value(value);
+  return status;
+}
+
+Status BinaryPlistReader::readDictionary(size_t offset,
+                                         uint64_t count,
+                                         size_t depth,
+                                         pt::ptree& node) const {
+  if (offset > table_ || (table_ - offset) / ref_size_ / 2 < count) {
+    return Status(1, "Malformed binary plist dictionary");
+  }
+
+  Status total_status = Status(0, "OK");
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t key_object = 0;
+    uint64_t value_object = 0;
+    readRef(offset, i, key_object);
+    readRef(offset, count + i, value_object);
+
+    std::string key;
+    if (!readKey(key_object, key).ok()) {
+      // Unknown type as dictionary key, most likely a malformed plist.
+      continue;
+    }
+
+    pt::ptree child;
+    auto status = readObject(value_object, depth + 1, child);
+    if (!status.ok()) {
+      total_status = status;
+    }
+    node.push_back(pt::ptree::value_type(key, std::move(child)));
+  }
+  return total_status;
+}
+
+Status BinaryPlistReader::readArray(size_t offset,
+                                    uint64_t count,
+                                    size_t depth,
+                                    pt::ptree& node) const {
+  if (offset > table_ || (table_ - offset) / ref_size_ < count) {
+    return Status(1, "Malformed binary plist array");
+  }
+
+  Status total_status = Status(0, "OK");
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t element = 0;
+    readRef(offset, i, element);
+
+    pt::ptree child;
+    auto status = readObject(element, depth + 1, child);
+    if (!status.ok()) {
+      total_status = status;
+    }
+    node.push_back(std::make_pair("", std::move(child)));
+  }
+  return total_status;
+}
+
+Status BinaryPlistReader::parse(pt::ptree& tree) {
+  unsigned char type = 0;
+  unsigned char info = 0;
+  size_t offset = 0;
+  uint64_t count = 0;
+  if (!readHeader(top_, type, info, offset, count)) {
+    return Status(1, "Malformed binary plist object");
+  }
+
+  if (type == BPLIST_DICT) {
+    return readDictionary(offset, count, 0, tree);
+  }
+
+  // Other top-level objects are children of a "root" key.
+  pt::ptree child;
+  auto status = readObject(top_, 0, child);
+  tree.push_back(pt::ptree::value_type("root", std::move(child)));
+  return status;
+}
+
+Status parseBinaryPlist(const std::string& content, pt::ptree& tree) {
+  tree.clear();
+  BinaryPlistReader reader(content);
+  auto status = reader.init();
+  if (!status.ok()) {
+    return status;
+  }
+  return reader.parse(tree);
+}
+}
@@ -0,0 +1,44 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// The magic and version prefix of binary property lists.
+extern const std::string kBinaryPlistMagic;
+
+/// Check if property list content uses the binary format.
+inline bool isBinaryPlist(const std::string& content) {
+  return content.compare(0, kBinaryPlistMagic.size(), kBinaryPlistMagic) == 0;
+}
+
+/**
+ * @brief Parse binary property list content without CoreFoundation.
+ *
+ * The tree matches the Foundation-backed parser: dictionaries are children,
+ * arrays are children with empty keys, and a top-level array is named "root".
+ * Numbers and dates are decimal strings, booleans are "1" or "0", and data
+ * is base64 encoded.
+ *
+ * @param content The complete content of a binary property list.
+ * @param tree The output property tree.
+ *
+ * @return an instance of Status, indicating success or failure if malformed.
+ */
+Status parseBinaryPlist(const std::string& content,
+                        boost::property_tree::ptree& tree);
+}
@@ -8,22 +8,102 @@
  *
  */
 
+#include <list>
 #include <sstream>
 
+#include <sys/stat.h>
+
 #import <Foundation/Foundation.h>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
+#include "osquery/filesystem/darwin/binary_plist.h"
+
 namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
+FLAG(uint64,
+     plist_cache_max,
+     1024,
+     "Maximum number of parsed property lists cached (0 disables)");
+
+/// A parsed property list and the file metadata it was parsed from.
+struct PlistCacheEntry {
+  ino_t inode{0};
+  off_t size{0};
+  struct timespec mtime;
+  pt::ptree tree;
+  std::list<std::string>::iterator position;
+};
+
+/// Parsed property lists by path, shared by every table reading plists.
+static std::map<std::string, PlistCacheEntry> kPlistCache;
+
+/// The cached paths, most recently used first.
+static std::list<std::string> kPlistCacheOrder;
+
+static Mutex kPlistCacheMutex;
+
+static inline bool isPlistCacheEntryCurrent(const PlistCacheEntry& entry,
+                                            const struct stat& file_stat) {
+  return entry.inode == file_stat.st_ino && entry.size == file_stat.st_size &&
+         entry.mtime.tv_sec == file_stat.st_mtimespec.tv_sec &&
+         entry.mtime.tv_nsec == file_stat.st_mtimespec.tv_nsec;
+}
+
+/// Copy a cached tree if the file has not changed since it was parsed.
+static bool getCachedPlist(const std::string& path,
+                           const struct stat& file_stat,
+                           pt::ptree& tree) {
+  WriteLock lock(kPlistCacheMutex);
+  auto entry = kPlistCache.find(path);
+  if (entry == kPlistCache.end()) {
+    return false;
+  }
+
+  if (!isPlistCacheEntryCurrent(entry->second, file_stat)) {
+    kPlistCacheOrder.erase(entry->second.position);
+    kPlistCache.erase(entry);
+    return false;
+  }
+
+  kPlistCacheOrder.splice(
+      kPlistCacheOrder.begin(), kPlistCacheOrder, entry->second.position);
+  tree = entry->second.tree;
+  return true;
+}
+
+static void cachePlist(const std::string& path,
+                       const struct stat& file_stat,
+                       const pt::ptree& tree) {
+  WriteLock lock(kPlistCacheMutex);
+  auto existing = kPlistCache.find(path);
+  if (existing != kPlistCache.end()) {
+    kPlistCacheOrder.erase(existing->second.position);
+    kPlistCache.erase(existing);
+  }
+
+  kPlistCacheOrder.push_front(path);
+  auto& entry = kPlistCache[path];
+  entry.inode = file_stat.st_ino;
+  entry.size = file_stat.st_size;
+  entry.mtime = file_stat.st_mtimespec;
+  entry.tree = tree;
+  entry.position = kPlistCacheOrder.begin();
+  while (kPlistCache.size() > FLAGS_plist_cache_max) {
+    kPlistCache.erase(kPlistCacheOrder.back());
+    kPlistCacheOrder.pop_back();
+  }
+}
+
 /**
  * @brief Filter selected data types from deserialized property list.
  *
@@ -143,6 +223,11 @@ static inline Status filterPlist(NSData* plist, pt::ptree& tree) {
 
 Status parsePlistContent(const std::string& content, pt::ptree& tree) {
   tree.clear();
+  if (isBinaryPlist(content)) {
+    // Binary property lists are read directly, without Foundation objects.
+    return parseBinaryPlist(content, tree);
+  }
+
   @autoreleasepool {
     id data = [NSData dataWithBytes:content.c_str() length:content.size()];
     if (data == nil) {
@@ -161,8 +246,13 @@ Status parsePlistContent(const std::string& content, pt::ptree& tree) {
       VLOG(1) << error_message;
       return Status(1, error_message);
     }
-    // Parse the plist data into a core foundation dictionary-literal.
-    return filterPlist(plist_data, tree);
+
+    @try {
+      // Parse the plist data into a core foundation dictionary-literal.
+      return filterPlist(plist_data, tree);
+    } @catch (NSException* exception) {
+      return Status(1, "Plist data is corrupted");
+    }
   }
 }
 
@@ -172,40 +262,24 @@ Status parsePlist(const fs::path& path, pt::ptree& tree) {
   auto dropper = DropPrivileges::get();
   dropper->dropToParent(path);
 
-  auto status = readFile(path);
+  // Many tables read the same property lists, reuse the parsed tree until
+  // the file changes.
+  struct stat file_stat;
+  bool cacheable = (FLAGS_plist_cache_max > 0 &&
+                    ::stat(path.string().c_str(), &file_stat) == 0);
+  if (cacheable && getCachedPlist(path.string(), file_stat, tree)) {
+    return Status(0, "OK");
+  }
+
+  std::string content;
+  auto status = readFile(path, content);
   if (!status.ok()) {
     return status;
   }
 
-  @autoreleasepool {
-    id ns_path = [NSString stringWithUTF8String:path.string().c_str()];
-    id stream = [NSInputStream inputStreamWithFileAtPath:ns_path];
-    if (stream == nil) {
-      return Status(1, "Unable to read plist: " + path.string());
-    }
-
-    // Read file content into a data object, containing potential plist data.
-    NSError* error = nil;
-    [stream open];
-    id plist_data = [NSPropertyListSerialization propertyListWithStream:stream
-                                                                options:0
-                                                                 format:NULL
-                                                                  error:&error];
-    if (plist_data == nil) {
-      // The most common error is lack of read permissions.
-      std::string error_message([[error localizedFailureReason] UTF8String]);
-      VLOG(1) << error_message;
-      [stream close];
-      return Status(1, error_message);
-    }
-
-    @try {
-      // Parse the plist data into a core foundation dictionary-literal.
-      status = filterPlist(plist_data, tree);
-    } @catch (NSException* exception) {
-      status = Status(1, "Plist data is corrupted");
-    }
-    [stream close];
+  status = parsePlistContent(content, tree);
+  if (status.ok() && cacheable) {
+    cachePlist(path.string(), file_stat, tree);
   }
   return status;
 }
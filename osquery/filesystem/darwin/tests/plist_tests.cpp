@@ -16,6 +16,7 @@
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/darwin/binary_plist.h"
 #include "osquery/tests/test_util.h"
 
 namespace fs = boost::filesystem;
@@ -102,4 +103,41 @@ TEST_F(PlistTests, test_parse_plist_content_with_blobs) {
   // Verify we parsed the binary blob correctly
   EXPECT_NE(alias.find("Applications/Flux.app"), std::string::npos);
 }
+
+TEST_F(PlistTests, test_parse_binary_plist_malformed) {
+  std::string content;
+  readFile(kTestDataPath + "test_binary.plist", content);
+  ASSERT_TRUE(isBinaryPlist(content));
+
+  // Truncated content loses the trailer and the offset table.
+  pt::ptree tree;
+  auto s = parseBinaryPlist(content.substr(0, content.size() / 2), tree);
+  EXPECT_FALSE(s.ok());
+  EXPECT_FALSE(parseBinaryPlist(kBinaryPlistMagic, tree).ok());
+
+  // Offsets past the offset table are rejected.
+  auto corrupt = content;
+  corrupt[corrupt.size() - 1] = '\xff';
+  EXPECT_FALSE(parsePlistContent(corrupt, tree).ok());
+}
+
+TEST_F(PlistTests, test_parse_plist_cache) {
+  auto path = kTestWorkingDirectory + "cached.plist";
+  std::string content;
+  readFile(kTestDataPath + "test.plist", content);
+  writeTextFile(path, content);
+
+  pt::ptree tree;
+  ASSERT_TRUE(parsePlist(path, tree).ok());
+  EXPECT_EQ(tree.get<std::string>("Label"), "com.apple.FileSyncAgent.sshd");
+
+  // The cached tree is replaced when the file changes.
+  readFile(kTestDataPath + "test_binary.plist", content);
+  writeTextFile(path, content);
+  ASSERT_TRUE(parsePlist(path, tree).ok());
+  EXPECT_EQ(tree.count("Label"), 0U);
+  EXPECT_EQ(tree.get<std::string>("SessionItems.Controller"),
+            "CustomListItems");
+  fs::remove(path);
+}
 }
@@ -0,0 +1,400 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/system.h>
+
+#include "osquery/filesystem/file_cache.h"
+#include "osquery/filesystem/fileops.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     file_metadata_cache_max,
+     10000,
+     "Maximum number of watched file stat results cached (0 disables)");
+
+FLAG(uint64,
+     parsed_file_cache_max,
+     128,
+     "Maximum number of parsed configuration files cached (0 disables)");
+
+FLAG(uint64,
+     directory_tree_cache_max,
+     100000,
+     "Maximum directories cached below recursive file paths (0 disables)");
+
+/// Reuse a stat result for at most this many seconds, atime is not watched.
+static const size_t kFileMetadataMaxAge = 60;
+
+/// Paths are compared without a trailing separator.
+static std::string normalizeCachePath(const std::string& path) {
+  if (path.size() > 1 && path.back() == '/') {
+    return path.substr(0, path.size() - 1);
+  }
+  return path;
+}
+
+/// The directory containing a normalized path.
+static std::string getCacheParent(const std::string& path) {
+  auto separator = path.rfind('/');
+  if (separator == std::string::npos) {
+    return "";
+  }
+  return (separator == 0) ? "/" : path.substr(0, separator);
+}
+
+FileMetadataCache& FileMetadataCache::instance() {
+  static FileMetadataCache cache;
+  return cache;
+}
+
+bool FileMetadataCache::stat(const std::string& path,
+                             struct stat& file_stat) {
+#if defined(WIN32)
+  return (::stat(path.c_str(), &file_stat) == 0);
+#else
+  auto key = normalizeCachePath(path);
+  auto now = getUnixTime();
+  size_t generation = 0;
+  {
+    WriteLock lock(mutex_);
+    auto entry = entries_.find(key);
+    if (entry != entries_.end()) {
+      if (entry->second.time + kFileMetadataMaxAge >= now && isWatched(key)) {
+        order_.splice(order_.begin(), order_, entry->second.position);
+        file_stat = entry->second.file_stat;
+        return true;
+      }
+      erase(key);
+    }
+    generation = generation_;
+  }
+
+  if (::stat(path.c_str(), &file_stat) != 0) {
+    return false;
+  }
+
+  if (FLAGS_file_metadata_cache_max == 0 ||
+      (!S_ISDIR(file_stat.st_mode) && file_stat.st_nlink > 1)) {
+    return true;
+  }
+
+  WriteLock lock(mutex_);
+  if (generation != generation_ || !isWatched(key) || entries_.count(key)) {
+    // An event arrived while the path was stat-ed.
+    return true;
+  }
+
+  order_.push_front(key);
+  auto& entry = entries_[key];
+  entry.file_stat = file_stat;
+  entry.time = now;
+  entry.position = order_.begin();
+  while (entries_.size() > FLAGS_file_metadata_cache_max) {
+    // Copy the path, erasing the entry removes it from the order.
+    auto oldest = order_.back();
+    erase(oldest);
+  }
+  return true;
+#endif
+}
+
+void FileMetadataCache::watch(const std::string& path) {
+  WriteLock lock(mutex_);
+  watched_.insert(normalizeCachePath(path));
+}
+
+void FileMetadataCache::unwatch(const std::string& path) {
+  // Results are only reused while their directory is watched.
+  WriteLock lock(mutex_);
+  watched_.erase(normalizeCachePath(path));
+}
+
+void FileMetadataCache::invalidate(const std::string& path) {
+  // Creating, removing, or moving an entry also changes the directory.
+  auto key = normalizeCachePath(path);
+  WriteLock lock(mutex_);
+  generation_++;
+  erase(key);
+  erase(getCacheParent(key));
+}
+
+void FileMetadataCache::clear() {
+  WriteLock lock(mutex_);
+  generation_++;
+  entries_.clear();
+  order_.clear();
+  watched_.clear();
+}
+
+size_t FileMetadataCache::size() const {
+  ReadLock lock(mutex_);
+  return entries_.size();
+}
+
+bool FileMetadataCache::isWatched(const std::string& path) const {
+  return (watched_.count(path) > 0 || watched_.count(getCacheParent(path)) > 0);
+}
+
+void FileMetadataCache::erase(const std::string& path) {
+  auto entry = entries_.find(path);
+  if (entry != entries_.end()) {
+    order_.erase(entry->second.position);
+    entries_.erase(entry);
+  }
+}
+
+/// Files modified more recently than this many seconds are not cached.
+static const size_t kParsedFileMinAge = 2;
+
+/// The inode, size, and modification time of each path, "-" if missing.
+static std::string getParsedFilesIdentity(
+    const std::vector<std::string>& paths, size_t now, bool& recent) {
+  std::string identity;
+  recent = false;
+  for (const auto& path : paths) {
+    struct stat file_stat;
+    if (::stat(path.c_str(), &file_stat) != 0) {
+      identity += "-;";
+      continue;
+    }
+
+    long nsec = 0;
+#if defined(__APPLE__)
+    nsec = file_stat.st_mtimespec.tv_nsec;
+#elif !defined(WIN32)
+    nsec = file_stat.st_mtim.tv_nsec;
+#endif
+    identity += std::to_string(file_stat.st_ino) + ":" +
+                std::to_string(file_stat.st_size) + ":" +
+                std::to_string(file_stat.st_mtime) + "." +
+                std::to_string(nsec) + ";";
+    if (static_cast<size_t>(file_stat.st_mtime) + kParsedFileMinAge > now) {
+      recent = true;
+    }
+  }
+  return identity;
+}
+
+ParsedFileCache& ParsedFileCache::instance() {
+  static ParsedFileCache cache;
+  return cache;
+}
+
+Status ParsedFileCache::read(const std::string& path,
+                             Parser parser,
+                             QueryData& results) {
+  return get({path},
+             reinterpret_cast<const void*>(parser),
+             true,
+             [parser](std::vector<std::string>& contents) {
+               return parser(contents[0]);
+             },
+             results);
+}
+
+void ParsedFileCache::read(const std::vector<std::string>& paths,
+                           MultiParser parser,
+                           QueryData& results) {
+  get(paths,
+      reinterpret_cast<const void*>(parser),
+      false,
+      [parser](std::vector<std::string>& contents) {
+        return parser(contents);
+      },
+      results);
+}
+
+Status ParsedFileCache::get(
+    const std::vector<std::string>& paths,
+    const void* parser,
+    bool required,
+    const std::function<QueryData(std::vector<std::string>&)>& parse,
+    QueryData& results) {
+  bool recent = false;
+  auto identity = getParsedFilesIdentity(paths, getUnixTime(), recent);
+
+  // Different parsers of the same files are cached separately.
+  auto key = std::to_string(reinterpret_cast<uintptr_t>(parser));
+  for (const auto& path : paths) {
+    key += ";" + path;
+  }
+
+  if (FLAGS_parsed_file_cache_max > 0) {
+    WriteLock lock(mutex_);
+    auto entry = entries_.find(key);
+    if (entry != entries_.end() && entry->second.identity == identity) {
+      order_.splice(order_.begin(), order_, entry->second.position);
+      results = entry->second.results;
+      return Status(0, "OK");
+    }
+  }
+
+  std::vector<std::string> contents(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) {
+    auto status = readFile(paths[i], contents[i]);
+    if (!status.ok() && required) {
+      return status;
+    }
+  }
+  results = parse(contents);
+
+  if (FLAGS_parsed_file_cache_max == 0 || recent) {
+    return Status(0, "OK");
+  }
+
+  WriteLock lock(mutex_);
+  auto entry = entries_.find(key);
+  if (entry == entries_.end()) {
+    order_.push_front(key);
+    entry = entries_.emplace(key, Entry()).first;
+    entry->second.position = order_.begin();
+  } else {
+    order_.splice(order_.begin(), order_, entry->second.position);
+  }
+  entry->second.identity = std::move(identity);
+  entry->second.results = results;
+  while (entries_.size() > FLAGS_parsed_file_cache_max) {
+    entries_.erase(order_.back());
+    order_.pop_back();
+  }
+  return Status(0, "OK");
+}
+
+void ParsedFileCache::clear() {
+  WriteLock lock(mutex_);
+  entries_.clear();
+  order_.clear();
+}
+
+size_t ParsedFileCache::size() const {
+  ReadLock lock(mutex_);
+  return entries_.size();
+}
+
+/// The recursive wildcard lists at most this many levels of directories.
+static const size_t kDirectoryTreeMaxDepth = 63;
+
+DirectoryTreeCache& DirectoryTreeCache::instance() {
+  static DirectoryTreeCache cache;
+  return cache;
+}
+
+size_t DirectoryTreeCache::listDirectories(const std::string& path,
+                                           std::vector<std::string>& results) {
+#if defined(WIN32)
+  std::vector<std::string> directories;
+  listDirectoriesInDirectory(path, directories, true);
+  results.insert(results.end(), directories.begin(), directories.end());
+  return directories.size();
+#else
+  auto directory = (!path.empty() && path.back() == '/') ? path : path + '/';
+  size_t listed = 0;
+  WriteLock lock(mutex_);
+  walk(directory, 0, getUnixTime(), listed, results);
+  return listed;
+#endif
+}
+
+void DirectoryTreeCache::walk(const std::string& directory,
+                              size_t depth,
+                              size_t now,
+                              size_t& listed,
+                              std::vector<std::string>& results) {
+#if !defined(WIN32)
+  if (depth >= kDirectoryTreeMaxDepth) {
+    return;
+  }
+
+  struct stat directory_stat;
+  if (::stat(directory.c_str(), &directory_stat) != 0 ||
+      !S_ISDIR(directory_stat.st_mode)) {
+    erase(directory);
+    return;
+  }
+
+  std::vector<std::string> children;
+  auto entry = entries_.find(directory);
+  if (entry != entries_.end() &&
+      entry->second.device == directory_stat.st_dev &&
+      entry->second.inode == directory_stat.st_ino &&
+      entry->second.mtime == directory_stat.st_mtime) {
+    children = entry->second.children;
+  } else {
+    listed++;
+    std::vector<PlatformDirectoryEntry> entries;
+    if (!platformListDirectory(directory, entries)) {
+      erase(directory);
+      return;
+    }
+
+    for (const auto& child : entries) {
+      if (child.directory && child.name[0] != '.') {
+        children.push_back(child.name);
+      }
+    }
+    std::sort(children.begin(), children.end());
+
+    // Subdirectories removed since the directory was listed are forgotten.
+    if (entry != entries_.end()) {
+      for (const auto& previous : entry->second.children) {
+        if (!std::binary_search(children.begin(), children.end(), previous)) {
+          erase(directory + previous + '/');
+        }
+      }
+    }
+
+    bool recent =
+        static_cast<size_t>(directory_stat.st_mtime) + kParsedFileMinAge > now;
+    if (FLAGS_directory_tree_cache_max == 0 || recent) {
+      entries_.erase(directory);
+    } else {
+      if (entries_.count(directory) == 0 &&
+          entries_.size() >= FLAGS_directory_tree_cache_max) {
+        // Directories of removed paths are only forgotten when full.
+        entries_.clear();
+      }
+
+      auto& cached = entries_[directory];
+      cached.device = directory_stat.st_dev;
+      cached.inode = directory_stat.st_ino;
+      cached.mtime = directory_stat.st_mtime;
+      cached.children = children;
+    }
+  }
+
+  for (const auto& child : children) {
+    auto path = directory + child + '/';
+    results.push_back(path);
+    walk(path, depth + 1, now, listed, results);
+  }
+#endif
+}
+
+void DirectoryTreeCache::erase(const std::string& directory) {
+  // Every path below sorts before the directory with its separator as '0'.
+  auto end = directory.substr(0, directory.size() - 1) + '0';
+  entries_.erase(entries_.lower_bound(directory), entries_.lower_bound(end));
+}
+
+void DirectoryTreeCache::clear() {
+  WriteLock lock(mutex_);
+  entries_.clear();
+}
+
+size_t DirectoryTreeCache::size() const {
+  ReadLock lock(mutex_);
+  return entries_.size();
+}
+}
@@ -0,0 +1,253 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <sys/stat.h>
+
+#include <functional>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/database.h>
+
+namespace osquery {
+
+/**
+ * @brief Stat results of paths watched by a file event publisher.
+ *
+ * The file and hash tables stat the same paths on every scheduled run. A
+ * file event publisher that watches a directory for content and attribute
+ * changes registers the directory, and invalidates each path it receives an
+ * event for. The stat of a path within a watched directory is reused until
+ * an event for the path arrives, or the result is older than a minute.
+ *
+ * Paths outside of watched directories, and files with several hard links
+ * that may change through an unwatched path, are always stat-ed.
+ */
+class FileMetadataCache : private boost::noncopyable {
+ public:
+  /// The process-wide cache.
+  static FileMetadataCache& instance();
+
+  /**
+   * @brief stat a path, reusing the result while the path is unchanged.
+   *
+   * @param path the path to stat, symlinks are followed.
+   * @param file_stat output stat result.
+   * @return true if the path exists and could be stat-ed.
+   */
+  bool stat(const std::string& path, struct stat& file_stat);
+
+  /// Reuse the stat results of a watched directory's entries, or a file.
+  void watch(const std::string& path);
+
+  /// The directory or file is no longer watched.
+  void unwatch(const std::string& path);
+
+  /// An event for a path, the path and its directory may have changed.
+  void invalidate(const std::string& path);
+
+  /// Forget every result and watch, such as when events were dropped.
+  void clear();
+
+  /// The number of cached stat results.
+  size_t size() const;
+
+ private:
+  FileMetadataCache() {}
+
+  /// Check if a path, or its directory, is watched.
+  bool isWatched(const std::string& path) const;
+
+  /// Remove a cached result.
+  void erase(const std::string& path);
+
+ private:
+  struct Entry {
+    /// The cached stat result.
+    struct stat file_stat;
+
+    /// The time the path was stat-ed.
+    size_t time{0};
+
+    /// The position of the path in the use order.
+    std::list<std::string>::iterator position;
+  };
+
+  /// Cached results by path, without a trailing separator.
+  std::unordered_map<std::string, Entry> entries_;
+
+  /// Paths ordered by use, most recent first.
+  std::list<std::string> order_;
+
+  /// Watched directories and files, without a trailing separator.
+  std::set<std::string> watched_;
+
+  /// Incremented by each invalidation, a stat racing one is not cached.
+  size_t generation_{0};
+
+  mutable Mutex mutex_;
+};
+
+/**
+ * @brief Rows parsed from small configuration files.
+ *
+ * Tables such as etc_hosts, etc_services and etc_protocols read and tokenize
+ * a file for every query, and query packs join them in many queries each
+ * interval. The parsed rows are reused while each file's inode, size and
+ * modification time are unchanged, so a repeated query costs a stat.
+ *
+ * A file modified within the last two seconds is parsed again by the next
+ * query, since a later write within the same modification time may not
+ * change its size. Pseudo-filesystems such as procfs do not update
+ * modification times, and should not be read through this cache.
+ */
+class ParsedFileCache : private boost::noncopyable {
+ public:
+  /// Parse the content of a file.
+  using Parser = QueryData (*)(const std::string& content);
+
+  /// Parse the contents of several files, in the order of their paths.
+  using MultiParser = QueryData (*)(const std::vector<std::string>& contents);
+
+  /// The process-wide cache.
+  static ParsedFileCache& instance();
+
+  /**
+   * @brief Read and parse a file, reusing the rows while it is unchanged.
+   *
+   * @param path the file to read.
+   * @param parser the parser, rows are cached for each parser and path.
+   * @param results output parsed rows.
+   * @return failure if the file could not be read.
+   */
+  Status read(const std::string& path, Parser parser, QueryData& results);
+
+  /**
+   * @brief Read and parse several files, the content of a missing file is
+   * empty.
+   */
+  void read(const std::vector<std::string>& paths,
+            MultiParser parser,
+            QueryData& results);
+
+  /// Forget every parsed file.
+  void clear();
+
+  /// The number of cached parsed files.
+  size_t size() const;
+
+ private:
+  ParsedFileCache() {}
+
+  /// Reuse or parse the rows of the files, returns the first read failure.
+  Status get(const std::vector<std::string>& paths,
+             const void* parser,
+             bool required,
+             const std::function<QueryData(std::vector<std::string>&)>& parse,
+             QueryData& results);
+
+ private:
+  struct Entry {
+    /// The identity of the files when they were read.
+    std::string identity;
+
+    /// The parsed rows.
+    QueryData results;
+
+    /// The position of the key in the use order.
+    std::list<std::string>::iterator position;
+  };
+
+  /// Cached rows by parser and paths.
+  std::unordered_map<std::string, Entry> entries_;
+
+  /// Keys ordered by use, most recent first.
+  std::list<std::string> order_;
+
+  mutable Mutex mutex_;
+};
+
+/**
+ * @brief The directories below the recursive paths of file event publishers.
+ *
+ * A recursive file_paths pattern, such as `/home/%%`, is expanded into a
+ * watch for every directory below it each time the configuration changes or
+ * the publisher restarts. The subdirectories of each directory are cached
+ * with the directory's inode and modification time, which change when an
+ * entry is added, removed or renamed. A later expansion stats each cached
+ * directory, and lists again only the directories that changed.
+ *
+ * A directory modified within two seconds of being listed is listed again,
+ * since a later change within the same modification time is not visible.
+ */
+class DirectoryTreeCache : private boost::noncopyable {
+ public:
+  /// The process-wide cache.
+  static DirectoryTreeCache& instance();
+
+  /**
+   * @brief List every directory below a directory.
+   *
+   * The results match a recursive listDirectoriesInDirectory: hidden
+   * entries are skipped, symlinks to directories are followed, and each
+   * path ends with a separator.
+   *
+   * @param path the directory.
+   * @param results output directories below the path.
+   * @return the number of directories that were listed rather than reused.
+   */
+  size_t listDirectories(const std::string& path,
+                         std::vector<std::string>& results);
+
+  /// Forget every listed directory.
+  void clear();
+
+  /// The number of cached directories.
+  size_t size() const;
+
+ private:
+  DirectoryTreeCache() {}
+
+  /// Append the directories below a directory, ending with a separator.
+  void walk(const std::string& directory,
+            size_t depth,
+            size_t now,
+            size_t& listed,
+            std::vector<std::string>& results);
+
+  /// Forget a directory and every directory below it.
+  void erase(const std::string& directory);
+
+ private:
+  struct Entry {
+    /// The identity of the directory when it was listed.
+    dev_t device{0};
+    ino_t inode{0};
+    time_t mtime{0};
+
+    /// The names of the subdirectories.
+    std::vector<std::string> children;
+  };
+
+  /// Listed directories by path, ending with a separator.
+  std::map<std::string, Entry> entries_;
+
+  mutable Mutex mutex_;
+};
+}
@@ -22,6 +22,7 @@
 #include <unistd.h>
 #endif
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -131,6 +132,28 @@ struct AsyncEvent {
   bool is_active_{false};
 };
 
+/**
+ * @brief Read a regular file in blocks using several overlapped requests.
+ *
+ * The file is opened for sequential overlapped reads and more than one block
+ * is requested at a time, the predicate receives each block in order. An
+ * unbuffered read bypasses the system file cache, such that bulk hashing
+ * does not evict other content.
+ *
+ * @param path The regular file path.
+ * @param file_size The number of bytes to read.
+ * @param block_size The requested block size, aligned if unbuffered.
+ * @param unbuffered Open the file with FILE_FLAG_NO_BUFFERING.
+ * @param predicate Called with each block in order.
+ * @return Failure unless every byte of the file was delivered.
+ */
+Status readFileOverlapped(
+    const std::string& path,
+    size_t file_size,
+    size_t block_size,
+    bool unbuffered,
+    std::function<void(const char* buffer, size_t size)> predicate);
+
 #endif
 
 /**
@@ -210,6 +233,9 @@ class PlatformFile {
 
   size_t size() const;
 
+  /// Commit written content to the storage device.
+  bool sync();
+
  private:
   fs::path fname_;
 
@@ -273,6 +299,31 @@ bool platformChmod(const std::string& path, mode_t perms);
  */
 std::vector<std::string> platformGlob(const std::string& find_path);
 
+#ifndef WIN32
+/// An entry of a directory listed by platformListDirectory.
+struct PlatformDirectoryEntry {
+  /// The entry name, without the directory.
+  std::string name;
+
+  /// The entry is a directory or a symlink to a directory.
+  bool directory{false};
+};
+
+/**
+ * @brief List the entries of a directory, except '.' and '..'.
+ *
+ * The entry types are read from the directory listing when possible and
+ * symlinks are resolved relative to the open directory, so listing does not
+ * stat each entry by its full path. Linux reads the listing with getdents64.
+ *
+ * @param path The directory.
+ * @param entries The output entries, in listing order.
+ * @return false if the directory could not be opened.
+ */
+bool platformListDirectory(const std::string& path,
+                           std::vector<PlatformDirectoryEntry>& entries);
+#endif
+
 /**
  * @brief Checks to see if the current user has the permissions to perform a
  *        specified operation on a file.
@@ -16,6 +16,7 @@
 #ifndef WIN32
 #include <glob.h>
 #include <pwd.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #endif
 
@@ -28,6 +29,7 @@
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 #include <osquery/system.h>
+#include <osquery/tables.h>
 
 #include "osquery/core/json.h"
 #include "osquery/filesystem/fileops.h"
@@ -47,6 +49,23 @@ HIDDEN_FLAG(bool, allow_unsafe, false, "Allow unsafe executable permissions");
 /// Disable forensics (atime/mtime preserving) file reads.
 HIDDEN_FLAG(bool, disable_forensic, true, "Disable atime/mtime preservation");
 
+/// Map regular files into memory for large sequential reads.
+HIDDEN_FLAG(bool, read_mmap, false, "Memory-map regular files for block reads");
+
+/// Bypass the Windows file cache when reading large files in blocks.
+HIDDEN_FLAG(bool,
+            read_unbuffered,
+            false,
+            "Use unbuffered reads for large block reads on Windows");
+
+/// Files smaller than this are read through the file cache.
+const size_t kUnbufferedReadMin = 4 * 1024 * 1024;
+
+FLAG(uint64,
+     glob_concurrency,
+     4,
+     "Threads walking the subtrees of a recursive file pattern");
+
 static const size_t kMaxRecursiveGlobs = 64;
 
 Status writeTextFile(const fs::path& path,
@@ -91,6 +110,13 @@ struct OpenReadableFile : private boost::noncopyable {
   std::unique_ptr<PlatformFile> fd{nullptr};
 };
 
+/// Apply the max byte-read based on file/link target ownership.
+static off_t getReadMax(const PlatformFile& fd) {
+  return static_cast<off_t>(
+      (fd.isOwnerRoot().ok()) ? FLAGS_read_max
+                              : std::min(FLAGS_read_max, FLAGS_read_user_max));
+}
+
 Status readFile(const fs::path& path,
                 size_t size,
                 size_t block_size,
@@ -108,11 +134,7 @@ Status readFile(const fs::path& path,
     file_size = static_cast<off_t>(size);
   }
 
-  // Apply the max byte-read based on file/link target ownership.
-  off_t read_max =
-      static_cast<off_t>((handle.fd->isOwnerRoot().ok())
-                             ? FLAGS_read_max
-                             : std::min(FLAGS_read_max, FLAGS_read_user_max));
+  off_t read_max = getReadMax(*handle.fd);
   if (file_size > read_max) {
     VLOG(1) << "Cannot read " << path << " size exceeds limit: " << file_size
             << " > " << read_max;
@@ -168,6 +190,116 @@ Status readFile(const fs::path& path,
   return Status(0, "OK");
 }
 
+Status readFileBlocks(
+    const fs::path& path,
+    size_t block_size,
+    bool preserve_time,
+    std::function<void(const char* buffer, size_t size)> predicate,
+    bool blocking) {
+  OpenReadableFile handle(path, blocking);
+  if (handle.fd == nullptr || !handle.fd->isValid()) {
+    return Status(1, "Cannot open file for reading: " + path.string());
+  }
+
+  auto file_size = handle.fd->size();
+  if (handle.fd->isSpecialFile() || file_size == 0) {
+    // Special files report an unreliable size, use the bounded buffered read.
+    handle.fd.reset();
+    return readFile(path,
+                    0,
+                    block_size,
+                    false,
+                    preserve_time,
+                    ([&predicate](std::string& buffer, size_t size) {
+                      predicate(buffer.data(), size);
+                    }),
+                    blocking);
+  }
+
+  off_t read_max = getReadMax(*handle.fd);
+  if (static_cast<off_t>(file_size) > read_max) {
+    VLOG(1) << "Cannot read " << path << " size exceeds limit: " << file_size
+            << " > " << read_max;
+    return Status(1, "File exceeds read limits");
+  }
+
+  PlatformTime times;
+  handle.fd->getFileTimes(times);
+
+  block_size = (block_size < 4096) ? 4096 : block_size;
+  bool mapped = false;
+  bool failed = false;
+#ifndef WIN32
+  if (FLAGS_read_mmap) {
+    // Hand the caller slices of a private read-only mapping, without copies.
+    auto data = ::mmap(nullptr,
+                       file_size,
+                       PROT_READ,
+                       MAP_PRIVATE,
+                       handle.fd->nativeHandle(),
+                       0);
+    if (data != MAP_FAILED) {
+      ::madvise(data, file_size, MADV_SEQUENTIAL);
+      auto begin = static_cast<const char*>(data);
+      for (size_t offset = 0; offset < file_size; offset += block_size) {
+        predicate(begin + offset, std::min(block_size, file_size - offset));
+      }
+      ::munmap(data, file_size);
+      mapped = true;
+    }
+  }
+
+#ifdef __linux__
+  if (!mapped) {
+    ::posix_fadvise(
+        handle.fd->nativeHandle(), 0, file_size, POSIX_FADV_SEQUENTIAL);
+  }
+#endif
+#else
+  // Keep several block reads outstanding instead of one synchronous read.
+  auto unbuffered = FLAGS_read_unbuffered && file_size >= kUnbufferedReadMin;
+  size_t delivered = 0;
+  mapped = readFileOverlapped(path.string(),
+                              file_size,
+                              block_size,
+                              unbuffered,
+                              [&predicate, &delivered](const char* buffer,
+                                                       size_t size) {
+                                delivered += size;
+                                predicate(buffer, size);
+                              })
+               .ok();
+  // The blocks already delivered cannot be read again.
+  failed = (!mapped && delivered > 0);
+#endif
+
+  if (!mapped && !failed) {
+    // Reuse a single buffer for every block, the file size bounds the read.
+    std::vector<char> buffer(std::min(block_size, file_size));
+    size_t total_bytes = 0;
+    ssize_t part_bytes = 0;
+    do {
+      part_bytes = handle.fd->read(
+          buffer.data(), std::min(buffer.size(), file_size - total_bytes));
+      if (part_bytes > 0) {
+        total_bytes += static_cast<size_t>(part_bytes);
+        predicate(buffer.data(), static_cast<size_t>(part_bytes));
+      }
+    } while ((part_bytes > 0 || handle.fd->hasPendingIo()) &&
+             total_bytes < file_size);
+  }
+
+  // Attempt to restore the atime and mtime before the file read.
+  if (preserve_time && !FLAGS_disable_forensic) {
+    handle.fd->setFileTimes(times);
+  }
+
+  if (failed) {
+    return Status(1, "Cannot read file: " + path.string());
+  }
+  return Status(0, "OK");
+}
+
 Status readFile(const fs::path& path,
                 std::string& content,
                 size_t size,
@@ -244,40 +376,125 @@ Status remove(const fs::path& path) {
   return Status(status_code, "N/A");
 }
 
+/// Check if a glob result is a directory, glob marks them with a separator.
+static inline bool isGlobDirectory(const std::string& found) {
+  return !found.empty() && (found.back() == '/' || found.back() == '\\');
+}
+
+#ifndef WIN32
+/// The entries found at each depth below a directory.
+using GlobLevels = std::vector<std::vector<std::string>>;
+
+/**
+ * @brief List every entry below a directory matched by a recursive wildcard.
+ *
+ * This yields the results of globbing the pattern with an additional "/**"
+ * for each level: entries beginning with '.' are skipped, directories and
+ * symlinks to directories end with a separator and are listed before their
+ * descendants are walked. Level i holds the entries i + 1 levels below.
+ */
+static void walkGlobDirectory(const std::string& directory,
+                              size_t depth,
+                              const GlobPrefixFilter& filter,
+                              GlobLevels& levels) {
+  if (depth >= levels.size() || QueryBudget::interrupted()) {
+    return;
+  }
+
+  std::vector<PlatformDirectoryEntry> entries;
+  if (!platformListDirectory(directory, entries)) {
+    return;
+  }
+
+  for (const auto& entry : entries) {
+    if (entry.name[0] == '.') {
+      continue;
+    }
+
+    auto path = directory + entry.name;
+    if (!entry.directory) {
+      levels[depth].push_back(std::move(path));
+      continue;
+    }
+
+    path += '/';
+    levels[depth].push_back(path);
+    if (filter == nullptr || filter(path)) {
+      walkGlobDirectory(path, depth + 1, filter, levels);
+    }
+  }
+}
+#endif
+
 static void genGlobs(std::string path,
                      std::vector<std::string>& results,
-                     GlobLimits limits) {
+                     GlobLimits limits,
+                     const GlobPrefixFilter& filter = nullptr) {
   // Use our helped escape/replace for wildcards.
   replaceGlobWildcards(path, limits);
 
   // Generate a glob set and recurse for double star.
-  size_t glob_index = 0;
-  while (++glob_index < kMaxRecursiveGlobs) {
-    auto glob_results = platformGlob(path);
+  // The end state is a non-recursive ending or empty set of matches.
+  // Allow a trailing slash after the double wild indicator.
+  auto glob_results = platformGlob(path);
+  size_t wild = path.rfind("**");
+  bool recursive = !(wild > path.size() || wild < path.size() - 3);
+  results.insert(results.end(), glob_results.begin(), glob_results.end());
 
-    for (auto const& result_path : glob_results) {
-      results.push_back(result_path);
+#ifndef WIN32
+  if (recursive) {
+    // Each further level of the double star lists the entries below the
+    // directories matched by the first level. Walk each directory's subtree
+    // once, rather than globbing the whole prefix again for every level.
+    std::vector<std::string> directories;
+    for (const auto& found : glob_results) {
+      if (isGlobDirectory(found) && (filter == nullptr || filter(found))) {
+        directories.push_back(found);
+      }
     }
 
-    // The end state is a non-recursive ending or empty set of matches.
-    size_t wild = path.rfind("**");
-    // Allow a trailing slash after the double wild indicator.
-    if (glob_results.size() == 0 || wild > path.size() ||
-        wild < path.size() - 3) {
-      break;
+    std::vector<GlobLevels> subtrees(
+        directories.size(), GlobLevels(kMaxRecursiveGlobs - 2));
+    parallelFor(directories.size(), FLAGS_glob_concurrency, [&](size_t i) {
+      auto directory = directories[i];
+      if (directory.back() == '\\') {
+        directory.back() = '/';
+      }
+      walkGlobDirectory(directory, 0, filter, subtrees[i]);
+    });
+
+    // Results are ordered by level, then by path, like the repeated globs.
+    for (size_t depth = 0; depth < kMaxRecursiveGlobs - 2; depth++) {
+      std::vector<std::string> level;
+      for (auto& subtree : subtrees) {
+        level.insert(level.end(),
+                     std::make_move_iterator(subtree[depth].begin()),
+                     std::make_move_iterator(subtree[depth].end()));
+      }
+      if (level.empty()) {
+        break;
+      }
+      std::sort(level.begin(), level.end());
+      results.insert(results.end(),
+                     std::make_move_iterator(level.begin()),
+                     std::make_move_iterator(level.end()));
     }
+  }
+#else
+  size_t glob_index = 1;
+  while (recursive && !glob_results.empty() &&
+         ++glob_index < kMaxRecursiveGlobs) {
     path += "/**";
+    glob_results = platformGlob(path);
+    results.insert(results.end(), glob_results.begin(), glob_results.end());
   }
+#endif
 
   // Prune results based on settings/requested glob limitations.
   auto end = std::remove_if(
       results.begin(), results.end(), [limits](const std::string& found) {
-        return !(((found[found.length() - 1] == '/' ||
-                   found[found.length() - 1] == '\\') &&
-                  limits & GLOB_FOLDERS) ||
-                 ((found[found.length() - 1] != '/' &&
-                   found[found.length() - 1] != '\\') &&
-                  limits & GLOB_FILES));
+        return !((isGlobDirectory(found) && limits & GLOB_FOLDERS) ||
+                 (!isGlobDirectory(found) && limits & GLOB_FILES));
       });
   results.erase(end, results.end());
 }
@@ -294,6 +511,14 @@ Status resolveFilePattern(const fs::path& fs_path,
   return Status(0, "OK");
 }
 
+Status resolveFilePattern(const fs::path& fs_path,
+                          std::vector<std::string>& results,
+                          GlobLimits setting,
+                          const GlobPrefixFilter& filter) {
+  genGlobs(fs_path.string(), results, setting, filter);
+  return Status(0, "OK");
+}
+
 inline void replaceGlobWildcards(std::string& pattern, GlobLimits limits) {
   // Replace SQL-wildcard '%' with globbing wildcard '*'.
   if (pattern.find("%") != std::string::npos) {
@@ -377,6 +602,19 @@ Status isDirectory(const fs::path& path) {
   return Status(ec.value(), ec.message());
 }
 
+std::string getPathsIdentity(const std::vector<std::string>& paths) {
+  std::string identity;
+  for (const auto& path : paths) {
+    struct stat file_stat;
+    if (::stat(path.c_str(), &file_stat) == 0) {
+      identity += path + ":" + std::to_string(file_stat.st_ino) + ":" +
+                  std::to_string(file_stat.st_size) + ":" +
+                  std::to_string(file_stat.st_mtime) + ";";
+    }
+  }
+  return identity;
+}
+
 std::set<fs::path> getHomeDirectories() {
   std::set<fs::path> results;
 
@@ -491,11 +729,7 @@ Status parseJSON(const fs::path& path, pt::ptree& tree) {
 
 Status parseJSONContent(const std::string& content, pt::ptree& tree) {
   // Read the extensions data into a JSON blob, then property tree.
-  try {
-    std::stringstream json_stream;
-    json_stream << content;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& /* e */) {
+  if (!parseJSONTree(content, tree).ok()) {
     return Status(1, "Could not parse JSON from file");
   }
   return Status(0, "OK");
@@ -16,6 +16,8 @@
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
+#include "osquery/filesystem/linux/proc.h"
+
 namespace osquery {
 
 const std::string kLinuxProcPath = "/proc";
@@ -77,4 +79,65 @@ Status procReadDescriptor(const std::string& process,
     return Status(1, "Could not read path");
   }
 }
+
+std::shared_ptr<ProcSnapshot> ProcSnapshot::get(const QueryContext& context) {
+  return context.getShared<ProcSnapshot>("proc");
+}
+
+Status ProcSnapshot::processes(std::set<std::string>& processes) {
+  WriteLock lock(mutex_);
+  if (!listed_) {
+    list_status_ = procProcesses(processes_);
+    listed_ = true;
+  }
+  processes = processes_;
+  return list_status_;
+}
+
+Status ProcSnapshot::descriptors(
+    const std::string& process,
+    std::map<std::string, std::string>& descriptors) {
+  {
+    ReadLock lock(mutex_);
+    auto it = descriptors_.find(process);
+    if (it != descriptors_.end()) {
+      descriptors = it->second.second;
+      return it->second.first;
+    }
+  }
+
+  // Walk the descriptors without the lock, a concurrent walk of the same
+  // process is possible but the first result is kept.
+  std::map<std::string, std::string> walked;
+  auto status = procDescriptors(process, walked);
+
+  WriteLock lock(mutex_);
+  auto it =
+      descriptors_.emplace(process, std::make_pair(status, std::move(walked)))
+          .first;
+  descriptors = it->second.second;
+  return it->second.first;
+}
+
+Status ProcSnapshot::read(const std::string& process,
+                          const std::string& name,
+                          std::string& content) {
+  auto path = kLinuxProcPath + "/" + process + "/" + name;
+  {
+    ReadLock lock(mutex_);
+    auto it = files_.find(path);
+    if (it != files_.end()) {
+      content = it->second.second;
+      return it->second.first;
+    }
+  }
+
+  std::string data;
+  auto status = readFile(path, data);
+
+  WriteLock lock(mutex_);
+  auto it = files_.emplace(path, std::make_pair(status, std::move(data))).first;
+  content = it->second.second;
+  return it->second.first;
+}
 }
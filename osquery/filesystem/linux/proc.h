@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+
+/**
+ * @brief A lazily read view of /proc shared by the tables of a query.
+ *
+ * The process tables each list the pids in /proc and walk the descriptors
+ * or read the files of each process. A query joining several of them would
+ * walk /proc once per table. A snapshot reads the pid list, and each pid's
+ * descriptors and files, the first time they are requested and returns the
+ * same content for the rest of the query.
+ *
+ * Tables share a snapshot through the QueryContext. A context created
+ * outside of an SQLite query receives a new snapshot.
+ */
+class ProcSnapshot : private boost::noncopyable {
+ public:
+  /// The snapshot shared by the tables scanned by a context's query.
+  static std::shared_ptr<ProcSnapshot> get(const QueryContext& context);
+
+  /**
+   * @brief The set of pids in /proc, see procProcesses.
+   *
+   * @param processes output list of process pids as strings.
+   * @return status of the /proc iteration.
+   */
+  Status processes(std::set<std::string>& processes);
+
+  /**
+   * @brief The descriptors of a process, see procDescriptors.
+   *
+   * @param process a string pid from proc.
+   * @param descriptors output map of descriptor numbers to link paths.
+   * @return status of iteration, failure if the process path did not exist.
+   */
+  Status descriptors(const std::string& process,
+                     std::map<std::string, std::string>& descriptors);
+
+  /**
+   * @brief The content of a file in a process's /proc directory.
+   *
+   * @param process a string pid from proc.
+   * @param name the file name, such as "stat", "status", or "environ".
+   * @param content output content of the file.
+   * @return status of the read, failure if the file could not be read.
+   */
+  Status read(const std::string& process,
+              const std::string& name,
+              std::string& content);
+
+ private:
+  /// If the pid list was read.
+  bool listed_{false};
+
+  /// The status of reading the pid list.
+  Status list_status_;
+
+  /// The pids in /proc.
+  std::set<std::string> processes_;
+
+  /// The status and descriptors of each requested process.
+  std::map<std::string, std::pair<Status, std::map<std::string, std::string>>>
+      descriptors_;
+
+  /// The status and content of each requested process file, by path.
+  std::map<std::string, std::pair<Status, std::string>> files_;
+
+  /// Tables using concurrency may read from several threads.
+  Mutex mutex_;
+};
+}
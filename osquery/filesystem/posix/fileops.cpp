@@ -8,16 +8,23 @@
  *
  */
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <glob.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
 #include <boost/optional.hpp>
 
 #include <osquery/filesystem.h>
@@ -262,6 +269,13 @@ size_t PlatformFile::size() const {
   return file.st_size;
 }
 
+bool PlatformFile::sync() {
+  if (!isValid()) {
+    return false;
+  }
+  return (::fsync(handle_) == 0);
+}
+
 boost::optional<std::string> getHomeDirectory() {
   // Try to get the caller's home directory using HOME and getpwuid.
   auto user = ::getpwuid(getuid());
@@ -300,6 +314,94 @@ std::vector<std::string> platformGlob(const std::string& find_path) {
   return results;
 }
 
+/// Set an entry's type from its listing type, resolving symlinks and unknowns.
+static void setDirectoryEntryType(int dirfd,
+                                  unsigned char type,
+                                  PlatformDirectoryEntry& entry) {
+  if (type == DT_DIR) {
+    entry.directory = true;
+  } else if (type == DT_LNK || type == DT_UNKNOWN) {
+    // Follow symlinks, as glob does when marking directories.
+    struct stat st;
+    entry.directory = (::fstatat(dirfd, entry.name.c_str(), &st, 0) == 0 &&
+                       S_ISDIR(st.st_mode));
+  }
+}
+
+#ifdef __linux__
+/// The layout of each record returned by getdents64.
+struct LinuxDirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+bool platformListDirectory(const std::string& path,
+                           std::vector<PlatformDirectoryEntry>& entries) {
+  auto fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  alignas(LinuxDirent64) char buffer[32768];
+  while (true) {
+    auto bytes = ::syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+    if (bytes <= 0) {
+      break;
+    }
+
+    for (long offset = 0; offset < bytes;) {
+      auto dirent = reinterpret_cast<LinuxDirent64*>(buffer + offset);
+      offset += dirent->d_reclen;
+      if (strcmp(dirent->d_name, ".") == 0 ||
+          strcmp(dirent->d_name, "..") == 0) {
+        continue;
+      }
+
+      PlatformDirectoryEntry entry;
+      entry.name = dirent->d_name;
+      setDirectoryEntryType(fd, dirent->d_type, entry);
+      entries.push_back(std::move(entry));
+    }
+  }
+
+  ::close(fd);
+  return true;
+}
+#else
+bool platformListDirectory(const std::string& path,
+                           std::vector<PlatformDirectoryEntry>& entries) {
+  auto fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  // The directory stream owns the descriptor.
+  auto dir = ::fdopendir(fd);
+  if (dir == nullptr) {
+    ::close(fd);
+    return false;
+  }
+
+  struct dirent* dirent = nullptr;
+  while ((dirent = ::readdir(dir)) != nullptr) {
+    if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+      continue;
+    }
+
+    PlatformDirectoryEntry entry;
+    entry.name = dirent->d_name;
+    setDirectoryEntryType(fd, dirent->d_type, entry);
+    entries.push_back(std::move(entry));
+  }
+
+  ::closedir(dir);
+  return true;
+}
+#endif
+
 int platformAccess(const std::string& path, mode_t mode) {
   return ::access(path.c_str(), mode);
 }
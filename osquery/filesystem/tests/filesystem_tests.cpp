@@ -23,6 +23,10 @@
 #include <osquery/system.h>
 
 #include "osquery/core/process.h"
+#include "osquery/filesystem/file_cache.h"
+#ifdef __linux__
+#include "osquery/filesystem/linux/proc.h"
+#endif
 #include "osquery/tests/test_util.h"
 
 namespace fs = boost::filesystem;
@@ -32,6 +36,7 @@ namespace osquery {
 
 DECLARE_uint64(read_max);
 DECLARE_uint64(read_user_max);
+DECLARE_bool(read_mmap);
 
 #ifdef WIN32
 auto raw_drive = getEnvVar("SystemDrive");
@@ -119,6 +124,44 @@ TEST_F(FilesystemTests, test_read_limit) {
   }
 }
 
+TEST_F(FilesystemTests, test_read_file_blocks) {
+  std::string expected;
+  for (size_t i = 0; i < 10000; i++) {
+    expected += std::to_string(i);
+  }
+  auto path = kTestWorkingDirectory + "fstests-blocks";
+  writeTextFile(path, expected);
+
+  auto mmap = FLAGS_read_mmap;
+  for (const auto& use_mmap : {false, true}) {
+    FLAGS_read_mmap = use_mmap;
+    std::string content;
+    size_t blocks = 0;
+    auto status = readFileBlocks(
+        path,
+        4096,
+        false,
+        ([&content, &blocks](const char* buffer, size_t size) {
+          EXPECT_LE(size, 4096U);
+          content.append(buffer, size);
+          blocks++;
+        }));
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(expected, content);
+    EXPECT_EQ((expected.size() + 4095) / 4096, blocks);
+  }
+
+  // The read limits apply to block reads.
+  auto max = FLAGS_read_max;
+  FLAGS_read_max = 3;
+  auto status = readFileBlocks(path, 4096, false, ([](const char*, size_t) {}));
+  EXPECT_FALSE(status.ok());
+  FLAGS_read_max = max;
+  FLAGS_read_mmap = mmap;
+
+  remove(path);
+}
+
 TEST_F(FilesystemTests, test_list_files_missing_directory) {
   std::vector<std::string> results;
   auto status = listFilesInDirectory("/foo/bar", results);
@@ -269,6 +312,26 @@ TEST_F(FilesystemTests, test_wildcard_double_folders) {
                            .string()));
 }
 
+TEST_F(FilesystemTests, test_wildcard_double_filter) {
+  // The filter prunes the walk below the rejected directory.
+  std::vector<std::string> results;
+  auto deep11 = kFakeDirectory + "/deep11/";
+  auto filter = [&deep11](const std::string& directory) {
+    return directory.find(deep11) != 0;
+  };
+  resolveFilePattern(kFakeDirectory + "/%%", results, GLOB_ALL, filter);
+  EXPECT_TRUE(contains(results, fs::path(deep11).make_preferred().string()));
+  for (const auto& result : results) {
+    if (result != fs::path(deep11).make_preferred().string()) {
+      EXPECT_NE(result.find(deep11), 0U);
+    }
+  }
+  EXPECT_TRUE(contains(results,
+                       fs::path(kFakeDirectory + "/deep1/deep2/level2.txt")
+                           .make_preferred()
+                           .string()));
+}
+
 TEST_F(FilesystemTests, test_wildcard_end_last_component) {
   std::vector<std::string> results;
   auto status = resolveFilePattern(kFakeDirectory + "/%11/%sh", results);
@@ -378,9 +441,176 @@ TEST_F(FilesystemTests, test_read_proc) {
   EXPECT_TRUE(readFile("/proc/" + std::to_string(getpid()) + "/stat", content));
   EXPECT_GT(content.size(), 0U);
 }
+
+TEST_F(FilesystemTests, test_proc_snapshot) {
+  QueryContext context;
+  context.state = std::make_shared<QueryState>();
+
+  // Tables scanned by the same query share a snapshot.
+  auto proc = ProcSnapshot::get(context);
+  EXPECT_EQ(proc, ProcSnapshot::get(context));
+  EXPECT_NE(proc, ProcSnapshot::get(QueryContext()));
+
+  auto pid = std::to_string(getpid());
+  std::set<std::string> processes;
+  EXPECT_TRUE(proc->processes(processes).ok());
+  EXPECT_EQ(processes.count(pid), 1U);
+
+  std::map<std::string, std::string> descriptors;
+  EXPECT_TRUE(proc->descriptors(pid, descriptors).ok());
+  EXPECT_FALSE(descriptors.empty());
+
+  std::string first;
+  EXPECT_TRUE(proc->read(pid, "stat", first).ok());
+  EXPECT_GT(first.size(), 0U);
+
+  // The content read first is returned for the rest of the query.
+  std::string second;
+  EXPECT_TRUE(proc->read(pid, "stat", second).ok());
+  EXPECT_EQ(first, second);
+  EXPECT_FALSE(proc->read(pid, "does_not_exist", second).ok());
+}
 #endif
 
 #ifndef WIN32
+TEST_F(FilesystemTests, test_file_metadata_cache) {
+  auto& cache = FileMetadataCache::instance();
+  auto directory = kTestWorkingDirectory + "file-metadata-cache";
+  auto path = directory + "/file.txt";
+  fs::create_directories(directory);
+  writeTextFile(path, "1");
+
+  // Paths outside of watched directories are always stat-ed.
+  struct stat file_stat;
+  EXPECT_TRUE(cache.stat(path, file_stat));
+  writeTextFile(path, "22");
+  EXPECT_TRUE(cache.stat(path, file_stat));
+  EXPECT_EQ(file_stat.st_size, 2);
+
+  // Within a watched directory the result is reused until an event.
+  cache.watch(directory + "/");
+  EXPECT_TRUE(cache.stat(path, file_stat));
+  writeTextFile(path, "333");
+  EXPECT_TRUE(cache.stat(path, file_stat));
+  EXPECT_EQ(file_stat.st_size, 2);
+
+  cache.invalidate(path);
+  EXPECT_TRUE(cache.stat(path, file_stat));
+  EXPECT_EQ(file_stat.st_size, 3);
+
+  // Removing the file invalidates it, and the directory.
+  fs::remove(path);
+  cache.invalidate(path);
+  EXPECT_FALSE(cache.stat(path, file_stat));
+
+  cache.unwatch(directory);
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0U);
+}
+
+/// Count the parses of a file.
+static size_t kParsedFileCount{0};
+
+static QueryData parseTestFile(const std::string& content) {
+  kParsedFileCount++;
+  return {{{"content", content}}};
+}
+
+TEST_F(FilesystemTests, test_parsed_file_cache) {
+  auto& cache = ParsedFileCache::instance();
+  auto path = kTestWorkingDirectory + "parsed-file-cache.txt";
+  writeTextFile(path, "1");
+
+  // A recently modified file is parsed by every read.
+  QueryData results;
+  kParsedFileCount = 0;
+  EXPECT_TRUE(cache.read(path, parseTestFile, results).ok());
+  EXPECT_TRUE(cache.read(path, parseTestFile, results).ok());
+  EXPECT_EQ(kParsedFileCount, 2U);
+
+  // Once older, the rows are reused while the file is unchanged.
+  auto mtime = fs::last_write_time(path) - 10;
+  fs::last_write_time(path, mtime);
+  EXPECT_TRUE(cache.read(path, parseTestFile, results).ok());
+  EXPECT_TRUE(cache.read(path, parseTestFile, results).ok());
+  EXPECT_EQ(kParsedFileCount, 3U);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["content"], "1");
+
+  // Rewriting the file with the same size and time is noticed by its inode.
+  auto replacement = path + ".new";
+  writeTextFile(replacement, "2");
+  fs::last_write_time(replacement, mtime);
+  fs::rename(replacement, path);
+  EXPECT_TRUE(cache.read(path, parseTestFile, results).ok());
+  EXPECT_EQ(kParsedFileCount, 4U);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["content"], "2");
+
+  // A missing file is a read failure, and is not cached.
+  fs::remove(path);
+  EXPECT_FALSE(cache.read(path, parseTestFile, results).ok());
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0U);
+}
+
+TEST_F(FilesystemTests, test_directory_tree_cache) {
+  auto& cache = DirectoryTreeCache::instance();
+  cache.clear();
+  auto root = kTestWorkingDirectory + "directory-tree-cache";
+  fs::remove_all(root);
+  fs::create_directories(root + "/a/b");
+  fs::create_directories(root + "/c");
+  fs::create_directories(root + "/.hidden");
+  writeTextFile(root + "/a/file.txt", "1");
+
+  // The recursive listing canonicalizes the directory.
+  auto directory = fs::canonical(root).string() + "/";
+
+  // The results match the recursive directory listing.
+  std::vector<std::string> expected;
+  listDirectoriesInDirectory(directory, expected, true);
+  std::sort(expected.begin(), expected.end());
+
+  std::vector<std::string> results;
+  EXPECT_EQ(cache.listDirectories(directory, results), 4U);
+  std::sort(results.begin(), results.end());
+  EXPECT_EQ(results, expected);
+  EXPECT_EQ(results.size(), 3U);
+
+  // Recently modified directories are listed again.
+  results.clear();
+  EXPECT_EQ(cache.listDirectories(directory, results), 4U);
+  EXPECT_EQ(cache.size(), 0U);
+
+  // Once older, unchanged directories are reused.
+  std::vector<std::string> directories = {
+      directory, directory + "a/", directory + "a/b/", directory + "c/"};
+  for (const auto& path : directories) {
+    fs::last_write_time(path, fs::last_write_time(path) - 10);
+  }
+  results.clear();
+  EXPECT_EQ(cache.listDirectories(directory, results), 4U);
+  results.clear();
+  EXPECT_EQ(cache.listDirectories(directory, results), 0U);
+  EXPECT_EQ(results.size(), 3U);
+  EXPECT_EQ(cache.size(), 4U);
+
+  // Only the changed directory is listed, a removed subtree is forgotten.
+  fs::remove_all(directory + "a/b");
+  fs::create_directories(directory + "a/d");
+  results.clear();
+  EXPECT_EQ(cache.listDirectories(directory, results), 2U);
+  std::sort(results.begin(), results.end());
+  expected = {directory + "a/", directory + "a/d/", directory + "c/"};
+  EXPECT_EQ(results, expected);
+  EXPECT_EQ(cache.size(), 2U);
+
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0U);
+  fs::remove_all(root);
+}
+
 TEST_F(FilesystemTests, test_read_symlink) {
   std::string content;
   auto status = readFile(kFakeDirectory + "/root2.txt", content);
@@ -15,6 +15,7 @@
 #include <io.h>
 #include <sddl.h>
 
+#include <algorithm>
 #include <memory>
 #include <regex>
 #include <vector>
@@ -128,6 +129,140 @@ AsyncEvent::~AsyncEvent() {
   }
 }
 
+/// The number of block reads kept outstanding by readFileOverlapped.
+const size_t kOverlappedReads = 4;
+
+/// Unbuffered reads use offsets and sizes aligned to the largest sector size.
+const size_t kUnbufferedAlignment = 4096;
+
+/// A block request, the buffer is page aligned for unbuffered reads.
+struct OverlappedRead {
+  AsyncEvent event;
+  char* buffer{nullptr};
+  size_t offset{0};
+  bool pending{false};
+};
+
+Status readFileOverlapped(
+    const std::string& path,
+    size_t file_size,
+    size_t block_size,
+    bool unbuffered,
+    std::function<void(const char* buffer, size_t size)> predicate) {
+  DWORD flags = FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN;
+  if (unbuffered) {
+    flags |= FILE_FLAG_NO_BUFFERING;
+    block_size = ((block_size + kUnbufferedAlignment - 1) /
+                  kUnbufferedAlignment) *
+                 kUnbufferedAlignment;
+  }
+
+  auto handle = ::CreateFileA(path.c_str(),
+                              GENERIC_READ,
+                              FILE_SHARE_READ,
+                              nullptr,
+                              OPEN_EXISTING,
+                              flags,
+                              nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return Status(1, "Cannot open file for overlapped reads: " + path);
+  }
+
+  std::vector<OverlappedRead> reads(kOverlappedReads);
+  bool allocated = true;
+  for (auto& read : reads) {
+    read.buffer = static_cast<char*>(::VirtualAlloc(
+        nullptr, block_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    allocated = allocated && (read.buffer != nullptr);
+  }
+
+  // Request the next block of the file, a request may complete immediately.
+  size_t next_offset = 0;
+  auto request = [&](OverlappedRead& read) {
+    if (next_offset >= file_size || read.buffer == nullptr) {
+      return false;
+    }
+
+    auto event = read.event.overlapped_.hEvent;
+    ::ZeroMemory(&read.event.overlapped_, sizeof(OVERLAPPED));
+    read.event.overlapped_.hEvent = event;
+    read.event.overlapped_.Offset = static_cast<DWORD>(next_offset);
+    read.event.overlapped_.OffsetHigh =
+        static_cast<DWORD>(static_cast<uint64_t>(next_offset) >> 32);
+
+    // Unbuffered reads must request whole sectors, past the end is allowed.
+    auto size = (unbuffered) ? block_size
+                             : std::min(block_size, file_size - next_offset);
+    if (!::ReadFile(handle,
+                    read.buffer,
+                    static_cast<DWORD>(size),
+                    nullptr,
+                    &read.event.overlapped_) &&
+        ::GetLastError() != ERROR_IO_PENDING) {
+      return false;
+    }
+
+    read.offset = next_offset;
+    read.pending = true;
+    next_offset += block_size;
+    return true;
+  };
+
+  // Nothing is delivered unless every buffer is available.
+  if (allocated) {
+    for (auto& read : reads) {
+      request(read);
+    }
+  }
+
+  // Requests complete in any order, blocks are delivered in file order.
+  size_t total_bytes = 0;
+  for (size_t index = 0; allocated && total_bytes < file_size;
+       index = (index + 1) % reads.size()) {
+    auto& read = reads[index];
+    if (!read.pending) {
+      break;
+    }
+
+    DWORD bytes_read = 0;
+    auto ret = ::GetOverlappedResult(
+        handle, &read.event.overlapped_, &bytes_read, TRUE);
+    read.pending = false;
+    if (ret == 0 || bytes_read == 0) {
+      break;
+    }
+
+    auto expected = std::min(block_size, file_size - read.offset);
+    auto size = std::min(static_cast<size_t>(bytes_read), expected);
+    predicate(read.buffer, size);
+    total_bytes += size;
+    if (size < expected) {
+      // The file was truncated while reading.
+      break;
+    }
+    request(read);
+  }
+
+  // Outstanding requests must finish before their buffers are released.
+  for (auto& read : reads) {
+    if (read.pending) {
+      DWORD bytes_read = 0;
+      ::CancelIoEx(handle, &read.event.overlapped_);
+      ::GetOverlappedResult(
+          handle, &read.event.overlapped_, &bytes_read, TRUE);
+    }
+    if (read.buffer != nullptr) {
+      ::VirtualFree(read.buffer, 0, MEM_RELEASE);
+    }
+  }
+
+  ::CloseHandle(handle);
+  if (total_bytes != file_size) {
+    return Status(1, "Cannot read file with overlapped reads: " + path);
+  }
+  return Status(0, "OK");
+}
+
 // Inspired by glob-to-regexp node package
 static std::string globToRegex(const std::string& glob) {
   bool in_group = false;
@@ -988,6 +1123,13 @@ size_t PlatformFile::size() const {
   return ::GetFileSize(handle_, nullptr);
 }
 
+bool PlatformFile::sync() {
+  if (!isValid()) {
+    return false;
+  }
+  return (::FlushFileBuffers(handle_) != FALSE);
+}
+
 bool platformChmod(const std::string& path, mode_t perms) {
   DWORD ret = 0;
   PACL dacl = nullptr;
@@ -0,0 +1,70 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/logger.h>
+#include <osquery/registry.h>
+
+namespace osquery {
+
+DECLARE_bool(disable_logging);
+DECLARE_bool(log_result_events);
+
+class BenchmarkLoggerPlugin : public LoggerPlugin {
+ protected:
+  Status logString(const std::string& s) override {
+    bytes_ += s.size();
+    return Status(0);
+  }
+
+  void init(const std::string& name,
+            const std::vector<StatusLogLine>& log) override {}
+
+ private:
+  size_t bytes_{0};
+};
+
+/// A differential result of 10k rows, logged to three loggers.
+static void LOGGER_log_query_log_item(benchmark::State& state) {
+  auto loggers = RegistryFactory::get().registry("logger");
+  for (const auto& name : {"benchmark_1", "benchmark_2", "benchmark_3"}) {
+    if (!loggers->exists(name)) {
+      loggers->add(name, std::make_shared<BenchmarkLoggerPlugin>());
+    }
+  }
+
+  QueryLogItem item;
+  item.name = "benchmark";
+  item.identifier = "hostname";
+  item.calendar_time = "Mon Jan  1 00:00:00 2017 UTC";
+  for (size_t i = 0; i < 10000; i++) {
+    Row r;
+    r["pid"] = std::to_string(i);
+    r["name"] = "process_" + std::to_string(i);
+    r["path"] = "/usr/local/bin/process_" + std::to_string(i);
+    item.results.added.push_back(std::move(r));
+  }
+
+  auto disable_logging = FLAGS_disable_logging;
+  auto log_result_events = FLAGS_log_result_events;
+  FLAGS_disable_logging = false;
+  FLAGS_log_result_events = (state.range_x() == 1);
+  while (state.KeepRunning()) {
+    logQueryLogItem(item, "benchmark_1,benchmark_2,benchmark_3");
+  }
+  state.SetItemsProcessed(state.iterations() * item.results.added.size());
+
+  FLAGS_disable_logging = disable_logging;
+  FLAGS_log_result_events = log_result_events;
+}
+
+BENCHMARK(LOGGER_log_query_log_item)->Arg(0)->Arg(1);
+}
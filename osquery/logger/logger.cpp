@@ -13,6 +13,10 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <condition_variable>
+#include <memory>
 #include <thread>
 
 #include <boost/noncopyable.hpp>
@@ -25,6 +29,7 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
+#include "osquery/core/tracing.h"
 
 namespace pt = boost::property_tree;
 
@@ -47,6 +52,25 @@ FLAG(bool,
      false,
      "Only send status logs to secondary logger plugins");
 
+FLAG(bool,
+     logger_status_sync,
+     false,
+     "Send status logs to logger plugins from the logging thread");
+
+FLAG(uint64,
+     logger_snapshot_chunk_rows,
+     0,
+     "Log scheduled snapshots as lines of at most this many rows (0 = one)");
+
+/// The number of status lines queued for the relay thread, a power of 2.
+const size_t kStatusRingSize = 4096;
+
+/// The max number of status lines relayed to logger plugins in one request.
+const size_t kStatusRelayBatch = 1024;
+
+/// Set for the status log relay thread, its status logs are sent directly.
+static thread_local bool kStatusRelayThread{false};
+
 /**
  * @brief Logger plugin registry.
  *
@@ -58,6 +82,78 @@ CREATE_REGISTRY(LoggerPlugin, "logger");
 
 class LoggerDisabler;
 
+/**
+ * @brief A bounded, lock-free, multiple-producer queue of status lines.
+ *
+ * Each logging thread claims a cell by advancing the enqueue position, and a
+ * single relay thread consumes cells in the order they were claimed. A cell's
+ * sequence tells producers and the consumer when it may be written or read,
+ * so neither takes a lock.
+ */
+class StatusLogRing : private boost::noncopyable {
+ public:
+  StatusLogRing() : cells_(new Cell[kStatusRingSize]) {
+    for (size_t i = 0; i < kStatusRingSize; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /// Add a line, returns false if the ring is full.
+  bool push(StatusLogLine& line) {
+    auto pos = enqueue_.load(std::memory_order_relaxed);
+    while (true) {
+      auto& cell = cells_[pos & (kStatusRingSize - 1)];
+      auto sequence = cell.sequence.load(std::memory_order_acquire);
+      if (sequence == pos) {
+        if (enqueue_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          cell.line = std::move(line);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (sequence < pos) {
+        // The cell has not been consumed since the last lap.
+        return false;
+      } else {
+        pos = enqueue_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// Remove the oldest line, this must only be called by the consumer.
+  bool pop(StatusLogLine& line) {
+    auto& cell = cells_[dequeue_ & (kStatusRingSize - 1)];
+    if (cell.sequence.load(std::memory_order_acquire) != dequeue_ + 1) {
+      return false;
+    }
+
+    line = std::move(cell.line);
+    cell.sequence.store(dequeue_ + kStatusRingSize, std::memory_order_release);
+    dequeue_++;
+    return true;
+  }
+
+  /// The number of lines claimed by producers.
+  size_t pushed() const {
+    return enqueue_.load(std::memory_order_acquire);
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence{0};
+    StatusLogLine line;
+  };
+
+  /// The ring of cells.
+  std::unique_ptr<Cell[]> cells_;
+
+  /// The next position for producers to claim.
+  std::atomic<size_t> enqueue_{0};
+
+  /// The next position to consume.
+  size_t dequeue_{0};
+};
+
 /**
  * @brief A custom Glog log sink for forwarding or buffering status logs.
  *
@@ -183,6 +279,9 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
     }
   }
 
+  /// Wait for the status lines queued before this call to be relayed.
+  static void flush();
+
  public:
   BufferedLogSink(BufferedLogSink const&) = delete;
   void operator=(BufferedLogSink const&) = delete;
@@ -193,9 +292,22 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
 
   /// Remove the log sink.
   ~BufferedLogSink() {
+    stopRelay();
     disable();
   }
 
+  /// Send status lines to each enabled logger plugin.
+  void sendStatus(const std::vector<StatusLogLine>& log);
+
+  /// Queue a forwarded status line for the relay thread.
+  bool queueStatus(StatusLogLine& line);
+
+  /// The relay thread, sending queued status lines in order.
+  void relay();
+
+  /// Stop the relay thread once every queued line is sent.
+  void stopRelay();
+
  private:
   /// Intermediate log storage until an osquery logger is initialized.
   std::vector<StatusLogLine> logs_;
@@ -218,6 +330,22 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
   /// Mutex to safely turn on/off forwarding
   Mutex forward_mutex_;
 
+  /// Status lines forwarded from logging threads to the relay thread.
+  StatusLogRing ring_;
+
+  /// The relay thread is started when the first line is queued.
+  std::thread relay_;
+  std::atomic<bool> relay_started_{false};
+  std::atomic<bool> relay_stopping_{false};
+
+  /// The number of queued lines sent by the relay thread.
+  std::atomic<size_t> relayed_{0};
+
+  /// Wake the relay thread, and callers waiting for lines to be relayed.
+  std::mutex relay_mutex_;
+  std::condition_variable relay_wake_;
+  std::condition_variable relay_done_;
+
  private:
   friend class LoggerDisabler;
   friend class LoggerForwardingDisabler;
@@ -258,22 +386,42 @@ LoggerForwardingDisabler::~LoggerForwardingDisabler() {
   BufferedLogSink::restoreForwardingAndUnlock(forward_state_);
 }
 
+/// Append a JSON string value, escaping quotes and control characters.
+static void appendJSONString(const std::string& value, std::string& output) {
+  output += '"';
+  for (const auto& c : value) {
+    if (c == '"' || c == '\\') {
+      output += '\\';
+      output += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8] = {0};
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      output += escaped;
+    } else {
+      output += c;
+    }
+  }
+  output += '"';
+}
+
 static void serializeIntermediateLog(const std::vector<StatusLogLine>& log,
                                      PluginRequest& request) {
-  pt::ptree tree;
+  // Write the JSON array of lines read by deserializeIntermediateLog without
+  // an intermediate property tree, since every forwarded line is serialized.
+  // Extension logger plugins parse this same format.
+  std::string output = "[";
   for (const auto& log_item : log) {
-    pt::ptree child;
-    child.put("s", log_item.severity);
-    child.put("f", log_item.filename);
-    child.put("i", log_item.line);
-    child.put("m", log_item.message);
-    tree.push_back(std::make_pair("", child));
-  }
-
-  // Save the log as a request JSON string.
-  std::ostringstream output;
-  pt::write_json(output, tree, false);
-  request["log"] = output.str();
+    if (output.size() > 1) {
+      output += ',';
+    }
+    output += "{\"s\":\"" + std::to_string(log_item.severity) + "\",\"f\":";
+    appendJSONString(log_item.filename, output);
+    output += ",\"i\":\"" + std::to_string(log_item.line) + "\",\"m\":";
+    appendJSONString(log_item.message, output);
+    output += '}';
+  }
+  output += ']';
+  request["log"] = std::move(output);
 }
 
 static void deserializeIntermediateLog(const PluginRequest& request,
@@ -364,9 +512,6 @@ void initLogger(const std::string& name) {
   // the case with filesystem logging.
   PluginRequest init_request = {{"init", name}};
   serializeIntermediateLog(intermediate_logs, init_request);
-  if (!init_request["log"].empty()) {
-    init_request["log"].pop_back();
-  }
 
   bool forward = false;
   PluginRequest features_request = {{"action", "features"}};
@@ -410,23 +555,12 @@ void BufferedLogSink::send(google::LogSeverity severity,
                            size_t message_len) {
   // Either forward the log to an enabled logger or buffer until one exists.
   if (forward_) {
-    auto logger_plugin = RegistryFactory::get().getActive("logger");
-    for (const auto& logger : osquery::split(logger_plugin, ",")) {
-      auto& enabled = BufferedLogSink::enabledPlugins();
-      if (std::find(enabled.begin(), enabled.end(), logger) != enabled.end()) {
-        // May use the logs_ storage to buffer/delay sending logs.
-        logs_.push_back({(StatusLogSeverity)severity,
-                         std::string(base_filename),
-                         line,
-                         std::string(message, message_len)});
-        PluginRequest request = {{"status", "true"}};
-        serializeIntermediateLog(logs_, request);
-        if (!request["log"].empty()) {
-          request["log"].pop_back();
-        }
-        logs_.clear();
-        Registry::call("logger", logger, request);
-      }
+    StatusLogLine item = {(StatusLogSeverity)severity,
+                          std::string(base_filename),
+                          line,
+                          std::string(message, message_len)};
+    if (FLAGS_logger_status_sync || !queueStatus(item)) {
+      sendStatus({item});
     }
   } else {
     logs_.push_back({(StatusLogSeverity)severity,
@@ -436,20 +570,189 @@ void BufferedLogSink::send(google::LogSeverity severity,
   }
 }
 
-Status LoggerPlugin::call(const PluginRequest& request,
-                          PluginResponse& response) {
-  if (FLAGS_logger_secondary_status_only &&
-      !BufferedLogSink::isPrimaryLogger(getName()) &&
-      (request.count("string") || request.count("snapshot"))) {
+/// Build the request envelope of status logs for an extension's logger.
+static PluginRequest getStatusRequest(const std::vector<StatusLogLine>& log) {
+  PluginRequest request = {{"status", "true"}};
+  serializeIntermediateLog(log, request);
+  return request;
+}
+
+void BufferedLogSink::sendStatus(const std::vector<StatusLogLine>& log) {
+  auto logger_plugin = RegistryFactory::get().getActive("logger");
+  for (const auto& logger : osquery::split(logger_plugin, ",")) {
+    auto& enabled = BufferedLogSink::enabledPlugins();
+    if (std::find(enabled.begin(), enabled.end(), logger) != enabled.end()) {
+      // Local loggers receive the lines without serializing them.
+      Registry::callLocal<LoggerPlugin>(
+          "logger",
+          logger,
+          [&log](LoggerPlugin& plugin) { return plugin.callStatus(log); },
+          [&log]() { return getStatusRequest(log); });
+    }
+  }
+}
+
+bool BufferedLogSink::queueStatus(StatusLogLine& line) {
+  // Lines logged while relaying are sent directly, as they would be without
+  // the relay thread, the relay cannot wait for itself.
+  if (kStatusRelayThread || relay_stopping_) {
+    return false;
+  }
+
+  if (!relay_started_.exchange(true)) {
+    relay_ = std::thread(&BufferedLogSink::relay, this);
+  }
+
+  // A full ring applies back-pressure to logging threads, keeping the order.
+  while (!ring_.push(line)) {
+    relay_wake_.notify_one();
+    std::this_thread::yield();
+  }
+  relay_wake_.notify_one();
+  return true;
+}
+
+void BufferedLogSink::relay() {
+  kStatusRelayThread = true;
+  std::vector<StatusLogLine> batch;
+  while (true) {
+    StatusLogLine line;
+    while (batch.size() < kStatusRelayBatch && ring_.pop(line)) {
+      batch.push_back(std::move(line));
+    }
+
+    if (batch.empty()) {
+      if (relay_stopping_) {
+        break;
+      }
+
+      // Producers wake the relay, the timeout covers a missed notification.
+      std::unique_lock<std::mutex> lock(relay_mutex_);
+      relay_wake_.wait_for(lock, std::chrono::milliseconds(100));
+      continue;
+    }
+
+    sendStatus(batch);
+    relayed_ += batch.size();
+    batch.clear();
+    {
+      std::lock_guard<std::mutex> lock(relay_mutex_);
+    }
+    relay_done_.notify_all();
+  }
+}
+
+void BufferedLogSink::flush() {
+  auto& self = instance();
+  if (!self.relay_started_ || kStatusRelayThread) {
+    return;
+  }
+
+  auto pushed = self.ring_.pushed();
+  std::unique_lock<std::mutex> lock(self.relay_mutex_);
+  self.relay_wake_.notify_one();
+  self.relay_done_.wait(lock, [&self, pushed]() {
+    return self.relayed_ >= pushed || self.relay_stopping_;
+  });
+}
+
+void BufferedLogSink::stopRelay() {
+  if (!relay_started_ || relay_stopping_.exchange(true)) {
+    return;
+  }
+
+  relay_wake_.notify_one();
+  if (relay_.joinable()) {
+    relay_.join();
+  }
+  relay_done_.notify_all();
+}
+
+/// The priority class of results logged on each thread.
+static thread_local LogPriority kLogPriority{LogPriority::NORMAL};
+
+bool getLogPriority(const std::string& name, LogPriority& priority) {
+  for (auto p : {LogPriority::HIGH, LogPriority::NORMAL, LogPriority::LOW}) {
+    if (name == getLogPriorityName(p)) {
+      priority = p;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string getLogPriorityName(LogPriority priority) {
+  switch (priority) {
+  case LogPriority::HIGH:
+    return "high";
+  case LogPriority::LOW:
+    return "low";
+  default:
+    return "normal";
+  }
+}
+
+LogPriorityScope::LogPriorityScope(LogPriority priority)
+    : previous_(kLogPriority) {
+  kLogPriority = priority;
+}
+
+LogPriorityScope::~LogPriorityScope() {
+  kLogPriority = previous_;
+}
+
+LogPriority LogPriorityScope::current() {
+  return kLogPriority;
+}
+
+/// Extension loggers receive the priority of results with each request.
+static void addLogPriority(PluginRequest& request) {
+  if (kLogPriority != LogPriority::NORMAL) {
+    request["priority"] = getLogPriorityName(kLogPriority);
+  }
+}
+
+/// Check if result logs are withheld from a secondary logger plugin.
+static bool isStatusOnly(const LoggerPlugin& plugin) {
+  return FLAGS_logger_secondary_status_only &&
+         !BufferedLogSink::isPrimaryLogger(plugin.getName());
+}
+
+Status LoggerPlugin::callString(const std::string& s) {
+  if (isStatusOnly(*this)) {
     return Status(0, "Logging disabled to secondary plugins");
   }
+  return this->logString(s);
+}
+
+Status LoggerPlugin::callSnapshot(const std::string& s) {
+  if (isStatusOnly(*this)) {
+    return Status(0, "Logging disabled to secondary plugins");
+  }
+  return this->logSnapshot(s);
+}
 
+Status LoggerPlugin::callStatus(const std::vector<StatusLogLine>& log) {
+  return this->logStatus(log);
+}
+
+Status LoggerPlugin::callEvent(const std::string& s) {
+  return this->logEvent(s);
+}
+
+Status LoggerPlugin::call(const PluginRequest& request,
+                          PluginResponse& response) {
   QueryLogItem item;
   std::vector<StatusLogLine> intermediate_logs;
+  auto priority = LogPriority::NORMAL;
+  if (request.count("priority") > 0) {
+    getLogPriority(request.at("priority"), priority);
+  }
+  LogPriorityScope scope(priority);
   if (request.count("string") > 0) {
-    return this->logString(request.at("string"));
+    return this->callString(request.at("string"));
   } else if (request.count("snapshot") > 0) {
-    return this->logSnapshot(request.at("snapshot"));
+    return this->callSnapshot(request.at("snapshot"));
   } else if (request.count("init") > 0) {
     deserializeIntermediateLog(request, intermediate_logs);
     this->setProcessName(request.at("init"));
@@ -457,9 +760,9 @@ Status LoggerPlugin::call(const PluginRequest& request,
     return Status(0);
   } else if (request.count("status") > 0) {
     deserializeIntermediateLog(request, intermediate_logs);
-    return this->logStatus(intermediate_logs);
+    return this->callStatus(intermediate_logs);
   } else if (request.count("event") > 0) {
-    return this->logEvent(request.at("event"));
+    return this->callEvent(request.at("event"));
   } else if (request.count("action") && request.at("action") == "features") {
     size_t features = 0;
     features |= (usesLogStatus()) ? LOGGER_FEATURE_LOGSTATUS : 0;
@@ -482,8 +785,15 @@ Status logString(const std::string& message,
     return Status(0, "Logging disabled");
   }
 
-  return Registry::call(
-      "logger", receiver, {{"string", message}, {"category", category}});
+  return Registry::callLocal<LoggerPlugin>(
+      "logger",
+      receiver,
+      [&message](LoggerPlugin& plugin) { return plugin.callString(message); },
+      [&message, &category]() {
+        PluginRequest request = {{"string", message}, {"category", category}};
+        addLogPriority(request);
+        return request;
+      });
 }
 
 Status logQueryLogItem(const QueryLogItem& results) {
@@ -503,21 +813,73 @@ Status logQueryLogItem(const QueryLogItem& results,
   } else {
     std::string json;
     status = serializeQueryLogItemJSON(results, json);
-    json_items.push_back(json);
+    json_items.push_back(std::move(json));
   }
   if (!status.ok()) {
     return status;
   }
 
-  for (auto& json : json_items) {
-    if (!json.empty() && json.back() == '\n') {
-      json.pop_back();
-      status = logString(json, "event", receiver);
-    }
+  // Each line is serialized once, then shared by every receiving logger.
+  auto lines = std::remove_if(
+      json_items.begin(), json_items.end(), [](std::string& json) {
+        if (json.empty() || json.back() != '\n') {
+          return true;
+        }
+        json.pop_back();
+        return false;
+      });
+  json_items.erase(lines, json_items.end());
+  if (json_items.empty()) {
+    return status;
   }
+
+  // Resolve the receivers once for all lines, local loggers are found once.
+  TRACE_PROBE2(logger__start, results.name.c_str(), json_items.size());
+  for (const auto& item : osquery::split(receiver, ",")) {
+    if (!Registry::get().exists("logger", item, true)) {
+      for (const auto& json : json_items) {
+        status = logString(json, "event", item);
+      }
+      continue;
+    }
+
+    status = Registry::callLocal<LoggerPlugin>(
+        "logger",
+        item,
+        [&json_items](LoggerPlugin& plugin) {
+          Status s;
+          for (const auto& json : json_items) {
+            s = plugin.callString(json);
+          }
+          return s;
+        },
+        [&json_items]() {
+          PluginRequest request = {{"string", json_items.front()},
+                                   {"category", "event"}};
+          addLogPriority(request);
+          return request;
+        });
+  }
+  TRACE_PROBE2(logger__done, results.name.c_str(), status.getCode());
   return status;
 }
 
+/// Send a serialized snapshot line to the active logger.
+static Status logSnapshotJSON(std::string& json) {
+  if (!json.empty() && json.back() == '\n') {
+    json.pop_back();
+  }
+  return Registry::callLocal<LoggerPlugin>(
+      "logger",
+      RegistryFactory::get().getActive("logger"),
+      [&json](LoggerPlugin& plugin) { return plugin.callSnapshot(json); },
+      [&json]() {
+        PluginRequest request = {{"snapshot", json}};
+        addLogPriority(request);
+        return request;
+      });
+}
+
 Status logSnapshotQuery(const QueryLogItem& item) {
   if (FLAGS_disable_logging) {
     return Status(0, "Logging disabled");
@@ -527,10 +889,71 @@ Status logSnapshotQuery(const QueryLogItem& item) {
   if (!serializeQueryLogItemJSON(item, json)) {
     return Status(1, "Could not serialize snapshot");
   }
-  if (!json.empty() && json.back() == '\n') {
-    json.pop_back();
+  return logSnapshotJSON(json);
+}
+
+SnapshotLogStream::SnapshotLogStream(const QueryLogItem& item)
+    : item_(item) {
+  writer_ = std::make_unique<SnapshotLogItemWriter>(item_, json_);
+}
+
+SnapshotLogStream::~SnapshotLogStream() {
+  if (!finished_) {
+    abort();
   }
-  return Registry::call("logger", {{"snapshot", json}});
+}
+
+Status SnapshotLogStream::add(Row&& row) {
+  rows_++;
+  if (FLAGS_disable_logging) {
+    return Status(0, "Logging disabled");
+  }
+
+  // A full line is logged only once another row follows, so a snapshot that
+  // fits in one line has no part fields.
+  auto chunk = FLAGS_logger_snapshot_chunk_rows;
+  if (chunk > 0 && writer_->rows() >= chunk) {
+    writer_->finish({{"snapshotPart", std::to_string(part_++)}});
+    auto status = logSnapshotJSON(json_);
+    if (!status.ok() && status_.ok()) {
+      status_ = status;
+    }
+    writer_ = std::make_unique<SnapshotLogItemWriter>(item_, json_);
+  }
+  writer_->addRow(row);
+  return Status(0, "OK");
+}
+
+void SnapshotLogStream::abort() {
+  finished_ = true;
+  if (FLAGS_disable_logging || part_ == 0) {
+    json_.clear();
+    return;
+  }
+
+  // Earlier lines were logged, the last line tells they are incomplete.
+  writer_->finish({{"snapshotPart", std::to_string(part_)},
+                   {"snapshotParts", std::to_string(part_ + 1)},
+                   {"snapshotIncomplete", "1"}});
+  logSnapshotJSON(json_);
+  json_.clear();
+}
+
+Status SnapshotLogStream::finish() {
+  finished_ = true;
+  if (FLAGS_disable_logging) {
+    return Status(0, "Logging disabled");
+  }
+
+  if (part_ == 0) {
+    writer_->finish();
+  } else {
+    writer_->finish({{"snapshotPart", std::to_string(part_)},
+                     {"snapshotParts", std::to_string(part_ + 1)}});
+  }
+  auto status = logSnapshotJSON(json_);
+  json_.clear();
+  return (status_.ok()) ? status : status_;
 }
 
 bool haltForwardingAndLock() {
@@ -549,20 +972,19 @@ void relayStatusLogs() {
   // Prevent our dumping and registry calling from producing additional logs.
   LoggerDisabler disabler;
 
-  // Construct a status log plugin request.
-  PluginRequest request = {{"status", "true"}};
   auto& status_logs = BufferedLogSink::dump();
   if (status_logs.size() == 0) {
     return;
   }
-  serializeIntermediateLog(status_logs, request);
-  if (!request["log"].empty()) {
-    request["log"].pop_back();
-  }
 
   // Skip the registry's logic, and send directly to the core's logger.
-  PluginResponse response;
-  Registry::call("logger", request, response);
+  Registry::callLocal<LoggerPlugin>(
+      "logger",
+      RegistryFactory::get().getActive("logger"),
+      [&status_logs](LoggerPlugin& plugin) {
+        return plugin.callStatus(status_logs);
+      },
+      [&status_logs]() { return getStatusRequest(status_logs); });
 
   // Flush the buffered status logs.
   // If the logger called failed then the logger is experiencing a catastrophic
@@ -571,6 +993,10 @@ void relayStatusLogs() {
   status_logs.clear();
 }
 
+void flushStatusLogs() {
+  BufferedLogSink::flush();
+}
+
 void systemLog(const std::string& line) {
 #ifndef WIN32
   syslog(LOG_NOTICE, "%s", line.c_str());
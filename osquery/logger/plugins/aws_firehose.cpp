@@ -21,6 +21,7 @@
 #include <osquery/flags.h>
 #include <osquery/registry.h>
 
+#include "osquery/core/process.h"
 #include "osquery/logger/plugins/aws_firehose.h"
 #include "osquery/logger/plugins/aws_util.h"
 
@@ -38,6 +39,8 @@ FLAG(string, aws_firehose_stream, "", "Name of Firehose stream for logging")
 const size_t FirehoseLogForwarder::kFirehoseMaxRecords = 500;
 // Max size of log + partition key is 1MB. Max size of partition key is 256B.
 const size_t FirehoseLogForwarder::kFirehoseMaxLogBytes = 1000000 - 256;
+// Attempts to send throttled records before the batch is left buffered.
+const size_t FirehoseLogForwarder::kFirehoseMaxAttempts = 10;
 
 Status FirehoseLoggerPlugin::setUp() {
   initAwsSdk();
@@ -60,7 +63,9 @@ Status FirehoseLogForwarder::send(std::vector<std::string>& log_data,
   std::vector<Aws::Firehose::Model::Record> records;
   for (const std::string& log : log_data) {
     if (log.size() + 1 > kFirehoseMaxLogBytes) {
+      // A record larger than the Firehose limit fails the entire request.
       LOG(ERROR) << "Firehose log too big, discarding!";
+      continue;
     }
     Aws::Firehose::Model::Record record;
     auto buffer =
@@ -73,26 +78,45 @@ Status FirehoseLogForwarder::send(std::vector<std::string>& log_data,
     records.push_back(std::move(record));
   }
 
-  Aws::Firehose::Model::PutRecordBatchRequest request;
-  request.WithDeliveryStreamName(FLAGS_aws_firehose_stream)
-      .WithRecords(std::move(records));
+  size_t throttled_attempts = 0;
+  for (size_t attempt = 0; records.size() > 0; attempt++) {
+    Aws::Firehose::Model::PutRecordBatchRequest request;
+    request.WithDeliveryStreamName(FLAGS_aws_firehose_stream)
+        .WithRecords(records);
+
+    Aws::Firehose::Model::PutRecordBatchOutcome outcome =
+        client_->PutRecordBatch(request);
+    Aws::Firehose::Model::PutRecordBatchResult result = outcome.GetResult();
+    if (result.GetFailedPutCount() == 0) {
+      VLOG(1) << "Successfully sent " << result.GetRequestResponses().size()
+              << " logs to Firehose.";
+      break;
+    }
 
-  Aws::Firehose::Model::PutRecordBatchOutcome outcome =
-      client_->PutRecordBatch(request);
-  Aws::Firehose::Model::PutRecordBatchResult result = outcome.GetResult();
-  if (result.GetFailedPutCount() != 0) {
+    // Throttled records are sent again, any other error fails the batch.
+    std::vector<Aws::Firehose::Model::Record> resend;
+    size_t i = 0;
     for (const auto& record : result.GetRequestResponses()) {
       if (!record.GetErrorMessage().empty()) {
-        VLOG(1) << "Firehose write for " << result.GetFailedPutCount() << " of "
-                << result.GetRequestResponses().size()
-                << " records failed with error " << record.GetErrorMessage();
-        return Status(1, record.GetErrorMessage());
+        if (!isAWSThrottleError(record.GetErrorCode()) ||
+            attempt + 1 >= kFirehoseMaxAttempts || i >= records.size()) {
+          VLOG(1) << "Firehose write for " << result.GetFailedPutCount()
+                  << " of " << result.GetRequestResponses().size()
+                  << " records failed with error " << record.GetErrorMessage();
+          return Status(1, record.GetErrorMessage());
+        }
+        resend.push_back(std::move(records[i]));
       }
+      i++;
     }
-  }
 
-  VLOG(1) << "Successfully sent " << result.GetRequestResponses().size()
-          << " logs to Firehose.";
+    throttled_attempts++;
+    recordRetries(resend.size(), resend.size());
+    VLOG(1) << "Resending " << resend.size()
+            << " throttled records to Firehose";
+    records = std::move(resend);
+    sleepFor(getAWSRetryDelay(throttled_attempts));
+  }
   return Status(0);
 }
 
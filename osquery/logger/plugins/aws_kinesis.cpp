@@ -10,6 +10,7 @@
 
 #include <algorithm>
 
+#include <aws/core/utils/HashingUtils.h>
 #include <aws/core/utils/Outcome.h>
 #include <aws/kinesis/model/PutRecordsRequest.h>
 #include <aws/kinesis/model/PutRecordsRequestEntry.h>
@@ -42,12 +43,94 @@ FLAG(bool,
      false,
      "Enable random kinesis partition keys");
 
+FLAG(bool,
+     aws_kinesis_aggregate,
+     false,
+     "Aggregate logs into KPL-format Kinesis records");
+
 // This is the max per AWS docs
 const size_t KinesisLogForwarder::kKinesisMaxRecords = 500;
 
 // Max size of log + partition key is 1MB. Max size of partition key is 256B.
 const size_t KinesisLogForwarder::kKinesisMaxLogBytes = 1000000 - 256;
 
+// Attempts to send rejected records before the batch is left buffered.
+const size_t KinesisLogForwarder::kKinesisMaxAttempts = 100;
+
+/// The magic prefix of KPL aggregated records.
+const std::string kKinesisAggregateMagic = "\xF3\x89\x9A\xC2";
+
+/// The bytes appended to each aggregated record: magic prefix and MD5.
+const size_t kKinesisAggregateOverhead = 4 + 16;
+
+/// Append a protobuf varint.
+static void appendVarint(std::string& buffer, size_t value) {
+  while (value >= 0x80) {
+    buffer += static_cast<char>((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  buffer += static_cast<char>(value);
+}
+
+/// Append a protobuf length-delimited field.
+static void appendField(std::string& buffer,
+                        size_t field,
+                        const std::string& value) {
+  appendVarint(buffer, (field << 3) | 2);
+  appendVarint(buffer, value.size());
+  buffer += value;
+}
+
+/// Add the magic prefix and the checksum to an aggregated record message.
+static std::string finishAggregate(const std::string& message) {
+  auto digest = Aws::Utils::HashingUtils::CalculateMD5(
+      Aws::String(message.data(), message.size()));
+  std::string record = kKinesisAggregateMagic + message;
+  record.append(reinterpret_cast<const char*>(digest.GetUnderlyingData()),
+                digest.GetLength());
+  return record;
+}
+
+void KinesisLogForwarder::aggregate(const std::vector<std::string>& log_data,
+                                    std::vector<std::string>& records) const {
+  // The AggregatedRecord message has a single partition key table entry, the
+  // host identifier, each Record refers to it by index 0.
+  std::string message;
+  for (const auto& log : log_data) {
+    std::string record;
+    appendVarint(record, (1 << 3) | 0);
+    appendVarint(record, 0);
+    appendField(record, 3, log);
+
+    // A Record field adds a tag and a length of at most 5 bytes.
+    if (!message.empty() && message.size() + record.size() + 5 +
+                                    kKinesisAggregateOverhead >
+                                kKinesisMaxLogBytes) {
+      records.push_back(finishAggregate(message));
+      message.clear();
+    }
+    if (message.empty()) {
+      appendField(message, 1, partition_key_);
+    }
+    appendField(message, 3, record);
+  }
+
+  if (!message.empty()) {
+    records.push_back(finishAggregate(message));
+  }
+}
+
+std::string KinesisLogForwarder::getPartitionKey() const {
+  if (!FLAGS_aws_kinesis_random_partition_key) {
+    return partition_key_;
+  }
+
+  // Generate a random partition key for each record, ensuring that records
+  // are spread evenly across shards.
+  static thread_local boost::uuids::random_generator generator;
+  return boost::uuids::to_string(generator());
+}
+
 Status KinesisLoggerPlugin::setUp() {
   initAwsSdk();
   forwarder_ = std::make_shared<KinesisLogForwarder>();
@@ -66,29 +149,35 @@ Status KinesisLoggerPlugin::logString(const std::string& s) {
 
 Status KinesisLogForwarder::send(std::vector<std::string>& log_data,
                                  const std::string& log_type) {
-  size_t retry_count = 100;
-  size_t retry_delay = 3000;
-  size_t original_data_size = log_data.size();
-  // exit if we sent all the data
-  while (log_data.size() > 0) {
-    std::vector<Aws::Kinesis::Model::PutRecordsRequestEntry> entries;
-    for (const std::string& log : log_data) {
-      if (log.size() > kKinesisMaxLogBytes) {
-        LOG(ERROR) << "Kinesis log too big, discarding!";
-      }
+  std::vector<std::string> records;
+  if (FLAGS_aws_kinesis_aggregate) {
+    aggregate(log_data, records);
+  } else {
+    records.reserve(log_data.size());
+    for (auto& log : log_data) {
+      records.push_back(std::move(log));
+    }
+  }
 
-      std::string record_partition_key = partition_key_;
-      if (FLAGS_aws_kinesis_random_partition_key) {
-        // Generate a random partition key for each record, ensuring that
-        // records are spread evenly across shards.
-        boost::uuids::uuid uuid = boost::uuids::random_generator()();
-        record_partition_key = boost::uuids::to_string(uuid);
-      }
+  // Records larger than the Kinesis limit would fail the entire request.
+  auto too_big = std::remove_if(
+      records.begin(), records.end(), [](const std::string& record) {
+        return record.size() > kKinesisMaxLogBytes;
+      });
+  if (too_big != records.end()) {
+    LOG(ERROR) << "Kinesis log too big, discarding!";
+    records.erase(too_big, records.end());
+  }
 
+  size_t original_data_size = records.size();
+  size_t throttled_attempts = 0;
+  for (size_t attempt = 0; records.size() > 0; attempt++) {
+    std::vector<Aws::Kinesis::Model::PutRecordsRequestEntry> entries;
+    for (const auto& record : records) {
       Aws::Kinesis::Model::PutRecordsRequestEntry entry;
-      entry.WithPartitionKey(record_partition_key)
-          .WithData(Aws::Utils::ByteBuffer((unsigned char*)log.c_str(),
-                                           log.length()));
+      entry.WithPartitionKey(getPartitionKey())
+          .WithData(Aws::Utils::ByteBuffer((unsigned char*)record.c_str(),
+                                           record.length()));
       entries.push_back(std::move(entry));
     }
 
@@ -102,38 +191,44 @@ Status KinesisLogForwarder::send(std::vector<std::string>& log_data,
     VLOG(1) << "Successfully sent "
             << result.GetRecords().size() - result.GetFailedRecordCount()
             << " of " << result.GetRecords().size() << " logs to Kinesis";
-    if (result.GetFailedRecordCount() != 0) {
-      std::vector<std::string> resend;
-      std::string error_msg = "";
-      int i = 0;
-      for (const auto& record : result.GetRecords()) {
-        if (!record.GetErrorMessage().empty()) {
-          resend.push_back(log_data[i]);
-          error_msg = record.GetErrorMessage();
+    if (result.GetFailedRecordCount() == 0) {
+      break;
+    }
+
+    // Only the rejected records are sent again.
+    std::vector<std::string> resend;
+    std::string error_msg;
+    size_t throttles = 0;
+    size_t i = 0;
+    for (const auto& entry : result.GetRecords()) {
+      if (!entry.GetErrorMessage().empty() && i < records.size()) {
+        resend.push_back(std::move(records[i]));
+        error_msg = entry.GetErrorMessage();
+        if (isAWSThrottleError(entry.GetErrorCode())) {
+          throttles++;
         }
-        i++;
-      }
-      // exit if we have tried too many times
-      // exit if all uploads fail right off the bat
-      // note, this will go back to the default logger batch retry code
-      if (retry_count == 0 ||
-          static_cast<int>(original_data_size) ==
-              result.GetFailedRecordCount()) {
-        LOG(ERROR) << "Kinesis write for " << result.GetFailedRecordCount()
-                   << " of " << result.GetRecords().size()
-                   << " records failed with error " << error_msg;
-        return Status(1, error_msg);
       }
+      i++;
+    }
 
-      VLOG(1) << "Resending " << result.GetFailedRecordCount()
-              << " records to Kinesis";
-      log_data = resend;
-      sleepFor(retry_delay);
-    } else {
-      log_data.clear();
+    // exit if we have tried too many times
+    // exit if all uploads fail right off the bat
+    // note, this will go back to the default logger batch retry code
+    if (attempt + 1 >= kKinesisMaxAttempts ||
+        (attempt == 0 && static_cast<int>(original_data_size) ==
+                             result.GetFailedRecordCount())) {
+      LOG(ERROR) << "Kinesis write for " << result.GetFailedRecordCount()
+                 << " of " << result.GetRecords().size()
+                 << " records failed with error " << error_msg;
+      return Status(1, error_msg);
     }
-    --retry_count;
-    retry_delay += 1000;
+
+    // Back off while the stream's shards are throttling writes.
+    throttled_attempts = (throttles > 0) ? throttled_attempts + 1 : 0;
+    recordRetries(resend.size(), throttles);
+    VLOG(1) << "Resending " << resend.size() << " records to Kinesis";
+    records = std::move(resend);
+    sleepFor(getAWSRetryDelay(throttled_attempts));
   }
   return Status(0);
 }
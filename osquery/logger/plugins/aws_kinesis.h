@@ -30,6 +30,7 @@ class KinesisLogForwarder : public BufferedLogForwarder {
  private:
   static const size_t kKinesisMaxLogBytes;
   static const size_t kKinesisMaxRecords;
+  static const size_t kKinesisMaxAttempts;
 
  public:
   KinesisLogForwarder()
@@ -42,11 +43,25 @@ class KinesisLogForwarder : public BufferedLogForwarder {
   Status send(std::vector<std::string>& log_data,
               const std::string& log_type) override;
 
+  /**
+   * @brief Pack logs into KPL-format aggregated records.
+   *
+   * Kinesis bills and limits shards by record, aggregation sends many small
+   * logs in each record. Consumers deaggregate with the KCL or the KPL
+   * deaggregation libraries.
+   */
+  void aggregate(const std::vector<std::string>& log_data,
+                 std::vector<std::string>& records) const;
+
+  /// The partition key of the next record, random keys spread the shards.
+  std::string getPartitionKey() const;
+
  private:
   std::string partition_key_;
   std::shared_ptr<Aws::Kinesis::KinesisClient> client_{nullptr};
 
   FRIEND_TEST(KinesisTests, test_send);
+  FRIEND_TEST(KinesisTests, test_aggregate);
 };
 
 class KinesisLoggerPlugin : public LoggerPlugin {
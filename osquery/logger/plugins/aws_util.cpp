@@ -8,7 +8,10 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
 #include <mutex>
+#include <random>
 #include <sstream>
 #include <string>
 
@@ -305,6 +308,28 @@ Status getAWSRegionFromProfile(std::string& region) {
   return Status(0);
 }
 
+/// The first and the largest delay before retrying throttled records.
+const size_t kAWSRetryBaseDelay = 100;
+const size_t kAWSRetryMaxDelay = 30000;
+
+bool isAWSThrottleError(const std::string& code) {
+  return (code == "ProvisionedThroughputExceededException" ||
+          code == "ThrottlingException" ||
+          code == "ServiceUnavailableException");
+}
+
+size_t getAWSRetryDelay(size_t attempt) {
+  auto delay = kAWSRetryBaseDelay << std::min<size_t>(attempt, 16);
+  delay = std::min(delay, kAWSRetryMaxDelay);
+
+  // Wait between half and all of the delay.
+  static thread_local std::default_random_engine generator(
+      static_cast<unsigned int>(
+          std::chrono::steady_clock::now().time_since_epoch().count()));
+  std::uniform_int_distribution<size_t> jitter(delay / 2, delay);
+  return jitter(generator);
+}
+
 void initAwsSdk() {
   static std::once_flag once_flag;
   try {
@@ -138,6 +138,19 @@ class OsqueryAWSCredentialsProviderChain
  */
 void initAwsSdk();
 
+/// Return true if an AWS record error code means a throughput limit was hit.
+bool isAWSThrottleError(const std::string& code);
+
+/**
+ * @brief Milliseconds to wait before retrying rejected records.
+ *
+ * The delay doubles with each consecutive throttled attempt, up to a cap,
+ * and is jittered so concurrent senders do not retry in lockstep.
+ *
+ * @param attempt The number of consecutive throttled attempts.
+ */
+size_t getAWSRetryDelay(size_t attempt);
+
 /**
  * @brief Retrieve the Aws::Region from the aws_region flag
  *
@@ -10,6 +10,8 @@
 
 #include <algorithm>
 #include <chrono>
+#include <future>
+#include <iterator>
 #include <thread>
 
 #include <boost/property_tree/ptree.hpp>
@@ -22,6 +24,8 @@
 
 #include "osquery/config/parsers/decorators.h"
 #include "osquery/core/json.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/process.h"
 #include "osquery/logger/plugins/buffered.h"
 
 namespace pt = boost::property_tree;
@@ -33,6 +37,57 @@ FLAG(uint64,
      1000000,
      "Maximum number of logs in buffered output plugins (0 = unlimited)");
 
+FLAG(uint64,
+     buffered_log_max_high,
+     1000000,
+     "Maximum number of high priority logs in buffered output plugins");
+
+FLAG(uint64,
+     buffered_log_max_low,
+     1000000,
+     "Maximum number of low priority logs in buffered output plugins");
+
+FLAG(uint64,
+     buffered_log_concurrency,
+     1,
+     "Number of log batches sent at once by buffered output plugins");
+
+FLAG(uint64,
+     buffered_log_latency,
+     0,
+     "Target milliseconds per buffered log send, adapts batches (0 = off)");
+
+/// A batch of buffered lines, sent as result and status sets.
+struct BufferedLogBatch {
+  std::vector<std::string> results;
+  std::vector<std::string> statuses;
+  std::vector<std::string> result_indexes;
+  std::vector<std::string> status_indexes;
+
+  /// The indexes of sent lines.
+  std::vector<std::string> sent_indexes;
+  bool sent{true};
+};
+
+/// The priority classes, in drain order.
+const std::vector<LogPriority> kLogPriorities = {
+    LogPriority::HIGH, LogPriority::NORMAL, LogPriority::LOW};
+
+/// The relative share of each check's lines given to each priority class.
+const size_t kLogPriorityWeights[] = {4, 2, 1};
+
+/// The maximum number of buffered logs of a priority class, 0 if unlimited.
+static size_t getPriorityMax(LogPriority priority) {
+  switch (priority) {
+  case LogPriority::HIGH:
+    return FLAGS_buffered_log_max_high;
+  case LogPriority::LOW:
+    return FLAGS_buffered_log_max_low;
+  default:
+    return FLAGS_buffered_log_max;
+  }
+}
+
 const std::chrono::seconds BufferedLogForwarder::kLogPeriod =
     std::chrono::seconds(4);
 const size_t BufferedLogForwarder::kMaxLogLines = 1024;
@@ -47,91 +102,255 @@ Status BufferedLogForwarder::setUp() {
   }
 
   buffer_count_ = indexes.size();
+  for (auto& count : priority_count_) {
+    count = 0;
+  }
+  for (const auto& index : indexes) {
+    priority_count_[static_cast<size_t>(getIndexPriority(index))]++;
+  }
+  buffered_metric_ =
+      &Metrics::gauge("logger_buffered_lines", "forwarder=" + index_name_);
+  buffered_metric_->set(buffer_count_);
   return Status(0);
 }
 
-void BufferedLogForwarder::check() {
-  // Get a list of all the buffered log items, with a max of 1024 lines.
-  std::vector<std::string> indexes;
-  auto status = scanDatabaseKeys(kLogs, indexes, index_name_, max_log_lines_);
-
-  // For each index, accumulate the log line into the result or status set.
-  std::vector<std::string> results, statuses;
-  iterate(indexes, ([&results, &statuses, this](std::string& index) {
-            std::string value;
-            auto& target = isResultIndex(index) ? results : statuses;
-            if (getDatabaseValue(kLogs, index, value)) {
-              target.push_back(std::move(value));
-            }
-          }));
+bool BufferedLogForwarder::check() {
+  // Read a batch of buffered lines for each send kept in flight, and their
+  // values, in ordered scans of each priority class.
+  size_t batch_lines = getBatchLines();
+  size_t concurrency = std::max<size_t>(1, FLAGS_buffered_log_concurrency);
+  size_t budget = batch_lines * concurrency;
+  std::vector<DatabaseKeyValues> classes(kLogPriorities.size());
+  for (size_t i = 0; i < kLogPriorities.size(); ++i) {
+    auto priority = kLogPriorities[i];
+    if (priority != LogPriority::NORMAL && priority_count_[i] == 0) {
+      continue;
+    }
+
+    // Normal priority results are read before statuses.
+    scanDatabasePrefix(
+        kLogs, genIndexPrefix(true, priority), classes[i], budget);
+    if (priority == LogPriority::NORMAL &&
+        (budget == 0 || classes[i].size() < budget)) {
+      DatabaseKeyValues statuses;
+      scanDatabasePrefix(kLogs,
+                         genIndexPrefix(false),
+                         statuses,
+                         (budget > 0) ? budget - classes[i].size() : 0);
+      std::move(statuses.begin(),
+                statuses.end(),
+                std::back_inserter(classes[i]));
+    }
+  }
+
+  // Each class receives its weighted share, unused shares go to the higher
+  // classes first.
+  std::vector<size_t> shares(kLogPriorities.size(), 0);
+  if (budget == 0) {
+    for (size_t i = 0; i < classes.size(); ++i) {
+      shares[i] = classes[i].size();
+    }
+  } else {
+    size_t weights = 0;
+    for (const auto& weight : kLogPriorityWeights) {
+      weights += weight;
+    }
+
+    size_t remaining = budget;
+    for (size_t i = 0; i < classes.size(); ++i) {
+      auto share = budget * kLogPriorityWeights[i] / weights;
+      shares[i] = std::min(classes[i].size(), share);
+      remaining -= shares[i];
+    }
+    for (size_t i = 0; i < classes.size() && remaining > 0; ++i) {
+      auto extra = std::min(classes[i].size() - shares[i], remaining);
+      shares[i] += extra;
+      remaining -= extra;
+    }
+  }
+
+  DatabaseKeyValues lines;
+  for (size_t i = 0; i < classes.size(); ++i) {
+    std::move(classes[i].begin(),
+              classes[i].begin() + shares[i],
+              std::back_inserter(lines));
+  }
+
+  // Accumulate each log line into the result or status set of its batch.
+  std::vector<BufferedLogBatch> batches;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    size_t batch = (batch_lines > 0) ? i / batch_lines : 0;
+    if (batch >= batches.size()) {
+      batches.resize(batch + 1);
+    }
+
+    auto& line = lines[i];
+    if (isResultIndex(line.first)) {
+      batches[batch].results.push_back(std::move(line.second));
+      batches[batch].result_indexes.push_back(std::move(line.first));
+    } else if (isStatusIndex(line.first)) {
+      batches[batch].statuses.push_back(std::move(line.second));
+      batches[batch].status_indexes.push_back(std::move(line.first));
+    }
+  }
 
   // If any results/statuses were found in the flushed buffer, send.
-  if (results.size() > 0) {
-    status = send(results, "result");
-    if (!status.ok()) {
-      VLOG(1) << "Error sending results to logger: " << status.getMessage();
-    } else {
-      // Clear the results logs once they were sent.
-      iterate(indexes, ([this](std::string& index) {
-                if (!isResultIndex(index)) {
-                  return;
-                }
-                deleteValueWithCount(kLogs, index);
-              }));
+  auto send_batch = [this](BufferedLogBatch& batch) {
+    if (batch.results.size() > 0) {
+      auto status = sendWithMetrics(batch.results, "result");
+      if (!status.ok()) {
+        VLOG(1) << "Error sending results to logger: " << status.getMessage();
+        batch.sent = false;
+      } else {
+        batch.sent_indexes = std::move(batch.result_indexes);
+      }
+    }
+
+    if (batch.statuses.size() > 0) {
+      auto status = sendWithMetrics(batch.statuses, "status");
+      if (!status.ok()) {
+        VLOG(1) << "Error sending status to logger: " << status.getMessage();
+        batch.sent = false;
+      } else {
+        batch.sent_indexes.insert(batch.sent_indexes.end(),
+                                  batch.status_indexes.begin(),
+                                  batch.status_indexes.end());
+      }
     }
+  };
+
+  // Keep every batch in flight, the first is sent from this thread.
+  std::vector<std::future<void>> sends;
+  for (size_t i = 1; i < batches.size(); ++i) {
+    sends.push_back(
+        std::async(std::launch::async, send_batch, std::ref(batches[i])));
+  }
+  if (!batches.empty()) {
+    send_batch(batches[0]);
   }
 
-  if (statuses.size() > 0) {
-    status = send(statuses, "status");
-    if (!status.ok()) {
-      VLOG(1) << "Error sending status to logger: " << status.getMessage();
-    } else {
-      // Clear the status logs once they were sent.
-      iterate(indexes, ([this](std::string& index) {
-                if (!isStatusIndex(index)) {
-                  return;
-                }
-                deleteValueWithCount(kLogs, index);
-              }));
+  bool sent = true;
+  std::vector<std::string> sent_indexes;
+  for (size_t i = 0; i < batches.size(); ++i) {
+    if (i > 0) {
+      sends[i - 1].wait();
     }
+    sent = sent && batches[i].sent;
+    sent_indexes.insert(sent_indexes.end(),
+                        batches[i].sent_indexes.begin(),
+                        batches[i].sent_indexes.end());
+  }
+
+  // Clear the logs once they were sent.
+  if (!sent_indexes.empty()) {
+    deleteValuesWithCount(kLogs, sent_indexes);
   }
 
   // Purge any logs exceeding the max after our send attempt
-  if (FLAGS_buffered_log_max > 0) {
-    purge();
+  purge();
+
+  // Every batch was full and sent, more may be buffered.
+  return sent && batch_lines > 0 && lines.size() >= budget;
+}
+
+Status BufferedLogForwarder::sendWithMetrics(
+    std::vector<std::string>& log_data, const std::string& log_type) {
+  size_t count = log_data.size();
+  auto start = std::chrono::steady_clock::now();
+  auto status = send(log_data, log_type);
+  auto latency = static_cast<size_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+
+  WriteLock lock(metrics_mutex_);
+  if (!status.ok()) {
+    metrics_.failures++;
+    return status;
   }
+
+  metrics_.sends++;
+  metrics_.lines += count;
+  metrics_.latency = latency;
+
+  // Halve batches sent slower than the target, and grow batches sent in less
+  // than half of the target back toward max_log_lines_.
+  auto target = FLAGS_buffered_log_latency;
+  if (target > 0 && max_log_lines_ > 0) {
+    auto lines = (metrics_.batch_lines > 0) ? metrics_.batch_lines
+                                            : max_log_lines_;
+    if (latency > target) {
+      lines = std::max<size_t>(1, lines / 2);
+    } else if (latency < target / 2) {
+      lines += std::max<size_t>(1, max_log_lines_ / 8);
+    }
+    metrics_.batch_lines = std::min(lines, max_log_lines_);
+  }
+  return status;
+}
+
+size_t BufferedLogForwarder::getBatchLines() {
+  WriteLock lock(metrics_mutex_);
+  if (FLAGS_buffered_log_latency == 0 || metrics_.batch_lines == 0 ||
+      metrics_.batch_lines > max_log_lines_) {
+    metrics_.batch_lines = max_log_lines_;
+  }
+  return metrics_.batch_lines;
+}
+
+BufferedLogMetrics BufferedLogForwarder::getMetrics() {
+  ReadLock lock(metrics_mutex_);
+  return metrics_;
+}
+
+void BufferedLogForwarder::recordRetries(size_t retries, size_t throttles) {
+  WriteLock lock(metrics_mutex_);
+  metrics_.retries += retries;
+  metrics_.throttles += throttles;
 }
 
 void BufferedLogForwarder::purge() {
-  if (buffer_count_ <= FLAGS_buffered_log_max) {
+  for (auto priority : kLogPriorities) {
+    purgePriority(priority);
+  }
+}
+
+void BufferedLogForwarder::purgePriority(LogPriority priority) {
+  auto max = getPriorityMax(priority);
+  auto count = priority_count_[static_cast<size_t>(priority)].load();
+  if (max == 0 || count <= max) {
     return;
   }
 
-  size_t purge_count = buffer_count_ - FLAGS_buffered_log_max;
+  size_t purge_count = count - max;
 
   // Collect purge_count indexes of each type (result/status) before
   // partitioning to find the oldest. Note this assumes that the indexes are
   // returned in ascending lexicographic order (true for RocksDB).
   std::vector<std::string> indexes;
-  auto status =
-      scanDatabaseKeys(kLogs, indexes, genIndexPrefix(true), purge_count);
+  auto status = scanDatabaseKeys(
+      kLogs, indexes, genIndexPrefix(true, priority), purge_count);
   if (!status.ok()) {
     LOG(ERROR) << "Error scanning DB during buffered log purge";
     return;
   }
 
-  LOG(WARNING) << "Purging buffered logs limit (" << FLAGS_buffered_log_max
-               << ") exceeded: " << buffer_count_;
+  LOG(WARNING) << "Purging buffered logs limit (" << max << ") exceeded for "
+               << getLogPriorityName(priority) << " priority: " << count;
 
-  std::vector<std::string> status_indexes;
-  status = scanDatabaseKeys(
-      kLogs, status_indexes, genIndexPrefix(false), purge_count);
-  if (!status.ok()) {
-    LOG(ERROR) << "Error scanning DB during buffered log purge";
-    return;
-  }
+  // Only the normal priority class buffers status logs.
+  if (priority == LogPriority::NORMAL) {
+    std::vector<std::string> status_indexes;
+    status = scanDatabaseKeys(
+        kLogs, status_indexes, genIndexPrefix(false), purge_count);
+    if (!status.ok()) {
+      LOG(ERROR) << "Error scanning DB during buffered log purge";
+      return;
+    }
 
-  indexes.insert(indexes.end(), status_indexes.begin(), status_indexes.end());
+    indexes.insert(
+        indexes.end(), status_indexes.begin(), status_indexes.end());
+  }
 
   if (indexes.size() < purge_count) {
     LOG(ERROR) << "Trying to purge " << purge_count << " logs but only found "
@@ -139,7 +358,7 @@ void BufferedLogForwarder::purge() {
     return;
   }
 
-  size_t prefix_size = genIndexPrefix(true).size();
+  size_t prefix_size = genIndexPrefix(true, priority).size();
   // Partition the indexes so that the first purge_count elements are the
   // oldest indexes (the ones to be purged)
   std::nth_element(indexes.begin(),
@@ -156,16 +375,23 @@ void BufferedLogForwarder::purge() {
   indexes.erase(indexes.begin() + purge_count, indexes.end());
 
   // Now only indexes of logs to be deleted remain
-  iterate(indexes, [this](const std::string& index) {
-    if (!deleteValueWithCount(kLogs, index).ok()) {
-      LOG(ERROR) << "Error deleting value during buffered log purge";
-    }
-  });
+  if (!deleteValuesWithCount(kLogs, indexes).ok()) {
+    LOG(ERROR) << "Error deleting values during buffered log purge";
+    return;
+  }
+  Metrics::counter("logger_purged_lines",
+                   "forwarder=" + index_name_ +
+                       ",priority=" + getLogPriorityName(priority))
+      .add(indexes.size());
 }
 
 void BufferedLogForwarder::start() {
+  // Sends wait on the network, draining competes only for idle CPU.
+  setThreadToBackgroundPriority();
   while (!interrupted()) {
-    check();
+    // Drain a backlog of buffered logs without waiting between full sends.
+    while (check() && !interrupted()) {
+    }
 
     // Cool off and time wait the configured period.
     pauseMilli(log_period_);
@@ -173,7 +399,7 @@ void BufferedLogForwarder::start() {
 }
 
 Status BufferedLogForwarder::logString(const std::string& s, size_t time) {
-  std::string index = genResultIndex(time);
+  std::string index = genResultIndex(time, LogPriorityScope::current());
   return addValueWithCount(kLogs, index, s);
 }
 
@@ -228,9 +454,28 @@ Status BufferedLogForwarder::logStatus(const std::vector<StatusLogLine>& log,
 
 bool BufferedLogForwarder::isIndex(const std::string& index, bool results) {
   size_t target = index_name_.size() + 1;
+  if (getIndexPriority(index) != LogPriority::NORMAL) {
+    target += 2;
+  }
   return target < index.size() && index.at(target) == (results ? 'r' : 's');
 }
 
+LogPriority BufferedLogForwarder::getIndexPriority(const std::string& index) {
+  size_t target = index_name_.size() + 1;
+  if (target + 1 >= index.size() || index.at(target + 1) != '_') {
+    return LogPriority::NORMAL;
+  }
+
+  switch (index.at(target)) {
+  case 'h':
+    return LogPriority::HIGH;
+  case 'l':
+    return LogPriority::LOW;
+  default:
+    return LogPriority::NORMAL;
+  }
+}
+
 bool BufferedLogForwarder::isResultIndex(const std::string& index) {
   return isIndex(index, true);
 }
@@ -239,23 +484,33 @@ bool BufferedLogForwarder::isStatusIndex(const std::string& index) {
   return isIndex(index, false);
 }
 
-std::string BufferedLogForwarder::genResultIndex(size_t time) {
-  return genIndex(true, time);
+std::string BufferedLogForwarder::genResultIndex(size_t time,
+                                                 LogPriority priority) {
+  return genIndex(true, time, priority);
 }
 
 std::string BufferedLogForwarder::genStatusIndex(size_t time) {
   return genIndex(false, time);
 }
 
-std::string BufferedLogForwarder::genIndexPrefix(bool results) {
-  return index_name_ + "_" + ((results) ? "r" : "s") + "_";
+std::string BufferedLogForwarder::genIndexPrefix(bool results,
+                                                 LogPriority priority) {
+  std::string prefix = index_name_ + "_";
+  if (priority == LogPriority::HIGH) {
+    prefix += "h_";
+  } else if (priority == LogPriority::LOW) {
+    prefix += "l_";
+  }
+  return prefix + ((results) ? "r" : "s") + "_";
 }
 
-std::string BufferedLogForwarder::genIndex(bool results, size_t time) {
+std::string BufferedLogForwarder::genIndex(bool results,
+                                           size_t time,
+                                           LogPriority priority) {
   if (time == 0) {
     time = getUnixTime();
   }
-  return genIndexPrefix(results) + std::to_string(time) + "_" +
+  return genIndexPrefix(results, priority) + std::to_string(time) + "_" +
          std::to_string(++log_index_);
 }
 
@@ -265,15 +520,28 @@ Status BufferedLogForwarder::addValueWithCount(const std::string& domain,
   Status status = setDatabaseValue(domain, key, value);
   if (status.ok()) {
     buffer_count_++;
+    priority_count_[static_cast<size_t>(getIndexPriority(key))]++;
+    if (buffered_metric_ != nullptr) {
+      buffered_metric_->set(buffer_count_);
+    }
   }
   return status;
 }
 
-Status BufferedLogForwarder::deleteValueWithCount(const std::string& domain,
-                                                  const std::string& key) {
-  Status status = deleteDatabaseValue(domain, key);
+Status BufferedLogForwarder::deleteValuesWithCount(
+    const std::string& domain, const std::vector<std::string>& keys) {
+  Status status = deleteDatabaseBatch(domain, keys);
   if (status.ok()) {
-    buffer_count_--;
+    buffer_count_ -= std::min<size_t>(keys.size(), buffer_count_);
+    for (const auto& key : keys) {
+      auto& count = priority_count_[static_cast<size_t>(getIndexPriority(key))];
+      if (count > 0) {
+        count--;
+      }
+    }
+    if (buffered_metric_ != nullptr) {
+      buffered_metric_->set(buffer_count_);
+    }
   }
   return status;
 }
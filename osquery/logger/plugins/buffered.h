@@ -17,11 +17,34 @@
 #include <thread>
 #include <vector>
 
+#include <osquery/core.h>
 #include <osquery/dispatcher.h>
 #include <osquery/logger.h>
 
 namespace osquery {
 
+class Metric;
+
+/// Throughput of a buffered log forwarder.
+struct BufferedLogMetrics {
+  /// The number of lines sent successfully.
+  size_t lines{0};
+
+  /// The number of successful and failed sends.
+  size_t sends{0};
+  size_t failures{0};
+
+  /// Milliseconds taken by the most recent successful send.
+  size_t latency{0};
+
+  /// The number of lines read for each batch.
+  size_t batch_lines{0};
+
+  /// The number of records resent, and those rejected by a throughput limit.
+  size_t retries{0};
+  size_t throttles{0};
+};
+
 /// Iterate through a vector, yielding during high utilization
 inline void iterate(std::vector<std::string>& input,
                     std::function<void(std::string&)> predicate) {
@@ -97,7 +120,8 @@ class BufferedLogForwarder : public InternalRunnable {
    *
    * Writes the result string to the backing store for buffering, but *does
    * not* actually send the string. The string will only be sent when check()
-   * runs and uses send() to send it.
+   * runs and uses send() to send it. The string is buffered in the priority
+   * class of the calling thread's LogPriorityScope.
    *
    * @param s Results string to log
    */
@@ -114,6 +138,9 @@ class BufferedLogForwarder : public InternalRunnable {
    */
   Status logStatus(const std::vector<StatusLogLine>& log, size_t time = 0);
 
+  /// The sends and lines forwarded since the forwarder started.
+  BufferedLogMetrics getMetrics();
+
  protected:
   /**
    * @brief Send labeled result logs.
@@ -121,6 +148,9 @@ class BufferedLogForwarder : public InternalRunnable {
    * The log_data provided to send must be mutable.
    * To optimize for smaller memory, this will be moved into place within the
    * constructed property tree before sending.
+   *
+   * When buffered_log_concurrency is greater than 1, send is called for
+   * several batches at once from different threads.
    */
   virtual Status send(std::vector<std::string>& log_data,
                       const std::string& log_type) = 0;
@@ -128,21 +158,33 @@ class BufferedLogForwarder : public InternalRunnable {
   /**
    * @brief Check for new logs and send.
    *
-   * Scan the logs domain for up to max_log_lines_ log lines.
-   * Sort those lines into status and request types then forward (send) each
+   * Scan the logs domain for a batch of up to max_log_lines_ log lines for
+   * each of the buffered_log_concurrency sends kept in flight.
+   * Each priority class receives a weighted share of the lines, high before
+   * normal before low, and a share a class does not use goes to the classes
+   * above it first. A backlog of low priority lines does not delay fresh
+   * high priority results, and is still drained.
+   * Sort each batch into status and request types then forward (send) each
    * set. On success, clear the data and indexes. Calls purge upon completion.
+   *
+   * @return true if every batch was full and sent, more may be buffered.
    */
-  void check();
+  bool check();
 
   /**
    * @brief Purge the oldest logs, if the max is exceeded
    *
    * Uses the buffered_log_max flag to determine the maximum number of buffered
-   * logs. If this number is exceeded, the logs with the oldest timestamp are
-   * purged. Order of purging for logs with the same timestamp is undefined.
+   * normal priority logs, and the buffered_log_max_high and
+   * buffered_log_max_low flags for the other classes. If a class exceeds its
+   * maximum, its logs with the oldest timestamp are purged. Order of purging
+   * for logs with the same timestamp is undefined.
    */
   void purge();
 
+  /// Count records a send retried, and those it retried after a throttle.
+  void recordRetries(size_t retries, size_t throttles);
+
  protected:
   /// Return whether the string is a result index
   bool isResultIndex(const std::string& index);
@@ -150,21 +192,32 @@ class BufferedLogForwarder : public InternalRunnable {
   /// Return whether the string is a status index
   bool isStatusIndex(const std::string& index);
 
+  /// Return the priority class of an index
+  LogPriority getIndexPriority(const std::string& index);
+
  private:
   /// Helper for isResultIndex/isStatusIndex
   bool isIndex(const std::string& index, bool results);
 
  protected:
   /// Generate a result index string to use with the backing store
-  std::string genResultIndex(size_t time = 0);
+  std::string genResultIndex(size_t time = 0,
+                             LogPriority priority = LogPriority::NORMAL);
 
   /// Generate a status index string to use with the backing store
   std::string genStatusIndex(size_t time = 0);
 
  private:
-  std::string genIndexPrefix(bool results);
+  /// Normal priority indexes have no class, "_h_" or "_l_" marks the others.
+  std::string genIndexPrefix(bool results,
+                             LogPriority priority = LogPriority::NORMAL);
+
+  std::string genIndex(bool results,
+                       size_t time = 0,
+                       LogPriority priority = LogPriority::NORMAL);
 
-  std::string genIndex(bool results, size_t time = 0);
+  /// Purge the oldest logs of a priority class exceeding its max.
+  void purgePriority(LogPriority priority);
 
   /**
    * @brief Add a database value while maintaining count
@@ -175,11 +228,18 @@ class BufferedLogForwarder : public InternalRunnable {
                            const std::string& value);
 
   /**
-   * @brief Delete a database value while maintaining count
+   * @brief Delete database values with a single write while maintaining count
    *
    */
-  Status deleteValueWithCount(const std::string& domain,
-                              const std::string& key);
+  Status deleteValuesWithCount(const std::string& domain,
+                               const std::vector<std::string>& keys);
+
+  /// Send a set of lines, recording the latency and adapting the batch size.
+  Status sendWithMetrics(std::vector<std::string>& log_data,
+                         const std::string& log_type);
+
+  /// The number of lines to read for each batch.
+  size_t getBatchLines();
 
  protected:
   /// Seconds between flushing logs
@@ -203,5 +263,17 @@ class BufferedLogForwarder : public InternalRunnable {
 
   /// Stores the count of buffered logs
   std::atomic<size_t> buffer_count_{0};
+
+  /// The count of buffered logs in each priority class
+  std::atomic<size_t> priority_count_[3]{{0}, {0}, {0}};
+
+  /// Reports the count of buffered logs, after setUp.
+  Metric* buffered_metric_{nullptr};
+
+  /// Send metrics, the batch size is adapted to the observed latency.
+  BufferedLogMetrics metrics_;
+
+  /// Access to the metrics from concurrent sends.
+  Mutex metrics_mutex_;
 };
 }
@@ -8,11 +8,18 @@
  *
  */
 
+#include <algorithm>
 #include <exception>
 
+#include <zlib.h>
+
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/filesystem/fileops.h"
 
 namespace fs = boost::filesystem;
 
@@ -33,13 +40,300 @@ FLAG_ALIAS(std::string, osquery_log_dir, logger_path);
 
 FLAG(int32, logger_mode, 0640, "Decimal mode for log files (default '0640')");
 
+FLAG(uint64,
+     logger_flush_size,
+     0,
+     "Bytes of results logs buffered before a write (default 0, unbuffered)");
+
+FLAG(uint64,
+     logger_flush_interval,
+     1,
+     "Seconds buffered results logs wait before a write (default 1)");
+
+FLAG(uint64,
+     logger_rotate_size,
+     0,
+     "Rotate results logs larger than this many bytes (default 0, disabled)");
+
+FLAG(uint64,
+     logger_rotate_max_files,
+     25,
+     "Number of rotated results logs to keep (default 25)");
+
+FLAG(bool,
+     logger_rotate_compress,
+     false,
+     "Compress rotated results logs with gzip");
+
+FLAG(string,
+     logger_fsync,
+     "none",
+     "Sync results logs to disk after each 'write', each 'rotate', or 'none'");
+
 const std::string kFilesystemLoggerFilename = "osqueryd.results.log";
 const std::string kFilesystemLoggerSnapshots = "osqueryd.snapshots.log";
 
+/// Size of each chunk read when compressing a rotated log.
+const size_t kLogCompressChunkSize = 64 * 1024;
+
+/**
+ * @brief An append-only results log kept open between writes.
+ *
+ * Lines are buffered until there are logger_flush_size bytes or the oldest
+ * is logger_flush_interval seconds old, then written together. The file is
+ * rotated, and optionally compressed, once it grows beyond
+ * logger_rotate_size. A log moved aside by an external logrotate is
+ * reopened.
+ */
+class FilesystemLogFile : private boost::noncopyable {
+ public:
+  explicit FilesystemLogFile(const fs::path& path) : path_(path) {}
+
+  ~FilesystemLogFile() {
+    flush();
+  }
+
+  /// Open or create the log, without writing to it.
+  Status create();
+
+  /// Buffer a line, then write the buffer if it is full.
+  Status append(const std::string& line);
+
+  /// Write the buffered lines.
+  Status flush();
+
+  /// Write the buffered lines if the oldest has waited the flush interval.
+  Status flushExpired();
+
+ private:
+  /// Open the log if it is not open, or was moved or removed.
+  Status open();
+
+  /// Write and clear the buffer, the caller holds the lock.
+  Status write();
+
+  /// Move the log to the first rotated path, shifting older logs.
+  Status rotate();
+
+  /// The path of the nth rotated log.
+  fs::path getRotatedPath(size_t n, bool compressed) const;
+
+ private:
+  /// The results or snapshots log path.
+  fs::path path_;
+
+  /// The open log, or nullptr.
+  std::unique_ptr<PlatformFile> file_{nullptr};
+
+  /// The size of the log, including the written buffers.
+  size_t size_{0};
+
+  /// Lines not yet written.
+  std::string buffer_;
+
+  /// The time the oldest buffered line was appended.
+  size_t buffer_time_{0};
+
+  /// The last time the log path was checked for an external rotation.
+  size_t checked_{0};
+
+  Mutex mutex_;
+};
+
+/// Compress a rotated log, gzip is available wherever zlib is linked.
+static Status compressLogFile(const fs::path& source, const fs::path& target) {
+  PlatformFile input(source.string(), PF_OPEN_EXISTING | PF_READ);
+  if (!input.isValid()) {
+    return Status(1, "Cannot read log: " + source.string());
+  }
+
+  auto output = gzopen(target.string().c_str(), "wb");
+  if (output == nullptr) {
+    return Status(1, "Cannot create compressed log: " + target.string());
+  }
+
+  std::string chunk(kLogCompressChunkSize, '\0');
+  ssize_t bytes = 0;
+  bool failed = false;
+  while ((bytes = input.read(&chunk[0], chunk.size())) > 0) {
+    if (gzwrite(output, chunk.data(), static_cast<unsigned>(bytes)) !=
+        bytes) {
+      failed = true;
+      break;
+    }
+  }
+  if (gzclose(output) != Z_OK || failed || bytes < 0) {
+    return Status(1, "Cannot compress log: " + source.string());
+  }
+
+  platformChmod(target.string(), FLAGS_logger_mode);
+  boost::system::error_code ec;
+  fs::remove(source, ec);
+  return Status(0, "OK");
+}
+
+Status FilesystemLogFile::create() {
+  WriteLock lock(mutex_);
+  file_.reset();
+  return open();
+}
+
+Status FilesystemLogFile::open() {
+  auto now = getUnixTime();
+  if (file_ != nullptr && now != checked_) {
+    // Reopen a log moved aside by an external rotation, at most each second.
+    checked_ = now;
+    if (!pathExists(path_).ok()) {
+      file_.reset();
+    }
+  }
+
+  if (file_ != nullptr) {
+    return Status(0, "OK");
+  }
+
+  file_.reset(new PlatformFile(path_.string(),
+                               PF_OPEN_ALWAYS | PF_WRITE | PF_APPEND,
+                               FLAGS_logger_mode));
+  if (!file_->isValid()) {
+    file_.reset();
+    return Status(1, "Could not create file: " + path_.string());
+  }
+
+  // If the file existed with different permissions they must be restricted.
+  if (!platformChmod(path_.string(), FLAGS_logger_mode)) {
+    file_.reset();
+    return Status(1, "Failed to change permissions for file: " +
+                         path_.string());
+  }
+  size_ = file_->size();
+  checked_ = now;
+  return Status(0, "OK");
+}
+
+Status FilesystemLogFile::append(const std::string& line) {
+  WriteLock lock(mutex_);
+  if (buffer_.empty()) {
+    buffer_time_ = getUnixTime();
+  }
+  buffer_ += line;
+  buffer_ += '\n';
+  if (buffer_.size() < FLAGS_logger_flush_size) {
+    return Status(0, "OK");
+  }
+  return write();
+}
+
+Status FilesystemLogFile::flush() {
+  WriteLock lock(mutex_);
+  return write();
+}
+
+Status FilesystemLogFile::flushExpired() {
+  WriteLock lock(mutex_);
+  if (buffer_.empty() ||
+      getUnixTime() - buffer_time_ < FLAGS_logger_flush_interval) {
+    return Status(0, "OK");
+  }
+  return write();
+}
+
+Status FilesystemLogFile::write() {
+  if (buffer_.empty()) {
+    return Status(0, "OK");
+  }
+
+  auto status = open();
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto bytes = file_->write(buffer_.data(), buffer_.size());
+  if (bytes < 0 || static_cast<size_t>(bytes) != buffer_.size()) {
+    // Do not retry a partially written buffer, the lines would repeat.
+    buffer_.clear();
+    file_.reset();
+    return Status(1, "Failed to write contents to file: " + path_.string());
+  }
+  size_ += buffer_.size();
+  buffer_.clear();
+
+  if (FLAGS_logger_fsync == "write") {
+    file_->sync();
+  }
+
+  if (FLAGS_logger_rotate_size > 0 && size_ >= FLAGS_logger_rotate_size) {
+    return rotate();
+  }
+  return Status(0, "OK");
+}
+
+fs::path FilesystemLogFile::getRotatedPath(size_t n, bool compressed) const {
+  auto path = path_.string() + "." + std::to_string(n);
+  return (compressed) ? path + ".gz" : path;
+}
+
+Status FilesystemLogFile::rotate() {
+  if (FLAGS_logger_fsync != "none") {
+    file_->sync();
+  }
+  file_.reset();
+
+  // Shift the rotated logs, the oldest is removed.
+  boost::system::error_code ec;
+  auto max_files = std::max<size_t>(FLAGS_logger_rotate_max_files, 1);
+  for (const auto compressed : {false, true}) {
+    fs::remove(getRotatedPath(max_files, compressed), ec);
+    for (size_t n = max_files - 1; n > 0; n--) {
+      auto older = getRotatedPath(n, compressed);
+      if (fs::exists(older, ec)) {
+        fs::rename(older, getRotatedPath(n + 1, compressed), ec);
+      }
+    }
+  }
+
+  auto rotated = getRotatedPath(1, false);
+  fs::rename(path_, rotated, ec);
+  if (ec) {
+    return Status(1, "Cannot rotate log: " + ec.message());
+  }
+
+  if (FLAGS_logger_rotate_compress) {
+    auto status = compressLogFile(rotated, getRotatedPath(1, true));
+    if (!status.ok()) {
+      LOG(WARNING) << status.getMessage();
+    }
+  }
+  return open();
+}
+
+/// Write results logs buffered for longer than the flush interval.
+class FilesystemLogFlusher : public InternalRunnable {
+ public:
+  explicit FilesystemLogFlusher(
+      std::vector<std::shared_ptr<FilesystemLogFile>> files)
+      : files_(std::move(files)) {}
+
+  void start() override {
+    while (!interrupted()) {
+      for (const auto& file : files_) {
+        file->flushExpired();
+      }
+      pauseMilli(1000);
+    }
+  }
+
+ private:
+  std::vector<std::shared_ptr<FilesystemLogFile>> files_;
+};
+
 class FilesystemLoggerPlugin : public LoggerPlugin {
  public:
   Status setUp() override;
 
+  /// Write the buffered results logs.
+  void tearDown() override;
+
   /// Log results (differential) to a distinct path.
   Status logString(const std::string& s) override;
 
@@ -59,18 +353,18 @@ class FilesystemLoggerPlugin : public LoggerPlugin {
   /// Write a status to Glog.
   Status logStatus(const std::vector<StatusLogLine>& log) override;
 
- private:
-  /// The plugin-internal filesystem writer method.
-  Status logStringToFile(const std::string& s,
-                         const std::string& filename,
-                         bool empty = false);
-
  private:
   /// The folder where Glog and the result/snapshot files are written.
   fs::path log_path_;
 
-  /// Filesystem writer mutex.
-  Mutex mutex_;
+  /// The results log.
+  std::shared_ptr<FilesystemLogFile> results_{nullptr};
+
+  /// The snapshots log.
+  std::shared_ptr<FilesystemLogFile> snapshots_{nullptr};
+
+  /// Writes buffered logs when the flush size is not reached in time.
+  std::shared_ptr<FilesystemLogFlusher> flusher_{nullptr};
 
  private:
   FRIEND_TEST(FilesystemLoggerTests, test_filesystem_init);
@@ -85,28 +379,46 @@ Status FilesystemLoggerPlugin::setUp() {
   // Glog 0.3.4 does not support a logfile mode.
   // FLAGS_logfile_mode = FLAGS_logger_mode;
 
+  tearDown();
+  results_ = std::make_shared<FilesystemLogFile>(log_path_ /
+                                                 kFilesystemLoggerFilename);
+  snapshots_ = std::make_shared<FilesystemLogFile>(log_path_ /
+                                                   kFilesystemLoggerSnapshots);
+  if (FLAGS_logger_flush_size > 0) {
+    flusher_ = std::make_shared<FilesystemLogFlusher>(
+        std::vector<std::shared_ptr<FilesystemLogFile>>{results_, snapshots_});
+    Dispatcher::addService(flusher_);
+  }
+
   // Ensure that we create the results log here.
-  return logStringToFile("", kFilesystemLoggerFilename, true);
+  return results_->create();
 }
 
-Status FilesystemLoggerPlugin::logString(const std::string& s) {
-  return logStringToFile(s, kFilesystemLoggerFilename);
+void FilesystemLoggerPlugin::tearDown() {
+  if (flusher_ != nullptr) {
+    flusher_->interrupt();
+    flusher_ = nullptr;
+  }
+
+  if (results_ != nullptr) {
+    results_->flush();
+  }
+
+  if (snapshots_ != nullptr) {
+    snapshots_->flush();
+  }
 }
 
-Status FilesystemLoggerPlugin::logStringToFile(const std::string& s,
-                                               const std::string& filename,
-                                               bool empty) {
-  WriteLock lock(mutex_);
-  Status status;
+Status FilesystemLoggerPlugin::logString(const std::string& s) {
+  if (results_ == nullptr) {
+    return Status(1, "Filesystem logger is not set up");
+  }
+
   try {
-    status = writeTextFile((log_path_ / filename).string(),
-                           (empty) ? "" : s + '\n',
-                           FLAGS_logger_mode,
-                           true);
+    return results_->append(s);
   } catch (const std::exception& e) {
     return Status(1, e.what());
   }
-  return status;
 }
 
 Status FilesystemLoggerPlugin::logStatus(
@@ -123,8 +435,16 @@ Status FilesystemLoggerPlugin::logStatus(
 }
 
 Status FilesystemLoggerPlugin::logSnapshot(const std::string& s) {
+  if (snapshots_ == nullptr) {
+    return Status(1, "Filesystem logger is not set up");
+  }
+
   // Send the snapshot data to a separate filename.
-  return logStringToFile(s, kFilesystemLoggerSnapshots);
+  try {
+    return snapshots_->append(s);
+  } catch (const std::exception& e) {
+    return Status(1, e.what());
+  }
 }
 
 void FilesystemLoggerPlugin::init(const std::string& name,
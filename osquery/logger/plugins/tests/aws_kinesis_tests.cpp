@@ -79,4 +79,36 @@ TEST_F(KinesisTests, test_send) {
       .WillOnce(Return(outcome));
   EXPECT_EQ(Status(1, "Foo error"), forwarder.send(logs, "results"));
 }
+
+TEST_F(KinesisTests, test_aggregate) {
+  KinesisLogForwarder forwarder;
+  forwarder.partition_key_ = "key";
+
+  std::vector<std::string> records;
+  forwarder.aggregate({"foo", "bar"}, records);
+  ASSERT_EQ(1U, records.size());
+
+  // The magic prefix, the partition key table, two records, and an MD5.
+  const auto& record = records[0];
+  ASSERT_EQ(43U, record.size());
+  EXPECT_EQ("\xF3\x89\x9A\xC2", record.substr(0, 4));
+  EXPECT_EQ("\x0A\x03key", record.substr(4, 5));
+  EXPECT_EQ(std::string("\x1A\x07\x08\x00\x1A\x03"
+                        "foo",
+                        9),
+            record.substr(9, 9));
+  EXPECT_EQ(std::string("\x1A\x07\x08\x00\x1A\x03"
+                        "bar",
+                        9),
+            record.substr(18, 9));
+
+  // Aggregated records are split at the Kinesis record size limit.
+  std::vector<std::string> logs(20, std::string(100000, 'A'));
+  records.clear();
+  forwarder.aggregate(logs, records);
+  ASSERT_EQ(3U, records.size());
+  for (const auto& aggregated : records) {
+    EXPECT_LE(aggregated.size(), 1000000U - 256);
+  }
+}
 }
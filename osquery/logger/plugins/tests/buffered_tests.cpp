@@ -30,6 +30,9 @@ namespace pt = boost::property_tree;
 namespace osquery {
 
 DECLARE_uint64(buffered_log_max);
+DECLARE_uint64(buffered_log_concurrency);
+DECLARE_uint64(buffered_log_latency);
+DECLARE_uint64(buffered_log_max_low);
 
 // Check that the string matches the StatusLogLine
 MATCHER_P(MatchesStatus, expected, "") {
@@ -77,8 +80,13 @@ class MockBufferedLogForwarder : public BufferedLogForwarder {
   FRIEND_TEST(BufferedLogForwarderTests, test_multiple);
   FRIEND_TEST(BufferedLogForwarderTests, test_async);
   FRIEND_TEST(BufferedLogForwarderTests, test_split);
+  FRIEND_TEST(BufferedLogForwarderTests, test_drain);
+  FRIEND_TEST(BufferedLogForwarderTests, test_concurrent);
+  FRIEND_TEST(BufferedLogForwarderTests, test_adapt_batch);
   FRIEND_TEST(BufferedLogForwarderTests, test_purge);
   FRIEND_TEST(BufferedLogForwarderTests, test_purge_max);
+  FRIEND_TEST(BufferedLogForwarderTests, test_priority);
+  FRIEND_TEST(BufferedLogForwarderTests, test_purge_priority);
 };
 
 TEST_F(BufferedLogForwarderTests, test_index) {
@@ -95,6 +103,14 @@ TEST_F(BufferedLogForwarderTests, test_index) {
   EXPECT_TRUE(runner.isStatusIndex(runner.genStatusIndex()));
   EXPECT_FALSE(runner.isStatusIndex(runner.genResultIndex()));
   EXPECT_FALSE(runner.isStatusIndex("foo"));
+
+  // Priority classes other than normal are marked in the index.
+  auto high = runner.genResultIndex(0, LogPriority::HIGH);
+  EXPECT_THAT(high, ContainsRegex("mock_h_r_[0-9]+_[0-9]+"));
+  EXPECT_TRUE(runner.isResultIndex(high));
+  EXPECT_EQ(LogPriority::HIGH, runner.getIndexPriority(high));
+  EXPECT_EQ(LogPriority::NORMAL,
+            runner.getIndexPriority(runner.genStatusIndex()));
 }
 
 TEST_F(BufferedLogForwarderTests, test_basic) {
@@ -270,6 +286,81 @@ TEST_F(BufferedLogForwarderTests, test_split) {
   runner2.check();
 }
 
+TEST_F(BufferedLogForwarderTests, test_drain) {
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 2);
+  runner.logString("foo");
+  runner.logString("bar");
+  runner.logString("baz");
+  runner.logStatus({makeStatusLogLine(O_INFO, "foo", 1, "foo")});
+
+  // A full set of lines was sent, so more may be buffered.
+  EXPECT_CALL(runner, send(ElementsAre("foo", "bar"), "result"))
+      .WillOnce(Return(Status(0)));
+  EXPECT_TRUE(runner.check());
+
+  // A failed send is not drained immediately.
+  EXPECT_CALL(runner, send(ElementsAre("baz"), "result"))
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner, send(_, "status")).WillOnce(Return(Status(1, "fail")));
+  EXPECT_FALSE(runner.check());
+
+  // The remaining status line is less than a full set.
+  EXPECT_CALL(runner, send(_, "status")).WillOnce(Return(Status(0)));
+  EXPECT_FALSE(runner.check());
+
+  // Every line was removed once sent.
+  EXPECT_FALSE(runner.check());
+}
+
+TEST_F(BufferedLogForwarderTests, test_concurrent) {
+  FLAGS_buffered_log_concurrency = 2;
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 1);
+  runner.logString("foo");
+  runner.logString("bar");
+  runner.logString("baz");
+
+  // Two batches are in flight, a failed batch is not removed.
+  EXPECT_CALL(runner, send(ElementsAre("foo"), "result"))
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner, send(ElementsAre("bar"), "result"))
+      .WillOnce(Return(Status(1, "fail")));
+  EXPECT_FALSE(runner.check());
+
+  EXPECT_CALL(runner, send(ElementsAre("bar"), "result"))
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner, send(ElementsAre("baz"), "result"))
+      .WillOnce(Return(Status(0)));
+  EXPECT_TRUE(runner.check());
+  EXPECT_FALSE(runner.check());
+
+  auto metrics = runner.getMetrics();
+  EXPECT_EQ(3U, metrics.lines);
+  EXPECT_EQ(3U, metrics.sends);
+  EXPECT_EQ(1U, metrics.failures);
+  FLAGS_buffered_log_concurrency = 1;
+}
+
+TEST_F(BufferedLogForwarderTests, test_adapt_batch) {
+  FLAGS_buffered_log_latency = 1;
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 4);
+  for (size_t i = 0; i < 6; i++) {
+    runner.logString(std::to_string(i));
+  }
+
+  // A send slower than the target halves the next batch.
+  EXPECT_CALL(runner, send(SizeIs(4), "result"))
+      .WillOnce(InvokeWithoutArgs([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return Status(0);
+      }));
+  EXPECT_TRUE(runner.check());
+  EXPECT_EQ(2U, runner.getMetrics().batch_lines);
+
+  EXPECT_CALL(runner, send(SizeIs(2), "result")).WillOnce(Return(Status(0)));
+  runner.check();
+  FLAGS_buffered_log_latency = 0;
+}
+
 // Test the purge() function independently of check()
 TEST_F(BufferedLogForwarderTests, test_purge) {
   FLAGS_buffered_log_max = 3;
@@ -340,4 +431,67 @@ TEST_F(BufferedLogForwarderTests, test_purge_max) {
 
   runner.check();
 }
+
+TEST_F(BufferedLogForwarderTests, test_priority) {
+  FLAGS_buffered_log_max = 0;
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 7);
+  ASSERT_TRUE(runner.setUp().ok());
+  size_t time = getUnixTime();
+  for (size_t i = 0; i < 10; ++i) {
+    runner.logString("n" + std::to_string(i), time + i);
+    LogPriorityScope low(LogPriority::LOW);
+    runner.logString("l" + std::to_string(i), time + i);
+  }
+  {
+    // Fresh results from an alerting pack arrive during the backlog.
+    LogPriorityScope high(LogPriority::HIGH);
+    runner.logString("h0", time + 10);
+    runner.logString("h1", time + 11);
+  }
+
+  // High priority lines are sent first, a backlog still drains low lines.
+  EXPECT_CALL(
+      runner,
+      send(ElementsAre("h0", "h1", "n0", "n1", "n2", "n3", "l0"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  EXPECT_CALL(
+      runner,
+      send(ElementsAre("n4", "n5", "n6", "n7", "n8", "n9", "l1"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  EXPECT_CALL(
+      runner,
+      send(ElementsAre("l2", "l3", "l4", "l5", "l6", "l7", "l8"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  EXPECT_CALL(runner, send(ElementsAre("l9"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  runner.check();
+}
+
+TEST_F(BufferedLogForwarderTests, test_purge_priority) {
+  FLAGS_buffered_log_max = 0;
+  FLAGS_buffered_log_max_low = 2;
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 100);
+  ASSERT_TRUE(runner.setUp().ok());
+  size_t time = getUnixTime();
+  runner.logString("n", time);
+  for (size_t i = 0; i < 5; ++i) {
+    LogPriorityScope low(LogPriority::LOW);
+    runner.logString("l" + std::to_string(i), time + i);
+  }
+
+  // Only the low priority class exceeds its limit.
+  runner.purge();
+  EXPECT_CALL(runner, send(ElementsAre("n", "l3", "l4"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  runner.check();
+  FLAGS_buffered_log_max_low = 1000000;
+}
 }
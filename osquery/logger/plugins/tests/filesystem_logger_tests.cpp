@@ -21,6 +21,9 @@ namespace fs = boost::filesystem;
 namespace osquery {
 
 DECLARE_string(logger_path);
+DECLARE_uint64(logger_flush_size);
+DECLARE_uint64(logger_rotate_size);
+DECLARE_uint64(logger_rotate_max_files);
 
 class FilesystemLoggerTests : public testing::Test {
  public:
@@ -101,4 +104,45 @@ TEST_F(FilesystemLoggerTests, test_log_snapshot) {
       "\"unixTime\":\"0\"}\n";
   EXPECT_EQ(content, expected);
 }
+
+TEST_F(FilesystemLoggerTests, test_buffered_rotation) {
+  auto plugin = Registry::get().plugin("logger", "filesystem");
+  auto logger = std::dynamic_pointer_cast<LoggerPlugin>(plugin);
+  ASSERT_NE(logger, nullptr);
+
+  auto logger_path = FLAGS_logger_path;
+  auto rotate_path = fs::path(logger_path) / "rotation";
+  fs::create_directories(rotate_path);
+  FLAGS_logger_path = rotate_path.string();
+  FLAGS_logger_flush_size = 32;
+  FLAGS_logger_rotate_size = 64;
+  FLAGS_logger_rotate_max_files = 2;
+  ASSERT_TRUE(plugin->setUp());
+
+  // Lines are held until the buffer is full.
+  auto results = rotate_path / "osqueryd.results.log";
+  EXPECT_TRUE(logger->callString("0123456789abcdef"));
+  std::string content;
+  EXPECT_TRUE(readFile(results, content));
+  EXPECT_TRUE(content.empty());
+  EXPECT_TRUE(logger->callString("0123456789abcdef"));
+  EXPECT_TRUE(readFile(results, content));
+  EXPECT_EQ(34U, content.size());
+
+  // Each 64 bytes written rotates the log, keeping two rotated logs.
+  for (size_t i = 0; i < 10; i++) {
+    EXPECT_TRUE(logger->callString("0123456789abcdef"));
+  }
+  plugin->tearDown();
+  EXPECT_TRUE(fs::exists(rotate_path / "osqueryd.results.log.1"));
+  EXPECT_TRUE(fs::exists(rotate_path / "osqueryd.results.log.2"));
+  EXPECT_FALSE(fs::exists(rotate_path / "osqueryd.results.log.3"));
+
+  FLAGS_logger_flush_size = 0;
+  FLAGS_logger_rotate_size = 0;
+  FLAGS_logger_rotate_max_files = 25;
+  FLAGS_logger_path = logger_path;
+  fs::remove_all(rotate_path);
+  EXPECT_TRUE(plugin->setUp());
+}
 }
@@ -39,7 +39,7 @@ FLAG(uint64,
      1 * 1024 * 1024,
      "Max size in bytes allowed per log line");
 
-FLAG(bool, logger_tls_compress, false, "GZip compress TLS/HTTPS request body");
+FLAG(bool, logger_tls_compress, false, "Compress TLS/HTTPS request body");
 
 REGISTER(TLSLoggerPlugin, "logger", "tls");
 
@@ -16,6 +16,7 @@
 namespace osquery {
 
 DECLARE_bool(logger_secondary_status_only);
+DECLARE_uint64(logger_snapshot_chunk_rows);
 
 class LoggerTests : public testing::Test {
  public:
@@ -29,6 +30,7 @@ class LoggerTests : public testing::Test {
     status_messages.clear();
     statuses_logged = 0;
     last_status = {O_INFO, "", -1, ""};
+    snapshot_lines.clear();
   }
 
   void TearDown() override {
@@ -48,6 +50,8 @@ class LoggerTests : public testing::Test {
   // Count added and removed snapshot rows
   static size_t snapshot_rows_added;
   static size_t snapshot_rows_removed;
+  // Track lines emitted to logSnapshot
+  static std::vector<std::string> snapshot_lines;
 
  private:
   /// Save the status of logging before running tests, restore afterward.
@@ -61,6 +65,7 @@ size_t LoggerTests::statuses_logged = 0;
 size_t LoggerTests::events_logged = 0;
 size_t LoggerTests::snapshot_rows_added = 0;
 size_t LoggerTests::snapshot_rows_removed = 0;
+std::vector<std::string> LoggerTests::snapshot_lines;
 
 inline void placeStatuses(const std::vector<StatusLogLine>& log) {
   for (const auto& status : log) {
@@ -106,6 +111,7 @@ class TestLoggerPlugin : public LoggerPlugin {
   Status logSnapshot(const std::string& s) override {
     LoggerTests::snapshot_rows_added += 1;
     LoggerTests::snapshot_rows_removed += 0;
+    LoggerTests::snapshot_lines.push_back(s);
     return Status(0, "OK");
   }
 
@@ -168,11 +174,26 @@ TEST_F(LoggerTests, test_log_string) {
 TEST_F(LoggerTests, test_logger_log_status) {
   // This will be printed to stdout.
   LOG(WARNING) << "Logger test is generating a warning status (2)";
+  flushStatusLogs();
 
   // The second warning status will be sent to the logger plugin.
   EXPECT_EQ(1U, LoggerTests::statuses_logged);
 }
 
+TEST_F(LoggerTests, test_logger_status_relay) {
+  for (size_t i = 0; i < 100; i++) {
+    LOG(WARNING) << "Logger test relay \"" << i << "\"";
+  }
+  flushStatusLogs();
+
+  // Forwarded status logs are relayed in the order they were logged.
+  ASSERT_EQ(100U, LoggerTests::status_messages.size());
+  for (size_t i = 0; i < 100; i++) {
+    EXPECT_EQ("Logger test relay \"" + std::to_string(i) + "\"",
+              LoggerTests::status_messages[i]);
+  }
+}
+
 TEST_F(LoggerTests, test_feature_request) {
   // Retrieve the test logger plugin.
   auto plugin = RegistryFactory::get().plugin("logger", "test");
@@ -201,6 +222,7 @@ TEST_F(LoggerTests, test_logger_variations) {
 
   // This will be printed to stdout.
   LOG(WARNING) << "Logger test is generating a warning status (3)";
+  flushStatusLogs();
 
   // Since the initLogger call triggered a failed init, meaning the logger
   // does NOT handle Glog logs, there will be no statuses logged.
@@ -223,6 +245,87 @@ TEST_F(LoggerTests, test_logger_snapshots) {
   EXPECT_EQ(1U, LoggerTests::snapshot_rows_added);
 }
 
+TEST_F(LoggerTests, test_logger_snapshot_stream) {
+  QueryLogItem item;
+  item.name = "test_query";
+  item.identifier = "unknown_test_host";
+  item.time = 0;
+  item.calendar_time = "no_time";
+  for (size_t i = 0; i < 5; i++) {
+    item.snapshot_results.push_back({{"test_column", std::to_string(i)}});
+  }
+
+  auto stream = [&item](size_t rows) {
+    SnapshotLogStream snapshot(item);
+    for (size_t i = 0; i < rows; i++) {
+      auto row = item.snapshot_results[i];
+      EXPECT_TRUE(snapshot.add(std::move(row)).ok());
+    }
+    EXPECT_EQ(rows, snapshot.rows());
+    return snapshot.finish();
+  };
+
+  // A streamed snapshot matches the line of logSnapshotQuery.
+  auto chunk_rows = FLAGS_logger_snapshot_chunk_rows;
+  FLAGS_logger_snapshot_chunk_rows = 0;
+  EXPECT_TRUE(stream(5).ok());
+  EXPECT_TRUE(logSnapshotQuery(item).ok());
+  ASSERT_EQ(2U, LoggerTests::snapshot_lines.size());
+  EXPECT_EQ(LoggerTests::snapshot_lines[1], LoggerTests::snapshot_lines[0]);
+
+  // Results that fit in one line have no part fields.
+  LoggerTests::snapshot_lines.clear();
+  FLAGS_logger_snapshot_chunk_rows = 5;
+  EXPECT_TRUE(stream(5).ok());
+  ASSERT_EQ(1U, LoggerTests::snapshot_lines.size());
+  EXPECT_EQ(std::string::npos,
+            LoggerTests::snapshot_lines[0].find("snapshotPart"));
+
+  // Larger results are logged as several lines.
+  LoggerTests::snapshot_lines.clear();
+  FLAGS_logger_snapshot_chunk_rows = 2;
+  EXPECT_TRUE(stream(5).ok());
+  ASSERT_EQ(3U, LoggerTests::snapshot_lines.size());
+  std::vector<size_t> sizes;
+  for (const auto& line : LoggerTests::snapshot_lines) {
+    QueryLogItem part;
+    EXPECT_TRUE(deserializeQueryLogItemJSON(line, part).ok());
+    EXPECT_EQ("test_query", part.name);
+    sizes.push_back(part.snapshot_results.size());
+  }
+  EXPECT_EQ(std::vector<size_t>({2, 2, 1}), sizes);
+  EXPECT_NE(std::string::npos,
+            LoggerTests::snapshot_lines[0].find("\"snapshotPart\":\"0\""));
+  EXPECT_EQ(std::string::npos,
+            LoggerTests::snapshot_lines[1].find("snapshotParts"));
+  EXPECT_NE(std::string::npos,
+            LoggerTests::snapshot_lines[2].find("\"snapshotParts\":\"3\""));
+
+  // A query that did not complete marks the last of its logged lines.
+  LoggerTests::snapshot_lines.clear();
+  {
+    SnapshotLogStream snapshot(item);
+    for (size_t i = 0; i < 3; i++) {
+      auto row = item.snapshot_results[i];
+      EXPECT_TRUE(snapshot.add(std::move(row)).ok());
+    }
+  }
+  ASSERT_EQ(2U, LoggerTests::snapshot_lines.size());
+  EXPECT_NE(std::string::npos,
+            LoggerTests::snapshot_lines[1].find("\"snapshotIncomplete\""));
+
+  // Without logged lines nothing is logged.
+  LoggerTests::snapshot_lines.clear();
+  {
+    SnapshotLogStream snapshot(item);
+    auto row = item.snapshot_results[0];
+    EXPECT_TRUE(snapshot.add(std::move(row)).ok());
+    snapshot.abort();
+  }
+  EXPECT_TRUE(LoggerTests::snapshot_lines.empty());
+  FLAGS_logger_snapshot_chunk_rows = chunk_rows;
+}
+
 class SecondTestLoggerPlugin : public LoggerPlugin {
  public:
   Status logString(const std::string& s) override {
@@ -257,6 +360,7 @@ TEST_F(LoggerTests, test_multiple_loggers) {
   EXPECT_EQ(2U, LoggerTests::log_lines.size());
 
   LOG(WARNING) << "Logger test is generating a warning status (4)";
+  flushStatusLogs();
   // Refer to the above notes about status logs not emitting until the logger
   // it initialized. We do a 0-test to check for dead locks around attempting
   // to forward Glog-based sinks recursively into our sinks.
@@ -265,6 +369,7 @@ TEST_F(LoggerTests, test_multiple_loggers) {
   // Now try to initialize multiple loggers (1) forwards, (2) does not.
   initLogger("logger_test");
   LOG(WARNING) << "Logger test is generating a warning status (5)";
+  flushStatusLogs();
   // Now that the "test" logger is initialized, the status log will be
   // forwarded.
   EXPECT_EQ(2U, LoggerTests::statuses_logged);
@@ -277,6 +382,7 @@ TEST_F(LoggerTests, test_multiple_loggers) {
   EXPECT_EQ(3U, LoggerTests::log_lines.size());
   // However, again, 2 status lines will be forwarded.
   LOG(WARNING) << "Logger test is generating another warning (6)";
+  flushStatusLogs();
   EXPECT_EQ(4U, LoggerTests::statuses_logged);
   FLAGS_logger_secondary_status_only = flag_default;
   logString("this is a third test", "added");
@@ -38,6 +38,11 @@ class NoneLoggerPlugin : public LoggerPlugin {
 REGISTER(NoneLoggerPlugin, "logger", "none");
 
 DECLARE_string(logger_plugin);
+
+#if !defined(KERNEL_TEST)
+/// Register a generate benchmark for each table, in table_benchmarks.cpp.
+void registerTableBenchmarks();
+#endif
 }
 
 int main(int argc, char *argv[]) {
@@ -49,6 +54,10 @@ int main(int argc, char *argv[]) {
   google::InitGoogleLogging(argv[0]);
 
   ::benchmark::Initialize(&argc, argv);
+#if !defined(KERNEL_TEST)
+  // Tables are only known once their plugins are registered.
+  osquery::registerTableBenchmarks();
+#endif
   ::benchmark::RunSpecifiedBenchmarks();
   return 0;
 }
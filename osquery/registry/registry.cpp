@@ -22,6 +22,8 @@
 #include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
 #include "osquery/core/process.h"
+#include "osquery/core/profiler.h"
+#include "osquery/core/tracing.h"
 
 namespace pt = boost::property_tree;
 
@@ -46,6 +48,7 @@ void RegistryInterface::remove(const std::string& item_name) {
   if (items_.count(item_name) > 0) {
     items_[item_name]->tearDown();
     items_.erase(item_name);
+    RegistryFactory::get().generation_++;
   }
 
   // Populate list of aliases to remove (those that mask item_name).
@@ -132,6 +135,11 @@ Status RegistryInterface::call(const std::string& item_name,
     // The item is a registered extension, call the extension by UUID.
     return callExtension(
         external_.at(item_name), name_, item_name, request, response);
+  } else if (cached_.count(item_name) > 0 &&
+             (request.count("action") == 0 ||
+              request.at("action") != "columns")) {
+    // Only the route info is known until the extension registers.
+    return Status(1, "Extension has not registered: " + item_name);
   } else if (routes_.count(item_name) > 0) {
     // The item has a route, but no extension, pass in the route info.
     response = routes_.at(item_name);
@@ -169,6 +177,7 @@ Status RegistryInterface::addPlugin(const std::string& plugin_name,
 
   plugin_item->setName(plugin_name);
   items_.emplace(std::make_pair(plugin_name, plugin_item));
+  RegistryFactory::get().generation_++;
 
   // The item can be listed as internal, meaning it does not broadcast.
   if (internal) {
@@ -224,6 +233,17 @@ Status RegistryInterface::addExternal(const RouteUUID& uuid,
                                       const RegistryRoutes& routes) {
   // Add each route name (item name) to the tracking.
   for (const auto& route : routes) {
+    if (cached_.count(route.first) > 0) {
+      cached_.erase(route.first);
+      if (routes_[route.first] == route.second) {
+        // The plugin was added with the same route info before registering.
+        external_[route.first] = uuid;
+        continue;
+      }
+      // The route info changed since it was remembered.
+      removeExternalPlugin(route.first);
+    }
+
     // Keep the routes info assigned to the registry.
     routes_[route.first] = route.second;
     auto status = addExternalPlugin(route.first, route.second);
@@ -235,6 +255,24 @@ Status RegistryInterface::addExternal(const RouteUUID& uuid,
   return Status(0, "OK");
 }
 
+void RegistryInterface::addCached(const RegistryRoutes& routes) {
+  for (const auto& route : routes) {
+    if (exists(route.first)) {
+      continue;
+    }
+
+    routes_[route.first] = route.second;
+    cached_.insert(route.first);
+    auto status = addExternalPlugin(route.first, route.second);
+    if (!status.ok()) {
+      VLOG(1) << "Cannot add cached " << name_ << " plugin " << route.first
+              << ": " << status.getMessage();
+      routes_.erase(route.first);
+      cached_.erase(route.first);
+    }
+  }
+}
+
 /// Remove all the routes for a given uuid.
 void RegistryInterface::removeExternal(const RouteUUID& uuid) {
   std::vector<std::string> removed_items;
@@ -321,7 +359,8 @@ Status RegistryFactory::addBroadcast(const RouteUUID& uuid,
   if (!allowDuplicates()) {
     for (const auto& registry : broadcast) {
       for (const auto& item : registry.second) {
-        if (exists(registry.first, item.first)) {
+        if (exists(registry.first, item.first) &&
+            !this->registry(registry.first)->isCached(item.first)) {
           VLOG(1) << "Extension " << uuid
                   << " has duplicate plugin name: " << item.first
                   << " in registry: " << registry.first;
@@ -374,6 +413,17 @@ Status RegistryFactory::removeBroadcast(const RouteUUID& uuid) {
   return Status(0, "OK");
 }
 
+Status RegistryFactory::addCachedBroadcast(const RegistryBroadcast& broadcast) {
+  WriteLock lock(mutex_);
+  for (const auto& registry : broadcast) {
+    if (!exists(registry.first)) {
+      return Status(1, "Unknown registry: " + registry.first);
+    }
+    this->registry(registry.first)->addCached(registry.second);
+  }
+  return Status(0, "OK");
+}
+
 /// Adds an alias for an internal registry item. This registry will only
 /// broadcast the alias name.
 Status RegistryFactory::addAlias(const std::string& registry_name,
@@ -394,21 +444,12 @@ std::string RegistryFactory::getAlias(const std::string& registry_name,
   return registries_.at(registry_name)->getAlias(alias);
 }
 
-Status RegistryFactory::call(const std::string& registry_name,
-                             const std::string& item_name,
-                             const PluginRequest& request,
-                             PluginResponse& response) {
-  // Forward factory call to the registry.
+/// Call a plugin, logging or rethrowing the exceptions it raises.
+static Status guardCall(const std::string& registry_name,
+                        const std::string& item_name,
+                        const std::function<Status()>& call) {
   try {
-    if (item_name.find(",") != std::string::npos) {
-      // Call is multiplexing plugins (usually for multiple loggers).
-      for (const auto& item : osquery::split(item_name, ",")) {
-        get().registry(registry_name)->call(item, request, response);
-      }
-      // All multiplexed items are called without regard for statuses.
-      return Status(0);
-    }
-    return get().registry(registry_name)->call(item_name, request, response);
+    return call();
   } catch (const std::exception& e) {
     LOG(ERROR) << registry_name << " registry " << item_name
                << " plugin caused exception: " << e.what();
@@ -426,6 +467,49 @@ Status RegistryFactory::call(const std::string& registry_name,
   }
 }
 
+Status RegistryFactory::call(const std::string& registry_name,
+                             const std::string& item_name,
+                             const PluginRequest& request,
+                             PluginResponse& response) {
+  // Forward factory call to the registry.
+  return guardCall(registry_name, item_name, [&]() {
+    if (item_name.find(",") != std::string::npos) {
+      // Call is multiplexing plugins (usually for multiple loggers).
+      for (const auto& item : osquery::split(item_name, ",")) {
+        get().registry(registry_name)->call(item, request, response);
+      }
+      // All multiplexed items are called without regard for statuses.
+      return Status(0);
+    }
+    return get().registry(registry_name)->call(item_name, request, response);
+  });
+}
+
+Status RegistryFactory::callPlugin(
+    const std::string& registry_name,
+    const std::string& item_name,
+    const std::function<Status(Plugin&)>& local,
+    const std::function<PluginRequest()>& envelope) {
+  if (item_name.find(",") != std::string::npos) {
+    for (const auto& item : osquery::split(item_name, ",")) {
+      callPlugin(registry_name, item, local, envelope);
+    }
+    return Status(0);
+  }
+
+  return guardCall(registry_name, item_name, [&]() {
+    const auto& items = get().registry(registry_name)->items_;
+    auto plugin = items.find(item_name);
+    if (plugin == items.end()) {
+      // Extension routing uses the request envelope.
+      PluginResponse response;
+      return get().registry(registry_name)->call(
+          item_name, envelope(), response);
+    }
+    return local(*plugin->second);
+  });
+}
+
 Status RegistryFactory::call(const std::string& registry_name,
                              const std::string& item_name,
                              const PluginRequest& request) {
@@ -454,7 +538,14 @@ Status RegistryFactory::callTable(const std::string& table_name,
   // This only works for local tables.
   if (tables.count(table_name) > 0) {
     auto plugin = std::dynamic_pointer_cast<TablePlugin>(tables.at(table_name));
-    response = plugin->generate(context);
+    context.concurrency = plugin->concurrency();
+    TRACE_PROBE1(table__start, table_name.c_str());
+    WorkerProfileScope profiled(WorkerProfileScope::TABLE, table_name);
+    // Tables in the warm set are generated ahead of distributed queries.
+    if (!plugin->getWarmCache(context, response)) {
+      response = plugin->generate(context);
+    }
+    TRACE_PROBE2(table__done, table_name.c_str(), response.size());
     return Status(0);
   } else {
     // If the table is not local then it does not benefit from complex contexts.
@@ -464,10 +555,38 @@ Status RegistryFactory::callTable(const std::string& table_name,
   }
 }
 
+Status RegistryFactory::callTable(const std::string& table_name,
+                                  QueryContext& context,
+                                  RowBatch& batch) {
+  auto& tables = get().registry("table")->items_;
+  if (tables.count(table_name) == 0) {
+    const auto& external = get().registry("table")->external_;
+    if (external.count(table_name) > 0) {
+      return callExtensionTable(
+          external.at(table_name), table_name, context, batch);
+    }
+    return Status(1, "Table is not local");
+  }
+
+  auto plugin = std::dynamic_pointer_cast<TablePlugin>(tables.at(table_name));
+  if (!plugin->usesBatch()) {
+    return Status(1, "Table does not generate batches");
+  }
+  batch.reset(plugin->columns());
+  context.concurrency = plugin->concurrency();
+  TRACE_PROBE1(table__start, table_name.c_str());
+  WorkerProfileScope profiled(WorkerProfileScope::TABLE, table_name);
+  plugin->generateBatch(batch, context);
+  TRACE_PROBE2(table__done, table_name.c_str(), batch.size());
+  return Status(0);
+}
+
 Status RegistryFactory::setActive(const std::string& registry_name,
                                   const std::string& item_name) {
   WriteLock lock(mutex_);
-  return registry(registry_name)->setActive(item_name);
+  auto status = registry(registry_name)->setActive(item_name);
+  generation_++;
+  return status;
 }
 
 std::string RegistryFactory::getActive(const std::string& registry_name) const {
@@ -236,6 +236,88 @@ TEST_F(RegistryTests, test_registry_api) {
   EXPECT_EQ(response[0].at("secret_power"), "magic");
 }
 
+TEST_F(RegistryTests, test_registry_call_local) {
+  TestCoreRegistry::get().add(
+      "local_widgets",
+      std::make_shared<RegistryType<WidgetPlugin>>("local_widgets"));
+  auto widgets = TestCoreRegistry::get().registry("local_widgets");
+  widgets->add("special", std::make_shared<SpecialWidget>());
+  widgets->add("other", std::make_shared<SpecialWidget>());
+
+  // Local plugins are called directly, the envelope is not built.
+  std::vector<std::string> called;
+  size_t envelopes = 0;
+  auto local = [&called](WidgetPlugin& plugin) {
+    called.push_back(plugin.getName());
+    return Status(0, "OK");
+  };
+  auto envelope = [&envelopes]() {
+    envelopes++;
+    return PluginRequest{{"secret_power", "magic"}};
+  };
+  auto status = TestCoreRegistry::callLocal<WidgetPlugin>(
+      "local_widgets", "special", local, envelope);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(std::vector<std::string>({"special"}), called);
+  EXPECT_EQ(0U, envelopes);
+
+  // Multiplexed items are each called.
+  called.clear();
+  status = TestCoreRegistry::callLocal<WidgetPlugin>(
+      "local_widgets", "special,other", local, envelope);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(std::vector<std::string>({"special", "other"}), called);
+
+  // Unknown items fall back to the envelope and the registry's routing.
+  called.clear();
+  status = TestCoreRegistry::callLocal<WidgetPlugin>(
+      "local_widgets", "does_not_exist", local, envelope);
+  EXPECT_FALSE(status.ok());
+  EXPECT_TRUE(called.empty());
+  EXPECT_EQ(1U, envelopes);
+}
+
+TEST_F(RegistryTests, test_registry_generation) {
+  auto& rf = TestCoreRegistry::get();
+  auto dog_registry = rf.registry("dog");
+
+  // Adding, activating, and removing items invalidate cached plugins.
+  auto generation = rf.generation();
+  dog_registry->add("generation", std::make_shared<DogPlugin>());
+  EXPECT_GT(rf.generation(), generation);
+
+  generation = rf.generation();
+  EXPECT_TRUE(rf.setActive("dog", "generation"));
+  EXPECT_GT(rf.generation(), generation);
+
+  generation = rf.generation();
+  dog_registry->remove("generation");
+  EXPECT_GT(rf.generation(), generation);
+}
+
+TEST_F(RegistryTests, test_cached_broadcast) {
+  auto& rf = TestCoreRegistry::get();
+  RegistryRoutes routes = {{"cached_dog", {{{"name", "value"}}}}};
+  EXPECT_TRUE(rf.addCachedBroadcast({{"dog", routes}}));
+  EXPECT_TRUE(rf.exists("dog", "cached_dog"));
+  EXPECT_TRUE(rf.registry("dog")->isCached("cached_dog"));
+
+  // The route info is available, other calls fail until registered.
+  PluginResponse response;
+  EXPECT_TRUE(rf.call("dog", "cached_dog", {{"action", "columns"}}, response));
+  EXPECT_EQ(routes.at("cached_dog"), response);
+  EXPECT_FALSE(rf.call("dog", "cached_dog", {{"action", "generate"}}));
+
+  // An extension registering the item replaces the cached route.
+  RouteUUID uuid = 1234;
+  EXPECT_TRUE(rf.addBroadcast(uuid, {{"dog", routes}}));
+  EXPECT_FALSE(rf.registry("dog")->isCached("cached_dog"));
+  EXPECT_EQ(uuid, rf.registry("dog")->getExternal().at("cached_dog"));
+
+  EXPECT_TRUE(rf.removeBroadcast(uuid));
+  EXPECT_FALSE(rf.exists("dog", "cached_dog"));
+}
+
 TEST_F(RegistryTests, test_real_registry) {
   EXPECT_TRUE(Registry::get().count() > 0U);
 
@@ -0,0 +1,189 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include <boost/algorithm/string.hpp>
+
+#include <osquery/core.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/core/metrics.h"
+#include "osquery/remote/endpoints.h"
+
+namespace osquery {
+
+CLI_FLAG(string,
+         tls_hostnames,
+         "",
+         "Comma-separated TLS/HTTPS hosts, nodes are sharded by identifier");
+
+FLAG(uint64,
+     tls_failover_backoff,
+     5,
+     "Seconds a TLS/HTTPS host is skipped after its first failed request");
+
+DECLARE_string(tls_hostname);
+
+/// The longest backoff for a failing host in seconds.
+const size_t kTLSMaxBackoff = 300;
+
+/// The health of a host.
+struct TLSEndpointHealth {
+  /// Consecutive requests that could not reach the host.
+  size_t failures{0};
+
+  /// The time the host may be tried again.
+  size_t retry{0};
+};
+
+static std::map<std::string, TLSEndpointHealth> kTLSEndpointHealth;
+
+static Mutex kTLSEndpointMutex;
+
+/// A well-mixed 64-bit FNV-1a of the identifier and host.
+static uint64_t getEndpointWeight(const std::string& identifier,
+                                  const std::string& host) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const auto& data : {identifier, host}) {
+    for (const auto& c : data) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 1099511628211ULL;
+    }
+    hash *= 1099511628211ULL;
+  }
+
+  // FNV-1a mixes poorly for strings sharing a prefix, finalize the bits.
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+std::vector<std::string> TLSEndpoints::hosts() {
+  std::vector<std::string> hosts;
+  if (FLAGS_tls_hostnames.empty()) {
+    hosts.push_back(FLAGS_tls_hostname);
+    return hosts;
+  }
+
+  std::vector<std::string> names;
+  boost::split(names, FLAGS_tls_hostnames, boost::is_any_of(","));
+  for (auto& name : names) {
+    boost::trim(name);
+    if (!name.empty() &&
+        std::find(hosts.begin(), hosts.end(), name) == hosts.end()) {
+      hosts.push_back(name);
+    }
+  }
+
+  if (hosts.empty()) {
+    hosts.push_back(FLAGS_tls_hostname);
+  }
+  return hosts;
+}
+
+std::vector<std::string> TLSEndpoints::order(const std::string& identifier) {
+  auto hosts = TLSEndpoints::hosts();
+  if (hosts.size() == 1) {
+    return hosts;
+  }
+
+  // Each host is weighted for the identifier, the heaviest is preferred.
+  using Weighted = std::pair<uint64_t, std::string>;
+  std::vector<Weighted> healthy;
+  std::vector<std::pair<size_t, std::string>> backoff;
+  auto now = getUnixTime();
+  {
+    ReadLock lock(kTLSEndpointMutex);
+    for (const auto& host : hosts) {
+      auto it = kTLSEndpointHealth.find(host);
+      if (it != kTLSEndpointHealth.end() && it->second.retry > now) {
+        backoff.push_back(std::make_pair(it->second.retry, host));
+      } else {
+        healthy.push_back(
+            std::make_pair(getEndpointWeight(identifier, host), host));
+      }
+    }
+  }
+
+  std::sort(healthy.begin(), healthy.end(), std::greater<Weighted>());
+  std::sort(backoff.begin(), backoff.end());
+
+  hosts.clear();
+  for (const auto& host : healthy) {
+    hosts.push_back(host.second);
+  }
+  for (const auto& host : backoff) {
+    hosts.push_back(host.second);
+  }
+  return hosts;
+}
+
+std::string TLSEndpoints::rewrite(const std::string& uri,
+                                  const std::string& host) {
+  auto prefix = "https://" + FLAGS_tls_hostname;
+  if (host == FLAGS_tls_hostname || uri.compare(0, prefix.size(), prefix)) {
+    return uri;
+  }
+
+  // Only replace a complete hostname, followed by a path or the end.
+  if (uri.size() > prefix.size() && uri[prefix.size()] != '/' &&
+      uri[prefix.size()] != '?') {
+    return uri;
+  }
+  return "https://" + host + uri.substr(prefix.size());
+}
+
+void TLSEndpoints::success(const std::string& host) {
+  WriteLock lock(kTLSEndpointMutex);
+  auto it = kTLSEndpointHealth.find(host);
+  if (it == kTLSEndpointHealth.end()) {
+    return;
+  }
+
+  if (it->second.failures > 0) {
+    LOG(INFO) << "TLS host recovered: " << host;
+  }
+  kTLSEndpointHealth.erase(it);
+}
+
+void TLSEndpoints::failure(const std::string& host) {
+  Metrics::counter("tls_endpoint_failures", "host=" + host).add();
+  if (FLAGS_tls_hostnames.empty()) {
+    return;
+  }
+
+  WriteLock lock(kTLSEndpointMutex);
+  auto& health = kTLSEndpointHealth[host];
+  health.failures++;
+  auto backoff = static_cast<size_t>(FLAGS_tls_failover_backoff);
+  for (size_t i = 1; i < health.failures && backoff < kTLSMaxBackoff; ++i) {
+    backoff *= 2;
+  }
+  backoff = std::min(backoff, kTLSMaxBackoff);
+  health.retry = getUnixTime() + backoff;
+  if (health.failures == 1) {
+    LOG(WARNING) << "TLS host failed, failing over for " << backoff
+                 << " seconds: " << host;
+  }
+}
+
+void TLSEndpoints::reset() {
+  WriteLock lock(kTLSEndpointMutex);
+  kTLSEndpointHealth.clear();
+}
+}
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/**
+ * @brief The TLS server hosts a node sends its requests to.
+ *
+ * By default every request is sent to `--tls_hostname`. When
+ * `--tls_hostnames` lists several backend nodes, each node chooses its
+ * preferred host by rendezvous hashing of its host identifier, so nodes
+ * spread evenly and adding or removing a host only moves the nodes that
+ * preferred it.
+ *
+ * Health is tracked passively. A host whose requests fail to connect, or
+ * time out, is skipped for a backoff that doubles with each consecutive
+ * failure. Requests fail over to the next host in the node's order. Once the
+ * backoff expires the next request checks the host again.
+ */
+class TLSEndpoints : private boost::noncopyable {
+ public:
+  /// The configured hosts, `--tls_hostname` if no list is set.
+  static std::vector<std::string> hosts();
+
+  /**
+   * @brief The hosts to try for a request, in order.
+   *
+   * Healthy hosts are ordered by preference for the identifier. Hosts in
+   * their backoff follow, soonest to recover first, as a last resort.
+   *
+   * @param identifier The node's host identifier.
+   */
+  static std::vector<std::string> order(const std::string& identifier);
+
+  /// Replace the host of a "https://" URI built with `--tls_hostname`.
+  static std::string rewrite(const std::string& uri, const std::string& host);
+
+  /// Record a request that reached the host.
+  static void success(const std::string& host);
+
+  /// Record a request that could not reach the host.
+  static void failure(const std::string& host);
+
+  /// Testing only, forget the health of every host.
+  static void reset();
+};
+}
@@ -12,6 +12,7 @@
 #include <osquery/filesystem.h>
 #include <osquery/system.h>
 
+#include "osquery/remote/endpoints.h"
 #include "osquery/remote/requests.h"
 #include "osquery/remote/serializers/json.h"
 #include "osquery/remote/transports/tls.h"
@@ -87,16 +88,23 @@ Status TLSEnrollPlugin::requestKey(const std::string& uri,
   params.put<std::string>(FLAGS_tls_enroll_override, getEnrollSecret());
   params.put<std::string>("host_identifier", getHostIdentifier());
 
-  auto request = Request<TLSTransport, JSONSerializer>(uri);
-  request.setOption("hostname", FLAGS_tls_hostname);
-  auto status = request.call(params);
-  if (!status.ok()) {
-    return status;
+  // Enrollment fails over between hosts like TLSRequestHelper::go.
+  Status status;
+  boost::property_tree::ptree recv;
+  for (const auto& host : TLSEndpoints::order(getHostIdentifier())) {
+    auto request = Request<TLSTransport, JSONSerializer>(
+        TLSEndpoints::rewrite(uri, host));
+    request.setOption("hostname", host);
+    status = request.call(params);
+    if (status.ok()) {
+      TLSEndpoints::success(host);
+      status = request.getResponse(recv);
+      break;
+    }
+    TLSEndpoints::failure(host);
   }
 
   // The call succeeded, store the node secret key (the enrollment response).
-  boost::property_tree::ptree recv;
-  status = request.getResponse(recv);
   if (!status.ok()) {
     return status;
   }
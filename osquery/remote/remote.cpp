@@ -9,16 +9,29 @@
  */
 
 #include <string>
+#include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include <zlib.h>
 
+#ifndef WIN32
+#include <lz4frame.h>
+#endif
+
+#include <boost/algorithm/string.hpp>
+
+#include "osquery/remote/requests.h"
+
 namespace osquery {
 
 #define MOD_GZIP_ZLIB_WINDOWSIZE 15
 #define MOD_GZIP_ZLIB_CFACTOR 9
 
-std::string compressString(const std::string& data) {
+const std::string kEncodingGzip{"gzip"};
+const std::string kEncodingLZ4{"lz4"};
+
+static std::string compressGzip(const std::string& data) {
   z_stream zs;
   memset(&zs, 0, sizeof(zs));
 
@@ -41,7 +54,7 @@ std::string compressString(const std::string& data) {
     char buffer[16384] = {0};
     while (ret == Z_OK) {
       zs.next_out = reinterpret_cast<Bytef*>(buffer);
-      zs.avail_out = sizeof(output);
+      zs.avail_out = sizeof(buffer);
 
       ret = deflate(&zs, Z_FINISH);
       if (output.size() < zs.total_out) {
@@ -57,4 +70,74 @@ std::string compressString(const std::string& data) {
 
   return output;
 }
+
+#ifndef WIN32
+static std::string compressLZ4(const std::string& data) {
+  LZ4F_preferences_t preferences;
+  memset(&preferences, 0, sizeof(preferences));
+  preferences.frameInfo.contentSize = data.size();
+
+  std::string output;
+  output.resize(LZ4F_compressFrameBound(data.size(), &preferences));
+  auto size = LZ4F_compressFrame(
+      &output[0], output.size(), data.data(), data.size(), &preferences);
+  if (LZ4F_isError(size)) {
+    return std::string();
+  }
+
+  output.resize(size);
+  return output;
+}
+#endif
+
+std::string compressString(const std::string& data,
+                           const std::string& encoding) {
+  if (encoding == kEncodingGzip) {
+    return compressGzip(data);
+  }
+#ifndef WIN32
+  if (encoding == kEncodingLZ4) {
+    return compressLZ4(data);
+  }
+#endif
+  return std::string();
+}
+
+bool isEncodingSupported(const std::string& encoding) {
+#ifndef WIN32
+  if (encoding == kEncodingLZ4) {
+    return true;
+  }
+#endif
+  return encoding == kEncodingGzip;
+}
+
+std::string negotiateEncoding(const std::string& preferred,
+                              const std::string& accepted) {
+  if (preferred == kEncodingGzip || !isEncodingSupported(preferred)) {
+    return kEncodingGzip;
+  }
+
+  // Each coding may include a weight, and a weight of 0 rejects the coding.
+  std::vector<std::string> codings;
+  boost::split(codings, accepted, boost::is_any_of(","));
+  for (const auto& item : codings) {
+    std::vector<std::string> parts;
+    boost::split(parts, item, boost::is_any_of(";"));
+    auto coding = boost::algorithm::to_lower_copy(boost::trim_copy(parts[0]));
+    if (coding != preferred) {
+      continue;
+    }
+
+    bool rejected = false;
+    for (size_t i = 1; i < parts.size(); ++i) {
+      auto weight = boost::trim_copy(parts[i]);
+      if (weight.size() > 2 && weight.compare(0, 2, "q=") == 0) {
+        rejected = (std::strtod(weight.c_str() + 2, nullptr) <= 0.0);
+      }
+    }
+    return (rejected) ? kEncodingGzip : preferred;
+  }
+  return kEncodingGzip;
+}
 }
@@ -23,16 +23,40 @@ namespace osquery {
 
 class Serializer;
 
+/// The default request body encoding, used unless a server accepts another.
+extern const std::string kEncodingGzip;
+
+/// An LZ4 frame encoding, much faster than GZip for repetitive JSON.
+extern const std::string kEncodingLZ4;
+
 /**
- * @brief Compress data using GZip.
+ * @brief Compress data using GZip, or another supported encoding.
  *
  * Requests API callers may request data be compressed before sending.
  * The compression step occurs after serialization, immediately before the
  * transport call.
  *
  * @param data The input/output mutable container.
+ * @param encoding The content encoding, an empty result if unsupported.
+ */
+std::string compressString(const std::string& data,
+                           const std::string& encoding = kEncodingGzip);
+
+/// Check if compressString supports a content encoding on this platform.
+bool isEncodingSupported(const std::string& encoding);
+
+/**
+ * @brief Choose the request body encoding for a server.
+ *
+ * A server advertises the request content encodings it accepts with an
+ * Accept-Encoding response header. The preferred encoding is used if it is
+ * supported and accepted, otherwise requests fall back to GZip.
+ *
+ * @param preferred The configured encoding.
+ * @param accepted The server's most recent Accept-Encoding header value.
  */
-std::string compressString(const std::string& data);
+std::string negotiateEncoding(const std::string& preferred,
+                              const std::string& accepted);
 
 /**
  * @brief Abstract base class for remote transport implementations
@@ -17,13 +17,10 @@ namespace osquery {
 
 Status JSONSerializer::serialize(const pt::ptree& params,
                                  std::string& serialized) {
-  std::ostringstream output;
-  try {
-    pt::write_json(output, params, false);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, std::string("JSON serialize error: ") + e.what());
-  }
-  serialized = output.str();
+  serialized.clear();
+  JSONWriter writer(serialized);
+  writer.tree(params);
+  serialized += '\n';
   return Status(0, "OK");
 }
 
@@ -36,12 +33,9 @@ Status JSONSerializer::deserialize(const std::string& serialized,
     params = pt::ptree();
     return Status(0, "OK");
   }
-  try {
-    std::stringstream input;
-    input << serialized;
-    pt::read_json(input, params);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, std::string("JSON deserialize error: ") + e.what());
+  auto status = parseJSONTree(serialized, params);
+  if (!status.ok()) {
+    return Status(1, "JSON deserialize error: " + status.getMessage());
   }
   return Status(0, "OK");
 }
@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/remote/endpoints.h"
+
+namespace osquery {
+
+DECLARE_string(tls_hostname);
+DECLARE_string(tls_hostnames);
+
+class EndpointsTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    hostname_ = FLAGS_tls_hostname;
+    hostnames_ = FLAGS_tls_hostnames;
+    FLAGS_tls_hostname = "primary:443";
+    FLAGS_tls_hostnames = "";
+    TLSEndpoints::reset();
+  }
+
+  void TearDown() override {
+    TLSEndpoints::reset();
+    FLAGS_tls_hostname = hostname_;
+    FLAGS_tls_hostnames = hostnames_;
+  }
+
+ private:
+  std::string hostname_;
+  std::string hostnames_;
+};
+
+TEST_F(EndpointsTests, test_hosts) {
+  auto hosts = TLSEndpoints::hosts();
+  ASSERT_EQ(1U, hosts.size());
+  EXPECT_EQ("primary:443", hosts[0]);
+
+  FLAGS_tls_hostnames = "a:443, b:443,,a:443";
+  hosts = TLSEndpoints::hosts();
+  ASSERT_EQ(2U, hosts.size());
+  EXPECT_EQ("a:443", hosts[0]);
+  EXPECT_EQ("b:443", hosts[1]);
+}
+
+TEST_F(EndpointsTests, test_rewrite) {
+  EXPECT_EQ("https://a:443/log",
+            TLSEndpoints::rewrite("https://primary:443/log", "a:443"));
+  EXPECT_EQ("https://a:443?x=1",
+            TLSEndpoints::rewrite("https://primary:443?x=1", "a:443"));
+  EXPECT_EQ("https://primary:4430/log",
+            TLSEndpoints::rewrite("https://primary:4430/log", "a:443"));
+  EXPECT_EQ("https://other/log",
+            TLSEndpoints::rewrite("https://other/log", "a:443"));
+}
+
+TEST_F(EndpointsTests, test_order) {
+  FLAGS_tls_hostnames = "a:443,b:443,c:443,d:443";
+
+  // Identifiers spread across the hosts and keep their preference.
+  std::map<std::string, size_t> preferred;
+  for (size_t i = 0; i < 400; ++i) {
+    auto identifier = "node" + std::to_string(i);
+    auto order = TLSEndpoints::order(identifier);
+    ASSERT_EQ(4U, order.size());
+    EXPECT_EQ(order, TLSEndpoints::order(identifier));
+    preferred[order[0]]++;
+  }
+  ASSERT_EQ(4U, preferred.size());
+  for (const auto& host : preferred) {
+    EXPECT_GT(host.second, 50U);
+  }
+
+  // Adding a host only moves the identifiers that now prefer it.
+  auto order = TLSEndpoints::order("node1");
+  FLAGS_tls_hostnames = "a:443,b:443,c:443,d:443,e:443";
+  auto added = TLSEndpoints::order("node1");
+  if (added[0] != "e:443") {
+    EXPECT_EQ(order[0], added[0]);
+  }
+
+  // A failed host is tried last until its backoff expires.
+  auto first = added[0];
+  TLSEndpoints::failure(first);
+  order = TLSEndpoints::order("node1");
+  EXPECT_NE(first, order[0]);
+  EXPECT_EQ(first, order.back());
+  EXPECT_EQ(added[1], order[0]);
+
+  TLSEndpoints::success(first);
+  EXPECT_EQ(first, TLSEndpoints::order("node1")[0]);
+}
+}
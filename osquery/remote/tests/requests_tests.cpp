@@ -154,4 +154,37 @@ TEST_F(RequestsTests, test_compression) {
   EXPECT_EQ(compressed, expected);
   EXPECT_LT(compressed.size(), uncompressed.size());
 }
+
+TEST_F(RequestsTests, test_negotiate_encoding) {
+  // GZip is used unless the server accepts the preferred encoding.
+  EXPECT_EQ(kEncodingGzip, negotiateEncoding(kEncodingGzip, "lz4"));
+  EXPECT_EQ(kEncodingGzip, negotiateEncoding(kEncodingLZ4, ""));
+  EXPECT_EQ(kEncodingGzip, negotiateEncoding(kEncodingLZ4, "gzip, br"));
+  EXPECT_EQ(kEncodingGzip, negotiateEncoding(kEncodingLZ4, "gzip, lz4;q=0"));
+  EXPECT_EQ(kEncodingGzip, negotiateEncoding("zstd", "zstd"));
+  if (!isPlatform(PlatformType::TYPE_WINDOWS)) {
+    EXPECT_EQ(kEncodingLZ4, negotiateEncoding(kEncodingLZ4, "gzip, LZ4"));
+    EXPECT_EQ(kEncodingLZ4, negotiateEncoding(kEncodingLZ4, "lz4;q=0.5"));
+  }
+}
+
+TEST_F(RequestsTests, test_lz4_compression) {
+  if (!isEncodingSupported(kEncodingLZ4)) {
+    return;
+  }
+
+  std::string uncompressed = "stringstringstringstring";
+  for (size_t i = 0; i < 10; i++) {
+    uncompressed += uncompressed;
+  }
+
+  // The output is an LZ4 frame, starting with the frame magic number.
+  auto compressed = compressString(uncompressed, kEncodingLZ4);
+  ASSERT_GT(compressed.size(), 4U);
+  EXPECT_EQ(std::string("\x04\x22\x4D\x18", 4), compressed.substr(0, 4));
+  EXPECT_LT(compressed.size(), uncompressed.size() / 10);
+
+  // Unknown encodings are not compressed.
+  EXPECT_TRUE(compressString(uncompressed, "zstd").empty());
+}
 }
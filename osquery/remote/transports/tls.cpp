@@ -13,6 +13,9 @@
 #include "osquery/remote/transports/tls.h"
 // clang-format on
 
+#include <map>
+
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 
 #include <osquery/core.h>
@@ -61,11 +64,41 @@ HIDDEN_FLAG(bool,
 
 HIDDEN_FLAG(bool, tls_dump, false, "Print remote requests and responses");
 
+/// Share HTTP clients between requests with the same TLS options.
+FLAG(bool,
+     tls_reuse_clients,
+     true,
+     "Reuse TLS/HTTPS clients across Config, Logger, and Enroll requests");
+
+/// Preferred request body encoding, used if accepted by the server.
+FLAG(string,
+     tls_compression,
+     "gzip",
+     "Compressed TLS/HTTPS request body encoding if accepted (gzip, lz4)");
+
 /// Undocumented feature to override TLS endpoints.
 HIDDEN_FLAG(bool, tls_node_api, false, "Use node key as TLS endpoints");
 
 DECLARE_bool(verbose);
 
+/// The Accept-Encoding header value most recently returned by each server.
+static std::map<std::string, std::string> kAcceptedEncodings;
+
+/// Access to the accepted encodings from concurrent requests.
+static Mutex kAcceptedEncodingsMutex;
+
+/// HTTP clients shared between requests, keyed by their TLS options.
+static std::map<std::string, http::client> kTLSClients;
+
+/// Access to the shared clients from concurrent requests.
+static Mutex kTLSClientsMutex;
+
+/// The HTTP status returned when a server rejects a request encoding.
+const uint16_t kUnsupportedMediaType = 415;
+
+/// Seconds to wait on a server unless a request sets a "timeout" option.
+const size_t kTLSRequestTimeout = 16;
+
 TLSTransport::TLSTransport() : verify_peer_(true) {
   if (FLAGS_tls_server_certs.size() > 0) {
     server_certificate_file_ = FLAGS_tls_server_certs;
@@ -81,13 +114,82 @@ void TLSTransport::decorateRequest(http::client::request& r) {
   r << boost::network::header("Connection", "close");
   r << boost::network::header("Content-Type", serializer_->getContentType());
   r << boost::network::header("Accept", serializer_->getContentType());
-  r << boost::network::header("Host", FLAGS_tls_hostname);
+  r << boost::network::header(
+      "Host", options_.get<std::string>("hostname", FLAGS_tls_hostname));
   r << boost::network::header("User-Agent", kTLSUserAgentBase + kVersion);
 }
 
+void TLSTransport::readAcceptedEncodings() {
+  auto host = options_.get<std::string>("hostname", FLAGS_tls_hostname);
+  for (const auto& header : response_.headers()) {
+    if (boost::iequals(header.first, "Accept-Encoding")) {
+      WriteLock lock(kAcceptedEncodingsMutex);
+      kAcceptedEncodings[host] = header.second;
+      return;
+    }
+  }
+
+  // A server that rejected an encoding falls back to GZip for retries.
+  if (static_cast<uint16_t>(status(response_)) == kUnsupportedMediaType) {
+    WriteLock lock(kAcceptedEncodingsMutex);
+    kAcceptedEncodings.erase(host);
+  }
+}
+
+std::string TLSTransport::getRequestEncoding() {
+  auto host = options_.get<std::string>("hostname", FLAGS_tls_hostname);
+  std::string accepted;
+  {
+    ReadLock lock(kAcceptedEncodingsMutex);
+    auto it = kAcceptedEncodings.find(host);
+    if (it != kAcceptedEncodings.end()) {
+      accepted = it->second;
+    }
+  }
+  return negotiateEncoding(FLAGS_tls_compression, accepted);
+}
+
+std::string TLSTransport::getClientKey() {
+  // A certificate that becomes readable, or unreadable, builds a new client.
+  auto file_key = [](const std::string& path) {
+    if (path.empty()) {
+      return std::string(":");
+    }
+    return path + ((isReadable(path).ok()) ? ":r" : ":u");
+  };
+
+  std::string key = (verify_peer_) ? "v|" : "n|";
+#if defined(DEBUG)
+  key += (FLAGS_tls_allow_unsafe) ? "a|" : "s|";
+#endif
+  key += file_key(server_certificate_file_) + "|";
+  key += file_key(client_certificate_file_) + "|";
+  key += file_key(client_private_key_file_) + "|";
+  key += options_.get<std::string>("hostname", "") + "|";
+  key += std::to_string(options_.get<size_t>("timeout", kTLSRequestTimeout));
+  return key;
+}
+
 http::client TLSTransport::getClient() {
+  if (!FLAGS_tls_reuse_clients) {
+    return makeClient();
+  }
+
+  // Copies of a client share its connection state and IO service.
+  auto key = getClientKey();
+  WriteLock lock(kTLSClientsMutex);
+  auto it = kTLSClients.find(key);
+  if (it == kTLSClients.end()) {
+    it = kTLSClients.insert(std::make_pair(key, makeClient())).first;
+  }
+  return it->second;
+}
+
+http::client TLSTransport::makeClient() {
   http::client::options options;
-  options.follow_redirects(true).always_verify_peer(verify_peer_).timeout(16);
+  options.follow_redirects(true)
+      .always_verify_peer(verify_peer_)
+      .timeout(options_.get<size_t>("timeout", kTLSRequestTimeout));
 
   std::string ciphers = kTLSCiphers;
   if (!isPlatform(PlatformType::TYPE_OSX)) {
@@ -170,6 +272,7 @@ Status TLSTransport::sendRequest() {
   VLOG(1) << "TLS/HTTPS GET request to URI: " << destination_;
   try {
     response_ = client.get(r);
+    readAcceptedEncodings();
     const auto& response_body = body(response_);
     if (FLAGS_verbose && FLAGS_tls_dump) {
       fprintf(stdout, "%s\n", std::string(response_body).c_str());
@@ -191,9 +294,11 @@ Status TLSTransport::sendRequest(const std::string& params, bool compress) {
   auto client = getClient();
   http::client::request r(destination_);
   decorateRequest(r);
+  std::string encoding;
   if (compress) {
     // Later, when posting/putting, the data will be optionally compressed.
-    r << boost::network::header("Content-Encoding", "gzip");
+    encoding = getRequestEncoding();
+    r << boost::network::header("Content-Encoding", encoding);
   }
 
   // Allow request calls to override the default HTTP POST verb.
@@ -210,11 +315,14 @@ Status TLSTransport::sendRequest(const std::string& params, bool compress) {
 
   try {
     if (verb == HTTP_POST) {
-      response_ = client.post(r, (compress) ? compressString(params) : params);
+      response_ = client.post(
+          r, (compress) ? compressString(params, encoding) : params);
     } else {
-      response_ = client.put(r, (compress) ? compressString(params) : params);
+      response_ = client.put(
+          r, (compress) ? compressString(params, encoding) : params);
     }
 
+    readAcceptedEncodings();
     const auto& response_body = body(response_);
     if (FLAGS_verbose && FLAGS_tls_dump) {
       fprintf(stdout, "%s\n", std::string(response_body).c_str());
@@ -93,6 +93,9 @@ DECLARE_string(tls_client_cert);
 /// TLS server hostname.
 DECLARE_string(tls_hostname);
 
+/// Preferred request body encoding, used if accepted by the server.
+DECLARE_string(tls_compression);
+
 /**
  * @brief HTTP verb selections.
  */
@@ -134,8 +137,21 @@ class TLSTransport : public Transport {
  public:
   TLSTransport();
 
+  /**
+   * @brief Get an HTTP client for the transport's TLS options.
+   *
+   * Clients, and their IO service threads, are shared by every transport
+   * with the same certificates, peer verification, and SNI hostname.
+   */
   boost::network::http::client getClient();
 
+ private:
+  /// Create an HTTP client for the transport's TLS options.
+  boost::network::http::client makeClient();
+
+  /// A key for the options used to create a client.
+  std::string getClientKey();
+
  private:
   /// Testing-only, disable peer verification.
   void disableVerifyPeer() {
@@ -175,6 +191,12 @@ class TLSTransport : public Transport {
     */
   void decorateRequest(boost::network::http::client::request& r);
 
+  /// Remember the request encodings the server accepts from its response.
+  void readAcceptedEncodings();
+
+  /// The encoding used for compressed request bodies sent to the server.
+  std::string getRequestEncoding();
+
  protected:
   /// Storage for the HTTP response object
   boost::network::http::client::response response_;
@@ -12,7 +12,9 @@
 
 #include <osquery/enroll.h>
 #include <osquery/flags.h>
+#include <osquery/system.h>
 
+#include "osquery/remote/endpoints.h"
 #include "osquery/remote/requests.h"
 #include "osquery/remote/transports/tls.h"
 
@@ -77,6 +79,30 @@ class TLSRequestHelper : private boost::noncopyable {
   static Status go(const std::string& uri,
                    boost::property_tree::ptree& params,
                    boost::property_tree::ptree& output) {
+    // Fail over to the node's next host when a host cannot be reached.
+    Status status;
+    for (const auto& host : TLSEndpoints::order(getHostIdentifier())) {
+      bool reached = false;
+      output.clear();
+      status = goHost<TSerializer>(
+          TLSEndpoints::rewrite(uri, host), host, params, output, reached);
+      if (reached) {
+        TLSEndpoints::success(host);
+        break;
+      }
+      TLSEndpoints::failure(host);
+    }
+    return status;
+  }
+
+ private:
+  /// Send a TLS request to a single host, see TLSRequestHelper::go.
+  template <class TSerializer>
+  static Status goHost(const std::string& uri,
+                       const std::string& host,
+                       boost::property_tree::ptree& params,
+                       boost::property_tree::ptree& output,
+                       bool& reached) {
     auto node_key = getNodeKey("tls");
 
     // If using a GET request, append the node_key to the URI variables.
@@ -89,7 +115,15 @@ class TLSRequestHelper : private boost::noncopyable {
 
     // Again check for GET to call with/without parameters.
     auto request = Request<TLSTransport, TSerializer>(uri + uri_suffix);
-    request.setOption("hostname", FLAGS_tls_hostname);
+    request.setOption("hostname", host);
+
+    // A long-polling caller waits on the server longer than a request would.
+    size_t timeout = 0;
+    if (params.count("_timeout")) {
+      timeout = params.get<size_t>("_timeout", 0);
+      request.setOption("timeout", timeout);
+      params.erase("_timeout");
+    }
 
     bool compress = false;
     if (params.count("_compress")) {
@@ -113,7 +147,11 @@ class TLSRequestHelper : private boost::noncopyable {
     bool should_post = (use_post || force_post);
     auto status = (should_post) ? request.call(params) : request.call();
 
-    // Restore caller-supplied parameters.
+    // Restore caller-supplied parameters, a failover host needs them too.
+    if (!use_post) {
+      params.put("_get", true);
+    }
+
     if (force_post) {
       params.put("_verb", "POST");
     }
@@ -122,9 +160,14 @@ class TLSRequestHelper : private boost::noncopyable {
       params.put("_compress", true);
     }
 
+    if (timeout > 0) {
+      params.put("_timeout", timeout);
+    }
+
     if (!status.ok()) {
       return status;
     }
+    reached = true;
 
     // The call succeeded, store the enrolled key.
     status = request.getResponse(output);
@@ -155,6 +198,7 @@ class TLSRequestHelper : private boost::noncopyable {
     return Status(0, "OK");
   }
 
+ public:
   /**
    * @brief Send a TLS request
    *
@@ -243,6 +287,38 @@ class TLSRequestHelper : private boost::noncopyable {
     return s;
   }
 
+  /**
+   * @brief Send a TLS request
+   *
+   * @param uri is the URI to send the request to
+   * @param params is a ptree of the params to send to the server. This isn't
+   * const because it will be modified to include node_key.
+   * @param output is the ptree which will be populated with the deserialized
+   * results
+   * @param attempts is the number of attempts to make if the request fails
+   *
+   * @return a Status object indicating the success or failure of the operation
+   */
+  template <class TSerializer>
+  static Status go(const std::string& uri,
+                   boost::property_tree::ptree& params,
+                   boost::property_tree::ptree& output,
+                   const size_t attempts) {
+    Status s;
+    for (size_t i = 1; i <= attempts; i++) {
+      output.clear();
+      s = TLSRequestHelper::go<TSerializer>(uri, params, output);
+      if (s.ok()) {
+        return s;
+      }
+      if (i == attempts) {
+        break;
+      }
+      sleepFor(i * i * 1000);
+    }
+    return s;
+  }
+
   /**
    * @brief Send a TLS request
    *
@@ -0,0 +1,454 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#ifndef WIN32
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <set>
+#include <vector>
+
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/filesystem.hpp>
+
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/registry.h>
+
+#include "osquery/sql/attach.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+FLAG(uint64,
+     attached_database_refresh,
+     60,
+     "Seconds between checks of attached databases for changes");
+
+DECLARE_uint64(read_max);
+
+const std::string kAttachedSchemaPlaceholder{"{{db}}"};
+
+/// Attached schemas are named with this prefix, then the view and an index.
+const std::string kAttachedSchemaPrefix{"attached_"};
+
+/// A copy of a matching database file.
+struct AttachedDatabaseCopy {
+  /// The application's database file.
+  std::string path;
+
+  /// The identity of the file and its write-ahead log when copied.
+  std::string identity;
+
+  /// The private copy attached to connections.
+  std::string copy;
+};
+
+/// Protect the sources and copies.
+static Mutex kAttachedMutex;
+
+/// The configured sources by view name.
+static std::map<std::string, AttachedDatabaseSource> kAttachedSources;
+
+/// The copies of each source's matching files.
+static std::map<std::string, std::vector<AttachedDatabaseCopy>> kAttachedCopies;
+
+/// Every view name created, so removed sources are dropped.
+static std::set<std::string> kAttachedViews;
+
+/// Incremented when the copies or sources change.
+static size_t kAttachedGeneration{1};
+
+/// When the source files were last checked, 0 forces a check.
+static size_t kAttachedChecked{0};
+
+/// Incremented for each copy, a copy is never replaced while attached.
+static size_t kAttachedCopyIndex{0};
+
+/// The generation that attached more copies than a connection allows.
+static size_t kAttachedLimitWarned{0};
+
+/// The directory of private copies, created by this process.
+static std::string kAttachedDirectory;
+
+/// Check that a directory is owned by this process's user and private.
+static bool isPrivateDirectory(const std::string& path) {
+#ifndef WIN32
+  struct stat directory_stat;
+  return ::lstat(path.c_str(), &directory_stat) == 0 &&
+         S_ISDIR(directory_stat.st_mode) &&
+         directory_stat.st_uid == ::geteuid() &&
+         (directory_stat.st_mode & 0777) == 0700;
+#else
+  // The directory was created with a unique name, inheriting its ACLs.
+  return isDirectory(path).ok();
+#endif
+}
+
+/**
+ * @brief The directory of private copies, created once for this process.
+ *
+ * The copies may be of other users' databases, so the directory always has
+ * a unique name, is never reused from a previous process, and must be owned
+ * by this user and inaccessible to others.
+ */
+static Status getAttachedDirectory(fs::path& directory) {
+  if (!kAttachedDirectory.empty() && isPrivateDirectory(kAttachedDirectory)) {
+    directory = kAttachedDirectory;
+    return Status(0, "OK");
+  }
+
+  boost::system::error_code ec;
+  auto temp = fs::temp_directory_path(ec);
+  if (ec) {
+    return Status(1, "Cannot find a temporary directory: " + ec.message());
+  }
+
+  std::string created;
+#ifndef WIN32
+  auto pattern = (temp / "osquery-attached-XXXXXX").string();
+  std::vector<char> buffer(pattern.begin(), pattern.end());
+  buffer.push_back('\0');
+  if (::mkdtemp(buffer.data()) == nullptr) {
+    return Status(1, "Cannot create attached database directory");
+  }
+  created = buffer.data();
+#else
+  auto unique = temp / fs::unique_path("osquery-attached-%%%%-%%%%-%%%%");
+  if (!fs::create_directory(unique, ec) || ec) {
+    return Status(1, "Cannot create attached database directory");
+  }
+  created = unique.string();
+#endif
+
+  if (!isPrivateDirectory(created)) {
+    fs::remove_all(created, ec);
+    return Status(1, "Attached database directory is not private: " + created);
+  }
+  kAttachedDirectory = created;
+  directory = kAttachedDirectory;
+  return Status(0, "OK");
+}
+
+/// Remove a private copy, an attached copy remains readable when unlinked.
+static void removeCopy(const AttachedDatabaseCopy& copy) {
+  if (!copy.copy.empty()) {
+    boost::system::error_code ec;
+    fs::remove(copy.copy, ec);
+  }
+}
+
+/**
+ * @brief Copy a database file and fold its write-ahead log into the copy.
+ *
+ * The copy is then a single file that may be attached as immutable.
+ */
+static Status copyDatabase(const std::string& path, std::string& copy) {
+  boost::system::error_code ec;
+  auto size = fs::file_size(path, ec);
+  if (ec || size > FLAGS_read_max) {
+    return Status(1, "Cannot copy database: " + path);
+  }
+
+  fs::path directory;
+  auto status = getAttachedDirectory(directory);
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto target = directory / (std::to_string(kAttachedCopyIndex++) + ".db");
+  fs::remove(target, ec);
+  fs::copy_file(path, target, ec);
+  if (ec) {
+    return Status(1, "Cannot copy database: " + ec.message());
+  }
+
+  auto wal = path + "-wal";
+  fs::remove(target.string() + "-wal", ec);
+  if (fs::exists(wal, ec)) {
+    fs::copy_file(wal, target.string() + "-wal", ec);
+  }
+
+  sqlite3* db = nullptr;
+  auto rc = sqlite3_open_v2(
+      target.string().c_str(), &db, SQLITE_OPEN_READWRITE, nullptr);
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_exec(
+        db, "PRAGMA journal_mode=DELETE", nullptr, nullptr, nullptr);
+  }
+  sqlite3_close(db);
+  fs::remove(target.string() + "-wal", ec);
+  fs::remove(target.string() + "-shm", ec);
+  if (rc != SQLITE_OK) {
+    fs::remove(target, ec);
+    return Status(1, "Cannot read database: " + path);
+  }
+
+  copy = target.string();
+  return Status(0, "OK");
+}
+
+/// Copy the sources' changed files, returns true if any copy changed.
+static bool checkSources() {
+  bool changed = false;
+  for (const auto& source : kAttachedSources) {
+    std::vector<std::string> paths;
+    resolveFilePattern(source.second.pattern, paths, GLOB_FILES);
+
+    auto& copies = kAttachedCopies[source.first];
+    std::vector<AttachedDatabaseCopy> updated;
+    for (const auto& path : paths) {
+      AttachedDatabaseCopy copy;
+      copy.path = path;
+      copy.identity = getPathsIdentity({path, path + "-wal"});
+      for (auto& previous : copies) {
+        if (previous.path == path && previous.identity == copy.identity) {
+          // The file has not changed since it was copied.
+          copy.copy = std::move(previous.copy);
+          break;
+        }
+      }
+
+      if (copy.copy.empty()) {
+        auto status = copyDatabase(path, copy.copy);
+        if (!status.ok()) {
+          VLOG(1) << status.getMessage();
+          continue;
+        }
+        changed = true;
+      }
+      updated.push_back(std::move(copy));
+    }
+
+    // Copies of removed or changed files are no longer attached.
+    for (const auto& previous : copies) {
+      if (!previous.copy.empty()) {
+        removeCopy(previous);
+        changed = true;
+      }
+    }
+    copies = std::move(updated);
+  }
+
+  // Copies of removed sources.
+  for (auto it = kAttachedCopies.begin(); it != kAttachedCopies.end();) {
+    if (kAttachedSources.count(it->first) == 0) {
+      for (const auto& copy : it->second) {
+        removeCopy(copy);
+      }
+      it = kAttachedCopies.erase(it);
+      changed = true;
+    } else {
+      ++it;
+    }
+  }
+  return changed;
+}
+
+/// Quote a string as an SQL literal.
+static std::string quoteLiteral(const std::string& value) {
+  return "'" + boost::replace_all_copy(value, "'", "''") + "'";
+}
+
+/// Attach a private copy as an immutable, read-only schema.
+static bool attachCopy(sqlite3* db,
+                       const std::string& schema,
+                       const std::string& copy) {
+  // Characters with a meaning in a URI filename are escaped.
+  std::string uri = "file:";
+  for (const auto& c : copy) {
+    if (c == '%' || c == '?' || c == '#') {
+      char escaped[4];
+      snprintf(escaped, sizeof(escaped), "%%%02X", c);
+      uri += escaped;
+    } else {
+      uri += c;
+    }
+  }
+  uri += "?mode=ro&immutable=1";
+
+  sqlite3_stmt* stmt = nullptr;
+  auto statement = "ATTACH DATABASE ? AS \"" + schema + "\"";
+  auto rc = sqlite3_prepare_v2(db, statement.c_str(), -1, &stmt, nullptr);
+  if (rc == SQLITE_OK) {
+    sqlite3_bind_text(stmt, 1, uri.c_str(), -1, SQLITE_TRANSIENT);
+    rc = sqlite3_step(stmt);
+  }
+  sqlite3_finalize(stmt);
+  return rc == SQLITE_DONE;
+}
+
+/// Detach every attached copy and drop the views of a connection.
+static void detachCopies(sqlite3* db) {
+  for (const auto& view : kAttachedViews) {
+    auto statement = "DROP VIEW IF EXISTS temp.\"" + view + "\"";
+    sqlite3_exec(db, statement.c_str(), nullptr, nullptr, nullptr);
+  }
+
+  std::vector<std::string> schemas;
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(
+          db, "PRAGMA database_list", -1, &stmt, nullptr) == SQLITE_OK) {
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      auto name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+      if (name != nullptr && std::string(name).find(kAttachedSchemaPrefix) ==
+                                 0) {
+        schemas.push_back(name);
+      }
+    }
+  }
+  sqlite3_finalize(stmt);
+
+  for (const auto& schema : schemas) {
+    auto statement = "DETACH DATABASE \"" + schema + "\"";
+    sqlite3_exec(db, statement.c_str(), nullptr, nullptr, nullptr);
+  }
+}
+
+Status AttachedDatabases::set(
+    const std::map<std::string, AttachedDatabaseSource>& sources) {
+  for (const auto& source : sources) {
+    const auto& name = source.first;
+    if (name.empty() ||
+        name.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789_") !=
+            std::string::npos) {
+      return Status(1, "Invalid attached database name: " + name);
+    }
+
+    if (Registry::get().exists("table", name)) {
+      return Status(1, "Attached database name is a table: " + name);
+    }
+
+    if (source.second.query.find(kAttachedSchemaPlaceholder) ==
+        std::string::npos) {
+      return Status(1, "Attached database query must use {{db}}: " + name);
+    }
+  }
+
+  WriteLock lock(kAttachedMutex);
+  kAttachedSources = sources;
+  for (const auto& source : sources) {
+    kAttachedViews.insert(source.first);
+  }
+  kAttachedChecked = 0;
+  kAttachedGeneration++;
+  return Status(0, "OK");
+}
+
+void AttachedDatabases::refresh(sqlite3* db, size_t& generation) {
+  WriteLock lock(kAttachedMutex);
+  if (kAttachedSources.empty() && kAttachedCopies.empty() &&
+      generation == kAttachedGeneration) {
+    return;
+  }
+
+  auto now = getUnixTime();
+  if (kAttachedChecked == 0 ||
+      now >= kAttachedChecked + FLAGS_attached_database_refresh) {
+    kAttachedChecked = now;
+    if (checkSources()) {
+      kAttachedGeneration++;
+    }
+  }
+
+  if (generation == kAttachedGeneration) {
+    return;
+  }
+
+  // Statements using the previous views are prepared again when stepped.
+  detachCopies(db);
+
+  // A connection attaches at most SQLITE_LIMIT_ATTACHED databases.
+  auto limit = sqlite3_limit(db, SQLITE_LIMIT_ATTACHED, -1);
+  size_t available = (limit > 0) ? static_cast<size_t>(limit) : 0;
+  for (const auto& source : kAttachedSources) {
+    std::string view;
+    const auto& copies = kAttachedCopies[source.first];
+    for (size_t i = 0; i < copies.size(); i++) {
+      if (available == 0) {
+        if (kAttachedLimitWarned != kAttachedGeneration) {
+          kAttachedLimitWarned = kAttachedGeneration;
+          LOG(WARNING) << "Cannot attach more than " << limit
+                       << " databases, skipping: " << copies[i].path;
+        }
+        continue;
+      }
+
+      auto schema = kAttachedSchemaPrefix + source.first + "_" +
+                    std::to_string(i);
+      if (!attachCopy(db, schema, copies[i].copy)) {
+        VLOG(1) << "Cannot attach database: " << copies[i].path;
+        continue;
+      }
+      available--;
+
+      auto query = boost::replace_all_copy(source.second.query,
+                                           kAttachedSchemaPlaceholder,
+                                           "\"" + schema + "\"");
+      view += (view.empty() ? "" : " UNION ALL ");
+      view += "SELECT *, " + quoteLiteral(copies[i].path) +
+              " AS attached_path FROM (" + query + ")";
+    }
+
+    if (view.empty()) {
+      // There are no matching databases.
+      continue;
+    }
+
+    auto statement = "CREATE TEMP VIEW \"" + source.first + "\" AS " + view;
+    char* error = nullptr;
+    if (sqlite3_exec(db, statement.c_str(), nullptr, nullptr, &error) !=
+        SQLITE_OK) {
+      LOG(WARNING) << "Cannot create attached database view " << source.first
+                   << ": " << ((error != nullptr) ? error : "");
+    }
+    sqlite3_free(error);
+  }
+  generation = kAttachedGeneration;
+}
+
+void AttachedDatabases::shutdown() {
+  WriteLock lock(kAttachedMutex);
+  for (const auto& copies : kAttachedCopies) {
+    for (const auto& copy : copies.second) {
+      removeCopy(copy);
+    }
+  }
+  kAttachedCopies.clear();
+  kAttachedGeneration++;
+
+  if (!kAttachedDirectory.empty()) {
+    boost::system::error_code ec;
+    fs::remove_all(kAttachedDirectory, ec);
+    kAttachedDirectory.clear();
+  }
+}
+
+/// Remove the private copies when the process exits.
+static struct AttachedDirectoryCleanup {
+  ~AttachedDirectoryCleanup() {
+    AttachedDatabases::shutdown();
+  }
+} kAttachedDirectoryCleanup;
+
+std::map<std::string, size_t> AttachedDatabases::attached() {
+  WriteLock lock(kAttachedMutex);
+  std::map<std::string, size_t> attached;
+  for (const auto& copies : kAttachedCopies) {
+    attached[copies.first] = copies.second.size();
+  }
+  return attached;
+}
+}
@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+
+#include <sqlite3.h>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// The placeholder replaced by each attached database's schema name.
+extern const std::string kAttachedSchemaPlaceholder;
+
+/// A foreign SQLite database, or set of databases, queried through a view.
+struct AttachedDatabaseSource {
+  /// A filesystem pattern, using % wildcards, matching the database files.
+  std::string pattern;
+
+  /**
+   * @brief The view's SELECT, run against each matching database.
+   *
+   * Tables of the database are named using the `{{db}}` schema placeholder,
+   * such as `SELECT url FROM {{db}}.urls`.
+   */
+  std::string query;
+};
+
+/**
+ * @brief Foreign SQLite databases attached read-only to query connections.
+ *
+ * Tables that read another application's SQLite database, such as a browser
+ * history, would open the file, step every row, and copy each column into
+ * a Row that the osquery SQLite engine then reads again. Instead, a database
+ * may be attached to each query connection and queried through a view, so
+ * constraints, joins and aggregates run natively against the source.
+ *
+ * Each matching file, with its write-ahead log, is copied before it is
+ * attached, so the application's locks never block a query and a query
+ * never blocks the application. A copy is made again only when the file
+ * changes, checked at most every `--attached_database_refresh` seconds. The
+ * view is the UNION ALL of the source query for every copy, with the
+ * original file as an `attached_path` column. A connection attaches at most
+ * SQLite's limit of attached databases, further copies are skipped.
+ */
+class AttachedDatabases {
+ public:
+  /// Replace every source, the views change before the next query.
+  static Status set(
+      const std::map<std::string, AttachedDatabaseSource>& sources);
+
+  /**
+   * @brief Attach the current copies and views to a connection.
+   *
+   * This does nothing unless the copies changed after the connection was
+   * last refreshed, as recorded in the caller's generation.
+   *
+   * @param db A query connection, opened with URI filenames allowed.
+   * @param generation The connection's generation of attached copies.
+   */
+  static void refresh(sqlite3* db, size_t& generation);
+
+  /// Remove every private copy and their directory, such as at exit.
+  static void shutdown();
+
+  /// The names of the attached views.
+  static std::map<std::string, size_t> attached();
+};
+}
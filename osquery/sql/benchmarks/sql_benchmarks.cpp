@@ -15,6 +15,7 @@
 #include <osquery/sql.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/process.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
@@ -186,6 +187,167 @@ static void SQL_virtual_table_internal_wide(benchmark::State& state) {
 
 BENCHMARK(SQL_virtual_table_internal_wide);
 
+static void SQL_virtual_table_internal_wide_sorted(benchmark::State& state) {
+  auto tables = RegistryFactory::get().registry("table");
+  tables->add("wide_benchmark", std::make_shared<BenchmarkWideTablePlugin>());
+
+  PluginResponse res;
+  Registry::call("table", "wide_benchmark", {{"action", "columns"}}, res);
+
+  // Attach a sample virtual table.
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("wide_benchmark", columnDefinition(res), dbc);
+
+  while (state.KeepRunning()) {
+    // Sorting and filtering access several columns more than once per row.
+    QueryData results;
+    queryInternal(
+        "select * from wide_benchmark where test_0 >= 0 and test_1 >= 0 "
+        "order by test_0, test_1",
+        results,
+        dbc->db());
+  }
+}
+
+BENCHMARK(SQL_virtual_table_internal_wide_sorted);
+
+class BenchmarkWideBatchTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    TableColumns cols;
+    for (int i = 0; i < 20; i++) {
+      cols.push_back(std::make_tuple(
+          "test_" + std::to_string(i), INTEGER_TYPE, ColumnOptions::DEFAULT));
+    }
+    return cols;
+  }
+
+  bool usesBatch() const override {
+    return true;
+  }
+
+  void generateBatch(RowBatch& batch, QueryContext& ctx) override {
+    for (int k = 0; k < 50; k++) {
+      batch.addRow();
+      for (size_t i = 0; i < 20; i++) {
+        batch.setInteger(i, 0);
+      }
+    }
+  }
+};
+
+static void SQL_virtual_table_internal_wide_batch(benchmark::State& state) {
+  auto tables = RegistryFactory::get().registry("table");
+  tables->add("wide_batch_benchmark",
+              std::make_shared<BenchmarkWideBatchTablePlugin>());
+
+  PluginResponse res;
+  Registry::call("table", "wide_batch_benchmark", {{"action", "columns"}}, res);
+
+  // Attach a sample virtual table that emits native integers.
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("wide_batch_benchmark", columnDefinition(res), dbc);
+
+  while (state.KeepRunning()) {
+    QueryData results;
+    queryInternal("select * from wide_batch_benchmark", results, dbc->db());
+  }
+}
+
+BENCHMARK(SQL_virtual_table_internal_wide_batch);
+
+/// Label a benchmark with the process's resident memory after its queries.
+static void setResidentLabel(benchmark::State& state) {
+  ResourceUsage usage;
+  getResourceUsage(usage);
+  state.SetLabel("rss_after=" + std::to_string(usage.resident_size / 1024) +
+                 "KB");
+}
+
+/// A table of large text cells, as rows or as a columnar batch.
+class BenchmarkTextTablePlugin : public TablePlugin {
+ public:
+  explicit BenchmarkTextTablePlugin(bool batch) : batch_(batch) {}
+
+ private:
+  TableColumns columns() const override {
+    TableColumns cols;
+    for (int i = 0; i < 10; i++) {
+      cols.push_back(std::make_tuple(
+          "test_" + std::to_string(i), TEXT_TYPE, ColumnOptions::DEFAULT));
+    }
+    return cols;
+  }
+
+  bool usesBatch() const override {
+    return batch_;
+  }
+
+  QueryData generate(QueryContext& ctx) override {
+    QueryData results;
+    for (int k = 0; k < 5000; k++) {
+      Row r;
+      for (int i = 0; i < 10; i++) {
+        r["test_" + std::to_string(i)] = getValue(k, i);
+      }
+      results.push_back(std::move(r));
+    }
+    return results;
+  }
+
+  void generateBatch(RowBatch& batch, QueryContext& ctx) override {
+    for (int k = 0; k < 5000; k++) {
+      batch.addRow();
+      for (int i = 0; i < 10; i++) {
+        batch.setText(i, getValue(k, i));
+      }
+    }
+  }
+
+  /// Cells are longer than the small string optimization.
+  static std::string getValue(int row, int column) {
+    return "/usr/lib/benchmark/" + std::to_string(row) + "/" +
+           std::to_string(column) + "/value";
+  }
+
+ private:
+  bool batch_{false};
+};
+
+static void SQL_virtual_table_internal_text(benchmark::State& state) {
+  auto batch = (state.range_x() == 1);
+  auto name = std::string(batch ? "text_batch_benchmark" : "text_benchmark");
+  auto tables = RegistryFactory::get().registry("table");
+  tables->add(name, std::make_shared<BenchmarkTextTablePlugin>(batch));
+
+  PluginResponse res;
+  Registry::call("table", name, {{"action", "columns"}}, res);
+
+  // Attach a sample virtual table that generates many text cells.
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal(name, columnDefinition(res), dbc);
+
+  while (state.KeepRunning()) {
+    // Only the generated cells, not the results, remain after the cursor.
+    QueryData results;
+    queryInternal("select count(*) from " + name + " where test_0 != ''",
+                  results,
+                  dbc->db());
+  }
+  setResidentLabel(state);
+}
+
+BENCHMARK(SQL_virtual_table_internal_text)->Arg(0)->Arg(1);
+
+static void SQL_attach_virtual_tables(benchmark::State& state) {
+  // Profile opening a connection with every registered table attached.
+  while (state.KeepRunning()) {
+    auto dbc = SQLiteDBManager::getUnique();
+  }
+}
+
+BENCHMARK(SQL_attach_virtual_tables);
+
 static void SQL_select_metadata(benchmark::State& state) {
   auto dbc = SQLiteDBManager::get();
   while (state.KeepRunning()) {
@@ -205,4 +367,21 @@ static void SQL_select_basic(benchmark::State& state) {
 }
 
 BENCHMARK(SQL_select_basic);
+
+static void SQL_regex_match_rows(benchmark::State& state) {
+  // Profile a pattern applied to many rows of a statement.
+  auto dbc = SQLiteDBManager::get();
+  while (state.KeepRunning()) {
+    QueryData results;
+    queryInternal(
+        "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c "
+        "WHERE x < 1000) SELECT count(*) FROM c "
+        "WHERE regex_match('/usr/bin/app' || x, '^/usr/bin/([a-z]+)1', 1) "
+        "IS NOT NULL",
+        results,
+        dbc->db());
+  }
+}
+
+BENCHMARK(SQL_regex_match_rows);
 }
@@ -0,0 +1,142 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/registry.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/core/process.h"
+
+namespace osquery {
+
+/// Comma-separated tables to benchmark, every local table by default.
+const std::string kBenchmarkTables{"BENCHMARK_TABLES"};
+
+/**
+ * @brief Constraint sets to benchmark in addition to a full scan.
+ *
+ * Sets are separated by ';' and name their table and comma-separated EQUALS
+ * constraints, for example "file:path=/etc/hosts;hash:path=/bin/ls".
+ */
+const std::string kBenchmarkTableConstraints{"BENCHMARK_TABLE_CONSTRAINTS"};
+
+/// A table and the EQUALS constraints of one benchmark.
+struct TableBenchmark {
+  std::string table;
+  std::vector<std::pair<std::string, std::string>> constraints;
+};
+
+/**
+ * @brief Generate a table's rows with a benchmark's constraints.
+ *
+ * The items processed are the rows generated and the bytes processed are
+ * the size of their values, the allocations the generator made for its
+ * results. The context has no table content, so results are not cached.
+ */
+static void TABLE_generate(benchmark::State& state,
+                           const TableBenchmark& spec) {
+  size_t rows = 0;
+  size_t bytes = 0;
+  while (state.KeepRunning()) {
+    QueryContext context;
+    for (const auto& constraint : spec.constraints) {
+      context.constraints[constraint.first].add(
+          Constraint(EQUALS, constraint.second));
+    }
+
+    PluginResponse response;
+    Registry::callTable(spec.table, context, response);
+    rows += response.size();
+    for (const auto& row : response) {
+      for (const auto& column : row) {
+        bytes += column.first.size() + column.second.size();
+      }
+    }
+  }
+  state.SetItemsProcessed(rows);
+  state.SetBytesProcessed(bytes);
+}
+
+/// The local tables selected by BENCHMARK_TABLES.
+static std::vector<std::string> getBenchmarkTables() {
+  auto selected = getEnvVar(kBenchmarkTables);
+  if (selected.is_initialized()) {
+    return split(*selected, ",");
+  }
+
+  // Event-based tables only read stored events, their publishers are not
+  // running while benchmarking.
+  auto event_based = static_cast<size_t>(TableAttributes::EVENT_BASED);
+  std::vector<std::string> tables;
+  for (const auto& plugin : RegistryFactory::get().plugins("table")) {
+    bool events = false;
+    for (const auto& item : plugin.second->routeInfo()) {
+      if (item.count("attributes") > 0) {
+        events = (std::stoul(item.at("attributes")) & event_based) != 0;
+      }
+    }
+    if (!events) {
+      tables.push_back(plugin.first);
+    }
+  }
+  return tables;
+}
+
+/// The constraint sets of BENCHMARK_TABLE_CONSTRAINTS.
+static std::vector<TableBenchmark> getBenchmarkConstraints() {
+  std::vector<TableBenchmark> benchmarks;
+  auto sets = getEnvVar(kBenchmarkTableConstraints);
+  if (!sets.is_initialized()) {
+    return benchmarks;
+  }
+
+  for (const auto& set : split(*sets, ";")) {
+    auto table = split(set, ":", 1);
+    if (table.size() != 2) {
+      continue;
+    }
+
+    TableBenchmark spec;
+    spec.table = table[0];
+    for (const auto& constraint : split(table[1], ",")) {
+      auto expr = split(constraint, "=", 1);
+      if (expr.size() == 2) {
+        spec.constraints.push_back(std::make_pair(expr[0], expr[1]));
+      }
+    }
+    benchmarks.push_back(std::move(spec));
+  }
+  return benchmarks;
+}
+
+void registerTableBenchmarks() {
+  std::vector<TableBenchmark> specs;
+  for (const auto& table : getBenchmarkTables()) {
+    TableBenchmark spec;
+    spec.table = table;
+    specs.push_back(std::move(spec));
+  }
+  for (auto& spec : getBenchmarkConstraints()) {
+    specs.push_back(std::move(spec));
+  }
+
+  for (const auto& spec : specs) {
+    // Names such as "TABLE_generate/file/path=/etc/hosts" compare between
+    // versions when the same tables and constraints are selected.
+    auto name = "TABLE_generate/" + spec.table;
+    for (const auto& constraint : spec.constraints) {
+      name += "/" + constraint.first + "=" + constraint.second;
+    }
+    benchmark::RegisterBenchmark(name.c_str(), TABLE_generate, spec);
+  }
+}
+}
@@ -16,6 +16,8 @@
 #include <osquery/sql.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+
 namespace osquery {
 
 FLAG(int32, value_max, 512, "Maximum returned row value size");
@@ -55,7 +57,6 @@ std::string SQL::getMessageString() {
 }
 
 static inline void escapeNonPrintableBytes(std::string& data) {
-  std::string escaped;
   // clang-format off
   char const hex_chars[16] = {
     '0', '1', '2', '3', '4', '5', '6', '7',
@@ -63,22 +64,26 @@ static inline void escapeNonPrintableBytes(std::string& data) {
   };
   // clang-format on
 
-  bool needs_replacement = false;
-  for (size_t i = 0; i < data.length(); i++) {
-    if (((unsigned char)data[i]) < 0x20 || ((unsigned char)data[i]) >= 0x80) {
-      needs_replacement = true;
-      escaped += "\\x";
-      escaped += hex_chars[(((unsigned char)data[i])) >> 4];
-      escaped += hex_chars[((unsigned char)data[i] & 0x0F) >> 0];
-    } else {
-      escaped += data[i];
-    }
+  // Most content is printable and is not copied.
+  auto i = scanPlainBytes(data.data(), data.size(), 0x7F);
+  if (i == data.size()) {
+    return;
   }
 
-  // Only replace if any escapes were made.
-  if (needs_replacement) {
-    data = std::move(escaped);
+  std::string escaped;
+  escaped.reserve(data.size() + 16);
+  escaped.append(data, 0, i);
+  while (i < data.size()) {
+    auto c = static_cast<unsigned char>(data[i++]);
+    escaped += "\\x";
+    escaped += hex_chars[c >> 4];
+    escaped += hex_chars[c & 0x0F];
+
+    auto run = scanPlainBytes(data.data() + i, data.size() - i, 0x7F);
+    escaped.append(data, i, run);
+    i += run;
   }
+  data = std::move(escaped);
 }
 
 void escapeNonPrintableBytesEx(std::string& data) {
@@ -123,6 +128,9 @@ Status SQLPlugin::call(const PluginRequest& request, PluginResponse& response) {
   }
 
   if (request.at("action") == "query") {
+    if (request.count("cache") > 0 && request.at("cache") == "1") {
+      return this->queryCached(request.at("query"), response);
+    }
     return this->query(request.at("query"), response);
   } else if (request.at("action") == "columns") {
     TableColumns columns;
@@ -150,6 +158,13 @@ Status query(const std::string& q, QueryData& results) {
       "sql", "sql", {{"action", "query"}, {"query", q}}, results);
 }
 
+Status queryCached(const std::string& q, QueryData& results) {
+  return Registry::call("sql",
+                        "sql",
+                        {{"action", "query"}, {"query", q}, {"cache", "1"}},
+                        results);
+}
+
 Status getQueryColumns(const std::string& q, TableColumns& columns) {
   PluginResponse response;
   auto status = Registry::call(
@@ -0,0 +1,449 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/watcher.h"
+#include "osquery/sql/sqlite_util.h"
+
+namespace osquery {
+
+FLAG(bool,
+     sqlite_memory_arena,
+     true,
+     "Serve small SQLite allocations from size-class arenas");
+
+/// The smallest size class, each following class doubles.
+const size_t kArenaMinClass = 16;
+
+/// The number of size classes, up to 1KB allocations use the arena.
+const size_t kArenaClasses = 7;
+
+/// The largest allocation served from the arena.
+const size_t kArenaMaxClass = kArenaMinClass << (kArenaClasses - 1);
+
+/// Arena memory is reserved from malloc in chunks of this size.
+const size_t kArenaChunkSize = 64 * 1024;
+
+/// Marks an allocation made with malloc rather than from the arena.
+const uint32_t kArenaLarge = 0xffffffff;
+
+/// The lookaside slot size, most of SQLite's transient objects fit.
+const int kLookasideSlotSize = 256;
+
+/// The default page size of SQLite databases.
+const int kPageSize = 4096;
+
+namespace {
+
+/// Every allocation is preceded by a header, keeping 8-byte alignment.
+struct ArenaHeader {
+  /// The size class, or kArenaLarge.
+  uint32_t size_class;
+
+  /// The usable size of the allocation.
+  uint32_t size;
+};
+
+static_assert(sizeof(ArenaHeader) == 8, "SQLite requires 8-byte alignment");
+
+/**
+ * @brief A size-class allocator for SQLite's small allocations.
+ *
+ * Freed blocks are kept on their class's free list and reused. Chunks are
+ * returned when SQLite shuts down, or when trimmed once every block carved
+ * from them is free. The arena stops growing at its limit, further
+ * allocations use malloc.
+ */
+class SQLiteArena {
+ public:
+  static SQLiteArena& get() {
+    // Leaked, SQLite may free memory after static destruction begins.
+    static auto* arena = new SQLiteArena();
+    return *arena;
+  }
+
+  void* allocate(int n) {
+    if (n <= 0) {
+      return nullptr;
+    }
+
+    auto size = static_cast<size_t>(n);
+    ArenaHeader* header = nullptr;
+    if (size <= kArenaMaxClass && limit_ > 0) {
+      header = allocateSmall(getClass(size));
+    }
+
+    if (header == nullptr) {
+      size = (size + 7) & ~size_t(7);
+      header = static_cast<ArenaHeader*>(malloc(sizeof(ArenaHeader) + size));
+      if (header == nullptr) {
+        return nullptr;
+      }
+      header->size_class = kArenaLarge;
+      header->size = static_cast<uint32_t>(size);
+    }
+
+    addUsed(header->size);
+    return header + 1;
+  }
+
+  void release(void* p) {
+    if (p == nullptr) {
+      return;
+    }
+
+    auto header = static_cast<ArenaHeader*>(p) - 1;
+    used_ -= header->size;
+    if (header->size_class == kArenaLarge) {
+      free(header);
+      return;
+    }
+
+    // The free list link overwrites the header.
+    auto size_class = header->size_class;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto block = reinterpret_cast<FreeBlock*>(header);
+    block->next = free_[size_class];
+    free_[size_class] = block;
+  }
+
+  void* reallocate(void* p, int n) {
+    auto header = static_cast<ArenaHeader*>(p) - 1;
+    auto size = static_cast<size_t>(n);
+    if (size <= header->size &&
+        (header->size_class == kArenaLarge ||
+         getClass(size) == header->size_class)) {
+      // The allocation already fits and would not move to a smaller class.
+      return p;
+    }
+
+    auto moved = allocate(n);
+    if (moved != nullptr) {
+      memcpy(moved, p, std::min<size_t>(header->size, size));
+      release(p);
+    }
+    return moved;
+  }
+
+  static int size(void* p) {
+    return static_cast<int>((static_cast<ArenaHeader*>(p) - 1)->size);
+  }
+
+  static int roundup(int n) {
+    auto size = static_cast<size_t>(n);
+    if (size <= kArenaMaxClass) {
+      return static_cast<int>(kArenaMinClass << getClass(size));
+    }
+    return static_cast<int>((size + 7) & ~size_t(7));
+  }
+
+  /// Set the most bytes of arena chunks, 0 disables the arena.
+  void setLimit(size_t limit) {
+    limit_ = limit;
+  }
+
+  /// Record if SQLite uses this allocator.
+  void setInstalled(bool installed) {
+    installed_ = installed;
+  }
+
+  bool isInstalled() const {
+    return installed_;
+  }
+
+  /// Return the arena chunks, SQLite has freed every allocation.
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto chunk : chunks_) {
+      free(chunk);
+    }
+    chunks_.clear();
+    carved_.clear();
+    std::fill(free_, free_ + kArenaClasses, nullptr);
+    next_ = nullptr;
+    end_ = nullptr;
+    arena_ = 0;
+  }
+
+  /// Return the chunks with no allocations to malloc, returns their bytes.
+  size_t trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (chunks_.empty()) {
+      return 0;
+    }
+
+    // Find the chunk of each free block, by the chunks' addresses.
+    std::vector<size_t> order(chunks_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+      return chunks_[a] < chunks_[b];
+    });
+    auto find = [this, &order](const FreeBlock* block) {
+      auto p = reinterpret_cast<const uint8_t*>(block);
+      auto it = std::upper_bound(
+          order.begin(), order.end(), p, [this](const uint8_t* p, size_t i) {
+            return p < chunks_[i];
+          });
+      return *(it - 1);
+    };
+
+    std::vector<size_t> available(chunks_.size(), 0);
+    for (uint32_t c = 0; c < kArenaClasses; c++) {
+      for (auto block = free_[c]; block != nullptr; block = block->next) {
+        available[find(block)] += sizeof(ArenaHeader) + (kArenaMinClass << c);
+      }
+    }
+
+    std::vector<bool> unused(chunks_.size(), false);
+    bool trimmed = false;
+    for (size_t i = 0; i < chunks_.size(); i++) {
+      unused[i] = (available[i] == carved_[i]);
+      trimmed = trimmed || unused[i];
+    }
+    if (!trimmed) {
+      return 0;
+    }
+
+    // Blocks of the returned chunks leave the free lists.
+    for (uint32_t c = 0; c < kArenaClasses; c++) {
+      auto link = &free_[c];
+      while (*link != nullptr) {
+        if (unused[find(*link)]) {
+          *link = (*link)->next;
+        } else {
+          link = &(*link)->next;
+        }
+      }
+    }
+
+    if (unused.back()) {
+      // The newest chunk is no longer carved.
+      next_ = nullptr;
+      end_ = nullptr;
+    }
+
+    size_t released = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < chunks_.size(); i++) {
+      if (unused[i]) {
+        free(chunks_[i]);
+        released += kArenaChunkSize;
+        continue;
+      }
+      chunks_[kept] = chunks_[i];
+      carved_[kept] = carved_[i];
+      kept++;
+    }
+    chunks_.resize(kept);
+    carved_.resize(kept);
+    arena_ -= released;
+    return released;
+  }
+
+  SQLiteMemoryStats stats() const {
+    SQLiteMemoryStats stats;
+    stats.used = used_;
+    stats.peak = peak_;
+    stats.arena = arena_;
+    stats.recycled = recycled_;
+    return stats;
+  }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  static uint32_t getClass(size_t size) {
+    uint32_t size_class = 0;
+    while ((kArenaMinClass << size_class) < size) {
+      size_class++;
+    }
+    return size_class;
+  }
+
+  ArenaHeader* allocateSmall(uint32_t size_class) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ArenaHeader* header = nullptr;
+    if (free_[size_class] != nullptr) {
+      header = reinterpret_cast<ArenaHeader*>(free_[size_class]);
+      free_[size_class] = free_[size_class]->next;
+      recycled_++;
+    } else {
+      auto block = sizeof(ArenaHeader) + (kArenaMinClass << size_class);
+      if (next_ == nullptr || next_ + block > end_) {
+        // The end of the previous chunk is left unused.
+        if (arena_ + kArenaChunkSize > limit_) {
+          return nullptr;
+        }
+        auto chunk = static_cast<uint8_t*>(malloc(kArenaChunkSize));
+        if (chunk == nullptr) {
+          return nullptr;
+        }
+        chunks_.push_back(chunk);
+        carved_.push_back(0);
+        arena_ += kArenaChunkSize;
+        next_ = chunk;
+        end_ = chunk + kArenaChunkSize;
+      }
+      header = reinterpret_cast<ArenaHeader*>(next_);
+      next_ += block;
+      carved_.back() += block;
+    }
+
+    header->size_class = size_class;
+    header->size = static_cast<uint32_t>(kArenaMinClass << size_class);
+    return header;
+  }
+
+  void addUsed(size_t size) {
+    auto used = used_ += size;
+    auto peak = peak_.load();
+    while (used > peak && !peak_.compare_exchange_weak(peak, used)) {
+    }
+  }
+
+ private:
+  /// Protects the free lists and chunks.
+  std::mutex mutex_;
+
+  FreeBlock* free_[kArenaClasses] = {nullptr};
+
+  std::vector<uint8_t*> chunks_;
+
+  /// The bytes of blocks carved from each chunk.
+  std::vector<size_t> carved_;
+
+  /// The unused remainder of the newest chunk.
+  uint8_t* next_{nullptr};
+  uint8_t* end_{nullptr};
+
+  size_t limit_{0};
+  bool installed_{false};
+  std::atomic<size_t> arena_{0};
+  std::atomic<size_t> used_{0};
+  std::atomic<size_t> peak_{0};
+  std::atomic<size_t> recycled_{0};
+};
+
+void* arenaMalloc(int n) {
+  return SQLiteArena::get().allocate(n);
+}
+
+void arenaFree(void* p) {
+  SQLiteArena::get().release(p);
+}
+
+void* arenaRealloc(void* p, int n) {
+  return SQLiteArena::get().reallocate(p, n);
+}
+
+int arenaSize(void* p) {
+  return SQLiteArena::size(p);
+}
+
+int arenaRoundup(int n) {
+  return SQLiteArena::roundup(n);
+}
+
+int arenaInit(void*) {
+  return SQLITE_OK;
+}
+
+void arenaShutdown(void*) {
+  SQLiteArena::get().reset();
+}
+}
+
+void configureSQLiteMemory() {
+  static std::once_flag once;
+  std::call_once(once, []() {
+    auto limit = getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024;
+    if (limit == 0) {
+      limit = 100 * 1024 * 1024;
+    }
+
+    if (FLAGS_sqlite_memory_arena) {
+      // An eighth of the worker's memory may be held by the arena.
+      SQLiteArena::get().setLimit(std::max(limit / 8, kArenaChunkSize));
+
+      sqlite3_mem_methods methods = {arenaMalloc,
+                                     arenaFree,
+                                     arenaRealloc,
+                                     arenaSize,
+                                     arenaRoundup,
+                                     arenaInit,
+                                     arenaShutdown,
+                                     nullptr};
+      if (sqlite3_config(SQLITE_CONFIG_MALLOC, &methods) != SQLITE_OK) {
+        // SQLite was initialized before the manager, keep its allocator.
+        SQLiteArena::get().setLimit(0);
+        VLOG(1) << "Cannot install the SQLite memory allocator";
+        return;
+      }
+      SQLiteArena::get().setInstalled(true);
+    }
+
+    // Lookaside slots for each connection, one per MB of the limit.
+    auto slots = std::min<size_t>(std::max<size_t>(limit >> 20, 64), 512);
+    sqlite3_config(
+        SQLITE_CONFIG_LOOKASIDE, kLookasideSlotSize, static_cast<int>(slots));
+
+    // Page cache memory shared by every connection, pages past the buffer
+    // are allocated from the heap. The in-memory databases hold few pages,
+    // mostly for sorting results.
+    int header = 0;
+    sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header);
+    auto cache_kb = std::min<size_t>(std::max<size_t>(limit >> 16, 256), 4096);
+    auto slot = (static_cast<size_t>(kPageSize + header) + 7) & ~size_t(7);
+    auto pages = cache_kb * 1024 / slot;
+
+    // SQLite may use the buffer until it shuts down, it is never freed.
+    auto buffer = new uint64_t[pages * slot / sizeof(uint64_t)];
+    sqlite3_config(SQLITE_CONFIG_PAGECACHE,
+                   buffer,
+                   static_cast<int>(slot),
+                   static_cast<int>(pages));
+  });
+}
+
+size_t trimSQLiteMemory() {
+  if (!SQLiteArena::get().isInstalled()) {
+    return 0;
+  }
+  return SQLiteArena::get().trim();
+}
+
+SQLiteMemoryStats SQLiteDBManager::memoryStats() {
+  if (SQLiteArena::get().isInstalled()) {
+    return SQLiteArena::get().stats();
+  }
+
+  // Without the arena only SQLite's own counters are available.
+  SQLiteMemoryStats stats;
+  sqlite3_int64 used = 0;
+  sqlite3_int64 peak = 0;
+  sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &used, &peak, 0);
+  stats.used = static_cast<size_t>(used);
+  stats.peak = static_cast<size_t>(peak);
+  return stats;
+}
+}
@@ -16,7 +16,11 @@
 #include <arpa/inet.h>
 #endif
 
+#include <zlib.h>
+
+#include <cstring>
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -24,6 +28,7 @@
 #include <boost/regex.hpp>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/hash.h"
 
 #include <sqlite3.h>
 
@@ -53,28 +58,6 @@ static SplitResult tokenSplit(const std::string& input,
   return osquery::split(input, tokens);
 }
 
-/**
- * @brief A regex SQLite column string split implementation.
- *
- * Split a column value using a single or multi-character token and select an
- * expected index. The token input is considered a regex.
- *
- * Example:
- *   1. SELECT ip_address from addresses;
- *      192.168.0.1
- *   2. SELECT SPLIT(ip_address, "\.", 1) from addresses;
- *      168
- *   3. SELECT SPLIT(ip_address, "\.0", 0) from addresses;
- *      192.168
- */
-static SplitResult regexSplit(const std::string& input,
-                              const std::string& token) {
-  // Split using the token as a regex to support multi-character tokens.
-  std::vector<std::string> result;
-  boost::algorithm::split_regex(result, input, boost::regex(token));
-  return result;
-}
-
 static void callStringSplitFunc(sqlite3_context* context,
                                 int argc,
                                 sqlite3_value** argv,
@@ -118,10 +101,178 @@ static void tokenStringSplitFunc(sqlite3_context* context,
   callStringSplitFunc(context, argc, argv, tokenSplit);
 }
 
+static void deleteRegex(void* pattern) {
+  delete static_cast<boost::regex*>(pattern);
+}
+
+/**
+ * @brief Get the compiled regex of a pattern argument.
+ *
+ * A constant pattern is compiled on the first row of a statement and kept
+ * with the statement as SQLite auxiliary data, the following rows reuse it.
+ * SQLite may discard auxiliary data when it is set, so callers must finish
+ * using the pattern before calling savePattern.
+ *
+ * @param compiled (output) Owns a newly compiled pattern.
+ * @return The pattern, nullptr if the pattern is invalid.
+ */
+static const boost::regex* getPattern(sqlite3_context* context,
+                                      sqlite3_value** argv,
+                                      int arg,
+                                      std::unique_ptr<boost::regex>& compiled) {
+  auto pattern = static_cast<boost::regex*>(sqlite3_get_auxdata(context, arg));
+  if (pattern != nullptr) {
+    return pattern;
+  }
+
+  try {
+    compiled.reset(new boost::regex((char*)sqlite3_value_text(argv[arg])));
+  } catch (const boost::regex_error& /* e */) {
+    return nullptr;
+  }
+  return compiled.get();
+}
+
+/// Keep a newly compiled pattern with the statement.
+static void savePattern(sqlite3_context* context,
+                        int arg,
+                        std::unique_ptr<boost::regex>& compiled) {
+  if (compiled != nullptr) {
+    sqlite3_set_auxdata(context, arg, compiled.release(), deleteRegex);
+  }
+}
+
+/**
+ * @brief A regex SQLite column string split implementation.
+ *
+ * Split a column value using a single or multi-character token and select an
+ * expected index. The token input is considered a regex.
+ *
+ * Example:
+ *   1. SELECT ip_address from addresses;
+ *      192.168.0.1
+ *   2. SELECT SPLIT(ip_address, "\.", 1) from addresses;
+ *      168
+ *   3. SELECT SPLIT(ip_address, "\.0", 0) from addresses;
+ *      192.168
+ */
 static void regexStringSplitFunc(sqlite3_context* context,
                                  int argc,
                                  sqlite3_value** argv) {
-  callStringSplitFunc(context, argc, argv, regexSplit);
+  assert(argc == 3);
+  if (SQLITE_NULL == sqlite3_value_type(argv[0]) ||
+      SQLITE_NULL == sqlite3_value_type(argv[1]) ||
+      SQLITE_NULL == sqlite3_value_type(argv[2])) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  std::unique_ptr<boost::regex> compiled;
+  auto pattern = getPattern(context, argv, 1, compiled);
+  if (pattern == nullptr) {
+    sqlite3_result_error(context, "Invalid pattern to regex_split", -1);
+    return;
+  }
+
+  // Split using the token as a regex to support multi-character tokens.
+  std::string input((char*)sqlite3_value_text(argv[0]));
+  auto index = static_cast<size_t>(sqlite3_value_int(argv[2]));
+  std::vector<std::string> result;
+  boost::algorithm::split_regex(result, input, *pattern);
+  if (index >= result.size()) {
+    sqlite3_result_null(context);
+  } else {
+    const auto& selected = result[index];
+    sqlite3_result_text(context,
+                        selected.c_str(),
+                        static_cast<int>(selected.size()),
+                        SQLITE_TRANSIENT);
+  }
+  savePattern(context, 1, compiled);
+}
+
+/**
+ * @brief Select a group of the first regex match in a column.
+ *
+ * Index 0 selects the whole match. If there is no match, or the group did
+ * not participate in the match, a NULL type is returned.
+ *
+ * Example:
+ *   1. SELECT REGEX_MATCH("192.168.0.1", "([0-9]+)\.([0-9]+)", 2);
+ *      168
+ */
+static void regexMatchFunc(sqlite3_context* context,
+                           int argc,
+                           sqlite3_value** argv) {
+  assert(argc == 3);
+  if (SQLITE_NULL == sqlite3_value_type(argv[0]) ||
+      SQLITE_NULL == sqlite3_value_type(argv[1]) ||
+      SQLITE_NULL == sqlite3_value_type(argv[2])) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  std::unique_ptr<boost::regex> compiled;
+  auto pattern = getPattern(context, argv, 1, compiled);
+  if (pattern == nullptr) {
+    sqlite3_result_error(context, "Invalid pattern to regex_match", -1);
+    return;
+  }
+
+  auto input = reinterpret_cast<const char*>(sqlite3_value_text(argv[0]));
+  auto size = static_cast<size_t>(sqlite3_value_bytes(argv[0]));
+  auto index = static_cast<size_t>(sqlite3_value_int(argv[2]));
+  boost::cmatch match;
+  if (boost::regex_search(input, input + size, match, *pattern) &&
+      index < match.size() && match[index].matched) {
+    sqlite3_result_text(context,
+                        match[index].first,
+                        static_cast<int>(match[index].length()),
+                        SQLITE_TRANSIENT);
+  } else {
+    sqlite3_result_null(context);
+  }
+  savePattern(context, 1, compiled);
+}
+
+/**
+ * @brief Hash the content of a column with SHA256.
+ *
+ * The platform's crypto library selects an implementation using the CPU's
+ * SHA or vector extensions.
+ */
+static void sha256Func(sqlite3_context* context,
+                       int argc,
+                       sqlite3_value** argv) {
+  assert(argc == 1);
+  if (SQLITE_NULL == sqlite3_value_type(argv[0])) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  // Text is hashed as its UTF-8 encoding, blobs as their bytes.
+  auto data = sqlite3_value_blob(argv[0]);
+  auto size = static_cast<size_t>(sqlite3_value_bytes(argv[0]));
+  auto hash = hashFromBuffer(HASH_TYPE_SHA256, data, size);
+  sqlite3_result_text(context,
+                      hash.c_str(),
+                      static_cast<int>(hash.size()),
+                      SQLITE_TRANSIENT);
+}
+
+/// Compute the CRC32 (zlib polynomial) of the content of a column.
+static void crc32Func(sqlite3_context* context,
+                      int argc,
+                      sqlite3_value** argv) {
+  assert(argc == 1);
+  if (SQLITE_NULL == sqlite3_value_type(argv[0])) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  auto data = static_cast<const Bytef*>(sqlite3_value_blob(argv[0]));
+  auto size = static_cast<uInt>(sqlite3_value_bytes(argv[0]));
+  sqlite3_result_int64(context, crc32(crc32(0L, Z_NULL, 0), data, size));
 }
 
 /**
@@ -152,6 +303,100 @@ static void ip4StringToDecimalFunc(sqlite3_context* context,
   }
 }
 
+/// A parsed network of an in_cidr argument.
+struct CIDRNetwork {
+  int family{0};
+  unsigned char address[16];
+  size_t bits{0};
+};
+
+static void deleteNetwork(void* network) {
+  delete static_cast<CIDRNetwork*>(network);
+}
+
+/// Parse an IPv4 or IPv6 address, returning the address family or 0.
+static int parseAddress(const std::string& input, unsigned char address[16]) {
+  if (input.find(':') != std::string::npos) {
+    return (inet_pton(AF_INET6, input.c_str(), address) == 1) ? AF_INET6 : 0;
+  }
+  return (inet_pton(AF_INET, input.c_str(), address) == 1) ? AF_INET : 0;
+}
+
+/// Parse a network in CIDR notation, an address without a prefix length is
+/// a network of that single address.
+static bool parseNetwork(const std::string& input, CIDRNetwork& network) {
+  auto slash = input.find('/');
+  network.family = parseAddress(input.substr(0, slash), network.address);
+  if (network.family == 0) {
+    return false;
+  }
+
+  size_t max_bits = (network.family == AF_INET) ? 32 : 128;
+  network.bits = max_bits;
+  if (slash != std::string::npos) {
+    long bits = 0;
+    if (!safeStrtol(input.substr(slash + 1), 10, bits).ok() || bits < 0 ||
+        static_cast<size_t>(bits) > max_bits) {
+      return false;
+    }
+    network.bits = static_cast<size_t>(bits);
+  }
+  return true;
+}
+
+/**
+ * @brief Check if an IP address is within a network in CIDR notation.
+ *
+ * The network argument is parsed once for each statement when it is
+ * constant. Addresses of a different family than the network, and invalid
+ * addresses, are not within the network.
+ *
+ * Example:
+ *   1. SELECT IN_CIDR("10.0.1.2", "10.0.0.0/8");
+ *      1
+ */
+static void inCIDRFunc(sqlite3_context* context,
+                       int argc,
+                       sqlite3_value** argv) {
+  assert(argc == 2);
+  if (SQLITE_NULL == sqlite3_value_type(argv[0]) ||
+      SQLITE_NULL == sqlite3_value_type(argv[1])) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  std::unique_ptr<CIDRNetwork> parsed;
+  auto network = static_cast<CIDRNetwork*>(sqlite3_get_auxdata(context, 1));
+  if (network == nullptr) {
+    parsed.reset(new CIDRNetwork());
+    if (!parseNetwork((char*)sqlite3_value_text(argv[1]), *parsed)) {
+      sqlite3_result_error(context, "Invalid network to in_cidr", -1);
+      return;
+    }
+    network = parsed.get();
+  }
+
+  unsigned char address[16];
+  bool within =
+      parseAddress((char*)sqlite3_value_text(argv[0]), address) ==
+      network->family;
+  if (within) {
+    // Compare the whole bytes of the prefix, then the remaining bits.
+    auto bytes = network->bits / 8;
+    within = memcmp(address, network->address, bytes) == 0;
+    auto bits = network->bits % 8;
+    if (within && bits > 0) {
+      unsigned char mask = static_cast<unsigned char>(0xff << (8 - bits));
+      within = (address[bytes] & mask) == (network->address[bytes] & mask);
+    }
+  }
+  sqlite3_result_int(context, (within) ? 1 : 0);
+
+  if (parsed != nullptr) {
+    sqlite3_set_auxdata(context, 1, parsed.release(), deleteNetwork);
+  }
+}
+
 void registerStringExtensions(sqlite3* db) {
   sqlite3_create_function(db,
                           "split",
@@ -169,6 +414,38 @@ void registerStringExtensions(sqlite3* db) {
                           regexStringSplitFunc,
                           nullptr,
                           nullptr);
+  sqlite3_create_function(db,
+                          "regex_match",
+                          3,
+                          SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                          nullptr,
+                          regexMatchFunc,
+                          nullptr,
+                          nullptr);
+  sqlite3_create_function(db,
+                          "sha256",
+                          1,
+                          SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                          nullptr,
+                          sha256Func,
+                          nullptr,
+                          nullptr);
+  sqlite3_create_function(db,
+                          "crc32",
+                          1,
+                          SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                          nullptr,
+                          crc32Func,
+                          nullptr,
+                          nullptr);
+  sqlite3_create_function(db,
+                          "in_cidr",
+                          2,
+                          SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                          nullptr,
+                          inCIDRFunc,
+                          nullptr,
+                          nullptr);
   sqlite3_create_function(db,
                           "inet_aton",
                           1,
@@ -8,11 +8,23 @@
  *
  */
 
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
 #include <osquery/core.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
+#include <osquery/system.h>
 
+#include "osquery/core/memory_pressure.h"
+#include "osquery/core/tracing.h"
+#include "osquery/core/worker_stats.h"
+#include "osquery/sql/attach.h"
 #include "osquery/sql/sqlite_util.h"
 #include "osquery/sql/virtual_table.h"
 
@@ -25,6 +37,31 @@ FLAG(string,
 
 FLAG(string, nullvalue, "", "Set string for NULL values, default ''");
 
+FLAG(uint64,
+     statement_cache_size,
+     32,
+     "Maximum prepared statements cached for each SQLite connection");
+
+FLAG(uint64,
+     query_results_cache_ttl,
+     0,
+     "Seconds to reuse the results of identical queries (default 0, off)");
+
+FLAG(uint64,
+     query_cost_budget,
+     0,
+     "Estimated plan cost above which distributed queries are rejected");
+
+DECLARE_uint64(schedule_workers);
+
+/// The most queries kept by the QueryResultsCache.
+const size_t kQueryResultsCacheMax{128};
+
+/// The recent results, and the cache protecting them.
+static std::map<std::string, std::shared_ptr<const QueryResultsCacheEntry>>
+    kQueryResults;
+static Mutex kQueryResultsMutex;
+
 using OpReg = QueryPlanner::Opcode::Register;
 
 using SQLiteDBInstanceRef = std::shared_ptr<SQLiteDBInstance>;
@@ -112,6 +149,10 @@ class SQLiteSQLPlugin : public SQLPlugin {
   /// Execute SQL and store results.
   Status query(const std::string& q, QueryData& results) const override;
 
+  /// Execute SQL, or reuse the results of a recent execution.
+  Status queryCached(const std::string& q,
+                     QueryData& results) const override;
+
   /// Introspect, explain, the suspected types selected in an SQL statement.
   Status getQueryColumns(const std::string& q,
                          TableColumns& columns) const override;
@@ -138,24 +179,139 @@ std::string getStringForSQLiteReturnCode(int code) {
 
 Status SQLiteSQLPlugin::query(const std::string& q, QueryData& results) const {
   auto dbc = SQLiteDBManager::get();
-  auto result = queryInternal(q, results, dbc->db());
+  auto result = queryInternal(q, results, dbc);
   dbc->clearAffectedTables();
   return result;
 }
 
+Status SQLiteSQLPlugin::queryCached(const std::string& q,
+                                    QueryData& results) const {
+  SQLInternal sql(q, SQLiteDBManager::get(), true);
+  results = std::move(sql.rows());
+  return sql.getStatus();
+}
+
 Status SQLiteSQLPlugin::getQueryColumns(const std::string& q,
                                         TableColumns& columns) const {
   auto dbc = SQLiteDBManager::get();
+  dbc->refreshAttached();
   return getQueryColumnsInternal(q, columns, dbc->db());
 }
 
-SQLInternal::SQLInternal(const std::string& q) {
-  auto dbc = SQLiteDBManager::get();
-  status_ = queryInternal(q, results_, dbc->db());
+SQLInternal::SQLInternal(const std::string& q)
+    : SQLInternal(q, SQLiteDBManager::get()) {}
+
+bool QueryResultsCache::enabled() {
+  return FLAGS_query_results_cache_ttl > 0;
+}
+
+std::shared_ptr<const QueryResultsCacheEntry> QueryResultsCache::get(
+    const std::string& q) {
+  ReadLock lock(kQueryResultsMutex);
+  auto it = kQueryResults.find(q);
+  if (it == kQueryResults.end() ||
+      it->second->time + FLAGS_query_results_cache_ttl <= getUnixTime()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+void QueryResultsCache::put(
+    const std::string& q, std::shared_ptr<const QueryResultsCacheEntry> entry) {
+  WriteLock lock(kQueryResultsMutex);
+  if (kQueryResults.size() >= kQueryResultsCacheMax &&
+      kQueryResults.count(q) == 0) {
+    // Remove the expired entries before the least-recent.
+    auto now = getUnixTime();
+    auto oldest = kQueryResults.begin();
+    for (auto it = kQueryResults.begin(); it != kQueryResults.end();) {
+      if (it->second->time + FLAGS_query_results_cache_ttl <= now) {
+        it = kQueryResults.erase(it);
+        continue;
+      }
+      if (it->second->time < oldest->second->time) {
+        oldest = it;
+      }
+      ++it;
+    }
+    if (kQueryResults.size() >= kQueryResultsCacheMax) {
+      kQueryResults.erase(oldest);
+    }
+  }
+  kQueryResults[q] = std::move(entry);
+}
+
+void QueryResultsCache::clear() {
+  WriteLock lock(kQueryResultsMutex);
+  kQueryResults.clear();
+}
+
+size_t QueryResultsCache::size() {
+  ReadLock lock(kQueryResultsMutex);
+  return kQueryResults.size();
+}
+
+SQLInternal::SQLInternal(const std::string& q, const SQLiteDBInstanceRef& dbc) {
+  execute(q, dbc);
+}
+
+SQLInternal::SQLInternal(const std::string& q,
+                         const SQLiteDBInstanceRef& dbc,
+                         bool use_cache) {
+  if (!use_cache || !QueryResultsCache::enabled()) {
+    execute(q, dbc);
+    return;
+  }
+
+  auto entry = QueryResultsCache::get(q);
+  if (entry != nullptr) {
+    results_ = entry->results;
+    event_based_ = entry->event_based;
+    generations_ = entry->generations;
+    cached_ = true;
+    return;
+  }
+
+  execute(q, dbc);
+  // Event-based tables return the events since each query's last execution.
+  // Results truncated by the budget's limits are not the complete set.
+  auto budget = QueryBudget::current();
+  bool truncated = (budget != nullptr && budget->truncated());
+  if (status_.ok() && !event_based_ && !truncated) {
+    auto fresh = std::make_shared<QueryResultsCacheEntry>();
+    fresh->time = getUnixTime();
+    fresh->results = results_;
+    fresh->event_based = event_based_;
+    fresh->generations = generations_;
+    QueryResultsCache::put(q, std::move(fresh));
+  }
+}
+
+static Status executeInternal(const std::string& q,
+                              QueryData& results,
+                              const SQLiteDBInstanceRef& dbc,
+                              const QueryRowCallback* callback);
+
+SQLInternal::SQLInternal(const std::string& q,
+                         const SQLiteDBInstanceRef& dbc,
+                         const QueryRowCallback& callback) {
+  execute(q, dbc, &callback);
+}
+
+void SQLInternal::execute(const std::string& q,
+                          const SQLiteDBInstanceRef& dbc,
+                          const QueryRowCallback* callback) {
+  TRACE_PROBE1(sql__start, q.c_str());
+  status_ = executeInternal(q, results_, dbc, callback);
+  TRACE_PROBE3(sql__done, q.c_str(), results_.size(), status_.getCode());
 
   // One of the advantages of using SQLInternal (aside from the Registry-bypass)
   // is the ability to "deep-inspect" the table attributes and actions.
   event_based_ = (dbc->getAttributes() & TableAttributes::EVENT_BASED) != 0;
+  if (status_.ok()) {
+    generations_ = dbc->getGenerations();
+  }
+  table_costs_ = dbc->getTableCosts();
 
   dbc->clearAffectedTables();
 }
@@ -173,7 +329,10 @@ Status SQLiteSQLPlugin::attach(const std::string& name) {
   // primary database. To allow this, getConnection can explicitly request the
   // primary instance and avoid the contention decisions.
   auto dbc = SQLiteDBManager::getConnection(true);
-  return attachTableInternal(name, statement, dbc);
+  status = attachTableInternal(name, statement, dbc);
+  // Pooled connections do not include the new table.
+  SQLiteDBManager::resetPool();
+  return status;
 }
 
 void SQLiteSQLPlugin::detach(const std::string& name) {
@@ -181,7 +340,9 @@ void SQLiteSQLPlugin::detach(const std::string& name) {
   if (!dbc->isPrimary()) {
     return;
   }
+  dbc->clearStatements();
   detachTableInternal(name, dbc->db());
+  SQLiteDBManager::resetPool();
 }
 
 SQLiteDBInstance::SQLiteDBInstance(sqlite3*& db, Mutex& mtx)
@@ -189,14 +350,29 @@ SQLiteDBInstance::SQLiteDBInstance(sqlite3*& db, Mutex& mtx)
   if (lock_.owns_lock()) {
     primary_ = true;
   } else {
+    // The manager provides a pooled connection instead.
     db_ = nullptr;
-    VLOG(1) << "DBManager contention: opening transient SQLite database";
-    init();
   }
 }
 
+/// Number of virtual machine instructions between query budget checks.
+const int kQueryBudgetOps{1000};
+
+static int queryBudgetProgress(void*) {
+  // Report the resource usage of a scheduled query to the watcher.
+  WorkerQueryScope::sample();
+
+  // A nonzero result stops the query with SQLITE_INTERRUPT.
+  return QueryBudget::interrupted() ? 1 : 0;
+}
+
 static inline void openOptimized(sqlite3*& db) {
-  sqlite3_open(":memory:", &db);
+  // URI filenames allow attached databases to be opened immutable.
+  sqlite3_open_v2(":memory:",
+                  &db,
+                  SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI,
+                  nullptr);
+  sqlite3_progress_handler(db, kQueryBudgetOps, queryBudgetProgress, nullptr);
 
   std::string settings;
   for (const auto& setting : kMemoryDBSettings) {
@@ -221,6 +397,15 @@ void SQLiteDBInstance::addAffectedTable(VirtualTableContent* table) {
   affected_tables_.insert(std::make_pair(table->name, table));
 }
 
+void SQLiteDBInstance::refreshAttached() {
+  SQLiteDBInstance* rdbc = this;
+  if (isPrimary() && !managed_) {
+    // Similarly to clearAffectedTables, the connection may be forwarded.
+    rdbc = SQLiteDBManager::getConnection(true).get();
+  }
+  AttachedDatabases::refresh(rdbc->db_, rdbc->attached_generation_);
+}
+
 TableAttributes SQLiteDBInstance::getAttributes() const {
   const SQLiteDBInstance* rdbc = this;
   if (isPrimary() && !managed_) {
@@ -235,6 +420,37 @@ TableAttributes SQLiteDBInstance::getAttributes() const {
   return attributes;
 }
 
+std::map<std::string, std::string> SQLiteDBInstance::getGenerations() const {
+  const SQLiteDBInstance* rdbc = this;
+  if (isPrimary() && !managed_) {
+    // Similarly to clearAffectedTables, the connection may be forwarded.
+    rdbc = SQLiteDBManager::getConnection(true).get();
+  }
+
+  std::map<std::string, std::string> generations;
+  for (const auto& table : rdbc->affected_tables_) {
+    if (table.second->generation.empty()) {
+      return {};
+    }
+    generations[table.first] = table.second->generation;
+  }
+  return generations;
+}
+
+std::map<std::string, TableCost> SQLiteDBInstance::getTableCosts() const {
+  const SQLiteDBInstance* rdbc = this;
+  if (isPrimary() && !managed_) {
+    // Similarly to clearAffectedTables, the connection may be forwarded.
+    rdbc = SQLiteDBManager::getConnection(true).get();
+  }
+
+  std::map<std::string, TableCost> costs;
+  for (const auto& table : rdbc->affected_tables_) {
+    costs[table.first] = table.second->cost;
+  }
+  return costs;
+}
+
 void SQLiteDBInstance::clearAffectedTables() {
   if (isPrimary() && !managed_) {
     // A primary instance must forward clear requests to the DB manager's
@@ -244,23 +460,91 @@ void SQLiteDBInstance::clearAffectedTables() {
   }
 
   for (const auto& table : affected_tables_) {
-    table.second->constraints.clear();
     table.second->cache.clear();
+    table.second->cost = TableCost();
   }
   // Since the affected tables are cleared, there are no more affected tables.
   // There is no concept of compounding tables between queries.
   affected_tables_.clear();
+  query_state_.reset();
+}
+
+std::shared_ptr<QueryState> SQLiteDBInstance::getQueryState() {
+  if (isPrimary() && !managed_) {
+    // Similarly to clearAffectedTables, the connection may be forwarded.
+    return SQLiteDBManager::getConnection(true)->getQueryState();
+  }
+
+  if (query_state_ == nullptr) {
+    query_state_ = std::make_shared<QueryState>();
+  }
+  return query_state_;
+}
+
+sqlite3_stmt* SQLiteDBInstance::takeStatement(const std::string& query) {
+  if (isPrimary() && !managed_) {
+    // The primary database's statements are cached by the managed instance.
+    return SQLiteDBManager::getConnection(true)->takeStatement(query);
+  }
+
+  WriteLock lock(statements_mutex_);
+  for (auto it = statements_.begin(); it != statements_.end(); ++it) {
+    if (it->first == query) {
+      auto stmt = it->second;
+      statements_.erase(it);
+      return stmt;
+    }
+  }
+  return nullptr;
+}
+
+void SQLiteDBInstance::cacheStatement(const std::string& query,
+                                      sqlite3_stmt* stmt) {
+  if (isPrimary() && !managed_) {
+    SQLiteDBManager::getConnection(true)->cacheStatement(query, stmt);
+    return;
+  }
+
+  WriteLock lock(statements_mutex_);
+  statements_.push_front(std::make_pair(query, stmt));
+  while (statements_.size() > FLAGS_statement_cache_size) {
+    sqlite3_finalize(statements_.back().second);
+    statements_.pop_back();
+  }
+}
+
+void SQLiteDBInstance::clearStatements() {
+  if (isPrimary() && !managed_) {
+    SQLiteDBManager::getConnection(true)->clearStatements();
+    return;
+  }
+  finalizeStatements();
+}
+
+void SQLiteDBInstance::finalizeStatements() {
+  WriteLock lock(statements_mutex_);
+  for (const auto& statement : statements_) {
+    sqlite3_finalize(statement.second);
+  }
+  statements_.clear();
 }
 
 SQLiteDBInstance::~SQLiteDBInstance() {
+  // Statements must be finalized before their database is closed.
   if (!isPrimary() && db_ != nullptr) {
+    finalizeStatements();
     sqlite3_close(db_);
   } else {
+    if (managed_) {
+      finalizeStatements();
+    }
     db_ = nullptr;
   }
 }
 
 SQLiteDBManager::SQLiteDBManager() : db_(nullptr) {
+  // The allocator must be installed before SQLite initializes.
+  configureSQLiteMemory();
   sqlite3_soft_heap_limit64(1);
   setDisabledTables(Flag::getValue("disable_tables"));
 }
@@ -297,29 +581,164 @@ SQLiteDBInstanceRef SQLiteDBManager::getUnique() {
 
 SQLiteDBInstanceRef SQLiteDBManager::getConnection(bool primary) {
   auto& self = instance();
-  WriteLock lock(self.create_mutex_);
+  {
+    WriteLock lock(self.create_mutex_);
+    if (self.db_ == nullptr) {
+      // Create primary SQLite DB instance.
+      openOptimized(self.db_);
+      self.connection_ = SQLiteDBInstanceRef(new SQLiteDBInstance(self.db_));
+      attachVirtualTables(self.connection_);
+    }
 
-  if (self.db_ == nullptr) {
-    // Create primary SQLite DB instance.
-    openOptimized(self.db_);
-    self.connection_ = SQLiteDBInstanceRef(new SQLiteDBInstance(self.db_));
-    attachVirtualTables(self.connection_);
-  }
+    // Internal usage may request the primary connection explicitly.
+    if (primary) {
+      return self.connection_;
+    }
 
-  // Internal usage may request the primary connection explicitly.
-  if (primary) {
-    return self.connection_;
+    // Create a 'database connection' for the managed database instance.
+    auto instance = std::make_shared<SQLiteDBInstance>(self.db_, self.mutex_);
+    if (instance->isPrimary()) {
+      WriteLock pool_lock(self.pool_mutex_);
+      self.stats_.primary++;
+      return instance;
+    }
   }
 
-  // Create a 'database connection' for the managed database instance.
-  auto instance = std::make_shared<SQLiteDBInstance>(self.db_, self.mutex_);
-  if (!instance->isPrimary()) {
-    attachVirtualTables(instance);
+  // The primary database is in use, do not wait for it.
+  return self.getPooled();
+}
+
+/// The maximum number of idle pooled connections.
+static size_t getPoolSize() {
+  // Each schedule worker and one other caller may contend for the primary.
+  return FLAGS_schedule_workers + 1;
+}
+
+/// Set when the manager is destroyed, connections are no longer pooled.
+static std::atomic<bool> kPoolClosed{false};
+
+SQLiteDBInstanceRef SQLiteDBManager::getPooled() {
+  size_t generation = 0;
+  {
+    WriteLock lock(pool_mutex_);
+    stats_.contended++;
+    if (!idle_.empty()) {
+      stats_.reused++;
+      auto instance = idle_.back().release();
+      idle_.pop_back();
+      return SQLiteDBInstanceRef(instance, releasePooled);
+    }
+    stats_.opened++;
+    generation = generation_;
   }
+
+  VLOG(1) << "DBManager contention: opening transient SQLite database";
+  auto instance = SQLiteDBInstanceRef(new SQLiteDBInstance(), releasePooled);
+  instance->generation_ = generation;
+  attachVirtualTables(instance);
   return instance;
 }
 
+void SQLiteDBManager::releasePooled(SQLiteDBInstance* instance) {
+  // The connection is closed when it is not returned to the pool.
+  std::unique_ptr<SQLiteDBInstance> connection(instance);
+  if (kPoolClosed) {
+    return;
+  }
+
+  // Per-query state is not shared with the next user of the connection.
+  connection->clearAffectedTables();
+
+  auto& self = SQLiteDBManager::instance();
+  WriteLock lock(self.pool_mutex_);
+  if (connection->generation_ == self.generation_ &&
+      self.idle_.size() < getPoolSize()) {
+    self.idle_.push_back(std::move(connection));
+  }
+}
+
+void SQLiteDBManager::resetPool() {
+  auto& self = instance();
+  std::vector<std::unique_ptr<SQLiteDBInstance>> idle;
+  WriteLock lock(self.pool_mutex_);
+  self.generation_++;
+  idle.swap(self.idle_);
+}
+
+size_t SQLiteDBManager::releaseMemory() {
+  auto before = memoryStats().used;
+  auto& self = instance();
+  {
+    std::vector<std::unique_ptr<SQLiteDBInstance>> idle;
+    WriteLock lock(self.pool_mutex_);
+    idle.swap(self.idle_);
+  }
+
+  {
+    // A query executing on the primary database keeps its memory.
+    WriteLock lock(self.mutex_, MUTEX_IMPL::try_to_lock);
+    if (lock.owns_lock() && self.db_ != nullptr) {
+      sqlite3_db_release_memory(self.db_);
+    }
+  }
+  sqlite3_release_memory(std::numeric_limits<int>::max());
+
+  auto after = memoryStats().used;
+  return ((before > after) ? before - after : 0) + trimSQLiteMemory();
+}
+
+size_t SQLiteDBManager::reclaimMemory() {
+  auto before = memoryStats().used;
+  auto& self = instance();
+  {
+    // Idle pooled connections are not executing a query.
+    WriteLock lock(self.pool_mutex_);
+    for (const auto& idle : self.idle_) {
+      sqlite3_db_release_memory(idle->db());
+    }
+  }
+
+  {
+    // A query executing on the primary database keeps its memory.
+    WriteLock lock(self.mutex_, MUTEX_IMPL::try_to_lock);
+    if (lock.owns_lock() && self.db_ != nullptr) {
+      sqlite3_db_release_memory(self.db_);
+    }
+  }
+  sqlite3_release_memory(std::numeric_limits<int>::max());
+
+  auto after = memoryStats().used;
+  return ((before > after) ? before - after : 0) + trimSQLiteMemory();
+}
+
+/// Under memory pressure release SQLite memory and cached query results.
+static std::string shedSQLiteMemory(MemoryPressureLevel level) {
+  if (level == MemoryPressureLevel::NONE) {
+    return "";
+  }
+
+  auto results = QueryResultsCache::size();
+  QueryResultsCache::clear();
+  auto bytes = SQLiteDBManager::releaseMemory();
+  return "released " + std::to_string(bytes) + " bytes of SQLite memory and " +
+         std::to_string(results) + " cached query results";
+}
+
+static bool kSQLiteMemoryShedding =
+    (MemoryPressure::addHandler("sqlite", shedSQLiteMemory), true);
+
+SQLiteDBPoolStats SQLiteDBManager::poolStats() {
+  auto& self = instance();
+  ReadLock lock(self.pool_mutex_);
+  auto stats = self.stats_;
+  stats.idle = self.idle_.size();
+  stats.size = getPoolSize();
+  return stats;
+}
+
 SQLiteDBManager::~SQLiteDBManager() {
+  kPoolClosed = true;
+  idle_.clear();
   connection_ = nullptr;
   if (db_ != nullptr) {
     sqlite3_close(db_);
@@ -327,9 +746,56 @@ SQLiteDBManager::~SQLiteDBManager() {
   }
 }
 
+/// The virtual table scans of a plan name their constraint set index.
+static const std::string kPlanIndexPrefix{"VIRTUAL TABLE INDEX "};
+
+/**
+ * @brief Estimate the cost of a query plan's nested virtual table scans.
+ *
+ * The scans of each select are listed from the outermost loop, so a scan is
+ * filtered once for each row expected from the scans listed before it.
+ */
+static double estimatePlanCost(const QueryData& plan,
+                               const PlanEstimates& estimates) {
+  double cost = 0;
+  std::map<std::string, double> outer_rows;
+  for (const auto& row : plan) {
+    const auto& detail = row.at("detail");
+    auto position = detail.find(kPlanIndexPrefix);
+    if (position == std::string::npos) {
+      continue;
+    }
+
+    auto index = std::strtol(
+        detail.c_str() + position + kPlanIndexPrefix.size(), nullptr, 10);
+    PlanEstimates::Estimate estimate;
+    if (!estimates.find(static_cast<int>(index), estimate)) {
+      continue;
+    }
+
+    // Older versions of SQLite number each select, later versions list the
+    // parent of each loop.
+    std::string select;
+    if (row.count("selectid") > 0) {
+      select = row.at("selectid");
+    } else if (row.count("parent") > 0) {
+      select = row.at("parent");
+    }
+    auto loops = outer_rows.emplace(select, 1.0).first;
+    cost += loops->second * estimate.cost;
+    loops->second *= std::max(1.0, estimate.rows);
+  }
+  return cost;
+}
+
 QueryPlanner::QueryPlanner(const std::string& query, sqlite3* db) {
   QueryData plan;
-  queryInternal("EXPLAIN QUERY PLAN " + query, plan, db);
+  {
+    // Record the estimates of the constraint sets SQLite considers.
+    PlanEstimates estimates;
+    queryInternal("EXPLAIN QUERY PLAN " + query, plan, db);
+    cost_ = estimatePlanCost(plan, estimates);
+  }
   queryInternal("EXPLAIN " + query, program_, db);
 
   for (const auto& row : plan) {
@@ -338,6 +804,22 @@ QueryPlanner::QueryPlanner(const std::string& query, sqlite3* db) {
   }
 }
 
+Status checkQueryCost(const std::string& query, sqlite3* db) {
+  if (FLAGS_query_cost_budget == 0) {
+    return Status(0, "OK");
+  }
+
+  QueryPlanner planner(query, db);
+  auto cost = planner.estimatedCost();
+  if (cost > static_cast<double>(FLAGS_query_cost_budget)) {
+    std::stringstream message;
+    message << "Query estimated cost " << std::fixed << std::setprecision(0)
+            << cost << " exceeds the budget of " << FLAGS_query_cost_budget;
+    return Status(1, message.str());
+  }
+  return Status(0, "OK");
+}
+
 Status QueryPlanner::applyTypes(TableColumns& columns) {
   std::map<size_t, ColumnType> column_types;
   for (const auto& row : program_) {
@@ -396,18 +878,177 @@ int queryDataCallback(void* argument, int argc, char* argv[], char* column[]) {
   return 0;
 }
 
-Status queryInternal(const std::string& q, QueryData& results, sqlite3* db) {
-  char* err = nullptr;
-  sqlite3_exec(db, q.c_str(), queryDataCallback, &results, &err);
-  sqlite3_db_release_memory(db);
-  if (err != nullptr) {
-    auto error_string = std::string(err);
-    sqlite3_free(err);
-    return Status(1, "Error running query: " + error_string);
+/// Step a prepared statement and accumulate each row into the results.
+static Status readStatementRows(sqlite3_stmt* stmt,
+                                QueryData& results,
+                                sqlite3* db,
+                                const QueryRowCallback* callback) {
+  // Cursors of the statement share the results of repeated filters.
+  StatementMemo memo;
+
+  // Row keys are copied from the names of the statement's columns.
+  auto count = sqlite3_column_count(stmt);
+  std::vector<std::string> columns;
+  std::vector<bool> named;
+  for (int i = 0; i < count; i++) {
+    auto name = sqlite3_column_name(stmt, i);
+    named.push_back(name != nullptr);
+    columns.push_back((name != nullptr) ? name : std::string());
+  }
+
+  int rc = SQLITE_OK;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    Row r;
+    for (int i = 0; i < count; i++) {
+      if (!named[i]) {
+        continue;
+      }
+
+      auto cell = r.emplace(columns[i], std::string());
+      if (!cell.second) {
+        // Found a column name collision in the result.
+        VLOG(1) << "Detected overloaded column name " << columns[i]
+                << " in query result consider using aliases";
+      }
+      auto value = sqlite3_column_text(stmt, i);
+      if (value == nullptr) {
+        cell.first->second = FLAGS_nullvalue;
+      } else {
+        cell.first->second.assign(reinterpret_cast<const char*>(value),
+                                  sqlite3_column_bytes(stmt, i));
+      }
+    }
+    if (callback == nullptr) {
+      results.push_back(std::move(r));
+      continue;
+    }
+
+    auto status = (*callback)(std::move(r));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  if (rc == SQLITE_INTERRUPT) {
+    return Status(1, "Query interrupted: its time budget was spent");
+  } else if (rc != SQLITE_DONE) {
+    return Status(1, "Error running query: " + std::string(sqlite3_errmsg(db)));
+  }
+  return Status(0, "OK");
+}
+
+/// Prepare the first statement of a query, tail points to the remainder.
+static Status prepareStatement(sqlite3* db,
+                               const char* query,
+                               sqlite3_stmt** stmt,
+                               const char** tail,
+                               bool persistent) {
+#if SQLITE_VERSION_NUMBER >= 3020000
+  // Persistent statements are allocated outside of the lookaside memory.
+  auto rc = sqlite3_prepare_v3(db,
+                               query,
+                               -1,
+                               (persistent) ? SQLITE_PREPARE_PERSISTENT : 0,
+                               stmt,
+                               tail);
+#else
+  (void)persistent;
+  auto rc = sqlite3_prepare_v2(db, query, -1, stmt, tail);
+#endif
+  if (rc != SQLITE_OK) {
+    if (*stmt != nullptr) {
+      sqlite3_finalize(*stmt);
+      *stmt = nullptr;
+    }
+    return Status(1, "Error running query: " + std::string(sqlite3_errmsg(db)));
   }
   return Status(0, "OK");
 }
 
+/// Check if the remainder of a query contains only whitespace.
+static bool isEmptyTail(const char* tail) {
+  while (tail != nullptr && *tail != '\0') {
+    if (!std::isspace(static_cast<unsigned char>(*tail))) {
+      return false;
+    }
+    tail++;
+  }
+  return true;
+}
+
+/// Execute a query, passing each row to the callback if one is set.
+static Status executeInternal(const std::string& q,
+                              QueryData& results,
+                              sqlite3* db,
+                              const QueryRowCallback* callback) {
+  // Each statement within the query is executed in order.
+  Status status(0, "OK");
+  const char* query = q.c_str();
+  while (status.ok() && query != nullptr && *query != '\0') {
+    sqlite3_stmt* stmt = nullptr;
+    const char* tail = nullptr;
+    status = prepareStatement(db, query, &stmt, &tail, false);
+    if (stmt != nullptr) {
+      // Comments and whitespace do not create a statement.
+      status = readStatementRows(stmt, results, db, callback);
+      sqlite3_finalize(stmt);
+    }
+    query = tail;
+  }
+  sqlite3_db_release_memory(db);
+  return status;
+}
+
+Status queryInternal(const std::string& q, QueryData& results, sqlite3* db) {
+  return executeInternal(q, results, db, nullptr);
+}
+
+/// Execute a query using the connection's cached statements.
+static Status executeInternal(const std::string& q,
+                              QueryData& results,
+                              const SQLiteDBInstanceRef& dbc,
+                              const QueryRowCallback* callback) {
+  dbc->refreshAttached();
+  auto db = dbc->db();
+  if (FLAGS_statement_cache_size == 0) {
+    return executeInternal(q, results, db, callback);
+  }
+
+  auto stmt = dbc->takeStatement(q);
+  if (stmt == nullptr) {
+    const char* tail = nullptr;
+    auto status = prepareStatement(db, q.c_str(), &stmt, &tail, true);
+    if (!status.ok()) {
+      return status;
+    }
+
+    if (stmt == nullptr || !isEmptyTail(tail)) {
+      // Only single statement queries are cached.
+      if (stmt != nullptr) {
+        sqlite3_finalize(stmt);
+      }
+      return executeInternal(q, results, db, callback);
+    }
+  }
+
+  auto status = readStatementRows(stmt, results, db, callback);
+  if (status.ok()) {
+    // Resetting releases the statement's virtual table cursors.
+    sqlite3_reset(stmt);
+    dbc->cacheStatement(q, stmt);
+  } else {
+    sqlite3_finalize(stmt);
+  }
+  sqlite3_db_release_memory(db);
+  return status;
+}
+
+Status queryInternal(const std::string& q,
+                     QueryData& results,
+                     const SQLiteDBInstanceRef& dbc) {
+  return executeInternal(q, results, dbc, nullptr);
+}
+
 Status getQueryColumnsInternal(const std::string& q,
                                TableColumns& columns,
                                sqlite3* db) {
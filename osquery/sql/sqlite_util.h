@@ -11,9 +11,12 @@
 #pragma once
 
 #include <atomic>
+#include <functional>
+#include <list>
 #include <map>
 #include <mutex>
 #include <unordered_set>
+#include <vector>
 
 #include <sqlite3.h>
 
@@ -68,10 +71,47 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Clear per-query state of a table affected by the use of this instance.
   void clearAffectedTables();
 
+  /**
+   * @brief The generation of each table affected by the use of this instance.
+   *
+   * @return each scanned table's generation, empty if any table's is empty.
+   */
+  std::map<std::string, std::string> getGenerations() const;
+
+  /// The cost of each table affected by the use of this instance.
+  std::map<std::string, TableCost> getTableCosts() const;
+
+  /// The objects shared by the tables scanned by the executing query.
+  std::shared_ptr<QueryState> getQueryState();
+
+  /**
+   * @brief Remove a prepared statement for a query from the cache.
+   *
+   * The caller owns the returned statement until it is returned using
+   * SQLiteDBInstance::cacheStatement, so a statement is never stepped by two
+   * callers at once.
+   *
+   * @param query The complete query text used to prepare the statement.
+   * @return The reset statement, or nullptr if none is cached.
+   */
+  sqlite3_stmt* takeStatement(const std::string& query);
+
+  /// Return a reset statement to the cache, evicting the least recently used.
+  void cacheStatement(const std::string& query, sqlite3_stmt* stmt);
+
+  /// Finalize every cached statement, such as when the schema changes.
+  void clearStatements();
+
+  /// Attach the current copies of attached databases, see AttachedDatabases.
+  void refreshAttached();
+
  private:
   /// Handle the primary/forwarding requests for table attribute accesses.
   TableAttributes getAttributes() const;
 
+  /// Finalize cached statements without forwarding to the primary.
+  void finalizeStatements();
+
  private:
   /// An opaque constructor only used by the DBManager.
   explicit SQLiteDBInstance(sqlite3* db)
@@ -93,16 +133,82 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Vector of tables that need their constraints cleared after execution.
   std::map<std::string, VirtualTableContent*> affected_tables_;
 
+  /// Objects shared by the affected tables, released with the tables.
+  std::shared_ptr<QueryState> query_state_;
+
+  /// Prepared statements and their query text, most recently used first.
+  std::list<std::pair<std::string, sqlite3_stmt*>> statements_;
+
+  /// Protect the cached statements.
+  Mutex statements_mutex_;
+
+  /// The table attach generation when a pooled connection was opened.
+  size_t generation_{0};
+
+  /// The generation of attached database copies used by the connection.
+  size_t attached_generation_{0};
+
  private:
   friend class SQLiteDBManager;
   friend class SQLInternal;
 
  private:
   FRIEND_TEST(SQLiteUtilTests, test_affected_tables);
+  FRIEND_TEST(SQLiteUtilTests, test_statement_cache);
 };
 
 using SQLiteDBInstanceRef = std::shared_ptr<SQLiteDBInstance>;
 
+/// Counters for connections handed out by the SQLiteDBManager.
+struct SQLiteDBPoolStats {
+  /// Requests that received the primary database.
+  size_t primary{0};
+
+  /// Requests made while the primary database was in use.
+  size_t contended{0};
+
+  /// Contended requests that reused an idle pooled connection.
+  size_t reused{0};
+
+  /// Contended requests that opened and attached a new connection.
+  size_t opened{0};
+
+  /// The number of idle pooled connections.
+  size_t idle{0};
+
+  /// The maximum number of idle pooled connections.
+  size_t size{0};
+};
+
+/// Counters of the osquery SQLite memory allocator.
+struct SQLiteMemoryStats {
+  /// Bytes currently allocated by SQLite.
+  size_t used{0};
+
+  /// The most bytes allocated by SQLite at once.
+  size_t peak{0};
+
+  /// Bytes of arena chunks reserved for small allocations.
+  size_t arena{0};
+
+  /// Small allocations served from a free list instead of carved or malloc.
+  size_t recycled{0};
+};
+
+/**
+ * @brief Install the osquery SQLite allocator and size SQLite's caches.
+ *
+ * This must run before SQLite initializes, later calls have no effect.
+ * Small allocations, most of a query's churn of records and values, are
+ * served from per-size-class free lists carved out of arena chunks. The
+ * arena, the lookaside slots, and the process's page cache buffer are sized
+ * from the watchdog memory limit.
+ */
+void configureSQLiteMemory();
+
+/// Return arena chunks without allocations to malloc, returns their bytes.
+size_t trimSQLiteMemory();
+
 /**
  * @brief osquery internal SQLite DB abstraction resource management.
  *
@@ -129,6 +235,8 @@ class SQLiteDBManager : private boost::noncopyable {
    * scope. Using the SQLiteDBManager will also try to optimize the number of
    * `sqlite3` databases in use by managing a single global instance and
    * returning resource-safe transient databases if there's access contention.
+   * Transient databases are kept attached in a pool when released, sized to
+   * the scheduler's workers, so concurrent queries do not re-attach tables.
    *
    * Note: osquery::initOsquery must be called before calling `get` in order
    * for virtual tables to be registered.
@@ -161,6 +269,43 @@ class SQLiteDBManager : private boost::noncopyable {
    */
   static bool isDisabled(const std::string& table_name);
 
+  /// Counters for primary and pooled connection use.
+  static SQLiteDBPoolStats poolStats();
+
+  /// Counters of the memory allocated by SQLite.
+  static SQLiteMemoryStats memoryStats();
+
+  /**
+   * @brief Release pooled connections attached with an outdated schema.
+   *
+   * Called when tables are attached or detached from the primary database.
+   * Idle connections are closed, and connections in use are closed when they
+   * are released.
+   */
+  static void resetPool();
+
+  /**
+   * @brief Release memory held by SQLite, used under memory pressure.
+   *
+   * Idle pooled connections are closed, and the primary database releases
+   * its page cache if it is not executing a query. Arena chunks without
+   * allocations are returned.
+   *
+   * @return The bytes SQLite no longer has allocated.
+   */
+  static size_t releaseMemory();
+
+  /**
+   * @brief Release memory held by SQLite, keeping its connections.
+   *
+   * Connections release their page caches, and arena chunks without
+   * allocations are returned. Unlike resetPrimary, or releaseMemory, the
+   * connections keep their attached tables and prepared statements.
+   *
+   * @return The bytes SQLite and its arena no longer hold.
+   */
+  static size_t reclaimMemory();
+
  protected:
   SQLiteDBManager();
   virtual ~SQLiteDBManager();
@@ -191,6 +336,25 @@ class SQLiteDBManager : private boost::noncopyable {
   /// Request a connection, optionally request the primary connection.
   static SQLiteDBInstanceRef getConnection(bool primary = false);
 
+  /// Take an idle pooled connection, or open and attach a new connection.
+  SQLiteDBInstanceRef getPooled();
+
+  /// Return a pooled connection when its last reference is released.
+  static void releasePooled(SQLiteDBInstance* instance);
+
+ private:
+  /// Idle connections with every virtual table attached.
+  std::vector<std::unique_ptr<SQLiteDBInstance>> idle_;
+
+  /// Incremented when the attached tables change.
+  size_t generation_{0};
+
+  /// Connection use counters, the idle and size counters are computed.
+  SQLiteDBPoolStats stats_;
+
+  /// Protect the idle connections, generation, and counters.
+  Mutex pool_mutex_;
+
  private:
   friend class SQLiteDBInstance;
   friend class SQLiteSQLPlugin;
@@ -226,6 +390,19 @@ class QueryPlanner : private boost::noncopyable {
    */
   Status applyTypes(TableColumns& columns);
 
+  /**
+   * @brief The estimated cost of executing the query.
+   *
+   * Each virtual table scan costs the estimate its table returned for the
+   * chosen constraints, as used by SQLite to order joins, once for every row
+   * expected from the scans outside of it. A table without a declared
+   * cardinality is assumed to scan as if it had 200 rows, and a scan missing
+   * a required constraint costs 1e10.
+   */
+  double estimatedCost() const {
+    return cost_;
+  }
+
   /**
    * @brief A helper structure to represent an opcode's result and type.
    *
@@ -257,11 +434,26 @@ class QueryPlanner : private boost::noncopyable {
   QueryData program_;
   /// The order of tables scanned.
   std::vector<std::string> tables_;
+
+  /// The estimated cost of the query.
+  double cost_{0};
 };
 
 /// Specific SQLite opcodes that change column/expression type.
 extern const std::map<std::string, QueryPlanner::Opcode> kSQLOpcodes;
 
+/**
+ * @brief Check a query's estimated cost against `--query_cost_budget`.
+ *
+ * Distributed queries above the budget are rejected with this status, and
+ * scheduled queries above it run as low priority queries.
+ *
+ * @param query the query to plan.
+ * @param db the SQLite3 database used to plan the query.
+ * @return failure explaining the cost if it exceeds a nonzero budget.
+ */
+Status checkQueryCost(const std::string& query, sqlite3* db);
+
 /**
  * @brief SQLite Internal: Execute a query on a specific database
  *
@@ -277,6 +469,24 @@ extern const std::map<std::string, QueryPlanner::Opcode> kSQLOpcodes;
  */
 Status queryInternal(const std::string& q, QueryData& results, sqlite3* db);
 
+/**
+ * @brief SQLite Internal: Execute a query using a connection's statements.
+ *
+ * Single-statement queries are prepared once for each connection and reused
+ * by later executions with the same query text, such as scheduled and
+ * distributed queries. The cache is cleared when tables are attached to or
+ * detached from the connection.
+ *
+ * @param q the query to execute
+ * @param results The QueryData struct to emit row on query success.
+ * @param dbc the connection to execute query q against
+ *
+ * @return A status indicating SQL query results.
+ */
+Status queryInternal(const std::string& q,
+                     QueryData& results,
+                     const SQLiteDBInstanceRef& dbc);
+
 /**
  * @brief SQLite Intern: Analyze a query, providing information about the
  * result columns
@@ -299,6 +509,55 @@ Status getQueryColumnsInternal(const std::string& q,
 /**
  * @brief SQLInternal: SQL, but backed by internal calls.
  */
+/// The results of a recent query execution.
+struct QueryResultsCacheEntry {
+  /// The time the query was executed.
+  size_t time{0};
+
+  /// The unescaped result rows.
+  QueryData results;
+
+  /// The query used event-based tables.
+  bool event_based{false};
+
+  /// The generations of the tables scanned by the query.
+  std::map<std::string, std::string> generations;
+};
+
+/**
+ * @brief A short-lived cache of query results keyed by the query text.
+ *
+ * Extensions frequently ask the core to run the same queries as the schedule,
+ * such as SELECT * FROM users. When --query_results_cache_ttl is set callers
+ * that opt-in reuse results executed within that many seconds.
+ */
+class QueryResultsCache : private boost::noncopyable {
+ public:
+  /// True if results are cached.
+  static bool enabled();
+
+  /// Get a fresh entry for a query, or nullptr.
+  static std::shared_ptr<const QueryResultsCacheEntry> get(
+      const std::string& q);
+
+  /// Store the results of a query, replacing the least-recent if full.
+  static void put(const std::string& q,
+                  std::shared_ptr<const QueryResultsCacheEntry> entry);
+
+  /// Remove every entry.
+  static void clear();
+
+  /// The number of entries, including expired entries.
+  static size_t size();
+};
+
+/**
+ * @brief Receives each row of a query as the statement produces it.
+ *
+ * A failed status stops the statement, and the query returns the status.
+ */
+using QueryRowCallback = std::function<Status(Row&&)>;
+
 class SQLInternal : public SQL {
  public:
   /**
@@ -308,6 +567,46 @@ class SQLInternal : public SQL {
    */
   explicit SQLInternal(const std::string& q);
 
+  /**
+   * @brief Instantiate an instance of the class using a specific connection.
+   *
+   * Callers executing queries concurrently may use their own connection
+   * from SQLiteDBManager::getUnique rather than contend for the primary.
+   *
+   * @param q An osquery SQL query.
+   * @param dbc The SQLite database instance used to execute the query.
+   */
+  SQLInternal(const std::string& q, const SQLiteDBInstanceRef& dbc);
+
+  /**
+   * @brief Instantiate an instance of the class that may reuse results.
+   *
+   * When the QueryResultsCache is enabled and holds a fresh entry for the
+   * query the results are copied from it and no tables are scanned.
+   * Otherwise successful results are stored for other callers.
+   *
+   * @param q An osquery SQL query.
+   * @param dbc The SQLite database instance used to execute the query.
+   * @param use_cache Reuse and store the results of the query.
+   */
+  SQLInternal(const std::string& q,
+              const SQLiteDBInstanceRef& dbc,
+              bool use_cache);
+
+  /**
+   * @brief Instantiate an instance of the class that streams its rows.
+   *
+   * Each row is passed to the callback, rather than kept in the results, so
+   * large results are not held in memory. The QueryResultsCache is not used.
+   *
+   * @param q An osquery SQL query.
+   * @param dbc The SQLite database instance used to execute the query.
+   * @param callback Receives each result row.
+   */
+  SQLInternal(const std::string& q,
+              const SQLiteDBInstanceRef& dbc,
+              const QueryRowCallback& callback);
+
  public:
   /**
    * @brief Check if the SQL query's results use event-based tables.
@@ -324,9 +623,44 @@ class SQLInternal : public SQL {
     return event_based_;
   }
 
+  /**
+   * @brief The TablePlugin::generation of each table the query scanned.
+   *
+   * This is empty if any scanned table does not declare a generation, in
+   * which case the results may change without any generation changing.
+   */
+  const std::map<std::string, std::string>& generations() const {
+    return generations_;
+  }
+
+  /// The filters, generate time, and rows of each table the query scanned.
+  const std::map<std::string, TableCost>& tableCosts() const {
+    return table_costs_;
+  }
+
+  /// The results were copied from the QueryResultsCache.
+  bool cached() const {
+    return cached_;
+  }
+
+ private:
+  /// Execute the query and inspect the tables it scanned.
+  void execute(const std::string& q,
+               const SQLiteDBInstanceRef& dbc,
+               const QueryRowCallback* callback = nullptr);
+
  private:
+  /// The results were copied from the QueryResultsCache.
+  bool cached_{false};
+
   /// Before completing the execution, store a check for EVENT_BASED.
   bool event_based_{false};
+
+  /// The generations of the tables scanned by the query.
+  std::map<std::string, std::string> generations_;
+
+  /// The cost of the tables scanned by the query.
+  std::map<std::string, TableCost> table_costs_;
 };
 
 /**
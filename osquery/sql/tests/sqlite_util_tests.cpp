@@ -15,11 +15,16 @@
 #include <osquery/core.h>
 #include <osquery/sql.h>
 
+#include "osquery/sql/attach.h"
 #include "osquery/sql/sqlite_util.h"
+#include "osquery/sql/virtual_table.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
 
+DECLARE_uint64(query_results_cache_ttl);
+DECLARE_uint64(attached_database_refresh);
+
 class SQLiteUtilTests : public testing::Test {};
 
 std::shared_ptr<SQLiteDBInstance> getTestDBC() {
@@ -48,6 +53,100 @@ TEST_F(SQLiteUtilTests, test_simple_query_execution) {
   EXPECT_EQ(sql.rows().size(), 1U);
 }
 
+/// Write a foreign database with a single table of urls.
+static void writeTestHistory(const std::string& path,
+                             const std::vector<std::string>& urls) {
+  sqlite3* db = nullptr;
+  sqlite3_open(path.c_str(), &db);
+  sqlite3_exec(db,
+               "DROP TABLE IF EXISTS urls; CREATE TABLE urls (url TEXT)",
+               nullptr,
+               nullptr,
+               nullptr);
+  for (const auto& url : urls) {
+    auto statement = "INSERT INTO urls VALUES ('" + url + "')";
+    sqlite3_exec(db, statement.c_str(), nullptr, nullptr, nullptr);
+  }
+  sqlite3_close(db);
+}
+
+TEST_F(SQLiteUtilTests, test_attached_databases) {
+  auto path = kTestWorkingDirectory + "attached_history.db";
+  writeTestHistory(path, {"https://osquery.io", "https://example.com"});
+
+  // Check the database files for every query.
+  FLAGS_attached_database_refresh = 0;
+  AttachedDatabaseSource source;
+  source.pattern = path;
+  source.query = "SELECT url FROM {{db}}.urls";
+  ASSERT_TRUE(AttachedDatabases::set({{"test_history", source}}).ok());
+
+  auto dbc = SQLiteDBManager::getUnique();
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT url, attached_path FROM test_history WHERE url LIKE '%osquery%'",
+      results,
+      dbc);
+  ASSERT_TRUE(status.ok()) << status.getMessage();
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("https://osquery.io", results[0]["url"]);
+  EXPECT_EQ(path, results[0]["attached_path"]);
+
+  // The view is updated when the database is replaced.
+  writeTestHistory(path + ".new", {"https://osquery.io"});
+  ASSERT_EQ(0, rename((path + ".new").c_str(), path.c_str()));
+  results.clear();
+  status = queryInternal("SELECT url FROM test_history", results, dbc);
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(1U, results.size());
+
+  // The attached copy is read only.
+  results.clear();
+  status = queryInternal(
+      "DELETE FROM attached_test_history_0.urls", results, dbc);
+  EXPECT_FALSE(status.ok());
+
+  // Names must use the {{db}} schema and must not be tables.
+  source.query = "SELECT url FROM urls";
+  EXPECT_FALSE(AttachedDatabases::set({{"test_history", source}}).ok());
+  source.query = "SELECT 1 FROM {{db}}.urls";
+  EXPECT_FALSE(AttachedDatabases::set({{"time", source}}).ok());
+
+  ASSERT_TRUE(AttachedDatabases::set({}).ok());
+  results.clear();
+  status = queryInternal("SELECT url FROM test_history", results, dbc);
+  EXPECT_FALSE(status.ok());
+  EXPECT_TRUE(AttachedDatabases::attached().empty());
+  FLAGS_attached_database_refresh = 60;
+}
+
+TEST_F(SQLiteUtilTests, test_attached_database_limit) {
+  // More databases match than a connection may attach.
+  for (size_t i = 0; i < 12; i++) {
+    writeTestHistory(
+        kTestWorkingDirectory + "attached_many_" + std::to_string(i) + ".db",
+        {"https://osquery.io"});
+  }
+
+  FLAGS_attached_database_refresh = 0;
+  AttachedDatabaseSource source;
+  source.pattern = kTestWorkingDirectory + "attached_many_%.db";
+  source.query = "SELECT url FROM {{db}}.urls";
+  ASSERT_TRUE(AttachedDatabases::set({{"test_many", source}}).ok());
+
+  auto dbc = SQLiteDBManager::getUnique();
+  auto limit = sqlite3_limit(dbc->db(), SQLITE_LIMIT_ATTACHED, -1);
+  QueryData results;
+  auto status = queryInternal("SELECT url FROM test_many", results, dbc);
+  ASSERT_TRUE(status.ok()) << status.getMessage();
+  EXPECT_EQ(static_cast<size_t>(std::min(limit, 12)), results.size());
+
+  ASSERT_TRUE(AttachedDatabases::set({}).ok());
+  AttachedDatabases::shutdown();
+  EXPECT_TRUE(AttachedDatabases::attached().empty());
+  FLAGS_attached_database_refresh = 60;
+}
+
 TEST_F(SQLiteUtilTests, test_sqlite_instance_manager) {
   auto dbc1 = SQLiteDBManager::get();
   auto dbc2 = SQLiteDBManager::get();
@@ -64,6 +163,42 @@ TEST_F(SQLiteUtilTests, test_sqlite_instance) {
   EXPECT_EQ(internal_db, SQLiteDBManager::get()->db());
 }
 
+TEST_F(SQLiteUtilTests, test_connection_pool) {
+  SQLiteDBManager::resetPool();
+  auto before = SQLiteDBManager::poolStats();
+  EXPECT_EQ(0U, before.idle);
+
+  // While the primary is in use, a pooled connection is opened and attached.
+  auto primary = SQLiteDBManager::get();
+  ASSERT_TRUE(primary->isPrimary());
+  sqlite3* pooled_db = nullptr;
+  {
+    auto pooled = SQLiteDBManager::get();
+    EXPECT_FALSE(pooled->isPrimary());
+    pooled_db = pooled->db();
+
+    QueryData results;
+    EXPECT_TRUE(queryInternal("SELECT * FROM time", results, pooled).ok());
+    EXPECT_EQ(1U, results.size());
+  }
+
+  // The released connection is idle and reused by the next contended request.
+  auto stats = SQLiteDBManager::poolStats();
+  EXPECT_EQ(before.contended + 1, stats.contended);
+  EXPECT_EQ(before.opened + 1, stats.opened);
+  EXPECT_EQ(1U, stats.idle);
+  {
+    auto pooled = SQLiteDBManager::get();
+    EXPECT_EQ(pooled_db, pooled->db());
+  }
+  stats = SQLiteDBManager::poolStats();
+  EXPECT_EQ(before.reused + 1, stats.reused);
+
+  // Changing the attached tables releases idle connections.
+  SQLiteDBManager::resetPool();
+  EXPECT_EQ(0U, SQLiteDBManager::poolStats().idle);
+}
+
 TEST_F(SQLiteUtilTests, test_reset) {
   auto internal_db = SQLiteDBManager::get()->db();
   ASSERT_NE(nullptr, internal_db);
@@ -84,6 +219,52 @@ TEST_F(SQLiteUtilTests, test_reset) {
   EXPECT_EQ(results.size(), 0U);
 }
 
+TEST_F(SQLiteUtilTests, test_reclaim_memory) {
+  SQLiteDBManager::resetPool();
+  auto internal_db = SQLiteDBManager::get()->db();
+  ASSERT_NE(nullptr, internal_db);
+  sqlite3_exec(internal_db,
+               "create view test_reclaim_view as select 'test' as t;",
+               nullptr,
+               nullptr,
+               nullptr);
+
+  // Open a pooled connection while the primary is in use.
+  sqlite3* pooled_db = nullptr;
+  {
+    auto primary = SQLiteDBManager::get();
+    auto pooled = SQLiteDBManager::get();
+    ASSERT_FALSE(pooled->isPrimary());
+    pooled_db = pooled->db();
+  }
+  EXPECT_EQ(1U, SQLiteDBManager::poolStats().idle);
+
+  // Reclaiming memory keeps the primary and the idle connections.
+  SQLiteDBManager::reclaimMemory();
+  EXPECT_EQ(1U, SQLiteDBManager::poolStats().idle);
+  auto instance = SQLiteDBManager::get();
+  EXPECT_EQ(internal_db, instance->db());
+  {
+    auto pooled = SQLiteDBManager::get();
+    EXPECT_EQ(pooled_db, pooled->db());
+  }
+
+  QueryData results;
+  queryInternal("select * from test_reclaim_view", results, instance->db());
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("test", results[0]["t"]);
+  sqlite3_exec(internal_db,
+               "drop view test_reclaim_view;",
+               nullptr,
+               nullptr,
+               nullptr);
+
+  // Releasing memory under pressure closes the idle connections.
+  instance.reset();
+  SQLiteDBManager::releaseMemory();
+  EXPECT_EQ(0U, SQLiteDBManager::poolStats().idle);
+}
+
 TEST_F(SQLiteUtilTests, test_direct_query_execution) {
   auto dbc = getTestDBC();
   QueryData results;
@@ -92,6 +273,90 @@ TEST_F(SQLiteUtilTests, test_direct_query_execution) {
   EXPECT_EQ(results, getTestDBExpectedResults());
 }
 
+TEST_F(SQLiteUtilTests, test_statement_cache) {
+  auto dbc = getTestDBC();
+  QueryData results;
+  ASSERT_TRUE(queryInternal(kTestQuery, results, dbc).ok());
+  EXPECT_EQ(results, getTestDBExpectedResults());
+  EXPECT_EQ(1U, dbc->statements_.size());
+
+  // The cached statement is reused and returns the same results.
+  results.clear();
+  ASSERT_TRUE(queryInternal(kTestQuery, results, dbc).ok());
+  EXPECT_EQ(results, getTestDBExpectedResults());
+  EXPECT_EQ(1U, dbc->statements_.size());
+
+  // Multiple statements and failing queries are not cached.
+  results.clear();
+  ASSERT_TRUE(
+      queryInternal("SELECT 1 AS a; SELECT 2 AS a;", results, dbc).ok());
+  EXPECT_EQ(2U, results.size());
+  EXPECT_FALSE(queryInternal("SELECT * FROM not_a_table", results, dbc).ok());
+  EXPECT_EQ(1U, dbc->statements_.size());
+
+  // A reused statement filters virtual tables using the same constraints.
+  for (size_t i = 0; i < 2; i++) {
+    results.clear();
+    ASSERT_TRUE(
+        queryInternal("SELECT path FROM file WHERE path = '/'", results, dbc)
+            .ok());
+    ASSERT_EQ(1U, results.size());
+    EXPECT_EQ("/", results[0]["path"]);
+    dbc->clearAffectedTables();
+  }
+  EXPECT_EQ(2U, dbc->statements_.size());
+
+  // Attaching a table changes the schema and clears the cache.
+  attachTableInternal("test_attach", "(`test` TEXT)", dbc);
+  EXPECT_EQ(0U, dbc->statements_.size());
+}
+
+TEST_F(SQLiteUtilTests, test_query_results_cache) {
+  auto dbc = getTestDBC();
+  auto ttl = FLAGS_query_results_cache_ttl;
+  QueryResultsCache::clear();
+
+  // Without a TTL the results are not stored.
+  FLAGS_query_results_cache_ttl = 0;
+  SQLInternal uncached("SELECT * FROM test_table", dbc, true);
+  EXPECT_TRUE(uncached.ok());
+  EXPECT_FALSE(uncached.cached());
+  EXPECT_EQ(0U, QueryResultsCache::size());
+
+  FLAGS_query_results_cache_ttl = 60;
+  SQLInternal first("SELECT * FROM test_table", dbc, true);
+  EXPECT_FALSE(first.cached());
+  EXPECT_EQ(1U, QueryResultsCache::size());
+
+  // The second execution reuses the results until a row changes.
+  sqlite3_exec(dbc->db(),
+               "INSERT INTO test_table VALUES (\"amy\", 25)",
+               nullptr,
+               nullptr,
+               nullptr);
+  SQLInternal second("SELECT * FROM test_table", dbc, true);
+  EXPECT_TRUE(second.cached());
+  EXPECT_EQ(first.rows(), second.rows());
+
+  // Callers that do not opt-in scan the tables.
+  SQLInternal fresh("SELECT * FROM test_table", dbc);
+  EXPECT_FALSE(fresh.cached());
+  EXPECT_EQ(3U, fresh.rows().size());
+
+  // Results truncated by a budget's limits are not stored.
+  QueryResultsCache::clear();
+  {
+    QueryBudget budget(0);
+    budget.setTruncated();
+    SQLInternal truncated("SELECT * FROM test_table", dbc, true);
+    EXPECT_TRUE(truncated.ok());
+    EXPECT_EQ(0U, QueryResultsCache::size());
+  }
+
+  QueryResultsCache::clear();
+  FLAGS_query_results_cache_ttl = ttl;
+}
+
 TEST_F(SQLiteUtilTests, test_passing_callback_no_data_param) {
   char* err = nullptr;
   auto dbc = getTestDBC();
@@ -139,6 +404,22 @@ TEST_F(SQLiteUtilTests, test_affected_tables) {
   EXPECT_EQ(dbc->affected_tables_.size(), 0U);
 }
 
+TEST_F(SQLiteUtilTests, test_query_state) {
+  auto dbc = getTestDBC();
+
+  // Every table scanned by a query receives the same state.
+  auto state = dbc->getQueryState();
+  EXPECT_EQ(state, dbc->getQueryState());
+  EXPECT_EQ(*state->get<int>("test"), 0);
+  *state->get<int>("test") = 1;
+  EXPECT_EQ(*dbc->getQueryState()->get<int>("test"), 1);
+
+  // The state is released with the affected tables after the query.
+  dbc->clearAffectedTables();
+  EXPECT_NE(state, dbc->getQueryState());
+  EXPECT_EQ(*dbc->getQueryState()->get<int>("test"), 0);
+}
+
 TEST_F(SQLiteUtilTests, test_table_attributes_event_based) {
   {
     SQLInternal sql_internal("select * from process_events");
@@ -246,4 +527,113 @@ TEST_F(SQLiteUtilTests, test_query_planner) {
   getQueryColumnsInternal(query, columns, dbc->db());
   EXPECT_EQ(getTypes(columns), TypeList({TEXT_TYPE, INTEGER_TYPE, TEXT_TYPE}));
 }
+
+TEST_F(SQLiteUtilTests, test_memory_stats) {
+  auto dbc = SQLiteDBManager::getUnique();
+  QueryData results;
+  auto status = queryInternal(
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c "
+      "WHERE x < 1000) SELECT x FROM c ORDER BY x DESC",
+      results,
+      dbc);
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(1000U, results.size());
+
+  // The open connection holds memory, and sorting the rows took more.
+  auto stats = SQLiteDBManager::memoryStats();
+  EXPECT_GT(stats.used, 0U);
+  EXPECT_GE(stats.peak, stats.used);
+}
+
+TEST_F(SQLiteUtilTests, test_query_budget) {
+  auto dbc = SQLiteDBManager::getUnique();
+  std::string query =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) "
+      "SELECT count(*) FROM c";
+
+  QueryData results;
+  {
+    // Queries that never complete are stopped when the budget is spent.
+    QueryBudget budget(10);
+    auto status = queryInternal(query, results, dbc);
+    EXPECT_FALSE(status.ok());
+    EXPECT_TRUE(budget.expired());
+  }
+
+  // The connection is usable once the budget ends.
+  results.clear();
+  auto status = queryInternal("SELECT 1 AS one", results, dbc);
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("1", results[0]["one"]);
+}
+
+#if !defined(FREEBSD)
+TEST_F(SQLiteUtilTests, test_string_functions) {
+  auto dbc = SQLiteDBManager::getUnique();
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT regex_match('192.168.0.1', '([0-9]+)\\.([0-9]+)', 2) AS m, "
+      "regex_match('192.168.0.1', 'x', 0) AS n, "
+      "regex_split('a1b22c', '[0-9]+', 2) AS s, "
+      "sha256('') AS h, crc32('123456789') AS c",
+      results,
+      dbc);
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("168", results[0]["m"]);
+  EXPECT_EQ("", results[0]["n"]);
+  EXPECT_EQ("c", results[0]["s"]);
+  EXPECT_EQ(
+      "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+      results[0]["h"]);
+  EXPECT_EQ("3421780262", results[0]["c"]);
+
+  // The pattern is compiled once and reused for each row.
+  results.clear();
+  status = queryInternal(
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c "
+      "WHERE x < 100) SELECT count(*) AS n FROM c "
+      "WHERE regex_match('n' || x, 'n[0-9]?5$', 0) IS NOT NULL",
+      results,
+      dbc);
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ("10", results[0]["n"]);
+
+  // Invalid patterns are errors.
+  results.clear();
+  status = queryInternal("SELECT regex_match('a', '(', 0)", results, dbc);
+  EXPECT_FALSE(status.ok());
+}
+
+TEST_F(SQLiteUtilTests, test_in_cidr) {
+  auto dbc = SQLiteDBManager::getUnique();
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT in_cidr('10.1.2.3', '10.0.0.0/8') AS a, "
+      "in_cidr('11.1.2.3', '10.0.0.0/8') AS b, "
+      "in_cidr('192.168.1.130', '192.168.1.128/25') AS c, "
+      "in_cidr('192.168.1.127', '192.168.1.128/25') AS d, "
+      "in_cidr('fe80::1', 'fe80::/10') AS e, "
+      "in_cidr('10.1.2.3', 'fe80::/10') AS f, "
+      "in_cidr('10.1.2.3', '10.1.2.3') AS g, "
+      "in_cidr('10.1.2.3', '0.0.0.0/0') AS h",
+      results,
+      dbc);
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("1", results[0]["a"]);
+  EXPECT_EQ("0", results[0]["b"]);
+  EXPECT_EQ("1", results[0]["c"]);
+  EXPECT_EQ("0", results[0]["d"]);
+  EXPECT_EQ("1", results[0]["e"]);
+  EXPECT_EQ("0", results[0]["f"]);
+  EXPECT_EQ("1", results[0]["g"]);
+  EXPECT_EQ("1", results[0]["h"]);
+
+  results.clear();
+  status = queryInternal("SELECT in_cidr('10.1.2.3', '10/33')", results, dbc);
+  EXPECT_FALSE(status.ok());
+}
+#endif
 }
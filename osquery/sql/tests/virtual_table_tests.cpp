@@ -11,6 +11,7 @@
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/registry.h>
 #include <osquery/sql.h>
@@ -19,6 +20,10 @@
 
 namespace osquery {
 
+DECLARE_uint64(table_batch_rows);
+DECLARE_uint64(statement_memo_bytes);
+DECLARE_uint64(query_cost_budget);
+
 class VirtualTableTests : public testing::Test {};
 
 // sample plugin used on tests
@@ -93,6 +98,7 @@ class aliasesTablePlugin : public TablePlugin {
 
  private:
   FRIEND_TEST(VirtualTableTests, test_tableplugin_aliases);
+  FRIEND_TEST(VirtualTableTests, test_lazy_attach);
 };
 
 TEST_F(VirtualTableTests, test_tableplugin_aliases) {
@@ -132,6 +138,30 @@ TEST_F(VirtualTableTests, test_tableplugin_aliases) {
   EXPECT_EQ(expected_statement, columnDefinition(response, false));
 }
 
+TEST_F(VirtualTableTests, test_lazy_attach) {
+  auto tables = RegistryFactory::get().registry("table");
+  tables->add("lazy_aliases", std::make_shared<aliasesTablePlugin>());
+
+  // Attaching registers modules without creating tables.
+  auto dbc = SQLiteDBManager::getUnique();
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT * FROM sqlite_temp_master WHERE tbl_name = 'lazy_aliases'",
+      results,
+      dbc->db());
+  ASSERT_TRUE(status.ok());
+  EXPECT_TRUE(results.empty());
+
+  // The table is connected when a query uses it, and aliases are available.
+  status = queryInternal("SELECT * FROM lazy_aliases", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  status = queryInternal("SELECT * FROM aliases1", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  status =
+      queryInternal("SELECT user_name FROM lazy_aliases", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+}
+
 TEST_F(VirtualTableTests, test_sqlite3_attach_vtable) {
   auto table = std::make_shared<sampleTablePlugin>();
   table->setName("sample");
@@ -372,6 +402,107 @@ TEST_F(VirtualTableTests, test_null_values) {
   }
 }
 
+class convertTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", INTEGER_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("b", BIGINT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("d", DOUBLE_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    return {
+        {{"i", "2"}, {"b", "4294967296"}, {"d", "1.5"}},
+        {{"i", "1"}, {"b", "bad"}},
+        {{"i", "3"}, {"b", "-1"}, {"d", "0.5"}},
+    };
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_column_conversion);
+};
+
+TEST_F(VirtualTableTests, test_column_conversion) {
+  auto tables = RegistryFactory::get().registry("table");
+  auto convert = std::make_shared<convertTablePlugin>();
+  tables->add("convert", convert);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("convert", convert->columnDefinition(), dbc);
+
+  // Sorting and expressions request the same cells more than once per row.
+  QueryData results;
+  queryInternal(
+      "SELECT i, i + i AS ii, b, d, d * 2 AS dd FROM convert WHERE i > 0 "
+      "ORDER BY i",
+      results,
+      dbc->db());
+  ASSERT_EQ(3U, results.size());
+  EXPECT_EQ("1", results[0]["i"]);
+  EXPECT_EQ("2", results[0]["ii"]);
+  EXPECT_EQ("", results[0]["b"]);
+  EXPECT_EQ("", results[0]["d"]);
+  EXPECT_EQ("4294967296", results[1]["b"]);
+  EXPECT_EQ("3.0", results[1]["dd"]);
+  EXPECT_EQ("-1", results[2]["b"]);
+  EXPECT_EQ("6", results[2]["ii"]);
+}
+
+class colsUsedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("col1", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("col2", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("col3", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    Row r;
+    for (const auto& column : {"col1", "col2", "col3"}) {
+      if (context.isColumnUsed(column)) {
+        r[column] = column;
+      }
+    }
+    return {r};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_columns_used);
+};
+
+TEST_F(VirtualTableTests, test_columns_used) {
+  auto tables = RegistryFactory::get().registry("table");
+  auto cols_used = std::make_shared<colsUsedTablePlugin>();
+  tables->add("cols_used", cols_used);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("cols_used", cols_used->columnDefinition(), dbc);
+
+  QueryData results;
+  queryInternal("SELECT col1 FROM cols_used", results, dbc->db());
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("col1", results[0]["col1"]);
+
+  // Columns used only within a predicate are also generated.
+  results.clear();
+  queryInternal(
+      "SELECT col1 FROM cols_used WHERE col3 = 'col3'", results, dbc->db());
+  ASSERT_EQ(1U, results.size());
+
+  // A row generated for an unused column is not returned.
+  results.clear();
+  queryInternal("SELECT col2 FROM cols_used WHERE col3 IS NULL",
+                results,
+                dbc->db());
+  EXPECT_EQ(0U, results.size());
+}
+
 class cacheTablePlugin : public TablePlugin {
  private:
   TableColumns columns() const override {
@@ -421,6 +552,384 @@ TEST_F(VirtualTableTests, test_table_cache) {
   ASSERT_EQ(results[0]["data"], "awesome_data");
 }
 
+class memoTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("data", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    generated++;
+    return {{{"data", "memo_data"}}};
+  }
+
+  size_t generated{0};
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_table_memo);
+};
+
+TEST_F(VirtualTableTests, test_table_memo) {
+  auto tables = RegistryFactory::get().registry("table");
+  auto memo = std::make_shared<memoTablePlugin>();
+  tables->add("memo", memo);
+
+  auto dbc1 = SQLiteDBManager::getUnique();
+  attachTableInternal("memo", memo->columnDefinition(), dbc1);
+  auto dbc2 = SQLiteDBManager::getUnique();
+  attachTableInternal("memo", memo->columnDefinition(), dbc2);
+
+  // Outside of a schedule step the results are always generated.
+  auto backup_step = TablePlugin::kCacheStep;
+  TableMemo::instance().clear();
+  TablePlugin::kCacheStep = 0;
+  QueryData results;
+  queryInternal("SELECT * FROM memo", results, dbc1->db());
+  queryInternal("SELECT * FROM memo", results, dbc2->db());
+  EXPECT_EQ(2U, memo->generated);
+
+  // Queries in the same step share results for the same constraints.
+  TablePlugin::kCacheStep = 100;
+  queryInternal("SELECT * FROM memo", results, dbc1->db());
+  results.clear();
+  queryInternal("SELECT * FROM memo", results, dbc2->db());
+  EXPECT_EQ(3U, memo->generated);
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("memo_data", results[0]["data"]);
+  EXPECT_EQ(1U, TableMemo::instance().hits());
+  EXPECT_GT(TableMemo::instance().bytes(), 0U);
+
+  // Different constraints generate again.
+  queryInternal(
+      "SELECT * FROM memo WHERE data = 'memo_data'", results, dbc1->db());
+  EXPECT_EQ(4U, memo->generated);
+
+  // A new step releases the results of the previous step.
+  TablePlugin::kCacheStep = 101;
+  queryInternal("SELECT * FROM memo", results, dbc2->db());
+  EXPECT_EQ(5U, memo->generated);
+
+  TablePlugin::kCacheStep = backup_step;
+  TableMemo::instance().clear();
+}
+
+class statementMemoOuterTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("v", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext&) override {
+    return {{{"v", "1"}}, {{"v", "1"}}, {{"v", "2"}}};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_statement_memo);
+};
+
+class statementMemoTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("x", INTEGER_TYPE, ColumnOptions::INDEX),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    generated++;
+    QueryData results;
+    for (const auto& x : context.constraints["x"].getAll(EQUALS)) {
+      results.push_back({{"x", x}});
+    }
+    return results;
+  }
+
+  size_t generated{0};
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_statement_memo);
+};
+
+TEST_F(VirtualTableTests, test_statement_memo) {
+  auto tables = RegistryFactory::get().registry("table");
+  auto memo = std::make_shared<statementMemoTablePlugin>();
+  tables->add("statement_memo", memo);
+  auto outer = std::make_shared<statementMemoOuterTablePlugin>();
+  tables->add("statement_memo_outer", outer);
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("statement_memo", memo->columnDefinition(), dbc);
+  attachTableInternal("statement_memo_outer", outer->columnDefinition(), dbc);
+
+  // The inner table is filtered for each outer row, twice with x = 1.
+  std::string statement =
+      "SELECT o.v AS v FROM statement_memo_outer o CROSS JOIN "
+      "statement_memo m ON m.x = o.v";
+  QueryData results;
+  auto status = queryInternal(statement, results, dbc->db());
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(3U, results.size());
+  EXPECT_EQ(2U, memo->generated);
+
+  // The results are not shared with the next statement.
+  results.clear();
+  queryInternal(statement, results, dbc->db());
+  EXPECT_EQ(3U, results.size());
+  EXPECT_EQ(4U, memo->generated);
+
+  // Without a memo each filter generates.
+  auto memo_bytes = FLAGS_statement_memo_bytes;
+  FLAGS_statement_memo_bytes = 0;
+  results.clear();
+  queryInternal(statement, results, dbc->db());
+  EXPECT_EQ(3U, results.size());
+  EXPECT_EQ(7U, memo->generated);
+  FLAGS_statement_memo_bytes = memo_bytes;
+}
+
+class batchTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", INTEGER_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("d", DOUBLE_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("text", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  ColumnAliasSet columnAliases() const override {
+    return {{"text", {"name"}}};
+  }
+
+  bool usesBatch() const override {
+    return true;
+  }
+
+ public:
+  void generateBatch(RowBatch& batch, QueryContext& context) override {
+    for (size_t i = 0; i < 3; i++) {
+      batch.addRow();
+      batch.setInteger(0, i);
+      batch.setDouble(1, i / 2.0);
+      if (i != 1) {
+        batch.setText(2, "row_" + std::to_string(i));
+      }
+    }
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_batch_table);
+};
+
+TEST_F(VirtualTableTests, test_batch_table) {
+  auto tables = RegistryFactory::get().registry("table");
+  auto batch = std::make_shared<batchTablePlugin>();
+  tables->add("batch", batch);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("batch", columnDefinition(batch->routeInfo(), true), dbc);
+
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT i, d, text, name FROM batch WHERE i > 0", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(2U, results.size());
+  EXPECT_EQ("1", results[0]["i"]);
+  EXPECT_EQ("0.5", results[0]["d"]);
+  // The unset cell is NULL.
+  EXPECT_EQ("", results[0]["text"]);
+  EXPECT_EQ("row_2", results[1]["text"]);
+  EXPECT_EQ("row_2", results[1]["name"]);
+
+  // Non-SQL callers receive the batch as rows.
+  PluginResponse response;
+  status = Registry::call("table", "batch", {{"action", "generate"}}, response);
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(3U, response.size());
+  EXPECT_EQ("2", response[2]["i"]);
+  EXPECT_EQ(0U, response[1].count("text"));
+}
+
+class streamTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  bool usesBatch() const override {
+    return true;
+  }
+
+ public:
+  void generateBatch(RowBatch& batch, QueryContext& context) override {
+    for (size_t i = 0; i < 100; i++) {
+      batch.addRow();
+      batch.setInteger(0, i);
+      generated++;
+    }
+  }
+
+  // The number of rows generated before the cursor stopped stepping.
+  size_t generated{0};
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_batch_table_streaming);
+  FRIEND_TEST(VirtualTableTests, test_table_profile);
+  FRIEND_TEST(VirtualTableTests, test_result_limits);
+};
+
+TEST_F(VirtualTableTests, test_batch_table_streaming) {
+  auto tables = RegistryFactory::get().registry("table");
+  auto stream = std::make_shared<streamTablePlugin>();
+  tables->add("stream", stream);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("stream", stream->columnDefinition(), dbc);
+
+  auto batch_rows = FLAGS_table_batch_rows;
+  FLAGS_table_batch_rows = 10;
+
+  // Every row is returned across several bounded batches.
+  QueryData results;
+  queryInternal("SELECT i FROM stream", results, dbc->db());
+  ASSERT_EQ(100U, results.size());
+  EXPECT_EQ("99", results[99]["i"]);
+  EXPECT_EQ(100U, stream->generated);
+
+  // A LIMIT stops the generator after the first batch.
+  stream->generated = 0;
+  results.clear();
+  queryInternal("SELECT i FROM stream LIMIT 5", results, dbc->db());
+  EXPECT_EQ(5U, results.size());
+  EXPECT_GE(stream->generated, 5U);
+  EXPECT_LT(stream->generated, 100U);
+
+  FLAGS_table_batch_rows = batch_rows;
+}
+
+TEST_F(VirtualTableTests, test_table_profile) {
+  auto tables = RegistryFactory::get().registry("table");
+  auto stream = std::make_shared<streamTablePlugin>();
+  tables->add("profile_stream", stream);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("profile_stream", stream->columnDefinition(), dbc);
+
+  auto batch_rows = FLAGS_table_batch_rows;
+  FLAGS_table_batch_rows = 10;
+
+  // Nothing is counted unless profiling is enabled.
+  auto& profiler = TableProfiler::instance();
+  QueryData results;
+  queryInternal("SELECT i FROM profile_stream", results, dbc->db());
+  EXPECT_TRUE(profiler.take().empty());
+
+  profiler.setEnabled(true);
+  results.clear();
+  queryInternal("SELECT i FROM profile_stream LIMIT 5", results, dbc->db());
+  profiler.setEnabled(false);
+  ASSERT_EQ(5U, results.size());
+
+  // SQLite read fewer rows than the first batch generated.
+  auto profiles = profiler.take();
+  ASSERT_EQ(1U, profiles.count("profile_stream"));
+  const auto& profile = profiles["profile_stream"];
+  EXPECT_EQ(1U, profile.filters);
+  EXPECT_EQ(10U, profile.generated);
+  EXPECT_EQ(5U, profile.consumed);
+  EXPECT_EQ(10 * sizeof(double), profile.bytes);
+  EXPECT_TRUE(profiler.take().empty());
+
+  FLAGS_table_batch_rows = batch_rows;
+}
+
+class limitsTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    QueryData results;
+    for (size_t i = 0; i < 10; i++) {
+      Row r = {{"i", INTEGER(i)}};
+      if (!context.admit(r)) {
+        break;
+      }
+      results.push_back(std::move(r));
+    }
+    return results;
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_result_limits);
+};
+
+TEST_F(VirtualTableTests, test_result_limits) {
+  auto tables = RegistryFactory::get().registry("table");
+  auto stream = std::make_shared<streamTablePlugin>();
+  tables->add("limits_stream", stream);
+  auto limits = std::make_shared<limitsTablePlugin>();
+  tables->add("limits", limits);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("limits_stream", stream->columnDefinition(), dbc);
+  attachTableInternal("limits", limits->columnDefinition(), dbc);
+
+  auto batch_rows = FLAGS_table_batch_rows;
+  FLAGS_table_batch_rows = 10;
+
+  {
+    // Batches stop at the row limit and the results are truncated.
+    QueryBudget budget(0);
+    budget.setResultLimits(25, 0);
+    QueryData results;
+    auto status =
+        queryInternal("SELECT i FROM limits_stream", results, dbc->db());
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(25U, results.size());
+    EXPECT_LT(stream->generated, 100U);
+    EXPECT_TRUE(budget.truncated());
+  }
+
+  {
+    // Generators admitting rows stop at the limit shared by the query.
+    QueryBudget budget(0);
+    budget.setResultLimits(13, 0);
+    QueryData results;
+    auto status = queryInternal(
+        "SELECT * FROM (SELECT i FROM limits UNION ALL SELECT i FROM limits)",
+        results,
+        dbc->db());
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(13U, results.size());
+    EXPECT_TRUE(budget.truncated());
+  }
+
+  {
+    // Results within the limits are not truncated.
+    QueryBudget budget(0);
+    budget.setResultLimits(10, 0);
+    QueryData results;
+    queryInternal("SELECT i FROM limits", results, dbc->db());
+    EXPECT_EQ(10U, results.size());
+    EXPECT_FALSE(budget.truncated());
+  }
+
+  FLAGS_table_batch_rows = batch_rows;
+}
+
 class indexIOptimizedTablePlugin : public TablePlugin {
  private:
   TableColumns columns() const override {
@@ -452,6 +961,9 @@ class indexIOptimizedTablePlugin : public TablePlugin {
 
   // Here the goal is to expect/assume the number of scans.
   size_t scans{0};
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_in_constraints);
 };
 
 class indexJOptimizedTablePlugin : public TablePlugin {
@@ -508,6 +1020,42 @@ class defaultScanTablePlugin : public TablePlugin {
   size_t scans{0};
 };
 
+class costsTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", INTEGER_TYPE, ColumnOptions::INDEX),
+        std::make_tuple("text", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  size_t cardinality() const override {
+    return 5;
+  }
+
+  ColumnCostMap columnCosts() const override {
+    return {{"i", 1000}};
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    scans++;
+
+    QueryData results;
+    for (size_t i = 0; i < 5; i++) {
+      results.push_back({{"i", INTEGER(i)}, {"text", "cost"}});
+    }
+    return results;
+  }
+
+  // Here the goal is to expect/assume the number of scans.
+  size_t scans{0};
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_indexing_costs);
+  FRIEND_TEST(VirtualTableTests, test_query_cost_estimates);
+};
+
 TEST_F(VirtualTableTests, test_indexing_costs) {
   // Get a database connection.
   auto dbc = SQLiteDBManager::getUnique();
@@ -555,5 +1103,77 @@ TEST_F(VirtualTableTests, test_indexing_costs) {
   ASSERT_EQ(1U, default_scan->scans);
   EXPECT_EQ(10U, i->scans);
   EXPECT_EQ(10U, j->scans);
+
+  // Declared cardinality and lookup costs are included in the route info.
+  auto costs = std::make_shared<costsTablePlugin>();
+  auto response = costs->routeInfo();
+  EXPECT_EQ("1000", response[0]["cost"]);
+  EXPECT_EQ(0U, response[1].count("cost"));
+  EXPECT_EQ("5", response.back()["cardinality"]);
+
+  table_registry->add("costs", costs);
+  attachTableInternal("costs", costs->columnDefinition(), dbc);
+
+  // The declared estimates do not change the results.
+  results.clear();
+  queryInternal("SELECT * from costs where i = 1;", results, dbc->db());
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("cost", results[0]["text"]);
+  EXPECT_EQ(1U, costs->scans);
+}
+
+TEST_F(VirtualTableTests, test_query_cost_estimates) {
+  auto dbc = SQLiteDBManager::getUnique();
+  auto table_registry = RegistryFactory::get().registry("table");
+
+  auto costs = std::make_shared<costsTablePlugin>();
+  table_registry->add("plan_costs", costs);
+  attachTableInternal("plan_costs", costs->columnDefinition(), dbc);
+
+  // A scan costs its cardinality, and an inner scan repeats for each row.
+  QueryPlanner scan("SELECT * FROM plan_costs", dbc->db());
+  EXPECT_DOUBLE_EQ(6, scan.estimatedCost());
+  QueryPlanner cross("SELECT * FROM plan_costs a, plan_costs b", dbc->db());
+  EXPECT_DOUBLE_EQ(36, cross.estimatedCost());
+  EXPECT_EQ(0U, costs->scans);
+
+  // Queries estimated above the budget are rejected.
+  FLAGS_query_cost_budget = 10;
+  EXPECT_TRUE(checkQueryCost("SELECT * FROM plan_costs", dbc->db()).ok());
+  auto status =
+      checkQueryCost("SELECT * FROM plan_costs a, plan_costs b", dbc->db());
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ("Query estimated cost 36 exceeds the budget of 10",
+            status.getMessage());
+  FLAGS_query_cost_budget = 0;
+}
+
+TEST_F(VirtualTableTests, test_in_constraints) {
+  auto dbc = SQLiteDBManager::getUnique();
+  auto table_registry = RegistryFactory::get().registry("table");
+
+  auto i = std::make_shared<indexIOptimizedTablePlugin>();
+  table_registry->add("index_in", i);
+  attachTableInternal("index_in", i->columnDefinition(), dbc);
+
+  QueryData results;
+  queryInternal(
+      "SELECT * from index_in where i in (1, 2, 3, 2);", results, dbc->db());
+  ASSERT_EQ(3U, results.size());
+  EXPECT_EQ("none", results[0]["text"]);
+#if SQLITE_VERSION_NUMBER >= 3038000
+  // Every value of the IN list is handled within a single generate.
+  EXPECT_EQ(1U, i->scans);
+#else
+  EXPECT_EQ(3U, i->scans);
+#endif
+
+  // Other constraints on the column are still applied by SQLite.
+  results.clear();
+  queryInternal("SELECT * from index_in where i in (1, 2, 3) and i = 2;",
+                results,
+                dbc->db());
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ("2", results[0]["i"]);
 }
 }
@@ -9,12 +9,16 @@
  */
 
 #include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 
 #include <osquery/core.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
+#include "osquery/core/tracing.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
@@ -23,13 +27,206 @@ FLAG(bool, enable_foreign, false, "Enable no-op foreign virtual tables");
 
 SHELL_FLAG(bool, planner, false, "Enable osquery runtime planner output");
 
+HIDDEN_FLAG(uint64,
+            table_batch_rows,
+            1024,
+            "Maximum rows a columnar table buffers before yielding");
+
+FLAG(uint64,
+     schedule_memo_bytes,
+     16 * 1024 * 1024,
+     "Maximum bytes of table results shared within a schedule step");
+
+FLAG(uint64,
+     statement_memo_bytes,
+     16 * 1024 * 1024,
+     "Maximum bytes of table results shared within a statement");
+
 DECLARE_bool(disable_events);
+DECLARE_bool(disable_caching);
+DECLARE_uint64(extensions_page_rows);
 
 RecursiveMutex kAttachMutex;
 
+/// The memo of the innermost statement executing on each thread.
+static thread_local StatementMemo* kStatementMemo{nullptr};
+
+/// The estimates recorder of the innermost planner on each thread.
+static thread_local PlanEstimates* kPlanEstimates{nullptr};
+
+/// The approximate size of a row's column names and values.
+static size_t getRowSize(const Row& row) {
+  size_t size = 0;
+  for (const auto& column : row) {
+    size += column.first.size() + column.second.size();
+  }
+  return size;
+}
+
+/// The approximate size of results stored for a key.
+static size_t getMemoSize(const std::string& key, const QueryData& results) {
+  size_t size = key.size();
+  for (const auto& row : results) {
+    size += getRowSize(row);
+  }
+  return size;
+}
+
+TableMemo& TableMemo::instance() {
+  static TableMemo memo;
+  return memo;
+}
+
+std::string TableMemo::key(const std::string& table,
+                           const QueryContext& context) {
+  return table + context.cacheKey();
+}
+
+void TableMemo::advance(size_t step) {
+  if (step > step_) {
+    results_.clear();
+    bytes_ = 0;
+    step_ = step;
+  }
+}
+
+bool TableMemo::lookup(size_t step,
+                       const std::string& key,
+                       QueryData& results) {
+  WriteLock lock(mutex_);
+  advance(step);
+  if (step != step_) {
+    return false;
+  }
+
+  auto it = results_.find(key);
+  if (it == results_.end()) {
+    return false;
+  }
+  results = it->second;
+  hits_++;
+  return true;
+}
+
+void TableMemo::store(size_t step,
+                      const std::string& key,
+                      const QueryData& results) {
+  auto size = getMemoSize(key, results);
+
+  WriteLock lock(mutex_);
+  advance(step);
+  if (step != step_ || results_.count(key) > 0 ||
+      bytes_ + size > FLAGS_schedule_memo_bytes) {
+    return;
+  }
+  results_[key] = results;
+  bytes_ += size;
+}
+
+void TableMemo::clear() {
+  WriteLock lock(mutex_);
+  results_.clear();
+  bytes_ = 0;
+  step_ = 0;
+}
+
+StatementMemo::StatementMemo() : previous_(kStatementMemo) {
+  kStatementMemo = this;
+}
+
+StatementMemo::~StatementMemo() {
+  kStatementMemo = previous_;
+}
+
+StatementMemo* StatementMemo::current() {
+  return kStatementMemo;
+}
+
+std::shared_ptr<const QueryData> StatementMemo::lookup(const std::string& key) {
+  auto it = results_.find(key);
+  if (it == results_.end()) {
+    return nullptr;
+  }
+  hits_++;
+  return it->second;
+}
+
+void StatementMemo::store(const std::string& key,
+                          const std::shared_ptr<const QueryData>& results) {
+  auto size = getMemoSize(key, *results);
+  if (results_.count(key) > 0 || bytes_ + size > FLAGS_statement_memo_bytes) {
+    return;
+  }
+  results_[key] = results;
+  bytes_ += size;
+}
+
+PlanEstimates::PlanEstimates() : previous_(kPlanEstimates) {
+  kPlanEstimates = this;
+}
+
+PlanEstimates::~PlanEstimates() {
+  kPlanEstimates = previous_;
+}
+
+PlanEstimates* PlanEstimates::current() {
+  return kPlanEstimates;
+}
+
+void PlanEstimates::record(int index, double cost, double rows) {
+  auto& estimate = estimates_[index];
+  estimate.cost = cost;
+  estimate.rows = rows;
+}
+
+bool PlanEstimates::find(int index, Estimate& estimate) const {
+  auto it = estimates_.find(index);
+  if (it == estimates_.end()) {
+    return false;
+  }
+  estimate = it->second;
+  return true;
+}
+
+TableProfiler& TableProfiler::instance() {
+  static TableProfiler profiler;
+  return profiler;
+}
+
+void TableProfiler::addFilter(const std::string& table) {
+  WriteLock lock(mutex_);
+  tables_[table].filters++;
+}
+
+void TableProfiler::addGenerate(const std::string& table,
+                                size_t us,
+                                size_t rows,
+                                size_t bytes) {
+  WriteLock lock(mutex_);
+  auto& profile = tables_[table];
+  profile.generate_us += us;
+  profile.generated += rows;
+  profile.bytes += bytes;
+}
+
+void TableProfiler::addConsumed(const std::string& table, size_t rows) {
+  WriteLock lock(mutex_);
+  tables_[table].consumed += rows;
+}
+
+std::map<std::string, TableProfile> TableProfiler::take() {
+  WriteLock lock(mutex_);
+  std::map<std::string, TableProfile> tables;
+  tables.swap(tables_);
+  return tables;
+}
+
 namespace tables {
 namespace sqlite {
 
+/// Stack size for each suspendable columnar table generator.
+static const size_t kGeneratorStackSize = 512 * 1024;
+
 /// For planner and debugging an incrementing cursor ID is used.
 static std::atomic<size_t> kPlannerCursorID{0};
 
@@ -77,6 +274,63 @@ static void plan(const std::string& output) {
   }
 }
 
+/// Microseconds since a profiled generator call began.
+static size_t elapsedUs(std::chrono::steady_clock::time_point start) {
+  return static_cast<size_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+}
+
+/// Drop the rows of a batch beyond the executing query's result limits.
+static void limitBatch(BaseCursor* pCur) {
+  auto budget = QueryBudget::current();
+  if (budget == nullptr || !budget->limitsResults()) {
+    return;
+  }
+
+  auto admitted = budget->admitRows(pCur->n, pCur->batch.bytes());
+  if (admitted < pCur->n) {
+    // The query has all the rows it may use, stop generating.
+    pCur->n = admitted;
+    pCur->generator.reset();
+  }
+}
+
+/**
+ * @brief Drop the rows of results beyond the executing query's limits.
+ *
+ * @return true if rows were dropped.
+ */
+static bool limitResults(QueryData& results) {
+  auto budget = QueryBudget::current();
+  if (budget == nullptr || !budget->limitsResults()) {
+    return false;
+  }
+
+  size_t admitted = 0;
+  for (; admitted < results.size(); ++admitted) {
+    if (budget->admitRows(1, getRowSize(results[admitted])) == 0) {
+      break;
+    }
+  }
+  if (admitted == results.size()) {
+    return false;
+  }
+  results.resize(admitted);
+  return true;
+}
+
+/// Report the rows SQLite read from a cursor since its last report.
+static void profileConsumed(BaseCursor* pCur) {
+  if (pCur->consumed > 0 && TableProfiler::instance().enabled()) {
+    auto* pVtab = (VirtualTable*)pCur->base.pVtab;
+    TableProfiler::instance().addConsumed(pVtab->content->name,
+                                          pCur->consumed);
+  }
+  pCur->consumed = 0;
+}
+
 int xOpen(sqlite3_vtab* tab, sqlite3_vtab_cursor** ppCursor) {
   int rc = SQLITE_NOMEM;
   auto* pCur = new BaseCursor;
@@ -96,6 +350,9 @@ int xOpen(sqlite3_vtab* tab, sqlite3_vtab_cursor** ppCursor) {
 int xClose(sqlite3_vtab_cursor* cur) {
   BaseCursor* pCur = (BaseCursor*)cur;
   plan("Closing cursor (" + std::to_string(pCur->id) + ")");
+  profileConsumed(pCur);
+  // Unwind a suspended generator before its context.
+  pCur->generator.reset();
   delete pCur;
   return SQLITE_OK;
 }
@@ -107,6 +364,8 @@ int xEof(sqlite3_vtab_cursor* cur) {
     // have been visited, clear the data container.
     return true;
   }
+  // SQLite reads each row it does not find at the end.
+  pCur->consumed++;
   return false;
 }
 
@@ -117,15 +376,55 @@ int xDestroy(sqlite3_vtab* p) {
   return SQLITE_OK;
 }
 
+/**
+ * @brief Resume a suspended generator until it buffers rows or completes.
+ *
+ * The buffered rows have been read; clear them and let the generator fill
+ * the bounded batch again.
+ */
+static void resumeGenerator(BaseCursor* pCur) {
+  while (pCur->generator != nullptr && pCur->row >= pCur->n) {
+    if (!(*pCur->generator)) {
+      // The generator has completed.
+      pCur->generator.reset();
+      break;
+    }
+
+    pCur->offset += pCur->n;
+    pCur->batch.clear();
+    auto start = std::chrono::steady_clock::now();
+    try {
+      (*pCur->generator)();
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "Table generator caused exception: " << e.what();
+      pCur->generator.reset();
+    }
+    pCur->row = 0;
+    pCur->n = pCur->batch.size();
+    auto* content = ((VirtualTable*)pCur->base.pVtab)->content;
+    auto us = elapsedUs(start);
+    content->cost.generate_time += us;
+    content->cost.rows += pCur->n;
+    if (TableProfiler::instance().enabled()) {
+      TableProfiler::instance().addGenerate(
+          content->name, us, pCur->n, pCur->batch.bytes());
+    }
+    limitBatch(pCur);
+  }
+}
+
 int xNext(sqlite3_vtab_cursor* cur) {
   BaseCursor* pCur = (BaseCursor*)cur;
   pCur->row++;
+  if (pCur->row >= pCur->n) {
+    resumeGenerator(pCur);
+  }
   return SQLITE_OK;
 }
 
 int xRowid(sqlite3_vtab_cursor* cur, sqlite_int64* pRowid) {
   const BaseCursor* pCur = (BaseCursor*)cur;
-  *pRowid = pCur->row;
+  *pRowid = pCur->offset + pCur->row;
   return SQLITE_OK;
 }
 
@@ -190,6 +489,11 @@ int xCreate(sqlite3* db,
           column.at("name"),
           columnTypeName(column.at("type")),
           (ColumnOptions)AS_LITERAL(INTEGER_LITERAL, column.at("op"))));
+      // Tables may declare a relative cost for constraint lookups.
+      if (column.count("cost") > 0) {
+        pVtab->content->costs[column.at("name")] =
+            AS_LITERAL(INTEGER_LITERAL, column.at("cost"));
+      }
     } else if (column.at("id") == "alias" && column.count("alias")) {
       // Create associated views for table aliases.
       views.insert(column.at("alias"));
@@ -214,67 +518,60 @@ int xCreate(sqlite3* db,
       // Store the attributes locally so they may be passed to the SQL object.
       pVtab->content->attributes =
           (TableAttributes)AS_LITERAL(INTEGER_LITERAL, column.at("attributes"));
+      if (column.count("cardinality") > 0) {
+        pVtab->content->cardinality =
+            AS_LITERAL(INTEGER_LITERAL, column.at("cardinality"));
+      }
     }
   }
 
-  // Create the requested 'aliases'.
-  for (const auto& view : views) {
-    statement = "CREATE VIEW " + view + " AS SELECT * FROM " + name;
-    sqlite3_exec(db, statement.c_str(), nullptr, nullptr, nullptr);
+  // Create the requested 'aliases'. An eponymous table is connected while a
+  // statement is prepared, its views are created when the module is attached.
+  if (argc > 3) {
+    for (const auto& view : views) {
+      statement = "CREATE VIEW " + view + " AS SELECT * FROM " + name;
+      sqlite3_exec(db, statement.c_str(), nullptr, nullptr, nullptr);
+    }
   }
   *ppVtab = (sqlite3_vtab*)pVtab;
   return rc;
 }
 
-int xColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int col) {
-  BaseCursor* pCur = (BaseCursor*)cur;
-  const auto* pVtab = (VirtualTable*)cur->pVtab;
-  if (col >= static_cast<int>(pVtab->content->columns.size())) {
-    // Requested column index greater than column set size.
-    return SQLITE_ERROR;
-  }
-  if (pCur->row >= pCur->data.size()) {
-    // Request row index greater than row set size.
-    return SQLITE_ERROR;
-  }
-
-  auto& column_name = std::get<0>(pVtab->content->columns[col]);
-  auto& type = std::get<1>(pVtab->content->columns[col]);
-  if (pVtab->content->aliases.count(column_name)) {
-    // Overwrite the aliased column with the type and name of the new column.
-    type = std::get<1>(
-        pVtab->content->columns[pVtab->content->aliases.at(column_name)]);
-    column_name = std::get<0>(
-        pVtab->content->columns[pVtab->content->aliases.at(column_name)]);
-  }
-
-  // Attempt to cast each xFilter-populated row/column to the SQLite type.
-  const auto& value = pCur->data[pCur->row][column_name];
-  if (pCur->data[pCur->row].count(column_name) == 0) {
+/// Convert a row-based cell to the column's SQLite type.
+static void convertCell(const Row& r,
+                        const std::string& column_name,
+                        ColumnType type,
+                        CursorCell& cell) {
+  cell.null = true;
+  auto it = r.find(column_name);
+  if (it == r.end()) {
     // Missing content.
     VLOG(1) << "Error " << column_name << " is empty";
-    sqlite3_result_null(ctx);
-  } else if (type == TEXT_TYPE) {
-    sqlite3_result_text(
-        ctx, value.c_str(), static_cast<int>(value.size()), SQLITE_STATIC);
+    return;
+  }
+
+  const auto& value = it->second;
+  if (type == TEXT_TYPE) {
+    cell.text = &value;
+    cell.null = false;
   } else if (type == INTEGER_TYPE) {
     long afinite;
     if (!safeStrtol(value, 0, afinite) || afinite < INT_MIN ||
         afinite > INT_MAX) {
       VLOG(1) << "Error casting " << column_name << " (" << value
               << ") to INTEGER";
-      sqlite3_result_null(ctx);
     } else {
-      sqlite3_result_int(ctx, (int)afinite);
+      cell.integer = afinite;
+      cell.null = false;
     }
   } else if (type == BIGINT_TYPE || type == UNSIGNED_BIGINT_TYPE) {
     long long afinite;
     if (!safeStrtoll(value, 0, afinite)) {
       VLOG(1) << "Error casting " << column_name << " (" << value
               << ") to BIGINT";
-      sqlite3_result_null(ctx);
     } else {
-      sqlite3_result_int64(ctx, afinite);
+      cell.integer = afinite;
+      cell.null = false;
     }
   } else if (type == DOUBLE_TYPE) {
     char* end = nullptr;
@@ -282,21 +579,163 @@ int xColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int col) {
     if (end == nullptr || end == value.c_str() || *end != '\0') {
       VLOG(1) << "Error casting " << column_name << " (" << value
               << ") to DOUBLE";
-      sqlite3_result_null(ctx);
     } else {
-      sqlite3_result_double(ctx, afinite);
+      cell.real = afinite;
+      cell.null = false;
     }
   } else {
     LOG(ERROR) << "Error unknown column type " << column_name;
   }
+}
+
+int xColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int col) {
+  BaseCursor* pCur = (BaseCursor*)cur;
+  const auto* pVtab = (VirtualTable*)cur->pVtab;
+  const auto& columns = pVtab->content->columns;
+  if (col >= static_cast<int>(columns.size())) {
+    // Requested column index greater than column set size.
+    return SQLITE_ERROR;
+  }
+  if (pCur->row >= pCur->n) {
+    // Request row index greater than row set size.
+    return SQLITE_ERROR;
+  }
+
+  // Aliased columns read the content of the column they alias.
+  auto index = static_cast<size_t>(col);
+  const auto& aliases = pVtab->content->aliases;
+  auto alias = aliases.find(std::get<0>(columns[index]));
+  if (alias != aliases.end()) {
+    index = alias->second;
+  }
+  const auto& column_name = std::get<0>(columns[index]);
+  const auto& type = std::get<1>(columns[index]);
+
+  if (pCur->batched) {
+    // Columnar rows are stored using the native SQLite type.
+    const auto& batch = pCur->batch;
+    if (index >= batch.columns() || batch.isNull(pCur->row, index)) {
+      sqlite3_result_null(ctx);
+    } else if (type == INTEGER_TYPE || type == BIGINT_TYPE ||
+               type == UNSIGNED_BIGINT_TYPE) {
+      sqlite3_result_int64(ctx, batch.getInteger(pCur->row, index));
+    } else if (type == DOUBLE_TYPE) {
+      sqlite3_result_double(ctx, batch.getDouble(pCur->row, index));
+    } else {
+      auto value = batch.getText(pCur->row, index);
+      sqlite3_result_text(
+          ctx, value.data(), static_cast<int>(value.size()), SQLITE_STATIC);
+    }
+    return SQLITE_OK;
+  }
+
+  if (pCur->cells.size() != columns.size()) {
+    pCur->cells.assign(columns.size(), CursorCell());
+  }
+
+  // Attempt to cast each xFilter-populated row/column to the SQLite type.
+  auto& cell = pCur->cells[index];
+  if (cell.row != pCur->row) {
+    convertCell(pCur->rows()[pCur->row], column_name, type, cell);
+    cell.row = pCur->row;
+  }
+
+  if (cell.null) {
+    sqlite3_result_null(ctx);
+  } else if (type == TEXT_TYPE) {
+    sqlite3_result_text(ctx,
+                        cell.text->c_str(),
+                        static_cast<int>(cell.text->size()),
+                        SQLITE_STATIC);
+  } else if (type == INTEGER_TYPE) {
+    sqlite3_result_int(ctx, static_cast<int>(cell.integer));
+  } else if (type == BIGINT_TYPE || type == UNSIGNED_BIGINT_TYPE) {
+    sqlite3_result_int64(ctx, cell.integer);
+  } else if (type == DOUBLE_TYPE) {
+    sqlite3_result_double(ctx, cell.real);
+  }
 
   return SQLITE_OK;
 }
 
+/**
+ * @brief Encode a constraint set and the columns used as a plan index string.
+ *
+ * Each constraint is a column name and operator. Expressions are not known
+ * until xFilter, which receives them as arguments in the same order. The
+ * order is 'a' or 'd' if the table returns rows by ascending or descending
+ * time, otherwise 'n'.
+ */
+static char* encodeConstraintSet(const ConstraintSet& constraints,
+                                 const UsedColumns& colsUsed,
+                                 char order) {
+  std::string encoded;
+  for (const auto& constraint : constraints) {
+    encoded += constraint.first + '\1' +
+               std::to_string(constraint.second.op) + '\2';
+  }
+  encoded += '\3';
+  for (const auto& column : colsUsed) {
+    encoded += column + '\2';
+  }
+  encoded += '\4';
+  encoded += order;
+
+  // SQLite frees the index string using sqlite3_free.
+  auto size = static_cast<int>(encoded.size() + 1);
+  auto idx = static_cast<char*>(sqlite3_malloc(size));
+  if (idx != nullptr) {
+    memcpy(idx, encoded.c_str(), encoded.size() + 1);
+  }
+  return idx;
+}
+
+/// Inverse of encodeConstraintSet.
+static void decodeConstraintSet(const std::string& encoded,
+                                ConstraintSet& constraints,
+                                UsedColumns& colsUsed,
+                                char& order) {
+  auto separator = encoded.find('\3');
+  size_t start = 0;
+  while (start < separator) {
+    auto end = encoded.find('\2', start);
+    auto op = encoded.find('\1', start);
+    if (end == std::string::npos || op == std::string::npos || op > end) {
+      break;
+    }
+    auto name = encoded.substr(start, op - start);
+    auto value = std::strtoul(encoded.c_str() + op + 1, nullptr, 10);
+    constraints.push_back(std::make_pair(
+        name, Constraint(static_cast<unsigned char>(value))));
+    start = end + 1;
+  }
+
+  if (separator == std::string::npos) {
+    return;
+  }
+  start = separator + 1;
+  auto order_separator = encoded.find('\4', start);
+  while (start < order_separator) {
+    auto end = encoded.find('\2', start);
+    if (end == std::string::npos || end > order_separator) {
+      break;
+    }
+    colsUsed.insert(encoded.substr(start, end - start));
+    start = end + 1;
+  }
+
+  if (order_separator != std::string::npos &&
+      order_separator + 1 < encoded.size()) {
+    order = encoded[order_separator + 1];
+  }
+}
+
 static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
   auto* pVtab = (VirtualTable*)tab;
   const auto& columns = pVtab->content->columns;
 
+  const auto& costs = pVtab->content->costs;
+
   ConstraintSet constraints;
   // Keep track of the index used for each valid constraint.
   // Expect this index to correspond with argv within xFilter.
@@ -307,6 +746,26 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
   // Tables may have requirements or use indexes.
   bool required_satisfied = false;
   bool index_used = false;
+  // The most expensive lookup, if an index or required column is used.
+  size_t lookup_cost = 1;
+  // An equality constraint on an index limits the rows generated.
+  bool index_equals = false;
+
+  // Event-based tables may return rows ordered by time and stop at a limit,
+  // if SQLite keeps exactly the rows that the time constraints select.
+  int time_column = -1;
+  if ((pVtab->content->attributes & TableAttributes::EVENT_BASED) &&
+      Registry::get().registry("table")->getExternal().count(
+          pVtab->content->name) == 0) {
+    for (size_t i = 0; i < columns.size(); ++i) {
+      if (std::get<0>(columns[i]) == "time") {
+        time_column = static_cast<int>(i);
+        break;
+      }
+    }
+  }
+  bool time_exact = (time_column >= 0);
+  std::vector<size_t> limit_terms;
 
   // Expressions operating on the same virtual table are loosely identified by
   // the consecutive sets of terms each of the constraint sets are applied onto.
@@ -317,34 +776,68 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
       // Record the term index (this index exists across all expressions).
       const auto& constraint_info = pIdxInfo->aConstraint[i];
 #if defined(DEBUG)
-      plan("Evaluating constraints for table: " + pVtab->content->name +
-           " [index=" + std::to_string(i) + " column=" +
-           std::to_string(constraint_info.iColumn) + " term=" +
-           std::to_string((int)constraint_info.iTermOffset) + " usable=" +
-           std::to_string((int)constraint_info.usable) + "]");
+      if (FLAGS_planner) {
+        plan("Evaluating constraints for table: " + pVtab->content->name +
+             " [index=" + std::to_string(i) + " column=" +
+             std::to_string(constraint_info.iColumn) + " term=" +
+             std::to_string((int)constraint_info.iTermOffset) + " usable=" +
+             std::to_string((int)constraint_info.usable) + "]");
+      }
 #endif
       if (!constraint_info.usable) {
         // A higher cost less priority, prefer more usable query constraints.
         cost += 10;
+        time_exact = false;
+        continue;
+      }
+
+#if SQLITE_VERSION_NUMBER >= 3038000
+      // LIMIT and OFFSET have no column, they are used after all terms.
+      if (constraint_info.op == SQLITE_INDEX_CONSTRAINT_LIMIT ||
+          constraint_info.op == SQLITE_INDEX_CONSTRAINT_OFFSET) {
+        limit_terms.push_back(i);
         continue;
       }
+#endif
 
       // Lookup the column name given an index into the table column set.
       if (constraint_info.iColumn < 0 ||
           static_cast<size_t>(constraint_info.iColumn) >=
               pVtab->content->columns.size()) {
         cost += 10;
+        time_exact = false;
         continue;
       }
       const auto& name = std::get<0>(columns[constraint_info.iColumn]);
 
+      // The event time range is applied exactly, other terms are not.
+      if (constraint_info.iColumn != time_column ||
+          (constraint_info.op != EQUALS && constraint_info.op != GREATER_THAN &&
+           constraint_info.op != GREATER_THAN_OR_EQUALS &&
+           constraint_info.op != LESS_THAN &&
+           constraint_info.op != LESS_THAN_OR_EQUALS)) {
+        time_exact = false;
+      }
+
       // Check if this constraint is on an index or required column.
       const auto& options = std::get<2>(columns[constraint_info.iColumn]);
-      if (options & ColumnOptions::REQUIRED) {
-        index_used = true;
-        required_satisfied = true;
-      } else if (options & (ColumnOptions::INDEX | ColumnOptions::ADDITIONAL)) {
+      if (options & (ColumnOptions::REQUIRED | ColumnOptions::INDEX |
+                     ColumnOptions::ADDITIONAL)) {
         index_used = true;
+        required_satisfied |= (options & ColumnOptions::REQUIRED) > 0;
+        index_equals |= (constraint_info.op == EQUALS);
+        auto column_cost = costs.find(name);
+        if (column_cost != costs.end()) {
+          lookup_cost = std::max(lookup_cost, column_cost->second);
+        }
+#if SQLITE_VERSION_NUMBER >= 3038000
+        // Receive every value of an IN list within a single filter, rather
+        // than filtering, and generating, once for each value.
+        if (constraint_info.op == EQUALS &&
+            sqlite3_vtab_in(pIdxInfo, static_cast<int>(i), -1)) {
+          sqlite3_vtab_in(pIdxInfo, static_cast<int>(i), 1);
+        }
+#endif
       }
 
       // Save a pair of the name and the constraint operator.
@@ -354,13 +847,34 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
           std::make_pair(name, Constraint(constraint_info.op)));
       pIdxInfo->aConstraintUsage[i].argvIndex = static_cast<int>(++expr_index);
 #if defined(DEBUG)
-      plan("Adding constraint for table: " + pVtab->content->name +
-           " [column=" + name + " arg_index=" + std::to_string(expr_index) +
-           " op=" + std::to_string(constraint_info.op) + "]");
+      if (FLAGS_planner) {
+        plan("Adding constraint for table: " + pVtab->content->name +
+             " [column=" + name + " arg_index=" + std::to_string(expr_index) +
+             " op=" + std::to_string(constraint_info.op) + "]");
+      }
 #endif
     }
   }
 
+  // The backing store of event-based tables is ordered by time. SQLite does
+  // not use the order of a plan filtering once for each value of an IN list.
+  char order = 'n';
+  if (time_column >= 0 && pIdxInfo->nOrderBy == 1 &&
+      pIdxInfo->aOrderBy[0].iColumn == time_column) {
+    order = (pIdxInfo->aOrderBy[0].desc) ? 'd' : 'a';
+    pIdxInfo->orderByConsumed = 1;
+  }
+
+  // Rows beyond a LIMIT, in the order returned, are not read by SQLite.
+  if (time_exact && (pIdxInfo->nOrderBy == 0 || order != 'n')) {
+    for (const auto& term : limit_terms) {
+      constraints.push_back(
+          std::make_pair("", Constraint(pIdxInfo->aConstraint[term].op)));
+      pIdxInfo->aConstraintUsage[term].argvIndex =
+          static_cast<int>(++expr_index);
+    }
+  }
+
   // Check the table for a required column.
   for (const auto& column : columns) {
     auto& options = std::get<2>(column);
@@ -371,21 +885,59 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
     }
   }
 
+  // Tables declaring a cardinality scan that many rows, otherwise a full scan
+  // is assumed to be much more expensive than an index lookup.
+  auto cardinality = pVtab->content->cardinality;
   if (!index_used) {
     // A column is marked index, but no index constraint was provided.
-    cost += 200;
+    cost += (cardinality > 0) ? cardinality : 200;
+  } else {
+    // Lookups are as expensive as the most expensive constrained column.
+    cost += lookup_cost - 1;
+  }
+
+  if (cardinality > 0) {
+    // Help SQLite order joins using the expected number of rows.
+    pIdxInfo->estimatedRows = (index_used && index_equals)
+                                  ? 1
+                                  : static_cast<sqlite3_int64>(cardinality);
+  }
+
+  // Record the columns used by the query, including the columns aliased by
+  // any used alias. The last bit of colUsed represents every later column.
+  UsedColumns colsUsed;
+  const auto& aliases = pVtab->content->aliases;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    if (i < 63 && (pIdxInfo->colUsed & (1ULL << i)) == 0) {
+      continue;
+    } else if (i >= 63 && (pIdxInfo->colUsed & (1ULL << 63)) == 0) {
+      break;
+    }
+    const auto& name = std::get<0>(columns[i]);
+    auto alias = aliases.find(name);
+    if (alias != aliases.end() && alias->second < columns.size()) {
+      colsUsed.insert(std::get<0>(columns[alias->second]));
+    }
+    colsUsed.insert(name);
   }
 
   pIdxInfo->idxNum = static_cast<int>(kConstraintIndexID++);
-#if defined(DEBUG)
-  plan("Recording constraint set for table: " + pVtab->content->name +
-       " [cost=" + std::to_string(cost) + " size=" +
-       std::to_string(constraints.size()) + " idx=" +
-       std::to_string(pIdxInfo->idxNum) + "]");
-#endif
-  // Add the constraint set to the table's tracked constraints.
-  pVtab->content->constraints[pIdxInfo->idxNum] = std::move(constraints);
+  if (FLAGS_planner) {
+    plan("Recording constraint set for table: " + pVtab->content->name +
+         " [cost=" + std::to_string(cost) + " rows=" +
+         std::to_string(pIdxInfo->estimatedRows) + " size=" +
+         std::to_string(constraints.size()) + " idx=" +
+         std::to_string(pIdxInfo->idxNum) + " order=" + order + "]");
+  }
+  // The constraint set is kept within the plan, so a prepared statement may
+  // filter again using the same set when it is reused.
+  pIdxInfo->idxStr = encodeConstraintSet(constraints, colsUsed, order);
+  pIdxInfo->needToFreeIdxStr = 1;
   pIdxInfo->estimatedCost = cost;
+  if (PlanEstimates::current() != nullptr) {
+    PlanEstimates::current()->record(
+        pIdxInfo->idxNum, cost, static_cast<double>(pIdxInfo->estimatedRows));
+  }
   return SQLITE_OK;
 }
 
@@ -398,10 +950,24 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
   auto* pVtab = (VirtualTable*)pVtabCursor->pVtab;
   auto* content = pVtab->content;
   pVtab->instance->addAffectedTable(content);
+  profileConsumed(pCur);
+  TRACE_PROBE1(filter__start, content->name.c_str());
+  content->cost.filters++;
+  bool profile = TableProfiler::instance().enabled();
+  if (profile) {
+    TableProfiler::instance().addFilter(content->name);
+  }
 
+  // A previous filter may have left a suspended generator.
+  pCur->generator.reset();
+  pCur->shared.reset();
   pCur->row = 0;
   pCur->n = 0;
-  QueryContext context(content);
+  pCur->offset = 0;
+  pCur->cells.clear();
+  pCur->context = std::make_unique<QueryContext>(content);
+  auto& context = *pCur->context;
+  context.state = pVtab->instance->getQueryState();
 
   // Track required columns, this is different than the requirements check
   // that occurs within BestIndex because this scan includes a cursor.
@@ -434,19 +1000,69 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
     }
   }
 
-// Filtering between cursors happens iteratively, not consecutively.
-// If there are multiple sets of constraints, they apply to each cursor.
-#if defined(DEBUG)
-  plan("Filtering called for table: " + content->name + " [constraint_count=" +
-       std::to_string(content->constraints.size()) + " argc=" +
-       std::to_string(argc) + " idx=" + std::to_string(idxNum) + "]");
-#endif
+  // Filtering between cursors happens iteratively, not consecutively.
+  // If there are multiple sets of constraints, they apply to each cursor.
+  // The index string holds the constraint set and columns SQLite chose.
+  ConstraintSet constraints;
+  if (idxStr != nullptr) {
+    UsedColumns colsUsed;
+    char order = 'n';
+    decodeConstraintSet(idxStr, constraints, colsUsed, order);
+    // Pass the columns used by this access plan to the table.
+    context.colsUsed = std::move(colsUsed);
+    context.ordered = (order != 'n');
+    context.descending = (order == 'd');
+  }
+  if (FLAGS_planner) {
+    plan("Filtering called for table: " + content->name +
+         " [constraint_count=" + std::to_string(constraints.size()) +
+         " argc=" + std::to_string(argc) + " idx=" + std::to_string(idxNum) +
+         "]");
+  }
 
   // Iterate over every argument to xFilter, filling in constraint values.
-  if (content->constraints.size() > 0) {
-    auto& constraints = content->constraints[idxNum];
+  if (constraints.size() > 0) {
+    bool unlimited = false;
     if (argc > 0) {
       for (size_t i = 0; i < static_cast<size_t>(argc); ++i) {
+        if (i >= constraints.size()) {
+          break;
+        }
+#if SQLITE_VERSION_NUMBER >= 3038000
+        // An IN list processed all at once is an EQUALS for each value, the
+        // constraint list admits any of them.
+        sqlite3_value* value = nullptr;
+        if (sqlite3_value_type(argv[i]) == SQLITE_NULL &&
+            sqlite3_vtab_in_first(argv[i], &value) == SQLITE_OK) {
+          const auto& name = constraints[i].first;
+          size_t count = 0;
+          while (value != nullptr) {
+            auto in_expr = (const char*)sqlite3_value_text(value);
+            if (in_expr != nullptr) {
+              context.constraints[name].add(Constraint(EQUALS, in_expr));
+              count++;
+            }
+            if (sqlite3_vtab_in_next(argv[i], &value) != SQLITE_OK) {
+              break;
+            }
+          }
+          if (FLAGS_planner) {
+            plan("Adding IN constraints to cursor (" +
+                 std::to_string(pCur->id) + "): " + name + " [count=" +
+                 std::to_string(count) + "]");
+          }
+          continue;
+        }
+#endif
+        if (constraints[i].first.empty()) {
+          // The LIMIT and OFFSET, the rows read are their sum. A negative or
+          // unknown LIMIT reads every row.
+          auto rows = sqlite3_value_int64(argv[i]);
+          unlimited |= (rows < 0 ||
+                        sqlite3_value_type(argv[i]) != SQLITE_INTEGER);
+          context.limit = (unlimited) ? 0 : context.limit + rows;
+          continue;
+        }
         auto expr = (const char*)sqlite3_value_text(argv[i]);
         if (expr == nullptr || expr[0] == 0) {
           // SQLite did not expose the expression value.
@@ -455,9 +1071,11 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
         // Set the expression from SQLite's now-populated argv.
         auto& constraint = constraints[i];
         constraint.second.expr = std::string(expr);
-        plan("Adding constraint to cursor (" + std::to_string(pCur->id) +
-             "): " + constraint.first + " " + opString(constraint.second.op) +
-             " " + constraint.second.expr);
+        if (FLAGS_planner) {
+          plan("Adding constraint to cursor (" + std::to_string(pCur->id) +
+               "): " + constraint.first + " " + opString(constraint.second.op) +
+               " " + constraint.second.expr);
+        }
         // Add the constraint to the column-sorted query request map.
         context.constraints[constraint.first].add(constraint.second);
       }
@@ -468,6 +1086,9 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
     // Evaluate index and optimized constratint requirements.
     // These are satisfied regarless of expression content availability.
     for (const auto& constraint : constraints) {
+      if (constraint.first.empty()) {
+        continue;
+      }
       if (options[constraint.first] & ColumnOptions::REQUIRED) {
         // A required option exists in the constraints.
         required_satisfied = true;
@@ -504,17 +1125,175 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
   pCur->data.clear();
   options.clear();
 
+  // A query limiting its results does not generate once it has enough.
+  auto budget = QueryBudget::current();
+  if (budget != nullptr && budget->limitsResults()) {
+    if (!budget->hasRoom()) {
+      if (FLAGS_planner) {
+        plan("Result limits reached for cursor (" +
+             std::to_string(pCur->id) + ")");
+      }
+      return SQLITE_OK;
+    }
+    context.max_rows = budget->remainingRows();
+    context.max_bytes = budget->remainingBytes();
+  }
+
   // Generate the row data set.
-  plan("Scanning rows for cursor (" + std::to_string(pCur->id) + ")");
-  Registry::callTable(pVtab->content->name, context, pCur->data);
+  if (FLAGS_planner) {
+    plan("Scanning rows for cursor (" + std::to_string(pCur->id) + ")");
+  }
+  auto plugin = std::dynamic_pointer_cast<TablePlugin>(
+      Registry::get().plugin("table", content->name));
+  // Extension tables are read in pages as the cursor reads their rows.
+  bool paged = (plugin == nullptr && FLAGS_extensions_page_rows > 0 &&
+                Registry::get().registry("table")->getExternal().count(
+                    content->name) > 0);
+  pCur->batched = ((plugin != nullptr && plugin->usesBatch()) || paged);
+  // Identify the content before it is generated, a change during the scan
+  // is found by the next scan.
+  content->generation = (plugin != nullptr) ? plugin->generation() : "";
+  if (!pCur->batched) {
+    // Cursors of the statement filtering the same way share results.
+    // Each cursor of a query limiting its results accounts its own rows.
+    auto key = TableMemo::key(content->name, context);
+    auto statement = (FLAGS_statement_memo_bytes > 0 &&
+                      !FLAGS_disable_caching && context.max_rows == 0 &&
+                      context.max_bytes == 0)
+                         ? StatementMemo::current()
+                         : nullptr;
+    if (statement != nullptr) {
+      pCur->shared = statement->lookup(key);
+      if (pCur->shared != nullptr) {
+        if (FLAGS_planner) {
+          plan("Using statement results for cursor (" +
+               std::to_string(pCur->id) + ")");
+        }
+        pCur->n = pCur->shared->size();
+        TRACE_PROBE2(filter__done, content->name.c_str(), pCur->n);
+        return SQLITE_OK;
+      }
+    }
 
-  // Set the number of rows.
-  pCur->n = pCur->data.size();
+    // Scheduled queries in the same step share generated results.
+    auto step = TablePlugin::kCacheStep;
+    bool memo = (step > 0 && FLAGS_schedule_memo_bytes > 0 &&
+                 !FLAGS_disable_caching &&
+                 (content->attributes & TableAttributes::EVENT_BASED) == 0 &&
+                 (content->attributes & TableAttributes::UTILITY) == 0);
+    if (memo && TableMemo::instance().lookup(step, key, pCur->data)) {
+      if (FLAGS_planner) {
+        plan("Using step results for cursor (" + std::to_string(pCur->id) +
+             ")");
+      }
+    } else {
+      auto start = std::chrono::steady_clock::now();
+      Registry::callTable(content->name, context, pCur->data);
+      auto us = elapsedUs(start);
+      content->cost.generate_time += us;
+      content->cost.rows += pCur->data.size();
+      if (profile) {
+        TableProfiler::instance().addGenerate(content->name,
+                                              us,
+                                              pCur->data.size(),
+                                              getMemoSize("", pCur->data));
+      }
+      if (context.truncated()) {
+        // The generator stopped at the limits, the rows are incomplete.
+        budget->setTruncated();
+      } else if (memo) {
+        TableMemo::instance().store(step, key, pCur->data);
+      }
+    }
+    limitResults(pCur->data);
+
+    if (statement != nullptr) {
+      // The cursor reads the rows it shares with the statement's memo.
+      auto shared = std::make_shared<const QueryData>(std::move(pCur->data));
+      pCur->data.clear();
+      statement->store(key, shared);
+      pCur->shared = std::move(shared);
+    }
+    pCur->n = pCur->rows().size();
+    TRACE_PROBE2(filter__done, content->name.c_str(), pCur->n);
+    return SQLITE_OK;
+  }
+
+  // Columnar tables stream, the generator runs until the batch is full.
+  // SQLite may stop stepping (LIMIT, EXISTS, joins) before generation ends.
+  if (paged) {
+    pCur->batch.reset(content->columns);
+  } else {
+    pCur->batch.clear();
+  }
+  auto start = std::chrono::steady_clock::now();
+  try {
+    pCur->generator = std::make_unique<BatchGenerator::pull_type>(
+        boost::coroutines2::fixedsize_stack(kGeneratorStackSize),
+        [pCur, content](BatchGenerator::push_type& yield) {
+          pCur->batch.setYield([&yield]() { yield(); },
+                               static_cast<size_t>(FLAGS_table_batch_rows));
+          Registry::callTable(content->name, *pCur->context, pCur->batch);
+        });
+  } catch (const std::exception& e) {
+    LOG(ERROR) << "Table " << content->name
+               << " generator caused exception: " << e.what();
+    pCur->generator.reset();
+  }
+  pCur->n = pCur->batch.size();
+  // Constructing the generator runs it until the first batch is full.
+  auto us = elapsedUs(start);
+  content->cost.generate_time += us;
+  content->cost.rows += pCur->n;
+  if (profile) {
+    TableProfiler::instance().addGenerate(
+        content->name, us, pCur->n, pCur->batch.bytes());
+  }
+  limitBatch(pCur);
+  if (pCur->n == 0) {
+    resumeGenerator(pCur);
+  }
+  TRACE_PROBE2(filter__done, content->name.c_str(), pCur->n);
   return SQLITE_OK;
 }
 }
 }
 
+/**
+ * @brief A static module structure does not need specific logic per-table.
+ *
+ * The create and connect methods are the same, so each registered module is
+ * also an eponymous virtual table. SQLite connects the table named by the
+ * module when a statement first uses it, without a CREATE VIRTUAL TABLE.
+ */
+// clang-format off
+static sqlite3_module kTableModule = {
+    0,
+    tables::sqlite::xCreate,
+    tables::sqlite::xCreate,
+    tables::sqlite::xBestIndex,
+    tables::sqlite::xDestroy,
+    tables::sqlite::xDestroy,
+    tables::sqlite::xOpen,
+    tables::sqlite::xClose,
+    tables::sqlite::xFilter,
+    tables::sqlite::xNext,
+    tables::sqlite::xEof,
+    tables::sqlite::xColumn,
+    tables::sqlite::xRowid,
+    nullptr, /* Update */
+    nullptr, /* Begin */
+    nullptr, /* Sync */
+    nullptr, /* Commit */
+    nullptr, /* Rollback */
+    nullptr, /* FindFunction */
+    nullptr, /* Rename */
+    nullptr, /* Savepoint */
+    nullptr, /* Release */
+    nullptr, /* RollbackTo */
+};
+// clang-format on
+
 Status attachTableInternal(const std::string& name,
                            const std::string& statement,
                            const SQLiteDBInstanceRef& instance) {
@@ -523,40 +1302,14 @@ Status attachTableInternal(const std::string& name,
     return Status(0, getStringForSQLiteReturnCode(0));
   }
 
-  // A static module structure does not need specific logic per-table.
-  // clang-format off
-  static sqlite3_module module = {
-      0,
-      tables::sqlite::xCreate,
-      tables::sqlite::xCreate,
-      tables::sqlite::xBestIndex,
-      tables::sqlite::xDestroy,
-      tables::sqlite::xDestroy,
-      tables::sqlite::xOpen,
-      tables::sqlite::xClose,
-      tables::sqlite::xFilter,
-      tables::sqlite::xNext,
-      tables::sqlite::xEof,
-      tables::sqlite::xColumn,
-      tables::sqlite::xRowid,
-      nullptr, /* Update */
-      nullptr, /* Begin */
-      nullptr, /* Sync */
-      nullptr, /* Commit */
-      nullptr, /* Rollback */
-      nullptr, /* FindFunction */
-      nullptr, /* Rename */
-      nullptr, /* Savepoint */
-      nullptr, /* Release */
-      nullptr, /* RollbackTo */
-  };
-  // clang-format on
 
   // Note, if the clientData API is used then this will save a registry call
   // within xCreate.
   RecursiveLock lock(kAttachMutex);
+  // Statements prepared before the schema change are not reused.
+  instance->clearStatements();
   int rc = sqlite3_create_module(
-      instance->db(), name.c_str(), &module, (void*)&(*instance));
+      instance->db(), name.c_str(), &kTableModule, (void*)&(*instance));
   if (rc == SQLITE_OK || rc == SQLITE_MISUSE) {
     auto format =
         "CREATE VIRTUAL TABLE temp." + name + " USING " + name + statement;
@@ -575,6 +1328,11 @@ Status detachTableInternal(const std::string& name, sqlite3* db) {
     LOG(ERROR) << "Error detaching table: " << name << " (" << rc << ")";
   }
 
+#if SQLITE_VERSION_NUMBER >= 3030000
+  // Remove the module so the eponymous table is no longer available.
+  sqlite3_create_module(db, name.c_str(), nullptr, nullptr);
+#endif
+
   return Status(rc, getStringForSQLiteReturnCode(rc));
 }
 
@@ -606,14 +1364,37 @@ void attachVirtualTables(const SQLiteDBInstanceRef& instance) {
 #endif
   }
 
+  RecursiveLock lock(kAttachMutex);
+  instance->clearStatements();
   PluginResponse response;
   for (const auto& name : RegistryFactory::get().names("table")) {
-    // Column information is nice for virtual table create call.
+    if (SQLiteDBManager::isDisabled(name)) {
+      VLOG(1) << "Table " << name << " is disabled, not attaching";
+      continue;
+    }
+
+    // Only the module is registered, a table is connected when first used.
+    int rc = sqlite3_create_module(
+        instance->db(), name.c_str(), &kTableModule, (void*)&(*instance));
+    if (rc != SQLITE_OK && rc != SQLITE_MISUSE) {
+      LOG(ERROR) << "Error attaching table: " << name << " (" << rc << ")";
+      continue;
+    }
+
+    // Table name aliases are views, which must exist before they are used.
     auto status =
         Registry::call("table", name, {{"action", "columns"}}, response);
-    if (status.ok()) {
-      auto statement = columnDefinition(response, true);
-      attachTableInternal(name, statement, instance);
+    if (!status.ok()) {
+      continue;
+    }
+    for (const auto& item : response) {
+      if (item.count("id") > 0 && item.at("id") == "alias" &&
+          item.count("alias") > 0) {
+        auto statement =
+            "CREATE VIEW " + item.at("alias") + " AS SELECT * FROM " + name;
+        sqlite3_exec(
+            instance->db(), statement.c_str(), nullptr, nullptr, nullptr);
+      }
     }
   }
 }
@@ -10,6 +10,12 @@
 
 #pragma once
 
+#include <atomic>
+#include <limits>
+#include <map>
+#include <unordered_map>
+
+#include <boost/coroutine2/coroutine.hpp>
 #include <boost/noncopyable.hpp>
 
 #include <osquery/tables.h>
@@ -29,6 +35,39 @@ namespace osquery {
  */
 extern RecursiveMutex kAttachMutex;
 
+/**
+ * @brief A suspendable table generator.
+ *
+ * Columnar tables are generated within a coroutine that yields each time the
+ * cursor's bounded RowBatch is full. The cursor resumes the generator as
+ * SQLite steps past the buffered rows.
+ */
+using BatchGenerator = boost::coroutines2::coroutine<void>;
+
+/**
+ * @brief A row-based cell converted to its SQLite type.
+ *
+ * SQLite may request the same column of the current row several times, for
+ * example when sorting or evaluating join predicates. Converted values are
+ * memoized per cursor so the string content is parsed once per row.
+ */
+struct CursorCell {
+  /// The cursor row this cell was converted for.
+  size_t row{std::numeric_limits<size_t>::max()};
+
+  /// True if the cell is missing or could not be converted.
+  bool null{true};
+
+  /// The converted integer value for INTEGER and BIGINT columns.
+  long long integer{0};
+
+  /// The converted value for DOUBLE columns.
+  double real{0};
+
+  /// The row content for TEXT columns.
+  const std::string* text{nullptr};
+};
+
 /**
  * @brief osquery cursor object.
  *
@@ -44,11 +83,265 @@ struct BaseCursor : private boost::noncopyable {
   /// Table data generated from last access.
   QueryData data;
 
+  /// Table data shared with the statement's memo, used instead of data.
+  std::shared_ptr<const QueryData> shared{nullptr};
+
+  /// The rows of the last access.
+  const QueryData& rows() const {
+    return (shared != nullptr) ? *shared : data;
+  }
+
+  /// Memoized conversions of the current row, indexed by column.
+  std::vector<CursorCell> cells;
+
+  /// Columnar table data generated from last access, if the table uses it.
+  RowBatch batch;
+
+  /// True if the last access generated the columnar batch.
+  bool batched{false};
+
+  /// The query context, this must exist as long as the generator.
+  std::unique_ptr<QueryContext> context{nullptr};
+
+  /// A suspended columnar table generator, if more rows may be generated.
+  std::unique_ptr<BatchGenerator::pull_type> generator{nullptr};
+
+  /// Number of rows consumed from previous batches, used for rowids.
+  size_t offset{0};
+
   /// Current cursor position.
   size_t row{0};
 
   /// Total number of rows.
   size_t n{0};
+
+  /// Rows SQLite read since the last profiled access.
+  size_t consumed{0};
+};
+
+/**
+ * @brief Generated table results shared by queries in the same schedule step.
+ *
+ * Several packs often select from the same expensive tables and become due
+ * in the same second. The results generated for a table and its normalized
+ * constraints are kept in memory for the remainder of the step, queries
+ * filtering the table the same way copy these rows instead of generating.
+ *
+ * Results are only shared between scheduled queries, the step is the
+ * thread's TablePlugin::kCacheStep. Entries are released when a newer step
+ * begins, and the total size of results is limited by --schedule_memo_bytes.
+ */
+class TableMemo : private boost::noncopyable {
+ public:
+  /// The memo shared by every SQLite connection in this process.
+  static TableMemo& instance();
+
+  /// Build a key from the table name, constraints, and used columns.
+  static std::string key(const std::string& table, const QueryContext& context);
+
+  /**
+   * @brief Copy the results stored for a key during a step.
+   *
+   * @return false if the results were not stored during this step.
+   */
+  bool lookup(size_t step, const std::string& key, QueryData& results);
+
+  /// Store results for a key during a step, if they fit within the limit.
+  void store(size_t step, const std::string& key, const QueryData& results);
+
+  /// Release all stored results.
+  void clear();
+
+  /// The approximate size of stored results in bytes.
+  size_t bytes() const {
+    return bytes_;
+  }
+
+  /// Number of lookups that used stored results.
+  size_t hits() const {
+    return hits_;
+  }
+
+ private:
+  TableMemo() {}
+
+  /// Release results of an older step, the lock must be held.
+  void advance(size_t step);
+
+ private:
+  /// The step the stored results were generated in.
+  size_t step_{0};
+
+  /// Stored results keyed by table, constraints, and used columns.
+  std::unordered_map<std::string, QueryData> results_;
+
+  /// Approximate size of stored results.
+  std::atomic<size_t> bytes_{0};
+
+  /// Number of lookups that used stored results.
+  std::atomic<size_t> hits_{0};
+
+  /// Protection around the stored results.
+  Mutex mutex_;
+};
+
+/**
+ * @brief The estimates of the constraint sets planned on a thread.
+ *
+ * SQLite asks each virtual table for the cost of several constraint sets
+ * while it plans a statement, then keeps one set for each scan. While a
+ * QueryPlanner prepares a query, the cost and rows estimated for each set are
+ * recorded by index number, so the chosen sets may be found in the plan.
+ */
+class PlanEstimates : private boost::noncopyable {
+ public:
+  /// The estimates of a constraint set.
+  struct Estimate {
+    /// The cost of one filter with the constraints.
+    double cost{0};
+
+    /// The number of rows one filter is expected to return.
+    double rows{0};
+  };
+
+  /// Begin recording the estimates of constraint sets on the thread.
+  PlanEstimates();
+
+  /// Restore the recorder of an enclosing planner.
+  ~PlanEstimates();
+
+  /// The recorder of the planner on this thread, if any.
+  static PlanEstimates* current();
+
+  /// Record the estimates of a constraint set.
+  void record(int index, double cost, double rows);
+
+  /// The estimates of a constraint set, false if it was not recorded.
+  bool find(int index, Estimate& estimate) const;
+
+ private:
+  /// The recorder of an enclosing planner on this thread.
+  PlanEstimates* previous_{nullptr};
+
+  /// Estimates by constraint set index.
+  std::map<int, Estimate> estimates_;
+};
+
+/**
+ * @brief Generated table results shared by the cursors of one statement.
+ *
+ * SQLite filters the inner table of a nested-loop join once for each outer
+ * row, often with a constraint value it has already filtered with. While a
+ * statement steps, the results generated for a table and its bound
+ * constraints and used columns are kept, and a repeated filter reads those
+ * rows instead of generating them again.
+ *
+ * A memo exists for each statement executing on a thread, the innermost is
+ * used when a table generator executes a statement of its own. The size of
+ * a statement's results is limited by --statement_memo_bytes.
+ */
+class StatementMemo : private boost::noncopyable {
+ public:
+  /// Begin sharing results between the cursors of a statement on the thread.
+  StatementMemo();
+
+  /// Release the results and restore the memo of an enclosing statement.
+  ~StatementMemo();
+
+  /// The memo of the statement executing on this thread, if any.
+  static StatementMemo* current();
+
+  /// The results stored for a key, nullptr if none were stored.
+  std::shared_ptr<const QueryData> lookup(const std::string& key);
+
+  /// Store results for a key, if they fit within the limit.
+  void store(const std::string& key,
+             const std::shared_ptr<const QueryData>& results);
+
+  /// The approximate size of stored results in bytes.
+  size_t bytes() const {
+    return bytes_;
+  }
+
+  /// Number of lookups that used stored results.
+  size_t hits() const {
+    return hits_;
+  }
+
+ private:
+  /// The memo of an enclosing statement on this thread.
+  StatementMemo* previous_{nullptr};
+
+  /// Stored results keyed by table, constraints, and used columns.
+  std::unordered_map<std::string, std::shared_ptr<const QueryData>> results_;
+
+  /// Approximate size of stored results.
+  size_t bytes_{0};
+
+  /// Number of lookups that used stored results.
+  size_t hits_{0};
+};
+
+/// Counters for a table, collected while profiling is enabled.
+struct TableProfile {
+  /// Number of times SQLite filtered the table.
+  size_t filters{0};
+
+  /// Time spent in the table's generator, in microseconds.
+  size_t generate_us{0};
+
+  /// Rows the generator produced.
+  size_t generated{0};
+
+  /// Rows SQLite read from cursors, fewer if it stopped stepping early.
+  size_t consumed{0};
+
+  /// The approximate size of the generated rows.
+  size_t bytes{0};
+};
+
+/**
+ * @brief Per-table filter, generate, and row counters for the shell.
+ *
+ * The shell's .profile mode enables this while it executes statements and
+ * reports the counters of each table a statement used. Results read from a
+ * statement or step memo count as a filter without generating rows.
+ */
+class TableProfiler : private boost::noncopyable {
+ public:
+  static TableProfiler& instance();
+
+  void setEnabled(bool enabled) {
+    enabled_ = enabled;
+  }
+
+  bool enabled() const {
+    return enabled_;
+  }
+
+  /// Count a filter of a table.
+  void addFilter(const std::string& table);
+
+  /// Add a call, or resumption, of a table's generator.
+  void addGenerate(const std::string& table,
+                   size_t us,
+                   size_t rows,
+                   size_t bytes);
+
+  /// Add rows SQLite read from a cursor of a table.
+  void addConsumed(const std::string& table, size_t rows);
+
+  /// Return the counters of each table and reset them.
+  std::map<std::string, TableProfile> take();
+
+ private:
+  std::atomic<bool> enabled_{false};
+
+  /// Counters keyed by table name.
+  std::map<std::string, TableProfile> tables_;
+
+  /// Protection around the counters.
+  Mutex mutex_;
 };
 
 /**
@@ -8,6 +8,9 @@
  *
  */
 
+#include <sys/stat.h>
+
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/tables/applications/browser_utils.h"
@@ -27,13 +30,28 @@ const std::map<std::string, std::string> kExtensionKeys = {
     {"author", "author"},
     {"background.persistent", "persistent"}};
 
-void genExtension(const std::string& uid,
-                  const std::string& path,
-                  QueryData& results) {
+FLAG(uint64,
+     browser_manifest_cache_max,
+     4096,
+     "Maximum number of parsed browser extension manifests cached");
+
+/// The manifest values of an extension and the file metadata they came from.
+struct ManifestCacheEntry {
+  time_t mtime{0};
+  off_t size{0};
+  ino_t inode{0};
+  Row values;
+};
+
+/// Parsed manifests by path, shared by the chrome-based extension tables.
+static std::map<std::string, ManifestCacheEntry> kManifestCache;
+static Mutex kManifestCacheMutex;
+
+/// Read the kExtensionKeys values of a manifest.
+static Status readManifest(const std::string& path, Row& values) {
   std::string json_data;
-  if (!forensicReadFile(path + kManifestFile, json_data).ok()) {
-    VLOG(1) << "Could not read file: " << path + kManifestFile;
-    return;
+  if (!forensicReadFile(path, json_data).ok()) {
+    return Status(1, "Could not read file: " + path);
   }
 
   // Read the extensions data into a JSON blob, then property tree.
@@ -43,16 +61,67 @@ void genExtension(const std::string& uid,
     json_stream << json_data;
     pt::read_json(json_stream, tree);
   } catch (const pt::json_parser::json_parser_error& /* e */) {
-    VLOG(1) << "Could not parse JSON from: " << path + kManifestFile;
-    return;
+    return Status(1, "Could not parse JSON from: " + path);
   }
 
-  Row r;
-  r["uid"] = uid;
   // Most of the keys are in the top-level JSON dictionary.
   for (const auto& it : kExtensionKeys) {
-    r[it.second] = tree.get<std::string>(it.first, "");
+    values[it.second] = tree.get<std::string>(it.first, "");
+  }
+  return Status(0, "OK");
+}
+
+/// Read a manifest, reusing the values parsed while the file is unchanged.
+static Status getManifest(const std::string& path, Row& values) {
+  struct stat file_stat;
+  if (FLAGS_browser_manifest_cache_max == 0 ||
+      ::stat(path.c_str(), &file_stat) != 0) {
+    return readManifest(path, values);
+  }
+
+  {
+    ReadLock lock(kManifestCacheMutex);
+    auto entry = kManifestCache.find(path);
+    if (entry != kManifestCache.end() &&
+        entry->second.mtime == file_stat.st_mtime &&
+        entry->second.size == file_stat.st_size &&
+        entry->second.inode == file_stat.st_ino) {
+      values = entry->second.values;
+      return Status(0, "OK");
+    }
+  }
 
+  auto status = readManifest(path, values);
+  if (!status.ok()) {
+    return status;
+  }
+
+  WriteLock lock(kManifestCacheMutex);
+  if (kManifestCache.size() >= FLAGS_browser_manifest_cache_max &&
+      kManifestCache.count(path) == 0) {
+    // Manifests rarely change, drop an arbitrary entry.
+    kManifestCache.erase(kManifestCache.begin());
+  }
+  auto& entry = kManifestCache[path];
+  entry.mtime = file_stat.st_mtime;
+  entry.size = file_stat.st_size;
+  entry.inode = file_stat.st_ino;
+  entry.values = values;
+  return status;
+}
+
+void genExtension(const std::string& uid,
+                  const std::string& path,
+                  QueryData& results) {
+  Row r;
+  auto status = getManifest(path + kManifestFile, r);
+  if (!status.ok()) {
+    VLOG(1) << status.getMessage();
+    return;
+  }
+
+  r["uid"] = uid;
+  for (const auto& it : kExtensionKeys) {
     // Convert JSON bool-types to an integer.
     if (r[it.second] == "true") {
       r[it.second] = INTEGER(1);
@@ -76,32 +145,46 @@ QueryData genChromeBasedExtensions(QueryContext& context,
   QueryData results;
 
   auto users = usersFromContext(context);
-  for (const auto& row : users) {
-    if (row.count("uid") > 0 && row.count("directory") > 0) {
-      // For each user, enumerate all of their chrome profiles.
-      std::vector<std::string> profiles;
-      fs::path extension_path = row.at("directory") / sub_dir;
-      if (!resolveFilePattern(extension_path, profiles, GLOB_FOLDERS).ok()) {
-        continue;
-      }
-
-      // For each profile list each extension in the Extensions directory.
-      std::vector<std::string> extensions;
-      for (const auto& profile : profiles) {
-        listDirectoriesInDirectory(profile, extensions);
-      }
-
-      // Generate an addons list from their extensions JSON.
-      std::vector<std::string> versions;
-      for (const auto& extension : extensions) {
-        listDirectoriesInDirectory(extension, versions);
-      }
-
-      // Extensions use /<EXTENSION>/<VERSION>/manifest.json.
-      for (const auto& version : versions) {
-        genExtension(row.at("uid"), version, results);
-      }
-    }
+  // Each user's profiles are independent, scan them concurrently.
+  std::vector<QueryData> user_results(users.size());
+  parallelFor(users.size(), context.concurrency, ([&](size_t i) {
+                const auto& row = users[i];
+                if (row.count("uid") == 0 || row.count("directory") == 0) {
+                  return;
+                }
+
+                // For each user, enumerate all of their chrome profiles.
+                std::vector<std::string> profiles;
+                fs::path extension_path = row.at("directory") / sub_dir;
+                if (!resolveFilePattern(
+                         extension_path, profiles, GLOB_FOLDERS)
+                         .ok()) {
+                  return;
+                }
+
+                // For each profile list each extension in the Extensions
+                // directory.
+                std::vector<std::string> extensions;
+                for (const auto& profile : profiles) {
+                  listDirectoriesInDirectory(profile, extensions);
+                }
+
+                // Generate an addons list from their extensions JSON.
+                std::vector<std::string> versions;
+                for (const auto& extension : extensions) {
+                  listDirectoriesInDirectory(extension, versions);
+                }
+
+                // Extensions use /<EXTENSION>/<VERSION>/manifest.json.
+                for (const auto& version : versions) {
+                  genExtension(row.at("uid"), version, user_results[i]);
+                }
+              }));
+
+  for (auto& rows : user_results) {
+    results.insert(results.end(),
+                   std::make_move_iterator(rows.begin()),
+                   std::make_move_iterator(rows.end()));
   }
 
   return results;
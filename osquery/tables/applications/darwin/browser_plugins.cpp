@@ -114,7 +114,7 @@ QueryData genBrowserPlugins(QueryContext& context) {
   // The caller is not requesting a JOIN against users. This is "special" logic
   // for user data-based tables since there is a concept of system-available
   // browser extensions.
-  if (context.constraints["uid"].notExistsOrMatches("0")) {
+  if (context.constraints["uid"].admits("0")) {
     enum_browser_plugins(kBrowserPluginsPath, "0");
   }
 
@@ -7,14 +7,13 @@
  *  of patent rights can be found in the PATENTS file in the same directory.
  *
  */
-#include <sstream>
+#include <memory>
+#include <vector>
 
 #include <osquery/config.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
-#include <osquery/core/conversions.h>
-
 #include "osquery/config/parsers/prometheus_targets.h"
 #include "osquery/tables/applications/posix/prometheus_metrics.h"
 
@@ -23,50 +22,196 @@ namespace http = boost::network::http;
 namespace osquery {
 namespace tables {
 
+/// The most recent response of each target, reused within a query interval.
+static std::map<std::string, PrometheusResponseData> kPrometheusCache;
+
+/// Access to the cached responses from concurrent queries.
+static Mutex kPrometheusCacheMutex;
+
+/// The client shared by scrapes, copies share its IO service and resolver.
+static std::shared_ptr<http::client> kPrometheusClient;
+
+/// The timeout of the shared client.
+static size_t kPrometheusClientTimeout{0};
+
+/// Access to the shared client.
+static Mutex kPrometheusClientMutex;
+
+inline bool isMetricSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+bool parseMetricLine(const std::string& content,
+                     size_t start,
+                     size_t end,
+                     std::string& name,
+                     std::string& labels,
+                     std::string& value) {
+  auto pos = start;
+  while (pos < end && isMetricSpace(content[pos])) {
+    pos++;
+  }
+  if (pos == end || content[pos] == '#') {
+    return false;
+  }
+
+  auto name_start = pos;
+  while (pos < end && content[pos] != '{' && !isMetricSpace(content[pos])) {
+    pos++;
+  }
+  name.assign(content, name_start, pos - name_start);
+
+  labels.clear();
+  if (pos < end && content[pos] == '{') {
+    // Label values are quoted and may escape quotes or contain braces.
+    auto labels_start = ++pos;
+    bool quoted = false;
+    for (; pos < end; pos++) {
+      if (quoted && content[pos] == '\\') {
+        pos++;
+      } else if (content[pos] == '"') {
+        quoted = !quoted;
+      } else if (!quoted && content[pos] == '}') {
+        break;
+      }
+    }
+    if (pos >= end) {
+      return false;
+    }
+    labels.assign(content, labels_start, pos - labels_start);
+    pos++;
+  }
+
+  while (pos < end && isMetricSpace(content[pos])) {
+    pos++;
+  }
+  auto value_start = pos;
+  while (pos < end && !isMetricSpace(content[pos])) {
+    pos++;
+  }
+  if (pos == value_start) {
+    return false;
+  }
+
+  // An optional timestamp may follow, the scrape time is reported instead.
+  value.assign(content, value_start, pos - value_start);
+  return true;
+}
+
 void parseScrapeResults(
     const std::map<std::string, PrometheusResponseData>& scrapeResults,
     QueryData& rows) {
+  std::string name;
+  std::string labels;
+  std::string value;
   for (auto const& target : scrapeResults) {
-    std::stringstream ss(target.second.content);
-    std::string dest;
-
-    while (std::getline(ss, dest)) {
-      if (!dest.empty() && dest[0] != '#') {
-        auto metric(osquery::split(dest, " "));
-
-        if (metric.size() > 1) {
-          Row r;
-          r[kColTargetName] = target.first;
-          r[kColTimeStamp] = BIGINT(target.second.timestampMS.count());
-          r[kColMetric] = metric[0];
-          r[kColValue] = metric[1];
-
-          rows.push_back(r);
-        }
+    const auto& content = target.second.content;
+    auto timestamp = BIGINT(target.second.timestampMS.count());
+
+    size_t start = 0;
+    while (start < content.size()) {
+      auto end = content.find('\n', start);
+      if (end == std::string::npos) {
+        end = content.size();
+      }
+
+      if (parseMetricLine(content, start, end, name, labels, value)) {
+        Row r;
+        r[kColTargetName] = target.first;
+        r[kColTimeStamp] = timestamp;
+        r[kColMetric] = name;
+        r[kColLabels] = labels;
+        r[kColValue] = value;
+        rows.push_back(std::move(r));
       }
+      start = end + 1;
     }
   }
 }
 
-void scrapeTargets(
-    std::map<std::string, PrometheusResponseData>& scrapeResults) {
-  http::client client(
-      http::client::options().follow_redirects(true).timeout(1));
+static http::client getPrometheusClient(size_t timeout) {
+  WriteLock lock(kPrometheusClientMutex);
+  if (kPrometheusClient == nullptr || kPrometheusClientTimeout != timeout) {
+    kPrometheusClient = std::make_shared<http::client>(
+        http::client::options()
+            .follow_redirects(true)
+            .cache_resolved(true)
+            .timeout(static_cast<int>(timeout)));
+    kPrometheusClientTimeout = timeout;
+  }
+  return *kPrometheusClient;
+}
+
+inline std::chrono::milliseconds getTimeMS() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch());
+}
+
+void scrapeTargets(std::map<std::string, PrometheusResponseData>& scrapeResults,
+                   size_t timeout) {
+  // A scheduled query reuses responses scraped during its interval.
+  std::chrono::milliseconds max_age(TablePlugin::kCacheInterval * 1000);
+  auto now = getTimeMS();
+
+  std::vector<std::string> targets;
+  {
+    WriteLock lock(kPrometheusCacheMutex);
+    // Responses of targets removed from the configuration are dropped.
+    for (auto it = kPrometheusCache.begin(); it != kPrometheusCache.end();) {
+      if (scrapeResults.count(it->first) == 0) {
+        it = kPrometheusCache.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    for (auto& target : scrapeResults) {
+      auto cached = kPrometheusCache.find(target.first);
+      if (max_age.count() > 0 && cached != kPrometheusCache.end() &&
+          now - cached->second.timestampMS < max_age) {
+        target.second = cached->second;
+      } else {
+        targets.push_back(target.first);
+      }
+    }
+  }
 
-  for (auto& target : scrapeResults) {
+  if (targets.empty()) {
+    return;
+  }
+
+  // Requests are sent together, the client completes them asynchronously.
+  auto client = getPrometheusClient(timeout);
+  std::vector<std::unique_ptr<http::client::response>> responses;
+  for (const auto& target : targets) {
     try {
-      http::client::request request(target.first);
-      http::client::response response(client.get(request));
+      http::client::request request(target);
+      responses.push_back(
+          std::make_unique<http::client::response>(client.get(request)));
+    } catch (std::exception& e) {
+      LOG(ERROR) << "Failed on scrape of target " << target << ": "
+                 << e.what();
+      responses.push_back(nullptr);
+    }
+  }
 
-      target.second.timestampMS =
-          std::chrono::duration_cast<std::chrono::milliseconds>(
-              std::chrono::system_clock::now().time_since_epoch());
-      target.second.content = static_cast<std::string>(body(response));
+  for (size_t i = 0; i < targets.size(); i++) {
+    if (responses[i] == nullptr) {
+      continue;
+    }
 
+    auto& result = scrapeResults[targets[i]];
+    try {
+      result.content = static_cast<std::string>(body(*responses[i]));
+      result.timestampMS = getTimeMS();
     } catch (std::exception& e) {
-      LOG(ERROR) << "Failed on scrape of target " << target.first << ": "
+      LOG(ERROR) << "Failed on scrape of target " << targets[i] << ": "
                  << e.what();
+      continue;
     }
+
+    WriteLock lock(kPrometheusCacheMutex);
+    kPrometheusCache[targets[i]] = result;
   }
 }
 
@@ -116,7 +261,7 @@ QueryData genPrometheusMetrics(QueryContext& context) {
     sr[url.second.data()] = PrometheusResponseData{};
   }
 
-  scrapeTargets(sr);
+  scrapeTargets(sr, config.get<size_t>("timeout", 1));
   parseScrapeResults(sr, result);
 
   return result;
@@ -25,12 +25,34 @@ const std::string kColTargetName = "target_name";
 const std::string kColMetric = "metric_name";
 const std::string kColValue = "metric_value";
 const std::string kColTimeStamp = "timestamp_ms";
+const std::string kColLabels = "labels";
 
 struct PrometheusResponseData {
   std::string content;
   std::chrono::milliseconds timestampMS;
 };
 
+/**
+ * @brief Parse one line of the Prometheus text exposition format.
+ *
+ * A sample line is a metric name, optional labels within braces, a value,
+ * and an optional timestamp. Comments and blank lines are not samples.
+ *
+ * @param content The scraped response.
+ * @param start The offset of the line in the response.
+ * @param end The offset of the line ending, or the end of the response.
+ * @param name Set to the metric name.
+ * @param labels Set to the labels within the braces, if any.
+ * @param value Set to the sample value.
+ * @return true if the line is a sample.
+ */
+bool parseMetricLine(const std::string& content,
+                     size_t start,
+                     size_t end,
+                     std::string& name,
+                     std::string& labels,
+                     std::string& value);
+
 /**
  * @brief parse raw payload returned by scraped targets into QueryData.
  *
@@ -46,11 +68,15 @@ void parseScrapeResults(
  * @brief Scrapes the Prometheus targets and returns response payload and
  * timestamp.
  *
+ * Targets are requested concurrently using a shared client. A scheduled
+ * query reuses a target's response scraped within its interval.
+ *
  * @param scrapeResults map where the key is the target url to be scraped and
  * value is the struct PrometheusResponseData where payload and timestamp are to
  * be written to.
+ * @param timeout Seconds to wait on each target.
  */
-void scrapeTargets(
-    std::map<std::string, PrometheusResponseData>& scrapeResults);
+void scrapeTargets(std::map<std::string, PrometheusResponseData>& scrapeResults,
+                   size_t timeout = 1);
 }
 }
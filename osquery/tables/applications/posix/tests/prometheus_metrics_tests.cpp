@@ -411,5 +411,33 @@ TEST_F(PrometheusMetricsTest, happy_path_10_metrics_2_targets) {
 
   validate(sr, expected);
 }
+
+TEST_F(PrometheusMetricsTest, labels_and_timestamps) {
+  std::chrono::milliseconds now(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch()));
+  std::string nowStr(std::to_string(now.count()));
+
+  // Label values may contain spaces, braces, and escaped quotes.
+  PrometheusResponseData r0 = PrometheusResponseData{
+      "# TYPE http_requests_total counter\n"
+      "http_requests_total{method=\"post\",code=\"200\"} 1027 1395066363000\n"
+      "http_requests_total{path=\"/a b}\",note=\"say \\\"hi\\\"\"} 3\r\n"
+      "truncated_labels{code=\"200\" 1\n"
+      "no_value\n",
+      now,
+  };
+  std::map<std::string, PrometheusResponseData> sr = {{"example1.com", r0}};
+
+  QueryData got;
+  parseScrapeResults(sr, got);
+  ASSERT_EQ(2U, got.size());
+  EXPECT_EQ("http_requests_total", got[0][kColMetric]);
+  EXPECT_EQ("method=\"post\",code=\"200\"", got[0][kColLabels]);
+  EXPECT_EQ("1027", got[0][kColValue]);
+  EXPECT_EQ(nowStr, got[0][kColTimeStamp]);
+  EXPECT_EQ("path=\"/a b}\",note=\"say \\\"hi\\\"\"", got[1][kColLabels]);
+  EXPECT_EQ("3", got[1][kColValue]);
+}
 }
 }
@@ -0,0 +1,87 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <vector>
+#include <string>
+
+#include <osquery/core.h>
+#include <osquery/config.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/freebsd/kqueue.h"
+#include "osquery/tables/events/event_utils.h"
+
+namespace osquery {
+
+/**
+ * @brief Track time, action changes to configured file paths.
+ *
+ * The kqueue publisher keeps the contract of the INotify publisher, this is
+ * the same subscriber without file access monitoring.
+ */
+class FileEventSubscriber : public EventSubscriber<KQueueEventPublisher> {
+ public:
+  Status init() override {
+    configure();
+    return Status(0);
+  }
+
+  /// Walk the configuration's file paths, create subscriptions.
+  void configure() override;
+
+  /**
+   * @brief This exports a single Callback for KQueueEventPublisher events.
+   *
+   * @param ec The EventCallback type receives an EventContextRef substruct
+   * for the KQueueEventPublisher declared in this EventSubscriber subclass.
+   *
+   * @return Was the callback successful.
+   */
+  Status Callback(const ECRef& ec, const SCRef& sc);
+};
+
+REGISTER(FileEventSubscriber, "event_subscriber", "file_events");
+
+void FileEventSubscriber::configure() {
+  // Clear all paths from kqueue, the publisher only applies the difference.
+  removeSubscriptions();
+
+  Config::getInstance().files([this](const std::string& category,
+                                     const std::vector<std::string>& files) {
+    for (const auto& file : files) {
+      VLOG(1) << "Added file event listener to: " << file;
+      auto sc = createSubscriptionContext();
+      sc->path = file;
+      sc->category = category;
+      subscribe(&FileEventSubscriber::Callback, sc);
+    }
+  });
+}
+
+Status FileEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  if (ec->action.empty()) {
+    return Status(0);
+  }
+
+  Row r;
+  r["action"] = ec->action;
+  r["target_path"] = ec->path;
+  r["category"] = sc->category;
+  r["transaction_id"] = INTEGER(ec->transaction_id);
+
+  // Add hashing and 'join' against the file table for stat-information.
+  decorateFileEvent(
+      ec->path, (ec->action == "CREATED" || ec->action == "UPDATED"), r);
+
+  add(r);
+  return Status(0, "OK");
+}
+}
@@ -0,0 +1,45 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/events.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/linux/audit.h"
+
+namespace osquery {
+namespace tables {
+
+QueryData genAuditStatus(QueryContext& context) {
+  QueryData results;
+
+  auto publisher = std::dynamic_pointer_cast<AuditEventPublisher>(
+      EventFactory::getEventPublisher("audit"));
+  if (publisher == nullptr || !publisher->hasStarted()) {
+    // The audit publisher is disabled or failed to set up.
+    return results;
+  }
+
+  auto status = publisher->getStatus();
+
+  Row r;
+  r["enabled"] = INTEGER(status.enabled);
+  r["pid"] = INTEGER(status.pid);
+  r["rate_limit"] = INTEGER(status.rate_limit);
+  r["backlog_limit"] = INTEGER(status.backlog_limit);
+  r["backlog"] = INTEGER(status.backlog);
+  r["lost"] = INTEGER(status.lost);
+  r["multicast"] = INTEGER(publisher->isMulticast());
+  r["received"] = BIGINT(publisher->numReceived());
+  r["receive_calls"] = BIGINT(publisher->numReceiveCalls());
+  results.push_back(r);
+  return results;
+}
+}
+}
@@ -16,11 +16,14 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/events/linux/fanotify.h"
 #include "osquery/events/linux/inotify.h"
 #include "osquery/tables/events/event_utils.h"
 
 namespace osquery {
 
+DECLARE_bool(disable_fanotify);
+
 /**
  * @brief Track time, action changes to /etc/passwd
  *
@@ -61,9 +64,21 @@ void FileEventSubscriber::configure() {
   // There may be a better way to find the set intersection/difference.
   removeSubscriptions();
 
+  // Prefer fanotify mount marks, fall back to inotify if it failed to set up.
+  EventPublisherRef fanotify;
+  if (!FLAGS_disable_fanotify) {
+    fanotify = EventFactory::getEventPublisher("fanotify");
+    if (fanotify != nullptr) {
+      fanotify->removeSubscriptions(getName());
+      if (fanotify->isEnding()) {
+        fanotify = nullptr;
+      }
+    }
+  }
+
   auto parser = Config::getParser("file_paths");
   auto& accesses = parser->getData().get_child("file_accesses");
-  Config::getInstance().files([this, &accesses](
+  Config::getInstance().files([this, &accesses, &fanotify](
       const std::string& category, const std::vector<std::string>& files) {
     for (const auto& file : files) {
       VLOG(1) << "Added file event listener to: " << file;
@@ -76,7 +91,22 @@ void FileEventSubscriber::configure() {
         sc->mask |= kFileAccessMasks;
       }
       sc->category = category;
-      subscribe(&FileEventSubscriber::Callback, sc);
+      if (fanotify == nullptr) {
+        subscribe(&FileEventSubscriber::Callback, sc);
+        continue;
+      }
+
+      // The fanotify publisher shares the inotify contexts.
+      EventFactory::addSubscription(
+          "fanotify",
+          getName(),
+          sc,
+          [this](const EventContextRef& ec, const SubscriptionContextRef& sc) {
+            return Callback(
+                std::static_pointer_cast<INotifyEventContext>(ec),
+                std::static_pointer_cast<INotifySubscriptionContext>(sc));
+          });
+      subscription_count_++;
     }
   });
 }
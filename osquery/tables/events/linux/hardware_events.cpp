@@ -49,26 +49,23 @@ Status HardwareEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
     return Status(0, "Missing node and driver.");
   }
 
-  struct udev_device* device = ec->device;
   r["action"] = ec->action_string;
   r["path"] = ec->devnode;
   r["type"] = ec->devtype;
   r["driver"] = ec->driver;
 
   // UDEV properties.
-  r["model"] = UdevEventPublisher::getValue(device, "ID_MODEL_FROM_DATABASE");
+  r["model"] = ec->getValue("ID_MODEL_FROM_DATABASE");
   if (r["path"].empty() && r["model"].empty()) {
     // Don't emit mising path/model combos.
     return Status(0, "Missing path and model.");
   }
 
-  r["model_id"] = INTEGER(UdevEventPublisher::getValue(device, "ID_MODEL_ID"));
-  r["vendor"] = UdevEventPublisher::getValue(device, "ID_VENDOR_FROM_DATABASE");
-  r["vendor_id"] =
-      INTEGER(UdevEventPublisher::getValue(device, "ID_VENDOR_ID"));
-  r["serial"] =
-      INTEGER(UdevEventPublisher::getValue(device, "ID_SERIAL_SHORT"));
-  r["revision"] = INTEGER(UdevEventPublisher::getValue(device, "ID_REVISION"));
+  r["model_id"] = INTEGER(ec->getValue("ID_MODEL_ID"));
+  r["vendor"] = ec->getValue("ID_VENDOR_FROM_DATABASE");
+  r["vendor_id"] = INTEGER(ec->getValue("ID_VENDOR_ID"));
+  r["serial"] = INTEGER(ec->getValue("ID_SERIAL_SHORT"));
+  r["revision"] = INTEGER(ec->getValue("ID_REVISION"));
   add(r);
   return Status(0, "OK");
 }
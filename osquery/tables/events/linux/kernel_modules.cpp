@@ -0,0 +1,50 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "osquery/events/linux/udev.h"
+#include "osquery/tables/system/linux/kernel_modules.h"
+
+namespace osquery {
+
+/**
+ * @brief Invalidate the kernel tables' cached rows when modules change.
+ *
+ * This subscriber does not record events, the kernel emits a `module`
+ * subsystem event as each module is loaded or removed.
+ */
+class KernelModuleChangesEventSubscriber
+    : public EventSubscriber<UdevEventPublisher> {
+ public:
+  Status init() override;
+
+  Status Callback(const ECRef& ec, const SCRef& sc);
+};
+
+REGISTER(KernelModuleChangesEventSubscriber,
+         "event_subscriber",
+         "kernel_module_changes");
+
+Status KernelModuleChangesEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->action = UDEV_EVENT_ACTION_ALL;
+  sc->subsystem = "module";
+  subscribe(&KernelModuleChangesEventSubscriber::Callback, sc);
+
+  tables::KernelChanges::setRunning(UdevEventPublisher::isRunning);
+  tables::KernelChanges::setWatching(true);
+  return Status(0, "OK");
+}
+
+Status KernelModuleChangesEventSubscriber::Callback(const ECRef& ec,
+                                                    const SCRef& sc) {
+  tables::KernelChanges::changed();
+  return Status(0, "OK");
+}
+}
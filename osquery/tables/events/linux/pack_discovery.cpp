@@ -0,0 +1,64 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string>
+#include <vector>
+
+#include <osquery/filesystem.h>
+#include <osquery/logger.h>
+#include <osquery/packs.h>
+
+#include "osquery/events/linux/inotify.h"
+
+namespace osquery {
+
+/// Package manager databases rewritten when packages change.
+const std::vector<std::string> kPackageDatabasePaths = {
+    "/var/lib/dpkg/", "/var/lib/rpm/",
+};
+
+/**
+ * @brief Expire pack discovery results when packages change.
+ *
+ * Discovery queries commonly check the installed software, this subscriber
+ * does not record events, it invalidates the DiscoveryCache instead.
+ */
+class PackDiscoveryEventSubscriber
+    : public EventSubscriber<INotifyEventPublisher> {
+ public:
+  Status init() override;
+
+  Status Callback(const ECRef& ec, const SCRef& sc);
+};
+
+REGISTER(PackDiscoveryEventSubscriber, "event_subscriber", "pack_discovery");
+
+Status PackDiscoveryEventSubscriber::init() {
+  for (const auto& path : kPackageDatabasePaths) {
+    if (!isDirectory(path).ok()) {
+      continue;
+    }
+
+    auto sc = createSubscriptionContext();
+    sc->path = path;
+    sc->mask = IN_MOVED_TO | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE;
+    subscribe(&PackDiscoveryEventSubscriber::Callback, sc);
+  }
+  return Status(0, "OK");
+}
+
+Status PackDiscoveryEventSubscriber::Callback(const ECRef& ec,
+                                              const SCRef& sc) {
+  VLOG(1) << "Package database changed, expiring discovery results: "
+          << ec->path;
+  DiscoveryCache::invalidate();
+  return Status(0, "OK");
+}
+}
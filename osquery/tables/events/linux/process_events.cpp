@@ -8,15 +8,21 @@
  *
  */
 
+#include <sys/stat.h>
+
 #include <osquery/config.h>
+#include <osquery/filesystem.h>
 #include <osquery/logger.h>
-#include <osquery/sql.h>
 #include <osquery/system.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/events/linux/audit.h"
+#include "osquery/events/linux/tracing.h"
 
 namespace osquery {
 
+DECLARE_bool(disable_tracing);
+
 #define AUDIT_SYSCALL_EXECVE 59
 
 // Depend on the external getUptime table method.
@@ -26,6 +32,11 @@ extern long getUptime();
 
 bool ProcessUpdate(size_t type, const AuditFields& fields, AuditFields& r) {
   if (type == AUDIT_SYSCALL) {
+    // Failed executions are not assembled.
+    if (fields.count("success") && fields.at("success") == "no") {
+      return false;
+    }
+
     r["pid"] = (fields.count("pid")) ? fields.at("pid") : "0";
     r["parent"] = fields.count("ppid") ? fields.at("ppid") : "0";
     r["uid"] = fields.count("uid") ? fields.at("uid") : "0";
@@ -34,25 +45,12 @@ bool ProcessUpdate(size_t type, const AuditFields& fields, AuditFields& r) {
     r["egid"] = fields.count("egid") ? fields.at("euid") : "0";
     r["path"] = (fields.count("exe")) ? decodeAuditValue(fields.at("exe")) : "";
 
-    auto qd = SQL::selectAllFrom("file", "path", EQUALS, r.at("path"));
-    if (qd.size() == 1) {
-      r["ctime"] = qd.front().at("ctime");
-      r["atime"] = qd.front().at("atime");
-      r["mtime"] = qd.front().at("mtime");
-      r["btime"] = "0";
-    }
-
     // This should get overwritten during the EXECVE state.
     r["cmdline"] = (fields.count("comm")) ? fields.at("comm") : "";
     // Do not record a cmdline size. If the final state is reached and no
     // 'argc'
     // has been filled in then the EXECVE state was not used.
     r["cmdline_size"] = "";
-
-    r["overflows"] = "";
-    r["env_size"] = "0";
-    r["env_count"] = "0";
-    r["env"] = "";
   }
 
   if (type == AUDIT_EXECVE) {
@@ -74,12 +72,13 @@ bool ProcessUpdate(size_t type, const AuditFields& fields, AuditFields& r) {
     // Then an overflow could be calculated/determined based on
     // actual/expected.
     r["cmdline_size"] = std::to_string(r.at("cmdline").size());
-
-    // Uptime is helpful for execution-based events.
-    r["uptime"] = std::to_string(tables::getUptime());
   }
 
   if (type == AUDIT_PATH) {
+    // Only the first path record describes the executed binary.
+    if (fields.count("item") && fields.at("item") != "0") {
+      return true;
+    }
     r["mode"] = (fields.count("mode")) ? fields.at("mode") : "";
     r["owner_uid"] = fields.count("ouid") ? fields.at("ouid") : "0";
     r["owner_gid"] = fields.count("ogid") ? fields.at("ogid") : "0";
@@ -95,46 +94,155 @@ class ProcessEventSubscriber : public EventSubscriber<AuditEventPublisher> {
   /// Kernel events matching the event type will fire.
   Status Callback(const ECRef& ec, const SCRef& sc);
 
- private:
-  AuditAssembler asm_;
+  /// Process executions read from the sched_process_exec tracepoint.
+  Status TracingCallback(const TracingEventContextRef& ec);
+
+ protected:
+  /// Executed file metadata and the uptime are computed when selected.
+  void enrichEvents(QueryData& results) const override;
+};
+
+/// Columns that are not read from the execution, and are not stored.
+const std::map<std::string, std::string> kProcessEventDefaults = {
+    {"overflows", ""}, {"env", ""}, {"env_count", "0"}, {"env_size", "0"},
 };
 
 REGISTER(ProcessEventSubscriber, "event_subscriber", "process_events");
 
 Status ProcessEventSubscriber::init() {
-  asm_.start(
-      20, {AUDIT_SYSCALL, AUDIT_EXECVE, AUDIT_PATH, AUDIT_CWD}, &ProcessUpdate);
+  if (!FLAGS_disable_tracing) {
+    // Tracepoints replace the audit execve rule, the rows are the same.
+    auto status = addTracingSubscription(
+        getName(),
+        {"sched/sched_process_exec"},
+        [this](const TracingEventContextRef& ec) {
+          return TracingCallback(ec);
+        });
+    if (status.ok()) {
+      subscription_count_++;
+    }
+    return status;
+  }
 
   auto sc = createSubscriptionContext();
 
   // Monitor for execve syscalls.
   sc->rules.push_back({AUDIT_SYSCALL_EXECVE, ""});
 
-  // Request call backs for all parts of the process execution state.
-  // Drop events if they are encountered outside of the expected state.
-  sc->types = {AUDIT_SYSCALL, AUDIT_EXECVE, AUDIT_CWD, AUDIT_PATH};
+  // The publisher assembles all parts of the process execution state.
+  sc->assembly.capacity = 20;
+  sc->assembly.types = {AUDIT_SYSCALL, AUDIT_EXECVE, AUDIT_PATH, AUDIT_CWD};
+  sc->assembly.update = &ProcessUpdate;
   subscribe(&ProcessEventSubscriber::Callback, sc);
 
   return Status(0, "OK");
 }
 
 Status ProcessEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
-  // Check and set the valid state change.
-  // If this is an unacceptable change reset the state and clear row data.
-  if (ec->fields.count("success") && ec->fields.at("success") == "no") {
-    return Status(0, "OK");
-  }
+  // The assembled fields are shared with the publisher, rows are copies.
+  Row r(*ec->assembled);
+  add(r);
+  return Status(0, "OK");
+}
+
+Status ProcessEventSubscriber::TracingCallback(
+    const TracingEventContextRef& ec) {
+  Row r;
+  auto pid = std::to_string(ec->pid);
+  r["pid"] = pid;
+  r["path"] = (ec->fields.count("filename")) ? ec->fields.at("filename") : "";
+
+  // Credentials and arguments are read while the process is running.
+  std::string content;
+  r["parent"] = "0";
+  r["uid"] = r["euid"] = r["gid"] = r["egid"] = "0";
+  if (readFile("/proc/" + pid + "/status", content).ok()) {
+    for (const auto& line : osquery::split(content, "\n")) {
+      auto detail = osquery::split(line);
+      if (detail.size() < 3) {
+        continue;
+      }
 
-  if (ec->type == AUDIT_PATH && ec->fields.count("item") &&
-      ec->fields.at("item") != "0") {
-    return Status(0, "OK");
+      if (detail[0] == "PPid:") {
+        r["parent"] = detail[1];
+      } else if (detail[0] == "Uid:") {
+        r["uid"] = detail[1];
+        r["euid"] = detail[2];
+      } else if (detail[0] == "Gid:") {
+        r["gid"] = detail[1];
+        r["egid"] = detail[2];
+      }
+    }
   }
 
-  auto fields = asm_.add(ec->auid, ec->type, ec->fields);
-  if (fields.is_initialized()) {
-    add(*fields);
+  r["cmdline"] = "";
+  if (readFile("/proc/" + pid + "/cmdline", content).ok()) {
+    // Arguments are null-delimited.
+    for (const auto& arg : osquery::split(content, std::string(1, '\0'))) {
+      if (r.at("cmdline").size() > 0) {
+        r["cmdline"] += " ";
+      }
+      r["cmdline"] += arg;
+    }
   }
+  r["cmdline_size"] = std::to_string(r.at("cmdline").size());
 
+  // The file mode and owners are read when the event is selected.
+  add(r);
   return Status(0, "OK");
 }
+
+void ProcessEventSubscriber::enrichEvents(QueryData& results) const {
+  // Executions of the same file share a stat.
+  std::map<std::string, std::pair<bool, struct stat>> files;
+  auto now = getUnixTime();
+  auto uptime = static_cast<size_t>(tables::getUptime());
+
+  for (auto& r : results) {
+    for (const auto& column : kProcessEventDefaults) {
+      r.emplace(column.first, column.second);
+    }
+
+    if (r.count("uptime") == 0) {
+      // The uptime at the execution is derived from the time since.
+      unsigned long int time = 0;
+      safeStrtoul(r["time"], 10, time);
+      auto elapsed = (now > time) ? now - time : 0;
+      r["uptime"] = BIGINT((uptime > elapsed) ? uptime - elapsed : 0);
+    }
+
+    // Events stored before enrichment, or of deleted files, are unchanged.
+    const auto& path = r["path"];
+    if (r.count("mtime") > 0 || path.empty()) {
+      continue;
+    }
+
+    auto file = files.find(path);
+    if (file == files.end()) {
+      struct stat path_stat {};
+      auto exists = (stat(path.c_str(), &path_stat) == 0);
+      file = files.emplace(path, std::make_pair(exists, path_stat)).first;
+    }
+    if (!file->second.first) {
+      r.emplace("mode", "");
+      r.emplace("owner_uid", "0");
+      r.emplace("owner_gid", "0");
+      continue;
+    }
+
+    // Audit executions include the mode and owners from the PATH record.
+    const auto& file_stat = file->second.second;
+    if (r.count("mode") == 0) {
+      char mode[8] = {0};
+      snprintf(mode, sizeof(mode), "%07o", file_stat.st_mode);
+      r["mode"] = mode;
+      r["owner_uid"] = BIGINT(file_stat.st_uid);
+      r["owner_gid"] = BIGINT(file_stat.st_gid);
+    }
+    r["atime"] = BIGINT(file_stat.st_atime);
+    r["mtime"] = BIGINT(file_stat.st_mtime);
+    r["ctime"] = BIGINT(file_stat.st_ctime);
+    r["btime"] = "0";
+  }
+}
 }
@@ -8,8 +8,15 @@
  *
  */
 
-#include <boost/algorithm/hex.hpp>
-#include <boost/algorithm/string.hpp>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <boost/filesystem.hpp>
 
 #include <osquery/logger.h>
 #include <osquery/sql.h>
@@ -17,12 +24,15 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/events/linux/audit.h"
+#include "osquery/events/linux/tracing.h"
 
 namespace osquery {
 
 #define AUDIT_SYSCALL_BIND 49
 #define AUDIT_SYSCALL_CONNECT 42
 
+DECLARE_bool(disable_tracing);
+
 FLAG(bool,
      audit_allow_sockets,
      false,
@@ -49,57 +59,95 @@ class SocketEventSubscriber : public EventSubscriber<AuditEventPublisher> {
   /// Kernel events matching the event type will fire.
   Status Callback(const ECRef& ec, const SCRef& sc);
 
- private:
-  AuditAssembler asm_;
+  /// Socket state changes read from the inet_sock_set_state tracepoint.
+  Status TracingCallback(const TracingEventContextRef& ec);
 };
 
 REGISTER(SocketEventSubscriber, "event_subscriber", "socket_events");
 
-inline std::string ip4FromSaddr(const std::string& saddr, ushort offset) {
-  long result{0};
-  safeStrtol(saddr.substr(offset, 8), 16, result);
-  return std::to_string((result & 0xff000000) >> 24) + "." +
-         std::to_string((result & 0x00ff0000) >> 16) + "." +
-         std::to_string((result & 0x0000ff00) >> 8) + "." +
-         std::to_string((result & 0x000000ff));
+/// The largest socket address the kernel logs, a sockaddr_storage.
+const size_t kSockAddrMaxSize{128};
+
+/// The value of a hex digit, or -1.
+static inline int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+/**
+ * @brief Decode the hex audit saddr field into the socket address bytes.
+ *
+ * @param saddr The hex field.
+ * @param bytes Output of at most kSockAddrMaxSize bytes.
+ * @param size Output number of bytes decoded.
+ * @return False if decoding stopped at an invalid digit.
+ */
+static bool decodeSockAddr(const std::string& saddr,
+                           unsigned char* bytes,
+                           size_t& size) {
+  auto length = std::min(saddr.size() / 2, kSockAddrMaxSize);
+  for (size = 0; size < length; size++) {
+    auto high = hexValue(saddr[size * 2]);
+    auto low = hexValue(saddr[size * 2 + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    bytes[size] = static_cast<unsigned char>((high << 4) | low);
+  }
+  return (saddr.size() % 2 == 0);
 }
 
 void parseSockAddr(const std::string& saddr, AuditFields& r) {
+  unsigned char bytes[kSockAddrMaxSize];
+  size_t size = 0;
+  auto decoded = decodeSockAddr(saddr, bytes, size);
+
+  // The family is in host order, the port and address are in network order.
   // The protocol is not included in the audit message.
-  if (saddr[0] == '0' && saddr[1] == '2') {
-    // IPv4
+  sa_family_t family = AF_UNSPEC;
+  if (size >= sizeof(family)) {
+    memcpy(&family, bytes, sizeof(family));
+  }
+  if (family == AF_INET && size >= 8) {
     r["family"] = "2";
-    long result{0};
-    safeStrtol(saddr.substr(4, 4), 16, result);
-    r["remote_port"] = INTEGER(result);
-    r["remote_address"] = ip4FromSaddr(saddr, 8);
-  } else if (saddr[0] == '0' && saddr[1] == 'A') {
-    // IPv6
+    r["remote_port"] = INTEGER((bytes[2] << 8) | bytes[3]);
+    char address[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, bytes + 4, address, sizeof(address));
+    r["remote_address"] = address;
+  } else if (family == AF_INET6 && size >= 24) {
     r["family"] = "11";
-    long result{0};
-    safeStrtol(saddr.substr(4, 4), 16, result);
-    r["remote_port"] = INTEGER(result);
-    std::string address;
-    for (size_t i = 0; i < 8; ++i) {
-      address += saddr.substr(16 + (i * 4), 4);
-      if (i == 0 || i % 7 != 0) {
-        address += ":";
+    r["remote_port"] = INTEGER((bytes[2] << 8) | bytes[3]);
+    // Groups are not compressed, the address follows the 4 byte flow info.
+    static const char kDigits[] = "0123456789abcdef";
+    char address[40];
+    for (size_t i = 0; i < 16; i++) {
+      auto offset = i * 2 + i / 2;
+      address[offset] = kDigits[bytes[8 + i] >> 4];
+      address[offset + 1] = kDigits[bytes[8 + i] & 0x0f];
+      if (i % 2 == 1) {
+        address[offset + 2] = (i == 15) ? '\0' : ':';
       }
     }
-    boost::algorithm::to_lower(address);
-    r["remote_address"] = std::move(address);
-  } else if (saddr[0] == '0' && saddr[1] == '1' && saddr.size() > 6) {
-    // Unix domain
+    r["remote_address"] = address;
+  } else if (family == AF_UNIX && size > 3) {
     r["family"] = "1";
     r["local_port"] = "0";
     r["remote_port"] = "0";
-    off_t begin = (saddr[4] == '0' && saddr[5] == '0') ? 6 : 4;
-    auto end = saddr.substr(begin).find("00");
-    end = (end == std::string::npos) ? saddr.size() : end + 4;
-    try {
-      r["socket"] = boost::algorithm::unhex(saddr.substr(begin, end - begin));
-    } catch (const boost::algorithm::hex_decode_error& e) {
+    // An abstract socket name begins with a NUL, the path ends with one.
+    size_t begin = (bytes[2] == 0) ? 3 : 2;
+    auto path = reinterpret_cast<const char*>(bytes + begin);
+    auto end = static_cast<const char*>(memchr(path, 0, size - begin));
+    if (end == nullptr && !decoded) {
       r["socket"] = "unknown";
+    } else {
+      r["socket"] =
+          std::string(path, (end != nullptr) ? end - path : size - begin);
     }
   } else {
     r["family"] = "-1";
@@ -124,6 +172,10 @@ bool SocketUpdate(size_t type, const AuditFields& fields, AuditFields& r) {
     return true;
   }
 
+  r["action"] = (fields.count("syscall") &&
+                 fields.at("syscall") == std::to_string(AUDIT_SYSCALL_BIND))
+                    ? "bind"
+                    : "connect";
   r["pid"] = fields.at("pid");
   r["path"] = decodeAuditValue(fields.at("exe"));
   // TODO: This is a hex value.
@@ -134,49 +186,116 @@ bool SocketUpdate(size_t type, const AuditFields& fields, AuditFields& r) {
   return true;
 }
 
+/// Format the raw address bytes of an inet_sock_set_state tracepoint.
+std::string addressFromTracing(const std::string& family,
+                               const std::string& address) {
+  std::string result;
+  if (family == "2" && address.size() >= 4) {
+    for (size_t i = 0; i < 4; i++) {
+      result += ((i > 0) ? "." : "") +
+                std::to_string(static_cast<unsigned char>(address[i]));
+    }
+  } else if (family == "10" && address.size() >= 16) {
+    // Match the audit formatting of expanded IPv6 groups.
+    for (size_t i = 0; i < 8; i++) {
+      char group[5] = {0};
+      snprintf(group,
+               sizeof(group),
+               "%02x%02x",
+               static_cast<unsigned char>(address[i * 2]),
+               static_cast<unsigned char>(address[i * 2 + 1]));
+      result += ((i > 0) ? ":" : "") + std::string(group);
+    }
+  }
+  return result;
+}
+
 Status SocketEventSubscriber::init() {
-  asm_.start(10, {AUDIT_TYPE_SYSCALL, AUDIT_TYPE_SOCKADDR}, &SocketUpdate);
+  if (!FLAGS_disable_tracing) {
+    // Tracepoints replace the audit bind and connect rules.
+    auto status = addTracingSubscription(
+        getName(),
+        {"sock/inet_sock_set_state"},
+        [this](const TracingEventContextRef& ec) {
+          return TracingCallback(ec);
+        });
+    if (status.ok()) {
+      subscription_count_++;
+    }
+    return status;
+  }
 
   auto sc = createSubscriptionContext();
 
   // Monitor for bind and connect syscalls.
   sc->rules.push_back({AUDIT_SYSCALL_BIND, ""});
   sc->rules.push_back({AUDIT_SYSCALL_CONNECT, ""});
-  // Also grab SADDR structures
-  sc->types.insert(AUDIT_TYPE_SOCKADDR);
 
-  // Drop events if they are encountered outside of the expected state.
-  // sc->types = {AUDIT_SYSCALL};
+  // The publisher assembles each syscall with its SADDR structure.
+  sc->assembly.capacity = 10;
+  sc->assembly.types = {AUDIT_TYPE_SYSCALL, AUDIT_TYPE_SOCKADDR};
+  sc->assembly.update = &SocketUpdate;
   subscribe(&SocketEventSubscriber::Callback, sc);
 
   return Status(0, "OK");
 }
 
 Status SocketEventSubscriber::Callback(const ECRef& ec, const SCRef&) {
-  if (ec->syscall == AUDIT_SYSCALL_CONNECT) {
-    if (ec->fields.count("exit") && ec->fields.at("exit") != "-115") {
-      // The connect syscall may want an exit with EINPROGRESS.
-    }
-  } else if (ec->type == AUDIT_TYPE_SYSCALL &&
-             ec->syscall != AUDIT_SYSCALL_BIND) {
-    return Status(0);
+  // The assembled fields are shared with the publisher, rows are copies.
+  Row r(*ec->assembled);
+  if (r["action"] == "bind") {
+    r["local_port"] = std::move(r["remote_port"]);
+    r["local_address"] = std::move(r["remote_address"]);
   }
+  add(r);
+  return Status(0);
+}
 
-  auto fields = asm_.add(ec->auid, ec->type, ec->fields);
-  if (ec->syscall == AUDIT_SYSCALL_CONNECT) {
-    asm_.set(ec->auid, "action", "connect");
-  } else if (ec->syscall == AUDIT_SYSCALL_BIND) {
-    asm_.set(ec->auid, "action", "bind");
+Status SocketEventSubscriber::TracingCallback(
+    const TracingEventContextRef& ec) {
+  auto& fields = ec->fields;
+  if (fields.count("newstate") == 0 || fields.count("family") == 0) {
+    return Status(0);
   }
 
-  if (fields.is_initialized()) {
-    if ((*fields)["action"] == "bind") {
-      (*fields)["local_port"] = std::move((*fields)["remote_port"]);
-      (*fields)["local_address"] = std::move((*fields)["remote_address"]);
-    }
-    add(*fields);
+  // Connects and listens change state within the calling process.
+  Row r;
+  auto state = fields.at("newstate");
+  if (state == std::to_string(TCP_SYN_SENT)) {
+    r["action"] = "connect";
+  } else if (state == std::to_string(TCP_LISTEN)) {
+    r["action"] = "bind";
+  } else {
+    return Status(0);
   }
 
+  r["pid"] = std::to_string(ec->pid);
+  boost::system::error_code ec_path;
+  r["path"] = boost::filesystem::read_symlink(
+                  "/proc/" + r.at("pid") + "/exe", ec_path)
+                  .string();
+  r["fd"] = "";
+  r["success"] = "1";
+  r["socket"] = "";
+
+  // The tracepoint uses AF_INET6, the audit rows use the hex sockaddr family.
+  const auto& family = fields.at("family");
+  r["family"] = (family == "10") ? "11" : family;
+  r["protocol"] = (fields.count("protocol")) ? fields.at("protocol") : "0";
+  r["local_port"] = (fields.count("sport")) ? fields.at("sport") : "0";
+  r["remote_port"] = (fields.count("dport")) ? fields.at("dport") : "0";
+
+  auto suffix = (family == "10") ? "_v6" : "";
+  auto saddr = std::string("saddr") + suffix;
+  auto daddr = std::string("daddr") + suffix;
+  r["local_address"] = (fields.count(saddr))
+                           ? addressFromTracing(family, fields.at(saddr))
+                           : "";
+  r["remote_address"] = (fields.count(daddr))
+                            ? addressFromTracing(family, fields.at(daddr))
+                            : "";
+  r["uptime"] = std::to_string(tables::getUptime());
+  add(r);
   return Status(0);
 }
 } // namespace osquery
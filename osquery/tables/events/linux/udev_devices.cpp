@@ -0,0 +1,62 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/logger.h>
+
+#include "osquery/events/linux/udev.h"
+#include "osquery/tables/system/linux/udev_devices.h"
+
+namespace osquery {
+
+/// The subsystems of the device tables.
+static const std::vector<std::string> kUdevCachedSubsystems = {
+    "block", "usb", "pci",
+};
+
+/**
+ * @brief Update the device tables' cached rows when devices change.
+ *
+ * This subscriber does not record events, it reports added, changed, and
+ * removed devices to the UdevDeviceCache instead.
+ */
+class UdevDevicesEventSubscriber : public EventSubscriber<UdevEventPublisher> {
+ public:
+  Status init() override;
+
+  Status Callback(const ECRef& ec, const SCRef& sc);
+};
+
+REGISTER(UdevDevicesEventSubscriber, "event_subscriber", "udev_devices");
+
+Status UdevDevicesEventSubscriber::init() {
+  for (const auto& subsystem : kUdevCachedSubsystems) {
+    auto sc = createSubscriptionContext();
+    sc->action = UDEV_EVENT_ACTION_ALL;
+    sc->subsystem = subsystem;
+    subscribe(&UdevDevicesEventSubscriber::Callback, sc);
+  }
+
+  tables::UdevDeviceCache::setRunning(UdevEventPublisher::isRunning);
+  tables::UdevDeviceCache::setWatching(true);
+  return Status(0, "OK");
+}
+
+Status UdevDevicesEventSubscriber::Callback(const ECRef& ec,
+                                            const SCRef& sc) {
+  auto syspath = udev_device_get_syspath(ec->device);
+  if (syspath == nullptr) {
+    return Status(0, "OK");
+  }
+
+  tables::UdevDeviceCache::changed(
+      ec->subsystem, syspath, ec->action == UDEV_EVENT_ACTION_REMOVE);
+  return Status(0, "OK");
+}
+}
@@ -0,0 +1,44 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/windows/etw.h"
+
+namespace osquery {
+
+class EtwProcessEventSubscriber : public EventSubscriber<EtwEventPublisher> {
+ public:
+  Status init() override {
+    auto sc = createSubscriptionContext();
+    sc->providers = ETW_PROVIDER_PROCESS;
+    subscribe(&EtwProcessEventSubscriber::Callback, sc);
+    return Status(0, "OK");
+  }
+
+  Status Callback(const ECRef& ec, const SCRef& sc);
+};
+
+REGISTER(EtwProcessEventSubscriber, "event_subscriber", "process_events");
+
+Status EtwProcessEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  Row r;
+  r["action"] = (ec->action == ETW_ACTION_PROCESS_START) ? "start" : "stop";
+  r["pid"] = BIGINT(ec->pid);
+  r["path"] = ec->path;
+  r["parent"] = BIGINT(ec->ppid);
+  r["session_id"] = BIGINT(ec->session_id);
+  r["time"] = BIGINT(ec->time);
+
+  add(r, ec->time);
+  return Status(0, "OK");
+}
+}
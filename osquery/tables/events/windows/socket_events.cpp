@@ -0,0 +1,54 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/windows/etw.h"
+
+namespace osquery {
+
+class EtwSocketEventSubscriber : public EventSubscriber<EtwEventPublisher> {
+ public:
+  Status init() override {
+    auto sc = createSubscriptionContext();
+    sc->providers = ETW_PROVIDER_NETWORK;
+    subscribe(&EtwSocketEventSubscriber::Callback, sc);
+    return Status(0, "OK");
+  }
+
+  Status Callback(const ECRef& ec, const SCRef& sc);
+};
+
+REGISTER(EtwSocketEventSubscriber, "event_subscriber", "socket_events");
+
+Status EtwSocketEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  Row r;
+  if (ec->action == ETW_ACTION_SOCKET_CONNECT) {
+    r["action"] = "connect";
+  } else if (ec->action == ETW_ACTION_SOCKET_ACCEPT) {
+    r["action"] = "accept";
+  } else {
+    r["action"] = "disconnect";
+  }
+
+  r["pid"] = BIGINT(ec->pid);
+  r["family"] = INTEGER(ec->family);
+  r["protocol"] = INTEGER(ec->protocol);
+  r["local_address"] = ec->local_address;
+  r["remote_address"] = ec->remote_address;
+  r["local_port"] = INTEGER(ec->local_port);
+  r["remote_port"] = INTEGER(ec->remote_port);
+  r["time"] = BIGINT(ec->time);
+
+  add(r, ec->time);
+  return Status(0, "OK");
+}
+}
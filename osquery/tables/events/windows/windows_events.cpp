@@ -72,17 +72,15 @@ Status WindowsEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   FILETIME cTime;
   GetSystemTimeAsFileTime(&cTime);
   r["time"] = BIGINT(filetimeToUnixtime(cTime));
-  r["datetime"] =
-      ec->eventRecord.get("Event.System.TimeCreated.<xmlattr>.SystemTime", "");
-  r["source"] = ec->eventRecord.get("Event.System.Channel", "");
-  r["provider_name"] =
-      ec->eventRecord.get("Event.System.Provider.<xmlattr>.Name", "");
-  r["provider_guid"] =
-      ec->eventRecord.get("Event.System.Provider.<xmlattr>.Guid", "");
-  r["eventid"] = INTEGER(ec->eventRecord.get("Event.System.EventID", -1));
-  r["task"] = INTEGER(ec->eventRecord.get("Event.System.Task", -1));
-  r["level"] = INTEGER(ec->eventRecord.get("Event.System.Level", -1));
-  r["keywords"] = BIGINT(ec->eventRecord.get("Event.System.Keywords", -1));
+  // The System properties are rendered as values by the publisher.
+  r["datetime"] = ec->datetime;
+  r["source"] = wstringToString(ec->channel.c_str());
+  r["provider_name"] = ec->provider_name;
+  r["provider_guid"] = ec->provider_guid;
+  r["eventid"] = INTEGER(ec->eventid);
+  r["task"] = INTEGER(ec->task);
+  r["level"] = INTEGER(ec->level);
+  r["keywords"] = BIGINT(ec->keywords);
 
   /*
    * From the MSDN definition of the Event Schema, each event will have
@@ -8,10 +8,16 @@
  *
  */
 
+#include <sys/stat.h>
+
 #include <map>
 #include <string>
 
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/trim.hpp>
+
 #include <osquery/config.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 /// The file change event publishers are slightly different in OS X and Linux.
@@ -21,6 +27,7 @@
 #include "osquery/events/linux/inotify.h"
 #endif
 
+#include "osquery/core/metrics.h"
 #include "osquery/tables/other/yara_utils.h"
 
 #ifdef CONCAT
@@ -30,22 +37,69 @@
 
 namespace osquery {
 
+FLAG(uint64,
+     yara_events_threads,
+     4,
+     "Threads scanning the files changed within YARA file_paths");
+
+FLAG(string,
+     yara_events_triggers,
+     "close_write,moved_to",
+     "Comma-separated file changes that trigger YARA scans: "
+     "close_write, created, modified, moved_to");
+
+FLAG(uint64,
+     yara_events_cache,
+     4096,
+     "Number of unchanged scanned files yara_events does not rescan");
+
+DECLARE_uint64(yara_scan_timeout);
+
 /// The file change event publishers are slightly different in OS X and Linux.
 #ifdef __APPLE__
 using FileEventSubscriber = EventSubscriber<FSEventsEventPublisher>;
 using FileEventContextRef = FSEventsEventContextRef;
 using FileSubscriptionContextRef = FSEventsSubscriptionContextRef;
-#define FILE_CHANGE_MASK                                                       \
-  kFSEventStreamEventFlagItemCreated | kFSEventStreamEventFlagItemModified |   \
-      kFSEventStreamEventFlagItemRenamed
+
+/// FSEvents does not report closes, files created or written are scanned.
+const std::map<std::string, uint32_t> kYARATriggerMasks = {
+    {"close_write",
+     kFSEventStreamEventFlagItemCreated | kFSEventStreamEventFlagItemModified},
+    {"created", kFSEventStreamEventFlagItemCreated},
+    {"modified", kFSEventStreamEventFlagItemModified},
+    {"moved_to", kFSEventStreamEventFlagItemRenamed},
+};
 #elif __linux__
 using FileEventSubscriber = EventSubscriber<INotifyEventPublisher>;
 using FileEventContextRef = INotifyEventContextRef;
 using FileSubscriptionContextRef = INotifySubscriptionContextRef;
-#define FILE_CHANGE_MASK                                                       \
-  ((IN_CREATE) | (IN_CLOSE_WRITE) | (IN_MODIFY) | (IN_MOVED_TO))
+
+const std::map<std::string, uint32_t> kYARATriggerMasks = {
+    {"close_write", IN_CLOSE_WRITE},
+    {"created", IN_CREATE},
+    {"modified", IN_MODIFY},
+    {"moved_to", IN_MOVED_TO},
+};
 #endif
 
+/// The file event mask of the --yara_events_triggers.
+static uint32_t getYARATriggerMask() {
+  std::vector<std::string> triggers;
+  boost::split(triggers, FLAGS_yara_events_triggers, boost::is_any_of(","));
+
+  uint32_t mask = 0;
+  for (auto& trigger : triggers) {
+    boost::trim(trigger);
+    auto it = kYARATriggerMasks.find(trigger);
+    if (it != kYARATriggerMasks.end()) {
+      mask |= it->second;
+    } else if (!trigger.empty()) {
+      LOG(WARNING) << "Unknown yara_events trigger: " << trigger;
+    }
+  }
+  return mask;
+}
+
 /**
  * @brief Track YARA matches to files.
  */
@@ -58,6 +112,12 @@ class YARAEventSubscriber : public FileEventSubscriber {
 
   void configure() override;
 
+ protected:
+  /// Changed files are scanned concurrently, each scan has its own row.
+  size_t dispatchThreads() const override {
+    return FLAGS_yara_events_threads;
+  }
+
  private:
   /**
    * @brief This exports a single Callback for FSEventsEventPublisher events.
@@ -69,6 +129,10 @@ class YARAEventSubscriber : public FileEventSubscriber {
    */
   Status Callback(const FileEventContextRef& ec,
                   const FileSubscriptionContextRef& sc);
+
+ private:
+  /// Unchanged files already scanned with the same rules.
+  YARAScanCache cache_;
 };
 
 /**
@@ -82,6 +146,7 @@ REGISTER(YARAEventSubscriber, "event_subscriber", "yara_events");
 
 void YARAEventSubscriber::configure() {
   removeSubscriptions();
+  cache_.setCapacity(FLAGS_yara_events_cache);
 
   // There is a special yara parser that tracks the related top-level keys.
   auto plugin = Config::getParser("yara");
@@ -104,6 +169,11 @@ void YARAEventSubscriber::configure() {
     file_map[category] = files;
   });
 
+  auto mask = getYARATriggerMask();
+  if (mask == 0) {
+    return;
+  }
+
   // For each category within yara's file_paths, add a subscription to the
   // corresponding set of paths.
   const auto& yara_paths = yara_config.get_child("file_paths");
@@ -120,7 +190,7 @@ void YARAEventSubscriber::configure() {
       auto sc = createSubscriptionContext();
       sc->recursive = 0;
       sc->path = file;
-      sc->mask = FILE_CHANGE_MASK;
+      sc->mask = mask;
       sc->category = yara_path_element.first;
       subscribe(&YARAEventSubscriber::Callback, sc);
     }
@@ -129,7 +199,8 @@ void YARAEventSubscriber::configure() {
 
 Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
                                      const FileSubscriptionContextRef& sc) {
-  if (ec->action != "UPDATED" && ec->action != "CREATED") {
+  if (ec->action != "UPDATED" && ec->action != "CREATED" &&
+      ec->action != "MOVED_TO") {
     return Status(1, "Invalid action");
   }
 
@@ -170,6 +241,20 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
   const auto& yara_config = parser->getData();
   const auto& yara_paths = yara_config.get_child("file_paths");
   const auto& sig_groups = yara_paths.find(category);
+
+  // The file is stat-ed before the scan, a write during it changes the time.
+  std::string rules_hash;
+  for (const auto& rule : sig_groups->second) {
+    rules_hash += yaraParser->rulesHash(rule.second.data()) + ',';
+  }
+  struct stat file_stat;
+  bool cacheable = (::stat(ec->path.c_str(), &file_stat) == 0);
+  if (cacheable && cache_.scanned(ec->path, file_stat, rules_hash)) {
+    static auto& unchanged = Metrics::counter("yara_scans_unchanged");
+    unchanged.add();
+    return Status(0, "Unchanged");
+  }
+
   for (const auto& rule : sig_groups->second) {
     const std::string group = rule.second.data();
     int result = yr_rules_scan_file(rules[group],
@@ -177,13 +262,17 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
                                     SCAN_FLAGS_FAST_MODE,
                                     YARACallback,
                                     (void*)&r,
-                                    0);
+                                    static_cast<int>(FLAGS_yara_scan_timeout));
 
     if (result != ERROR_SUCCESS) {
       return Status(1, "YARA error: " + std::to_string(result));
     }
   }
 
+  if (cacheable) {
+    cache_.add(ec->path, file_stat, rules_hash);
+  }
+
   if (ec->action != "" && r.at("matches").size() > 0) {
     add(r);
   }
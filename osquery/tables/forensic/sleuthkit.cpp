@@ -8,15 +8,22 @@
  *
  */
 
+#include <deque>
 #include <map>
 #include <set>
+#include <sstream>
 
+#include <boost/algorithm/string.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
 
 #include <tsk/libtsk.h>
 
+#include <osquery/config.h>
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
@@ -24,10 +31,20 @@
 #include "osquery/tables/system/hash.h"
 
 namespace fs = boost::filesystem;
+namespace pt = boost::property_tree;
 
 namespace osquery {
+
+FLAG(uint64,
+     device_hash_read_max,
+     0,
+     "Maximum bytes of inode content a device_hash query reads (0 no limit)");
+
 namespace tables {
 
+/// Maximum directory entries a device_file partition walk reads per query.
+static const size_t kDeviceWalkMax = 1024 * 10;
+
 const std::map<TSK_FS_META_TYPE_ENUM, std::string> kTSKTypeNames{
     {TSK_FS_META_TYPE_REG, "regular"},   {TSK_FS_META_TYPE_DIR, "directory"},
     {TSK_FS_META_TYPE_LNK, "symlink"},   {TSK_FS_META_TYPE_BLK, "block"},
@@ -35,6 +52,18 @@ const std::map<TSK_FS_META_TYPE_ENUM, std::string> kTSKTypeNames{
     {TSK_FS_META_TYPE_SOCK, "socket"},
 };
 
+/// A directory waiting to be listed by a partition walk.
+struct DeviceDirectory {
+  /// The directory's inode address.
+  TSK_INUM_T inode{0};
+
+  /// The path of the directory within the partition.
+  std::string path;
+
+  /// The index of the first entry not yet listed.
+  size_t offset{0};
+};
+
 class DeviceHelper : private boost::noncopyable {
  public:
   explicit DeviceHelper(const std::string& device_path)
@@ -63,12 +92,16 @@ class DeviceHelper : private boost::noncopyable {
       std::function<void(const std::string&, TskFsFile*, const std::string&)>
           predicate);
 
-  /// Provide a partition description for context and iterate from path.
+  /**
+   * @brief Walk the files of a partition from its root.
+   *
+   * A scheduled query resumes the walk where its previous execution stopped,
+   * after reading kDeviceWalkMax directory entries, and starts again from
+   * the root after a complete walk. Other queries always start at the root.
+   */
   void generateFiles(const std::string& partition,
                      TskFsInfo* fs,
-                     const std::string& path,
-                     QueryData& results,
-                     TSK_INUM_T inode = 0);
+                     QueryData& results);
 
   /// Similar to generateFiles but only yield a row to results.
   void generateFile(const std::string& partition,
@@ -80,17 +113,29 @@ class DeviceHelper : private boost::noncopyable {
   /// Volume accessor, used for computing offsets using block/sector size.
   const std::shared_ptr<TskVsInfo>& getVolume() { return volume_; }
 
-  /// Reset stack counting for directory iteration.
-  void resetStack() {
-    stack_ = 0;
-    count_ = 0;
-    std::set<std::string>().swap(loops_);
+  /// The device node path.
+  const std::string& getDevicePath() const {
+    return device_path_;
   }
 
  private:
   /// Attempt to open the provided device image and volume.
   bool open();
 
+  /**
+   * @brief List the entries of a directory, from its offset.
+   *
+   * Regular files are added to results and subdirectories are added to the
+   * front of the pending directories, in inode order, for a depth-first walk.
+   *
+   * @return false if the walk stopped within the directory.
+   */
+  bool listDirectory(const std::string& partition,
+                     TskFsInfo* fs,
+                     DeviceDirectory& directory,
+                     std::deque<DeviceDirectory>& pending,
+                     QueryData& results);
+
  private:
   /// Has the device open been attempted.
   bool opened_{false};
@@ -107,11 +152,68 @@ class DeviceHelper : private boost::noncopyable {
   /// Filesystem path to the device node.
   std::string device_path_;
 
-  size_t stack_{0};
+  /// The number of directory entries read by a walk.
   size_t count_{0};
-  std::set<std::string> loops_;
 };
 
+/// The key of a scheduled query's partition walk in the backing store.
+static std::string getWalkCursorKey(const std::string& device,
+                                    const std::string& partition) {
+  const auto& query_name = Config::getExecutingQuery();
+  if (query_name.empty()) {
+    return "";
+  }
+  return "device_file." + query_name + "." + device + "." + partition;
+}
+
+static void loadWalkCursor(const std::string& key,
+                           std::deque<DeviceDirectory>& pending) {
+  std::string content;
+  if (!getDatabaseValue(kPersistentSettings, key, content) || content.empty()) {
+    return;
+  }
+
+  pt::ptree tree;
+  try {
+    std::stringstream input(content);
+    pt::read_json(input, tree);
+  } catch (const pt::json_parser::json_parser_error& /* e */) {
+    return;
+  }
+
+  for (const auto& item : tree) {
+    DeviceDirectory directory;
+    directory.inode = item.second.get<TSK_INUM_T>("inode", 0);
+    directory.path = item.second.get<std::string>("path", "");
+    directory.offset = item.second.get<size_t>("offset", 0);
+    if (directory.inode != 0 && !directory.path.empty()) {
+      pending.push_back(std::move(directory));
+    }
+  }
+}
+
+static void saveWalkCursor(const std::string& key,
+                           const std::deque<DeviceDirectory>& pending) {
+  if (pending.empty()) {
+    // The walk completed, the next execution starts from the root.
+    deleteDatabaseValue(kPersistentSettings, key);
+    return;
+  }
+
+  pt::ptree tree;
+  for (const auto& directory : pending) {
+    pt::ptree item;
+    item.put("inode", directory.inode);
+    item.put("path", directory.path);
+    item.put("offset", directory.offset);
+    tree.push_back(std::make_pair("", item));
+  }
+
+  std::stringstream output;
+  pt::write_json(output, tree, false);
+  setDatabaseValue(kPersistentSettings, key, output.str());
+}
+
 bool DeviceHelper::open() {
   if (opened_) {
     return opened_result_;
@@ -195,25 +297,23 @@ void DeviceHelper::generateFile(const std::string& partition,
   results.push_back(r);
 }
 
-void DeviceHelper::generateFiles(const std::string& partition,
+bool DeviceHelper::listDirectory(const std::string& partition,
                                  TskFsInfo* fs,
-                                 const std::string& path,
-                                 QueryData& results,
-                                 TSK_INUM_T inode) {
-  if (stack_++ > 1024) {
-    return;
-  }
-
+                                 DeviceDirectory& directory,
+                                 std::deque<DeviceDirectory>& pending,
+                                 QueryData& results) {
   auto* dir = new TskFsDir();
-  if (dir->open(fs, ((inode == 0) ? fs->getRootINum() : inode))) {
+  if (dir->open(fs, directory.inode)) {
     delete dir;
-    return;
+    return true;
   }
 
   // Iterate through the directory.
   std::map<TSK_INUM_T, std::string> additional;
-  for (size_t i = 0; i < dir->getSize(); i++) {
-    if (count_++ > 1024 * 10) {
+  bool complete = true;
+  for (auto& i = directory.offset; i < dir->getSize(); i++) {
+    if (count_++ > kDeviceWalkMax || QueryBudget::interrupted()) {
+      complete = false;
       break;
     }
 
@@ -232,7 +332,7 @@ void DeviceHelper::generateFiles(const std::string& partition,
     std::string leaf;
     auto* name = file->getName();
     if (name != nullptr) {
-      leaf = (fs::path(path) / name->getName()).string();
+      leaf = (fs::path(directory.path) / name->getName()).string();
     }
 
     if (meta->getType() == TSK_FS_META_TYPE_REG) {
@@ -251,13 +351,93 @@ void DeviceHelper::generateFiles(const std::string& partition,
   }
   delete dir;
 
-  // If we are recursing.
-  for (const auto& d : additional) {
-    if (std::find(loops_.begin(), loops_.end(), d.second) == loops_.end()) {
-      generateFiles(partition, fs, d.second, results, d.first);
-      loops_.insert(d.second);
+  // Subdirectories are walked before the remaining pending directories.
+  for (auto d = additional.rbegin(); d != additional.rend(); ++d) {
+    DeviceDirectory child;
+    child.inode = d->first;
+    child.path = d->second;
+    pending.push_front(std::move(child));
+  }
+  return complete;
+}
+
+void DeviceHelper::generateFiles(const std::string& partition,
+                                 TskFsInfo* fs,
+                                 QueryData& results) {
+  std::deque<DeviceDirectory> pending;
+  auto key = getWalkCursorKey(device_path_, partition);
+  if (!key.empty()) {
+    loadWalkCursor(key, pending);
+  }
+
+  if (pending.empty()) {
+    DeviceDirectory root;
+    root.inode = fs->getRootINum();
+    root.path = "/";
+    pending.push_back(std::move(root));
+  }
+
+  // Each directory is listed once, links may create loops.
+  std::set<TSK_INUM_T> listed;
+  count_ = 0;
+  while (!pending.empty()) {
+    auto directory = std::move(pending.front());
+    pending.pop_front();
+    if (directory.offset == 0 && !listed.insert(directory.inode).second) {
+      continue;
     }
+
+    if (!listDirectory(partition, fs, directory, pending, results)) {
+      // Resume within the directory, after its entries already listed.
+      pending.push_front(std::move(directory));
+      break;
+    }
+  }
+
+  if (!key.empty()) {
+    saveWalkCursor(key, pending);
+  }
+}
+
+/**
+ * @brief The metadata identifying an inode's content.
+ *
+ * A hash cached for the inode is valid while its size, modification, and
+ * change times are unchanged.
+ */
+static std::string getInodeIdentity(TskFsFile* file, TSK_OFF_T& size) {
+  auto* meta = file->getMeta();
+  if (meta == nullptr) {
+    return "";
   }
+
+  size = meta->getSize();
+  auto identity = std::to_string(size) + ":" +
+                  std::to_string(meta->getMTime()) + ":" +
+                  std::to_string(meta->getCTime());
+  delete meta;
+  return identity;
+}
+
+/// Read hashes cached for an unchanged inode.
+static bool getCachedInodeHashes(const std::string& key,
+                                 const std::string& identity,
+                                 MultiHashes& hashes) {
+  std::string value;
+  if (!getDatabaseValue(kPersistentSettings, key, value)) {
+    return false;
+  }
+
+  std::vector<std::string> fields;
+  boost::split(fields, value, boost::is_any_of(","));
+  if (fields.size() != 4 || fields[0] != identity) {
+    return false;
+  }
+
+  hashes.md5 = fields[1];
+  hashes.sha1 = fields[2];
+  hashes.sha256 = fields[3];
+  return true;
 }
 
 MultiHashes hashInode(TskFsFile* file) {
@@ -294,6 +474,13 @@ MultiHashes hashInode(TskFsFile* file) {
         return MultiHashes();
       }
 
+      if (QueryBudget::interrupted()) {
+        // The query is stopped, a partial content hash is not reported.
+        free(buffer);
+        delete meta;
+        return MultiHashes();
+      }
+
       md5.update(buffer, chunk_size);
       sha1.update(buffer, chunk_size);
       sha256.update(buffer, chunk_size);
@@ -318,11 +505,13 @@ QueryData genDeviceHash(QueryContext& context) {
   auto parts = context.constraints["partition"].getAll(EQUALS);
   auto inodes = context.constraints["inode"].getAll(EQUALS);
 
+  // Bytes of inode content read by this query.
+  size_t bytes = 0;
   for (const auto& dev : devices) {
     // For each require device path, open a device helper that checks the
     // image, checks the volume, and allows partition iteration.
     DeviceHelper dh(dev);
-    dh.partitions(([&results, &dev, &dh, &parts, &inodes](
+    dh.partitions(([&results, &dev, &dh, &parts, &inodes, &bytes](
         const TskVsPartInfo* part) {
       // The table also requires a partition for searching.
       auto address = std::to_string(part->getAddr());
@@ -341,15 +530,43 @@ QueryData genDeviceHash(QueryContext& context) {
 
       dh.inodes(inodes,
                 fs,
-                ([&results, &address, &dev, &dh, &fs](const std::string& inode,
-                                                      TskFsFile* file,
-                                                      const std::string& path) {
+                ([&results, &address, &dev, &bytes](const std::string& inode,
+                                                    TskFsFile* file,
+                                                    const std::string& path) {
                   Row r;
                   r["device"] = dev;
                   r["partition"] = address;
                   r["inode"] = inode;
 
-                  auto hashes = hashInode(file);
+                  // Unchanged inodes are not read again.
+                  TSK_OFF_T size = 0;
+                  auto identity = getInodeIdentity(file, size);
+                  auto key = "device_hash." + dev + "." + address + "." + inode;
+                  MultiHashes hashes;
+                  if (!identity.empty() &&
+                      getCachedInodeHashes(key, identity, hashes)) {
+                    r["md5"] = std::move(hashes.md5);
+                    r["sha1"] = std::move(hashes.sha1);
+                    r["sha256"] = std::move(hashes.sha256);
+                    results.push_back(r);
+                    return;
+                  }
+
+                  // Inodes past the query's read limit are not hashed.
+                  auto limit = FLAGS_device_hash_read_max;
+                  if (limit > 0 && bytes + static_cast<size_t>(size) > limit) {
+                    results.push_back(r);
+                    return;
+                  }
+
+                  bytes += static_cast<size_t>(size);
+                  hashes = hashInode(file);
+                  if (!identity.empty() && !hashes.md5.empty()) {
+                    setDatabaseValue(kPersistentSettings,
+                                     key,
+                                     identity + "," + hashes.md5 + "," +
+                                         hashes.sha1 + "," + hashes.sha256);
+                  }
                   r["md5"] = std::move(hashes.md5);
                   r["sha1"] = std::move(hashes.sha1);
                   r["sha256"] = std::move(hashes.sha256);
@@ -401,8 +618,7 @@ QueryData genDeviceFile(QueryContext& context) {
       // If no inodes or paths were provided as constraints assume a walk of
       // the partition was requested.
       if (inodes.empty() && paths.empty()) {
-        dh.generateFiles(address, fs, "/", results);
-        dh.resetStack();
+        dh.generateFiles(address, fs, results);
       }
 
       // For each path the canonical name must be mapped to an inode address.
@@ -210,7 +210,7 @@ QueryData genRoutes(QueryContext &context) {
   // Need a map from index->name for each route entry.
   ifmap = genInterfaceMap();
   for (const auto &route_type : kRouteTypes) {
-    if (context.constraints["type"].notExistsOrMatches(route_type.second)) {
+    if (context.constraints["type"].admits(route_type.second)) {
       genRouteTableType(route_type, ifmap, results);
     }
   }
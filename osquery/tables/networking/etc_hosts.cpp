@@ -21,6 +21,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/file_cache.h"
 #include "osquery/filesystem/fileops.h"
 
 namespace fs = boost::filesystem;
@@ -61,12 +62,10 @@ QueryData parseEtcHostsContent(const std::string& content) {
 }
 
 QueryData genEtcHosts(QueryContext& context) {
-  std::string content;
-  if (readFile(kEtcHosts, content).ok()) {
-    return parseEtcHostsContent(content);
-  } else {
-    return {};
-  }
+  QueryData results;
+  ParsedFileCache::instance().read(
+      kEtcHosts.string(), parseEtcHostsContent, results);
+  return results;
 }
 }
 }
@@ -21,6 +21,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/file_cache.h"
 #include "osquery/filesystem/fileops.h"
 
 namespace fs = boost::filesystem;
@@ -77,14 +78,13 @@ QueryData parseEtcProtocolsContent(const std::string& content) {
 }
 
 QueryData genEtcProtocols(QueryContext& context) {
-  std::string content;
-  auto s = readFile(kEtcProtocols, content);
-  if (s.ok()) {
-    return parseEtcProtocolsContent(content);
-  } else {
+  QueryData results;
+  auto s = ParsedFileCache::instance().read(
+      kEtcProtocols.string(), parseEtcProtocolsContent, results);
+  if (!s.ok()) {
     TLOG << "Error reading " << kEtcProtocols << ": " << s.toString();
-    return {};
   }
+  return results;
 }
 }
 }
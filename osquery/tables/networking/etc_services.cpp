@@ -21,6 +21,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/file_cache.h"
 #include "osquery/filesystem/fileops.h"
 
 namespace fs = boost::filesystem;
@@ -87,14 +88,13 @@ QueryData parseEtcServicesContent(const std::string& content) {
 }
 
 QueryData genEtcServices(QueryContext& context) {
-  std::string content;
-  auto s = readFile(kEtcServices, content);
-  if (s.ok()) {
-    return parseEtcServicesContent(content);
-  } else {
+  QueryData results;
+  auto s = ParsedFileCache::instance().read(
+      kEtcServices.string(), parseEtcServicesContent, results);
+  if (!s.ok()) {
     TLOG << "Error reading " << kEtcServices << ": " << s.toString();
-    return {};
   }
+  return results;
 }
 }
 }
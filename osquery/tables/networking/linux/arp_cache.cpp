@@ -8,7 +8,12 @@
  *
  */
 
+#include <linux/neighbour.h>
+#include <sys/socket.h>
+
 #include <fstream>
+#include <iomanip>
+#include <sstream>
 
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/trim.hpp>
@@ -17,14 +22,85 @@
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
+#include "osquery/tables/networking/linux/netlink.h"
+
 namespace osquery {
 namespace tables {
 
 const std::string kLinuxArpTable = "/proc/net/arp";
 
+/// The neighbor hardware address, formatted as /proc/net/arp would.
+static std::string getNeighborMac(const struct rtattr* attr) {
+  if (attr == nullptr) {
+    return "00:00:00:00:00:00";
+  }
+
+  std::stringstream mac;
+  auto data = static_cast<const unsigned char*>(RTA_DATA(attr));
+  for (size_t i = 0; i < RTA_PAYLOAD(attr); ++i) {
+    if (i > 0) {
+      mac << ":";
+    }
+    mac << std::hex << std::setfill('0') << std::setw(2)
+        << static_cast<unsigned int>(data[i]);
+  }
+  return mac.str();
+}
+
+void genNetlinkNeighbor(const struct nlmsghdr* netlink_msg,
+                        const std::map<int, NetlinkLink>& links,
+                        QueryData& results) {
+  auto message = static_cast<struct ndmsg*>(NLMSG_DATA(netlink_msg));
+  if (netlink_msg->nlmsg_type != RTM_NEWNEIGH ||
+      message->ndm_family != AF_INET || (message->ndm_state & NUD_NOARP)) {
+    // The ARP table only lists resolved or resolving IPv4 neighbors.
+    return;
+  }
+
+  const struct rtattr* destination = nullptr;
+  const struct rtattr* lladdr = nullptr;
+  auto attr = static_cast<struct rtattr*>(RTM_RTA(message));
+  auto attr_size = RTM_PAYLOAD(netlink_msg);
+  for (; RTA_OK(attr, attr_size); attr = RTA_NEXT(attr, attr_size)) {
+    if (attr->rta_type == NDA_DST) {
+      destination = attr;
+    } else if (attr->rta_type == NDA_LLADDR) {
+      lladdr = attr;
+    }
+  }
+
+  if (destination == nullptr) {
+    return;
+  }
+
+  Row r;
+  r["address"] =
+      getNetlinkIP(message->ndm_family, (char*)RTA_DATA(destination));
+  r["mac"] = getNeighborMac(lladdr);
+  if (links.count(message->ndm_ifindex) > 0) {
+    r["interface"] = links.at(message->ndm_ifindex).name;
+  }
+  r["permanent"] = (message->ndm_state & NUD_PERMANENT) ? "1" : "0";
+  results.push_back(r);
+}
+
 QueryData genArpCache(QueryContext& context) {
   QueryData results;
 
+  // Read neighbors from the shared rtnetlink snapshot.
+  std::map<int, NetlinkLink> links;
+  if (getNetlinkLinks(links).ok()) {
+    auto status = NetlinkCache::instance().forEach(
+        NETLINK_NEIGHBORS,
+        ([&links, &results](const struct nlmsghdr* netlink_msg) {
+          genNetlinkNeighbor(netlink_msg, links, results);
+        }));
+    if (status.ok()) {
+      return results;
+    }
+    results.clear();
+  }
+
   boost::filesystem::path arp_path = kLinuxArpTable;
   if (!osquery::isReadable(arp_path).ok()) {
     VLOG(1) << "Cannot read arp table";
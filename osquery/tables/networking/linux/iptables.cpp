@@ -12,12 +12,16 @@
 
 #include <arpa/inet.h>
 #include <libiptc/libiptc.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/trim.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
@@ -32,6 +36,11 @@ static const std::string kHexMap = "0123456789ABCDEF";
 static const int kMaskHighBits = 4;
 static const int kMaskLowBits = 15;
 
+FLAG(uint64,
+     iptables_cache_ttl,
+     60,
+     "Seconds to reuse parsed iptables rules while a table is unchanged");
+
 void parseIpEntry(const ipt_ip *ip, Row &r) {
   r["protocol"] = INTEGER(ip->proto);
   if (strlen(ip->iniface)) {
@@ -71,7 +80,52 @@ void parseIpEntry(const ipt_ip *ip, Row &r) {
   r["outiface_mask"] = TEXT(outiface_mask);
 }
 
-void genIPTablesRules(const std::string &filter, QueryData &results) {
+/// Parsed rules of a filter and the kernel's description of the table.
+struct IPTablesCacheEntry {
+  struct ipt_getinfo info;
+  size_t time{0};
+  QueryData rows;
+};
+
+/// Parsed rules by filter name.
+static std::map<std::string, IPTablesCacheEntry> kIPTablesCache;
+static Mutex kIPTablesCacheMutex;
+
+/**
+ * @brief Read the size and hook offsets of a filter.
+ *
+ * This is a small fixed-size request, unlike reading the rules, which copies
+ * every entry from the kernel. A replaced ruleset almost always changes the
+ * number of entries, their size, or the hook offsets.
+ */
+static bool getIPTablesInfo(const std::string &filter,
+                            struct ipt_getinfo &info) {
+  int socket_fd = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW);
+  if (socket_fd < 0) {
+    return false;
+  }
+
+  memset(&info, 0, sizeof(info));
+  strncpy(info.name, filter.c_str(), sizeof(info.name) - 1);
+  socklen_t size = sizeof(info);
+  auto result =
+      getsockopt(socket_fd, IPPROTO_IP, IPT_SO_GET_INFO, &info, &size);
+  close(socket_fd);
+  return result == 0;
+}
+
+bool isSameIPTablesInfo(const struct ipt_getinfo &left,
+                        const struct ipt_getinfo &right) {
+  return left.valid_hooks == right.valid_hooks &&
+         left.num_entries == right.num_entries && left.size == right.size &&
+         memcmp(left.hook_entry, right.hook_entry, sizeof(left.hook_entry)) ==
+             0 &&
+         memcmp(left.underflow, right.underflow, sizeof(left.underflow)) == 0;
+}
+
+void genIPTablesRules(const std::string &filter,
+                      const QueryContext &context,
+                      QueryData &results) {
   Row r;
   r["filter_name"] = filter;
 
@@ -84,6 +138,9 @@ void genIPTablesRules(const std::string &filter, QueryData &results) {
   // Iterate through chains
   for (auto chain = iptc_first_chain(handle); chain != nullptr;
        chain = iptc_next_chain(handle)) {
+    if (!context.admits("chain", chain)) {
+      continue;
+    }
     r["chain"] = TEXT(chain);
 
     struct ipt_counters counters;
@@ -130,6 +187,51 @@ void genIPTablesRules(const std::string &filter, QueryData &results) {
   iptc_free(handle);
 }
 
+/// Generate the rules of a filter, reusing the rules parsed for a query.
+static void genCachedIPTablesRules(const std::string &filter,
+                                   QueryContext &context,
+                                   QueryData &results) {
+  // Counters change with every packet, only the rules themselves are cached.
+  struct ipt_getinfo info;
+  if (FLAGS_iptables_cache_ttl == 0 ||
+      context.isAnyColumnUsed({"packets", "bytes"}) ||
+      !getIPTablesInfo(filter, info)) {
+    genIPTablesRules(filter, context, results);
+    return;
+  }
+
+  auto now = getUnixTime();
+  {
+    ReadLock lock(kIPTablesCacheMutex);
+    auto entry = kIPTablesCache.find(filter);
+    if (entry != kIPTablesCache.end() &&
+        isSameIPTablesInfo(entry->second.info, info) &&
+        now < entry->second.time + FLAGS_iptables_cache_ttl) {
+      for (const auto &row : entry->second.rows) {
+        if (context.admits("chain", row.at("chain"))) {
+          results.push_back(row);
+        }
+      }
+      return;
+    }
+  }
+
+  // Parse every chain, later queries may select others.
+  QueryContext all;
+  IPTablesCacheEntry entry;
+  entry.info = info;
+  entry.time = now;
+  genIPTablesRules(filter, all, entry.rows);
+  for (const auto &row : entry.rows) {
+    if (context.admits("chain", row.at("chain"))) {
+      results.push_back(row);
+    }
+  }
+
+  WriteLock lock(kIPTablesCacheMutex);
+  kIPTablesCache[filter] = std::move(entry);
+}
+
 QueryData genIptables(QueryContext &context) {
   QueryData results;
 
@@ -139,8 +241,8 @@ QueryData genIptables(QueryContext &context) {
   if (s.ok()) {
     for (auto &line : split(content, "\n")) {
       boost::trim(line);
-      if (line.size() > 0) {
-        genIPTablesRules(line, results);
+      if (line.size() > 0 && context.admits("filter_name", line)) {
+        genCachedIPTablesRules(line, context, results);
       }
     }
   } else {
@@ -0,0 +1,293 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#include <linux/if_link.h>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/tables/networking/linux/netlink.h"
+
+namespace osquery {
+namespace tables {
+
+FLAG(uint64,
+     netlink_snapshot_ttl,
+     1,
+     "Seconds to reuse rtnetlink dumps between tables (0 always dumps)");
+
+/// The size of each read, a dump datagram is at most a page or two.
+#define NETLINK_READ_SIZE 32768
+
+/// The request type of each NetlinkDump.
+static const uint16_t kNetlinkDumpTypes[NETLINK_DUMP_COUNT] = {
+    RTM_GETLINK, RTM_GETROUTE, RTM_GETNEIGH,
+};
+
+/// A dump request, the payload is the family-specific header of the type.
+struct NetlinkRequest {
+  struct nlmsghdr header;
+  union {
+    struct ifinfomsg link;
+    struct rtmsg route;
+    struct ndmsg neighbor;
+  } payload;
+};
+
+static std::atomic<uint32_t> kNetlinkSequence{1};
+
+std::string getNetlinkIP(int family, const char* buffer) {
+  char dst[INET6_ADDRSTRLEN] = {0};
+
+  inet_ntop(family, buffer, dst, INET6_ADDRSTRLEN);
+  std::string address(dst);
+  boost::trim(address);
+
+  return address;
+}
+
+static size_t getNetlinkPayloadSize(uint16_t type) {
+  switch (type) {
+  case RTM_GETLINK:
+    return sizeof(struct ifinfomsg);
+  case RTM_GETNEIGH:
+    return sizeof(struct ndmsg);
+  default:
+    return sizeof(struct rtmsg);
+  }
+}
+
+Status dumpNetlink(uint16_t type, std::string& messages) {
+  int socket_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (socket_fd < 0) {
+    return Status(1, "Cannot open NETLINK socket");
+  }
+
+  // Prevent a missing response from hanging the table.
+  struct timeval timeout = {1, 0};
+  setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  NetlinkRequest request;
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_len = NLMSG_LENGTH(getNetlinkPayloadSize(type));
+  request.header.nlmsg_type = type;
+  request.header.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST;
+  request.header.nlmsg_seq = kNetlinkSequence++;
+
+  if (send(socket_fd, &request, request.header.nlmsg_len, 0) < 0) {
+    close(socket_fd);
+    return Status(1, "Cannot write NETLINK request header to socket");
+  }
+
+  // A dump is answered by as many datagrams as needed, ending in NLMSG_DONE.
+  messages.clear();
+  std::string buffer(NETLINK_READ_SIZE, '\0');
+  while (true) {
+    auto bytes = recv(socket_fd, &buffer[0], buffer.size(), 0);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (bytes <= 0) {
+      close(socket_fd);
+      return Status(1, "Could not read from NETLINK");
+    }
+
+    auto size = static_cast<size_t>(bytes);
+    auto header = reinterpret_cast<struct nlmsghdr*>(&buffer[0]);
+    for (; NLMSG_OK(header, size); header = NLMSG_NEXT(header, size)) {
+      if (header->nlmsg_seq != request.header.nlmsg_seq) {
+        continue;
+      }
+
+      if (header->nlmsg_type == NLMSG_DONE) {
+        close(socket_fd);
+        return Status(0, "OK");
+      }
+
+      if (header->nlmsg_type == NLMSG_ERROR) {
+        close(socket_fd);
+        return Status(1, "Read invalid NETLINK message");
+      }
+
+      messages.append(reinterpret_cast<const char*>(header),
+                      NLMSG_ALIGN(header->nlmsg_len));
+    }
+  }
+}
+
+NetlinkCache& NetlinkCache::instance() {
+  static NetlinkCache cache;
+  return cache;
+}
+
+NetlinkCache::~NetlinkCache() {
+  if (notify_fd_ >= 0) {
+    close(notify_fd_);
+  }
+}
+
+void NetlinkCache::subscribe() {
+  subscribed_ = true;
+  int socket_fd = socket(PF_NETLINK,
+                         SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                         NETLINK_ROUTE);
+  if (socket_fd < 0) {
+    return;
+  }
+
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  address.nl_groups =
+      RTMGRP_LINK | RTMGRP_NEIGH | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+  if (bind(socket_fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+    VLOG(1) << "Cannot subscribe to NETLINK route changes";
+    close(socket_fd);
+    return;
+  }
+  notify_fd_ = socket_fd;
+}
+
+void NetlinkCache::readNotifications() {
+  if (notify_fd_ < 0) {
+    return;
+  }
+
+  std::string buffer(NETLINK_READ_SIZE, '\0');
+  while (true) {
+    auto bytes = recv(notify_fd_, &buffer[0], buffer.size(), 0);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (bytes < 0) {
+      if (errno == ENOBUFS) {
+        // Notifications were dropped, none of the snapshots can be trusted.
+        for (auto& snapshot : snapshots_) {
+          snapshot.messages = nullptr;
+        }
+        continue;
+      }
+      // No more pending notifications.
+      return;
+    }
+
+    auto size = static_cast<size_t>(bytes);
+    auto header = reinterpret_cast<struct nlmsghdr*>(&buffer[0]);
+    for (; NLMSG_OK(header, size); header = NLMSG_NEXT(header, size)) {
+      switch (header->nlmsg_type) {
+      case RTM_NEWLINK:
+      case RTM_DELLINK:
+        snapshots_[NETLINK_LINKS].messages = nullptr;
+        // Routes through a removed link are removed without notifications.
+        snapshots_[NETLINK_ROUTES].messages = nullptr;
+        break;
+      case RTM_NEWROUTE:
+      case RTM_DELROUTE:
+        snapshots_[NETLINK_ROUTES].messages = nullptr;
+        break;
+      case RTM_NEWNEIGH:
+      case RTM_DELNEIGH:
+        snapshots_[NETLINK_NEIGHBORS].messages = nullptr;
+        break;
+      }
+    }
+  }
+}
+
+Status NetlinkCache::forEach(NetlinkDump dump,
+                             const NetlinkPredicate& predicate) {
+  std::shared_ptr<const std::string> messages;
+  if (FLAGS_netlink_snapshot_ttl > 0) {
+    WriteLock lock(mutex_);
+    if (!subscribed_) {
+      // Subscribe before the first dump, so no change is missed.
+      subscribe();
+    }
+    readNotifications();
+
+    auto& snapshot = snapshots_[dump];
+    auto now = getUnixTime();
+    bool expired = (notify_fd_ < 0 || dump == NETLINK_LINKS) &&
+                   now >= snapshot.time + FLAGS_netlink_snapshot_ttl;
+    if (snapshot.messages == nullptr || expired) {
+      auto content = std::make_shared<std::string>();
+      auto status = dumpNetlink(kNetlinkDumpTypes[dump], *content);
+      if (!status.ok()) {
+        return status;
+      }
+      snapshot.messages = content;
+      snapshot.time = now;
+    }
+    messages = snapshot.messages;
+  } else {
+    auto content = std::make_shared<std::string>();
+    auto status = dumpNetlink(kNetlinkDumpTypes[dump], *content);
+    if (!status.ok()) {
+      return status;
+    }
+    messages = content;
+  }
+
+  // The snapshot is immutable, read it without holding the lock.
+  size_t size = messages->size();
+  auto header = reinterpret_cast<const struct nlmsghdr*>(messages->data());
+  for (; NLMSG_OK(header, size); header = NLMSG_NEXT(header, size)) {
+    predicate(header);
+  }
+  return Status(0, "OK");
+}
+
+Status getNetlinkLinks(std::map<int, NetlinkLink>& links) {
+  return NetlinkCache::instance().forEach(
+      NETLINK_LINKS, ([&links](const struct nlmsghdr* netlink_msg) {
+        if (netlink_msg->nlmsg_type != RTM_NEWLINK) {
+          return;
+        }
+
+        auto message = static_cast<struct ifinfomsg*>(NLMSG_DATA(netlink_msg));
+        auto attr = IFLA_RTA(message);
+        auto attr_size = IFLA_PAYLOAD(netlink_msg);
+
+        NetlinkLink link;
+        link.type = message->ifi_type;
+        for (; RTA_OK(attr, attr_size); attr = RTA_NEXT(attr, attr_size)) {
+          if (attr->rta_type == IFLA_IFNAME) {
+            auto name = static_cast<const char*>(RTA_DATA(attr));
+            link.name.assign(name, strnlen(name, RTA_PAYLOAD(attr)));
+          } else if (attr->rta_type == IFLA_MTU) {
+            link.mtu = *static_cast<uint32_t*>(RTA_DATA(attr));
+          }
+        }
+        links[message->ifi_index] = std::move(link);
+      }));
+}
+
+void NetlinkCache::clear() {
+  WriteLock lock(mutex_);
+  for (auto& snapshot : snapshots_) {
+    snapshot.messages = nullptr;
+  }
+}
+}
+}
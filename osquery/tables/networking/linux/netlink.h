@@ -0,0 +1,130 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <array>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/status.h>
+
+namespace osquery {
+namespace tables {
+
+/// The rtnetlink dumps shared by the networking tables.
+enum NetlinkDump {
+  NETLINK_LINKS = 0,
+  NETLINK_ROUTES,
+  NETLINK_NEIGHBORS,
+  NETLINK_DUMP_COUNT,
+};
+
+/// Called for each message of a dump.
+using NetlinkPredicate = std::function<void(const struct nlmsghdr*)>;
+
+/**
+ * @brief A snapshot of the kernel's rtnetlink state.
+ *
+ * The routes, arp_cache and interface_details tables each previously opened a
+ * socket and dumped their state per query. The dumps are now shared, and
+ * reused for up to --netlink_snapshot_ttl seconds, so tables joined in a query
+ * or scheduled in the same tick read the state once.
+ *
+ * Route, neighbor and link changes are multicast to a subscribed socket as
+ * RTMGRP_* notifications. A snapshot of routes or neighbors is reused until
+ * a notification for that dump arrives, rather than expiring. Links include
+ * counters that change without notifications and always expire.
+ */
+class NetlinkCache : private boost::noncopyable {
+ public:
+  /// The process-wide snapshot.
+  static NetlinkCache& instance();
+
+  /**
+   * @brief Call a predicate for each message of a dump.
+   *
+   * @param dump The rtnetlink state to read.
+   * @param predicate Called for each message, in the kernel's order.
+   * @return Failure if the dump could not be read.
+   */
+  Status forEach(NetlinkDump dump, const NetlinkPredicate& predicate);
+
+  /// Drop every snapshot.
+  void clear();
+
+ private:
+  NetlinkCache() = default;
+  ~NetlinkCache();
+
+  /// Subscribe to change notifications, once.
+  void subscribe();
+
+  /// Drain pending notifications, expiring the dumps they change.
+  void readNotifications();
+
+ private:
+  /// Messages of a dump and when they were read.
+  struct Snapshot {
+    std::shared_ptr<const std::string> messages{nullptr};
+    size_t time{0};
+  };
+
+  /// Snapshots indexed by NetlinkDump.
+  std::array<Snapshot, NETLINK_DUMP_COUNT> snapshots_;
+
+  /// A non-blocking socket subscribed to RTMGRP_* notifications, or -1.
+  int notify_fd_{-1};
+
+  /// Set true after the first subscription attempt.
+  bool subscribed_{false};
+
+  /// Protect the snapshots and the notification socket.
+  Mutex mutex_;
+};
+
+/**
+ * @brief Read a complete rtnetlink dump.
+ *
+ * The response is read until NLMSG_DONE, however many datagrams it spans.
+ *
+ * @param type The request type, such as RTM_GETROUTE.
+ * @param messages The output concatenated messages, excluding NLMSG_DONE.
+ * @return Failure if the socket could not be used or the kernel failed.
+ */
+Status dumpNetlink(uint16_t type, std::string& messages);
+
+/// The properties of a link used by the networking tables.
+struct NetlinkLink {
+  std::string name;
+  uint32_t mtu{0};
+  uint16_t type{0};
+};
+
+/**
+ * @brief Read the links from the shared snapshot, keyed by interface index.
+ *
+ * Tables resolve the interface of a route or neighbor from its index, this
+ * replaces an if_indextoname ioctl for each row.
+ */
+Status getNetlinkLinks(std::map<int, NetlinkLink>& links);
+
+/// Format an address attribute of a family.
+std::string getNetlinkIP(int family, const char* buffer);
+}
+}
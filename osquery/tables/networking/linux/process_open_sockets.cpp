@@ -8,13 +8,25 @@
  *
  */
 
+#include <algorithm>
+
 #include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/linux/proc.h"
+#include "osquery/tables/networking/linux/inet_diag.h"
+
+#ifndef SOCK_DIAG_BY_FAMILY
+#define SOCK_DIAG_BY_FAMILY 20
+#endif
 
 namespace osquery {
 namespace tables {
@@ -31,6 +43,13 @@ const std::map<int, std::string> kLinuxProtocolNames = {
 // A map of socket handles (inodes) to their pid and file descriptor.
 typedef std::map<std::string, std::pair<std::string, std::string> > InodeMap;
 
+// Every socket state, the sock_diag filter used unless only binds are read.
+const uint32_t kAllSocketStates = ~0U;
+
+// The states of sockets without a remote address: TCP listeners and
+// unconnected (closed) sockets such as a bound UDP socket.
+const uint32_t kBoundSocketStates = (1U << TCP_LISTEN) | (1U << TCP_CLOSE);
+
 std::string addressFromHex(const std::string &encoded_address, int family) {
   char addr_buffer[INET6_ADDRSTRLEN] = {0};
   if (family == AF_INET) {
@@ -63,6 +82,16 @@ unsigned short portFromHex(const std::string &encoded_port) {
   return decoded;
 }
 
+void setSocketProcess(const InodeMap &inodes, Row &r) {
+  if (inodes.count(r["socket"]) > 0) {
+    r["pid"] = inodes.at(r["socket"]).second;
+    r["fd"] = inodes.at(r["socket"]).first;
+  } else {
+    r["pid"] = "-1";
+    r["fd"] = "-1";
+  }
+}
+
 void genSocketsFromProc(const InodeMap &inodes,
                         int protocol,
                         int family,
@@ -133,53 +162,196 @@ void genSocketsFromProc(const InodeMap &inodes,
       r["path"] = "";
     }
 
-    if (inodes.count(r["socket"]) > 0) {
-      r["pid"] = inodes.at(r["socket"]).second;
-      r["fd"] = inodes.at(r["socket"]).first;
-    } else {
-      r["pid"] = "-1";
-      r["fd"] = "-1";
+    setSocketProcess(inodes, r);
+    results.push_back(r);
+  }
+}
+
+/**
+ * @brief Dump the sockets of a protocol and family using sock_diag.
+ *
+ * The kernel encodes each socket as a binary message, which avoids formatting
+ * and parsing the /proc/net text tables, and skips sockets not in one of the
+ * requested states.
+ *
+ * @return failure if the kernel does not support dumping the protocol, no
+ *   rows are added in that case.
+ */
+Status genSocketsFromNetlink(const InodeMap &inodes,
+                             int protocol,
+                             int family,
+                             uint32_t states,
+                             QueryData &results) {
+  auto fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+  if (fd < 0) {
+    return Status(1, "Cannot open sock_diag socket");
+  }
+
+  struct {
+    struct nlmsghdr nlh;
+    struct inet_diag_req_v2 req;
+  } request;
+  memset(&request, 0, sizeof(request));
+  request.nlh.nlmsg_len = sizeof(request);
+  request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  request.req.sdiag_family = family;
+  request.req.sdiag_protocol = protocol;
+  request.req.idiag_states = states;
+
+  struct sockaddr_nl kernel;
+  memset(&kernel, 0, sizeof(kernel));
+  kernel.nl_family = AF_NETLINK;
+  if (sendto(fd,
+             &request,
+             sizeof(request),
+             0,
+             (struct sockaddr *)&kernel,
+             sizeof(kernel)) < 0) {
+    close(fd);
+    return Status(1, "Cannot request sockets from sock_diag");
+  }
+
+  // Rows are added once the dump completes, a failure falls back to /proc.
+  QueryData rows;
+  Status status(1, "Incomplete sock_diag dump");
+  alignas(struct nlmsghdr) char buffer[32768];
+  bool done = false;
+  while (!done) {
+    auto size = recv(fd, buffer, sizeof(buffer), 0);
+    if (size <= 0) {
+      break;
     }
 
-    results.push_back(r);
+    auto length = static_cast<unsigned int>(size);
+    auto nlh = (struct nlmsghdr *)buffer;
+    for (; NLMSG_OK(nlh, length); nlh = NLMSG_NEXT(nlh, length)) {
+      if (nlh->nlmsg_type == NLMSG_DONE) {
+        // A dump error, such as an unsupported protocol, ends the dump.
+        auto error = (nlh->nlmsg_len >= NLMSG_LENGTH(sizeof(int)))
+                         ? *(int *)NLMSG_DATA(nlh)
+                         : 0;
+        if (error == 0) {
+          status = Status(0, "OK");
+        } else {
+          status = Status(1, "Protocol not supported by sock_diag");
+        }
+        done = true;
+        break;
+      } else if (nlh->nlmsg_type == NLMSG_ERROR) {
+        status = Status(1, "Protocol not supported by sock_diag");
+        done = true;
+        break;
+      } else if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY ||
+                 nlh->nlmsg_len < NLMSG_LENGTH(sizeof(inet_diag_msg))) {
+        continue;
+      }
+
+      auto msg = (struct inet_diag_msg *)NLMSG_DATA(nlh);
+      char local[INET6_ADDRSTRLEN] = {0};
+      char remote[INET6_ADDRSTRLEN] = {0};
+      inet_ntop(family, msg->id.idiag_src, local, sizeof(local));
+      inet_ntop(family, msg->id.idiag_dst, remote, sizeof(remote));
+
+      Row r;
+      r["socket"] = BIGINT(msg->idiag_inode);
+      r["family"] = INTEGER(family);
+      r["protocol"] = INTEGER(protocol);
+      r["local_address"] = local;
+      r["local_port"] = INTEGER(ntohs(msg->id.idiag_sport));
+      r["remote_address"] = remote;
+      r["remote_port"] = INTEGER(ntohs(msg->id.idiag_dport));
+      r["path"] = "";
+      setSocketProcess(inodes, r);
+      rows.push_back(std::move(r));
+    }
+  }
+  close(fd);
+
+  if (status.ok()) {
+    results.insert(results.end(),
+                   std::make_move_iterator(rows.begin()),
+                   std::make_move_iterator(rows.end()));
   }
+  return status;
 }
 
 QueryData genOpenSockets(QueryContext &context) {
   QueryData results;
 
+  auto proc = ProcSnapshot::get(context);
+
   // If a pid is given then set that as the only item in processes.
   std::set<std::string> pids;
   if (context.constraints["pid"].exists(EQUALS)) {
     pids = context.constraints["pid"].getAll(EQUALS);
   } else {
-    osquery::procProcesses(pids);
+    proc->processes(pids);
   }
 
   // Generate a map of socket inode to process tid.
+  // The descriptors of every process are only walked if the query reads the
+  // owning process of each socket.
+  // If sockets without an owner (pid -1) are filtered, so are the sockets of
+  // the processes the pid constraints do not admit.
+  bool owned = !context.admits("pid", "-1");
   InodeMap socket_inodes;
-  for (const auto &process : pids) {
-    std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
-      for (const auto &fd : descriptors) {
-        if (fd.second.find("socket:[") == 0) {
-          // See #792: std::regex is incomplete until GCC 4.9 (skip 8 chars)
-          auto inode = fd.second.substr(8);
-          socket_inodes[inode.substr(0, inode.size() - 1)] =
-              std::make_pair(fd.first, process);
+  if (context.isAnyColumnUsed({"pid", "fd"})) {
+    for (const auto &process : pids) {
+      if (owned && !context.admits("pid", process)) {
+        continue;
+      }
+      std::map<std::string, std::string> descriptors;
+      if (proc->descriptors(process, descriptors).ok()) {
+        for (const auto &fd : descriptors) {
+          if (fd.second.find("socket:[") == 0) {
+            // See #792: std::regex is incomplete until GCC 4.9 (skip 8 chars)
+            auto inode = fd.second.substr(8);
+            socket_inodes[inode.substr(0, inode.size() - 1)] =
+                std::make_pair(fd.first, process);
+          }
         }
       }
     }
   }
 
-  // This used to use netlink (Ref: #1094) to request socket information.
-  // Use proc messages to query socket information.
+  // A remote_port = 0 constraint, such as from listening_ports, only needs
+  // sockets without a peer, so the kernel may skip connected sockets.
+  auto states = kAllSocketStates;
+  if (context.constraints["remote_port"].exists(EQUALS)) {
+    auto ports = context.constraints["remote_port"].getAll(EQUALS);
+    if (ports.size() == 1 && *ports.begin() == "0") {
+      states = kBoundSocketStates;
+    }
+  }
+
+  // Request socket information using sock_diag (Ref: #1094) and use the
+  // proc text tables for protocols the kernel cannot dump.
   for (const auto &protocol : kLinuxProtocolNames) {
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET, results);
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET6, results);
+    if (!context.admits("protocol", std::to_string(protocol.first))) {
+      continue;
+    }
+    for (const auto &family : {AF_INET, AF_INET6}) {
+      if (!context.admits("family", std::to_string(family))) {
+        continue;
+      }
+      if (!genSocketsFromNetlink(
+               socket_inodes, protocol.first, family, states, results)
+               .ok()) {
+        genSocketsFromProc(socket_inodes, protocol.first, family, results);
+      }
+    }
   }
 
-  genSocketsFromProc(socket_inodes, IPPROTO_IP, AF_UNIX, results);
+  if (context.admits("family", "0")) {
+    genSocketsFromProc(socket_inodes, IPPROTO_IP, AF_UNIX, results);
+  }
+
+  if (owned) {
+    auto unowned = [](const Row &r) { return r.at("pid") == "-1"; };
+    results.erase(std::remove_if(results.begin(), results.end(), unowned),
+                  results.end());
+  }
   return results;
 }
 }
@@ -21,6 +21,8 @@ namespace osquery {
 namespace tables {
 
 void parseIpEntry(const ipt_ip *ip, Row &row);
+bool isSameIPTablesInfo(const struct ipt_getinfo &left,
+                        const struct ipt_getinfo &right);
 
 ipt_ip* getIpEntryContent() {
   static ipt_ip ip_entry;
@@ -62,5 +64,25 @@ TEST_F(IptablesTests, test_iptables_ip_entry) {
   parseIpEntry(getIpEntryContent(), row);
   EXPECT_EQ(row, getIpEntryExpectedResults());
 }
+TEST_F(IptablesTests, test_iptables_info_changes) {
+  struct ipt_getinfo info;
+  memset(&info, 0, sizeof(info));
+  strcpy(info.name, "filter");
+  info.valid_hooks = 0x0e;
+  info.num_entries = 4;
+  info.size = 656;
+
+  auto same = info;
+  EXPECT_TRUE(isSameIPTablesInfo(info, same));
+
+  // Replacing a ruleset moves the hooks or changes the number of entries.
+  auto changed = info;
+  changed.num_entries = 5;
+  EXPECT_FALSE(isSameIPTablesInfo(info, changed));
+
+  changed = info;
+  changed.hook_entry[NF_IP_FORWARD] = 200;
+  EXPECT_FALSE(isSameIPTablesInfo(info, changed));
+}
 }
 }
@@ -0,0 +1,74 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/tables/networking/linux/netlink.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+namespace tables {
+
+DECLARE_uint64(netlink_snapshot_ttl);
+
+class NetlinkTests : public testing::Test {
+ protected:
+  void TearDown() override {
+    NetlinkCache::instance().clear();
+  }
+};
+
+TEST_F(NetlinkTests, test_dump_links) {
+  std::string messages;
+  ASSERT_TRUE(dumpNetlink(RTM_GETLINK, messages).ok());
+  EXPECT_FALSE(messages.empty());
+
+  // Every host has a loopback link.
+  std::map<int, NetlinkLink> links;
+  ASSERT_TRUE(getNetlinkLinks(links).ok());
+  bool loopback = false;
+  for (const auto& link : links) {
+    if (link.second.name == "lo") {
+      loopback = true;
+      EXPECT_GT(link.second.mtu, 0U);
+    }
+  }
+  EXPECT_TRUE(loopback);
+}
+
+TEST_F(NetlinkTests, test_snapshot_routes) {
+  auto ttl = FLAGS_netlink_snapshot_ttl;
+  FLAGS_netlink_snapshot_ttl = 60;
+
+  // Routes without changes are reused from the snapshot.
+  size_t first = 0;
+  auto status = NetlinkCache::instance().forEach(
+      NETLINK_ROUTES, ([&first](const struct nlmsghdr* msg) { first++; }));
+  ASSERT_TRUE(status.ok());
+
+  size_t count = 0;
+  status = NetlinkCache::instance().forEach(
+      NETLINK_ROUTES, ([&count](const struct nlmsghdr* msg) { count++; }));
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(first, count);
+
+  // Without a TTL each query dumps the routes.
+  FLAGS_netlink_snapshot_ttl = 0;
+  count = 0;
+  status = NetlinkCache::instance().forEach(
+      NETLINK_ROUTES, ([&count](const struct nlmsghdr* msg) { count++; }));
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(first, count);
+  FLAGS_netlink_snapshot_ttl = ttl;
+}
+}
+}
@@ -0,0 +1,98 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/tables.h>
+
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+namespace tables {
+
+typedef std::map<std::string, std::pair<std::string, std::string> > InodeMap;
+
+Status genSocketsFromNetlink(const InodeMap &inodes,
+                             int protocol,
+                             int family,
+                             uint32_t states,
+                             QueryData &results);
+void genSocketsFromProc(const InodeMap &inodes,
+                        int protocol,
+                        int family,
+                        QueryData &results);
+
+class ProcessOpenSocketsTests : public testing::Test {};
+
+static const Row *findSocket(const QueryData &rows, const std::string &inode) {
+  for (const auto &row : rows) {
+    if (row.at("socket") == inode) {
+      return &row;
+    }
+  }
+  return nullptr;
+}
+
+TEST_F(ProcessOpenSocketsTests, test_netlink_matches_proc) {
+  // Bind a listening socket to an ephemeral loopback port.
+  auto fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(fd, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(bind(fd, (struct sockaddr *)&address, sizeof(address)), 0);
+  ASSERT_EQ(listen(fd, 1), 0);
+
+  struct stat st;
+  ASSERT_EQ(fstat(fd, &st), 0);
+  auto inode = std::to_string(st.st_ino);
+  socklen_t length = sizeof(address);
+  getsockname(fd, (struct sockaddr *)&address, &length);
+  auto port = std::to_string(ntohs(address.sin_port));
+
+  InodeMap inodes = {{inode, std::make_pair("3", "1")}};
+  QueryData netlink;
+  auto status = genSocketsFromNetlink(
+      inodes, IPPROTO_TCP, AF_INET, (1U << TCP_LISTEN), netlink);
+  if (!status.ok()) {
+    // The kernel may not include sock_diag support.
+    close(fd);
+    return;
+  }
+
+  QueryData proc;
+  genSocketsFromProc(inodes, IPPROTO_TCP, AF_INET, proc);
+  close(fd);
+
+  auto netlink_row = findSocket(netlink, inode);
+  auto proc_row = findSocket(proc, inode);
+  ASSERT_NE(netlink_row, nullptr);
+  ASSERT_NE(proc_row, nullptr);
+  EXPECT_EQ(*netlink_row, *proc_row);
+  EXPECT_EQ(netlink_row->at("local_address"), "127.0.0.1");
+  EXPECT_EQ(netlink_row->at("local_port"), port);
+  EXPECT_EQ(netlink_row->at("pid"), "1");
+
+  // Only the requested states are dumped.
+  QueryData established;
+  genSocketsFromNetlink(
+      inodes, IPPROTO_TCP, AF_INET, (1U << TCP_ESTABLISHED), established);
+  EXPECT_EQ(findSocket(established, inode), nullptr);
+}
+}
+}
@@ -20,7 +20,10 @@ typedef std::map<std::string, std::vector<ProtoFamilyPair>> PortMap;
 QueryData genListeningPorts(QueryContext& context) {
   QueryData results;
 
-  auto sockets = SQL::selectAllFrom("process_open_sockets");
+  // Only sockets without a remote port are binds, platforms may use the
+  // constraint to skip connected sockets.
+  auto sockets =
+      SQL::selectAllFrom("process_open_sockets", "remote_port", EQUALS, "0");
 
   PortMap ports;
   for (const auto& socket : sockets) {
@@ -18,7 +18,6 @@
 
 #ifdef __linux__
 #include <linux/if_link.h>
-#include <sys/ioctl.h>
 #endif
 
 #include <osquery/core.h>
@@ -27,6 +26,10 @@
 
 #include "osquery/tables/networking/utils.h"
 
+#ifdef __linux__
+#include "osquery/tables/networking/linux/netlink.h"
+#endif
+
 namespace osquery {
 namespace tables {
 
@@ -66,7 +69,9 @@ void genAddressesFromAddr(const struct ifaddrs* addr, QueryData& results) {
   results.push_back(r);
 }
 
-void genDetailsFromAddr(const struct ifaddrs* addr, QueryData& results) {
+void genDetailsFromAddr(const struct ifaddrs* addr,
+                        const std::map<std::string, Row>& links,
+                        QueryData& results) {
   Row r;
   if (addr->ifa_name != nullptr) {
     r["interface"] = std::string(addr->ifa_name);
@@ -90,24 +95,12 @@ void genDetailsFromAddr(const struct ifaddrs* addr, QueryData& results) {
     r["oerrors"] = BIGINT_FROM_UINT32(ifd->tx_errors);
     r["idrops"] = BIGINT_FROM_UINT32(ifd->rx_dropped);
     r["odrops"] = BIGINT_FROM_UINT32(ifd->tx_dropped);
-    // Get Linux physical properties for the AF_PACKET entry.
-    int fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd >= 0) {
-      struct ifreq ifr;
-      memcpy(ifr.ifr_name, addr->ifa_name, IFNAMSIZ);
-      if (ioctl(fd, SIOCGIFMTU, &ifr) >= 0) {
-        r["mtu"] = BIGINT_FROM_UINT32(ifr.ifr_mtu);
-      }
-
-      if (ioctl(fd, SIOCGIFMETRIC, &ifr) >= 0) {
-        r["metric"] = BIGINT_FROM_UINT32(ifr.ifr_metric);
-      }
-
-      if (ioctl(fd, SIOCGIFHWADDR, &ifr) >= 0) {
-        r["type"] = INTEGER_FROM_UCHAR(ifr.ifr_hwaddr.sa_family);
+    // Get Linux physical properties from the shared rtnetlink snapshot.
+    auto link = links.find(addr->ifa_name);
+    if (link != links.end()) {
+      for (const auto& column : link->second) {
+        r[column.first] = column.second;
       }
-
-      close(fd);
     }
 
     // Last change is not implemented in Linux.
@@ -159,6 +152,17 @@ QueryData genInterfaceAddresses(QueryContext& context) {
 QueryData genInterfaceDetails(QueryContext& context) {
   QueryData results;
 
+  // Linux link properties by interface name, metrics are always 0.
+  std::map<std::string, Row> links;
+#ifdef __linux__
+  std::map<int, NetlinkLink> netlink_links;
+  getNetlinkLinks(netlink_links);
+  for (const auto& link : netlink_links) {
+    links[link.second.name] = {{"mtu", BIGINT_FROM_UINT32(link.second.mtu)},
+                               {"type", INTEGER(link.second.type)}};
+  }
+#endif
+
   struct ifaddrs* if_addrs = nullptr;
   struct ifaddrs* if_addr = nullptr;
   if (getifaddrs(&if_addrs) != 0 || if_addrs == nullptr) {
@@ -172,7 +176,7 @@ QueryData genInterfaceDetails(QueryContext& context) {
       continue;
     }
 
-    genDetailsFromAddr(if_addr, results);
+    genDetailsFromAddr(if_addr, links, results);
   }
 
   freeifaddrs(if_addrs);
@@ -8,12 +8,22 @@
  *
  */
 
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include <osquery/dispatcher.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
@@ -365,29 +375,32 @@ Row& LLDPNeighbor::getNeighbor() {
   return row_;
 }
 
-QueryData genLLDPNeighbors(QueryContext& context) {
-  QueryData rows;
+/// A connection with its deleter, lldpctl_release.
+using LLDPConnection =
+    std::unique_ptr<lldpctl_conn_t, std::function<void(lldpctl_conn_t*)>>;
 
-  auto delConn = [](lldpctl_conn_t* c) { lldpctl_release(c); };
-  std::unique_ptr<lldpctl_conn_t, decltype(delConn)> conn(
-      lldpctl_new(nullptr, nullptr, nullptr), delConn);
+static LLDPConnection newLLDPConnection(lldpctl_send_callback send,
+                                        lldpctl_recv_callback recv,
+                                        void* user_data) {
+  return LLDPConnection(lldpctl_new(send, recv, user_data),
+                        [](lldpctl_conn_t* c) { lldpctl_release(c); });
+}
 
-  lldpctl_error_t err = lldpctl_last_error(conn.get());
-  if (err != LLDPCTL_NO_ERROR) {
-    LOG(ERROR) << "could not initiate new lldpd connection: "
-               << lldpctl_strerror(err);
-    return rows;
-  }
+/// Neighbors are identified by their interface, chassis, and port.
+static std::string getLLDPNeighborKey(const std::string& interface,
+                                      const Row& row) {
+  return interface + "\n" + row.at("chassis_id") + "\n" + row.at("port_id");
+}
 
+/// Read every neighbor of every interface.
+static Status genLLDPNeighborRows(lldpctl_conn_t* conn,
+                                  std::map<std::string, Row>& neighbors) {
   std::unique_ptr<lldpctl_atom_t, decltype(delLLDPAtom)> interfaces(
-      lldpctl_get_interfaces(conn.get()), delLLDPAtom);
+      lldpctl_get_interfaces(conn), delLLDPAtom);
 
-  err = lldpctl_last_error(conn.get());
+  lldpctl_error_t err = lldpctl_last_error(conn);
   if (err != LLDPCTL_NO_ERROR) {
-    LOG(WARNING) << "could not connect to lldpd (hint: you might need to "
-                    "install lldpd v0.9.X or run in sudo): "
-                 << lldpctl_strerror(err);
-    return rows;
+    return Status(1, lldpctl_strerror(err));
   }
 
   lldpctl_atom_t* interface = nullptr;
@@ -396,21 +409,285 @@ QueryData genLLDPNeighbors(QueryContext& context) {
 
     std::unique_ptr<lldpctl_atom_t, decltype(delLLDPAtom)> port(
         lldpctl_get_port(interface), delLLDPAtom);
-    std::unique_ptr<lldpctl_atom_t, decltype(delLLDPAtom)> neighbors(
+    std::unique_ptr<lldpctl_atom_t, decltype(delLLDPAtom)> neighbors_atom(
         lldpctl_atom_get(port.get(), lldpctl_k_port_neighbors), delLLDPAtom);
 
     lldpctl_atom_t* neighbor = nullptr;
-    lldpctl_atom_foreach(neighbors.get(), neighbor) {
+    lldpctl_atom_foreach(neighbors_atom.get(), neighbor) {
       std::unique_ptr<lldpctl_atom_t, decltype(delLLDPAtom)> chassis(
           lldpctl_atom_get(neighbor, lldpctl_k_port_chassis), delLLDPAtom);
 
       LLDPNeighbor n(neighbor, chassis.get());
       Row& row = n.getNeighbor();
       row["interface"] = ifaceName;
-      rows.push_back(row);
+      neighbors[getLLDPNeighborKey(ifaceName, row)] = row;
+    }
+  }
+  return Status(0, "OK");
+}
+
+FLAG(bool,
+     lldp_neighbors_watch,
+     true,
+     "Maintain lldp_neighbors from lldpd change notifications");
+
+/**
+ * @brief Neighbors maintained by lldpd change notifications.
+ *
+ * The watcher owns an asynchronous lldpctl connection on its own socket, so
+ * it can wait for notifications with a timeout and stop when interrupted.
+ * After subscribing it reads every neighbor once, then applies each added,
+ * updated, or deleted neighbor to the cache.
+ */
+class LLDPNeighborWatcher : public InternalRunnable {
+ public:
+  /// Start the watcher once, true if the cache has every neighbor.
+  static bool ready();
+
+  /// Copy the cached neighbors.
+  static void getNeighbors(QueryData& rows);
+
+ protected:
+  void start() override;
+
+ private:
+  /// Watch until the connection fails or the thread is interrupted.
+  void watch();
+
+  /// Write a request to the socket.
+  static ssize_t send(lldpctl_conn_t* conn,
+                      const uint8_t* data,
+                      size_t length,
+                      void* user_data);
+
+  /// Replies are pushed with lldpctl_recv, as they are read.
+  static ssize_t recv(lldpctl_conn_t* conn,
+                      const uint8_t* data,
+                      size_t length,
+                      void* user_data);
+
+  /// Wait for and push the next data read from the socket.
+  bool receive();
+
+  /// Apply a neighbor change to the cache.
+  static void changed(lldpctl_conn_t* conn,
+                      lldpctl_change_t type,
+                      lldpctl_atom_t* interface,
+                      lldpctl_atom_t* neighbor,
+                      void* data);
+
+ private:
+  /// The socket connected to lldpd.
+  int fd_{-1};
+
+  /// The asynchronous connection using fd_.
+  lldpctl_conn_t* conn_{nullptr};
+
+ private:
+  /// Neighbors by getLLDPNeighborKey.
+  static std::map<std::string, Row> neighbors_;
+
+  /// Set when the neighbors were read after subscribing.
+  static bool ready_;
+
+  /// Set when the watcher service was added.
+  static bool started_;
+
+  /// Protect the neighbors and watcher state.
+  static Mutex mutex_;
+};
+
+std::map<std::string, Row> LLDPNeighborWatcher::neighbors_;
+bool LLDPNeighborWatcher::ready_{false};
+bool LLDPNeighborWatcher::started_{false};
+Mutex LLDPNeighborWatcher::mutex_;
+
+bool LLDPNeighborWatcher::ready() {
+  {
+    ReadLock lock(mutex_);
+    if (started_) {
+      return ready_;
     }
   }
 
+  WriteLock lock(mutex_);
+  if (!started_) {
+    started_ = true;
+    Dispatcher::addService(std::make_shared<LLDPNeighborWatcher>());
+  }
+  return ready_;
+}
+
+void LLDPNeighborWatcher::getNeighbors(QueryData& rows) {
+  ReadLock lock(mutex_);
+  for (const auto& neighbor : neighbors_) {
+    rows.push_back(neighbor.second);
+  }
+}
+
+ssize_t LLDPNeighborWatcher::send(lldpctl_conn_t* conn,
+                                  const uint8_t* data,
+                                  size_t length,
+                                  void* user_data) {
+  auto watcher = static_cast<LLDPNeighborWatcher*>(user_data);
+  auto bytes = ::send(watcher->fd_, data, length, MSG_NOSIGNAL);
+  return (bytes < 0) ? LLDPCTL_ERR_CALLBACK_FAILURE : bytes;
+}
+
+ssize_t LLDPNeighborWatcher::recv(lldpctl_conn_t* conn,
+                                  const uint8_t* data,
+                                  size_t length,
+                                  void* user_data) {
+  return LLDPCTL_ERR_WOULD_BLOCK;
+}
+
+bool LLDPNeighborWatcher::receive() {
+  while (!interrupted()) {
+    struct pollfd pfd = {fd_, POLLIN, 0};
+    auto result = ::poll(&pfd, 1, 1000);
+    if (result < 0 && errno != EINTR) {
+      return false;
+    } else if (result <= 0) {
+      continue;
+    }
+
+    uint8_t buffer[4096];
+    auto bytes = ::read(fd_, buffer, sizeof(buffer));
+    if (bytes <= 0) {
+      // lldpd closed the connection.
+      return false;
+    }
+    return lldpctl_recv(conn_, buffer, bytes) >= 0;
+  }
+  return false;
+}
+
+void LLDPNeighborWatcher::changed(lldpctl_conn_t* conn,
+                                  lldpctl_change_t type,
+                                  lldpctl_atom_t* interface,
+                                  lldpctl_atom_t* neighbor,
+                                  void* data) {
+  std::unique_ptr<lldpctl_atom_t, decltype(delLLDPAtom)> chassis(
+      lldpctl_atom_get(neighbor, lldpctl_k_port_chassis), delLLDPAtom);
+
+  LLDPNeighbor n(neighbor, chassis.get());
+  Row& row = n.getNeighbor();
+  row["interface"] = getAtomStr(interface, lldpctl_k_interface_name);
+  auto key = getLLDPNeighborKey(row.at("interface"), row);
+
+  WriteLock lock(mutex_);
+  if (type == lldpctl_c_deleted) {
+    neighbors_.erase(key);
+  } else {
+    neighbors_[key] = row;
+  }
+}
+
+void LLDPNeighborWatcher::watch() {
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    return;
+  }
+
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path,
+          lldpctl_get_default_transport(),
+          sizeof(address.sun_path) - 1);
+  if (connect(fd_, (struct sockaddr*)&address, sizeof(address)) != 0) {
+    close(fd_);
+    fd_ = -1;
+    return;
+  }
+
+  auto conn = newLLDPConnection(&LLDPNeighborWatcher::send,
+                                &LLDPNeighborWatcher::recv,
+                                this);
+  conn_ = conn.get();
+
+  // An asynchronous request returns would-block until its reply is pushed.
+  int rc = LLDPCTL_ERR_WOULD_BLOCK;
+  while ((rc = lldpctl_watch_callback(
+              conn_, &LLDPNeighborWatcher::changed, nullptr)) ==
+         LLDPCTL_ERR_WOULD_BLOCK) {
+    if (!receive()) {
+      break;
+    }
+  }
+
+  if (rc == LLDPCTL_NO_ERROR) {
+    // Subscribed, notifications queue on the socket while neighbors are read.
+    std::map<std::string, Row> neighbors;
+    auto sync = newLLDPConnection(nullptr, nullptr, nullptr);
+    if (genLLDPNeighborRows(sync.get(), neighbors).ok()) {
+      WriteLock lock(mutex_);
+      neighbors_ = std::move(neighbors);
+      ready_ = true;
+    }
+
+    while (receive()) {
+      // Each notification was applied by LLDPNeighborWatcher::changed.
+    }
+  }
+
+  {
+    WriteLock lock(mutex_);
+    ready_ = false;
+    neighbors_.clear();
+  }
+  conn.reset();
+  conn_ = nullptr;
+  close(fd_);
+  fd_ = -1;
+}
+
+void LLDPNeighborWatcher::start() {
+  while (!interrupted()) {
+    watch();
+    // lldpd is not running or restarted, connect again later.
+    pauseMilli(10 * 1000);
+  }
+}
+
+/// A synchronous connection reused by queries when not watching.
+static LLDPConnection kLLDPConnection{nullptr};
+static Mutex kLLDPConnectionMutex;
+
+QueryData genLLDPNeighbors(QueryContext& context) {
+  QueryData rows;
+  if (FLAGS_lldp_neighbors_watch && LLDPNeighborWatcher::ready()) {
+    LLDPNeighborWatcher::getNeighbors(rows);
+    return rows;
+  }
+
+  WriteLock lock(kLLDPConnectionMutex);
+  if (kLLDPConnection == nullptr) {
+    kLLDPConnection = newLLDPConnection(nullptr, nullptr, nullptr);
+
+    lldpctl_error_t err = lldpctl_last_error(kLLDPConnection.get());
+    if (err != LLDPCTL_NO_ERROR) {
+      LOG(ERROR) << "could not initiate new lldpd connection: "
+                 << lldpctl_strerror(err);
+      kLLDPConnection.reset();
+      return rows;
+    }
+  }
+
+  std::map<std::string, Row> neighbors;
+  auto status = genLLDPNeighborRows(kLLDPConnection.get(), neighbors);
+  if (!status.ok()) {
+    LOG(WARNING) << "could not connect to lldpd (hint: you might need to "
+                    "install lldpd v0.9.X or run in sudo): "
+                 << status.getMessage();
+    // Connect again for the next query, lldpd may have restarted.
+    kLLDPConnection.reset();
+    return rows;
+  }
+
+  for (auto& neighbor : neighbors) {
+    rows.push_back(std::move(neighbor.second));
+  }
   return rows;
 }
 }
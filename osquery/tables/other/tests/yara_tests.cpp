@@ -10,12 +10,20 @@
 
 #include <gtest/gtest.h>
 
+#include <boost/filesystem.hpp>
+
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 
 #include "osquery/tables/other/yara_utils.h"
+#include "osquery/tests/test_util.h"
+
+namespace fs = boost::filesystem;
 
 namespace osquery {
 
+DECLARE_string(yara_cache_path);
+
 const std::string ruleFile = "/tmp/osquery-yara.sig";
 const std::string ls = "/bin/ls";
 const std::string alwaysTrue = "rule always_true { condition: true }";
@@ -73,4 +81,62 @@ TEST_F(YARATest, test_match_false) {
   // Should have 0 count
   EXPECT_TRUE(r["count"] == "0");
 }
+
+TEST_F(YARATest, test_compiled_rules_cache) {
+  auto cache_path = FLAGS_yara_cache_path;
+  FLAGS_yara_cache_path = kTestWorkingDirectory + "yara-cache";
+  fs::remove_all(FLAGS_yara_cache_path);
+
+  auto cached = []() {
+    std::vector<std::string> files;
+    listFilesInDirectory(FLAGS_yara_cache_path, files);
+    return files;
+  };
+
+  // Compiled rules are saved, then loaded while the rule file is unchanged.
+  EXPECT_EQ(scanFile(alwaysTrue)["count"], "1");
+  auto files = cached();
+  ASSERT_EQ(files.size(), 1U);
+  EXPECT_EQ(scanFile(alwaysTrue)["count"], "1");
+  EXPECT_EQ(cached(), files);
+
+  // Changed content is compiled again and replaces the cached rules.
+  EXPECT_EQ(scanFile(alwaysFalse)["count"], "0");
+  EXPECT_EQ(cached().size(), 1U);
+  EXPECT_NE(cached(), files);
+
+  fs::remove_all(FLAGS_yara_cache_path);
+  FLAGS_yara_cache_path = cache_path;
+}
+
+TEST_F(YARATest, test_scan_cache) {
+  YARAScanCache cache(2);
+  struct stat file_stat;
+  ASSERT_EQ(stat(ls.c_str(), &file_stat), 0);
+
+  EXPECT_FALSE(cache.scanned(ls, file_stat, "rules"));
+  cache.add(ls, file_stat, "rules");
+  EXPECT_TRUE(cache.scanned(ls, file_stat, "rules"));
+
+  // Changed rules or a changed file are scanned again.
+  EXPECT_FALSE(cache.scanned(ls, file_stat, "other_rules"));
+  auto changed = file_stat;
+  changed.st_size++;
+  EXPECT_FALSE(cache.scanned(ls, changed, "rules"));
+  changed = file_stat;
+  changed.st_ino++;
+  EXPECT_FALSE(cache.scanned(ls, changed, "rules"));
+
+  // The least recently scanned file is forgotten.
+  cache.add("/a", file_stat, "rules");
+  cache.add("/b", file_stat, "rules");
+  EXPECT_EQ(cache.size(), 2U);
+  EXPECT_FALSE(cache.scanned(ls, file_stat, "rules"));
+  EXPECT_TRUE(cache.scanned("/b", file_stat, "rules"));
+
+  cache.setCapacity(0);
+  EXPECT_EQ(cache.size(), 0U);
+  cache.add(ls, file_stat, "rules");
+  EXPECT_FALSE(cache.scanned(ls, file_stat, "rules"));
+}
 }
@@ -11,6 +11,7 @@
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 #include <osquery/status.h>
@@ -23,6 +24,9 @@
 #include <yara.h>
 
 namespace osquery {
+
+DECLARE_uint64(yara_scan_timeout);
+
 namespace tables {
 
 void doYARAScan(YR_RULES* rules,
@@ -44,8 +48,12 @@ void doYARAScan(YR_RULES* rules,
   r["sigfile"] = std::string(sigfile);
 
   // Perform the scan, using the static YARA subscriber callback.
-  int result = yr_rules_scan_file(
-      rules, path.c_str(), SCAN_FLAGS_FAST_MODE, YARACallback, (void*)&r, 0);
+  int result = yr_rules_scan_file(rules,
+                                  path.c_str(),
+                                  SCAN_FLAGS_FAST_MODE,
+                                  YARACallback,
+                                  (void*)&r,
+                                  static_cast<int>(FLAGS_yara_scan_timeout));
   if (result == ERROR_SUCCESS) {
     results.push_back(std::move(r));
   }
@@ -125,16 +133,32 @@ QueryData genYara(QueryContext& context) {
     groups.insert(file);
   }
 
-  // Scan every path pair.
+  // Scan every path pair using the signature groups.
+  std::vector<std::pair<std::string, std::string>> scans;
   for (const auto& path : paths) {
-    // Scan using the signature groups.
     for (const auto& group : groups) {
       if (rules.count(group) > 0) {
-        doYARAScan(rules[group], path.c_str(), results, group, group);
+        scans.push_back(std::make_pair(path, group));
       }
     }
   }
 
+  // Each scan is independent, the compiled rules are only read.
+  std::vector<QueryData> scan_results(scans.size());
+  parallelFor(scans.size(), context.concurrency, ([&](size_t i) {
+                const auto& group = scans[i].second;
+                doYARAScan(rules.at(group),
+                           scans[i].first,
+                           scan_results[i],
+                           group,
+                           group);
+              }));
+
+  for (auto& scan : scan_results) {
+    for (auto& r : scan) {
+      results.push_back(std::move(r));
+    }
+  }
   return results;
 }
 }
@@ -10,14 +10,35 @@
 
 #include <map>
 #include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
 
 #include <osquery/config.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/tables/other/yara_utils.h"
+#include "osquery/tables/system/hash.h"
+
+namespace fs = boost::filesystem;
 
 namespace osquery {
 
+FLAG(string,
+     yara_cache_path,
+     OSQUERY_DB_HOME "/yara",
+     "Directory of compiled YARA rules, keyed by their rule files' content");
+
+FLAG(uint64,
+     yara_scan_timeout,
+     60,
+     "Seconds a YARA scan of a single file may run (0 for no limit)");
+
+/// The extension of compiled rules in the yara_cache_path.
+static const std::string kYARACacheExtension = ".yarc";
+
 /**
  * The callback used when there are compilation problems in the rules.
  */
@@ -33,10 +54,113 @@ void YARACompilerCallback(int error_level,
   }
 }
 
+/**
+ * @brief The name of a group's compiled rules within the yara_cache_path.
+ *
+ * The name is a hash of the group followed by a hash of the rule files'
+ * paths and content. An edited rule file results in a new name, and the
+ * group's previous compiled rules are removed when the new rules are saved.
+ */
+static std::string getYARACacheName(const std::string &group,
+                                    const std::vector<std::string> &files) {
+  Hash hash(HASH_TYPE_SHA256);
+#ifdef YR_VERSION
+  // The compiled rule format is specific to the library version.
+  hash.update(YR_VERSION, strlen(YR_VERSION));
+#endif
+  for (const auto &file : files) {
+    std::string content;
+    if (!readFile(file, content).ok()) {
+      return "";
+    }
+    hash.update(file.c_str(), file.size() + 1);
+    hash.update(content.data(), content.size());
+  }
+
+  auto prefix = hashFromBuffer(HASH_TYPE_SHA256, group.data(), group.size());
+  return prefix.substr(0, 16) + "-" + hash.digest() + kYARACacheExtension;
+}
+
+/// The paths of a group's rule files, relative to /etc/osquery/yara/.
+static std::vector<std::string> getYARARulePaths(const pt::ptree &rule_files) {
+  std::vector<std::string> paths;
+  for (const auto &item : rule_files) {
+    auto rule = item.second.get("", "");
+    paths.push_back((rule[0] != '/') ? "/etc/osquery/yara/" + rule : rule);
+  }
+  return paths;
+}
+
+std::string getYARARulesHash(const std::string &group,
+                             const pt::ptree &rule_files) {
+  auto name = getYARACacheName(group, getYARARulePaths(rule_files));
+  return name.substr(0, name.size() - kYARACacheExtension.size());
+}
+
+/// Load compiled rules from the cache, if the cache path is safe.
+static bool loadCachedRules(const std::string &name, YR_RULES **rules) {
+  if (FLAGS_yara_cache_path.empty() || name.empty()) {
+    return false;
+  }
+
+  // Compiled rules are only loaded from a directory users cannot write.
+  auto path = (fs::path(FLAGS_yara_cache_path) / name).string();
+  if (!pathExists(path).ok() || !safePermissions(FLAGS_yara_cache_path, path)) {
+    return false;
+  }
+
+  if (yr_rules_load(path.c_str(), rules) != ERROR_SUCCESS) {
+    VLOG(1) << "Cannot load cached YARA rules: " << path;
+    return false;
+  }
+  VLOG(1) << "Loaded cached YARA rules: " << path;
+  return true;
+}
+
+/// Save compiled rules and remove the previous rules of the same group.
+static void saveCachedRules(const std::string &name, YR_RULES *rules) {
+  if (FLAGS_yara_cache_path.empty() || name.empty()) {
+    return;
+  }
+
+  boost::system::error_code ec;
+  fs::path directory(FLAGS_yara_cache_path);
+  if (!fs::is_directory(directory, ec)) {
+    fs::create_directories(directory, ec);
+    fs::permissions(directory, fs::owner_all, ec);
+  }
+
+  // Write the rules to a temporary name so a partial file is never loaded.
+  auto path = directory / name;
+  auto temporary = directory / (name + ".tmp");
+  if (yr_rules_save(rules, temporary.string().c_str()) != ERROR_SUCCESS) {
+    VLOG(1) << "Cannot save compiled YARA rules: " << path.string();
+    fs::remove(temporary, ec);
+    return;
+  }
+  fs::rename(temporary, path, ec);
+
+  auto prefix = name.substr(0, name.find('-') + 1);
+  for (fs::directory_iterator it(directory, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    auto filename = it->path().filename().string();
+    if (filename != name && filename.compare(0, prefix.size(), prefix) == 0) {
+      boost::system::error_code remove_ec;
+      fs::remove(it->path(), remove_ec);
+    }
+  }
+}
+
 /**
  * Compile a single rule file and load it into rule pointer.
  */
 Status compileSingleFile(const std::string &file, YR_RULES **rules) {
+  // Rules compiled from the same file content are loaded from the cache.
+  auto cache_name = getYARACacheName(file, {file});
+  if (loadCachedRules(cache_name, rules)) {
+    return Status(0, "OK");
+  }
+
   YR_COMPILER *compiler = nullptr;
   int result = yr_compiler_create(&compiler);
   if (result != ERROR_SUCCESS) {
@@ -92,6 +216,7 @@ Status compileSingleFile(const std::string &file, YR_RULES **rules) {
       yr_compiler_destroy(compiler);
       return Status(1, "Insufficient memory to get YARA rules");
     }
+    saveCachedRules(cache_name, *rules);
   }
 
   if (compiler != nullptr) {
@@ -109,6 +234,14 @@ Status compileSingleFile(const std::string &file, YR_RULES **rules) {
 Status handleRuleFiles(const std::string &category,
                        const pt::ptree &rule_files,
                        std::map<std::string, YR_RULES *> &rules) {
+  // Rules compiled from the same files and content are loaded from the cache.
+  auto cache_name = getYARACacheName(category, getYARARulePaths(rule_files));
+  YR_RULES *cached_rules = nullptr;
+  if (loadCachedRules(cache_name, &cached_rules)) {
+    rules[category] = cached_rules;
+    return Status(0, "OK");
+  }
+
   YR_COMPILER *compiler = nullptr;
   int result = yr_compiler_create(&compiler);
   if (result != ERROR_SUCCESS) {
@@ -184,6 +317,7 @@ Status handleRuleFiles(const std::string &category,
       yr_compiler_destroy(compiler);
       return Status(1, "Insufficient memory to get YARA rules");
     }
+    saveCachedRules(cache_name, rules[category]);
   }
 
   if (compiler != nullptr) {
@@ -194,6 +328,75 @@ Status handleRuleFiles(const std::string &category,
   return Status(0, "OK");
 }
 
+/// The modification time of a file in nanoseconds.
+static unsigned long long getModificationTime(const struct stat &file_stat) {
+#ifdef __APPLE__
+  const auto &mtime = file_stat.st_mtimespec;
+#else
+  const auto &mtime = file_stat.st_mtim;
+#endif
+  return static_cast<unsigned long long>(mtime.tv_sec) * 1000000000ULL +
+         mtime.tv_nsec;
+}
+
+bool YARAScanCache::scanned(const std::string &path,
+                            const struct stat &file_stat,
+                            const std::string &rules) {
+  WriteLock lock(mutex_);
+  auto it = entries_.find(path);
+  if (it == entries_.end()) {
+    return false;
+  }
+
+  const auto &entry = it->second;
+  return entry.device == file_stat.st_dev && entry.inode == file_stat.st_ino &&
+         entry.size == file_stat.st_size &&
+         entry.mtime == getModificationTime(file_stat) && entry.rules == rules;
+}
+
+void YARAScanCache::add(const std::string &path,
+                        const struct stat &file_stat,
+                        const std::string &rules) {
+  WriteLock lock(mutex_);
+  if (capacity_ == 0) {
+    return;
+  }
+
+  auto it = entries_.find(path);
+  if (it != entries_.end()) {
+    order_.erase(it->second.position);
+  } else {
+    if (entries_.size() >= capacity_) {
+      entries_.erase(order_.back());
+      order_.pop_back();
+    }
+    it = entries_.emplace(path, Entry()).first;
+  }
+
+  order_.push_front(path);
+  auto &entry = it->second;
+  entry.device = file_stat.st_dev;
+  entry.inode = file_stat.st_ino;
+  entry.size = file_stat.st_size;
+  entry.mtime = getModificationTime(file_stat);
+  entry.rules = rules;
+  entry.position = order_.begin();
+}
+
+void YARAScanCache::setCapacity(size_t capacity) {
+  WriteLock lock(mutex_);
+  capacity_ = capacity;
+  while (entries_.size() > capacity_) {
+    entries_.erase(order_.back());
+    order_.pop_back();
+  }
+}
+
+size_t YARAScanCache::size() const {
+  WriteLock lock(mutex_);
+  return entries_.size();
+}
+
 /**
  * This is the YARA callback. Used to store matching rules in the row which is
  * passed in as user_data.
@@ -266,6 +469,9 @@ Status YARAConfigParserPlugin::update(const std::string &source,
         VLOG(1) << "YARA rule compile error: " << status.getMessage();
         return status;
       }
+
+      WriteLock lock(hashes_mutex_);
+      hashes_[element.first] = getYARARulesHash(element.first, element.second);
     }
   }
 
@@ -278,6 +484,12 @@ Status YARAConfigParserPlugin::update(const std::string &source,
   return Status(0, "OK");
 }
 
+std::string YARAConfigParserPlugin::rulesHash(const std::string &group) const {
+  WriteLock lock(hashes_mutex_);
+  auto hash = hashes_.find(group);
+  return (hash == hashes_.end()) ? "" : hash->second;
+}
+
 /// Call the simple YARA ConfigParserPlugin "yara".
 REGISTER(YARAConfigParserPlugin, "config_parser", "yara");
 }
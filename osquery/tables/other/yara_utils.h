@@ -8,6 +8,14 @@
  *
  */
 
+#include <sys/stat.h>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include <boost/noncopyable.hpp>
+
 #include <osquery/config.h>
 #include <osquery/tables.h>
 
@@ -34,6 +42,66 @@ Status handleRuleFiles(const std::string& category,
 
 int YARACallback(int message, void* message_data, void* user_data);
 
+/// A hash of the library version, and a rule group's file paths and content.
+std::string getYARARulesHash(const std::string& group,
+                             const pt::ptree& rule_files);
+
+/**
+ * @brief Files scanned by yara_events, and the rules they were scanned with.
+ *
+ * A file that is closed after writing, or touched, without changing its
+ * content is not scanned again. The identity of a file is its device, inode,
+ * modification time, and size, along with a hash of the rules. The least
+ * recently scanned files are forgotten when the capacity is reached.
+ */
+class YARAScanCache : private boost::noncopyable {
+ public:
+  explicit YARAScanCache(size_t capacity = 0) : capacity_(capacity) {}
+
+  /// Check if a file is unchanged since it was scanned with the rules.
+  bool scanned(const std::string& path,
+               const struct stat& file_stat,
+               const std::string& rules);
+
+  /// Remember that a file was scanned.
+  void add(const std::string& path,
+           const struct stat& file_stat,
+           const std::string& rules);
+
+  /// Change the maximum number of files, 0 disables the cache.
+  void setCapacity(size_t capacity);
+
+  /// The number of remembered files.
+  size_t size() const;
+
+ private:
+  struct Entry {
+    dev_t device{0};
+    ino_t inode{0};
+    off_t size{0};
+
+    /// Modification time in nanoseconds.
+    unsigned long long mtime{0};
+
+    /// The hash of the rules the file was scanned with.
+    std::string rules;
+
+    /// The position of the path in the scan order.
+    std::list<std::string>::iterator position;
+  };
+
+  /// Files by path.
+  std::unordered_map<std::string, Entry> entries_;
+
+  /// Paths ordered by scan, most recent first.
+  std::list<std::string> order_;
+
+  /// The maximum number of files.
+  size_t capacity_{0};
+
+  mutable Mutex mutex_;
+};
+
 /**
  * @brief A simple ConfigParserPlugin for a "yara" dictionary key.
  *
@@ -52,12 +120,21 @@ class YARAConfigParserPlugin : public ConfigParserPlugin {
   // Retrieve compiled rules.
   std::map<std::string, YR_RULES*>& rules() { return rules_; }
 
+  /// The hash of a group's rules, see getYARARulesHash.
+  std::string rulesHash(const std::string& group) const;
+
   Status setUp() override;
 
  private:
   // Store compiled rules in a map (group => rules).
   std::map<std::string, YR_RULES*> rules_;
 
+  /// The hash of each group's rules when they were compiled.
+  std::map<std::string, std::string> hashes_;
+
+  /// Protect the hashes while the config is updated.
+  mutable Mutex hashes_mutex_;
+
   /// Store the signatures and file_paths and compile the rules.
   Status update(const std::string& source, const ParserConfig& config) override;
 };
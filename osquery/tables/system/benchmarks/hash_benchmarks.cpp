@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+#include "osquery/filesystem/fileops.h"
+#include "osquery/tables/system/hash.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+
+DECLARE_uint64(read_max);
+DECLARE_bool(read_mmap);
+DECLARE_uint64(hash_cache_max);
+
+/// Create a file of the requested size in MB, filled with a pattern.
+static std::string createHashBenchmarkFile(size_t megabytes) {
+  auto path = kTestWorkingDirectory + "hash-benchmark-" +
+              std::to_string(megabytes);
+  std::string block(1024 * 1024, '\0');
+  for (size_t i = 0; i < block.size(); i++) {
+    block[i] = static_cast<char>(i % 251);
+  }
+
+  PlatformFile file(path, PF_CREATE_ALWAYS | PF_WRITE);
+  for (size_t i = 0; i < megabytes; i++) {
+    file.write(block.data(), block.size());
+  }
+  return path;
+}
+
+static void benchmarkHashFile(benchmark::State& state, bool mmap) {
+  auto megabytes = static_cast<size_t>(state.range_x());
+  auto path = createHashBenchmarkFile(megabytes);
+
+  // Allow multi-GB reads and always hash the content.
+  auto read_max = FLAGS_read_max;
+  auto read_mmap = FLAGS_read_mmap;
+  auto cache_max = FLAGS_hash_cache_max;
+  FLAGS_read_max = (megabytes + 1) * 1024 * 1024;
+  FLAGS_read_mmap = mmap;
+  FLAGS_hash_cache_max = 0;
+
+  while (state.KeepRunning()) {
+    auto hashes = hashMultiFromFile(
+        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
+    benchmark::DoNotOptimize(hashes);
+  }
+  state.SetBytesProcessed(state.iterations() * megabytes * 1024 * 1024);
+
+  FLAGS_read_max = read_max;
+  FLAGS_read_mmap = read_mmap;
+  FLAGS_hash_cache_max = cache_max;
+  remove(path);
+}
+
+static void HASH_multi_file_read(benchmark::State& state) {
+  benchmarkHashFile(state, false);
+}
+
+BENCHMARK(HASH_multi_file_read)->Arg(64)->Arg(1024)->Arg(4096);
+
+static void HASH_multi_file_mmap(benchmark::State& state) {
+  benchmarkHashFile(state, true);
+}
+
+BENCHMARK(HASH_multi_file_mmap)->Arg(64)->Arg(1024)->Arg(4096);
+}
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/registry.h>
+
+#ifdef __linux__
+#include "osquery/tables/system/linux/kernel_modules.h"
+#endif
+
+namespace osquery {
+
+#ifdef __linux__
+namespace tables {
+
+std::string genKernelIntegrityGeneration();
+}
+
+/**
+ * @brief Run the kernel_integrity checks for every query.
+ *
+ * Without module events, or with `--kernel_table_cache=false`, each query
+ * asks the kernel to hash its text segment and check the syscall table.
+ */
+static void KERNEL_integrity_uncached(benchmark::State& state) {
+  tables::KernelChanges::setWatching(false);
+  while (state.KeepRunning()) {
+    PluginResponse response;
+    Registry::call(
+        "table", "kernel_integrity", {{"action", "generate"}}, response);
+  }
+}
+
+BENCHMARK(KERNEL_integrity_uncached);
+
+/// Query kernel_integrity while module events are received, without changes.
+static void KERNEL_integrity_cached(benchmark::State& state) {
+  tables::KernelChanges::setWatching(true);
+  while (state.KeepRunning()) {
+    PluginResponse response;
+    Registry::call(
+        "table", "kernel_integrity", {{"action", "generate"}}, response);
+  }
+  tables::KernelChanges::setWatching(false);
+}
+
+BENCHMARK(KERNEL_integrity_cached);
+
+/// The check for kernel changes made by each cached query and schedule step.
+static void KERNEL_integrity_generation(benchmark::State& state) {
+  tables::KernelChanges::setWatching(true);
+  while (state.KeepRunning()) {
+    auto generation = tables::genKernelIntegrityGeneration();
+    benchmark::DoNotOptimize(generation);
+  }
+  tables::KernelChanges::setWatching(false);
+}
+
+BENCHMARK(KERNEL_integrity_generation);
+
+/// Parse the loaded modules for every query.
+static void KERNEL_modules_uncached(benchmark::State& state) {
+  tables::KernelChanges::setWatching(false);
+  size_t modules = 0;
+  while (state.KeepRunning()) {
+    PluginResponse response;
+    Registry::call(
+        "table", "kernel_modules", {{"action", "generate"}}, response);
+    modules += response.size();
+  }
+  state.SetItemsProcessed(modules);
+}
+
+BENCHMARK(KERNEL_modules_uncached);
+#endif
+}
@@ -0,0 +1,103 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#ifndef WIN32
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/registry.h>
+#include <osquery/sql.h>
+
+namespace osquery {
+
+/**
+ * @brief Generate every column of the processes table.
+ *
+ * The items processed are the processes generated, so the reported rate is
+ * the per-process cost on the benchmarking host.
+ */
+static void PROCESSES_generate(benchmark::State& state) {
+  size_t processes = 0;
+  while (state.KeepRunning()) {
+    PluginResponse response;
+    Registry::call("table", "processes", {{"action", "generate"}}, response);
+    processes += response.size();
+  }
+  state.SetItemsProcessed(processes);
+}
+
+BENCHMARK(PROCESSES_generate);
+
+/// Select the columns read from stat and status, skipping the links.
+static void PROCESSES_select_stat(benchmark::State& state) {
+  size_t processes = 0;
+  while (state.KeepRunning()) {
+    SQL sql("select pid, parent, name, uid, resident_size from processes");
+    processes += sql.rows().size();
+  }
+  state.SetItemsProcessed(processes);
+}
+
+BENCHMARK(PROCESSES_select_stat);
+
+/// Select the columns without kernel argument or path reads.
+static void PROCESSES_select_cheap(benchmark::State& state) {
+  size_t processes = 0;
+  while (state.KeepRunning()) {
+    SQL sql("select pid, parent, uid, state from processes");
+    processes += sql.rows().size();
+  }
+  state.SetItemsProcessed(processes);
+}
+
+BENCHMARK(PROCESSES_select_cheap);
+
+#ifndef WIN32
+/**
+ * @brief Select the command line while the host runs extra processes.
+ *
+ * The range is the number of sleeping children forked before timing, such
+ * that the benchmark reflects hosts with thousands of processes. Repeated
+ * generations may reuse the static attributes of the children.
+ */
+static void PROCESSES_select_spawned(benchmark::State& state) {
+  std::vector<pid_t> children;
+  for (int i = 0; i < state.range_x(); i++) {
+    auto child = fork();
+    if (child == 0) {
+      pause();
+      _exit(0);
+    } else if (child > 0) {
+      children.push_back(child);
+    }
+  }
+
+  size_t processes = 0;
+  while (state.KeepRunning()) {
+    SQL sql("select pid, name, path, cmdline from processes");
+    processes += sql.rows().size();
+  }
+  state.SetItemsProcessed(processes);
+
+  for (const auto& child : children) {
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+  }
+}
+
+BENCHMARK(PROCESSES_select_spawned)->Arg(1000);
+#endif
+}
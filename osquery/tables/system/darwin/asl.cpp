@@ -8,27 +8,77 @@
  *
  */
 
+#include <boost/noncopyable.hpp>
+
+#include <osquery/config.h>
+#include <osquery/database.h>
+
+#include "osquery/core/conversions.h"
 #include "osquery/tables/system/darwin/asl_utils.h"
 
 namespace osquery {
 namespace tables {
 
-QueryData genAsl(QueryContext &context) {
-  QueryData results;
+/// Release an ASL query or response when it goes out of scope.
+template <typename T>
+struct AslObject : private boost::noncopyable {
+  explicit AslObject(T object) : object(object) {}
+
+  ~AslObject() {
+    if (object != nullptr) {
+      asl_release(object);
+    }
+  }
+
+  T object;
+};
+
+/// The key of a scheduled query's last read message ID in the backing store.
+static std::string getAslCursorKey() {
+  const auto& query_name = Config::getExecutingQuery();
+  if (query_name.empty()) {
+    return "";
+  }
+  return "asl." + query_name;
+}
+
+void genAsl(RowBatch& batch, QueryContext& context) {
+  // The batch may yield and its generator be unwound while reading messages.
+  AslObject<aslmsg> query(createAslQuery(context));
 
-  aslmsg query = createAslQuery(context);
-  aslresponse result = asl_search(nullptr, query);
+  // A scheduled query only reads messages added since its last execution.
+  auto key = getAslCursorKey();
+  long long cursor = 0;
+  if (!key.empty()) {
+    std::string content;
+    if (getDatabaseValue(kPersistentSettings, key, content).ok()) {
+      long long id = 0;
+      if (safeStrtoll(content, 10, id).ok() && id > 0) {
+        cursor = id;
+        addCursorOp(query.object, cursor);
+      }
+    }
+  }
 
+  // Messages are appended to the batch as they are read, a bounded batch
+  // yields to the SQL cursor rather than holding every matching message.
+  auto last = cursor;
+  AslObject<aslresponse> result(asl_search(nullptr, query.object));
   aslmsg row = nullptr;
-  while ((row = asl_next(result)) != nullptr) {
-    Row r;
-    readAslRow(row, r);
-    results.push_back(r);
+  while ((row = asl_next(result.object)) != nullptr) {
+    const char* id_value = asl_get(row, ASL_KEY_MSG_ID);
+    long long id = 0;
+    if (id_value != nullptr && safeStrtoll(id_value, 10, id).ok() &&
+        id > last) {
+      last = id;
+    }
+
+    readAslRow(row, batch);
   }
-  asl_release(result);
-  asl_release(query);
 
-  return results;
+  if (!key.empty() && last > cursor) {
+    setDatabaseValue(kPersistentSettings, key, std::to_string(last));
+  }
 }
 }
 }
@@ -152,6 +152,26 @@ void readAslRow(aslmsg row, Row& r) {
   r[kExtraColumnKey] = ss.str();
 }
 
+void readAslRow(aslmsg row, RowBatch& batch) {
+  Row r;
+  readAslRow(row, r);
+
+  batch.addRow();
+  for (const auto& cell : r) {
+    auto column = batch.index(cell.first);
+    if (column < batch.columns()) {
+      batch.set(column, cell.second);
+    }
+  }
+}
+
+void addCursorOp(aslmsg& query, long long id) {
+  asl_set_query(query,
+                ASL_KEY_MSG_ID,
+                std::to_string(id).c_str(),
+                ASL_QUERY_OP_GREATER | ASL_QUERY_OP_NUMERIC);
+}
+
 std::string convertLikeRegex(const std::string& like_str) {
   // % is equivalent to .*
   // _ is equivalent to .
@@ -69,6 +69,25 @@ aslmsg createAslQuery(const QueryContext& context);
  */
 void readAslRow(aslmsg row, Row& r);
 
+/**
+ * @brief Append a row of ASL data to a RowBatch of the asl table.
+ *
+ * @param row The ASL row to read data from.
+ * @param batch The batch to append a row to.
+ */
+void readAslRow(aslmsg row, RowBatch& batch);
+
+/**
+ * @brief Restrict an ASL query to messages after a message ID.
+ *
+ * ASL assigns increasing message IDs, a scheduled query uses the last ID it
+ * read as a cursor and only reads messages added since its last execution.
+ *
+ * @param query The query on which to add the operation.
+ * @param id The last message ID read.
+ */
+void addCursorOp(aslmsg& query, long long id);
+
 /**
  * @brief Convert a LIKE format string into a regex
  *
@@ -172,7 +172,7 @@ QueryData genCrashLogs(QueryContext& context) {
   };
 
   // Process system logs
-  if (context.constraints["uid"].notExistsOrMatches("0")) {
+  if (context.constraints["uid"].admits("0")) {
     process_crash_logs(kDiagnosticReportsPath, "application");
   }
 
@@ -116,7 +116,7 @@ void readKernelPanic(const std::string& appLog, QueryData& results) {
 QueryData genKernelPanics(QueryContext& context) {
   QueryData results;
 
-  if (context.constraints["uid"].notExistsOrMatches("0")) {
+  if (context.constraints["uid"].admits("0")) {
     std::vector<std::string> files;
     if (listFilesInDirectory(kDiagnosticReportsPath, files)) {
       for (const auto& lf : files) {
@@ -116,7 +116,7 @@ QueryData genLaunchd(QueryContext& context) {
 
   // For each found launcher (plist in known paths) parse the plist.
   for (const auto& path : launchers) {
-    if (!context.constraints["path"].matches(path)) {
+    if (!context.constraints["path"].admits(path)) {
       // Optimize by not searching when a path is a constraint.
       continue;
     }
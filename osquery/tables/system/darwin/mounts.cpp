@@ -13,6 +13,8 @@
 
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/posix/mount_stats.h"
+
 namespace osquery {
 namespace tables {
 
@@ -23,8 +25,10 @@ QueryData genMounts(QueryContext& context) {
   int mnts = 0;
   int i;
   char real_path[PATH_MAX];
+  std::vector<std::string> paths;
 
-  mnts = getmntinfo(&mnt, MNT_WAIT);
+  // The kernel's last statistics, each filesystem is not asked again.
+  mnts = getmntinfo(&mnt, MNT_NOWAIT);
   if (mnts == 0) {
     // Failed to get mount information.
     return results;
@@ -39,15 +43,20 @@ QueryData genMounts(QueryContext& context) {
                                         : mnt[i].f_mntfromname);
     r["type"] = TEXT(mnt[i].f_fstypename);
     r["flags"] = INTEGER(mnt[i].f_flags);
-    r["blocks"] = BIGINT(mnt[i].f_blocks);
-    r["blocks_free"] = BIGINT(mnt[i].f_bfree);
-    r["blocks_available"] = BIGINT(mnt[i].f_bavail);
-    r["blocks_size"] = BIGINT(mnt[i].f_bsize);
-    r["inodes"] = BIGINT(mnt[i].f_files);
-    r["inodes_free"] = BIGINT(mnt[i].f_ffree);
     r["owner"] = INTEGER(mnt[i].f_owner);
+    paths.push_back(r["path"]);
     results.push_back(r);
   }
+
+  // A hung mount point has no capacity rather than blocking the query.
+  std::map<std::string, MountCapacity> capacities;
+  MountStats::get(paths, capacities);
+  for (auto& r : results) {
+    auto capacity = capacities.find(r["path"]);
+    if (capacity != capacities.end()) {
+      MountStats::fill(capacity->second, r);
+    }
+  }
   return results;
 }
 }
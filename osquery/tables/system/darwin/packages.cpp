@@ -8,11 +8,16 @@
  *
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 #include <osquery/tables.h>
 
+#include "osquery/filesystem/fileops.h"
 // Package BOM structure headers
 #include "osquery/tables/system/darwin/packages.h"
 
@@ -20,6 +25,9 @@ namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
 
 namespace osquery {
+
+DECLARE_bool(disable_forensic);
+
 namespace tables {
 
 const std::vector<std::string> kPkgReceiptPaths = {
@@ -148,9 +156,11 @@ const BOMPaths* BOM::getPaths(int index) const {
 void genBOMPaths(const std::string& path,
                  const BOM& bom,
                  const BOMPaths* paths,
+                 const ConstraintList& filepaths,
                  QueryData& results) {
-  std::map<uint32_t, std::string> filenames;
-  std::map<uint32_t, uint32_t> parents;
+  // Entries follow their parent directory, only directories that may contain
+  // a requested filepath keep their full path.
+  std::map<uint32_t, std::string> directories;
 
   while (paths != nullptr) {
     for (unsigned j = 0; j < ntohs(paths->count); j++) {
@@ -179,16 +189,23 @@ void genBOMPaths(const std::string& path,
       std::string filename(file->name, file_size - sizeof(BOMFile));
       filename = std::string(filename.c_str());
 
-      // Maintain a lookup from BOM file index to filename.
-      filenames[info1->id] = filename;
       if (file->parent) {
-        parents[info1->id] = file->parent;
+        auto parent = directories.find(file->parent);
+        if (parent != directories.end()) {
+          filename = parent->second + "/" + filename;
+        } else if (filepaths.exists()) {
+          // The parent directory cannot contain a requested filepath.
+          continue;
+        }
       }
 
-      auto it = parents.find(info1->id);
-      while (it != parents.end()) {
-        filename = filenames[it->second] + "/" + filename;
-        it = parents.find(it->second);
+      if (S_ISDIR(ntohs(info2->mode)) &&
+          filepaths.admitsPrefix(filename + "/")) {
+        directories[info1->id] = filename;
+      }
+
+      if (!filepaths.admits(filename)) {
+        continue;
       }
 
       Row r;
@@ -210,19 +227,11 @@ void genBOMPaths(const std::string& path,
   }
 }
 
-void genPackageBOM(const std::string& path, QueryData& results) {
-  std::string content;
-  // Read entire BOM file.
-  if (!forensicReadFile(path, content).ok()) {
-    return;
-  }
-
-  // Create a BOM representation.
-  BOM bom(content.c_str(), content.size());
-  if (!bom.isValid()) {
-    return;
-  }
-
+/// Find the paths tree of a BOM and generate its entries.
+void genBOM(const std::string& path,
+            const BOM& bom,
+            const ConstraintList& filepaths,
+            QueryData& results) {
   size_t var_offset = 0;
   for (unsigned i = 0; i < ntohl(bom.Vars->count); i++) {
     // Iterate through each BOM variable, a packed set of structures.
@@ -253,18 +262,55 @@ void genPackageBOM(const std::string& path, QueryData& results) {
       paths = bom.getPaths(paths->indices[0].index0);
     }
 
-    genBOMPaths(path, bom, paths, results);
+    genBOMPaths(path, bom, paths, filepaths, results);
     break;
   }
 }
 
+void genPackageBOM(const std::string& path,
+                   const ConstraintList& filepaths,
+                   QueryData& results) {
+  PlatformFile fd(path, PF_OPEN_EXISTING | PF_READ);
+  if (!fd.isValid()) {
+    return;
+  }
+
+  auto size = fd.size();
+  if (fd.isSpecialFile() || size == 0) {
+    return;
+  }
+
+  PlatformTime times;
+  fd.getFileTimes(times);
+
+  // Map the BOM, only the pages of the structures read are brought into
+  // memory. Receipts may be large, and most queries select few paths.
+  auto data =
+      ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.nativeHandle(), 0);
+  if (data == MAP_FAILED) {
+    return;
+  }
+
+  // Create a BOM representation.
+  BOM bom(static_cast<const char*>(data), size);
+  if (bom.isValid()) {
+    genBOM(path, bom, filepaths, results);
+  }
+
+  ::munmap(data, size);
+  if (!FLAGS_disable_forensic) {
+    // Restore the atime of the BOM, like a forensic read.
+    fd.setFileTimes(times);
+  }
+}
+
 QueryData genPackageBOM(QueryContext& context) {
   QueryData results;
   if (context.constraints["path"].exists(EQUALS)) {
     // If an explicit path was given, generate and return.
     auto paths = context.constraints["path"].getAll(EQUALS);
     for (const auto& path : paths) {
-      genPackageBOM(path, results);
+      genPackageBOM(path, context.constraints["filepath"], results);
     }
   }
 
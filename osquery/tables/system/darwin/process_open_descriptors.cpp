@@ -181,7 +181,7 @@ QueryData genOpenSockets(QueryContext& context) {
 
   auto pidlist = getProcList(context);
   for (auto& pid : pidlist) {
-    if (!context.constraints["pid"].matches(pid)) {
+    if (!context.constraints["pid"].admits(pid)) {
       // Optimize by not searching when a pid is a constraint.
       continue;
     }
@@ -196,7 +196,7 @@ QueryData genOpenFiles(QueryContext& context) {
 
   auto pidlist = getProcList(context);
   for (auto& pid : pidlist) {
-    if (!context.constraints["pid"].matches(pid)) {
+    if (!context.constraints["pid"].admits(pid)) {
       // Optimize by not searching when a pid is a constraint.
       continue;
     }
@@ -18,8 +18,10 @@
 #include <array>
 #include <map>
 #include <set>
+#include <tuple>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/noncopyable.hpp>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
@@ -104,6 +106,12 @@ struct proc_cred {
     uid_t uid{0};
     gid_t gid{0};
   } real, effective, saved;
+
+  /// The process start in microseconds, 0 if only short info is available.
+  uint64_t start{0};
+
+  /// The executable name, this changes when the process calls exec.
+  std::string comm;
 };
 
 inline bool getProcCred(int pid, proc_cred& cred) {
@@ -122,6 +130,9 @@ inline bool getProcCred(int pid, proc_cred& cred) {
     cred.effective.gid = bsdinfo.pbi_gid;
     cred.saved.uid = bsdinfo.pbi_svuid;
     cred.saved.gid = bsdinfo.pbi_svgid;
+    cred.start = bsdinfo.pbi_start_tvsec * 1000000 + bsdinfo.pbi_start_tvusec;
+    cred.comm = std::string(
+        bsdinfo.pbi_comm, strnlen(bsdinfo.pbi_comm, sizeof(bsdinfo.pbi_comm)));
     return true;
   } else if (proc_pidinfo(pid,
                           PROC_PIDT_SHORTBSDINFO,
@@ -138,6 +149,9 @@ inline bool getProcCred(int pid, proc_cred& cred) {
     cred.effective.gid = bsdinfo_short.pbsi_gid;
     cred.saved.uid = bsdinfo_short.pbsi_svuid;
     cred.saved.gid = bsdinfo_short.pbsi_svgid;
+    cred.comm = std::string(
+        bsdinfo_short.pbsi_comm,
+        strnlen(bsdinfo_short.pbsi_comm, sizeof(bsdinfo_short.pbsi_comm)));
     return true;
   }
   return false;
@@ -225,6 +239,76 @@ proc_args getProcRawArgs(int pid, size_t argmax) {
   return args;
 }
 
+/// The attributes of a process that only change if it calls exec.
+struct ProcStaticInfo {
+  /// The executable path and name, if the process was not a zombie.
+  std::string path;
+  std::string name;
+  bool has_path{false};
+
+  /// The command line invocation including arguments.
+  std::string cmdline;
+  bool has_cmdline{false};
+
+  /// The last table generation that listed this process.
+  size_t generation{0};
+};
+
+/// A process is identified by its pid, start time, and executable name.
+using ProcStaticKey = std::tuple<int, uint64_t, std::string>;
+
+/**
+ * @brief Static process attributes, kept between generations.
+ *
+ * Scheduled queries select from processes every interval. A process keeps
+ * its path and arguments until it exits, the cache avoids reading them from
+ * the kernel again. The command name is part of the key so a process that
+ * calls exec is read again.
+ */
+class ProcStaticCache : private boost::noncopyable {
+ public:
+  /// Copy the cached attributes, or insert an empty entry.
+  ProcStaticInfo get(const ProcStaticKey& key) {
+    WriteLock lock(mutex_);
+    auto& info = cache_[key];
+    info.generation = generation_;
+    return info;
+  }
+
+  /// Save attributes read for a process.
+  void set(const ProcStaticKey& key, const ProcStaticInfo& info) {
+    WriteLock lock(mutex_);
+    auto& cached = cache_[key];
+    cached = info;
+    cached.generation = generation_;
+  }
+
+  /// Start a generation, returns the previous generation.
+  size_t begin() {
+    WriteLock lock(mutex_);
+    return generation_++;
+  }
+
+  /// Remove processes not listed since the generation started.
+  void expire(size_t generation) {
+    WriteLock lock(mutex_);
+    for (auto it = cache_.begin(); it != cache_.end();) {
+      it = (it->second.generation <= generation) ? cache_.erase(it)
+                                                 : std::next(it);
+    }
+  }
+
+ private:
+  std::map<ProcStaticKey, ProcStaticInfo> cache_;
+  size_t generation_{1};
+  Mutex mutex_;
+};
+
+static ProcStaticCache& getProcStaticCache() {
+  static ProcStaticCache cache;
+  return cache;
+}
+
 QueryData genProcesses(QueryContext& context) {
   QueryData results;
 
@@ -237,20 +321,24 @@ QueryData genProcesses(QueryContext& context) {
   auto pidlist = getProcList(context);
   int argmax = genMaxArgs();
 
+  // Only read the attributes of the selected columns.
+  auto use_cmdline = context.isColumnUsed("cmdline");
+  auto use_dirs = context.isAnyColumnUsed({"cwd", "root"});
+  auto use_path = context.isAnyColumnUsed({"path", "name", "on_disk"});
+  auto use_rusage = context.isAnyColumnUsed({"wired_size",
+                                             "resident_size",
+                                             "total_size",
+                                             "user_time",
+                                             "system_time",
+                                             "start_time"});
+  auto use_threads = context.isColumnUsed("threads");
+
+  auto& cache = getProcStaticCache();
+  auto generation = cache.begin();
   for (auto& pid : pidlist) {
     Row r;
     r["pid"] = INTEGER(pid);
 
-    {
-      // The command line invocation including arguments.
-      auto args = getProcRawArgs(pid, argmax);
-      std::string cmdline = boost::algorithm::join(args.args, " ");
-      r["cmdline"] = cmdline;
-    }
-
-    // The process relative root and current working directory.
-    genProcRootAndCWD(pid, r);
-
     proc_cred cred;
     if (getProcCred(pid, cred)) {
       r["parent"] = BIGINT(cred.parent);
@@ -270,16 +358,43 @@ QueryData genProcesses(QueryContext& context) {
       continue;
     }
 
+    // Without a start time the process cannot be identified between runs.
+    auto key = std::make_tuple(pid, cred.start, cred.comm);
+    auto info = (cred.start != 0) ? cache.get(key) : ProcStaticInfo();
+    auto cached = info.has_path && info.has_cmdline;
+
+    if (use_cmdline && !info.has_cmdline) {
+      // The command line invocation including arguments.
+      auto args = getProcRawArgs(pid, argmax);
+      info.cmdline = boost::algorithm::join(args.args, " ");
+      info.has_cmdline = true;
+    }
+    r["cmdline"] = info.cmdline;
+
+    // The process relative root and current working directory.
+    if (use_dirs) {
+      genProcRootAndCWD(pid, r);
+    }
+
     // If the process is not a Zombie, try to find the path and name.
-    if (cred.status != 5) {
-      r["path"] = getProcPath(pid);
-      // OS X proc_name only returns 16 bytes, use the basename of the path.
-      r["name"] = fs::path(r["path"]).filename().string();
-    } else {
+    if (cred.status == 5) {
       r["path"] = "";
       std::vector<char> name(17);
       proc_name(pid, name.data(), 16);
       r["name"] = std::string(name.data());
+    } else {
+      if (use_path && !info.has_path) {
+        info.path = getProcPath(pid);
+        // OS X proc_name only returns 16 bytes, use the basename of the path.
+        info.name = fs::path(info.path).filename().string();
+        info.has_path = true;
+      }
+      r["path"] = info.path;
+      r["name"] = info.name;
+    }
+
+    if (cred.start != 0 && !cached && (info.has_path || info.has_cmdline)) {
+      cache.set(key, info);
     }
 
     // If the path of the executable that started the process is available and
@@ -289,16 +404,17 @@ QueryData genProcesses(QueryContext& context) {
     // to 0.
     if (r["path"].empty()) {
       r["on_disk"] = INTEGER(-1);
-    } else if (pathExists(r["path"])) {
-      r["on_disk"] = INTEGER(1);
-    } else {
-      r["on_disk"] = INTEGER(0);
+    } else if (context.isColumnUsed("on_disk")) {
+      r["on_disk"] = INTEGER((pathExists(r["path"])) ? 1 : 0);
     }
 
     // systems usage and time information
     struct rusage_info_v2 rusage_info_data;
-    int status =
-        proc_pid_rusage(pid, RUSAGE_INFO_V2, (rusage_info_t*)&rusage_info_data);
+    int status = -1;
+    if (use_rusage) {
+      status = proc_pid_rusage(
+          pid, RUSAGE_INFO_V2, (rusage_info_t*)&rusage_info_data);
+    }
     // proc_pid_rusage returns -1 if it was unable to gather information
     if (status == 0) {
       // size/memory information
@@ -324,8 +440,11 @@ QueryData genProcesses(QueryContext& context) {
     }
 
     struct proc_taskinfo task_info;
-    status =
-        proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &task_info, sizeof(task_info));
+    status = 0;
+    if (use_threads) {
+      status =
+          proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &task_info, sizeof(task_info));
+    }
     if (status == sizeof(task_info)) {
       r["threads"] = INTEGER(task_info.pti_threadnum);
     } else {
@@ -335,6 +454,12 @@ QueryData genProcesses(QueryContext& context) {
     results.push_back(r);
   }
 
+  // Processes that exited are removed once every process was listed.
+  if (context.constraints.count("pid") == 0 ||
+      !context.constraints.at("pid").exists(EQUALS)) {
+    cache.expire(generation);
+  }
+
   return results;
 }
 
@@ -288,6 +288,28 @@ const std::map<std::string, std::string> kSMCKeyDescriptions = {
     {"PDTR", "DC In Total"},
     {"PSTR", "System Total"}};
 
+/**
+ * @brief SMC key metadata, read once for the life of the process.
+ *
+ * The set of SMC keys and their types do not change while the host is
+ * running. Caching them avoids enumerating every key index for each scan,
+ * and a key information call before each read.
+ */
+struct SMCKeyCache {
+  /// The enumerated keys, empty until an enumeration succeeds.
+  std::vector<std::string> keys;
+
+  /// The enumerated keys, for presence checks.
+  std::set<std::string> key_set;
+
+  /// The size and type of keys that were read.
+  std::map<UInt32, SMCKeyDataKeyInfo_t> info;
+
+  Mutex mutex;
+};
+
+static SMCKeyCache kSMCKeyCache;
+
 class SMCHelper : private boost::noncopyable {
  public:
   virtual ~SMCHelper() {
@@ -313,7 +335,18 @@ class SMCHelper : private boost::noncopyable {
   /// Read all keys (a service API call) into a string vector.
   std::vector<std::string> getKeys() const;
 
+  /**
+   * @brief Check if the SMC may report a key.
+   *
+   * Keys that were not enumerated are not read, except hidden keys which
+   * are only enumerated when the SMC is unlocked.
+   */
+  bool hasKey(const std::string &key) const;
+
  private:
+  /// Read the size and type of a key, once for the life of the process.
+  bool getKeyInfo(UInt32 key, SMCKeyDataKeyInfo_t &info) const;
+
   /// Perform an API call to the IOKit AppleSMC service.
   kern_return_t call(uint32_t selector,
                      SMCKeyData_t *in,
@@ -431,22 +464,21 @@ bool SMCHelper::read(const std::string &key, SMCValue_t *val) const {
 
   in.key = strtoul(key.c_str(), 4, 16);
   memcpy(val->key.bytes, key.c_str(), 4);
-  in.data8 = SMCCMDType::READ_KEYINFO;
 
-  auto result = call(KERNEL_INDEX_SMC, &in, &out);
-  if (result != kIOReturnSuccess) {
+  SMCKeyDataKeyInfo_t info;
+  if (!getKeyInfo(in.key, info)) {
     return false;
   }
 
-  val->dataSize = out.keyInfo.dataSize;
-  val->dataType.bytes[0] = (uint32_t)out.keyInfo.dataType >> 24;
-  val->dataType.bytes[1] = (uint32_t)out.keyInfo.dataType >> 16;
-  val->dataType.bytes[2] = (uint32_t)out.keyInfo.dataType >> 8;
-  val->dataType.bytes[3] = (uint32_t)out.keyInfo.dataType;
+  val->dataSize = info.dataSize;
+  val->dataType.bytes[0] = (uint32_t)info.dataType >> 24;
+  val->dataType.bytes[1] = (uint32_t)info.dataType >> 16;
+  val->dataType.bytes[2] = (uint32_t)info.dataType >> 8;
+  val->dataType.bytes[3] = (uint32_t)info.dataType;
   in.keyInfo.dataSize = val->dataSize;
   in.data8 = SMCCMDType::READ_BYTES;
 
-  result = call(KERNEL_INDEX_SMC, &in, &out);
+  auto result = call(KERNEL_INDEX_SMC, &in, &out);
   if (result != kIOReturnSuccess) {
     return false;
   }
@@ -455,6 +487,53 @@ bool SMCHelper::read(const std::string &key, SMCValue_t *val) const {
   return true;
 }
 
+bool SMCHelper::getKeyInfo(UInt32 key, SMCKeyDataKeyInfo_t &info) const {
+  {
+    WriteLock lock(kSMCKeyCache.mutex);
+    auto cached = kSMCKeyCache.info.find(key);
+    if (cached != kSMCKeyCache.info.end()) {
+      info = cached->second;
+      return true;
+    }
+  }
+
+  SMCKeyData_t in;
+  SMCKeyData_t out;
+  memset(&in, 0, sizeof(SMCKeyData_t));
+  memset(&out, 0, sizeof(SMCKeyData_t));
+  in.key = key;
+  in.data8 = SMCCMDType::READ_KEYINFO;
+
+  auto result = call(KERNEL_INDEX_SMC, &in, &out);
+  if (result != kIOReturnSuccess) {
+    // Failures are not cached, a locked SMC may later report hidden keys.
+    return false;
+  }
+
+  info = out.keyInfo;
+  WriteLock lock(kSMCKeyCache.mutex);
+  kSMCKeyCache.info[key] = info;
+  return true;
+}
+
+bool SMCHelper::hasKey(const std::string &key) const {
+  if (kSMCHiddenKeys.count(key) > 0) {
+    return true;
+  }
+
+  {
+    WriteLock lock(kSMCKeyCache.mutex);
+    if (!kSMCKeyCache.key_set.empty()) {
+      return kSMCKeyCache.key_set.count(key) > 0;
+    }
+  }
+
+  // Enumerate the keys once, if that fails every key may be read.
+  getKeys();
+  WriteLock lock(kSMCKeyCache.mutex);
+  return kSMCKeyCache.key_set.empty() || kSMCKeyCache.key_set.count(key) > 0;
+}
+
 size_t SMCHelper::getKeysCount() const {
   SMCValue_t val;
   read("#KEY", &val);
@@ -462,6 +541,13 @@ size_t SMCHelper::getKeysCount() const {
 }
 
 std::vector<std::string> SMCHelper::getKeys() const {
+  {
+    WriteLock lock(kSMCKeyCache.mutex);
+    if (!kSMCKeyCache.keys.empty()) {
+      return kSMCKeyCache.keys;
+    }
+  }
+
   std::vector<std::string> keys;
   size_t totalKeys = getKeysCount();
   for (size_t i = 0; i < totalKeys; i++) {
@@ -487,6 +573,12 @@ std::vector<std::string> SMCHelper::getKeys() const {
     key.bytes[4] = 0;
     keys.push_back(key.bytes);
   }
+
+  if (!keys.empty()) {
+    WriteLock lock(kSMCKeyCache.mutex);
+    kSMCKeyCache.keys = keys;
+    kSMCKeyCache.key_set = std::set<std::string>(keys.begin(), keys.end());
+  }
   return keys;
 }
 
@@ -562,7 +654,8 @@ inline QueryData getSMCKeysUsingPredicate(
   QueryData results;
   auto wrapped = ([&smc, &keys, &results, &predicate](const std::string &expr) {
     // Check if the expression key is within the category of 'keys'.
-    if (keys.count(expr) > 0) {
+    // Most keys of a category are not reported by a given model's SMC.
+    if (keys.count(expr) > 0 && smc.hasKey(expr)) {
       QueryData key_data;
       // Generate the basic SMC key data for this input expression.
       genSMCKey(expr, smc, key_data);
@@ -130,6 +130,21 @@ TEST_F(AslTests, test_create_asl_query) {
 
   asl_release(query);
 }
+
+TEST_F(AslTests, test_add_cursor_op) {
+  aslmsg query = asl_new(ASL_TYPE_QUERY);
+  addCursorOp(query, 1234);
+  ASSERT_EQ((size_t)1, asl_count(query));
+
+  const char *key, *val;
+  uint32_t op;
+  ASSERT_EQ(0, asl_fetch_key_val_op(query, 0, &key, &val, &op));
+  ASSERT_STREQ(ASL_KEY_MSG_ID, key);
+  ASSERT_STREQ("1234", val);
+  ASSERT_EQ((uint32_t)(ASL_QUERY_OP_GREATER | ASL_QUERY_OP_NUMERIC), op);
+
+  asl_release(query);
+}
 #endif
 
 TEST_F(AslTests, test_read_asl_row) {
@@ -8,16 +8,29 @@
  *
  */
 
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
 #include <iomanip>
+#include <list>
+#include <memory>
 #include <sstream>
+#include <unordered_map>
 #include <vector>
 
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/filesystem/file_cache.h"
 #include "osquery/tables/system/hash.h"
 
 namespace osquery {
@@ -34,7 +47,42 @@ namespace osquery {
 #define SHA1_CTX SHA_CTX
 #endif
 
-#define HASH_CHUNK_SIZE 4096
+/// Hash file content in large blocks, see readFileBlocks.
+#define HASH_CHUNK_SIZE (1024 * 1024)
+
+FLAG(uint64,
+     hash_cache_max,
+     20000,
+     "Maximum number of file hashes cached in the backing store (0 disables)");
+
+/// Only refresh a cached hash's access time after this many seconds.
+static const size_t kHashCacheTouchInterval = 3600;
+
+/// Recently used hashes are also kept in memory, by content identity.
+static const size_t kHashMemoryCacheMax = 4096;
+
+/// Protect the cache entry count and eviction.
+static Mutex kHashCacheMutex;
+
+/// True once the existing cache entries were counted.
+static bool kHashCacheCounted{false};
+
+static std::atomic<size_t> kHashCacheEntries{0};
+static std::atomic<size_t> kHashCacheHits{0};
+static std::atomic<size_t> kHashCacheMisses{0};
+static std::atomic<size_t> kHashCacheEvictions{0};
+
+/// Protect the in-memory hashes and their use order.
+static Mutex kHashMemoryMutex;
+
+/// Identities ordered by use, most recent first.
+static std::list<std::string> kHashMemoryOrder;
+
+/// In-memory hashes and their position in the use order.
+static std::unordered_map<
+    std::string,
+    std::pair<MultiHashes, std::list<std::string>::iterator>>
+    kHashMemory;
 
 Hash::~Hash() {
   if (ctx_ != nullptr) {
@@ -99,40 +147,251 @@ std::string hashFromBuffer(HashType hash_type,
   return hash.digest();
 }
 
-MultiHashes hashMultiFromFile(int mask, const std::string& path) {
-  std::map<HashType, std::shared_ptr<Hash>> hashes = {
-      {HASH_TYPE_MD5, std::make_shared<Hash>(HASH_TYPE_MD5)},
-      {HASH_TYPE_SHA1, std::make_shared<Hash>(HASH_TYPE_SHA1)},
-      {HASH_TYPE_SHA256, std::make_shared<Hash>(HASH_TYPE_SHA256)},
-  };
+/// Read a file and compute the requested hashes, without using the cache.
+static MultiHashes hashMultiFromFileContent(int mask, const std::string& path) {
+  // Only the requested digests are updated, in one pass over each block.
+  std::unique_ptr<Hash> md5, sha1, sha256;
+  std::vector<Hash*> hashes;
+  if (mask & HASH_TYPE_MD5) {
+    md5.reset(new Hash(HASH_TYPE_MD5));
+    hashes.push_back(md5.get());
+  }
+  if (mask & HASH_TYPE_SHA1) {
+    sha1.reset(new Hash(HASH_TYPE_SHA1));
+    hashes.push_back(sha1.get());
+  }
+  if (mask & HASH_TYPE_SHA256) {
+    sha256.reset(new Hash(HASH_TYPE_SHA256));
+    hashes.push_back(sha256.get());
+  }
 
-  readFile(path,
-           0,
-           HASH_CHUNK_SIZE,
-           false,
-           true,
-           ([&hashes, &mask](std::string& buffer, size_t size) {
-             for (auto& hash : hashes) {
-               if (mask & hash.first) {
-                 hash.second->update(&buffer[0], size);
-               }
-             }
-           }));
+  readFileBlocks(path,
+                 HASH_CHUNK_SIZE,
+                 true,
+                 ([&hashes](const char* buffer, size_t size) {
+                   for (auto& hash : hashes) {
+                     hash->update(buffer, size);
+                   }
+                 }));
 
   MultiHashes mh;
   mh.mask = mask;
-  if (mask & HASH_TYPE_MD5) {
-    mh.md5 = hashes.at(HASH_TYPE_MD5)->digest();
+  if (md5 != nullptr) {
+    mh.md5 = md5->digest();
   }
-  if (mask & HASH_TYPE_SHA1) {
-    mh.sha1 = hashes.at(HASH_TYPE_SHA1)->digest();
+  if (sha1 != nullptr) {
+    mh.sha1 = sha1->digest();
   }
-  if (mask & HASH_TYPE_SHA256) {
-    mh.sha256 = hashes.at(HASH_TYPE_SHA256)->digest();
+  if (sha256 != nullptr) {
+    mh.sha256 = sha256->digest();
   }
   return mh;
 }
 
+/// The identity of a file's content, a cached hash is valid while unchanged.
+static std::string getHashCacheIdentity(const std::string& path) {
+  // Files in directories watched for changes may skip the stat.
+  struct stat file_stat;
+  if (!FileMetadataCache::instance().stat(path, file_stat)) {
+    return "";
+  }
+
+  long mtime_nsec = 0;
+  long ctime_nsec = 0;
+#if defined(__linux__)
+  mtime_nsec = file_stat.st_mtim.tv_nsec;
+  ctime_nsec = file_stat.st_ctim.tv_nsec;
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+  mtime_nsec = file_stat.st_mtimespec.tv_nsec;
+  ctime_nsec = file_stat.st_ctimespec.tv_nsec;
+#endif
+
+  return std::to_string(file_stat.st_ino) + ":" +
+         std::to_string(file_stat.st_dev) + ":" +
+         std::to_string(file_stat.st_size) + ":" +
+         std::to_string(file_stat.st_mtime) + "." +
+         std::to_string(mtime_nsec) + ":" + std::to_string(file_stat.st_ctime) +
+         "." + std::to_string(ctime_nsec);
+}
+
+/// A parsed cache entry: identity, mask, access time, md5, sha1, sha256.
+struct HashCacheEntry {
+  std::string identity;
+  int mask{0};
+  size_t access{0};
+  MultiHashes hashes;
+};
+
+static bool parseHashCacheEntry(const std::string& value,
+                                HashCacheEntry& entry) {
+  // Hashes that were not computed are empty fields.
+  std::vector<std::string> fields;
+  boost::split(fields, value, boost::is_any_of(","));
+  if (fields.size() != 6) {
+    return false;
+  }
+
+  entry.identity = fields[0];
+  entry.mask = static_cast<int>(AS_LITERAL(INTEGER_LITERAL, fields[1]));
+  entry.access = AS_LITERAL(BIGINT_LITERAL, fields[2]);
+  entry.hashes.mask = entry.mask;
+  entry.hashes.md5 = fields[3];
+  entry.hashes.sha1 = fields[4];
+  entry.hashes.sha256 = fields[5];
+  return true;
+}
+
+static std::string serializeHashCacheEntry(const HashCacheEntry& entry) {
+  return entry.identity + "," + std::to_string(entry.mask) + "," +
+         std::to_string(entry.access) + "," + entry.hashes.md5 + "," +
+         entry.hashes.sha1 + "," + entry.hashes.sha256;
+}
+
+/**
+ * @brief Find hashes computed for the same content, within this process.
+ *
+ * The identity includes the inode and device, so the hashes computed by a
+ * scheduled hash query are found by the file event subscribers, and remain
+ * valid if the file is renamed.
+ */
+static bool getHashMemory(const std::string& identity,
+                          int mask,
+                          MultiHashes& hashes) {
+  WriteLock lock(kHashMemoryMutex);
+  auto cached = kHashMemory.find(identity);
+  if (cached == kHashMemory.end() ||
+      (cached->second.first.mask & mask) != mask) {
+    return false;
+  }
+
+  kHashMemoryOrder.splice(
+      kHashMemoryOrder.begin(), kHashMemoryOrder, cached->second.second);
+  hashes = cached->second.first;
+  return true;
+}
+
+static void setHashMemory(const std::string& identity,
+                          const MultiHashes& hashes) {
+  WriteLock lock(kHashMemoryMutex);
+  auto cached = kHashMemory.find(identity);
+  if (cached != kHashMemory.end()) {
+    cached->second.first = hashes;
+    kHashMemoryOrder.splice(
+        kHashMemoryOrder.begin(), kHashMemoryOrder, cached->second.second);
+    return;
+  }
+
+  kHashMemoryOrder.push_front(identity);
+  kHashMemory[identity] = std::make_pair(hashes, kHashMemoryOrder.begin());
+  while (kHashMemory.size() > kHashMemoryCacheMax) {
+    kHashMemory.erase(kHashMemoryOrder.back());
+    kHashMemoryOrder.pop_back();
+  }
+}
+
+/// Count the existing entries once, the count is then maintained.
+static void countHashCache() {
+  if (!kHashCacheCounted) {
+    std::vector<std::string> keys;
+    scanDatabaseKeys(kHashes, keys);
+    kHashCacheEntries = keys.size();
+    kHashCacheCounted = true;
+  }
+}
+
+/// Remove the least-recently used entries once the cache is over its limit.
+static void pruneHashCache() {
+  WriteLock lock(kHashCacheMutex);
+  countHashCache();
+
+  // Allow the cache to grow slightly past the limit to amortize the scan.
+  size_t limit = FLAGS_hash_cache_max;
+  if (kHashCacheEntries <= limit + limit / 10) {
+    return;
+  }
+
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kHashes, keys);
+  std::vector<std::pair<size_t, std::string>> accessed;
+  for (const auto& key : keys) {
+    std::string value;
+    HashCacheEntry entry;
+    if (getDatabaseValue(kHashes, key, value) &&
+        parseHashCacheEntry(value, entry)) {
+      accessed.push_back(std::make_pair(entry.access, key));
+    } else {
+      accessed.push_back(std::make_pair(0, key));
+    }
+  }
+
+  std::sort(accessed.begin(), accessed.end());
+  for (size_t i = 0; i + limit < accessed.size(); i++) {
+    deleteDatabaseValue(kHashes, accessed[i].second);
+    kHashCacheEvictions++;
+  }
+  kHashCacheEntries = std::min(accessed.size(), limit);
+}
+
+MultiHashes hashMultiFromFile(int mask, const std::string& path) {
+  auto identity =
+      (FLAGS_hash_cache_max > 0) ? getHashCacheIdentity(path) : "";
+  if (identity.empty()) {
+    // The cache is disabled or the file cannot be identified.
+    kHashCacheMisses++;
+    return hashMultiFromFileContent(mask, path);
+  }
+
+  HashCacheEntry entry;
+  if (getHashMemory(identity, mask, entry.hashes)) {
+    kHashCacheHits++;
+    return entry.hashes;
+  }
+
+  std::string value;
+  auto now = getUnixTime();
+  if (getDatabaseValue(kHashes, path, value) &&
+      parseHashCacheEntry(value, entry) && entry.identity == identity) {
+    if ((entry.mask & mask) == mask) {
+      kHashCacheHits++;
+      if (entry.access + kHashCacheTouchInterval < now) {
+        // Refresh the access time used for LRU eviction.
+        entry.access = now;
+        setDatabaseValue(kHashes, path, serializeHashCacheEntry(entry));
+      }
+      setHashMemory(identity, entry.hashes);
+      return entry.hashes;
+    }
+    // The content is unchanged, also compute the previously-cached hashes.
+    mask |= entry.mask;
+  } else if (value.empty()) {
+    kHashCacheEntries++;
+  }
+
+  kHashCacheMisses++;
+  entry.identity = identity;
+  entry.mask = mask;
+  entry.access = now;
+  entry.hashes = hashMultiFromFileContent(mask, path);
+  setDatabaseValue(kHashes, path, serializeHashCacheEntry(entry));
+  setHashMemory(identity, entry.hashes);
+  pruneHashCache();
+  return entry.hashes;
+}
+
+HashCacheStats getHashCacheStats() {
+  {
+    WriteLock lock(kHashCacheMutex);
+    countHashCache();
+  }
+
+  HashCacheStats stats;
+  stats.entries = kHashCacheEntries;
+  stats.hits = kHashCacheHits;
+  stats.misses = kHashCacheMisses;
+  stats.evictions = kHashCacheEvictions;
+  return stats;
+}
+
 std::string hashFromFile(HashType hash_type, const std::string& path) {
   auto hashes = hashMultiFromFile(hash_type, path);
   if (hash_type == HASH_TYPE_MD5) {
@@ -146,27 +405,78 @@ std::string hashFromFile(HashType hash_type, const std::string& path) {
 
 namespace tables {
 
-void genHashForFile(const std::string& path,
-                    const std::string& dir,
-                    QueryContext& context,
-                    QueryData& results) {
+/// A file to hash, the path and directory used to match constraints.
+using HashTarget = std::pair<std::string, std::string>;
+
+void genHashForFiles(const std::vector<HashTarget>& targets,
+                     QueryContext& context,
+                     QueryData& results) {
+  // Only compute the hashes used by the query.
+  int mask = 0;
+  mask |= (context.isColumnUsed("md5")) ? HASH_TYPE_MD5 : 0;
+  mask |= (context.isColumnUsed("sha1")) ? HASH_TYPE_SHA1 : 0;
+  mask |= (context.isColumnUsed("sha256")) ? HASH_TYPE_SHA256 : 0;
+
   // Must provide the path, filename, directory separate from boost path->string
   // helpers to match any explicit (query-parsed) predicate constraints.
-  Row r;
-  if (context.isCached(path)) {
-    r = context.getCache(path);
-  } else {
-    auto hashes = hashMultiFromFile(
-        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
+  // The cache index includes the mask, cursors may use different columns.
+  QueryData rows(targets.size());
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < targets.size(); i++) {
+    auto index = targets[i].first + ":" + std::to_string(mask);
+    if (mask != 0 && context.isCached(index)) {
+      rows[i] = context.getCache(index);
+      continue;
+    }
+
+    rows[i]["path"] = targets[i].first;
+    rows[i]["directory"] = targets[i].second;
+    if (mask != 0) {
+      // The file content does not need to be read if no hash is used.
+      pending.push_back(i);
+    }
+  }
+
+  // Reading and hashing file content is independent for each file.
+  // Files are not hashed after the query's budget is spent.
+  std::vector<char> hashed(pending.size(), 0);
+  parallelFor(pending.size(), context.concurrency, ([&](size_t i) {
+                auto& r = rows[pending[i]];
+                hashed[i] = 1;
+                auto hashes = hashMultiFromFile(mask, r["path"]);
+                if (mask & HASH_TYPE_MD5) {
+                  r["md5"] = std::move(hashes.md5);
+                }
+                if (mask & HASH_TYPE_SHA1) {
+                  r["sha1"] = std::move(hashes.sha1);
+                }
+                if (mask & HASH_TYPE_SHA256) {
+                  r["sha256"] = std::move(hashes.sha256);
+                }
+              }));
+
+  for (size_t i = 0; i < pending.size(); i++) {
+    if (hashed[i] != 0) {
+      const auto& target = targets[pending[i]].first;
+      context.setCache(target + ":" + std::to_string(mask), rows[pending[i]]);
+    }
+  }
 
-    r["path"] = path;
-    r["directory"] = dir;
-    r["md5"] = std::move(hashes.md5);
-    r["sha1"] = std::move(hashes.sha1);
-    r["sha256"] = std::move(hashes.sha256);
-    context.setCache(path, r);
+  for (auto& r : rows) {
+    results.push_back(std::move(r));
   }
-  results.push_back(r);
+}
+
+QueryData genOsqueryHashCache(QueryContext& context) {
+  auto stats = getHashCacheStats();
+
+  Row r;
+  r["entries"] = BIGINT(stats.entries);
+  r["max_entries"] = BIGINT(FLAGS_hash_cache_max);
+  r["hits"] = BIGINT(stats.hits);
+  r["misses"] = BIGINT(stats.misses);
+  r["evictions"] = BIGINT(stats.evictions);
+  return {r};
 }
 
 QueryData genHash(QueryContext& context) {
@@ -176,6 +486,10 @@ QueryData genHash(QueryContext& context) {
   // The query must provide a predicate with constraints including path or
   // directory. We search for the parsed predicate constraints with the equals
   // operator.
+  // Recursive patterns skip the subtrees the path constraints do not admit.
+  auto path_filter = [&context](const std::string& directory) {
+    return context.constraints["path"].admitsPrefix(directory);
+  };
   auto paths = context.constraints["path"].getAll(EQUALS);
   context.expandConstraints(
       "path",
@@ -183,8 +497,8 @@ QueryData genHash(QueryContext& context) {
       paths,
       ([&](const std::string& pattern, std::set<std::string>& out) {
         std::vector<std::string> patterns;
-        auto status =
-            resolveFilePattern(pattern, patterns, GLOB_ALL | GLOB_NO_CANON);
+        auto status = resolveFilePattern(
+            pattern, patterns, GLOB_ALL | GLOB_NO_CANON, path_filter);
         if (status.ok()) {
           for (const auto& resolved : patterns) {
             out.insert(resolved);
@@ -193,17 +507,33 @@ QueryData genHash(QueryContext& context) {
         return status;
       }));
 
-  // Iterate through the file paths, adding the hash results
+  // Iterate through the file paths, collecting the files to hash.
+  // Files beyond the query's result limits are not hashed.
+  std::vector<HashTarget> targets;
+  auto add_target = [&context, &targets](const std::string& path,
+                                         const std::string& directory) {
+    if (!context.admit({{"path", path}, {"directory", directory}})) {
+      return false;
+    }
+    targets.push_back(std::make_pair(path, directory));
+    return true;
+  };
+
   for (const auto& path_string : paths) {
     boost::filesystem::path path = path_string;
     if (!boost::filesystem::is_regular_file(path, ec)) {
       continue;
     }
 
-    genHashForFile(path_string, path.parent_path().string(), context, results);
+    if (!add_target(path_string, path.parent_path().string())) {
+      break;
+    }
   }
 
   // Now loop through constraints using the directory column constraint.
+  auto directory_filter = [&context](const std::string& directory) {
+    return context.constraints["directory"].admitsPrefix(directory);
+  };
   auto directories = context.constraints["directory"].getAll(EQUALS);
   context.expandConstraints(
       "directory",
@@ -211,8 +541,8 @@ QueryData genHash(QueryContext& context) {
       directories,
       ([&](const std::string& pattern, std::set<std::string>& out) {
         std::vector<std::string> patterns;
-        auto status =
-            resolveFilePattern(pattern, patterns, GLOB_FOLDERS | GLOB_NO_CANON);
+        auto status = resolveFilePattern(
+            pattern, patterns, GLOB_FOLDERS | GLOB_NO_CANON, directory_filter);
         if (status.ok()) {
           for (const auto& resolved : patterns) {
             out.insert(resolved);
@@ -223,6 +553,10 @@ QueryData genHash(QueryContext& context) {
 
   // Iterate over the directory paths
   for (const auto& directory_string : directories) {
+    if (context.truncated()) {
+      break;
+    }
+
     boost::filesystem::path directory = directory_string;
     if (!boost::filesystem::is_directory(directory, ec)) {
       continue;
@@ -231,14 +565,15 @@ QueryData genHash(QueryContext& context) {
     // Iterate over the directory files and generate a hash for each regular
     // file.
     boost::filesystem::directory_iterator begin(directory), end;
-    for (; begin != end; ++begin) {
-      if (boost::filesystem::is_regular_file(begin->path(), ec)) {
-        genHashForFile(
-            begin->path().string(), directory_string, context, results);
+    for (; begin != end && !QueryBudget::interrupted(); ++begin) {
+      if (boost::filesystem::is_regular_file(begin->path(), ec) &&
+          !add_target(begin->path().string(), directory_string)) {
+        break;
       }
     }
   }
 
+  genHashForFiles(targets, context, results);
   return results;
 }
 }
@@ -120,6 +120,30 @@ std::string hashFromFile(HashType hash_type, const std::string& path);
  */
 MultiHashes hashMultiFromFile(int mask, const std::string& path);
 
+/**
+ * @brief Counters describing the persistent file hash cache.
+ *
+ * hashMultiFromFile consults a cache in the backing store before reading a
+ * file. Entries are keyed by path and are valid while the file's inode,
+ * device, size, mtime, and ctime are unchanged.
+ */
+struct HashCacheStats {
+  /// The approximate number of cached files.
+  size_t entries{0};
+
+  /// Number of files hashed without reading content.
+  size_t hits{0};
+
+  /// Number of files read and hashed.
+  size_t misses{0};
+
+  /// Number of least-recently used entries removed.
+  size_t evictions{0};
+};
+
+/// Inspect the persistent file hash cache.
+HashCacheStats getHashCacheStats();
+
 /**
  * @brief Compute a hash digest from the contents of a buffer.
  *
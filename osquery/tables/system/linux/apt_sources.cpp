@@ -21,6 +21,7 @@
 #define DEBUG
 #endif
 
+#include <osquery/filesystem.h>
 #include <osquery/system.h>
 #include <osquery/tables.h>
 
@@ -77,6 +78,19 @@ void extractAptSourceInfo(pkgCache::PkgFileIterator src,
   results.push_back(r);
 }
 
+std::string genAptSrcsGeneration() {
+  if (getEnvVar("APT_CONFIG").is_initialized()) {
+    // The sources may be read from any configured paths.
+    return "";
+  }
+
+  // The sources lists, and the package cache built when they are updated.
+  return getPathsIdentity({"/etc/apt/sources.list",
+                           "/etc/apt/sources.list.d",
+                           "/var/lib/apt/lists",
+                           "/var/cache/apt/pkgcache.bin"});
+}
+
 QueryData genAptSrcs(QueryContext& context) {
   QueryData results;
 
@@ -8,180 +8,221 @@
 *
 */
 
-// see README.api of libdpkg-dev
-#define LIBDPKG_VOLATILE_API
-
-extern "C" {
-#include <dpkg/dpkg-db.h>
-#include <dpkg/dpkg.h>
-#include <dpkg/pkg-array.h>
-#include <dpkg/parsedump.h>
-}
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
 
-#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 #include <osquery/tables.h>
 
+namespace fs = boost::filesystem;
+
 namespace osquery {
 namespace tables {
 
 static const std::string kDPKGPath{"/var/lib/dpkg"};
 
-/// A comparator used to sort the packages array.
-int pkg_sorter(const void *a, const void *b) {
-  const struct pkginfo *pa = *(const struct pkginfo **)a;
-  const struct pkginfo *pb = *(const struct pkginfo **)b;
-  const char *arch_a = pa->installed.arch->name;
-  const char *arch_b = pb->installed.arch->name;
+/// The installed package database, in the dpkg control file format.
+static const std::string kDPKGStatusPath{kDPKGPath + "/status"};
 
-  int res = strcmp(pa->set->name, pb->set->name);
-  if (res != 0) {
-    return res;
-  }
+/// Updates written by an interrupted or in-progress dpkg transaction.
+static const std::string kDPKGUpdatesPath{kDPKGPath + "/updates"};
 
-  if (pa->installed.arch == pb->installed.arch) {
-    return 0;
-  }
+/// Packages by name and architecture, sorted like dpkg's own listings.
+using DebPackageMap = std::map<std::pair<std::string, std::string>, Row>;
 
-  return strcmp(arch_a, arch_b);
-}
+/// Protect the parsed packages.
+static Mutex kDebPackagesMutex;
 
-/**
- * @brief A field extractor to fetch the revision of a package.
- *
- * dpkg tracks the revision as part of version, but we need to provide our own
- * fwritefunction for fieldinfos to extract it.
- */
-void w_revision(struct varbuf *vb,
-                const struct pkginfo *pkg,
-                const struct pkgbin *pkgbin,
-                enum fwriteflags flags,
-                const struct fieldinfo *fip) {
-  if (flags & fw_printheader) {
-    varbuf_add_str(vb, "Revision: ");
+/// The status and updates identity the packages were parsed at.
+static std::string kDebPackagesIdentity;
+
+/// The parsed packages, rows are copied to each query's results.
+static QueryData kDebPackages;
+
+const std::map<std::string, std::string> kFieldMappings = {
+    {"Package", "name"},
+    {"Version", "version"},
+    {"Installed-Size", "size"},
+    {"Architecture", "arch"},
+    {"Source", "source"},
+};
+
+/// Remove leading and trailing whitespace from a field value.
+static boost::string_ref trimDebField(boost::string_ref value) {
+  while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+    value.remove_prefix(1);
   }
-  varbuf_add_str(vb, pkgbin->version.revision);
-  if (flags & fw_printheader) {
-    varbuf_add_char(vb, '\n');
+  while (!value.empty() && (value.back() == ' ' || value.back() == '\t' ||
+                            value.back() == '\r')) {
+    value.remove_suffix(1);
   }
+  return value;
 }
 
-/**
-* @brief Initialize dpkg and load packages into memory
-*/
-void dpkg_setup(struct pkg_array *packages) {
-  dpkg_set_progname("osquery");
-  push_error_context();
+/// Add a parsed paragraph, replacing a previous paragraph of the package.
+static void addDebParagraph(Row &r, bool installed, DebPackageMap &packages) {
+  if (r.count("name") == 0) {
+    r.clear();
+    return;
+  }
 
-  dpkg_db_set_dir("/var/lib/dpkg/");
-  modstatdb_init();
-  modstatdb_open(msdbrw_readonly);
+  auto key = std::make_pair(r["name"], r["arch"]);
+  if (!installed) {
+    // A later paragraph may remove the package.
+    packages.erase(key);
+    r.clear();
+    return;
+  }
 
-  pkg_array_init_from_db(packages);
-  pkg_array_sort(packages, pkg_sorter);
+  // The revision is the version's suffix after the last hyphen.
+  const auto &version = r["version"];
+  auto hyphen = version.rfind('-');
+  r["revision"] =
+      (hyphen == std::string::npos) ? "" : version.substr(hyphen + 1);
+  if (r["arch"].empty()) {
+    r.erase("arch");
+  }
+
+  packages[key] = std::move(r);
+  r.clear();
 }
 
 /**
-* @brief Clean up after dpkg operations
-*/
-void dpkg_teardown(struct pkg_array *packages) {
-  pkg_array_destroy(packages);
+ * @brief Parse the paragraphs of a dpkg status or update file.
+ *
+ * Each paragraph is a set of "Field: value" lines ending at a blank line.
+ * Continuation lines, such as a multi-line Description, start with a space
+ * and are skipped. Only packages with a Status other than not-installed are
+ * kept, a later paragraph for the same package and architecture replaces an
+ * earlier one.
+ */
+void parseDpkgStatus(const char *data, size_t size, DebPackageMap &packages) {
+  boost::string_ref content(data, size);
+  Row r;
+  bool installed = false;
+  while (!content.empty()) {
+    auto end = content.find('\n');
+    auto line = content.substr(0, end);
+    content.remove_prefix((end == boost::string_ref::npos) ? content.size()
+                                                           : end + 1);
+
+    if (trimDebField(line).empty()) {
+      addDebParagraph(r, installed, packages);
+      installed = false;
+      continue;
+    }
+
+    if (line.front() == ' ' || line.front() == '\t') {
+      continue;
+    }
+
+    auto separator = line.find(':');
+    if (separator == boost::string_ref::npos) {
+      continue;
+    }
 
-  pkg_db_reset();
-  modstatdb_done();
+    auto field = line.substr(0, separator).to_string();
+    auto value = trimDebField(line.substr(separator + 1));
+    if (field == "Status") {
+      // The status is the last of the want, flag, and status words.
+      auto space = value.rfind(' ');
+      auto status = (space == boost::string_ref::npos)
+                        ? value
+                        : value.substr(space + 1);
+      installed = (status != "not-installed");
+      continue;
+    }
 
-  pop_error_context(ehflag_normaltidy);
+    auto mapping = kFieldMappings.find(field);
+    if (mapping != kFieldMappings.end()) {
+      r[mapping->second] = value.to_string();
+    }
+  }
+  addDebParagraph(r, installed, packages);
 }
 
-const std::map<std::string, std::string> kFieldMappings = {
-    {"Package", "name"},
-    {"Version", "version"},
-    {"Installed-Size", "size"},
-    {"Architecture", "arch"},
-    {"Source", "source"},
-    {"Revision", "revision"}};
+/// Parse a file, mapping it into memory when --read_mmap is enabled.
+static void parseDpkgFile(const std::string &path, DebPackageMap &packages) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0 || file_stat.st_size == 0) {
+    return;
+  }
 
-/**
-* @brief Field names and function references to extract information.
-*
-* These are taken from lib/dpkg/parse.c, with a slight modification to
-* add an fwritefunction for Revision. Additional fields can be taken
-* as needed.
-*/
-const struct fieldinfo fieldinfos[] = {
-    {FIELD("Package"), f_name, w_name, 0},
-    {FIELD("Installed-Size"),
-     f_charfield,
-     w_charfield,
-     PKGIFPOFF(installedsize)},
-    {FIELD("Architecture"), f_architecture, w_architecture, 0},
-    {FIELD("Source"), f_charfield, w_charfield, PKGIFPOFF(source)},
-    {FIELD("Version"), f_version, w_version, PKGIFPOFF(version)},
-    {FIELD("Revision"), f_revision, w_revision, 0},
-    {}};
-
-void extractDebPackageInfo(const struct pkginfo *pkg, QueryData &results) {
-  Row r;
+  // A single block holds the whole file, paragraphs are not split.
+  auto block_size = static_cast<size_t>(file_stat.st_size);
+  readFileBlocks(path, block_size, false, ([&packages](const char *buffer,
+                                                       size_t size) {
+    parseDpkgStatus(buffer, size, packages);
+  }));
+}
 
-  struct varbuf vb;
-  varbuf_init(&vb, 20);
-
-  // Iterate over the desired fieldinfos, calling their fwritefunctions
-  // to extract the package's information.
-  const struct fieldinfo *fip = nullptr;
-  for (fip = fieldinfos; fip->name; fip++) {
-    fip->wcall(&vb, pkg, &pkg->installed, fw_printheader, fip);
-
-    std::string line = vb.string();
-    if (!line.empty()) {
-      size_t separator_position = line.find(':');
-
-      std::string key = line.substr(0, separator_position);
-      std::string value = line.substr(separator_position + 1, line.length());
-      auto it = kFieldMappings.find(key);
-      if (it != kFieldMappings.end()) {
-        boost::algorithm::trim(value);
-        r[it->second] = std::move(value);
-      }
+/**
+ * @brief Parse the installed packages from the dpkg database.
+ *
+ * The status file is parsed first, then pending updates in their numeric
+ * order, as dpkg applies the update journal over the status file.
+ */
+static QueryData parseDpkgDatabase() {
+  DebPackageMap packages;
+  parseDpkgFile(kDPKGStatusPath, packages);
+
+  std::vector<std::string> updates;
+  listFilesInDirectory(kDPKGUpdatesPath, updates);
+  std::vector<std::pair<unsigned long long, std::string>> journal;
+  for (const auto &update : updates) {
+    auto name = fs::path(update).filename().string();
+    if (!name.empty() &&
+        std::all_of(name.begin(), name.end(), [](char c) {
+          return c >= '0' && c <= '9';
+        })) {
+      journal.push_back(std::make_pair(std::stoull(name), update));
     }
-    varbuf_reset(&vb);
   }
-  varbuf_destroy(&vb);
 
-  results.push_back(r);
-}
+  std::sort(journal.begin(), journal.end());
+  for (const auto &update : journal) {
+    parseDpkgFile(update.second, packages);
+  }
 
-QueryData genDebPackages(QueryContext &context) {
   QueryData results;
+  results.reserve(packages.size());
+  for (auto &package : packages) {
+    results.push_back(std::move(package.second));
+  }
+  return results;
+}
 
+/// The identity of the package database, it changes with every transaction.
+std::string genDebPackagesGeneration() {
+  return getPathsIdentity({kDPKGStatusPath, kDPKGUpdatesPath});
+}
+
+QueryData genDebPackages(QueryContext &context) {
   if (!osquery::isDirectory(kDPKGPath)) {
     TLOG << "Cannot find DPKG database: " << kDPKGPath;
-    return results;
+    return {};
   }
 
   auto dropper = DropPrivileges::get();
   dropper->dropTo("nobody");
 
-  struct pkg_array packages;
-  dpkg_setup(&packages);
-
-  for (int i = 0; i < packages.n_pkgs; i++) {
-    struct pkginfo *pkg = packages.pkgs[i];
-    // Casted to int to allow the older enums that were embeded in the packages
-    // struct to be compared
-    if (static_cast<int>(pkg->status) ==
-        static_cast<int>(PKG_STAT_NOTINSTALLED)) {
-      continue;
-    }
-
-    extractDebPackageInfo(pkg, results);
+  // An unchanged database is not parsed again.
+  auto identity = genDebPackagesGeneration();
+  WriteLock lock(kDebPackagesMutex);
+  if (identity.empty() || identity != kDebPackagesIdentity) {
+    kDebPackages = parseDpkgDatabase();
+    kDebPackagesIdentity = identity;
   }
-
-  dpkg_teardown(&packages);
-  return results;
+  return kDebPackages;
 }
 }
 }
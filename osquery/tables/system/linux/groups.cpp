@@ -8,39 +8,42 @@
  *
  */
 
-#include <mutex>
-#include <set>
-
-#include <grp.h>
-
 #include <osquery/core.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/tables/system/posix/account_cache.h"
+
 namespace osquery {
 namespace tables {
 
-Mutex grpEnumerationMutex;
+void genGroup(const GroupEntry& group, QueryData& results) {
+  Row r;
+  r["gid"] = INTEGER(group.gid);
+  r["gid_signed"] = INTEGER((int32_t)group.gid);
+  r["groupname"] = TEXT(group.groupname);
+  results.push_back(r);
+}
 
 QueryData genGroups(QueryContext& context) {
   QueryData results;
-  struct group* grp = nullptr;
-  std::set<long> groups_in;
 
-  WriteLock lock(grpEnumerationMutex);
-  setgrent();
-  while ((grp = getgrent()) != nullptr) {
-    if (std::find(groups_in.begin(), groups_in.end(), grp->gr_gid) ==
-        groups_in.end()) {
-      Row r;
-      r["gid"] = INTEGER(grp->gr_gid);
-      r["gid_signed"] = INTEGER((int32_t)grp->gr_gid);
-      r["groupname"] = TEXT(grp->gr_name);
-      results.push_back(r);
-      groups_in.insert(grp->gr_gid);
+  if (context.constraints["gid"].exists(EQUALS)) {
+    auto gids = context.constraints["gid"].getAll(EQUALS);
+    for (const auto& gid : gids) {
+      long agid{0};
+      GroupEntry group;
+      if (safeStrtol(gid, 10, agid) && AccountCache::getGroup(agid, group)) {
+        genGroup(group, results);
+      }
+    }
+  } else {
+    std::vector<GroupEntry> groups;
+    AccountCache::getGroups(groups);
+    for (const auto& group : groups) {
+      genGroup(group, results);
     }
   }
-  endgrent();
-  groups_in.clear();
 
   return results;
 }
@@ -8,16 +8,33 @@
 #include <osquery/core.h>
 #include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/linux/kernel_modules.h"
+
 namespace osquery {
 namespace tables {
 
+FLAG(uint64,
+     kernel_integrity_max_age,
+     3600,
+     "Seconds to cache kernel_integrity results without kernel changes");
+
 const std::string kKernelSyscallAddrModifiedPath = "/sys/kernel/camb/syscall_addr_modified";
 const std::string kKernelTextHashPath = "/sys/kernel/camb/text_segment_hash";
 
-QueryData genKernelIntegrity(QueryContext &context) {
+/// Protect the cached integrity checks.
+static Mutex kKernelIntegrityMutex;
+
+/// The kernel generation the integrity was checked at.
+static std::string kKernelIntegrityIdentity;
+
+/// The cached check results.
+static QueryData kKernelIntegrity;
+
+static QueryData checkKernelIntegrity() {
   QueryData results;
   Row r;
   std::string content;
@@ -50,5 +67,27 @@ QueryData genKernelIntegrity(QueryContext &context) {
 
   return results;
 }
+
+std::string genKernelIntegrityGeneration() {
+  auto generation = KernelChanges::generation();
+  if (generation.empty() || FLAGS_kernel_integrity_max_age == 0) {
+    return generation;
+  }
+
+  // The checks are repeated at least this often, without module changes.
+  return generation + ":" +
+         std::to_string(getUnixTime() / FLAGS_kernel_integrity_max_age);
+}
+
+QueryData genKernelIntegrity(QueryContext &context) {
+  // Hashing the kernel text is expensive, only repeat it after changes.
+  auto identity = genKernelIntegrityGeneration();
+  WriteLock lock(kKernelIntegrityMutex);
+  if (identity.empty() || identity != kKernelIntegrityIdentity) {
+    kKernelIntegrity = checkKernelIntegrity();
+    kKernelIntegrityIdentity = identity;
+  }
+  return kKernelIntegrity;
+}
 }
 }
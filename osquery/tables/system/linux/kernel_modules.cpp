@@ -14,17 +14,86 @@
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/linux/kernel_modules.h"
 
 namespace osquery {
 namespace tables {
 
+FLAG(bool,
+     kernel_table_cache,
+     true,
+     "Cache kernel module and integrity rows, updated from udev events");
+
 static const std::string kKernelModulePath = "/proc/modules";
 
-QueryData genKernelModules(QueryContext& context) {
+/// Set by a module load or unload, and any taint, such as an unsigned module.
+static const std::string kKernelTaintedPath = "/proc/sys/kernel/tainted";
+
+/// Protect the change counter and watching state.
+static Mutex kKernelChangesMutex;
+
+/// Incremented for each module event, and when watching starts or stops.
+static size_t kKernelChanges{0};
+static bool kKernelWatching{false};
+static std::function<bool()> kKernelRunning;
+
+/// Protect the parsed modules.
+static Mutex kKernelModulesMutex;
+
+/// The kernel generation the modules were parsed at.
+static std::string kKernelModulesIdentity;
+
+/// The parsed modules, rows are copied to each query's results.
+static QueryData kKernelModules;
+
+void KernelChanges::changed() {
+  WriteLock lock(kKernelChangesMutex);
+  kKernelChanges++;
+}
+
+void KernelChanges::setWatching(bool watching) {
+  WriteLock lock(kKernelChangesMutex);
+  kKernelWatching = watching;
+  kKernelChanges++;
+}
+
+void KernelChanges::setRunning(std::function<bool()> running) {
+  WriteLock lock(kKernelChangesMutex);
+  kKernelRunning = std::move(running);
+}
+
+std::string KernelChanges::generation() {
+  size_t changes = 0;
+  std::function<bool()> running;
+  {
+    WriteLock lock(kKernelChangesMutex);
+    if (!kKernelWatching || !FLAGS_kernel_table_cache) {
+      return "";
+    }
+    changes = kKernelChanges;
+    running = kKernelRunning;
+  }
+
+  // Module events are missed once the publisher's run loop ends.
+  if (running != nullptr && !running()) {
+    return "";
+  }
+
+  // Taint is not reported by udev, but is cheap to read.
+  std::string tainted;
+  if (!readFile(kKernelTaintedPath, tainted).ok()) {
+    tainted.clear();
+  }
+  boost::trim(tainted);
+  return std::to_string(changes) + ":" + tainted;
+}
+
+static QueryData parseKernelModules() {
   QueryData results;
 
   if (!pathExists(kKernelModulePath).ok()) {
@@ -68,5 +137,20 @@ QueryData genKernelModules(QueryContext& context) {
 
   return results;
 }
+
+std::string genKernelModulesGeneration() {
+  return KernelChanges::generation();
+}
+
+QueryData genKernelModules(QueryContext& context) {
+  // Modules are not parsed again until the kernel reports a change.
+  auto identity = genKernelModulesGeneration();
+  WriteLock lock(kKernelModulesMutex);
+  if (identity.empty() || identity != kKernelModulesIdentity) {
+    kKernelModules = parseKernelModules();
+    kKernelModulesIdentity = identity;
+  }
+  return kKernelModules;
+}
 }
 }
@@ -0,0 +1,48 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+namespace osquery {
+namespace tables {
+
+/**
+ * @brief Track changes to the loaded kernel modules and kernel taint.
+ *
+ * The kernel_modules table parses `/proc/modules` and kernel_integrity asks
+ * the kernel to hash its text segment and check the syscall table. When the
+ * udev event publisher is running, the kernel_module_changes subscriber
+ * reports each module loaded or removed. The tables then keep their rows
+ * until a module changes or the kernel's taint flags change.
+ */
+class KernelChanges {
+ public:
+  /// Record that a kernel module was loaded or removed.
+  static void changed();
+
+  /// Set when module events are received, until then rows are not cached.
+  static void setWatching(bool watching);
+
+  /// Set a check of the events' source, rows are not cached while it fails.
+  static void setRunning(std::function<bool()> running);
+
+  /**
+   * @brief An identity of the kernel's modules and taint.
+   *
+   * This is empty when module events are not received, or the cache is
+   * disabled with `--kernel_table_cache=false`.
+   */
+  static std::string generation();
+};
+}
+}
@@ -14,6 +14,10 @@
 #include <stdio.h>
 #include <unistd.h>
 
+#include <set>
+#include <string>
+#include <vector>
+
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
@@ -93,7 +97,9 @@ const static msr_record_t fields[] = {
      .mask = NO_MASK,
      .is_flag = false}};
 
-void getModelSpecificRegisterData(QueryData &results, int cpu_number) {
+/// Read the used registers of a CPU, false if the msr device cannot be read.
+static bool getModelSpecificRegisterData(
+    const std::vector<const msr_record_t *> &records, int cpu_number, Row &r) {
   auto msr_filename =
     std::string("/dev/cpu/") + std::to_string(cpu_number) + "/msr";
 
@@ -105,28 +111,25 @@ void getModelSpecificRegisterData(QueryData &results, int cpu_number) {
     if (err == EACCES) {
       TLOG << "Could not access msr device.  Run osquery as root.";
     }
-    return;
+    return false;
   }
 
-  Row r;
   r["processor_number"] = BIGINT(cpu_number);
-  for (const msr_record_t &field : fields) {
+  for (const auto &field : records) {
     uint64_t output;
-    ssize_t size = pread(fd, &output, sizeof(uint64_t), field.offset);
+    ssize_t size = pread(fd, &output, sizeof(uint64_t), field->offset);
     if (size != sizeof(uint64_t)) {
       // Processor does not have a record of this type.
       continue;
     }
-    if (field.is_flag) {
-      r[field.name] = BIGINT((output & field.mask) ? 1 : 0);
+    if (field->is_flag) {
+      r[field->name] = BIGINT((output & field->mask) ? 1 : 0);
     } else {
-      r[field.name] = BIGINT(output & field.mask);
+      r[field->name] = BIGINT(output & field->mask);
     }
   }
-  results.push_back(r);
   close(fd);
-
-  return;
+  return true;
 }
 
 // Filter only for filenames starting with a digit.
@@ -147,12 +150,45 @@ QueryData genModelSpecificRegister(QueryContext &context) {
     TLOG << "No msr information check msr kernel module is enabled.";
     return results;
   }
+
+  // Only the requested processors are read.
+  std::set<std::string> processors;
+  auto constrained = context.constraints["processor_number"].exists(EQUALS);
+  if (constrained) {
+    processors = context.constraints["processor_number"].getAll(EQUALS);
+  }
+
+  std::vector<int> cpus;
   while (num_entries--) {
-    getModelSpecificRegisterData(results, atoi(entries[num_entries]->d_name));
+    std::string name = entries[num_entries]->d_name;
+    if (!constrained || processors.count(name) > 0) {
+      cpus.push_back(atoi(name.c_str()));
+    }
     free(entries[num_entries]);
   }
   free(entries);
 
+  // Each read is a cross-CPU call, skip the registers that are not used.
+  std::vector<const msr_record_t *> records;
+  for (const msr_record_t &field : fields) {
+    if (context.isColumnUsed(field.name)) {
+      records.push_back(&field);
+    }
+  }
+
+  // The reads of every CPU's device are independent.
+  std::vector<Row> rows(cpus.size());
+  std::vector<char> opened(cpus.size(), 0);
+  parallelFor(cpus.size(), context.concurrency, ([&](size_t i) {
+                opened[i] =
+                    getModelSpecificRegisterData(records, cpus[i], rows[i]);
+              }));
+
+  for (size_t i = 0; i < cpus.size(); i++) {
+    if (opened[i] != 0) {
+      results.push_back(std::move(rows[i]));
+    }
+  }
   return results;
 }
 }
@@ -9,12 +9,13 @@
  */
 
 #include <mntent.h>
-#include <sys/vfs.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/posix/mount_stats.h"
+
 namespace osquery {
 namespace tables {
 
@@ -26,6 +27,7 @@ QueryData genMounts(QueryContext &context) {
     return {};
   }
 
+  std::vector<std::string> paths;
   char real_path[PATH_MAX + 1] = {0};
   struct mntent *ent = nullptr;
   while ((ent = getmntent(mounts))) {
@@ -38,20 +40,21 @@ QueryData genMounts(QueryContext &context) {
     r["type"] = std::string(ent->mnt_type);
     r["flags"] = std::string(ent->mnt_opts);
 
-    struct statfs st;
-    if (!statfs(ent->mnt_dir, &st)) {
-      r["blocks_size"] = BIGINT(st.f_bsize);
-      r["blocks"] = BIGINT(st.f_blocks);
-      r["blocks_free"] = BIGINT(st.f_bfree);
-      r["blocks_available"] = BIGINT(st.f_bavail);
-      r["inodes"] = BIGINT(st.f_files);
-      r["inodes_free"] = BIGINT(st.f_ffree);
-    }
-
+    paths.push_back(r["path"]);
     results.push_back(std::move(r));
   }
   endmntent(mounts);
 
+  // A hung mount point has no capacity rather than blocking the query.
+  std::map<std::string, MountCapacity> capacities;
+  MountStats::get(paths, capacities);
+  for (auto& r : results) {
+    auto capacity = capacities.find(r["path"]);
+    if (capacity != capacities.end()) {
+      MountStats::fill(capacity->second, r);
+    }
+  }
+
   return results;
 }
 }
@@ -24,6 +24,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/file_cache.h"
 
 namespace osquery {
 namespace tables {
@@ -281,6 +282,11 @@ QueryData parsePortageUseContent(const std::vector<std::string>& pkg_paths) {
 }
 
 /* Functions refered from tables */
+std::string genPortagePackagesGeneration() {
+  // Portage updates the package database's modification time when merging.
+  return getPathsIdentity({kPortagePackageDir, kPortageWorld});
+}
+
 QueryData portagePackages(QueryContext& context) {
   std::string content_use;
   std::vector<std::string> pkg_paths;
@@ -305,19 +311,26 @@ QueryData genPortageUse(QueryContext& context) {
   }
 }
 
-QueryData genPortageKeywordSummary(QueryContext& context) {
-  std::string keywords;
-  std::string masked;
-  std::string unmasked;
-  readFile(kPortageKeywords, keywords);
-  readFile(kPortageMask, masked);
-  readFile(kPortageUnMask, unmasked);
-
+/// Parse the keywords, mask, and unmask files.
+static QueryData parsePortageKeywordFiles(
+    const std::vector<std::string>& contents) {
+  const auto& keywords = contents[0];
+  const auto& masked = contents[1];
+  const auto& unmasked = contents[2];
   if (!keywords.empty() || !masked.empty() || unmasked.empty()) {
     return parsePortageKeywordSummaryContent(keywords, masked, unmasked);
   } else {
     return {};
   }
 }
+
+QueryData genPortageKeywordSummary(QueryContext& context) {
+  QueryData results;
+  ParsedFileCache::instance().read(
+      {kPortageKeywords, kPortageMask, kPortageUnMask},
+      parsePortageKeywordFiles,
+      results);
+  return results;
+}
 }
 }
@@ -13,6 +13,8 @@
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 
+#include "osquery/filesystem/linux/proc.h"
+
 namespace osquery {
 namespace tables {
 
@@ -40,16 +42,17 @@ void genDescriptors(const std::string& process,
 QueryData genOpenFiles(QueryContext& context) {
   QueryData results;
 
+  auto proc = ProcSnapshot::get(context);
   std::set<std::string> pids;
   if (context.constraints["pid"].exists(EQUALS)) {
     pids = context.constraints["pid"].getAll(EQUALS);
   } else {
-    osquery::procProcesses(pids);
+    proc->processes(pids);
   }
 
   for (const auto& process : pids) {
     std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
+    if (proc->descriptors(process, descriptors).ok()) {
       genDescriptors(process, descriptors, results);
     }
   }
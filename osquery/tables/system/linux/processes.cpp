@@ -8,9 +8,13 @@
  *
  */
 
+#include <algorithm>
+#include <climits>
+#include <functional>
 #include <map>
 #include <string>
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -19,6 +23,7 @@
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/regex.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
@@ -26,6 +31,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/linux/proc.h"
 
 namespace osquery {
 namespace tables {
@@ -35,11 +41,201 @@ inline std::string getProcAttr(const std::string& attr,
   return "/proc/" + pid + "/" + attr;
 }
 
-inline std::string readProcCMDLine(const std::string& pid) {
-  auto attr = getProcAttr("cmdline", pid);
+/// The size of the buffers used to read /proc/<pid>/stat and status.
+const size_t kProcBufferSize = 4096;
 
+/**
+ * @brief A /proc/<pid> directory, its files are opened relative to it.
+ *
+ * Opening each file relative to the directory avoids resolving the full path
+ * for every file, and every file read belongs to the same process even if
+ * the pid is reused while it is read.
+ */
+class ProcDirectory : private boost::noncopyable {
+ public:
+  explicit ProcDirectory(const std::string& pid) : pid_(pid) {
+    auto path = getProcAttr("", pid);
+    fd_ = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+
+  ~ProcDirectory() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  /// The process exited or the directory could not be opened.
+  bool valid() const {
+    return fd_ >= 0;
+  }
+
+  const std::string& pid() const {
+    return pid_;
+  }
+
+  /**
+   * @brief Read a file into a fixed buffer.
+   *
+   * @return The bytes read, which fill the buffer if the file is larger, or
+   *   -1 if the file could not be read.
+   */
+  ssize_t read(const char* name, char* buffer, size_t size) const;
+
+  /// Read a file of any size.
+  bool read(const char* name, std::string& content) const;
+
+  /**
+   * @brief Read a file of any size, a line at a time, using a fixed buffer.
+   *
+   * Lines are passed without their newline and reference the buffer, only a
+   * line spanning two reads is copied.
+   */
+  bool readLines(const char* name,
+                 const std::function<void(boost::string_ref)>& predicate) const;
+
+  /// Read a symlink, such as exe or cwd.
+  std::string link(const char* name) const;
+
+ private:
+  std::string pid_;
+
+  /// The directory descriptor, or -1.
+  int fd_{-1};
+};
+
+ssize_t ProcDirectory::read(const char* name, char* buffer, size_t size) const {
+  auto fd = openat(fd_, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  // Files in /proc are generated and may return less than requested.
+  size_t total = 0;
+  while (total < size) {
+    auto bytes = pread(fd, buffer + total, size - total, total);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      break;
+    }
+    total += bytes;
+  }
+  close(fd);
+  return static_cast<ssize_t>(total);
+}
+
+bool ProcDirectory::read(const char* name, std::string& content) const {
+  char buffer[kProcBufferSize];
+  auto fd = openat(fd_, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  ssize_t bytes = 0;
+  while ((bytes = ::read(fd, buffer, sizeof(buffer))) != 0) {
+    if (bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    content.append(buffer, bytes);
+  }
+  close(fd);
+  return bytes == 0;
+}
+
+bool ProcDirectory::readLines(
+    const char* name,
+    const std::function<void(boost::string_ref)>& predicate) const {
+  char buffer[kProcBufferSize];
+  auto fd = openat(fd_, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  // The beginning of a line that did not end within the previous read.
+  std::string partial;
+  ssize_t bytes = 0;
+  while ((bytes = ::read(fd, buffer, sizeof(buffer))) != 0) {
+    if (bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    boost::string_ref content(buffer, bytes);
+    while (!content.empty()) {
+      auto end = content.find('\n');
+      if (end == boost::string_ref::npos) {
+        partial.append(content.data(), content.size());
+        break;
+      }
+
+      if (partial.empty()) {
+        predicate(content.substr(0, end));
+      } else {
+        partial.append(content.data(), end);
+        predicate(partial);
+        partial.clear();
+      }
+      content.remove_prefix(end + 1);
+    }
+  }
+  close(fd);
+
+  if (!partial.empty()) {
+    predicate(partial);
+  }
+  return bytes == 0;
+}
+
+std::string ProcDirectory::link(const char* name) const {
+  char link_path[PATH_MAX] = {0};
+  auto bytes = readlinkat(fd_, name, link_path, sizeof(link_path) - 1);
+  if (bytes < 0) {
+    return "";
+  }
+  return std::string(link_path, bytes);
+}
+
+/**
+ * @brief Split a buffer into fields without copying them.
+ *
+ * Repeated delimiters are treated as one, like osquery::split.
+ *
+ * @return The number of fields, at most max.
+ */
+static size_t splitProcFields(boost::string_ref content,
+                              char delim,
+                              boost::string_ref* fields,
+                              size_t max) {
+  size_t count = 0;
+  while (count < max && !content.empty()) {
+    auto end = std::min(content.find(delim), content.size());
+    if (end > 0) {
+      fields[count++] = content.substr(0, end);
+    }
+    content.remove_prefix(std::min(end + 1, content.size()));
+  }
+  return count;
+}
+
+/// Remove leading and trailing whitespace from a field.
+static boost::string_ref trimProcField(boost::string_ref field) {
+  while (!field.empty() && std::isspace(field.front())) {
+    field.remove_prefix(1);
+  }
+  while (!field.empty() && std::isspace(field.back())) {
+    field.remove_suffix(1);
+  }
+  return field;
+}
+
+inline std::string readProcCMDLine(const ProcDirectory& dir) {
   std::string content;
-  readFile(attr, content);
+  dir.read("cmdline", content);
   // Remove \0 delimiters.
   std::replace_if(content.begin(),
                   content.end(),
@@ -50,28 +246,15 @@ inline std::string readProcCMDLine(const std::string& pid) {
   return content;
 }
 
-inline std::string readProcLink(const std::string& attr,
-                                const std::string& pid) {
-  // The exe is a symlink to the binary on-disk.
-  auto attr_path = getProcAttr(attr, pid);
-
-  std::string result;
-  char link_path[PATH_MAX] = {0};
-  auto bytes = readlink(attr_path.c_str(), link_path, sizeof(link_path) - 1);
-  if (bytes >= 0) {
-    result = std::string(link_path);
-  }
-
-  return result;
-}
-
 // In the case where the linked binary path ends in " (deleted)", and a file
 // actually exists at that path, check whether the inode of that file matches
 // the inode of the mapped file in /proc/%pid/maps
-Status deletedMatchesInode(const std::string& path, const std::string& pid) {
+Status deletedMatchesInode(const std::string& path,
+                           const std::string& pid,
+                           ProcSnapshot& proc) {
   const std::string maps_path = getProcAttr("maps", pid);
   std::string maps_contents;
-  auto s = osquery::readFile(maps_path, maps_contents);
+  auto s = proc.read(pid, "maps", maps_contents);
   if (!s.ok()) {
     return Status(-1, "Cannot read maps file: " + maps_path);
   }
@@ -98,7 +281,8 @@ Status deletedMatchesInode(const std::string& path, const std::string& pid) {
   }
 }
 
-std::set<std::string> getProcList(const QueryContext& context) {
+std::set<std::string> getProcList(const QueryContext& context,
+                                  ProcSnapshot& proc) {
   std::set<std::string> pidlist;
   if (context.constraints.count("pid") > 0 &&
       context.constraints.at("pid").exists(EQUALS)) {
@@ -108,17 +292,21 @@ std::set<std::string> getProcList(const QueryContext& context) {
       }
     }
   } else {
-    osquery::procProcesses(pidlist);
+    proc.processes(pidlist);
   }
 
+  // Skip the pids filtered by ranges or other pid constraints.
+  for (auto it = pidlist.begin(); it != pidlist.end();) {
+    it = context.admits("pid", *it) ? std::next(it) : pidlist.erase(it);
+  }
   return pidlist;
 }
 
-void genProcessEnvironment(const std::string& pid, QueryData& results) {
-  auto attr = getProcAttr("environ", pid);
-
+void genProcessEnvironment(const std::string& pid,
+                           ProcSnapshot& proc,
+                           QueryData& results) {
   std::string content;
-  readFile(attr, content);
+  proc.read(pid, "environ", content);
   const char* variable = content.c_str();
 
   // Stop at the end of nul-delimited string content.
@@ -135,53 +323,120 @@ void genProcessEnvironment(const std::string& pid, QueryData& results) {
   }
 }
 
-void genProcessMap(const std::string& pid, QueryData& results) {
-  auto map = getProcAttr("maps", pid);
+/// The fields of a /proc/<pid>/maps line, referencing the line.
+struct ProcMapsEntry {
+  boost::string_ref start;
+  boost::string_ref end;
+  boost::string_ref permissions;
+  boost::string_ref device;
+  boost::string_ref inode;
+  boost::string_ref path;
+  unsigned long long offset{0};
+  bool offset_valid{false};
+};
 
-  std::string content;
-  readFile(map, content);
-  for (auto& line : osquery::split(content, "\n")) {
-    auto fields = osquery::split(line, " ");
-    // If can't read address, not sure.
-    if (fields.size() < 5) {
-      continue;
-    }
+/// Remove and return the next space-delimited field of a line.
+static boost::string_ref nextProcField(boost::string_ref& line) {
+  while (!line.empty() && line.front() == ' ') {
+    line.remove_prefix(1);
+  }
+  auto end = std::min(line.find(' '), line.size());
+  auto field = line.substr(0, end);
+  line.remove_prefix(end);
+  return field;
+}
 
-    Row r;
-    r["pid"] = pid;
-    if (!fields[0].empty()) {
-      auto addresses = osquery::split(fields[0], "-");
-      if (addresses.size() >= 2) {
-        r["start"] = "0x" + addresses[0];
-        r["end"] = "0x" + addresses[1];
-      } else {
-        // Problem with the address format.
-        continue;
-      }
+/// Parse a hex field, false if it is empty, invalid, or out of range.
+static bool parseProcHex(boost::string_ref field, unsigned long long& value) {
+  if (field.empty() || field.size() > 16) {
+    return false;
+  }
+
+  value = 0;
+  for (auto c : field) {
+    if (!std::isxdigit(c)) {
+      return false;
     }
+    value = (value << 4) |
+            static_cast<unsigned long long>(
+                std::isdigit(c) ? c - '0' : std::tolower(c) - 'a' + 10);
+  }
+  return true;
+}
 
-    r["permissions"] = fields[1];
-    try {
-      auto offset = std::stoll(fields[2], nullptr, 16);
-      r["offset"] = (offset != 0) ? BIGINT(offset) : r["start"];
+/**
+ * @brief Parse a line of /proc/<pid>/maps without copying its fields.
+ *
+ * The line is "start-end permissions offset device inode path", the path
+ * is optional and may include spaces.
+ */
+bool parseProcMapsLine(boost::string_ref line, ProcMapsEntry& entry) {
+  auto addresses = nextProcField(line);
+  entry.permissions = nextProcField(line);
+  auto offset = nextProcField(line);
+  entry.device = nextProcField(line);
+  entry.inode = nextProcField(line);
+  if (entry.inode.empty()) {
+    return false;
+  }
 
-    } catch (const std::exception& e) {
-      // Value was out of range or could not be interpreted as a hex long long.
-      r["offset"] = "-1";
+  auto separator = addresses.find('-');
+  if (separator == boost::string_ref::npos) {
+    // Problem with the address format.
+    return false;
+  }
+  entry.start = addresses.substr(0, separator);
+  entry.end = addresses.substr(separator + 1);
+
+  // Offsets above LLONG_MAX could not be interpreted as a hex long long.
+  entry.offset_valid =
+      parseProcHex(offset, entry.offset) &&
+      entry.offset <= static_cast<unsigned long long>(LLONG_MAX);
+
+  // Path name must be trimmed.
+  entry.path = trimProcField(line);
+  return true;
+}
+
+void genProcessMap(const std::string& pid,
+                   QueryContext& context,
+                   QueryData& results) {
+  ProcDirectory dir(pid);
+  if (!dir.valid()) {
+    return;
+  }
+
+  dir.readLines("maps", ([&pid, &context, &results](boost::string_ref line) {
+    ProcMapsEntry entry;
+    if (!parseProcMapsLine(line, entry)) {
+      return;
+    }
+
+    // Skip the row copies of mappings SQLite filters, such as other paths.
+    auto path = entry.path.to_string();
+    if (!context.admits("path", path)) {
+      return;
     }
-    r["device"] = fields[3];
-    r["inode"] = fields[4];
 
-    // Path name must be trimmed.
-    if (fields.size() > 5) {
-      boost::trim(fields[5]);
-      r["path"] = fields[5];
+    Row r;
+    r["pid"] = pid;
+    r["start"] = "0x" + entry.start.to_string();
+    r["end"] = "0x" + entry.end.to_string();
+    r["permissions"] = entry.permissions.to_string();
+    if (!entry.offset_valid) {
+      r["offset"] = "-1";
+    } else {
+      r["offset"] =
+          (entry.offset != 0) ? BIGINT(entry.offset) : r.at("start");
     }
+    r["device"] = entry.device.to_string();
+    r["inode"] = entry.inode.to_string();
+    r["path"] = std::move(path);
 
     // BSS with name in pathname.
-    r["pseudo"] = (fields[4] == "0" && !r["path"].empty()) ? "1" : "0";
+    r["pseudo"] = (entry.inode == "0" && !entry.path.empty()) ? "1" : "0";
     results.push_back(std::move(r));
-  }
+  }));
 }
 
 /**
@@ -210,77 +465,125 @@ struct SimpleProcStat : private boost::noncopyable {
   /// For errors processing proc data.
   Status status;
 
-  explicit SimpleProcStat(const std::string& pid);
+  explicit SimpleProcStat(const ProcDirectory& dir);
+
+ private:
+  /// Parse the fields following the command name in /proc/<pid>/stat.
+  void parseStat(boost::string_ref content);
+
+  /// Parse the lines of /proc/<pid>/status.
+  void parseStatus(boost::string_ref content);
 };
 
-SimpleProcStat::SimpleProcStat(const std::string& pid) {
-  std::string content;
-  if (readFile(getProcAttr("stat", pid), content).ok()) {
-    auto start = content.find_last_of(")");
-    // Start parsing stats from ") <MODE>..."
-    if (start == std::string::npos || content.size() <= start + 2) {
-      status = Status(1, "Invalid /proc/stat header");
+SimpleProcStat::SimpleProcStat(const ProcDirectory& dir) {
+  char buffer[kProcBufferSize];
+  auto bytes = dir.read("stat", buffer, sizeof(buffer));
+  if (bytes > 0) {
+    parseStat(boost::string_ref(buffer, bytes));
+    if (!status.ok()) {
       return;
     }
+  }
 
-    auto details = osquery::split(content.substr(start + 2), " ");
-    if (details.size() <= 19) {
-      status = Status(1, "Invalid /proc/stat content");
-      return;
-    }
+  // /proc/N/status may be not available, or readable by this user.
+  bytes = dir.read("status", buffer, sizeof(buffer));
+  if (bytes < 0) {
+    status = Status(1, "Cannot read /proc/status");
+    return;
+  }
 
-    this->state = details.at(0);
-    this->parent = details.at(1);
-    this->group = details.at(2);
-    this->user_time = details.at(11);
-    this->system_time = details.at(12);
-    this->nice = details.at(16);
-    this->threads = details.at(17);
-    try {
-      this->start_time = TEXT(AS_LITERAL(BIGINT_LITERAL, details.at(19)) / 100);
-    } catch (const boost::bad_lexical_cast& e) {
-      this->start_time = "-1";
-    }
+  if (static_cast<size_t>(bytes) < sizeof(buffer)) {
+    parseStatus(boost::string_ref(buffer, bytes));
+    return;
   }
 
-  // /proc/N/status may be not available, or readable by this user.
-  if (!readFile(getProcAttr("status", pid), content).ok()) {
+  // A process in many groups has a larger status than the buffer.
+  std::string content;
+  if (!dir.read("status", content)) {
     status = Status(1, "Cannot read /proc/status");
     return;
   }
+  parseStatus(content);
+}
+
+void SimpleProcStat::parseStat(boost::string_ref content) {
+  // Start parsing stats from ") <MODE>..."
+  auto start = content.rfind(')');
+  if (start == boost::string_ref::npos || content.size() <= start + 2) {
+    status = Status(1, "Invalid /proc/stat header");
+    return;
+  }
+
+  // Only up to the start time is used.
+  const size_t kStatFields = 20;
+  boost::string_ref details[kStatFields];
+  auto count = splitProcFields(
+      content.substr(start + 2), ' ', details, kStatFields);
+  if (count < kStatFields) {
+    status = Status(1, "Invalid /proc/stat content");
+    return;
+  }
+
+  this->state = details[0].to_string();
+  this->parent = details[1].to_string();
+  this->group = details[2].to_string();
+  this->user_time = details[11].to_string();
+  this->system_time = details[12].to_string();
+  this->nice = details[16].to_string();
+  this->threads = details[17].to_string();
+  auto start_time = trimProcField(details[19]);
+  char* end = nullptr;
+  std::string value = start_time.to_string();
+  auto ticks = strtoll(value.c_str(), &end, 10);
+  if (value.empty() || end == nullptr || *end != '\0') {
+    this->start_time = "-1";
+  } else {
+    this->start_time = BIGINT(ticks / 100);
+  }
+}
+
+void SimpleProcStat::parseStatus(boost::string_ref content) {
+  while (!content.empty()) {
+    auto end = std::min(content.find('\n'), content.size());
+    auto line = content.substr(0, end);
+    content.remove_prefix(std::min(end + 1, content.size()));
 
-  for (const auto& line : osquery::split(content, "\n")) {
     // Status lines are formatted: Key: Value....\n.
-    auto detail = osquery::split(line, ":", 1);
-    if (detail.size() != 2) {
+    auto colon = line.find(':');
+    if (colon == boost::string_ref::npos) {
+      continue;
+    }
+    auto key = trimProcField(line.substr(0, colon));
+    auto value = trimProcField(line.substr(colon + 1));
+    if (key.empty() || value.empty()) {
       continue;
     }
 
     // There are specific fields from each detail.
-    if (detail.at(0) == "Name") {
-      this->name = detail.at(1);
-    } else if (detail.at(0) == "VmRSS") {
-      detail[1].erase(detail.at(1).end() - 3, detail.at(1).end());
+    if (key == "Name") {
+      this->name = value.to_string();
+    } else if (key == "VmRSS" && value.size() > 3) {
       // Memory is reported in kB.
-      this->resident_size = detail.at(1) + "000";
-    } else if (detail.at(0) == "VmSize") {
-      detail[1].erase(detail.at(1).end() - 3, detail.at(1).end());
+      value.remove_suffix(3);
+      this->resident_size = value.to_string() + "000";
+    } else if (key == "VmSize" && value.size() > 3) {
       // Memory is reported in kB.
-      this->total_size = detail.at(1) + "000";
-    } else if (detail.at(0) == "Gid") {
-      // Format is: R E - -
-      auto gid_detail = osquery::split(detail.at(1), "\t");
-      if (gid_detail.size() == 4) {
-        this->real_gid = gid_detail.at(0);
-        this->effective_gid = gid_detail.at(1);
-        this->saved_gid = gid_detail.at(2);
+      value.remove_suffix(3);
+      this->total_size = value.to_string() + "000";
+    } else if (key == "Gid" || key == "Uid") {
+      // Format is: R E S F
+      boost::string_ref ids[5];
+      if (splitProcFields(value, '\t', ids, 5) != 4) {
+        continue;
       }
-    } else if (detail.at(0) == "Uid") {
-      auto uid_detail = osquery::split(detail.at(1), "\t");
-      if (uid_detail.size() == 4) {
-        this->real_uid = uid_detail.at(0);
-        this->effective_uid = uid_detail.at(1);
-        this->saved_uid = uid_detail.at(2);
+      if (key == "Gid") {
+        this->real_gid = ids[0].to_string();
+        this->effective_gid = ids[1].to_string();
+        this->saved_gid = ids[2].to_string();
+      } else {
+        this->real_uid = ids[0].to_string();
+        this->effective_uid = ids[1].to_string();
+        this->saved_uid = ids[2].to_string();
       }
     }
   }
@@ -300,7 +603,7 @@ SimpleProcStat::SimpleProcStat(const std::string& pid) {
  *             to contain the (deleted) suffix, it will be removed.
  * @return A tristate -1 error, 1 yes, 0 nope.
  */
-int getOnDisk(const std::string& pid, std::string& path) {
+int getOnDisk(const std::string& pid, std::string& path, ProcSnapshot& proc) {
   if (path.empty()) {
     return -1;
   }
@@ -322,7 +625,7 @@ int getOnDisk(const std::string& pid, std::string& path) {
   // process is actually running from a binary file ending with
   // " (deleted)". See #1607
   std::string maps_contents;
-  Status deleted = deletedMatchesInode(path, pid);
+  Status deleted = deletedMatchesInode(path, pid, proc);
   if (deleted.getCode() == -1) {
     LOG(ERROR) << deleted.getMessage();
     return -1;
@@ -338,28 +641,52 @@ int getOnDisk(const std::string& pid, std::string& path) {
   }
 }
 
-void genProcess(const std::string& pid, QueryData& results) {
+void genProcess(const std::string& pid,
+                QueryContext& context,
+                ProcSnapshot& proc,
+                QueryData& results) {
   // Parse the process stat and status.
-  SimpleProcStat proc_stat(pid);
+  ProcDirectory dir(pid);
+  if (!dir.valid()) {
+    return;
+  }
+  SimpleProcStat proc_stat(dir);
 
   if (!proc_stat.status.ok()) {
     VLOG(1) << proc_stat.status.getMessage() << " for pid " << pid;
     return;
   }
 
+  // Skip reading the links and command line of processes SQLite filters.
+  if (!context.admits("parent", proc_stat.parent) ||
+      !context.admits("uid", proc_stat.real_uid) ||
+      !context.admits("name", proc_stat.name)) {
+    return;
+  }
+
   Row r;
   r["pid"] = pid;
   r["parent"] = proc_stat.parent;
-  r["path"] = readProcLink("exe", pid);
+  // The exe link is also needed to check if the process is on disk.
+  if (context.isAnyColumnUsed({"path", "on_disk"})) {
+    // The exe is a symlink to the binary on-disk.
+    r["path"] = dir.link("exe");
+  }
   r["name"] = proc_stat.name;
   r["pgroup"] = proc_stat.group;
   r["state"] = proc_stat.state;
   r["nice"] = proc_stat.nice;
   r["threads"] = proc_stat.threads;
   // Read/parse cmdline arguments.
-  r["cmdline"] = readProcCMDLine(pid);
-  r["cwd"] = readProcLink("cwd", pid);
-  r["root"] = readProcLink("root", pid);
+  if (context.isColumnUsed("cmdline")) {
+    r["cmdline"] = readProcCMDLine(dir);
+  }
+  if (context.isColumnUsed("cwd")) {
+    r["cwd"] = dir.link("cwd");
+  }
+  if (context.isColumnUsed("root")) {
+    r["root"] = dir.link("root");
+  }
   r["uid"] = proc_stat.real_uid;
   r["euid"] = proc_stat.effective_uid;
   r["suid"] = proc_stat.saved_uid;
@@ -367,7 +694,9 @@ void genProcess(const std::string& pid, QueryData& results) {
   r["egid"] = proc_stat.effective_gid;
   r["sgid"] = proc_stat.saved_gid;
 
-  r["on_disk"] = INTEGER(getOnDisk(pid, r["path"]));
+  if (context.isColumnUsed("on_disk")) {
+    r["on_disk"] = INTEGER(getOnDisk(pid, r["path"], proc));
+  }
 
   // size/memory information
   r["wired_size"] = "0"; // No support for unpagable counters in linux.
@@ -385,9 +714,10 @@ void genProcess(const std::string& pid, QueryData& results) {
 QueryData genProcesses(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
+  auto proc = ProcSnapshot::get(context);
+  auto pidlist = getProcList(context, *proc);
   for (const auto& pid : pidlist) {
-    genProcess(pid, results);
+    genProcess(pid, context, *proc, results);
   }
 
   return results;
@@ -396,9 +726,10 @@ QueryData genProcesses(QueryContext& context) {
 QueryData genProcessEnvs(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
+  auto proc = ProcSnapshot::get(context);
+  auto pidlist = getProcList(context, *proc);
   for (const auto& pid : pidlist) {
-    genProcessEnvironment(pid, results);
+    genProcessEnvironment(pid, *proc, results);
   }
 
   return results;
@@ -407,9 +738,10 @@ QueryData genProcessEnvs(QueryContext& context) {
 QueryData genProcessMemoryMap(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
+  auto proc = ProcSnapshot::get(context);
+  auto pidlist = getProcList(context, *proc);
   for (const auto& pid : pidlist) {
-    genProcessMap(pid, results);
+    genProcessMap(pid, context, results);
   }
 
   return results;
@@ -30,6 +30,25 @@ namespace tables {
 // Maximum number of files per RPM.
 #define MAX_RPM_FILES 2048
 
+/// The rpmdb backends' package files, only the existing backend's is found.
+const std::vector<std::string> kRpmDatabasePaths = {
+    "/var/lib/rpm/Packages",
+    "/var/lib/rpm/Packages.db",
+    "/var/lib/rpm/rpmdb.sqlite",
+    "/usr/lib/sysimage/rpm/Packages",
+    "/usr/lib/sysimage/rpm/Packages.db",
+    "/usr/lib/sysimage/rpm/rpmdb.sqlite",
+};
+
+/// Protect the cached packages.
+static Mutex kRpmPackagesMutex;
+
+/// The rpmdb identity the packages were read at.
+static std::string kRpmPackagesIdentity;
+
+/// Every installed package, rows are copied to each query's results.
+static QueryData kRpmPackages;
+
 /**
  * @brief Return a string representation of the RPM tag type.
  *
@@ -87,14 +106,14 @@ class RpmEnvironmentManager : public boost::noncopyable {
   boost::optional<std::string> config_;
 };
 
-QueryData genRpmPackages(QueryContext& context) {
-  QueryData results;
-
-  auto dropper = DropPrivileges::get();
-  dropper->dropTo("nobody");
+/// The identity of the rpmdb, it changes with every transaction.
+std::string genRpmPackagesGeneration() {
+  return getPathsIdentity(kRpmDatabasePaths);
+}
 
-  // Isolate RPM/package inspection to the canonical: /usr/lib/rpm.
-  RpmEnvironmentManager env_manager;
+/// Read every installed package's header.
+static QueryData readRpmPackages() {
+  QueryData results;
 
   // The following implementation uses http://rpm.org/api/4.11.1/
   rpmInitCrypto();
@@ -104,13 +123,7 @@ QueryData genRpmPackages(QueryContext& context) {
   }
 
   rpmts ts = rpmtsCreate();
-  rpmdbMatchIterator matches;
-  if (context.constraints["name"].exists(EQUALS)) {
-    auto name = (*context.constraints["name"].getAll(EQUALS).begin());
-    matches = rpmtsInitIterator(ts, RPMTAG_NAME, name.c_str(), name.size());
-  } else {
-    matches = rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
-  }
+  auto matches = rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
 
   Header header;
   while ((header = rpmdbNextIterator(matches)) != nullptr) {
@@ -125,7 +138,7 @@ QueryData genRpmPackages(QueryContext& context) {
     r["arch"] = getRpmAttribute(header, RPMTAG_ARCH, td);
 
     rpmtdFree(td);
-    results.push_back(r);
+    results.push_back(std::move(r));
   }
 
   rpmdbFreeIterator(matches);
@@ -136,6 +149,35 @@ QueryData genRpmPackages(QueryContext& context) {
   return results;
 }
 
+QueryData genRpmPackages(QueryContext& context) {
+  auto dropper = DropPrivileges::get();
+  dropper->dropTo("nobody");
+
+  // Isolate RPM/package inspection to the canonical: /usr/lib/rpm.
+  RpmEnvironmentManager env_manager;
+
+  // Headers are only read again after a transaction changes the rpmdb.
+  auto identity = genRpmPackagesGeneration();
+  WriteLock lock(kRpmPackagesMutex);
+  if (identity.empty() || identity != kRpmPackagesIdentity) {
+    kRpmPackages = readRpmPackages();
+    kRpmPackagesIdentity = identity;
+  }
+
+  if (!context.constraints["name"].exists(EQUALS)) {
+    return kRpmPackages;
+  }
+
+  QueryData results;
+  auto names = context.constraints["name"].getAll(EQUALS);
+  for (const auto& row : kRpmPackages) {
+    if (names.count(row.at("name")) > 0) {
+      results.push_back(row);
+    }
+  }
+  return results;
+}
+
 QueryData genRpmPackageFiles(QueryContext& context) {
   QueryData results;
 
@@ -159,9 +201,11 @@ QueryData genRpmPackageFiles(QueryContext& context) {
     matches = rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
   }
 
+  // File digests are only formatted when selected.
+  auto use_digest = context.isColumnUsed("sha256");
+
   Header header;
   while ((header = rpmdbNextIterator(matches)) != nullptr) {
-    rpmtd td = rpmtdNew();
     rpmfi fi = rpmfiNew(ts, header, RPMTAG_BASENAMES, RPMFI_NOHEADER);
     auto file_count = rpmfiFC(fi);
     if (file_count <= 0 || file_count > MAX_RPM_FILES) {
@@ -170,10 +214,15 @@ QueryData genRpmPackageFiles(QueryContext& context) {
       continue;
     }
 
+    // The package name is shared by each of its files.
+    rpmtd td = rpmtdNew();
+    auto package = getRpmAttribute(header, RPMTAG_NAME, td);
+    rpmtdFree(td);
+
     // Iterate over every file in this package.
     for (size_t i = 0; rpmfiNext(fi) >= 0 && i < file_count; i++) {
       Row r;
-      r["package"] = getRpmAttribute(header, RPMTAG_NAME, td);
+      r["package"] = package;
       auto path = rpmfiFN(fi);
       r["path"] = (path != nullptr) ? path : "";
       auto username = rpmfiFUser(fi);
@@ -183,17 +232,19 @@ QueryData genRpmPackageFiles(QueryContext& context) {
       r["mode"] = lsperms(rpmfiFMode(fi));
       r["size"] = BIGINT(rpmfiFSize(fi));
 
-      int digest_algo;
-      auto digest = rpmfiFDigestHex(fi, &digest_algo);
-      if (digest_algo == PGPHASHALGO_SHA256) {
-        r["sha256"] = (digest != nullptr) ? digest : "";
+      if (use_digest) {
+        int digest_algo;
+        auto digest = rpmfiFDigestHex(fi, &digest_algo);
+        if (digest_algo == PGPHASHALGO_SHA256) {
+          r["sha256"] = (digest != nullptr) ? digest : "";
+        }
+        free(digest);
       }
 
-      results.push_back(r);
+      results.push_back(std::move(r));
     }
 
     rpmfiFree(fi);
-    rpmtdFree(td);
   }
 
   rpmdbFreeIterator(matches);
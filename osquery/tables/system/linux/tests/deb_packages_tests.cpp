@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+using DebPackageMap = std::map<std::pair<std::string, std::string>, Row>;
+
+void parseDpkgStatus(const char* data, size_t size, DebPackageMap& packages);
+
+class DebPackagesTests : public testing::Test {};
+
+static const std::string kDpkgStatusContent =
+    "Package: zlib1g\n"
+    "Status: install ok installed\n"
+    "Priority: required\n"
+    "Installed-Size: 163\n"
+    "Architecture: amd64\n"
+    "Source: zlib\n"
+    "Version: 1:1.2.8.dfsg-2ubuntu4\n"
+    "Description: compression library - runtime\n"
+    " zlib is a library implementing the deflate compression method.\n"
+    " .\n"
+    "\n"
+    "Package: adduser\n"
+    "Status: install ok installed\n"
+    "Installed-Size: 648\n"
+    "Architecture: all\n"
+    "Version: 3.113\n"
+    "\n"
+    "Package: removed\n"
+    "Status: deinstall ok not-installed\n"
+    "Architecture: amd64\n"
+    "Version: 1.0-1\n";
+
+TEST_F(DebPackagesTests, test_parse_status) {
+  DebPackageMap packages;
+  parseDpkgStatus(
+      kDpkgStatusContent.data(), kDpkgStatusContent.size(), packages);
+  ASSERT_EQ(packages.size(), 2U);
+  EXPECT_EQ(packages.begin()->first.first, "adduser");
+
+  auto& zlib = packages[std::make_pair("zlib1g", "amd64")];
+  EXPECT_EQ(zlib["version"], "1:1.2.8.dfsg-2ubuntu4");
+  EXPECT_EQ(zlib["revision"], "2ubuntu4");
+  EXPECT_EQ(zlib["source"], "zlib");
+  EXPECT_EQ(zlib["size"], "163");
+
+  // Packages without a revision or source.
+  auto& adduser = packages[std::make_pair("adduser", "all")];
+  EXPECT_EQ(adduser["revision"], "");
+  EXPECT_EQ(adduser.count("source"), 0U);
+}
+
+TEST_F(DebPackagesTests, test_parse_updates) {
+  DebPackageMap packages;
+  parseDpkgStatus(
+      kDpkgStatusContent.data(), kDpkgStatusContent.size(), packages);
+
+  // An update journal entry replaces, or removes, a package.
+  std::string update =
+      "Package: zlib1g\n"
+      "Status: install ok installed\n"
+      "Architecture: amd64\n"
+      "Version: 1:1.2.11-1\n"
+      "\n"
+      "Package: adduser\n"
+      "Status: purge ok not-installed\n"
+      "Architecture: all\n";
+  parseDpkgStatus(update.data(), update.size(), packages);
+  ASSERT_EQ(packages.size(), 1U);
+  EXPECT_EQ(packages.begin()->second.at("version"), "1:1.2.11-1");
+  EXPECT_EQ(packages.begin()->second.at("revision"), "1");
+}
+}
+}
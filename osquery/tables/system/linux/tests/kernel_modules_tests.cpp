@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+#include <osquery/tables.h>
+
+#include "osquery/tables/system/linux/kernel_modules.h"
+
+namespace osquery {
+
+DECLARE_bool(kernel_table_cache);
+
+namespace tables {
+
+QueryData genKernelModules(QueryContext& context);
+
+class KernelModulesTests : public testing::Test {
+ protected:
+  void TearDown() override {
+    KernelChanges::setWatching(false);
+    KernelChanges::setRunning(nullptr);
+    FLAGS_kernel_table_cache = true;
+  }
+};
+
+TEST_F(KernelModulesTests, test_generation) {
+  // Without module events every query parses the modules.
+  KernelChanges::setWatching(false);
+  EXPECT_TRUE(KernelChanges::generation().empty());
+
+  KernelChanges::setWatching(true);
+  auto generation = KernelChanges::generation();
+  EXPECT_FALSE(generation.empty());
+  EXPECT_EQ(generation, KernelChanges::generation());
+
+  // A module load or unload changes the generation.
+  KernelChanges::changed();
+  EXPECT_NE(generation, KernelChanges::generation());
+
+  // Without a running publisher module events are missed.
+  bool running = false;
+  KernelChanges::setRunning([&running]() { return running; });
+  EXPECT_TRUE(KernelChanges::generation().empty());
+  running = true;
+  EXPECT_FALSE(KernelChanges::generation().empty());
+
+  FLAGS_kernel_table_cache = false;
+  EXPECT_TRUE(KernelChanges::generation().empty());
+}
+
+TEST_F(KernelModulesTests, test_cached_rows) {
+  QueryContext context;
+  auto rows = genKernelModules(context);
+
+  // The cached rows are the rows parsed without module events.
+  KernelChanges::setWatching(true);
+  EXPECT_EQ(rows, genKernelModules(context));
+  EXPECT_EQ(rows, genKernelModules(context));
+
+  KernelChanges::changed();
+  EXPECT_EQ(rows, genKernelModules(context));
+}
+}
+}
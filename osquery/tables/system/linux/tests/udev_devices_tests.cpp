@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/tables/system/linux/udev_devices.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+namespace tables {
+
+class UdevDevicesTests : public testing::Test {
+ protected:
+  void TearDown() override {
+    UdevDeviceCache::setWatching(false);
+  }
+
+  /// Generate the pci rows, counting the devices generated.
+  QueryData generate(size_t& generated) {
+    QueryData results;
+    UdevDeviceCache::generate(
+        "pci",
+        ([&generated](struct udev_device* device, Row& r) {
+          generated++;
+          r["syspath"] = udev_device_get_syspath(device);
+          return true;
+        }),
+        results);
+    return results;
+  }
+};
+
+TEST_F(UdevDevicesTests, test_cached_rows) {
+  UdevDeviceCache::setWatching(false);
+  size_t generated = 0;
+  auto rows = generate(generated);
+  EXPECT_EQ(rows.size(), generated);
+
+  // Without device events every query enumerates the devices.
+  generated = 0;
+  generate(generated);
+  EXPECT_EQ(rows.size(), generated);
+
+  UdevDeviceCache::setWatching(true);
+  generated = 0;
+  generate(generated);
+  EXPECT_EQ(rows.size(), generated);
+
+  // The enumerated rows are reused until a device changes.
+  generated = 0;
+  EXPECT_EQ(rows, generate(generated));
+  EXPECT_EQ(0U, generated);
+  if (rows.empty()) {
+    return;
+  }
+
+  auto syspath = rows[0]["syspath"];
+  UdevDeviceCache::changed("pci", syspath, false);
+  EXPECT_EQ(rows, generate(generated));
+  EXPECT_EQ(1U, generated);
+
+  // A removed device's row is dropped without generating it.
+  generated = 0;
+  UdevDeviceCache::changed("pci", syspath, true);
+  EXPECT_EQ(rows.size() - 1, generate(generated).size());
+  EXPECT_EQ(0U, generated);
+}
+}
+}
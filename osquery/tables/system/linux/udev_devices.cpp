@@ -0,0 +1,174 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+#include <set>
+
+#include <osquery/core.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/tables/system/linux/udev_devices.h"
+
+namespace osquery {
+namespace tables {
+
+FLAG(bool,
+     udev_device_cache,
+     true,
+     "Cache udev device rows, updated from udev events");
+
+/// The cached rows of a subsystem.
+struct UdevSubsystemCache {
+  /// Set after the subsystem was enumerated while watching.
+  bool populated{false};
+
+  /// Rows by device syspath.
+  std::map<std::string, Row> rows;
+
+  /// Devices added or changed since they were generated.
+  std::set<std::string> changed;
+};
+
+static std::map<std::string, UdevSubsystemCache> kUdevSubsystems;
+static bool kUdevWatching{false};
+static std::function<bool()> kUdevRunning;
+
+/// Held while generating, so events wait for an enumeration to complete.
+static Mutex kUdevDevicesMutex;
+
+/// Generate the row of a device by syspath, false if it has no row.
+static bool genUdevRow(struct udev* handle,
+                       const std::string& syspath,
+                       const UdevRowGenerator& generator,
+                       Row& r) {
+  auto device = udev_device_new_from_syspath(handle, syspath.c_str());
+  if (device == nullptr) {
+    // The device was removed.
+    return false;
+  }
+
+  auto has_row = generator(device, r);
+  udev_device_unref(device);
+  return has_row;
+}
+
+/// Enumerate a subsystem, generating a row for each device.
+static void genUdevRows(struct udev* handle,
+                        const std::string& subsystem,
+                        const UdevRowGenerator& generator,
+                        std::map<std::string, Row>& rows) {
+  auto enumerate = udev_enumerate_new(handle);
+  udev_enumerate_add_match_subsystem(enumerate, subsystem.c_str());
+  udev_enumerate_scan_devices(enumerate);
+
+  struct udev_list_entry *devices, *entry;
+  devices = udev_enumerate_get_list_entry(enumerate);
+  udev_list_entry_foreach(entry, devices) {
+    const char* path = udev_list_entry_get_name(entry);
+    if (path == nullptr) {
+      continue;
+    }
+
+    Row r;
+    if (genUdevRow(handle, path, generator, r)) {
+      rows[path] = std::move(r);
+    }
+  }
+  udev_enumerate_unref(enumerate);
+}
+
+void UdevDeviceCache::generate(const std::string& subsystem,
+                               const UdevRowGenerator& generator,
+                               QueryData& results) {
+  auto handle = udev_new();
+  if (handle == nullptr) {
+    VLOG(1) << "Could not get udev handle";
+    return;
+  }
+
+  // Device events are missed once the publisher's run loop ends.
+  std::function<bool()> running;
+  {
+    WriteLock lock(kUdevDevicesMutex);
+    running = kUdevRunning;
+  }
+  bool received = (running == nullptr || running());
+
+  WriteLock lock(kUdevDevicesMutex);
+  if (!kUdevWatching || !received || !FLAGS_udev_device_cache) {
+    std::map<std::string, Row> rows;
+    genUdevRows(handle, subsystem, generator, rows);
+    udev_unref(handle);
+    for (auto& row : rows) {
+      results.push_back(std::move(row.second));
+    }
+    return;
+  }
+
+  auto& cache = kUdevSubsystems[subsystem];
+  if (!cache.populated) {
+    genUdevRows(handle, subsystem, generator, cache.rows);
+    cache.populated = true;
+    cache.changed.clear();
+  }
+
+  // Only the devices with events since the last query are generated again.
+  for (const auto& syspath : cache.changed) {
+    Row r;
+    if (genUdevRow(handle, syspath, generator, r)) {
+      cache.rows[syspath] = std::move(r);
+    } else {
+      cache.rows.erase(syspath);
+    }
+  }
+  cache.changed.clear();
+  udev_unref(handle);
+
+  for (const auto& row : cache.rows) {
+    results.push_back(row.second);
+  }
+}
+
+void UdevDeviceCache::changed(const std::string& subsystem,
+                              const std::string& syspath,
+                              bool removed) {
+  WriteLock lock(kUdevDevicesMutex);
+  auto cache = kUdevSubsystems.find(subsystem);
+  if (cache == kUdevSubsystems.end() || !cache->second.populated) {
+    // The next query enumerates the subsystem.
+    return;
+  }
+
+  if (removed) {
+    cache->second.rows.erase(syspath);
+    cache->second.changed.erase(syspath);
+  } else {
+    cache->second.changed.insert(syspath);
+  }
+}
+
+void UdevDeviceCache::setWatching(bool watching) {
+  WriteLock lock(kUdevDevicesMutex);
+  kUdevWatching = watching;
+  kUdevSubsystems.clear();
+}
+
+void UdevDeviceCache::setRunning(std::function<bool()> running) {
+  WriteLock lock(kUdevDevicesMutex);
+  kUdevRunning = std::move(running);
+}
+
+void UdevDeviceCache::clear() {
+  WriteLock lock(kUdevDevicesMutex);
+  kUdevSubsystems.clear();
+}
+}
+}
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <libudev.h>
+
+#include <functional>
+#include <string>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/// Fill the row of a device, false if the device has no row.
+using UdevRowGenerator = std::function<bool(struct udev_device*, Row&)>;
+
+/**
+ * @brief Rows generated from the udev devices of a subsystem.
+ *
+ * The block_devices, usb_devices and pci_devices tables enumerate a udev
+ * subsystem and read properties, or probe, each device. When the udev event
+ * publisher is running, the udev_devices subscriber reports each device that
+ * is added, changed, or removed. A subsystem is then enumerated once, and
+ * later queries only generate the rows of changed devices.
+ */
+class UdevDeviceCache {
+ public:
+  /**
+   * @brief Generate the rows of a subsystem's devices.
+   *
+   * @param subsystem The udev subsystem, such as "block".
+   * @param generator Fill the row for each device that was not cached.
+   * @param results The output rows, ordered by device syspath.
+   */
+  static void generate(const std::string& subsystem,
+                       const UdevRowGenerator& generator,
+                       QueryData& results);
+
+  /// Record that a device was added, changed, or removed.
+  static void changed(const std::string& subsystem,
+                      const std::string& syspath,
+                      bool removed);
+
+  /// Set when device events are received, until then rows are not cached.
+  static void setWatching(bool watching);
+
+  /// Set a check of the events' source, rows are not cached while it fails.
+  static void setRunning(std::function<bool()> running);
+
+  /// Drop every cached row.
+  static void clear();
+};
+}
+}
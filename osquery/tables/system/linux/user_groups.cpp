@@ -10,44 +10,41 @@
 
 #include "osquery/tables/system/user_groups.h"
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/posix/account_cache.h"
 
 namespace osquery {
 namespace tables {
 
-extern Mutex pwdEnumerationMutex;
+static void genUserGroups(const PasswdEntry& entry, QueryData& results) {
+  user_t<uid_t, gid_t> user;
+  user.name = entry.username.c_str();
+  user.uid = entry.uid;
+  user.gid = entry.gid;
+  getGroupsForUser<uid_t, gid_t>(results, user);
+}
 
 QueryData genUserGroups(QueryContext& context) {
   QueryData results;
-  struct passwd* pwd = nullptr;
 
   if (context.constraints["uid"].exists(EQUALS)) {
     std::set<std::string> uids = context.constraints["uid"].getAll(EQUALS);
     for (const auto& uid : uids) {
       long auid{0};
-      if (safeStrtol(uid, 10, auid) && (pwd = getpwuid(auid)) != nullptr) {
-        user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
-        getGroupsForUser<uid_t, gid_t>(results, user);
+      PasswdEntry user;
+      if (safeStrtol(uid, 10, auid) && AccountCache::getUser(auid, user)) {
+        genUserGroups(user, results);
       }
     }
   } else {
-    WriteLock lock(pwdEnumerationMutex);
-    std::set<gid_t> users_in;
-    while ((pwd = getpwent()) != nullptr) {
-      if (std::find(users_in.begin(), users_in.end(), pwd->pw_uid) ==
-          users_in.end()) {
-        user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
-        getGroupsForUser<uid_t, gid_t>(results, user);
-        users_in.insert(pwd->pw_uid);
+    std::vector<PasswdEntry> users;
+    AccountCache::getUsers(users);
+    std::set<uid_t> users_in;
+    for (const auto& user : users) {
+      if (users_in.count(user.uid) == 0) {
+        genUserGroups(user, results);
+        users_in.insert(user.uid);
       }
     }
-    endpwent();
-    users_in.clear();
   }
 
   return results;
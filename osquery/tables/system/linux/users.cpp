@@ -8,78 +8,53 @@
  *
  */
 
-#include <pwd.h>
-
-#include <mutex>
-
 #include <osquery/core.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/posix/account_cache.h"
 
 namespace osquery {
 namespace tables {
 
-Mutex pwdEnumerationMutex;
-
-void genUser(const struct passwd* pwd, QueryData& results) {
+void genUser(const PasswdEntry& user, QueryData& results) {
   Row r;
-  r["uid"] = BIGINT(pwd->pw_uid);
-  r["gid"] = BIGINT(pwd->pw_gid);
-  r["uid_signed"] = BIGINT((int32_t)pwd->pw_uid);
-  r["gid_signed"] = BIGINT((int32_t)pwd->pw_gid);
-
-  if (pwd->pw_name != nullptr) {
-    r["username"] = TEXT(pwd->pw_name);
-  }
-
-  if (pwd->pw_gecos != nullptr) {
-    r["description"] = TEXT(pwd->pw_gecos);
-  }
-
-  if (pwd->pw_dir != nullptr) {
-    r["directory"] = TEXT(pwd->pw_dir);
-  }
-
-  if (pwd->pw_shell != nullptr) {
-    r["shell"] = TEXT(pwd->pw_shell);
-  }
+  r["uid"] = BIGINT(user.uid);
+  r["gid"] = BIGINT(user.gid);
+  r["uid_signed"] = BIGINT((int32_t)user.uid);
+  r["gid_signed"] = BIGINT((int32_t)user.gid);
+  r["username"] = TEXT(user.username);
+  r["description"] = TEXT(user.description);
+  r["directory"] = TEXT(user.directory);
+  r["shell"] = TEXT(user.shell);
   results.push_back(r);
 }
 
 QueryData genUsers(QueryContext& context) {
   QueryData results;
 
-  struct passwd* pwd = nullptr;
+  PasswdEntry user;
   if (context.constraints["uid"].exists(EQUALS)) {
     auto uids = context.constraints["uid"].getAll(EQUALS);
     for (const auto& uid : uids) {
       long auid{0};
-      if (safeStrtol(uid, 10, auid)) {
-        WriteLock lock(pwdEnumerationMutex);
-        pwd = getpwuid(auid);
-        if (pwd != nullptr) {
-          genUser(pwd, results);
-        }
+      if (safeStrtol(uid, 10, auid) && AccountCache::getUser(auid, user)) {
+        genUser(user, results);
       }
     }
   } else if (context.constraints["username"].exists(EQUALS)) {
     auto usernames = context.constraints["username"].getAll(EQUALS);
     for (const auto& username : usernames) {
-      WriteLock lock(pwdEnumerationMutex);
-      pwd = getpwnam(username.c_str());
-      if (pwd != nullptr) {
-        genUser(pwd, results);
+      if (AccountCache::getUser(username, user)) {
+        genUser(user, results);
       }
     }
   } else {
-    WriteLock lock(pwdEnumerationMutex);
-    pwd = getpwent();
-    while (pwd != nullptr) {
-      genUser(pwd, results);
-      pwd = getpwent();
+    std::vector<PasswdEntry> users;
+    AccountCache::getUsers(users);
+    for (const auto& entry : users) {
+      genUser(entry, results);
     }
-    endpwent();
   }
 
   return results;
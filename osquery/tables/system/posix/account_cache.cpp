@@ -0,0 +1,221 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <grp.h>
+#include <pwd.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <set>
+
+#include <osquery/core.h>
+#include <osquery/flags.h>
+#include <osquery/system.h>
+
+#include "osquery/tables/system/posix/account_cache.h"
+
+namespace osquery {
+namespace tables {
+
+FLAG(uint64,
+     account_cache_ttl,
+     60,
+     "Seconds to cache users and groups read from NSS (0 disables)");
+
+/**
+ * @brief Cached entries of one account database.
+ *
+ * An id or name maps to false for lookups that found no entry.
+ */
+template <typename Entry, typename Id>
+struct AccountDatabase {
+  /// The file of local entries, a change expires every entry.
+  std::string path;
+
+  /// When the entries were first cached.
+  size_t time{0};
+
+  /// The file's modification time and size when the entries were cached.
+  time_t mtime{0};
+  off_t size{0};
+
+  /// Set if every entry was enumerated.
+  bool enumerated{false};
+  std::vector<Entry> entries;
+
+  std::map<Id, std::pair<bool, Entry>> ids;
+  std::map<std::string, std::pair<bool, Entry>> names;
+
+  explicit AccountDatabase(std::string file) : path(std::move(file)) {}
+
+  /// Drop the entries if the file changed or they are older than the TTL.
+  void expire() {
+    struct stat file_stat;
+    if (::stat(path.c_str(), &file_stat) != 0) {
+      file_stat.st_mtime = 0;
+      file_stat.st_size = 0;
+    }
+
+    auto now = getUnixTime();
+    if (FLAGS_account_cache_ttl == 0 || now >= time + FLAGS_account_cache_ttl ||
+        file_stat.st_mtime != mtime || file_stat.st_size != size) {
+      clear();
+      time = now;
+      mtime = file_stat.st_mtime;
+      size = file_stat.st_size;
+    }
+  }
+
+  void clear() {
+    enumerated = false;
+    entries.clear();
+    ids.clear();
+    names.clear();
+  }
+};
+
+static AccountDatabase<PasswdEntry, uid_t> kPasswdDatabase("/etc/passwd");
+static AccountDatabase<GroupEntry, gid_t> kGroupDatabase("/etc/group");
+
+/// Protect the caches and the non-reentrant passwd and group functions.
+static Mutex kAccountCacheMutex;
+
+static PasswdEntry copyPasswd(const struct passwd* pwd) {
+  PasswdEntry user;
+  user.uid = pwd->pw_uid;
+  user.gid = pwd->pw_gid;
+  if (pwd->pw_name != nullptr) {
+    user.username = pwd->pw_name;
+  }
+
+  if (pwd->pw_gecos != nullptr) {
+    user.description = pwd->pw_gecos;
+  }
+
+  if (pwd->pw_dir != nullptr) {
+    user.directory = pwd->pw_dir;
+  }
+
+  if (pwd->pw_shell != nullptr) {
+    user.shell = pwd->pw_shell;
+  }
+  return user;
+}
+
+static GroupEntry copyGroup(const struct group* grp) {
+  GroupEntry group;
+  group.gid = grp->gr_gid;
+  if (grp->gr_name != nullptr) {
+    group.groupname = grp->gr_name;
+  }
+  return group;
+}
+
+void AccountCache::getUsers(std::vector<PasswdEntry>& users) {
+  WriteLock lock(kAccountCacheMutex);
+  kPasswdDatabase.expire();
+  if (!kPasswdDatabase.enumerated) {
+    struct passwd* pwd = nullptr;
+    setpwent();
+    while ((pwd = getpwent()) != nullptr) {
+      auto user = copyPasswd(pwd);
+      kPasswdDatabase.ids[user.uid] = std::make_pair(true, user);
+      kPasswdDatabase.names[user.username] = std::make_pair(true, user);
+      kPasswdDatabase.entries.push_back(std::move(user));
+    }
+    endpwent();
+    kPasswdDatabase.enumerated = true;
+  }
+  users = kPasswdDatabase.entries;
+}
+
+bool AccountCache::getUser(uid_t uid, PasswdEntry& user) {
+  WriteLock lock(kAccountCacheMutex);
+  kPasswdDatabase.expire();
+  auto entry = kPasswdDatabase.ids.find(uid);
+  if (entry == kPasswdDatabase.ids.end()) {
+    auto pwd = getpwuid(uid);
+    auto found =
+        (pwd != nullptr) ? std::make_pair(true, copyPasswd(pwd))
+                         : std::make_pair(false, PasswdEntry());
+    entry = kPasswdDatabase.ids.emplace(uid, std::move(found)).first;
+  }
+
+  if (entry->second.first) {
+    user = entry->second.second;
+  }
+  return entry->second.first;
+}
+
+bool AccountCache::getUser(const std::string& username, PasswdEntry& user) {
+  WriteLock lock(kAccountCacheMutex);
+  kPasswdDatabase.expire();
+  auto entry = kPasswdDatabase.names.find(username);
+  if (entry == kPasswdDatabase.names.end()) {
+    auto pwd = getpwnam(username.c_str());
+    auto found =
+        (pwd != nullptr) ? std::make_pair(true, copyPasswd(pwd))
+                         : std::make_pair(false, PasswdEntry());
+    entry = kPasswdDatabase.names.emplace(username, std::move(found)).first;
+  }
+
+  if (entry->second.first) {
+    user = entry->second.second;
+  }
+  return entry->second.first;
+}
+
+void AccountCache::getGroups(std::vector<GroupEntry>& groups) {
+  WriteLock lock(kAccountCacheMutex);
+  kGroupDatabase.expire();
+  if (!kGroupDatabase.enumerated) {
+    struct group* grp = nullptr;
+    std::set<gid_t> groups_in;
+    setgrent();
+    while ((grp = getgrent()) != nullptr) {
+      if (groups_in.count(grp->gr_gid) > 0) {
+        continue;
+      }
+
+      auto group = copyGroup(grp);
+      groups_in.insert(group.gid);
+      kGroupDatabase.ids[group.gid] = std::make_pair(true, group);
+      kGroupDatabase.entries.push_back(std::move(group));
+    }
+    endgrent();
+    kGroupDatabase.enumerated = true;
+  }
+  groups = kGroupDatabase.entries;
+}
+
+bool AccountCache::getGroup(gid_t gid, GroupEntry& group) {
+  WriteLock lock(kAccountCacheMutex);
+  kGroupDatabase.expire();
+  auto entry = kGroupDatabase.ids.find(gid);
+  if (entry == kGroupDatabase.ids.end()) {
+    auto grp = getgrgid(gid);
+    auto found = (grp != nullptr) ? std::make_pair(true, copyGroup(grp))
+                                  : std::make_pair(false, GroupEntry());
+    entry = kGroupDatabase.ids.emplace(gid, std::move(found)).first;
+  }
+
+  if (entry->second.first) {
+    group = entry->second.second;
+  }
+  return entry->second.first;
+}
+
+void AccountCache::clear() {
+  WriteLock lock(kAccountCacheMutex);
+  kPasswdDatabase.clear();
+  kGroupDatabase.clear();
+}
+}
+}
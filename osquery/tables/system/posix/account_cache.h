@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+namespace osquery {
+namespace tables {
+
+/// A passwd entry copied from the name service.
+struct PasswdEntry {
+  uid_t uid{0};
+  gid_t gid{0};
+  std::string username;
+  std::string description;
+  std::string directory;
+  std::string shell;
+};
+
+/// A group entry copied from the name service.
+struct GroupEntry {
+  gid_t gid{0};
+  std::string groupname;
+};
+
+/**
+ * @brief Users and groups from NSS, shared by the tables that resolve them.
+ *
+ * With LDAP or SSSD backends, each getpwent, getpwuid, or getgrgid call may
+ * be a network request, and tables such as users are often joined per uid.
+ * Enumerations and lookups, including unknown ids, are cached until
+ * /etc/passwd or /etc/group changes, or for --account_cache_ttl seconds as
+ * remote backends change without notice.
+ */
+class AccountCache {
+ public:
+  /// Every user, enumerated with getpwent, in enumeration order.
+  static void getUsers(std::vector<PasswdEntry>& users);
+
+  /// Look up a user by uid, false if there is no such user.
+  static bool getUser(uid_t uid, PasswdEntry& user);
+
+  /// Look up a user by name, false if there is no such user.
+  static bool getUser(const std::string& username, PasswdEntry& user);
+
+  /// Every group, enumerated with getgrent, without duplicate gids.
+  static void getGroups(std::vector<GroupEntry>& groups);
+
+  /// Look up a group by gid, false if there is no such group.
+  static bool getGroup(gid_t gid, GroupEntry& group);
+
+  /// Drop every cached user and group.
+  static void clear();
+};
+}
+}
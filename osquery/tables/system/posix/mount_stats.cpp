@@ -0,0 +1,233 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#ifdef __linux__
+#include <sys/vfs.h>
+#else
+#include <sys/param.h>
+#include <sys/mount.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <system_error>
+#include <thread>
+
+#include <osquery/flags.h>
+#include <osquery/system.h>
+
+#include "osquery/core/metrics.h"
+#include "osquery/tables/system/posix/mount_stats.h"
+
+namespace osquery {
+namespace tables {
+
+FLAG(uint64,
+     mounts_statfs_timeout,
+     1000,
+     "Milliseconds to wait for mount points' statfs (0 waits without limit)");
+
+FLAG(uint64,
+     mounts_statfs_cache,
+     10,
+     "Seconds to cache the capacity of each mount point (0 disables)");
+
+/// The most workers waiting to read mount points, a hung statfs keeps its
+/// worker and another may be started.
+const size_t kMountStatsWorkers{4};
+
+/// The last statfs of a mount point.
+struct MountState {
+  /// Set while a worker reads the mount point.
+  bool pending{false};
+
+  /// Set if the last statfs succeeded.
+  bool ok{false};
+
+  /// When the last statfs returned, 0 if it has not.
+  size_t time{0};
+
+  MountCapacity capacity;
+};
+
+/// The mount points and their workers, protected by one mutex.
+struct MountStatsState {
+  std::mutex mutex;
+  std::condition_variable returned;
+  std::map<std::string, MountState> mounts;
+
+  /// Mount points waiting for a worker, and the same set for lookups.
+  std::deque<std::string> queue;
+  std::set<std::string> queued;
+
+  /// The started workers, and those within a statfs.
+  size_t workers{0};
+  size_t busy{0};
+};
+
+/// A worker that never returns may still hold the state at exit.
+static MountStatsState& getState() {
+  static auto* state = new MountStatsState();
+  return *state;
+}
+
+/// Read a mount point, the state's lock must not be held.
+static void readMount(const std::string& path, MountState& mount) {
+  MountCapacity capacity;
+  struct statfs st;
+  mount.ok = (::statfs(path.c_str(), &st) == 0);
+  if (mount.ok) {
+    capacity.blocks_size = st.f_bsize;
+    capacity.blocks = st.f_blocks;
+    capacity.blocks_free = st.f_bfree;
+    capacity.blocks_available = st.f_bavail;
+    capacity.inodes = st.f_files;
+    capacity.inodes_free = st.f_ffree;
+  }
+  mount.capacity = capacity;
+  mount.time = getUnixTime();
+}
+
+/// Read queued mount points until the queue is empty.
+static void readMounts() {
+  auto& state = getState();
+  std::unique_lock<std::mutex> lock(state.mutex);
+  while (!state.queue.empty()) {
+    // A mount point is pending only once a worker reads it.
+    auto path = std::move(state.queue.front());
+    state.queue.pop_front();
+    state.queued.erase(path);
+    state.mounts[path].pending = true;
+    state.busy++;
+    lock.unlock();
+
+    MountState mount;
+    readMount(path, mount);
+
+    lock.lock();
+    state.busy--;
+    state.mounts[path] = mount;
+    state.returned.notify_all();
+  }
+  state.workers--;
+}
+
+void MountStats::get(const std::vector<std::string>& paths,
+                     std::map<std::string, MountCapacity>& capacities) {
+  auto& state = getState();
+  std::unique_lock<std::mutex> lock(state.mutex);
+
+  auto now = getUnixTime();
+  std::vector<std::string> requested;
+  for (const auto& path : paths) {
+    auto& mount = state.mounts[path];
+    if (mount.pending) {
+      // The mount point has not responded to an earlier query.
+      continue;
+    }
+
+    if (mount.time != 0 && now < mount.time + FLAGS_mounts_statfs_cache) {
+      continue;
+    }
+    requested.push_back(path);
+  }
+
+  if (FLAGS_mounts_statfs_timeout == 0) {
+    lock.unlock();
+    std::vector<MountState> read(requested.size());
+    for (size_t i = 0; i < requested.size(); i++) {
+      readMount(requested[i], read[i]);
+    }
+    lock.lock();
+    for (size_t i = 0; i < requested.size(); i++) {
+      if (!state.mounts[requested[i]].pending) {
+        state.mounts[requested[i]] = read[i];
+      }
+    }
+  } else if (!requested.empty()) {
+    // Mount points queued by an earlier query stay in the queue.
+    for (const auto& path : requested) {
+      if (state.queued.insert(path).second) {
+        state.queue.push_back(path);
+      }
+    }
+
+    // Workers within a hung statfs do not read the queue.
+    auto wanted = std::min(state.queue.size(), kMountStatsWorkers);
+    while (state.workers - state.busy < wanted) {
+      try {
+        std::thread(readMounts).detach();
+        state.workers++;
+      } catch (const std::system_error& /* e */) {
+        if (state.workers == 0) {
+          // Without a worker the mount points are read by the query.
+          state.workers++;
+          lock.unlock();
+          readMounts();
+          lock.lock();
+        }
+        break;
+      }
+    }
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(FLAGS_mounts_statfs_timeout);
+    state.returned.wait_until(lock, deadline, [&state, &requested]() {
+      for (const auto& path : requested) {
+        if (state.mounts[path].pending || state.queued.count(path) > 0) {
+          return false;
+        }
+      }
+      return true;
+    });
+  }
+
+  size_t unresponsive = 0;
+  for (const auto& path : paths) {
+    const auto& mount = state.mounts[path];
+    if (mount.pending || state.queued.count(path) > 0) {
+      unresponsive++;
+    } else if (mount.ok) {
+      capacities[path] = mount.capacity;
+    }
+  }
+
+  if (unresponsive > 0) {
+    static auto& timeouts = Metrics::counter("mounts_statfs_timeouts");
+    timeouts.add(unresponsive);
+  }
+}
+
+void MountStats::fill(const MountCapacity& capacity, Row& r) {
+  r["blocks_size"] = BIGINT(capacity.blocks_size);
+  r["blocks"] = BIGINT(capacity.blocks);
+  r["blocks_free"] = BIGINT(capacity.blocks_free);
+  r["blocks_available"] = BIGINT(capacity.blocks_available);
+  r["inodes"] = BIGINT(capacity.inodes);
+  r["inodes_free"] = BIGINT(capacity.inodes_free);
+}
+
+void MountStats::clear() {
+  auto& state = getState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  for (auto it = state.mounts.begin(); it != state.mounts.end();) {
+    if (it->second.pending || state.queued.count(it->first) > 0) {
+      ++it;
+    } else {
+      it = state.mounts.erase(it);
+    }
+  }
+}
+}
+}
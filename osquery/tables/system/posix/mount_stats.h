@@ -0,0 +1,60 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/// The capacity of a mounted filesystem, as reported by statfs.
+struct MountCapacity {
+  unsigned long long blocks_size{0};
+  unsigned long long blocks{0};
+  unsigned long long blocks_free{0};
+  unsigned long long blocks_available{0};
+  unsigned long long inodes{0};
+  unsigned long long inodes_free{0};
+};
+
+/**
+ * @brief Capacities of mount points, read without blocking on a hung mount.
+ *
+ * A statfs of a network filesystem whose server does not respond may never
+ * return, which would block the mounts table and every query scheduled after
+ * it. Each statfs runs on a worker thread instead, and mount points that do
+ * not respond within `--mounts_statfs_timeout` milliseconds have no capacity.
+ * A mount whose statfs has not yet returned is not read again until it does.
+ * Capacities are cached for `--mounts_statfs_cache` seconds.
+ */
+class MountStats {
+ public:
+  /**
+   * @brief Read the capacity of each mount point.
+   *
+   * @param paths The mount points.
+   * @param capacities Filled with the mount points that responded.
+   */
+  static void get(const std::vector<std::string>& paths,
+                  std::map<std::string, MountCapacity>& capacities);
+
+  /// Add the capacity columns to a mounts row.
+  static void fill(const MountCapacity& capacity, Row& r);
+
+  /// Drop every cached capacity, a pending statfs is still awaited.
+  static void clear();
+};
+}
+}
@@ -8,8 +8,6 @@
  *
  */
 
-#include <pwd.h>
-#include <grp.h>
 #include <sys/stat.h>
 
 #include <boost/filesystem.hpp>
@@ -18,6 +16,8 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/posix/account_cache.h"
+
 namespace fs = boost::filesystem;
 
 namespace osquery {
@@ -38,20 +38,20 @@ Status genBin(const fs::path& path, int perms, QueryData& results) {
   // store path
   Row r;
   r["path"] = path.string();
-  struct passwd* pw = getpwuid(info.st_uid);
-  struct group* gr = getgrgid(info.st_gid);
 
   // get user name + group
   std::string user;
-  if (pw != nullptr) {
-    user = std::string(pw->pw_name);
+  PasswdEntry pw;
+  GroupEntry gr;
+  if (AccountCache::getUser(info.st_uid, pw)) {
+    user = pw.username;
   } else {
     user = boost::lexical_cast<std::string>(info.st_uid);
   }
 
   std::string group;
-  if (gr != nullptr) {
-    group = std::string(gr->gr_name);
+  if (AccountCache::getGroup(info.st_gid, gr)) {
+    group = gr.groupname;
   } else {
     group = boost::lexical_cast<std::string>(info.st_gid);
   }
@@ -0,0 +1,60 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "osquery/tables/system/posix/account_cache.h"
+
+namespace osquery {
+namespace tables {
+
+class AccountCacheTests : public testing::Test {
+ protected:
+  void TearDown() override {
+    AccountCache::clear();
+  }
+};
+
+TEST_F(AccountCacheTests, test_user_lookups) {
+  PasswdEntry user;
+  ASSERT_TRUE(AccountCache::getUser(0, user));
+  EXPECT_EQ(user.uid, 0U);
+  EXPECT_FALSE(user.username.empty());
+
+  // Lookups by name and enumeration return the same entry.
+  PasswdEntry named;
+  ASSERT_TRUE(AccountCache::getUser(user.username, named));
+  EXPECT_EQ(named.uid, user.uid);
+  EXPECT_EQ(named.directory, user.directory);
+
+  std::vector<PasswdEntry> users;
+  AccountCache::getUsers(users);
+  bool found = false;
+  for (const auto& entry : users) {
+    found = found || (entry.uid == 0 && entry.username == user.username);
+  }
+  EXPECT_TRUE(found);
+}
+
+TEST_F(AccountCacheTests, test_missing_entries) {
+  // Unknown ids are cached as missing and still report failure.
+  PasswdEntry user;
+  EXPECT_FALSE(AccountCache::getUser("osquery-no-such-user", user));
+  EXPECT_FALSE(AccountCache::getUser("osquery-no-such-user", user));
+
+  GroupEntry group;
+  ASSERT_TRUE(AccountCache::getGroup(0, group));
+  EXPECT_EQ(group.gid, 0U);
+  EXPECT_FALSE(group.groupname.empty());
+}
+}
+}
@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/tables/system/posix/mount_stats.h"
+
+namespace osquery {
+namespace tables {
+
+DECLARE_uint64(mounts_statfs_timeout);
+
+class MountStatsTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    timeout_ = FLAGS_mounts_statfs_timeout;
+  }
+
+  void TearDown() override {
+    FLAGS_mounts_statfs_timeout = timeout_;
+    MountStats::clear();
+  }
+
+ private:
+  unsigned long long timeout_{0};
+};
+
+TEST_F(MountStatsTests, test_get_capacities) {
+  std::map<std::string, MountCapacity> capacities;
+  MountStats::get({"/", "/osquery/does/not/exist"}, capacities);
+
+  // A mount point that cannot be read has no capacity.
+  ASSERT_EQ(capacities.size(), 1U);
+  ASSERT_EQ(capacities.count("/"), 1U);
+  EXPECT_GT(capacities["/"].blocks_size, 0U);
+  EXPECT_GT(capacities["/"].blocks, 0U);
+
+  Row r;
+  MountStats::fill(capacities["/"], r);
+  EXPECT_EQ(r["blocks"], BIGINT(capacities["/"].blocks));
+  EXPECT_EQ(r.count("inodes_free"), 1U);
+}
+
+TEST_F(MountStatsTests, test_get_without_timeout) {
+  // The mount points are read by the query.
+  FLAGS_mounts_statfs_timeout = 0;
+  std::map<std::string, MountCapacity> capacities;
+  MountStats::get({"/"}, capacities);
+  ASSERT_EQ(capacities.count("/"), 1U);
+
+  // A cached capacity is returned again.
+  std::map<std::string, MountCapacity> cached;
+  MountStats::get({"/"}, cached);
+  ASSERT_EQ(cached.count("/"), 1U);
+  EXPECT_EQ(cached["/"].blocks, capacities["/"].blocks);
+}
+}
+}
@@ -11,11 +11,13 @@
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
+#include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/hash.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
@@ -130,5 +132,30 @@ TEST_F(SystemsTablesTests, test_abstract_joins) {
     ASSERT_GT(results.rows().size(), 1U);
   }
 }
+TEST_F(SystemsTablesTests, test_hash_cache) {
+  auto path = kTestWorkingDirectory + "hash-cache.txt";
+  ASSERT_TRUE(writeTextFile(path, "cached content").ok());
+
+  auto before = getHashCacheStats();
+  auto first = hashMultiFromFile(HASH_TYPE_SHA1, path);
+  auto second = hashMultiFromFile(HASH_TYPE_SHA1, path);
+  EXPECT_EQ(first.sha1, second.sha1);
+
+  // The second request is served from the cache.
+  auto after = getHashCacheStats();
+  EXPECT_EQ(before.misses + 1, after.misses);
+  EXPECT_EQ(before.hits + 1, after.hits);
+
+  // Changing the content invalidates the entry.
+  ASSERT_TRUE(writeTextFile(path, "changed content, and size").ok());
+  auto third = hashMultiFromFile(HASH_TYPE_SHA1, path);
+  EXPECT_NE(first.sha1, third.sha1);
+  EXPECT_EQ(third.sha1, hashFromFile(HASH_TYPE_SHA1, path));
+
+  // The table reports the counters.
+  SQL results("select * from osquery_hash_cache");
+  ASSERT_EQ(results.rows().size(), 1U);
+  EXPECT_GT(AS_LITERAL(BIGINT_LITERAL, results.rows()[0].at("hits")), 0);
+}
 }
 }
@@ -21,7 +21,18 @@ namespace tables {
 QueryData genInstalledPatches(QueryContext& context) {
   QueryData results;
 
-  WmiRequest wmiSystemReq("select * from Win32_QuickFixEngineering");
+  // Enumerating hotfixes is slow and the list rarely changes.
+  auto query = WmiRequest::selectUsed(context,
+                                      "Win32_QuickFixEngineering",
+                                      {{"csname", "CSName"},
+                                       {"hotfix_id", "HotFixID"},
+                                       {"caption", "Caption"},
+                                       {"description", "Description"},
+                                       {"fix_comments", "FixComments"},
+                                       {"installed_by", "InstalledBy"},
+                                       {"install_date", "InstallDate"},
+                                       {"installed_on", "InstalledOn"}});
+  WmiRequest wmiSystemReq(query, (BSTR)L"ROOT\\CIMV2", 60);
   std::vector<WmiResultItem>& wmiResults = wmiSystemReq.results();
 
   if (wmiResults.size() != 0) {
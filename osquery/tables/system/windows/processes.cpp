@@ -8,18 +8,16 @@
  *
  */
 
-#include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #define _WIN32_DCOM
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #include <psapi.h>
 #include <stdlib.h>
-
-#include <boost/algorithm/string/join.hpp>
-#include <boost/algorithm/string/trim.hpp>
-#include <boost/lexical_cast.hpp>
+#include <winternl.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
@@ -35,6 +33,63 @@ int getUidFromSid(PSID sid);
 int getGidFromSid(PSID sid);
 namespace tables {
 
+/// The NTSTATUS returned when a snapshot does not fit the buffer.
+const NTSTATUS kStatusInfoLengthMismatch = 0xC0000004;
+
+/// The initial process snapshot buffer size, grown to the required size.
+const ULONG kProcessSnapshotSize = 512 * 1024;
+
+/// The documented layout of a SystemProcessInformation entry.
+struct ProcessSnapshotEntry {
+  ULONG NextEntryOffset;
+  ULONG NumberOfThreads;
+  LARGE_INTEGER WorkingSetPrivateSize;
+  ULONG HardFaultCount;
+  ULONG NumberOfThreadsHighWatermark;
+  ULONGLONG CycleTime;
+  LARGE_INTEGER CreateTime;
+  LARGE_INTEGER UserTime;
+  LARGE_INTEGER KernelTime;
+  UNICODE_STRING ImageName;
+  LONG BasePriority;
+  HANDLE UniqueProcessId;
+  HANDLE InheritedFromUniqueProcessId;
+  ULONG HandleCount;
+  ULONG SessionId;
+  ULONG_PTR UniqueProcessKey;
+  SIZE_T PeakVirtualSize;
+  SIZE_T VirtualSize;
+  ULONG PageFaultCount;
+  SIZE_T PeakWorkingSetSize;
+  SIZE_T WorkingSetSize;
+  SIZE_T QuotaPeakPagedPoolUsage;
+  SIZE_T QuotaPagedPoolUsage;
+  SIZE_T QuotaPeakNonPagedPoolUsage;
+  SIZE_T QuotaNonPagedPoolUsage;
+  SIZE_T PagefileUsage;
+  SIZE_T PeakPagefileUsage;
+  SIZE_T PrivatePageCount;
+};
+
+using NtQuerySystemInformationFn = NTSTATUS(NTAPI*)(SYSTEM_INFORMATION_CLASS,
+                                                    PVOID,
+                                                    ULONG,
+                                                    PULONG);
+
+using NtQueryInformationProcessFn =
+    NTSTATUS(NTAPI*)(HANDLE, PROCESSINFOCLASS, PVOID, ULONG, PULONG);
+
+/// Resolve an ntdll export, ntdll is loaded into every process.
+static FARPROC getNtdllProc(const char* name) {
+  auto ntdll = GetModuleHandleA("ntdll.dll");
+  return (ntdll == nullptr) ? nullptr : GetProcAddress(ntdll, name);
+}
+
+/// The snapshot holds process IDs as handles.
+static long getSnapshotPid(HANDLE id) {
+  return static_cast<long>(reinterpret_cast<ULONG_PTR>(id));
+}
+
 std::set<long> getSelectedPids(const QueryContext& context) {
   std::set<long> pidlist;
   if (context.constraints.count("pid") > 0 &&
@@ -50,53 +105,122 @@ std::set<long> getSelectedPids(const QueryContext& context) {
   return pidlist;
 }
 
-void genProcess(const WmiResultItem& result, QueryData& results_data) {
-  Row r;
-  Status s;
-  long pid;
-  long lPlaceHolder;
-  std::string sPlaceHolder;
-  HANDLE hProcess = nullptr;
+/**
+ * @brief Read every process's core accounting with a single system call.
+ *
+ * The snapshot replaces a WMI Win32_Process query and the per-process calls
+ * that followed it. The buffer holds ProcessSnapshotEntry structures, each
+ * followed by its threads and image name.
+ */
+static Status getProcessSnapshot(std::vector<char>& buffer) {
+  static auto query = reinterpret_cast<NtQuerySystemInformationFn>(
+      getNtdllProc("NtQuerySystemInformation"));
+  if (query == nullptr) {
+    return Status(1, "Cannot resolve NtQuerySystemInformation");
+  }
 
-  /// Store current process pid for more efficient API use.
-  auto currentPid = GetCurrentProcessId();
+  ULONG size = (buffer.empty()) ? kProcessSnapshotSize : buffer.size();
+  for (size_t attempt = 0; attempt < 5; attempt++) {
+    buffer.resize(size);
+    ULONG needed = 0;
+    auto status = query(SystemProcessInformation, buffer.data(), size, &needed);
+    if (status == kStatusInfoLengthMismatch) {
+      // Processes may start between the calls, leave space for them.
+      size = needed + kProcessSnapshotSize / 4;
+      continue;
+    }
 
-  s = result.GetLong("ProcessId", pid);
-  r["pid"] = s.ok() ? BIGINT(pid) : BIGINT(-1);
+    if (!NT_SUCCESS(status)) {
+      return Status(1, "Process snapshot failed: " + std::to_string(status));
+    }
+    return Status(0, "OK");
+  }
+  return Status(1, "Process snapshot did not fit its buffer");
+}
 
-  long uid = -1;
-  long gid = -1;
-  if (pid == currentPid) {
-    hProcess = GetCurrentProcess();
-  } else {
-    hProcess =
-        OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, false, pid);
+/// Read the command line from the process environment block.
+static std::string getProcessCommandLine(HANDLE process) {
+  static auto query = reinterpret_cast<NtQueryInformationProcessFn>(
+      getNtdllProc("NtQueryInformationProcess"));
+  if (query == nullptr || process == nullptr) {
+    return "";
   }
 
-  if (GetLastError() == ERROR_ACCESS_DENIED) {
-    uid = 0;
-    gid = 0;
+  PROCESS_BASIC_INFORMATION info;
+  if (!NT_SUCCESS(query(process,
+                        ProcessBasicInformation,
+                        &info,
+                        sizeof(info),
+                        nullptr)) ||
+      info.PebBaseAddress == nullptr) {
+    return "";
   }
 
-  result.GetString("Name", r["name"]);
-  result.GetString("ExecutablePath", r["path"]);
-  result.GetString("CommandLine", r["cmdline"]);
-  result.GetString("ExecutionState", r["state"]);
-  result.GetLong("ParentProcessId", lPlaceHolder);
-  r["parent"] = BIGINT(lPlaceHolder);
-  result.GetLong("Priority", lPlaceHolder);
-  r["nice"] = INTEGER(lPlaceHolder);
-  r["on_disk"] = osquery::pathExists(r["path"]).toString();
-
-  std::vector<char> fileName(MAX_PATH);
-  fileName.assign(MAX_PATH + 1, '\0');
-  if (pid == currentPid) {
-    GetModuleFileName(nullptr, fileName.data(), MAX_PATH);
-  } else {
-    GetModuleFileNameEx(hProcess, nullptr, fileName.data(), MAX_PATH);
+  PEB peb;
+  RTL_USER_PROCESS_PARAMETERS params;
+  if (!ReadProcessMemory(
+          process, info.PebBaseAddress, &peb, sizeof(peb), nullptr) ||
+      !ReadProcessMemory(process,
+                         peb.ProcessParameters,
+                         &params,
+                         sizeof(params),
+                         nullptr)) {
+    return "";
   }
-  r["cwd"] = SQL_TEXT(fileName.data());
-  r["root"] = r["cwd"];
+
+  auto length = params.CommandLine.Length / sizeof(wchar_t);
+  std::vector<wchar_t> cmdline(length + 1, L'\0');
+  if (length == 0 ||
+      !ReadProcessMemory(process,
+                         params.CommandLine.Buffer,
+                         cmdline.data(),
+                         params.CommandLine.Length,
+                         nullptr)) {
+    return "";
+  }
+  return wstringToString(cmdline.data());
+}
+
+/// Read the on-disk path of the process image.
+static std::string getProcessPath(HANDLE process) {
+  std::vector<char> path(MAX_PATH + 1, '\0');
+  auto size = static_cast<DWORD>(MAX_PATH);
+  if (process == nullptr ||
+      !QueryFullProcessImageNameA(process, 0, path.data(), &size)) {
+    return "";
+  }
+  return std::string(path.data(), size);
+}
+
+void genProcess(const ProcessSnapshotEntry& proc,
+                QueryContext& context,
+                QueryData& results_data) {
+  auto pid = getSnapshotPid(proc.UniqueProcessId);
+  auto parent = getSnapshotPid(proc.InheritedFromUniqueProcessId);
+
+  std::string name;
+  if (proc.ImageName.Buffer != nullptr && proc.ImageName.Length > 0) {
+    name = wstringToString(
+        std::wstring(proc.ImageName.Buffer,
+                     proc.ImageName.Length / sizeof(wchar_t))
+            .c_str());
+  } else if (pid == 0) {
+    name = "System Idle Process";
+  }
+
+  // Skip opening processes SQLite filters.
+  if (!context.admits("parent", BIGINT(parent)) ||
+      !context.admits("name", name)) {
+    return;
+  }
+
+  Row r;
+  r["pid"] = BIGINT(pid);
+  r["parent"] = BIGINT(parent);
+  r["name"] = name;
+  r["state"] = "";
+  r["nice"] = INTEGER(proc.BasePriority);
+  r["threads"] = INTEGER(proc.NumberOfThreads);
 
   r["pgroup"] = "-1";
   r["euid"] = "-1";
@@ -105,24 +229,57 @@ void genProcess(const WmiResultItem& result, QueryData& results_data) {
   r["sgid"] = "-1";
   r["start_time"] = "0";
 
-  result.GetString("UserModeTime", sPlaceHolder);
-  long long llHolder;
-  osquery::safeStrtoll(sPlaceHolder, 10, llHolder);
-  r["user_time"] = BIGINT(llHolder / 10000000);
-  result.GetString("KernelModeTime", sPlaceHolder);
-  osquery::safeStrtoll(sPlaceHolder, 10, llHolder);
-  r["system_time"] = BIGINT(llHolder / 10000000);
-  result.GetString("PrivatePageCount", sPlaceHolder);
-  r["wired_size"] = BIGINT(sPlaceHolder);
-  result.GetString("WorkingSetSize", sPlaceHolder);
-  r["resident_size"] = sPlaceHolder;
-  result.GetString("VirtualSize", sPlaceHolder);
-  r["total_size"] = BIGINT(sPlaceHolder);
+  // The snapshot times are in 100ns intervals.
+  r["user_time"] = BIGINT(proc.UserTime.QuadPart / 10000000);
+  r["system_time"] = BIGINT(proc.KernelTime.QuadPart / 10000000);
+  r["wired_size"] = BIGINT(proc.PrivatePageCount);
+  r["resident_size"] = BIGINT(proc.WorkingSetSize);
+  r["total_size"] = BIGINT(proc.VirtualSize);
+
+  // The remaining columns need the process opened, only if they are used.
+  auto use_path = context.isAnyColumnUsed({"path", "on_disk", "cwd", "root"});
+  auto use_cmdline = context.isColumnUsed("cmdline");
+  auto use_owner = context.isAnyColumnUsed({"uid", "gid"});
+  if (!use_path && !use_cmdline && !use_owner) {
+    results_data.push_back(r);
+    return;
+  }
+
+  HANDLE hProcess = nullptr;
+  if (pid == static_cast<long>(GetCurrentProcessId())) {
+    hProcess = GetCurrentProcess();
+  } else {
+    // The command line is read from the process memory.
+    DWORD access = (use_cmdline) ? PROCESS_QUERY_INFORMATION | PROCESS_VM_READ
+                                 : PROCESS_QUERY_LIMITED_INFORMATION;
+    hProcess = OpenProcess(access, false, pid);
+  }
+
+  long uid = -1;
+  long gid = -1;
+  if (hProcess == nullptr && GetLastError() == ERROR_ACCESS_DENIED) {
+    uid = 0;
+    gid = 0;
+  }
+
+  if (use_path) {
+    r["path"] = getProcessPath(hProcess);
+    r["on_disk"] = osquery::pathExists(r["path"]).toString();
+    r["cwd"] = r["path"];
+    r["root"] = r["cwd"];
+  }
+
+  if (use_cmdline) {
+    r["cmdline"] = getProcessCommandLine(hProcess);
+  }
 
   /// Get the process UID and GID from its SID
   HANDLE tok = nullptr;
+  BOOL ret = 0;
   std::vector<char> tokOwner(sizeof(TOKEN_OWNER), 0x0);
-  auto ret = OpenProcessToken(hProcess, TOKEN_READ, &tok);
+  if (use_owner && hProcess != nullptr) {
+    ret = OpenProcessToken(hProcess, TOKEN_READ, &tok);
+  }
   if (ret != 0 && tok != nullptr) {
     unsigned long tokOwnerBuffLen;
     ret = GetTokenInformation(tok, TokenOwner, nullptr, 0, &tokOwnerBuffLen);
@@ -141,7 +298,7 @@ void genProcess(const WmiResultItem& result, QueryData& results_data) {
     r["gid"] = INTEGER(gid);
   }
 
-  if (hProcess != nullptr) {
+  if (hProcess != nullptr && hProcess != GetCurrentProcess()) {
     CloseHandle(hProcess);
     hProcess = nullptr;
   }
@@ -155,27 +312,27 @@ void genProcess(const WmiResultItem& result, QueryData& results_data) {
 QueryData genProcesses(QueryContext& context) {
   QueryData results;
 
-  std::string query = "SELECT * FROM Win32_Process";
+  std::vector<char> buffer;
+  auto status = getProcessSnapshot(buffer);
+  if (!status.ok()) {
+    VLOG(1) << status.getMessage();
+    return results;
+  }
 
   auto pidlist = getSelectedPids(context);
-  if (pidlist.size() > 0) {
-    std::vector<std::string> constraints;
-    for (const auto& pid : pidlist) {
-      constraints.push_back("ProcessId=" + std::to_string(pid));
+  size_t offset = 0;
+  while (offset + sizeof(ProcessSnapshotEntry) <= buffer.size()) {
+    const auto& proc =
+        *reinterpret_cast<const ProcessSnapshotEntry*>(buffer.data() + offset);
+    auto pid = getSnapshotPid(proc.UniqueProcessId);
+    if (pidlist.empty() || pidlist.count(pid) > 0) {
+      genProcess(proc, context, results);
     }
-    if (constraints.size() > 0) {
-      query += " WHERE " + boost::algorithm::join(constraints, " OR ");
-    }
-  }
 
-  WmiRequest request(query);
-  if (request.getStatus().ok()) {
-    for (const auto& item : request.results()) {
-      long pid = 0;
-      if (item.GetLong("ProcessId", pid).ok()) {
-        genProcess(item, results);
-      }
+    if (proc.NextEntryOffset == 0) {
+      break;
     }
+    offset += proc.NextEntryOffset;
   }
 
   return results;
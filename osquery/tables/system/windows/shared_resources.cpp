@@ -22,7 +22,17 @@ namespace tables {
 QueryData genShares(QueryContext& context) {
   QueryData results_data;
 
-  WmiRequest request("SELECT * FROM Win32_Share");
+  auto query = WmiRequest::selectUsed(context,
+                                      "Win32_Share",
+                                      {{"description", "Description"},
+                                       {"install_date", "InstallDate"},
+                                       {"status", "Status"},
+                                       {"allow_maximum", "AllowMaximum"},
+                                       {"maximum_allowed", "MaximumAllowed"},
+                                       {"name", "Name"},
+                                       {"path", "Path"},
+                                       {"type", "Type"}});
+  WmiRequest request(query);
   if (request.getStatus().ok()) {
     std::vector<WmiResultItem>& results = request.results();
     for (const auto& result : results) {
@@ -34,7 +34,9 @@ QueryData genSystemInfo(QueryContext& context) {
     }
   }
 
-  WmiRequest wmiSystemReq("select * from Win32_ComputerSystem");
+  // The computer system's hardware does not change between queries.
+  WmiRequest wmiSystemReq(
+      "select * from Win32_ComputerSystem", (BSTR)L"ROOT\\CIMV2", 60);
   std::vector<WmiResultItem>& wmiResults = wmiSystemReq.results();
   if (wmiResults.size() != 0) {
     long numProcs = 0;
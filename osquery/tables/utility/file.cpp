@@ -16,6 +16,9 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/filesystem/file_cache.h"
+#include "osquery/tables/columns/file.h"
+
 namespace fs = boost::filesystem;
 
 namespace osquery {
@@ -33,71 +36,78 @@ const std::map<fs::file_type, std::string> kTypeNames{
     {fs::status_error, "error"},
 };
 
+using Col = FileColumns;
+
 void genFileInfo(const fs::path& path,
                  const fs::path& parent,
                  const std::string& pattern,
-                 QueryData& results) {
+                 QueryContext& context,
+                 RowBatch& batch) {
   // Must provide the path, filename, directory separate from boost path->string
   // helpers to match any explicit (query-parsed) predicate constraints.
-#if !defined(WIN32)
-  // On POSIX systems, first check the link state.
-  struct stat link_stat;
-  if (lstat(path.string().c_str(), &link_stat) < 0) {
-    // Path was not real, had too may links, or could not be accessed.
+  // Skip the stat calls for paths SQLite would filter, such as the entries of
+  // a directory, or the union of several path patterns, that do not match
+  // every path and filename constraint.
+  if (!context.admits("path", path.string()) ||
+      !context.admits("filename", path.filename().string())) {
     return;
   }
-#endif
 
+  // Paths in directories watched for changes may skip the stat.
   struct stat file_stat;
-  if (stat(path.string().c_str(), &file_stat)) {
+  if (!FileMetadataCache::instance().stat(path.string(), file_stat)) {
     // Path was not real, had too may links, or could not be accessed.
     return;
   }
 
-  Row r;
-  r["path"] = path.string();
-  r["filename"] = path.filename().string();
-  r["directory"] = parent.string();
+  FileRow r(batch);
+  r.set<Col::path>(path.string());
+  r.set<Col::filename>(path.filename().string());
+  r.set<Col::directory>(parent.string());
 
-  r["inode"] = BIGINT(file_stat.st_ino);
-  r["uid"] = BIGINT(file_stat.st_uid);
-  r["gid"] = BIGINT(file_stat.st_gid);
-  r["mode"] = lsperms(file_stat.st_mode);
-  r["device"] = BIGINT(file_stat.st_rdev);
-  r["size"] = BIGINT(file_stat.st_size);
+  r.set<Col::inode>(file_stat.st_ino);
+  r.set<Col::uid>(file_stat.st_uid);
+  r.set<Col::gid>(file_stat.st_gid);
+  r.set<Col::mode>(lsperms(file_stat.st_mode));
+  r.set<Col::device>(file_stat.st_rdev);
+  r.set<Col::size>(file_stat.st_size);
 
 #if !defined(WIN32)
-  r["block_size"] = INTEGER(file_stat.st_blksize);
-  r["hard_links"] = INTEGER(file_stat.st_nlink);
+  r.set<Col::block_size>(file_stat.st_blksize);
+  r.set<Col::hard_links>(file_stat.st_nlink);
 #endif
 
   // Times
-  r["atime"] = BIGINT(file_stat.st_atime);
-  r["mtime"] = BIGINT(file_stat.st_mtime);
-  r["ctime"] = BIGINT(file_stat.st_ctime);
+  r.set<Col::atime>(file_stat.st_atime);
+  r.set<Col::mtime>(file_stat.st_mtime);
+  r.set<Col::ctime>(file_stat.st_ctime);
 #if defined(__linux__) || defined(WIN32)
   // No 'birth' or create time in Linux or Windows.
-  r["btime"] = "0";
+  r.set<Col::btime>(0);
 #else
-  r["btime"] = BIGINT(file_stat.st_birthtimespec.tv_sec);
+  r.set<Col::btime>(file_stat.st_birthtimespec.tv_sec);
 #endif
 
-  // Type booleans
+  // Type booleans, this requires an additional status lookup.
+  if (!context.isColumnUsed("type")) {
+    return;
+  }
+
   boost::system::error_code ec;
   auto status = fs::status(path, ec);
   if (kTypeNames.count(status.type())) {
-    r["type"] = kTypeNames.at(status.type());
+    r.set<Col::type>(kTypeNames.at(status.type()));
   } else {
-    r["type"] = "unknown";
+    r.set<Col::type>(std::string("unknown"));
   }
-
-  results.push_back(r);
 }
 
-QueryData genFile(QueryContext& context) {
-  QueryData results;
-
+void genFile(RowBatch& batch, QueryContext& context) {
   // Resolve file paths for EQUALS and LIKE operations.
+  // Recursive patterns skip the subtrees the path constraints do not admit.
+  auto path_filter = [&context](const std::string& directory) {
+    return context.constraints["path"].admitsPrefix(directory);
+  };
   auto paths = context.constraints["path"].getAll(EQUALS);
   context.expandConstraints(
       "path",
@@ -105,8 +115,8 @@ QueryData genFile(QueryContext& context) {
       paths,
       ([&](const std::string& pattern, std::set<std::string>& out) {
         std::vector<std::string> patterns;
-        auto status =
-            resolveFilePattern(pattern, patterns, GLOB_ALL | GLOB_NO_CANON);
+        auto status = resolveFilePattern(
+            pattern, patterns, GLOB_ALL | GLOB_NO_CANON, path_filter);
         if (status.ok()) {
           for (const auto& resolved : patterns) {
             out.insert(resolved);
@@ -117,11 +127,17 @@ QueryData genFile(QueryContext& context) {
 
   // Iterate through each of the resolved/supplied paths.
   for (const auto& path_string : paths) {
+    if (QueryBudget::interrupted()) {
+      return;
+    }
     fs::path path = path_string;
-    genFileInfo(path, path.parent_path(), "", results);
+    genFileInfo(path, path.parent_path(), "", context, batch);
   }
 
   // Resolve directories for EQUALS and LIKE operations.
+  auto directory_filter = [&context](const std::string& directory) {
+    return context.constraints["directory"].admitsPrefix(directory);
+  };
   auto directories = context.constraints["directory"].getAll(EQUALS);
   context.expandConstraints(
       "directory",
@@ -129,8 +145,8 @@ QueryData genFile(QueryContext& context) {
       directories,
       ([&](const std::string& pattern, std::set<std::string>& out) {
         std::vector<std::string> patterns;
-        auto status =
-            resolveFilePattern(pattern, patterns, GLOB_FOLDERS | GLOB_NO_CANON);
+        auto status = resolveFilePattern(
+            pattern, patterns, GLOB_FOLDERS | GLOB_NO_CANON, directory_filter);
         if (status.ok()) {
           for (const auto& resolved : patterns) {
             out.insert(resolved);
@@ -141,6 +157,10 @@ QueryData genFile(QueryContext& context) {
 
   // Now loop through constraints using the directory column constraint.
   for (const auto& directory_string : directories) {
+    if (!context.admits("directory", directory_string)) {
+      // A directory resolved from one pattern may not match the others.
+      continue;
+    }
     if (!isReadable(directory_string) || !isDirectory(directory_string)) {
       continue;
     }
@@ -149,14 +169,16 @@ QueryData genFile(QueryContext& context) {
       // Iterate over the directory and generate info for each regular file.
       fs::directory_iterator begin(directory_string), end;
       for (; begin != end; ++begin) {
-        genFileInfo(begin->path(), directory_string, "", results);
+        if (QueryBudget::interrupted()) {
+          // The query is stopped, large directories are not read to the end.
+          return;
+        }
+        genFileInfo(begin->path(), directory_string, "", context, batch);
       }
     } catch (const fs::filesystem_error& /* e */) {
       continue;
     }
   }
-
-  return results;
 }
 }
 }
@@ -10,6 +10,7 @@
 
 #include <osquery/config.h>
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/events.h>
 #include <osquery/extensions.h>
 #include <osquery/filesystem.h>
@@ -21,7 +22,11 @@
 #include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/core/metrics.h"
 #include "osquery/core/process.h"
+#include "osquery/core/worker_stats.h"
+#include "osquery/sql/sqlite_util.h"
 
 namespace osquery {
 
@@ -39,17 +44,28 @@ QueryData genOsqueryEvents(QueryContext& context) {
     r["name"] = publisher;
     r["publisher"] = publisher;
     r["type"] = "publisher";
+    // Publishers do not queue or store events.
+    r["queue_depth"] = "0";
+    r["queue_drops"] = "0";
+    r["rate_limited"] = "0";
+    r["sampled"] = "0";
+    r["expired"] = "0";
+    r["expire_pending"] = "0";
 
     auto pubref = EventFactory::getEventPublisher(publisher);
     if (pubref != nullptr) {
       r["subscriptions"] = INTEGER(pubref->numSubscriptions());
       r["events"] = INTEGER(pubref->numEvents());
       r["refreshes"] = INTEGER(pubref->restartCount());
+      r["coalesced"] = INTEGER(pubref->numCoalesced());
+      r["drops"] = INTEGER(pubref->numDropped());
       r["active"] = (pubref->hasStarted() && !pubref->isEnding()) ? "1" : "0";
     } else {
       r["subscriptions"] = "0";
       r["events"] = "0";
       r["refreshes"] = "0";
+      r["coalesced"] = "0";
+      r["drops"] = "0";
       r["active"] = "-1";
     }
     results.push_back(r);
@@ -60,20 +76,34 @@ QueryData genOsqueryEvents(QueryContext& context) {
     Row r;
     r["name"] = subscriber;
     r["type"] = "subscriber";
-    // Subscribers will never 'restart'.
+    // Subscribers will never 'restart' or coalesce.
     r["refreshes"] = "0";
+    r["coalesced"] = "0";
+    r["drops"] = "0";
 
     auto subref = EventFactory::getEventSubscriber(subscriber);
     if (subref != nullptr) {
       r["publisher"] = subref->getType();
       r["subscriptions"] = INTEGER(subref->numSubscriptions());
       r["events"] = INTEGER(subref->numEvents());
+      r["queue_depth"] = INTEGER(subref->queueDepth());
+      r["queue_drops"] = INTEGER(subref->queueDrops());
+      r["rate_limited"] = INTEGER(subref->rateLimited());
+      r["sampled"] = INTEGER(subref->sampledOut());
+      r["expired"] = INTEGER(subref->expiredEvents());
+      r["expire_pending"] = INTEGER(subref->pendingExpiration());
 
       // Subscribers are always active, even if their publisher is not.
       r["active"] = (subref->state() == EventState::EVENT_RUNNING) ? "1" : "0";
     } else {
       r["subscriptions"] = "0";
       r["events"] = "0";
+      r["queue_depth"] = "0";
+      r["queue_drops"] = "0";
+      r["rate_limited"] = "0";
+      r["sampled"] = "0";
+      r["expired"] = "0";
+      r["expire_pending"] = "0";
       r["active"] = "-1";
     }
     results.push_back(r);
@@ -180,6 +210,8 @@ QueryData genOsqueryExtensions(QueryContext& context) {
 
   ExtensionList extensions;
   if (getExtensions(extensions).ok()) {
+    // The core's metrics are the calls served by its extension manager.
+    auto metrics = getExtensionRouteMetrics();
     for (const auto& extension : extensions) {
       Row r;
       r["uuid"] = SQL_TEXT(extension.first);
@@ -188,6 +220,13 @@ QueryData genOsqueryExtensions(QueryContext& context) {
       r["sdk_version"] = extension.second.sdk_version;
       r["path"] = getExtensionSocket(extension.first);
       r["type"] = (extension.first == 0) ? "core" : "extension";
+
+      const auto& route = metrics[extension.first];
+      r["calls"] = BIGINT(route.calls);
+      r["active_calls"] = INTEGER(route.active);
+      r["queued_calls"] = INTEGER(route.queued);
+      r["queue_latency"] = BIGINT(route.wait);
+      r["max_queue_latency"] = BIGINT(route.max_wait);
       results.push_back(r);
     }
   }
@@ -229,6 +268,35 @@ QueryData genOsqueryInfo(QueryContext& context) {
     r["watcher"] = "-1";
   }
 
+  // The watcher records a window of the worker's utilization.
+  std::vector<WorkerUtilization> samples;
+  auto stats = WorkerStats::get();
+  if (Initializer::isWorker() && stats != nullptr) {
+    stats->samples(samples);
+  }
+  std::vector<std::string> utilization;
+  std::vector<std::string> memory;
+  for (const auto& sample : samples) {
+    utilization.push_back(std::to_string(sample.utilization));
+    memory.push_back(std::to_string(sample.footprint));
+  }
+  r["utilization_history"] = osquery::join(utilization, ",");
+  r["memory_history"] = osquery::join(memory, ",");
+
+  auto sql_memory = SQLiteDBManager::memoryStats();
+  r["sql_memory"] = BIGINT(sql_memory.used);
+  r["sql_memory_peak"] = BIGINT(sql_memory.peak);
+  r["sql_arena"] = BIGINT(sql_memory.arena);
+  r["sql_arena_recycled"] = BIGINT(sql_memory.recycled);
+
+  std::vector<std::string> timings;
+  for (const auto& timing : Initializer::getStartupTimings()) {
+    timings.push_back(timing.first + "=" + std::to_string(timing.second));
+  }
+  r["startup_timings"] = osquery::join(timings, ",");
+  r["recovery_gap"] = BIGINT(
+      (Initializer::isWorker() && stats != nullptr) ? stats->recoveryGap() : 0);
+
   std::string uuid;
   r["uuid"] = (getHostUUID(uuid)) ? uuid : "";
 
@@ -256,6 +324,14 @@ QueryData genOsquerySchedule(QueryContext& context) {
         r["system_time"] = "0";
         r["average_memory"] = "0";
         r["last_executed"] = "0";
+        r["drift"] = "0";
+        r["rows"] = "0";
+        r["truncated"] = "0";
+        for (const auto& measure : {"wall_time", "rows", "output_size"}) {
+          for (const auto& percentile : {"_p50", "_p95", "_p99"}) {
+            r[std::string(measure) + percentile] = "0";
+          }
+        }
 
         // Report optional performance information.
         Config::getInstance().getPerformanceStats(
@@ -263,15 +339,172 @@ QueryData genOsquerySchedule(QueryContext& context) {
               r["executions"] = BIGINT(perf.executions);
               r["last_executed"] = BIGINT(perf.last_executed);
               r["output_size"] = BIGINT(perf.output_size);
-              r["wall_time"] = BIGINT(perf.wall_time);
-              r["user_time"] = BIGINT(perf.user_time);
-              r["system_time"] = BIGINT(perf.system_time);
+              // Times are recorded in microseconds.
+              r["wall_time"] = BIGINT(perf.wall_time / 1000000);
+              r["user_time"] = BIGINT(perf.user_time / 1000);
+              r["system_time"] = BIGINT(perf.system_time / 1000);
               r["average_memory"] = BIGINT(perf.average_memory);
+              r["drift"] = BIGINT(perf.drift);
+              r["rows"] = BIGINT(perf.rows);
+              r["truncated"] = BIGINT(perf.truncated);
+
+              // Percentiles of the recent executions.
+              std::vector<uint64_t> wall_time;
+              std::vector<uint64_t> rows;
+              std::vector<uint64_t> output_size;
+              for (const auto& execution : perf.recent) {
+                wall_time.push_back(execution.wall_time / 1000);
+                rows.push_back(execution.rows);
+                output_size.push_back(execution.output_size);
+              }
+              r["wall_time_p50"] = BIGINT(getPercentile(wall_time, 50));
+              r["wall_time_p95"] = BIGINT(getPercentile(wall_time, 95));
+              r["wall_time_p99"] = BIGINT(getPercentile(wall_time, 99));
+              r["rows_p50"] = BIGINT(getPercentile(rows, 50));
+              r["rows_p95"] = BIGINT(getPercentile(rows, 95));
+              r["rows_p99"] = BIGINT(getPercentile(rows, 99));
+              r["output_size_p50"] = BIGINT(getPercentile(output_size, 50));
+              r["output_size_p95"] = BIGINT(getPercentile(output_size, 95));
+              r["output_size_p99"] = BIGINT(getPercentile(output_size, 99));
             });
 
         results.push_back(r);
       });
   return results;
 }
+
+QueryData genOsqueryScheduleTables(QueryContext& context) {
+  QueryData results;
+
+  Config::getInstance().scheduledQueries(
+      [&results](const std::string& name, const ScheduledQuery& query) {
+        Config::getInstance().getPerformanceStats(
+            name, [&results, &name](const QueryPerformance& perf) {
+              for (const auto& table : perf.tables) {
+                Row r;
+                r["name"] = SQL_TEXT(name);
+                r["table_name"] = SQL_TEXT(table.first);
+                r["filters"] = BIGINT(table.second.filters);
+                // Generate times are recorded in microseconds.
+                r["generate_time"] =
+                    BIGINT(table.second.generate_time / 1000);
+                r["rows"] = BIGINT(table.second.rows);
+                results.push_back(r);
+              }
+            });
+      });
+  return results;
+}
+
+QueryData genOsqueryScheduleLoad(QueryContext& context) {
+  QueryData results;
+
+  Config::getInstance().scheduleLoad([&results](const ScheduleLoad& load) {
+    Row r;
+    r["step"] = BIGINT(load.step);
+    r["due"] = INTEGER(load.due);
+    r["executed"] = INTEGER(load.executed);
+    r["deferred"] = INTEGER(load.deferred);
+    // The cost is estimated in microseconds.
+    r["cost"] = BIGINT(load.cost / 1000);
+    results.push_back(r);
+  });
+  return results;
+}
+
+QueryData genOsqueryTableCache(QueryContext& context) {
+  QueryData results;
+
+  for (const auto& plugin : RegistryFactory::get().plugins("table")) {
+    auto table = std::dynamic_pointer_cast<TablePlugin>(plugin.second);
+    if (table == nullptr) {
+      continue;
+    }
+
+    // Only cacheable tables perform lookups.
+    auto stats = table->cacheStats();
+    if (stats.entries == 0 && stats.hits == 0 && stats.misses == 0) {
+      continue;
+    }
+
+    Row r;
+    r["name"] = plugin.first;
+    r["ttl"] = INTEGER(table->cacheTTL());
+    r["entries"] = INTEGER(stats.entries);
+    r["spilled"] = INTEGER(stats.spilled);
+    r["bytes"] = BIGINT(stats.bytes);
+    r["hits"] = BIGINT(stats.hits);
+    r["misses"] = BIGINT(stats.misses);
+    results.push_back(r);
+  }
+  return results;
+}
+
+QueryData genOsqueryMetrics(QueryContext& context) {
+  QueryData results;
+
+  std::vector<MetricSample> samples;
+  Metrics::samples(samples);
+  for (const auto& sample : samples) {
+    Row r;
+    r["name"] = sample.name;
+    r["labels"] = sample.labels;
+    r["type"] = metricTypeName(sample.type);
+    r["value"] = BIGINT(sample.value);
+    if (sample.type == MetricType::HISTOGRAM) {
+      r["sum"] = BIGINT(sample.sum);
+      std::vector<std::string> buckets;
+      for (const auto& bucket : sample.buckets) {
+        buckets.push_back(std::to_string(bucket));
+      }
+      r["buckets"] = osquery::join(buckets, ",");
+    }
+    results.push_back(r);
+  }
+  return results;
+}
+
+QueryData genOsquerySQLConnections(QueryContext& context) {
+  auto stats = SQLiteDBManager::poolStats();
+
+  Row r;
+  r["primary_uses"] = BIGINT(stats.primary);
+  r["contended"] = BIGINT(stats.contended);
+  r["reused"] = BIGINT(stats.reused);
+  r["opened"] = BIGINT(stats.opened);
+  r["idle"] = INTEGER(stats.idle);
+  r["pool_size"] = INTEGER(stats.size);
+  return {r};
+}
+
+QueryData genOsqueryDatabaseStats(QueryContext& context) {
+  QueryData results;
+
+  PluginResponse stats;
+  if (!getDatabaseStats(stats)) {
+    return results;
+  }
+
+  for (auto& domain : stats) {
+    Row r;
+    r["domain"] = domain["domain"];
+    for (const auto& column : {"keys",
+                               "size",
+                               "memtable_bytes",
+                               "pending_compaction_bytes",
+                               "bytes_written",
+                               "compaction_bytes_written",
+                               "stall_micros",
+                               "get_p50",
+                               "get_p99",
+                               "write_p50",
+                               "write_p99",
+                               "evicted"}) {
+      r[column] = domain[column];
+    }
+    results.push_back(r);
+  }
+  return results;
+}
 }
 }
@@ -0,0 +1,99 @@
+#!/usr/bin/env python
+
+#  Copyright (c) 2014-present, Facebook, Inc.
+#  All rights reserved.
+#
+#  This source code is licensed under the BSD-style license found in the
+#  LICENSE file in the root directory of this source tree. An additional grant
+#  of patent rights can be found in the PATENTS file in the same directory.
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+from __future__ import unicode_literals
+
+import csv
+import sys
+
+try:
+    import argparse
+except ImportError:
+    print("Cannot import argparse.")
+    exit(1)
+
+# Suffixes of the aggregate rows written with --benchmark_repetitions.
+AGGREGATES = ("_mean", "_median", "_stddev")
+
+
+def read_results(path):
+    """Read the CPU time of each benchmark in a CSV report.
+
+    A benchmark repeated several times is reported by its median, otherwise
+    by its only row. Rows appended by tools/benchmark.sh, such as executable
+    sizes, are kept as their iteration count.
+    """
+    results = {}
+    medians = {}
+    with open(path) as fh:
+        for row in csv.reader(fh):
+            if len(row) < 4 or row[0] == "name":
+                continue
+            name = row[0].strip('"')
+            try:
+                cpu_time = float(row[3]) if row[3] else float(row[1])
+            except ValueError:
+                # Benchmarks that reported an error have no times.
+                continue
+            if name.endswith("_median"):
+                medians[name[:-len("_median")]] = cpu_time
+            elif not name.endswith(AGGREGATES):
+                results[name] = cpu_time
+    results.update(medians)
+    return results
+
+
+def compare(baseline, current, threshold):
+    """Print the change of each benchmark, return the regressed names."""
+    regressions = []
+    for name in sorted(current):
+        if name not in baseline or baseline[name] == 0:
+            print("  %-60s new" % (name))
+            continue
+        before = baseline[name]
+        after = current[name]
+        change = (after - before) * 100 / before
+        marker = ""
+        if change > threshold:
+            marker = " REGRESSION"
+            regressions.append(name)
+        print("  %-60s %12.0f %12.0f %+7.1f%%%s" % (
+            name, before, after, change, marker))
+    for name in sorted(set(baseline) - set(current)):
+        print("  %-60s removed" % (name))
+    return regressions
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=(
+        "Compare osquery benchmark CSV reports, such as those written by "
+        "tools/benchmark.sh for two versions."
+    ))
+    parser.add_argument("baseline", help="Report of the previous version")
+    parser.add_argument("current", help="Report of the version under test")
+    parser.add_argument(
+        "--threshold", metavar="PERCENT", type=float, default=10,
+        help="Increase in CPU time reported as a regression (default 10)"
+    )
+    parser.add_argument(
+        "--fail", action="store_true", default=False,
+        help="Exit non-0 if any benchmark regressed"
+    )
+    args = parser.parse_args()
+
+    regressions = compare(read_results(args.baseline),
+                          read_results(args.current), args.threshold)
+    if len(regressions) > 0:
+        print("%d benchmarks regressed by more than %.0f%%" % (
+            len(regressions), args.threshold))
+        if args.fail:
+            sys.exit(1)
@@ -0,0 +1,438 @@
+#!/usr/bin/env python
+
+#  Copyright (c) 2014-present, Facebook, Inc.
+#  All rights reserved.
+#
+#  This source code is licensed under the BSD-style license found in the
+#  LICENSE file in the root directory of this source tree. An additional grant
+#  of patent rights can be found in the PATENTS file in the same directory.
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+from __future__ import unicode_literals
+
+import argparse
+import gzip
+import json
+import os
+import random
+import shutil
+import ssl
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+from SocketServer import ThreadingMixIn
+from StringIO import StringIO
+
+try:
+    import psutil
+except ImportError:
+    print("Cannot import psutil.")
+    exit(1)
+
+# Import the testing utils
+TESTS_DIR = os.path.dirname(os.path.realpath(__file__)) + "/../tests/"
+sys.path.append(TESTS_DIR)
+
+import utils
+
+NODE_KEY = "soak_node_key"
+ENROLL_SECRET_PATH = TESTS_DIR + "test_enroll_secret.txt"
+
+# The scheduled query reporting drift, it is not part of the load.
+MONITOR_QUERY = "soak_monitor"
+
+# Metrics read from the --metrics_textfile.
+METRICS = [
+    "logger_buffered_lines",
+    "logger_purged_lines",
+    "schedule_queries_executed",
+    "schedule_queries_skipped",
+    "schedule_queries_timed_out",
+    "tls_endpoint_failures",
+    "watcher_worker_restarts",
+    "worker_memory_degradations",
+]
+
+
+def synthetic_query(rows, churn):
+    """A query over a generated table of rows, churn percent change."""
+    # Each row has a stable ID, a changing subset has random values.
+    return (
+        "WITH RECURSIVE soak(i) AS "
+        "(SELECT 1 UNION ALL SELECT i + 1 FROM soak WHERE i < %d) "
+        "SELECT i AS id, printf('%%032d', i) AS name, "
+        "CASE WHEN abs(random() %% 100) < %d "
+        "THEN hex(randomblob(16)) ELSE i END AS value FROM soak"
+    ) % (rows, churn)
+
+
+def synthetic_config(args):
+    """A config with a pack of synthetic scheduled queries."""
+    queries = {}
+    for i in range(args.queries):
+        queries["soak_%d" % i] = {
+            "query": synthetic_query(args.rows, args.churn),
+            "interval": args.interval,
+        }
+    return {
+        "schedule": {
+            MONITOR_QUERY: {
+                "query": (
+                    "SELECT name, interval, executions, drift, wall_time, "
+                    "average_memory FROM osquery_schedule "
+                    "WHERE name LIKE '%%soak_%%' AND name != '%s'"
+                ) % MONITOR_QUERY,
+                "interval": args.sample,
+                "snapshot": True,
+            },
+        },
+        "packs": {
+            "soak": {"queries": queries},
+        },
+    }
+
+
+class SoakState(object):
+    """The totals reported to the mock TLS endpoint."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.requests = 0
+        self.results = 0
+        self.status = 0
+        self.drift = {}
+        self.executions = {}
+
+
+class SoakHandler(BaseHTTPRequestHandler):
+    def log_message(self, format, *args):
+        pass
+
+    def _reply(self, response):
+        # The configured latency and failures apply to every request.
+        time.sleep(self.server.args.latency / 1000.0)
+        if random.random() * 100 < self.server.args.failures:
+            self.send_response(500)
+            self.end_headers()
+            return
+        self.send_response(200)
+        self.send_header("Content-type", "application/json")
+        self.end_headers()
+        self.wfile.write(json.dumps(response))
+
+    def _read(self):
+        length = int(self.headers.getheader("content-length", 0))
+        body = self.rfile.read(length)
+        if self.headers.getheader("content-encoding", "") == "gzip":
+            body = gzip.GzipFile(fileobj=StringIO(body)).read()
+        return json.loads(body) if len(body) > 0 else {}
+
+    def do_GET(self):
+        self.do_POST()
+
+    def do_POST(self):
+        request = self._read() if self.command == "POST" else {}
+        state = self.server.state
+        with state.lock:
+            state.requests += 1
+        if self.path == "/enroll":
+            self._reply({"node_key": NODE_KEY})
+        elif self.path == "/config":
+            self._reply(self.server.config)
+        elif self.path == "/log":
+            self.log(request)
+            self._reply({})
+        else:
+            self._reply({})
+
+    def log(self, request):
+        state = self.server.state
+        for item in request.get("data", []):
+            if not isinstance(item, dict):
+                item = json.loads(item)
+            with state.lock:
+                if request.get("log_type") != "result":
+                    state.status += 1
+                    continue
+                state.results += 1
+                if item.get("name") != MONITOR_QUERY:
+                    continue
+                for row in item.get("snapshot", []):
+                    state.drift[row["name"]] = int(row.get("drift", 0))
+                    state.executions[row["name"]] = int(
+                        row.get("executions", 0))
+
+
+class SoakServer(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+
+def start_server(args, config, state):
+    httpd = SoakServer(("localhost", args.port), SoakHandler)
+    httpd.args = args
+    httpd.config = config
+    httpd.state = state
+    httpd.socket = ssl.wrap_socket(httpd.socket,
+                                   certfile=TESTS_DIR + "test_server.pem",
+                                   keyfile=TESTS_DIR + "test_server.key",
+                                   server_side=True)
+    thread = threading.Thread(target=httpd.serve_forever)
+    thread.daemon = True
+    thread.start()
+    return httpd
+
+
+def read_metrics(path):
+    """Sum the samples of each metric in a Prometheus text file."""
+    metrics = {}
+    try:
+        with open(path, "r") as fh:
+            for line in fh:
+                if line.startswith("#") or len(line.strip()) == 0:
+                    continue
+                name, value = line.rsplit(" ", 1)
+                name = name.split("{")[0]
+                if name.startswith("osquery_"):
+                    name = name[len("osquery_"):]
+                metrics[name] = metrics.get(name, 0) + float(value)
+    except (IOError, ValueError):
+        pass
+    return metrics
+
+
+def run_daemon(args, work):
+    flags = [
+        "--config_plugin=tls",
+        "--config_tls_endpoint=/config",
+        "--config_refresh=%d" % args.config_refresh,
+        "--logger_plugin=tls",
+        "--logger_tls_endpoint=/log",
+        "--logger_tls_period=%d" % args.logger_period,
+        "--enroll_tls_endpoint=/enroll",
+        "--enroll_secret_path=%s" % ENROLL_SECRET_PATH,
+        "--tls_hostname=localhost:%d" % args.port,
+        "--tls_server_certs=%s" % (TESTS_DIR + "test_server_ca.pem"),
+        "--database_path=%s" % os.path.join(work, "osquery.db"),
+        "--pidfile=%s" % os.path.join(work, "osquery.pid"),
+        "--extensions_socket=%s" % os.path.join(work, "osquery.em"),
+        "--metrics_textfile=%s" % os.path.join(work, "metrics.prom"),
+        "--metrics_textfile_interval=%d" % args.sample,
+        "--disable_extensions",
+        "--force",
+    ] + args.args.split()
+    output = open(os.path.join(work, "osqueryd.log"), "w")
+    return subprocess.Popen([args.osqueryd] + flags,
+                            stdout=output, stderr=output)
+
+
+def sample_worker(proc, last):
+    """Find the watcher's worker, its resident memory and CPU utilization."""
+    try:
+        watcher = psutil.Process(pid=proc.pid)
+        children = watcher.children()
+        pid = children[0].pid if len(children) > 0 else watcher.pid
+        # Utilization is measured since the previous sample of the worker.
+        worker = last if last is not None and last.pid == pid else \
+            psutil.Process(pid=pid)
+        return worker, worker.memory_info().rss, worker.cpu_percent()
+    except (psutil.NoSuchProcess, psutil.AccessDenied):
+        return last, 0, 0
+
+
+def soak(args):
+    config = synthetic_config(args)
+    state = SoakState()
+    httpd = start_server(args, config, state)
+
+    work = tempfile.mkdtemp(prefix="osquery-soak-")
+    proc = run_daemon(args, work)
+    output = open(args.output, "w") if args.output else None
+    columns = ["time", "worker", "rss", "cpu", "results", "max_drift",
+               "restarts"] + METRICS
+    if output is not None:
+        output.write(",".join(columns) + "\n")
+
+    start = time.time()
+    worker = None
+    restarts = 0
+    max_rss = 0
+    max_drift = 0
+    max_backlog = 0
+    try:
+        while time.time() - start < args.duration:
+            time.sleep(args.sample)
+            if proc.poll() is not None:
+                print(utils.red("osqueryd exited: %d" % proc.returncode))
+                break
+
+            last = worker
+            worker, rss, cpu = sample_worker(proc, worker)
+            pid = worker.pid if worker is not None else 0
+            if last is not None and pid != last.pid:
+                # The watchdog stopped or lost the worker.
+                restarts += 1
+                print(utils.yellow("Worker restarted: %d -> %d" % (
+                    last.pid, pid)))
+            max_rss = max(max_rss, rss)
+
+            metrics = read_metrics(os.path.join(work, "metrics.prom"))
+            backlog = metrics.get("logger_buffered_lines", 0)
+            max_backlog = max(max_backlog, backlog)
+            with state.lock:
+                results = state.results
+                drift = max(state.drift.values()) if state.drift else 0
+            max_drift = max(max_drift, drift)
+
+            row = [int(time.time() - start), pid, rss, cpu, results, drift,
+                   restarts] + [metrics.get(name, 0) for name in METRICS]
+            if output is not None:
+                output.write(",".join([str(v) for v in row]) + "\n")
+                output.flush()
+            if args.verbose:
+                print("%6ds rss: %d cpu: %5.1f results: %d drift: %d "
+                      "backlog: %d restarts: %d" % (
+                          row[0], rss, cpu, results, drift, backlog,
+                          restarts))
+    finally:
+        proc.terminate()
+        proc.wait()
+        httpd.shutdown()
+        if output is not None:
+            output.close()
+        if not args.keep:
+            shutil.rmtree(work)
+
+    summary = {
+        "duration": int(time.time() - start),
+        "queries": args.queries,
+        "rows": args.rows,
+        "results": state.results,
+        "requests": state.requests,
+        "max_rss": max_rss,
+        "max_drift": max_drift,
+        "max_backlog": max_backlog,
+        "worker_restarts": restarts,
+    }
+    print(json.dumps(summary, indent=2, sort_keys=True))
+
+    # Report each threshold that was exceeded.
+    failed = False
+    checks = [
+        ("max_rss", args.max_rss * 1024 * 1024),
+        ("max_drift", args.max_drift),
+        ("max_backlog", args.max_backlog),
+        ("worker_restarts", args.max_restarts),
+    ]
+    for name, limit in checks:
+        if limit >= 0 and summary[name] > limit:
+            print(utils.red("FAILED") + " %s: %d > %d" % (
+                name, summary[name], limit))
+            failed = True
+    if proc.returncode not in [0, -15]:
+        failed = True
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=(
+        "Soak osqueryd with a synthetic schedule and a mock TLS endpoint."
+    ))
+    parser.add_argument(
+        "--osqueryd", metavar="PATH", default="./build/%s/osquery/osqueryd" % (
+            utils.platform()),
+        help="Path to the osqueryd binary."
+    )
+    parser.add_argument(
+        "--args", default="",
+        help="Additional osqueryd flags, such as watchdog limits."
+    )
+    parser.add_argument(
+        "--verbose", action="store_true", default=False,
+        help="Print each sample."
+    )
+    parser.add_argument(
+        "--keep", action="store_true", default=False,
+        help="Keep the database and osqueryd output."
+    )
+    parser.add_argument(
+        "--output", metavar="CSV", default=None,
+        help="Write each sample to a CSV file."
+    )
+
+    group = parser.add_argument_group("Load Options:")
+    group.add_argument(
+        "--queries", type=int, default=100,
+        help="Number of synthetic scheduled queries."
+    )
+    group.add_argument(
+        "--rows", type=int, default=1000,
+        help="Rows generated by each synthetic query."
+    )
+    group.add_argument(
+        "--churn", type=int, default=10,
+        help="Percent of rows that change between executions."
+    )
+    group.add_argument(
+        "--interval", type=int, default=60,
+        help="Interval of each synthetic query in seconds."
+    )
+    group.add_argument(
+        "--duration", type=int, default=3600,
+        help="Seconds to run the soak."
+    )
+    group.add_argument(
+        "--sample", type=int, default=10,
+        help="Seconds between samples."
+    )
+
+    group = parser.add_argument_group("Endpoint Options:")
+    group.add_argument(
+        "--port", type=int, default=8443,
+        help="Local TCP port of the mock TLS endpoint."
+    )
+    group.add_argument(
+        "--latency", type=int, default=0,
+        help="Milliseconds the endpoint waits before each reply."
+    )
+    group.add_argument(
+        "--failures", type=int, default=0,
+        help="Percent of requests the endpoint fails."
+    )
+    group.add_argument(
+        "--logger_period", type=int, default=4,
+        help="Seconds between TLS logger requests."
+    )
+    group.add_argument(
+        "--config_refresh", type=int, default=0,
+        help="Seconds between config requests, 0 to request once."
+    )
+
+    group = parser.add_argument_group("Threshold Options (-1 to ignore):")
+    group.add_argument(
+        "--max_rss", type=int, default=-1,
+        help="Maximum worker resident memory in MB."
+    )
+    group.add_argument(
+        "--max_drift", type=int, default=-1,
+        help="Maximum total drift in seconds of a synthetic query."
+    )
+    group.add_argument(
+        "--max_backlog", type=int, default=-1,
+        help="Maximum buffered log lines."
+    )
+    group.add_argument(
+        "--max_restarts", type=int, default=-1,
+        help="Maximum worker restarts."
+    )
+    args = parser.parse_args()
+
+    if not os.path.exists(args.osqueryd):
+        print(utils.red("Cannot find --osqueryd: %s" % args.osqueryd))
+        exit(1)
+    exit(soak(args))
@@ -42,4 +42,14 @@ wc -c $(find $SCRIPT_DIR/../build -name "osqueryd" | xargs) \
   | awk '{print "\"EXECUTABLE_osqueryd_size\","$1",,,,,\""$2"\""}' \
     >>$OUTDIR/$NODE-benchmark.csv
 
+# Keep each version's results, compare with BENCHMARK_BASELINE if it is set.
+# Set BENCHMARK_TABLES and BENCHMARK_TABLE_CONSTRAINTS to select the tables
+# and constraint sets of the TABLE_generate benchmarks.
+VERSION=`git describe --tags HEAD --always`
+cp $OUTDIR/$NODE-benchmark.csv $OUTDIR/$NODE-$VERSION-benchmark.csv
+if [[ ! -z "$BENCHMARK_BASELINE" ]]; then
+  python $SCRIPT_DIR/analysis/compare_benchmarks.py \
+    $BENCHMARK_BASELINE $OUTDIR/$NODE-$VERSION-benchmark.csv
+fi
+
 exit 0
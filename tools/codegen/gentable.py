@@ -33,6 +33,15 @@ TEMPLATES = {}
 # Temporary reserved column names
 RESERVED = ["n", "index"]
 
+# C++ keywords and common macros used as column names, their generated
+# indexes end with "_"
+CPP_RESERVED = [
+    "class", "default", "delete", "new", "operator", "private", "protected",
+    "public", "register", "signed", "template", "union", "unsigned",
+    # Macros defined by common system headers.
+    "major", "max", "min", "minor",
+]
+
 # Set the platform in osquery-language
 PLATFORM = platform()
 
@@ -87,6 +96,7 @@ TABLE_ATTRIBUTES = {
     "cacheable": "CACHEABLE",
     "utility": "UTILITY",
     "kernel_required": "KERNEL_REQUIRED",
+    "boot_cacheable": "BOOT_CACHEABLE",
 }
 
 
@@ -96,6 +106,11 @@ def to_camel_case(snake_case):
     return components[0] + "".join(x.title() for x in components[1:])
 
 
+def to_pascal_case(snake_case):
+    """ convert a snake_case string to PascalCase """
+    return "".join(x.title() for x in snake_case.split('_'))
+
+
 def lightred(msg):
     return "\033[1;31m %s \033[0m" % str(msg)
 
@@ -176,13 +191,19 @@ class TableState(Singleton):
         self.impl = ""
         self.function = ""
         self.class_name = ""
+        self.batch = False
         self.description = ""
         self.attributes = {}
+        self.cardinality = 0
+        self.concurrency = 1
+        self.cache_ttl = 0
+        self.generation = ""
         self.examples = []
         self.aliases = []
         self.fuzz_paths = []
         self.has_options = False
         self.has_column_aliases = False
+        self.spec_path = ""
 
     def columns(self):
         return [i for i in self.schema if isinstance(i, Column)]
@@ -212,6 +233,27 @@ class TableState(Singleton):
             if len(set(all_options).intersection(NON_CACHEABLE)) > 0:
                 print(lightred("Table cannot be marked cacheable: %s" % (path)))
                 exit(1)
+        if "boot_cacheable" in self.attributes:
+            if len(set(all_options).intersection(NON_CACHEABLE)) > 0 or \
+                    "cacheable" in self.attributes:
+                print(lightred(
+                    "Table cannot be marked boot_cacheable: %s" % (path)))
+                exit(1)
+        if self.cache_ttl > 0 and "cacheable" not in self.attributes:
+            print(lightred("Table cache_ttl requires cacheable: %s" % (path)))
+            exit(1)
+        if self.generation != "" and self.class_name != "":
+            print(lightred(
+                "Subscriber tables cannot declare a generation: %s" % (path)))
+            exit(1)
+        if self.batch:
+            if "cacheable" in self.attributes or \
+                    "boot_cacheable" in self.attributes or \
+                    self.class_name != "":
+                print(lightred(
+                    "Batch tables cannot be cacheable or subscribers: %s" % (
+                        path)))
+                exit(1)
         if self.table_name == "" or self.function == "":
             print(lightred("Invalid table spec: %s" % (path)))
             exit(1)
@@ -239,12 +281,20 @@ class TableState(Singleton):
         self.impl_content = jinja2.Template(TEMPLATES[template]).render(
             table_name=self.table_name,
             table_name_cc=to_camel_case(self.table_name),
+            table_name_pc=to_pascal_case(self.table_name),
+            spec_path=self.spec_path,
             schema=self.columns(),
             header=self.header,
             impl=self.impl,
             function=self.function,
             class_name=self.class_name,
+            batch=self.batch,
             attributes=self.attributes,
+            cardinality=self.cardinality,
+            concurrency=self.concurrency,
+            cache_ttl=self.cache_ttl,
+            generation=self.generation,
+            column_costs=[c for c in self.columns() if c.cost > 0],
             examples=self.examples,
             aliases=self.aliases,
             has_options=self.has_options,
@@ -271,12 +321,16 @@ class Column(object):
     documentation generation and reference.
     """
 
-    def __init__(self, name, col_type, description="", aliases=[], **kwargs):
+    def __init__(self, name, col_type, description="", aliases=[], cost=0,
+                 **kwargs):
         self.name = name
         self.type = col_type
         self.description = description
         self.aliases = aliases
+        self.cost = cost
         self.options = kwargs
+        # The name of the column's index in generated column headers.
+        self.identifier = name + "_" if name in CPP_RESERVED else name
 
 
 class ForeignKey(object):
@@ -298,6 +352,10 @@ def table_name(name, aliases=[]):
     table.table_name = name
     table.description = ""
     table.attributes = {}
+    table.cardinality = 0
+    table.concurrency = 1
+    table.cache_ttl = 0
+    table.generation = ""
     table.examples = []
     table.aliases = aliases
 
@@ -335,11 +393,53 @@ def attributes(**kwargs):
         table.attributes[attr] = kwargs[attr]
 
 
+def cardinality(rows):
+    """
+    estimate the number of rows returned by a full scan of the table, this
+    helps SQLite order joins. Columns may also set a relative cost for
+    generating rows through a constraint on the column:
+
+      Column("path", TEXT, "File path", index=True, cost=100)
+    """
+    table.cardinality = rows
+
+
+def concurrency(workers):
+    """
+    allow the table implementation to generate rows for independent
+    constraints using up to this many worker threads, see parallelFor
+    """
+    table.concurrency = workers
+
+
+def cache_ttl(seconds):
+    """
+    keep the results of a cacheable table fresh for this many seconds
+    within the schedule, instead of the interval of the generating query
+    """
+    table.cache_ttl = seconds
+
+
+def generation(function):
+    """
+    name a function in the implementation file returning a token that changes
+    whenever the table's content may change, such as the modification times
+    of a package database:
+
+      # the function is "std::string genFooGeneration();"
+      generation("genFooGeneration")
+
+    The scheduler skips a differential query when every table it scanned
+    reports the same tokens as the query's previous execution.
+    """
+    table.generation = function
+
+
 def fuzz_paths(paths):
     table.fuzz_paths = paths
 
 
-def implementation(impl_string):
+def implementation(impl_string, batch=False):
     """
     define the path to the implementation file and the function which
     implements the virtual table. You should use the following format:
@@ -347,6 +447,11 @@ def implementation(impl_string):
       # the path is "osquery/table/implementations/foo.cpp"
       # the function is "QueryData genFoo();"
       implementation("foo@genFoo")
+
+    A table may fill a columnar RowBatch instead of returning QueryData:
+
+      # the function is "void genFoo(RowBatch& batch, QueryContext& context);"
+      implementation("foo@genFoo", batch=True)
     """
     logging.debug("- implementation")
     filename, function = impl_string.split("@")
@@ -360,6 +465,7 @@ def implementation(impl_string):
     table.impl = impl
     table.function = function
     table.class_name = class_name
+    table.batch = batch
 
     '''Check if the table has a subscriber attribute, if so, enforce time.'''
     if "event_subscriber" in table.attributes:
@@ -390,10 +496,12 @@ def main(argc, argv):
         action="store_true")
     parser.add_argument("--foreign", default=False, action="store_true",
         help="Generate a foreign table")
+    parser.add_argument("--columns", default=False, action="store_true",
+        help="Generate a header of column indexes instead of a table plugin")
     parser.add_argument("--templates", default=SCRIPT_DIR + "/templates",
                         help="Path to codegen output .cpp.in templates")
     parser.add_argument("spec_file", help="Path to input .table spec file")
-    parser.add_argument("output", help="Path to output .cpp file")
+    parser.add_argument("output", help="Path to output .cpp or .h file")
     args = parser.parse_args()
 
     if args.debug:
@@ -410,8 +518,13 @@ def main(argc, argv):
         with open(filename, "rU") as file_handle:
             tree = ast.parse(file_handle.read())
             exec(compile(tree, "<string>", "exec"))
+            table.spec_path = filename
             blacklisted = is_blacklisted(table.table_name, path=filename)
-            if not args.disable_blacklist and blacklisted:
+            if args.columns:
+                # Blacklisted tables keep their columns, the code using them
+                # is still compiled.
+                table.generate(output, template="columns")
+            elif not args.disable_blacklist and blacklisted:
                 table.blacklist(output)
             else:
                 template_type = "default" if not args.foreign else "foreign"